@@ -18,118 +18,323 @@
 /*
  * Copyright (C) 2016 ScyllaDB
  */
+
+// An I/O scheduler benchmark: runs a workload of I/O classes, each with its
+// shares, request size, read/write mix, concurrency, rate and active
+// period, against a file on a real disk or against a simulated device, and
+// reports the bandwidth each class got, its share of the total, and its
+// latency percentiles.
+//
+// Classes are given with --class, or one per line of a --workload file,
+// as comma separated key=value pairs, e.g.
+//
+//     name=query,shares=100,reqsize=4096,parallelism=16
+//     name=compaction,shares=10,reqsize=131072,reads=0.5,parallelism=4,start=5
+//
+// Keys (all optional):
+//     name         name of the class (default: class<n>)
+//     shares       I/O shares (default: 10)
+//     reqsize      request size, in bytes, a multiple of 4096 (default: 4096)
+//     parallelism  requests in flight per shard (default: 10)
+//     rate         requests started per second per shard, or 0 to issue the
+//                  next one as soon as one completes (default: 0)
+//     reads        fraction of the requests that are reads (default: 1)
+//     start        seconds into the run the class starts (default: 0)
+//     duration     seconds the class runs for, or 0 for the rest of the
+//                  run (default: 0)
+//     bandwidth    bytes/s limit of the class, on a real disk (default: none)
+//     iops         requests/s limit of the class, on a real disk (default: none)
+//
+// With --simulate, every shard has a simulated device instead: a fair
+// queue in front of --sim-capacity channels, each of which serves a request
+// in --sim-latency plus its transfer time at its part of --sim-bandwidth;
+// writes take --sim-write-cost times longer. Class limits only apply to
+// real disks, which go through the reactor's I/O queues.
+
 #include "core/app-template.hh"
 #include "core/distributed.hh"
 #include "core/reactor.hh"
+#include "core/fair_queue.hh"
 #include "core/future.hh"
+#include "core/future-util.hh"
+#include "core/hdr_histogram.hh"
 #include "core/shared_ptr.hh"
 #include "core/file.hh"
 #include "core/sleep.hh"
 #include "core/align.hh"
+#include "core/print.hh"
 #include "core/timer.hh"
 #include <chrono>
+#include <fstream>
 #include <boost/range/irange.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
 #include <iomanip>
 #include <random>
 
 using namespace seastar;
 using namespace std::chrono_literals;
 
-static auto random_seed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-static std::default_random_engine random_generator(random_seed);
+using clock_type = std::chrono::steady_clock;
+using fseconds = std::chrono::duration<double>;
 
-class context {
-    struct class_data {
-        static int idgen();
+struct class_spec {
+    sstring name;
+    uint32_t shares = 10;
+    size_t reqsize = 4096;
+    unsigned parallelism = 10;
+    double rate = 0;
+    double reads = 1;
+    double start = 0;
+    double duration = 0;
+    uint64_t bandwidth = 0;
+    uint64_t iops = 0;
+};
 
-        uint32_t _shares;
-        io_priority_class _iop;
-        unsigned _final = 0;
+static class_spec parse_class_spec(const std::string& text, unsigned idx) {
+    class_spec spec;
+    spec.name = sprint("class%d", idx);
+    std::vector<std::string> pairs;
+    boost::split(pairs, text, boost::is_any_of(","));
+    for (auto& pair : pairs) {
+        boost::trim(pair);
+        if (pair.empty()) {
+            continue;
+        }
+        auto eq = pair.find('=');
+        if (eq == std::string::npos) {
+            throw std::invalid_argument(sprint("bad class parameter \"%s\": expected key=value", pair));
+        }
+        auto key = pair.substr(0, eq);
+        auto value = pair.substr(eq + 1);
+        try {
+            if (key == "name") {
+                spec.name = value;
+            } else if (key == "shares") {
+                spec.shares = boost::lexical_cast<uint32_t>(value);
+            } else if (key == "reqsize") {
+                spec.reqsize = boost::lexical_cast<size_t>(value);
+            } else if (key == "parallelism") {
+                spec.parallelism = boost::lexical_cast<unsigned>(value);
+            } else if (key == "rate") {
+                spec.rate = boost::lexical_cast<double>(value);
+            } else if (key == "reads") {
+                spec.reads = boost::lexical_cast<double>(value);
+            } else if (key == "start") {
+                spec.start = boost::lexical_cast<double>(value);
+            } else if (key == "duration") {
+                spec.duration = boost::lexical_cast<double>(value);
+            } else if (key == "bandwidth") {
+                spec.bandwidth = boost::lexical_cast<uint64_t>(value);
+            } else if (key == "iops") {
+                spec.iops = boost::lexical_cast<uint64_t>(value);
+            } else {
+                throw std::invalid_argument(sprint("unknown class parameter \"%s\"", key));
+            }
+        } catch (boost::bad_lexical_cast&) {
+            throw std::invalid_argument(sprint("bad value for class parameter \"%s\": %s", key, value));
+        }
+    }
+    if (!spec.shares || !spec.parallelism || !spec.reqsize || spec.reqsize % 4096
+            || spec.reads < 0 || spec.reads > 1 || spec.rate < 0 || spec.start < 0 || spec.duration < 0) {
+        throw std::invalid_argument(sprint("bad parameters for class %s", spec.name));
+    }
+    return spec;
+}
 
-        size_t _bytes = 0;
-        std::chrono::steady_clock::time_point _start = {};
+struct sim_config {
+    unsigned capacity;
+    std::chrono::microseconds latency;
+    double bandwidth; // bytes per second
+    double write_cost;
+};
+
+static hdr_histogram make_latency_histogram() {
+    // microseconds, up to over a day
+    return hdr_histogram(7, uint64_t(1) << 36);
+}
 
-        class_data(uint32_t shares)
-            : _shares(shares)
-            , _iop(engine().register_one_priority_class(sprint("test-class-%d", idgen()), shares))
+// What a class achieved on a shard, or on all of them once added up
+struct class_result {
+    uint64_t ops = 0;
+    uint64_t bytes = 0;
+    fseconds active = fseconds(0);
+    hdr_histogram latency = make_latency_histogram();
+    class_result& operator+=(const class_result& r) {
+        ops += r.ops;
+        bytes += r.bytes;
+        active = std::max(active, r.active);
+        latency += r.latency;
+        return *this;
+    }
+};
+
+class context {
+    struct class_data {
+        class_spec spec;
+        io_priority_class iop;
+        priority_class_ptr sim_pc; // with --simulate
+        class_result result;
+        clock_type::time_point stop;
+        clock_type::time_point next_arrival;
+        std::bernoulli_distribution is_read;
+        std::uniform_int_distribution<uint64_t> pos_distribution;
+        class_data(class_spec s, io_priority_class iop, uint64_t file_size)
+            : spec(std::move(s))
+            , iop(iop)
+            , is_read(spec.reads)
+            , pos_distribution(0, file_size / spec.reqsize - 1)
         {}
     };
     std::vector<class_data> _cl;
-
-    sstring _dir;
-    unsigned _parallelism;
-    std::chrono::seconds _duration;
-    size_t _reqsize;
-
-    semaphore _finished;
-    file _fq;
-    std::uniform_int_distribution<uint32_t> _pos_distribution;
+    std::chrono::duration<double> _duration;
+    std::experimental::optional<sim_config> _sim;
+    std::unique_ptr<fair_queue> _sim_fq;
+    file _f;
+    std::default_random_engine _random;
 public:
-    context(sstring dir, std::vector<uint32_t> shares, unsigned parallelism, unsigned duration, size_t reqsize)
-            : _cl(shares.begin(), shares.end())
-            , _dir(dir)
-            , _parallelism(parallelism)
-            , _duration(duration)
-            , _reqsize(align_up(reqsize, 4096ul))
-            , _finished(0)
-            , _pos_distribution(0, parallelism * shares.size() - 1)
+    context(std::vector<class_spec> specs, std::vector<io_priority_class> iops, double duration, uint64_t file_size,
+            std::experimental::optional<sim_config> sim, unsigned seed)
+            : _duration(duration)
+            , _sim(sim)
+            , _random(seed + engine().cpu_id())
     {
+        for (unsigned i = 0; i < specs.size(); ++i) {
+            _cl.emplace_back(std::move(specs[i]), iops[i], file_size);
+        }
+        if (_sim) {
+            _sim_fq = std::make_unique<fair_queue>(_sim->capacity);
+            for (auto& cl : _cl) {
+                cl.sim_pc = _sim_fq->register_priority_class(cl.spec.shares);
+            }
+        }
     }
 
-    future<> stop() { return make_ready_future<>(); }
-    future<> start(sstring name) {
-        return open_file_dma(name, open_flags::ro).then([this] (auto f) {
-            _fq = f;
-        });
+    future<> stop() {
+        return _f ? _f.close() : make_ready_future<>();
     }
 
-    future<> read_class(class_data& cl) {
-        auto bufptr = allocate_aligned_buffer<char>(_reqsize, 4096);
-        auto buf = bufptr.get();
-        auto pos = _pos_distribution(random_generator) * _reqsize;
-        return _fq.dma_read(pos, buf, _reqsize, cl._iop).then([bufptr = std::move(bufptr), &cl, this] (size_t size) {
-            cl._bytes += size;
-            if ((std::chrono::steady_clock::now() - cl._start) < _duration) {
-                return this->read_class(cl);
-            } else {
-                return make_ready_future<>();
-            }
+    future<> start(sstring name) {
+        if (_sim) {
+            return make_ready_future<>();
+        }
+        return open_file_dma(name, open_flags::rw).then([this] (file f) {
+            _f = std::move(f);
         });
     }
 
-    future<> issue_reads() {
-        return parallel_for_each(_cl.begin(), _cl.end(), [this] (class_data& cl) {
-            auto parallelism = boost::irange(0u, _parallelism);
-            cl._start = std::chrono::steady_clock::now();
-            return parallel_for_each(parallelism.begin(), parallelism.end(), [this, &cl] (auto dummy) {
-                return this->read_class(cl);
-            }).then([&cl, this] {
-                auto duration = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - cl._start).count();
-                cl._final = (cl._bytes / duration) >> 10;
-                _finished.signal(1);
+    future<> run() {
+        auto begin = clock_type::now();
+        return parallel_for_each(_cl, [this, begin] (class_data& cl) {
+            auto start = begin + std::chrono::duration_cast<clock_type::duration>(fseconds(cl.spec.start));
+            auto length = cl.spec.duration ? fseconds(cl.spec.duration) : _duration - fseconds(cl.spec.start);
+            cl.stop = start + std::chrono::duration_cast<clock_type::duration>(length);
+            return sleep(start - clock_type::now()).then([this, &cl, start] {
+                cl.next_arrival = clock_type::now();
+                return parallel_for_each(boost::irange(0u, cl.spec.parallelism), [this, &cl] (unsigned) {
+                    return issue_requests(cl);
+                }).then([&cl, start] {
+                    cl.result.active = clock_type::now() - start;
+                });
             });
         });
     }
 
-    future<> print_stats() {
-        return _finished.wait(_cl.size()).then([this] {
-            std::stringstream ss;
-            ss << "Shard " << std::setw(2) << engine().cpu_id() << ":";
-            auto idx = 0;
-            for (auto& cl: _cl) {
-                ss << " Class " << idx++ << "(" << std::setw(2) << cl._shares << " shares): " << std::setw(8) << cl._final << " KB/s";
+    std::vector<class_result> results() const {
+        std::vector<class_result> ret;
+        for (auto& cl : _cl) {
+            ret.push_back(cl.result);
+        }
+        return ret;
+    }
+
+private:
+    future<> issue_requests(class_data& cl) {
+        return do_until([&cl] { return clock_type::now() >= cl.stop; }, [this, &cl] {
+            // with a rate, requests are due at fixed intervals, and their
+            // latency counts from then, so that a stalled class is not
+            // flattered by having issued fewer requests
+            auto due = clock_type::now();
+            auto wait = make_ready_future<>();
+            if (cl.spec.rate) {
+                due = cl.next_arrival;
+                cl.next_arrival += std::chrono::duration_cast<clock_type::duration>(fseconds(1 / cl.spec.rate));
+                if (due >= cl.stop) {
+                    return sleep(cl.stop - clock_type::now());
+                }
+                wait = sleep(due - clock_type::now());
             }
-            ss << std::endl;
-            std::cout << ss.str();
-            return make_ready_future<>();
+            return wait.then([this, &cl] {
+                return do_request(cl, cl.is_read(_random), cl.pos_distribution(_random) * cl.spec.reqsize);
+            }).then([&cl, due] {
+                auto latency = std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - due);
+                cl.result.latency.record(latency.count());
+                cl.result.ops++;
+                cl.result.bytes += cl.spec.reqsize;
+            });
         });
     }
+
+    future<> do_request(class_data& cl, bool read, uint64_t pos) {
+        if (_sim) {
+            fair_queue_request_descriptor desc;
+            desc.weight = read ? 1 : std::max(1u, unsigned(_sim->write_cost));
+            desc.size = cl.spec.reqsize;
+            auto service = fseconds(cl.spec.reqsize * _sim->capacity / _sim->bandwidth) * (read ? 1 : _sim->write_cost);
+            auto duration = _sim->latency + std::chrono::duration_cast<std::chrono::microseconds>(service);
+            return _sim_fq->queue(cl.sim_pc, desc, [duration] {
+                return sleep(duration);
+            });
+        }
+        auto bufptr = allocate_aligned_buffer<char>(cl.spec.reqsize, 4096);
+        auto buf = bufptr.get();
+        auto done = [bufptr = std::move(bufptr)] (size_t) {};
+        if (read) {
+            return _f.dma_read(pos, buf, cl.spec.reqsize, cl.iop).then(std::move(done));
+        }
+        return _f.dma_write(pos, buf, cl.spec.reqsize, cl.iop).then(std::move(done));
+    }
 };
 
-int context::class_data::idgen() {
-    static thread_local int id = 0;
-    return id++;
+static void print_results(const std::vector<class_spec>& specs, const std::vector<class_result>& results, bool json) {
+    uint32_t total_shares = 0;
+    double total_bandwidth = 0;
+    for (unsigned i = 0; i < specs.size(); ++i) {
+        total_shares += specs[i].shares;
+        if (results[i].active.count() > 0) {
+            total_bandwidth += results[i].bytes / results[i].active.count();
+        }
+    }
+    if (json) {
+        print("{\"shards\": %d, \"classes\": [", smp::count);
+    } else {
+        print("%-16s %8s %12s %10s %8s %8s %10s %10s %10s %10s %10s\n", "class", "shares", "KB/s", "IOPS",
+                "share", "expected", "p50 us", "p95 us", "p99 us", "p999 us", "max us");
+    }
+    for (unsigned i = 0; i < specs.size(); ++i) {
+        auto& s = specs[i];
+        auto& r = results[i];
+        auto secs = r.active.count();
+        auto bandwidth = secs > 0 ? r.bytes / secs : 0;
+        auto iops = secs > 0 ? r.ops / secs : 0;
+        auto share = total_bandwidth > 0 ? bandwidth / total_bandwidth : 0;
+        auto expected = double(s.shares) / total_shares;
+        auto& l = r.latency;
+        if (json) {
+            print("%s{\"name\": \"%s\", \"shares\": %d, \"reqsize\": %d, \"ops\": %d, \"bytes\": %d, \"seconds\": %.3f, "
+                    "\"bandwidth\": %.0f, \"iops\": %.1f, \"bandwidth_share\": %.4f, \"expected_share\": %.4f, "
+                    "\"latency_us\": {\"mean\": %.1f, \"p50\": %d, \"p95\": %d, \"p99\": %d, \"p999\": %d, \"max\": %d}}",
+                    i ? ", " : "", s.name, s.shares, s.reqsize, r.ops, r.bytes, secs,
+                    bandwidth, iops, share, expected,
+                    l.mean(), l.percentile(50), l.percentile(95), l.percentile(99), l.percentile(99.9), l.max());
+        } else {
+            print("%-16s %8d %12.0f %10.0f %8.3f %8.3f %10d %10d %10d %10d %10d\n", s.name, s.shares, bandwidth / 1024, iops,
+                    share, expected, l.percentile(50), l.percentile(95), l.percentile(99), l.percentile(99.9), l.max());
+        }
+    }
+    if (json) {
+        print("]}\n");
+    }
 }
 
 int main(int ac, char** av) {
@@ -139,58 +344,126 @@ int main(int ac, char** av) {
     auto opt_add = app.add_options();
     opt_add
         ("directory", bpo::value<sstring>()->default_value("."), "directory where to execute the test")
-        ("parallelism", bpo::value<unsigned>()->default_value(10), "number of parallel requests per class")
-        ("duration", bpo::value<unsigned>()->default_value(10), "for how long (in seconds) to run the test")
-        ("reqsize", bpo::value<size_t>()->default_value(4096), "size of each read request")
-        ("shares", bpo::value<sstring>()->default_value("10,10"), "comma-separated list of shares per each class (default: 10,10)")
+        ("duration", bpo::value<double>()->default_value(10), "for how long (in seconds) to run the test")
+        ("class", bpo::value<std::vector<std::string>>()->composing(), "an I/O class, as key=value pairs (see the source for the keys); may be repeated")
+        ("workload", bpo::value<sstring>(), "a file with one --class per line; # starts a comment")
+        ("file-size", bpo::value<uint64_t>()->default_value(256 << 20), "size of the file requests go to")
+        ("seed", bpo::value<unsigned>()->default_value(0), "seed of the request positions and read/write mix")
+        ("format", bpo::value<sstring>()->default_value("text"), "output format: text or json")
+        ("simulate", "run against a simulated device rather than a file")
+        ("sim-capacity", bpo::value<unsigned>()->default_value(32), "requests the simulated device serves at once")
+        ("sim-latency", bpo::value<unsigned>()->default_value(100), "latency of the simulated device, in microseconds")
+        ("sim-bandwidth", bpo::value<double>()->default_value(1e9), "bandwidth of the simulated device, in bytes/s")
+        ("sim-write-cost", bpo::value<double>()->default_value(2), "how much longer writes take than reads on the simulated device")
     ;
 
-
     distributed<context> ctx;
     return app.run(ac, av, [&] {
         auto& opts = app.configuration();
-        auto& directory = opts["directory"].as<sstring>();
-        return file_system_at(directory).then([directory] (auto fs) {
-            if (fs != fs_type::xfs) {
-                throw std::runtime_error(sprint("This is a performance test. %s is not on XFS", directory));
+        std::vector<std::string> lines;
+        if (opts.count("class")) {
+            lines = opts["class"].as<std::vector<std::string>>();
+        }
+        if (opts.count("workload")) {
+            std::ifstream in(opts["workload"].as<sstring>());
+            if (!in) {
+                throw std::runtime_error(sprint("cannot read %s", opts["workload"].as<sstring>()));
             }
-        }).then([&] {
-            auto& parallelism = opts["parallelism"].as<unsigned>();
-            auto& share_list = opts["shares"].as<sstring>();
-            auto& duration = opts["duration"].as<unsigned>();
-            auto& reqsize = opts["reqsize"].as<size_t>();
-
-            std::vector<sstring> strs;
-            boost::split(strs, share_list, boost::is_any_of(","));
-            std::vector<uint32_t> shares(strs.size(), 0);
-            std::transform(strs.begin(), strs.end(), shares.begin(), [] (sstring s) { return boost::lexical_cast<uint32_t>(s); });
-
-            // Create the file, it is the same file so do it from one shard only.
-            auto name = sprint("%s/test-queue", directory);
-            auto size = reqsize * parallelism * shares.size();
-            return open_file_dma(name, open_flags::rw | open_flags::create | open_flags::truncate).then([name, size] (auto f) {
-                auto bufptr = allocate_aligned_buffer<char>(size, 4096);
-                auto buf = bufptr.get();
-                std::uniform_int_distribution<char> fill('@', '~');
-                memset(buf, fill(random_generator), size);
-                return f.dma_write(0, buf, size).then([size, bufptr = std::move(bufptr), f] (auto s) {
-                    assert(s == size);
-                    return make_ready_future<>();
-                });
-            }).then([directory, shares, parallelism, duration, reqsize, name, &ctx] {
-                return ctx.start(directory, std::move(shares), parallelism, duration, reqsize).then([&ctx, name = std::move(name)] {
-                    engine().at_exit([&ctx] {
-                        return ctx.stop();
+            std::string line;
+            while (std::getline(in, line)) {
+                line = line.substr(0, line.find('#'));
+                boost::trim(line);
+                if (!line.empty()) {
+                    lines.push_back(line);
+                }
+            }
+        }
+        if (lines.empty()) {
+            lines = { "shares=10", "shares=10" };
+        }
+        std::vector<class_spec> specs;
+        for (auto& line : lines) {
+            specs.push_back(parse_class_spec(line, specs.size()));
+        }
+        auto& format = opts["format"].as<sstring>();
+        if (format != "text" && format != "json") {
+            throw std::invalid_argument(sprint("unknown format %s", format));
+        }
+        bool json = format == "json";
+        auto duration = opts["duration"].as<double>();
+        auto seed = opts["seed"].as<unsigned>();
+        auto file_size = opts["file-size"].as<uint64_t>();
+        for (auto& s : specs) {
+            file_size = std::max<uint64_t>(file_size, s.reqsize);
+        }
+        file_size = align_up<uint64_t>(file_size, 1 << 20);
+        std::experimental::optional<sim_config> sim;
+        if (opts.count("simulate")) {
+            sim = sim_config{opts["sim-capacity"].as<unsigned>(), std::chrono::microseconds(opts["sim-latency"].as<unsigned>()),
+                    opts["sim-bandwidth"].as<double>(), opts["sim-write-cost"].as<double>()};
+            if (!sim->capacity || sim->bandwidth <= 0 || sim->write_cost <= 0) {
+                throw std::invalid_argument("bad simulated device parameters");
+            }
+        }
+        // registered once, for all shards, as the I/O queues are shared
+        std::vector<io_priority_class> iops;
+        for (auto& s : specs) {
+            io_priority_class_limits limits;
+            limits.bytes_per_second = s.bandwidth;
+            limits.ops_per_second = s.iops;
+            iops.push_back(engine().register_one_priority_class(sprint("test-%s", s.name), s.shares, limits));
+        }
+        auto& directory = opts["directory"].as<sstring>();
+        auto name = sprint("%s/test-queue", directory);
+        auto prepare = make_ready_future<>();
+        if (!sim) {
+            prepare = file_system_at(directory).then([directory] (auto fs) {
+                if (fs != fs_type::xfs) {
+                    throw std::runtime_error(sprint("This is a performance test. %s is not on XFS", directory));
+                }
+            }).then([name, file_size, seed] {
+                // Create the file, it is the same file so do it from one shard only.
+                return open_file_dma(name, open_flags::rw | open_flags::create | open_flags::truncate).then([file_size, seed] (file f) {
+                    return do_with(std::move(f), uint64_t(0), [file_size, seed] (file& f, uint64_t& pos) {
+                        constexpr size_t chunk = 1 << 20;
+                        auto bufptr = allocate_aligned_buffer<char>(chunk, 4096);
+                        std::default_random_engine random(seed);
+                        std::uniform_int_distribution<char> fill('@', '~');
+                        memset(bufptr.get(), fill(random), chunk);
+                        return do_until([&pos, file_size] { return pos >= file_size; }, [&f, &pos, buf = bufptr.get()] {
+                            return f.dma_write(pos, buf, chunk).then([&pos] (size_t s) {
+                                assert(s == chunk);
+                                pos += chunk;
+                            });
+                        }).then([&f] {
+                            return f.close();
+                        }).finally([bufptr = std::move(bufptr)] {});
                     });
-                    return ctx.invoke_on_all([name = std::move(name)] (auto& c) {
-                        return c.start(name).then([&c] {
-                            return c.issue_reads();
-                        }).then([&c] {
-                            return c.print_stats();
-                        });
-                    }).or_terminate();
                 });
             });
+        }
+        return prepare.then([&ctx, specs, iops, duration, file_size, sim, seed] {
+            return ctx.start(specs, iops, duration, file_size, sim, seed);
+        }).then([&ctx, name, specs, json] {
+            engine().at_exit([&ctx] {
+                return ctx.stop();
+            });
+            return ctx.invoke_on_all([name] (context& c) {
+                return c.start(name).then([&c] {
+                    return c.run();
+                });
+            }).then([&ctx, specs] {
+                return ctx.map_reduce0([] (const context& c) {
+                    return c.results();
+                }, std::vector<class_result>(specs.size()), [] (std::vector<class_result> a, std::vector<class_result> b) {
+                    for (unsigned i = 0; i < a.size(); ++i) {
+                        a[i] += b[i];
+                    }
+                    return a;
+                });
+            }).then([specs, json] (std::vector<class_result> results) {
+                print_results(specs, results, json);
+            }).or_terminate();
         });
     });
 }
@@ -38,6 +38,8 @@
 #include <queue>
 #include <fstream>
 #include <future>
+#include <sstream>
+#include <algorithm>
 #include "core/sstring.hh"
 #include "core/posix.hh"
 #include "core/resource.hh"
@@ -362,6 +364,10 @@ class iotune_manager {
         _async_objs.emplace_back(std::move(task));
     }
 
+    const test_file& file() const {
+        return _test_file;
+    }
+
     void wait_for_threads() {
         std::vector<async_obj> running;
         std::swap(running, _async_objs);
@@ -658,9 +664,7 @@ void test_file::generate(iotune_manager& iotune_manager, std::chrono::seconds ti
               << " seconds" << std::endl;
 }
 
-uint32_t io_queue_discovery(sstring dir, std::vector<unsigned> cpus, std::chrono::seconds timeout) {
-    iotune_manager iotune_manager(cpus.size(), dir, timeout);
-
+uint32_t io_queue_discovery(iotune_manager& iotune_manager, std::vector<unsigned> cpus) {
     do {
         for (auto i = 0ul; i < cpus.size(); ++i) {
             iotune_manager.spawn_new([&iotune_manager, &cpus, id = i] {
@@ -675,19 +679,318 @@ uint32_t io_queue_discovery(sstring dir, std::vector<unsigned> cpus, std::chrono
     return iotune_manager.finish_estimate();
 }
 
+// Device profiling
+//
+// A single queue depth does not describe devices whose behaviour differs
+// between small and large requests, or reads and writes. Once the depth is
+// known, the device is profiled at it: throughput by request size and
+// direction, read latency percentiles by concurrency, and the latency of
+// reads competing with writes. The profile is written as YAML; its top
+// level keys are the --io-device properties of the disk cost model.
+
+struct profile_workload {
+    size_t read_size = 0;
+    unsigned read_concurrency = 0;
+    size_t write_size = 0;
+    unsigned write_concurrency = 0;
+};
+
+// The requests of one direction that completed during a workload's run
+struct direction_result {
+    uint64_t ops = 0;
+    uint64_t bytes = 0;
+    std::vector<uint32_t> latencies_us;
+
+    direction_result& operator+=(const direction_result& x) {
+        ops += x.ops;
+        bytes += x.bytes;
+        latencies_us.insert(latencies_us.end(), x.latencies_us.begin(), x.latencies_us.end());
+        return *this;
+    }
+    uint64_t iops(double seconds) const {
+        return ops / seconds;
+    }
+    uint64_t bandwidth(double seconds) const {
+        return bytes / seconds;
+    }
+    // The latency that a fraction q of the requests completed within
+    uint32_t percentile(double q) {
+        if (latencies_us.empty()) {
+            return 0;
+        }
+        auto nth = latencies_us.begin() + std::min<size_t>(q * latencies_us.size(), latencies_us.size() - 1);
+        std::nth_element(latencies_us.begin(), nth, latencies_us.end());
+        return *nth;
+    }
+};
+
+struct workload_result {
+    direction_result reads;
+    direction_result writes;
+    double seconds = 0;
+};
+
+class device_profiler {
+    const test_file& _file;
+    uint64_t _file_size;
+    std::vector<unsigned> _cpus;
+    iotune_manager::clock::duration _run_time;
+    std::mutex _result_mutex;
+private:
+    // This thread's part of a workload's concurrency
+    unsigned share(unsigned concurrency, size_t thread) const {
+        return concurrency / _cpus.size() + (thread < concurrency % _cpus.size());
+    }
+    void run_thread(size_t thread, const profile_workload& w, iotune_manager::clock::time_point start, workload_result& result);
+public:
+    device_profiler(const test_file& file, uint64_t file_size, std::vector<unsigned> cpus, iotune_manager::clock::duration run_time)
+        : _file(file), _file_size(file_size), _cpus(std::move(cpus)), _run_time(run_time) {}
+    workload_result run(const profile_workload& w);
+};
+
+workload_result device_profiler::run(const profile_workload& w) {
+    workload_result result;
+    result.seconds = std::chrono::duration_cast<std::chrono::duration<double>>(_run_time).count();
+    // give the threads time to be pinned and set up before they start
+    auto start = iotune_manager::clock::now() + 100ms;
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(_cpus.size());
+    for (auto i = 0ul; i < _cpus.size(); ++i) {
+        threads.emplace_back([this, i, &w, start, &result, &errors] {
+            try {
+                pin_this_thread(_cpus[i]);
+                run_thread(i, w, start, result);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    for (auto&& t : threads) {
+        t.join();
+    }
+    for (auto&& ex : errors) {
+        if (ex) {
+            std::rethrow_exception(ex);
+        }
+    }
+    return result;
+}
+
+void device_profiler::run_thread(size_t thread, const profile_workload& w, iotune_manager::clock::time_point start, workload_result& result) {
+    struct request {
+        iocb cb;
+        bool write;
+        size_t size;
+        std::unique_ptr<char[], free_deleter> buf;
+        iotune_manager::clock::time_point issued;
+    };
+    auto read_concurrency = share(w.read_concurrency, thread);
+    auto write_concurrency = share(w.write_concurrency, thread);
+    if (!read_concurrency && !write_concurrency) {
+        return;
+    }
+    std::vector<request> requests(read_concurrency + write_concurrency);
+    for (auto i = 0u; i < requests.size(); ++i) {
+        auto& rq = requests[i];
+        rq.write = i >= read_concurrency;
+        rq.size = rq.write ? w.write_size : w.read_size;
+        rq.buf = allocate_aligned_buffer<char>(rq.size, 4096);
+        memset(rq.buf.get(), 0, rq.size);
+    }
+
+    io_context_t io_context = {0};
+    auto r = ::io_setup(requests.size(), &io_context);
+    throw_kernel_error(r);
+    auto destroyer = defer([&io_context] { ::io_destroy(io_context); });
+
+    auto issue = [this] (request& rq) {
+        std::uniform_int_distribution<uint64_t> pos_distribution(0, _file_size / rq.size - 1);
+        auto pos = pos_distribution(random_generator) * rq.size;
+        if (rq.write) {
+            io_prep_pwrite(&rq.cb, _file.file.get(), rq.buf.get(), rq.size, pos);
+        } else {
+            io_prep_pread(&rq.cb, _file.file.get(), rq.buf.get(), rq.size, pos);
+        }
+        rq.cb.data = &rq;
+        rq.issued = iotune_manager::clock::now();
+        return &rq.cb;
+    };
+
+    workload_result mine;
+    std::vector<iocb*> iocb_vecptr;
+    std::vector<io_event> ev(requests.size());
+    while (iotune_manager::clock::now() < start);
+    auto end = start + _run_time;
+    for (auto&& rq : requests) {
+        iocb_vecptr.push_back(issue(rq));
+    }
+    r = ::io_submit(io_context, iocb_vecptr.size(), iocb_vecptr.data());
+    throw_kernel_error(r);
+
+    auto outstanding = requests.size();
+    struct timespec timeout = {0, 0};
+    while (outstanding) {
+        int n = ::io_getevents(io_context, 1, ev.size(), ev.data(), &timeout);
+        throw_kernel_error(n);
+        auto now = iotune_manager::clock::now();
+        iocb_vecptr.clear();
+        for (auto i = 0ul; i < size_t(n); ++i) {
+            auto& rq = *reinterpret_cast<request*>(ev[i].data);
+            sanity_check_ev(ev[i], rq.size);
+            if (now >= end) {
+                --outstanding;
+                continue;
+            }
+            auto& d = rq.write ? mine.writes : mine.reads;
+            ++d.ops;
+            d.bytes += rq.size;
+            d.latencies_us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(now - rq.issued).count());
+            iocb_vecptr.push_back(issue(rq));
+        }
+        if (!iocb_vecptr.empty()) {
+            r = ::io_submit(io_context, iocb_vecptr.size(), iocb_vecptr.data());
+            throw_kernel_error(r);
+        }
+    }
+    std::lock_guard<std::mutex> guard(_result_mutex);
+    result.reads += mine.reads;
+    result.writes += mine.writes;
+}
+
+// Profiles the device at the given queue depth, and returns the profile as YAML
+std::string profile_device(device_profiler& profiler, sstring dir, unsigned iodepth) {
+    static constexpr size_t small_request = 4096;
+    static constexpr size_t large_request = 128 << 10;
+    std::ostringstream throughput, latency, mixed;
+    uint64_t read_iops = 0, write_iops = 0, read_bandwidth = 0, write_bandwidth = 0;
+
+    std::cout << "Profiling throughput by request size" << std::endl;
+    throughput << "throughput:\n";
+    for (size_t size : { 4ul << 10, 16ul << 10, 64ul << 10, 128ul << 10 }) {
+        profile_workload rw;
+        rw.read_size = size;
+        rw.read_concurrency = iodepth;
+        auto reads = profiler.run(rw);
+        profile_workload ww;
+        ww.write_size = size;
+        ww.write_concurrency = iodepth;
+        auto writes = profiler.run(ww);
+        auto riops = reads.reads.iops(reads.seconds);
+        auto wiops = writes.writes.iops(writes.seconds);
+        auto rbw = reads.reads.bandwidth(reads.seconds);
+        auto wbw = writes.writes.bandwidth(writes.seconds);
+        std::cout << "  " << size / 1024 << "kB: " << riops << " read IOPS, " << wiops << " write IOPS" << std::endl;
+        throughput << "  - request-size: " << size << "\n"
+                   << "    concurrency: " << iodepth << "\n"
+                   << "    read-iops: " << riops << "\n"
+                   << "    read-bandwidth: " << rbw << "\n"
+                   << "    write-iops: " << wiops << "\n"
+                   << "    write-bandwidth: " << wbw << "\n";
+        if (size == small_request) {
+            read_iops = riops;
+            write_iops = wiops;
+        } else if (size == large_request) {
+            read_bandwidth = rbw;
+            write_bandwidth = wbw;
+        }
+    }
+
+    std::cout << "Profiling read latency by concurrency" << std::endl;
+    latency << "read-latency:\n"
+            << "  request-size: " << small_request << "\n"
+            << "  points:\n";
+    for (unsigned concurrency = 1; ; concurrency = std::min(concurrency * 2, iodepth)) {
+        profile_workload w;
+        w.read_size = small_request;
+        w.read_concurrency = concurrency;
+        auto res = profiler.run(w);
+        latency << "    - concurrency: " << concurrency << "\n"
+                << "      iops: " << res.reads.iops(res.seconds) << "\n"
+                << "      p50-us: " << res.reads.percentile(0.5) << "\n"
+                << "      p95-us: " << res.reads.percentile(0.95) << "\n"
+                << "      p99-us: " << res.reads.percentile(0.99) << "\n"
+                << "      p999-us: " << res.reads.percentile(0.999) << "\n";
+        if (concurrency == iodepth) {
+            break;
+        }
+    }
+
+    std::cout << "Profiling reads competing with writes" << std::endl;
+    mixed << "mixed:\n"
+          << "  read-size: " << small_request << "\n"
+          << "  write-size: " << large_request << "\n"
+          << "  points:\n";
+    for (unsigned quarters : { 1, 2, 3 }) {
+        profile_workload w;
+        w.read_size = small_request;
+        w.write_size = large_request;
+        w.write_concurrency = std::max(iodepth * quarters / 4, 1u);
+        w.read_concurrency = std::max(iodepth - w.write_concurrency, 1u);
+        auto res = profiler.run(w);
+        mixed << "    - read-concurrency: " << w.read_concurrency << "\n"
+              << "      write-concurrency: " << w.write_concurrency << "\n"
+              << "      read-iops: " << res.reads.iops(res.seconds) << "\n"
+              << "      read-p50-us: " << res.reads.percentile(0.5) << "\n"
+              << "      read-p99-us: " << res.reads.percentile(0.99) << "\n"
+              << "      write-bandwidth: " << res.writes.bandwidth(res.seconds) << "\n"
+              << "      write-p99-us: " << res.writes.percentile(0.99) << "\n";
+    }
+
+    auto io_device = sprint("%s:max-io-requests=%d,read-iops=%d,write-iops=%d,read-bandwidth=%d,write-bandwidth=%d",
+            dir, iodepth, read_iops, write_iops, read_bandwidth, write_bandwidth);
+    std::cout << "Recommended --io-device: " << io_device << std::endl;
+    std::ostringstream out;
+    out << "# I/O profile of the device, measured by iotune\n"
+        << "mountpoint: " << dir << "\n"
+        << "max-io-requests: " << iodepth << "\n"
+        << "read-iops: " << read_iops << "\n"
+        << "write-iops: " << write_iops << "\n"
+        << "read-bandwidth: " << read_bandwidth << "\n"
+        << "write-bandwidth: " << write_bandwidth << "\n"
+        << "io-device: \"" << io_device << "\"\n"
+        << throughput.str() << latency.str() << mixed.str();
+    return out.str();
+}
+
+// Expands a leading ~ and the like of a path given by the user
+static boost::filesystem::path expand_path(const std::string& path) {
+    wordexp_t k;
+    // Since we get the path from the user, it can be anything. So just
+    // rely on posix for that.
+    wordexp(path.c_str(), &k, 0);
+    assert(k.we_wordc == 1);
+    boost::filesystem::path ret(k.we_wordv[0]);
+    wordfree(&k);
+    return ret;
+}
+
+int write_profile_file(std::string profile_file, const std::string& profile) {
+    auto path = expand_path(profile_file);
+    try {
+        boost::filesystem::create_directories(path.parent_path());
+        std::ofstream ofs;
+        ofs.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        ofs.open(path.string(), std::ofstream::trunc);
+        ofs << profile;
+        ofs.close();
+        std::cout << "Written the device profile to " << path.string() << std::endl;
+    } catch (boost::filesystem::filesystem_error &e) {
+        std::cout << e.what() << " when writing the device profile" << std::endl;
+        return 1;
+    } catch (std::ios_base::failure& e) {
+        std::cout << e.what() << " when writing the device profile" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
 int write_configuration_file(std::string conf_file, std::string format, unsigned max_io_requests, std::experimental::optional<unsigned> num_io_queues = {}) {
     std::cout << "Recommended --max-io-requests: " << max_io_requests << std::endl;
     if (num_io_queues) {
         std::cout << "Recommended --num-io-queues: " << *num_io_queues << std::endl;
     }
 
-    wordexp_t k;
-    // Do tilde expansion if needed, but since we get the directory from the user, it
-    // can be anything. So just rely on posix for that.
-    wordexp(conf_file.c_str(), &k, 0);
-    assert(k.we_wordc == 1);
-    boost::filesystem::path conf_path(k.we_wordv[0]);
-    wordfree(&k);
+    auto conf_path = expand_path(conf_file);
 
     auto error_msg = " when writing configuration file. Please add them to your seastar command line";
     try {
@@ -735,6 +1038,9 @@ int main(int ac, char** av) {
         ("format", bpo::value<sstring>()->default_value("seastar"), "Configuration file format (seastar | envfile)")
         ("timeout", bpo::value<uint64_t>()->default_value(60 * 6), "Maximum time to wait for iotune to finish (seconds)")
         ("fs-check", bpo::bool_switch(&fs_check), "perform FS check only")
+        ("profile-file", bpo::value<sstring>(), "also profile the device (throughput by request size, latency by concurrency, "
+                "reads competing with writes), and write the profile to this YAML file")
+        ("profile-run-time", bpo::value<unsigned>()->default_value(2000), "How long to run each of the profile's measurements (milliseconds)")
     ;
 
     bpo::variables_map configuration;
@@ -797,18 +1103,27 @@ int main(int ac, char** av) {
     auto timeout = std::chrono::seconds(configuration["timeout"].as<uint64_t>());
 
     try {
-        auto iodepth = io_queue_discovery(directory, cpuvec, timeout);
+        iotune_manager iotune_manager(cpuvec.size(), directory, timeout);
+        auto iodepth = io_queue_discovery(iotune_manager, cpuvec);
         auto num_io_queues = cpuvec.size();
         if (iodepth / num_io_queues < 4) {
             num_io_queues = iodepth / 4;
         }
 
+        int ret;
         if (num_io_queues != cpuvec.size()) {
             iodepth = (iodepth / num_io_queues) * num_io_queues;
-            return write_configuration_file(conf_file, format, iodepth, num_io_queues);
+            ret = write_configuration_file(conf_file, format, iodepth, num_io_queues);
         } else {
-            return write_configuration_file(conf_file, format, iodepth);
+            ret = write_configuration_file(conf_file, format, iodepth);
+        }
+        if (ret || !configuration.count("profile-file")) {
+            return ret;
         }
+        auto run_time = std::chrono::milliseconds(configuration["profile-run-time"].as<unsigned>());
+        device_profiler profiler(iotune_manager.file(), iotune_manager.file_size, cpuvec, run_time);
+        auto profile = profile_device(profiler, directory, iodepth);
+        return write_profile_file(configuration["profile-file"].as<sstring>(), profile);
     } catch (iotune_timeout_exception &e) {
         // Otherwise we'll coredump on the exception, but this can happen
         std::cerr << "Timed out: " << e.what() << std::endl;
@@ -66,6 +66,8 @@ blob := any+ >start_blob $advance_blob;
 maybe_noreply = (sp "noreply" @{ _noreply = true; })? >{ _noreply = false; };
 maybe_expiration = (sp expiration)? >{ _expiration = 0; };
 version_field = u64 %{ _version = _u64; };
+meta_flag = [^ \r\n]+ >mark %{ _meta_flags.emplace_back(str()); };
+meta_flags = (sp meta_flag)*;
 
 insertion_params = sp key sp flags sp expiration sp size maybe_noreply (crlf @{ fcall blob; } ) crlf;
 set = "set" insertion_params @{ _state = state::cmd_set; };
@@ -79,10 +81,15 @@ flush = "flush_all" maybe_expiration maybe_noreply crlf @{ _state = state::cmd_f
 version = "version" crlf @{ _state = state::cmd_version; };
 stats = "stats" crlf @{ _state = state::cmd_stats; };
 stats_hash = "stats hash" crlf @{ _state = state::cmd_stats_hash; };
+stats_shards = "stats shards" crlf @{ _state = state::cmd_stats_shards; };
 incr = "incr" sp key sp u64 maybe_noreply crlf @{ _state = state::cmd_incr; };
 decr = "decr" sp key sp u64 maybe_noreply crlf @{ _state = state::cmd_decr; };
+meta_noop = "mn" crlf @{ _state = state::cmd_meta_noop; };
+meta_get = "mg" sp key meta_flags crlf @{ _state = state::cmd_meta_get; };
+meta_set = "ms" sp key sp size meta_flags (crlf @{ fcall blob; } ) crlf @{ _state = state::cmd_meta_set; };
+meta_delete = "md" sp key meta_flags crlf @{ _state = state::cmd_meta_delete; };
 main := (add | replace | set | get | gets | delete | flush | version | cas | stats | incr | decr
-    | stats_hash) >eof{ _state = state::eof; };
+    | stats_hash | stats_shards | meta_noop | meta_get | meta_set | meta_delete) >eof{ _state = state::eof; };
 
 prepush {
     prepush();
@@ -111,8 +118,13 @@ public:
         cmd_version,
         cmd_stats,
         cmd_stats_hash,
+        cmd_stats_shards,
         cmd_incr,
         cmd_decr,
+        cmd_meta_noop,
+        cmd_meta_get,
+        cmd_meta_set,
+        cmd_meta_delete,
     };
     state _state;
     uint32_t _u32;
@@ -127,11 +139,14 @@ public:
     sstring _blob;
     bool _noreply;
     std::vector<memcache::item_key> _keys;
+    // of meta commands: a letter, and its token if any
+    std::vector<sstring> _meta_flags;
 public:
     void init() {
         init_base();
         _state = state::error;
         _keys.clear();
+        _meta_flags.clear();
         %% write init;
     }
 
@@ -0,0 +1,206 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <experimental/optional>
+#include "core/byteorder.hh"
+#include "core/future.hh"
+#include "core/sstring.hh"
+#include "core/temporary_buffer.hh"
+#include "apps/memcached/memcached.hh"
+
+namespace memcache {
+
+using namespace seastar;
+
+// The memcached binary protocol, as described in
+// https://github.com/memcached/memcached/wiki/BinaryProtocolRevamped
+
+namespace binary {
+
+static constexpr uint8_t request_magic = 0x80;
+static constexpr uint8_t response_magic = 0x81;
+static constexpr size_t header_size = 24;
+
+enum class opcode : uint8_t {
+    get = 0x00,
+    set = 0x01,
+    add = 0x02,
+    replace = 0x03,
+    del = 0x04,
+    increment = 0x05,
+    decrement = 0x06,
+    quit = 0x07,
+    flush = 0x08,
+    getq = 0x09,
+    noop = 0x0a,
+    version = 0x0b,
+    getk = 0x0c,
+    getkq = 0x0d,
+    stat = 0x10,
+    setq = 0x11,
+    addq = 0x12,
+    replaceq = 0x13,
+    delq = 0x14,
+    incrementq = 0x15,
+    decrementq = 0x16,
+    quitq = 0x17,
+    flushq = 0x18,
+};
+
+enum class status : uint16_t {
+    no_error = 0x0000,
+    key_not_found = 0x0001,
+    key_exists = 0x0002,
+    value_too_large = 0x0003,
+    invalid_arguments = 0x0004,
+    item_not_stored = 0x0005,
+    non_numeric_value = 0x0006,
+    unknown_command = 0x0081,
+    out_of_memory = 0x0082,
+};
+
+// The fields of a request or response header, in host byte order; the
+// last two bytes of the fixed part are the vbucket id in requests and the
+// status in responses
+struct header {
+    uint8_t magic;
+    uint8_t opcode;
+    uint16_t key_length;
+    uint8_t extras_length;
+    uint8_t data_type;
+    uint16_t vbucket_or_status;
+    uint32_t body_length;
+    uint32_t opaque;
+    uint64_t cas;
+
+    static header read(const char* p) {
+        header h;
+        h.magic = p[0];
+        h.opcode = p[1];
+        h.key_length = read_be<uint16_t>(p + 2);
+        h.extras_length = p[4];
+        h.data_type = p[5];
+        h.vbucket_or_status = read_be<uint16_t>(p + 6);
+        h.body_length = read_be<uint32_t>(p + 8);
+        h.opaque = read_be<uint32_t>(p + 12);
+        h.cas = read_be<uint64_t>(p + 16);
+        return h;
+    }
+    void write(char* p) const {
+        p[0] = magic;
+        p[1] = opcode;
+        write_be<uint16_t>(p + 2, key_length);
+        p[4] = extras_length;
+        p[5] = data_type;
+        write_be<uint16_t>(p + 6, vbucket_or_status);
+        write_be<uint32_t>(p + 8, body_length);
+        write_be<uint32_t>(p + 12, opaque);
+        write_be<uint64_t>(p + 16, cas);
+    }
+};
+
+}
+
+// Reads one binary protocol request from an input_stream, with
+// input_stream::consume()
+class memcache_binary_parser {
+public:
+    using unconsumed_remainder = std::experimental::optional<temporary_buffer<char>>;
+    // Bodies larger than that are refused, so that a corrupt length does
+    // not make the connection buffer gigabytes
+    static constexpr uint32_t max_body_length = 32 << 20;
+    enum class state {
+        error,
+        eof,
+        done,
+    };
+    state _state;
+    binary::header _header;
+    sstring _extras;
+    sstring _key;
+    sstring _value;
+private:
+    bool _in_body;
+    sstring _buf; // of what is being read
+    size_t _filled;
+private:
+    void start_reading(size_t size) {
+        _buf = sstring(sstring::initialized_later(), size);
+        _filled = 0;
+    }
+    // Returns whether the header or the body is complete
+    bool fill(temporary_buffer<char>& data) {
+        auto n = std::min(data.size(), _buf.size() - _filled);
+        std::copy_n(data.get(), n, _buf.begin() + _filled);
+        _filled += n;
+        data.trim_front(n);
+        return _filled == _buf.size();
+    }
+    void split_body() {
+        auto extras = _header.extras_length;
+        auto key = _header.key_length;
+        _extras = sstring(_buf.begin(), extras);
+        _key = sstring(_buf.begin() + extras, key);
+        _value = sstring(_buf.begin() + extras + key, _buf.size() - extras - key);
+    }
+public:
+    void init() {
+        _state = state::error;
+        _in_body = false;
+        start_reading(binary::header_size);
+        _extras = {};
+        _key = {};
+        _value = {};
+    }
+    future<unconsumed_remainder> operator()(temporary_buffer<char> data) {
+        if (data.empty()) {
+            // the stream ended; in the middle of a request, it is an error
+            _state = !_in_body && _filled == 0 ? state::eof : state::error;
+            return make_ready_future<unconsumed_remainder>(std::move(data));
+        }
+        if (!_in_body) {
+            if (!fill(data)) {
+                return make_ready_future<unconsumed_remainder>();
+            }
+            _header = binary::header::read(_buf.begin());
+            if (_header.magic != binary::request_magic
+                    || _header.body_length > max_body_length
+                    || size_t(_header.extras_length) + _header.key_length > _header.body_length) {
+                _state = state::error;
+                return make_ready_future<unconsumed_remainder>(std::move(data));
+            }
+            _in_body = true;
+            start_reading(_header.body_length);
+        }
+        if (!fill(data)) {
+            return make_ready_future<unconsumed_remainder>();
+        }
+        split_body();
+        _state = state::done;
+        return make_ready_future<unconsumed_remainder>(std::move(data));
+    }
+    bool eof() const {
+        return _state == state::eof;
+    }
+};
+
+}
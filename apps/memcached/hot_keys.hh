@@ -0,0 +1,101 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+namespace memcache {
+
+// Finds the keys that are read more than a given number of times per
+// second, so that the shard that owns them can replicate them to the other
+// shards.
+//
+// One in sample_rate reads is counted, in a count-min sketch of the key
+// hashes: a read increments a counter per row, picked by the hash, and the
+// smallest of them estimates the reads of the key, above the true count if
+// all of them are shared with other keys. The counters are reset every
+// second.
+template <typename Clock>
+class hot_key_detector {
+    static constexpr unsigned rows = 4;
+    static constexpr unsigned column_bits = 10;
+    static constexpr unsigned sample_rate = 8;
+    using counter = uint16_t;
+    std::array<std::array<counter, 1 << column_bits>, rows> _counts{};
+    counter _threshold = 0; // sampled reads per window
+    std::chrono::seconds _window = std::chrono::seconds(1);
+    typename Clock::time_point _window_start;
+    unsigned _tick = 0;
+private:
+    static unsigned column(size_t hash, unsigned row) {
+        static constexpr uint64_t multipliers[rows] = {
+            0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL,
+        };
+        return (uint64_t(hash) * multipliers[row]) >> (64 - column_bits);
+    }
+public:
+    // reads_per_second of 0 disables the detection
+    explicit hot_key_detector(unsigned reads_per_second = 0) {
+        set_threshold(reads_per_second);
+    }
+    void set_threshold(unsigned reads_per_second) {
+        if (!reads_per_second) {
+            _threshold = 0;
+            return;
+        }
+        auto sampled = std::max(reads_per_second / sample_rate, 1u);
+        _threshold = std::min<unsigned>(sampled, std::numeric_limits<counter>::max() - 1);
+    }
+    bool enabled() const {
+        return _threshold;
+    }
+    // Records a read of the key with the hash; returns true when its
+    // estimated reads in the current second reach the threshold, which
+    // happens at most once per second for a key
+    bool record(size_t hash, typename Clock::time_point now) {
+        if (!_threshold || ++_tick % sample_rate) {
+            return false;
+        }
+        if (now - _window_start >= _window) {
+            for (auto& row : _counts) {
+                row.fill(0);
+            }
+            _window_start = now;
+        }
+        auto estimate = std::numeric_limits<counter>::max();
+        for (unsigned r = 0; r < rows; ++r) {
+            auto& c = _counts[r][column(hash, r)];
+            if (c < std::numeric_limits<counter>::max()) {
+                ++c;
+            }
+            estimate = std::min(estimate, c);
+        }
+        return estimate == _threshold;
+    }
+};
+
+}
@@ -0,0 +1,383 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include "core/bitops.hh"
+
+namespace memcache {
+
+using namespace seastar;
+
+// An open addressing hash index of pointers to T, for the items of the
+// cache.
+//
+// Slots are grouped by seven in 64 byte, cache line aligned, groups, that
+// start with a control word: a byte per slot, holding 7 bits of the hash of
+// its item (the tag), or marking it empty or deleted. A lookup first
+// matches the tag against all the control bytes of a group at once, with
+// 64 bit word arithmetic, and so usually touches one cache line of the
+// index, and only the items whose tag matches.
+//
+// The index grows incrementally: once three quarters of the slots are
+// taken, a table twice as large is allocated, and each subsequent insertion
+// or erasure initializes a few of its groups, then moves the items of a
+// few groups of the old table to it. Lookups check both tables meanwhile.
+//
+// HashOf()(const T&) returns the hash of an item, which must not change
+// while it is indexed.
+template <typename T, typename HashOf>
+class item_index {
+public:
+    static constexpr unsigned group_slots = 7;
+private:
+    static constexpr uint64_t lsbs = 0x0001010101010101ULL; // of the slot bytes
+    static constexpr uint64_t msbs = 0x0080808080808080ULL;
+    static constexpr uint8_t empty = 0x80;
+    static constexpr uint8_t deleted = 0xfe;
+    // the eighth control byte is never empty nor a tag
+    static constexpr uint64_t empty_group = 0xff80808080808080ULL;
+    // groups initialized (while growing) and migrated (once initialized) per
+    // insertion or erasure
+    static constexpr size_t init_step = 16;
+    static constexpr size_t migrate_step = 4;
+
+    struct alignas(64) group {
+        uint64_t ctrl;
+        T* slots[group_slots];
+
+        uint8_t ctrl_at(unsigned slot) const {
+            return ctrl >> (slot * 8);
+        }
+        void set_ctrl(unsigned slot, uint8_t c) {
+            ctrl = (ctrl & ~(uint64_t(0xff) << (slot * 8))) | (uint64_t(c) << (slot * 8));
+        }
+        // a bit set in byte i for slots i which may hold tag; false
+        // positives are left to the caller's comparison
+        uint64_t match(uint8_t tag) const {
+            auto x = ctrl ^ (lsbs * tag);
+            return (x - lsbs) & ~x & msbs;
+        }
+        uint64_t match_empty() const {
+            return ctrl & ~(ctrl << 6) & msbs;
+        }
+        uint64_t match_empty_or_deleted() const {
+            return ctrl & msbs;
+        }
+    };
+    static_assert(sizeof(group) == 64 || sizeof(T*) != 8, "a group should fill a cache line");
+
+    struct table {
+        group* groups = nullptr;
+        size_t mask = 0; // number of groups - 1
+        size_t used = 0;
+        size_t tombstones = 0;
+
+        size_t group_count() const {
+            return groups ? mask + 1 : 0;
+        }
+        size_t capacity() const {
+            return group_count() * group_slots;
+        }
+    };
+
+    table _table;
+    table _next; // being initialized, then migrated to, while growing
+    size_t _initialized = 0; // groups of _next
+    size_t _migrated = 0; // groups of _table
+    uint64_t _resize_failures = 0;
+    uint64_t _resizes = 0;
+private:
+    static unsigned slot_of(uint64_t bits) {
+        return count_trailing_zeros(bits) / 8;
+    }
+    static uint8_t tag_of(size_t hash) {
+        return hash & 0x7f;
+    }
+    static size_t home_of(const table& t, size_t hash) {
+        return (hash >> 7) & t.mask;
+    }
+
+    static group* allocate_groups(size_t count) {
+        return static_cast<group*>(::aligned_alloc(alignof(group), count * sizeof(group)));
+    }
+
+    // Calls func(group&, slot) for the slots of t that may hold an item with
+    // the hash, in probe order, until it returns true; returns whether it did
+    template <typename Func>
+    static bool probe(const table& t, size_t hash, Func&& func) {
+        auto tag = tag_of(hash);
+        auto g = home_of(t, hash);
+        for (size_t step = 1; step <= t.group_count(); ++step) {
+            auto& grp = t.groups[g];
+            for (auto bits = grp.match(tag); bits; bits &= bits - 1) {
+                if (func(grp, slot_of(bits))) {
+                    return true;
+                }
+            }
+            if (grp.match_empty()) {
+                return false;
+            }
+            // triangular probing visits every group of a power of two
+            g = (g + step) & t.mask;
+        }
+        return false;
+    }
+
+    template <typename Pred>
+    static T* find_in(const table& t, size_t hash, Pred& pred) {
+        T* found = nullptr;
+        probe(t, hash, [&] (group& grp, unsigned slot) {
+            if (pred(*grp.slots[slot])) {
+                found = grp.slots[slot];
+                return true;
+            }
+            return false;
+        });
+        return found;
+    }
+
+    static bool insert_into(table& t, size_t hash, T* p) {
+        auto g = home_of(t, hash);
+        for (size_t step = 1; step <= t.group_count(); ++step) {
+            auto& grp = t.groups[g];
+            if (auto bits = grp.match_empty_or_deleted()) {
+                auto slot = slot_of(bits);
+                if (grp.ctrl_at(slot) == deleted) {
+                    t.tombstones--;
+                }
+                grp.set_ctrl(slot, tag_of(hash));
+                grp.slots[slot] = p;
+                t.used++;
+                return true;
+            }
+            g = (g + step) & t.mask;
+        }
+        return false;
+    }
+
+    static void vacate(table& t, group& grp, unsigned slot) {
+        // probes stop at groups with an empty slot, so none went past this
+        // one and it needs no tombstone
+        if (grp.match_empty()) {
+            grp.set_ctrl(slot, empty);
+        } else {
+            grp.set_ctrl(slot, deleted);
+            t.tombstones++;
+        }
+        t.used--;
+    }
+
+    static bool erase_from(table& t, size_t hash, T* p) {
+        return probe(t, hash, [&] (group& grp, unsigned slot) {
+            if (grp.slots[slot] != p) {
+                return false;
+            }
+            vacate(t, grp, slot);
+            return true;
+        });
+    }
+
+    bool growing() const {
+        return _next.groups;
+    }
+    bool migrating() const {
+        return growing() && _initialized == _next.group_count();
+    }
+
+    void start_growing() {
+        // a table mostly full of tombstones is only rebuilt
+        auto count = _table.used * 2 > _table.capacity() * 3 / 4 ? _table.group_count() * 2 : _table.group_count();
+        auto groups = allocate_groups(count);
+        if (!groups) {
+            _resize_failures++;
+            return;
+        }
+        _next.groups = groups;
+        _next.mask = count - 1;
+        _initialized = 0;
+        _migrated = 0;
+        _resizes++;
+    }
+
+    void initialize(size_t groups) {
+        auto end = std::min(_initialized + groups, _next.group_count());
+        for (; _initialized < end; ++_initialized) {
+            _next.groups[_initialized].ctrl = empty_group;
+        }
+    }
+
+    void migrate(size_t groups) {
+        auto end = std::min(_migrated + groups, _table.group_count());
+        for (; _migrated < end; ++_migrated) {
+            auto& grp = _table.groups[_migrated];
+            for (auto bits = ~grp.match_empty_or_deleted() & msbs; bits; bits &= bits - 1) {
+                auto slot = slot_of(bits);
+                auto p = grp.slots[slot];
+                insert_into(_next, HashOf()(*p), p);
+                vacate(_table, grp, slot);
+            }
+        }
+        if (_migrated == _table.group_count()) {
+            ::free(_table.groups);
+            _table = _next;
+            _next = table();
+        }
+    }
+
+    // Does a step of growing, if the index is growing or should start to
+    void advance() {
+        if (!growing()) {
+            if ((_table.used + _table.tombstones + 1) * 4 > _table.capacity() * 3) {
+                start_growing();
+            }
+        } else if (!migrating()) {
+            // finish at once if the old table is about to fill up, which
+            // the step sizes should prevent
+            auto urgent = (_table.used + _table.tombstones + 1) * 16 > _table.capacity() * 15;
+            initialize(urgent ? _next.group_count() : init_step);
+        } else {
+            migrate(migrate_step);
+        }
+    }
+
+    static void reset(table& t) {
+        for (size_t g = 0; g < t.group_count(); ++g) {
+            t.groups[g].ctrl = empty_group;
+        }
+        t.used = 0;
+        t.tombstones = 0;
+    }
+public:
+    explicit item_index(size_t initial_groups = 256) {
+        auto count = size_t(1) << log2ceil(std::max<size_t>(initial_groups, 1));
+        _table.groups = allocate_groups(count);
+        if (!_table.groups) {
+            throw std::bad_alloc();
+        }
+        _table.mask = count - 1;
+        reset(_table);
+    }
+    item_index(const item_index&) = delete;
+    item_index& operator=(const item_index&) = delete;
+    ~item_index() {
+        ::free(_table.groups);
+        ::free(_next.groups);
+    }
+
+    size_t size() const {
+        return _table.used + _next.used;
+    }
+    // Slots of the table items are inserted to
+    size_t capacity() const {
+        return migrating() ? _next.capacity() : _table.capacity();
+    }
+    bool resizing() const {
+        return growing();
+    }
+    uint64_t resizes() const {
+        return _resizes;
+    }
+    uint64_t resize_failures() const {
+        return _resize_failures;
+    }
+
+    // Returns the item with the hash for which pred(const T&) is true, or
+    // nullptr
+    template <typename Pred>
+    T* find(size_t hash, Pred&& pred) const {
+        if (migrating()) {
+            if (auto p = find_in(_next, hash, pred)) {
+                return p;
+            }
+        }
+        return find_in(_table, hash, pred);
+    }
+
+    // Indexes p, which must not be already; throws std::bad_alloc if the
+    // index is full and could not grow
+    void insert(T* p) {
+        advance();
+        if (!insert_into(migrating() ? _next : _table, HashOf()(*p), p)) {
+            throw std::bad_alloc();
+        }
+    }
+
+    // Removes p from the index; returns whether it was indexed
+    bool erase(T* p) {
+        auto hash = HashOf()(*p);
+        auto erased = (migrating() && erase_from(_next, hash, p)) || erase_from(_table, hash, p);
+        advance();
+        return erased;
+    }
+
+    // Empties the index, calling dispose(T*) on every item
+    template <typename Func>
+    void clear_and_dispose(Func&& dispose) {
+        size_t position = 0;
+        while (position < positions()) {
+            position = for_each(position, positions(), [&dispose] (T* p) { dispose(p); });
+        }
+        ::free(_next.groups);
+        _next = table();
+        reset(_table);
+    }
+
+    // The items are visited a group at a time, by positions in
+    // [0, positions()), which follow the groups of the index's tables
+    size_t positions() const {
+        return _table.group_count() + (migrating() ? _next.group_count() : 0);
+    }
+
+    // Calls func(T*) on the items of count groups from position on, and
+    // returns the position after them. Items moved by the index growing
+    // between calls may be visited twice, or not at all.
+    template <typename Func>
+    size_t for_each(size_t position, size_t count, Func&& func) const {
+        auto end = std::min(position + count, positions());
+        for (; position < end; ++position) {
+            auto& grp = position < _table.group_count() ? _table.groups[position]
+                    : _next.groups[position - _table.group_count()];
+            for (auto bits = ~grp.match_empty_or_deleted() & msbs; bits; bits &= bits - 1) {
+                func(grp.slots[slot_of(bits)]);
+            }
+        }
+        return position;
+    }
+
+    // Number of groups holding 0 to group_slots items
+    std::array<size_t, group_slots + 1> occupancy() const {
+        std::array<size_t, group_slots + 1> histogram{};
+        for (size_t position = 0; position < positions(); ++position) {
+            size_t n = 0;
+            for_each(position, 1, [&n] (T*) { ++n; });
+            histogram[n]++;
+        }
+        return histogram;
+    }
+};
+
+}
@@ -19,28 +19,38 @@
  * Copyright 2014-2015 Cloudius Systems
  */
 
-#include <boost/intrusive/unordered_set.hpp>
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive_ptr.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/optional.hpp>
+#include <boost/range/irange.hpp>
 #include <iomanip>
 #include <sstream>
 #include "core/app-template.hh"
 #include "core/future-util.hh"
+#include "core/gate.hh"
+#include "core/shared_future.hh"
+#include "core/scheduling.hh"
 #include "core/timer-set.hh"
 #include "core/shared_ptr.hh"
 #include "core/stream.hh"
 #include "core/memory.hh"
 #include "core/units.hh"
 #include "core/distributed.hh"
+#include "core/fstream.hh"
 #include "core/vector-data-sink.hh"
 #include "core/bitops.hh"
 #include "core/slab.hh"
 #include "core/align.hh"
+#include "core/rope.hh"
 #include "net/api.hh"
 #include "net/packet-data-source.hh"
 #include "apps/memcached/ascii.hh"
+#include "apps/memcached/binary.hh"
+#include "apps/memcached/hot_keys.hh"
+#include "apps/memcached/item_index.hh"
+#include "apps/memcached/snapshot.hh"
+#include "util/log.hh"
 #include "memcached.hh"
 #include <unistd.h>
 
@@ -59,6 +69,7 @@ static constexpr double default_slab_growth_factor = 1.25;
 static constexpr uint64_t default_slab_page_size = 1UL*MB;
 static constexpr uint64_t default_per_cpu_slab_size = 0UL; // zero means reclaimer is enabled.
 static __thread slab_allocator<item>* slab;
+static logger memcached_logger("memcached");
 
 template<typename T>
 using optional = boost::optional<T>;
@@ -130,10 +141,8 @@ class item : public slab_item_base {
     using duration = expiration::duration;
     static constexpr uint8_t field_alignment = alignof(void*);
 private:
-    using hook_type = bi::unordered_set_member_hook<>;
     // TODO: align shared data to cache line boundary
     version_type _version;
-    hook_type _cache_link;
     bi::list_member_hook<> _timer_link;
     size_t _key_hash;
     expiration _expiry;
@@ -142,6 +151,7 @@ class item : public slab_item_base {
     uint16_t _ref_count;
     uint8_t _key_size;
     uint8_t _ascii_prefix_size;
+    bool _replica = false; // of a hot key of another shard
     char _data[]; // layout: data=key, (data+key_size)=ascii_prefix, (data+key_size+ascii_prefix_size)=value.
     friend class cache;
 public:
@@ -309,6 +319,10 @@ struct cache_stats {
     size_t _resize_failure {};
     size_t _size {};
     size_t _reclaims{};
+    size_t _replicas {};
+    size_t _replica_hits {};
+    size_t _replications {};
+    size_t _replica_invalidations {};
 
     void operator+=(const cache_stats& o) {
         _get_hits += o._get_hits;
@@ -330,6 +344,10 @@ struct cache_stats {
         _resize_failure += o._resize_failure;
         _size += o._size;
         _reclaims += o._reclaims;
+        _replicas += o._replicas;
+        _replica_hits += o._replica_hits;
+        _replications += o._replications;
+        _replica_invalidations += o._replica_invalidations;
     }
 };
 
@@ -360,17 +378,15 @@ struct item_insertion_data {
     expiration expiry;
 };
 
-class cache {
+class cache : public peering_sharded_service<cache> {
 private:
-    using cache_type = bi::unordered_set<item,
-        bi::member_hook<item, item::hook_type, &item::_cache_link>,
-        bi::power_2_buckets<true>,
-        bi::constant_time_size<true>>;
-    using cache_iterator = typename cache_type::iterator;
-    static constexpr size_t initial_bucket_count = 1 << 10;
-    static constexpr float load_factor = 0.75f;
-    size_t _resize_up_threshold = load_factor * initial_bucket_count;
-    cache_type::bucket_type* _buckets;
+    struct item_hash {
+        size_t operator()(const item& item_ref) const {
+            return hash_value(item_ref);
+        }
+    };
+    using cache_type = item_index<item, item_hash>;
+    static constexpr size_t initial_group_count = 1 << 8;
     cache_type _cache;
     seastar::timer_set<item, &item::_timer_link> _alive;
     timer<clock_type> _timer;
@@ -378,6 +394,18 @@ class cache {
     clock_type::duration _wc_to_clock_type_delta;
     cache_stats _stats;
     timer<clock_type> _flush_timer;
+    timer<> _rebalance_timer;
+    scheduling_group _rebalance_sg;
+    timer<> _snapshot_timer;
+    sstring _snapshot_file; // empty unless snapshots are enabled
+    io_priority_class _snapshot_pc;
+    bool _snapshot_running = false;
+    // held by the background work, that stop() waits for
+    seastar::gate _gate;
+    static constexpr size_t snapshot_batch_size = 128 * 1024;
+    hot_key_detector<clock_type> _hot_keys;
+    // owned keys replicated to the other shards, and the replication
+    std::unordered_map<sstring, shared_future<>> _replicated;
 private:
     size_t item_size(item& item_ref) {
         constexpr size_t field_alignment = alignof(void*);
@@ -410,7 +438,7 @@ class cache {
     template <bool IsInCache = true, bool IsInTimerList = true, bool Release = true>
     void erase(item& item_ref) {
         if (IsInCache) {
-            _cache.erase(_cache.iterator_to(item_ref));
+            _cache.erase(&item_ref);
         }
         if (IsInTimerList) {
             if (item_ref._expiry.ever_expires()) {
@@ -418,6 +446,9 @@ class cache {
             }
         }
         _stats._bytes -= item_size(item_ref);
+        if (item_ref._replica) {
+            _stats._replicas--;
+        }
         if (Release) {
             // memory used by item shouldn't be freed when slab is replacing it with another item.
             intrusive_ptr_release(&item_ref);
@@ -445,13 +476,13 @@ class cache {
     }
 
     inline
-    cache_iterator find(const item_key& key) {
-        return _cache.find(key, std::hash<item_key>(), item_key_cmp());
+    item* find(const item_key& key) {
+        return _cache.find(key.hash(), [&key] (const item& item_ref) { return item_key_cmp()(key, item_ref); });
     }
 
     template <typename Origin>
     inline
-    cache_iterator add_overriding(cache_iterator i, item_insertion_data& insertion) {
+    item* add_overriding(item* i, item_insertion_data& insertion) {
         auto& old_item = *i;
         uint64_t old_item_version = old_item._version;
 
@@ -462,50 +493,123 @@ class cache {
             Origin::move_if_local(insertion.data), insertion.expiry, old_item_version + 1);
         intrusive_ptr_add_ref(new_item);
 
-        auto insert_result = _cache.insert(*new_item);
-        assert(insert_result.second);
+        _cache.insert(new_item);
         if (insertion.expiry.ever_expires() && _alive.insert(*new_item)) {
             _timer.rearm(new_item->get_timeout());
         }
         _stats._bytes += size;
-        return insert_result.first;
+        return new_item;
     }
 
     template <typename Origin>
     inline
-    void add_new(item_insertion_data& insertion) {
+    item& add_new(item_insertion_data& insertion, item::version_type version = 1) {
         size_t size = item_size(insertion);
         auto new_item = slab->create(size, Origin::move_if_local(insertion.key), Origin::move_if_local(insertion.ascii_prefix),
-            Origin::move_if_local(insertion.data), insertion.expiry);
+            Origin::move_if_local(insertion.data), insertion.expiry, version);
         intrusive_ptr_add_ref(new_item);
         auto& item_ref = *new_item;
-        _cache.insert(item_ref);
+        _cache.insert(&item_ref);
         if (insertion.expiry.ever_expires() && _alive.insert(item_ref)) {
             _timer.rearm(item_ref.get_timeout());
         }
         _stats._bytes += size;
-        maybe_rehash();
+        return item_ref;
     }
 
-    void maybe_rehash() {
-        if (_cache.size() >= _resize_up_threshold) {
-            auto new_size = _cache.bucket_count() * 2;
-            auto old_buckets = _buckets;
-            try {
-                _buckets = new cache_type::bucket_type[new_size];
-            } catch (const std::bad_alloc& e) {
-                _stats._resize_failure++;
-                return;
+    // Sends copies of an owned item to the other shards, once they got the
+    // previous ones
+    void replicate(item& item_ref) {
+        if (_gate.is_closed()) {
+            return;
+        }
+        sstring key(item_ref.key().data(), item_ref.key_size());
+        auto i = _replicated.find(key);
+        auto previous = i == _replicated.end() ? make_ready_future<>() : i->second.get_future();
+        auto done = with_gate(_gate, [this, it = boost::intrusive_ptr<item>(&item_ref), previous = std::move(previous)] () mutable {
+            return previous.then([this, it] {
+                return parallel_for_each(smp::all_cpus(), [this, it] (unsigned cpu) {
+                    if (cpu == engine().cpu_id()) {
+                        return make_ready_future<>();
+                    }
+                    return container().invoke_on(cpu, [original = make_foreign(it)] (cache& c) {
+                        c.add_replica(*original);
+                    });
+                });
+            });
+        }).handle_exception([] (std::exception_ptr) {});
+        _replicated[key] = shared_future<>(std::move(done));
+        _stats._replications++;
+    }
+
+    // Serializes the items of the index groups from position on, until
+    // about snapshot_batch_size bytes, and advances position past them
+    temporary_buffer<char> serialize_groups(size_t& position) {
+        using namespace std::chrono;
+        auto first = position;
+        size_t size = 0;
+        while (position < _cache.positions() && size < snapshot_batch_size) {
+            position = _cache.for_each(position, 1, [&size] (item* i) {
+                size += snapshot::record_header_size + i->key_size() + i->ascii_prefix_size() + i->value_size();
+            });
+        }
+        temporary_buffer<char> buf(size);
+        auto p = buf.get_write();
+        auto now = clock_type::now();
+        _cache.for_each(first, position - first, [&] (item* i) {
+            snapshot::record_header header;
+            header.expiry = 0;
+            if (i->_expiry.ever_expires()) {
+                if (i->get_timeout() <= now) {
+                    return;
+                }
+                header.expiry = duration_cast<seconds>(i->get_timeout().time_since_epoch() - _wc_to_clock_type_delta).count();
+            }
+            header.value_size = i->value_size();
+            header.key_size = i->key_size();
+            header.ascii_prefix_size = i->ascii_prefix_size();
+            header.write(p);
+            p += snapshot::record_header_size;
+            p = std::copy(i->key().begin(), i->key().end(), p);
+            p = std::copy(i->ascii_prefix().begin(), i->ascii_prefix().end(), p);
+            p = std::copy(i->value().begin(), i->value().end(), p);
+        });
+        buf.trim(p - buf.get());
+        return buf;
+    }
+
+    // Inserts a snapshot record, unless it expired; returns whether it did
+    bool load_item(const snapshot::record_header& header, const temporary_buffer<char>& body,
+                   const std::function<bool (const item_key&)>& owned) {
+        using namespace std::chrono;
+        item_insertion_data insertion;
+        if (header.expiry) {
+            if (header.expiry <= duration_cast<seconds>(system_clock::now().time_since_epoch()).count()) {
+                return false;
             }
-            _cache.rehash(typename cache_type::bucket_traits(_buckets, new_size));
-            delete[] old_buckets;
-            _resize_up_threshold = _cache.bucket_count() * load_factor;
+            // the item's clock_type expiry follows from the current offset
+            // between the clocks, not the one it was saved with
+            insertion.expiry = expiration(_wc_to_clock_type_delta, header.expiry);
         }
+        auto p = body.get();
+        insertion.key = item_key(sstring(p, header.key_size));
+        if (!owned(insertion.key)) {
+            return false;
+        }
+        p += header.key_size;
+        insertion.ascii_prefix = sstring(p, header.ascii_prefix_size);
+        p += header.ascii_prefix_size;
+        insertion.data = sstring(p, header.value_size);
+        try {
+            set(insertion);
+        } catch (const std::bad_alloc&) {
+            return false;
+        }
+        return true;
     }
 public:
-    cache(uint64_t per_cpu_slab_size, uint64_t slab_page_size)
-        : _buckets(new cache_type::bucket_type[initial_bucket_count])
-        , _cache(cache_type::bucket_traits(_buckets, initial_bucket_count))
+    cache(uint64_t per_cpu_slab_size, uint64_t slab_page_size, slab_eviction_policy eviction_policy)
+        : _cache(initial_group_count)
     {
         using namespace std::chrono;
 
@@ -517,7 +621,7 @@ class cache {
 
         // initialize per-thread slab allocator.
         slab = new slab_allocator<item>(default_slab_growth_factor, per_cpu_slab_size, slab_page_size,
-                [this](item& item_ref) { erase<true, true, false>(item_ref); _stats._evicted++; });
+                [this](item& item_ref) { erase<true, true, false>(item_ref); _stats._evicted++; }, eviction_policy);
 #ifdef __DEBUG__
         static bool print_slab_classes = true;
         if (print_slab_classes) {
@@ -533,7 +637,8 @@ class cache {
 
     void flush_all() {
         _flush_timer.cancel();
-        _cache.erase_and_dispose(_cache.begin(), _cache.end(), [this] (item* it) {
+        _replicated.clear();
+        _cache.clear_and_dispose([this] (item* it) {
             erase<false, true>(*it);
         });
     }
@@ -546,7 +651,7 @@ class cache {
     template <typename Origin = local_origin_tag>
     bool set(item_insertion_data& insertion) {
         auto i = find(insertion.key);
-        if (i != _cache.end()) {
+        if (i) {
             add_overriding<Origin>(i, insertion);
             _stats._set_replaces++;
             return true;
@@ -560,7 +665,7 @@ class cache {
     template <typename Origin = local_origin_tag>
     bool add(item_insertion_data& insertion) {
         auto i = find(insertion.key);
-        if (i != _cache.end()) {
+        if (i) {
             return false;
         }
 
@@ -572,7 +677,7 @@ class cache {
     template <typename Origin = local_origin_tag>
     bool replace(item_insertion_data& insertion) {
         auto i = find(insertion.key);
-        if (i == _cache.end()) {
+        if (!i) {
             return false;
         }
 
@@ -583,7 +688,7 @@ class cache {
 
     bool remove(const item_key& key) {
         auto i = find(key);
-        if (i == _cache.end()) {
+        if (!i) {
             _stats._delete_misses++;
             return false;
         }
@@ -595,7 +700,7 @@ class cache {
 
     item_ptr get(const item_key& key) {
         auto i = find(key);
-        if (i == _cache.end()) {
+        if (!i) {
             _stats._get_misses++;
             return nullptr;
         }
@@ -604,10 +709,88 @@ class cache {
         return item_ptr(&item_ref);
     }
 
+    // Reads over this many per second of a key by other shards replicate it
+    // to them; 0 disables replication
+    void set_hot_key_threshold(unsigned reads_per_second) {
+        _hot_keys.set_threshold(reads_per_second);
+    }
+
+    // get() for another shard, that replicates the key if it is hot
+    item_ptr get_for_peer(const item_key& key) {
+        auto found = get(key);
+        if (found && _hot_keys.record(key.hash(), clock_type::now())) {
+            replicate(*found);
+        }
+        return found;
+    }
+
+    // The replica of a key of another shard, if there is one here
+    item_ptr get_replica(const item_key& key) {
+        if (!_stats._replicas) {
+            return nullptr;
+        }
+        auto i = find(key);
+        if (!i || !i->_replica) {
+            return nullptr;
+        }
+        _stats._get_hits++;
+        _stats._replica_hits++;
+        return item_ptr(i);
+    }
+
+    // Stores a copy of an item of another shard, which is read-only here
+    void add_replica(const item& original) {
+        item_key key(sstring(original.key().data(), original.key_size()));
+        if (auto i = find(key)) {
+            if (!i->_replica) {
+                return;
+            }
+            erase(*i);
+        }
+        item_insertion_data insertion {
+            .key = std::move(key),
+            .ascii_prefix = sstring(original.ascii_prefix().data(), original.ascii_prefix_size()),
+            .data = sstring(original.value().data(), original.value_size()),
+            .expiry = original._expiry
+        };
+        try {
+            add_new<local_origin_tag>(insertion, original._version)._replica = true;
+            _stats._replicas++;
+        } catch (const std::bad_alloc&) {
+        }
+    }
+
+    void drop_replica(const sstring& key) {
+        auto i = find(item_key(key));
+        if (i && i->_replica) {
+            erase(*i);
+        }
+    }
+
+    // To be called before a change to an owned key: the returned future
+    // resolves once the other shards dropped their replicas of it
+    future<> invalidate_replicas(const item_key& key) {
+        if (_replicated.empty()) {
+            return make_ready_future<>();
+        }
+        auto i = _replicated.find(key.key());
+        if (i == _replicated.end()) {
+            return make_ready_future<>();
+        }
+        auto replicated = i->second.get_future();
+        _replicated.erase(i);
+        _stats._replica_invalidations++;
+        return replicated.then([this, key = key.key()] {
+            return container().invoke_on_all([key] (cache& c) {
+                c.drop_replica(key);
+            });
+        });
+    }
+
     template <typename Origin = local_origin_tag>
     cas_result cas(item_insertion_data& insertion, item::version_type version) {
         auto i = find(insertion.key);
-        if (i == _cache.end()) {
+        if (!i) {
             _stats._cas_misses++;
             return cas_result::not_found;
         }
@@ -625,19 +808,16 @@ class cache {
         return _cache.size();
     }
 
-    size_t bucket_count() {
-        return _cache.bucket_count();
-    }
-
     cache_stats stats() {
-        _stats._size = size();
+        _stats._size = size() - _stats._replicas;
+        _stats._resize_failure = _cache.resize_failures();
         return _stats;
     }
 
     template <typename Origin = local_origin_tag>
     std::pair<item_ptr, bool> incr(item_key& key, uint64_t delta) {
         auto i = find(key);
-        if (i == _cache.end()) {
+        if (!i) {
             _stats._incr_misses++;
             return {item_ptr{}, false};
         }
@@ -660,7 +840,7 @@ class cache {
     template <typename Origin = local_origin_tag>
     std::pair<item_ptr, bool> decr(item_key& key, uint64_t delta) {
         auto i = find(key);
-        if (i == _cache.end()) {
+        if (!i) {
             _stats._decr_misses++;
             return {item_ptr{}, false};
         }
@@ -681,61 +861,204 @@ class cache {
     }
 
     std::pair<unsigned, foreign_ptr<lw_shared_ptr<std::string>>> print_hash_stats() {
-        static constexpr unsigned bits = sizeof(size_t) * 8;
-        size_t histo[bits + 1] {};
-        size_t max_size = 0;
-        unsigned max_bucket = 0;
-
-        for (size_t i = 0; i < _cache.bucket_count(); i++) {
-            size_t size = _cache.bucket_size(i);
-            unsigned bucket;
-            if (size == 0) {
-                bucket = 0;
-            } else {
-                bucket = bits - count_leading_zeros(size);
-            }
-            max_bucket = std::max(max_bucket, bucket);
-            max_size = std::max(max_size, size);
-            histo[bucket]++;
-        }
+        auto histo = _cache.occupancy();
 
         std::stringstream ss;
 
         ss << "size: " << _cache.size() << "\n";
-        ss << "buckets: " << _cache.bucket_count() << "\n";
-        ss << "load: " << sprint("%.2lf", (double)_cache.size() / _cache.bucket_count()) << "\n";
-        ss << "max bucket occupancy: " << max_size << "\n";
-        ss << "bucket occupancy histogram:\n";
-
-        for (unsigned i = 0; i < (max_bucket + 2); i++) {
-            ss << "  ";
-            if (i == 0) {
-                ss << "0: ";
-            } else if (i == 1) {
-                ss << "1: ";
-            } else {
-                ss << (1 << (i - 1)) << "+: ";
-            }
-            ss << histo[i] << "\n";
+        ss << "slots: " << _cache.capacity() << "\n";
+        ss << "load: " << sprint("%.2lf", (double)_cache.size() / _cache.capacity()) << "\n";
+        ss << "resizing: " << (_cache.resizing() ? "yes" : "no") << "\n";
+        ss << "resizes: " << _cache.resizes() << "\n";
+        ss << "group occupancy histogram:\n";
+
+        for (unsigned i = 0; i < histo.size(); i++) {
+            ss << "  " << i << ": " << histo[i] << "\n";
         }
         return {engine().cpu_id(), make_foreign(make_lw_shared<std::string>(ss.str()))};
     }
 
-    future<> stop() { return make_ready_future<>(); }
+    // Every interval, moves a slab page to the slab class that evicts the most,
+    // from one that doesn't evict; the work is accounted to sg.
+    void start_slab_rebalancing(scheduling_group sg, std::chrono::milliseconds interval) {
+        _rebalance_sg = sg;
+        _rebalance_timer.set_callback([this] {
+            with_gate(_gate, [this] {
+                return with_scheduling_group(_rebalance_sg, [] {
+                    slab->rebalance();
+                });
+            });
+        });
+        _rebalance_timer.arm_periodic(interval);
+    }
+
+    // Saves the items to snapshot_file every interval (if not zero), and when
+    // stopped.
+    void start_snapshots(sstring snapshot_file, io_priority_class pc, std::chrono::seconds interval) {
+        _snapshot_file = std::move(snapshot_file);
+        _snapshot_pc = pc;
+        if (!interval.count()) {
+            return;
+        }
+        _snapshot_timer.set_callback([this] {
+            if (_snapshot_running) {
+                return;
+            }
+            _snapshot_running = true;
+            with_gate(_gate, [this] {
+                return save_snapshot(_snapshot_file, _snapshot_pc).handle_exception([this] (std::exception_ptr ep) {
+                    memcached_logger.warn("failed to save {}: {}", _snapshot_file, ep);
+                }).finally([this] {
+                    _snapshot_running = false;
+                });
+            });
+        });
+        _snapshot_timer.arm_periodic(interval);
+    }
+
+    // Saves the items to file_name, through a temporary file that replaces
+    // it once complete. Items are serialized a batch of index groups at a
+    // time, so that the cache keeps serving meanwhile; those changed during
+    // the snapshot may or may not be in it.
+    future<> save_snapshot(sstring file_name, io_priority_class pc) {
+        auto tmp_name = file_name + ".tmp";
+        return open_file_dma(tmp_name, open_flags::wo | open_flags::create | open_flags::truncate).then(
+                [this, pc] (file f) {
+            file_output_stream_options options;
+            options.buffer_size = snapshot_batch_size;
+            options.write_behind = 4;
+            options.io_priority_class = pc;
+            auto out = make_lw_shared<output_stream<char>>(make_file_output_stream(std::move(f), options));
+            auto position = make_lw_shared<size_t>(0);
+            return out->write(snapshot::magic, snapshot::magic_size).then([this, out, position] {
+                return do_until([this, position] { return *position >= _cache.positions(); }, [this, out, position] {
+                    return out->write(serialize_groups(*position));
+                });
+            }).finally([out] {
+                return out->close();
+            });
+        }).then([tmp_name = std::move(tmp_name), file_name = std::move(file_name)] {
+            return rename_file(tmp_name, file_name);
+        });
+    }
+
+    // Loads the items saved by save_snapshot(), but for those that expired
+    // since, and returns how many were loaded. A missing file loads nothing.
+    // Items for which owned() is false are skipped too.
+    future<uint64_t> load_snapshot(sstring file_name, io_priority_class pc, std::function<bool (const item_key&)> owned) {
+        auto filter = make_lw_shared<std::function<bool (const item_key&)>>(std::move(owned));
+        return file_exists(file_name).then([this, file_name, pc, filter] (bool exists) {
+            if (!exists) {
+                return make_ready_future<uint64_t>(0);
+            }
+            return open_file_dma(file_name, open_flags::ro).then([this, pc, filter] (file f) {
+                file_input_stream_options options;
+                options.buffer_size = snapshot_batch_size;
+                options.read_ahead = 4;
+                options.io_priority_class = pc;
+                auto in = make_lw_shared<input_stream<char>>(make_file_input_stream(std::move(f), options));
+                auto loaded = make_lw_shared<uint64_t>(0);
+                return in->read_exactly(snapshot::magic_size).then([this, in, loaded, filter] (temporary_buffer<char> magic) {
+                    if (magic.size() != snapshot::magic_size || memcmp(magic.get(), snapshot::magic, snapshot::magic_size)) {
+                        throw std::runtime_error("not a memcached snapshot");
+                    }
+                    return repeat([this, in, loaded, filter] {
+                        return in->read_exactly(snapshot::record_header_size).then([this, in, loaded, filter] (temporary_buffer<char> buf) {
+                            if (buf.empty()) {
+                                return make_ready_future<stop_iteration>(stop_iteration::yes);
+                            }
+                            if (buf.size() != snapshot::record_header_size) {
+                                throw std::runtime_error("truncated snapshot");
+                            }
+                            auto header = snapshot::record_header::read(buf.get());
+                            return in->read_exactly(header.body_size()).then([this, header, loaded, filter] (temporary_buffer<char> body) {
+                                if (body.size() != header.body_size()) {
+                                    throw std::runtime_error("truncated snapshot");
+                                }
+                                *loaded += load_item(header, body, *filter);
+                                return stop_iteration::no;
+                            });
+                        });
+                    });
+                }).finally([in] {
+                    return in->close();
+                }).then([loaded] {
+                    return *loaded;
+                });
+            });
+        });
+    }
+
+    future<> stop() {
+        _rebalance_timer.cancel();
+        _snapshot_timer.cancel();
+        return _gate.close().then([this] {
+            if (_snapshot_file.empty()) {
+                return make_ready_future<>();
+            }
+            return save_snapshot(_snapshot_file, _snapshot_pc).handle_exception([this] (std::exception_ptr ep) {
+                memcached_logger.warn("failed to save {}: {}", _snapshot_file, ep);
+            });
+        });
+    }
     clock_type::duration get_wc_to_clock_type_delta() { return _wc_to_clock_type_delta; }
 };
 
 class sharded_cache {
 private:
     distributed<cache>& _peers;
+    uint16_t _shard_port_base = 0;
+public:
+    // The hash that assigns keys to shards, which clients may compute to
+    // send requests to the shard that owns their keys (see "stats shards");
+    // it is independent of the table hash, which would otherwise only use
+    // the buckets of its shard
+    static uint64_t key_hash(const item_key& key) {
+        uint64_t h = 14695981039346656037ULL;
+        for (auto c : key.key()) {
+            h ^= uint8_t(c);
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+    static constexpr const char* key_hash_name = "fnv1a_64";
 
-    inline
     unsigned get_cpu(const item_key& key) {
-        return std::hash<item_key>()(key) % smp::count;
+        return key_hash(key) % smp::count;
+    }
+
+private:
+    // Runs func(cache&, origin tag) on the shard that owns the key, which
+    // changes it: the other shards' replicas of the key are invalidated
+    // first, and the result is returned once they are gone
+    template <typename Func>
+    auto on_owner(const item_key& key, Func func) {
+        auto run = [&key, func = std::move(func)] (cache& c, auto origin) mutable {
+            auto invalidated = c.invalidate_replicas(key);
+            auto result = func(c, origin);
+            return invalidated.then([result = std::move(result)] () mutable {
+                return std::move(result);
+            });
+        };
+        auto cpu = get_cpu(key);
+        if (engine().cpu_id() == cpu) {
+            return run(_peers.local(), local_origin_tag());
+        }
+        return _peers.invoke_on(cpu, [run = std::move(run)] (cache& c) mutable {
+            return run(c, remote_origin_tag());
+        });
     }
 public:
     sharded_cache(distributed<cache>& peers) : _peers(peers) {}
 
+    // If set, shard N also serves connections on port shard_port_base + N
+    void set_shard_port_base(uint16_t port) {
+        _shard_port_base = port;
+    }
+    uint16_t shard_port_base() const {
+        return _shard_port_base;
+    }
+
     future<> flush_all() {
         return _peers.invoke_on_all(&cache::flush_all);
     }
@@ -748,50 +1071,95 @@ class sharded_cache {
 
     // The caller must keep @insertion live until the resulting future resolves.
     future<bool> set(item_insertion_data& insertion) {
-        auto cpu = get_cpu(insertion.key);
-        if (engine().cpu_id() == cpu) {
-            return make_ready_future<bool>(_peers.local().set(insertion));
-        }
-        return _peers.invoke_on(cpu, &cache::set<remote_origin_tag>, std::ref(insertion));
+        return on_owner(insertion.key, [&insertion] (cache& c, auto origin) {
+            return c.set<decltype(origin)>(insertion);
+        });
     }
 
     // The caller must keep @insertion live until the resulting future resolves.
     future<bool> add(item_insertion_data& insertion) {
-        auto cpu = get_cpu(insertion.key);
-        if (engine().cpu_id() == cpu) {
-            return make_ready_future<bool>(_peers.local().add(insertion));
-        }
-        return _peers.invoke_on(cpu, &cache::add<remote_origin_tag>, std::ref(insertion));
+        return on_owner(insertion.key, [&insertion] (cache& c, auto origin) {
+            return c.add<decltype(origin)>(insertion);
+        });
     }
 
     // The caller must keep @insertion live until the resulting future resolves.
     future<bool> replace(item_insertion_data& insertion) {
-        auto cpu = get_cpu(insertion.key);
-        if (engine().cpu_id() == cpu) {
-            return make_ready_future<bool>(_peers.local().replace(insertion));
-        }
-        return _peers.invoke_on(cpu, &cache::replace<remote_origin_tag>, std::ref(insertion));
+        return on_owner(insertion.key, [&insertion] (cache& c, auto origin) {
+            return c.replace<decltype(origin)>(insertion);
+        });
     }
 
     // The caller must keep @key live until the resulting future resolves.
     future<bool> remove(const item_key& key) {
-        auto cpu = get_cpu(key);
-        return _peers.invoke_on(cpu, &cache::remove, std::ref(key));
+        return on_owner(key, [&key] (cache& c, auto origin) {
+            return c.remove(key);
+        });
     }
 
     // The caller must keep @key live until the resulting future resolves.
     future<item_ptr> get(const item_key& key) {
         auto cpu = get_cpu(key);
-        return _peers.invoke_on(cpu, &cache::get, std::ref(key));
+        if (engine().cpu_id() == cpu) {
+            return make_ready_future<item_ptr>(_peers.local().get(key));
+        }
+        if (auto replica = _peers.local().get_replica(key)) {
+            return make_ready_future<item_ptr>(std::move(replica));
+        }
+        return _peers.invoke_on(cpu, &cache::get_for_peer, std::ref(key));
+    }
+
+    // Gets the items of all keys, in their order, with at most one call to
+    // each shard that owns some of them.
+    // The caller must keep @keys live until the resulting future resolves.
+    future<std::vector<item_ptr>> get_multi(const std::vector<item_key>& keys) {
+        auto items = make_lw_shared<std::vector<item_ptr>>(keys.size());
+        // indexes of the keys, by owner shard
+        auto by_cpu = make_lw_shared<std::vector<std::vector<unsigned>>>(smp::count);
+        for (unsigned i = 0; i < keys.size(); ++i) {
+            (*by_cpu)[get_cpu(keys[i])].push_back(i);
+        }
+        return parallel_for_each(boost::irange(0u, smp::count), [this, &keys, items, by_cpu] (unsigned cpu) {
+            auto& indexes = (*by_cpu)[cpu];
+            if (indexes.empty()) {
+                return make_ready_future<>();
+            }
+            if (engine().cpu_id() == cpu) {
+                for (auto i : indexes) {
+                    (*items)[i] = _peers.local().get(keys[i]);
+                }
+                return make_ready_future<>();
+            }
+            // the keys without a replica here
+            indexes.erase(std::remove_if(indexes.begin(), indexes.end(), [this, &keys, items] (unsigned i) {
+                (*items)[i] = _peers.local().get_replica(keys[i]);
+                return bool((*items)[i]);
+            }), indexes.end());
+            if (indexes.empty()) {
+                return make_ready_future<>();
+            }
+            return _peers.invoke_on(cpu, [&keys, &indexes] (cache& c) {
+                std::vector<item_ptr> found;
+                found.reserve(indexes.size());
+                for (auto i : indexes) {
+                    found.emplace_back(c.get_for_peer(keys[i]));
+                }
+                return found;
+            }).then([items, &indexes] (std::vector<item_ptr> found) {
+                for (unsigned j = 0; j < indexes.size(); ++j) {
+                    (*items)[indexes[j]] = std::move(found[j]);
+                }
+            });
+        }).then([items, by_cpu] {
+            return std::move(*items);
+        });
     }
 
     // The caller must keep @insertion live until the resulting future resolves.
     future<cas_result> cas(item_insertion_data& insertion, item::version_type version) {
-        auto cpu = get_cpu(insertion.key);
-        if (engine().cpu_id() == cpu) {
-            return make_ready_future<cas_result>(_peers.local().cas(insertion, version));
-        }
-        return _peers.invoke_on(cpu, &cache::cas<remote_origin_tag>, std::ref(insertion), std::move(version));
+        return on_owner(insertion.key, [&insertion, version] (cache& c, auto origin) {
+            return c.cas<decltype(origin)>(insertion, version);
+        });
     }
 
     future<cache_stats> stats() {
@@ -800,22 +1168,16 @@ class sharded_cache {
 
     // The caller must keep @key live until the resulting future resolves.
     future<std::pair<item_ptr, bool>> incr(item_key& key, uint64_t delta) {
-        auto cpu = get_cpu(key);
-        if (engine().cpu_id() == cpu) {
-            return make_ready_future<std::pair<item_ptr, bool>>(
-                _peers.local().incr<local_origin_tag>(key, delta));
-        }
-        return _peers.invoke_on(cpu, &cache::incr<remote_origin_tag>, std::ref(key), std::move(delta));
+        return on_owner(key, [&key, delta] (cache& c, auto origin) {
+            return c.incr<decltype(origin)>(key, delta);
+        });
     }
 
     // The caller must keep @key live until the resulting future resolves.
     future<std::pair<item_ptr, bool>> decr(item_key& key, uint64_t delta) {
-        auto cpu = get_cpu(key);
-        if (engine().cpu_id() == cpu) {
-            return make_ready_future<std::pair<item_ptr, bool>>(
-                _peers.local().decr(key, delta));
-        }
-        return _peers.invoke_on(cpu, &cache::decr<remote_origin_tag>, std::ref(key), std::move(delta));
+        return on_owner(key, [&key, delta] (cache& c, auto origin) {
+            return c.decr<decltype(origin)>(key, delta);
+        });
     }
 
     future<> print_hash_stats(output_stream<char>& out) {
@@ -856,6 +1218,22 @@ struct system_stats {
     future<> stop() { return make_ready_future<>(); }
 };
 
+// The client flags of an item, which its ascii prefix " <flags> <size>"
+// starts with
+static std::experimental::string_view client_flags(const item& it) {
+    auto prefix = it.ascii_prefix().substr(1);
+    return prefix.substr(0, prefix.find(' '));
+}
+
+// Seconds until an item expires, or -1 if it never does
+static int64_t seconds_to_expiry(const item& it) {
+    auto timeout = const_cast<item&>(it).get_timeout();
+    if (timeout == never_expire_timepoint) {
+        return -1;
+    }
+    return std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::seconds>(timeout - clock_type::now()).count());
+}
+
 class ascii_protocol {
 private:
     using this_type = ascii_protocol;
@@ -864,7 +1242,6 @@ class ascii_protocol {
     memcache_ascii_parser _parser;
     item_key _item_key;
     item_insertion_data _insertion;
-    std::vector<item_ptr> _items;
 private:
     static constexpr const char *msg_crlf = "\r\n";
     static constexpr const char *msg_error = "ERROR\r\n";
@@ -880,7 +1257,19 @@ class ascii_protocol {
     static constexpr const char *msg_stat = "STAT ";
     static constexpr const char *msg_out_of_memory = "SERVER_ERROR Out of memory allocating new item\r\n";
     static constexpr const char *msg_error_non_numeric_value = "CLIENT_ERROR cannot increment or decrement non-numeric value\r\n";
+    static constexpr const char *msg_meta_noop = "MN\r\n";
+    static constexpr const char *msg_meta_miss = "EN\r\n";
+    static constexpr const char *msg_meta_stored = "HD";
+    static constexpr const char *msg_meta_not_stored = "NS";
+    static constexpr const char *msg_meta_exists = "EX";
+    static constexpr const char *msg_meta_not_found = "NF";
+    static constexpr const char *msg_meta_invalid_flag = "CLIENT_ERROR invalid flag\r\n";
+    static constexpr const char *msg_meta_bad_token = "CLIENT_ERROR bad token in command line format\r\n";
 private:
+    // The response refers to the item's key, prefix and value in the slab
+    // memory of the shard that owns it, which the item_ptr keeps pinned
+    // until the message is sent; remote items are unpinned on their shard,
+    // in batches, by the foreign_ptr
     template <bool WithVersion>
     static void append_item(scattered_message<char>& msg, item_ptr item) {
         if (!item) {
@@ -913,14 +1302,9 @@ class ascii_protocol {
                 return out.write(std::move(msg));
             });
         } else {
-            _items.clear();
-            return parallel_for_each(_parser._keys.begin(), _parser._keys.end(), [this] (const auto& key) {
-                return _cache.get(key).then([this] (auto item) {
-                    _items.emplace_back(std::move(item));
-                });
-            }).then([this, &out] () {
+            return _cache.get_multi(_parser._keys).then([&out] (std::vector<item_ptr> items) {
                 scattered_message<char> msg;
-                for (auto& item : _items) {
+                for (auto& item : items) {
                     append_item<WithVersion>(msg, std::move(item));
                 }
                 msg.append_static(msg_end);
@@ -929,13 +1313,196 @@ class ascii_protocol {
         }
     }
 
+    // Appends to msg the flags of a meta command that return something,
+    // in the order of the request; item is null when there is none
+    void append_meta_flags(scattered_message<char>& msg, const item* it) {
+        for (auto&& flag : _parser._meta_flags) {
+            switch (flag[0]) {
+            case 'O':
+                msg.append_static(" ");
+                msg.append(flag);
+                break;
+            case 'k':
+                msg.append_static(" k");
+                msg.append(_parser._key.key());
+                break;
+            case 'c':
+                if (it) {
+                    msg.append(make_sstring(" c", to_sstring(const_cast<item*>(it)->version())));
+                }
+                break;
+            case 'f':
+                if (it) {
+                    msg.append_static(" f");
+                    msg.append_static(client_flags(*it));
+                }
+                break;
+            case 's':
+                if (it) {
+                    msg.append(make_sstring(" s", to_sstring(it->value_size())));
+                }
+                break;
+            case 't':
+                if (it) {
+                    msg.append(make_sstring(" t", to_sstring(seconds_to_expiry(*it))));
+                }
+                break;
+            }
+        }
+    }
+
+    bool has_meta_flag(char f) const {
+        return std::any_of(_parser._meta_flags.begin(), _parser._meta_flags.end(), [f] (const sstring& flag) {
+            return flag[0] == f;
+        });
+    }
+
+    // Returns the token of a meta flag, or nullptr if it is not given
+    const sstring* meta_flag_token(char f) const {
+        for (auto&& flag : _parser._meta_flags) {
+            if (flag[0] == f) {
+                return &flag;
+            }
+        }
+        return nullptr;
+    }
+
+    bool meta_flags_are(const char* supported) const {
+        return std::all_of(_parser._meta_flags.begin(), _parser._meta_flags.end(), [supported] (const sstring& flag) {
+            return strchr(supported, flag[0]);
+        });
+    }
+
+    static optional<uint32_t> meta_flag_u32(const sstring* flag) {
+        try {
+            return boost::lexical_cast<uint32_t>(flag->begin() + 1, flag->size() - 1);
+        } catch (const boost::bad_lexical_cast&) {
+            return {};
+        }
+    }
+
+    // Writes the status line of a meta command that has no value
+    future<> write_meta_status(output_stream<char>& out, const char* status, const item* it = nullptr) {
+        scattered_message<char> msg;
+        msg.append_static(status);
+        append_meta_flags(msg, it);
+        msg.append_static(msg_crlf);
+        return out.write(std::move(msg));
+    }
+
+    future<> handle_meta_get(output_stream<char>& out) {
+        _system_stats.local()._cmd_get++;
+        if (!meta_flags_are("cfkOqstv")) {
+            return out.write(msg_meta_invalid_flag);
+        }
+        return _cache.get(_parser._key).then([this, &out] (item_ptr item) -> future<> {
+            if (!item) {
+                return has_meta_flag('q') ? make_ready_future<>() : out.write(msg_meta_miss);
+            }
+            scattered_message<char> msg;
+            auto with_value = has_meta_flag('v');
+            if (with_value) {
+                msg.append_static("VA ");
+                msg.append(to_sstring(item->value_size()));
+            } else {
+                msg.append_static("HD");
+            }
+            append_meta_flags(msg, &*item);
+            msg.append_static(msg_crlf);
+            if (with_value) {
+                msg.append_static(item->value());
+                msg.append_static(msg_crlf);
+            }
+            msg.on_delete([item = std::move(item)] {});
+            return out.write(std::move(msg));
+        });
+    }
+
+    future<> handle_meta_set(output_stream<char>& out) {
+        _system_stats.local()._cmd_set++;
+        if (!meta_flags_are("CFkMOqT")) {
+            return out.write(msg_meta_invalid_flag);
+        }
+        optional<uint32_t> flags = 0;
+        optional<uint32_t> ttl = 0;
+        if (auto f = meta_flag_token('F')) {
+            flags = meta_flag_u32(f);
+        }
+        if (auto t = meta_flag_token('T')) {
+            ttl = meta_flag_u32(t);
+        }
+        auto mode = meta_flag_token('M');
+        char m = mode && mode->size() == 2 ? (*mode)[1] : 'S';
+        if (!flags || !ttl || !strchr("SER", m)) {
+            return out.write(msg_meta_bad_token);
+        }
+        _insertion = item_insertion_data{
+            .key = _parser._key,
+            .ascii_prefix = make_sstring(" ", to_sstring(*flags), " ", _parser._size_str),
+            .data = std::move(_parser._blob),
+            .expiry = expiration(_cache.get_wc_to_clock_type_delta(), *ttl)
+        };
+        auto respond = [this, &out] (const char* status) {
+            if (status == msg_meta_stored && has_meta_flag('q')) {
+                return make_ready_future<>();
+            }
+            return write_meta_status(out, status);
+        };
+        if (auto c = meta_flag_token('C')) {
+            item::version_type version;
+            try {
+                version = boost::lexical_cast<item::version_type>(c->begin() + 1, c->size() - 1);
+            } catch (const boost::bad_lexical_cast&) {
+                return out.write(msg_meta_bad_token);
+            }
+            return _cache.cas(_insertion, version).then([respond] (cas_result result) {
+                switch (result) {
+                case cas_result::stored:
+                    return respond(msg_meta_stored);
+                case cas_result::not_found:
+                    return respond(msg_meta_not_found);
+                case cas_result::bad_version:
+                    return respond(msg_meta_exists);
+                default:
+                    std::abort();
+                }
+            });
+        }
+        switch (m) {
+        case 'E':
+            return _cache.add(_insertion).then([respond] (bool added) {
+                return respond(added ? msg_meta_stored : msg_meta_not_stored);
+            });
+        case 'R':
+            return _cache.replace(_insertion).then([respond] (bool replaced) {
+                return respond(replaced ? msg_meta_stored : msg_meta_not_stored);
+            });
+        default:
+            return _cache.set(_insertion).then([respond] (bool) {
+                return respond(msg_meta_stored);
+            });
+        }
+    }
+
+    future<> handle_meta_delete(output_stream<char>& out) {
+        if (!meta_flags_are("kOq")) {
+            return out.write(msg_meta_invalid_flag);
+        }
+        return _cache.remove(_parser._key).then([this, &out] (bool removed) {
+            if (removed && has_meta_flag('q')) {
+                return make_ready_future<>();
+            }
+            return write_meta_status(out, removed ? msg_meta_stored : msg_meta_not_found);
+        });
+    }
+
     template <typename Value>
-    static future<> print_stat(output_stream<char>& out, const char* key, Value value) {
-        return out.write(msg_stat)
-                .then([&out, key] { return out.write(key); })
-                .then([&out] { return out.write(" "); })
-                .then([&out, value] { return out.write(to_sstring(value)); })
-                .then([&out] { return out.write(msg_crlf); });
+    static void print_stat(rope& r, const char* key, Value value) {
+        r.append(msg_stat);
+        r.append(key);
+        r.append(" ");
+        r.append(to_sstring(value));
+        r.append(msg_crlf);
     }
 
     future<> print_stats(output_stream<char>& out) {
@@ -945,78 +1512,49 @@ class ascii_protocol {
                     auto now = clock_type::now();
                     auto total_items = all_cache_stats._set_replaces + all_cache_stats._set_adds
                         + all_cache_stats._cas_hits;
-                    return print_stat(out, "pid", getpid())
-                        .then([&out, uptime = now - all_system_stats._start_time] {
-                            return print_stat(out, "uptime",
-                                std::chrono::duration_cast<std::chrono::seconds>(uptime).count());
-                        }).then([now, &out] {
-                            return print_stat(out, "time",
-                                std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count());
-                        }).then([&out] {
-                            return print_stat(out, "version", VERSION_STRING);
-                        }).then([&out] {
-                            return print_stat(out, "pointer_size", sizeof(void*)*8);
-                        }).then([&out, v = all_system_stats._curr_connections] {
-                            return print_stat(out, "curr_connections", v);
-                        }).then([&out, v = all_system_stats._total_connections] {
-                            return print_stat(out, "total_connections", v);
-                        }).then([&out, v = all_system_stats._curr_connections] {
-                            return print_stat(out, "connection_structures", v);
-                        }).then([&out, v = all_system_stats._cmd_get] {
-                            return print_stat(out, "cmd_get", v);
-                        }).then([&out, v = all_system_stats._cmd_set] {
-                            return print_stat(out, "cmd_set", v);
-                        }).then([&out, v = all_system_stats._cmd_flush] {
-                            return print_stat(out, "cmd_flush", v);
-                        }).then([&out] {
-                            return print_stat(out, "cmd_touch", 0);
-                        }).then([&out, v = all_cache_stats._get_hits] {
-                            return print_stat(out, "get_hits", v);
-                        }).then([&out, v = all_cache_stats._get_misses] {
-                            return print_stat(out, "get_misses", v);
-                        }).then([&out, v = all_cache_stats._delete_misses] {
-                            return print_stat(out, "delete_misses", v);
-                        }).then([&out, v = all_cache_stats._delete_hits] {
-                            return print_stat(out, "delete_hits", v);
-                        }).then([&out, v = all_cache_stats._incr_misses] {
-                            return print_stat(out, "incr_misses", v);
-                        }).then([&out, v = all_cache_stats._incr_hits] {
-                            return print_stat(out, "incr_hits", v);
-                        }).then([&out, v = all_cache_stats._decr_misses] {
-                            return print_stat(out, "decr_misses", v);
-                        }).then([&out, v = all_cache_stats._decr_hits] {
-                            return print_stat(out, "decr_hits", v);
-                        }).then([&out, v = all_cache_stats._cas_misses] {
-                            return print_stat(out, "cas_misses", v);
-                        }).then([&out, v = all_cache_stats._cas_hits] {
-                            return print_stat(out, "cas_hits", v);
-                        }).then([&out, v = all_cache_stats._cas_badval] {
-                            return print_stat(out, "cas_badval", v);
-                        }).then([&out] {
-                            return print_stat(out, "touch_hits", 0);
-                        }).then([&out] {
-                            return print_stat(out, "touch_misses", 0);
-                        }).then([&out] {
-                            return print_stat(out, "auth_cmds", 0);
-                        }).then([&out] {
-                            return print_stat(out, "auth_errors", 0);
-                        }).then([&out] {
-                            return print_stat(out, "threads", smp::count);
-                        }).then([&out, v = all_cache_stats._size] {
-                            return print_stat(out, "curr_items", v);
-                        }).then([&out, v = total_items] {
-                            return print_stat(out, "total_items", v);
-                        }).then([&out, v = all_cache_stats._expired] {
-                            return print_stat(out, "seastar.expired", v);
-                        }).then([&out, v = all_cache_stats._resize_failure] {
-                            return print_stat(out, "seastar.resize_failure", v);
-                        }).then([&out, v = all_cache_stats._evicted] {
-                            return print_stat(out, "evictions", v);
-                        }).then([&out, v = all_cache_stats._bytes] {
-                            return print_stat(out, "bytes", v);
-                        }).then([&out] {
-                            return out.write(msg_end);
-                        });
+                    // built whole and written at once, rather than as five
+                    // writes per stat
+                    rope r;
+                    print_stat(r, "pid", getpid());
+                    print_stat(r, "uptime", std::chrono::duration_cast<std::chrono::seconds>(now - all_system_stats._start_time).count());
+                    print_stat(r, "time", std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count());
+                    print_stat(r, "version", VERSION_STRING);
+                    print_stat(r, "pointer_size", sizeof(void*)*8);
+                    print_stat(r, "curr_connections", all_system_stats._curr_connections);
+                    print_stat(r, "total_connections", all_system_stats._total_connections);
+                    print_stat(r, "connection_structures", all_system_stats._curr_connections);
+                    print_stat(r, "cmd_get", all_system_stats._cmd_get);
+                    print_stat(r, "cmd_set", all_system_stats._cmd_set);
+                    print_stat(r, "cmd_flush", all_system_stats._cmd_flush);
+                    print_stat(r, "cmd_touch", 0);
+                    print_stat(r, "get_hits", all_cache_stats._get_hits);
+                    print_stat(r, "get_misses", all_cache_stats._get_misses);
+                    print_stat(r, "delete_misses", all_cache_stats._delete_misses);
+                    print_stat(r, "delete_hits", all_cache_stats._delete_hits);
+                    print_stat(r, "incr_misses", all_cache_stats._incr_misses);
+                    print_stat(r, "incr_hits", all_cache_stats._incr_hits);
+                    print_stat(r, "decr_misses", all_cache_stats._decr_misses);
+                    print_stat(r, "decr_hits", all_cache_stats._decr_hits);
+                    print_stat(r, "cas_misses", all_cache_stats._cas_misses);
+                    print_stat(r, "cas_hits", all_cache_stats._cas_hits);
+                    print_stat(r, "cas_badval", all_cache_stats._cas_badval);
+                    print_stat(r, "touch_hits", 0);
+                    print_stat(r, "touch_misses", 0);
+                    print_stat(r, "auth_cmds", 0);
+                    print_stat(r, "auth_errors", 0);
+                    print_stat(r, "threads", smp::count);
+                    print_stat(r, "curr_items", all_cache_stats._size);
+                    print_stat(r, "total_items", total_items);
+                    print_stat(r, "seastar.expired", all_cache_stats._expired);
+                    print_stat(r, "seastar.resize_failure", all_cache_stats._resize_failure);
+                    print_stat(r, "seastar.replicas", all_cache_stats._replicas);
+                    print_stat(r, "seastar.replica_hits", all_cache_stats._replica_hits);
+                    print_stat(r, "seastar.replications", all_cache_stats._replications);
+                    print_stat(r, "seastar.replica_invalidations", all_cache_stats._replica_invalidations);
+                    print_stat(r, "evictions", all_cache_stats._evicted);
+                    print_stat(r, "bytes", all_cache_stats._bytes);
+                    r.append(msg_end);
+                    return out.write(std::move(r).release_message());
                 });
         });
     }
@@ -1154,6 +1692,16 @@ class ascii_protocol {
                 case memcache_ascii_parser::state::cmd_stats_hash:
                     return _cache.print_hash_stats(out);
 
+                case memcache_ascii_parser::state::cmd_stats_shards:
+                {
+                    rope r;
+                    print_stat(r, "shards", smp::count);
+                    print_stat(r, "key_hash", sharded_cache::key_hash_name);
+                    print_stat(r, "shard_port_base", _cache.shard_port_base());
+                    r.append(msg_end);
+                    return out.write(std::move(r).release_message());
+                }
+
                 case memcache_ascii_parser::state::cmd_incr:
                 {
                     auto f = _cache.incr(_parser._key, _parser._u64);
@@ -1175,6 +1723,18 @@ class ascii_protocol {
                     });
                 }
 
+                case memcache_ascii_parser::state::cmd_meta_noop:
+                    return out.write(msg_meta_noop);
+
+                case memcache_ascii_parser::state::cmd_meta_get:
+                    return handle_meta_get(out);
+
+                case memcache_ascii_parser::state::cmd_meta_set:
+                    return handle_meta_set(out);
+
+                case memcache_ascii_parser::state::cmd_meta_delete:
+                    return handle_meta_delete(out);
+
                 case memcache_ascii_parser::state::cmd_decr:
                 {
                     auto f = _cache.decr(_parser._key, _parser._u64);
@@ -1213,6 +1773,345 @@ class ascii_protocol {
     };
 };
 
+// Serves the binary protocol, on connections whose first byte is its
+// request magic. Values stored with either protocol can be read with the
+// other: the binary flags are kept in the item's ascii prefix.
+class binary_protocol {
+private:
+    using status = binary::status;
+    using opcode = binary::opcode;
+    sharded_cache& _cache;
+    distributed<system_stats>& _system_stats;
+    memcache_binary_parser _parser;
+    item_key _item_key;
+    item_insertion_data _insertion;
+    bool _quit = false;
+    static constexpr uint32_t no_auto_create = 0xffffffff;
+    static constexpr size_t max_key_length = 250;
+private:
+    binary::opcode op() const {
+        return binary::opcode(_parser._header.opcode);
+    }
+    static uint32_t item_flags(const item& it) {
+        uint32_t flags = 0;
+        for (auto c : client_flags(it)) {
+            flags = flags * 10 + (c - '0');
+        }
+        return flags;
+    }
+    // Appends a response to msg; extras, key and value must live until
+    // the message is sent
+    void append_response(scattered_message<char>& msg, status st, std::experimental::string_view extras = {},
+            std::experimental::string_view key = {}, std::experimental::string_view value = {}, uint64_t cas = 0) {
+        binary::header h;
+        h.magic = binary::response_magic;
+        h.opcode = _parser._header.opcode;
+        h.key_length = key.size();
+        h.extras_length = extras.size();
+        h.data_type = 0;
+        h.vbucket_or_status = uint16_t(st);
+        h.body_length = extras.size() + key.size() + value.size();
+        h.opaque = _parser._header.opaque;
+        h.cas = cas;
+        sstring hdr(sstring::initialized_later(), binary::header_size);
+        h.write(hdr.begin());
+        msg.append(std::move(hdr));
+        msg.append_static(extras);
+        msg.append_static(key);
+        msg.append_static(value);
+    }
+    future<> respond(output_stream<char>& out, status st, sstring value = {}, uint64_t cas = 0) {
+        scattered_message<char> msg;
+        append_response(msg, st, {}, {}, value, cas);
+        msg.on_delete([value = std::move(value)] {});
+        return out.write(std::move(msg));
+    }
+    future<> respond_error(output_stream<char>& out, status st) {
+        static const std::unordered_map<uint16_t, sstring> texts = {
+            { uint16_t(status::key_not_found), "Not found" },
+            { uint16_t(status::key_exists), "Data exists for key" },
+            { uint16_t(status::invalid_arguments), "Invalid arguments" },
+            { uint16_t(status::item_not_stored), "Not stored" },
+            { uint16_t(status::non_numeric_value), "Non-numeric server-side value for incr or decr" },
+            { uint16_t(status::unknown_command), "Unknown command" },
+            { uint16_t(status::out_of_memory), "Out of memory" },
+        };
+        return respond(out, st, texts.at(uint16_t(st)));
+    }
+    // Quiet commands only respond to failures
+    bool quiet() const {
+        switch (op()) {
+        case opcode::setq: case opcode::addq: case opcode::replaceq: case opcode::delq:
+        case opcode::incrementq: case opcode::decrementq: case opcode::quitq: case opcode::flushq:
+            return true;
+        default:
+            return false;
+        }
+    }
+    future<> handle_get(output_stream<char>& out) {
+        _system_stats.local()._cmd_get++;
+        _item_key = item_key(std::move(_parser._key));
+        return _cache.get(_item_key).then([this, &out] (item_ptr item) -> future<> {
+            auto with_key = op() == opcode::getk || op() == opcode::getkq;
+            auto is_quiet = op() == opcode::getq || op() == opcode::getkq;
+            if (!item) {
+                if (is_quiet) {
+                    return make_ready_future<>();
+                }
+                if (!with_key) {
+                    return respond_error(out, status::key_not_found);
+                }
+                scattered_message<char> msg;
+                append_response(msg, status::key_not_found, {}, _item_key.key());
+                return out.write(std::move(msg));
+            }
+            sstring flags(sstring::initialized_later(), 4);
+            write_be<uint32_t>(flags.begin(), item_flags(*item));
+            scattered_message<char> msg;
+            append_response(msg, status::no_error, flags, with_key ? item->key() : std::experimental::string_view(),
+                    item->value(), item->version());
+            msg.on_delete([item = std::move(item), flags = std::move(flags)] {});
+            return out.write(std::move(msg));
+        });
+    }
+    future<> handle_store(output_stream<char>& out) {
+        _system_stats.local()._cmd_set++;
+        if (_parser._extras.size() != 8) {
+            return respond_error(out, status::invalid_arguments);
+        }
+        auto flags = read_be<uint32_t>(_parser._extras.begin());
+        auto expiry = read_be<uint32_t>(_parser._extras.begin() + 4);
+        auto size = _parser._value.size();
+        _insertion = item_insertion_data{
+            .key = item_key(std::move(_parser._key)),
+            .ascii_prefix = make_sstring(" ", to_sstring(flags), " ", to_sstring(size)),
+            .data = std::move(_parser._value),
+            .expiry = expiration(_cache.get_wc_to_clock_type_delta(), expiry)
+        };
+        auto stored = [this, &out] (status st) {
+            if (st == status::no_error) {
+                return quiet() ? make_ready_future<>() : respond(out, st);
+            }
+            return respond_error(out, st);
+        };
+        auto cas = _parser._header.cas;
+        if (cas) {
+            return _cache.cas(_insertion, cas).then([stored] (cas_result result) {
+                switch (result) {
+                case cas_result::stored:
+                    return stored(status::no_error);
+                case cas_result::not_found:
+                    return stored(status::key_not_found);
+                case cas_result::bad_version:
+                    return stored(status::key_exists);
+                default:
+                    std::abort();
+                }
+            });
+        }
+        switch (op()) {
+        case opcode::set:
+        case opcode::setq:
+            return _cache.set(_insertion).then([stored] (bool) {
+                return stored(status::no_error);
+            });
+        case opcode::add:
+        case opcode::addq:
+            return _cache.add(_insertion).then([stored] (bool added) {
+                return stored(added ? status::no_error : status::key_exists);
+            });
+        default:
+            return _cache.replace(_insertion).then([stored] (bool replaced) {
+                return stored(replaced ? status::no_error : status::key_not_found);
+            });
+        }
+    }
+    future<> handle_delete(output_stream<char>& out) {
+        _item_key = item_key(std::move(_parser._key));
+        return _cache.remove(_item_key).then([this, &out] (bool removed) {
+            if (!removed) {
+                return respond_error(out, status::key_not_found);
+            }
+            return quiet() ? make_ready_future<>() : respond(out, status::no_error);
+        });
+    }
+    future<> respond_counter(output_stream<char>& out, std::pair<item_ptr, bool> result) {
+        auto item = std::move(result.first);
+        if (!result.second) {
+            return respond_error(out, status::non_numeric_value);
+        }
+        if (quiet()) {
+            return make_ready_future<>();
+        }
+        sstring value(sstring::initialized_later(), 8);
+        write_be<uint64_t>(value.begin(), *item->data_as_integral());
+        return respond(out, status::no_error, std::move(value), item->version());
+    }
+    future<> handle_counter(output_stream<char>& out) {
+        if (_parser._extras.size() != 20) {
+            return respond_error(out, status::invalid_arguments);
+        }
+        auto delta = read_be<uint64_t>(_parser._extras.begin());
+        auto initial = read_be<uint64_t>(_parser._extras.begin() + 8);
+        auto expiry = read_be<uint32_t>(_parser._extras.begin() + 16);
+        _item_key = item_key(std::move(_parser._key));
+        auto increment = op() == opcode::increment || op() == opcode::incrementq;
+        auto apply = [this, increment, delta] {
+            return increment ? _cache.incr(_item_key, delta) : _cache.decr(_item_key, delta);
+        };
+        return apply().then([this, &out, apply, initial, expiry] (std::pair<item_ptr, bool> result) {
+            if (result.first) {
+                return respond_counter(out, std::move(result));
+            }
+            if (expiry == no_auto_create) {
+                return respond_error(out, status::key_not_found);
+            }
+            // a missing counter is created with the initial value
+            auto value = to_sstring(initial);
+            _insertion = item_insertion_data{
+                .key = _item_key,
+                .ascii_prefix = make_sstring(" 0 ", to_sstring(value.size())),
+                .data = std::move(value),
+                .expiry = expiration(_cache.get_wc_to_clock_type_delta(), expiry)
+            };
+            return _cache.add(_insertion).then([this, &out, apply, initial] (bool added) {
+                if (added) {
+                    if (quiet()) {
+                        return make_ready_future<>();
+                    }
+                    sstring value(sstring::initialized_later(), 8);
+                    write_be<uint64_t>(value.begin(), initial);
+                    return respond(out, status::no_error, std::move(value));
+                }
+                // created meanwhile by another client
+                return apply().then([this, &out] (std::pair<item_ptr, bool> result) {
+                    if (!result.first) {
+                        return respond_error(out, status::key_not_found);
+                    }
+                    return respond_counter(out, std::move(result));
+                });
+            });
+        });
+    }
+    future<> handle_flush(output_stream<char>& out) {
+        _system_stats.local()._cmd_flush++;
+        uint32_t expiry = 0;
+        if (_parser._extras.size() == 4) {
+            expiry = read_be<uint32_t>(_parser._extras.begin());
+        }
+        auto f = expiry ? _cache.flush_at(expiry) : _cache.flush_all();
+        return f.then([this, &out] {
+            return quiet() ? make_ready_future<>() : respond(out, status::no_error);
+        });
+    }
+    future<> handle_stat(output_stream<char>& out) {
+        return _cache.stats().then([this, &out] (cache_stats stats) {
+            auto msg = make_lw_shared<scattered_message<char>>();
+            auto values = make_lw_shared<std::vector<std::pair<sstring, sstring>>>();
+            auto add = [&] (const char* name, uint64_t value) {
+                values->emplace_back(name, to_sstring(value));
+            };
+            add("pid", getpid());
+            add("threads", smp::count);
+            add("curr_items", stats._size);
+            add("bytes", stats._bytes);
+            add("get_hits", stats._get_hits);
+            add("get_misses", stats._get_misses);
+            add("evictions", stats._evicted);
+            for (auto&& v : *values) {
+                append_response(*msg, status::no_error, {}, v.first, v.second);
+            }
+            // an empty stat ends the list
+            append_response(*msg, status::no_error);
+            msg->on_delete([values] {});
+            return out.write(std::move(*msg));
+        });
+    }
+public:
+    binary_protocol(sharded_cache& cache, distributed<system_stats>& system_stats)
+        : _cache(cache)
+        , _system_stats(system_stats)
+    {}
+
+    // Whether the connection is to be closed
+    bool quit() const {
+        return _quit;
+    }
+
+    future<> handle(input_stream<char>& in, output_stream<char>& out) {
+        _parser.init();
+        return in.consume(_parser).then([this, &out] () -> future<> {
+            switch (_parser._state) {
+            case memcache_binary_parser::state::eof:
+                return make_ready_future<>();
+            case memcache_binary_parser::state::error:
+                // the stream cannot be resynchronized
+                _quit = true;
+                return make_ready_future<>();
+            case memcache_binary_parser::state::done:
+                break;
+            }
+            if (_parser._key.size() > max_key_length) {
+                return respond_error(out, status::invalid_arguments);
+            }
+            switch (op()) {
+            case opcode::get:
+            case opcode::getq:
+            case opcode::getk:
+            case opcode::getkq:
+                return handle_get(out);
+            case opcode::set:
+            case opcode::setq:
+            case opcode::add:
+            case opcode::addq:
+            case opcode::replace:
+            case opcode::replaceq:
+                return handle_store(out);
+            case opcode::del:
+            case opcode::delq:
+                return handle_delete(out);
+            case opcode::increment:
+            case opcode::incrementq:
+            case opcode::decrement:
+            case opcode::decrementq:
+                return handle_counter(out);
+            case opcode::flush:
+            case opcode::flushq:
+                return handle_flush(out);
+            case opcode::noop:
+                return respond(out, status::no_error);
+            case opcode::version:
+                return respond(out, status::no_error, VERSION_STRING);
+            case opcode::stat:
+                return handle_stat(out);
+            case opcode::quit:
+            case opcode::quitq:
+                _quit = true;
+                return quiet() ? make_ready_future<>() : respond(out, status::no_error);
+            }
+            return respond_error(out, status::unknown_command);
+        }).then_wrapped([this, &out] (auto&& f) -> future<> {
+            try {
+                f.get();
+            } catch (std::bad_alloc& e) {
+                return respond_error(out, status::out_of_memory);
+            }
+            return make_ready_future<>();
+        });
+    }
+};
+
+// Tells the protocol of a connection from its first byte, without
+// consuming it
+struct protocol_detector {
+    using unconsumed_remainder = std::experimental::optional<temporary_buffer<char>>;
+    bool binary = false;
+    future<unconsumed_remainder> operator()(temporary_buffer<char> data) {
+        binary = !data.empty() && uint8_t(data[0]) == binary::request_magic;
+        return make_ready_future<unconsumed_remainder>(std::move(data));
+    }
+};
+
 class udp_server {
 public:
     static const size_t default_max_datagram_size = 1400;
@@ -1317,6 +2216,7 @@ class udp_server {
 class tcp_server {
 private:
     lw_shared_ptr<server_socket> _listener;
+    lw_shared_ptr<server_socket> _shard_listener;
     sharded_cache& _cache;
     distributed<system_stats>& _system_stats;
     uint16_t _port;
@@ -1326,6 +2226,7 @@ class tcp_server {
         input_stream<char> _in;
         output_stream<char> _out;
         ascii_protocol _proto;
+        binary_protocol _binary_proto;
         distributed<system_stats>& _system_stats;
         connection(connected_socket&& socket, socket_address addr, sharded_cache& c, distributed<system_stats>& system_stats)
             : _socket(std::move(socket))
@@ -1333,6 +2234,7 @@ class tcp_server {
             , _in(_socket.input())
             , _out(_socket.output())
             , _proto(c, system_stats)
+            , _binary_proto(c, system_stats)
             , _system_stats(system_stats)
         {
             _system_stats.local()._curr_connections++;
@@ -1349,16 +2251,23 @@ class tcp_server {
         , _port(port)
     {}
 
-    void start() {
-        listen_options lo;
-        lo.reuse_address = true;
-        _listener = engine().listen(make_ipv4_address({_port}), lo);
-        keep_doing([this] {
-            return _listener->accept().then([this] (connected_socket fd, socket_address addr) mutable {
+    void serve(lw_shared_ptr<server_socket> listener) {
+        keep_doing([this, listener] {
+            return listener->accept().then([this] (connected_socket fd, socket_address addr) mutable {
                 auto conn = make_lw_shared<connection>(std::move(fd), addr, _cache, _system_stats);
-                do_until([conn] { return conn->_in.eof(); }, [conn] {
-                    return conn->_proto.handle(conn->_in, conn->_out).then([conn] {
-                        return conn->_out.flush();
+                auto detector = make_lw_shared<protocol_detector>();
+                conn->_in.consume(*detector).then([conn, detector] {
+                    if (detector->binary) {
+                        return do_until([conn] { return conn->_in.eof() || conn->_binary_proto.quit(); }, [conn] {
+                            return conn->_binary_proto.handle(conn->_in, conn->_out).then([conn] {
+                                return conn->_out.flush();
+                            });
+                        });
+                    }
+                    return do_until([conn] { return conn->_in.eof(); }, [conn] {
+                        return conn->_proto.handle(conn->_in, conn->_out).then([conn] {
+                            return conn->_out.flush();
+                        });
                     });
                 }).finally([conn] {
                     return conn->_out.close().finally([conn]{});
@@ -1367,6 +2276,19 @@ class tcp_server {
         }).or_terminate();
     }
 
+    void start() {
+        listen_options lo;
+        lo.reuse_address = true;
+        _listener = engine().listen(make_ipv4_address({_port}), lo);
+        serve(_listener);
+        if (auto base = _cache.shard_port_base()) {
+            // clients that hash their keys like get_cpu() connect here to
+            // the owner of their keys, whose requests then stay local
+            _shard_listener = engine().listen(make_ipv4_address({uint16_t(base + engine().cpu_id())}), lo);
+            serve(_shard_listener);
+        }
+    }
+
     future<> stop() { return make_ready_future<>(); }
 };
 
@@ -1417,10 +2339,32 @@ int main(int ac, char** av) {
              "Maximum memory to be used for items (value in megabytes) (reclaimer is disabled if set)")
         ("slab-page-size", bpo::value<uint64_t>()->default_value(memcache::default_slab_page_size/MB),
              "Size of slab page (value in megabytes)")
+        ("slab-eviction", bpo::value<std::string>()->default_value("lru"),
+             "Item eviction policy: lru, segmented-lru (items read once can't evict those read again) "
+             "or clock (hits don't reorder items)")
+        ("slab-rebalance-interval", bpo::value<unsigned>()->default_value(0),
+             "If set, every this many milliseconds a slab page is moved to the slab class that evicts "
+             "the most items, from one that doesn't evict")
+        ("slab-rebalance-shares", bpo::value<float>()->default_value(100),
+             "CPU shares of the slab rebalancing scheduling group")
+        ("snapshot-dir", bpo::value<std::string>()->default_value(""),
+             "If set, each shard saves its items to a file in this directory on shutdown, and reloads them on startup")
+        ("snapshot-interval", bpo::value<unsigned>()->default_value(0),
+             "If set, the items are also saved every this many seconds")
+        ("snapshot-io-shares", bpo::value<unsigned>()->default_value(100),
+             "I/O shares of the snapshot reads and writes")
+        ("snapshot-bandwidth", bpo::value<uint64_t>()->default_value(0),
+             "If set, caps the snapshot reads and writes to this many megabytes per second")
+        ("hot-key-threshold", bpo::value<unsigned>()->default_value(0),
+             "If set, keys read more than this many times per second from other shards are copied to all shards, "
+             "which then serve them locally until they change")
         ("stats",
              "Print basic statistics periodically (every second)")
         ("port", bpo::value<uint16_t>()->default_value(11211),
              "Specify UDP and TCP ports for memcached server to listen on")
+        ("shard-port-base", bpo::value<uint16_t>()->default_value(0),
+             "If set, shard N also listens on TCP port shard-port-base + N, where the keys it owns are served "
+             "without crossing shards; \"stats shards\" tells clients how keys map to shards")
         ;
 
     return app.run_deprecated(ac, av, [&] {
@@ -1431,13 +2375,75 @@ int main(int ac, char** av) {
 
         auto&& config = app.configuration();
         uint16_t port = config["port"].as<uint16_t>();
+        uint16_t shard_port_base = config["shard-port-base"].as<uint16_t>();
+        cache.set_shard_port_base(shard_port_base);
         uint64_t per_cpu_slab_size = config["max-slab-size"].as<uint64_t>() * MB;
         uint64_t slab_page_size = config["slab-page-size"].as<uint64_t>() * MB;
-        return cache_peers.start(std::move(per_cpu_slab_size), std::move(slab_page_size)).then([&system_stats] {
+        static const std::unordered_map<std::string, slab_eviction_policy> eviction_policies = {
+            { "lru", slab_eviction_policy::lru },
+            { "segmented-lru", slab_eviction_policy::segmented_lru },
+            { "clock", slab_eviction_policy::clock },
+        };
+        auto eviction_policy = eviction_policies.find(config["slab-eviction"].as<std::string>());
+        if (eviction_policy == eviction_policies.end()) {
+            throw std::invalid_argument("unknown slab eviction policy: " + config["slab-eviction"].as<std::string>());
+        }
+        return cache_peers.start(std::move(per_cpu_slab_size), std::move(slab_page_size), eviction_policy->second).then([&system_stats] {
             return system_stats.start(memcache::clock_type::now());
         }).then([&] {
             std::cout << PLATFORM << " memcached " << VERSION << "\n";
             return make_ready_future<>();
+        }).then([shard_port_base] {
+            if (!shard_port_base) {
+                return make_ready_future<>();
+            }
+            // stacks that spread connections by RSS must send those of a
+            // shard port to its shard; those that don't steer them (posix)
+            // reach the only listener of the port anyway
+            return parallel_for_each(smp::all_cpus(), [shard_port_base] (unsigned cpu) {
+                net::flow_rule rule;
+                rule.local_port = shard_port_base + cpu;
+                rule.cpu = cpu;
+                return engine().net().add_flow_rule(rule).handle_exception([] (std::exception_ptr) {});
+            });
+        }).then([&] {
+            sstring dir = config["snapshot-dir"].as<std::string>();
+            if (dir.empty()) {
+                return make_ready_future<>();
+            }
+            io_priority_class_limits limits;
+            limits.bytes_per_second = config["snapshot-bandwidth"].as<uint64_t>() * MB;
+            auto pc = engine().register_one_priority_class("memcached_snapshot", config["snapshot-io-shares"].as<unsigned>(), limits);
+            auto interval = std::chrono::seconds(config["snapshot-interval"].as<unsigned>());
+            // a snapshot holds the keys of its shard, as long as the number
+            // of shards is the same; the others are dropped
+            return recursive_touch_directory(dir).then([&cache_peers, dir, pc] {
+                return cache_peers.map_reduce0([dir, pc] (memcache::cache& c) {
+                    auto file_name = memcache::snapshot::file_name(dir, engine().cpu_id());
+                    return c.load_snapshot(file_name, pc, [] (const memcache::item_key& key) {
+                        return memcache::sharded_cache::key_hash(key) % smp::count == engine().cpu_id();
+                    }).handle_exception([file_name] (std::exception_ptr ep) {
+                        memcache::memcached_logger.warn("failed to load {}: {}", file_name, ep);
+                        return uint64_t(0);
+                    });
+                }, uint64_t(0), std::plus<uint64_t>());
+            }).then([&cache_peers, dir, pc, interval] (uint64_t loaded) {
+                memcache::memcached_logger.info("loaded {} items from {}", loaded, dir);
+                return cache_peers.invoke_on_all([dir, pc, interval] (memcache::cache& c) {
+                    c.start_snapshots(memcache::snapshot::file_name(dir, engine().cpu_id()), pc, interval);
+                });
+            });
+        }).then([&] {
+            return cache_peers.invoke_on_all(&memcache::cache::set_hot_key_threshold, config["hot-key-threshold"].as<unsigned>());
+        }).then([&] {
+            auto interval = std::chrono::milliseconds(config["slab-rebalance-interval"].as<unsigned>());
+            if (!interval.count()) {
+                return make_ready_future<>();
+            }
+            return create_scheduling_group("slab_rebalance", config["slab-rebalance-shares"].as<float>()).then(
+                    [&cache_peers, interval] (scheduling_group sg) {
+                return cache_peers.invoke_on_all(&memcache::cache::start_slab_rebalancing, sg, interval);
+            });
         }).then([&, port] {
             return tcp_server.start(std::ref(cache), std::ref(system_stats), port);
         }).then([&tcp_server] {
@@ -0,0 +1,77 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include "core/byteorder.hh"
+#include "core/sstring.hh"
+
+namespace memcache {
+
+using namespace seastar;
+
+// The format of the files the cache of each shard is saved to, and reloaded
+// from when memcached restarts: a magic string, then one record per item,
+// each a fixed record header followed by the key, the ascii prefix and the
+// value. Integers are little endian.
+
+namespace snapshot {
+
+static constexpr char magic[] = "SMCSNAP1";
+static constexpr size_t magic_size = sizeof(magic) - 1;
+static constexpr size_t record_header_size = 12;
+
+struct record_header {
+    uint32_t value_size;
+    // wall clock expiry, in seconds since the epoch, or 0 for items that
+    // never expire
+    uint32_t expiry;
+    uint8_t key_size;
+    uint8_t ascii_prefix_size;
+
+    size_t body_size() const {
+        return size_t(key_size) + ascii_prefix_size + value_size;
+    }
+    static record_header read(const char* p) {
+        record_header h;
+        h.value_size = read_le<uint32_t>(p);
+        h.expiry = read_le<uint32_t>(p + 4);
+        h.key_size = p[8];
+        h.ascii_prefix_size = p[9];
+        return h;
+    }
+    void write(char* p) const {
+        write_le<uint32_t>(p, value_size);
+        write_le<uint32_t>(p + 4, expiry);
+        p[8] = key_size;
+        p[9] = ascii_prefix_size;
+        write_le<uint16_t>(p + 10, 0); // reserved
+    }
+};
+
+inline sstring file_name(const sstring& dir, unsigned shard) {
+    return dir + "/memcached-" + to_sstring(shard) + ".snapshot";
+}
+
+}
+
+}
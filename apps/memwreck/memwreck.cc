@@ -0,0 +1,665 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+// A load generator for memcached servers, like seawreck is for HTTP ones:
+// its connections send gets and sets of keys picked from a uniform or
+// zipfian distribution, either as fast as the server answers (closed
+// loop) or at a fixed rate (open loop), and it prints the throughput, hit
+// ratio and latency percentiles.
+
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <random>
+#include <experimental/optional>
+#include <boost/range/irange.hpp>
+#include "apps/memcached/binary.hh"
+#include "core/app-template.hh"
+#include "core/distributed.hh"
+#include "core/future-util.hh"
+#include "core/hdr_histogram.hh"
+#include "core/print.hh"
+#include "core/reactor.hh"
+#include "core/semaphore.hh"
+#include "core/sleep.hh"
+
+using namespace seastar;
+namespace binary = memcache::binary;
+
+using clock_type = steady_clock_type;
+
+// Picks the keys of the requests, by their index in [0, n)
+class key_distribution {
+public:
+    virtual ~key_distribution() {}
+    virtual uint64_t next(std::mt19937_64& rng) = 0;
+};
+
+class uniform_keys : public key_distribution {
+    std::uniform_int_distribution<uint64_t> _dist;
+public:
+    explicit uniform_keys(uint64_t n) : _dist(0, n - 1) {}
+    virtual uint64_t next(std::mt19937_64& rng) override {
+        return _dist(rng);
+    }
+};
+
+// Picks key i with a probability proportional to 1 / (i + 1)^theta, with
+// the method of Gray et al., "Quickly generating billion-record synthetic
+// databases" (which YCSB uses too); 0 < theta < 1
+class zipfian_keys : public key_distribution {
+    uint64_t _n;
+    double _theta;
+    double _zetan;
+    double _alpha;
+    double _eta;
+    std::uniform_real_distribution<double> _uniform;
+private:
+    static double zeta(uint64_t n, double theta) {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; ++i) {
+            sum += 1 / std::pow(double(i), theta);
+        }
+        return sum;
+    }
+public:
+    zipfian_keys(uint64_t n, double theta)
+        : _n(n)
+        , _theta(theta)
+        , _zetan(zeta(n, theta))
+        , _alpha(1 / (1 - theta))
+        , _eta((1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta(2, theta) / _zetan)) {
+    }
+    virtual uint64_t next(std::mt19937_64& rng) override {
+        auto u = _uniform(rng);
+        auto uz = u * _zetan;
+        if (uz < 1) {
+            return 0;
+        }
+        if (uz < 1 + std::pow(0.5, _theta)) {
+            return 1;
+        }
+        return std::min<uint64_t>(_n - 1, _n * std::pow(_eta * u - _eta + 1, _alpha));
+    }
+};
+
+struct workload_config {
+    sstring protocol;
+    uint64_t keys;
+    sstring key_prefix;
+    sstring key_distribution;
+    double zipf_exponent;
+    unsigned value_size_min;
+    unsigned value_size_max;
+    double get_ratio;
+    unsigned multiget;
+    // requests per second over all connections; 0 for a closed loop
+    double rate;
+    // requests in flight per connection, in a closed loop
+    unsigned pipeline;
+    // most requests in flight per connection, in an open loop
+    unsigned max_outstanding;
+    unsigned total_conn;
+};
+
+struct load_stats {
+    uint64_t gets = 0;
+    uint64_t sets = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t errors = 0;
+    hdr_histogram latency{7, 60'000'000}; // microseconds
+public:
+    void operator+=(const load_stats& o) {
+        gets += o.gets;
+        sets += o.sets;
+        hits += o.hits;
+        misses += o.misses;
+        errors += o.errors;
+        latency += o.latency;
+    }
+};
+
+class memcached_client {
+public:
+    struct request {
+        bool get;
+        unsigned keys;
+        clock_type::time_point start;
+    };
+    class connection;
+private:
+    workload_config _cfg;
+    bool _binary;
+    std::mt19937_64 _rng;
+    std::unique_ptr<key_distribution> _keys;
+    std::uniform_int_distribution<unsigned> _value_size;
+    std::bernoulli_distribution _is_get;
+    sstring _value;
+    std::vector<std::unique_ptr<connection>> _connections;
+    load_stats _stats;
+    timer<> _run_timer;
+    bool _done = false;
+    bool _recording = false;
+    static constexpr unsigned prefill_pipeline = 64;
+public:
+    class connection {
+        memcached_client& _client;
+        connected_socket _fd;
+        input_stream<char> _in;
+        output_stream<char> _out;
+        // read but not parsed yet
+        temporary_buffer<char> _buf;
+        std::deque<request> _inflight;
+        semaphore _window{0};
+        // signalled once per request sent, and once after the last one
+        semaphore _pending{0};
+        clock_type::time_point _next_send;
+        uint64_t _prefill_key;
+        unsigned _hits = 0;
+        std::exception_ptr _error;
+    private:
+        sstring key(uint64_t index) const {
+            return _client._cfg.key_prefix + to_sstring(index);
+        }
+        future<> fill() {
+            return _in.read().then([this] (temporary_buffer<char> buf) {
+                if (buf.empty()) {
+                    throw std::runtime_error("connection closed by the server");
+                }
+                _buf = std::move(buf);
+            });
+        }
+        // Reads a line, without its "\r\n"
+        future<sstring> read_line() {
+            return repeat_until_value([this, line = sstring()] () mutable {
+                auto nl = _buf.find('\n');
+                if (nl == _buf.end()) {
+                    line += sstring(_buf.get(), _buf.size());
+                    return fill().then([] {
+                        return std::experimental::optional<sstring>();
+                    });
+                }
+                line += sstring(_buf.get(), nl - _buf.begin());
+                _buf.trim_front(nl - _buf.begin() + 1);
+                if (!line.empty() && line[line.size() - 1] == '\r') {
+                    line.resize(line.size() - 1);
+                }
+                return make_ready_future<std::experimental::optional<sstring>>(std::move(line));
+            });
+        }
+        future<temporary_buffer<char>> read(size_t n) {
+            if (_buf.size() >= n) {
+                auto ret = _buf.share(0, n);
+                _buf.trim_front(n);
+                return make_ready_future<temporary_buffer<char>>(std::move(ret));
+            }
+            auto ret = make_lw_shared<temporary_buffer<char>>(n);
+            return repeat([this, ret, got = size_t(0)] () mutable {
+                auto now = std::min(_buf.size(), ret->size() - got);
+                std::copy_n(_buf.get(), now, ret->get_write() + got);
+                _buf.trim_front(now);
+                got += now;
+                if (got == ret->size()) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return fill().then([] {
+                    return stop_iteration::no;
+                });
+            }).then([ret] {
+                return std::move(*ret);
+            });
+        }
+        future<> skip(size_t n) {
+            return repeat([this, n] () mutable {
+                auto now = std::min(_buf.size(), n);
+                _buf.trim_front(now);
+                n -= now;
+                if (!n) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return fill().then([] {
+                    return stop_iteration::no;
+                });
+            });
+        }
+        void write_binary_header(std::string& out, binary::opcode op, size_t extras, size_t key, size_t value) {
+            binary::header h{};
+            h.magic = binary::request_magic;
+            h.opcode = uint8_t(op);
+            h.key_length = key;
+            h.extras_length = extras;
+            h.body_length = extras + key + value;
+            char buf[binary::header_size];
+            h.write(buf);
+            out.append(buf, sizeof(buf));
+        }
+        future<> send(const request& r, uint64_t set_key) {
+            std::string out;
+            if (r.get) {
+                if (!_client._binary) {
+                    out += "get";
+                    for (unsigned i = 0; i < r.keys; ++i) {
+                        out += ' ';
+                        out += key(_client.next_key());
+                    }
+                    out += "\r\n";
+                } else if (r.keys == 1) {
+                    auto k = key(_client.next_key());
+                    write_binary_header(out, binary::opcode::get, 0, k.size(), 0);
+                    out.append(k.begin(), k.end());
+                } else {
+                    // only hits are answered, and the noop ends the answer
+                    for (unsigned i = 0; i < r.keys; ++i) {
+                        auto k = key(_client.next_key());
+                        write_binary_header(out, binary::opcode::getkq, 0, k.size(), 0);
+                        out.append(k.begin(), k.end());
+                    }
+                    write_binary_header(out, binary::opcode::noop, 0, 0, 0);
+                }
+            } else {
+                auto k = key(set_key);
+                auto size = _client.next_value_size();
+                if (!_client._binary) {
+                    out += "set ";
+                    out.append(k.begin(), k.end());
+                    out += " 0 0 " + std::to_string(size) + "\r\n";
+                    out.append(_client._value.begin(), size);
+                    out += "\r\n";
+                } else {
+                    // flags and expiry
+                    static const char extras[8] = {};
+                    write_binary_header(out, binary::opcode::set, sizeof(extras), k.size(), size);
+                    out.append(extras, sizeof(extras));
+                    out.append(k.begin(), k.end());
+                    out.append(_client._value.begin(), size);
+                }
+            }
+            return _out.write(out).then([this] {
+                return _out.flush();
+            });
+        }
+        future<> receive_ascii(const request& r) {
+            if (!r.get) {
+                return read_line().then([this] (sstring line) {
+                    if (line != "STORED") {
+                        _client.stats().errors++;
+                    }
+                });
+            }
+            _hits = 0;
+            return repeat([this, keys = r.keys] {
+                return read_line().then([this, keys] (sstring line) {
+                    if (line == "END") {
+                        _client.stats().hits += _hits;
+                        _client.stats().misses += keys - std::min(keys, _hits);
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    auto size = line.find_last_of(' ');
+                    if (line.find("VALUE ") != 0 || size == sstring::npos) {
+                        _client.stats().errors++;
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    _hits++;
+                    return skip(std::stoul(std::string(line.begin() + size + 1, line.end())) + 2).then([] {
+                        return stop_iteration::no;
+                    });
+                });
+            });
+        }
+        // Reads a response; returns its header
+        future<binary::header> read_binary() {
+            return read(binary::header_size).then([this] (temporary_buffer<char> buf) {
+                auto h = binary::header::read(buf.get());
+                if (h.magic != binary::response_magic) {
+                    throw std::runtime_error("bad binary response");
+                }
+                return skip(h.body_length).then([h] {
+                    return h;
+                });
+            });
+        }
+        future<> receive_binary(const request& r) {
+            if (!r.get || r.keys == 1) {
+                return read_binary().then([this, get = r.get] (binary::header h) {
+                    auto st = binary::status(h.vbucket_or_status);
+                    if (st == binary::status::no_error) {
+                        _client.stats().hits += get;
+                    } else if (get && st == binary::status::key_not_found) {
+                        _client.stats().misses++;
+                    } else {
+                        _client.stats().errors++;
+                    }
+                });
+            }
+            _hits = 0;
+            return repeat([this, keys = r.keys] {
+                return read_binary().then([this, keys] (binary::header h) {
+                    if (binary::opcode(h.opcode) == binary::opcode::noop) {
+                        _client.stats().hits += _hits;
+                        _client.stats().misses += keys - std::min(keys, _hits);
+                        return stop_iteration::yes;
+                    }
+                    if (binary::status(h.vbucket_or_status) == binary::status::no_error) {
+                        _hits++;
+                    } else {
+                        _client.stats().errors++;
+                    }
+                    return stop_iteration::no;
+                });
+            });
+        }
+        // Sends requests until the run or the prefill is over, as the
+        // window and, in an open loop, the schedule let it
+        future<> send_requests(bool prefill) {
+            _next_send = clock_type::now();
+            return repeat([this, prefill] {
+                if (prefill ? _prefill_key >= _client._cfg.keys : _client._done) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                auto open_loop = !prefill && _client.open_loop();
+                auto scheduled = make_ready_future<>();
+                if (open_loop) {
+                    auto now = clock_type::now();
+                    if (_next_send > now) {
+                        scheduled = sleep(_next_send - now);
+                    }
+                }
+                return scheduled.then([this] {
+                    return _window.wait();
+                }).then([this, prefill, open_loop] {
+                    request r;
+                    r.get = !prefill && _client.next_is_get();
+                    r.keys = r.get ? _client._cfg.multiget : 1;
+                    // an open loop measures the latency from when the
+                    // request was due, so that a slow server can't hide
+                    // its latency by delaying the requests
+                    r.start = open_loop ? _next_send : clock_type::now();
+                    _next_send += _client.interval();
+                    uint64_t set_key = 0;
+                    if (prefill) {
+                        set_key = _prefill_key;
+                        _prefill_key += _client._cfg.total_conn;
+                    } else if (!r.get) {
+                        set_key = _client.next_key();
+                    }
+                    _inflight.push_back(r);
+                    _pending.signal();
+                    return send(r, set_key).then([] {
+                        return stop_iteration::no;
+                    });
+                });
+            }).handle_exception([this] (std::exception_ptr ep) {
+                if (!_error) {
+                    _error = ep;
+                }
+            }).finally([this] {
+                _pending.signal();
+            });
+        }
+        future<> receive_responses() {
+            return repeat([this] {
+                return _pending.wait().then([this] {
+                    if (_inflight.empty()) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    auto r = _inflight.front();
+                    auto received = _client._binary ? receive_binary(r) : receive_ascii(r);
+                    return received.then([this, r] {
+                        _inflight.pop_front();
+                        _window.signal();
+                        if (_client._recording) {
+                            auto latency = clock_type::now() - r.start;
+                            (r.get ? _client.stats().gets : _client.stats().sets)++;
+                            _client.stats().latency.record(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+                        }
+                        return stop_iteration::no;
+                    });
+                });
+            }).handle_exception([this] (std::exception_ptr ep) {
+                if (!_error) {
+                    _error = ep;
+                }
+                _window.broken();
+            });
+        }
+    public:
+        connection(memcached_client& client, connected_socket&& fd, uint64_t first_key)
+            : _client(client)
+            , _fd(std::move(fd))
+            , _in(_fd.input())
+            , _out(_fd.output())
+            , _prefill_key(first_key) {
+        }
+        // Sets each key of the connection once (prefill), or runs the
+        // workload until the client is done
+        future<> run(bool prefill) {
+            auto depth = prefill ? prefill_pipeline : _client.open_loop() ? _client._cfg.max_outstanding : _client._cfg.pipeline;
+            _window.signal(depth);
+            auto received = receive_responses();
+            return when_all(send_requests(prefill), std::move(received)).then([this, depth] (auto) {
+                if (_error) {
+                    return make_exception_future<>(_error);
+                }
+                _window.consume(depth);
+                return make_ready_future<>();
+            });
+        }
+        future<> close() {
+            return _out.close();
+        }
+    };
+private:
+    bool open_loop() const {
+        return _cfg.rate > 0;
+    }
+    // Between two requests of a connection, in an open loop
+    clock_type::duration interval() const {
+        if (!open_loop()) {
+            return clock_type::duration(0);
+        }
+        return std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(_cfg.total_conn / _cfg.rate));
+    }
+    uint64_t next_key() {
+        return _keys->next(_rng);
+    }
+    unsigned next_value_size() {
+        return _value_size(_rng);
+    }
+    bool next_is_get() {
+        return _is_get(_rng);
+    }
+    load_stats& stats() {
+        return _stats;
+    }
+    // Runs func(connection&) on all connections
+    template <typename Func>
+    future<> for_each_connection(Func func) {
+        return parallel_for_each(_connections, [func] (std::unique_ptr<connection>& c) {
+            return func(*c).handle_exception([] (std::exception_ptr ep) {
+                print("memcached connection error on cpu %u: %s\n", engine().cpu_id(), ep);
+            });
+        });
+    }
+public:
+    explicit memcached_client(workload_config cfg)
+        : _cfg(std::move(cfg))
+        , _binary(_cfg.protocol == "binary")
+        , _rng(std::random_device()() + engine().cpu_id())
+        , _value_size(_cfg.value_size_min, std::max(_cfg.value_size_min, _cfg.value_size_max))
+        , _is_get(_cfg.get_ratio)
+        , _value(sstring::initialized_later(), std::max(_cfg.value_size_min, _cfg.value_size_max))
+        , _run_timer([this] { _done = true; }) {
+        if (_cfg.key_distribution == "zipfian") {
+            _keys = std::make_unique<zipfian_keys>(_cfg.keys, _cfg.zipf_exponent);
+        } else {
+            _keys = std::make_unique<uniform_keys>(_cfg.keys);
+        }
+        std::fill(_value.begin(), _value.end(), 'x');
+    }
+
+    future<> connect(ipv4_addr server_addr) {
+        auto conn_per_core = _cfg.total_conn / smp::count;
+        return parallel_for_each(boost::irange(0u, conn_per_core), [this, server_addr, conn_per_core] (unsigned i) {
+            return engine().net().connect(make_ipv4_address(server_addr)).then([this, i, conn_per_core] (connected_socket fd) {
+                auto first_key = engine().cpu_id() * conn_per_core + i;
+                _connections.push_back(std::make_unique<connection>(*this, std::move(fd), first_key));
+            });
+        });
+    }
+
+    // Stores every key once, so that the gets of the run can hit
+    future<> prefill() {
+        return for_each_connection([] (connection& c) {
+            return c.run(true);
+        });
+    }
+
+    future<> run(unsigned duration) {
+        _recording = true;
+        _run_timer.arm(std::chrono::seconds(duration));
+        return for_each_connection([] (connection& c) {
+            return c.run(false);
+        }).then([this] {
+            _recording = false;
+        });
+    }
+
+    future<load_stats> get_stats() {
+        return make_ready_future<load_stats>(_stats);
+    }
+
+    future<> stop() {
+        return for_each_connection([] (connection& c) {
+            return c.close();
+        });
+    }
+};
+
+namespace bpo = boost::program_options;
+
+int main(int ac, char** av) {
+    app_template app;
+    app.add_options()
+        ("server,s", bpo::value<std::string>()->default_value("127.0.0.1:11211"), "Server address")
+        ("conn,c", bpo::value<unsigned>()->default_value(0), "total connections (default: one per cpu)")
+        ("duration,d", bpo::value<unsigned>()->default_value(10), "duration of the test in seconds")
+        ("protocol", bpo::value<std::string>()->default_value("ascii"), "ascii or binary")
+        ("keys", bpo::value<uint64_t>()->default_value(100000), "number of distinct keys")
+        ("key-prefix", bpo::value<std::string>()->default_value("key:"), "prefix of the keys, which end with their number")
+        ("key-distribution", bpo::value<std::string>()->default_value("uniform"), "uniform or zipfian")
+        ("zipf-exponent", bpo::value<double>()->default_value(0.99), "exponent of the zipfian distribution, in (0, 1)")
+        ("value-size", bpo::value<unsigned>()->default_value(100), "size of the values set, in bytes")
+        ("value-size-max", bpo::value<unsigned>()->default_value(0),
+             "if larger than value-size, the values' sizes are uniformly distributed between the two")
+        ("get-ratio", bpo::value<double>()->default_value(0.9), "fraction of the requests that are gets")
+        ("multiget", bpo::value<unsigned>()->default_value(1), "keys per get")
+        ("rate", bpo::value<double>()->default_value(0),
+             "requests per second over all connections, sent whether or not the previous ones were answered; "
+             "if 0, each connection sends a request when one is answered")
+        ("pipeline", bpo::value<unsigned>()->default_value(1), "requests in flight per connection, with a rate of 0")
+        ("max-outstanding", bpo::value<unsigned>()->default_value(1000),
+             "most requests in flight per connection with a rate; later ones wait, and their wait counts in the latency")
+        ("prefill", "set every key once before the run");
+
+    return app.run(ac, av, [&app] () -> future<int> {
+        auto& config = app.configuration();
+        auto server = config["server"].as<std::string>();
+        workload_config cfg;
+        cfg.protocol = config["protocol"].as<std::string>();
+        cfg.keys = config["keys"].as<uint64_t>();
+        cfg.key_prefix = config["key-prefix"].as<std::string>();
+        cfg.key_distribution = config["key-distribution"].as<std::string>();
+        cfg.zipf_exponent = config["zipf-exponent"].as<double>();
+        cfg.value_size_min = config["value-size"].as<unsigned>();
+        cfg.value_size_max = config["value-size-max"].as<unsigned>();
+        cfg.get_ratio = config["get-ratio"].as<double>();
+        cfg.multiget = config["multiget"].as<unsigned>();
+        cfg.rate = config["rate"].as<double>();
+        cfg.pipeline = config["pipeline"].as<unsigned>();
+        cfg.max_outstanding = config["max-outstanding"].as<unsigned>();
+        cfg.total_conn = config["conn"].as<unsigned>() ? config["conn"].as<unsigned>() : smp::count;
+        auto duration = config["duration"].as<unsigned>();
+        auto prefill = config.count("prefill");
+
+        if (cfg.total_conn % smp::count != 0) {
+            print("Error: conn needs to be n * cpu_nr\n");
+            return make_ready_future<int>(-1);
+        }
+        if (cfg.protocol != "ascii" && cfg.protocol != "binary") {
+            print("Error: unknown protocol %s\n", cfg.protocol);
+            return make_ready_future<int>(-1);
+        }
+        if (cfg.key_distribution != "uniform" && cfg.key_distribution != "zipfian") {
+            print("Error: unknown key distribution %s\n", cfg.key_distribution);
+            return make_ready_future<int>(-1);
+        }
+        if (cfg.key_distribution == "zipfian" && !(cfg.zipf_exponent > 0 && cfg.zipf_exponent < 1)) {
+            print("Error: zipf-exponent needs to be in (0, 1)\n");
+            return make_ready_future<int>(-1);
+        }
+        if (!cfg.keys || !cfg.multiget || !cfg.pipeline || !cfg.max_outstanding
+                || cfg.get_ratio < 0 || cfg.get_ratio > 1 || cfg.rate < 0) {
+            print("Error: keys, multiget, pipeline and max-outstanding need to be positive, "
+                    "get-ratio in [0, 1] and rate non-negative\n");
+            return make_ready_future<int>(-1);
+        }
+
+        auto clients = new distributed<memcached_client>;
+        print("========== memwreck ============\n");
+        print("Server: %s (%s)\n", server, cfg.protocol);
+        print("Connections: %u\n", cfg.total_conn);
+        print("Keys: %u, %s\n", cfg.keys, cfg.key_distribution);
+        print("Gets: %.0f%%, %u keys each\n", cfg.get_ratio * 100, cfg.multiget);
+        print("Rate: %s\n", cfg.rate ? to_sstring(cfg.rate) + " requests/sec" : sstring("closed loop"));
+        return clients->start(std::move(cfg)).then([clients, server] {
+            return clients->invoke_on_all(&memcached_client::connect, ipv4_addr{server});
+        }).then([clients, prefill] {
+            if (!prefill) {
+                return make_ready_future<>();
+            }
+            return clients->invoke_on_all(&memcached_client::prefill);
+        }).then([clients, duration] {
+            auto started = clock_type::now();
+            return clients->invoke_on_all(&memcached_client::run, duration).then([clients] {
+                return clients->map_reduce(adder<load_stats>(), &memcached_client::get_stats);
+            }).then([started] (load_stats stats) {
+                auto secs = std::chrono::duration<double>(clock_type::now() - started).count();
+                auto& l = stats.latency;
+                print("Total cpus: %u\n", smp::count);
+                print("Total requests: %u (%u gets, %u sets)\n", stats.gets + stats.sets, stats.gets, stats.sets);
+                print("Total time: %f\n", secs);
+                print("Requests/sec: %f\n", (stats.gets + stats.sets) / secs);
+                print("Hit ratio: %f\n", stats.hits + stats.misses ? double(stats.hits) / (stats.hits + stats.misses) : 0);
+                print("Errors: %u\n", stats.errors);
+                print("Latency (us): mean %.1f, p50 %u, p90 %u, p99 %u, p99.9 %u, p99.99 %u, max %u\n",
+                        l.mean(), l.percentile(50), l.percentile(90), l.percentile(99), l.percentile(99.9),
+                        l.percentile(99.99), l.max());
+                print("==========     done     ============\n");
+            });
+        }).then([clients] {
+            return clients->stop().then([clients] {
+                delete clients;
+                return make_ready_future<int>(0);
+            });
+        });
+    });
+}
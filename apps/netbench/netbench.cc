@@ -0,0 +1,463 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+// A benchmark of the network stacks: run it as a server on one machine and
+// as a client on another, both with the same --network-stack (posix, or
+// native over DPDK or virtio), to measure
+//
+//   rr       request/response latency, and rate, of ping-pong messages
+//   stream   throughput of bulk transfers
+//   connect  rate and latency of connection setup
+//   udp      rate of small datagrams, sent one way
+//
+// The client prints the throughput, latency percentiles and the CPU
+// utilization of each shard over the run; the server prints what it
+// received, and its own utilization, every --report-interval seconds.
+//
+// The server listens on --port for rr (it echoes what it reads), on
+// --port + 1 for stream (it discards it), on --port + 2 for connect (it
+// closes the connections it accepts), and on UDP --port for udp.
+
+#include <chrono>
+#include <vector>
+#include <boost/range/irange.hpp>
+#include "core/app-template.hh"
+#include "core/distributed.hh"
+#include "core/future-util.hh"
+#include "core/hdr_histogram.hh"
+#include "core/print.hh"
+#include "core/reactor.hh"
+#include "core/sleep.hh"
+#include "net/api.hh"
+
+using namespace seastar;
+
+using clock_type = steady_clock_type;
+using fseconds = std::chrono::duration<double>;
+
+enum class test_type { rr, stream, connect, udp };
+
+static constexpr uint16_t stream_port_offset = 1;
+static constexpr uint16_t connect_port_offset = 2;
+
+static hdr_histogram make_latency_histogram() {
+    return hdr_histogram(7, 60'000'000); // microseconds
+}
+
+// What a shard did over a run or a report interval; summed over the
+// shards, except for the utilizations, which are by shard
+struct shard_stats {
+    uint64_t ops = 0;
+    uint64_t bytes = 0;
+    uint64_t connections = 0;
+    uint64_t errors = 0;
+    hdr_histogram latency = make_latency_histogram();
+    std::vector<double> utilization = std::vector<double>(smp::count);
+    void operator+=(const shard_stats& o) {
+        ops += o.ops;
+        bytes += o.bytes;
+        connections += o.connections;
+        errors += o.errors;
+        latency += o.latency;
+        for (unsigned i = 0; i < utilization.size(); ++i) {
+            utilization[i] += o.utilization[i];
+        }
+    }
+};
+
+// Measures the fraction of the time the shard is busy, from the reactor's
+// busy time
+class utilization_meter {
+    clock_type::time_point _start = clock_type::now();
+    clock_type::duration _busy = engine().total_busy_time();
+public:
+    double get() const {
+        auto wall = clock_type::now() - _start;
+        return wall.count() ? double((engine().total_busy_time() - _busy).count()) / wall.count() : 0;
+    }
+};
+
+static sstring format_utilization(const std::vector<double>& utilization) {
+    sstring ret;
+    for (auto u : utilization) {
+        ret += sprint("%s%.0f%%", ret.empty() ? "" : " ", u * 100);
+    }
+    return ret;
+}
+
+struct client_config {
+    test_type test;
+    ipv4_addr server;
+    unsigned conn; // per shard
+    size_t size;
+};
+
+class client {
+    client_config _cfg;
+    shard_stats _stats;
+    clock_type::time_point _end;
+private:
+    bool done() const {
+        return clock_type::now() >= _end;
+    }
+    future<> run_rr() {
+        return engine().net().connect(make_ipv4_address(_cfg.server)).then([this] (connected_socket s) {
+            s.set_nodelay(true);
+            return do_with(std::move(s), [this] (connected_socket& s) {
+                return do_with(s.input(), s.output(), temporary_buffer<char>(_cfg.size),
+                        [this] (input_stream<char>& in, output_stream<char>& out, temporary_buffer<char>& msg) {
+                    std::fill_n(msg.get_write(), msg.size(), 'r');
+                    return do_until([this] { return done(); }, [this, &in, &out, &msg] {
+                        auto start = clock_type::now();
+                        return out.write(msg.get(), msg.size()).then([&out] {
+                            return out.flush();
+                        }).then([this, &in] {
+                            return in.read_exactly(_cfg.size);
+                        }).then([this, start] (temporary_buffer<char> reply) {
+                            if (reply.size() != _cfg.size) {
+                                throw std::runtime_error("connection closed by the server");
+                            }
+                            _stats.latency.record(std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - start).count());
+                            _stats.ops++;
+                            _stats.bytes += _cfg.size;
+                        });
+                    }).finally([&out] {
+                        return out.close();
+                    });
+                });
+            });
+        });
+    }
+    future<> run_stream() {
+        auto server = _cfg.server;
+        server.port += stream_port_offset;
+        return engine().net().connect(make_ipv4_address(server)).then([this] (connected_socket s) {
+            return do_with(std::move(s), [this] (connected_socket& s) {
+                return do_with(s.output(), temporary_buffer<char>(_cfg.size), [this] (output_stream<char>& out, temporary_buffer<char>& msg) {
+                    std::fill_n(msg.get_write(), msg.size(), 's');
+                    return do_until([this] { return done(); }, [this, &out, &msg] {
+                        return out.write(msg.get(), msg.size()).then([this] {
+                            _stats.ops++;
+                            _stats.bytes += _cfg.size;
+                        });
+                    }).finally([&out] {
+                        return out.close();
+                    });
+                });
+            });
+        });
+    }
+    future<> run_connect() {
+        auto server = _cfg.server;
+        server.port += connect_port_offset;
+        return do_until([this] { return done(); }, [this, server] {
+            auto start = clock_type::now();
+            return engine().net().connect(make_ipv4_address(server)).then_wrapped([this, start] (future<connected_socket> f) {
+                try {
+                    auto s = f.get0();
+                    _stats.latency.record(std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - start).count());
+                    _stats.ops++;
+                    s.shutdown_output();
+                } catch (...) {
+                    // the server, or the local stack, ran out of ports or
+                    // of room for connections
+                    _stats.errors++;
+                }
+            });
+        });
+    }
+    future<> run_udp() {
+        return do_with(engine().net().make_udp_channel(), [this] (net::udp_channel& chan) {
+            return do_until([this] { return done(); }, [this, &chan] {
+                auto msg = temporary_buffer<char>(_cfg.size);
+                std::fill_n(msg.get_write(), msg.size(), 'u');
+                return chan.send(_cfg.server, net::packet(std::move(msg))).then([this] {
+                    _stats.ops++;
+                    _stats.bytes += _cfg.size;
+                });
+            }).finally([&chan] {
+                chan.close();
+            });
+        });
+    }
+    future<> run_one() {
+        switch (_cfg.test) {
+        case test_type::rr: return run_rr();
+        case test_type::stream: return run_stream();
+        case test_type::connect: return run_connect();
+        case test_type::udp: return run_udp();
+        }
+        abort();
+    }
+public:
+    explicit client(client_config cfg) : _cfg(cfg) {}
+    future<> run(unsigned duration) {
+        _end = clock_type::now() + std::chrono::seconds(duration);
+        auto meter = utilization_meter();
+        return parallel_for_each(boost::irange(0u, _cfg.conn), [this] (unsigned) {
+            return run_one().handle_exception([this] (std::exception_ptr ep) {
+                print("shard %d: %s\n", engine().cpu_id(), ep);
+                _stats.errors++;
+            });
+        }).then([this, meter] {
+            _stats.utilization[engine().cpu_id()] = meter.get();
+        });
+    }
+    shard_stats get_stats() {
+        return _stats;
+    }
+    future<> stop() {
+        return make_ready_future<>();
+    }
+};
+
+class server {
+    uint16_t _port;
+    std::vector<server_socket> _listeners;
+    std::experimental::optional<net::udp_channel> _udp;
+    // the server's ops are the datagrams it received, and its bytes those
+    // of the streams
+    shard_stats _stats;
+    utilization_meter _meter;
+    future<> _loops = make_ready_future<>();
+    bool _stopped = false;
+private:
+    template <typename Handler>
+    future<> accept_loop(server_socket& ss, Handler handler) {
+        return repeat([this, &ss, handler] {
+            return ss.accept().then_wrapped([this, handler] (future<connected_socket, socket_address> f) {
+                if (_stopped) {
+                    f.ignore_ready_future();
+                    return stop_iteration::yes;
+                }
+                auto s = std::get<0>(f.get());
+                _stats.connections++;
+                handler(std::move(s)).handle_exception([] (std::exception_ptr) {});
+                return stop_iteration::no;
+            });
+        });
+    }
+    static future<> echo(connected_socket s) {
+        s.set_nodelay(true);
+        return do_with(std::move(s), [] (connected_socket& s) {
+            return do_with(s.input(), s.output(), [] (input_stream<char>& in, output_stream<char>& out) {
+                return repeat([&in, &out] {
+                    return in.read().then([&out] (temporary_buffer<char> buf) {
+                        if (buf.empty()) {
+                            return make_ready_future<stop_iteration>(stop_iteration::yes);
+                        }
+                        return out.write(std::move(buf)).then([&out] {
+                            return out.flush();
+                        }).then([] {
+                            return stop_iteration::no;
+                        });
+                    });
+                }).finally([&out] {
+                    return out.close();
+                });
+            });
+        });
+    }
+    future<> sink(connected_socket s) {
+        return do_with(std::move(s), [this] (connected_socket& s) {
+            return do_with(s.input(), [this] (input_stream<char>& in) {
+                return repeat([this, &in] {
+                    return in.read().then([this] (temporary_buffer<char> buf) {
+                        _stats.bytes += buf.size();
+                        return buf.empty() ? stop_iteration::yes : stop_iteration::no;
+                    });
+                });
+            });
+        });
+    }
+    future<> udp_loop() {
+        return repeat([this] {
+            return _udp->receive().then_wrapped([this] (future<net::udp_datagram> f) {
+                if (_stopped) {
+                    f.ignore_ready_future();
+                    return stop_iteration::yes;
+                }
+                f.get0();
+                _stats.ops++;
+                return stop_iteration::no;
+            });
+        });
+    }
+public:
+    explicit server(uint16_t port) : _port(port) {}
+    void start() {
+        listen_options lo;
+        lo.reuse_address = true;
+        for (uint16_t offset : { uint16_t(0), stream_port_offset, connect_port_offset }) {
+            _listeners.push_back(engine().listen(make_ipv4_address({uint16_t(_port + offset)}), lo));
+        }
+        _udp = engine().net().make_udp_channel(ipv4_addr{_port});
+        _loops = when_all(
+            accept_loop(_listeners[0], &server::echo),
+            accept_loop(_listeners[1], [this] (connected_socket s) { return sink(std::move(s)); }),
+            accept_loop(_listeners[2], [] (connected_socket s) {
+                s.shutdown_output();
+                return make_ready_future<>();
+            }),
+            udp_loop()).discard_result();
+    }
+    // Returns the stats since the last call
+    shard_stats take_stats() {
+        auto ret = std::move(_stats);
+        ret.utilization[engine().cpu_id()] = _meter.get();
+        _stats = shard_stats();
+        _meter = utilization_meter();
+        return ret;
+    }
+    future<> stop() {
+        _stopped = true;
+        for (auto& l : _listeners) {
+            l.abort_accept();
+        }
+        if (_udp) {
+            _udp->close();
+        }
+        // connections still open are left to the reactor's exit
+        return std::move(_loops);
+    }
+};
+
+namespace bpo = boost::program_options;
+
+int main(int ac, char** av) {
+    app_template app;
+    app.add_options()
+        ("mode", bpo::value<std::string>()->default_value("client"), "client or server")
+        ("server,s", bpo::value<std::string>()->default_value("127.0.0.1"), "server address, for the client")
+        ("port", bpo::value<uint16_t>()->default_value(10000), "first port of the server")
+        ("test", bpo::value<std::string>()->default_value("rr"), "rr, stream, connect or udp")
+        ("conn,c", bpo::value<unsigned>()->default_value(1), "connections, or concurrent connects or senders, per shard")
+        ("size", bpo::value<size_t>()->default_value(0), "message size, in bytes (default: 64 for rr and udp, 64K for stream)")
+        ("duration,d", bpo::value<unsigned>()->default_value(10), "duration of the test in seconds")
+        ("report-interval", bpo::value<unsigned>()->default_value(1), "seconds between the server's reports");
+
+    return app.run(ac, av, [&app] () -> future<int> {
+        auto& config = app.configuration();
+        auto mode = config["mode"].as<std::string>();
+        auto port = config["port"].as<uint16_t>();
+        if (mode == "server") {
+            auto servers = new distributed<server>;
+            auto interval = std::chrono::seconds(std::max(1u, config["report-interval"].as<unsigned>()));
+            return servers->start(port).then([servers] {
+                return servers->invoke_on_all(&server::start);
+            }).then([servers, interval, port] {
+                print("netbench server listening on port %d (rr), %d (stream), %d (connect) and UDP %d\n",
+                        port, port + stream_port_offset, port + connect_port_offset, port);
+                auto report = new timer<>([servers, interval] {
+                    servers->map_reduce(adder<shard_stats>(), &server::take_stats).then([interval] (shard_stats s) {
+                        auto secs = fseconds(interval).count();
+                        print("stream %.1f MB/s, udp %.0f pps, connections %.0f/s, cpu: %s\n",
+                                s.bytes / secs / 1e6, s.ops / secs, s.connections / secs, format_utilization(s.utilization));
+                    });
+                });
+                report->arm_periodic(interval);
+                // serve until interrupted
+                auto stopped = make_lw_shared<promise<int>>();
+                engine().at_exit([servers, report, stopped] {
+                    report->cancel();
+                    return servers->stop().then([servers, report, stopped] {
+                        delete report;
+                        delete servers;
+                        stopped->set_value(0);
+                    });
+                });
+                return stopped->get_future();
+            });
+        }
+        if (mode != "client") {
+            print("Error: unknown mode %s\n", mode);
+            return make_ready_future<int>(-1);
+        }
+        client_config cfg;
+        auto test = config["test"].as<std::string>();
+        if (test == "rr") {
+            cfg.test = test_type::rr;
+        } else if (test == "stream") {
+            cfg.test = test_type::stream;
+        } else if (test == "connect") {
+            cfg.test = test_type::connect;
+        } else if (test == "udp") {
+            cfg.test = test_type::udp;
+        } else {
+            print("Error: unknown test %s\n", test);
+            return make_ready_future<int>(-1);
+        }
+        cfg.server = ipv4_addr(config["server"].as<std::string>(), port);
+        cfg.conn = config["conn"].as<unsigned>();
+        cfg.size = config["size"].as<size_t>();
+        if (!cfg.size) {
+            cfg.size = cfg.test == test_type::stream ? 64 * 1024 : 64;
+        }
+        auto duration = config["duration"].as<unsigned>();
+        if (!cfg.conn || !duration) {
+            print("Error: conn and duration need to be positive\n");
+            return make_ready_future<int>(-1);
+        }
+
+        auto clients = new distributed<client>;
+        print("========== netbench ============\n");
+        print("Server: %s, test: %s, size: %u\n", cfg.server, test, cfg.size);
+        print("Connections: %u per shard, %u shards\n", cfg.conn, smp::count);
+        return clients->start(cfg).then([clients, duration, test = cfg.test] {
+            auto started = clock_type::now();
+            return clients->invoke_on_all(&client::run, duration).then([clients] {
+                return clients->map_reduce(adder<shard_stats>(), &client::get_stats);
+            }).then([started, test] (shard_stats stats) {
+                auto secs = fseconds(clock_type::now() - started).count();
+                auto& l = stats.latency;
+                print("Total time: %f\n", secs);
+                switch (test) {
+                case test_type::rr:
+                    print("Requests/sec: %f\n", stats.ops / secs);
+                    break;
+                case test_type::stream:
+                    print("Throughput: %.1f MB/s\n", stats.bytes / secs / 1e6);
+                    break;
+                case test_type::connect:
+                    print("Connections/sec: %f\n", stats.ops / secs);
+                    break;
+                case test_type::udp:
+                    print("Datagrams/sec: %f (sent)\n", stats.ops / secs);
+                    break;
+                }
+                if (l.count()) {
+                    print("Latency (us): mean %.1f, p50 %u, p90 %u, p99 %u, p99.9 %u, p99.99 %u, max %u\n",
+                            l.mean(), l.percentile(50), l.percentile(90), l.percentile(99), l.percentile(99.9),
+                            l.percentile(99.99), l.max());
+                }
+                print("Errors: %u\n", stats.errors);
+                print("CPU utilization by shard: %s\n", format_utilization(stats.utilization));
+                print("==========     done     ============\n");
+            });
+        }).then([clients] {
+            return clients->stop().then([clients] {
+                delete clients;
+                return make_ready_future<int>(0);
+            });
+        });
+    });
+}
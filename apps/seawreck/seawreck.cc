@@ -26,8 +26,12 @@
 #include "core/future-util.hh"
 #include "core/distributed.hh"
 #include "core/semaphore.hh"
+#include "core/circular_buffer.hh"
+#include "core/hdr_histogram.hh"
 #include "core/future-util.hh"
+#include "util/log.hh"
 #include <chrono>
+#include <random>
 
 using namespace seastar;
 
@@ -38,11 +42,29 @@ void http_debug(const char* fmt, Args&&... args) {
 #endif
 }
 
+using clock_type = steady_clock_type;
+
+struct load_config {
+    unsigned duration;
+    unsigned conn_per_core;
+    unsigned reqs_per_conn;
+    // requests per second on each shard; 0 for a closed loop, where each
+    // connection sends a request as soon as a response comes back
+    double rate;
+    bool poisson;
+    // requests in flight on a connection, at most
+    unsigned pipeline;
+    std::vector<sstring> requests; // serialized, sent in turn
+};
+
+// Latencies are in microseconds, to within 1/128
+static hdr_histogram make_latency_histogram() {
+    return hdr_histogram(7, uint64_t(1) << 36);
+}
+
 class http_client {
 private:
-    unsigned _duration;
-    unsigned _conn_per_core;
-    unsigned _reqs_per_conn;
+    load_config _cfg;
     std::vector<connected_socket> _sockets;
     semaphore _conn_connected{0};
     semaphore _conn_finished{0};
@@ -50,13 +72,45 @@ class http_client {
     bool _timer_based;
     bool _timer_done{false};
     uint64_t _total_reqs{0};
+    hdr_histogram _latency = make_latency_histogram();
+    unsigned _next_request = 0;
 public:
-    http_client(unsigned duration, unsigned total_conn, unsigned reqs_per_conn)
-        : _duration(duration)
-        , _conn_per_core(total_conn / smp::count)
-        , _reqs_per_conn(reqs_per_conn)
-        , _run_timer([this] { _timer_done = true; })
-        , _timer_based(reqs_per_conn == 0) {
+    class connection;
+private:
+    std::vector<connection*> _conns;
+    // Open loop: arrivals are generated by a timer, independently of the
+    // responses. A request that is due while all connections are full
+    // waits here, and its latency still counts from when it was due, so
+    // that a slow server cannot hide the queueing delay it causes.
+    timer<> _arrivals;
+    clock_type::time_point _next_arrival;
+    std::mt19937 _random{std::random_device()()};
+    std::exponential_distribution<double> _interval;
+    circular_buffer<clock_type::time_point> _backlog;
+    unsigned _next_conn = 0;
+    uint64_t _max_backlog = 0;
+public:
+    http_client(load_config cfg)
+        : _cfg(std::move(cfg))
+        , _run_timer([this] { _timer_done = true; on_timer_done(); })
+        , _timer_based(_cfg.reqs_per_conn == 0 || open_loop())
+        , _arrivals([this] { on_arrivals(); })
+        , _interval(open_loop() ? _cfg.rate : 1) {
+    }
+
+    bool open_loop() const {
+        return _cfg.rate > 0;
+    }
+
+    const sstring& next_request() {
+        auto& r = _cfg.requests[_next_request];
+        _next_request = (_next_request + 1) % _cfg.requests.size();
+        return r;
+    }
+
+    void record(clock_type::time_point intended) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - intended).count();
+        _latency.record(us);
     }
 
     class connection {
@@ -67,6 +121,13 @@ class http_client {
         http_response_parser _parser;
         http_client* _http_client;
         uint64_t _nr_done{0};
+        uint64_t _nr_sent{0};
+        // when the requests in flight were meant to be sent, oldest first
+        circular_buffer<clock_type::time_point> _in_flight;
+        unsigned _unsent = 0;
+        bool _writing = false;
+        bool _closing = false;
+        semaphore _responses_due{0};
     public:
         connection(connected_socket&& fd, http_client* client)
             : _fd(std::move(fd))
@@ -79,77 +140,215 @@ class http_client {
             return _nr_done;
         }
 
+        bool has_room() const {
+            return !_closing && _in_flight.size() < _http_client->_cfg.pipeline;
+        }
+
+        void send(clock_type::time_point intended) {
+            _in_flight.push_back(intended);
+            ++_nr_sent;
+            ++_unsent;
+            _responses_due.signal();
+            if (!_writing) {
+                _writing = true;
+                write_loop();
+            }
+        }
+
+        // Stops reading once the requests in flight are answered
+        void close() {
+            _closing = true;
+            _responses_due.signal();
+        }
+
+        // Writes the requests that were sent, a batch at a time and with
+        // one flush per batch
+        void write_loop() {
+            repeat([this] {
+                if (!_unsent) {
+                    _writing = false;
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return do_with(std::exchange(_unsent, 0), [this] (unsigned& n) {
+                    return repeat([this, &n] {
+                        if (!n) {
+                            return make_ready_future<stop_iteration>(stop_iteration::yes);
+                        }
+                        --n;
+                        return _write_buf.write(_http_client->next_request()).then([] {
+                            return stop_iteration::no;
+                        });
+                    });
+                }).then([this] {
+                    return _write_buf.flush();
+                }).then([] {
+                    return stop_iteration::no;
+                });
+            }).handle_exception([this] (auto ep) {
+                _writing = false;
+                _closing = true;
+                print("http request error: %s\n", ep);
+            });
+        }
+
+        // Reads the response to the oldest request in flight
+        future<bool> read_response() {
+            _parser.init();
+            return _read_buf.consume(_parser).then([this] {
+                // Read HTTP response header first
+                if (_parser.eof()) {
+                    return make_ready_future<bool>(false);
+                }
+                auto _rsp = _parser.get_parsed_response();
+                auto it = _rsp->_headers.find("Content-Length");
+                if (it == _rsp->_headers.end()) {
+                    print("Error: HTTP response does not contain: Content-Length\n");
+                    return make_ready_future<bool>(false);
+                }
+                auto content_len = std::stoi(it->second);
+                http_debug("Content-Length = %d\n", content_len);
+                // Read HTTP response body
+                return _read_buf.read_exactly(content_len).then([this] (temporary_buffer<char> buf) {
+                    _nr_done++;
+                    http_debug("%s\n", buf.get());
+                    _http_client->record(_in_flight.front());
+                    _in_flight.pop_front();
+                    return true;
+                });
+            });
+        }
+
         future<> do_req() {
-            return _write_buf.write("GET / HTTP/1.1\r\nHost: 127.0.0.1:10000\r\n\r\n").then([this] {
-                return _write_buf.flush();
-            }).then([this] {
-                _parser.init();
-                return _read_buf.consume(_parser).then([this] {
-                    // Read HTTP response header first
-                    if (_parser.eof()) {
-                        return make_ready_future<>();
-                    }
-                    auto _rsp = _parser.get_parsed_response();
-                    auto it = _rsp->_headers.find("Content-Length");
-                    if (it == _rsp->_headers.end()) {
-                        print("Error: HTTP response does not contain: Content-Length\n");
-                        return make_ready_future<>();
+            if (!_http_client->open_loop()) {
+                // closed loop: keep the pipeline full
+                while (has_room() && !_http_client->done(_nr_sent)) {
+                    send(clock_type::now());
+                }
+            }
+            return repeat([this] {
+                return _responses_due.wait().then([this] {
+                    if (_in_flight.empty()) {
+                        // only a close() leaves nothing to read
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
                     }
-                    auto content_len = std::stoi(it->second);
-                    http_debug("Content-Length = %d\n", content_len);
-                    // Read HTTP response body
-                    return _read_buf.read_exactly(content_len).then([this] (temporary_buffer<char> buf) {
-                        _nr_done++;
-                        http_debug("%s\n", buf.get());
-                        if (_http_client->done(_nr_done)) {
-                            return make_ready_future();
-                        } else {
-                            return do_req();
+                    return read_response().then([this] (bool ok) {
+                        if (!ok) {
+                            _closing = true;
+                            return stop_iteration::yes;
                         }
+                        if (_http_client->open_loop()) {
+                            _http_client->on_room(this);
+                        } else if (!_http_client->done(_nr_sent)) {
+                            send(clock_type::now());
+                        } else if (_in_flight.empty()) {
+                            return stop_iteration::yes;
+                        }
+                        return stop_iteration::no;
                     });
                 });
             });
         }
     };
 
+    // Sends the requests that are due, catching up if the timer fired late
+    void on_arrivals() {
+        auto now = clock_type::now();
+        while (_next_arrival <= now) {
+            dispatch(_next_arrival);
+            _next_arrival += next_interval();
+        }
+        if (!_timer_done) {
+            _arrivals.arm(_next_arrival);
+        }
+    }
+
+    clock_type::duration next_interval() {
+        double secs = _cfg.poisson ? _interval(_random) : 1 / _cfg.rate;
+        return std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(secs));
+    }
+
+    void dispatch(clock_type::time_point intended) {
+        for (unsigned i = 0; i < _conns.size(); ++i) {
+            auto c = _conns[_next_conn];
+            _next_conn = (_next_conn + 1) % _conns.size();
+            if (c->has_room()) {
+                c->send(intended);
+                return;
+            }
+        }
+        _backlog.push_back(intended);
+        _max_backlog = std::max<uint64_t>(_max_backlog, _backlog.size());
+    }
+
+    void on_room(connection* c) {
+        while (!_backlog.empty() && c->has_room()) {
+            c->send(_backlog.front());
+            _backlog.pop_front();
+        }
+    }
+
+    void on_timer_done() {
+        if (!open_loop()) {
+            return;
+        }
+        _arrivals.cancel();
+        // what was never sent is not waited for, but is reported
+        if (!_backlog.empty()) {
+            print("Requests never sent on cpu %2d: %ld\n", engine().cpu_id(), _backlog.size());
+        }
+        _backlog.pop_front_n(_backlog.size());
+        for (auto c : _conns) {
+            c->close();
+        }
+    }
+
     future<uint64_t> total_reqs() {
         print("Requests on cpu %2d: %ld\n", engine().cpu_id(), _total_reqs);
+        if (open_loop()) {
+            print("Largest backlog on cpu %2d: %ld\n", engine().cpu_id(), _max_backlog);
+        }
         return make_ready_future<uint64_t>(_total_reqs);
     }
 
+    hdr_histogram latency() const {
+        return _latency;
+    }
+
     bool done(uint64_t nr_done) {
         if (_timer_based) {
             return _timer_done;
         } else {
-            return nr_done >= _reqs_per_conn;
+            return nr_done >= _cfg.reqs_per_conn;
         }
     }
 
     future<> connect(ipv4_addr server_addr) {
         // Establish all the TCP connections first
-        for (unsigned i = 0; i < _conn_per_core; i++) {
+        for (unsigned i = 0; i < _cfg.conn_per_core; i++) {
             engine().net().connect(make_ipv4_address(server_addr)).then([this] (connected_socket fd) {
                 _sockets.push_back(std::move(fd));
                 http_debug("Established connection %6d on cpu %3d\n", _conn_connected.current(), engine().cpu_id());
                 _conn_connected.signal();
             }).or_terminate();
         }
-        return _conn_connected.wait(_conn_per_core);
+        return _conn_connected.wait(_cfg.conn_per_core);
     }
 
     future<> run() {
         // All connected, start HTTP request
-        http_debug("Established all %6d tcp connections on cpu %3d\n", _conn_per_core, engine().cpu_id());
+        http_debug("Established all %6d tcp connections on cpu %3d\n", _cfg.conn_per_core, engine().cpu_id());
         if (_timer_based) {
-            _run_timer.arm(std::chrono::seconds(_duration));
+            _run_timer.arm(std::chrono::seconds(_cfg.duration));
         }
         for (auto&& fd : _sockets) {
-            auto conn = new connection(std::move(fd), this);
+            _conns.push_back(new connection(std::move(fd), this));
+        }
+        _sockets.clear();
+        for (auto conn : _conns) {
             conn->do_req().then_wrapped([this, conn] (auto&& f) {
                 http_debug("Finished connection %6d on cpu %3d\n", _conn_finished.current(), engine().cpu_id());
                 _total_reqs += conn->nr_done();
                 _conn_finished.signal();
-                delete conn;
                 try {
                     f.get();
                 } catch (std::exception& ex) {
@@ -157,9 +356,18 @@ class http_client {
                 }
             });
         }
+        if (open_loop()) {
+            _next_arrival = clock_type::now();
+            on_arrivals();
+        }
 
         // All finished
-        return _conn_finished.wait(_conn_per_core);
+        return _conn_finished.wait(_cfg.conn_per_core).then([this] {
+            for (auto conn : _conns) {
+                delete conn;
+            }
+            _conns.clear();
+        });
     }
     future<> stop() {
         return make_ready_future();
@@ -174,7 +382,15 @@ int main(int ac, char** av) {
         ("server,s", bpo::value<std::string>()->default_value("192.168.66.100:10000"), "Server address")
         ("conn,c", bpo::value<unsigned>()->default_value(100), "total connections")
         ("reqs,r", bpo::value<unsigned>()->default_value(0), "reqs per connection")
-        ("duration,d", bpo::value<unsigned>()->default_value(10), "duration of the test in seconds)");
+        ("duration,d", bpo::value<unsigned>()->default_value(10), "duration of the test in seconds)")
+        ("rate", bpo::value<double>()->default_value(0),
+                "target requests per second, over all connections (open loop); 0 sends each request when the previous response "
+                "arrives (closed loop)")
+        ("arrivals", bpo::value<std::string>()->default_value("poisson"), "open loop arrivals: poisson or constant")
+        ("pipeline", bpo::value<unsigned>()->default_value(1), "requests in flight on each connection, at most")
+        ("path", bpo::value<std::vector<std::string>>()->composing(), "paths to request, in turn (may be repeated; default /)")
+        ("method", bpo::value<std::string>()->default_value("GET"), "request method")
+        ("body", bpo::value<std::string>()->default_value(""), "request body");
 
     return app.run(ac, av, [&app] () -> future<int> {
         auto& config = app.configuration();
@@ -182,11 +398,39 @@ int main(int ac, char** av) {
         auto reqs_per_conn = config["reqs"].as<unsigned>();
         auto total_conn= config["conn"].as<unsigned>();
         auto duration = config["duration"].as<unsigned>();
+        auto rate = config["rate"].as<double>();
+        auto arrivals = config["arrivals"].as<std::string>();
+        auto method = config["method"].as<std::string>();
+        auto body = config["body"].as<std::string>();
+        std::vector<std::string> paths = {"/"};
+        if (config.count("path")) {
+            paths = config["path"].as<std::vector<std::string>>();
+        }
 
         if (total_conn % smp::count != 0) {
             print("Error: conn needs to be n * cpu_nr\n");
             return make_ready_future<int>(-1);
         }
+        if (arrivals != "poisson" && arrivals != "constant") {
+            print("Error: arrivals must be poisson or constant\n");
+            return make_ready_future<int>(-1);
+        }
+
+        load_config cfg;
+        cfg.duration = duration;
+        cfg.conn_per_core = total_conn / smp::count;
+        cfg.reqs_per_conn = reqs_per_conn;
+        cfg.rate = rate / smp::count;
+        cfg.poisson = arrivals == "poisson";
+        cfg.pipeline = std::max(config["pipeline"].as<unsigned>(), 1u);
+        for (auto&& path : paths) {
+            auto req = sprint("%s %s HTTP/1.1\r\nHost: %s\r\n", method, path, server);
+            if (!body.empty() || method == "POST" || method == "PUT") {
+                req += sprint("Content-Length: %d\r\n", body.size());
+            }
+            req += "\r\n" + body;
+            cfg.requests.push_back(std::move(req));
+        }
 
         auto http_clients = new distributed<http_client>;
 
@@ -195,8 +439,13 @@ int main(int ac, char** av) {
         print("========== http_client ============\n");
         print("Server: %s\n", server);
         print("Connections: %u\n", total_conn);
-        print("Requests/connection: %s\n", reqs_per_conn == 0 ? "dynamic (timer based)" : std::to_string(reqs_per_conn));
-        return http_clients->start(std::move(duration), std::move(total_conn), std::move(reqs_per_conn)).then([http_clients, server] {
+        if (rate > 0) {
+            print("Target rate: %f requests/sec, %s arrivals\n", rate, arrivals);
+        } else {
+            print("Requests/connection: %s\n", reqs_per_conn == 0 ? "dynamic (timer based)" : std::to_string(reqs_per_conn));
+        }
+        print("Pipeline depth: %u\n", cfg.pipeline);
+        return http_clients->start(std::move(cfg)).then([http_clients, server] {
             return http_clients->invoke_on_all(&http_client::connect, ipv4_addr{server});
         }).then([http_clients] {
             return http_clients->invoke_on_all(&http_client::run);
@@ -211,6 +460,16 @@ int main(int ac, char** av) {
            print("Total requests: %u\n", total_reqs);
            print("Total time: %f\n", secs);
            print("Requests/sec: %f\n", static_cast<double>(total_reqs) / secs);
+           return http_clients->map_reduce0([] (http_client& c) { return c.latency(); }, make_latency_histogram(),
+                   [] (hdr_histogram a, const hdr_histogram& b) {
+               a += b;
+               return a;
+           });
+        }).then([http_clients] (hdr_histogram latency) {
+           print("Latency (us): min %d mean %.1f max %d\n", latency.min(), latency.mean(), latency.max());
+           for (auto p : {50.0, 90.0, 99.0, 99.9, 99.99, 100.0}) {
+               print("  %7.3f%%  %d\n", p, latency.percentile(p));
+           }
            print("==========     done     ============\n");
            return http_clients->stop().then([http_clients] {
                // FIXME: If we call engine().exit(0) here to exit when
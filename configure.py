@@ -224,6 +224,11 @@ tests = [
     'tests/tcp_test',
     'tests/futures_test',
     'tests/alloc_test',
+    'tests/allocation_test',
+    'tests/memory_account_test',
+    'tests/object_pool_test',
+    'tests/node_shared_test',
+    'tests/cross_shard_queue_test',
     'tests/foreign_ptr_test',
     'tests/smp_test',
     'tests/thread_test',
@@ -236,6 +241,9 @@ tests = [
     'tests/defer_test',
     'tests/httpd',
     'tests/memcached/test_ascii_parser',
+    'tests/memcached/test_binary_parser',
+    'tests/memcached/test_item_index',
+    'tests/memcached/test_hot_keys',
     'tests/tcp_sctp_server',
     'tests/tcp_sctp_client',
     'tests/allocator_test',
@@ -246,33 +254,66 @@ tests = [
     'tests/checked_ptr_test',
     'tests/slab_test',
     'tests/fstream_test',
+    'tests/block_cache_test',
+    'tests/tracing_test',
+    'tests/metrics_mmap_test',
+    'tests/block_stream_test',
+    'tests/tcp_congestion_test',
+    'tests/tcp_reassembly_test',
+    'tests/gso_test',
+    'tests/gro_test',
+    'tests/ipv6_test',
+    'tests/checksum_test',
+    'tests/rss_balance_test',
+    'tests/conntrack_test',
     'tests/distributed_test',
     'tests/rpc',
     'tests/semaphore_test',
     'tests/expiring_fifo_test',
     'tests/packet_test',
+    'tests/rope_test',
     'tests/tls_test',
     'tests/fair_queue_test',
     'tests/rpc_test',
     'tests/connect_test',
+    'tests/udp_batch_test',
+    'tests/tcp_zero_copy_test',
     'tests/chunked_fifo_test',
     'tests/circular_buffer_test',
     'tests/perf/perf_fstream',
+    'tests/perf/perf_timers',
+    'tests/perf/perf_future',
+    'tests/perf/perf_noncopyable_function',
+    'tests/perf/rpc_perf',
+    'tests/perf/perf_micro',
     'tests/json_formatter_test',
     'tests/dns_test',
     'tests/execution_stage_test',
+    'tests/coroutines_test',
+    'tests/scheduling_group_test',
     'tests/lowres_clock_test',
+    'tests/tsc_clock_test',
     'tests/program_options_test',
     'tests/tuple_utils_test',
     'tests/tls_echo_server',
     'tests/tls_simple_client',
     'tests/circular_buffer_fixed_capacity_test',
     'tests/noncopyable_function_test',
+    'tests/flat_hash_map_test',
+    'tests/simple_stream_test',
+    'tests/timer_wheel_test',
+    'tests/adaptive_poll_test',
+    'tests/arena_test',
+    'tests/hdr_histogram_test',
+    'tests/event_trace_test',
+    'tests/log_test',
     ]
 
 apps = [
     'apps/httpd/httpd',
     'apps/seawreck/seawreck',
+    'apps/memwreck/memwreck',
+    'apps/netbench/netbench',
     'apps/fair_queue_tester/fair_queue_tester',
     'apps/memcached/memcached',
     'apps/iotune/iotune',
@@ -321,12 +362,16 @@ arg_parser.add_argument('--enable-alloc-failure-injector', dest='alloc_failure_i
 add_tristate(arg_parser, name = 'exception-scalability-workaround', dest='exception_workaround',
         help='disabling override of dl_iterate_phdr symbol to workaround C++ exception scalability issues')
 arg_parser.add_argument('--allocator-page-size', dest='allocator_page_size', type=int, help='override allocator page size')
+arg_parser.add_argument('--release-log-max-level', dest='release_log_max_level', default='trace',
+                        choices=['error', 'warn', 'info', 'debug', 'trace'],
+                        help='compile out, in release mode, the log messages of the levels above this one')
 args = arg_parser.parse_args()
 
 libnet = [
     'net/proxy.cc',
     'net/virtio.cc',
     'net/dpdk.cc',
+    'net/xdp.cc',
     'net/ip.cc',
     'net/ethernet.cc',
     'net/arp.cc',
@@ -334,20 +379,39 @@ libnet = [
     'net/ip_checksum.cc',
     'net/udp.cc',
     'net/tcp.cc',
+    'net/tcp-congestion.cc',
+    'net/gso.cc',
+    'net/gro.cc',
+    'net/ipv6.cc',
+    'net/rss_balance.cc',
     'net/dhcp.cc',
     'net/tls.cc',
     'net/dns.cc',
+    'net/tcp_peer_stats.cc',
     ]
 
 core = [
     'core/reactor.cc',
+    'core/tsc_clock.cc',
+    'core/cpu_profiler.cc',
     'core/systemwide_memory_barrier.cc',
     'core/fstream.cc',
+    'core/block_cache.cc',
+    'core/shared_file.cc',
+    'core/batched_rwlock.cc',
+    'core/block_stream.cc',
+    'core/crc32c.cc',
+    'core/dma_buffer_pool.cc',
     'core/posix.cc',
     'core/memory.cc',
+    'core/memory_account.cc',
     'core/resource.cc',
     'core/scollectd.cc',
     'core/metrics.cc',
+    'core/hdr_histogram.cc',
+    'core/tracing.cc',
+    'core/metrics_mmap.cc',
+    'core/event_trace.cc',
     'core/app-template.cc',
     'core/thread.cc',
     'core/dpdk_rte.cc',
@@ -364,6 +428,7 @@ core = [
     'net/inet_address.cc',
     'rpc/rpc.cc',
     'rpc/lz4_compressor.cc',
+    'rpc/zstd_compressor.cc',
     'core/exception_hacks.cc',
     ]
 
@@ -378,16 +443,24 @@ prometheus = [
 http = ['http/transformers.cc',
         'http/json_path.cc',
         'http/file_handler.cc',
+        'http/file_cache.cc',
         'http/common.cc',
         'http/routes.cc',
+        'http/route_tree.cc',
         'json/json_elements.cc',
         'json/formatter.cc',
+        'json/json_parser.cc',
         'http/matcher.cc',
         'http/mime_types.cc',
         'http/httpd.cc',
+        'http/http2.cc',
+        'http/hpack.cc',
         'http/reply.cc',
         'http/request_parser.rl',
+        'http/http_response_parser.rl',
+        'http/client.cc',
         'http/api_docs.cc',
+        'http/cpu_profiler.cc',
         ]
 
 boost_test_lib = [
@@ -408,7 +481,7 @@ libs = ' '.join(['-laio',
                               '-lboost_program_options -lboost_system -lboost_filesystem'),
                  '-lstdc++ -lm',
                  maybe_static(args.staticboost, '-lboost_thread'),
-                 '-lcryptopp -lrt -lgnutls -lgnutlsxx -llz4 -lprotobuf -ldl -lgcc_s -lunwind',
+                 '-lcryptopp -lrt -lgnutls -lgnutlsxx -llz4 -lz -lprotobuf -ldl -lgcc_s -lunwind',
                  ])
 
 boost_unit_test_lib = maybe_static(args.staticboost, '-lboost_unit_test_framework')
@@ -423,6 +496,9 @@ if args.gcc6_concepts:
 if args.alloc_failure_injector:
     defines.append('SEASTAR_ENABLE_ALLOC_FAILURE_INJECTION')
 
+if args.release_log_max_level != 'trace':
+    modes['release']['opt'] += ' -DSEASTAR_LOG_MAX_LEVEL=' + args.release_log_max_level
+
 if not apply_tristate(args.exception_workaround, test = lambda: not args.staticcxx and not args.static,
         note = "Note: disabling exception scalability workaround due to static linkage of libgcc and libstdc++",
         missing = "Error: cannot enable exception scalability workaround with static linkage of libgcc and libstdc++"):
@@ -445,6 +521,9 @@ deps = {
     'apps/httpd/httpd': ['apps/httpd/demo.json', 'apps/httpd/main.cc'] + http + libnet + core,
     'apps/memcached/memcached': ['apps/memcached/memcache.cc'] + memcache_base,
     'tests/memcached/test_ascii_parser': ['tests/memcached/test_ascii_parser.cc'] + memcache_base,
+    'tests/memcached/test_binary_parser': ['tests/memcached/test_binary_parser.cc'] + memcache_base,
+    'tests/memcached/test_item_index': ['tests/memcached/test_item_index.cc'],
+    'tests/memcached/test_hot_keys': ['tests/memcached/test_hot_keys.cc'],
     'tests/fileiotest': ['tests/fileiotest.cc'] + core,
     'tests/directory_test': ['tests/directory_test.cc'] + core,
     'tests/linecount': ['tests/linecount.cc'] + core,
@@ -455,6 +534,11 @@ deps = {
     'tests/timertest': ['tests/timertest.cc'] + core,
     'tests/futures_test': ['tests/futures_test.cc'] + core,
     'tests/alloc_test': ['tests/alloc_test.cc'] + core,
+    'tests/allocation_test': ['tests/allocation_test.cc'] + http + core + libnet,
+    'tests/memory_account_test': ['tests/memory_account_test.cc'] + core,
+    'tests/object_pool_test': ['tests/object_pool_test.cc'] + core,
+    'tests/node_shared_test': ['tests/node_shared_test.cc'] + core,
+    'tests/cross_shard_queue_test': ['tests/cross_shard_queue_test.cc'] + core,
     'tests/foreign_ptr_test': ['tests/foreign_ptr_test.cc'] + core,
     'tests/semaphore_test': ['tests/semaphore_test.cc'] + core,
     'tests/expiring_fifo_test': ['tests/expiring_fifo_test.cc'] + core,
@@ -468,13 +552,15 @@ deps = {
     'tests/tls_test': ['tests/tls_test.cc'] + core + libnet,
     'tests/fair_queue_test': ['tests/fair_queue_test.cc'] + core,
     'apps/seawreck/seawreck': ['apps/seawreck/seawreck.cc', 'http/http_response_parser.rl'] + core + libnet,
+    'apps/memwreck/memwreck': ['apps/memwreck/memwreck.cc'] + core + libnet,
+    'apps/netbench/netbench': ['apps/netbench/netbench.cc'] + core + libnet,
     'apps/fair_queue_tester/fair_queue_tester': ['apps/fair_queue_tester/fair_queue_tester.cc'] + core,
     'apps/iotune/iotune': ['apps/iotune/iotune.cc'] + ['core/resource.cc', 'core/fsqual.cc'],
     'tests/blkdiscard_test': ['tests/blkdiscard_test.cc'] + core,
     'tests/sstring_test': ['tests/sstring_test.cc'] + core,
     'tests/unwind_test': ['tests/unwind_test.cc'] + core,
     'tests/defer_test': ['tests/defer_test.cc'] + core,
-    'tests/httpd': ['tests/httpd.cc'] + http + core,
+    'tests/httpd': ['tests/httpd.cc'] + http + core + libnet,
     'tests/allocator_test': ['tests/allocator_test.cc'] + core,
     'tests/output_stream_test': ['tests/output_stream_test.cc'] + core + libnet,
     'tests/udp_zero_copy': ['tests/udp_zero_copy.cc'] + core + libnet,
@@ -483,18 +569,41 @@ deps = {
     'tests/checked_ptr_test': ['tests/checked_ptr_test.cc'] + core,
     'tests/slab_test': ['tests/slab_test.cc'] + core,
     'tests/fstream_test': ['tests/fstream_test.cc'] + core,
+    'tests/block_cache_test': ['tests/block_cache_test.cc'] + core,
+    'tests/tracing_test': ['tests/tracing_test.cc'] + core,
+    'tests/metrics_mmap_test': ['tests/metrics_mmap_test.cc'] + core,
+    'tests/block_stream_test': ['tests/block_stream_test.cc'] + core,
+    'tests/tcp_congestion_test': ['tests/tcp_congestion_test.cc'] + core + libnet,
+    'tests/tcp_reassembly_test': ['tests/tcp_reassembly_test.cc'] + core + libnet,
+    'tests/gso_test': ['tests/gso_test.cc'] + core + libnet,
+    'tests/gro_test': ['tests/gro_test.cc'] + core + libnet,
+    'tests/ipv6_test': ['tests/ipv6_test.cc'] + core + libnet,
+    'tests/checksum_test': ['tests/checksum_test.cc'] + core + libnet,
+    'tests/rss_balance_test': ['tests/rss_balance_test.cc'] + core + libnet,
+    'tests/conntrack_test': ['tests/conntrack_test.cc'] + core + libnet,
     'tests/distributed_test': ['tests/distributed_test.cc'] + core,
     'tests/rpc': ['tests/rpc.cc'] + core + libnet,
     'tests/rpc_test': ['tests/rpc_test.cc'] + core + libnet,
     'tests/packet_test': ['tests/packet_test.cc'] + core + libnet,
+    'tests/rope_test': ['tests/rope_test.cc'] + core + libnet,
     'tests/connect_test': ['tests/connect_test.cc'] + core + libnet,
+    'tests/udp_batch_test': ['tests/udp_batch_test.cc'] + core + libnet,
+    'tests/tcp_zero_copy_test': ['tests/tcp_zero_copy_test.cc'] + core + libnet,
     'tests/chunked_fifo_test': ['tests/chunked_fifo_test.cc'] + core,
     'tests/circular_buffer_test': ['tests/circular_buffer_test.cc'] + core,
     'tests/perf/perf_fstream': ['tests/perf/perf_fstream.cc'] + core,
-    'tests/json_formatter_test': ['tests/json_formatter_test.cc'] + core + http,
+    'tests/perf/perf_timers': ['tests/perf/perf_timers.cc'],
+    'tests/perf/perf_future': ['tests/perf/perf_future.cc'] + core,
+    'tests/perf/perf_noncopyable_function': ['tests/perf/perf_noncopyable_function.cc'],
+    'tests/perf/rpc_perf': ['tests/perf/rpc_perf.cc'] + core + libnet,
+    'tests/perf/perf_micro': ['tests/perf/perf_tests.cc', 'tests/perf/perf_micro_core.cc', 'tests/perf/perf_micro_data.cc'] + core,
+    'tests/json_formatter_test': ['tests/json_formatter_test.cc'] + core + http + libnet,
     'tests/dns_test': ['tests/dns_test.cc'] + core + libnet,
     'tests/execution_stage_test': ['tests/execution_stage_test.cc'] + core,
+    'tests/coroutines_test': ['tests/coroutines_test.cc'] + core,
+    'tests/scheduling_group_test': ['tests/scheduling_group_test.cc'] + core,
     'tests/lowres_clock_test': ['tests/lowres_clock_test.cc'] + core,
+    'tests/tsc_clock_test': ['tests/tsc_clock_test.cc'] + core,
     'tests/program_options_test': ['tests/program_options_test.cc'] + core,
     'tests/tuple_utils_test': ['tests/tuple_utils_test.cc'],
     'tests/tls_echo_server': ['tests/tls_echo_server.cc'] + core + libnet,
@@ -502,13 +611,27 @@ deps = {
     'tests/circular_buffer_fixed_capacity_test': ['tests/circular_buffer_fixed_capacity_test.cc'],
     'tests/scheduling_group_demo': ['tests/scheduling_group_demo.cc'] + core,
     'tests/noncopyable_function_test': ['tests/noncopyable_function_test.cc'],
+    'tests/flat_hash_map_test': ['tests/flat_hash_map_test.cc'],
+    'tests/simple_stream_test': ['tests/simple_stream_test.cc'],
+    'tests/timer_wheel_test': ['tests/timer_wheel_test.cc'],
+    'tests/adaptive_poll_test': ['tests/adaptive_poll_test.cc'],
+    'tests/arena_test': ['tests/arena_test.cc'],
+    'tests/hdr_histogram_test': ['tests/hdr_histogram_test.cc'] + core,
+    'tests/event_trace_test': ['tests/event_trace_test.cc'] + core,
+    'tests/log_test': ['tests/log_test.cc'] + core,
 }
 
 boost_tests = [
     'tests/memcached/test_ascii_parser',
+    'tests/memcached/test_binary_parser',
     'tests/fileiotest',
     'tests/futures_test',
     'tests/alloc_test',
+    'tests/allocation_test',
+    'tests/memory_account_test',
+    'tests/object_pool_test',
+    'tests/node_shared_test',
+    'tests/cross_shard_queue_test',
     'tests/foreign_ptr_test',
     'tests/semaphore_test',
     'tests/expiring_fifo_test',
@@ -518,12 +641,29 @@ boost_tests = [
     'tests/httpd',
     'tests/output_stream_test',
     'tests/fstream_test',
+    'tests/block_cache_test',
+    'tests/tracing_test',
+    'tests/metrics_mmap_test',
+    'tests/block_stream_test',
+    'tests/tcp_congestion_test',
+    'tests/tcp_reassembly_test',
+    'tests/gso_test',
+    'tests/gro_test',
+    'tests/ipv6_test',
+    'tests/checksum_test',
+    'tests/rss_balance_test',
+    'tests/conntrack_test',
     'tests/rpc_test',
     'tests/connect_test',
+    'tests/udp_batch_test',
+    'tests/tcp_zero_copy_test',
     'tests/json_formatter_test',
     'tests/dns_test',
     'tests/execution_stage_test',
+    'tests/coroutines_test',
+    'tests/scheduling_group_test',
     'tests/lowres_clock_test',
+    'tests/tsc_clock_test',
     ]
 
 for bt in boost_tests:
@@ -687,6 +827,42 @@ if try_compile(args.cxx, source = textwrap.dedent('''\
         ''')):
     defines.append("HAVE_LZ4_COMPRESS_DEFAULT")
 
+# zstd with precompiled dictionaries, for the rpc compressor
+if try_compile(args.cxx, source = textwrap.dedent('''\
+        #include <zstd.h>
+
+        void m(ZSTD_CCtx* cctx, const ZSTD_CDict* cdict) {
+            ZSTD_compress_usingCDict(cctx, nullptr, 0, nullptr, 0, cdict);
+            ZSTD_getDictID_fromDict(nullptr, 0);
+            ZSTD_minCLevel();
+        }
+        ''')):
+    defines.append("HAVE_ZSTD")
+    libs += ' -lzstd'
+
+# io_uring_prep_poll_remove() takes the user_data to cancel as __u64 since liburing 2.0
+if try_compile(args.cxx, source = textwrap.dedent('''\
+        #include <liburing.h>
+
+        void m(io_uring_sqe* sqe) {
+            io_uring_prep_poll_remove(sqe, __u64(0));
+        }
+        ''')):
+    defines.append("HAVE_LIBURING")
+    libs += ' -luring'
+
+# AF_XDP sockets, and the bpf(BPF_LINK_CREATE) attachment of XDP programs
+if try_compile(args.cxx, source = textwrap.dedent('''\
+        #include <linux/bpf.h>
+        #include <linux/if_xdp.h>
+
+        void m(union bpf_attr* attr, sockaddr_xdp* sxdp) {
+            attr->link_create.attach_type = BPF_XDP;
+            sxdp->sxdp_flags = XDP_ZEROCOPY;
+        }
+        ''')):
+    defines.append("HAVE_AF_XDP")
+
 if try_compile_and_link(args.cxx, flags=['-fsanitize=address'], source = textwrap.dedent('''\
         #include <cstddef>
 
@@ -0,0 +1,170 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+#if defined(__x86_64__) && !defined(__clang__) && __GNUC__ >= 9
+#define SEASTAR_HAVE_TPAUSE
+#include <cpuid.h>
+#include <immintrin.h>
+#include <x86intrin.h>
+#endif
+
+#include "util/spinlock.hh"
+
+namespace seastar {
+
+/// \cond internal
+
+// Chooses how long an idle reactor should busy-poll before going to sleep.
+//
+// Sleeping costs a fixed wakeup penalty (the syscall, the interrupt and the
+// cache/TLB refill); polling costs CPU for as long as it lasts. This is the
+// ski-rental problem: with no knowledge of the future, polling for as long
+// as a sleep costs is 2-competitive, which is what the fixed
+// --idle-poll-time-us does. Here we keep a decaying histogram of observed
+// idle period lengths and pick the poll window that minimizes the expected
+// cost against that distribution: short windows when work arrives in
+// bursts, none at all when the shard is mostly idle for long stretches.
+class adaptive_poll_time {
+public:
+    using duration = std::chrono::nanoseconds;
+private:
+    // Bucket i holds idle periods in [2^i, 2^(i+1)) microseconds; bucket 0
+    // also holds everything shorter and the last one everything longer.
+    static constexpr unsigned nr_buckets = 24;
+    // Recompute the window every so many samples, and halve the weights
+    // every so many recomputations, forgetting old behaviour.
+    static constexpr unsigned recompute_interval = 64;
+    static constexpr unsigned decay_interval = 16;
+    std::array<uint32_t, nr_buckets> _weights = {};
+    unsigned _samples = 0;
+    unsigned _recomputations = 0;
+    duration _wakeup_cost;
+    duration _poll_time;
+private:
+    static unsigned bucket_of(duration d) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+        if (us <= 1) {
+            return 0;
+        }
+        unsigned b = std::numeric_limits<unsigned long long>::digits - 1 - __builtin_clzll(us);
+        return std::min(b, nr_buckets - 1);
+    }
+    static duration bucket_upper_bound(unsigned b) {
+        return std::chrono::microseconds(uint64_t(2) << b);
+    }
+    static duration bucket_midpoint(unsigned b) {
+        return std::chrono::microseconds(b ? (uint64_t(3) << b) / 2 : 1);
+    }
+    void recompute() {
+        // cost(w) = sum over periods t of (t <= w ? t : w + wakeup_cost);
+        // candidates are 0 and the bucket boundaries up to twice the wakeup
+        // cost, beyond which polling never beats sleeping immediately.
+        uint64_t total = 0;
+        for (auto w : _weights) {
+            total += w;
+        }
+        if (!total) {
+            return;
+        }
+        using fus = std::chrono::duration<double, std::micro>;
+        auto wakeup = fus(_wakeup_cost).count();
+        auto best_cost = total * wakeup;
+        duration best = duration(0);
+        double below_cost = 0;
+        uint64_t below = 0;
+        for (unsigned b = 0; b < nr_buckets - 1 && bucket_upper_bound(b) <= 2 * _wakeup_cost; ++b) {
+            below += _weights[b];
+            below_cost += _weights[b] * fus(bucket_midpoint(b)).count();
+            auto w = fus(bucket_upper_bound(b)).count();
+            auto cost = below_cost + (total - below) * (w + wakeup);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best = bucket_upper_bound(b);
+            }
+        }
+        _poll_time = best;
+        if (++_recomputations % decay_interval == 0) {
+            for (auto& w : _weights) {
+                w /= 2;
+            }
+        }
+    }
+public:
+    // \c wakeup_cost is the estimated price of a sleep/wakeup cycle; the
+    // window starts at it, matching the fixed policy, until enough idle
+    // periods have been observed.
+    explicit adaptive_poll_time(duration wakeup_cost)
+            : _wakeup_cost(wakeup_cost), _poll_time(wakeup_cost) {
+    }
+    // Records the length of an idle period, from the time the reactor ran
+    // out of work until work arrived, whether it slept or not.
+    void record_idle_period(duration d) {
+        ++_weights[bucket_of(d)];
+        if (++_samples % recompute_interval == 0) {
+            recompute();
+        }
+    }
+    duration poll_time() const {
+        return _poll_time;
+    }
+};
+
+namespace internal {
+
+// Waits for a short while in a lightweight idle state. Uses tpause (which
+// lets the core enter C0.2 and hands its resources to the SMT sibling) on
+// CPUs that support WAITPKG, and falls back to the pause instruction.
+inline void idle_relax() {
+#ifdef SEASTAR_HAVE_TPAUSE
+    static const bool have_waitpkg = [] {
+        unsigned eax, ebx, ecx, edx;
+        return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 5));
+    }();
+    if (have_waitpkg) {
+        struct waitpkg {
+            [[gnu::target("waitpkg")]]
+            static void tpause(uint64_t cycles) {
+                // 0: C0.2, the deeper of the two states
+                _tpause(0, __rdtsc() + cycles);
+            }
+        };
+        // ~1us at common TSC frequencies, short enough to keep the poll
+        // responsive; the OS may further cap it via IA32_UMWAIT_CONTROL.
+        waitpkg::tpause(2000);
+        return;
+    }
+#endif
+    cpu_relax();
+}
+
+}
+
+/// \endcond
+
+}
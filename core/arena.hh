@@ -0,0 +1,243 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <utility>
+#include "align.hh"
+
+namespace seastar {
+
+/// \addtogroup memory-module
+/// @{
+
+/// A per-shard cache of arena chunks.
+///
+/// Arenas that are created and destroyed at a high rate (one per request,
+/// say) can hand their chunks back to a cache instead of freeing them, so
+/// that the next arena starts with a chunk that is already allocated and
+/// likely still in cache. Only chunks of the cache's chunk size are kept.
+class arena_chunk_cache {
+    struct free_chunk {
+        free_chunk* next;
+    };
+    size_t _chunk_size;
+    size_t _max_chunks;
+    size_t _nr_chunks = 0;
+    free_chunk* _chunks = nullptr;
+public:
+    /// \param chunk_size size of the chunks kept, in bytes
+    /// \param max_chunks maximum number of chunks kept; chunks released
+    ///        beyond it are freed
+    explicit arena_chunk_cache(size_t chunk_size = 32 * 1024, size_t max_chunks = 64)
+        : _chunk_size(chunk_size), _max_chunks(max_chunks) {}
+    arena_chunk_cache(const arena_chunk_cache&) = delete;
+    arena_chunk_cache& operator=(const arena_chunk_cache&) = delete;
+    ~arena_chunk_cache() {
+        while (_chunks) {
+            auto c = _chunks;
+            _chunks = c->next;
+            std::free(c);
+        }
+    }
+    size_t chunk_size() const {
+        return _chunk_size;
+    }
+    /// Number of chunks currently cached
+    size_t size() const {
+        return _nr_chunks;
+    }
+    /// \cond internal
+    void* get() {
+        if (!_chunks) {
+            return std::malloc(_chunk_size);
+        }
+        auto c = _chunks;
+        _chunks = c->next;
+        --_nr_chunks;
+        return c;
+    }
+    void put(void* chunk) {
+        if (_nr_chunks == _max_chunks) {
+            std::free(chunk);
+            return;
+        }
+        auto c = new (chunk) free_chunk{_chunks};
+        _chunks = c;
+        ++_nr_chunks;
+    }
+    /// \endcond
+};
+
+/// A bump-pointer allocator for short-lived, scoped data.
+///
+/// Allocations are carved out of chunks, which for the default chunk size
+/// are spans of the seastar allocator; an allocation costs a pointer bump,
+/// and individual deallocations are no-ops. Everything is released at once
+/// when the arena is reset or destroyed, which makes it suitable for
+/// request-scoped structures (parsed headers, DOMs, argument tuples) that
+/// would otherwise be built and freed object by object.
+///
+/// The arena does not run destructors: objects allocated in it must be
+/// trivially destructible, or be destroyed by their owner (as containers
+/// using \ref arena_allocator do) before the arena is reset.
+///
+/// An arena belongs to the shard that created it and must not be used from
+/// other shards.
+class arena {
+    struct chunk {
+        chunk* next;
+        size_t size;
+        bool from_cache;
+    };
+    static constexpr size_t header_size = align_up(sizeof(chunk), alignof(std::max_align_t));
+    size_t _chunk_size;
+    arena_chunk_cache* _cache;
+    chunk* _chunks = nullptr;
+    char* _pos = nullptr;
+    char* _end = nullptr;
+    size_t _allocated = 0;
+private:
+    chunk* new_chunk(size_t size) {
+        bool from_cache = _cache && size == _cache->chunk_size();
+        void* mem = from_cache ? _cache->get() : std::malloc(size);
+        if (!mem) {
+            throw std::bad_alloc();
+        }
+        return new (mem) chunk{nullptr, size, from_cache};
+    }
+    void release(chunk* c) {
+        if (c->from_cache) {
+            _cache->put(c);
+        } else {
+            std::free(c);
+        }
+    }
+    void* allocate_slow(size_t size, size_t align) {
+        auto needed = header_size + size + align - 1;
+        if (needed > _chunk_size / 4) {
+            // Too large to share a chunk: give it its own, behind the
+            // current one so the rest of the current chunk stays usable.
+            auto c = new_chunk(needed);
+            if (_chunks) {
+                c->next = _chunks->next;
+                _chunks->next = c;
+            } else {
+                c->next = nullptr;
+                _chunks = c;
+            }
+            return align_up(reinterpret_cast<char*>(c) + header_size, align);
+        }
+        auto c = new_chunk(_chunk_size);
+        c->next = _chunks;
+        _chunks = c;
+        _pos = reinterpret_cast<char*>(c) + header_size;
+        _end = reinterpret_cast<char*>(c) + _chunk_size;
+        auto p = align_up(_pos, align);
+        _pos = p + size;
+        return p;
+    }
+public:
+    /// Constructs an arena allocating chunks of \c chunk_size bytes.
+    explicit arena(size_t chunk_size = 32 * 1024)
+        : _chunk_size(chunk_size), _cache(nullptr) {}
+    /// Constructs an arena that takes its chunks from, and returns them
+    /// to, \c cache.
+    explicit arena(arena_chunk_cache& cache)
+        : _chunk_size(cache.chunk_size()), _cache(&cache) {}
+    arena(arena&& x) noexcept
+        : _chunk_size(x._chunk_size), _cache(x._cache), _chunks(std::exchange(x._chunks, nullptr))
+        , _pos(std::exchange(x._pos, nullptr)), _end(std::exchange(x._end, nullptr))
+        , _allocated(std::exchange(x._allocated, 0)) {}
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+    ~arena() {
+        reset();
+    }
+    /// Allocates \c size bytes aligned to \c align (a power of two).
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        _allocated += size;
+        auto p = align_up(_pos, align);
+        if (__builtin_expect(_pos && p + size <= _end, true)) {
+            _pos = p + size;
+            return p;
+        }
+        return allocate_slow(size, align);
+    }
+    /// Constructs a T in the arena. T's destructor will not be run by
+    /// the arena.
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+    /// Releases all memory allocated from the arena, returning chunks to
+    /// its cache, if it has one.
+    void reset() noexcept {
+        while (_chunks) {
+            auto c = _chunks;
+            _chunks = c->next;
+            release(c);
+        }
+        _pos = _end = nullptr;
+        _allocated = 0;
+    }
+    /// Number of bytes requested from the arena since it was created or
+    /// last reset.
+    size_t allocated_bytes() const {
+        return _allocated;
+    }
+};
+
+/// A standard allocator that allocates from an \ref arena, for use with
+/// containers holding request-scoped data. Deallocation is a no-op; the
+/// memory returns when the arena is reset.
+template <typename T>
+class arena_allocator {
+    arena* _arena;
+public:
+    using value_type = T;
+    explicit arena_allocator(arena& a) noexcept : _arena(&a) {}
+    template <typename U>
+    arena_allocator(const arena_allocator<U>& x) noexcept : _arena(&x.get_arena()) {}
+    T* allocate(size_t n) {
+        return static_cast<T*>(_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T*, size_t) noexcept {}
+    arena& get_arena() const noexcept {
+        return *_arena;
+    }
+    template <typename U>
+    bool operator==(const arena_allocator<U>& x) const noexcept {
+        return _arena == &x.get_arena();
+    }
+    template <typename U>
+    bool operator!=(const arena_allocator<U>& x) const noexcept {
+        return !(*this == x);
+    }
+};
+
+/// @}
+
+}
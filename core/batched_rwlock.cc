@@ -0,0 +1,88 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "batched_rwlock.hh"
+#include "metrics.hh"
+
+namespace seastar {
+
+batched_rwlock::batched_rwlock(sstring name, unsigned max_consecutive_writers)
+        : batched_rwlock(max_consecutive_writers) {
+    namespace sm = metrics;
+    static auto lock_label = sm::label("lock");
+    auto l = lock_label(name);
+    auto us = [] (const clock::duration& d) {
+        return [&d] { return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); };
+    };
+    _metrics.add_group("rwlock", {
+        sm::make_derive("read_waits", _stats.read_waits, sm::description("Read locks that had to wait"), {l}),
+        sm::make_derive("write_waits", _stats.write_waits, sm::description("Write locks that had to wait"), {l}),
+        sm::make_derive("read_batches", _stats.read_batches,
+                sm::description("Batches of waiting readers granted the lock together"), {l}),
+        sm::make_derive("read_wait_time_us", us(_stats.read_wait_time),
+                sm::description("Total time read locks waited, in microseconds"), {l}),
+        sm::make_derive("write_wait_time_us", us(_stats.write_wait_time),
+                sm::description("Total time write locks waited, in microseconds"), {l}),
+        sm::make_gauge("waiters", [this] { return waiters(); }, sm::description("Fibers waiting for the lock"), {l}),
+    });
+}
+
+future<> batched_rwlock::wait_for_read() {
+    ++_stats.read_waits;
+    auto now = clock::now();
+    if (_waiting_readers.empty()) {
+        _waiting_readers_since = now;
+    }
+    _waiting_readers_late += now - _waiting_readers_since;
+    _waiting_readers.emplace_back();
+    return _waiting_readers.back().get_future();
+}
+
+future<> batched_rwlock::wait_for_write() {
+    ++_stats.write_waits;
+    _waiting_writers.push_back(writer{promise<>(), clock::now()});
+    return _waiting_writers.back().pr.get_future();
+}
+
+void batched_rwlock::grant_readers() {
+    auto n = _waiting_readers.size();
+    _stats.read_wait_time += (clock::now() - _waiting_readers_since) * int64_t(n) - _waiting_readers_late;
+    _waiting_readers_late = clock::duration(0);
+    ++_stats.read_batches;
+    _consecutive_writers = 0;
+    _readers += n;
+    // granted in one pass, before any of them runs
+    while (!_waiting_readers.empty()) {
+        _waiting_readers.front().set_value();
+        _waiting_readers.pop_front();
+    }
+}
+
+void batched_rwlock::grant_writer() {
+    auto& w = _waiting_writers.front();
+    _stats.write_wait_time += clock::now() - w.since;
+    _writer = true;
+    ++_consecutive_writers;
+    w.pr.set_value();
+    _waiting_writers.pop_front();
+}
+
+}
@@ -0,0 +1,230 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include "future.hh"
+#include "circular_buffer.hh"
+#include "metrics_registration.hh"
+#include "sstring.hh"
+#include "tsc_clock.hh"
+
+namespace seastar {
+
+/// \cond internal
+// lock / unlock semantics for batched_rwlock, so it can be used with with_lock()
+class batched_rwlock;
+struct batched_rwlock_for_read {
+    future<> lock();
+    void unlock();
+    friend class batched_rwlock;
+};
+
+struct batched_rwlock_for_write {
+    future<> lock();
+    void unlock();
+    friend class batched_rwlock;
+};
+/// \endcond
+
+/// \addtogroup fiber-module
+/// @{
+
+/// \brief A read-write lock that prefers writers, within a bound, and
+/// releases the waiting readers together.
+///
+/// Like \ref rwlock, this is a lock between fibers of one shard. Unlike
+/// it, readers do not overtake waiting writers: a reader that arrives
+/// while a writer holds or waits for the lock waits for the next read
+/// batch. When the lock becomes free, the whole batch is granted at once,
+/// unless there are waiting writers and fewer than
+/// \c max_consecutive_writers of them went since the previous batch. So
+/// neither side starves: a stream of readers delays a writer by at most
+/// the readers already holding the lock, and a stream of writers delays
+/// readers by at most \c max_consecutive_writers write sections.
+///
+/// The time fibers waited for the lock is counted, and exported as metrics
+/// when the lock is given a name.
+class batched_rwlock : private batched_rwlock_for_read, batched_rwlock_for_write {
+    using clock = tsc_clock;
+    struct writer {
+        promise<> pr;
+        clock::time_point since;
+    };
+    struct stats {
+        uint64_t read_waits = 0;
+        uint64_t write_waits = 0;
+        uint64_t read_batches = 0;
+        clock::duration read_wait_time = clock::duration(0);
+        clock::duration write_wait_time = clock::duration(0);
+    };
+    unsigned _readers = 0;
+    bool _writer = false;
+    unsigned _max_consecutive_writers;
+    unsigned _consecutive_writers = 0;
+    circular_buffer<promise<>> _waiting_readers;
+    // arrival of the first waiting reader, and the sum of the others'
+    // arrivals after it, to account their wait when the batch is granted
+    clock::time_point _waiting_readers_since;
+    clock::duration _waiting_readers_late = clock::duration(0);
+    circular_buffer<writer> _waiting_writers;
+    stats _stats;
+    metrics::metric_groups _metrics;
+private:
+    bool must_wait_for_read() const {
+        return _writer || !_waiting_writers.empty();
+    }
+    bool must_wait_for_write() const {
+        return _writer || _readers || !_waiting_writers.empty() || !_waiting_readers.empty();
+    }
+    future<> wait_for_read();
+    future<> wait_for_write();
+    void grant_readers();
+    void grant_writer();
+    // Hands the lock, which has just become free, to the next waiters
+    void wake() {
+        if (!_waiting_readers.empty()
+                && (_waiting_writers.empty() || _consecutive_writers >= _max_consecutive_writers)) {
+            grant_readers();
+        } else if (!_waiting_writers.empty()) {
+            grant_writer();
+        }
+    }
+public:
+    /// \param max_consecutive_writers how many waiting writers may take the
+    ///        lock in a row while readers wait; at least 1
+    explicit batched_rwlock(unsigned max_consecutive_writers = 1)
+            : _max_consecutive_writers(std::max(max_consecutive_writers, 1u)) {
+    }
+    /// Also registers the lock's wait metrics, labelled with \c name, which
+    /// must therefore be unique on the shard.
+    explicit batched_rwlock(sstring name, unsigned max_consecutive_writers = 1);
+    batched_rwlock(const batched_rwlock&) = delete;
+    batched_rwlock& operator=(const batched_rwlock&) = delete;
+
+    /// Cast this lock into a read lock object with lock semantics appropriate
+    /// to be used by "with_lock".
+    batched_rwlock_for_read& for_read() {
+        return *this;
+    }
+
+    /// Cast this lock into a write lock object with lock semantics appropriate
+    /// to be used by "with_lock".
+    batched_rwlock_for_write& for_write() {
+        return *this;
+    }
+
+    /// Acquires the lock in read mode. Many readers may hold it together.
+    future<> read_lock() {
+        if (!must_wait_for_read()) {
+            ++_readers;
+            return make_ready_future<>();
+        }
+        return wait_for_read();
+    }
+
+    /// Releases the lock, which must have been taken in read mode.
+    void read_unlock() {
+        assert(_readers);
+        if (!--_readers) {
+            wake();
+        }
+    }
+
+    /// Acquires the lock in write mode, excluding all other holders.
+    future<> write_lock() {
+        if (!must_wait_for_write()) {
+            _writer = true;
+            ++_consecutive_writers;
+            return make_ready_future<>();
+        }
+        return wait_for_write();
+    }
+
+    /// Releases the lock, which must have been taken in write mode.
+    void write_unlock() {
+        assert(_writer);
+        _writer = false;
+        wake();
+    }
+
+    /// Tries to acquire the lock in read mode iff this can be done without waiting.
+    bool try_read_lock() {
+        if (must_wait_for_read()) {
+            return false;
+        }
+        ++_readers;
+        return true;
+    }
+
+    /// Tries to acquire the lock in write mode iff this can be done without waiting.
+    bool try_write_lock() {
+        if (must_wait_for_write()) {
+            return false;
+        }
+        _writer = true;
+        ++_consecutive_writers;
+        return true;
+    }
+
+    /// Number of fibers waiting for the lock, in either mode
+    size_t waiters() const {
+        return _waiting_readers.size() + _waiting_writers.size();
+    }
+    /// Number of read batches granted so far
+    uint64_t read_batches() const {
+        return _stats.read_batches;
+    }
+    /// Total time readers waited for the lock
+    clock::duration read_wait_time() const {
+        return _stats.read_wait_time;
+    }
+    /// Total time writers waited for the lock
+    clock::duration write_wait_time() const {
+        return _stats.write_wait_time;
+    }
+    friend struct batched_rwlock_for_read;
+    friend struct batched_rwlock_for_write;
+};
+
+/// \cond internal
+inline future<> batched_rwlock_for_read::lock() {
+    return static_cast<batched_rwlock*>(this)->read_lock();
+}
+
+inline void batched_rwlock_for_read::unlock() {
+    static_cast<batched_rwlock*>(this)->read_unlock();
+}
+
+inline future<> batched_rwlock_for_write::lock() {
+    return static_cast<batched_rwlock*>(this)->write_lock();
+}
+
+inline void batched_rwlock_for_write::unlock() {
+    static_cast<batched_rwlock*>(this)->write_unlock();
+}
+/// \endcond
+
+/// @}
+
+}
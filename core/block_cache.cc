@@ -0,0 +1,322 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include <limits>
+#include <vector>
+#include <boost/range/irange.hpp>
+#include "block_cache.hh"
+#include "future-util.hh"
+#include "metrics.hh"
+
+namespace seastar {
+
+block_cache::block_cache(sstring name, block_cache_config cfg)
+        : _cfg(cfg)
+        , _reclaimer([this] (size_t bytes) { return evict(bytes); }, memory::reclaimer_scope::sync,
+                // dropping cached blocks is cheaper than what most reclaimers do
+                memory::reclaimer::default_priority / 2) {
+    namespace sm = metrics;
+    static auto cache_label = sm::label("cache");
+    auto l = cache_label(name);
+    _metrics.add_group("block_cache", {
+        sm::make_derive("hits", _stats.hits, sm::description("Block reads served from the cache"), {l}),
+        sm::make_derive("misses", _stats.misses, sm::description("Block reads that had to go to the file"), {l}),
+        sm::make_derive("insertions", _stats.insertions, sm::description("Blocks added to the cache"), {l}),
+        sm::make_derive("evictions", _stats.evictions,
+                sm::description("Blocks dropped from the cache to make room, or to give memory back to the allocator"), {l}),
+        sm::make_derive("invalidations", _stats.invalidations,
+                sm::description("Blocks dropped from the cache because they were written to, or their file closed"), {l}),
+        sm::make_current_bytes("bytes", [this] { return _used; }, sm::description("Memory held by the cached blocks"), {l}),
+        sm::make_gauge("blocks", [this] { return _entries.size(); }, sm::description("Number of cached blocks"), {l}),
+    });
+}
+
+block_cache::~block_cache() {
+    clear();
+}
+
+temporary_buffer<uint8_t>* block_cache::find(uint64_t file_id, uint64_t block) {
+    auto i = _entries.find(key{file_id, block});
+    if (i == _entries.end()) {
+        ++_stats.misses;
+        return nullptr;
+    }
+    ++_stats.hits;
+    _lru.erase(_lru.iterator_to(i->second));
+    _lru.push_front(i->second);
+    return &i->second.data;
+}
+
+void block_cache::insert(uint64_t file_id, uint64_t block, temporary_buffer<uint8_t> data) {
+    if (data.size() > _cfg.capacity) {
+        return;
+    }
+    if (_used + data.size() > _cfg.capacity) {
+        evict(_used + data.size() - _cfg.capacity);
+    }
+    auto r = _entries.emplace(key{file_id, block}, entry());
+    if (!r.second) {
+        // raced with another miss of the same block
+        return;
+    }
+    auto& e = r.first->second;
+    e.k = key{file_id, block};
+    e.data = std::move(data);
+    _used += e.data.size();
+    _lru.push_front(e);
+    ++_stats.insertions;
+}
+
+void block_cache::erase(entries_type::iterator i) {
+    _lru.erase(_lru.iterator_to(i->second));
+    _used -= i->second.data.size();
+    _entries.erase(i);
+}
+
+size_t block_cache::evict(size_t bytes) {
+    size_t freed = 0;
+    while (freed < bytes && !_lru.empty()) {
+        auto& e = _lru.back();
+        freed += e.data.size();
+        erase(_entries.find(e.k));
+        ++_stats.evictions;
+    }
+    return freed;
+}
+
+void block_cache::invalidate(uint64_t file_id, uint64_t first, uint64_t last) {
+    auto i = _entries.lower_bound(key{file_id, first});
+    while (i != _entries.end() && i->first.file_id == file_id && i->first.block < last) {
+        erase(i++);
+        ++_stats.invalidations;
+    }
+}
+
+void block_cache::clear() {
+    while (!_entries.empty()) {
+        erase(_entries.begin());
+    }
+}
+
+class cached_file_impl : public file_impl {
+    file _file;
+    block_cache& _cache;
+    uint64_t _id;
+    // Bumped by every change to the file, so that reads that started before
+    // it do not cache what they read
+    uint64_t _generation = 0;
+    using blocks = std::vector<temporary_buffer<uint8_t>>;
+private:
+    uint64_t block_size() const {
+        return _cache._cfg.block_size;
+    }
+    void invalidate(uint64_t pos, uint64_t len) {
+        ++_generation;
+        auto first = pos / block_size();
+        auto last = len ? (pos + len - 1) / block_size() + 1 : first;
+        _cache.invalidate(_id, first, last);
+    }
+    void invalidate_from(uint64_t pos) {
+        ++_generation;
+        _cache.invalidate(_id, pos / block_size(), std::numeric_limits<uint64_t>::max());
+    }
+    future<temporary_buffer<uint8_t>> get_block(uint64_t block, const io_priority_class& pc) {
+        if (auto data = _cache.find(_id, block)) {
+            return make_ready_future<temporary_buffer<uint8_t>>(data->share());
+        }
+        return _file.dma_read_bulk<uint8_t>(block * block_size(), block_size(), pc).then(
+                [this, block, generation = _generation] (temporary_buffer<uint8_t> data) {
+            // the last block of the file may grow, so it is not cached
+            if (data.size() == block_size() && generation == _generation) {
+                _cache.insert(_id, block, data.share());
+            }
+            return data;
+        });
+    }
+    // Reads the blocks that cover [pos, pos + len)
+    future<blocks> get_blocks(uint64_t pos, size_t len, const io_priority_class& pc) {
+        auto first = pos / block_size();
+        auto last = (pos + len - 1) / block_size() + 1;
+        auto ret = make_lw_shared<blocks>(last - first);
+        return parallel_for_each(boost::irange(first, last), [this, ret, first, &pc] (uint64_t block) {
+            return get_block(block, pc).then([ret, i = block - first] (temporary_buffer<uint8_t> data) {
+                (*ret)[i] = std::move(data);
+            });
+        }).then([ret] {
+            return std::move(*ret);
+        });
+    }
+    // Passes the blocks' data from front, up to len bytes or the end of
+    // the file, to consume(const uint8_t*, size_t); returns the number of
+    // bytes passed
+    template <typename Consumer>
+    size_t copy_out(const blocks& bs, size_t front, size_t len, Consumer consume) const {
+        size_t copied = 0;
+        for (auto&& b : bs) {
+            if (copied == len || front >= b.size()) {
+                break;
+            }
+            auto n = std::min(b.size() - front, len - copied);
+            consume(b.get() + front, n);
+            copied += n;
+            front = 0;
+            if (b.size() < block_size()) {
+                break;
+            }
+        }
+        return copied;
+    }
+public:
+    cached_file_impl(file f, block_cache& cache)
+            : _file(std::move(f))
+            , _cache(cache)
+            , _id(cache.new_file_id()) {
+        _memory_dma_alignment = _file.memory_dma_alignment();
+        _disk_read_dma_alignment = _file.disk_read_dma_alignment();
+        _disk_write_dma_alignment = _file.disk_write_dma_alignment();
+    }
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc) override {
+        invalidate(pos, len);
+        return _file.dma_write(pos, static_cast<const char*>(buffer), len, pc).then([this, pos, len] (size_t r) {
+            invalidate(pos, len);
+            return r;
+        });
+    }
+    virtual future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override {
+        size_t len = 0;
+        for (auto&& v : iov) {
+            len += v.iov_len;
+        }
+        invalidate(pos, len);
+        return _file.dma_write(pos, std::move(iov), pc).then([this, pos, len] (size_t r) {
+            invalidate(pos, len);
+            return r;
+        });
+    }
+    virtual future<size_t> read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc) override {
+        if (!len) {
+            return make_ready_future<size_t>(0);
+        }
+        return get_blocks(pos, len, pc).then([this, pos, buffer, len] (blocks bs) {
+            auto out = static_cast<uint8_t*>(buffer);
+            return copy_out(bs, pos % block_size(), len, [&out] (const uint8_t* p, size_t n) {
+                out = std::copy_n(p, n, out);
+            });
+        });
+    }
+    virtual future<size_t> read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override {
+        size_t len = 0;
+        for (auto&& v : iov) {
+            len += v.iov_len;
+        }
+        if (!len) {
+            return make_ready_future<size_t>(0);
+        }
+        return get_blocks(pos, len, pc).then([this, pos, len, iov = std::move(iov)] (blocks bs) {
+            auto v = iov.begin();
+            size_t v_pos = 0;
+            return copy_out(bs, pos % block_size(), len, [&] (const uint8_t* p, size_t n) {
+                while (n) {
+                    if (v_pos == v->iov_len) {
+                        ++v;
+                        v_pos = 0;
+                        continue;
+                    }
+                    auto now = std::min(n, v->iov_len - v_pos);
+                    std::copy_n(p, now, static_cast<uint8_t*>(v->iov_base) + v_pos);
+                    p += now;
+                    n -= now;
+                    v_pos += now;
+                }
+            });
+        });
+    }
+    virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) override {
+        if (!range_size) {
+            return make_ready_future<temporary_buffer<uint8_t>>();
+        }
+        auto front = offset % block_size();
+        if (front + range_size <= block_size()) {
+            // within one block: share it rather than copy
+            return get_block(offset / block_size(), pc).then([front, range_size] (temporary_buffer<uint8_t> data) {
+                if (front >= data.size()) {
+                    return temporary_buffer<uint8_t>();
+                }
+                data.trim_front(front);
+                data.trim(std::min(range_size, data.size()));
+                return data;
+            });
+        }
+        return get_blocks(offset, range_size, pc).then([this, front, range_size] (blocks bs) {
+            auto ret = allocate_dma_buffer<uint8_t>(_memory_dma_alignment, range_size);
+            auto out = ret.get_write();
+            auto copied = copy_out(bs, front, range_size, [&out] (const uint8_t* p, size_t n) {
+                out = std::copy_n(p, n, out);
+            });
+            ret.trim(copied);
+            return ret;
+        });
+    }
+    virtual future<> flush() override {
+        return _file.flush();
+    }
+    virtual future<struct stat> stat() override {
+        return _file.stat();
+    }
+    virtual future<> truncate(uint64_t length) override {
+        invalidate_from(length);
+        return _file.truncate(length).then([this, length] {
+            invalidate_from(length);
+        });
+    }
+    virtual future<> discard(uint64_t offset, uint64_t length) override {
+        invalidate(offset, length);
+        return _file.discard(offset, length).then([this, offset, length] {
+            invalidate(offset, length);
+        });
+    }
+    virtual future<> allocate(uint64_t position, uint64_t length) override {
+        return _file.allocate(position, length);
+    }
+    virtual future<uint64_t> size() override {
+        return _file.size();
+    }
+    virtual future<> close() override {
+        invalidate_from(0);
+        return _file.close();
+    }
+    virtual std::unique_ptr<file_handle_impl> dup() override {
+        return get_file_impl(_file)->dup();
+    }
+    virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)> next) override {
+        return _file.list_directory(std::move(next));
+    }
+    virtual subscription<std::vector<directory_scan_entry>> scan_directory(
+            std::function<future<> (std::vector<directory_scan_entry>)> next, directory_scan_options options) override {
+        return _file.scan_directory(std::move(next), std::move(options));
+    }
+};
+
+file make_cached_file(file f, block_cache& cache) {
+    return file(make_shared<cached_file_impl>(std::move(f), cache));
+}
+
+}
@@ -0,0 +1,137 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <boost/intrusive/list.hpp>
+#include "file.hh"
+#include "memory.hh"
+#include "metrics_registration.hh"
+#include "temporary_buffer.hh"
+
+namespace seastar {
+
+/// \addtogroup fileio-module
+/// @{
+
+/// Configuration of a \ref block_cache
+struct block_cache_config {
+    /// Size of the cached blocks; a multiple of the read alignment of the
+    /// cached files
+    size_t block_size = 16 * 1024;
+    /// Memory the cache may hold, in bytes; it also gives memory back to
+    /// the allocator when the shard runs low
+    size_t capacity = 64 * 1024 * 1024;
+};
+
+class cached_file_impl;
+
+/// A per-shard cache of file blocks, for DMA files whose hot blocks (such
+/// as index pages) are read over and over.
+///
+/// Files are cached by wrapping them with \ref make_cached_file(); all the
+/// files wrapped with the same cache share its capacity, and blocks are
+/// evicted in least recently used order when it is full, or when the
+/// shard's memory reclaimer needs memory. Writes go through to the file,
+/// and invalidate the blocks they touch; the last, partial, block of a
+/// file is never cached.
+///
+/// The cache exports hit, miss and eviction metrics, labelled with its
+/// name, which must therefore be unique on the shard.
+class block_cache {
+    struct key {
+        uint64_t file_id;
+        uint64_t block;
+        bool operator<(const key& x) const {
+            return file_id < x.file_id || (file_id == x.file_id && block < x.block);
+        }
+    };
+    struct entry {
+        key k;
+        temporary_buffer<uint8_t> data;
+        boost::intrusive::list_member_hook<> lru_link;
+    };
+    using entries_type = std::map<key, entry>;
+    using lru_type = boost::intrusive::list<entry,
+            boost::intrusive::member_hook<entry, boost::intrusive::list_member_hook<>, &entry::lru_link>,
+            boost::intrusive::constant_time_size<false>>;
+    struct stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions = 0;
+        uint64_t invalidations = 0;
+    };
+    block_cache_config _cfg;
+    entries_type _entries;
+    lru_type _lru; // most recently used first
+    size_t _used = 0;
+    uint64_t _next_file_id = 0;
+    stats _stats;
+    memory::reclaimer _reclaimer;
+    metrics::metric_groups _metrics;
+private:
+    temporary_buffer<uint8_t>* find(uint64_t file_id, uint64_t block);
+    void insert(uint64_t file_id, uint64_t block, temporary_buffer<uint8_t> data);
+    // Drops the cached blocks in [first, last)
+    void invalidate(uint64_t file_id, uint64_t first, uint64_t last);
+    void erase(entries_type::iterator i);
+    size_t evict(size_t bytes);
+    uint64_t new_file_id() {
+        return _next_file_id++;
+    }
+    friend class cached_file_impl;
+public:
+    /// \param name name of the cache, used to label metrics
+    explicit block_cache(sstring name, block_cache_config cfg = block_cache_config());
+    block_cache(const block_cache&) = delete;
+    block_cache& operator=(const block_cache&) = delete;
+    /// All files wrapped with the cache must have been closed.
+    ~block_cache();
+    const block_cache_config& config() const {
+        return _cfg;
+    }
+    /// Bytes held by the cached blocks
+    size_t used_memory() const {
+        return _used;
+    }
+    uint64_t hits() const {
+        return _stats.hits;
+    }
+    uint64_t misses() const {
+        return _stats.misses;
+    }
+    /// Drops all cached blocks.
+    void clear();
+};
+
+/// Wraps \c f so that its reads are served from \c cache when possible.
+///
+/// The returned file must be closed before the cache is destroyed, and
+/// be used from the shard of the cache; \ref file::dup() returns a handle
+/// to the underlying, uncached, file.
+file make_cached_file(file f, block_cache& cache);
+
+/// @}
+
+}
@@ -0,0 +1,201 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include <lz4.h>
+#include "block_stream.hh"
+#include "byteorder.hh"
+#include "crc32c.hh"
+#include "print.hh"
+
+namespace seastar {
+
+namespace {
+
+// Each block is a header followed by the block's stored data, which is its
+// data, or the data compressed when that made it smaller.
+struct block_header {
+    static constexpr size_t size = 16;
+    static constexpr uint32_t lz4_compressed = 1;
+    static constexpr uint32_t checksummed = 2;
+    static constexpr uint32_t known_flags = lz4_compressed | checksummed;
+    uint32_t stored_size = 0;
+    uint32_t data_size = 0;
+    // of the stored data
+    uint32_t crc = 0;
+    uint32_t flags = 0;
+
+    void write(char* p) const {
+        for (auto v : {stored_size, data_size, crc, flags}) {
+            auto le = cpu_to_le(v);
+            std::copy_n(reinterpret_cast<const char*>(&le), sizeof(le), p);
+            p += sizeof(le);
+        }
+    }
+    static block_header read(const char* p) {
+        uint32_t v[4];
+        for (auto& x : v) {
+            uint32_t le;
+            std::copy_n(p, sizeof(le), reinterpret_cast<char*>(&le));
+            x = le_to_cpu(le);
+            p += sizeof(le);
+        }
+        block_header h;
+        h.stored_size = v[0];
+        h.data_size = v[1];
+        h.crc = v[2];
+        h.flags = v[3];
+        return h;
+    }
+};
+
+class block_sink_impl final : public data_sink_impl {
+    output_stream<char> _out;
+    block_stream_options _options;
+private:
+    temporary_buffer<char> compress(const temporary_buffer<char>& buf) {
+        temporary_buffer<char> dst(LZ4_compressBound(buf.size()));
+#ifdef HAVE_LZ4_COMPRESS_DEFAULT
+        auto size = LZ4_compress_default(buf.get(), dst.get_write(), buf.size(), dst.size());
+#else
+        auto size = LZ4_compress(buf.get(), dst.get_write(), buf.size());
+#endif
+        if (size <= 0) {
+            throw std::runtime_error("block stream LZ4 compression failure");
+        }
+        dst.trim(size);
+        return dst;
+    }
+    future<> put_block(temporary_buffer<char> buf) {
+        if (buf.empty()) {
+            return make_ready_future<>();
+        }
+        block_header h;
+        h.data_size = buf.size();
+        if (_options.compression == block_compression::lz4) {
+            auto compressed = compress(buf);
+            // incompressible data is stored as it is
+            if (compressed.size() < buf.size()) {
+                buf = std::move(compressed);
+                h.flags |= block_header::lz4_compressed;
+            }
+        }
+        h.stored_size = buf.size();
+        if (_options.checksum) {
+            h.crc = crc32c(0, buf.get(), buf.size());
+            h.flags |= block_header::checksummed;
+        }
+        char header[block_header::size];
+        h.write(header);
+        return _out.write(header, sizeof(header)).then([this, buf = std::move(buf)] {
+            return _out.write(buf.get(), buf.size());
+        });
+    }
+public:
+    block_sink_impl(output_stream<char> out, block_stream_options options)
+            : _out(std::move(out)), _options(options) {
+        if (!_options.block_size || _options.block_size > max_block_size) {
+            throw std::invalid_argument(sprint("block stream block size %d is not in (0, %d]", _options.block_size, max_block_size));
+        }
+    }
+    virtual future<> put(net::packet data) override {
+        if (!data.len()) {
+            return make_ready_future<>();
+        }
+        // blocks are contiguous, to be compressed
+        data.linearize();
+        return put_block(std::move(data.release().front()));
+    }
+    virtual future<> put(temporary_buffer<char> buf) override {
+        return put_block(std::move(buf));
+    }
+    virtual future<> flush() override {
+        return _out.flush();
+    }
+    virtual future<> close() override {
+        return _out.close();
+    }
+};
+
+class block_source_impl final : public data_source_impl {
+    input_stream<char> _in;
+private:
+    temporary_buffer<char> decompress(const block_header& h, temporary_buffer<char> stored) {
+        temporary_buffer<char> data(h.data_size);
+        auto size = LZ4_decompress_safe(stored.get(), data.get_write(), stored.size(), data.size());
+        if (size < 0 || uint32_t(size) != h.data_size) {
+            throw block_stream_error("block stream LZ4 decompression failure");
+        }
+        return data;
+    }
+public:
+    explicit block_source_impl(input_stream<char> in) : _in(std::move(in)) {}
+    virtual future<temporary_buffer<char>> get() override {
+        return _in.read_exactly(block_header::size).then([this] (temporary_buffer<char> hbuf) {
+            if (hbuf.empty()) {
+                return make_ready_future<temporary_buffer<char>>();
+            }
+            if (hbuf.size() < block_header::size) {
+                throw block_stream_error("block stream truncated in a block header");
+            }
+            auto h = block_header::read(hbuf.get());
+            if ((h.flags & ~block_header::known_flags) || h.data_size > max_block_size || h.stored_size > uint32_t(LZ4_compressBound(max_block_size))
+                    || (!(h.flags & block_header::lz4_compressed) && h.stored_size != h.data_size)) {
+                throw block_stream_error(sprint("malformed block stream header (flags %#x, sizes %d/%d)", h.flags, h.stored_size, h.data_size));
+            }
+            return _in.read_exactly(h.stored_size).then([this, h] (temporary_buffer<char> stored) {
+                if (stored.size() < h.stored_size) {
+                    throw block_stream_error("block stream truncated in a block");
+                }
+                if ((h.flags & block_header::checksummed) && crc32c(0, stored.get(), stored.size()) != h.crc) {
+                    throw block_stream_error("block stream checksum mismatch");
+                }
+                if (h.flags & block_header::lz4_compressed) {
+                    return decompress(h, std::move(stored));
+                }
+                return stored;
+            });
+        });
+    }
+    virtual future<> close() override {
+        return _in.close();
+    }
+};
+
+}
+
+data_sink make_block_sink(output_stream<char> out, block_stream_options options) {
+    return data_sink(std::make_unique<block_sink_impl>(std::move(out), options));
+}
+
+data_source make_block_source(input_stream<char> in) {
+    return data_source(std::make_unique<block_source_impl>(std::move(in)));
+}
+
+output_stream<char> make_block_output_stream(output_stream<char> out, block_stream_options options) {
+    auto block_size = options.block_size;
+    return output_stream<char>(make_block_sink(std::move(out), options), block_size, true);
+}
+
+input_stream<char> make_block_input_stream(input_stream<char> in) {
+    return input_stream<char>(make_block_source(std::move(in)));
+}
+
+}
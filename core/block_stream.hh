@@ -0,0 +1,88 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <stdexcept>
+#include "iostream.hh"
+
+namespace seastar {
+
+/// \addtogroup fileio-module
+/// @{
+
+/// How the blocks of a block stream are compressed
+enum class block_compression {
+    none,
+    lz4,
+};
+
+/// Options of the streams made by \ref make_block_output_stream()
+struct block_stream_options {
+    /// Size of the blocks the data is cut into, each compressed and
+    /// checksummed on its own; at most \ref max_block_size
+    size_t block_size = 64 * 1024;
+    /// Whether each block carries a CRC32C checksum, verified when read
+    bool checksum = true;
+    block_compression compression = block_compression::none;
+};
+
+/// Largest block a block stream writes or accepts
+constexpr size_t max_block_size = 16 << 20;
+
+/// Thrown by block input streams on a block that fails its checksum, or
+/// that is truncated or malformed
+class block_stream_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/// Returns a sink that frames each buffer put into it as a block of a
+/// block stream, compressing and checksumming it as \c options say, and
+/// writes the block to \c out.
+///
+/// Checksums are computed where the buffers are, and uncompressed blocks
+/// are copied only once, into \c out's buffers; with a file output stream
+/// below, compressing a block overlaps the write-behind of the previous
+/// ones. Closing the sink closes \c out.
+data_sink make_block_sink(output_stream<char> out, block_stream_options options = block_stream_options());
+
+/// Returns a source of the data of the blocks of a block stream read from
+/// \c in, one block per buffer.
+///
+/// The blocks describe how they were compressed and checksummed, so they
+/// are read back whatever the writer's options; checksums are verified and
+/// compressed blocks decompressed as they are returned, while \c in reads
+/// ahead. Uncompressed blocks are returned without being copied. Closing
+/// the source closes \c in.
+data_source make_block_source(input_stream<char> in);
+
+/// Returns an output stream that writes its data to \c out as a block
+/// stream of \c options.block_size blocks; see \ref make_block_sink().
+output_stream<char> make_block_output_stream(output_stream<char> out, block_stream_options options = block_stream_options());
+
+/// Returns an input stream of the data of the block stream read from
+/// \c in; see \ref make_block_source().
+input_stream<char> make_block_input_stream(input_stream<char> in);
+
+/// @}
+
+}
@@ -0,0 +1,141 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+namespace seastar {
+
+/// \cond internal
+namespace internal {
+
+// Delimiter sets up to this size are searched with vector compares, one
+// per delimiter; larger ones with a lookup table
+constexpr size_t max_vector_delimiters = 8;
+
+inline const char* find_first_of_table(const char* p, const char* end, const char* set, size_t n) noexcept {
+    uint64_t table[4] = {};
+    for (size_t i = 0; i < n; ++i) {
+        auto c = uint8_t(set[i]);
+        table[c / 64] |= uint64_t(1) << (c % 64);
+    }
+    for (; p != end; ++p) {
+        auto c = uint8_t(*p);
+        if (table[c / 64] & (uint64_t(1) << (c % 64))) {
+            break;
+        }
+    }
+    return p;
+}
+
+#ifdef __x86_64__
+
+// SSE2 is part of x86-64, so needs no dispatch
+inline const char* find_first_of_sse2(const char* p, const char* end, const char* set, size_t n) noexcept {
+    __m128i delims[max_vector_delimiters];
+    for (size_t i = 0; i < n; ++i) {
+        delims[i] = _mm_set1_epi8(set[i]);
+    }
+    for (; end - p >= 16; p += 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        auto m = _mm_cmpeq_epi8(v, delims[0]);
+        for (size_t i = 1; i < n; ++i) {
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, delims[i]));
+        }
+        if (auto bits = _mm_movemask_epi8(m)) {
+            return p + __builtin_ctz(bits);
+        }
+    }
+    return find_first_of_table(p, end, set, n);
+}
+
+__attribute__((target("avx2")))
+inline const char* find_first_of_avx2(const char* p, const char* end, const char* set, size_t n) noexcept {
+    __m256i delims[max_vector_delimiters];
+    for (size_t i = 0; i < n; ++i) {
+        delims[i] = _mm256_set1_epi8(set[i]);
+    }
+    for (; end - p >= 32; p += 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        auto m = _mm256_cmpeq_epi8(v, delims[0]);
+        for (size_t i = 1; i < n; ++i) {
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, delims[i]));
+        }
+        if (auto bits = unsigned(_mm256_movemask_epi8(m))) {
+            return p + __builtin_ctz(bits);
+        }
+    }
+    return find_first_of_sse2(p, end, set, n);
+}
+
+inline bool have_avx2() noexcept {
+    static const bool have = __builtin_cpu_supports("avx2");
+    return have;
+}
+
+#endif
+
+}
+/// \endcond
+
+/// Returns the first byte of [\c begin, \c end) that is one of the \c n
+/// bytes at \c set, or \c end if there is none.
+///
+/// This is the inner loop of protocol parsers looking for their
+/// delimiters (line ends, header separators), so small sets are compared
+/// 16 or 32 bytes at a time, with AVX2 when the CPU has it; a single
+/// delimiter is left to memchr(), which the C library already vectorizes.
+inline const char* find_first_of(const char* begin, const char* end, const char* set, size_t n) noexcept {
+    if (n == 1) {
+        auto p = static_cast<const char*>(std::memchr(begin, set[0], end - begin));
+        return p ? p : end;
+    }
+    if (n == 0) {
+        return end;
+    }
+#ifdef __x86_64__
+    if (n <= internal::max_vector_delimiters) {
+        if (end - begin >= 32 && internal::have_avx2()) {
+            return internal::find_first_of_avx2(begin, end, set, n);
+        }
+        return internal::find_first_of_sse2(begin, end, set, n);
+    }
+#endif
+    return internal::find_first_of_table(begin, end, set, n);
+}
+
+/// Returns the first occurrence of the \c n bytes at \c needle in
+/// [\c begin, \c end), or \c end if there is none.
+inline const char* find_bytes(const char* begin, const char* end, const char* needle, size_t n) noexcept {
+    if (!n) {
+        return begin;
+    }
+    auto p = static_cast<const char*>(::memmem(begin, end - begin, needle, n));
+    return p ? p : end;
+}
+
+}
@@ -112,9 +112,10 @@ class chunked_fifo {
     // A list of freed chunks, to support reserve() and to improve
     // performance of repeated push and pop, especially on an empty queue.
     // It is a performance/memory tradeoff how many freed chunks to keep
-    // here (see save_free_chunks constant below).
+    // here (see set_max_free_chunks()).
     chunk* _free_chunks = nullptr;
     size_t _nfree_chunks = 0;
+    size_t _max_free_chunks = 1;
 public:
     using value_type = T;
     using size_type = size_t;
@@ -137,6 +138,21 @@ class chunked_fifo {
     inline void emplace_back(A&&... args);
     inline T& front() const noexcept;
     inline void pop_front() noexcept;
+    // push_back_n(first, n) pushes the n items starting at first, filling
+    // a chunk at a time. All the chunks needed are allocated up front, so
+    // only the items' constructors can fail; the items pushed before the
+    // failure stay in the queue.
+    template <typename Iterator>
+    void push_back_n(Iterator first, size_t n);
+    // pop_front_n(n, func) pops up to n items from the front, passing them
+    // to func(T* items, size_t count) first, as the runs of items that are
+    // contiguous in memory; it returns the number of items popped. If func
+    // throws, the run it was passed stays in the queue.
+    template <typename Func>
+    size_t pop_front_n(size_t n, Func&& func);
+    // pop_front_n(n) pops up to n items from the front without looking at
+    // them.
+    void pop_front_n(size_t n) noexcept;
     inline bool empty() const noexcept;
     inline size_t size() const noexcept;
     void clear() noexcept;
@@ -150,6 +166,19 @@ class chunked_fifo {
     // shrink_to_fit() frees memory held, but unused, by the queue. Such
     // unused memory might exist after pops, or because of reserve().
     void shrink_to_fit();
+    // set_max_free_chunks(n) sets how many emptied chunks the queue keeps
+    // for reuse instead of freeing them (1 by default). A producer and
+    // consumer that keep the queue a few chunks long cycle through chunks
+    // continuously, and keeping that many of them avoids allocating one
+    // every items_per_chunk pushes. It does not free chunks already kept
+    // or reserved - use shrink_to_fit() for that.
+    void set_max_free_chunks(size_t n) noexcept {
+        _max_free_chunks = n;
+    }
+    // number of chunks held for future pushes, by pops or by reserve()
+    size_t free_chunks() const noexcept {
+        return _nfree_chunks;
+    }
 private:
     void back_chunk_new();
     void front_chunk_delete() noexcept;
@@ -166,7 +195,8 @@ chunked_fifo<T, items_per_chunk>::chunked_fifo(chunked_fifo&& x) noexcept
         , _back_chunk(x._back_chunk)
         , _nchunks(x._nchunks)
         , _free_chunks(x._free_chunks)
-        , _nfree_chunks(x._nfree_chunks) {
+        , _nfree_chunks(x._nfree_chunks)
+        , _max_free_chunks(x._max_free_chunks) {
     x._front_chunk = nullptr;
     x._back_chunk = nullptr;
     x._nchunks = 0;
@@ -411,10 +441,10 @@ chunked_fifo<T, items_per_chunk>::front_chunk_delete() noexcept {
     // immediately. There is a performance/memory tradeoff of how many freed
     // chunks to save: If we save them all, the queue can never shrink from
     // its maximum memory use (this is how circular_buffer behaves).
-    // The ad-hoc choice made here is to limit the number of saved chunks to 1,
-    // but this could easily be made a configuration option.
-    static constexpr int save_free_chunks = 1;
-    if (_nfree_chunks < save_free_chunks) {
+    // By default we save a single chunk, which is enough for the above
+    // examples; queues whose length varies by more than a chunk can save
+    // more with set_max_free_chunks().
+    if (_nfree_chunks < _max_free_chunks) {
         _front_chunk->next = _free_chunks;
         _free_chunks = _front_chunk;
         ++_nfree_chunks;
@@ -440,15 +470,75 @@ chunked_fifo<T, items_per_chunk>::pop_front() noexcept {
     }
 }
 
+template <typename T, size_t items_per_chunk>
+template <typename Iterator>
+void
+chunked_fifo<T, items_per_chunk>::push_back_n(Iterator first, size_t n) {
+    reserve(size() + n);
+    while (n) {
+        ensure_room_back();
+        auto c = _back_chunk;
+        auto room = items_per_chunk - (c->end - c->begin);
+        try {
+            for (auto k = std::min(n, room); k; --k) {
+                new (&c->items[mask(c->end)].data) T(*first);
+                ++first;
+                ++c->end;
+                --n;
+            }
+        } catch (...) {
+            undo_room_back();
+            throw;
+        }
+    }
+}
+
+template <typename T, size_t items_per_chunk>
+template <typename Func>
+size_t
+chunked_fifo<T, items_per_chunk>::pop_front_n(size_t n, Func&& func) {
+    size_t popped = 0;
+    while (popped != n && !empty()) {
+        auto c = _front_chunk;
+        // The items of a chunk may wrap around its end
+        auto run = std::min<size_t>({n - popped, c->end - c->begin,
+                items_per_chunk - mask(c->begin)});
+        auto p = &c->items[mask(c->begin)].data;
+        func(p, run);
+        for (auto i = p; i != p + run; ++i) {
+            i->~T();
+        }
+        popped += run;
+        c->begin += run;
+        if (c->begin == c->end) {
+            front_chunk_delete();
+        }
+    }
+    return popped;
+}
+
+template <typename T, size_t items_per_chunk>
+void
+chunked_fifo<T, items_per_chunk>::pop_front_n(size_t n) noexcept {
+    pop_front_n(n, [] (T*, size_t) noexcept {});
+}
+
 template <typename T, size_t items_per_chunk>
 void chunked_fifo<T, items_per_chunk>::reserve(size_t n) {
     // reserve() guarantees that (n - size()) additional push()es will
     // succeed without reallocation:
+    if (n <= size()) {
+        return;
+    }
     size_t need = n - size();
     // If we already have a back chunk, it might have room for some pushes
     // before filling up, so decrease "need":
     if (_back_chunk) {
-        need -= items_per_chunk - (_back_chunk->end - _back_chunk->begin);
+        size_t room = items_per_chunk - (_back_chunk->end - _back_chunk->begin);
+        if (need <= room) {
+            return;
+        }
+        need -= room;
     }
     size_t needed_chunks = (need + items_per_chunk - 1) / items_per_chunk;
     // If we already have some freed chunks saved, we need to allocate fewer
@@ -75,6 +75,18 @@ class circular_buffer {
     T& back();
     void pop_front();
     void pop_back();
+    // Pushes the n items starting at first, growing the storage at most
+    // once.
+    template <typename Iterator>
+    void push_back_n(Iterator first, size_t n);
+    // Pops up to n items from the front, passing them to
+    // func(T* items, size_t count) first, as at most two runs of items
+    // contiguous in memory; returns the number of items popped. If func
+    // throws, the run it was passed stays in the buffer.
+    template <typename Func>
+    size_t pop_front_n(size_t n, Func&& func);
+    // Pops up to n items from the front.
+    void pop_front_n(size_t n);
     bool empty() const;
     size_t size() const;
     size_t capacity() const;
@@ -398,6 +410,46 @@ circular_buffer<T, Alloc>::pop_back() {
     --_impl.end;
 }
 
+template <typename T, typename Alloc>
+template <typename Iterator>
+inline
+void
+circular_buffer<T, Alloc>::push_back_n(Iterator first, size_t n) {
+    reserve(size() + n);
+    for (; n; --n) {
+        _impl.construct(&_impl.storage[mask(_impl.end)], *first);
+        ++first;
+        ++_impl.end;
+    }
+}
+
+template <typename T, typename Alloc>
+template <typename Func>
+inline
+size_t
+circular_buffer<T, Alloc>::pop_front_n(size_t n, Func&& func) {
+    n = std::min(n, size());
+    size_t popped = 0;
+    while (popped != n) {
+        auto run = std::min(n - popped, _impl.capacity - mask(_impl.begin));
+        auto p = &front();
+        func(p, run);
+        for (auto i = p; i != p + run; ++i) {
+            _impl.destroy(i);
+        }
+        _impl.begin += run;
+        popped += run;
+    }
+    return popped;
+}
+
+template <typename T, typename Alloc>
+inline
+void
+circular_buffer<T, Alloc>::pop_front_n(size_t n) {
+    pop_front_n(n, [] (T*, size_t) {});
+}
+
 template <typename T, typename Alloc>
 inline
 T&
@@ -0,0 +1,215 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+/// \file
+///
+/// \brief C++20 coroutine support for seastar::future
+///
+/// Including this header in a translation unit compiled with coroutine
+/// support (e.g. -std=c++20, plus -fcoroutines on GCC 10) allows functions
+/// returning future<T...> to be written as coroutines, and futures to be
+/// co_await'ed:
+///
+/// ```
+/// future<int> read_two(input_stream<char>& in) {
+///     auto a = co_await in.read_exactly(4);
+///     auto b = co_await in.read_exactly(4);
+///     co_return decode(a) + decode(b);
+/// }
+/// ```
+///
+/// A coroutine allocates a single frame, through the seastar allocator's
+/// per-shard pools, and no continuation per co_await: the task that resumes
+/// the coroutine and the storage for the awaited result both live in the
+/// frame. Awaiting a ready future does not suspend unless the reactor asks
+/// for preemption.
+///
+/// The rest of seastar is still C++14; this header is only usable by
+/// applications built as C++20.
+
+#if defined(__cpp_impl_coroutine) && defined(__cpp_impl_destroying_delete)
+
+#define SEASTAR_COROUTINES_ENABLED
+
+#include <coroutine>
+#include <new>
+#include "future.hh"
+
+namespace seastar {
+
+/// \cond internal
+namespace internal {
+
+template <typename... T>
+class coroutine_promise_base : public task {
+protected:
+    promise<T...> _promise;
+    // Number of owners of this object as a task: every suspension hands one
+    // std::unique_ptr<task> to the awaited future, and the reactor deletes
+    // it after running it. The frame is destroyed once the last owner lets
+    // go and the coroutine has either finished or will never be resumed.
+    unsigned _owners = 0;
+    bool _running = false;
+public:
+    future<T...> get_return_object() noexcept {
+        return _promise.get_future();
+    }
+    std::suspend_never initial_suspend() noexcept {
+        return {};
+    }
+    // Running from the reactor, the frame must outlive run() (the reactor
+    // deletes the task after running it), so suspend and let that delete
+    // destroy it. Otherwise the coroutine completed without ever
+    // suspending, and the frame can go right away.
+    auto final_suspend() noexcept {
+        struct final_awaiter {
+            bool _ready;
+            bool await_ready() const noexcept { return _ready; }
+            void await_suspend(std::coroutine_handle<>) const noexcept {}
+            void await_resume() const noexcept {}
+        };
+        return final_awaiter{!_running};
+    }
+    void unhandled_exception() noexcept {
+        _promise.set_exception(std::current_exception());
+    }
+    void own() noexcept {
+        ++_owners;
+    }
+};
+
+template <typename Promise>
+class coroutine_promise_task_mixin : public Promise {
+public:
+    virtual void run() noexcept override {
+        this->_running = true;
+        std::coroutine_handle<coroutine_promise_task_mixin>::from_promise(*this).resume();
+    }
+    // The reactor (or an abandoned promise) deletes tasks through
+    // std::unique_ptr<task>; the object lives in the coroutine frame, so
+    // instead of destroying it the delete releases one owner and destroys
+    // the frame when none are left.
+    static void operator delete(coroutine_promise_task_mixin* p, std::destroying_delete_t) noexcept {
+        if (--p->_owners == 0) {
+            std::coroutine_handle<coroutine_promise_task_mixin>::from_promise(*p).destroy();
+        }
+    }
+    // Frees the coroutine frame; sized deallocation lets the seastar
+    // allocator skip looking up the size of the (small, short-lived) frame.
+    static void operator delete(void* ptr, size_t size) noexcept {
+        ::operator delete(ptr, size);
+    }
+};
+
+template <typename... T>
+class coroutine_promise : public coroutine_promise_base<T...> {
+public:
+    template <typename... U>
+    void return_value(U&&... value) {
+        this->_promise.set_value(std::forward<U>(value)...);
+    }
+    void return_value(future<T...>&& fut) noexcept {
+        fut.forward_to(std::move(this->_promise));
+    }
+};
+
+template <>
+class coroutine_promise<> : public coroutine_promise_base<> {
+public:
+    void return_void() noexcept {
+        _promise.set_value();
+    }
+};
+
+// Maps the value tuple of a future<T...> to the result of co_await
+template <typename... T>
+struct coroutine_result {
+    using type = std::tuple<T...>;
+    static type unwrap(std::tuple<T...>&& v) {
+        return std::move(v);
+    }
+};
+
+template <typename T>
+struct coroutine_result<T> {
+    using type = T;
+    static type unwrap(std::tuple<T>&& v) {
+        return std::get<0>(std::move(v));
+    }
+};
+
+template <>
+struct coroutine_result<> {
+    using type = void;
+    static void unwrap(std::tuple<>&&) {
+    }
+};
+
+template <typename... T>
+class future_awaiter {
+    future<T...> _future;
+    future_state<T...> _state;
+public:
+    explicit future_awaiter(future<T...>&& f) noexcept : _future(std::move(f)) {}
+    future_awaiter(const future_awaiter&) = delete;
+    future_awaiter(future_awaiter&&) = delete;
+
+    bool await_ready() noexcept {
+        return _future.available() && !need_preempt();
+    }
+    template <typename Promise>
+    void await_suspend(std::coroutine_handle<Promise> h) {
+        auto& pr = h.promise();
+        pr.own();
+        _future.schedule_task(std::unique_ptr<task>(&pr), &_state);
+    }
+    typename coroutine_result<T...>::type await_resume() {
+        if (_state.available()) {
+            return coroutine_result<T...>::unwrap(std::move(_state).get());
+        }
+        // did not suspend, the result is still in the future
+        return coroutine_result<T...>::unwrap(_future.get());
+    }
+};
+
+}
+/// \endcond
+
+/// Allows a future to be co_await'ed from a seastar coroutine
+template <typename... T>
+auto operator co_await(future<T...> f) noexcept {
+    return internal::future_awaiter<T...>(std::move(f));
+}
+
+}
+
+namespace std {
+
+template <typename... T, typename... Args>
+struct coroutine_traits<seastar::future<T...>, Args...> {
+    using promise_type = seastar::internal::coroutine_promise_task_mixin<seastar::internal::coroutine_promise<T...>>;
+};
+
+}
+
+#endif
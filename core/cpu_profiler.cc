@@ -0,0 +1,121 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "cpu_profiler.hh"
+#include "posix.hh"
+#include "print.hh"
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <unordered_map>
+#include <algorithm>
+
+namespace seastar {
+
+int cpu_profiler::signal_number() {
+    // SIGRTMIN and SIGRTMIN + 1 are used by the reactor's timer and the
+    // stall detector.
+    return SIGRTMIN + 2;
+}
+
+cpu_profiler::cpu_profiler(std::chrono::nanoseconds period, size_t capacity)
+        : _capacity(capacity)
+        , _ring(std::make_unique<cpu_profiler_sample[]>(capacity)) {
+    struct sigevent sev = {};
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev._sigev_un._tid = syscall(SYS_gettid);
+    sev.sigev_signo = signal_number();
+    auto r = timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &_timer);
+    throw_system_error_on(r == -1, "timer_create");
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, signal_number());
+    r = ::pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+    throw_pthread_error(r);
+    auto its = posix::to_relative_itimerspec(period, period);
+    r = timer_settime(_timer, 0, &its, nullptr);
+    throw_system_error_on(r == -1, "timer_settime");
+}
+
+cpu_profiler::~cpu_profiler() {
+    timer_delete(_timer);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, signal_number());
+    ::pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+}
+
+void cpu_profiler::on_signal() noexcept {
+    if (_reading.load(std::memory_order_relaxed)) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto n = _recorded.load(std::memory_order_relaxed);
+    auto& sample = _ring[n % _capacity];
+    sample.trace = current_backtrace();
+    sample.sg = current_scheduling_group();
+    _recorded.store(n + 1, std::memory_order_relaxed);
+}
+
+std::vector<cpu_profiler_sample> cpu_profiler::samples() {
+    // The handler runs on this thread, so a compiler barrier is enough to
+    // order it against the copy below.
+    _reading.store(true, std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    auto n = _recorded.load(std::memory_order_relaxed);
+    auto nr = std::min<uint64_t>(n, _capacity);
+    std::vector<cpu_profiler_sample> ret;
+    ret.reserve(nr);
+    for (auto i = n - nr; i != n; ++i) {
+        ret.push_back(_ring[i % _capacity]);
+    }
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    _reading.store(false, std::memory_order_relaxed);
+    return ret;
+}
+
+static sstring format_frame(const frame& f) {
+    if (f.so->name.empty()) {
+        return sprint("0x%x", f.addr);
+    }
+    return sprint("%s+0x%x", f.so->name, f.addr);
+}
+
+sstring fold_cpu_profiler_samples(const std::vector<cpu_profiler_sample>& samples, const sstring& prefix) {
+    std::unordered_map<sstring, uint64_t> stacks;
+    for (auto& s : samples) {
+        sstring stack = prefix.empty() ? s.sg.name() : prefix + ";" + s.sg.name();
+        auto& frames = s.trace.frames();
+        // backtraces are recorded innermost frame first
+        for (auto i = frames.rbegin(); i != frames.rend(); ++i) {
+            stack += ";";
+            stack += format_frame(*i);
+        }
+        ++stacks[stack];
+    }
+    sstring ret;
+    for (auto& s : stacks) {
+        ret += sprint("%s %d\n", s.first, s.second);
+    }
+    return ret;
+}
+
+}
@@ -0,0 +1,79 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <time.h>
+#include "util/backtrace.hh"
+#include "scheduling.hh"
+#include "sstring.hh"
+
+namespace seastar {
+
+/// A backtrace recorded by the sampling CPU profiler, tagged with the
+/// scheduling group that was running when the sample was taken.
+struct cpu_profiler_sample {
+    saved_backtrace trace;
+    scheduling_group sg;
+};
+
+/// \cond internal
+
+// Per-shard sampling profiler: a timer on the reactor thread's CPU-time
+// clock raises a signal every period of CPU time consumed, and the signal
+// handler records the current backtrace into a fixed-size ring, overwriting
+// the oldest samples. The ring is only accessed from the reactor thread;
+// samples() masks the handler while copying instead of taking a lock.
+class cpu_profiler {
+    timer_t _timer = {};
+    size_t _capacity;
+    std::unique_ptr<cpu_profiler_sample[]> _ring;
+    std::atomic<uint64_t> _recorded = { 0 };
+    std::atomic<uint64_t> _dropped = { 0 };
+    std::atomic<bool> _reading = { false };
+public:
+    cpu_profiler(std::chrono::nanoseconds period, size_t capacity);
+    ~cpu_profiler();
+    cpu_profiler(const cpu_profiler&) = delete;
+    void operator=(const cpu_profiler&) = delete;
+    // Called from the signal handler
+    void on_signal() noexcept;
+    // Returns the recorded samples, oldest first
+    std::vector<cpu_profiler_sample> samples();
+    uint64_t recorded() const { return _recorded.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+    static int signal_number();
+};
+
+/// \endcond
+
+/// Aggregates samples in the "folded stacks" format used by flamegraph.pl:
+/// one line per distinct stack, with frames separated by ';' from the
+/// outermost to the innermost, followed by a space and the number of
+/// samples. Each stack starts with \c prefix (if not empty) and the name
+/// of the sample's scheduling group.
+sstring fold_cpu_profiler_samples(const std::vector<cpu_profiler_sample>& samples, const sstring& prefix = "");
+
+}
@@ -0,0 +1,95 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include <array>
+#include <cstring>
+#include "crc32c.hh"
+#ifdef __x86_64__
+#include <nmmintrin.h>
+#endif
+
+namespace seastar {
+
+namespace {
+
+struct crc32c_table {
+    std::array<uint32_t, 256> entries;
+    crc32c_table() {
+        // the reflected Castagnoli polynomial
+        constexpr uint32_t poly = 0x82f63b78;
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? (c >> 1) ^ poly : c >> 1;
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+uint32_t crc32c_software(uint32_t crc, const unsigned char* p, size_t len) {
+    static const crc32c_table table;
+    while (len--) {
+        crc = table.entries[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef __x86_64__
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hardware(uint32_t crc, const unsigned char* p, size_t len) {
+    uint64_t c = crc;
+    for (; len && reinterpret_cast<uintptr_t>(p) % 8; --len) {
+        c = _mm_crc32_u8(c, *p++);
+    }
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    for (; len; --len) {
+        c = _mm_crc32_u8(c, *p++);
+    }
+    return c;
+}
+
+bool have_crc32c_instruction() {
+    static const bool have = __builtin_cpu_supports("sse4.2");
+    return have;
+}
+
+#endif
+
+}
+
+uint32_t crc32c(uint32_t crc, const char* data, size_t len) {
+    auto p = reinterpret_cast<const unsigned char*>(data);
+    crc = ~crc;
+#ifdef __x86_64__
+    if (have_crc32c_instruction()) {
+        return ~crc32c_hardware(crc, p, len);
+    }
+#endif
+    return ~crc32c_software(crc, p, len);
+}
+
+}
@@ -0,0 +1,37 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace seastar {
+
+/// Computes the CRC32C (Castagnoli) checksum of \c len bytes at \c data.
+///
+/// \param crc the checksum of the data that precedes \c data, to checksum
+///            data given in pieces; 0 for the first piece
+///
+/// Uses the SSE 4.2 crc32 instruction when the CPU has it.
+uint32_t crc32c(uint32_t crc, const char* data, size_t len);
+
+}
@@ -0,0 +1,332 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <experimental/optional>
+#include "cacheline.hh"
+#include "condition-variable.hh"
+#include "future-util.hh"
+#include "reactor.hh"
+
+namespace seastar {
+
+/// \addtogroup smp-module
+/// @{
+
+/// A bounded queue that any number of shards push to, and one shard pops
+/// from.
+///
+/// Pushing to a \c cross_shard_queue costs no cross-shard message: the
+/// elements are moved through a lock-free ring (a bounded multi-producer
+/// ring in the manner of D. Vyukov's), which the consumer shard checks when
+/// it polls its smp queues. A producer wakes the consumer shard only if it
+/// is sleeping, with the same protocol that the smp queues use, so a busy
+/// consumer sees no notification at all. \ref try_push_bulk() and
+/// \ref consume() move many elements with one reservation and one release
+/// of ring slots.
+///
+/// A producer that finds the ring full gets a future from
+/// \ref push_eventually(), which resolves once the consumer made room; the
+/// consumer sends one message per waiting producer shard for that, so the
+/// backpressure costs messages only while the ring is full.
+///
+/// The queue is created on its consumer shard, which alone may pop from it
+/// and destroy it; it must outlive the pushes of all producers.
+template <typename T>
+class cross_shard_queue final : private reactor::remote_work_poller {
+    struct cell {
+        // position + 1 when the cell holds the element of that position;
+        // position when it is free for it
+        std::atomic<size_t> seq;
+        std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+        T& value() {
+            return *reinterpret_cast<T*>(&storage);
+        }
+    };
+    struct alignas(cache_line_size) producer_shard {
+        std::atomic<bool> waiting = { false };
+        // used on the producer shard only
+        condition_variable not_full;
+    };
+    const size_t _capacity;
+    const size_t _mask;
+    reactor* const _consumer;
+    const unsigned _consumer_cpu;
+    std::unique_ptr<cell[]> _cells;
+    std::unique_ptr<producer_shard[]> _producers;
+    // next position to reserve, by producers
+    alignas(cache_line_size) std::atomic<size_t> _tail = { 0 };
+    // positions below are free, or will be once their producers wrote
+    // them; only a hint for bulk reservations
+    alignas(cache_line_size) std::atomic<size_t> _head_hint = { 0 };
+    alignas(cache_line_size) std::atomic<bool> _producers_waiting = { false };
+    // consumer side
+    alignas(cache_line_size) size_t _head = 0;
+    std::experimental::optional<promise<>> _not_empty;
+private:
+    static size_t round_up_capacity(size_t capacity) {
+        size_t ret = 2;
+        while (ret < capacity) {
+            ret *= 2;
+        }
+        return ret;
+    }
+    void notify_consumer() {
+        if (engine().cpu_id() == _consumer_cpu) {
+            poll();
+        } else {
+            _consumer->maybe_wakeup();
+        }
+    }
+    // The consumer made room: tell the shards whose pushes wait
+    void wake_producers() {
+        // pairs with the fence of push_eventually()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!_producers_waiting.load(std::memory_order_relaxed)) {
+            return;
+        }
+        _producers_waiting.store(false, std::memory_order_relaxed);
+        for (auto s : smp::all_cpus()) {
+            auto& p = _producers[s];
+            if (!p.waiting.load(std::memory_order_relaxed) || !p.waiting.exchange(false, std::memory_order_relaxed)) {
+                continue;
+            }
+            if (s == engine().cpu_id()) {
+                p.not_full.broadcast();
+                continue;
+            }
+            smp::submit_to(s, [&p] {
+                p.not_full.broadcast();
+            });
+        }
+    }
+    virtual bool poll() override {
+        if (!_not_empty || empty()) {
+            return false;
+        }
+        auto p = std::move(*_not_empty);
+        _not_empty = {};
+        p.set_value();
+        return true;
+    }
+    virtual bool pure_poll() override {
+        return _not_empty && !empty();
+    }
+public:
+    /// \param capacity elements the ring holds; rounded up to a power of 2
+    explicit cross_shard_queue(size_t capacity)
+            : _capacity(round_up_capacity(capacity))
+            , _mask(_capacity - 1)
+            , _consumer(&engine())
+            , _consumer_cpu(engine().cpu_id())
+            , _cells(new cell[_capacity])
+            , _producers(new producer_shard[smp::count]) {
+        for (size_t i = 0; i < _capacity; ++i) {
+            _cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+        _consumer->register_remote_work_poller(*this);
+    }
+    cross_shard_queue(const cross_shard_queue&) = delete;
+    cross_shard_queue& operator=(const cross_shard_queue&) = delete;
+    ~cross_shard_queue() {
+        _consumer->unregister_remote_work_poller(*this);
+        consume([] (T) {});
+    }
+
+    size_t capacity() const {
+        return _capacity;
+    }
+
+    /// \name Producer side, on any shard
+    /// @{
+
+    /// Pushes \c value, unless the queue is full; \c value is only moved
+    /// from if it is pushed.
+    bool try_push(T&& value) {
+        auto pos = _tail.load(std::memory_order_relaxed);
+        cell* c;
+        for (;;) {
+            c = &_cells[pos & _mask];
+            auto diff = intptr_t(c->seq.load(std::memory_order_acquire)) - intptr_t(pos);
+            if (diff == 0) {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+        new (&c->storage) T(std::move(value));
+        c->seq.store(pos + 1, std::memory_order_release);
+        notify_consumer();
+        return true;
+    }
+
+    /// Pushes as many of the \c n elements starting at \c first as there
+    /// is room for, moving them, with a single reservation; returns their
+    /// number.
+    template <typename Iterator>
+    size_t try_push_bulk(Iterator first, size_t n) {
+        auto pos = _tail.load(std::memory_order_relaxed);
+        size_t k;
+        for (;;) {
+            auto used = pos - _head_hint.load(std::memory_order_acquire);
+            k = std::min(n, used < _capacity ? _capacity - used : 0);
+            if (!k) {
+                return 0;
+            }
+            // slots are freed in order, so if the last one is, all are
+            auto& last = _cells[(pos + k - 1) & _mask];
+            if (last.seq.load(std::memory_order_acquire) != pos + k - 1) {
+                auto now = _tail.load(std::memory_order_relaxed);
+                if (now == pos) {
+                    return 0;
+                }
+                pos = now;
+                continue;
+            }
+            if (_tail.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        for (size_t i = 0; i < k; ++i, ++first) {
+            auto& c = _cells[(pos + i) & _mask];
+            new (&c.storage) T(std::move(*first));
+            c.seq.store(pos + i + 1, std::memory_order_release);
+        }
+        notify_consumer();
+        return k;
+    }
+
+    /// Pushes \c value, waiting for room if the queue is full.
+    future<> push_eventually(T&& value) {
+        if (try_push(std::move(value))) {
+            return make_ready_future<>();
+        }
+        return do_with(std::move(value), [this] (T& value) {
+            return repeat([this, &value] {
+                if (try_push(std::move(value))) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                auto& p = _producers[engine().cpu_id()];
+                p.waiting.store(true, std::memory_order_relaxed);
+                _producers_waiting.store(true, std::memory_order_relaxed);
+                // pairs with the fence of wake_producers()
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (try_push(std::move(value))) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return p.not_full.wait().then([] {
+                    return stop_iteration::no;
+                });
+            });
+        });
+    }
+
+    /// Pushes all of \c values, in order, in as few bulk pushes as the
+    /// room in the queue allows.
+    future<> push_bulk_eventually(std::vector<T> values) {
+        return do_with(std::move(values), size_t(0), [this] (std::vector<T>& values, size_t& pushed) {
+            return repeat([this, &values, &pushed] {
+                pushed += try_push_bulk(values.begin() + pushed, values.size() - pushed);
+                if (pushed == values.size()) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                // wait for room for the next one, then bulk push again
+                return push_eventually(std::move(values[pushed++])).then([] {
+                    return stop_iteration::no;
+                });
+            });
+        });
+    }
+
+    /// @}
+
+    /// \name Consumer side, on the shard that created the queue
+    /// @{
+
+    bool empty() const {
+        return _cells[_head & _mask].seq.load(std::memory_order_acquire) != _head + 1;
+    }
+
+    /// Pops up to \c max elements, in the order their pushes reserved them,
+    /// passing each to \c func; returns their number.
+    template <typename Func>
+    size_t consume(Func&& func, size_t max = std::numeric_limits<size_t>::max()) {
+        size_t n = 0;
+        while (n < max && !empty()) {
+            auto& c = _cells[_head & _mask];
+            T value(std::move(c.value()));
+            c.value().~T();
+            c.seq.store(_head + _capacity, std::memory_order_release);
+            ++_head;
+            ++n;
+            func(std::move(value));
+        }
+        if (n) {
+            _head_hint.store(_head, std::memory_order_release);
+            wake_producers();
+        }
+        return n;
+    }
+
+    std::experimental::optional<T> try_pop() {
+        std::experimental::optional<T> ret;
+        consume([&ret] (T&& value) {
+            ret = std::move(value);
+        }, 1);
+        return ret;
+    }
+
+    /// Returns a future that resolves once the queue is not empty; only
+    /// one may wait at a time.
+    future<> not_empty() {
+        if (!empty()) {
+            return make_ready_future<>();
+        }
+        assert(!_not_empty);
+        _not_empty = promise<>();
+        return _not_empty->get_future();
+    }
+
+    future<T> pop_eventually() {
+        if (auto value = try_pop()) {
+            return make_ready_future<T>(std::move(*value));
+        }
+        return not_empty().then([this] {
+            return pop_eventually();
+        });
+    }
+
+    /// @}
+};
+
+/// @}
+
+}
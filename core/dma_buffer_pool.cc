@@ -0,0 +1,182 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include <array>
+#include <vector>
+#include "dma_buffer_pool.hh"
+#include "bitops.hh"
+#include "memory.hh"
+#include "metrics.hh"
+
+namespace seastar {
+
+namespace {
+
+// The pool of the calling shard, if it was created and not yet destroyed;
+// deleters compare it to the pool their buffer came from.
+class dma_buffer_pool;
+thread_local dma_buffer_pool* local_dma_buffer_pool = nullptr;
+thread_local size_t dma_buffer_pool_capacity = 16 << 20;
+
+class dma_buffer_pool {
+    static constexpr size_t min_size = 4096;
+    static constexpr size_t max_size = 1 << 20;
+    static constexpr unsigned nr_classes = log2ceil(max_size) - log2ceil(min_size) + 1;
+    // Pooled buffers are aligned on this, which satisfies the memory
+    // alignment of all the devices we know of
+    static constexpr size_t alignment = 4096;
+    std::array<std::vector<void*>, nr_classes> _free; // most recently freed last
+    dma_buffer_pool_stats _stats;
+    memory::reclaimer _reclaimer;
+    metrics::metric_groups _metrics;
+private:
+    static size_t class_size(unsigned cls) {
+        return min_size << cls;
+    }
+    // Returns the class of the buffers that \c size bytes would be served
+    // from, or nr_classes if they are not pooled
+    static unsigned size_class(size_t size) {
+        if (!size || size > max_size) {
+            return nr_classes;
+        }
+        auto cls = size <= min_size ? 0 : log2ceil(size) - log2ceil(min_size);
+        auto cs = class_size(cls);
+        if (size < cs - cs / 4) {
+            return nr_classes;
+        }
+        return cls;
+    }
+public:
+    dma_buffer_pool()
+            : _reclaimer([this] (size_t bytes) { return reclaim(bytes); }, memory::reclaimer_scope::sync,
+                    // cached buffers are free memory in all but name
+                    memory::reclaimer::default_priority / 4) {
+        namespace sm = metrics;
+        _metrics.add_group("dma_buffer_pool", {
+            sm::make_derive("hits", _stats.hits, sm::description("DMA buffer allocations served from a cached buffer")),
+            sm::make_derive("misses", _stats.misses, sm::description("DMA buffer allocations of a pooled size that went to the allocator")),
+            sm::make_derive("bypassed", _stats.bypassed, sm::description("DMA buffer allocations of a size or alignment that is not pooled")),
+            sm::make_derive("dropped", _stats.dropped, sm::description("Freed DMA buffers given back to the allocator because the pool was full")),
+            sm::make_current_bytes("cached_bytes", [this] { return _stats.cached_bytes; },
+                    sm::description("Memory held by the free DMA buffers cached by the pool")),
+            sm::make_current_bytes("used_bytes", [this] { return _stats.used_bytes; },
+                    sm::description("Memory held by the pooled DMA buffers in use")),
+        });
+        local_dma_buffer_pool = this;
+    }
+    ~dma_buffer_pool() {
+        local_dma_buffer_pool = nullptr;
+        clear();
+    }
+    temporary_buffer<char> allocate(size_t align, size_t size) {
+        auto cls = size_class(size);
+        if (cls == nr_classes || !align || align > alignment || alignment % align) {
+            ++_stats.bypassed;
+            return temporary_buffer<char>::aligned(align, size);
+        }
+        void* p;
+        auto& fl = _free[cls];
+        if (!fl.empty()) {
+            ++_stats.hits;
+            p = fl.back();
+            fl.pop_back();
+            _stats.cached_bytes -= class_size(cls);
+        } else {
+            ++_stats.misses;
+            if (::posix_memalign(&p, alignment, class_size(cls))) {
+                throw std::bad_alloc();
+            }
+        }
+        _stats.used_bytes += class_size(cls);
+        return temporary_buffer<char>(static_cast<char*>(p), size, make_deleter(deleter(), [this, p, cls] {
+            if (local_dma_buffer_pool == this) {
+                release(p, cls);
+            } else {
+                // freed on another shard, or after the pool was destroyed
+                ::free(p);
+            }
+        }));
+    }
+    void release(void* p, unsigned cls) {
+        _stats.used_bytes -= class_size(cls);
+        if (_stats.cached_bytes + class_size(cls) > dma_buffer_pool_capacity) {
+            ++_stats.dropped;
+            ::free(p);
+            return;
+        }
+        try {
+            _free[cls].push_back(p);
+        } catch (...) {
+            ::free(p);
+            return;
+        }
+        _stats.cached_bytes += class_size(cls);
+    }
+    // Frees cached buffers, largest first, until \c bytes are freed
+    size_t reclaim(size_t bytes) {
+        size_t freed = 0;
+        for (unsigned cls = nr_classes; cls-- > 0 && freed < bytes; ) {
+            auto& fl = _free[cls];
+            while (!fl.empty() && freed < bytes) {
+                ::free(fl.back());
+                fl.pop_back();
+                freed += class_size(cls);
+            }
+        }
+        _stats.cached_bytes -= freed;
+        return freed;
+    }
+    void clear() {
+        reclaim(_stats.cached_bytes);
+    }
+    const dma_buffer_pool_stats& stats() const {
+        return _stats;
+    }
+};
+
+dma_buffer_pool& local_pool() {
+    static thread_local dma_buffer_pool pool;
+    return pool;
+}
+
+}
+
+temporary_buffer<char> allocate_dma_buffer(size_t alignment, size_t size) {
+    return local_pool().allocate(alignment, size);
+}
+
+dma_buffer_pool_stats get_dma_buffer_pool_stats() {
+    return local_pool().stats();
+}
+
+void drop_cached_dma_buffers() {
+    local_pool().clear();
+}
+
+void set_dma_buffer_pool_capacity(size_t bytes) {
+    dma_buffer_pool_capacity = bytes;
+    if (local_dma_buffer_pool) {
+        local_dma_buffer_pool->reclaim(local_dma_buffer_pool->stats().cached_bytes > bytes
+                ? local_dma_buffer_pool->stats().cached_bytes - bytes : 0);
+    }
+}
+
+}
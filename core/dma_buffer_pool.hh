@@ -0,0 +1,93 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "temporary_buffer.hh"
+
+namespace seastar {
+
+/// \addtogroup fileio-module
+/// @{
+
+/// Statistics of the calling shard's pool of DMA buffers, see
+/// \ref allocate_dma_buffer()
+struct dma_buffer_pool_stats {
+    /// Allocations served from a cached buffer
+    uint64_t hits = 0;
+    /// Allocations of a pooled size that had to go to the allocator
+    uint64_t misses = 0;
+    /// Allocations that were too large, too oddly sized or too strictly
+    /// aligned to be pooled
+    uint64_t bypassed = 0;
+    /// Buffers given back to the allocator because the pool was full
+    uint64_t dropped = 0;
+    /// Bytes held by the cached, free, buffers
+    size_t cached_bytes = 0;
+    /// Bytes held by the pooled buffers that are in use
+    size_t used_bytes = 0;
+};
+
+/// Allocates a buffer of \c size elements, aligned on \c alignment bytes,
+/// for DMA reads and writes.
+///
+/// Buffers of the standard sizes, the powers of two from 4K to 1M, are
+/// taken from a per-shard pool and given back to it when the returned
+/// buffer (and all its shares) are destroyed, so that streaming reads and
+/// writes reuse the same few buffers rather than churn through large
+/// allocations. Other sizes are rounded up to a standard size when that
+/// wastes at most a quarter of it, and allocated directly otherwise, as are
+/// alignments stricter than 4K.
+///
+/// The pool holds up to \c --dma-buffer-pool-memory bytes of free buffers,
+/// and gives them back to the allocator when the shard runs low on memory.
+/// Buffers may be freed on any shard; those freed on another shard than
+/// the one that allocated them are not recycled.
+temporary_buffer<char> allocate_dma_buffer(size_t alignment, size_t size);
+
+/// \copydoc allocate_dma_buffer(size_t, size_t)
+template <typename CharType>
+inline
+temporary_buffer<CharType> allocate_dma_buffer(size_t alignment, size_t size) {
+    static_assert(sizeof(CharType) == 1, "must buffer stream of bytes");
+    auto buf = allocate_dma_buffer(alignment, size);
+    auto p = reinterpret_cast<CharType*>(buf.get_write());
+    return temporary_buffer<CharType>(p, size, buf.release());
+}
+
+/// Returns the statistics of the calling shard's pool of DMA buffers.
+dma_buffer_pool_stats get_dma_buffer_pool_stats();
+
+/// Gives the calling shard's cached DMA buffers back to the allocator.
+void drop_cached_dma_buffers();
+
+/// \cond internal
+
+// Sets how many bytes of free buffers the calling shard's pool may cache.
+void set_dma_buffer_pool_capacity(size_t bytes);
+
+/// \endcond
+
+/// @}
+
+}
@@ -0,0 +1,117 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "event_trace.hh"
+#include "posix.hh"
+#include "bitops.hh"
+
+namespace seastar {
+
+event_trace::event_trace(unsigned shard, size_t capacity, sstring stall_dump_path)
+        : _mask((uint64_t(1) << log2ceil(std::max<size_t>(capacity, 1))) - 1)
+        , _ring(new event_trace_record[_mask + 1]())
+        , _anchor_tsc(read_tsc())
+        , _anchor_ns(now_ns())
+        , _shard(shard) {
+    if (!stall_dump_path.empty()) {
+        _stall_fd = ::open(stall_dump_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        throw_system_error_on(_stall_fd == -1, "open");
+    }
+}
+
+event_trace::~event_trace() {
+    if (_stall_fd != -1) {
+        ::close(_stall_fd);
+    }
+}
+
+namespace {
+
+// Where the records of a ring are, oldest first: at most two runs
+struct ring_runs {
+    event_trace_dump_header header;
+    iovec iov[3];
+    int nr_iov;
+};
+
+}
+
+static void fill_dump(ring_runs& r, unsigned shard, uint64_t anchor_tsc, uint64_t anchor_ns,
+        const event_trace_record* ring, uint64_t mask, uint64_t recorded) noexcept {
+    auto& h = r.header;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, "SSEVTRC1", sizeof(h.magic));
+    h.shard = shard;
+    h.anchor_tsc[0] = anchor_tsc;
+    h.anchor_ns[0] = anchor_ns;
+    h.anchor_tsc[1] = event_trace::read_tsc();
+    h.anchor_ns[1] = event_trace::now_ns();
+    h.recorded = recorded;
+    auto size = mask + 1;
+    h.nr_records = std::min(recorded, size);
+    r.iov[0] = iovec{&h, sizeof(h)};
+    r.nr_iov = 1;
+    auto first = recorded > size ? recorded & mask : 0;
+    auto tail = std::min(h.nr_records, size - first);
+    r.iov[r.nr_iov++] = iovec{const_cast<event_trace_record*>(ring + first), tail * sizeof(event_trace_record)};
+    if (tail < h.nr_records) {
+        r.iov[r.nr_iov++] = iovec{const_cast<event_trace_record*>(ring), (h.nr_records - tail) * sizeof(event_trace_record)};
+    }
+}
+
+sstring event_trace::dump() const {
+    ring_runs r;
+    fill_dump(r, _shard, _anchor_tsc, _anchor_ns, _ring.get(), _mask, _recorded.load(std::memory_order_relaxed));
+    size_t size = 0;
+    for (int i = 0; i < r.nr_iov; ++i) {
+        size += r.iov[i].iov_len;
+    }
+    sstring ret(sstring::initialized_later(), size);
+    auto out = ret.begin();
+    for (int i = 0; i < r.nr_iov; ++i) {
+        out = std::copy_n(static_cast<const char*>(r.iov[i].iov_base), r.iov[i].iov_len, out);
+    }
+    return ret;
+}
+
+void event_trace::dump_on_stall() noexcept {
+    if (_stall_fd == -1) {
+        return;
+    }
+    ring_runs r;
+    fill_dump(r, _shard, _anchor_tsc, _anchor_ns, _ring.get(), _mask, _recorded.load(std::memory_order_relaxed));
+    // plain system calls, safe in a signal handler
+    off_t size = 0;
+    for (int i = 0; i < r.nr_iov; ++i) {
+        size += r.iov[i].iov_len;
+    }
+    if (::pwritev(_stall_fd, r.iov, r.nr_iov, 0) == size) {
+        (void)::ftruncate(_stall_fd, size);
+    }
+}
+
+}
@@ -0,0 +1,134 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "sstring.hh"
+
+namespace seastar {
+
+/// Kinds of reactor events recorded by the event trace
+enum class event_trace_type : uint8_t {
+    task_start = 0,  ///< a task of the group starts running
+    task_end = 1,    ///< the task ended
+    poll = 2,        ///< poller number \c arg found work
+    io_submit = 3,   ///< an I/O request of priority class \c group, of \c arg bytes, is dispatched
+    io_complete = 4, ///< the request completed
+    smp_send = 5,    ///< a message is sent to shard \c arg
+    smp_receive = 6, ///< a message from shard \c arg is processed
+    timer_fire = 7,  ///< a timer callback runs
+    stall = 8,       ///< the stall detector fired, after \c arg ms
+};
+
+/// A recorded reactor event, in the event trace dump format
+struct event_trace_record {
+    /// time stamp counter (or CLOCK_MONOTONIC nanoseconds on machines
+    /// without one) when the event happened
+    uint64_t tsc;
+    uint32_t arg;
+    /// the scheduling group, or I/O priority class, of the event
+    uint16_t group;
+    event_trace_type type;
+    uint8_t reserved;
+};
+
+static_assert(sizeof(event_trace_record) == 16, "the dump format changed");
+
+/// Header of an event trace dump, which is followed by its records,
+/// oldest first; all fields are in the host's byte order.
+///
+/// Time stamps are converted to time with the two anchors, which are
+/// readings of the time stamp counter and of CLOCK_MONOTONIC taken at the
+/// same time, when the trace started and when it was dumped.
+struct event_trace_dump_header {
+    char magic[8]; // "SSEVTRC1"
+    uint32_t shard;
+    uint32_t reserved;
+    uint64_t anchor_tsc[2];
+    uint64_t anchor_ns[2];
+    uint64_t nr_records;
+    /// events recorded since the trace started, including those that
+    /// were overwritten
+    uint64_t recorded;
+};
+
+/// \cond internal
+
+// Per-shard ring of the latest reactor events. It is only written by the
+// reactor thread, and read by it or by its signal handlers (the stall
+// detector dumps it), so the write position is published with a signal
+// fence rather than a lock.
+class event_trace {
+    uint64_t _mask;
+    std::unique_ptr<event_trace_record[]> _ring;
+    std::atomic<uint64_t> _recorded = { 0 };
+    uint64_t _anchor_tsc;
+    uint64_t _anchor_ns;
+    unsigned _shard;
+    int _stall_fd = -1;
+public:
+    static uint64_t now_ns() noexcept {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+    static uint64_t read_tsc() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return now_ns();
+#endif
+    }
+    // capacity is rounded up to a power of two; if stall_dump_path is not
+    // empty, the trace is dumped to it when the stall detector fires
+    event_trace(unsigned shard, size_t capacity, sstring stall_dump_path);
+    ~event_trace();
+    event_trace(const event_trace&) = delete;
+    void operator=(const event_trace&) = delete;
+    void record(event_trace_type type, uint16_t group, uint32_t arg) noexcept {
+        auto n = _recorded.load(std::memory_order_relaxed);
+        auto& r = _ring[n & _mask];
+        r.tsc = read_tsc();
+        r.arg = arg;
+        r.group = group;
+        r.type = type;
+        std::atomic_signal_fence(std::memory_order_release);
+        _recorded.store(n + 1, std::memory_order_relaxed);
+    }
+    // The dump: a header followed by the records, oldest first
+    sstring dump() const;
+    // Writes the dump to the stall dump file, if there is one; async
+    // signal safe
+    void dump_on_stall() noexcept;
+};
+
+/// \endcond
+
+}
@@ -31,6 +31,9 @@
 #include "util/gcc6-concepts.hh"
 #include "util/noncopyable_function.hh"
 #include "../util/defer.hh"
+#include <array>
+#include <chrono>
+#include <limits>
 
 namespace seastar {
 
@@ -113,21 +116,70 @@ std::reference_wrapper<T> unwrap_for_es(reference_wrapper_for_es<T> ref) {
 /// Base execution stage class
 class execution_stage {
 public:
+    using clock_type = std::chrono::steady_clock;
+    static constexpr size_t histogram_buckets = 16;
     struct stats {
         uint64_t tasks_scheduled = 0;
         uint64_t tasks_preempted = 0;
         uint64_t function_calls_enqueued = 0;
         uint64_t function_calls_executed = 0;
+        // The following are only maintained when a latency target is set.
+        // Bucket i counts batches of [2^i, 2^(i+1)) function calls and calls
+        // that waited [2^i, 2^(i+1)) microseconds in the queue, respectively.
+        std::array<uint64_t, histogram_buckets> batch_size_histogram = {};
+        std::array<uint64_t, histogram_buckets> wait_time_histogram = {};
+        uint64_t batch_size_sum = 0;
+        uint64_t wait_time_sum_us = 0;
     };
 protected:
+    static constexpr size_t initial_batch_limit = 16;
+    static constexpr size_t max_batch_limit = 1024;
     bool _empty = true;
     bool _flush_scheduled = false;
     scheduling_group _sg;
     stats _stats;
     sstring _name;
     metrics::metric_group _metric_group;
+    std::chrono::microseconds _latency_target{0};
+    size_t _batch_limit = initial_batch_limit;
+    double _cost_per_call_ns = 0;
 protected:
     virtual void do_flush() noexcept = 0;
+    static unsigned histogram_bucket(uint64_t v) noexcept {
+        unsigned b = v ? std::numeric_limits<unsigned long long>::digits - 1 - __builtin_clzll(v) : 0;
+        return std::min<unsigned>(b, histogram_buckets - 1);
+    }
+    // Records a call that waited \c wait in the queue before being executed.
+    void account_wait(clock_type::duration wait) noexcept {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(wait).count();
+        _stats.wait_time_histogram[histogram_bucket(us)]++;
+        _stats.wait_time_sum_us += us;
+    }
+    // Feedback after a batch of \c calls function calls that took \c runtime
+    // to execute, the oldest of which waited \c max_wait in the queue.
+    //
+    // Whenever the latency target is exceeded the batch limit is halved.
+    // Otherwise a full batch grows it by a quarter as long as the cost per
+    // call keeps going down (or stays within 5%), i.e. as long as larger
+    // batches still improve instruction cache locality.
+    void adapt_batch_limit(size_t calls, clock_type::duration runtime, clock_type::duration max_wait) noexcept {
+        _stats.batch_size_histogram[histogram_bucket(calls)]++;
+        _stats.batch_size_sum += calls;
+        if (max_wait > _latency_target) {
+            _batch_limit = std::max<size_t>(1, _batch_limit / 2);
+            _cost_per_call_ns = 0;
+            return;
+        }
+        if (calls < _batch_limit) {
+            return;
+        }
+        auto cost = std::chrono::duration<double, std::nano>(runtime).count() / calls;
+        if (!_cost_per_call_ns || cost <= _cost_per_call_ns * 1.05) {
+            _batch_limit = std::min(max_batch_limit, _batch_limit + _batch_limit / 4 + 1);
+        }
+        _cost_per_call_ns = cost;
+    }
+    metrics::histogram make_histogram(const std::array<uint64_t, histogram_buckets>& buckets, uint64_t sum) const;
 public:
     explicit execution_stage(const sstring& name, scheduling_group sg = {});
     virtual ~execution_stage();
@@ -148,6 +200,27 @@ class execution_stage {
     /// Returns execution stage usage statistics
     const stats& get_stats() const noexcept { return _stats; }
 
+    /// Sets a latency target for queued function calls
+    ///
+    /// By default a task executing the queued function calls is scheduled as
+    /// soon as the first one is enqueued. With a latency target the stage
+    /// instead waits until an adaptive number of calls has accumulated (or
+    /// the reactor polls), growing that number while it reduces the cost per
+    /// call and halving it whenever a call had to wait longer than \c target.
+    /// Batch sizes and wait times are then recorded in get_stats().
+    ///
+    /// \param target maximum desired time between enqueuing a call and
+    ///               executing it; zero restores the default behaviour
+    void set_latency_target(std::chrono::microseconds target) noexcept {
+        _latency_target = target;
+        _batch_limit = initial_batch_limit;
+        _cost_per_call_ns = 0;
+    }
+
+    /// Returns the number of queued calls that triggers a flush when a latency
+    /// target is set
+    size_t batch_limit() const noexcept { return _batch_limit; }
+
     /// Flushes execution stage
     ///
     /// Ensures that a task which would execute all queued operations is
@@ -263,6 +336,7 @@ class concrete_execution_stage final : public execution_stage {
     struct work_item {
         input_type _in;
         promise_type _ready;
+        clock_type::time_point _enqueued;
 
         work_item(typename internal::wrap_for_es<Args>::type... args) : _in(std::move(args)...) { }
 
@@ -272,7 +346,10 @@ class concrete_execution_stage final : public execution_stage {
     };
     chunked_fifo<work_item, flush_threshold> _queue;
 
-    noncopyable_function<ReturnType (Args...)> _function;
+    // Stage functions often capture a few pointers and a configuration
+    // struct; keep them inline, next to the queue they are called for
+    using function_type = noncopyable_function<ReturnType (Args...), 64>;
+    function_type _function;
 private:
     auto unwrap(input_type&& in) {
         return tuple_map(std::move(in), [] (auto&& obj) {
@@ -280,7 +357,35 @@ class concrete_execution_stage final : public execution_stage {
         });
     }
 
+    void do_flush_adaptive() noexcept {
+        if (_queue.empty()) {
+            return;
+        }
+        auto start = clock_type::now();
+        auto max_wait = start - _queue.front()._enqueued;
+        size_t calls = 0;
+        while (!_queue.empty() && calls < _batch_limit) {
+            auto& wi = _queue.front();
+            account_wait(start - wi._enqueued);
+            futurize<ReturnType>::apply(_function, unwrap(std::move(wi._in))).forward_to(std::move(wi._ready));
+            _queue.pop_front();
+            _stats.function_calls_executed++;
+            calls++;
+
+            if (need_preempt()) {
+                _stats.tasks_preempted++;
+                break;
+            }
+        }
+        _empty = _queue.empty();
+        adapt_batch_limit(calls, clock_type::now() - start, max_wait);
+    }
+
     virtual void do_flush() noexcept override {
+        if (_latency_target.count()) {
+            do_flush_adaptive();
+            return;
+        }
         while (!_queue.empty()) {
             auto& wi = _queue.front();
             futurize<ReturnType>::apply(_function, unwrap(std::move(wi._in))).forward_to(std::move(wi._ready));
@@ -295,13 +400,13 @@ class concrete_execution_stage final : public execution_stage {
         _empty = _queue.empty();
     }
 public:
-    explicit concrete_execution_stage(const sstring& name, scheduling_group sg, noncopyable_function<ReturnType (Args...)> f)
+    explicit concrete_execution_stage(const sstring& name, scheduling_group sg, function_type f)
         : execution_stage(name, sg)
         , _function(std::move(f))
     {
         _queue.reserve(flush_threshold);
     }
-    explicit concrete_execution_stage(const sstring& name, noncopyable_function<ReturnType (Args...)> f)
+    explicit concrete_execution_stage(const sstring& name, function_type f)
         : concrete_execution_stage(name, scheduling_group(), std::move(f)) {
     }
 
@@ -331,7 +436,14 @@ class concrete_execution_stage final : public execution_stage {
         _empty = false;
         _stats.function_calls_enqueued++;
         auto f = _queue.back()._ready.get_future();
-        flush();
+        if (!_latency_target.count()) {
+            flush();
+        } else {
+            _queue.back()._enqueued = clock_type::now();
+            if (_queue.size() >= _batch_limit) {
+                flush();
+            }
+        }
         return f;
     }
 };
@@ -505,10 +617,42 @@ inline execution_stage::execution_stage(const sstring& name, scheduling_group sg
                                   [name, &esm = internal::execution_stage_manager::get()] {
                                       return esm.get_stage(name)->get_stats().function_calls_executed;
                                   }),
+             metrics::make_gauge("batch_limit",
+                                  metrics::description("Number of queued function calls that triggers a flush when a latency target is set"),
+                                  { metrics::label_instance("execution_stage", name), },
+                                  [name, &esm = internal::execution_stage_manager::get()] {
+                                      return esm.get_stage(name)->batch_limit();
+                                  }),
+             metrics::make_histogram("batch_size",
+                                  metrics::description("Number of function calls executed per task, when a latency target is set"),
+                                  { metrics::label_instance("execution_stage", name), },
+                                  [name, &esm = internal::execution_stage_manager::get()] {
+                                      auto& s = *esm.get_stage(name);
+                                      return s.make_histogram(s.get_stats().batch_size_histogram, s.get_stats().batch_size_sum);
+                                  }),
+             metrics::make_histogram("wait_time_us",
+                                  metrics::description("Time function calls spent queued before execution, when a latency target is set"),
+                                  { metrics::label_instance("execution_stage", name), },
+                                  [name, &esm = internal::execution_stage_manager::get()] {
+                                      auto& s = *esm.get_stage(name);
+                                      return s.make_histogram(s.get_stats().wait_time_histogram, s.get_stats().wait_time_sum_us);
+                                  }),
            });
     undo.cancel();
 }
 
+inline metrics::histogram execution_stage::make_histogram(const std::array<uint64_t, histogram_buckets>& buckets, uint64_t sum) const {
+    metrics::histogram h;
+    h.sample_sum = sum;
+    h.buckets.resize(buckets.size());
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        h.sample_count += buckets[i];
+        h.buckets[i].count = buckets[i];
+        h.buckets[i].upper_bound = double((uint64_t(2) << i) - 1);
+    }
+    return h;
+}
+
 inline execution_stage::~execution_stage()
 {
     internal::execution_stage_manager::get().unregister_execution_stage(*this);
@@ -518,6 +662,9 @@ inline execution_stage::execution_stage(execution_stage&& other)
     : _stats(other._stats)
     , _name(std::move(other._name))
     , _metric_group(std::move(other._metric_group))
+    , _latency_target(other._latency_target)
+    , _batch_limit(other._batch_limit)
+    , _cost_per_call_ns(other._cost_per_call_ns)
 {
     internal::execution_stage_manager::get().update_execution_stage_registration(other, *this);
 }
@@ -25,6 +25,7 @@
 #include "chunked_fifo.hh"
 #include <stdexcept>
 #include <exception>
+#include <boost/intrusive/list.hpp>
 #include "timer.hh"
 #include "future-util.hh"
 #include "lowres_clock.hh"
@@ -49,6 +50,11 @@ struct promise_expiry {
 /// T is removed and destroyed from the container immediately after OnExpiry returns.
 /// OnExpiry callback must not modify the container, it can only modify its argument.
 ///
+/// Expiring elements share a single timer, armed for the earliest of their
+/// timeouts, rather than arming one each; pushing an element whose timeout
+/// is not earlier than those of the elements pushed before it, as with a
+/// fixed timeout from now, takes constant time.
+///
 /// The container can only be moved before any elements are pushed.
 ///
 template <typename T, typename OnExpiry = dummy_expiry<T>, typename Clock = lowres_clock>
@@ -59,28 +65,29 @@ class expiring_fifo {
 private:
     struct entry {
         std::experimental::optional<T> payload; // disengaged means that it's expired
-        timer<Clock> tr;
+        time_point timeout = time_point::max();
+        // linked into _expiring while the element may expire
+        boost::intrusive::list_member_hook<> expiry_link;
         entry(T&& payload_) : payload(std::move(payload_)) {}
         entry(const T& payload_) : payload(payload_) {}
-        entry(T payload_, expiring_fifo& ef, time_point timeout)
+        entry(T payload_, time_point timeout_)
                 : payload(std::move(payload_))
-                , tr([this, &ef] {
-                    ef._on_expiry(*payload);
-                    payload = std::experimental::nullopt;
-                    --ef._size;
-                    ef.drop_expired_front();
-                })
-        {
-            tr.arm(timeout);
+                , timeout(timeout_) {
         }
         entry(entry&& x) = delete;
         entry(const entry& x) = delete;
     };
+    using expiry_list = boost::intrusive::list<entry,
+            boost::intrusive::member_hook<entry, boost::intrusive::list_member_hook<>, &entry::expiry_link>,
+            boost::intrusive::constant_time_size<false>>;
 
     // There is an invariant that the front element is never expired.
     chunked_fifo<entry> _list;
+    // The elements that may expire, earliest timeout first
+    expiry_list _expiring;
     OnExpiry _on_expiry;
     size_t _size = 0;
+    timer<Clock> _timer;
 
     // Ensures that front() is not expired by dropping expired elements from the front.
     void drop_expired_front() {
@@ -88,6 +95,30 @@ class expiring_fifo {
             _list.pop_front();
         }
     }
+    // The timer is only ever moved earlier: when the earliest element
+    // leaves, it is left to fire early, and re-armed then, rather than
+    // re-armed on every removal
+    void arm_timer(time_point timeout) {
+        if (_timer.armed() && _timer.get_timeout() <= timeout) {
+            return;
+        }
+        _timer.set_callback([this] { expire(); });
+        _timer.rearm(timeout);
+    }
+    void expire() {
+        auto now = Clock::now();
+        while (!_expiring.empty() && _expiring.front().timeout <= now) {
+            auto& e = _expiring.front();
+            _expiring.pop_front();
+            _on_expiry(*e.payload);
+            e.payload = std::experimental::nullopt;
+            --_size;
+        }
+        drop_expired_front();
+        if (!_expiring.empty()) {
+            arm_timer(_expiring.front().timeout);
+        }
+    }
 public:
     expiring_fifo() = default;
     expiring_fifo(OnExpiry on_expiry) : _on_expiry(std::move(on_expiry)) {}
@@ -152,7 +183,16 @@ class expiring_fifo {
     /// case it never expires.
     void push_back(T payload, time_point timeout) {
         if (timeout < time_point::max()) {
-            _list.emplace_back(std::move(payload), *this, timeout);
+            _list.emplace_back(std::move(payload), timeout);
+            auto& e = _list.back();
+            auto i = _expiring.end();
+            while (i != _expiring.begin() && std::prev(i)->timeout > timeout) {
+                --i;
+            }
+            _expiring.insert(i, e);
+            if (&_expiring.front() == &e) {
+                arm_timer(timeout);
+            }
         } else {
             _list.emplace_back(std::move(payload));
         }
@@ -162,6 +202,10 @@ class expiring_fifo {
     /// Removes the element at the front.
     /// Can be called only if !empty().
     void pop_front() {
+        auto& e = _list.front();
+        if (e.expiry_link.is_linked()) {
+            _expiring.erase(_expiring.iterator_to(e));
+        }
         _list.pop_front();
         --_size;
         drop_expired_front();
@@ -32,17 +32,95 @@
 #include <chrono>
 #include <unordered_set>
 #include <cmath>
+#include <limits>
+#include <atomic>
 
 namespace seastar {
 
 /// \addtogroup io-module
 /// @{
 
+/// \brief describes a request that passes through the \ref fair_queue.
+///
+/// A request has two dimensions: its weight, in request count units, and
+/// its size, in byte units. Both count against the queue's limits, and
+/// the share of the queue's capacity they represent is what the request
+/// costs its priority class.
+///
+/// \related fair_queue
+struct fair_queue_request_descriptor {
+    unsigned weight = 1; ///< the weight of this request for capacity purposes (IOPS).
+    unsigned size = 0;   ///< the effective size of this request, for bandwidth purposes.
+};
+
+/// \brief Dispatch capacity shared by several \ref fair_queue instances
+///
+/// Fair queues configured with the same shared capacity count their
+/// executing requests against it, instead of against their own counters,
+/// so that together they do not exceed their (identical) limits. They may
+/// live on different shards: the capacity is taken and returned with
+/// atomic operations, without locks or cross-shard messages.
+///
+/// A queue is not notified when another queue returns capacity; it must
+/// be polled with \ref fair_queue::dispatch_pending() while it has
+/// waiters.
+///
+/// \related fair_queue
+class fair_queue_shared_capacity {
+    std::atomic<unsigned> _requests = { 0 };
+    std::atomic<unsigned> _req_count = { 0 };
+    std::atomic<unsigned> _bytes_count = { 0 };
+
+    static bool reserve(std::atomic<unsigned>& counter, unsigned n, unsigned limit) {
+        auto cur = counter.load(std::memory_order_relaxed);
+        do {
+            if (cur >= limit) {
+                return false;
+            }
+        } while (!counter.compare_exchange_weak(cur, cur + n, std::memory_order_relaxed));
+        return true;
+    }
+public:
+    /// Takes the capacity \c desc needs, if the requests executing are below
+    /// the limits; returns whether it was taken.
+    bool try_reserve(fair_queue_request_descriptor desc, unsigned capacity, unsigned max_req_count, unsigned max_bytes_count) {
+        if (!reserve(_requests, 1, capacity)) {
+            return false;
+        }
+        if (!reserve(_req_count, desc.weight, max_req_count)) {
+            _requests.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (!reserve(_bytes_count, desc.size, max_bytes_count)) {
+            _req_count.fetch_sub(desc.weight, std::memory_order_relaxed);
+            _requests.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+    /// Returns the capacity taken by \ref try_reserve()
+    void release(fair_queue_request_descriptor desc) {
+        _bytes_count.fetch_sub(desc.size, std::memory_order_relaxed);
+        _req_count.fetch_sub(desc.weight, std::memory_order_relaxed);
+        _requests.fetch_sub(1, std::memory_order_relaxed);
+    }
+    /// Returns whether a request would likely be admitted now
+    bool has_room(unsigned capacity, unsigned max_req_count, unsigned max_bytes_count) const {
+        return _requests.load(std::memory_order_relaxed) < capacity
+                && _req_count.load(std::memory_order_relaxed) < max_req_count
+                && _bytes_count.load(std::memory_order_relaxed) < max_bytes_count;
+    }
+    /// \return the number of requests executing in all the queues
+    unsigned requests_executing() const {
+        return _requests.load(std::memory_order_relaxed);
+    }
+};
+
 /// \cond internal
 class priority_class {
     struct request {
         promise<> pr;
-        unsigned weight;
+        fair_queue_request_descriptor desc;
     };
     friend class fair_queue;
     uint32_t _shares = 0;
@@ -70,9 +148,12 @@ using priority_class_ptr = lw_shared_ptr<priority_class>;
 /// This is a fair queue, allowing multiple request producers to queue requests
 /// that will then be served proportionally to their classes' shares.
 ///
-/// To each request, a weight can also be associated. A request of weight 1 will consume
-/// 1 share. Higher weights for a request will consume a proportionally higher amount of
-/// shares.
+/// To each request, a weight and a size can also be associated (see
+/// \ref fair_queue_request_descriptor). A request consumes shares in
+/// proportion to the fraction of the queue's request count and byte
+/// limits it takes, so that, for example, a large write can be made to
+/// cost as much as the many small reads the device could have served
+/// in its place.
 ///
 /// The user of this interface is expected to register multiple \ref priority_class
 /// objects, which will each have a shares attribute.
@@ -85,6 +166,27 @@ using priority_class_ptr = lw_shared_ptr<priority_class>;
 /// them first, until balance is restored. This balancing is expected to happen within
 /// a certain time window that obeys an exponential decay.
 class fair_queue {
+public:
+    /// \brief Fair Queue configuration structure.
+    ///
+    /// Sets the operation parameters of a \ref fair_queue
+    /// \related fair_queue
+    struct config {
+        /// how many concurrent requests are allowed in this queue
+        unsigned capacity = std::numeric_limits<unsigned>::max();
+        /// the queue exponential decay parameter, as in exp(-1/tau * t)
+        std::chrono::microseconds tau = std::chrono::milliseconds(100);
+        /// the sum of the weights of executing requests above which no
+        /// more requests are dispatched
+        unsigned max_req_count = std::numeric_limits<int>::max();
+        /// the sum of the sizes of executing requests above which no
+        /// more requests are dispatched
+        unsigned max_bytes_count = std::numeric_limits<int>::max();
+        /// if set, the limits above apply to the executing requests of all
+        /// the queues sharing this capacity, rather than to this queue's
+        fair_queue_shared_capacity* shared_capacity = nullptr;
+    };
+private:
     friend priority_class;
 
     struct class_compare {
@@ -93,8 +195,11 @@ class fair_queue {
         }
     };
 
-    semaphore _sem;
-    unsigned _capacity;
+    config _config;
+    unsigned _requests_executing = 0;
+    unsigned _requests_queued = 0;
+    unsigned _req_count_executing = 0;
+    unsigned _bytes_count_executing = 0;
     using clock_type = std::chrono::steady_clock::time_point;
     clock_type _base;
     std::chrono::microseconds _tau;
@@ -118,19 +223,37 @@ class fair_queue {
         return h;
     }
 
-    void execute_one() {
-        _sem.wait().then([this] {
-            priority_class_ptr h;
-            do {
-                h = pop_priority_class();
-            } while (h->_queue.empty());
+    bool can_dispatch() const {
+        if (_config.shared_capacity) {
+            return _requests_queued;
+        }
+        return _requests_queued
+                && _requests_executing < _config.capacity
+                && _req_count_executing < _config.max_req_count
+                && _bytes_count_executing < _config.max_bytes_count;
+    }
+
+    void dispatch_requests() {
+        while (can_dispatch()) {
+            while (_handles.top()->_queue.empty()) {
+                pop_priority_class();
+            }
+            if (_config.shared_capacity && !_config.shared_capacity->try_reserve(_handles.top()->_queue.front().desc,
+                    _config.capacity, _config.max_req_count, _config.max_bytes_count)) {
+                return;
+            }
+            auto h = pop_priority_class();
 
             auto req = std::move(h->_queue.front());
             h->_queue.pop_front();
+            _requests_queued--;
+            _requests_executing++;
+            _req_count_executing += req.desc.weight;
+            _bytes_count_executing += req.desc.size;
 
             req.pr.set_value();
             auto delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
-            auto req_cost  = float(req.weight) / h->_shares;
+            auto req_cost = (float(req.desc.weight) / _config.max_req_count + float(req.desc.size) / _config.max_bytes_count) / h->_shares;
             auto cost  = expf(1.0f/_tau.count() * delta.count()) * req_cost;
             float next_accumulated = h->_accumulated + cost;
             while (std::isinf(next_accumulated)) {
@@ -145,14 +268,30 @@ class fair_queue {
             if (!h->_queue.empty()) {
                 push_priority_class(h);
             }
-            return make_ready_future<>();
-        });
+        }
+    }
+
+    void notify_request_finished(fair_queue_request_descriptor desc) {
+        _requests_executing--;
+        _req_count_executing -= desc.weight;
+        _bytes_count_executing -= desc.size;
+        if (_config.shared_capacity) {
+            _config.shared_capacity->release(desc);
+        }
+        dispatch_requests();
     }
 
     float normalize_factor() const {
         return std::numeric_limits<float>::min();
     }
 
+    static config make_config(unsigned capacity, std::chrono::microseconds tau) {
+        config cfg;
+        cfg.capacity = capacity;
+        cfg.tau = tau;
+        return cfg;
+    }
+
     void normalize_stats() {
         auto time_delta = std::log(normalize_factor()) * _tau;
         // time_delta is negative; and this may advance _base into the future
@@ -162,15 +301,21 @@ class fair_queue {
         }
     }
 public:
+    /// Constructs a fair queue with configuration parameters \c cfg.
+    ///
+    /// \param cfg an instance of the class \ref config
+    explicit fair_queue(config cfg)
+                                           : _config(std::move(cfg))
+                                           , _base(std::chrono::steady_clock::now())
+                                           , _tau(_config.tau) {
+    }
+
     /// Constructs a fair queue with a given \c capacity.
     ///
     /// \param capacity how many concurrent requests are allowed in this queue.
     /// \param tau the queue exponential decay parameter, as in exp(-1/tau * t)
     explicit fair_queue(unsigned capacity, std::chrono::microseconds tau = std::chrono::milliseconds(100))
-                                           : _sem(capacity)
-                                           , _capacity(capacity)
-                                           , _base(std::chrono::steady_clock::now())
-                                           , _tau(tau) {
+                                           : fair_queue(make_config(capacity, tau)) {
     }
 
     /// Registers a priority class against this fair queue.
@@ -192,14 +337,39 @@ class fair_queue {
 
     /// \return how many waiters are currently queued for all classes.
     size_t waiters() const {
-        return _sem.waiters();
+        return _requests_queued;
     }
 
-    /// Executes the function \c func through this class' \ref fair_queue, with weight \c weight
+    /// \return the number of requests currently executing
+    size_t requests_currently_executing() const {
+        return _requests_executing;
+    }
+
+    /// Dispatches the queued requests that fit in the capacity, for queues
+    /// with a shared capacity, which other queues may have returned.
+    ///
+    /// \return whether any request was dispatched
+    bool dispatch_pending() {
+        auto queued = _requests_queued;
+        dispatch_requests();
+        return _requests_queued != queued;
+    }
+
+    /// \return whether \ref dispatch_pending() would likely dispatch a request
+    bool can_dispatch_pending() const {
+        if (!_config.shared_capacity) {
+            return can_dispatch();
+        }
+        return _requests_queued
+                && _config.shared_capacity->has_room(_config.capacity, _config.max_req_count, _config.max_bytes_count);
+    }
+
+    /// Executes the function \c func through this class' \ref fair_queue, consuming
+    /// the capacity described by \c desc
     ///
     /// \return \c func's return value, if \c func returns a future, or future<T> if \c func returns a non-future of type T.
     template <typename Func>
-    futurize_t<std::result_of_t<Func()>> queue(priority_class_ptr pc, unsigned weight, Func func) {
+    futurize_t<std::result_of_t<Func()>> queue(priority_class_ptr pc, fair_queue_request_descriptor desc, Func func) {
         // We need to return a future in this function on which the caller can wait.
         // Since we don't know which queue we will use to execute the next request - if ours or
         // someone else's, we need a separate promise at this point.
@@ -207,20 +377,26 @@ class fair_queue {
         auto fut = pr.get_future();
 
         push_priority_class(pc);
-        pc->_queue.push_back(priority_class::request{std::move(pr), weight});
-        try {
-            execute_one();
-        } catch (...) {
-            pc->_queue.pop_back();
-            throw;
-        }
+        pc->_queue.push_back(priority_class::request{std::move(pr), desc});
+        _requests_queued++;
+        dispatch_requests();
         return fut.then([func = std::move(func)] {
             return func();
-        }).finally([this] {
-            _sem.signal();
+        }).finally([this, desc] {
+            notify_request_finished(desc);
         });
     }
 
+    /// Executes the function \c func through this class' \ref fair_queue, with weight \c weight
+    ///
+    /// \return \c func's return value, if \c func returns a future, or future<T> if \c func returns a non-future of type T.
+    template <typename Func>
+    futurize_t<std::result_of_t<Func()>> queue(priority_class_ptr pc, unsigned weight, Func func) {
+        fair_queue_request_descriptor desc;
+        desc.weight = weight;
+        return queue(std::move(pc), desc, std::move(func));
+    }
+
     /// Updates the current shares of this priority class
     ///
     /// \param new_shares the new number of shares for this priority class
@@ -22,11 +22,17 @@
 #pragma once
 
 #include "file.hh"
+#include "shared_future.hh"
+#include "timer.hh"
 #include <deque>
+#include <map>
 #include <atomic>
+#include <memory>
 
 namespace seastar {
 
+class io_queue;
+
 class posix_file_handle_impl : public seastar::file_handle_impl {
     int _fd;
     std::atomic<unsigned>* _refcount;
@@ -43,6 +49,45 @@ class posix_file_handle_impl : public seastar::file_handle_impl {
 
 class posix_file_impl : public file_impl {
     std::atomic<unsigned>* _refcount = nullptr;
+    // of the device the file is on
+    io_queue* _io_queue;
+    // Flushes made while one is in progress wait for the next one, which
+    // they all share
+    bool _flushing = false;
+    std::unique_ptr<shared_promise<>> _next_flush;
+    // dma_read_bulk() calls waiting to be merged, when merging reads
+    struct bulk_read {
+        uint64_t offset;
+        size_t len;
+        const io_priority_class* pc;
+        promise<temporary_buffer<uint8_t>> pr;
+    };
+    bool _merge_reads = false;
+    std::vector<bulk_read> _bulk_reads;
+    // discard() calls waiting to be issued, when batching them: merged
+    // ranges, from offset to end, which all complete together
+    struct discard_batch {
+        std::map<uint64_t, uint64_t> ranges;
+        shared_promise<> done;
+    };
+    bool _batch_discards = false;
+    std::unique_ptr<discard_batch> _pending_discards;
+    timer<> _discard_timer;
+    // When the pending discards were queued, and the shard's I/O count
+    // when their idle wait last started
+    timer<>::clock::time_point _discards_queued;
+    uint64_t _discard_io_mark = 0;
+    // Batches are issued one after the other
+    future<> _discards_issued = make_ready_future<>();
+    // Of the file's reads and writes, when tagged; shared with those in flight
+    lw_shared_ptr<file_latency_stats> _latency_stats;
+    // Opened without O_DIRECT, so that reads may be served from the page cache
+    bool _buffered = false;
+    // Opened with O_DSYNC, so that writes are queued as dsync writes
+    bool _dsync = false;
+protected:
+    // Discards with BLKDISCARD rather than by punching holes
+    bool _blockdev = false;
 public:
     int _fd;
     posix_file_impl(int fd, file_open_options options);
@@ -61,9 +106,28 @@ class posix_file_impl : public file_impl {
     virtual future<> close() noexcept override;
     virtual std::unique_ptr<seastar::file_handle_impl> dup() override;
     virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)> next) override;
+    virtual subscription<std::vector<directory_scan_entry>> scan_directory(
+            std::function<future<> (std::vector<directory_scan_entry>)> next, directory_scan_options options) override;
     virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc);
 private:
     void query_dma_alignment();
+    void find_io_queue();
+    void detect_open_flags();
+    // Reads into iov from the page cache without blocking when it holds the
+    // data, and from the backend or a syscall thread otherwise
+    future<size_t> read_buffered(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc);
+    future<size_t> do_read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc);
+    future<temporary_buffer<uint8_t>> do_dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc);
+    void merge_bulk_reads();
+    template <typename Func>
+    future<io_event> track_latency(Func submit);
+    future<> queue_discard(uint64_t offset, uint64_t length);
+    void maybe_issue_discards();
+    void issue_discards();
+    // Discards [offset, offset + length) of the file, or of the block device
+    static future<> discard_range(int fd, bool blockdev, uint64_t offset, uint64_t length);
+    future<> do_flush();
+    void start_next_flush();
 
     /**
      * Try to read from the given position where the previous short read has
@@ -124,6 +188,10 @@ class append_challenged_posix_file_impl : public posix_file_impl {
     // Set when the user closes the file
     bool _done = false;
     bool _sloppy_size = false;
+    // If non-zero, the file is extended ahead of appending writes by this
+    // much, in the background
+    uint64_t _extension_size = 0;
+    bool _extending = false;
     // Fulfiled when _done and I/O is complete
     promise<> _completed;
 private:
@@ -133,6 +201,7 @@ class append_challenged_posix_file_impl : public posix_file_impl {
     bool may_dispatch(const op& candidate) const noexcept;
     void dispatch(op& candidate) noexcept;
     void optimize_queue() noexcept;
+    void maybe_extend() noexcept;
     void process_queue() noexcept;
     bool may_quit() const noexcept;
     void enqueue(op&& op);
@@ -154,7 +223,6 @@ class blockdev_file_impl : public posix_file_impl {
 public:
     blockdev_file_impl(int fd, file_open_options options);
     future<> truncate(uint64_t length) override;
-    future<> discard(uint64_t offset, uint64_t length) override;
     future<uint64_t> size() override;
     virtual future<> allocate(uint64_t position, uint64_t length) override;
 };
@@ -28,6 +28,7 @@
 #include "core/align.hh"
 #include "core/future-util.hh"
 #include "core/fair_queue.hh"
+#include "core/dma_buffer_pool.hh"
 #include <experimental/optional>
 #include <system_error>
 #include <sys/stat.h>
@@ -74,6 +75,35 @@ struct directory_entry {
     std::experimental::optional<directory_entry_type> type;
 };
 
+/// A directory entry returned by \ref file::scan_directory()
+struct directory_scan_entry {
+    /// Name of the file in a directory entry.  Will never be "." or "..".  Only the last component is included.
+    sstring name;
+    /// Type of the directory entry, if known.
+    std::experimental::optional<directory_entry_type> type;
+    /// Metadata of the file, as returned by lstat(), if requested with
+    /// \ref directory_scan_options::stat and it could be read.
+    std::experimental::optional<struct stat> stat;
+};
+
+/// Options for \ref file::scan_directory()
+struct directory_scan_options {
+    /// Bytes of directory entries read at a time; each batch holds the
+    /// entries read together (on Linux, about 30 bytes plus the name each)
+    size_t buffer_size = 64 * 1024;
+    /// Whether to stat() the entries, together with reading them
+    bool stat = false;
+};
+
+/// Latency of the reads and writes of an open file, from their submission
+/// to their completion; see \ref file_open_options::latency_tag
+struct file_latency_stats {
+    sstring tag;
+    uint64_t ops = 0;
+    std::chrono::steady_clock::duration total_latency = {};
+    std::chrono::steady_clock::duration max_latency = {};
+};
+
 /// File open options
 ///
 /// Options used to configure an open file.
@@ -83,6 +113,27 @@ struct file_open_options {
     uint64_t extent_allocation_size_hint = 1 << 20; ///< Allocate this much disk space when extending the file
     bool sloppy_size = false; ///< Allow the file size not to track the amount of data written until a flush
     uint64_t sloppy_size_hint = 1 << 20; ///< Hint as to what the eventual file size will be
+    /// If non-zero, on filesystems that serialize appending writes (XFS),
+    /// extend the file with fallocate() ahead of the writes, in chunks of
+    /// this many bytes, so that appending writes do not change its size and
+    /// may run concurrently. The extra space is trimmed by \ref file::close();
+    /// until then the file's on-disk size may exceed the data written.
+    uint64_t append_extension_size = 0;
+    /// Merge the \ref file::dma_read_bulk() calls made in the same
+    /// scheduling round that read adjacent or overlapping ranges into
+    /// single reads; for files read by many concurrent streams or lookups.
+    bool merge_reads = false;
+    /// Queue \ref file::discard() calls and issue them in the background,
+    /// merging adjacent or overlapping ranges, under their own priority class
+    /// whose bandwidth is capped by the \c --discard-bandwidth option; with
+    /// \c --discard-defer, they also wait for the shard's disk I/O to go
+    /// quiet. The discards' futures resolve once their ranges are discarded;
+    /// \ref file::close() issues and waits for the queued ones.
+    bool batch_discards = false;
+    /// If not empty, track the latency of the file's reads and writes, under
+    /// this tag, so that the file shows in \ref reactor::slowest_files()
+    /// when it is among the slowest open files of its shard.
+    sstring latency_tag;
 };
 
 /// \cond internal
@@ -135,6 +186,8 @@ class file_impl {
     virtual future<> close() = 0;
     virtual std::unique_ptr<file_handle_impl> dup();
     virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)> next) = 0;
+    virtual subscription<std::vector<directory_scan_entry>> scan_directory(
+            std::function<future<> (std::vector<directory_scan_entry>)> next, directory_scan_options options);
     virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) = 0;
 
     friend class reactor;
@@ -339,6 +392,11 @@ class file {
     ///
     /// Prior to a flush, written data may or may not survive a power failure.  After
     /// a flush, data is guaranteed to be on disk.
+    ///
+    /// Files opened with \ref open_flags::dsync need no flush for the data they
+    /// were written: each write is durable when it completes. The file size is
+    /// still only stable after a flush if it was changed other than by writes
+    /// (\ref truncate(), \ref allocate(), or \ref file_open_options::sloppy_size).
     future<> flush() {
         return _file_impl->flush();
     }
@@ -399,6 +457,20 @@ class file {
         return _file_impl->list_directory(std::move(next));
     }
 
+    /// Returns a directory listing in batches, given that this file object
+    /// is a directory.
+    ///
+    /// Unlike \ref list_directory(), which hands out entries one at a time,
+    /// each batch holds all the entries read by one trip to a syscall
+    /// thread, and, if \ref directory_scan_options::stat is set, their
+    /// metadata, read in one more trip. This makes scanning directories of
+    /// many files much cheaper than listing them and calling file_stat()
+    /// on each.
+    subscription<std::vector<directory_scan_entry>> scan_directory(
+            std::function<future<> (std::vector<directory_scan_entry>)> next, directory_scan_options options = {}) {
+        return _file_impl->scan_directory(std::move(next), std::move(options));
+    }
+
     /**
      * Read a data bulk containing the provided addresses range that starts at
      * the given offset and ends at either the address aligned to
@@ -435,6 +507,8 @@ class file {
 private:
     friend class reactor;
     friend class file_impl;
+    friend class file_data_source_impl;
+    friend class mmap_data_source_impl;
 };
 
 /// \brief A shard-transportable handle to a file
@@ -473,7 +547,7 @@ struct file::read_state {
 
     read_state(uint64_t offset, uint64_t front, size_t to_read,
             size_t memory_alignment, size_t disk_alignment)
-    : buf(tmp_buf_type::aligned(memory_alignment,
+    : buf(allocate_dma_buffer<CharType>(memory_alignment,
                                 align_up(to_read, disk_alignment)))
     , _offset(offset)
     , _to_read(to_read)
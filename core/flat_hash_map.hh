@@ -0,0 +1,466 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include "bitops.hh"
+
+namespace seastar {
+
+/// \cond internal
+namespace internal {
+
+// An open addressing hash table of Traits::value_type, identified by
+// Traits::key(value); Traits::relocate(to, from) moves a value to
+// uninitialized memory and destroys the original.
+//
+// Values sit in an array of slots, with a separate array of control
+// bytes: one per slot, holding 7 bits of the hash of its key (the tag), or
+// marking it empty or deleted. Control bytes are grouped by eight in a
+// word, so a lookup matches the tag against a whole group with 64 bit
+// word arithmetic, reads eight candidate slots' control bytes from one
+// cache line, and then compares only the keys whose tag matches. Groups
+// are probed quadratically; the table grows by doubling once seven eighths
+// of its slots are taken or deleted.
+//
+// There is no locking, and both arrays are allocated with operator new,
+// in power of two sizes that suit the seastar allocator.
+template <typename Traits, typename Hash, typename KeyEqual>
+class flat_hash_table {
+public:
+    using key_type = typename Traits::key_type;
+    using value_type = typename Traits::value_type;
+private:
+    static constexpr unsigned group_slots = 8;
+    static constexpr uint64_t lsbs = 0x0101010101010101ULL;
+    static constexpr uint64_t msbs = 0x8080808080808080ULL;
+    static constexpr uint8_t empty_ctrl = 0x80;
+    static constexpr uint8_t deleted_ctrl = 0xfe;
+    static constexpr uint64_t empty_group = lsbs * empty_ctrl;
+
+    struct group {
+        uint64_t ctrl;
+
+        uint8_t ctrl_at(unsigned slot) const {
+            return ctrl >> (slot * 8);
+        }
+        void set_ctrl(unsigned slot, uint8_t c) {
+            ctrl = (ctrl & ~(uint64_t(0xff) << (slot * 8))) | (uint64_t(c) << (slot * 8));
+        }
+        // a bit set in byte i for slots i which may hold tag; false
+        // positives are left to the key comparison
+        uint64_t match(uint8_t tag) const {
+            auto x = ctrl ^ (lsbs * tag);
+            return (x - lsbs) & ~x & msbs;
+        }
+        uint64_t match_empty() const {
+            return ctrl & ~(ctrl << 6) & msbs;
+        }
+        uint64_t match_empty_or_deleted() const {
+            return ctrl & msbs;
+        }
+    };
+    using slot = std::aligned_storage_t<sizeof(value_type), alignof(value_type)>;
+
+    std::unique_ptr<group[]> _groups;
+    std::unique_ptr<slot[]> _slots;
+    size_t _mask = 0; // number of groups - 1
+    size_t _size = 0;
+    size_t _deleted = 0;
+    Hash _hash;
+    KeyEqual _equal;
+private:
+    static unsigned slot_of(uint64_t bits) {
+        return count_trailing_zeros(bits) / 8;
+    }
+    // Mixes the hash, since std::hash of integers is the identity
+    static uint64_t mix(size_t hash) {
+        return uint64_t(hash) * 0x9e3779b97f4a7c15ULL;
+    }
+    static uint8_t tag_of(uint64_t mixed) {
+        return mixed >> 57;
+    }
+    size_t home_of(uint64_t mixed) const {
+        return (mixed >> 32) & _mask;
+    }
+    size_t group_count() const {
+        return _groups ? _mask + 1 : 0;
+    }
+    value_type* value_at(size_t i) {
+        return reinterpret_cast<value_type*>(&_slots[i]);
+    }
+    const value_type* value_at(size_t i) const {
+        return reinterpret_cast<const value_type*>(&_slots[i]);
+    }
+    bool full_at(size_t i) const {
+        return !(_groups[i / group_slots].ctrl_at(i % group_slots) & 0x80);
+    }
+    // Returns the index of the slot holding key, or capacity()
+    size_t find_index(const key_type& key) const {
+        if (!_size) {
+            return capacity();
+        }
+        auto mixed = mix(_hash(key));
+        auto tag = tag_of(mixed);
+        auto g = home_of(mixed);
+        for (size_t step = 1; step <= group_count(); ++step) {
+            auto& grp = _groups[g];
+            for (auto bits = grp.match(tag); bits; bits &= bits - 1) {
+                auto i = g * group_slots + slot_of(bits);
+                if (_equal(Traits::key(*value_at(i)), key)) {
+                    return i;
+                }
+            }
+            if (grp.match_empty()) {
+                break;
+            }
+            g = (g + step) & _mask;
+        }
+        return capacity();
+    }
+    // Takes the first empty or deleted slot on the probe sequence of the
+    // mixed hash, and returns its index
+    size_t take_free_slot(uint64_t mixed) {
+        auto g = home_of(mixed);
+        for (size_t step = 1; ; ++step) {
+            auto& grp = _groups[g];
+            if (auto bits = grp.match_empty_or_deleted()) {
+                auto s = slot_of(bits);
+                if (grp.ctrl_at(s) == deleted_ctrl) {
+                    --_deleted;
+                }
+                grp.set_ctrl(s, tag_of(mixed));
+                ++_size;
+                return g * group_slots + s;
+            }
+            g = (g + step) & _mask;
+        }
+    }
+    // Marks a taken slot, whose value is gone, free
+    void free_slot(size_t i) {
+        auto& grp = _groups[i / group_slots];
+        // a probe that reached a group with an empty slot stopped there, so
+        // the slot can become empty rather than deleted
+        if (grp.match_empty()) {
+            grp.set_ctrl(i % group_slots, empty_ctrl);
+        } else {
+            grp.set_ctrl(i % group_slots, deleted_ctrl);
+            ++_deleted;
+        }
+        --_size;
+    }
+    // The fewest groups that hold n values
+    static size_t groups_for(size_t n) {
+        size_t groups = 1;
+        while (groups * group_slots * 7 / 8 < n) {
+            groups *= 2;
+        }
+        return groups;
+    }
+    void rehash(size_t groups) {
+        auto old_capacity = capacity();
+        auto old_groups = std::move(_groups);
+        auto old_slots = std::move(_slots);
+        _groups.reset(new group[groups]);
+        _slots.reset(new slot[groups * group_slots]);
+        _mask = groups - 1;
+        _size = 0;
+        _deleted = 0;
+        for (size_t g = 0; g < groups; ++g) {
+            _groups[g].ctrl = empty_group;
+        }
+        for (size_t i = 0; i < old_capacity; ++i) {
+            if (old_groups[i / group_slots].ctrl_at(i % group_slots) & 0x80) {
+                continue;
+            }
+            auto& v = *reinterpret_cast<value_type*>(&old_slots[i]);
+            auto j = take_free_slot(mix(_hash(Traits::key(v))));
+            Traits::relocate(value_at(j), v);
+        }
+    }
+    void prepare_insert() {
+        if (_size + _deleted + 1 > capacity() * 7 / 8) {
+            // to at most half the maximum load; the same capacity, if
+            // deleted slots were most of the load
+            rehash(groups_for(2 * (_size + 1)));
+        }
+    }
+public:
+    template <bool Const>
+    class basic_iterator {
+        using table_type = std::conditional_t<Const, const flat_hash_table, flat_hash_table>;
+        table_type* _table = nullptr;
+        size_t _index = 0;
+        void skip_free() {
+            while (_index < _table->capacity() && !_table->full_at(_index)) {
+                ++_index;
+            }
+        }
+        friend class flat_hash_table;
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename flat_hash_table::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+
+        basic_iterator() = default;
+        basic_iterator(table_type* table, size_t index) : _table(table), _index(index) {}
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        basic_iterator(const basic_iterator<false>& x) : _table(x._table), _index(x._index) {}
+        reference operator*() const {
+            return *_table->value_at(_index);
+        }
+        pointer operator->() const {
+            return _table->value_at(_index);
+        }
+        basic_iterator& operator++() {
+            ++_index;
+            skip_free();
+            return *this;
+        }
+        basic_iterator operator++(int) {
+            auto ret = *this;
+            ++*this;
+            return ret;
+        }
+        bool operator==(const basic_iterator& x) const {
+            return _index == x._index;
+        }
+        bool operator!=(const basic_iterator& x) const {
+            return _index != x._index;
+        }
+    };
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    flat_hash_table() = default;
+    flat_hash_table(flat_hash_table&& x) noexcept
+            : _groups(std::move(x._groups))
+            , _slots(std::move(x._slots))
+            , _mask(std::exchange(x._mask, 0))
+            , _size(std::exchange(x._size, 0))
+            , _deleted(std::exchange(x._deleted, 0))
+            , _hash(std::move(x._hash))
+            , _equal(std::move(x._equal)) {
+    }
+    flat_hash_table& operator=(flat_hash_table&& x) noexcept {
+        if (this != &x) {
+            this->~flat_hash_table();
+            new (this) flat_hash_table(std::move(x));
+        }
+        return *this;
+    }
+    ~flat_hash_table() {
+        clear();
+    }
+
+    size_t size() const {
+        return _size;
+    }
+    bool empty() const {
+        return !_size;
+    }
+    size_t capacity() const {
+        return group_count() * group_slots;
+    }
+
+    iterator begin() {
+        iterator i(this, 0);
+        if (_groups) {
+            i.skip_free();
+        }
+        return i;
+    }
+    iterator end() {
+        return iterator(this, capacity());
+    }
+    const_iterator begin() const {
+        const_iterator i(this, 0);
+        if (_groups) {
+            i.skip_free();
+        }
+        return i;
+    }
+    const_iterator end() const {
+        return const_iterator(this, capacity());
+    }
+
+    iterator find(const key_type& key) {
+        return iterator(this, find_index(key));
+    }
+    const_iterator find(const key_type& key) const {
+        return const_iterator(this, find_index(key));
+    }
+    size_t count(const key_type& key) const {
+        return find_index(key) != capacity();
+    }
+
+    // Unless there is a value with key, inserts the value constructed from
+    // args, which must have that key
+    template <typename... Args>
+    std::pair<iterator, bool> emplace_with_key(const key_type& key, Args&&... args) {
+        auto i = find_index(key);
+        if (i != capacity()) {
+            return { iterator(this, i), false };
+        }
+        prepare_insert();
+        i = take_free_slot(mix(_hash(key)));
+        try {
+            new (value_at(i)) value_type(std::forward<Args>(args)...);
+        } catch (...) {
+            free_slot(i);
+            throw;
+        }
+        return { iterator(this, i), true };
+    }
+
+    iterator erase(const_iterator it) {
+        auto i = it._index;
+        value_at(i)->~value_type();
+        free_slot(i);
+        iterator next(this, i);
+        return ++next;
+    }
+    size_t erase(const key_type& key) {
+        auto i = find_index(key);
+        if (i == capacity()) {
+            return 0;
+        }
+        erase(const_iterator(this, i));
+        return 1;
+    }
+    void clear() {
+        for (size_t i = 0; _size && i < capacity(); ++i) {
+            if (full_at(i)) {
+                value_at(i)->~value_type();
+                --_size;
+            }
+        }
+        for (size_t g = 0; g < group_count(); ++g) {
+            _groups[g].ctrl = empty_group;
+        }
+        _deleted = 0;
+    }
+    // Makes room for n values, so that inserting them does not rehash
+    void reserve(size_t n) {
+        if (n > capacity() * 7 / 8 - _deleted) {
+            rehash(groups_for(std::max(n, _size)));
+        }
+    }
+};
+
+template <typename Key, typename T>
+struct flat_hash_map_traits {
+    using key_type = Key;
+    using value_type = std::pair<const Key, T>;
+    static const Key& key(const value_type& v) {
+        return v.first;
+    }
+    static void relocate(value_type* to, value_type& from) {
+        new (to) value_type(std::move(const_cast<Key&>(from.first)), std::move(from.second));
+        from.~value_type();
+    }
+};
+
+template <typename Key>
+struct flat_hash_set_traits {
+    using key_type = Key;
+    using value_type = Key;
+    static const Key& key(const value_type& v) {
+        return v;
+    }
+    static void relocate(value_type* to, value_type& from) {
+        new (to) value_type(std::move(from));
+        from.~value_type();
+    }
+};
+
+}
+/// \endcond
+
+/// \addtogroup utilities
+/// @{
+
+/// A hash map for shard-local lookups on hot paths, such as connection
+/// demultiplexing.
+///
+/// Values are stored inline, in open addressing slots, with a byte of
+/// their key's hash kept aside in groups of eight, so that a lookup
+/// usually reads one cache line of these and the slot of the value it
+/// looks for, where \c std::unordered_map chases a bucket pointer and a
+/// node pointer. Otherwise it keeps the interface of \c std::unordered_map,
+/// except that insertions invalidate all iterators and references to the
+/// values, and erasures only those to the erased value. It is not safe for
+/// concurrent use, as nothing on a shard needs it to be.
+template <typename Key, typename T, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class flat_hash_map : public internal::flat_hash_table<internal::flat_hash_map_traits<Key, T>, Hash, KeyEqual> {
+    using base = internal::flat_hash_table<internal::flat_hash_map_traits<Key, T>, Hash, KeyEqual>;
+public:
+    using mapped_type = T;
+    using typename base::value_type;
+    using typename base::iterator;
+
+    std::pair<iterator, bool> insert(const value_type& v) {
+        return this->emplace_with_key(v.first, v);
+    }
+    std::pair<iterator, bool> insert(value_type&& v) {
+        return this->emplace_with_key(v.first, std::move(v));
+    }
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        value_type v(std::forward<Args>(args)...);
+        return this->emplace_with_key(v.first, std::move(v));
+    }
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args) {
+        return this->emplace_with_key(key, std::piecewise_construct, std::forward_as_tuple(key),
+                std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+    T& operator[](const Key& key) {
+        return try_emplace(key).first->second;
+    }
+};
+
+/// A hash set with the layout, and the limits, of \ref flat_hash_map.
+template <typename Key, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class flat_hash_set : public internal::flat_hash_table<internal::flat_hash_set_traits<Key>, Hash, KeyEqual> {
+    using base = internal::flat_hash_table<internal::flat_hash_set_traits<Key>, Hash, KeyEqual>;
+public:
+    using typename base::iterator;
+
+    std::pair<iterator, bool> insert(const Key& key) {
+        return this->emplace_with_key(key, key);
+    }
+    std::pair<iterator, bool> insert(Key&& key) {
+        return this->emplace_with_key(key, std::move(key));
+    }
+};
+
+/// @}
+
+}
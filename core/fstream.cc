@@ -24,11 +24,24 @@
 #include "circular_buffer.hh"
 #include "semaphore.hh"
 #include "reactor.hh"
+#include "file-impl.hh"
 #include <malloc.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <unordered_map>
 
 namespace seastar {
 
+// Histories shared by the open streams of a file
+static thread_local std::unordered_map<file_impl*, file_input_stream_history*> file_input_stream_histories;
+
+file_input_stream_history::~file_input_stream_history() {
+    if (_file) {
+        file_input_stream_histories.erase(_file);
+    }
+}
+
 class file_data_source_impl : public data_source_impl {
     struct issued_read {
         uint64_t _pos;
@@ -51,8 +64,29 @@ class file_data_source_impl : public data_source_impl {
     std::experimental::optional<promise<>> _done;
     size_t _current_buffer_size;
     bool _in_slow_start = false;
+    // Buffers consumed since the stream last dropped read data
+    unsigned _sequential_reads = 0;
     using unused_ratio_target = std::ratio<25, 100>;
+    // Consumed buffers after which the stream is deemed sequential
+    static constexpr unsigned sequential_threshold = 2;
 private:
+    static lw_shared_ptr<file_input_stream_history> history_of(file& f) {
+        auto impl = f._file_impl.get();
+        auto i = file_input_stream_histories.find(impl);
+        if (i != file_input_stream_histories.end()) {
+            return i->second->shared_from_this();
+        }
+        auto h = make_lw_shared<file_input_stream_history>();
+        h->_file = impl;
+        file_input_stream_histories.emplace(impl, h.get());
+        return h;
+    }
+    static file_input_stream_options with_history(file& f, file_input_stream_options options) {
+        if (!options.dynamic_adjustments && options.share_history_by_file) {
+            options.dynamic_adjustments = history_of(f);
+        }
+        return options;
+    }
     size_t minimal_buffer_size() const {
         return std::min(std::max(_options.buffer_size / 4, size_t(8192)), _options.buffer_size);
     }
@@ -60,9 +94,14 @@ class file_data_source_impl : public data_source_impl {
     void try_increase_read_ahead() {
         // Read-ahead can be increased up to user-specified limit if the
         // consumer has to wait for a buffer and we are not in a slow start
-        // phase.
+        // phase. Once the stream is known to be sequential, it is doubled,
+        // so that scans reach full read-ahead within a few reads.
         if (_current_read_ahead < _options.read_ahead && !_in_slow_start) {
-            _current_read_ahead++;
+            if (_sequential_reads >= sequential_threshold) {
+                _current_read_ahead = std::min(std::max(_current_read_ahead * 2, 1u), _options.read_ahead);
+            } else {
+                _current_read_ahead++;
+            }
             if (_options.dynamic_adjustments) {
                 auto& h = *_options.dynamic_adjustments;
                 h.read_ahead = std::max(h.read_ahead, _current_read_ahead);
@@ -143,6 +182,9 @@ class file_data_source_impl : public data_source_impl {
         _current_buffer_size = new_size;
     }
     void update_history_unused(uint64_t bytes) {
+        if (bytes) {
+            _sequential_reads = 0;
+        }
         if (!_options.dynamic_adjustments) {
             return;
         }
@@ -160,7 +202,7 @@ class file_data_source_impl : public data_source_impl {
     }
 public:
     file_data_source_impl(file f, uint64_t offset, uint64_t len, file_input_stream_options options)
-            : _file(std::move(f)), _options(options), _pos(offset), _remain(len), _current_read_ahead(get_initial_read_ahead())
+            : _file(std::move(f)), _options(with_history(_file, options)), _pos(offset), _remain(len), _current_read_ahead(get_initial_read_ahead())
             , _current_buffer_size(_options.buffer_size) {
         // prevent wraparounds
         set_new_buffer_size(after_skip::no);
@@ -173,6 +215,7 @@ class file_data_source_impl : public data_source_impl {
         issue_read_aheads(1);
         auto ret = std::move(_read_buffers.front());
         _read_buffers.pop_front();
+        ++_sequential_reads;
         update_history_consumed(ret._size);
         _reactor._io_stats.fstream_reads += 1;
         _reactor._io_stats.fstream_read_bytes += ret._size;
@@ -308,6 +351,130 @@ input_stream<char> make_file_input_stream(
     return make_file_input_stream(std::move(f), 0, std::move(options));
 }
 
+class mmap_data_source_impl final : public data_source_impl {
+    struct mapping {
+        char* addr = nullptr;
+        size_t size = 0;
+        mapping() = default;
+        mapping(const mapping&) = delete;
+        ~mapping() {
+            if (addr) {
+                ::munmap(addr, size);
+            }
+        }
+    };
+    file _file;
+    int _fd;
+    mmap_input_stream_options _options;
+    lw_shared_ptr<mapping> _map; // null until mapped
+    uint64_t _pos = 0;
+    uint64_t _advised = 0; // end of the range already prefetched
+    size_t _page_size = ::sysconf(_SC_PAGESIZE);
+private:
+    future<> map() {
+        return _file.size().then([this] (uint64_t size) {
+            auto m = make_lw_shared<mapping>();
+            if (!size) {
+                _map = std::move(m);
+                return make_ready_future<>();
+            }
+            // mmap() takes the process' address space lock, which may be
+            // held by a page fault waiting on the disk
+            return engine()._thread_pool.submit<std::pair<void*, int>>([fd = _fd, size] {
+                auto addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+                return std::make_pair(addr, errno);
+            }).then([this, m, size] (std::pair<void*, int> r) {
+                if (r.first == MAP_FAILED) {
+                    throw std::system_error(r.second, std::system_category(), "mmap");
+                }
+                m->addr = static_cast<char*>(r.first);
+                m->size = size;
+                _map = std::move(m);
+            });
+        });
+    }
+    void prefetch(uint64_t from) {
+        auto to = std::min<uint64_t>(_map->size, from + uint64_t(_options.read_ahead) * _options.buffer_size);
+        from = align_down<uint64_t>(std::max(from, _advised), _page_size);
+        if (from >= to) {
+            return;
+        }
+        // Starts read-ahead in the kernel; errors only cost us the prefetch
+        ::madvise(_map->addr + from, to - from, MADV_WILLNEED);
+        _advised = to;
+    }
+    // Makes the pages of [pos, pos + len) resident, faulting them in from a
+    // syscall thread if some are not
+    future<> populate(uint64_t pos, size_t len) {
+        auto start = align_down<uint64_t>(pos, _page_size);
+        auto end = align_up<uint64_t>(pos + len, _page_size);
+        auto pages = (end - start) / _page_size;
+        std::vector<unsigned char> residency(pages);
+        auto p = _map->addr + start;
+        if (::mincore(p, end - start, residency.data()) == 0
+                && std::all_of(residency.begin(), residency.end(), [] (unsigned char r) { return r & 1; })) {
+            return make_ready_future<>();
+        }
+        return engine()._thread_pool.submit<int>(syscall_lane::sync, [p, pages, page_size = _page_size] {
+            int sum = 0;
+            for (size_t i = 0; i < pages; ++i) {
+                sum += *static_cast<const volatile char*>(p + i * page_size);
+            }
+            return sum;
+        }).discard_result();
+    }
+    future<temporary_buffer<char>> get_mapped() {
+        if (_pos >= _map->size) {
+            return make_ready_future<temporary_buffer<char>>();
+        }
+        auto pos = _pos;
+        size_t len = std::min<uint64_t>(_options.buffer_size, _map->size - pos);
+        _pos += len;
+        prefetch(_pos);
+        return populate(pos, len).then([m = _map, pos, len] {
+            return temporary_buffer<char>(m->addr + pos, len, make_deleter([m] {}));
+        });
+    }
+public:
+    // Returns the descriptor of f, or -1 if it is not a mappable file
+    static int fd_of(file& f) {
+        auto pfi = dynamic_cast<posix_file_impl*>(f._file_impl.get());
+        return pfi ? pfi->_fd : -1;
+    }
+    mmap_data_source_impl(file f, int fd, mmap_input_stream_options options)
+            : _file(std::move(f)), _fd(fd), _options(options) {
+        _options.buffer_size = std::max<size_t>(_options.buffer_size, 1);
+    }
+    virtual future<temporary_buffer<char>> get() override {
+        if (!_map) {
+            return map().then([this] {
+                return get_mapped();
+            });
+        }
+        return get_mapped();
+    }
+    virtual future<temporary_buffer<char>> skip(uint64_t n) override {
+        _pos += n;
+        return get();
+    }
+    virtual future<> close() override {
+        // the buffers handed out keep the mapping alive
+        _map = {};
+        return make_ready_future<>();
+    }
+};
+
+input_stream<char> make_mmap_input_stream(file f, mmap_input_stream_options options) {
+    auto fd = mmap_data_source_impl::fd_of(f);
+    if (fd == -1) {
+        file_input_stream_options fallback;
+        fallback.buffer_size = options.buffer_size;
+        fallback.read_ahead = options.read_ahead;
+        return make_file_input_stream(std::move(f), std::move(fallback));
+    }
+    return input_stream<char>(data_source(std::make_unique<mmap_data_source_impl>(std::move(f), fd, options)));
+}
+
 
 class file_data_sink_impl : public data_sink_impl {
     file _file;
@@ -316,34 +483,86 @@ class file_data_sink_impl : public data_sink_impl {
     semaphore _write_behind_sem = { _options.write_behind };
     future<> _background_writes_done = make_ready_future<>();
     bool _failed = false;
+    // Buffers gathered for the next write, when coalescing
+    std::vector<temporary_buffer<char>> _pending;
+    uint64_t _pending_pos = 0;
+    size_t _pending_bytes = 0;
+    // What coalesced writes should end on a multiple of; 0 until known
+    uint64_t _io_alignment = 0;
+    using buffers = std::vector<temporary_buffer<char>>;
 public:
     file_data_sink_impl(file f, file_output_stream_options options)
             : _file(std::move(f)), _options(options) {
         _write_behind_sem.ensure_space_for_waiters(1); // So that wait() doesn't throw
+        if (!_options.align_to_optimal_io_size) {
+            _io_alignment = _file.disk_write_dma_alignment();
+        }
     }
     future<> put(net::packet data) { abort(); }
     virtual temporary_buffer<char> allocate_buffer(size_t size) override {
-        return temporary_buffer<char>::aligned(_file.memory_dma_alignment(), size);
+        return allocate_dma_buffer(_file.memory_dma_alignment(), size);
     }
     virtual future<> put(temporary_buffer<char> buf) override {
         uint64_t pos = _pos;
         _pos += buf.size();
+        if (!_options.coalesce_size) {
+            buffers bufs;
+            bufs.push_back(std::move(buf));
+            return write(pos, std::move(bufs));
+        }
+        if (_pending.empty()) {
+            _pending_pos = pos;
+        }
+        _pending_bytes += buf.size();
+        _pending.push_back(std::move(buf));
+        return maybe_put_pending();
+    }
+private:
+    future<> maybe_put_pending() {
+        if (!_io_alignment) {
+            return _file.stat().then_wrapped([this] (future<struct stat> f) {
+                uint64_t alignment = _file.disk_write_dma_alignment();
+                try {
+                    alignment = std::max<uint64_t>(alignment, f.get0().st_blksize);
+                } catch (...) {
+                    // not all files can tell; settle for the DMA alignment
+                }
+                _io_alignment = alignment;
+                return maybe_put_pending();
+            });
+        }
+        auto aligned = (_pending_pos + _pending_bytes) % _io_alignment == 0;
+        if (_pending_bytes >= _options.coalesce_size
+                || (aligned && _pending_bytes + _options.buffer_size > _options.coalesce_size)
+                || _pending.size() >= IOV_MAX) {
+            return put_pending();
+        }
+        return make_ready_future<>();
+    }
+    future<> put_pending() {
+        if (_pending.empty()) {
+            return make_ready_future<>();
+        }
+        _pending_bytes = 0;
+        return write(_pending_pos, std::exchange(_pending, buffers()));
+    }
+    future<> write(uint64_t pos, buffers bufs) {
         if (!_options.write_behind) {
-            return do_put(pos, std::move(buf));
+            return do_put(pos, std::move(bufs));
         }
         // Write behind strategy:
         //
         // 1. Issue N writes in parallel, using a semaphore to limit to N
         // 2. Collect results in _background_writes_done, merging exception futures
         // 3. If we've already seen a failure, don't issue more writes.
-        return _write_behind_sem.wait().then([this, pos, buf = std::move(buf)] () mutable {
+        return _write_behind_sem.wait().then([this, pos, bufs = std::move(bufs)] () mutable {
             if (_failed) {
                 _write_behind_sem.signal();
                 auto ret = std::move(_background_writes_done);
                 _background_writes_done = make_ready_future<>();
                 return ret;
             }
-            auto this_write_done = do_put(pos, std::move(buf)).finally([this] {
+            auto this_write_done = do_put(pos, std::move(bufs)).finally([this] {
                 _write_behind_sem.signal();
             });
             _background_writes_done = when_all(std::move(_background_writes_done), std::move(this_write_done))
@@ -365,15 +584,14 @@ class file_data_sink_impl : public data_sink_impl {
         });
     }
 public:
-    future<> do_put(uint64_t pos, temporary_buffer<char> buf) noexcept {
+    future<> do_put(uint64_t pos, buffers bufs) noexcept {
       try {
         // put() must usually be of chunks multiple of file::dma_alignment.
         // Only the last part can have an unaligned length. If put() was
         // called again with an unaligned pos, we have a bug in the caller.
         assert(!(pos & (_file.disk_write_dma_alignment() - 1)));
         bool truncate = false;
-        auto p = static_cast<const char*>(buf.get());
-        size_t buf_size = buf.size();
+        auto& buf = bufs.back();
 
         if ((buf.size() & (_file.disk_write_dma_alignment() - 1)) != 0) {
             // If buf size isn't aligned, copy its content into a new aligned buf.
@@ -381,13 +599,21 @@ class file_data_sink_impl : public data_sink_impl {
             auto tmp = allocate_buffer(align_up(buf.size(), _file.disk_write_dma_alignment()));
             ::memcpy(tmp.get_write(), buf.get(), buf.size());
             buf = std::move(tmp);
-            p = buf.get();
-            buf_size = buf.size();
             truncate = true;
         }
 
-        return _file.dma_write(pos, p, buf_size, _options.io_priority_class).then(
-                [this, buf = std::move(buf), truncate] (size_t size) {
+        future<size_t> written = make_ready_future<size_t>(0);
+        if (bufs.size() == 1) {
+            written = _file.dma_write(pos, buf.get(), buf.size(), _options.io_priority_class);
+        } else {
+            std::vector<iovec> iov;
+            iov.reserve(bufs.size());
+            for (auto&& b : bufs) {
+                iov.push_back(iovec{b.get_write(), b.size()});
+            }
+            written = _file.dma_write(pos, std::move(iov), _options.io_priority_class);
+        }
+        return written.then([this, bufs = std::move(bufs), truncate] (size_t size) {
             if (truncate) {
                 return _file.truncate(_pos);
             }
@@ -408,12 +634,16 @@ class file_data_sink_impl : public data_sink_impl {
     }
 public:
     virtual future<> flush() override {
-        return wait().then([this] {
+        return put_pending().then([this] {
+            return wait();
+        }).then([this] {
             return _file.flush();
         });
     }
     virtual future<> close() noexcept {
-        return wait().finally([this] {
+        return put_pending().finally([this] {
+            return wait();
+        }).finally([this] {
             return _file.close();
         });
     }
@@ -436,6 +666,28 @@ output_stream<char> make_file_output_stream(file f, file_output_stream_options o
     return output_stream<char>(file_data_sink(std::move(f), options), options.buffer_size, true);
 }
 
+future<> data_sink_impl::put_file(file& f, uint64_t offset, uint64_t len) {
+    static constexpr uint64_t chunk_size = 128 << 10;
+    return do_with(offset, len, [this, &f] (uint64_t& offset, uint64_t& len) {
+        return repeat([this, &f, &offset, &len] {
+            if (!len) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            return f.dma_read_bulk<char>(offset, std::min(len, chunk_size)).then([this, &offset, &len] (temporary_buffer<char> buf) {
+                if (buf.empty()) {
+                    throw std::runtime_error(sprint("file ended %d bytes before the range to write did", len));
+                }
+                buf.trim(std::min<uint64_t>(buf.size(), len));
+                offset += buf.size();
+                len -= buf.size();
+                return put(std::move(buf)).then([] {
+                    return stop_iteration::no;
+                });
+            });
+        });
+    });
+}
+
 /*
  * template initialization, definition in iostream-impl.hh
  */
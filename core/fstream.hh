@@ -36,7 +36,14 @@
 
 namespace seastar {
 
-class file_input_stream_history {
+class file_impl;
+
+/// History of the reads of input streams, from which they adapt their
+/// buffer size and read-ahead to the access pattern: it is shared by the
+/// streams given the same \ref file_input_stream_options::dynamic_adjustments,
+/// and by the concurrent streams of the same file with
+/// \ref file_input_stream_options::share_history_by_file.
+class file_input_stream_history : public enable_lw_shared_from_this<file_input_stream_history> {
     static constexpr uint64_t window_size = 4 * 1024 * 1024;
     struct window {
         uint64_t total_read = 0;
@@ -45,8 +52,22 @@ class file_input_stream_history {
     window current_window;
     window previous_window;
     unsigned read_ahead = 1;
+    // set for histories shared by file, to unregister them
+    file_impl* _file = nullptr;
 
     friend class file_data_source_impl;
+public:
+    file_input_stream_history() = default;
+    file_input_stream_history(const file_input_stream_history&) = delete;
+    file_input_stream_history& operator=(const file_input_stream_history&) = delete;
+    ~file_input_stream_history();
+    /// Bytes read, and read but dropped unused, over the last 4MB to 8MB
+    uint64_t total_read() const {
+        return current_window.total_read + previous_window.total_read;
+    }
+    uint64_t unused_read() const {
+        return current_window.unused_read + previous_window.unused_read;
+    }
 };
 
 /// Data structure describing options for opening a file input stream
@@ -55,6 +76,10 @@ struct file_input_stream_options {
     unsigned read_ahead = 0;      ///< Maximum number of extra read-ahead operations
     ::seastar::io_priority_class io_priority_class = default_priority_class();
     lw_shared_ptr<file_input_stream_history> dynamic_adjustments = { }; ///< Input stream history, if null dynamic adjustments are disabled
+    /// If \c dynamic_adjustments is null, enable dynamic adjustments with a
+    /// history shared by the streams that are open on the same file at the
+    /// same time.
+    bool share_history_by_file = false;
 };
 
 /// \brief Creates an input_stream to read a portion of a file.
@@ -81,10 +106,43 @@ input_stream<char> make_file_input_stream(
 input_stream<char> make_file_input_stream(
         file file, file_input_stream_options = {});
 
+/// Data structure describing options for opening an mmap input stream
+struct mmap_input_stream_options {
+    size_t buffer_size = 128 * 1024; ///< Size of the returned buffers
+    unsigned read_ahead = 4; ///< Number of buffers to prefetch ahead of the consumer
+};
+
+/// \brief Creates an input_stream that reads a file through a shared memory
+/// mapping, without copying it.
+///
+/// Meant for immutable files that are read over and over and fit well in
+/// the page cache: the returned buffers point into the mapping, and keep it
+/// alive, so that parsing proceeds in place. The stream prefetches ahead of
+/// the consumer with \c madvise(MADV_WILLNEED), and before returning a
+/// buffer makes its pages resident from a syscall thread, so that the
+/// reactor thread does not usually take page faults.
+///
+/// \param file File to read; it must not be written to or truncated while
+///             the stream or its buffers live. Files that cannot be mapped
+///             are read with \ref make_file_input_stream() instead.
+/// \param options A set of options controlling the stream.
+///
+/// \note The buffers are read-only, and must be released on the calling
+///       shard.
+input_stream<char> make_mmap_input_stream(file file, mmap_input_stream_options options = {});
+
 struct file_output_stream_options {
     unsigned buffer_size = 8192;
     unsigned preallocation_size = 1024*1024; // 1MB
     unsigned write_behind = 1; ///< Number of buffers to write in parallel
+    /// If non-zero, adjacent buffers are gathered into a single write of up
+    /// to this many bytes, rather than written one by one; write_behind
+    /// then counts these writes. Should be a multiple of buffer_size.
+    unsigned coalesce_size = 0;
+    /// When coalescing, end writes on a multiple of the file's optimal I/O
+    /// size (its \c st_blksize) where possible, at the cost of writes of up
+    /// to coalesce_size + buffer_size bytes.
+    bool align_to_optimal_io_size = true;
     ::seastar::io_priority_class io_priority_class = default_priority_class();
 };
 
@@ -526,6 +526,10 @@ class promise {
         _state = &tws->_state;
         _task = std::move(tws);
     }
+    void schedule(std::unique_ptr<task> t, future_state<T...>* st) noexcept {
+        _state = st;
+        _task = std::move(t);
+    }
     template<urgent Urgent>
     __attribute__((always_inline))
     void make_ready() noexcept;
@@ -652,6 +656,27 @@ struct futurize<future<Args...>> {
 template <typename T>
 using futurize_t = typename futurize<T>::type;
 
+/// \cond internal
+namespace internal {
+
+// Whether a continuation returning \c Result may run inline on an available
+// future even when preemption is due. One that does not return a future
+// cannot extend the chain with asynchronous work, so a chain of them is no
+// longer than the code that built it; deferring it to a task would only add
+// an allocation and a trip through the run queue. Debug builds always defer,
+// to keep exercising the task path.
+template <typename Result>
+constexpr bool can_run_ready_continuation_inline() {
+#ifndef DEBUG
+    return !is_future<Result>::value;
+#else
+    return false;
+#endif
+}
+
+}
+/// \endcond
+
 /// @}
 
 GCC6_CONCEPT(
@@ -878,6 +903,12 @@ class future {
     /// If the future failed, the function is not called, and the exception
     /// is propagated into the return value of then().
     ///
+    /// If the future is already available, the function is called right away,
+    /// without allocating a task, unless preemption is due and the function
+    /// returns a future. A chain of then() calls on ready futures with
+    /// functions returning plain values thus runs as straight-line code, and
+    /// its result is a ready future.
+    ///
     /// \param func - function to be called when the future becomes available,
     ///               unless it has failed.
     /// \return a \c future representing the return value of \c func, applied
@@ -887,7 +918,7 @@ class future {
     Result
     then(Func&& func) noexcept {
         using futurator = futurize<std::result_of_t<Func(T&&...)>>;
-        if (available() && !need_preempt()) {
+        if (available() && (internal::can_run_ready_continuation_inline<std::result_of_t<Func(T&&...)>>() || !need_preempt())) {
             if (failed()) {
                 return futurator::make_exception_future(get_available_state().get_exception());
             } else {
@@ -935,7 +966,7 @@ class future {
     Result
     then_wrapped(Func&& func) noexcept {
         using futurator = futurize<std::result_of_t<Func(future)>>;
-        if (available() && !need_preempt()) {
+        if (available() && (internal::can_run_ready_continuation_inline<std::result_of_t<Func(future)>>() || !need_preempt())) {
             return futurator::apply(std::forward<Func>(func), future(get_available_state()));
         }
         typename futurator::promise_type pr;
@@ -1130,6 +1161,23 @@ class future {
         state()->ignore();
     }
 
+    /// \cond internal
+    // Arranges for \c t to run once the future is available, with the result
+    // moved to \c *st. Unlike then(), nothing is allocated: coroutine
+    // awaiters keep both the task and the state in the coroutine frame.
+    void schedule_task(std::unique_ptr<task> t, future_state<T...>* st) {
+        if (state()->available()) {
+            *st = std::move(*state());
+            ::seastar::schedule(std::move(t));
+        } else {
+            assert(_promise);
+            _promise->schedule(std::move(t), st);
+            _promise->_future = nullptr;
+            _promise = nullptr;
+        }
+    }
+    /// \endcond
+
     /// \cond internal
     template <typename... U>
     friend class promise;
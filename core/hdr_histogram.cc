@@ -0,0 +1,125 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "hdr_histogram.hh"
+
+namespace seastar {
+
+hdr_histogram::hdr_histogram(unsigned precision_bits, uint64_t max_value)
+        : _precision_bits(precision_bits)
+        , _max_value(max_value) {
+    if (precision_bits > 16) {
+        throw std::invalid_argument("hdr_histogram precision is at most 16 bits");
+    }
+    _counts.resize(bucket_of(max_value) + 1);
+}
+
+uint64_t hdr_histogram::lowest_in(unsigned bucket) const noexcept {
+    uint64_t sub_buckets = uint64_t(1) << _precision_bits;
+    if (bucket < sub_buckets) {
+        return bucket;
+    }
+    unsigned shift = (bucket >> _precision_bits) - 1;
+    uint64_t sub = bucket - (uint64_t(shift) << _precision_bits);
+    return sub << shift;
+}
+
+uint64_t hdr_histogram::highest_in(unsigned bucket) const noexcept {
+    if (bucket + 1 == _counts.size()) {
+        return std::numeric_limits<uint64_t>::max();
+    }
+    return lowest_in(bucket + 1) - 1;
+}
+
+hdr_histogram& hdr_histogram::operator+=(const hdr_histogram& h) {
+    if (h._precision_bits != _precision_bits || h._max_value != _max_value) {
+        throw std::invalid_argument("adding hdr_histograms of different precision or range");
+    }
+    for (size_t i = 0; i < _counts.size(); ++i) {
+        _counts[i] += h._counts[i];
+    }
+    _count += h._count;
+    _sum += h._sum;
+    _min = std::min(_min, h._min);
+    _max = std::max(_max, h._max);
+    return *this;
+}
+
+uint64_t hdr_histogram::value_at_quantile(double q) const noexcept {
+    if (!_count) {
+        return 0;
+    }
+    q = std::min(std::max(q, 0.0), 1.0);
+    auto rank = std::max<uint64_t>(uint64_t(std::ceil(q * _count)), 1);
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < _counts.size(); ++b) {
+        seen += _counts[b];
+        if (seen >= rank) {
+            return std::min(highest_in(b), _max);
+        }
+    }
+    return _max;
+}
+
+void hdr_histogram::reset() noexcept {
+    std::fill(_counts.begin(), _counts.end(), 0);
+    _count = 0;
+    _sum = 0;
+    _min = std::numeric_limits<uint64_t>::max();
+    _max = 0;
+}
+
+metrics::histogram hdr_histogram::to_metrics(unsigned export_precision_bits) const {
+    export_precision_bits = std::min(export_precision_bits, _precision_bits);
+    // every exported bucket covers 2^drop of ours, but for the exact ones
+    // below 2^precision_bits, which are exported as one bucket per
+    // exported bucket width
+    unsigned drop = _precision_bits - export_precision_bits;
+    metrics::histogram h;
+    h.sample_count = _count;
+    h.sample_sum = _sum;
+    uint64_t count = 0;
+    for (unsigned b = 0; b < _counts.size(); ++b) {
+        count += _counts[b];
+        bool last = b + 1 == _counts.size();
+        auto high = highest_in(b);
+        // closes an exported bucket either at the end of a run of 2^drop
+        // of ours, or at the boundary of one of theirs below the linear
+        // range
+        bool boundary = b >= (1u << _precision_bits)
+                ? ((b + 1) & ((1u << drop) - 1)) == 0
+                : ((high + 1) & ((uint64_t(1) << drop) - 1)) == 0;
+        if (boundary || last) {
+            metrics::histogram_bucket hb;
+            hb.count = count;
+            hb.upper_bound = last ? double(_max_value) : double(high);
+            h.buckets.push_back(hb);
+            count = 0;
+        }
+    }
+    return h;
+}
+
+}
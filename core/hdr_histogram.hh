@@ -0,0 +1,146 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "metrics_types.hh"
+
+namespace seastar {
+
+/// \addtogroup metrics
+/// @{
+
+/// A log-linear histogram of non-negative integers, in the manner of
+/// HdrHistogram.
+///
+/// Values below 2^precision_bits are counted exactly; above, every power
+/// of two is split into 2^precision_bits equal buckets, so that every
+/// recorded value, and every percentile read back, is within a relative
+/// error of 2^-precision_bits of the actual one. Recording is a few
+/// arithmetic instructions and an increment, with no allocation and no
+/// atomics: a histogram belongs to a shard, and the histograms of several
+/// shards are combined with \ref operator+=() (for percentiles over all
+/// of them) or through \ref to_metrics(), whose fixed buckets the metrics
+/// layer adds up when it aggregates shards.
+///
+/// \code
+/// hdr_histogram latency(5, 60'000'000); // microseconds, up to a minute
+/// latency.record(us);
+/// ...
+/// sm::make_histogram("latency_us", sm::description("..."), [this] { return latency.to_metrics(); })
+/// \endcode
+class hdr_histogram {
+    unsigned _precision_bits;
+    uint64_t _max_value;
+    std::vector<uint64_t> _counts;
+    uint64_t _count = 0;
+    uint64_t _sum = 0;
+    uint64_t _min = std::numeric_limits<uint64_t>::max();
+    uint64_t _max = 0;
+private:
+    unsigned bucket_of(uint64_t v) const noexcept {
+        uint64_t sub_buckets = uint64_t(1) << _precision_bits;
+        if (v < sub_buckets) {
+            return v;
+        }
+        unsigned top = std::numeric_limits<uint64_t>::digits - 1 - __builtin_clzll(v);
+        unsigned shift = top - _precision_bits;
+        // (v >> shift) is in [sub_buckets, 2 * sub_buckets)
+        return (shift << _precision_bits) + (v >> shift);
+    }
+    // The smallest and largest values counted in a bucket
+    uint64_t lowest_in(unsigned bucket) const noexcept;
+    uint64_t highest_in(unsigned bucket) const noexcept;
+public:
+    /// \param precision_bits the log2 of the number of buckets per power
+    ///        of two; at most 16
+    /// \param max_value the largest value tracked separately; larger ones
+    ///        are counted in the last bucket (but are still accounted for
+    ///        in \ref sum() and \ref max())
+    explicit hdr_histogram(unsigned precision_bits = 5, uint64_t max_value = uint64_t(1) << 40);
+
+    /// Records \c count occurrences of \c value
+    void record(uint64_t value, uint64_t count = 1) noexcept {
+        auto b = bucket_of(value < _max_value ? value : _max_value);
+        _counts[b] += count;
+        _count += count;
+        _sum += value * count;
+        _min = value < _min ? value : _min;
+        _max = value > _max ? value : _max;
+    }
+
+    /// Adds the values recorded in another histogram, which must have
+    /// the same precision and maximum value (or std::invalid_argument is
+    /// thrown)
+    hdr_histogram& operator+=(const hdr_histogram& h);
+
+    /// The value below which the fraction \c q (in [0, 1]) of the
+    /// recorded values fall, within the histogram's precision: the
+    /// highest value of the bucket where it is reached, and never more
+    /// than the largest recorded value. 0 if nothing was recorded.
+    uint64_t value_at_quantile(double q) const noexcept;
+
+    /// Same as \ref value_at_quantile(), with \c p in [0, 100]
+    uint64_t percentile(double p) const noexcept {
+        return value_at_quantile(p / 100);
+    }
+
+    uint64_t count() const noexcept {
+        return _count;
+    }
+    uint64_t sum() const noexcept {
+        return _sum;
+    }
+    /// The smallest recorded value, or 0 if nothing was recorded
+    uint64_t min() const noexcept {
+        return _count ? _min : 0;
+    }
+    uint64_t max() const noexcept {
+        return _max;
+    }
+    double mean() const noexcept {
+        return _count ? double(_sum) / _count : 0;
+    }
+    unsigned precision_bits() const noexcept {
+        return _precision_bits;
+    }
+    uint64_t max_value() const noexcept {
+        return _max_value;
+    }
+
+    /// Forgets the recorded values
+    void reset() noexcept;
+
+    /// Exports the histogram as a metrics histogram, with
+    /// 2^export_precision_bits buckets per power of two (at most
+    /// precision_bits); the buckets only depend on the precision and the
+    /// maximum value, so the exports of histograms configured alike can
+    /// be added up.
+    metrics::histogram to_metrics(unsigned export_precision_bits = 0) const;
+};
+
+/// @}
+
+}
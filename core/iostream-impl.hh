@@ -72,6 +72,9 @@ future<> output_stream<CharType>::write(scattered_message<CharType> msg) {
 template<typename CharType>
 future<>
 output_stream<CharType>::zero_copy_put(net::packet p) {
+    if (corks()) {
+        return cork(std::move(p));
+    }
     // if flush is scheduled, disable it, so it will not try to write in parallel
     _flush = false;
     if (_flushing) {
@@ -139,6 +142,42 @@ future<> output_stream<CharType>::write(temporary_buffer<CharType> p) {
     return write(net::packet(std::move(p)));
 }
 
+template <typename CharType>
+future<> output_stream<CharType>::write_file(file& f, uint64_t offset, uint64_t len) {
+    if (!len) {
+        return make_ready_future<>();
+    }
+    // the file's data goes after what is buffered
+    future<> buffered = make_ready_future<>();
+    if (corks()) {
+        if (_end) {
+            _buf.trim(_end);
+            _end = 0;
+            buffered = cork(std::move(_buf));
+        } else if (_zc_bufs) {
+            buffered = cork(std::move(_zc_bufs));
+        }
+        buffered = buffered.then([this] {
+            return uncork();
+        });
+    } else if (_end) {
+        _buf.trim(_end);
+        _end = 0;
+        buffered = put(std::move(_buf));
+    } else if (_zc_bufs) {
+        buffered = zero_copy_put(std::move(_zc_bufs));
+    } else {
+        // as put() does: cancel a scheduled flush, or wait for a running one
+        _flush = false;
+        if (_flushing) {
+            buffered = _in_batch.value().get_future();
+        }
+    }
+    return buffered.then([this, &f, offset, len] {
+        return _fd.put_file(f, offset, len);
+    });
+}
+
 template <typename CharType>
 future<temporary_buffer<CharType>>
 input_stream<CharType>::read_exactly_part(size_t n, tmp_buf out, size_t completed) {
@@ -418,6 +457,9 @@ void add_to_flush_poller(output_stream<char>* x);
 template <typename CharType>
 future<>
 output_stream<CharType>::put(temporary_buffer<CharType> buf) {
+    if (corks()) {
+        return cork(net::packet(net::fragment{reinterpret_cast<char*>(buf.get_write()), buf.size()}, buf.release()));
+    }
     // if flush is scheduled, disable it, so it will not try to write in parallel
     _flush = false;
     if (_flushing) {
@@ -430,10 +472,46 @@ output_stream<CharType>::put(temporary_buffer<CharType> buf) {
     }
 }
 
+template <typename CharType>
+future<>
+output_stream<CharType>::cork(net::packet p) {
+    if (_ex) {
+        return make_exception_future<>(std::move(_ex));
+    }
+    if (_corked) {
+        _corked.append(std::move(p));
+    } else {
+        _corked = std::move(p);
+    }
+    if (!_in_batch) {
+        add_to_flush_poller(this);
+        _in_batch = promise<>();
+    }
+    if (_corked.len() < max_corked) {
+        return make_ready_future<>();
+    }
+    // the sink is not keeping up: hold the writer back until it does
+    return uncork();
+}
+
+template <typename CharType>
+future<>
+output_stream<CharType>::uncork() {
+    if (!_in_batch) {
+        return make_ready_future<>();
+    }
+    return _in_batch.value().get_future().then([this] {
+        if (_ex) {
+            return make_exception_future<>(std::move(_ex));
+        }
+        return make_ready_future<>();
+    });
+}
+
 template <typename CharType>
 void
 output_stream<CharType>::poll_flush() {
-    if (!_flush) {
+    if (!_flush && !_corked) {
         // flush was canceled, do nothing
         _flushing = false;
         _in_batch.value().set_value();
@@ -442,16 +520,33 @@ output_stream<CharType>::poll_flush() {
     }
 
     auto f = make_ready_future();
+    auto flush = _flush;
     _flush = false;
     _flushing = true; // make whoever wants to write into the fd to wait for flush to complete
 
-    if (_end) {
+    auto p = std::move(_corked);
+    _corked = net::packet::make_null_packet();
+    if (!flush) {
+        // only what is corked goes, what is buffered waits for a flush
+    } else if (_end) {
         // send whatever is in the buffer right now
         _buf.trim(_end);
         _end = 0;
-        f = _fd.put(std::move(_buf));
+        if (p) {
+            p.append(net::packet(net::fragment{reinterpret_cast<char*>(_buf.get_write()), _buf.size()}, _buf.release()));
+        } else {
+            f = _fd.put(std::move(_buf));
+        }
     } else if(_zc_bufs) {
-        f = _fd.put(std::move(_zc_bufs));
+        if (p) {
+            p.append(std::move(_zc_bufs));
+            _zc_bufs = net::packet::make_null_packet();
+        } else {
+            f = _fd.put(std::move(_zc_bufs));
+        }
+    }
+    if (p) {
+        f = _fd.put(std::move(p));
     }
 
     f.then([this] {
@@ -43,6 +43,8 @@ namespace seastar {
 
 namespace net { class packet; }
 
+class file;
+
 class data_source_impl {
 public:
     virtual ~data_source_impl() {}
@@ -83,6 +85,11 @@ class data_sink_impl {
     virtual future<> put(temporary_buffer<char> buf) {
         return put(net::packet(net::fragment{buf.get_write(), buf.size()}, buf.release()));
     }
+    // Writes [offset, offset + len) of f, which must stay open until the
+    // returned future resolves. Sinks that can move file data without
+    // copying it through user space (sockets, with sendfile()) override
+    // this; by default, the range is read and put.
+    virtual future<> put_file(file& f, uint64_t offset, uint64_t len);
     virtual future<> flush() {
         return make_ready_future<>();
     }
@@ -108,6 +115,9 @@ class data_sink {
     future<> put(net::packet p) {
         return _dsi->put(std::move(p));
     }
+    future<> put_file(file& f, uint64_t offset, uint64_t len) {
+        return _dsi->put_file(f, offset, len);
+    }
     future<> flush() {
         return _dsi->flush();
     }
@@ -203,6 +213,11 @@ class output_stream final {
     size_t _end = 0;
     bool _trim_to_size = false;
     bool _batch_flushes = false;
+    // With batched flushes and untrimmed chunks, what would be put in the
+    // sink is corked instead: gathered, up to max_corked bytes, and put as
+    // one scattered packet by the next batch flush, with the flushed data
+    net::packet _corked = net::packet::make_null_packet();
+    static constexpr size_t max_corked = 64 * 1024;
     std::experimental::optional<promise<>> _in_batch;
     bool _flush = false;
     bool _flushing = false;
@@ -215,6 +230,12 @@ class output_stream final {
     void poll_flush();
     future<> zero_copy_put(net::packet p);
     future<> zero_copy_split_and_put(net::packet p);
+    bool corks() const {
+        return _batch_flushes && !_trim_to_size;
+    }
+    future<> cork(net::packet p);
+    // Resolves once what is corked, and what is being flushed, is put
+    future<> uncork();
 public:
     using char_type = CharType;
     output_stream() = default;
@@ -233,6 +254,15 @@ class output_stream final {
     future<> write(net::packet p);
     future<> write(scattered_message<char_type> msg);
     future<> write(temporary_buffer<char_type>);
+    /// Writes [offset, offset + len) of a file, after the data written so
+    /// far. Where the stream's sink allows it (posix sockets), the data
+    /// goes from the page cache to the sink without being copied through
+    /// user space; otherwise it is read and written.
+    ///
+    /// \param f file to write from; it must stay open until the returned
+    ///          future resolves
+    /// \return a future that fails if the file ends before the range does
+    future<> write_file(file& f, uint64_t offset, uint64_t len);
     future<> flush();
     future<> close();
 
@@ -89,6 +89,12 @@ disable_abort_on_alloc_failure_temporarily::~disable_abort_on_alloc_failure_temp
 #include <experimental/optional>
 #include <functional>
 #include <cstring>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cinttypes>
+#include <random>
+#include <cmath>
 #include <boost/intrusive/list.hpp>
 #include <sys/mman.h>
 #include "util/defer.hh"
@@ -105,9 +111,10 @@ struct allocation_site {
     mutable size_t size = 0; // amount of bytes in live objects allocated at backtrace.
     mutable const allocation_site* next = nullptr;
     saved_backtrace backtrace;
+    unsigned group = 0; // allocation group the objects were allocated by
 
     bool operator==(const allocation_site& o) const {
-        return backtrace == o.backtrace;
+        return backtrace == o.backtrace && group == o.group;
     }
 
     bool operator!=(const allocation_site& o) const {
@@ -122,7 +129,7 @@ namespace std {
 template<>
 struct hash<seastar::allocation_site> {
     size_t operator()(const seastar::allocation_site& bi) const {
-        return std::hash<seastar::saved_backtrace>()(bi.backtrace);
+        return std::hash<seastar::saved_backtrace>()(bi.backtrace) ^ bi.group;
     }
 };
 
@@ -136,7 +143,7 @@ namespace memory {
 
 seastar::logger seastar_memory_logger("seastar_memory");
 
-static allocation_site_ptr get_allocation_site() __attribute__((unused));
+static allocation_site_ptr get_allocation_site(size_t size) __attribute__((unused));
 
 static void on_allocation_failure(size_t size);
 
@@ -153,7 +160,9 @@ static std::atomic<bool> live_cpus[max_cpus];
 static thread_local uint64_t g_allocs;
 static thread_local uint64_t g_frees;
 static thread_local uint64_t g_cross_cpu_frees;
+static thread_local uint64_t g_cross_cpu_free_batches;
 static thread_local uint64_t g_reclaims;
+static thread_local unsigned g_allocation_group;
 
 using std::experimental::optional;
 
@@ -216,7 +225,10 @@ struct page {
     uint32_t span_size; // in pages, if we're the head or the tail
     page_list_link link;
     small_pool* pool;  // if used in a small_pool
-    free_object* freelist;
+    union {
+        free_object* freelist; // if used in a small_pool
+        unsigned alloc_group; // for large allocations, valid for head only
+    };
 #ifdef SEASTAR_HEAPPROF
     allocation_site_ptr alloc_site; // for objects whose size is multiple of page size, valid for head only
 #endif
@@ -282,6 +294,8 @@ class small_pool {
     span_sizes _span_sizes;
     free_object* _free = nullptr;
     size_t _free_count = 0;
+    size_t _nr_objects = 0;       // carved from the pool's spans
+    size_t _span_free_count = 0;  // returned to partially free spans
     unsigned _min_free;
     unsigned _max_free;
     unsigned _pages_in_use = 0;
@@ -297,6 +311,7 @@ class small_pool {
     static constexpr unsigned size_to_idx(unsigned size);
     static constexpr unsigned idx_to_size(unsigned idx);
     allocation_site_ptr& alloc_site_holder(void* ptr);
+    small_pool_stats get_stats() const;
 private:
     void add_more_objects();
     void trim_free_list();
@@ -370,6 +385,16 @@ struct cross_cpu_free_item {
     cross_cpu_free_item* next;
 };
 
+// Objects freed on this cpu but owned by another, waiting to be handed over
+// to the owner in a single atomic operation
+struct cross_cpu_free_batch {
+    static constexpr unsigned max_size = 128;
+    cross_cpu_free_item* head = nullptr;
+    cross_cpu_free_item* tail = nullptr;
+    unsigned size = 0;
+    bool queued = false; // in cpu_pages::xcpu_batched_cpus
+};
+
 struct cpu_pages {
     uint32_t min_free_pages = 20000000 / page_size;
     char* memory;
@@ -377,6 +402,10 @@ struct cpu_pages {
     uint32_t nr_pages;
     uint32_t nr_free_pages;
     uint32_t current_min_free_pages = 0;
+    uint32_t pressure_free_pages = 2 * min_free_pages;
+    bool under_pressure = false;
+    bool pressure_notification_pending = false;
+    std::function<void ()> pressure_hook;
     size_t large_allocation_warning_threshold = std::numeric_limits<size_t>::max();
     unsigned cpu_id = -1U;
     std::function<void (std::function<void ()>)> reclaim_hook;
@@ -393,8 +422,17 @@ struct cpu_pages {
         }
         page_list free_spans[nr_span_lists];  // contains spans with span_size >= 2^idx
     } fsu;
+    // Number and total size (in pages) of the spans in each free_spans list
+    uint32_t nr_free_spans[nr_span_lists] = {};
+    uint32_t free_span_pages[nr_span_lists] = {};
     small_pool_array small_pools;
     alignas(seastar::cache_line_size) std::atomic<cross_cpu_free_item*> xcpu_freelist;
+    // Only threads that flush periodically (reactor threads, from their poll
+    // loop) batch their cross-cpu frees
+    bool batch_cross_cpu_frees = false;
+    cross_cpu_free_batch xcpu_batches[max_cpus];
+    unsigned xcpu_batched_cpus[max_cpus];
+    unsigned nr_xcpu_batched_cpus = 0;
     alignas(seastar::cache_line_size) std::vector<physical_address> virt_to_phys_map;
     static std::atomic<unsigned> cpu_id_gen;
     static cpu_pages* all_cpus[max_cpus];
@@ -408,6 +446,13 @@ struct cpu_pages {
     } asu;
     allocation_site_ptr alloc_site_list_head = nullptr; // For easy traversal of asu.alloc_sites from scylla-gdb.py
     bool collect_backtrace = false;
+    // When non-zero, only one allocation every heapprof_sample_interval
+    // bytes on average is profiled; the distance between samples is drawn
+    // from an exponential distribution, so that allocations are sampled
+    // with a probability proportional to their size whatever their pattern.
+    size_t heapprof_sample_interval = 0;
+    ssize_t heapprof_bytes_until_sample = 0;
+    std::minstd_rand heapprof_random;
     char* mem() { return memory; }
 
     void link(page_list& list, page* span);
@@ -418,9 +463,30 @@ struct cpu_pages {
     };
     void maybe_reclaim();
     template <typename Trimmer>
-    void* allocate_large_and_trim(unsigned nr_pages, Trimmer trimmer);
+    void* allocate_large_and_trim(unsigned nr_pages, Trimmer trimmer, bool may_reclaim = true);
     void* allocate_large(unsigned nr_pages);
     void* allocate_large_aligned(unsigned align_pages, unsigned nr_pages);
+    static constexpr unsigned huge_page_pages = huge_page_size / page_size;
+    // Live large allocations starting on a huge page boundary and covering
+    // at least one huge page
+    size_t nr_huge_aligned_spans = 0;
+    size_t huge_aligned_pages = 0;
+    void account_huge_aligned(pageidx idx, uint32_t n_pages, int sign) {
+        if (idx % huge_page_pages == 0 && n_pages >= huge_page_pages) {
+            nr_huge_aligned_spans += sign;
+            huge_aligned_pages += sign * ssize_t(n_pages);
+        }
+    }
+    static constexpr unsigned no_allocation_group = -1U;
+    // Kept once allocated, as live large allocations refer to it
+    std::unique_ptr<allocation_group_stats[]> allocation_groups;
+    bool track_allocation_groups = false;
+    void account_allocation_group(void* ptr, size_t size);
+    void account_large_free(page* span, uint32_t n_pages) {
+        if (span->alloc_group != no_allocation_group) {
+            allocation_groups[span->alloc_group].live_large_memory -= size_t(n_pages) * page_size;
+        }
+    }
     page* find_and_unlink_span(unsigned nr_pages);
     page* find_and_unlink_span_reclaiming(unsigned n_pages);
     void free_large(void* ptr);
@@ -431,7 +497,10 @@ struct cpu_pages {
     void free(void* ptr, size_t size);
     bool try_cross_cpu_free(void* ptr);
     void shrink(void* ptr, size_t new_size);
+    bool try_expand(void* ptr, size_t new_size);
     void free_cross_cpu(unsigned cpu_id, void* ptr);
+    void hand_over_cross_cpu_batch(unsigned cpu_id);
+    bool flush_cross_cpu_frees();
     bool drain_cross_cpu_freelist();
     size_t object_size(void* ptr);
     page* to_page(void* p) {
@@ -444,6 +513,7 @@ struct cpu_pages {
     void schedule_reclaim();
     void set_reclaim_hook(std::function<void (std::function<void ()>)> hook);
     void set_min_free_pages(size_t pages);
+    bool update_memory_pressure();
     void resize(size_t new_size, allocate_system_memory_fn alloc_sys_mem);
     void do_resize(size_t new_size, allocate_system_memory_fn alloc_sys_mem);
     void replace_memory_backing(allocate_system_memory_fn alloc_sys_mem);
@@ -473,6 +543,18 @@ void set_heap_profiling_enabled(bool enable) {
     cpu_mem.collect_backtrace = enable;
 }
 
+static void draw_next_heapprof_sample() {
+    std::exponential_distribution<double> distance(1.0 / cpu_mem.heapprof_sample_interval);
+    cpu_mem.heapprof_bytes_until_sample = ssize_t(distance(cpu_mem.heapprof_random)) + 1;
+}
+
+void set_heap_profiling_sample_interval(size_t bytes) {
+    cpu_mem.heapprof_sample_interval = bytes;
+    if (bytes) {
+        draw_next_heapprof_sample();
+    }
+}
+
 // Free spans are store in the largest index i such that nr_pages >= 1 << i.
 static inline
 unsigned index_of(unsigned pages) {
@@ -491,11 +573,17 @@ unsigned index_of_conservative(unsigned pages) {
 void
 cpu_pages::unlink(page_list& list, page* span) {
     list.erase(pages, *span);
+    auto idx = &list - fsu.free_spans;
+    --nr_free_spans[idx];
+    free_span_pages[idx] -= span->span_size;
 }
 
 void
 cpu_pages::link(page_list& list, page* span) {
     list.push_front(pages, *span);
+    auto idx = &list - fsu.free_spans;
+    ++nr_free_spans[idx];
+    free_span_pages[idx] += span->span_size;
 }
 
 void cpu_pages::free_span_no_merge(uint32_t span_start, uint32_t nr_pages) {
@@ -573,6 +661,7 @@ cpu_pages::find_and_unlink_span_reclaiming(unsigned n_pages) {
 }
 
 void cpu_pages::maybe_reclaim() {
+    update_memory_pressure();
     if (nr_free_pages < current_min_free_pages) {
         drain_cross_cpu_freelist();
         run_reclaimers(reclaimer_scope::sync);
@@ -584,13 +673,13 @@ void cpu_pages::maybe_reclaim() {
 
 template <typename Trimmer>
 void*
-cpu_pages::allocate_large_and_trim(unsigned n_pages, Trimmer trimmer) {
+cpu_pages::allocate_large_and_trim(unsigned n_pages, Trimmer trimmer, bool may_reclaim) {
     // Avoid exercising the reclaimers for requests we'll not be able to satisfy
     // nr_pages might be zero during startup, so check for that too
     if (nr_pages && n_pages >= nr_pages) {
         return nullptr;
     }
-    page* span = find_and_unlink_span_reclaiming(n_pages);
+    page* span = may_reclaim ? find_and_unlink_span_reclaiming(n_pages) : find_and_unlink_span(n_pages);
     if (!span) {
         return nullptr;
     }
@@ -612,8 +701,10 @@ cpu_pages::allocate_large_and_trim(unsigned n_pages, Trimmer trimmer) {
     span->free = span_end->free = false;
     span->span_size = span_end->span_size = t.nr_pages;
     span->pool = nullptr;
+    span->alloc_group = no_allocation_group;
+    account_huge_aligned(span_idx, t.nr_pages, 1);
 #ifdef SEASTAR_HEAPPROF
-    auto alloc_site = get_allocation_site();
+    auto alloc_site = get_allocation_site(t.nr_pages * page_size);
     span->alloc_site = alloc_site;
     if (alloc_site) {
         ++alloc_site->count;
@@ -641,6 +732,19 @@ cpu_pages::check_large_allocation(size_t size) {
 void*
 cpu_pages::allocate_large(unsigned n_pages) {
     check_large_allocation(n_pages * page_size);
+    if (n_pages >= huge_page_pages) {
+        // Place allocations covering whole huge pages on huge page boundaries,
+        // so that they are backed by as few huge pages as possible and don't
+        // share them with small, short-lived allocations. The unaligned head
+        // goes back to the free lists. This is only worth it if there is a
+        // large enough free span already, so don't reclaim for it.
+        auto ret = allocate_large_and_trim(n_pages + huge_page_pages - 1, [=] (unsigned idx, unsigned n) {
+            return trim{align_up(idx, huge_page_pages) - idx, n_pages};
+        }, false);
+        if (ret) {
+            return ret;
+        }
+    }
     return allocate_large_and_trim(n_pages, [n_pages] (unsigned idx, unsigned n) {
         return trim{0, std::min(n, n_pages)};
     });
@@ -683,13 +787,21 @@ saved_backtrace get_backtrace() noexcept {
 }
 
 static
-allocation_site_ptr get_allocation_site() {
+allocation_site_ptr get_allocation_site(size_t size) {
     if (!cpu_mem.is_initialized() || !cpu_mem.collect_backtrace) {
         return nullptr;
     }
+    if (cpu_mem.heapprof_sample_interval) {
+        cpu_mem.heapprof_bytes_until_sample -= size;
+        if (cpu_mem.heapprof_bytes_until_sample > 0) {
+            return nullptr;
+        }
+        draw_next_heapprof_sample();
+    }
     disable_backtrace_temporarily dbt;
     allocation_site new_alloc_site;
     new_alloc_site.backtrace = get_backtrace();
+    new_alloc_site.group = g_allocation_group;
     auto insert_result = cpu_mem.asu.alloc_sites.insert(std::move(new_alloc_site));
     allocation_site_ptr alloc_site = &*insert_result.first;
     if (insert_result.second) {
@@ -699,6 +811,27 @@ allocation_site_ptr get_allocation_site() {
     return alloc_site;
 }
 
+std::vector<heap_profile_site> get_heap_profile() {
+    // don't profile our own allocations while walking the sites
+    disable_backtrace_temporarily dbt;
+    std::vector<heap_profile_site> ret;
+    double interval = cpu_mem.heapprof_sample_interval;
+    for (auto&& site : cpu_mem.asu.alloc_sites) {
+        if (!site.count) {
+            continue;
+        }
+        auto estimated_size = site.size;
+        if (interval) {
+            // An object of size s is sampled with probability 1 - exp(-s / interval),
+            // so each sampled one stands for s / (1 - exp(-s / interval)) bytes.
+            double avg = double(site.size) / site.count;
+            estimated_size = site.count * avg / -std::expm1(-avg / interval);
+        }
+        ret.push_back(heap_profile_site{site.backtrace, site.group, site.count, site.size, estimated_size});
+    }
+    return ret;
+}
+
 #ifdef SEASTAR_HEAPPROF
 
 allocation_site_ptr&
@@ -722,7 +855,7 @@ cpu_pages::allocate_small(unsigned size) {
     if (!ptr) {
         return nullptr;
     }
-    allocation_site_ptr alloc_site = get_allocation_site();
+    allocation_site_ptr alloc_site = get_allocation_site(pool.object_size());
     if (alloc_site) {
         ++alloc_site->count;
         alloc_site->size += pool.object_size();
@@ -742,9 +875,22 @@ void cpu_pages::free_large(void* ptr) {
         alloc_site->size -= span->span_size * page_size;
     }
 #endif
+    account_huge_aligned(idx, span->span_size, -1);
+    account_large_free(span, span->span_size);
     free_span(idx, span->span_size);
 }
 
+void cpu_pages::account_allocation_group(void* ptr, size_t size) {
+    auto& g = allocation_groups[g_allocation_group];
+    ++g.allocations;
+    g.allocated_bytes += size;
+    auto span = to_page(ptr);
+    if (!span->pool) {
+        span->alloc_group = g_allocation_group;
+        g.live_large_memory += size_t(span->span_size) * page_size;
+    }
+}
+
 size_t cpu_pages::object_size(void* ptr) {
     pageidx idx = (reinterpret_cast<char*>(ptr) - mem()) / page_size;
     page* span = &pages[idx];
@@ -769,12 +915,58 @@ void cpu_pages::free_cross_cpu(unsigned cpu_id, void* ptr) {
         return;
     }
     auto p = reinterpret_cast<cross_cpu_free_item*>(ptr);
+    ++g_cross_cpu_frees;
+    if (batch_cross_cpu_frees) {
+        auto& b = xcpu_batches[cpu_id];
+        p->next = b.head;
+        b.head = p;
+        if (!b.size++) {
+            b.tail = p;
+        }
+        if (!b.queued) {
+            b.queued = true;
+            xcpu_batched_cpus[nr_xcpu_batched_cpus++] = cpu_id;
+        }
+        if (b.size == cross_cpu_free_batch::max_size) {
+            hand_over_cross_cpu_batch(cpu_id);
+        }
+        return;
+    }
     auto& list = all_cpus[cpu_id]->xcpu_freelist;
     auto old = list.load(std::memory_order_relaxed);
     do {
         p->next = old;
     } while (!list.compare_exchange_weak(old, p, std::memory_order_release, std::memory_order_relaxed));
-    ++g_cross_cpu_frees;
+}
+
+void cpu_pages::hand_over_cross_cpu_batch(unsigned cpu_id) {
+    auto& b = xcpu_batches[cpu_id];
+    // The owner may have exited since the objects were batched; leak them
+    if (live_cpus[cpu_id].load(std::memory_order_relaxed)) {
+        auto& list = all_cpus[cpu_id]->xcpu_freelist;
+        auto old = list.load(std::memory_order_relaxed);
+        do {
+            b.tail->next = old;
+        } while (!list.compare_exchange_weak(old, b.head, std::memory_order_release, std::memory_order_relaxed));
+        ++g_cross_cpu_free_batches;
+    }
+    b.head = b.tail = nullptr;
+    b.size = 0;
+}
+
+bool cpu_pages::flush_cross_cpu_frees() {
+    if (!nr_xcpu_batched_cpus) {
+        return false;
+    }
+    for (unsigned i = 0; i < nr_xcpu_batched_cpus; ++i) {
+        auto cpu_id = xcpu_batched_cpus[i];
+        if (xcpu_batches[cpu_id].size) {
+            hand_over_cross_cpu_batch(cpu_id);
+        }
+        xcpu_batches[cpu_id].queued = false;
+    }
+    nr_xcpu_batched_cpus = 0;
+    return true;
 }
 
 bool cpu_pages::drain_cross_cpu_freelist() {
@@ -859,14 +1051,64 @@ void cpu_pages::shrink(void* ptr, size_t new_size) {
         alloc_site->size += new_size_pages * page_size;
     }
 #endif
+    pageidx idx = span - pages;
+    account_huge_aligned(idx, old_size_pages, -1);
+    account_huge_aligned(idx, new_size_pages, 1);
+    account_large_free(span, old_size_pages - new_size_pages);
     span->span_size = new_size_pages;
     span[new_size_pages - 1].free = false;
     span[new_size_pages - 1].span_size = new_size_pages;
-    pageidx idx = span - pages;
     free_span(idx + new_size_pages, old_size_pages - new_size_pages);
 }
 
+// Takes the pages following a large allocation, when enough of them are
+// free, rather than moving it
+bool cpu_pages::try_expand(void* ptr, size_t new_size) {
+    if (object_cpu_id(ptr) != cpu_id) {
+        return false;
+    }
+    page* span = to_page(ptr);
+    if (span->pool) {
+        return false;
+    }
+    size_t new_size_pages = align_up(new_size, page_size) / page_size;
+    auto old_size_pages = span->span_size;
+    if (new_size_pages <= old_size_pages) {
+        return true;
+    }
+    auto extra = new_size_pages - old_size_pages;
+    pageidx idx = span - pages;
+    page* after = &pages[idx + old_size_pages];
+    if (!after->free || after->span_size < extra) {
+        return false;
+    }
+    auto a_size = after->span_size;
+    unlink(fsu.free_spans[index_of(a_size)], after);
+    nr_free_pages -= a_size;
+    after->free = false;
+    if (a_size > extra) {
+        free_span_no_merge(idx + new_size_pages, a_size - extra);
+    }
+#ifdef SEASTAR_HEAPPROF
+    auto alloc_site = span->alloc_site;
+    if (alloc_site) {
+        alloc_site->size += extra * page_size;
+    }
+#endif
+    account_huge_aligned(idx, old_size_pages, -1);
+    account_huge_aligned(idx, new_size_pages, 1);
+    if (span->alloc_group != no_allocation_group) {
+        allocation_groups[span->alloc_group].live_large_memory += extra * page_size;
+    }
+    span->span_size = new_size_pages;
+    span[new_size_pages - 1].free = false;
+    span[new_size_pages - 1].span_size = new_size_pages;
+    maybe_reclaim();
+    return true;
+}
+
 cpu_pages::~cpu_pages() {
+    flush_cross_cpu_frees();
     live_cpus[cpu_id].store(false, std::memory_order_relaxed);
 }
 
@@ -1006,6 +1248,7 @@ void cpu_pages::do_resize(size_t new_size, allocate_system_memory_fn alloc_sys_m
         old_pages_size -= page_size;
     }
     if (old_pages_size != 0) {
+        account_huge_aligned(old_pages_start, old_pages_size / page_size, -1);
         free_span(old_pages_start, old_pages_size / page_size);
     }
     free_span(old_nr_pages, new_pages - old_nr_pages);
@@ -1027,9 +1270,14 @@ reclaiming_result cpu_pages::run_reclaimers(reclaimer_scope scope) {
     while (nr_free_pages < target) {
         bool made_progress = false;
         ++g_reclaims;
+        // reclaimers are sorted by priority: ask the cheapest ones first, and
+        // for no more than we need
         for (auto&& r : reclaimers) {
+            if (nr_free_pages >= target) {
+                break;
+            }
             if (r->scope() >= scope) {
-                made_progress |= r->do_reclaim() == reclaiming_result::reclaimed_something;
+                made_progress |= r->do_reclaim(size_t(target - nr_free_pages) * page_size) != 0;
             }
         }
         if (!made_progress) {
@@ -1073,9 +1321,36 @@ void cpu_pages::set_min_free_pages(size_t pages) {
         throw std::runtime_error("Number of pages too large");
     }
     min_free_pages = pages;
+    pressure_free_pages = std::min<size_t>(2 * pages, std::numeric_limits<decltype(pressure_free_pages)>::max());
     maybe_reclaim();
 }
 
+bool cpu_pages::update_memory_pressure() {
+    bool pressure = nr_free_pages < pressure_free_pages;
+    if (pressure == under_pressure) {
+        return false;
+    }
+    under_pressure = pressure;
+    if (!pressure_hook || !reclaim_hook || pressure_notification_pending) {
+        return false;
+    }
+    // the hook checks the current state, so one pending notification
+    // covers any number of crossings
+    pressure_notification_pending = true;
+    try {
+        reclaim_hook([this] {
+            pressure_notification_pending = false;
+            pressure_hook();
+        });
+    } catch (...) {
+        // try again on the next check
+        pressure_notification_pending = false;
+        under_pressure = !pressure;
+        return false;
+    }
+    return true;
+}
+
 small_pool::small_pool(unsigned object_size) noexcept
     : _object_size(object_size) {
     unsigned span_size = 1;
@@ -1141,6 +1416,7 @@ small_pool::add_more_objects() {
             obj->next = _free;
             _free = obj;
             ++_free_count;
+            --_span_free_count;
             ++span.nr_small_alloc;
         }
     }
@@ -1168,6 +1444,7 @@ small_pool::add_more_objects() {
             h->next = _free;
             _free = h;
             ++_free_count;
+            ++_nr_objects;
             ++span->nr_small_alloc;
         }
     }
@@ -1188,7 +1465,12 @@ small_pool::trim_free_list() {
         }
         obj->next = span->freelist;
         span->freelist = obj;
+        ++_span_free_count;
         if (--span->nr_small_alloc == 0) {
+            // all of the span's objects are back in its freelist
+            auto span_objects = span->span_size * page_size / _object_size;
+            _nr_objects -= span_objects;
+            _span_free_count -= span_objects;
             _pages_in_use -= span->span_size;
             _span_list.erase(cpu_mem.pages, *span);
             cpu_mem.free_span(span - cpu_mem.pages, span->span_size);
@@ -1196,6 +1478,18 @@ small_pool::trim_free_list() {
     }
 }
 
+small_pool_stats
+small_pool::get_stats() const {
+    small_pool_stats ret;
+    ret.object_size = _object_size;
+    ret.span_size = _span_sizes.preferred * page_size;
+    ret.memory = _pages_in_use * page_size;
+    ret.live_objects = _nr_objects - _free_count - _span_free_count;
+    ret.free_objects = _free_count;
+    ret.span_free_objects = _span_free_count;
+    return ret;
+}
+
 void
 abort_on_underflow(size_t size) {
     if (std::make_signed_t<size_t>(size) < 0) {
@@ -1244,6 +1538,9 @@ void* allocate(size_t size) {
     if (!ptr) {
         on_allocation_failure(size);
     }
+    if (__builtin_expect(cpu_mem.track_allocation_groups && ptr, false)) {
+        cpu_mem.account_allocation_group(ptr, size);
+    }
     ++g_allocs;
     return ptr;
 }
@@ -1266,6 +1563,9 @@ void* allocate_aligned(size_t align, size_t size) {
     if (!ptr) {
         on_allocation_failure(size);
     }
+    if (__builtin_expect(cpu_mem.track_allocation_groups && ptr, false)) {
+        cpu_mem.account_allocation_group(ptr, size);
+    }
     ++g_allocs;
     return ptr;
 }
@@ -1292,14 +1592,39 @@ void shrink(void* obj, size_t new_size) {
     cpu_mem.shrink(obj, new_size);
 }
 
+bool try_expand(void* obj, size_t new_size) {
+    if (!cpu_mem.try_expand(obj, new_size)) {
+        return false;
+    }
+    ++g_frees;
+    ++g_allocs; // like shrink()
+    return true;
+}
+
 void set_reclaim_hook(std::function<void (std::function<void ()>)> hook) {
     cpu_mem.set_reclaim_hook(hook);
 }
 
 reclaimer::reclaimer(reclaim_fn reclaim, reclaimer_scope scope)
+    : reclaimer([reclaim = std::move(reclaim)] (size_t) -> size_t {
+        auto free_before = cpu_mem.nr_free_pages;
+        if (reclaim() == reclaiming_result::reclaimed_nothing) {
+            return 0;
+        }
+        auto free_after = cpu_mem.nr_free_pages;
+        // it may have freed objects without freeing whole pages
+        return free_after > free_before ? size_t(free_after - free_before) * page_size : 1;
+    }, scope, default_priority) {
+}
+
+reclaimer::reclaimer(targeted_reclaim_fn reclaim, reclaimer_scope scope, unsigned priority)
     : _reclaim(std::move(reclaim))
-    , _scope(scope) {
-    cpu_mem.reclaimers.push_back(this);
+    , _scope(scope)
+    , _priority(priority) {
+    auto& r = cpu_mem.reclaimers;
+    r.insert(std::upper_bound(r.begin(), r.end(), priority, [] (unsigned p, reclaimer* x) {
+        return p < x->priority();
+    }), this);
 }
 
 reclaimer::~reclaimer() {
@@ -1361,15 +1686,144 @@ void configure(std::vector<resource::memory> m, bool mbind,
     }
 }
 
+void populate() {
+    if (!cpu_mem.virt_to_phys_map.empty()) {
+        // hugetlbfs memory is populated when it is mapped
+        return;
+    }
+    auto start = cpu_mem.mem();
+    auto size = cpu_mem.nr_pages * page_size;
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+    if (::madvise(start, size, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
+    // Kernels before 5.14 don't know MADV_POPULATE_WRITE: fault the pages
+    // in by hand, which is safe as nothing else runs on the shard yet
+    for (size_t off = 0; off < size; off += page_size) {
+        auto p = reinterpret_cast<volatile char*>(start + off);
+        *p = *p;
+    }
+}
+
 statistics stats() {
-    return statistics{g_allocs, g_frees, g_cross_cpu_frees,
+    return statistics{g_allocs, g_frees, g_cross_cpu_frees, g_cross_cpu_free_batches,
         cpu_mem.nr_pages * page_size, cpu_mem.nr_free_pages * page_size, g_reclaims};
 }
 
+unsigned nr_small_pools() {
+    return small_pool_array::nr_small_pools;
+}
+
+small_pool_stats get_small_pool_stats(unsigned idx) {
+    return cpu_mem.small_pools[idx].get_stats();
+}
+
+unsigned nr_free_span_orders() {
+    return cpu_pages::nr_span_lists;
+}
+
+free_span_stats get_free_span_stats(unsigned order) {
+    free_span_stats ret;
+    ret.span_size = (size_t(1) << order) * page_size;
+    ret.spans = cpu_mem.nr_free_spans[order];
+    ret.free_memory = size_t(cpu_mem.free_span_pages[order]) * page_size;
+    return ret;
+}
+
+huge_page_stats get_huge_page_stats() {
+    huge_page_stats ret;
+    ret.huge_aligned_allocations = cpu_mem.nr_huge_aligned_spans;
+    ret.huge_aligned_memory = cpu_mem.huge_aligned_pages * page_size;
+    return ret;
+}
+
+size_t huge_page_backed_memory() {
+    size_t ret = 0;
+    auto start = reinterpret_cast<uintptr_t>(cpu_mem.memory);
+    auto end = start + size_t(cpu_mem.nr_pages) * page_size;
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool ours = false;
+    while (std::getline(smaps, line)) {
+        uintptr_t vma_start, vma_end;
+        if (std::sscanf(line.c_str(), "%" SCNxPTR "-%" SCNxPTR, &vma_start, &vma_end) == 2) {
+            ours = vma_start < end && vma_end > start;
+            continue;
+        }
+        size_t kb;
+        if (ours && (std::sscanf(line.c_str(), "AnonHugePages: %zu kB", &kb) == 1
+                || std::sscanf(line.c_str(), "Private_Hugetlb: %zu kB", &kb) == 1
+                || std::sscanf(line.c_str(), "Shared_Hugetlb: %zu kB", &kb) == 1)) {
+            ret += kb * 1024;
+        }
+    }
+    return ret;
+}
+
+void set_allocation_group_tracking(bool enable) {
+    if (enable && !cpu_mem.allocation_groups) {
+        cpu_mem.allocation_groups.reset(new allocation_group_stats[max_allocation_groups]);
+    }
+    cpu_mem.track_allocation_groups = enable;
+}
+
+allocation_group_stats get_allocation_group_stats(unsigned group) {
+    if (group >= max_allocation_groups) {
+        throw std::out_of_range("allocation group out of range");
+    }
+    if (!cpu_mem.allocation_groups) {
+        return allocation_group_stats();
+    }
+    return cpu_mem.allocation_groups[group];
+}
+
+void set_allocation_group(unsigned group) {
+    g_allocation_group = group;
+}
+
+void dump_allocator_stats(std::ostream& os) {
+    auto free_mem = size_t(cpu_mem.nr_free_pages) * page_size;
+    auto total_mem = size_t(cpu_mem.nr_pages) * page_size;
+    os << format("Used memory: {} Free memory: {} Total memory: {}\n", total_mem - free_mem, free_mem, total_mem);
+    os << "Small pools:\n";
+    os << format("{:>8} {:>8} {:>10} {:>10} {:>10} {:>12} {:>6}\n", "objsz", "spansz", "usedobj", "freeobj", "spanfree", "memory", "wst%");
+    for (unsigned i = 0; i < nr_small_pools(); ++i) {
+        auto sp = get_small_pool_stats(i);
+        if (!sp.memory) {
+            continue;
+        }
+        auto wasted_percent = (sp.free_objects + sp.span_free_objects) * sp.object_size * 100.0 / sp.memory;
+        os << format("{:>8} {:>8} {:>10} {:>10} {:>10} {:>12} {:>6.1f}\n", sp.object_size, sp.span_size,
+                sp.live_objects, sp.free_objects, sp.span_free_objects, sp.memory, wasted_percent);
+    }
+    os << "Free page spans:\n";
+    os << format("{:>5} {:>12} {:>8} {:>12}\n", "order", "size [B]", "spans", "free [B]");
+    for (unsigned i = 0; i < nr_free_span_orders(); ++i) {
+        auto fs = get_free_span_stats(i);
+        if (!fs.spans) {
+            continue;
+        }
+        os << format("{:>5} {:>12} {:>8} {:>12}\n", i, fs.span_size, fs.spans, fs.free_memory);
+    }
+}
+
 bool drain_cross_cpu_freelist() {
     return cpu_mem.drain_cross_cpu_freelist();
 }
 
+void set_cross_cpu_free_batching(bool enable) {
+    if (!enable) {
+        cpu_mem.flush_cross_cpu_frees();
+    }
+    cpu_mem.batch_cross_cpu_frees = enable;
+}
+
+bool flush_cross_cpu_frees() {
+    return cpu_mem.flush_cross_cpu_frees();
+}
+
 translation
 translate(const void* addr, size_t size) {
     auto cpu_id = object_cpu_id(addr);
@@ -1395,6 +1849,18 @@ void set_min_free_pages(size_t pages) {
     cpu_mem.set_min_free_pages(pages);
 }
 
+bool under_memory_pressure() {
+    return cpu_mem.under_pressure;
+}
+
+void set_memory_pressure_hook(std::function<void ()> hook) {
+    cpu_mem.pressure_hook = std::move(hook);
+}
+
+bool update_memory_pressure() {
+    return cpu_mem.update_memory_pressure();
+}
+
 static thread_local int report_on_alloc_failure_suppressed = 0;
 
 class disable_report_on_alloc_failure_temporarily {
@@ -1420,31 +1886,9 @@ void on_allocation_failure(size_t size) {
                     (seastar_memory_logger.is_enabled(seastar::log_level::debug) && !abort_on_alloc_failure_suppressed))) {
         disable_report_on_alloc_failure_temporarily guard;
         seastar_memory_logger.debug("Failed to allocate {} bytes at {}", size, current_backtrace());
-        auto free_mem = cpu_mem.nr_free_pages * page_size;
-        auto total_mem = cpu_mem.nr_pages * page_size;
-        seastar_memory_logger.debug("Used memory: {} Free memory: {} Total memory: {}", total_mem - free_mem, free_mem, total_mem);
-        seastar_memory_logger.debug("Small pools:");
-        seastar_memory_logger.debug("objsz spansz usedobj   memory       wst%");
-        for (unsigned i = 0; i < cpu_mem.small_pools.nr_small_pools; i++) {
-            auto& sp = cpu_mem.small_pools[i];
-            auto use_count = sp._pages_in_use * page_size / sp.object_size() - sp._free_count;
-            auto memory = sp._pages_in_use * page_size;
-            auto wasted_percent = memory ? sp._free_count * sp.object_size() * 100.0 / memory : 0;
-            seastar_memory_logger.debug("{} {} {} {} {}", sp.object_size(), sp._span_sizes.preferred * page_size, use_count, memory, wasted_percent);
-        }
-        seastar_memory_logger.debug("Page spans:");
-        seastar_memory_logger.debug("index size [B]     free [B]");
-        for (unsigned i = 0; i< cpu_mem.nr_span_lists; i++) {
-            auto& span_list = cpu_mem.fsu.free_spans[i];
-            auto front = span_list._front;
-            uint32_t total = 0;
-            while(front) {
-                auto& span = cpu_mem.pages[front];
-                total += span.span_size;
-                front = span.link._next;
-            }
-            seastar_memory_logger.debug("{} {} {}", i, (1<<i) * page_size, total * page_size);
-        }
+        std::ostringstream os;
+        dump_allocator_stats(os);
+        seastar_memory_logger.debug("{}", os.str());
     }
 
     if (!abort_on_alloc_failure_suppressed
@@ -1525,6 +1969,9 @@ void* realloc(void* ptr, size_t size) {
         seastar::memory::shrink(ptr, size);
         return ptr;
     }
+    if (ptr && seastar::memory::try_expand(ptr, size)) {
+        return ptr;
+    }
     auto nptr = malloc(size);
     if (!nptr) {
         return nptr;
@@ -1744,6 +2191,14 @@ void set_heap_profiling_enabled(bool enabled) {
     seastar_logger.warn("Seastar compiled with default allocator, heap profiler not supported");
 }
 
+void set_heap_profiling_sample_interval(size_t bytes) {
+    // Ignore, heap profiler not supported for default allocator.
+}
+
+std::vector<heap_profile_site> get_heap_profile() {
+    return {};
+}
+
 void enable_abort_on_allocation_failure() {
     seastar_logger.warn("Seastar compiled with default allocator, will not abort on bad_alloc");
 }
@@ -1751,6 +2206,9 @@ void enable_abort_on_allocation_failure() {
 reclaimer::reclaimer(reclaim_fn reclaim, reclaimer_scope) {
 }
 
+reclaimer::reclaimer(targeted_reclaim_fn reclaim, reclaimer_scope, unsigned) {
+}
+
 reclaimer::~reclaimer() {
 }
 
@@ -1760,14 +2218,67 @@ void set_reclaim_hook(std::function<void (std::function<void ()>)> hook) {
 void configure(std::vector<resource::memory> m, bool mbind, std::experimental::optional<std::string> hugepages_path) {
 }
 
+void populate() {
+}
+
 statistics stats() {
-    return statistics{0, 0, 0, 1 << 30, 1 << 30, 0};
+    return statistics{0, 0, 0, 0, 1 << 30, 1 << 30, 0};
+}
+
+unsigned nr_small_pools() {
+    return 0;
+}
+
+small_pool_stats get_small_pool_stats(unsigned idx) {
+    throw std::out_of_range("no small pools with the default allocator");
+}
+
+unsigned nr_free_span_orders() {
+    return 0;
+}
+
+free_span_stats get_free_span_stats(unsigned order) {
+    throw std::out_of_range("no free spans with the default allocator");
+}
+
+void dump_allocator_stats(std::ostream& os) {
+    os << "Seastar compiled with default allocator, allocator statistics not supported\n";
+}
+
+huge_page_stats get_huge_page_stats() {
+    return huge_page_stats{0, 0};
+}
+
+bool try_expand(void* ptr, size_t new_size) {
+    return false;
+}
+
+size_t huge_page_backed_memory() {
+    return 0;
+}
+
+void set_allocation_group_tracking(bool enable) {
+    // Ignore, not supported for default allocator.
+}
+
+allocation_group_stats get_allocation_group_stats(unsigned group) {
+    return allocation_group_stats();
+}
+
+void set_allocation_group(unsigned group) {
 }
 
 bool drain_cross_cpu_freelist() {
     return false;
 }
 
+void set_cross_cpu_free_batching(bool enable) {
+}
+
+bool flush_cross_cpu_frees() {
+    return false;
+}
+
 translation
 translate(const void* addr, size_t size) {
     return {};
@@ -1785,6 +2296,18 @@ void set_min_free_pages(size_t pages) {
     // Ignore, reclaiming not supported for default allocator.
 }
 
+bool under_memory_pressure() {
+    return false;
+}
+
+void set_memory_pressure_hook(std::function<void ()> hook) {
+    // Ignore, free memory is not tracked by the default allocator.
+}
+
+bool update_memory_pressure() {
+    return false;
+}
+
 void set_large_allocation_warning_threshold(size_t) {
     // Ignore, not supported for default allocator.
 }
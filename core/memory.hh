@@ -24,8 +24,10 @@
 
 #include "resource.hh"
 #include "bitops.hh"
+#include "util/backtrace.hh"
 #include <new>
 #include <functional>
+#include <iosfwd>
 #include <vector>
 
 namespace seastar {
@@ -75,6 +77,11 @@ static constexpr size_t huge_page_size =
 void configure(std::vector<resource::memory> m, bool mbind,
         std::experimental::optional<std::string> hugetlbfs_path = {});
 
+// Faults in all of the calling shard's memory, on the NUMA nodes it was
+// bound to, so that allocations don't pay for it later. Must be called
+// after configure(), before the shard runs anything else.
+void populate();
+
 void enable_abort_on_allocation_failure();
 
 class disable_abort_on_alloc_failure_temporarily {
@@ -85,6 +92,39 @@ class disable_abort_on_alloc_failure_temporarily {
 
 void set_heap_profiling_enabled(bool);
 
+/// \endcond
+
+/// Makes the heap profiler record only one allocation every \c bytes bytes
+/// allocated, on average, instead of all of them; 0 records them all.
+///
+/// Only sampled allocations pay for capturing a backtrace, which makes the
+/// profiler cheap enough to leave enabled under real load. Their frees are
+/// tracked, and get_heap_profile() scales the sampled live bytes back into
+/// an estimate of the live bytes allocated at each site. Requires seastar to
+/// be built with SEASTAR_HEAPPROF, and the profiler to be enabled.
+void set_heap_profiling_sample_interval(size_t bytes);
+
+/// Live memory allocated at one call site, as recorded by the heap profiler.
+struct heap_profile_site {
+    /// Where the objects were allocated
+    saved_backtrace backtrace;
+    /// Allocation (scheduling) group that allocated the objects
+    unsigned group;
+    /// Number of recorded (sampled) objects that are still live
+    size_t count;
+    /// Size of the recorded objects that are still live, in bytes
+    size_t size;
+    /// Estimated size of all live objects allocated at this site, in bytes;
+    /// equal to \c size when every allocation is recorded
+    size_t estimated_size;
+};
+
+/// Returns the live memory of this lcore recorded by the heap profiler, by
+/// allocation site.
+std::vector<heap_profile_site> get_heap_profile();
+
+/// \cond internal
+
 enum class reclaiming_result {
     reclaimed_nothing,
     reclaimed_something
@@ -112,16 +152,37 @@ enum class reclaimer_scope {
 class reclaimer {
 public:
     using reclaim_fn = std::function<reclaiming_result ()>;
+    // Frees about the given number of bytes, and returns how many bytes it
+    // actually freed.
+    using targeted_reclaim_fn = std::function<size_t (size_t bytes_to_reclaim)>;
+    // Reclaimers are asked to free memory in increasing priority order, and
+    // only until the allocator has enough free memory, so the cheapest
+    // sources of memory should have the lowest priorities.
+    static constexpr unsigned default_priority = 100;
 private:
-    reclaim_fn _reclaim;
+    targeted_reclaim_fn _reclaim;
     reclaimer_scope _scope;
+    unsigned _priority;
+    size_t _reclaimed_bytes = 0;
 public:
     // Installs new reclaimer which will be invoked when system is falling
     // low on memory. 'scope' determines when reclaimer can be executed.
+    // It is asked at default_priority, and is assumed to have freed
+    // whatever the allocator's free memory grew by.
     reclaimer(reclaim_fn reclaim, reclaimer_scope scope = reclaimer_scope::async);
+    // Installs new reclaimer which is told how many bytes the allocator
+    // needs, and is asked after reclaimers of lower 'priority'.
+    reclaimer(targeted_reclaim_fn reclaim, reclaimer_scope scope, unsigned priority);
     ~reclaimer();
-    reclaiming_result do_reclaim() { return _reclaim(); }
+    size_t do_reclaim(size_t bytes_to_reclaim) {
+        auto freed = _reclaim(bytes_to_reclaim);
+        _reclaimed_bytes += freed;
+        return freed;
+    }
     reclaimer_scope scope() const { return _scope; }
+    unsigned priority() const { return _priority; }
+    // Total number of bytes this reclaimer reported having freed
+    size_t reclaimed_bytes() const { return _reclaimed_bytes; }
 };
 
 // Call periodically to recycle objects that were freed
@@ -130,6 +191,17 @@ class reclaimer {
 // Returns @true if any work was actually performed.
 bool drain_cross_cpu_freelist();
 
+// Makes frees of objects owned by other cpus, on this thread, be buffered
+// per owner and handed over in batches (one atomic operation per batch
+// rather than per object). Only for threads that call
+// flush_cross_cpu_frees() periodically; disabling flushes.
+void set_cross_cpu_free_batching(bool enable);
+
+// Hands over buffered cross-cpu frees to their owners.
+//
+// Returns @true if any were buffered.
+bool flush_cross_cpu_frees();
+
 
 // We don't want the memory code calling back into the rest of
 // the system, so allow the rest of the system to tell the memory
@@ -168,14 +240,15 @@ class statistics {
     uint64_t _mallocs;
     uint64_t _frees;
     uint64_t _cross_cpu_frees;
+    uint64_t _cross_cpu_free_batches;
     size_t _total_memory;
     size_t _free_memory;
     uint64_t _reclaims;
 private:
-    statistics(uint64_t mallocs, uint64_t frees, uint64_t cross_cpu_frees,
+    statistics(uint64_t mallocs, uint64_t frees, uint64_t cross_cpu_frees, uint64_t cross_cpu_free_batches,
             uint64_t total_memory, uint64_t free_memory, uint64_t reclaims)
         : _mallocs(mallocs), _frees(frees), _cross_cpu_frees(cross_cpu_frees)
-        , _total_memory(total_memory), _free_memory(free_memory), _reclaims(reclaims) {}
+        , _cross_cpu_free_batches(cross_cpu_free_batches), _total_memory(total_memory), _free_memory(free_memory), _reclaims(reclaims) {}
 public:
     /// Total number of memory allocations calls since the system was started.
     uint64_t mallocs() const { return _mallocs; }
@@ -184,6 +257,9 @@ class statistics {
     /// Total number of memory deallocations that occured on a different lcore
     /// than the one on which they were allocated.
     uint64_t cross_cpu_frees() const { return _cross_cpu_frees; }
+    /// Total number of batches in which cross-cpu deallocations were handed
+    /// over to the lcores owning the memory.
+    uint64_t cross_cpu_free_batches() const { return _cross_cpu_free_batches; }
     /// Total number of objects which were allocated but not freed.
     size_t live_objects() const { return mallocs() - frees(); }
     /// Total free memory (in bytes)
@@ -197,6 +273,118 @@ class statistics {
     friend statistics stats();
 };
 
+/// Statistics of one of the pools small allocations are served from.
+///
+/// Objects freed by the application first return to the pool's free list;
+/// when that grows too long, they go back to the spans they were carved
+/// from, and a span whose objects are all back is returned to the page
+/// allocator. Objects held in partially free spans are memory the pool
+/// owns but that cannot be used by other pools or large allocations.
+struct small_pool_stats {
+    /// Size of the pool's objects, in bytes
+    size_t object_size;
+    /// Size of the spans the pool carves objects from, in bytes
+    size_t span_size;
+    /// Memory held in spans owned by the pool, in bytes
+    size_t memory;
+    /// Number of objects allocated and not yet freed
+    size_t live_objects;
+    /// Number of free objects in the pool's free list
+    size_t free_objects;
+    /// Number of free objects held in partially free spans
+    size_t span_free_objects;
+};
+
+/// Statistics of the free page spans of one size order: order \c i holds
+/// spans of at least 2^i pages, and less than 2^(i+1).
+struct free_span_stats {
+    /// Smallest size of the spans in this order, in bytes
+    size_t span_size;
+    /// Number of free spans
+    size_t spans;
+    /// Total size of the free spans, in bytes
+    size_t free_memory;
+};
+
+/// Number of small object pools, in increasing object size order.
+/// Zero when seastar is compiled with the default allocator.
+unsigned nr_small_pools();
+
+/// Capture a snapshot of the statistics of a small object pool of this lcore.
+small_pool_stats get_small_pool_stats(unsigned idx);
+
+/// Number of free page span orders.
+/// Zero when seastar is compiled with the default allocator.
+unsigned nr_free_span_orders();
+
+/// Capture a snapshot of the statistics of the free page spans of an order,
+/// on this lcore.
+free_span_stats get_free_span_stats(unsigned order);
+
+/// Writes a human readable report of this lcore's small pools and free
+/// page spans, telling whether memory is used up or just fragmented.
+void dump_allocator_stats(std::ostream& os);
+
+/// Huge page placement statistics of an lcore's memory.
+///
+/// Large allocations covering at least a huge page are placed on huge page
+/// boundaries when a free span allows it, so that they are backed by as few
+/// (transparent) huge pages as possible, and don't share them with small
+/// allocations.
+struct huge_page_stats {
+    /// Number of live large allocations placed on a huge page boundary
+    size_t huge_aligned_allocations;
+    /// Size of those allocations, in bytes
+    size_t huge_aligned_memory;
+};
+
+/// Capture a snapshot of this lcore's huge page placement statistics.
+huge_page_stats get_huge_page_stats();
+
+/// Returns how much of this lcore's memory is actually backed by huge pages
+/// (transparent or hugetlbfs), in bytes, as reported by the kernel.
+///
+/// Reads /proc/self/smaps, so it is too expensive to call often.
+size_t huge_page_backed_memory();
+
+/// Grows an allocation of this lcore to at least \c new_size bytes without
+/// moving it, when the pages that follow it are free. Only allocations of
+/// whole pages (larger than the small pools' objects) can grow in place.
+///
+/// \return true if the allocation now holds \c new_size bytes; false, with
+///         it left unchanged, otherwise, and always with the default allocator.
+bool try_expand(void* ptr, size_t new_size);
+
+/// Maximum number of allocation groups; allocations are attributed to the
+/// scheduling group that was running when they were made, by group id.
+static constexpr unsigned max_allocation_groups = 1024;
+
+/// Memory allocated by one allocation group (scheduling group) of this lcore.
+struct allocation_group_stats {
+    /// Number of allocations made by the group
+    uint64_t allocations = 0;
+    /// Bytes allocated by the group, including memory since freed
+    uint64_t allocated_bytes = 0;
+    /// Memory in live allocations larger than a page made by the group, in
+    /// bytes. Live small allocations are not attributed to groups; the heap
+    /// profiler's samples are (see \ref heap_profile_site::group).
+    size_t live_large_memory = 0;
+};
+
+/// Enables or disables attributing allocations to the scheduling group
+/// running when they are made. Costs an increment per allocation while
+/// enabled.
+void set_allocation_group_tracking(bool enable);
+
+/// Returns the memory allocated by \c group while tracking was enabled.
+allocation_group_stats get_allocation_group_stats(unsigned group);
+
+/// \cond internal
+// Sets the group that allocations are attributed to; called by the
+// reactor when it switches scheduling groups.
+void set_allocation_group(unsigned group);
+/// \endcond
+
 struct memory_layout {
     uintptr_t start;
     uintptr_t end;
@@ -213,6 +401,25 @@ size_t min_free_memory();
 /// Sets the value of free memory low water mark in memory::page_size units.
 void set_min_free_pages(size_t pages);
 
+/// Returns true if free memory is below the pressure watermark, which is
+/// twice the low water mark set by set_min_free_pages().
+///
+/// Subsystems should throttle admission of new work while it is, so that
+/// reclaim can run asynchronously rather than on the allocation path.
+/// See also \ref memory_account.
+bool under_memory_pressure();
+
+/// \cond internal
+// Installs a function to be run, as a task scheduled through the reclaim
+// hook, after free memory crosses the pressure watermark in either direction.
+void set_memory_pressure_hook(std::function<void ()> hook);
+
+// Notices free memory going back above the pressure watermark; called
+// by the reactor outside the allocator, since frees can't schedule tasks.
+// Returns true if it scheduled a notification.
+bool update_memory_pressure();
+/// \endcond
+
 /// Enable the large allocation warning threshold.
 ///
 /// Warn when allocation above a given threshold are performed.
@@ -0,0 +1,108 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include <algorithm>
+#include <vector>
+#include "memory_account.hh"
+#include "memory.hh"
+#include "metrics.hh"
+
+namespace seastar {
+
+static thread_local std::vector<memory_account*> memory_accounts;
+static thread_local condition_variable memory_pressure_waiters;
+
+memory_account::memory_account(sstring name, size_t soft_limit, size_t hard_limit)
+        : _name(std::move(name)), _soft_limit(soft_limit), _hard_limit(hard_limit) {
+    namespace sm = metrics;
+    static auto account_label = sm::label("account");
+    auto l = account_label(_name);
+    _metrics.add_group("memory", {
+        sm::make_current_bytes("account_used_memory", [this] { return _used; },
+                sm::description("Memory charged to the account"), {l}),
+        sm::make_gauge("account_soft_limit", [this] { return _soft_limit; },
+                sm::description("Usage, in bytes, at which the account throttles admission"), {l}),
+        sm::make_gauge("account_hard_limit", [this] { return _hard_limit; },
+                sm::description("Usage, in bytes, the account refuses to exceed"), {l}),
+    });
+    memory_accounts.push_back(this);
+}
+
+memory_account::~memory_account() {
+    memory_accounts.erase(std::find(memory_accounts.begin(), memory_accounts.end(), this));
+    _admission.broken();
+}
+
+void memory_account::set_limits(size_t soft_limit, size_t hard_limit) {
+    _soft_limit = soft_limit;
+    _hard_limit = hard_limit;
+    if (!should_throttle()) {
+        _admission.broadcast();
+    }
+}
+
+void memory_account::release(size_t bytes) {
+    assert(bytes <= _used);
+    _used -= bytes;
+    if (!should_throttle()) {
+        _admission.broadcast();
+    }
+}
+
+bool memory_account::should_throttle() const {
+    return _used >= _soft_limit || memory::under_memory_pressure();
+}
+
+future<> memory_account::wait_for_admission() {
+    if (!should_throttle()) {
+        return make_ready_future<>();
+    }
+    return _admission.wait([this] { return !should_throttle(); });
+}
+
+void memory_account::notify_memory_pressure_changed() {
+    if (!should_throttle()) {
+        _admission.broadcast();
+    }
+}
+
+future<> wait_for_memory_pressure() {
+    if (memory::under_memory_pressure()) {
+        return make_ready_future<>();
+    }
+    return memory_pressure_waiters.wait([] { return memory::under_memory_pressure(); });
+}
+
+namespace internal {
+
+void notify_memory_pressure_changed() {
+    if (memory::under_memory_pressure()) {
+        memory_pressure_waiters.broadcast();
+        return;
+    }
+    for (auto a : memory_accounts) {
+        a->notify_memory_pressure_changed();
+    }
+}
+
+}
+
+}
@@ -0,0 +1,121 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <limits>
+#include "future.hh"
+#include "sstring.hh"
+#include "condition-variable.hh"
+#include "metrics_registration.hh"
+
+namespace seastar {
+
+/// \addtogroup memory-module
+/// @{
+
+/// Tracks the memory used by one subsystem of a shard (a cache, memtables,
+/// network buffers), against a soft and a hard limit.
+///
+/// Subsystems charge the account for the memory they hold and release it
+/// when they let go of it. Before admitting new work, they wait for
+/// \ref wait_for_admission(), which defers while the account is over its
+/// soft limit or the shard is under memory pressure (see
+/// \ref memory::under_memory_pressure()); this keeps reclaim off the
+/// allocation path, where it would stall the shard. The hard limit is
+/// enforced by \ref try_charge().
+///
+/// Accounts are per shard, and export their usage as metrics labelled with
+/// their name, which must therefore be unique on the shard.
+class memory_account {
+    sstring _name;
+    size_t _soft_limit;
+    size_t _hard_limit;
+    size_t _used = 0;
+    condition_variable _admission;
+    metrics::metric_groups _metrics;
+public:
+    /// \param name name of the subsystem, used to label metrics
+    /// \param soft_limit usage at which admission is throttled, in bytes
+    /// \param hard_limit usage that \ref try_charge() refuses to exceed, in bytes
+    memory_account(sstring name, size_t soft_limit, size_t hard_limit = std::numeric_limits<size_t>::max());
+    memory_account(const memory_account&) = delete;
+    memory_account& operator=(const memory_account&) = delete;
+    ~memory_account();
+    const sstring& name() const {
+        return _name;
+    }
+    /// Number of bytes currently charged to the account
+    size_t used() const {
+        return _used;
+    }
+    size_t soft_limit() const {
+        return _soft_limit;
+    }
+    size_t hard_limit() const {
+        return _hard_limit;
+    }
+    void set_limits(size_t soft_limit, size_t hard_limit = std::numeric_limits<size_t>::max());
+    /// Charges \c bytes to the account if that does not take it over its
+    /// hard limit; returns whether it was charged.
+    bool try_charge(size_t bytes) {
+        if (bytes > _hard_limit || _used > _hard_limit - bytes) {
+            return false;
+        }
+        _used += bytes;
+        return true;
+    }
+    /// Charges \c bytes to the account unconditionally, for memory that
+    /// was already allocated.
+    void charge(size_t bytes) {
+        _used += bytes;
+    }
+    /// Returns \c bytes previously charged to the account.
+    void release(size_t bytes);
+    /// Returns true if new work should wait before allocating: the account
+    /// is over its soft limit, or the shard is under memory pressure.
+    bool should_throttle() const;
+    /// Returns a future that resolves when \ref should_throttle() is false;
+    /// immediately if it already is.
+    future<> wait_for_admission();
+    /// \cond internal
+    void notify_memory_pressure_changed();
+    /// \endcond
+};
+
+/// Returns a future that resolves when free memory on this shard drops
+/// below the pressure watermark (immediately, if it already is below),
+/// for subsystems that can give memory back before reclaim has to run.
+future<> wait_for_memory_pressure();
+
+/// \cond internal
+namespace internal {
+
+// Wakes up the waiters of memory accounts and of wait_for_memory_pressure();
+// installed by the reactor as the memory pressure hook.
+void notify_memory_pressure_changed();
+
+}
+/// \endcond
+
+/// @}
+
+}
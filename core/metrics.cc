@@ -21,6 +21,7 @@
 
 #include "metrics.hh"
 #include "metrics_api.hh"
+#include <mutex>
 #include <boost/range/algorithm.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/replace.hpp>
@@ -115,9 +116,12 @@ label shard_label("shard");
 label type_label("type");
 namespace impl {
 
-registered_metric::registered_metric(metric_id id, metric_function f, bool enabled) :
+registered_metric::registered_metric(metric_id id, metric_function f, bool enabled, bool skip_when_empty,
+        std::vector<sstring> aggregate_labels) :
         _f(f), _impl(get_local_impl()) {
     _info.enabled = enabled;
+    _info.skip_when_empty = skip_when_empty;
+    _info.aggregate_labels = std::move(aggregate_labels);
     _info.id = id;
 }
 
@@ -126,6 +130,7 @@ metric_value metric_value::operator+(const metric_value& c) {
     switch (_type) {
     case data_type::HISTOGRAM:
         boost::get<histogram>(res.u) += boost::get<histogram>(c.u);
+        break;
     default:
         boost::get<double>(res.u) += boost::get<double>(c.u);
         break;
@@ -162,6 +167,18 @@ metric_definition_impl& metric_definition_impl::operator ()(const label_instance
     return *this;
 }
 
+metric_definition_impl& metric_definition_impl::aggregate(const std::vector<label>& labels) {
+    for (auto&& l : labels) {
+        aggregate_labels.push_back(l.name());
+    }
+    return *this;
+}
+
+metric_definition_impl& metric_definition_impl::set_skip_when_empty(bool skip) {
+    skip_when_empty = skip;
+    return *this;
+}
+
 std::unique_ptr<metric_groups_def> create_metric_groups() {
     return  std::make_unique<metric_groups_impl>();
 }
@@ -176,7 +193,8 @@ metric_groups_impl& metric_groups_impl::add_metric(group_name_type name, const m
 
     metric_id id(name, md._impl->name, md._impl->labels);
 
-    get_local_impl()->add_registration(id, md._impl->type.base_type, md._impl->f, md._impl->d, md._impl->enabled);
+    get_local_impl()->add_registration(id, md._impl->type.base_type, md._impl->f, md._impl->d, md._impl->enabled,
+            md._impl->skip_when_empty, md._impl->aggregate_labels);
 
     _registration.push_back(id);
     return *this;
@@ -196,6 +214,73 @@ metric_groups_impl& metric_groups_impl::add_group(group_name_type name, const st
     return *this;
 }
 
+namespace {
+
+// Hashes and compares interned values by value, to look them up with a
+// pointer to a value
+template <typename T>
+struct pointee_hash {
+    size_t operator()(const T* p) const {
+        return std::hash<T>()(*p);
+    }
+};
+
+template <typename T>
+struct pointee_equal {
+    bool operator()(const T* a, const T* b) const {
+        return *a == *b;
+    }
+};
+
+// The interned values of a type, shared by all shards. Interning happens
+// when metrics are registered, so a lock is good enough.
+template <typename T>
+class intern_pool {
+    std::mutex _mutex;
+    std::unordered_map<const T*, std::weak_ptr<const T>, pointee_hash<T>, pointee_equal<T>> _values;
+public:
+    std::shared_ptr<const T> get(const T& v) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto i = _values.find(&v);
+        if (i != _values.end()) {
+            if (auto p = i->second.lock()) {
+                return p;
+            }
+            // its last user is about to remove it
+            _values.erase(i);
+        }
+        auto p = std::shared_ptr<const T>(new T(v), [this] (const T* x) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                auto i = _values.find(x);
+                if (i != _values.end() && i->first == x) {
+                    _values.erase(i);
+                }
+            }
+            delete x;
+        });
+        _values.emplace(p.get(), p);
+        return p;
+    }
+};
+
+// never destroyed, since ids may outlive static destruction
+template <typename T>
+intern_pool<T>& pool() {
+    static auto p = new intern_pool<T>();
+    return *p;
+}
+
+}
+
+interned_sstring intern(const sstring& s) {
+    return pool<sstring>().get(s);
+}
+
+interned_labels intern(const labels_type& labels) {
+    return pool<labels_type>().get(labels);
+}
+
 bool metric_id::operator<(
         const metric_id& id2) const {
     return as_tuple() < id2.as_tuple();
@@ -208,7 +293,7 @@ static std::string safe_name(const sstring& name) {
 }
 
 sstring metric_id::full_name() const {
-    return safe_name(_group + "_" + _name);
+    return safe_name(*_group + "_" + *_name);
 }
 
 bool metric_id::operator==(
@@ -317,8 +402,9 @@ std::vector<std::vector<metric_function>>& impl::functions() {
     return _current_metrics;
 }
 
-void impl::add_registration(const metric_id& id, data_type type, metric_function f, const description& d, bool enabled) {
-    auto rm = ::seastar::make_shared<registered_metric>(id, f, enabled);
+void impl::add_registration(const metric_id& id, data_type type, metric_function f, const description& d, bool enabled,
+        bool skip_when_empty, const std::vector<sstring>& aggregate_labels) {
+    auto rm = ::seastar::make_shared<registered_metric>(id, f, enabled, skip_when_empty, aggregate_labels);
     sstring name = id.full_name();
     if (_value_map.find(name) != _value_map.end()) {
         auto& metric = _value_map[name];
@@ -328,12 +414,12 @@ void impl::add_registration(const metric_id& id, data_type type, metric_function
         if (metric.info().type != type) {
             throw std::runtime_error("registering metrics " + name + " registered with different type.");
         }
-        metric[id.labels()] = rm;
+        metric[id.shared_labels()] = rm;
     } else {
         _value_map[name].info().type = type;
         _value_map[name].info().d = d;
         _value_map[name].info().name = id.full_name();
-        _value_map[name][id.labels()] = rm;
+        _value_map[name][id.shared_labels()] = rm;
     }
     dirty();
 }
@@ -344,6 +430,8 @@ const bool metric_disabled = false;
 
 
 histogram& histogram::operator+=(const histogram& c) {
+    sample_count += c.sample_count;
+    sample_sum += c.sample_sum;
     for (size_t i = 0; i < c.buckets.size(); i++) {
         if (buckets.size() <= i) {
             buckets.push_back(c.buckets[i]);
@@ -316,9 +316,23 @@ struct metric_definition_impl {
     metric_function f;
     description d;
     bool enabled = true;
+    bool skip_when_empty = false;
+    std::vector<sstring> aggregate_labels;
     std::map<sstring, sstring> labels;
     metric_definition_impl& operator ()(bool enabled);
     metric_definition_impl& operator ()(const label_instance& label);
+    /*!
+     * \brief reports the metric summed with the other metrics of its
+     * family that only differ by the given labels, e.g. by
+     * \ref shard_label to report one series for all shards instead of
+     * one per shard
+     */
+    metric_definition_impl& aggregate(const std::vector<label>& labels);
+    /*!
+     * \brief omits the metric from reports while it is zero (for
+     * histograms: while it has no samples)
+     */
+    metric_definition_impl& set_skip_when_empty(bool skip = true);
     metric_definition_impl(
         metric_name_type name,
         metric_type type,
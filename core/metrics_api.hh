@@ -22,6 +22,7 @@
 #pragma once
 
 #include "metrics.hh"
+#include <memory>
 #include <unordered_map>
 #include "sharded.hh"
 #include <boost/functional/hash.hpp>
@@ -62,6 +63,20 @@ namespace seastar {
 namespace metrics {
 namespace impl {
 
+/*!
+ * \brief interned metric id parts
+ *
+ * Metric ids are copied into their registration, the registry index and
+ * every metadata snapshot, on every shard, so they don't own their
+ * strings and labels: they point to immutable copies, that all equal
+ * values share, across shards. A copy lives as long as ids point to it.
+ */
+using interned_sstring = std::shared_ptr<const sstring>;
+using interned_labels = std::shared_ptr<const labels_type>;
+
+interned_sstring intern(const sstring& s);
+interned_labels intern(const labels_type& labels);
+
 /**
  * Metrics are collected in groups that belongs to some logical entity.
  * For example, different measurements of the cpu, will belong to group "cpu".
@@ -77,11 +92,11 @@ namespace impl {
 
 class metric_id {
 public:
-    metric_id() = default;
-    metric_id(group_name_type group, metric_name_type name,
-                    labels_type labels = {})
-                    : _group(std::move(group)), _name(
-                                    std::move(name)), _labels(labels) {
+    metric_id() : metric_id(group_name_type(), metric_name_type()) {
+    }
+    metric_id(const group_name_type& group, const metric_name_type& name,
+                    const labels_type& labels = {})
+                    : _group(intern(group)), _name(intern(name)), _labels(intern(labels)) {
     }
     metric_id(metric_id &&) = default;
     metric_id(const metric_id &) = default;
@@ -90,21 +105,24 @@ class metric_id {
     metric_id & operator=(const metric_id &) = default;
 
     const group_name_type & group_name() const {
-        return _group;
+        return *_group;
     }
     void group_name(const group_name_type & name) {
-        _group = name;
+        _group = intern(name);
     }
     const instance_id_type & instance_id() const {
-        return _labels.at(shard_label.name());
+        return _labels->at(shard_label.name());
     }
     const metric_name_type & name() const {
-        return _name;
+        return *_name;
     }
     const metrics::metric_type_def & inherit_type() const {
-        return _labels.at(type_label.name());
+        return _labels->at(type_label.name());
     }
     const labels_type& labels() const {
+        return *_labels;
+    }
+    const interned_labels& shared_labels() const {
         return _labels;
     }
     sstring full_name() const;
@@ -116,9 +134,9 @@ class metric_id {
         return std::tie(group_name(), instance_id(), name(),
                     inherit_type(), labels());
     }
-    group_name_type _group;
-    metric_name_type _name;
-    labels_type _labels;
+    interned_sstring _group;
+    interned_sstring _name;
+    interned_labels _labels;
 };
 }
 }
@@ -164,6 +182,9 @@ struct metric_family_info {
 struct metric_info {
     metric_id id;
     bool enabled;
+    bool skip_when_empty = false;
+    // the labels the metric is summed over when reported
+    std::vector<sstring> aggregate_labels;
 };
 
 
@@ -188,7 +209,8 @@ class registered_metric {
     metric_function _f;
     shared_ptr<impl> _impl;
 public:
-    registered_metric(metric_id id, metric_function f, bool enabled=true);
+    registered_metric(metric_id id, metric_function f, bool enabled=true, bool skip_when_empty=false,
+            std::vector<sstring> aggregate_labels = {});
     virtual ~registered_metric() {}
     virtual metric_value operator()() const {
         return _f();
@@ -215,7 +237,22 @@ class registered_metric {
 };
 
 using register_ref = shared_ptr<registered_metric>;
-using metric_instances = std::map<labels_type, register_ref>;
+
+// Orders interned labels by value, and finds them by value too
+struct interned_labels_less {
+    using is_transparent = void;
+    bool operator()(const interned_labels& a, const interned_labels& b) const {
+        return *a < *b;
+    }
+    bool operator()(const labels_type& a, const interned_labels& b) const {
+        return a < *b;
+    }
+    bool operator()(const interned_labels& a, const labels_type& b) const {
+        return *a < b;
+    }
+};
+
+using metric_instances = std::map<interned_labels, register_ref, interned_labels_less>;
 
 class metric_family {
     metric_instances _instances;
@@ -235,12 +272,16 @@ class metric_family {
     metric_family(metric_instances&& instances) : _instances(std::move(instances)) {
     }
 
-    register_ref& operator[](const labels_type& l) {
+    register_ref& operator[](const interned_labels& l) {
         return _instances[l];
     }
 
     const register_ref& at(const labels_type& l) const {
-        return _instances.at(l);
+        auto i = _instances.find(l);
+        if (i == _instances.end()) {
+            throw std::out_of_range("no metric instance with these labels");
+        }
+        return i->second;
     }
 
     metric_family_info& info() {
@@ -333,7 +374,8 @@ class impl {
         return _value_map;
     }
 
-    void add_registration(const metric_id& id, data_type type, metric_function f, const description& d, bool enabled);
+    void add_registration(const metric_id& id, data_type type, metric_function f, const description& d, bool enabled,
+            bool skip_when_empty = false, const std::vector<sstring>& aggregate_labels = {});
     void remove_registration(const metric_id& id);
     future<> stop() {
         return make_ready_future<>();
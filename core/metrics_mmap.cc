@@ -0,0 +1,220 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <cstring>
+#include <limits>
+#include <fcntl.h>
+#include <unistd.h>
+#include "metrics_mmap.hh"
+#include "metrics_api.hh"
+#include "posix.hh"
+#include "reactor.hh"
+#include "timer.hh"
+#include "print.hh"
+#include "align.hh"
+
+namespace seastar {
+
+namespace metrics_mmap {
+
+constexpr char file_header::magic_value[8];
+constexpr uint32_t file_header::current_version;
+
+static logger mlogger("metrics_mmap");
+
+namespace {
+
+// The calling shard's exporter. The files are on tmpfs, so setting them up
+// is done with plain system calls rather than through the reactor.
+class exporter {
+    config _cfg;
+    timer<> _timer;
+    // the layout the file was written for
+    shared_ptr<metrics::impl::metric_metadata> _metadata;
+    mmap_area _map;
+    file_header* _header = nullptr;
+    char* _values = nullptr;
+private:
+    sstring path() const {
+        return sprint("%s-%d", _cfg.path, engine().cpu_id());
+    }
+    static sstring value_name(const metrics::impl::metric_id& id, const char* suffix) {
+        auto name = id.full_name() + suffix;
+        sstring labels;
+        for (auto&& l : id.labels()) {
+            // the file is the shard's, and its values are typed
+            if (l.first == metrics::shard_label.name() || l.first == metrics::type_label.name()) {
+                continue;
+            }
+            if (!labels.empty()) {
+                labels += ",";
+            }
+            labels += l.first + "=\"" + l.second + "\"";
+        }
+        return labels.empty() ? name : name + "{" + labels + "}";
+    }
+    static value_type type_of(metrics::impl::data_type t) {
+        switch (t) {
+        case metrics::impl::data_type::COUNTER:
+        case metrics::impl::data_type::ABSOLUTE:
+            return value_type::unsigned_integer;
+        case metrics::impl::data_type::DERIVE:
+            return value_type::signed_integer;
+        default:
+            return value_type::floating;
+        }
+    }
+    // Writes a file for the layout of the metadata, replacing the old one
+    void layout(shared_ptr<metrics::impl::metric_metadata> metadata) {
+        std::vector<std::pair<value_type, sstring>> names;
+        for (auto&& family : *metadata) {
+            for (auto&& m : family.metrics) {
+                if (family.mf.type == metrics::impl::data_type::HISTOGRAM) {
+                    names.emplace_back(value_type::unsigned_integer, value_name(m.id, "_count"));
+                    names.emplace_back(value_type::floating, value_name(m.id, "_sum"));
+                } else {
+                    names.emplace_back(type_of(family.mf.type), value_name(m.id, ""));
+                }
+            }
+        }
+        size_t names_size = 0;
+        for (auto&& n : names) {
+            names_size += 4 + std::min<size_t>(n.second.size(), std::numeric_limits<uint16_t>::max());
+        }
+        auto values_offset = align_up(sizeof(file_header) + names_size, size_t(8));
+        auto size = values_offset + names.size() * 8;
+
+        auto p = path();
+        auto tmp = p + ".tmp";
+        auto fd = file_desc::open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        fd.truncate(size);
+        auto map = fd.map_shared_rw(size, 0);
+        auto header = new (map.get()) file_header();
+        std::copy_n(file_header::magic_value, sizeof(header->magic), header->magic);
+        header->version = file_header::current_version;
+        header->shard = engine().cpu_id();
+        header->nr_values = names.size();
+        header->names_offset = sizeof(file_header);
+        header->values_offset = values_offset;
+        auto out = map.get() + sizeof(file_header);
+        for (auto&& n : names) {
+            uint16_t len = std::min<size_t>(n.second.size(), std::numeric_limits<uint16_t>::max());
+            *out++ = char(n.first);
+            *out++ = 0;
+            std::memcpy(out, &len, sizeof(len));
+            out += sizeof(len);
+            out = std::copy_n(n.second.begin(), len, out);
+        }
+        if (::rename(tmp.c_str(), p.c_str())) {
+            throw std::system_error(errno, std::system_category(), "rename " + tmp);
+        }
+        if (_header) {
+            _header->stale.store(1, std::memory_order_release);
+        }
+        _map = std::move(map);
+        _header = header;
+        _values = _map.get() + values_offset;
+        _metadata = std::move(metadata);
+    }
+    void write_value(char*& out, value_type t, double v) {
+        uint64_t raw;
+        switch (t) {
+        case value_type::floating:
+            std::memcpy(&raw, &v, sizeof(raw));
+            break;
+        case value_type::unsigned_integer:
+            raw = uint64_t(v);
+            break;
+        case value_type::signed_integer:
+            raw = uint64_t(int64_t(v));
+            break;
+        }
+        std::memcpy(out, &raw, sizeof(raw));
+        out += sizeof(raw);
+    }
+    void update() {
+        auto vals = metrics::impl::get_values();
+        if (vals->metadata != _metadata) {
+            layout(vals->metadata);
+        }
+        auto seq = _header->sequence.load(std::memory_order_relaxed);
+        _header->sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        auto out = _values;
+        for (size_t f = 0; f < vals->values.size(); ++f) {
+            auto t = (*_metadata)[f].mf.type;
+            for (auto&& v : vals->values[f]) {
+                if (t == metrics::impl::data_type::HISTOGRAM) {
+                    auto& h = v.get_histogram();
+                    write_value(out, value_type::unsigned_integer, h.sample_count);
+                    write_value(out, value_type::floating, h.sample_sum);
+                } else {
+                    write_value(out, type_of(t), v.d());
+                }
+            }
+        }
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        _header->timestamp_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(), std::memory_order_relaxed);
+        _header->sequence.store(seq + 2, std::memory_order_release);
+    }
+public:
+    explicit exporter(config cfg) : _cfg(std::move(cfg)) {
+        _timer.set_callback([this] {
+            try {
+                update();
+            } catch (...) {
+                mlogger.error("failed to export metrics to {}: {}", path(), std::current_exception());
+            }
+        });
+    }
+    void start() {
+        _timer.arm_periodic(_cfg.period);
+    }
+    ~exporter() {
+        _timer.cancel();
+        if (_header) {
+            _header->stale.store(1, std::memory_order_release);
+            ::unlink(path().c_str());
+        }
+    }
+};
+
+thread_local std::unique_ptr<exporter> local_exporter;
+
+}
+
+future<> start(config cfg) {
+    return smp::invoke_on_all([cfg] {
+        local_exporter = std::make_unique<exporter>(cfg);
+        local_exporter->start();
+    });
+}
+
+future<> stop() {
+    return smp::invoke_on_all([] {
+        local_exporter.reset();
+    });
+}
+
+}
+
+}
@@ -0,0 +1,107 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "sstring.hh"
+#include "future.hh"
+
+namespace seastar {
+
+/// \brief Exports metric values into shared memory files.
+///
+/// Each shard writes a snapshot of its metric values into a file of
+/// its own, \c <path>-<shard>, every \ref config::period. The file is
+/// memory mapped, and so is meant to be on a tmpfs: a reader on the same
+/// host (such as a monitoring sidecar) maps it, and reads the values as
+/// often as it likes, without any cost for the reactor.
+///
+/// The file starts with a \ref file_header, followed by the names of the
+/// values at \ref file_header::names_offset, and by the values themselves
+/// at \ref file_header::values_offset. The names, and so the offsets of
+/// the values, only change when metrics are registered or unregistered:
+/// the shard then writes a new file, renames it over the old one, and
+/// marks the old one \ref file_header::stale, so that readers reopen the
+/// file.
+///
+/// Values are updated in place under a sequence lock. A consistent
+/// snapshot is read by reading \ref file_header::sequence (with acquire
+/// semantics), retrying while it is odd, then copying the values, then
+/// re-reading the sequence (after an acquire fence) and retrying if it
+/// changed.
+namespace metrics_mmap {
+
+/// Type of an exported value, which is 8 bytes long
+enum class value_type : uint8_t {
+    floating = 0, ///< a double
+    unsigned_integer = 1, ///< a uint64_t
+    signed_integer = 2, ///< an int64_t
+};
+
+/// Header of an exported metrics file; all fields are in the host's byte
+/// order.
+struct file_header {
+    static constexpr char magic_value[8] = { 'S', 'S', 'M', 'E', 'T', 'R', 'I', 'C' };
+    static constexpr uint32_t current_version = 1;
+    char magic[8];
+    uint32_t version;
+    uint32_t shard;
+    uint32_t nr_values;
+    /// Each value is named by a value_type byte, a byte of padding, the
+    /// uint16_t length of its name, and the name, which is the metric's
+    /// full name followed by its labels in braces
+    /// (\c group_name{label="value",...}), but for the shard and type
+    /// ones; histograms export a _count and a _sum value.
+    uint32_t names_offset;
+    /// Of nr_values 8-byte values, in the order of their names
+    uint32_t values_offset;
+    /// Set once the file is replaced with one of a new layout
+    std::atomic<uint32_t> stale;
+    /// Odd while the values are updated
+    std::atomic<uint64_t> sequence;
+    /// When the values were updated, in nanoseconds since the epoch
+    std::atomic<uint64_t> timestamp_ns;
+    char reserved[16];
+};
+
+static_assert(sizeof(file_header) == 64, "the file layout changed");
+
+/// Configures the exporter
+struct config {
+    /// Path of the files, to which "-<shard>" is appended
+    sstring path = "/dev/shm/seastar-metrics";
+    /// How often the values are written
+    std::chrono::milliseconds period = std::chrono::seconds(1);
+};
+
+/// Starts exporting the metrics of all shards.
+future<> start(config cfg);
+
+/// Stops exporting metrics, and removes the files.
+future<> stop();
+
+}
+
+}
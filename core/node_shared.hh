@@ -0,0 +1,167 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <vector>
+#include "reactor.hh"
+#include "future-util.hh"
+#include "semaphore.hh"
+
+namespace seastar {
+
+/// \addtogroup smp-module
+/// @{
+
+/// Read-mostly data shared by all shards of a NUMA node.
+///
+/// Data that every shard reads but that rarely changes (routing maps,
+/// compiled schemas) is usually replicated per shard, which multiplies its
+/// memory footprint by the number of shards and its cache footprint by the
+/// number of shards per last level cache. A \c node_shared<T> instead keeps
+/// one copy of the data per NUMA node, allocated by the node's first shard
+/// from its node-local memory, that the node's shards read directly.
+///
+/// Copies are immutable once published. \ref publish() replaces them with
+/// new ones and retires the old ones RCU-style: they are destroyed once
+/// every shard has run a task since the new copies were published. So a
+/// reference returned by \ref get() is only valid until the task that got
+/// it ends: it must not be held across a continuation, a preemption point
+/// or a \ref seastar::thread yield; call get() again instead.
+///
+/// The \c node_shared object itself belongs to the shard that created it,
+/// which alone may publish; any shard may call get() as long as the object
+/// lives, and it must be stopped with \ref stop() before it is destroyed.
+template <typename T>
+class node_shared {
+    static constexpr unsigned no_shard = -1U;
+    unsigned _owner;
+    std::vector<unsigned> _nodes; // that have shards
+    std::vector<unsigned> _leaders; // by node: first shard on the node
+    std::unique_ptr<std::atomic<const T*>[]> _copies; // by node
+    semaphore _publish_lock = { 1 };
+    bool _stopped = false;
+private:
+    // Destroys copies on the shards that allocated them, once no reader
+    // can still see them
+    future<> retire(std::vector<const T*> old) {
+        return smp::invoke_on_all([] {}).then([this, old = std::move(old)] {
+            return parallel_for_each(_nodes, [this, &old] (unsigned node) {
+                auto p = old[node];
+                if (!p) {
+                    return make_ready_future<>();
+                }
+                return smp::submit_to(_leaders[node], [p] {
+                    delete p;
+                });
+            });
+        });
+    }
+public:
+    node_shared()
+            : _owner(engine().cpu_id()) {
+        unsigned nr_nodes = 0;
+        for (auto s : smp::all_cpus()) {
+            nr_nodes = std::max(nr_nodes, smp::numa_node(s) + 1);
+        }
+        _leaders.resize(nr_nodes, no_shard);
+        for (auto s : smp::all_cpus()) {
+            auto& leader = _leaders[smp::numa_node(s)];
+            if (leader == no_shard) {
+                leader = s;
+                _nodes.push_back(smp::numa_node(s));
+            }
+        }
+        _copies.reset(new std::atomic<const T*>[nr_nodes]);
+        for (unsigned node = 0; node < nr_nodes; ++node) {
+            _copies[node].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    node_shared(const node_shared&) = delete;
+    node_shared& operator=(const node_shared&) = delete;
+    ~node_shared() {
+        assert(_stopped);
+    }
+    /// Returns the copy of the data for the calling shard's NUMA node, or
+    /// nullptr if nothing was published yet. Valid until the calling task
+    /// ends.
+    const T* get() const noexcept {
+        return _copies[smp::numa_node(engine().cpu_id())].load(std::memory_order_acquire);
+    }
+    /// Replaces the data with new copies built by \c make(), and retires
+    /// the old ones.
+    ///
+    /// \c make is called once per NUMA node, on the node's first shard, and
+    /// must return a T; it is copied to these shards, so it should capture
+    /// only what may be read from other shards. Publications made while
+    /// another is in progress are made after it.
+    ///
+    /// \return a future that resolves once the new copies are visible to
+    ///         all shards and the old ones are destroyed. If any \c make()
+    ///         fails, the data is left as it was and the error returned.
+    template <typename Func>
+    future<> publish(Func make) {
+        assert(engine().cpu_id() == _owner && !_stopped);
+        return with_semaphore(_publish_lock, 1, [this, make = std::move(make)] () mutable {
+            auto fresh = std::make_unique<std::vector<const T*>>(_leaders.size(), nullptr);
+            auto& fr = *fresh;
+            return parallel_for_each(_nodes, [this, &make, &fr] (unsigned node) {
+                return smp::submit_to(_leaders[node], [make] () mutable -> const T* {
+                    return new T(make());
+                }).then([&fr, node] (const T* copy) {
+                    fr[node] = copy;
+                });
+            }).then_wrapped([this, fresh = std::move(fresh)] (future<> f) mutable {
+                if (f.failed()) {
+                    auto ex = f.get_exception();
+                    return retire(std::move(*fresh)).then([ex = std::move(ex)] () mutable {
+                        return make_exception_future<>(std::move(ex));
+                    });
+                }
+                std::vector<const T*> old(_leaders.size(), nullptr);
+                for (auto node : _nodes) {
+                    old[node] = _copies[node].exchange((*fresh)[node], std::memory_order_acq_rel);
+                }
+                return retire(std::move(old));
+            });
+        });
+    }
+    /// Retires the data; the object may be destroyed once the returned
+    /// future resolves.
+    future<> stop() {
+        assert(engine().cpu_id() == _owner);
+        return with_semaphore(_publish_lock, 1, [this] {
+            _stopped = true;
+            std::vector<const T*> old(_leaders.size(), nullptr);
+            for (auto node : _nodes) {
+                old[node] = _copies[node].exchange(nullptr, std::memory_order_acq_rel);
+            }
+            return retire(std::move(old));
+        });
+    }
+};
+
+/// @}
+
+}
@@ -0,0 +1,206 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "reactor.hh"
+
+namespace seastar {
+
+/// \addtogroup memory-module
+/// @{
+
+/// Configuration of an \ref object_pool
+struct object_pool_config {
+    /// Number of objects in the first block the pool allocates
+    size_t initial_block_objects = 16;
+    /// Blocks double in size as the pool grows, up to this many objects
+    size_t max_block_objects = 1024;
+};
+
+/// A per-shard pool of objects of type T, for fixed-size objects that are
+/// allocated and freed at a high rate.
+///
+/// Objects are carved out of blocks that grow geometrically, and freed
+/// objects are kept on an intrusive free list, so getting and returning
+/// an object costs a few instructions and no allocator call. Blocks are
+/// only freed when the pool is destroyed; all objects must have been
+/// returned to the pool by then.
+///
+/// With \c ReuseObjects, objects are constructed once, when the pool first
+/// hands them out, and kept constructed on the free list: the user is
+/// responsible for resetting whatever state must not carry over between
+/// uses. This saves the destructor and constructor (and whatever memory
+/// they free and allocate) on every use. Otherwise, objects are constructed
+/// when they are taken from the pool and destroyed when they are returned.
+///
+/// Objects returned through \ref object_pool::ptr on another shard go back
+/// to the pool of the shard that allocated them, batched with other such
+/// returns; the pool must outlive these in-flight returns.
+template <typename T, bool ReuseObjects = false>
+class object_pool {
+    struct node {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        union {
+            node* next;            // while on the free list
+            object_pool* owner;    // while handed out
+        };
+        bool constructed;
+    };
+    static_assert(std::is_standard_layout<node>::value, "object must be at the start of its node");
+    object_pool_config _cfg;
+    unsigned _cpu;
+    std::vector<std::unique_ptr<node[]>> _blocks;
+    size_t _next_block_objects;
+    node* _free = nullptr;
+    size_t _capacity = 0;
+    size_t _free_objects = 0;
+public:
+    /// Returns objects to their pool when they are destroyed, on whatever
+    /// shard.
+    struct deleter {
+        void operator()(T* p) const {
+            object_pool::release(p);
+        }
+    };
+    using ptr = std::unique_ptr<T, deleter>;
+private:
+    static node* to_node(T* p) {
+        return reinterpret_cast<node*>(p);
+    }
+    void grow() {
+        auto n = _next_block_objects;
+        std::unique_ptr<node[]> block(new node[n]);
+        for (size_t i = 0; i < n; ++i) {
+            block[i].constructed = false;
+            block[i].next = i + 1 < n ? &block[i + 1] : _free;
+        }
+        _free = &block[0];
+        _blocks.push_back(std::move(block));
+        _capacity += n;
+        _free_objects += n;
+        _next_block_objects = std::min(n * 2, _cfg.max_block_objects);
+    }
+    node* take() {
+        if (!_free) {
+            grow();
+        }
+        auto n = _free;
+        _free = n->next;
+        --_free_objects;
+        n->owner = this;
+        return n;
+    }
+    void put(node* n) {
+        n->next = _free;
+        _free = n;
+        ++_free_objects;
+    }
+    static void release(T* p) {
+        auto n = to_node(p);
+        auto pool = n->owner;
+        if (engine().cpu_id() == pool->_cpu) {
+            pool->deallocate(p);
+        } else {
+            engine().add_foreign_disposal(pool->_cpu, p, [] (void* obj) {
+                auto p = static_cast<T*>(obj);
+                to_node(p)->owner->deallocate(p);
+            });
+        }
+    }
+public:
+    explicit object_pool(object_pool_config cfg = object_pool_config())
+            : _cfg(cfg)
+            , _cpu(engine().cpu_id())
+            , _next_block_objects(std::max<size_t>(cfg.initial_block_objects, 1)) {
+        _cfg.max_block_objects = std::max(_cfg.max_block_objects, _next_block_objects);
+    }
+    object_pool(const object_pool&) = delete;
+    object_pool& operator=(const object_pool&) = delete;
+    ~object_pool() {
+        assert(_free_objects == _capacity);
+        if (ReuseObjects) {
+            for (auto n = _free; n; n = n->next) {
+                if (n->constructed) {
+                    reinterpret_cast<T*>(&n->storage)->~T();
+                }
+            }
+        }
+    }
+    /// Takes an object from the pool. Without \c ReuseObjects, it is
+    /// constructed from \c args; with it, it is default-constructed the
+    /// first time it is handed out, and reused as it was left afterwards.
+    template <typename... Args>
+    T* allocate(Args&&... args) {
+        static_assert(!ReuseObjects || sizeof...(Args) == 0, "reused objects are default-constructed");
+        auto n = take();
+        auto p = reinterpret_cast<T*>(&n->storage);
+        if (!ReuseObjects || !n->constructed) {
+            try {
+                new (p) T(std::forward<Args>(args)...);
+            } catch (...) {
+                put(n);
+                throw;
+            }
+            n->constructed = true;
+        }
+        return p;
+    }
+    /// Returns an object taken from this pool, on the shard that owns it.
+    void deallocate(T* p) {
+        auto n = to_node(p);
+        assert(n->owner == this);
+        if (!ReuseObjects) {
+            p->~T();
+            n->constructed = false;
+        }
+        put(n);
+    }
+    /// Like \ref allocate(), but returns a pointer that gives the object
+    /// back to this pool, from any shard, when destroyed.
+    template <typename... Args>
+    ptr make(Args&&... args) {
+        return ptr(allocate(std::forward<Args>(args)...));
+    }
+    /// Number of objects the pool has memory for
+    size_t capacity() const {
+        return _capacity;
+    }
+    /// Number of objects on the free list
+    size_t free_objects() const {
+        return _free_objects;
+    }
+    /// Number of objects handed out and not yet returned
+    size_t size() const {
+        return _capacity - _free_objects;
+    }
+};
+
+/// @}
+
+}
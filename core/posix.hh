@@ -221,6 +221,14 @@ class file_desc {
         throw_system_error_on(r == -1, "recvmsg");
         return { size_t(r) };
     }
+    boost::optional<size_t> recvmmsg(mmsghdr* msgs, unsigned vlen, int flags) {
+        auto r = ::recvmmsg(_fd, msgs, vlen, flags, nullptr);
+        if (r == -1 && errno == EAGAIN) {
+            return {};
+        }
+        throw_system_error_on(r == -1, "recvmmsg");
+        return { size_t(r) };
+    }
     boost::optional<size_t> send(const void* buffer, size_t len, int flags) {
         auto r = ::send(_fd, buffer, len, flags);
         if (r == -1 && errno == EAGAIN) {
@@ -237,6 +245,14 @@ class file_desc {
         throw_system_error_on(r == -1, "sendto");
         return { size_t(r) };
     }
+    boost::optional<size_t> sendmmsg(mmsghdr* msgs, unsigned vlen, int flags) {
+        auto r = ::sendmmsg(_fd, msgs, vlen, flags);
+        if (r == -1 && errno == EAGAIN) {
+            return {};
+        }
+        throw_system_error_on(r == -1, "sendmmsg");
+        return { size_t(r) };
+    }
     boost::optional<size_t> sendmsg(const msghdr* msg, int flags) {
         auto r = ::sendmsg(_fd, msg, flags);
         if (r == -1 && errno == EAGAIN) {
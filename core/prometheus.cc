@@ -24,11 +24,15 @@
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include "proto/metrics2.pb.h"
 #include <sstream>
+#include <regex>
+#include <algorithm>
+#include <experimental/optional>
 
 #include "scollectd_api.hh"
 #include "scollectd-impl.hh"
 #include "metrics_api.hh"
 #include "http/function_handlers.hh"
+#include "http/exception.hh"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/range/algorithm_ext/erase.hpp>
 #include <boost/algorithm/string.hpp>
@@ -155,17 +159,6 @@ static std::string to_str(const seastar::metrics::impl::metric_value& v) {
     return ""; // we should never get here but it makes the compiler happy
 }
 
-static void add_name(std::ostream& s, const sstring& name, const std::map<sstring, sstring>& labels, const config& ctx) {
-    s << name << "{instance=\"" << ctx.hostname << '"';
-    if (!labels.empty()) {
-        for (auto l : labels) {
-            s << "," << l.first  << "=\"" << l.second << '"';
-        }
-    }
-    s << "} ";
-
-}
-
 /*!
  * \brief iterator for metric family
  *
@@ -403,53 +396,327 @@ class metric_family_range {
     }
 };
 
-future<> write_text_representation(output_stream<char>& out, const metrics_families_per_shard& families, const config& ctx) {
-    return do_with(metric_family_range(families), false,
-            [&ctx, &out](auto& m, auto& found) mutable {
-        return do_for_each(m, [&out, &found, &ctx] (metric_family& metric_family) mutable {
-            std::stringstream s;
-            auto name = ctx.prefix + "_" + metric_family.name();
-            found = false;
-            metric_family.foreach_metric([&s, &ctx, &found, &name, &metric_family](auto value, auto value_info) mutable {
-                if (!found) {
-                    if (metric_family.metadata().d.str() != "") {
-                        s << "# HELP " << name << " " <<  metric_family.metadata().d.str() << "\n";
-                    }
-                    s << "# TYPE " << name << " " << to_str(metric_family.metadata().type) << "\n";
-                    found = true;
+/*!
+ * \brief the families a scrape asked for, by their exported name
+ *
+ * An empty filter matches every family.
+ */
+struct name_filter {
+    sstring name;
+    bool prefix = false;
+    std::experimental::optional<std::regex> regex;
+
+    name_filter() = default;
+    name_filter(const httpd::request& req) {
+        name = req.get_query_param("__name__");
+        if (!name.empty() && name[name.size() - 1] == '*') {
+            prefix = true;
+            name.resize(name.size() - 1);
+        }
+        auto re = req.get_query_param("name_regex");
+        if (!re.empty()) {
+            try {
+                regex = std::regex(re.begin(), re.end());
+            } catch (std::regex_error& e) {
+                throw httpd::bad_param_exception(sprint("bad name_regex: %s", e.what()));
+            }
+        }
+    }
+    bool operator()(const sstring& n) const {
+        if (prefix) {
+            if (n.size() < name.size() || !std::equal(name.begin(), name.end(), n.begin())) {
+                return false;
+            }
+        } else if (!name.empty() && n != name) {
+            return false;
+        }
+        return !regex || std::regex_match(n.begin(), n.end(), *regex);
+    }
+};
+
+/*!
+ * \brief the parts of a shard's text representation that only change when
+ * metrics are registered or unregistered
+ *
+ * They are rendered once per version of the shard's metadata, which is
+ * replaced on every registration change, so a scrape only formats the
+ * values.
+ */
+struct text_prefixes {
+    // the series that the metrics of a family that are aggregated over
+    // some of their labels are summed into
+    struct aggregation {
+        // by group: the labels, without the aggregated ones
+        std::vector<sstring> labels;
+        // by metric: the group it is summed into, or -1
+        std::vector<int> group_of;
+    };
+    shared_ptr<mi::metric_metadata> metadata;
+    sstring prefix;
+    sstring hostname;
+    // by family: the HELP and TYPE lines
+    std::vector<sstring> headers;
+    // by family
+    std::vector<sstring> names;
+    // by family, by metric: the labels, without the closing brace
+    std::vector<std::vector<sstring>> labels;
+    // by family; empty for the families that have no aggregated metrics
+    std::vector<aggregation> aggregations;
+
+    static sstring render_labels(const mi::labels_type& labels, const config& ctx, const std::vector<sstring>& skip = {}) {
+        sstring l = "{instance=\"" + ctx.hostname + "\"";
+        for (auto&& i : labels) {
+            if (std::find(skip.begin(), skip.end(), i.first) == skip.end()) {
+                l += "," + i.first + "=\"" + i.second + "\"";
+            }
+        }
+        return l;
+    }
+
+    text_prefixes(shared_ptr<mi::metric_metadata> md, const config& ctx)
+            : metadata(std::move(md)), prefix(ctx.prefix), hostname(ctx.hostname) {
+        headers.reserve(metadata->size());
+        names.reserve(metadata->size());
+        labels.reserve(metadata->size());
+        aggregations.resize(metadata->size());
+        size_t f = 0;
+        for (auto&& mf : *metadata) {
+            auto name = ctx.prefix + "_" + mf.mf.name;
+            sstring header;
+            if (mf.mf.d.str() != "") {
+                header = "# HELP " + name + " " + mf.mf.d.str() + "\n";
+            }
+            header += "# TYPE " + name + " " + sstring(to_str(mf.mf.type)) + "\n";
+            headers.push_back(std::move(header));
+            std::vector<sstring> family_labels;
+            family_labels.reserve(mf.metrics.size());
+            auto& agg = aggregations[f++];
+            for (auto&& m : mf.metrics) {
+                family_labels.push_back(render_labels(m.id.labels(), ctx));
+                if (m.aggregate_labels.empty()) {
+                    continue;
                 }
-                if (value.type() == mi::data_type::HISTOGRAM) {
-                    auto&& h = value.get_histogram();
-                    std::map<sstring, sstring> labels = value_info.id.labels();
-                    auto& le = labels["le"];
-                    uint64_t count = 0;
-                    auto bucket = name + "_bucket";
-                    for (auto  i : h.buckets) {
-                         le = std::to_string(i.upper_bound);
-                        count += i.count;
-                        add_name(s, bucket, labels, ctx);
-                        s << count;
-                        s << "\n";
-                    }
-                    labels["le"] = "+Inf";
-                    add_name(s, bucket, labels, ctx);
-                    s << h.sample_count;
-                    s << "\n";
-
-                    add_name(s, name + "_sum", {}, ctx);
-                    s << h.sample_sum;
-                    s << "\n";
-                    add_name(s, name + "_count", {}, ctx);
-                    s << h.sample_count;
-                    s << "\n";
-
-                } else {
-                    add_name(s, name, value_info.id.labels(), ctx);
-                    s << to_str(value);
-                    s << "\n";
+                if (agg.group_of.empty()) {
+                    agg.group_of.resize(mf.metrics.size(), -1);
                 }
+                auto l = render_labels(m.id.labels(), ctx, m.aggregate_labels);
+                auto g = std::find(agg.labels.begin(), agg.labels.end(), l);
+                if (g == agg.labels.end()) {
+                    g = agg.labels.insert(g, std::move(l));
+                }
+                agg.group_of[family_labels.size() - 1] = g - agg.labels.begin();
+            }
+            labels.push_back(std::move(family_labels));
+            names.push_back(std::move(name));
+        }
+    }
+    bool valid_for(const shared_ptr<mi::metric_metadata>& md, const config& ctx) const {
+        return metadata.get() == md.get() && prefix == ctx.prefix && hostname == ctx.hostname;
+    }
+};
+
+/*!
+ * \brief a shard's metrics in the text representation
+ *
+ * The series of each of the shard's families, in name order, are
+ * rendered by the shard itself; the shard serving the scrape only merges
+ * the families of all shards, and sums their aggregated series.
+ */
+struct text_slice {
+    // an aggregated series, summed over the shard's metrics
+    struct sum {
+        mi::metric_value value;
+        bool set = false;
+        bool skip_when_empty = true;
+    };
+    lw_shared_ptr<const text_prefixes> prefixes;
+    // by family
+    std::vector<std::string> series;
+    // by family, by group of the family's aggregation
+    std::vector<std::vector<sum>> sums;
+
+    size_t families() const {
+        return prefixes->metadata->size();
+    }
+    const sstring& name(size_t family) const {
+        return prefixes->metadata->at(family).mf.name;
+    }
+};
+
+using text_slices = std::vector<foreign_ptr<std::unique_ptr<text_slice>>>;
+
+// The last prefixes rendered on the shard; a server exporting with more
+// than one configuration renders them again when it changes
+static thread_local lw_shared_ptr<const text_prefixes> local_text_prefixes;
+
+static bool is_empty(const mi::metric_value& value) {
+    if (value.type() == mi::data_type::HISTOGRAM) {
+        return value.get_histogram().sample_count == 0;
+    }
+    return value.d() == 0;
+}
+
+static void add_value_line(std::string& s, const sstring& name, const sstring& labels, const std::string& extra_label, const std::string& value) {
+    s.append(name.begin(), name.end());
+    s.append(labels.begin(), labels.end());
+    s += extra_label;
+    s += "} ";
+    s += value;
+    s += "\n";
+}
+
+static void add_value(std::string& s, const sstring& name, const sstring& labels, const mi::metric_value& value, const sstring& hostname) {
+    if (value.type() == mi::data_type::HISTOGRAM) {
+        auto&& h = value.get_histogram();
+        uint64_t count = 0;
+        auto bucket = name + "_bucket";
+        for (auto i : h.buckets) {
+            count += i.count;
+            add_value_line(s, bucket, labels, ",le=\"" + std::to_string(i.upper_bound) + "\"", std::to_string(count));
+        }
+        add_value_line(s, bucket, labels, ",le=\"+Inf\"", std::to_string(h.sample_count));
+        // the sum and count only carry the instance label
+        auto instance = "{instance=\"" + hostname + "\"";
+        add_value_line(s, name + "_sum", instance, "", std::to_string(h.sample_sum));
+        add_value_line(s, name + "_count", instance, "", std::to_string(h.sample_count));
+    } else {
+        add_value_line(s, name, labels, "", to_str(value));
+    }
+}
+
+static std::unique_ptr<text_slice> render_text_slice(const config& ctx, const name_filter& filter) {
+    auto impl = mi::get_local_impl();
+    auto metadata = impl->metadata();
+    auto& functions = impl->functions();
+    if (!local_text_prefixes || !local_text_prefixes->valid_for(metadata, ctx)) {
+        local_text_prefixes = make_lw_shared<const text_prefixes>(metadata, ctx);
+    }
+    auto& p = *local_text_prefixes;
+    auto slice = std::make_unique<text_slice>();
+    slice->prefixes = local_text_prefixes;
+    slice->series.resize(functions.size());
+    slice->sums.resize(functions.size());
+    for (size_t f = 0; f < functions.size(); ++f) {
+        auto& name = p.names[f];
+        if (!filter(name)) {
+            continue;
+        }
+        auto& metrics = metadata->at(f).metrics;
+        auto& agg = p.aggregations[f];
+        auto& sums = slice->sums[f];
+        sums.resize(agg.labels.size());
+        auto& s = slice->series[f];
+        for (size_t m = 0; m < functions[f].size(); ++m) {
+            auto value = functions[f][m]();
+            auto& info = metrics[m];
+            if (!agg.group_of.empty() && agg.group_of[m] >= 0) {
+                auto& sum = sums[agg.group_of[m]];
+                sum.value = sum.set ? sum.value + value : value;
+                sum.set = true;
+                sum.skip_when_empty &= info.skip_when_empty;
+                continue;
+            }
+            if (info.skip_when_empty && is_empty(value)) {
+                continue;
+            }
+            add_value(s, name, p.labels[f][m], value, p.hostname);
+        }
+    }
+    return slice;
+}
+
+static future<> get_text_slices(text_slices& slices, const config& ctx, const name_filter& filter) {
+    slices.resize(smp::count);
+    return parallel_for_each(boost::irange(0u, smp::count), [&slices, &ctx, &filter] (auto cpu) {
+        return smp::submit_to(cpu, [ctx, filter] {
+            return make_foreign(render_text_slice(ctx, filter));
+        }).then([&slices, cpu] (auto res) {
+            slices[cpu] = std::move(res);
+        });
+    });
+}
+
+// Sums the aggregated series of a family over the shards that have it,
+// and renders them
+static std::string render_aggregated(const text_slices& slices, const std::vector<std::pair<unsigned, size_t>>& shards) {
+    std::map<sstring, text_slice::sum> sums;
+    const text_prefixes* p = nullptr;
+    for (auto&& sp : shards) {
+        auto& slice = *slices[sp.first];
+        p = slice.prefixes.get();
+        auto& groups = p->aggregations[sp.second].labels;
+        auto& shard_sums = slice.sums[sp.second];
+        for (size_t g = 0; g < shard_sums.size(); ++g) {
+            if (!shard_sums[g].set) {
+                continue;
+            }
+            auto& sum = sums[groups[g]];
+            sum.value = sum.set ? sum.value + shard_sums[g].value : shard_sums[g].value;
+            sum.set = true;
+            sum.skip_when_empty &= shard_sums[g].skip_when_empty;
+        }
+    }
+    std::string s;
+    for (auto&& i : sums) {
+        if (i.second.skip_when_empty && is_empty(i.second.value)) {
+            continue;
+        }
+        add_value(s, p->names[shards.back().second], i.first, i.second.value, p->hostname);
+    }
+    return s;
+}
+
+/*!
+ * \brief writes the families of all shards, merged by name
+ *
+ * Each family goes out as its header followed by the series rendered by
+ * each of the shards that have it, written directly from the shards'
+ * slices, and its aggregated series; families with no series left after
+ * filtering are left out.
+ */
+future<> write_text_representation(output_stream<char>& out, const text_slices& slices) {
+    return do_with(std::vector<size_t>(slices.size(), 0), [&out, &slices] (std::vector<size_t>& positions) {
+        return repeat([&out, &slices, &positions] {
+            const sstring* name = nullptr;
+            for (unsigned shard = 0; shard < slices.size(); ++shard) {
+                auto& slice = *slices[shard];
+                if (positions[shard] < slice.families() && (!name || slice.name(positions[shard]) < *name)) {
+                    name = &slice.name(positions[shard]);
+                }
+            }
+            if (!name) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            // the shards that have the family, and its position in them
+            std::vector<std::pair<unsigned, size_t>> shards;
+            bool aggregated = false;
+            bool empty = true;
+            for (unsigned shard = 0; shard < slices.size(); ++shard) {
+                auto& slice = *slices[shard];
+                auto& pos = positions[shard];
+                if (pos < slice.families() && slice.name(pos) == *name) {
+                    aggregated |= !slice.sums[pos].empty();
+                    empty &= slice.series[pos].empty();
+                    shards.emplace_back(shard, pos++);
+                }
+            }
+            auto sums = aggregated ? render_aggregated(slices, shards) : std::string();
+            if (empty && sums.empty()) {
+                return make_ready_future<stop_iteration>(stop_iteration::no);
+            }
+            auto& header = slices[shards.front().first]->prefixes->headers[shards.front().second];
+            return do_with(std::move(shards), std::move(sums), [&out, &slices, &header] (auto& shards, auto& sums) {
+                return out.write(header).then([&out, &slices, &shards] {
+                    return do_for_each(shards, [&out, &slices] (auto& sp) {
+                        auto& series = slices[sp.first]->series[sp.second];
+                        return series.empty() ? make_ready_future<>() : out.write(series);
+                    });
+                }).then([&out, &sums] {
+                    return sums.empty() ? make_ready_future<>() : out.write(sums);
+                });
+            }).then([] {
+                return stop_iteration::no;
             });
-            return out.write(s.str());
         });
     });
 }
@@ -499,12 +766,24 @@ class metrics_handler : public handler_base  {
     future<std::unique_ptr<httpd::reply>> handle(const sstring& path,
         std::unique_ptr<httpd::request> req, std::unique_ptr<httpd::reply> rep) override {
         auto text = is_accept_text(req->get_header("Accept"));
-        rep->write_body((text) ? "txt" : "proto", [this, text] (output_stream<char>&& s) {
+        if (text) {
+            rep->write_body("txt", [this, filter = name_filter(*req)] (output_stream<char>&& s) {
+                return do_with(text_slices(), output_stream<char>(std::move(s)),
+                        [this, &filter] (text_slices& slices, output_stream<char>& s) mutable {
+                    return get_text_slices(slices, _ctx, filter).then([&s, &slices] {
+                        return write_text_representation(s, slices);
+                    }).finally([&s] () mutable {
+                        return s.close();
+                    });
+                });
+            });
+            return make_ready_future<std::unique_ptr<httpd::reply>>(std::move(rep));
+        }
+        rep->write_body("proto", [this] (output_stream<char>&& s) {
             return do_with(metrics_families_per_shard(), output_stream<char>(std::move(s)),
-                    [this, text] (metrics_families_per_shard& families, output_stream<char>& s) mutable {
-                return get_map_value(families).then([&s, &families, this, text]() mutable {
-                    return (text) ? write_text_representation(s, families, _ctx) :
-                            write_protobuf_representation(s, families, _ctx);
+                    [this] (metrics_families_per_shard& families, output_stream<char>& s) mutable {
+                return get_map_value(families).then([&s, &families, this]() mutable {
+                    return write_protobuf_representation(s, families, _ctx);
                 }).finally([&s] () mutable {
                     return s.close();
                 });
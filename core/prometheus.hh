@@ -40,6 +40,14 @@ future<> start(httpd::http_server_control& http_server, config ctx);
 
 /// \defgroup add_prometheus_routes adds a /metrics endpoint that returns prometheus metrics
 ///    both in txt format and in protobuf according to the prometheus spec
+///
+/// The txt format can be filtered by the exported metric name: with
+/// `__name__=name` only that metric is returned, with `__name__=prefix*` the
+/// metrics that start with the prefix, and with `name_regex=re` the metrics
+/// whose whole name matches the (ECMAScript) regular expression. Metrics
+/// registered with metric_definition_impl::aggregate() are reported summed
+/// over the given labels, and those registered with set_skip_when_empty()
+/// are left out while they are zero.
 /// @{
 future<> add_prometheus_routes(distributed<http_server>& server, config ctx);
 future<> add_prometheus_routes(http_server& server, config ctx);
@@ -22,12 +22,17 @@
 #define __user /* empty */  // for xfs includes, below
 
 #include <cinttypes>
+#include <fstream>
 #include <sys/syscall.h>
 #include <sys/vfs.h>
 #include <sys/statfs.h>
+#include <sys/sysmacros.h>
+#include <sys/sendfile.h>
+#include <netinet/tcp.h>
 #include "task.hh"
 #include "reactor.hh"
 #include "memory.hh"
+#include "memory_account.hh"
 #include "core/posix.hh"
 #include "net/packet.hh"
 #include "net/stack.hh"
@@ -190,8 +195,54 @@ wrap_syscall(int result, const Extra& extra) {
     return {result, extra, errno};
 }
 
-reactor_backend_epoll::reactor_backend_epoll()
-    : _epollfd(file_desc::epoll_create(EPOLL_CLOEXEC)) {
+reactor_backend_epoll::reactor_backend_epoll(size_t max_aio)
+    : _epollfd(file_desc::epoll_create(EPOLL_CLOEXEC))
+    , _io_context(0) {
+    auto r = ::io_setup(max_aio, &_io_context);
+    assert(r >= 0);
+}
+
+reactor_backend_epoll::~reactor_backend_epoll() {
+    ::io_destroy(_io_context);
+}
+
+int reactor_backend_epoll::submit_aio(::iocb** iocbs, size_t nr) {
+    return ::io_submit(_io_context, nr, iocbs);
+}
+
+size_t reactor_backend_epoll::reap_aio() {
+    std::array<io_event, 128> ev;
+    struct timespec timeout = {0, 0};
+    auto n = ::io_getevents(_io_context, 1, ev.size(), ev.data(), &timeout);
+    assert(n >= 0);
+    for (size_t i = 0; i < size_t(n); ++i) {
+        auto pr = reinterpret_cast<promise<io_event>*>(ev[i].data);
+        pr->set_value(ev[i]);
+        delete pr;
+    }
+    return n;
+}
+
+static std::unique_ptr<reactor_backend>
+make_reactor_backend(const reactor_backend_config& cfg, size_t max_aio) {
+#ifdef HAVE_OSV
+    return std::make_unique<reactor_backend_osv>();
+#else
+#ifdef HAVE_LIBURING
+    if (cfg.name == "io_uring") {
+        return std::make_unique<reactor_backend_uring>(reactor_backend_uring::ring_entries, cfg.io_uring_sqpoll);
+    }
+#endif
+    return std::make_unique<reactor_backend_epoll>(max_aio);
+#endif
+}
+
+std::vector<sstring> reactor_backend_config::available() {
+    std::vector<sstring> ret = { "epoll" };
+#ifdef HAVE_LIBURING
+    ret.push_back("io_uring");
+#endif
+    return ret;
 }
 
 reactor::signals::signals() : _pending_signals(0) {
@@ -378,9 +429,51 @@ reactor::task_queue::task_queue(unsigned id, sstring name, float shares)
         sm::make_gauge("shares", [this] { return _shares; },
                 sm::description("Shares allocated to this queue"),
                 {group_label}),
+        sm::make_gauge("max_utilization", [this] { return _max_utilization; },
+                sm::description("Maximum fraction of the CPU this queue may use; 1 when not capped"),
+                {group_label}),
+        sm::make_counter("throttled_time_ms", [this] {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(_throttled_time).count();
+        }, sm::description("Accumulated time this queue spent throttled by its maximum utilization"),
+            {group_label}),
+        sm::make_histogram("wakeup_latency_us", sm::description("Time this queue waited to start running after becoming runnable or being preempted (sampled)"),
+                {group_label}, [this] { return _wait_time.to_metrics(); }),
+        sm::make_counter("task_quota_violations", _task_quota_violations,
+                sm::description("Number of times this queue ran for longer than the task quota before yielding"),
+                {group_label}),
+        sm::make_derive("allocations", [this] { return memory::get_allocation_group_stats(_id).allocations; },
+                sm::description("Number of allocations made by this group; requires --memory-group-accounting"),
+                {group_label}),
+        sm::make_derive("allocated_bytes", [this] { return memory::get_allocation_group_stats(_id).allocated_bytes; },
+                sm::description("Bytes allocated by this group, including memory since freed; requires --memory-group-accounting"),
+                {group_label}),
+        sm::make_current_bytes("live_large_memory", [this] { return memory::get_allocation_group_stats(_id).live_large_memory; },
+                sm::description("Memory in live allocations larger than a page made by this group; requires --memory-group-accounting"),
+                {group_label}),
     });
 }
 
+void
+reactor::log2_histogram::add(sched_clock::duration d) noexcept {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    unsigned b = us > 1 ? std::numeric_limits<unsigned long long>::digits - 1 - __builtin_clzll(us) : 0;
+    ++_buckets[std::min(b, nr_buckets - 1)];
+    _sum_us += std::max<int64_t>(us, 0);
+}
+
+metrics::histogram
+reactor::log2_histogram::to_metrics() const {
+    metrics::histogram h;
+    h.sample_sum = _sum_us;
+    h.buckets.resize(nr_buckets);
+    for (unsigned i = 0; i < nr_buckets; ++i) {
+        h.sample_count += _buckets[i];
+        h.buckets[i].count = _buckets[i];
+        h.buckets[i].upper_bound = double((uint64_t(2) << i) - 1);
+    }
+    return h;
+}
+
 inline
 int64_t
 reactor::task_queue::to_vruntime(sched_clock::duration runtime) const {
@@ -395,12 +488,92 @@ reactor::task_queue::set_shares(float shares) {
     _reciprocal_shares_times_2_power_32 = (uint64_t(1) << 32) / _shares;
 }
 
+// Period over which scheduling group CPU bandwidth caps are enforced; long
+// enough to hold several task quotas, short enough not to be noticeable
+// as a stall of the capped group.
+static constexpr auto bandwidth_period = std::chrono::milliseconds(10);
+
+void
+reactor::task_queue::set_max_utilization(float fraction) {
+    _max_utilization = std::min(std::max(fraction, 0.001f), 1.0f);
+    _bandwidth_budget = bandwidth_quota();
+    _bandwidth_period_start = sched_clock::now();
+}
+
+reactor::sched_clock::duration
+reactor::task_queue::bandwidth_quota() const {
+    return std::chrono::duration_cast<sched_clock::duration>(bandwidth_period * _max_utilization);
+}
+
+void
+reactor::task_queue::refill_bandwidth(sched_clock::time_point now) {
+    auto periods = (now - _bandwidth_period_start) / bandwidth_period;
+    if (periods > 0) {
+        // Overruns (the last task of a quota may run past the budget) are
+        // paid back from the following periods.
+        _bandwidth_budget = std::min(_bandwidth_budget + periods * bandwidth_quota(), bandwidth_quota());
+        _bandwidth_period_start += periods * bandwidth_period;
+    }
+}
+
 void
 reactor::account_runtime(task_queue& tq, sched_clock::duration runtime) {
     tq._vruntime += tq.to_vruntime(runtime);
     tq._runtime += runtime;
 }
 
+bool
+reactor::maybe_throttle(task_queue& tq, sched_clock::duration runtime, sched_clock::time_point now) {
+    if (tq._max_utilization >= 1 || _stopped) {
+        return false;
+    }
+    tq.refill_bandwidth(now);
+    tq._bandwidth_budget -= runtime;
+    if (tq._bandwidth_budget > sched_clock::duration(0)) {
+        return false;
+    }
+    sched_print("throttling tq {} {}, budget {} usec", (void*)&tq, tq._name, tq._bandwidth_budget / 1us);
+    tq._throttled = true;
+    // Keep add_task() from activating the queue until it is unthrottled
+    tq._active = true;
+    tq._throttled_since = now;
+    _throttled_task_queues.push_back(&tq);
+    auto next_period = sched_clock::to_steady(tq._bandwidth_period_start + bandwidth_period);
+    if (!_bandwidth_timer.armed() || next_period < _bandwidth_timer.get_timeout()) {
+        _bandwidth_timer.rearm(next_period);
+    }
+    return true;
+}
+
+void
+reactor::unthrottle_task_queues(bool all) {
+    auto now = sched_clock::now();
+    std::experimental::optional<sched_clock::time_point> next;
+    auto& tqs = _throttled_task_queues;
+    for (auto i = tqs.begin(); i != tqs.end(); ) {
+        auto tq = *i;
+        tq->refill_bandwidth(now);
+        if (all || tq->_max_utilization >= 1 || tq->_bandwidth_budget > sched_clock::duration(0)) {
+            tq->_throttled = false;
+            tq->_throttled_time += now - tq->_throttled_since;
+            tq->_active = false;
+            if (!tq->_q.empty()) {
+                activate(*tq);
+            }
+            i = tqs.erase(i);
+        } else {
+            auto next_period = tq->_bandwidth_period_start + bandwidth_period;
+            next = next ? std::min(*next, next_period) : next_period;
+            ++i;
+        }
+    }
+    if (next) {
+        _bandwidth_timer.rearm(sched_clock::to_steady(*next));
+    } else {
+        _bandwidth_timer.cancel();
+    }
+}
+
 void
 reactor::account_idle(sched_clock::duration runtime) {
     // anything to do here?
@@ -412,8 +585,20 @@ struct reactor::task_queue::indirect_compare {
     }
 };
 
-reactor::reactor(unsigned id)
-    : _backend()
+// Orders the heap of active task queues: true if tq1 should run after tq2.
+// Boosted (freshly activated latency-critical) queues come first, then the
+// lowest vruntime.
+struct reactor::task_queue::heap_compare {
+    bool operator()(const task_queue* tq1, const task_queue* tq2) const {
+        if (tq1->_boosted != tq2->_boosted) {
+            return tq2->_boosted;
+        }
+        return tq1->_vruntime > tq2->_vruntime;
+    }
+};
+
+reactor::reactor(unsigned id, reactor_backend_config backend_cfg, thread_pool_config thread_pool_cfg)
+    : _backend(make_reactor_backend(backend_cfg, max_aio))
     , _id(id)
 #ifdef HAVE_OSV
     , _timer_thread(
@@ -422,24 +607,22 @@ reactor::reactor(unsigned id)
 #endif
     , _task_quota_timer(file_desc::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC))
     , _cpu_started(0)
-    , _io_context(0)
     , _io_context_available(max_aio)
     , _reuseport(posix_reuseport_detect())
     , _task_quota_timer_thread(&reactor::task_quota_timer_thread_fn, this)
-    , _thread_pool(seastar::format("syscall-{}", id)) {
+    , _thread_pool(seastar::format("syscall-{}", id), thread_pool_cfg) {
     _task_queues.push_back(std::make_unique<task_queue>(0, "main", 1000));
     _task_queues.push_back(std::make_unique<task_queue>(1, "atexit", 1000));
     _at_destroy_tasks = _task_queues.back().get();
+    _bandwidth_timer.set_callback([this] { unthrottle_task_queues(); });
     seastar::thread_impl::init();
-    auto r = ::io_setup(max_aio, &_io_context);
-    assert(r >= 0);
 #ifdef HAVE_OSV
     _timer_thread.start();
 #else
     sigset_t mask;
     sigemptyset(&mask);
     sigaddset(&mask, alarm_signal());
-    r = ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    auto r = ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
     assert(r == 0);
     struct sigevent sev;
     sev.sigev_notify = SIGEV_THREAD_ID;
@@ -457,6 +640,9 @@ reactor::reactor(unsigned id)
             fn();
         }));
     });
+    memory::set_memory_pressure_hook([] {
+        internal::notify_memory_pressure_changed();
+    });
 }
 
 reactor::~reactor() {
@@ -478,7 +664,6 @@ reactor::~reactor() {
     eraser(_expired_timers);
     eraser(_expired_lowres_timers);
     eraser(_expired_manual_timers);
-    ::io_destroy(_io_context);
 }
 
 // Add to an atomic integral non-atomically and returns the previous value
@@ -602,6 +787,18 @@ reactor::block_notifier(int) {
     buf.append_decimal(uint64_t(delta.count()));
     buf.append(" ms");
     print_with_backtrace(buf);
+    if (auto& t = engine()._event_trace) {
+        t->record(event_trace_type::stall, 0, delta.count());
+        t->dump_on_stall();
+    }
+}
+
+void
+reactor::cpu_profiler_signal_handler(int) {
+    auto& p = engine()._cpu_profiler;
+    if (p) {
+        p->on_signal();
+    }
 }
 
 template <typename T, typename E, typename EnableFunc>
@@ -619,6 +816,7 @@ void reactor::complete_timers(T& timers, E& expired_timers, EnableFunc&& enable_
             if (t->_period) {
                 t->readd_periodic();
             }
+            trace_event(event_trace_type::timer_fire, 0);
             try {
                 t->_callback();
             } catch (...) {
@@ -702,12 +900,27 @@ void reactor::configure(boost::program_options::variables_map vm) {
     });
 
     _handle_sigint = !vm.count("no-handle-interrupt");
+    _task_accounting = vm.count("task-accounting");
+    memory::set_allocation_group_tracking(vm.count("memory-group-accounting"));
+    _work_stealing = vm["work-stealing"].as<bool>();
+    auto sleep_protocol = vm["sleep-protocol"].as<std::string>();
+    if (sleep_protocol != "membarrier" && sleep_protocol != "fence") {
+        throw std::invalid_argument(format("unknown sleep protocol {} (valid values: membarrier, fence)", sleep_protocol));
+    }
+    _fenced_sleep = sleep_protocol == "fence";
+    _pending_wakeups.reserve(smp::count);
     auto task_quota = vm["task-quota-ms"].as<double>() * 1ms;
     _task_quota = std::chrono::duration_cast<sched_clock::duration>(task_quota);
 
     auto blocked_time = vm["blocked-reactor-notify-ms"].as<unsigned>() * 1ms;
     _tasks_processed_report_threshold = unsigned(blocked_time / task_quota);
     _stall_detector_reports_per_minute = vm["blocked-reactor-reports-per-minute"].as<unsigned>();
+    _cpu_profiler_frequency = vm["cpu-profiler-frequency"].as<unsigned>();
+    _event_trace_size = vm["event-trace-size"].as<unsigned>();
+    if (vm.count("event-trace-stall-dump")) {
+        _event_trace_stall_dump = sprint("%s-%d", vm["event-trace-stall-dump"].as<std::string>(), _id);
+    }
+    thread_impl::configure_stack_pool(vm["thread-stack-guard-pages"].as<bool>(), vm["thread-stack-cache"].as<unsigned>());
 
     _max_task_backlog = vm["max-task-backlog"].as<unsigned>();
     _max_poll_time = vm["idle-poll-time-us"].as<unsigned>() * 1us;
@@ -719,12 +932,28 @@ void reactor::configure(boost::program_options::variables_map vm) {
            && !vm.count("poll-mode")) {
         _max_poll_time = 0us;
     }
+    if (vm.count("adaptive-poll") && !vm.count("poll-mode")) {
+        _adaptive_poll_time = std::make_unique<adaptive_poll_time>(vm["idle-poll-time-us"].as<unsigned>() * 1us);
+    }
     set_strict_dma(!vm.count("relaxed-dma"));
-    if (!vm["poll-aio"].as<bool>()
-            || (vm["poll-aio"].defaulted() && vm.count("overprovisioned"))) {
+    // Backends whose storage completions wake up the sleeping reactor don't
+    // need the eventfd to avoid busy-polling for disk I/O.
+    if (!_backend->storage_completions_wake_sleep()
+            && (!vm["poll-aio"].as<bool>()
+                || (vm["poll-aio"].defaulted() && vm.count("overprovisioned")))) {
         _aio_eventfd = pollable_fd(file_desc::eventfd(0, 0));
     }
     set_bypass_fsync(vm["unsafe-bypass-fsync"].as<bool>());
+    _aio_fdsync = vm["aio-fdsync"].as<bool>();
+    if (vm.count("discard-bandwidth")) {
+        _discard_bandwidth = parse_memory_size(vm["discard-bandwidth"].as<std::string>());
+    }
+    _discard_defer = std::chrono::milliseconds(vm["discard-defer"].as<unsigned>());
+    if (vm.count("dma-buffer-pool-memory")) {
+        set_dma_buffer_pool_capacity(parse_memory_size(vm["dma-buffer-pool-memory"].as<std::string>()));
+    } else {
+        set_dma_buffer_pool_capacity(std::min<size_t>(memory::stats().total_memory() / 64, 32 << 20));
+    }
 }
 
 future<> reactor_backend_epoll::get_epoll_future(pollable_fd_state& pfd,
@@ -805,9 +1034,13 @@ reactor::posix_listen(socket_address sa, listen_options opts) {
     }
     if (_reuseport)
         fd.setsockopt(SOL_SOCKET, SO_REUSEPORT, 1);
+    if (opts.proto == transport::TCP && !opts.congestion_control.empty()) {
+        // inherited by the accepted sockets
+        fd.setsockopt(IPPROTO_TCP, TCP_CONGESTION, opts.congestion_control.c_str());
+    }
 
     fd.bind(sa.u.sa, sizeof(sa.u.sas));
-    fd.listen(100);
+    fd.listen(opts.listen_backlog);
     return pollable_fd(std::move(fd));
 }
 
@@ -843,6 +1076,30 @@ reactor::posix_connect(lw_shared_ptr<pollable_fd> pfd, socket_address sa, socket
     });
 }
 
+future<size_t>
+reactor::sendfile(pollable_fd_state& fd, file& f, uint64_t offset, size_t len) {
+    auto pf = dynamic_cast<posix_file_impl*>(f._file_impl.get());
+    if (!pf) {
+        return make_exception_future<size_t>(std::system_error(EINVAL, std::system_category()));
+    }
+    return writeable(fd).then([this, &fd, &f, in_fd = pf->_fd, offset, len] {
+        // sendfile() reads the file, which may block, so it runs on a syscall thread
+        return _thread_pool.submit<syscall_result<ssize_t>>([out_fd = fd.fd.get(), in_fd, offset, len] {
+            off_t off = offset;
+            return wrap_syscall<ssize_t>(::sendfile(out_fd, in_fd, &off, len));
+        }).then([this, &fd, &f, offset, len] (syscall_result<ssize_t> sr) {
+            if (sr.result == -1 && sr.error == EAGAIN) {
+                return sendfile(fd, f, offset, len);
+            }
+            sr.throw_if_error();
+            if (size_t(sr.result) == len) {
+                fd.speculate_epoll(EPOLLOUT);
+            }
+            return make_ready_future<size_t>(sr.result);
+        });
+    });
+}
+
 server_socket
 reactor::listen(socket_address sa, listen_options opt) {
     return server_socket(_network_stack->listen(sa, opt));
@@ -899,14 +1156,15 @@ reactor::flush_pending_aio() {
         for (size_t i = 0; i < nr; ++i) {
             iocbs[i] = &_pending_aio[i];
         }
-        auto r = ::io_submit(_io_context, nr, iocbs);
+        auto r = _backend->submit_aio(iocbs, nr);
         size_t nr_consumed;
         if (r < 0) {
             auto ec = -r;
             switch (ec) {
                 case EAGAIN:
                     return did_work;
-                case EBADF: {
+                case EBADF:
+                case EINVAL: {
                     auto pr = reinterpret_cast<promise<io_event>*>(iocbs[0]->data);
                     try {
                         throw_kernel_error(r);
@@ -917,6 +1175,8 @@ reactor::flush_pending_aio() {
                     _io_context_available.signal(1);
                     // if EBADF, it means that the first request has a bad fd, so
                     // we will only remove it from _pending_aio and try again.
+                    // EINVAL means that the kernel does not support it, as
+                    // with fdsync on kernels or filesystems without it.
                     nr_consumed = 1;
                     break;
                 }
@@ -945,43 +1205,83 @@ const io_priority_class& default_priority_class() {
     return shard_default_class;
 }
 
+const io_priority_class& reactor::discard_priority_class() {
+    // one class for all shards, so that they share its limit
+    static auto discard_class = [] {
+        io_priority_class_limits limits;
+        limits.bytes_per_second = engine()._discard_bandwidth;
+        return engine().register_one_priority_class("discard", 1, limits);
+    }();
+    return discard_class;
+}
+
 template <typename Func>
 future<io_event>
-reactor::submit_io_read(const io_priority_class& pc, size_t len, Func prepare_io) {
+reactor::submit_io_read(io_queue& ioq, const io_priority_class& pc, size_t len, Func prepare_io) {
     ++_io_stats.aio_reads;
     _io_stats.aio_read_bytes += len;
-    return io_queue::queue_request(_io_coordinator, pc, len, std::move(prepare_io));
+    return ioq.queue_request(pc, io_queue::request_type::read, len, std::move(prepare_io));
 }
 
 template <typename Func>
 future<io_event>
-reactor::submit_io_write(const io_priority_class& pc, size_t len, Func prepare_io) {
+reactor::submit_io_write(io_queue& ioq, const io_priority_class& pc, size_t len, Func prepare_io, bool dsync) {
     ++_io_stats.aio_writes;
     _io_stats.aio_write_bytes += len;
-    return io_queue::queue_request(_io_coordinator, pc, len, std::move(prepare_io));
+    _io_stats.aio_dsync_writes += dsync;
+    auto type = dsync ? io_queue::request_type::dsync_write : io_queue::request_type::write;
+    return ioq.queue_request(pc, type, len, std::move(prepare_io));
 }
 
 bool reactor::process_io()
 {
-    io_event ev[max_aio];
-    struct timespec timeout = {0, 0};
-    auto n = ::io_getevents(_io_context, 1, max_aio, ev, &timeout);
-    assert(n >= 0);
-    for (size_t i = 0; i < size_t(n); ++i) {
-        auto pr = reinterpret_cast<promise<io_event>*>(ev[i].data);
-        pr->set_value(ev[i]);
-        delete pr;
-    }
+    auto n = _backend->reap_aio();
     _io_context_available.signal(n);
     return n;
 }
 
-io_queue::io_queue(shard_id coordinator, size_t capacity, std::vector<shard_id> topology)
-        : _coordinator(coordinator)
-        , _capacity(capacity)
+fair_queue::config io_queue::make_fair_queue_config(const config& cfg) {
+    fair_queue::config fq_cfg;
+    fq_cfg.capacity = cfg.capacity;
+    fq_cfg.max_req_count = cfg.max_req_count;
+    fq_cfg.max_bytes_count = cfg.max_bytes_count;
+    fq_cfg.shared_capacity = cfg.shared_capacity;
+    return fq_cfg;
+}
+
+io_queue::io_queue(config cfg, std::vector<shard_id> topology)
+        : _config(std::move(cfg))
+        , _coordinator(_config.coordinator)
+        , _capacity(_config.capacity)
         , _io_topology(std::move(topology))
         , _priority_classes()
-        , _fq(capacity) {
+        , _fq(make_fair_queue_config(_config)) {
+    _throttle_timer.set_callback([this] { release_throttled(); });
+}
+
+fair_queue_request_descriptor io_queue::request_descriptor(request_type type, size_t len) const {
+    fair_queue_request_descriptor desc;
+    if (!_config.disk_cost_model) {
+        // only for fairness between classes; capacity is counted in requests
+        desc.weight = 1 + len/(16 << 10);
+        return desc;
+    }
+    if (type == request_type::discard) {
+        desc.weight = _config.disk_req_write_to_read_multiplier;
+        desc.size = 0;
+    } else if (type == request_type::write || type == request_type::dsync_write) {
+        desc.weight = _config.disk_req_write_to_read_multiplier;
+        if (type == request_type::dsync_write) {
+            // the write, and making it durable
+            desc.weight = _config.disk_req_dsync_write_to_read_multiplier
+                    ? _config.disk_req_dsync_write_to_read_multiplier : 2 * desc.weight;
+        }
+        desc.size = std::min<double>(len * _config.disk_bytes_write_to_read_multiplier, _config.max_bytes_count);
+    } else {
+        desc.weight = read_request_base_count;
+        desc.size = std::min<size_t>(len, _config.max_bytes_count);
+    }
+    return desc;
 }
 
 io_queue::~io_queue() {
@@ -1001,6 +1301,7 @@ std::array<std::atomic<uint32_t>, io_queue::_max_classes> io_queue::_registered_
 // structure is passed along all the time - and sometimes we can't help but copy it, better keep
 // it lean. The name won't really be used for anything other than monitoring.
 std::array<sstring, io_queue::_max_classes> io_queue::_registered_names;
+std::array<io_priority_class_limits, io_queue::_max_classes> io_queue::_registered_limits;
 
 void io_queue::fill_shares_array() {
     for (unsigned i = 0; i < _max_classes; ++i) {
@@ -1008,13 +1309,14 @@ void io_queue::fill_shares_array() {
     }
 }
 
-io_priority_class io_queue::register_one_priority_class(sstring name, uint32_t shares) {
+io_priority_class io_queue::register_one_priority_class(sstring name, uint32_t shares, io_priority_class_limits limits) {
     for (unsigned i = 0; i < _max_classes; ++i) {
         uint32_t unused = 0;
         auto s = _registered_shares[i].compare_exchange_strong(unused, shares, std::memory_order_acq_rel);
         if (s) {
             io_priority_class p;
             _registered_names[i] = name;
+            _registered_limits[i] = limits;
             p.val = i;
             return p;
         };
@@ -1023,19 +1325,33 @@ io_priority_class io_queue::register_one_priority_class(sstring name, uint32_t s
 }
 
 seastar::metrics::label io_queue_shard("ioshard");
+seastar::metrics::label mountpoint_label("mountpoint");
 
-io_queue::priority_class_data::priority_class_data(sstring name, priority_class_ptr ptr, shard_id owner)
+// Rate limited classes may burst to this much of a second's worth of
+// their limit
+static constexpr double io_throttle_burst = 0.01;
+static constexpr auto io_throttle_period = std::chrono::milliseconds(1);
+
+io_queue::priority_class_data::priority_class_data(sstring name, sstring mountpoint, priority_class_ptr ptr, uint32_t shares,
+        io_priority_class_limits limits, shard_id owner)
     : ptr(ptr)
     , bytes(0)
     , ops(0)
     , nr_queued(0)
     , queue_time(1s)
+    , shares(shares)
+    , limits(limits)
+    , last_refill(clock_type::now())
 {
+    // start with a full burst
+    byte_tokens = limits.bytes_per_second * io_throttle_burst;
+    op_tokens = std::max(limits.ops_per_second * io_throttle_burst, 1.0);
     namespace sm = seastar::metrics;
     auto shard = sm::impl::shard();
+    std::vector<sm::label_instance> labels = { io_queue_shard(shard), sm::shard_label(owner), mountpoint_label(mountpoint) };
     _metric_groups.add_group("io_queue", {
-            sm::make_derive(name + sstring("_total_bytes"), bytes, sm::description("Total bytes passed in the queue"), {io_queue_shard(shard), sm::shard_label(owner)}),
-            sm::make_derive(name + sstring("_total_operations"), ops, sm::description("Total bytes passed in the queue"), {io_queue_shard(shard), sm::shard_label(owner)}),
+            sm::make_derive(name + sstring("_total_bytes"), bytes, sm::description("Total bytes passed in the queue"), labels),
+            sm::make_derive(name + sstring("_total_operations"), ops, sm::description("Total bytes passed in the queue"), labels),
             // Note: The counter below is not the same as reactor's queued-io-requests
             // queued-io-requests shows us how many requests in total exist in this I/O Queue.
             //
@@ -1045,11 +1361,151 @@ io_queue::priority_class_data::priority_class_data(sstring name, priority_class_
             // In other words: the new counter tells you how busy a class is, and the
             // old counter tells you how busy the system is.
 
-            sm::make_queue_length(name + sstring("_queue_length"), nr_queued, sm::description("Number of requests in the queue"), {io_queue_shard(shard), sm::shard_label(owner)}),
+            sm::make_queue_length(name + sstring("_queue_length"), nr_queued, sm::description("Number of requests in the queue"), labels),
             sm::make_gauge(name + sstring("_delay"), [this] {
                 return queue_time.count();
-            }, sm::description("total delay time in the queue"), {io_queue_shard(shard), sm::shard_label(owner)})
+            }, sm::description("total delay time in the queue"), labels),
+            sm::make_queue_length(name + sstring("_throttled_queue_length"), [this] { return throttled.size(); },
+                    sm::description("Number of requests held back by the class's rate limits, or by another class's latency goal"),
+                    labels),
+            sm::make_derive(name + sstring("_throttled_time_ms"), [this] {
+                return std::chrono::duration_cast<std::chrono::milliseconds>(throttled_time).count();
+            }, sm::description("Total time requests spent held back by the class's rate limits, or by another class's latency goal"),
+                    labels),
+            sm::make_gauge(name + sstring("_latency"), [this] {
+                return latency.count();
+            }, sm::description("Average latency of the class's requests, if it has a latency goal"), labels),
     });
+    static auto direction_label = sm::label("direction");
+    for (unsigned dir : { 0, 1 }) {
+        auto dir_labels = labels;
+        dir_labels.push_back(direction_label(dir ? "write" : "read"));
+        _metric_groups.add_group("io_queue", {
+                sm::make_histogram(name + sstring("_queue_latency_us"),
+                        sm::description("Time the class's requests waited in the queue, including throttling"), dir_labels,
+                        [this, dir] { return queue_latency[dir].to_metrics(); }),
+                sm::make_histogram(name + sstring("_device_latency_us"),
+                        sm::description("Time the class's requests took to execute, once dispatched by the queue"), dir_labels,
+                        [this, dir] { return device_latency[dir].to_metrics(); }),
+        });
+    }
+}
+
+void
+io_queue::latency_histogram::add(clock_type::duration d) noexcept {
+    auto us = std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(d).count(), 0);
+    unsigned b;
+    if (us < sub_buckets) {
+        b = us;
+    } else {
+        // sub_buckets buckets per power of two, by the bits after the top one
+        unsigned top = std::numeric_limits<unsigned long long>::digits - 1 - __builtin_clzll(us);
+        b = (top - 1) * sub_buckets + ((us >> (top - 2)) & (sub_buckets - 1));
+    }
+    ++_buckets[std::min(b, nr_buckets - 1)];
+    _sum_us += us;
+}
+
+metrics::histogram
+io_queue::latency_histogram::to_metrics() const {
+    metrics::histogram h;
+    h.sample_sum = _sum_us;
+    h.buckets.resize(nr_buckets);
+    for (unsigned i = 0; i < nr_buckets; ++i) {
+        h.sample_count += _buckets[i];
+        h.buckets[i].count = _buckets[i];
+        if (i < sub_buckets) {
+            h.buckets[i].upper_bound = i;
+        } else {
+            auto top = i / sub_buckets + 1;
+            h.buckets[i].upper_bound = double((uint64_t(sub_buckets + 1 + i % sub_buckets) << (top - 2)) - 1);
+        }
+    }
+    return h;
+}
+
+bool io_queue::priority_class_data::has_tokens(clock_type::time_point now) {
+    auto elapsed = std::chrono::duration<double>(now - last_refill).count();
+    last_refill = now;
+    if (limits.bytes_per_second) {
+        auto rate = double(limits.bytes_per_second);
+        byte_tokens = std::min(byte_tokens + rate * elapsed, rate * io_throttle_burst);
+    }
+    if (limits.ops_per_second) {
+        auto rate = double(limits.ops_per_second);
+        op_tokens = std::min(op_tokens + rate * elapsed, std::max(rate * io_throttle_burst, 1.0));
+    }
+    return (!limits.bytes_per_second || byte_tokens > 0) && (!limits.ops_per_second || op_tokens > 0);
+}
+
+void io_queue::priority_class_data::consume(size_t len) {
+    byte_tokens -= len;
+    op_tokens -= 1;
+}
+
+bool io_queue::latency_throttled(const priority_class_data& pclass) const {
+    return pclass.shares < _endangered_shares && !pclass.limits.latency_goal.count();
+}
+
+future<> io_queue::admit(priority_class_data& pclass, size_t len) {
+    bool limited = pclass.limits.bytes_per_second || pclass.limits.ops_per_second;
+    if (!limited && !_endangered_shares) {
+        return make_ready_future<>();
+    }
+    auto now = clock_type::now();
+    if (pclass.throttled.empty() && pclass.has_tokens(now) && !latency_throttled(pclass)) {
+        pclass.consume(len);
+        return make_ready_future<>();
+    }
+    pclass.throttled.push_back(priority_class_data::throttled_request{promise<>(), len, now});
+    auto f = pclass.throttled.back().pr.get_future();
+    if (!_throttle_timer.armed()) {
+        _throttle_timer.arm(io_throttle_period);
+    }
+    return f;
+}
+
+void io_queue::release_throttled() {
+    auto now = clock_type::now();
+    bool more = false;
+    for (auto&& e : _priority_classes) {
+        auto& pclass = *e.second;
+        // classes throttled for the sake of another's latency still get
+        // to dispatch one request per period, so they are not starved
+        bool trickle = latency_throttled(pclass);
+        unsigned released = 0;
+        while (!pclass.throttled.empty() && !(trickle && released) && pclass.has_tokens(now)) {
+            auto req = std::move(pclass.throttled.front());
+            pclass.throttled.pop_front();
+            pclass.consume(req.len);
+            pclass.throttled_time += now - req.since;
+            req.pr.set_value();
+            ++released;
+        }
+        more |= !pclass.throttled.empty();
+    }
+    if (more) {
+        _throttle_timer.arm(io_throttle_period);
+    }
+}
+
+void io_queue::update_latency(priority_class_data& pclass, std::chrono::duration<double> latency) {
+    // exponentially weighted moving average, over about the last 10 requests
+    pclass.latency = pclass.latency * 0.9 + latency * 0.1;
+    bool endangered = pclass.latency > pclass.limits.latency_goal * 0.8;
+    if (endangered == pclass.latency_endangered) {
+        return;
+    }
+    pclass.latency_endangered = endangered;
+    _endangered_shares = 0;
+    for (auto&& e : _priority_classes) {
+        if (e.second->latency_endangered) {
+            _endangered_shares = std::max(_endangered_shares, e.second->shares);
+        }
+    }
+    if (!_endangered_shares) {
+        release_throttled();
+    }
 }
 
 io_queue::priority_class_data& io_queue::find_or_create_class(const io_priority_class& pc, shard_id owner) {
@@ -1057,6 +1513,9 @@ io_queue::priority_class_data& io_queue::find_or_create_class(const io_priority_
     if (it_pclass == _priority_classes.end()) {
         auto shares = _registered_shares.at(pc.id()).load(std::memory_order_acquire);
         auto name = _registered_names.at(pc.id());
+        auto limits = _registered_limits.at(pc.id());
+        limits.bytes_per_second /= _config.nr_io_queues;
+        limits.ops_per_second /= _config.nr_io_queues;
         // A note on naming:
         //
         // We could just add the owner as the instance id and have something like:
@@ -1072,7 +1531,7 @@ io_queue::priority_class_data& io_queue::find_or_create_class(const io_priority_
         // This conveys all the information we need and allows one to easily group all classes from
         // the same I/O queue (by filtering by shard)
 
-        auto ret = _priority_classes.emplace(pc.id(), make_lw_shared<priority_class_data>(name, _fq.register_priority_class(shares), owner));
+        auto ret = _priority_classes.emplace(pc.id(), make_lw_shared<priority_class_data>(name, _config.mountpoint, _fq.register_priority_class(shares), shares, limits, owner));
         it_pclass = ret.first;
     }
     return *(it_pclass->second);
@@ -1080,21 +1539,45 @@ io_queue::priority_class_data& io_queue::find_or_create_class(const io_priority_
 
 template <typename Func>
 future<io_event>
-io_queue::queue_request(shard_id coordinator, const io_priority_class& pc, size_t len, Func prepare_io) {
-    auto start = std::chrono::steady_clock::now();
-    return smp::submit_to(coordinator, [start, &pc, len, prepare_io = std::move(prepare_io), owner = engine().cpu_id()] {
-        auto& queue = *(engine()._io_queue);
-        unsigned weight = 1 + len/(16 << 10);
+io_queue::queue_request(const io_priority_class& pc, request_type type, size_t len, Func prepare_io) {
+    return queue_work(pc, type, len, [prepare_io = std::move(prepare_io)] {
+        return engine().submit_io(std::move(prepare_io));
+    });
+}
+
+template <typename Func>
+futurize_t<std::result_of_t<Func()>>
+io_queue::queue_work(const io_priority_class& pc, request_type type, size_t len, Func func) {
+    auto start = clock_type::now();
+    return smp::submit_to(_coordinator, [this, start, &pc, type, len, func = std::move(func), owner = engine().cpu_id()] () mutable {
+        uint16_t pc_id = pc.id();
+        auto& queue = *this;
+        auto desc = queue.request_descriptor(type, len);
         // First time will hit here, and then we create the class. It is important
         // that we create the shared pointer in the same shard it will be used at later.
         auto& pclass = queue.find_or_create_class(pc, owner);
         pclass.bytes += len;
         pclass.ops++;
         pclass.nr_queued++;
-        return queue._fq.queue(pclass.ptr, weight, [&pclass, start, prepare_io = std::move(prepare_io)] {
-            pclass.nr_queued--;
-            pclass.queue_time = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start);
-            return engine().submit_io(std::move(prepare_io));
+        auto dir = type == request_type::read ? 0 : 1;
+        return queue.admit(pclass, len).then([&queue, &pclass, desc, start, dir, pc_id, len, func = std::move(func)] () mutable {
+            return queue._fq.queue(pclass.ptr, desc, [&pclass, start, dir, pc_id, len, func = std::move(func)] {
+                pclass.nr_queued--;
+                auto dispatched = clock_type::now();
+                pclass.queue_time = std::chrono::duration_cast<std::chrono::duration<double>>(dispatched - start);
+                pclass.queue_latency[dir].add(dispatched - start);
+                engine().trace_event(event_trace_type::io_submit, pc_id, len);
+                return func().then_wrapped([&pclass, dir, dispatched, pc_id, len] (auto f) {
+                    engine().trace_event(event_trace_type::io_complete, pc_id, len);
+                    pclass.device_latency[dir].add(clock_type::now() - dispatched);
+                    return std::move(f);
+                });
+            });
+        }).then_wrapped([&queue, &pclass, start] (auto f) {
+            if (!f.failed() && pclass.limits.latency_goal.count()) {
+                queue.update_latency(pclass, clock_type::now() - start);
+            }
+            return std::move(f);
         });
     });
 }
@@ -1103,12 +1586,68 @@ file_impl* file_impl::get_file_impl(file& f) {
     return f._file_impl.get();
 }
 
+// Batches list_directory(), for files that have no better way
+subscription<std::vector<directory_scan_entry>>
+file_impl::scan_directory(std::function<future<> (std::vector<directory_scan_entry>)> next, directory_scan_options options) {
+    static constexpr size_t batch_size = 1024;
+    struct work {
+        stream<std::vector<directory_scan_entry>> s;
+        std::vector<directory_scan_entry> batch;
+        // Failures of the consumer are already reported to it
+        bool consumer_failed = false;
+    };
+    auto produce = [] (work& w, std::vector<directory_scan_entry> batch) {
+        return w.s.produce(std::move(batch)).handle_exception([&w] (std::exception_ptr ep) {
+            w.consumer_failed = true;
+            return make_exception_future<>(std::move(ep));
+        });
+    };
+    auto w = make_lw_shared<work>();
+    auto ret = w->s.listen(std::move(next));
+    w->s.started().then([w, this, produce] {
+        auto sub = list_directory([w, produce] (directory_entry de) {
+            w->batch.push_back({std::move(de.name), de.type, {}});
+            if (w->batch.size() < batch_size) {
+                return make_ready_future<>();
+            }
+            return produce(*w, std::exchange(w->batch, {}));
+        });
+        auto done = sub.done();
+        return done.finally([sub = std::move(sub)] {});
+    }).then([w, produce] {
+        if (w->batch.empty()) {
+            return make_ready_future<>();
+        }
+        return produce(*w, std::move(w->batch));
+    }).then_wrapped([w] (future<> f) {
+        if (!f.failed()) {
+            w->s.close();
+        } else if (w->consumer_failed) {
+            f.ignore_ready_future();
+        } else {
+            w->s.set_exception(f.get_exception());
+        }
+    });
+    return ret;
+}
+
 posix_file_impl::posix_file_impl(int fd, file_open_options options)
-        : _fd(fd) {
+        : _merge_reads(options.merge_reads), _batch_discards(options.batch_discards), _fd(fd) {
     query_dma_alignment();
+    find_io_queue();
+    detect_open_flags();
+    _discard_timer.set_callback([this] { maybe_issue_discards(); });
+    if (!options.latency_tag.empty()) {
+        _latency_stats = make_lw_shared<file_latency_stats>();
+        _latency_stats->tag = std::move(options.latency_tag);
+        engine()._latency_tracked_files.insert(_latency_stats.get());
+    }
 }
 
 posix_file_impl::~posix_file_impl() {
+    if (_latency_stats) {
+        engine()._latency_tracked_files.erase(_latency_stats.get());
+    }
     if (_refcount && _refcount->fetch_add(-1, std::memory_order_relaxed) != 1) {
         return;
     }
@@ -1132,10 +1671,61 @@ posix_file_impl::query_dma_alignment() {
     }
 }
 
+void
+posix_file_impl::find_io_queue() {
+    struct stat st;
+    auto r = ::fstat(_fd, &st);
+    // if we can't tell the device, the default queue will do
+    _io_queue = &engine().get_io_queue(r == 0 ? st.st_dev : 0);
+}
+
+void
+posix_file_impl::detect_open_flags() {
+    // tmpfs files, and all files with --relaxed-dma where O_DIRECT is not
+    // supported
+    auto flags = ::fcntl(_fd, F_GETFL);
+    _buffered = flags != -1 && !(flags & O_DIRECT);
+    _dsync = flags != -1 && (flags & O_DSYNC) == O_DSYNC;
+}
+
+template <typename Func>
+future<io_event>
+posix_file_impl::track_latency(Func submit) {
+    if (!_latency_stats) {
+        return submit();
+    }
+    return submit().then([stats = _latency_stats, start = tsc_clock::now()] (io_event ev) {
+        auto latency = tsc_clock::now() - start;
+        ++stats->ops;
+        stats->total_latency += latency;
+        stats->max_latency = std::max(stats->max_latency, latency);
+        return ev;
+    });
+}
+
+std::vector<file_latency_stats>
+reactor::slowest_files(size_t n) const {
+    std::vector<file_latency_stats> ret;
+    for (auto stats : _latency_tracked_files) {
+        ret.push_back(*stats);
+    }
+    auto mean = [] (const file_latency_stats& s) {
+        return s.ops ? s.total_latency / int64_t(s.ops) : std::chrono::steady_clock::duration(0);
+    };
+    n = std::min(n, ret.size());
+    std::partial_sort(ret.begin(), ret.begin() + n, ret.end(), [&mean] (const file_latency_stats& a, const file_latency_stats& b) {
+        return mean(a) > mean(b);
+    });
+    ret.resize(n);
+    return ret;
+}
+
 future<size_t>
 posix_file_impl::write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& io_priority_class) {
-    return engine().submit_io_write(io_priority_class, len, [fd = _fd, pos, buffer, len] (iocb& io) {
-        io_prep_pwrite(&io, fd, const_cast<void*>(buffer), len, pos);
+    return track_latency([&] {
+        return engine().submit_io_write(*_io_queue, io_priority_class, len, [fd = _fd, pos, buffer, len] (iocb& io) {
+            io_prep_pwrite(&io, fd, const_cast<void*>(buffer), len, pos);
+        }, _dsync);
     }).then([] (io_event ev) {
         throw_kernel_error(long(ev.res));
         return make_ready_future<size_t>(size_t(ev.res));
@@ -1148,8 +1738,10 @@ posix_file_impl::write_dma(uint64_t pos, std::vector<iovec> iov, const io_priori
     auto iov_ptr = std::make_unique<std::vector<iovec>>(std::move(iov));
     auto size = iov_ptr->size();
     auto data = iov_ptr->data();
-    return engine().submit_io_write(io_priority_class, len, [fd = _fd, pos, data, size] (iocb& io) {
-        io_prep_pwritev(&io, fd, data, size, pos);
+    return track_latency([&] {
+        return engine().submit_io_write(*_io_queue, io_priority_class, len, [fd = _fd, pos, data, size] (iocb& io) {
+            io_prep_pwritev(&io, fd, data, size, pos);
+        }, _dsync);
     }).then([iov_ptr = std::move(iov_ptr)] (io_event ev) {
         throw_kernel_error(long(ev.res));
         return make_ready_future<size_t>(size_t(ev.res));
@@ -1158,8 +1750,40 @@ posix_file_impl::write_dma(uint64_t pos, std::vector<iovec> iov, const io_priori
 
 future<size_t>
 posix_file_impl::read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& io_priority_class) {
-    return engine().submit_io_read(io_priority_class, len, [fd = _fd, pos, buffer, len] (iocb& io) {
-        io_prep_pread(&io, fd, buffer, len, pos);
+    if (_buffered) {
+        return read_buffered(pos, {iovec{buffer, len}}, io_priority_class);
+    }
+    auto split = align_up<size_t>(_io_queue->max_request_size(), _disk_read_dma_alignment);
+    if (!split || len <= split) {
+        return do_read_dma(pos, buffer, len, io_priority_class);
+    }
+    // Read the parts in parallel; the read ends where the first short part does
+    auto nr_parts = (len + split - 1) / split;
+    auto sizes = make_lw_shared<std::vector<size_t>>(nr_parts);
+    return parallel_for_each(boost::irange<size_t>(0, nr_parts), [this, pos, buffer, len, split, sizes, &io_priority_class] (size_t i) {
+        auto off = i * split;
+        return do_read_dma(pos + off, static_cast<char*>(buffer) + off, std::min(split, len - off), io_priority_class).then(
+                [sizes, i] (size_t size) {
+            (*sizes)[i] = size;
+        });
+    }).then([sizes, split] {
+        size_t total = 0;
+        for (auto size : *sizes) {
+            total += size;
+            if (size < split) {
+                break;
+            }
+        }
+        return total;
+    });
+}
+
+future<size_t>
+posix_file_impl::do_read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& io_priority_class) {
+    return track_latency([&] {
+        return engine().submit_io_read(*_io_queue, io_priority_class, len, [fd = _fd, pos, buffer, len] (iocb& io) {
+            io_prep_pread(&io, fd, buffer, len, pos);
+        });
     }).then([] (io_event ev) {
         throw_kernel_error(long(ev.res));
         return make_ready_future<size_t>(size_t(ev.res));
@@ -1168,20 +1792,164 @@ posix_file_impl::read_dma(uint64_t pos, void* buffer, size_t len, const io_prior
 
 future<size_t>
 posix_file_impl::read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& io_priority_class) {
+    if (_buffered) {
+        return read_buffered(pos, std::move(iov), io_priority_class);
+    }
     auto len = boost::accumulate(iov | boost::adaptors::transformed(std::mem_fn(&iovec::iov_len)), size_t(0));
     auto iov_ptr = std::make_unique<std::vector<iovec>>(std::move(iov));
     auto size = iov_ptr->size();
     auto data = iov_ptr->data();
-    return engine().submit_io_read(io_priority_class, len, [fd = _fd, pos, data, size] (iocb& io) {
-        io_prep_preadv(&io, fd, data, size, pos);
+    return track_latency([&] {
+        return engine().submit_io_read(*_io_queue, io_priority_class, len, [fd = _fd, pos, data, size] (iocb& io) {
+            io_prep_preadv(&io, fd, data, size, pos);
+        });
     }).then([iov_ptr = std::move(iov_ptr)] (io_event ev) {
         throw_kernel_error(long(ev.res));
         return make_ready_future<size_t>(size_t(ev.res));
     });
 }
 
+// preadv2() is wrapped by glibc since 2.26, and RWF_NOWAIT supported by
+// Linux since 4.14
+#if defined(RWF_NOWAIT) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 26)
+#define SEASTAR_HAVE_PREADV2
+#endif
+#endif
+
+future<size_t>
+posix_file_impl::read_buffered(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) {
+    // Linux-aio, unlike io_uring, reads buffered files synchronously,
+    // blocking the reactor whenever the data is not cached. So first try to
+    // read from the page cache without blocking, which needs no more than
+    // this one system call when the data is there.
+    size_t done = 0;
+#ifdef SEASTAR_HAVE_PREADV2
+    if (engine()._nowait_reads) {
+        auto len = boost::accumulate(iov | boost::adaptors::transformed(std::mem_fn(&iovec::iov_len)), size_t(0));
+        auto r = ::preadv2(_fd, iov.data(), iov.size(), pos, RWF_NOWAIT);
+        if (r == ssize_t(len) || r == 0) {
+            ++engine()._io_stats.buffered_reads_nowait;
+            return make_ready_future<size_t>(r);
+        }
+        if (r == -1 && (errno == EOPNOTSUPP || errno == ENOSYS || errno == EINVAL)) {
+            engine()._nowait_reads = false;
+        } else if (r == -1 && errno != EAGAIN) {
+            return make_exception_future<size_t>(std::system_error(errno, std::system_category()));
+        } else {
+            ++engine()._io_stats.buffered_reads_offloaded;
+        }
+        if (r > 0) {
+            // Only part of it is cached (or the read reaches the end of the
+            // file, which the rest of the read finds out); read the rest
+            done = r;
+            pos += done;
+            auto i = iov.begin();
+            for (auto skip = done; skip; ) {
+                if (skip >= i->iov_len) {
+                    skip -= i->iov_len;
+                    ++i;
+                } else {
+                    i->iov_base = static_cast<char*>(i->iov_base) + skip;
+                    i->iov_len -= skip;
+                    skip = 0;
+                }
+            }
+            iov.erase(iov.begin(), i);
+        }
+    }
+#endif
+    auto iov_ptr = std::make_unique<std::vector<iovec>>(std::move(iov));
+    auto data = iov_ptr->data();
+    auto size = iov_ptr->size();
+    if (engine()._backend->async_buffered_reads()) {
+        auto len = boost::accumulate(*iov_ptr | boost::adaptors::transformed(std::mem_fn(&iovec::iov_len)), size_t(0));
+        return track_latency([&] {
+            return engine().submit_io_read(*_io_queue, pc, len, [fd = _fd, pos, data, size] (iocb& io) {
+                io_prep_preadv(&io, fd, data, size, pos);
+            });
+        }).then([done, iov_ptr = std::move(iov_ptr)] (io_event ev) {
+            throw_kernel_error(long(ev.res));
+            return make_ready_future<size_t>(done + size_t(ev.res));
+        });
+    }
+    return engine()._thread_pool.submit<syscall_result<ssize_t>>([fd = _fd, pos, data, size] {
+        return wrap_syscall<ssize_t>(::preadv(fd, data, size, pos));
+    }).then([done, iov_ptr = std::move(iov_ptr)] (syscall_result<ssize_t> sr) {
+        sr.throw_if_error();
+        return make_ready_future<size_t>(done + size_t(sr.result));
+    });
+}
+
 future<temporary_buffer<uint8_t>>
 posix_file_impl::dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) {
+    if (!_merge_reads) {
+        return do_dma_read_bulk(offset, range_size, pc);
+    }
+    if (_bulk_reads.empty()) {
+        // let the other reads of this round join
+        later().then([this] {
+            merge_bulk_reads();
+        });
+    }
+    _bulk_reads.push_back(bulk_read{offset, range_size, &pc, promise<temporary_buffer<uint8_t>>()});
+    return _bulk_reads.back().pr.get_future();
+}
+
+void
+posix_file_impl::merge_bulk_reads() {
+    // Merged reads are not made larger than this, so that they don't hold
+    // up the reads that asked for their beginning for too long
+    static constexpr size_t max_merged_read = 128 * 1024;
+    auto reads = std::exchange(_bulk_reads, {});
+    std::sort(reads.begin(), reads.end(), [] (const bulk_read& a, const bulk_read& b) {
+        return std::make_tuple(a.pc->id(), a.offset) < std::make_tuple(b.pc->id(), b.offset);
+    });
+    auto align = _disk_read_dma_alignment;
+    for (size_t i = 0, j; i < reads.size(); i = j) {
+        auto start = align_down<uint64_t>(reads[i].offset, align);
+        auto end = reads[i].offset + reads[i].len;
+        for (j = i + 1; j < reads.size(); ++j) {
+            auto& r = reads[j];
+            auto new_end = std::max(end, r.offset + r.len);
+            if (r.pc->id() != reads[i].pc->id()
+                    || align_down<uint64_t>(r.offset, align) > align_up<uint64_t>(end, align)
+                    || new_end - start > max_merged_read) {
+                break;
+            }
+            end = new_end;
+        }
+        if (j == i + 1) {
+            do_dma_read_bulk(reads[i].offset, reads[i].len, *reads[i].pc).forward_to(std::move(reads[i].pr));
+            continue;
+        }
+        auto group = std::make_unique<std::vector<bulk_read>>(std::make_move_iterator(reads.begin() + i),
+                std::make_move_iterator(reads.begin() + j));
+        do_dma_read_bulk(start, end - start, *reads[i].pc).then_wrapped(
+                [start, group = std::move(group)] (future<temporary_buffer<uint8_t>> f) {
+            if (f.failed()) {
+                auto ex = f.get_exception();
+                for (auto&& r : *group) {
+                    r.pr.set_exception(ex);
+                }
+                return;
+            }
+            auto buf = f.get0();
+            for (auto&& r : *group) {
+                auto off = r.offset - start;
+                if (off >= buf.size()) {
+                    // beyond the end of the file
+                    r.pr.set_value(temporary_buffer<uint8_t>());
+                } else {
+                    r.pr.set_value(buf.share(off, std::min(r.len, buf.size() - off)));
+                }
+            }
+        });
+    }
+}
+
+future<temporary_buffer<uint8_t>>
+posix_file_impl::do_dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) {
     using tmp_buf_type = typename file::read_state<uint8_t>::tmp_buf_type;
 
     auto front = offset & (_disk_read_dma_alignment - 1);
@@ -1245,7 +2013,7 @@ posix_file_impl::read_maybe_eof(uint64_t pos, size_t len, const io_priority_clas
     // We have to allocate a new aligned buffer to make sure we don't get
     // an EINVAL error due to unaligned destination buffer.
     //
-    temporary_buffer<uint8_t> buf = temporary_buffer<uint8_t>::aligned(
+    temporary_buffer<uint8_t> buf = allocate_dma_buffer<uint8_t>(
                _memory_dma_alignment, align_up(len, size_t(_disk_read_dma_alignment)));
 
     // try to read a single bulk from the given position
@@ -1286,6 +2054,7 @@ append_challenged_posix_file_impl::append_challenged_posix_file_impl(int fd, fil
     throw_system_error_on(r == -1);
     _committed_size = _logical_size = r;
     _sloppy_size = options.sloppy_size;
+    _extension_size = align_up<uint64_t>(options.append_extension_size, _disk_write_dma_alignment);
     auto hint = align_up<uint64_t>(options.sloppy_size_hint, _disk_write_dma_alignment);
     if (_sloppy_size && _committed_size < hint) {
         auto r = ::ftruncate(_fd, hint);
@@ -1315,7 +2084,7 @@ append_challenged_posix_file_impl::size_changing(const op& candidate) const noex
 bool
 append_challenged_posix_file_impl::may_dispatch(const op& candidate) const noexcept {
     if (size_changing(candidate)) {
-        return !_current_size_changing_ops && !_current_non_size_changing_ops;
+        return !_current_size_changing_ops && !_current_non_size_changing_ops && !_extending;
     } else {
         return !_current_size_changing_ops;
     }
@@ -1337,7 +2106,7 @@ append_challenged_posix_file_impl::dispatch(op& candidate) noexcept {
 // be issued concurrently.
 void
 append_challenged_posix_file_impl::optimize_queue() noexcept {
-    if (_current_non_size_changing_ops || _current_size_changing_ops) {
+    if (_current_non_size_changing_ops || _current_size_changing_ops || _extending) {
         // Can't issue an ftruncate() if something is going on
         return;
     }
@@ -1373,12 +2142,53 @@ append_challenged_posix_file_impl::optimize_queue() noexcept {
     }
 }
 
+// Extends the file in the background once appending writes get within
+// half an extension of its end, so that they find it already extended
+// and are not size-changing. Writes within the file run concurrently with
+// the extension; writes beyond it, and truncates, wait for it.
 void
-append_challenged_posix_file_impl::process_queue() noexcept {
-    optimize_queue();
-    while (!_q.empty() && may_dispatch(_q.front())) {
-        op candidate = std::move(_q.front());
-        _q.pop_front();
+append_challenged_posix_file_impl::maybe_extend() noexcept {
+    if (!_extension_size || _extending || _done || _current_size_changing_ops) {
+        return;
+    }
+    auto horizon = _logical_size;
+    for (const auto& op : _q) {
+        if (op.type == opcode::write) {
+            horizon = std::max(horizon, op.pos + op.len);
+        }
+    }
+    if (horizon + _extension_size / 2 < _committed_size) {
+        return;
+    }
+    auto from = _committed_size;
+    auto to = align_up(horizon, _extension_size) + _extension_size;
+    _extending = true;
+    engine()._thread_pool.submit<syscall_result<int>>(syscall_lane::sync, [fd = _fd, from, to] {
+        return wrap_syscall<int>(::fallocate(fd, 0, from, to - from));
+    }).then_wrapped([this, to] (future<syscall_result<int>> f) {
+        _extending = false;
+        try {
+            if (f.get0().result != -1) {
+                _committed_size = std::max(_committed_size, to);
+            } else {
+                // Most likely not supported, or out of space; appending
+                // writes extend the file themselves, as without extension
+                _extension_size = 0;
+            }
+        } catch (...) {
+            _extension_size = 0;
+        }
+        process_queue();
+    });
+}
+
+void
+append_challenged_posix_file_impl::process_queue() noexcept {
+    maybe_extend();
+    optimize_queue();
+    while (!_q.empty() && may_dispatch(_q.front())) {
+        op candidate = std::move(_q.front());
+        _q.pop_front();
         dispatch(candidate);
     }
     if (may_quit()) {
@@ -1395,7 +2205,7 @@ append_challenged_posix_file_impl::enqueue(op&& op) {
 
 bool
 append_challenged_posix_file_impl::may_quit() const noexcept {
-    return _done && _q.empty() && !_current_non_size_changing_ops && !_current_size_changing_ops;
+    return _done && _q.empty() && !_current_non_size_changing_ops && !_current_size_changing_ops && !_extending;
 }
 
 void
@@ -1697,51 +2507,102 @@ file::file(int fd, file_open_options options)
         : _file_impl(make_file_impl(fd, options)) {
 }
 
+// Completes opening a file for DMA, once open() (without O_DIRECT) returned
+// fd. Closes fd if it cannot be used.
+static
+syscall_result<int>
+prepare_dma_fd(int fd, int open_flags, bool strict_o_direct, const file_open_options& options, bool set_extent_hint) {
+    // We want O_DIRECT, except in two cases:
+    //   - tmpfs (which doesn't support it, but works fine anyway)
+    //   - strict_o_direct == false (where we forgive it being not supported)
+    // Because open() with O_DIRECT will fail, we open it without O_DIRECT, try
+    // to update it to O_DIRECT with fcntl(), and if that fails, see if we
+    // can forgive it.
+    auto is_tmpfs = [] (int fd) {
+        struct ::statfs buf;
+        auto r = ::fstatfs(fd, &buf);
+        if (r == -1) {
+            return false;
+        }
+        return buf.f_type == 0x01021994; // TMPFS_MAGIC
+    };
+    int r = ::fcntl(fd, F_SETFL, open_flags | O_DIRECT);
+    auto maybe_ret = wrap_syscall<int>(r);  // capture errno (should be EINVAL)
+    if (r == -1  && strict_o_direct && !is_tmpfs(fd)) {
+        ::close(fd);
+        return maybe_ret;
+    }
+    if (set_extent_hint) {
+        fsxattr attr = {};
+        if (options.extent_allocation_size_hint) {
+            attr.fsx_xflags |= XFS_XFLAG_EXTSIZE;
+            attr.fsx_extsize = options.extent_allocation_size_hint;
+        }
+        // Ignore error; may be !xfs, and just a hint anyway
+        ::ioctl(fd, XFS_IOC_FSSETXATTR, &attr);
+    }
+    return wrap_syscall<int>(fd);
+}
+
 future<file>
 reactor::open_file_dma(sstring name, open_flags flags, file_open_options options) {
     static constexpr mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH; // 0644
-    return _thread_pool.submit<syscall_result<int>>([name, flags, options, strict_o_direct = _strict_o_direct] {
-        // We want O_DIRECT, except in two cases:
-        //   - tmpfs (which doesn't support it, but works fine anyway)
-        //   - strict_o_direct == false (where we forgive it being not supported)
-        // Because open() with O_DIRECT will fail, we open it without O_DIRECT, try
-        // to update it to O_DIRECT with fcntl(), and if that fails, see if we
-        // can forgive it.
-        auto is_tmpfs = [] (int fd) {
-            struct ::statfs buf;
-            auto r = ::fstatfs(fd, &buf);
-            if (r == -1) {
-                return false;
-            }
-            return buf.f_type == 0x01021994; // TMPFS_MAGIC
-        };
-        auto open_flags = O_CLOEXEC | static_cast<int>(flags);
-        int fd = ::open(name.c_str(), open_flags, mode);
-        if (fd == -1) {
-            return wrap_syscall<int>(fd);
-        }
-        int r = ::fcntl(fd, F_SETFL, open_flags | O_DIRECT);
-        auto maybe_ret = wrap_syscall<int>(r);  // capture errno (should be EINVAL)
-        if (r == -1  && strict_o_direct && !is_tmpfs(fd)) {
-            ::close(fd);
-            return maybe_ret;
-        }
-        if (fd != -1) {
-            fsxattr attr = {};
-            if (options.extent_allocation_size_hint) {
-                attr.fsx_xflags |= XFS_XFLAG_EXTSIZE;
-                attr.fsx_extsize = options.extent_allocation_size_hint;
+    auto open_flags = O_CLOEXEC | static_cast<int>(flags);
+    auto open_on_thread = [this, name, open_flags, options, strict_o_direct = _strict_o_direct] {
+        return _thread_pool.submit<syscall_result<int>>([name, open_flags, options, strict_o_direct] {
+            int fd = ::open(name.c_str(), open_flags, mode);
+            if (fd == -1) {
+                return wrap_syscall<int>(fd);
             }
-            // Ignore error; may be !xfs, and just a hint anyway
-            ::ioctl(fd, XFS_IOC_FSSETXATTR, &attr);
+            return prepare_dma_fd(fd, open_flags, strict_o_direct, options, true);
+        });
+    };
+    auto name_ptr = make_lw_shared<sstring>(std::move(name));
+    return _backend->open_file(name_ptr->c_str(), open_flags, mode).then(
+            [this, name_ptr, open_flags, options, open_on_thread] (int fd) {
+        if (fd == -ENOSYS) {
+            return open_on_thread();
+        }
+        if (fd < 0) {
+            syscall_result<int> sr;
+            sr.result = -1;
+            sr.error = -fd;
+            return make_ready_future<syscall_result<int>>(sr);
         }
-        return wrap_syscall<int>(fd);
+        // The rest needs no disk access, except for the XFS extent size
+        // hint, which only matters for (and so is only set on) files
+        // being created, since XFS refuses to change it once a file has
+        // extents.
+        return make_ready_future<syscall_result<int>>(
+                prepare_dma_fd(fd, open_flags, _strict_o_direct, options, open_flags & O_CREAT));
     }).then([options] (syscall_result<int> sr) {
         sr.throw_if_error();
         return make_ready_future<file>(file(sr.result, options));
     });
 }
 
+future<>
+reactor::open_files_dma(std::vector<sstring> names, open_flags flags,
+        std::function<void (size_t index, future<file> f)> on_open, file_open_options options) {
+    // Enough to keep all syscall threads, or the kernel, busy
+    static constexpr size_t parallelism = 64;
+    struct work {
+        std::vector<sstring> names;
+        std::function<void (size_t, future<file>)> on_open;
+        size_t next = 0;
+    };
+    auto w = make_lw_shared<work>(work{std::move(names), std::move(on_open)});
+    auto nr_workers = std::min(parallelism, w->names.size());
+    return parallel_for_each(boost::irange<size_t>(0, nr_workers), [this, w, flags, options] (size_t) {
+        return do_until([w] { return w->next == w->names.size(); }, [this, w, flags, options] {
+            auto i = w->next++;
+            return open_file_dma(w->names[i], flags, options).then_wrapped([w, i] (future<file> f) {
+                w->on_open(i, std::move(f));
+            });
+        });
+    });
+}
+
 future<>
 reactor::remove_file(sstring pathname) {
     return engine()._thread_pool.submit<syscall_result<int>>([pathname] {
@@ -1945,6 +2806,8 @@ posix_file_impl::dup() {
 
 posix_file_impl::posix_file_impl(int fd, std::atomic<unsigned>* refcount)
         : _refcount(refcount), _fd(fd) {
+    find_io_queue();
+    detect_open_flags();
 }
 
 posix_file_handle_impl::~posix_file_handle_impl() {
@@ -1977,10 +2840,69 @@ posix_file_impl::flush(void) {
     if (engine()._bypass_fsync) {
         return make_ready_future<>();
     }
-    return engine()._thread_pool.submit<syscall_result<int>>([this] {
-        return wrap_syscall<int>(::fdatasync(_fd));
-    }).then([] (syscall_result<int> sr) {
-        sr.throw_if_error();
+    if (_flushing) {
+        // The flush in progress may have started before writes this one
+        // must cover, so wait for the next one
+        if (!_next_flush) {
+            _next_flush = std::make_unique<shared_promise<>>();
+        }
+        return _next_flush->get_shared_future();
+    }
+    _flushing = true;
+    return do_flush().finally([this] {
+        start_next_flush();
+    });
+}
+
+void
+posix_file_impl::start_next_flush() {
+    _flushing = false;
+    if (!_next_flush) {
+        return;
+    }
+    auto pr = std::move(_next_flush);
+    _flushing = true;
+    do_flush().then_wrapped([this, pr = std::move(pr)] (future<> f) {
+        start_next_flush();
+        if (f.failed()) {
+            pr->set_exception(f.get_exception());
+        } else {
+            pr->set_value();
+        }
+    });
+}
+
+future<>
+posix_file_impl::do_flush() {
+    auto sync_on_thread = [this] {
+        return engine()._thread_pool.submit<syscall_result<int>>(syscall_lane::sync, [this] {
+            return wrap_syscall<int>(::fdatasync(_fd));
+        }).then([] (syscall_result<int> sr) {
+            sr.throw_if_error();
+            return make_ready_future<>();
+        });
+    };
+    if (!engine()._aio_fdsync) {
+        return sync_on_thread();
+    }
+    return engine().submit_io([fd = _fd] (iocb& io) {
+        io_prep_fdsync(&io, fd);
+    }).then_wrapped([sync_on_thread] (future<io_event> f) {
+        long res;
+        try {
+            res = long(f.get0().res);
+        } catch (std::system_error& e) {
+            if (e.code().value() != EINVAL) {
+                throw;
+            }
+            res = -EINVAL;
+        }
+        if (res == -EINVAL) {
+            // not supported here; don't try again
+            engine()._aio_fdsync = false;
+            return sync_on_thread();
+        }
+        throw_kernel_error(res);
         return make_ready_future<>();
     });
 }
@@ -1999,7 +2921,7 @@ posix_file_impl::stat(void) {
 
 future<>
 posix_file_impl::truncate(uint64_t length) {
-    return engine()._thread_pool.submit<syscall_result<int>>([this, length] {
+    return engine()._thread_pool.submit<syscall_result<int>>(syscall_lane::sync, [this, length] {
         return wrap_syscall<int>(::ftruncate(_fd, length));
     }).then([] (syscall_result<int> sr) {
         sr.throw_if_error();
@@ -2009,6 +2931,7 @@ posix_file_impl::truncate(uint64_t length) {
 
 blockdev_file_impl::blockdev_file_impl(int fd, file_open_options options)
         : posix_file_impl(fd, options) {
+    _blockdev = true;
 }
 
 future<>
@@ -2017,9 +2940,13 @@ blockdev_file_impl::truncate(uint64_t length) {
 }
 
 future<>
-posix_file_impl::discard(uint64_t offset, uint64_t length) {
-    return engine()._thread_pool.submit<syscall_result<int>>([this, offset, length] () mutable {
-        return wrap_syscall<int>(::fallocate(_fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+posix_file_impl::discard_range(int fd, bool blockdev, uint64_t offset, uint64_t length) {
+    return engine()._thread_pool.submit<syscall_result<int>>(syscall_lane::sync, [fd, blockdev, offset, length] {
+        if (blockdev) {
+            uint64_t range[2] { offset, length };
+            return wrap_syscall<int>(::ioctl(fd, BLKDISCARD, &range));
+        }
+        return wrap_syscall<int>(::fallocate(fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
             offset, length));
     }).then([] (syscall_result<int> sr) {
         sr.throw_if_error();
@@ -2027,6 +2954,95 @@ posix_file_impl::discard(uint64_t offset, uint64_t length) {
     });
 }
 
+future<>
+posix_file_impl::discard(uint64_t offset, uint64_t length) {
+    if (_batch_discards) {
+        return queue_discard(offset, length);
+    }
+    return discard_range(_fd, _blockdev, offset, length);
+}
+
+// Batched discards are queued for this long before they are issued, so that
+// the discards of a burst are merged
+static constexpr auto discard_batch_window = std::chrono::milliseconds(1);
+// Deferred discards wait for the disk to go quiet no longer than this
+static constexpr auto max_discard_deferral = std::chrono::seconds(10);
+// Merged ranges are issued in requests of at most this size, so that their
+// bandwidth is limited smoothly
+static constexpr uint64_t max_discard_request_size = 16 << 20;
+
+future<>
+posix_file_impl::queue_discard(uint64_t offset, uint64_t length) {
+    if (!length) {
+        return make_ready_future<>();
+    }
+    if (!_pending_discards) {
+        _pending_discards = std::make_unique<discard_batch>();
+        _discards_queued = timer<>::clock::now();
+        auto& stats = engine().get_io_stats();
+        _discard_io_mark = stats.aio_reads + stats.aio_writes;
+        _discard_timer.arm(engine()._discard_defer.count() ? engine()._discard_defer : discard_batch_window);
+    }
+    auto& ranges = _pending_discards->ranges;
+    auto end = offset + length;
+    // absorb the ranges that overlap or touch this one
+    auto i = ranges.upper_bound(offset);
+    if (i != ranges.begin() && std::prev(i)->second >= offset) {
+        --i;
+        offset = i->first;
+    }
+    while (i != ranges.end() && i->first <= end) {
+        end = std::max(end, i->second);
+        i = ranges.erase(i);
+    }
+    ranges.emplace(offset, end);
+    return _pending_discards->done.get_shared_future();
+}
+
+void
+posix_file_impl::maybe_issue_discards() {
+    auto defer = engine()._discard_defer;
+    if (defer.count()) {
+        auto& stats = engine().get_io_stats();
+        auto ops = stats.aio_reads + stats.aio_writes;
+        if (ops != _discard_io_mark && timer<>::clock::now() - _discards_queued < max_discard_deferral) {
+            _discard_io_mark = ops;
+            _discard_timer.arm(defer);
+            return;
+        }
+    }
+    issue_discards();
+}
+
+void
+posix_file_impl::issue_discards() {
+    _discard_timer.cancel();
+    auto batch = std::move(_pending_discards);
+    auto& pc = engine().discard_priority_class();
+    // the batch does not refer to the file, which may be gone by the time
+    // it is issued
+    _discards_issued = _discards_issued.then([batch = std::move(batch), &pc, ioq = _io_queue, fd = _fd, blockdev = _blockdev] () mutable {
+        auto& ranges = batch->ranges;
+        return do_for_each(ranges, [&pc, ioq, fd, blockdev] (const std::pair<const uint64_t, uint64_t>& r) {
+            auto nr_requests = (r.second - r.first + max_discard_request_size - 1) / max_discard_request_size;
+            auto requests = boost::irange<uint64_t>(0, nr_requests);
+            return do_for_each(requests.begin(), requests.end(), [&pc, ioq, fd, blockdev, r] (uint64_t i) {
+                auto offset = r.first + i * max_discard_request_size;
+                auto len = std::min(max_discard_request_size, r.second - offset);
+                return ioq->queue_work(pc, io_queue::request_type::discard, len, [fd, blockdev, offset, len] {
+                    return discard_range(fd, blockdev, offset, len);
+                });
+            });
+        }).then_wrapped([batch = std::move(batch)] (future<> f) {
+            if (f.failed()) {
+                batch->done.set_exception(f.get_exception());
+            } else {
+                batch->done.set_value();
+            }
+        });
+    });
+}
+
 future<>
 posix_file_impl::allocate(uint64_t position, uint64_t length) {
 #ifdef FALLOC_FL_ZERO_RANGE
@@ -2035,7 +3051,7 @@ posix_file_impl::allocate(uint64_t position, uint64_t length) {
     if (!supported) {
         return make_ready_future<>();
     }
-    return engine()._thread_pool.submit<syscall_result<int>>([this, position, length] () mutable {
+    return engine()._thread_pool.submit<syscall_result<int>>(syscall_lane::sync, [this, position, length] () mutable {
         auto ret = ::fallocate(_fd, FALLOC_FL_ZERO_RANGE|FALLOC_FL_KEEP_SIZE, position, length);
         if (ret == -1 && errno == EOPNOTSUPP) {
             ret = 0;
@@ -2051,17 +3067,6 @@ posix_file_impl::allocate(uint64_t position, uint64_t length) {
 #endif
 }
 
-future<>
-blockdev_file_impl::discard(uint64_t offset, uint64_t length) {
-    return engine()._thread_pool.submit<syscall_result<int>>([this, offset, length] () mutable {
-        uint64_t range[2] { offset, length };
-        return wrap_syscall<int>(::ioctl(_fd, BLKDISCARD, &range));
-    }).then([] (syscall_result<int> sr) {
-        sr.throw_if_error();
-        return make_ready_future<>();
-    });
-}
-
 future<>
 blockdev_file_impl::allocate(uint64_t position, uint64_t length) {
     // nothing to do for block device
@@ -2083,6 +3088,14 @@ posix_file_impl::close() noexcept {
         seastar_logger.warn("double close() detected, contact support");
         return make_ready_future<>();
     }
+    if (_pending_discards || !_discards_issued.available()) {
+        if (_pending_discards) {
+            issue_discards();
+        }
+        return std::exchange(_discards_issued, make_ready_future<>()).then([this] {
+            return close();
+        });
+    }
     auto fd = _fd;
     _fd = -1;  // Prevent a concurrent close (which is illegal) from closing another file's fd
     if (_refcount && _refcount->fetch_add(-1, std::memory_order_relaxed) != 1) {
@@ -2207,6 +3220,135 @@ posix_file_impl::list_directory(std::function<future<> (directory_entry de)> nex
     return ret;
 }
 
+subscription<std::vector<directory_scan_entry>>
+posix_file_impl::scan_directory(std::function<future<> (std::vector<directory_scan_entry>)> next, directory_scan_options options) {
+    // Large enough for any entry, so that getdents64() doesn't fail with
+    // EINVAL once we stop filling the buffer
+    static constexpr size_t max_dirent_size = 512;
+    struct linux_dirent64 {
+        ino64_t        d_ino;
+        off64_t        d_off;
+        unsigned short d_reclen;
+        unsigned char  d_type;
+        char           d_name[];
+    };
+    struct work {
+        stream<std::vector<directory_scan_entry>> s;
+        std::unique_ptr<char[]> buffer;
+        size_t size;
+        bool eof = false;
+        // Failures of the consumer are already reported to it
+        bool consumer_failed = false;
+    };
+    auto w = make_lw_shared<work>();
+    w->size = std::max(options.buffer_size, 2 * max_dirent_size);
+    w->buffer.reset(new char[w->size]);
+    auto ret = w->s.listen(std::move(next));
+
+    // As in list_directory(), the syscall threads only fill buffers
+    // allocated here, since they cannot malloc()
+    auto read_batch = [w, this] {
+        return engine()._thread_pool.submit<syscall_result<long>>([w, fd = _fd] {
+            long filled = 0;
+            while (w->size - filled >= max_dirent_size) {
+                auto r = ::syscall(__NR_getdents64, fd, w->buffer.get() + filled, w->size - filled);
+                if (r <= 0) {
+                    if (r == -1 && !filled) {
+                        return wrap_syscall(r);
+                    }
+                    // an error will recur on the next batch
+                    break;
+                }
+                filled += r;
+            }
+            return syscall_result<long>{filled, 0};
+        }).then([w] (syscall_result<long> sr) {
+            sr.throw_if_error();
+            std::vector<directory_scan_entry> batch;
+            if (sr.result == 0) {
+                w->eof = true;
+                return batch;
+            }
+            for (long pos = 0; pos < sr.result; ) {
+                auto de = reinterpret_cast<linux_dirent64*>(w->buffer.get() + pos);
+                pos += de->d_reclen;
+                sstring name = de->d_name;
+                if (name == "." || name == "..") {
+                    continue;
+                }
+                std::experimental::optional<directory_entry_type> type;
+                switch (de->d_type) {
+                case DT_BLK: type = directory_entry_type::block_device; break;
+                case DT_CHR: type = directory_entry_type::char_device; break;
+                case DT_DIR: type = directory_entry_type::directory; break;
+                case DT_FIFO: type = directory_entry_type::fifo; break;
+                case DT_LNK: type = directory_entry_type::link; break;
+                case DT_REG: type = directory_entry_type::regular; break;
+                case DT_SOCK: type = directory_entry_type::socket; break;
+                default: break; // unknown
+                }
+                batch.push_back({std::move(name), type, {}});
+            }
+            return batch;
+        });
+    };
+    auto stat_batch = [this] (std::vector<directory_scan_entry> batch) {
+        struct stats {
+            std::vector<directory_scan_entry> batch;
+            std::vector<struct stat> st;
+            std::vector<int> ok;
+        };
+        auto s = make_lw_shared<stats>();
+        s->st.resize(batch.size());
+        s->ok.resize(batch.size());
+        s->batch = std::move(batch);
+        return engine()._thread_pool.submit<int>([s, fd = _fd] {
+            for (size_t i = 0; i < s->batch.size(); ++i) {
+                s->ok[i] = ::fstatat(fd, s->batch[i].name.c_str(), &s->st[i], AT_SYMLINK_NOFOLLOW) == 0;
+            }
+            return 0;
+        }).then([s] (int) {
+            for (size_t i = 0; i < s->batch.size(); ++i) {
+                // files removed since they were listed, or that we may not
+                // look at, have no metadata
+                if (s->ok[i]) {
+                    auto& e = s->batch[i];
+                    e.stat = s->st[i];
+                    e.type = stat_to_entry_type(s->st[i].st_mode);
+                }
+            }
+            return std::move(s->batch);
+        });
+    };
+    w->s.started().then([w, read_batch, stat_batch, options] {
+        return do_until([w] { return w->eof; }, [w, read_batch, stat_batch, options] {
+            return read_batch().then([stat_batch, options] (std::vector<directory_scan_entry> batch) {
+                if (!options.stat || batch.empty()) {
+                    return make_ready_future<std::vector<directory_scan_entry>>(std::move(batch));
+                }
+                return stat_batch(std::move(batch));
+            }).then([w] (std::vector<directory_scan_entry> batch) {
+                if (batch.empty()) {
+                    return make_ready_future<>();
+                }
+                return w->s.produce(std::move(batch)).handle_exception([w] (std::exception_ptr ep) {
+                    w->consumer_failed = true;
+                    return make_exception_future<>(std::move(ep));
+                });
+            });
+        });
+    }).then_wrapped([w] (future<> f) {
+        if (!f.failed()) {
+            w->s.close();
+        } else if (w->consumer_failed) {
+            f.ignore_ready_future();
+        } else {
+            w->s.set_exception(f.get_exception());
+        }
+    });
+    return ret;
+}
+
 void reactor::enable_timer(steady_clock_type::time_point when)
 {
 #ifndef HAVE_OSV
@@ -2325,7 +3467,9 @@ uint64_t
 reactor::pending_task_count() const {
     uint64_t ret = 0;
     for (auto&& tq : _task_queues) {
-        ret += tq->_q.size();
+        if (tq) {
+            ret += tq->_q.size();
+        }
     }
     return ret;
 }
@@ -2334,7 +3478,9 @@ uint64_t
 reactor::tasks_processed() const {
     uint64_t ret = 0;
     for (auto&& tq : _task_queues) {
-        ret += tq->_tasks_processed;
+        if (tq) {
+            ret += tq->_tasks_processed;
+        }
     }
     return ret;
 }
@@ -2350,6 +3496,10 @@ void reactor::register_metrics() {
             sm::make_derive("polls", [this] { return _polls.load(std::memory_order_relaxed); }, sm::description("Number of times pollers were executed")),
             sm::make_derive("timers_pending", std::bind(&decltype(_timers)::size, &_timers), sm::description("Number of tasks in the timer-pending queue")),
             sm::make_gauge("utilization", [this] { return (1-_load)  * 100; }, sm::description("CPU utilization")),
+            sm::make_histogram("poll_iteration_us", sm::description("Duration of reactor loop iterations (running tasks and polling), excluding sleeps (sampled)"),
+                    [this] { return _poll_iteration_time.to_metrics(); }),
+            sm::make_gauge("idle_poll_time_us", [this] { return std::chrono::duration_cast<std::chrono::microseconds>(_max_poll_time).count(); },
+                    sm::description("Time the reactor busy-polls when idle before going to sleep; varies with --adaptive-poll")),
             sm::make_derive("cpu_busy_ns", [this] () -> int64_t { return std::chrono::duration_cast<std::chrono::nanoseconds>(total_busy_time()).count(); },
                     sm::description("Total cpu busy time in nanoseconds")),
             // total_operations value:DERIVE:0:U
@@ -2359,26 +3509,96 @@ void reactor::register_metrics() {
             // total_operations value:DERIVE:0:U
             sm::make_derive("aio_writes", _io_stats.aio_writes, sm::description("Total aio-writes operations")),
             sm::make_total_bytes("aio_bytes_write", _io_stats.aio_write_bytes, sm::description("Total aio-writes bytes")),
+            sm::make_derive("aio_dsync_writes", _io_stats.aio_dsync_writes,
+                    sm::description("Total aio-writes operations to files opened with O_DSYNC")),
+            sm::make_derive("buffered_reads_nowait", _io_stats.buffered_reads_nowait,
+                    sm::description("Reads of files opened without O_DIRECT served from the page cache without blocking")),
+            sm::make_derive("buffered_reads_offloaded", _io_stats.buffered_reads_offloaded,
+                    sm::description("Reads of files opened without O_DIRECT that missed the page cache, and were offloaded to io_uring or a syscall thread")),
             // total_operations value:DERIVE:0:U
             sm::make_derive("fsyncs", _fsyncs, sm::description("Total number of fsync operations")),
             // total_operations value:DERIVE:0:U
             sm::make_derive("io_threaded_fallbacks", std::bind(&thread_pool::operation_count, &_thread_pool),
                     sm::description("Total number of io-threaded-fallbacks operations")),
+            sm::make_derive("thread_stacks_allocated", [] { return thread_impl::get_stack_pool_stats().allocations; },
+                    sm::description("Total number of seastar::thread stacks mapped from the kernel")),
+            sm::make_derive("thread_stacks_reused", [] { return thread_impl::get_stack_pool_stats().reuses; },
+                    sm::description("Total number of seastar::thread stacks reused from the per-shard pool")),
+            sm::make_gauge("thread_stacks_cached", [] { return thread_impl::get_stack_pool_stats().cached; },
+                    sm::description("Number of free seastar::thread stacks held by the per-shard pool")),
+            sm::make_derive("foreign_disposals", _foreign_disposals_sent,
+                    sm::description("Total number of objects owned by other shards sent back to them for destruction")),
+            sm::make_derive("foreign_disposal_batches", _foreign_disposal_batches_sent,
+                    sm::description("Total number of messages carrying objects back to their owner shards for destruction")),
+            sm::make_derive("stealable_tasks_run", _stealable_tasks_run,
+                    sm::description("Total number of stealable functions submitted on this shard and run here")),
+            sm::make_derive("stealable_tasks_stolen", _stealable_tasks_stolen,
+                    sm::description("Total number of stealable functions this shard took from other shards")),
+            sm::make_queue_length("stealable_tasks_queued", [this] { return _stealable_tasks.size(); },
+                    sm::description("Number of stealable functions waiting to run, on this shard or another")),
 
     });
 
+#ifndef HAVE_OSV
+    for (auto lane : { syscall_lane::metadata, syscall_lane::sync }) {
+        static auto lane_label = sm::label("lane");
+        auto l = lane_label(lane == syscall_lane::sync ? "sync" : "metadata");
+        _metric_groups.add_group("reactor", {
+            sm::make_derive("syscall_operations", [this, lane] { return _thread_pool.stats(lane).operations; },
+                    sm::description("Total number of operations completed by the syscall threads of this lane"), {l}),
+            sm::make_queue_length("syscall_queue_length", [this, lane] { return _thread_pool.stats(lane).queue_length; },
+                    sm::description("Number of operations queued or running on the syscall threads of this lane"), {l}),
+            sm::make_derive("syscall_queue_wait_time_us", [this, lane] {
+                return std::chrono::duration_cast<std::chrono::microseconds>(_thread_pool.stats(lane).total_wait_time).count();
+            }, sm::description("Total time operations waited for a syscall thread of this lane; divide by syscall_operations for the average"), {l}),
+        });
+    }
+#endif
+
     _metric_groups.add_group("memory", {
             sm::make_derive("malloc_operations", [] { return memory::stats().mallocs(); },
                     sm::description("Total number of malloc operations")),
             sm::make_derive("free_operations", [] { return memory::stats().frees(); }, sm::description("Total number of free operations")),
             sm::make_derive("cross_cpu_free_operations", [] { return memory::stats().cross_cpu_frees(); }, sm::description("Total number of cross cpu free")),
+            sm::make_derive("cross_cpu_free_batches", [] { return memory::stats().cross_cpu_free_batches(); },
+                    sm::description("Total number of batches cross cpu frees were handed over in; divide cross_cpu_free_operations by it for the average batch size")),
             sm::make_gauge("malloc_live_objects", [] { return memory::stats().live_objects(); }, sm::description("Number of live objects")),
             sm::make_current_bytes("free_memory", [] { return memory::stats().free_memory(); }, sm::description("Free memeory size in bytes")),
             sm::make_current_bytes("total_memory", [] { return memory::stats().total_memory(); }, sm::description("Total memeory size in bytes")),
             sm::make_current_bytes("allocated_memory", [] { return memory::stats().allocated_memory(); }, sm::description("Allocated memeory size in bytes")),
-            sm::make_derive("reclaims_operations", [] { return memory::stats().reclaims(); }, sm::description("Total reclaims operations"))
+            sm::make_derive("reclaims_operations", [] { return memory::stats().reclaims(); }, sm::description("Total reclaims operations")),
+            sm::make_gauge("huge_aligned_allocations", [] { return memory::get_huge_page_stats().huge_aligned_allocations; },
+                    sm::description("Number of live large allocations placed on a huge page boundary")),
+            sm::make_current_bytes("huge_aligned_memory", [] { return memory::get_huge_page_stats().huge_aligned_memory; },
+                    sm::description("Size of the live large allocations placed on a huge page boundary")),
     });
 
+    for (unsigned i = 0; i < memory::nr_small_pools(); ++i) {
+        static auto object_size_label = sm::label("object_size");
+        auto l = object_size_label(memory::get_small_pool_stats(i).object_size);
+        _metric_groups.add_group("memory", {
+            sm::make_gauge("small_pool_live_objects", [i] { return memory::get_small_pool_stats(i).live_objects; },
+                    sm::description("Number of allocated objects in this small pool"), {l}),
+            sm::make_gauge("small_pool_free_objects", [i] { return memory::get_small_pool_stats(i).free_objects; },
+                    sm::description("Number of free objects in this small pool's free list"), {l}),
+            sm::make_gauge("small_pool_span_free_objects", [i] { return memory::get_small_pool_stats(i).span_free_objects; },
+                    sm::description("Number of free objects held by this small pool in partially used spans"), {l}),
+            sm::make_current_bytes("small_pool_memory", [i] { return memory::get_small_pool_stats(i).memory; },
+                    sm::description("Memory held in spans owned by this small pool"), {l}),
+        });
+    }
+
+    for (unsigned i = 0; i < memory::nr_free_span_orders(); ++i) {
+        static auto span_order_label = sm::label("span_order");
+        auto l = span_order_label(i);
+        _metric_groups.add_group("memory", {
+            sm::make_gauge("free_spans", [i] { return memory::get_free_span_stats(i).spans; },
+                    sm::description("Number of free page spans of this order (at least 2^order pages)"), {l}),
+            sm::make_current_bytes("free_span_memory", [i] { return memory::get_free_span_stats(i).free_memory; },
+                    sm::description("Total size of the free page spans of this order"), {l}),
+        });
+    }
+
     _metric_groups.add_group("reactor", {
             sm::make_derive("logging_failures", [] { return logging_failures; }, sm::description("Total number of logging failures")),
             // total_operations value:DERIVE:0:U
@@ -2420,17 +3640,57 @@ void reactor::register_metrics() {
     });
 }
 
+reactor::task_type_stats&
+reactor::task_queue::get_task_type_stats(const std::type_info& ti) {
+    auto& stats = _task_type_stats[std::type_index(ti)];
+    if (!stats) {
+        stats = std::make_unique<task_type_stats>();
+        namespace sm = seastar::metrics;
+        static auto group = sm::label("group");
+        static auto task_type = sm::label("task_type");
+        std::vector<sm::label_instance> labels = {group(_name), task_type(pretty_type_name(ti))};
+        auto& st = *stats;
+        stats->_metrics.add_group("scheduler", {
+            sm::make_counter("task_type_runtime_us", [&st] {
+                return std::chrono::duration_cast<std::chrono::microseconds>(st._runtime).count();
+            }, sm::description("Accumulated runtime of tasks of this type on this task queue"), labels),
+            sm::make_counter("task_type_tasks_processed", st._tasks_processed,
+                    sm::description("Count of tasks of this type executed on this task queue"), labels),
+            sm::make_gauge("task_type_max_runtime_us", [&st] {
+                return std::chrono::duration_cast<std::chrono::microseconds>(st._max_runtime).count();
+            }, sm::description("Longest execution of a task of this type on this task queue"), labels),
+        });
+    }
+    return *stats;
+}
+
+static_assert(memory::max_allocation_groups >= max_scheduling_groups(), "allocation groups must cover all scheduling groups");
+
 void reactor::run_tasks(task_queue& tq) {
     // Make sure new tasks will inherit our scheduling group
     *internal::current_scheduling_group_ptr() = scheduling_group(tq._id);
+    memory::set_allocation_group(tq._id);
     auto& tasks = tq._q;
     while (!tasks.empty()) {
         auto tsk = std::move(tasks.front());
         tasks.pop_front();
         STAP_PROBE(seastar, reactor_run_tasks_single_start);
-        tsk->run();
-        tsk.reset();
+        trace_event(event_trace_type::task_start, tq._id);
+        if (__builtin_expect(_task_accounting, false)) {
+            auto& stats = tq.get_task_type_stats(typeid(*tsk));
+            auto start = sched_clock::now();
+            tsk->run();
+            tsk.reset();
+            auto runtime = sched_clock::now() - start;
+            ++stats._tasks_processed;
+            stats._runtime += runtime;
+            stats._max_runtime = std::max(stats._max_runtime, runtime);
+        } else {
+            tsk->run();
+            tsk.reset();
+        }
         STAP_PROBE(seastar, reactor_run_tasks_single_end);
+        trace_event(event_trace_type::task_end, tq._id);
         ++tq._tasks_processed;
         // check at end of loop, to allow at least one task to run
         if (need_preempt() && tasks.size() <= _max_task_backlog) {
@@ -2443,6 +3703,26 @@ void reactor::force_poll() {
     g_need_preempt = true;
 }
 
+bool
+reactor::flush_foreign_disposals() {
+    if (_foreign_disposal_targets.empty()) {
+        return false;
+    }
+    for (auto cpu : _foreign_disposal_targets) {
+        auto& batch = _foreign_disposals[cpu];
+        _foreign_disposals_sent += batch.size();
+        ++_foreign_disposal_batches_sent;
+        smp::submit_to(cpu, [batch = std::move(batch)] {
+            for (auto& d : batch) {
+                d.dispose(d.object);
+            }
+        });
+        batch = {};
+    }
+    _foreign_disposal_targets.clear();
+    return true;
+}
+
 bool
 reactor::flush_tcp_batches() {
     bool work = _flush_batching.size();
@@ -2504,19 +3784,40 @@ reactor::do_check_lowres_timers() const {
 
 class reactor::io_pollfn final : public reactor::pollfn {
     reactor& _r;
+private:
+    // Applies func to all I/O queues, of all devices; returns whether it
+    // returned true for any of them
+    template <typename Func>
+    bool for_each_io_queue(Func func) {
+        bool ret = func(*_r._io_queue);
+        for (auto&& q : _r._device_io_queues) {
+            ret |= func(*q.second);
+        }
+        return ret;
+    }
 public:
     io_pollfn(reactor& r) : _r(r) {}
     virtual bool poll() override final {
-        return _r.process_io();
+        bool work = _r.process_io();
+        return for_each_io_queue([] (io_queue& q) { return q.poll_shared_capacity(); }) || work;
     }
     virtual bool pure_poll() override final {
-        return poll(); // actually performs work, but triggers no user continuations, so okay
+        // process_io() actually performs work, but triggers no user continuations, so okay
+        bool work = _r.process_io();
+        return for_each_io_queue([] (io_queue& q) { return q.can_poll_shared_capacity(); }) || work;
     }
     virtual bool try_enter_interrupt_mode() override {
+        // nothing wakes us up when another shard returns the capacity our
+        // queued requests wait for
+        if (for_each_io_queue([] (io_queue& q) { return q.waiting_for_shared_capacity(); })) {
+            return false;
+        }
         // aio cannot generate events if there are no inflight aios;
-        // but if we enabled _aio_eventfd, we can always enter
+        // but if we enabled _aio_eventfd, or the backend wakes up on
+        // storage completions, we can always enter
         return _r._io_context_available.current() == reactor::max_aio
-                || _r._aio_eventfd;
+                || _r._aio_eventfd
+                || _r._backend->storage_completions_wake_sleep();
     }
     virtual void exit_interrupt_mode() override {
         // nothing to do
@@ -2573,6 +3874,25 @@ class reactor::batch_flush_pollfn final : public reactor::pollfn {
     }
 };
 
+class reactor::foreign_disposal_pollfn final : public reactor::pollfn {
+    reactor& _r;
+public:
+    foreign_disposal_pollfn(reactor& r) : _r(r) {}
+    virtual bool poll() final override {
+        return _r.flush_foreign_disposals();
+    }
+    virtual bool pure_poll() override final {
+        return poll(); // actually performs work, but triggers no user continuations, so okay
+    }
+    virtual bool try_enter_interrupt_mode() override {
+        // Like batch_flush_pollfn, there's nothing to wait for once a
+        // poll found nothing queued.
+        return true;
+    }
+    virtual void exit_interrupt_mode() override final {
+    }
+};
+
 class reactor::aio_batch_submit_pollfn final : public reactor::pollfn {
     reactor& _r;
 public:
@@ -2595,7 +3915,10 @@ class reactor::aio_batch_submit_pollfn final : public reactor::pollfn {
 class reactor::drain_cross_cpu_freelist_pollfn final : public reactor::pollfn {
 public:
     virtual bool poll() final override {
-        return memory::drain_cross_cpu_freelist();
+        auto flushed = memory::flush_cross_cpu_frees();
+        auto drained = memory::drain_cross_cpu_freelist();
+        // frees may have relieved memory pressure
+        return memory::update_memory_pressure() || drained || flushed;
     }
     virtual bool pure_poll() override final {
         return poll(); // actually performs work, but triggers no user continuations, so okay
@@ -2606,6 +3929,9 @@ class reactor::drain_cross_cpu_freelist_pollfn final : public reactor::pollfn {
         // doesn't have any side effects.
         //
         // We'll take care of those items when we wake up for another reason.
+        // Hand over the frees batched for other cpus, though, so we don't sit
+        // on their memory while sleeping.
+        memory::flush_cross_cpu_frees();
         return true;
     }
     virtual void exit_interrupt_mode() override final {
@@ -2667,12 +3993,35 @@ class reactor::smp_pollfn final : public reactor::pollfn {
 public:
     smp_pollfn(reactor& r) : _r(r) {}
     virtual bool poll() final override {
-        return smp::poll_queues();
+        bool work = smp::poll_queues();
+        for (auto p : _r._remote_work_pollers) {
+            work |= p->poll();
+        }
+        _r.flush_wakeups();
+        return work;
     }
     virtual bool pure_poll() final override {
-        return smp::pure_poll_queues();
+        if (smp::pure_poll_queues()) {
+            return true;
+        }
+        for (auto p : _r._remote_work_pollers) {
+            if (p->pure_poll()) {
+                return true;
+            }
+        }
+        return false;
     }
     virtual bool try_enter_interrupt_mode() override {
+        if (_r._fenced_sleep) {
+            // pairs with the fence in maybe_wakeup()
+            _r._sleeping.store(true, std::memory_order_seq_cst);
+            if (poll()) {
+                // raced
+                _r._sleeping.store(false, std::memory_order_relaxed);
+                return false;
+            }
+            return true;
+        }
         // systemwide_memory_barrier() is very slow if run concurrently,
         // so don't go to sleep if it is running now.
         if (!_membarrier_lock.try_lock()) {
@@ -2763,6 +4112,14 @@ reactor::wakeup() {
     pthread_kill(_thread_id, alarm_signal());
 }
 
+void
+reactor::flush_wakeups() {
+    for (auto r : _pending_wakeups) {
+        r->wakeup();
+    }
+    _pending_wakeups.clear();
+}
+
 void reactor::start_aio_eventfd_loop() {
     if (!_aio_eventfd) {
         return;
@@ -2796,28 +4153,24 @@ reactor::have_more_tasks() const {
 
 void reactor::insert_active_task_queue(task_queue* tq) {
     tq->_active = true;
-    auto& atq = _active_task_queues;
-    auto less = task_queue::indirect_compare();
-    if (atq.empty() || less(atq.back(), tq)) {
-        // Common case: idle->working
-        // Common case: CPU intensive task queue going to the back
-        atq.push_back(tq);
-    } else {
-        // Common case: newly activated queue preempting everything else
-        atq.push_front(tq);
-        // Less common case: newly activated queue behind something already active
-        size_t i = 0;
-        while (i + 1 != atq.size() && !less(atq[i], atq[i+1])) {
-            std::swap(atq[i], atq[i+1]);
-            ++i;
-        }
-    }
+    _active_task_queues.push_back(tq);
+    std::push_heap(_active_task_queues.begin(), _active_task_queues.end(), task_queue::heap_compare());
+}
+
+reactor::task_queue*
+reactor::pop_active_task_queue() {
+    std::pop_heap(_active_task_queues.begin(), _active_task_queues.end(), task_queue::heap_compare());
+    auto tq = _active_task_queues.back();
+    _active_task_queues.pop_back();
+    tq->_boosted = false;
+    return tq;
 }
 
 void
 reactor::insert_activating_task_queues() {
-    // Quadratic, but since we expect the common cases in insert_active_task_queue() to dominate, faster
     for (auto&& tq : _activating_task_queues) {
+        // Latency-critical queues go ahead of everything, regardless of vruntime
+        tq->_boosted = tq->_latency_critical;
         insert_active_task_queue(tq);
     }
     _activating_task_queues.clear();
@@ -2834,19 +4187,29 @@ reactor::run_some_tasks(sched_clock::time_point& t_run_completed) {
     do {
         auto t_run_started = t_run_completed;
         insert_activating_task_queues();
-        auto tq = _active_task_queues.front();
-        _active_task_queues.pop_front();
+        auto tq = pop_active_task_queue();
         sched_print("running tq {} {}", (void*)tq, tq->_name);
+        if (tq->_ready_since != sched_clock::time_point()) {
+            t_run_started = sched_clock::now();
+            tq->_wait_time.add(t_run_started - tq->_ready_since);
+            tq->_ready_since = {};
+        }
         tq->_current = true;
         run_tasks(*tq);
         tq->_current = false;
-        t_run_completed = std::chrono::steady_clock::now();
+        t_run_completed = sched_clock::now();
         auto delta = t_run_completed - t_run_started;
         account_runtime(*tq, delta);
+        if (delta > _task_quota) {
+            ++tq->_task_quota_violations;
+        }
         _last_vruntime = std::max(tq->_vruntime, _last_vruntime);
         sched_print("run complete ({} {}); time consumed {} usec; final vruntime {} empty {}",
                 (void*)tq, tq->_name, delta / 1us, tq->_vruntime, tq->_q.empty());
-        if (!tq->_q.empty()) {
+        if (maybe_throttle(*tq, delta, t_run_completed)) {
+            // parked until its next bandwidth period
+        } else if (!tq->_q.empty()) {
+            tq->_ready_since = t_run_completed;
             insert_active_task_queue(tq);
         } else {
             tq->_active = false;
@@ -2854,6 +4217,7 @@ reactor::run_some_tasks(sched_clock::time_point& t_run_completed) {
     } while (have_more_tasks() && !need_preempt());
     STAP_PROBE(seastar, reactor_run_tasks_end);
     *internal::current_scheduling_group_ptr() = default_scheduling_group(); // Prevent inheritance from last group run
+    memory::set_allocation_group(0);
     sched_print("run_some_tasks: end");
 }
 
@@ -2875,6 +4239,15 @@ reactor::activate(task_queue& tq) {
     }
     tq._vruntime = std::max(_last_vruntime - advantage, tq._vruntime);
     _activating_task_queues.push_back(&tq);
+    // Sample the wakeup latency; a clock read per activation would be
+    // noticeable for I/O bound groups.
+    if (++tq._activations % 16 == 0) {
+        tq._ready_since = sched_clock::now();
+    }
+    if (tq._latency_critical) {
+        // Have whatever is running yield at its next preemption check
+        g_need_preempt = true;
+    }
 }
 
 int reactor::run() {
@@ -2923,8 +4296,10 @@ int reactor::run() {
 
     // Register smp queues poller
     std::experimental::optional<poller> smp_poller;
+    std::experimental::optional<poller> foreign_disposal_poller;
     if (smp::count > 1) {
         smp_poller = poller(std::make_unique<smp_pollfn>(*this));
+        foreign_disposal_poller = poller(std::make_unique<foreign_disposal_pollfn>(*this));
     }
 
     poller syscall_poller(std::make_unique<syscall_pollfn>(*this));
@@ -2939,6 +4314,8 @@ int reactor::run() {
 #endif
 
     poller drain_cross_cpu_freelist(std::make_unique<drain_cross_cpu_freelist_pollfn>());
+    memory::set_cross_cpu_free_batching(true);
+    auto stop_cross_cpu_free_batching = defer([] { memory::set_cross_cpu_free_batching(false); });
 
     poller expire_lowres_timers(std::make_unique<lowres_timer_pollfn>(*this));
 
@@ -2972,19 +4349,40 @@ int reactor::run() {
     auto r = sigaction(block_notifier_signal(), &sa_block_notifier, nullptr);
     assert(r == 0);
 
+    if (_cpu_profiler_frequency) {
+        struct sigaction sa_cpu_profiler = {};
+        sa_cpu_profiler.sa_handler = &reactor::cpu_profiler_signal_handler;
+        sa_cpu_profiler.sa_flags = SA_RESTART;
+        r = sigaction(cpu_profiler::signal_number(), &sa_cpu_profiler, nullptr);
+        assert(r == 0);
+        _cpu_profiler = std::make_unique<cpu_profiler>(std::chrono::nanoseconds(1s) / _cpu_profiler_frequency, 1024);
+    }
+    if (_event_trace_size) {
+        _event_trace = std::make_unique<event_trace>(_id, _event_trace_size, _event_trace_stall_dump);
+    }
+
     bool idle = false;
 
     std::function<bool()> check_for_work = [this] () {
-        return poll_once() || have_more_tasks() || seastar::thread::try_run_one_yielded_thread();
+        return poll_once() || have_more_tasks() || seastar::thread::try_run_one_yielded_thread()
+                || (_work_stealing && steal_task());
     };
     std::function<bool()> pure_check_for_work = [this] () {
         return pure_poll_once() || have_more_tasks() || seastar::thread::try_run_one_yielded_thread();
     };
     auto t_run_completed = idle_end;
+    // Every so many loop iterations are timed; those that go to sleep
+    // are not recorded.
+    unsigned iteration = 0;
     while (true) {
+        bool sample_iteration = ++iteration % 64 == 0;
+        auto iteration_start = sample_iteration ? sched_clock::now() : sched_clock::time_point();
         run_some_tasks(t_run_completed);
         if (_stopped) {
             load_timer.cancel();
+            // Don't leave tasks of throttled queues behind
+            unthrottle_task_queues(true);
+            flush_foreign_disposals();
             // Final tasks may include sending the last response to cpu 0, so run them
             while (have_more_tasks()) {
                 run_some_tasks(t_run_completed);
@@ -3005,6 +4403,10 @@ int reactor::run() {
             if (idle) {
                 _total_idle += idle_end - idle_start;
                 account_idle(idle_end - idle_start);
+                if (_adaptive_poll_time) {
+                    _adaptive_poll_time->record_idle_period(idle_end - idle_start);
+                    _max_poll_time = _adaptive_poll_time->poll_time();
+                }
                 idle_start = idle_end;
                 idle = false;
             }
@@ -3025,12 +4427,17 @@ int reactor::run() {
                 report_exception("Exception while running idle cpu handler", std::current_exception());
             }
             if (go_to_sleep) {
-                internal::cpu_relax();
+                if (_adaptive_poll_time) {
+                    internal::idle_relax();
+                } else {
+                    internal::cpu_relax();
+                }
                 if (idle_end - idle_start > _max_poll_time) {
                     // Turn off the task quota timer to avoid spurious wakeups
                     struct itimerspec zero_itimerspec = {};
                     _task_quota_timer.timerfd_settime(0, zero_itimerspec);
                     auto start_sleep = sched_clock::now();
+                    sample_iteration = false;
                     sleep();
                     // We may have slept for a while, so freshen idle_end
                     idle_end = sched_clock::now();
@@ -3044,12 +4451,16 @@ int reactor::run() {
             }
             t_run_completed = idle_end;
         }
+        if (sample_iteration) {
+            _poll_iteration_time.add(sched_clock::now() - iteration_start);
+        }
     }
     // To prevent ordering issues from rising, destroy the I/O queue explicitly at this point.
     // This is needed because the reactor is destroyed from the thread_local destructors. If
     // the I/O queue happens to use any other infrastructure that is also kept this way (for
     // instance, collectd), we will not have any way to guarantee who is destroyed first.
     my_io_queue.reset(nullptr);
+    my_device_io_queues.clear();
     return _return;
 }
 
@@ -3080,6 +4491,17 @@ reactor::start_epoll() {
 bool
 reactor::poll_once() {
     bool work = false;
+    if (__builtin_expect(bool(_event_trace), false)) {
+        uint32_t i = 0;
+        for (auto c : _pollers) {
+            if (c->poll()) {
+                _event_trace->record(event_trace_type::poll, 0, i);
+                work = true;
+            }
+            ++i;
+        }
+        return work;
+    }
     for (auto c : _pollers) {
         work |= c->poll();
     }
@@ -3087,6 +4509,42 @@ reactor::poll_once() {
     return work;
 }
 
+void
+reactor::add_stealable_task(std::unique_ptr<stealable_task> t) {
+    auto sg = t->group();
+    _stealable_tasks.push(t.release());
+    // Each submission schedules one attempt to run a task locally; it finds
+    // nothing if an idle shard got there first.
+    schedule(make_task(sg, [this] {
+        if (auto t = _stealable_tasks.pop_newest()) {
+            ++_stealable_tasks_run;
+            t->run();
+            t->complete();
+        }
+    }));
+}
+
+bool
+reactor::steal_task() {
+    for (unsigned i = 1; i < smp::count; ++i) {
+        auto victim = smp::_reactors[(_id + i) % smp::count];
+        if (!victim->_stealable_tasks.size()) {
+            continue;
+        }
+        if (auto t = victim->_stealable_tasks.pop_oldest()) {
+            ++_stealable_tasks_stolen;
+            schedule(make_task(t->group(), [t] {
+                t->run();
+                smp::submit_to(t->origin(), [t] {
+                    t->complete();
+                });
+            }));
+            return true;
+        }
+    }
+    return false;
+}
+
 bool
 reactor::pure_poll_once() {
     for (auto c : _pollers) {
@@ -3221,6 +4679,7 @@ syscall_work_queue::syscall_work_queue()
 }
 
 void syscall_work_queue::submit_item(std::unique_ptr<syscall_work_queue::work_item> item) {
+    ++_in_flight;
     _queue_has_room.wait().then([this, item = std::move(item)] () mutable {
         _pending.push(item.release());
         _start_eventfd.signal(1);
@@ -3235,17 +4694,35 @@ unsigned syscall_work_queue::complete() {
     });
     for (auto p = tmp_buf.data(); p != end; ++p) {
         auto wi = *p;
+        _total_wait_time += wi->_started - wi->_submitted;
         wi->complete();
         delete wi;
     }
+    _in_flight -= nr;
+    _operations += nr;
     _queue_has_room.signal(nr);
     return nr;
 }
 
-smp_message_queue::smp_message_queue(reactor* from, reactor* to)
+static size_t smp_batch_size(smp_message_queue::link l) {
+    switch (l) {
+    case smp_message_queue::link::smt_siblings: return 1;
+    case smp_message_queue::link::same_node: return 16;
+    case smp_message_queue::link::remote_node: return 32;
+    }
+    abort();
+}
+
+smp_message_queue::smp_message_queue(reactor* from, reactor* to, link l)
     : _pending(to)
     , _completed(from)
 {
+    _send_batch_size = smp_batch_size(l);
+    _respond_batch_size = smp_batch_size(l);
+    // Cross-node cache line transfers are expensive, so give partial
+    // batches one more poll to fill up; pure_poll_queues() still flushes
+    // everything before the reactor goes to sleep.
+    _flush_deferral = l == link::remote_node ? 1 : 0;
 }
 
 void smp_message_queue::stop() {
@@ -3261,6 +4738,7 @@ void smp_message_queue::move_pending() {
     auto nr = end - begin;
     _pending.maybe_wakeup();
     _tx.a.pending_fifo.erase(begin, end);
+    _deferred_polls = 0;
     _current_queue_length += nr;
     _last_snt_batch = nr;
     _sent += nr;
@@ -3272,17 +4750,19 @@ bool smp_message_queue::pure_poll_tx() const {
     return !const_cast<lf_queue&>(_completed).empty();
 }
 
-void smp_message_queue::submit_item(std::unique_ptr<smp_message_queue::work_item> item) {
-    _tx.a.pending_fifo.push_back(item.get());
-    item.release();
-    if (_tx.a.pending_fifo.size() >= batch_size) {
+void smp_message_queue::submit_item(smp_message_queue::work_item* item) {
+    item->_submit_time = steady_clock_type::now();
+    item->_trace = tracing::current();
+    engine().trace_event(event_trace_type::smp_send, 0, _pending.remote->cpu_id());
+    _tx.a.pending_fifo.push_back(item);
+    if (_tx.a.pending_fifo.size() >= _send_batch_size) {
         move_pending();
     }
 }
 
 void smp_message_queue::respond(work_item* item) {
     _completed_fifo.push_back(item);
-    if (_completed_fifo.size() >= batch_size || engine()._stopped) {
+    if (_completed_fifo.size() >= _respond_batch_size || engine()._stopped) {
         flush_response_batch();
     }
 }
@@ -3313,17 +4793,44 @@ bool smp_message_queue::pure_poll_rx() const {
 void
 smp_message_queue::lf_queue::maybe_wakeup() {
     // Called after lf_queue_base::push().
-    //
-    // This is read-after-write, which wants memory_order_seq_cst,
-    // but we insert that barrier using systemwide_memory_barrier()
-    // because seq_cst is so expensive.
+    remote->maybe_wakeup();
+}
+
+void reactor::register_remote_work_poller(remote_work_poller& p) {
+    _remote_work_pollers.push_back(&p);
+}
+
+void reactor::unregister_remote_work_poller(remote_work_poller& p) {
+    _remote_work_pollers.erase(std::remove(_remote_work_pollers.begin(), _remote_work_pollers.end(), &p),
+            _remote_work_pollers.end());
+}
+
+void
+reactor::maybe_wakeup() {
+    // Called after making work visible to this reactor.
+    if (_fenced_sleep) {
+        // pairs with the store in smp_pollfn::try_enter_interrupt_mode()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // of the shards that find it asleep, only one wakes it
+        if (_sleeping.load(std::memory_order_relaxed) && _sleeping.exchange(false, std::memory_order_relaxed)) {
+            if (local_engine) {
+                local_engine->_pending_wakeups.push_back(this);
+            } else {
+                wakeup();
+            }
+        }
+        return;
+    }
+    // This is read-after-write, which wants memory_order_seq_cst,
+    // but we insert that barrier using systemwide_memory_barrier()
+    // because seq_cst is so expensive.
     //
     // However, we do need a compiler barrier:
     std::atomic_signal_fence(std::memory_order_seq_cst);
-    if (remote->_sleeping.load(std::memory_order_relaxed)) {
+    if (_sleeping.load(std::memory_order_relaxed)) {
         // We are free to clear it, because we're sending a signal now
-        remote->_sleeping.store(false, std::memory_order_relaxed);
-        remote->wakeup();
+        _sleeping.store(false, std::memory_order_relaxed);
+        wakeup();
     }
 }
 
@@ -3351,9 +4858,11 @@ size_t smp_message_queue::process_queue(lf_queue& q, Func process) {
 }
 
 size_t smp_message_queue::process_completions() {
-    auto nr = process_queue<prefetch_cnt*2>(_completed, [] (work_item* wi) {
+    auto now = steady_clock_type::now();
+    auto nr = process_queue<prefetch_cnt*2>(_completed, [this, now] (work_item* wi) {
+        _total_completion_latency_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(now - wi->_submit_time).count();
         wi->complete();
-        delete wi;
+        destroy_work_item(wi);
     });
     _current_queue_length -= nr;
     _compl += nr;
@@ -3362,14 +4871,35 @@ size_t smp_message_queue::process_completions() {
     return nr;
 }
 
+void smp_message_queue::destroy_work_item(work_item* wi) {
+    auto& tx = _tx.a;
+    // an item constructed in a slot lives at the slot's address
+    auto slot = reinterpret_cast<work_item_slot*>(wi);
+    std::less<const work_item_slot*> less;
+    if (!less(slot, tx.slots.get()) && less(slot, tx.slots.get() + queue_length)) {
+        wi->~work_item();
+        tx.free_slots.push_back(slot);
+    } else {
+        delete wi;
+    }
+}
+
 void smp_message_queue::flush_request_batch() {
     if (!_tx.a.pending_fifo.empty()) {
         move_pending();
     }
 }
 
+void smp_message_queue::poll_request_batch() {
+    if (!_tx.a.pending_fifo.empty() && _deferred_polls++ >= _flush_deferral) {
+        move_pending();
+    }
+}
+
 size_t smp_message_queue::process_incoming() {
     auto nr = process_queue<prefetch_cnt>(_pending, [this] (work_item* wi) {
+        tracing::context_scope trace(wi->_trace);
+        engine().trace_event(event_trace_type::smp_receive, 0, _completed.remote->cpu_id());
         wi->process().then([this, wi] {
             respond(wi);
         });
@@ -3396,17 +4926,63 @@ void smp_message_queue::start(unsigned cpuid) {
             // total_operations value:DERIVE:0:U
             sm::make_derive("total_sent_messages", _sent, sm::description("Total number of sent messages"), {sm::shard_label(instance)})(sm::metric_disabled),
             // total_operations value:DERIVE:0:U
-            sm::make_derive("total_completed_messages", _compl, sm::description("Total number of messages completed"), {sm::shard_label(instance)})(sm::metric_disabled)
+            sm::make_derive("total_completed_messages", _compl, sm::description("Total number of messages completed"), {sm::shard_label(instance)})(sm::metric_disabled),
+            // total_time_in_ns value:DERIVE:0:U
+            sm::make_derive("total_completion_latency_ns", _total_completion_latency_ns,
+                    sm::description("Total time, in nanoseconds, between submitting messages and processing their completion; divide by total_completed_messages for the average round trip latency"),
+                    {sm::shard_label(instance)})(sm::metric_disabled)
     });
 }
 
 /* not yet implemented for OSv. TODO: do the notification like we do class smp. */
 #ifndef HAVE_OSV
-thread_pool::thread_pool(sstring name) : _worker_thread([this, name] { work(name); }), _notify(pthread_self()) {
-    engine()._signals.handle_signal(SIGUSR1, [this] { inter_thread_wq.complete(); });
+thread_pool::worker::worker(thread_pool& pool, sstring name)
+        : thread([this, &pool, name] { pool.work(wq, name); }) {
+}
+
+thread_pool::thread_pool(sstring name, thread_pool_config cfg) : _notify(pthread_self()) {
+    for (unsigned i = 0; i < cfg.metadata_threads; ++i) {
+        _lanes[unsigned(syscall_lane::metadata)].push_back(std::make_unique<worker>(*this, i ? seastar::format("{}-{}", name, i) : name));
+    }
+    for (unsigned i = 0; i < cfg.sync_threads; ++i) {
+        _lanes[unsigned(syscall_lane::sync)].push_back(std::make_unique<worker>(*this, seastar::format("{}-sync{}", name, i)));
+    }
+    engine()._signals.handle_signal(SIGUSR1, [this] { complete(); });
+}
+
+unsigned thread_pool::complete() {
+    unsigned nr = 0;
+    for (auto& lane : _lanes) {
+        for (auto& w : lane) {
+            nr += w->wq.complete();
+        }
+    }
+    return nr;
 }
 
-void thread_pool::work(sstring name) {
+thread_pool::worker& thread_pool::pick_worker(syscall_lane lane) {
+    auto& workers = _lanes[unsigned(lane)];
+    if (workers.empty()) {
+        // no dedicated threads for this lane, share the metadata ones
+        return pick_worker(syscall_lane::metadata);
+    }
+    auto it = std::min_element(workers.begin(), workers.end(), [] (const std::unique_ptr<worker>& a, const std::unique_ptr<worker>& b) {
+        return a->wq._in_flight < b->wq._in_flight;
+    });
+    return **it;
+}
+
+thread_pool::lane_stats thread_pool::stats(syscall_lane lane) const {
+    lane_stats ret;
+    for (auto& w : _lanes[unsigned(lane)]) {
+        ret.operations += w->wq._operations;
+        ret.queue_length += w->wq._in_flight;
+        ret.total_wait_time += w->wq._total_wait_time;
+    }
+    return ret;
+}
+
+void thread_pool::work(syscall_work_queue& inter_thread_wq, sstring name) {
     pthread_setname_np(pthread_self(), name.c_str());
     sigset_t mask;
     sigfillset(&mask);
@@ -3426,6 +5002,7 @@ void thread_pool::work(sstring name) {
         });
         for (auto p = tmp_buf.data(); p != end; ++p) {
             auto wi = *p;
+            wi->_started = std::chrono::steady_clock::now();
             wi->process();
             inter_thread_wq._completed.push(wi);
         }
@@ -3437,8 +5014,12 @@ void thread_pool::work(sstring name) {
 
 thread_pool::~thread_pool() {
     _stopped.store(true, std::memory_order_relaxed);
-    inter_thread_wq._start_eventfd.signal(1);
-    _worker_thread.join();
+    for (auto& lane : _lanes) {
+        for (auto& w : lane) {
+            w->wq._start_eventfd.signal(1);
+            w->thread.join();
+        }
+    }
 }
 #endif
 
@@ -3533,11 +5114,18 @@ network_stack_registrator::network_stack_registrator(sstring name,
     network_stack_registry::register_stack(name, opts, factory, make_default);
 }
 
+#ifdef SEASTAR_THREAD_STACK_GUARDS
+static constexpr bool thread_stack_guard_pages_default = true;
+#else
+static constexpr bool thread_stack_guard_pages_default = false;
+#endif
+
 boost::program_options::options_description
 reactor::get_options_description(std::chrono::duration<double> default_task_quota) {
     namespace bpo = boost::program_options;
     bpo::options_description opts("Core options");
     auto net_stack_names = network_stack_registry::list();
+    auto backend_names = reactor_backend_config::available();
     opts.add_options()
         ("network-stack", bpo::value<std::string>(),
                 sprint("select network stack (valid values: %s)",
@@ -3546,18 +5134,48 @@ reactor::get_options_description(std::chrono::duration<double> default_task_quot
         ("poll-mode", "poll continuously (100% cpu use)")
         ("idle-poll-time-us", bpo::value<unsigned>()->default_value(calculate_poll_time() / 1us),
                 "idle polling time in microseconds (reduce for overprovisioned environments or laptops)")
+        ("sleep-protocol", bpo::value<std::string>()->default_value("membarrier"),
+                "how a shard going to sleep synchronizes with the shards handing it work: membarrier (a systemwide memory barrier "
+                "each time it goes to sleep) or fence (a memory fence per hand-off, with the wakeups of each poll sent together)")
+        ("adaptive-poll", "choose the idle polling time from the observed distribution of idle periods, treating --idle-poll-time-us as the cost of sleeping (ignored with --poll-mode)")
         ("poll-aio", bpo::value<bool>()->default_value(true),
                 "busy-poll for disk I/O (reduces latency and increases throughput)")
+        ("reactor-backend", bpo::value<std::string>()->default_value("epoll"),
+                sprint("internal reactor implementation (valid values: %s)",
+                        format_separated(backend_names.begin(), backend_names.end(), ", ")).c_str())
+#ifdef HAVE_LIBURING
+        ("io-uring-sqpoll", "poll the io_uring submission queue from a kernel thread, avoiding io_uring_enter() calls (io_uring backend only)")
+#endif
         ("task-quota-ms", bpo::value<double>()->default_value(default_task_quota / 1ms), "Max time (ms) between polls")
         ("max-task-backlog", bpo::value<unsigned>()->default_value(1000), "Maximum number of task backlog to allow; above this we ignore I/O")
         ("blocked-reactor-notify-ms", bpo::value<unsigned>()->default_value(2000), "threshold in miliseconds over which the reactor is considered blocked if no progress is made")
         ("blocked-reactor-reports-per-minute", bpo::value<unsigned>()->default_value(5), "Maximum number of backtraces reported by stall detector per minute")
+        ("thread-stack-guard-pages", bpo::value<bool>()->default_value(thread_stack_guard_pages_default),
+                "protect the bottom page of seastar::thread stacks to catch stack overflows")
+        ("thread-stack-cache", bpo::value<unsigned>()->default_value(64), "Number of free seastar::thread stacks kept per shard for reuse")
+        ("task-accounting", "account runtime per task type (continuation lambda type) and export it via metrics")
+        ("memory-group-accounting", "account memory allocated per scheduling group and export it via metrics")
+        ("work-stealing", bpo::value<bool>()->default_value(true), "let idle shards run functions submitted with smp::submit_stealable() on other shards")
+        ("cpu-profiler-frequency", bpo::value<unsigned>()->default_value(0), "Number of backtraces sampled per second of reactor CPU time (0 to disable the CPU profiler)")
+        ("event-trace-size", bpo::value<unsigned>()->default_value(0), "Number of the latest reactor events (task runs, polls, I/O, smp messages, timers) kept per shard for latency debugging, rounded up to a power of two (0 to disable the event trace)")
+        ("event-trace-stall-dump", bpo::value<std::string>(), "Dump the event trace to this path, suffixed with -<shard>, when the stall detector fires")
         ("relaxed-dma", "allow using buffered I/O if DMA is not available (reduces performance)")
+        ("syscall-threads", bpo::value<unsigned>()->default_value(1), "Number of threads per shard running blocking file metadata syscalls (open, stat, rename, ...)")
+        ("syscall-sync-threads", bpo::value<unsigned>()->default_value(1), "Number of threads per shard running fdatasync(), fallocate() and ftruncate(), so they don't delay metadata syscalls (0 to share the metadata threads)")
         ("unsafe-bypass-fsync", bpo::value<bool>()->default_value(false), "Bypass fsync(), may result in data loss. Use for testing on consumer drives")
+        ("aio-fdsync", bpo::value<bool>()->default_value(true), "Submit fdatasync() through the storage I/O backend (AIO or io_uring) rather than "
+                "running it on a syscall thread, where the kernel and filesystem support it")
+        ("discard-bandwidth", bpo::value<std::string>(), "cap the bandwidth of the discards of files opened with batched discards (ex: 100M), "
+                "per device; unlimited by default")
+        ("discard-defer", bpo::value<unsigned>()->default_value(0), "Milliseconds without other disk I/O on the shard that batched discards "
+                "wait for before they are issued, for up to 10 seconds (0 not to defer them)")
+        ("dma-buffer-pool-memory", bpo::value<std::string>(), "Memory each shard may keep in free DMA buffers of the standard sizes, for "
+                "reuse by file reads and writes (ex: 16M); by default 1/64 of the shard's memory, up to 32M")
         ("overprovisioned", "run in an overprovisioned environment (such as docker or a laptop); equivalent to --idle-poll-time-us 0 --thread-affinity 0 --poll-aio 0")
         ("abort-on-seastar-bad-alloc", "abort when seastar allocator cannot allocate memory")
 #ifdef SEASTAR_HEAPPROF
         ("heapprof", "enable seastar heap profiling")
+        ("heapprof-sample-interval", bpo::value<size_t>()->default_value(0), "profile one allocation every so many bytes allocated, on average (0: profile all allocations)")
 #endif
         ;
     opts.add(network_stack_registry::options_description());
@@ -3577,13 +5195,32 @@ smp::get_options_description()
         ("hugepages", bpo::value<std::string>(), "path to accessible hugetlbfs mount (typically /dev/hugepages/something)")
         ("lock-memory", bpo::value<bool>(), "lock all memory (prevents swapping)")
         ("thread-affinity", bpo::value<bool>()->default_value(true), "pin threads to their cpus (disable for overprovisioning)")
+        ("cpu-placement", bpo::value<std::string>()->default_value("spread"), "how shard ids are mapped onto cpus: spread (hwloc's distribution), "
+                "ccx-dense (neighbouring shards share an L3 cache domain, then a core) or smt-avoid (neighbouring shards share an L3 cache domain "
+                "but not a core)")
 #ifdef HAVE_HWLOC
         ("num-io-queues", bpo::value<unsigned>(), "Number of IO queues. Each IO unit will be responsible for a fraction of the IO requests. Defaults to the number of threads")
         ("max-io-requests", bpo::value<unsigned>(), "Maximum amount of concurrent requests to be sent to the disk. Defaults to 128 times the number of IO queues")
 #else
         ("max-io-requests", bpo::value<unsigned>(), "Maximum amount of concurrent requests to be sent to the disk. Defaults to 128 times the number of processors")
 #endif
+        ("read-iops", bpo::value<unsigned>(), "Random 4k read operations per second the disk sustains, as measured by iotune; enables the I/O cost model")
+        ("write-iops", bpo::value<unsigned>(), "Random 4k write operations per second the disk sustains, as measured by iotune")
+        ("dsync-write-iops", bpo::value<unsigned>(), "Random 4k O_DSYNC write operations per second the disk sustains; twice the cost of a write if not given")
+        ("read-bandwidth", bpo::value<std::string>(), "Sequential read bandwidth of the disk, in bytes per second (ex: 2G), as measured by iotune; enables the I/O cost model")
+        ("write-bandwidth", bpo::value<std::string>(), "Sequential write bandwidth of the disk, in bytes per second (ex: 1G), as measured by iotune")
+        ("io-latency-goal-ms", bpo::value<double>()->default_value(0.75), "Latency the I/O cost model aims to keep requests at, by limiting how much of the disk's capacity is in flight")
+        ("io-device", bpo::value<std::vector<std::string>>(), "give the I/O device mounted at MOUNTPOINT I/O queues of its own, "
+                "with the given properties (as measured by iotune), in the form MOUNTPOINT[:property=value,...], where the properties "
+                "are max-io-requests, read-iops, write-iops, read-bandwidth, write-bandwidth and max-request-size (by default, "
+                "the device's max_sectors_kb); may be repeated")
+        ("io-max-request-size", bpo::value<std::string>(), "split reads larger than this (ex: 128k) into requests of this size, "
+                "queued separately, so that large reads don't monopolize the disk; by default reads are kept whole")
+        ("decentralized-io", bpo::value<bool>()->default_value(false), "dispatch I/O from every shard directly, sharing each I/O queue's capacity between its shards "
+                "through atomic counters, instead of forwarding it to the I/O queue's coordinator shard")
         ("mbind", bpo::value<bool>()->default_value(true), "enable mbind")
+        ("populate-memory", bpo::value<bool>()->default_value(false), "fault in the shards' memory at startup, all shards at once, "
+                "rather than as it is first used")
 #ifndef NO_EXCEPTION_HACK
         ("enable-glibc-exception-scaling-workaround", bpo::value<bool>()->default_value(true), "enable workaround for glibc/gcc c++ exception scalablity problem")
 #endif
@@ -3610,6 +5247,8 @@ std::vector<posix_thread> smp::_threads;
 std::vector<std::function<void ()>> smp::_thread_loops;
 std::experimental::optional<boost::barrier> smp::_all_event_loops_done;
 std::vector<reactor*> smp::_reactors;
+std::vector<unsigned> smp::_numa_nodes;
+std::vector<unsigned> smp::_cache_domains;
 smp_message_queue** smp::_qs;
 std::thread::id smp::_tmain;
 unsigned smp::count = 1;
@@ -3661,8 +5300,9 @@ void smp::arrive_at_event_loop_end() {
     }
 }
 
-void smp::allocate_reactor(unsigned id) {
+void smp::allocate_reactor(unsigned id, reactor_backend_config backend_cfg, thread_pool_config thread_pool_cfg) {
     assert(!reactor_holder);
+    tsc_clock::calibrate();
 
     // we cannot just write "local_engin = new reactor" since reactor's constructor
     // uses local_engine
@@ -3670,7 +5310,7 @@ void smp::allocate_reactor(unsigned id) {
     int r = posix_memalign(&buf, cache_line_size, sizeof(reactor));
     assert(r == 0);
     local_engine = reinterpret_cast<reactor*>(buf);
-    new (buf) reactor(id);
+    new (buf) reactor(id, std::move(backend_cfg), thread_pool_cfg);
     reactor_holder.reset(local_engine);
 }
 
@@ -3730,8 +5370,158 @@ static void sigabrt_action() noexcept {
     print_with_backtrace("Aborting");
 }
 
+static smp_message_queue::link smp_link(const resource::cpu& a, const resource::cpu& b) {
+    if (a.nodeid != b.nodeid) {
+        return smp_message_queue::link::remote_node;
+    } else if (a.core_id == b.core_id) {
+        return smp_message_queue::link::smt_siblings;
+    }
+    return smp_message_queue::link::same_node;
+}
+
+// Properties of an I/O device, as measured by iotune
+struct io_device_properties {
+    sstring mountpoint = "undefined";
+    dev_t device_id = 0;
+    // zero when unknown
+    unsigned max_io_requests = 0;
+    unsigned read_iops = 0;
+    unsigned write_iops = 0;
+    // of writes to files opened with O_DSYNC
+    unsigned dsync_write_iops = 0;
+    uint64_t read_bandwidth = 0;
+    uint64_t write_bandwidth = 0;
+    size_t max_request_size = 0;
+};
+
+// The largest request the device takes whole, as the block layer would
+// split larger ones anyway; 0 when unknown
+static size_t device_max_request_size(dev_t dev) {
+    // partitions have no queue of their own; their disk's is one level up
+    for (auto queue : { "queue", "../queue" }) {
+        auto path = format("/sys/dev/block/{}:{}/{}/max_sectors_kb", major(dev), minor(dev), queue);
+        std::ifstream in(path);
+        size_t kb;
+        if (in >> kb) {
+            return kb * 1024;
+        }
+    }
+    return 0;
+}
+
+// Parses --io-device's MOUNTPOINT:key=value[,key=value...]
+static io_device_properties parse_io_device(const std::string& spec) {
+    io_device_properties dev;
+    auto colon = spec.find(':');
+    dev.mountpoint = spec.substr(0, colon);
+    struct ::stat st;
+    if (::stat(dev.mountpoint.c_str(), &st) == -1) {
+        throw std::invalid_argument(format("cannot stat I/O device mountpoint {}: {}", dev.mountpoint, strerror(errno)));
+    }
+    dev.device_id = st.st_dev;
+    if (colon == std::string::npos) {
+        return dev;
+    }
+    std::vector<std::string> properties;
+    auto rest = spec.substr(colon + 1);
+    boost::split(properties, rest, boost::is_any_of(","));
+    for (auto&& property : properties) {
+        auto eq = property.find('=');
+        if (eq == std::string::npos) {
+            throw std::invalid_argument(format("bad I/O device property {} (expected key=value)", property));
+        }
+        auto key = property.substr(0, eq);
+        auto value = property.substr(eq + 1);
+        if (key == "max-io-requests") {
+            dev.max_io_requests = boost::lexical_cast<unsigned>(value);
+        } else if (key == "read-iops") {
+            dev.read_iops = boost::lexical_cast<unsigned>(value);
+        } else if (key == "write-iops") {
+            dev.write_iops = boost::lexical_cast<unsigned>(value);
+        } else if (key == "dsync-write-iops") {
+            dev.dsync_write_iops = boost::lexical_cast<unsigned>(value);
+        } else if (key == "read-bandwidth") {
+            dev.read_bandwidth = parse_memory_size(value);
+        } else if (key == "write-bandwidth") {
+            dev.write_bandwidth = parse_memory_size(value);
+        } else if (key == "max-request-size") {
+            dev.max_request_size = parse_memory_size(value);
+        } else {
+            throw std::invalid_argument(format("unknown I/O device property {} (valid properties: max-io-requests, "
+                    "read-iops, write-iops, dsync-write-iops, read-bandwidth, write-bandwidth, max-request-size)", key));
+        }
+    }
+    if (!dev.max_request_size) {
+        dev.max_request_size = device_max_request_size(dev.device_id);
+    }
+    return dev;
+}
+
+// Properties of the devices not configured with --io-device
+static io_device_properties default_io_device(const boost::program_options::variables_map& configuration) {
+    io_device_properties dev;
+    if (configuration.count("read-iops")) {
+        dev.read_iops = configuration["read-iops"].as<unsigned>();
+    }
+    if (configuration.count("write-iops")) {
+        dev.write_iops = configuration["write-iops"].as<unsigned>();
+    }
+    if (configuration.count("dsync-write-iops")) {
+        dev.dsync_write_iops = configuration["dsync-write-iops"].as<unsigned>();
+    }
+    if (configuration.count("read-bandwidth")) {
+        dev.read_bandwidth = parse_memory_size(configuration["read-bandwidth"].as<std::string>());
+    }
+    if (configuration.count("write-bandwidth")) {
+        dev.write_bandwidth = parse_memory_size(configuration["write-bandwidth"].as<std::string>());
+    }
+    if (configuration.count("io-max-request-size")) {
+        dev.max_request_size = parse_memory_size(configuration["io-max-request-size"].as<std::string>());
+    }
+    return dev;
+}
+
+// Derives the disk cost model of each I/O queue from the disk's measured
+// capabilities; reads are the unit of cost.
+static io_queue::config disk_cost_model_config(const io_device_properties& dev, double latency_goal, unsigned nr_io_queues) {
+    io_queue::config cfg;
+    cfg.mountpoint = dev.mountpoint;
+    cfg.max_request_size = dev.max_request_size;
+    if (!dev.read_iops && !dev.read_bandwidth) {
+        return cfg;
+    }
+    cfg.disk_cost_model = true;
+    // Disk capacity is split between the I/O queues; each keeps enough in
+    // flight to saturate its part of the disk, but not more, to not exceed
+    // the latency goal.
+    auto limit = [nr_io_queues] (double per_second, double latency_goal, double unit) {
+        auto v = std::max(per_second * latency_goal / nr_io_queues, 1.0) * unit;
+        return unsigned(std::min(v, double(std::numeric_limits<int>::max())));
+    };
+    if (dev.read_iops) {
+        cfg.max_req_count = limit(dev.read_iops, latency_goal, io_queue::read_request_base_count);
+        if (dev.write_iops) {
+            cfg.disk_req_write_to_read_multiplier = io_queue::read_request_base_count * double(dev.read_iops) / dev.write_iops;
+        }
+        if (dev.dsync_write_iops) {
+            cfg.disk_req_dsync_write_to_read_multiplier = io_queue::read_request_base_count * double(dev.read_iops) / dev.dsync_write_iops;
+        }
+    }
+    if (dev.read_bandwidth) {
+        double read_bw = dev.read_bandwidth;
+        cfg.max_bytes_count = limit(read_bw, latency_goal, 1);
+        if (dev.write_bandwidth) {
+            cfg.disk_bytes_write_to_read_multiplier = read_bw / dev.write_bandwidth;
+        }
+    }
+    return cfg;
+}
+
 void smp::configure(boost::program_options::variables_map configuration)
 {
+    using startup_clock = std::chrono::steady_clock;
+    using fseconds = std::chrono::duration<double>;
+    auto startup_begin = startup_clock::now();
 #ifndef NO_EXCEPTION_HACK
     if (configuration["enable-glibc-exception-scaling-workaround"].as<bool>()) {
         init_phdr_cache();
@@ -3769,6 +5559,7 @@ void smp::configure(boost::program_options::variables_map configuration)
     if (!thread_affinity) {
         mbind = false;
     }
+    auto populate = configuration["populate-memory"].as<bool>();
 
     smp::count = 1;
     smp::_tmain = std::this_thread::get_id();
@@ -3838,21 +5629,57 @@ void smp::configure(boost::program_options::variables_map configuration)
     if (configuration.count("num-io-queues")) {
         rc.io_queues = configuration["num-io-queues"].as<unsigned>();
     }
+    rc.placement = resource::parse_cpu_placement(configuration["cpu-placement"].as<std::string>());
 
     auto resources = resource::allocate(rc);
     std::vector<resource::cpu> allocations = std::move(resources.cpus);
+    for (auto&& a : allocations) {
+        _numa_nodes.push_back(a.nodeid);
+        _cache_domains.push_back(a.cache_id);
+    }
+    auto resources_allocated = startup_clock::now();
     if (thread_affinity) {
         smp::pin(allocations[0].cpu_id);
     }
     memory::configure(allocations[0].mem, mbind, hugepages_path);
+    auto memory_configured = startup_clock::now();
+    // Written by each shard before reactors_registered, read after it
+    static std::vector<fseconds> populate_times;
+    populate_times.assign(smp::count, fseconds(0));
+    auto populate_memory = [] (unsigned shard) {
+        auto start = startup_clock::now();
+        memory::populate();
+        populate_times[shard] = startup_clock::now() - start;
+    };
 
     if (configuration.count("abort-on-seastar-bad-alloc")) {
         memory::enable_abort_on_allocation_failure();
     }
 
     bool heapprof_enabled = configuration.count("heapprof");
+    size_t heapprof_sample_interval = configuration.count("heapprof-sample-interval")
+            ? configuration["heapprof-sample-interval"].as<size_t>() : 0;
+    memory::set_heap_profiling_sample_interval(heapprof_sample_interval);
     memory::set_heap_profiling_enabled(heapprof_enabled);
 
+    reactor_backend_config backend_cfg;
+    backend_cfg.name = configuration["reactor-backend"].as<std::string>();
+    auto backend_names = reactor_backend_config::available();
+    if (std::find(backend_names.begin(), backend_names.end(), backend_cfg.name) == backend_names.end()) {
+        throw std::runtime_error(sprint("unknown reactor backend %s (valid values: %s)", backend_cfg.name,
+                format_separated(backend_names.begin(), backend_names.end(), ", ")));
+    }
+#ifdef HAVE_LIBURING
+    backend_cfg.io_uring_sqpoll = configuration.count("io-uring-sqpoll");
+#endif
+
+    thread_pool_config thread_pool_cfg;
+    thread_pool_cfg.metadata_threads = configuration["syscall-threads"].as<unsigned>();
+    thread_pool_cfg.sync_threads = configuration["syscall-sync-threads"].as<unsigned>();
+    if (!thread_pool_cfg.metadata_threads) {
+        throw std::runtime_error("--syscall-threads must be at least 1");
+    }
+
 #ifdef HAVE_DPDK
     if (smp::_using_dpdk) {
         dpdk::eal::cpuset cpus;
@@ -3871,11 +5698,39 @@ void smp::configure(boost::program_options::variables_map configuration)
 
     auto io_info = std::move(resources.io_queues);
 
-    std::vector<io_queue*> all_io_queues;
-    all_io_queues.resize(io_info.coordinators.size());
+    // Devices configured with --io-device get queues of their own, with
+    // the same topology as the default ones; the default device comes first.
+    std::vector<io_device_properties> io_devices = { default_io_device(configuration) };
+    if (configuration.count("io-device")) {
+        for (auto&& spec : configuration["io-device"].as<std::vector<std::string>>()) {
+            io_devices.push_back(parse_io_device(spec));
+        }
+    }
+    // In decentralized mode every shard gets an I/O queue of its own, and
+    // the queues of a coordinator's shards share its capacity; otherwise
+    // the coordinators' queues serve their shards.
+    bool decentralized_io = configuration["decentralized-io"].as<bool>();
+    auto nr_io_queues = decentralized_io ? smp::count : io_info.coordinators.size();
+    double io_latency_goal = configuration["io-latency-goal-ms"].as<double>() / 1000;
+    // by device and coordinator
+    static std::vector<std::unique_ptr<fair_queue_shared_capacity>> shared_io_capacities;
+    // by device and queue
+    std::vector<std::vector<io_queue*>> all_io_queues(io_devices.size());
+    std::vector<io_queue::config> io_cfgs;
+    for (size_t d = 0; d < io_devices.size(); ++d) {
+        all_io_queues[d].resize(nr_io_queues);
+        auto cfg = disk_cost_model_config(io_devices[d], io_latency_goal, io_info.coordinators.size());
+        cfg.nr_io_queues = nr_io_queues;
+        io_cfgs.push_back(cfg);
+        if (decentralized_io) {
+            for (size_t i = 0; i < io_info.coordinators.size(); ++i) {
+                shared_io_capacities.push_back(std::make_unique<fair_queue_shared_capacity>());
+            }
+        }
+    }
     io_queue::fill_shares_array();
 
-    auto alloc_io_queue = [io_info, &all_io_queues] (unsigned shard) {
+    auto alloc_io_queue = [io_info, io_devices, io_cfgs, decentralized_io, &all_io_queues] (unsigned shard) {
         auto cid = io_info.shard_to_coordinator[shard];
         int vec_idx = 0;
         for (auto& coordinator: io_info.coordinators) {
@@ -3883,20 +5738,43 @@ void smp::configure(boost::program_options::variables_map configuration)
                 vec_idx++;
                 continue;
             }
-            if (shard == cid) {
-                all_io_queues[vec_idx] = new io_queue(coordinator.id, coordinator.capacity, io_info.shard_to_coordinator);
+            for (size_t d = 0; d < io_devices.size(); ++d) {
+                auto cfg = io_cfgs[d];
+                cfg.capacity = coordinator.capacity;
+                if (io_devices[d].max_io_requests) {
+                    cfg.capacity = std::max<unsigned>(io_devices[d].max_io_requests / io_info.coordinators.size(), 1);
+                }
+                if (decentralized_io) {
+                    cfg.coordinator = shard;
+                    cfg.shared_capacity = shared_io_capacities[d * io_info.coordinators.size() + vec_idx].get();
+                    std::vector<shard_id> topology(smp::count);
+                    std::iota(topology.begin(), topology.end(), 0);
+                    all_io_queues[d][shard] = new io_queue(std::move(cfg), std::move(topology));
+                } else if (shard == cid) {
+                    cfg.coordinator = coordinator.id;
+                    all_io_queues[d][vec_idx] = new io_queue(std::move(cfg), io_info.shard_to_coordinator);
+                }
             }
-            return vec_idx;
+            return decentralized_io ? int(shard) : vec_idx;
         }
         assert(0); // Impossible
     };
 
-    auto assign_io_queue = [&all_io_queues] (shard_id id, int queue_idx) {
-        if (all_io_queues[queue_idx]->coordinator() == id) {
-            engine().my_io_queue.reset(all_io_queues[queue_idx]);
+    auto assign_io_queue = [&all_io_queues, io_devices] (shard_id id, int queue_idx) {
+        for (size_t d = 0; d < io_devices.size(); ++d) {
+            auto queue = all_io_queues[d][queue_idx];
+            if (d == 0) {
+                if (queue->coordinator() == id) {
+                    engine().my_io_queue.reset(queue);
+                }
+                engine()._io_queue = queue;
+            } else {
+                if (queue->coordinator() == id) {
+                    engine().my_device_io_queues.emplace_back(queue);
+                }
+                engine()._device_io_queues[io_devices[d].device_id] = queue;
+            }
         }
-        engine()._io_queue = all_io_queues[queue_idx];
-        engine()._io_coordinator = all_io_queues[queue_idx]->coordinator();
     };
 
     _all_event_loops_done.emplace(smp::count);
@@ -3904,13 +5782,17 @@ void smp::configure(boost::program_options::variables_map configuration)
     unsigned i;
     for (i = 1; i < smp::count; i++) {
         auto allocation = allocations[i];
-        create_thread([configuration, hugepages_path, i, allocation, assign_io_queue, alloc_io_queue, thread_affinity, heapprof_enabled, mbind] {
+        create_thread([configuration, hugepages_path, i, allocation, assign_io_queue, alloc_io_queue, thread_affinity, heapprof_enabled, heapprof_sample_interval, mbind, populate, populate_memory, backend_cfg, thread_pool_cfg] {
             auto thread_name = seastar::format("reactor-{}", i);
             pthread_setname_np(pthread_self(), thread_name.c_str());
             if (thread_affinity) {
                 smp::pin(allocation.cpu_id);
             }
             memory::configure(allocation.mem, mbind, hugepages_path);
+            if (populate) {
+                populate_memory(i);
+            }
+            memory::set_heap_profiling_sample_interval(heapprof_sample_interval);
             memory::set_heap_profiling_enabled(heapprof_enabled);
             sigset_t mask;
             sigfillset(&mask);
@@ -3919,7 +5801,7 @@ void smp::configure(boost::program_options::variables_map configuration)
             }
             auto r = ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
             throw_pthread_error(r);
-            allocate_reactor(i);
+            allocate_reactor(i, backend_cfg, thread_pool_cfg);
             _reactors[i] = &engine();
             auto queue_idx = alloc_io_queue(i);
             reactors_registered.wait();
@@ -3932,7 +5814,7 @@ void smp::configure(boost::program_options::variables_map configuration)
         });
     }
 
-    allocate_reactor(0);
+    allocate_reactor(0, backend_cfg, thread_pool_cfg);
     _reactors[0] = &engine();
     auto queue_idx = alloc_io_queue(0);
 
@@ -3945,22 +5827,54 @@ void smp::configure(boost::program_options::variables_map configuration)
     }
 #endif
 
+    // only now, so that it overlaps with the other shards'
+    if (populate) {
+        populate_memory(0);
+    }
+
     reactors_registered.wait();
+    auto reactors_allocated = startup_clock::now();
     smp::_qs = new smp_message_queue* [smp::count];
     for(unsigned i = 0; i < smp::count; i++) {
         smp::_qs[i] = reinterpret_cast<smp_message_queue*>(operator new[] (sizeof(smp_message_queue) * smp::count));
         for (unsigned j = 0; j < smp::count; ++j) {
-            new (&smp::_qs[i][j]) smp_message_queue(_reactors[j], _reactors[i]);
+            new (&smp::_qs[i][j]) smp_message_queue(_reactors[j], _reactors[i], smp_link(allocations[i], allocations[j]));
         }
     }
     smp_queues_constructed.wait();
     start_all_queues();
     assign_io_queue(0, queue_idx);
     inited.wait();
+    auto queues_started = startup_clock::now();
 
     engine().configure(configuration);
     // The raw `new` is necessary because of the private constructor of `lowres_clock_impl`.
     engine()._lowres_clock_impl = std::unique_ptr<lowres_clock_impl>(new lowres_clock_impl);
+    auto startup_end = startup_clock::now();
+    seastar_logger.debug("startup took {:.3f}s: resources {:.3f}s, memory {:.3f}s, reactors {:.3f}s "
+            "(populating memory: {:.3f}s on the slowest shard), queues {:.3f}s, configuration {:.3f}s",
+            fseconds(startup_end - startup_begin).count(),
+            fseconds(resources_allocated - startup_begin).count(),
+            fseconds(memory_configured - resources_allocated).count(),
+            fseconds(reactors_allocated - memory_configured).count(),
+            std::max_element(populate_times.begin(), populate_times.end())->count(),
+            fseconds(queues_started - reactors_allocated).count(),
+            fseconds(startup_end - queues_started).count());
+}
+
+std::vector<unsigned> smp::nearby_shards(unsigned shard) {
+    std::vector<unsigned> ret(all_cpus().begin(), all_cpus().end());
+    auto node = numa_node(shard);
+    auto domain = cache_domain(shard);
+    auto key = [=] (unsigned s) {
+        auto same_node = numa_node(s) == node;
+        return std::make_tuple(s != shard, !same_node || cache_domain(s) != domain, !same_node,
+                numa_node(s), cache_domain(s));
+    };
+    std::stable_sort(ret.begin(), ret.end(), [&key] (unsigned a, unsigned b) {
+        return key(a) < key(b);
+    });
+    return ret;
 }
 
 bool smp::poll_queues() {
@@ -3972,7 +5886,7 @@ bool smp::poll_queues() {
             got += rxq.has_unflushed_responses();
             got += rxq.process_incoming();
             auto& txq = _qs[i][engine()._id];
-            txq.flush_request_batch();
+            txq.poll_request_batch();
             got += txq.process_completions();
         }
     }
@@ -4022,6 +5936,276 @@ reactor_backend_epoll::make_reactor_notifier() {
     return std::make_unique<reactor_notifier_epoll>();
 }
 
+#ifdef HAVE_LIBURING
+// user_data of poll completions is tagged with this bit, to tell them apart
+// from storage completions, whose user_data is the promise<io_event>* taken
+// from iocb::data. Completions of POLL_REMOVE requests have no user_data.
+static constexpr uintptr_t uring_poll_tag = 1;
+// user_data of IORING_OP_OPENAT completions is a promise<int>*, tagged with
+// this bit
+static constexpr uintptr_t uring_open_tag = 2;
+
+reactor_backend_uring::reactor_backend_uring(unsigned entries, bool sqpoll) {
+    ::io_uring_params params = {};
+    if (sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = 1000; // ms
+    }
+    auto r = ::io_uring_queue_init_params(entries, &_uring, &params);
+    throw_kernel_error(r);
+    if (auto probe = ::io_uring_get_probe_ring(&_uring)) {
+        _openat_supported = ::io_uring_opcode_supported(probe, IORING_OP_OPENAT);
+        ::io_uring_free_probe(probe);
+    }
+}
+
+reactor_backend_uring::~reactor_backend_uring() {
+    ::io_uring_queue_exit(&_uring);
+    for (auto&& p : _polls) {
+        for (auto op : p.second) {
+            delete op;
+        }
+    }
+}
+
+::io_uring_sqe* reactor_backend_uring::get_sqe() {
+    auto sqe = ::io_uring_get_sqe(&_uring);
+    while (!sqe) {
+        // submission ring is full; hand the queued entries to the kernel to make room
+        ::io_uring_submit(&_uring);
+        sqe = ::io_uring_get_sqe(&_uring);
+    }
+    return sqe;
+}
+
+future<> reactor_backend_uring::poll(pollable_fd_state& pfd, promise<> pollable_fd_state::* pr, int event) {
+    if (pfd.events_known & event) {
+        pfd.events_known &= ~event;
+        return make_ready_future();
+    }
+    pfd.events_requested |= event;
+    if (!(pfd.events_epoll & event)) {
+        pfd.events_epoll |= event;
+        auto op = new poll_op{&pfd, event};
+        _polls[&pfd][event == EPOLLIN ? 0 : 1] = op;
+        auto sqe = get_sqe();
+        // POLLIN/POLLOUT have the same values as EPOLLIN/EPOLLOUT
+        ::io_uring_prep_poll_add(sqe, pfd.fd.get(), event);
+        ::io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(op) | uring_poll_tag));
+    }
+    pfd.*pr = promise<>();
+    return (pfd.*pr).get_future();
+}
+
+void reactor_backend_uring::cancel_poll(poll_op* op) {
+    // The op is freed when the cancelled poll's completion arrives.
+    op->fd = nullptr;
+    auto sqe = get_sqe();
+    ::io_uring_prep_poll_remove(sqe, reinterpret_cast<uintptr_t>(op) | uring_poll_tag);
+    ::io_uring_sqe_set_data(sqe, nullptr);
+}
+
+void reactor_backend_uring::complete_poll(poll_op* op, int res) {
+    std::unique_ptr<poll_op> op_holder(op);
+    if (!op->fd) {
+        return;
+    }
+    auto& pfd = *op->fd;
+    auto event = op->event;
+    auto i = _polls.find(&pfd);
+    i->second[event == EPOLLIN ? 0 : 1] = nullptr;
+    if (!i->second[0] && !i->second[1]) {
+        _polls.erase(i);
+    }
+    pfd.events_epoll &= ~event;
+    // Errors and hangups wake the waiter, so that its next syscall on the
+    // descriptor observes them.
+    if (res < 0 || (res & (EPOLLERR | EPOLLHUP))) {
+        res = event;
+    }
+    if (pfd.events_requested & res & event) {
+        pfd.events_requested &= ~event;
+        pfd.events_known &= ~event;
+        auto pr = event == EPOLLIN ? &pollable_fd_state::pollin : &pollable_fd_state::pollout;
+        (pfd.*pr).set_value();
+        pfd.*pr = promise<>();
+    }
+}
+
+size_t reactor_backend_uring::process_completions() {
+    if (::io_uring_sq_ready(&_uring)) {
+        ::io_uring_submit(&_uring);
+    }
+    std::array<::io_uring_cqe*, 128> cqes;
+    size_t total = 0;
+    unsigned n;
+    do {
+        n = ::io_uring_peek_batch_cqe(&_uring, cqes.data(), cqes.size());
+        for (unsigned i = 0; i < n; ++i) {
+            auto data = reinterpret_cast<uintptr_t>(::io_uring_cqe_get_data(cqes[i]));
+            auto res = cqes[i]->res;
+            if (!data) {
+                continue;
+            } else if (data & uring_poll_tag) {
+                complete_poll(reinterpret_cast<poll_op*>(data & ~uring_poll_tag), res);
+            } else if (data & uring_open_tag) {
+                auto pr = reinterpret_cast<promise<int>*>(data & ~uring_open_tag);
+                pr->set_value(res);
+                delete pr;
+            } else {
+                auto pr = reinterpret_cast<promise<io_event>*>(data);
+                io_event ev = {};
+                ev.data = pr;
+                ev.res = long(res);
+                pr->set_value(ev);
+                delete pr;
+                ++_storage_completed;
+            }
+        }
+        ::io_uring_cq_advance(&_uring, n);
+        total += n;
+    } while (n == cqes.size());
+    return total;
+}
+
+bool reactor_backend_uring::wait_and_process(int timeout, const sigset_t* active_sigmask) {
+    if (timeout && !::io_uring_cq_ready(&_uring)) {
+        if (::io_uring_sq_ready(&_uring)) {
+            ::io_uring_submit(&_uring);
+        }
+        __kernel_timespec ts;
+        if (timeout > 0) {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000;
+        }
+        ::io_uring_cqe* cqe;
+        auto r = ::io_uring_wait_cqes(&_uring, &cqe, 1, timeout > 0 ? &ts : nullptr,
+                const_cast<sigset_t*>(active_sigmask));
+        if (r == -EINTR) {
+            return false; // gdb can cause this
+        }
+        assert(r == 0 || r == -ETIME);
+    }
+    return process_completions();
+}
+
+future<> reactor_backend_uring::readable(pollable_fd_state& fd) {
+    return poll(fd, &pollable_fd_state::pollin, EPOLLIN);
+}
+
+future<> reactor_backend_uring::writeable(pollable_fd_state& fd) {
+    return poll(fd, &pollable_fd_state::pollout, EPOLLOUT);
+}
+
+void reactor_backend_uring::abort_fd(pollable_fd_state& pfd, std::exception_ptr ex,
+                                     promise<> pollable_fd_state::* pr, int event) {
+    if (pfd.events_epoll & event) {
+        pfd.events_epoll &= ~event;
+        auto i = _polls.find(&pfd);
+        auto& op = i->second[event == EPOLLIN ? 0 : 1];
+        cancel_poll(op);
+        op = nullptr;
+        if (!i->second[0] && !i->second[1]) {
+            _polls.erase(i);
+        }
+    }
+    if (pfd.events_requested & event) {
+        pfd.events_requested &= ~event;
+        (pfd.*pr).set_exception(std::move(ex));
+    }
+    pfd.events_known &= ~event;
+}
+
+void reactor_backend_uring::abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+    abort_fd(fd, std::move(ex), &pollable_fd_state::pollin, EPOLLIN);
+}
+
+void reactor_backend_uring::abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
+    abort_fd(fd, std::move(ex), &pollable_fd_state::pollout, EPOLLOUT);
+}
+
+void reactor_backend_uring::forget(pollable_fd_state& fd) {
+    auto i = _polls.find(&fd);
+    if (i == _polls.end()) {
+        return;
+    }
+    for (auto op : i->second) {
+        if (op) {
+            cancel_poll(op);
+        }
+    }
+    _polls.erase(i);
+}
+
+int reactor_backend_uring::submit_aio(::iocb** iocbs, size_t nr) {
+    size_t i = 0;
+    for (; i < nr; ++i) {
+        auto sqe = ::io_uring_get_sqe(&_uring);
+        if (!sqe) {
+            break;
+        }
+        auto& io = *iocbs[i];
+        auto fd = io.aio_fildes;
+        switch (io.aio_lio_opcode) {
+        case IO_CMD_PREAD:
+            ::io_uring_prep_read(sqe, fd, io.u.c.buf, io.u.c.nbytes, io.u.c.offset);
+            break;
+        case IO_CMD_PWRITE:
+            ::io_uring_prep_write(sqe, fd, io.u.c.buf, io.u.c.nbytes, io.u.c.offset);
+            break;
+        case IO_CMD_PREADV:
+            ::io_uring_prep_readv(sqe, fd, io.u.v.vec, io.u.v.nr, io.u.v.offset);
+            break;
+        case IO_CMD_PWRITEV:
+            ::io_uring_prep_writev(sqe, fd, io.u.v.vec, io.u.v.nr, io.u.v.offset);
+            break;
+        case IO_CMD_FDSYNC:
+            ::io_uring_prep_fsync(sqe, fd, IORING_FSYNC_DATASYNC);
+            break;
+        case IO_CMD_FSYNC:
+            ::io_uring_prep_fsync(sqe, fd, 0);
+            break;
+        default:
+            abort();
+        }
+        ::io_uring_sqe_set_data(sqe, io.data);
+    }
+    if (nr && !i) {
+        // ring full; retried on the next poll, after completions were reaped
+        return -EAGAIN;
+    }
+    ::io_uring_submit(&_uring);
+    return i;
+}
+
+size_t reactor_backend_uring::reap_aio() {
+    process_completions();
+    return std::exchange(_storage_completed, 0);
+}
+
+future<int> reactor_backend_uring::open_file(const char* path, int flags, mode_t mode) {
+    if (!_openat_supported) {
+        return make_ready_future<int>(-ENOSYS);
+    }
+    auto pr = std::make_unique<promise<int>>();
+    auto ret = pr->get_future();
+    auto sqe = get_sqe();
+    ::io_uring_prep_openat(sqe, AT_FDCWD, path, flags, mode);
+    ::io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(pr.release()) | uring_open_tag));
+    return ret;
+}
+
+future<> reactor_backend_uring::notified(reactor_notifier *n) {
+    std::cout << "reactor_backend_uring does not yet support notifiers!\n";
+    abort();
+}
+
+std::unique_ptr<reactor_notifier>
+reactor_backend_uring::make_reactor_notifier() {
+    return std::make_unique<reactor_notifier_epoll>();
+}
+#endif /* HAVE_LIBURING */
+
 #ifdef HAVE_OSV
 class reactor_notifier_osv :
         public reactor_notifier, private osv::newpoll::pollable {
@@ -4202,6 +6386,50 @@ future<file> open_file_dma(sstring name, open_flags flags, file_open_options opt
     return engine().open_file_dma(std::move(name), flags, options);
 }
 
+future<> open_files_dma(std::vector<sstring> names, open_flags flags,
+        std::function<void (size_t index, future<file> f)> on_open, file_open_options options) {
+    return engine().open_files_dma(std::move(names), flags, std::move(on_open), options);
+}
+
+future<std::vector<file>> open_files_dma(std::vector<sstring> names, open_flags flags) {
+    return open_files_dma(std::move(names), flags, file_open_options());
+}
+
+future<std::vector<file>> open_files_dma(std::vector<sstring> names, open_flags flags, file_open_options options) {
+    struct result {
+        std::vector<std::experimental::optional<file>> files;
+        std::exception_ptr error;
+    };
+    auto r = make_lw_shared<result>();
+    r->files.resize(names.size());
+    return engine().open_files_dma(std::move(names), flags, [r] (size_t i, future<file> f) {
+        try {
+            r->files[i] = f.get0();
+        } catch (...) {
+            if (!r->error) {
+                r->error = std::current_exception();
+            }
+        }
+    }, options).then([r] {
+        if (!r->error) {
+            std::vector<file> files;
+            files.reserve(r->files.size());
+            for (auto&& f : r->files) {
+                files.push_back(std::move(*f));
+            }
+            return make_ready_future<std::vector<file>>(std::move(files));
+        }
+        return parallel_for_each(r->files, [] (std::experimental::optional<file>& f) {
+            if (!f) {
+                return make_ready_future<>();
+            }
+            return f->close().handle_exception([] (std::exception_ptr) {});
+        }).then([r] {
+            return make_exception_future<std::vector<file>>(r->error);
+        });
+    });
+}
+
 future<file> open_directory(sstring name) {
     return engine().open_directory(std::move(name));
 }
@@ -4381,26 +6609,115 @@ reactor::sched_clock::duration reactor::total_busy_time() {
 
 void
 reactor::init_scheduling_group(seastar::scheduling_group sg, sstring name, float shares) {
-    _task_queues.resize(std::max<size_t>(_task_queues.size(), sg._id + 1));
-    _task_queues[sg._id] = std::make_unique<task_queue>(sg._id, name, shares);
+    // The task queue itself is only created when the group is first used
+    // on this shard, so that idle groups cost nothing.
+    _scheduling_group_specs[sg._id] = scheduling_group_spec{std::move(name), shares};
+}
+
+reactor::task_queue&
+reactor::create_task_queue(unsigned id) {
+    auto i = _scheduling_group_specs.find(id);
+    if (i == _scheduling_group_specs.end()) {
+        // Destroyed group
+        return *_task_queues[0];
+    }
+    _task_queues.resize(std::max<size_t>(_task_queues.size(), id + 1));
+    _task_queues[id] = std::make_unique<task_queue>(id, i->second.name, i->second.shares);
+    return *_task_queues[id];
+}
+
+void
+reactor::destroy_scheduling_group_queue(seastar::scheduling_group sg) {
+    _scheduling_group_specs.erase(sg._id);
+    if (sg._id >= _task_queues.size() || !_task_queues[sg._id]) {
+        return;
+    }
+    auto tq = std::move(_task_queues[sg._id]);
+    assert(!tq->_current);
+    auto forget = [&] (task_queue_list& tqs) {
+        tqs.erase(std::remove(tqs.begin(), tqs.end(), tq.get()), tqs.end());
+    };
+    forget(_active_task_queues);
+    std::make_heap(_active_task_queues.begin(), _active_task_queues.end(), task_queue::heap_compare());
+    forget(_activating_task_queues);
+    forget(_throttled_task_queues);
+    auto& main = *_task_queues[0];
+    bool was_empty = main._q.empty();
+    while (!tq->_q.empty()) {
+        main._q.push_back(std::move(tq->_q.front()));
+        tq->_q.pop_front();
+    }
+    if (was_empty && !main._q.empty()) {
+        activate(main);
+    }
 }
 
 const sstring&
 scheduling_group::name() const {
-    return engine()._task_queues[_id]->_name;
+    return engine().task_queue_of(_id)._name;
+}
+
+memory::allocation_group_stats
+scheduling_group::memory_stats() const {
+    return memory::get_allocation_group_stats(_id);
 }
 
 void
 scheduling_group::set_shares(float shares) {
-    engine()._task_queues[_id]->set_shares(shares);
+    engine().task_queue_of(_id).set_shares(shares);
+}
+
+void
+scheduling_group::set_max_utilization(float fraction) {
+    engine().task_queue_of(_id).set_max_utilization(fraction);
+}
+
+void
+scheduling_group::set_latency_critical(bool critical) {
+    engine().task_queue_of(_id)._latency_critical = critical;
+}
+
+namespace {
+
+// Scheduling group ids are global; destroyed groups' ids are reused.
+class scheduling_group_ids {
+    std::mutex _mutex;
+    unsigned _next = 2; // 0=main, 1=atexit
+    std::vector<unsigned> _free;
+public:
+    std::experimental::optional<unsigned> allocate() {
+        std::lock_guard<std::mutex> g(_mutex);
+        if (!_free.empty()) {
+            auto id = _free.back();
+            _free.pop_back();
+            return id;
+        }
+        if (_next == max_scheduling_groups()) {
+            return {};
+        }
+        return _next++;
+    }
+    void release(unsigned id) {
+        std::lock_guard<std::mutex> g(_mutex);
+        _free.push_back(id);
+    }
+};
+
+scheduling_group_ids& the_scheduling_group_ids() {
+    static scheduling_group_ids ids;
+    return ids;
+}
+
 }
 
 future<scheduling_group>
 create_scheduling_group(sstring name, float shares) {
-    static std::atomic<unsigned> last{2}; // 0=main, 1=atexit
-    auto id = last.fetch_add(1);
-    assert(id < max_scheduling_groups());
-    auto sg = scheduling_group(id);
+    auto id = the_scheduling_group_ids().allocate();
+    if (!id) {
+        return make_exception_future<scheduling_group>(std::runtime_error(
+                sprint("cannot create more than %d scheduling groups", max_scheduling_groups())));
+    }
+    auto sg = scheduling_group(*id);
     return smp::invoke_on_all([sg, name, shares] {
         engine().init_scheduling_group(sg, name, shares);
     }).then([sg] {
@@ -4408,4 +6725,19 @@ create_scheduling_group(sstring name, float shares) {
     });
 }
 
+future<>
+destroy_scheduling_group(scheduling_group sg) {
+    if (sg._id < 2) {
+        return make_exception_future<>(std::invalid_argument("cannot destroy the main or atexit scheduling group"));
+    }
+    if (sg == current_scheduling_group()) {
+        return make_exception_future<>(std::invalid_argument("cannot destroy the current scheduling group"));
+    }
+    return smp::invoke_on_all([sg] {
+        engine().destroy_scheduling_group_queue(sg);
+    }).then([sg] {
+        the_scheduling_group_ids().release(sg._id);
+    });
+}
+
 }
@@ -30,10 +30,15 @@
 #include <memory>
 #include <type_traits>
 #include <libaio.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unordered_map>
+#include <unordered_set>
+#include <typeindex>
 #include <netinet/ip.h>
 #include <cstring>
 #include <cassert>
@@ -41,6 +46,7 @@
 #include <iostream>
 #include <unistd.h>
 #include <vector>
+#include <array>
 #include <queue>
 #include <algorithm>
 #include <thread>
@@ -75,9 +81,16 @@
 #include "condition-variable.hh"
 #include "util/log.hh"
 #include "lowres_clock.hh"
+#include "tsc_clock.hh"
 #include "manual_clock.hh"
 #include "core/metrics_registration.hh"
+#include "core/metrics_types.hh"
+#include "core/tracing.hh"
 #include "scheduling.hh"
+#include "cpu_profiler.hh"
+#include "event_trace.hh"
+#include "adaptive_poll.hh"
+#include "stealable_task.hh"
 
 #ifdef HAVE_OSV
 #include <osv/sched.hh>
@@ -151,7 +164,11 @@ class pollable_fd {
     future<pollable_fd, socket_address> accept();
     future<size_t> sendmsg(struct msghdr *msg);
     future<size_t> recvmsg(struct msghdr *msg);
+    // Return the number of messages sent or received, at least one
+    future<size_t> sendmmsg(struct mmsghdr* msgs, unsigned vlen);
+    future<size_t> recvmmsg(struct mmsghdr* msgs, unsigned vlen);
     future<size_t> sendto(socket_address addr, const void* buf, size_t len);
+    future<size_t> sendfile(file& f, uint64_t offset, size_t len);
     file_desc& get_file_desc() const { return _s->fd; }
     void shutdown(int how) { _s->fd.shutdown(how); }
     void close() { _s.reset(); }
@@ -246,7 +263,13 @@ class syscall_work_queue {
     lf_queue _completed;
     writeable_eventfd _start_eventfd;
     semaphore _queue_has_room = { queue_length };
+    // Statistics, only accessed from the reactor thread
+    size_t _in_flight = 0;
+    uint64_t _operations = 0;
+    std::chrono::steady_clock::duration _total_wait_time = {};
     struct work_item {
+        std::chrono::steady_clock::time_point _submitted = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point _started;
         virtual ~work_item() {}
         virtual void process() = 0;
         virtual void complete() = 0;
@@ -284,9 +307,35 @@ class syscall_work_queue {
     friend class thread_pool;
 };
 
+// Selects the container holding the reactor's active timers for each clock.
+// lowres_clock timers (TCP timers, connection and request timeouts) are armed
+// and cancelled at a high rate and rarely expire, so they are kept in a
+// timing wheel with the clock's granularity; the others use timer_set.
+template <typename Clock>
+struct timer_container_selector {
+    using type = timer_set<timer<Clock>, &timer<Clock>::_link>;
+};
+
+template <>
+struct timer_container_selector<lowres_clock> {
+    using type = timer_wheel<timer<lowres_clock>, &timer<lowres_clock>::_link,
+            std::chrono::duration_cast<lowres_clock::duration>(std::chrono::milliseconds(10)).count()>;
+};
+
+template <typename Clock>
+using timer_container_for = typename timer_container_selector<Clock>::type;
+
 class smp_message_queue {
+public:
+    // How the hardware threads running the two shards connected by a queue
+    // relate to each other; selects the batching and flush policy.
+    enum class link {
+        smt_siblings,  // same physical core: flush every message immediately
+        same_node,     // same NUMA node
+        remote_node,   // different NUMA nodes: larger batches, deferred flush
+    };
+private:
     static constexpr size_t queue_length = 128;
-    static constexpr size_t batch_size = 16;
     static constexpr size_t prefetch_cnt = 2;
     struct work_item;
     struct lf_queue_remote {
@@ -307,6 +356,10 @@ class smp_message_queue {
         size_t _last_snt_batch = 0;
         size_t _last_cmpl_batch = 0;
         size_t _current_queue_length = 0;
+        uint64_t _total_completion_latency_ns = 0;
+        size_t _send_batch_size;
+        unsigned _flush_deferral; // polls a partial request batch may wait
+        unsigned _deferred_polls = 0;
     };
     // keep this between two structures with statistics
     // this makes sure that they have at least one cache line
@@ -316,8 +369,12 @@ class smp_message_queue {
     struct alignas(seastar::cache_line_size) {
         size_t _received = 0;
         size_t _last_rcv_batch = 0;
+        size_t _respond_batch_size;
     };
     struct work_item {
+        steady_clock_type::time_point _submit_time;
+        // the submitter's, for the synchronous part of process()
+        tracing::trace_context _trace;
         virtual ~work_item() {}
         virtual future<> process() = 0;
         virtual void complete() = 0;
@@ -356,22 +413,39 @@ class smp_message_queue {
         }
         future_type get_future() { return _promise.get_future(); }
     };
+    // Work items are allocated and destroyed on the sending shard, so each
+    // queue keeps a preallocated set of fixed-size slots for them; small
+    // closures are constructed in place and never touch the allocator.
+    // Items that are too large, or submitted while all slots are in flight,
+    // fall back to the heap.
+    static constexpr size_t work_item_slot_size = 256;
+    struct work_item_slot {
+        std::aligned_storage_t<work_item_slot_size> storage;
+    };
     union tx_side {
         tx_side() {}
         ~tx_side() {}
         void init() { new (&a) aa; }
         struct aa {
             std::deque<work_item*> pending_fifo;
+            std::unique_ptr<work_item_slot[]> slots{new work_item_slot[queue_length]};
+            std::vector<work_item_slot*> free_slots;
+            aa() {
+                free_slots.reserve(queue_length);
+                for (size_t i = 0; i < queue_length; ++i) {
+                    free_slots.push_back(&slots[i]);
+                }
+            }
         } a;
     } _tx;
     std::vector<work_item*> _completed_fifo;
 public:
-    smp_message_queue(reactor* from, reactor* to);
+    smp_message_queue(reactor* from, reactor* to, link l = link::same_node);
     template <typename Func>
     futurize_t<std::result_of_t<Func()>> submit(Func&& func) {
-        auto wi = std::make_unique<async_work_item<Func>>(std::forward<Func>(func));
+        auto wi = make_work_item<async_work_item<Func>>(std::forward<Func>(func));
         auto fut = wi->get_future();
-        submit_item(std::move(wi));
+        submit_item(wi);
         return fut;
     }
     void start(unsigned cpuid);
@@ -382,10 +456,27 @@ class smp_message_queue {
     void stop();
 private:
     void work();
-    void submit_item(std::unique_ptr<work_item> wi);
+    template <typename Item, typename... Args>
+    Item* make_work_item(Args&&... args) {
+        auto& free_slots = _tx.a.free_slots;
+        if (sizeof(Item) > sizeof(work_item_slot) || alignof(Item) > alignof(work_item_slot) || free_slots.empty()) {
+            return new Item(std::forward<Args>(args)...);
+        }
+        auto slot = free_slots.back();
+        free_slots.pop_back();
+        try {
+            return new (slot) Item(std::forward<Args>(args)...);
+        } catch (...) {
+            free_slots.push_back(slot);
+            throw;
+        }
+    }
+    void destroy_work_item(work_item* wi);
+    void submit_item(work_item* wi);
     void respond(work_item* wi);
     void move_pending();
     void flush_request_batch();
+    void poll_request_batch();
     void flush_response_batch();
     bool has_unflushed_responses() const;
     bool pure_poll_rx() const;
@@ -394,26 +485,55 @@ class smp_message_queue {
     friend class smp;
 };
 
+// Selects the syscall threads an operation is queued on. Operations that
+// can block on the disk for a long time (fdatasync(), fallocate(),
+// ftruncate()) get their own lane so that metadata operations such as
+// open() and stat() don't queue behind them.
+enum class syscall_lane {
+    metadata,
+    sync,
+};
+
+struct thread_pool_config {
+    unsigned metadata_threads = 1;
+    unsigned sync_threads = 1;
+};
+
 class thread_pool {
     uint64_t _aio_threaded_fallbacks = 0;
 #ifndef HAVE_OSV
+    static constexpr unsigned nr_lanes = 2;
     // FIXME: implement using reactor_notifier abstraction we used for SMP
-    syscall_work_queue inter_thread_wq;
-    posix_thread _worker_thread;
+    struct worker {
+        syscall_work_queue wq;
+        posix_thread thread;
+        worker(thread_pool& pool, sstring name);
+    };
+    std::array<std::vector<std::unique_ptr<worker>>, nr_lanes> _lanes;
     std::atomic<bool> _stopped = { false };
     std::atomic<bool> _main_thread_idle = { false };
     pthread_t _notify;
 public:
-    explicit thread_pool(sstring thread_name);
+    struct lane_stats {
+        uint64_t operations = 0;
+        size_t queue_length = 0;
+        std::chrono::steady_clock::duration total_wait_time = {};
+    };
+    thread_pool(sstring thread_name, thread_pool_config cfg);
     ~thread_pool();
     template <typename T, typename Func>
     future<T> submit(Func func) {
+        return submit<T>(syscall_lane::metadata, std::move(func));
+    }
+    template <typename T, typename Func>
+    future<T> submit(syscall_lane lane, Func func) {
         ++_aio_threaded_fallbacks;
-        return inter_thread_wq.submit<T>(std::move(func));
+        return pick_worker(lane).wq.submit<T>(std::move(func));
     }
     uint64_t operation_count() const { return _aio_threaded_fallbacks; }
+    lane_stats stats(syscall_lane lane) const;
 
-    unsigned complete() { return inter_thread_wq.complete(); }
+    unsigned complete();
     // Before we enter interrupt mode, we must make sure that the syscall thread will properly
     // generate signals to wake us up. This means we need to make sure that all modifications to
     // the pending and completed fields in the inter_thread_wq are visible to all threads.
@@ -430,15 +550,21 @@ class thread_pool {
 public:
     template <typename T, typename Func>
     future<T> submit(Func func) { std::cout << "thread_pool not yet implemented on osv\n"; abort(); }
+    template <typename T, typename Func>
+    future<T> submit(syscall_lane, Func func) { return submit<T>(std::move(func)); }
 #endif
 private:
-    void work(sstring thread_name);
+#ifndef HAVE_OSV
+    worker& pick_worker(syscall_lane lane);
+    void work(syscall_work_queue& wq, sstring thread_name);
+#endif
 };
 
 // The "reactor_backend" interface provides a method of waiting for various
 // basic events on one thread. We have one implementation based on epoll and
-// file-descriptors (reactor_backend_epoll) and one implementation based on
-// OSv-specific file-descriptor-less mechanisms (reactor_backend_osv).
+// file-descriptors (reactor_backend_epoll), one based on a Linux io_uring
+// (reactor_backend_uring) and one implementation based on OSv-specific
+// file-descriptor-less mechanisms (reactor_backend_osv).
 class reactor_backend {
 public:
     virtual ~reactor_backend() {};
@@ -460,15 +586,49 @@ class reactor_backend {
     virtual future<> notified(reactor_notifier *n) = 0;
     // Methods for allowing sending notifications events between threads.
     virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() = 0;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) = 0;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) = 0;
+    // Methods for storage (disk) I/O. submit_aio() hands prepared iocbs to
+    // the kernel, following io_submit() conventions: it returns the number of
+    // iocbs consumed, or a negative errno. reap_aio() fulfills the
+    // promise<io_event> attached (via iocb::data) to each finished request,
+    // and returns the number of requests completed.
+    virtual int submit_aio(::iocb** iocbs, size_t nr) = 0;
+    virtual size_t reap_aio() = 0;
+    // Returns true if storage completions wake a blocked wait_and_process(),
+    // so the reactor may sleep with disk I/O in flight.
+    virtual bool storage_completions_wake_sleep() const = 0;
+    // Returns true if buffered (not O_DIRECT) reads submitted with
+    // submit_aio() complete asynchronously, rather than blocking the
+    // submitting thread the way linux-aio does.
+    virtual bool async_buffered_reads() const {
+        return false;
+    }
+    // Opens a file without blocking the reactor thread, if the backend can:
+    // resolves to the new descriptor, or to a negative errno. Backends that
+    // cannot return -ENOSYS, and open() is then run on a syscall thread.
+    // path must live until the returned future resolves.
+    virtual future<int> open_file(const char* path, int flags, mode_t mode) {
+        return make_ready_future<int>(-ENOSYS);
+    }
+};
+
+// Selects the reactor_backend implementation; see the --reactor-backend option.
+struct reactor_backend_config {
+    sstring name = "epoll";
+    bool io_uring_sqpoll = false;
+    static std::vector<sstring> available();
 };
 
 // reactor backend using file-descriptor & epoll, suitable for running on
 // Linux. Can wait on multiple file descriptors, and converts other events
 // (such as timers, signals, inter-thread notifications) into file descriptors
 // using mechanisms like timerfd, signalfd and eventfd respectively.
+// Storage I/O is submitted with linux-aio.
 class reactor_backend_epoll : public reactor_backend {
 private:
     file_desc _epollfd;
+    io_context_t _io_context;
     future<> get_epoll_future(pollable_fd_state& fd,
             promise<> pollable_fd_state::* pr, int event);
     void complete_epoll_event(pollable_fd_state& fd,
@@ -476,18 +636,72 @@ class reactor_backend_epoll : public reactor_backend {
     void abort_fd(pollable_fd_state& fd, std::exception_ptr ex,
             promise<> pollable_fd_state::* pr, int event);
 public:
-    reactor_backend_epoll();
-    virtual ~reactor_backend_epoll() override { }
+    explicit reactor_backend_epoll(size_t max_aio);
+    virtual ~reactor_backend_epoll() override;
     virtual bool wait_and_process(int timeout, const sigset_t* active_sigmask) override;
     virtual future<> readable(pollable_fd_state& fd) override;
     virtual future<> writeable(pollable_fd_state& fd) override;
     virtual void forget(pollable_fd_state& fd) override;
     virtual future<> notified(reactor_notifier *n) override;
     virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
-    void abort_reader(pollable_fd_state& fd, std::exception_ptr ex);
-    void abort_writer(pollable_fd_state& fd, std::exception_ptr ex);
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual int submit_aio(::iocb** iocbs, size_t nr) override;
+    virtual size_t reap_aio() override;
+    virtual bool storage_completions_wake_sleep() const override { return false; }
 };
 
+#ifdef HAVE_LIBURING
+// reactor backend using a single per-shard io_uring for both file descriptor
+// readiness (one-shot IORING_OP_POLL_ADD requests) and storage I/O. Poll
+// requests are queued on the submission ring without a system call, and all
+// completions are reaped from the shared completion ring without one, which
+// replaces the epoll_ctl(), epoll_wait() and io_getevents() calls of the
+// epoll backend. With SQPOLL a kernel thread consumes the submission ring,
+// and no system calls are needed at all while it is awake.
+class reactor_backend_uring : public reactor_backend {
+    // An in-flight IORING_OP_POLL_ADD for one direction of a file descriptor.
+    // fd is cleared when the descriptor is forgotten or aborted before the
+    // poll completes; the completion is then ignored.
+    struct poll_op {
+        pollable_fd_state* fd;
+        int event;
+    };
+    ::io_uring _uring;
+    // whether the kernel has IORING_OP_OPENAT (since Linux 5.6)
+    bool _openat_supported = false;
+    // indexed by direction: 0 for EPOLLIN, 1 for EPOLLOUT
+    std::unordered_map<pollable_fd_state*, std::array<poll_op*, 2>> _polls;
+    size_t _storage_completed = 0;
+public:
+    static constexpr unsigned ring_entries = 1024;
+private:
+    ::io_uring_sqe* get_sqe();
+    future<> poll(pollable_fd_state& fd, promise<> pollable_fd_state::* pr, int event);
+    void cancel_poll(poll_op* op);
+    void abort_fd(pollable_fd_state& fd, std::exception_ptr ex,
+            promise<> pollable_fd_state::* pr, int event);
+    void complete_poll(poll_op* op, int res);
+    size_t process_completions();
+public:
+    reactor_backend_uring(unsigned entries, bool sqpoll);
+    virtual ~reactor_backend_uring() override;
+    virtual bool wait_and_process(int timeout, const sigset_t* active_sigmask) override;
+    virtual future<> readable(pollable_fd_state& fd) override;
+    virtual future<> writeable(pollable_fd_state& fd) override;
+    virtual void forget(pollable_fd_state& fd) override;
+    virtual future<> notified(reactor_notifier *n) override;
+    virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual int submit_aio(::iocb** iocbs, size_t nr) override;
+    virtual size_t reap_aio() override;
+    virtual bool storage_completions_wake_sleep() const override { return true; }
+    virtual bool async_buffered_reads() const override { return true; }
+    virtual future<int> open_file(const char* path, int flags, mode_t mode) override;
+};
+#endif /* HAVE_LIBURING */
+
 #ifdef HAVE_OSV
 // reactor_backend using OSv-specific features, without any file descriptors.
 // This implementation cannot currently wait on file descriptors, but unlike
@@ -520,57 +734,190 @@ enum class open_flags {
     create = O_CREAT,
     truncate = O_TRUNC,
     exclusive = O_EXCL,
+    // Every write is durable once it completes, as if followed by
+    // fdatasync(); devices with a volatile cache get FUA writes rather
+    // than a cache flush. No flush() is needed for the data written.
+    dsync = O_DSYNC,
 };
 
 inline open_flags operator|(open_flags a, open_flags b) {
     return open_flags(static_cast<unsigned int>(a) | static_cast<unsigned int>(b));
 }
 
+/// Absolute limits of an I/O priority class, on top of its shares, for the
+/// whole node (they are split evenly between the I/O queues). Zero means
+/// no limit.
+struct io_priority_class_limits {
+    /// Maximum throughput of the class, in bytes per second
+    uint64_t bytes_per_second = 0;
+    /// Maximum rate of requests of the class, per second
+    uint64_t ops_per_second = 0;
+    /// Latency the class's requests should complete in. When the observed
+    /// latency of the class approaches it, classes with fewer shares and
+    /// no latency goal of their own are throttled, until it recovers.
+    std::chrono::microseconds latency_goal = std::chrono::microseconds(0);
+};
+
 class io_queue {
+public:
+    // Discards occupy the disk like writes, but transfer no data; dsync
+    // writes, to files opened with open_flags::dsync, cost more than others
+    enum class request_type { read, write, dsync_write, discard };
+    // Weight of a read request in the disk cost model; a write weighs
+    // disk_req_write_to_read_multiplier
+    static constexpr unsigned read_request_base_count = 128;
+
+    struct config {
+        shard_id coordinator;
+        unsigned capacity = std::numeric_limits<unsigned>::max();
+        // Cost model of the disk, derived from its read and write IOPS and
+        // bandwidth: requests are charged by size and direction, and no
+        // more are dispatched once those executing add up to max_req_count
+        // or max_bytes_count, which is where the latency goal would be
+        // exceeded. Without one, requests are only limited by capacity.
+        bool disk_cost_model = false;
+        unsigned max_req_count = std::numeric_limits<int>::max();
+        unsigned max_bytes_count = std::numeric_limits<int>::max();
+        unsigned disk_req_write_to_read_multiplier = read_request_base_count;
+        float disk_bytes_write_to_read_multiplier = 1.0f;
+        // Weight of a dsync write; 0 when unknown, for twice a write's
+        unsigned disk_req_dsync_write_to_read_multiplier = 0;
+        // Class limits are split evenly between the I/O queues
+        unsigned nr_io_queues = 1;
+        // In decentralized mode, every shard has its own I/O queue, and the
+        // queues of the shards of a coordinator group share their capacity
+        // and cost model limits through this.
+        fair_queue_shared_capacity* shared_capacity = nullptr;
+        // Where the device is mounted, to tell the queues of different
+        // devices apart in metrics
+        sstring mountpoint = "undefined";
+        // Reads larger than this are split into requests of this size,
+        // queued separately, so that they don't hold up other classes; 0
+        // to keep them whole
+        size_t max_request_size = 0;
+    };
 private:
+    config _config;
     shard_id _coordinator;
     size_t _capacity;
     std::vector<shard_id> _io_topology;
 
+    using clock_type = tsc_clock;
+
+    // Log-linear histogram of latencies, in microseconds: every power of two
+    // is split into sub_buckets buckets, so that percentiles read from it are
+    // within 25% of the actual ones, while adding to it stays cheap
+    struct latency_histogram {
+        static constexpr unsigned sub_buckets = 4;
+        static constexpr unsigned nr_buckets = sub_buckets * 25;
+        std::array<uint64_t, nr_buckets> _buckets = {};
+        uint64_t _sum_us = 0;
+        void add(clock_type::duration d) noexcept;
+        metrics::histogram to_metrics() const;
+    };
+
     struct priority_class_data {
+        struct throttled_request {
+            promise<> pr;
+            size_t len;
+            clock_type::time_point since;
+        };
         priority_class_ptr ptr;
         size_t bytes;
         uint64_t ops;
         uint32_t nr_queued;
         std::chrono::duration<double> queue_time;
+        uint32_t shares;
+        // this queue's part of the class limits
+        io_priority_class_limits limits;
+        // Token buckets for the rate limits; they may go negative, so a
+        // request larger than the burst is let through and paid for later
+        double byte_tokens = 0;
+        double op_tokens = 0;
+        clock_type::time_point last_refill;
+        circular_buffer<throttled_request> throttled;
+        std::chrono::duration<double> throttled_time = std::chrono::duration<double>(0);
+        // Average latency of the class's requests, tracked if it has a goal
+        std::chrono::duration<double> latency = std::chrono::duration<double>(0);
+        bool latency_endangered = false;
+        // By direction, reads first: time requests waited in the queue, and
+        // then took to execute
+        std::array<latency_histogram, 2> queue_latency;
+        std::array<latency_histogram, 2> device_latency;
         metrics::metric_groups _metric_groups;
-        priority_class_data(sstring name, priority_class_ptr ptr, shard_id owner);
+        priority_class_data(sstring name, sstring mountpoint, priority_class_ptr ptr, uint32_t shares,
+                io_priority_class_limits limits, shard_id owner);
+        bool has_tokens(clock_type::time_point now);
+        void consume(size_t len);
     };
 
     std::unordered_map<unsigned, lw_shared_ptr<priority_class_data>> _priority_classes;
     fair_queue _fq;
+    // Shares of the class with the most shares whose latency is close to its
+    // goal; classes with fewer shares and no goal are throttled meanwhile
+    uint32_t _endangered_shares = 0;
+    timer<> _throttle_timer;
+
+    future<> admit(priority_class_data& pclass, size_t len);
+    bool latency_throttled(const priority_class_data& pclass) const;
+    void release_throttled();
+    void update_latency(priority_class_data& pclass, std::chrono::duration<double> latency);
+
+    static fair_queue::config make_fair_queue_config(const config& cfg);
+    fair_queue_request_descriptor request_descriptor(request_type type, size_t len) const;
 
     static constexpr unsigned _max_classes = 2048;
     static std::array<std::atomic<uint32_t>, _max_classes> _registered_shares;
     static std::array<sstring, _max_classes> _registered_names;
+    static std::array<io_priority_class_limits, _max_classes> _registered_limits;
 
-    static io_priority_class register_one_priority_class(sstring name, uint32_t shares);
+    static io_priority_class register_one_priority_class(sstring name, uint32_t shares,
+            io_priority_class_limits limits = io_priority_class_limits());
 
     priority_class_data& find_or_create_class(const io_priority_class& pc, shard_id owner);
     static void fill_shares_array();
     friend smp;
 public:
 
-    io_queue(shard_id coordinator, size_t capacity, std::vector<shard_id> topology);
+    io_queue(config cfg, std::vector<shard_id> topology);
     ~io_queue();
 
+    // Runs do_io through the queue, on its coordinator shard
+    template <typename Func>
+    future<io_event>
+    queue_request(const io_priority_class& pc, request_type type, size_t len, Func do_io);
+
+    // Runs func, which returns a future, through the queue on its
+    // coordinator shard, as a request of len bytes; for I/O that is not
+    // submitted to the storage backend
     template <typename Func>
-    static future<io_event>
-    queue_request(shard_id coordinator, const io_priority_class& pc, size_t len, Func do_io);
+    futurize_t<std::result_of_t<Func()>>
+    queue_work(const io_priority_class& pc, request_type type, size_t len, Func func);
 
     size_t capacity() const {
         return _capacity;
     }
 
+    size_t max_request_size() const {
+        return _config.max_request_size;
+    }
+
     size_t queued_requests() const {
         return _fq.waiters();
     }
 
+    // Queues that share their capacity are not woken up when another
+    // queue returns some, so the reactor polls them while they have waiters
+    bool poll_shared_capacity() {
+        return _config.shared_capacity && _fq.dispatch_pending();
+    }
+    bool can_poll_shared_capacity() const {
+        return _config.shared_capacity && _fq.can_dispatch_pending();
+    }
+    bool waiting_for_shared_capacity() const {
+        return _config.shared_capacity && _fq.waiters();
+    }
+
     shard_id coordinator() const {
         return _coordinator;
     }
@@ -580,10 +927,10 @@ class io_queue {
     friend class reactor;
 };
 
-constexpr unsigned max_scheduling_groups() { return 16; }
+constexpr unsigned max_scheduling_groups() { return 1024; }
 
 class reactor {
-    using sched_clock = std::chrono::steady_clock;
+    using sched_clock = tsc_clock;
 private:
     struct pollfn {
         virtual ~pollfn() {}
@@ -603,12 +950,13 @@ class reactor {
         virtual void exit_interrupt_mode() {}
     };
     struct task_queue;
-    using task_queue_list = circular_buffer_fixed_capacity<task_queue*, max_scheduling_groups()>;
+    using task_queue_list = std::vector<task_queue*>;
 
     class io_pollfn;
     class signal_pollfn;
     class aio_batch_submit_pollfn;
     class batch_flush_pollfn;
+    class foreign_disposal_pollfn;
     class smp_pollfn;
     class drain_cross_cpu_freelist_pollfn;
     class lowres_timer_pollfn;
@@ -620,6 +968,7 @@ class reactor {
     friend signal_pollfn;
     friend aio_batch_submit_pollfn;
     friend batch_flush_pollfn;
+    friend foreign_disposal_pollfn;
     friend smp_pollfn;
     friend drain_cross_cpu_freelist_pollfn;
     friend lowres_timer_pollfn;
@@ -661,6 +1010,12 @@ class reactor {
         uint64_t aio_read_bytes = 0;
         uint64_t aio_writes = 0;
         uint64_t aio_write_bytes = 0;
+        // of aio_writes, those to files opened with open_flags::dsync
+        uint64_t aio_dsync_writes = 0;
+        // buffered file reads served from the page cache by preadv2(RWF_NOWAIT),
+        // and those it could not serve without blocking
+        uint64_t buffered_reads_nowait = 0;
+        uint64_t buffered_reads_offloaded = 0;
         uint64_t fstream_reads = 0;
         uint64_t fstream_read_bytes = 0;
         uint64_t fstream_reads_blocked = 0;
@@ -669,16 +1024,13 @@ class reactor {
         uint64_t fstream_read_ahead_discarded_bytes = 0;
     };
 private:
-    // FIXME: make _backend a unique_ptr<reactor_backend>, not a compile-time #ifdef.
+    std::unique_ptr<reactor_backend> _backend;
 #ifdef HAVE_OSV
-    reactor_backend_osv _backend;
     sched::thread _timer_thread;
     sched::thread *_engine_thread;
     mutable mutex _timer_mutex;
     condvar _timer_cond;
     s64 _timer_due = 0;
-#else
-    reactor_backend_epoll _backend;
 #endif
     sigset_t _active_sigmask; // holds sigmask while sleeping with sig disabled
     std::vector<pollfn*> _pollers;
@@ -688,12 +1040,13 @@ class reactor {
     // some reactors will talk to foreign io_queues. If this reactor holds a valid IO queue, it will
     // be stored here.
     std::unique_ptr<io_queue> my_io_queue = {};
+    // The same, for the devices configured with --io-device
+    std::vector<std::unique_ptr<io_queue>> my_device_io_queues;
 
-
-    // For submiting the actual IO, all we need is the coordinator id. So storing it
-    // separately saves us the pointer access.
-    shard_id _io_coordinator;
+    // Queue of the devices not configured with --io-device
     io_queue* _io_queue;
+    // Queues of the devices configured with --io-device, by device id
+    std::unordered_map<dev_t, io_queue*> _device_io_queues;
     friend io_queue;
 
     std::vector<std::function<future<> ()>> _exit_funcs;
@@ -702,6 +1055,7 @@ class reactor {
     bool _stopped = false;
     condition_variable _stop_requested;
     bool _handle_sigint = true;
+    bool _task_accounting = false;
     promise<std::unique_ptr<network_stack>> _network_stack_ready_promise;
     int _return = 0;
     timer_t _steady_clock_timer = {};
@@ -714,20 +1068,42 @@ class reactor {
     unsigned _tasks_processed_report_threshold;
     unsigned _stall_detector_reports_per_minute;
     std::atomic<uint64_t> _stall_detector_missed_ticks = { 0 };
+    unsigned _cpu_profiler_frequency = 0;
+    std::unique_ptr<cpu_profiler> _cpu_profiler;
+    size_t _event_trace_size = 0;
+    sstring _event_trace_stall_dump;
+    std::unique_ptr<event_trace> _event_trace;
 
     unsigned _max_task_backlog = 1000;
     timer_set<timer<>, &timer<>::_link> _timers;
     timer_set<timer<>, &timer<>::_link>::timer_list_t _expired_timers;
-    timer_set<timer<lowres_clock>, &timer<lowres_clock>::_link> _lowres_timers;
-    timer_set<timer<lowres_clock>, &timer<lowres_clock>::_link>::timer_list_t _expired_lowres_timers;
+    timer_container_for<lowres_clock> _lowres_timers;
+    timer_container_for<lowres_clock>::timer_list_t _expired_lowres_timers;
     timer_set<timer<manual_clock>, &timer<manual_clock>::_link> _manual_timers;
     timer_set<timer<manual_clock>, &timer<manual_clock>::_link>::timer_list_t _expired_manual_timers;
-    io_context_t _io_context;
     std::vector<struct ::iocb> _pending_aio;
     semaphore _io_context_available;
     io_stats _io_stats;
     uint64_t _fsyncs = 0;
     uint64_t _cxx_exceptions = 0;
+    // Per task type statistics, collected only when task accounting is
+    // enabled. A task's type is the dynamic type of the task object, so
+    // continuations are distinguished by the type of their lambda.
+    // Latency distribution in power-of-two microsecond buckets: bucket i
+    // holds samples of [2^i, 2^(i+1)) us, bucket 0 also shorter ones.
+    struct log2_histogram {
+        static constexpr unsigned nr_buckets = 24;
+        std::array<uint64_t, nr_buckets> _buckets = {};
+        uint64_t _sum_us = 0;
+        void add(sched_clock::duration d) noexcept;
+        metrics::histogram to_metrics() const;
+    };
+    struct task_type_stats {
+        uint64_t _tasks_processed = 0;
+        sched_clock::duration _runtime = {};
+        sched_clock::duration _max_runtime = {};
+        seastar::metrics::metric_groups _metrics;
+    };
     struct task_queue {
         explicit task_queue(unsigned id, sstring name, float shares);
         int64_t _vruntime = 0;
@@ -735,20 +1111,66 @@ class reactor {
         int64_t _reciprocal_shares_times_2_power_32;
         bool _current = false;
         bool _active = false;
-        uint8_t _id;
+        // Activated while latency-critical; runs ahead of everything once
+        bool _boosted = false;
+        unsigned _id;
         sched_clock::duration _runtime = {};
         uint64_t _tasks_processed = 0;
         circular_buffer<std::unique_ptr<task>> _q;
         sstring _name;
+        // CPU bandwidth cap: the queue may run for _max_utilization of every
+        // bandwidth period, and is throttled once its budget is used up.
+        float _max_utilization = 1;
+        bool _throttled = false;
+        bool _latency_critical = false;
+        sched_clock::duration _bandwidth_budget = {};
+        sched_clock::time_point _bandwidth_period_start = {};
+        sched_clock::time_point _throttled_since = {};
+        sched_clock::duration _throttled_time = {};
+        // Set on sampled activations and on preemption; the time until the
+        // queue runs again is recorded in _wait_time.
+        sched_clock::time_point _ready_since = {};
+        unsigned _activations = 0;
+        log2_histogram _wait_time;
+        uint64_t _task_quota_violations = 0;
         int64_t to_vruntime(sched_clock::duration runtime) const;
         void set_shares(float shares);
+        void set_max_utilization(float fraction);
+        sched_clock::duration bandwidth_quota() const;
+        void refill_bandwidth(sched_clock::time_point now);
         struct indirect_compare;
+        struct heap_compare;
         seastar::metrics::metric_groups _metrics;
+        std::unordered_map<std::type_index, std::unique_ptr<task_type_stats>> _task_type_stats;
+        task_type_stats& get_task_type_stats(const std::type_info& ti);
     };
-    boost::container::static_vector<std::unique_ptr<task_queue>, max_scheduling_groups()> _task_queues;
+    // Indexed by scheduling group id; a queue is created on a shard the
+    // first time the group is used there, and is null before that and
+    // once the group has been destroyed.
+    std::vector<std::unique_ptr<task_queue>> _task_queues;
+    struct scheduling_group_spec {
+        sstring name;
+        float shares;
+    };
+    std::unordered_map<unsigned, scheduling_group_spec> _scheduling_group_specs;
     int64_t _last_vruntime = 0;
+    // Binary heap ordered by task_queue::heap_compare, so that choosing and
+    // re-queueing a task queue is logarithmic in the number of active groups
     task_queue_list _active_task_queues;
     task_queue_list _activating_task_queues;
+    std::vector<task_queue*> _throttled_task_queues;
+    struct foreign_disposal {
+        void* object;
+        void (*dispose)(void*);
+    };
+    // Objects owned by other shards, waiting to be sent back to them for
+    // destruction, indexed by owner shard
+    std::vector<std::vector<foreign_disposal>> _foreign_disposals;
+    std::vector<unsigned> _foreign_disposal_targets;
+    uint64_t _foreign_disposals_sent = 0;
+    uint64_t _foreign_disposal_batches_sent = 0;
+    log2_histogram _poll_iteration_time;
+    timer<> _bandwidth_timer;
     task_queue* _at_destroy_tasks;
     sched_clock::duration _task_quota;
     /// Handler that will be called when there is no task to execute on cpu.
@@ -772,20 +1194,48 @@ class reactor {
     sched_clock::duration _total_idle;
     sched_clock::time_point _start_time = sched_clock::now();
     std::chrono::nanoseconds _max_poll_time = calculate_poll_time();
+    std::unique_ptr<adaptive_poll_time> _adaptive_poll_time;
+    bool _work_stealing = false;
+    uint64_t _stealable_tasks_run = 0;
+    uint64_t _stealable_tasks_stolen = 0;
+    stealable_task_queue _stealable_tasks alignas(seastar::cache_line_size);
     circular_buffer<output_stream<char>* > _flush_batching;
     std::atomic<bool> _sleeping alignas(seastar::cache_line_size);
+    // Whether going to sleep and handing off work to a sleeping shard are
+    // ordered by a memory fence on each side (--sleep-protocol=fence),
+    // rather than by a systemwide barrier when going to sleep; the shards
+    // found asleep since the last poll are then woken together, once each
+    bool _fenced_sleep = false;
+    std::vector<reactor*> _pending_wakeups;
     pthread_t _thread_id alignas(seastar::cache_line_size) = pthread_self();
     bool _strict_o_direct = true;
     bool _bypass_fsync = false;
+    // Whether fdatasync() is submitted like reads and writes rather than
+    // run on a syscall thread; cleared if the kernel or filesystem refuses
+    bool _aio_fdsync = true;
+    // Cleared when the kernel turns down preadv2(RWF_NOWAIT)
+    bool _nowait_reads = true;
+    // Limit of the files' batched discards, shared by the shards of each
+    // device (0 for none), and how long they wait for the shard's disk I/O
+    // to go quiet (0 not to defer them)
+    uint64_t _discard_bandwidth = 0;
+    std::chrono::milliseconds _discard_defer{0};
+    // Of the open files tagged with file_open_options::latency_tag
+    std::unordered_set<const file_latency_stats*> _latency_tracked_files;
     bool& _local_need_preempt{g_need_preempt}; // for access from the _task_quota_timer_thread
     std::thread _task_quota_timer_thread;
     std::atomic<bool> _dying{false};
 private:
     static std::chrono::nanoseconds calculate_poll_time();
+    // The class batched discards are issued with, capped to --discard-bandwidth
+    const io_priority_class& discard_priority_class();
     static void block_notifier(int);
+    static void cpu_profiler_signal_handler(int);
     void wakeup();
+    void flush_wakeups();
     bool flush_pending_aio();
     bool flush_tcp_batches();
+    bool flush_foreign_disposals();
     bool do_expire_lowres_timers();
     bool do_check_lowres_timers() const;
     void expire_manual_timers();
@@ -803,6 +1253,10 @@ class reactor {
      */
     bool poll_once();
     bool pure_poll_once();
+    void add_stealable_task(std::unique_ptr<stealable_task> t);
+    // Takes the oldest stealable task of another shard, if any, and
+    // schedules it here; called when this shard is out of work.
+    bool steal_task();
     template <typename Func> // signature: bool ()
     static std::unique_ptr<pollfn> make_pollfn(Func&& func);
 
@@ -838,15 +1292,33 @@ class reactor {
     void run_some_tasks(sched_clock::time_point& t_run_completed);
     void activate(task_queue& tq);
     void insert_active_task_queue(task_queue* tq);
+    task_queue* pop_active_task_queue();
     void insert_activating_task_queues();
     void account_runtime(task_queue& tq, sched_clock::duration runtime);
+    // Checks the queue's CPU bandwidth budget after it ran; returns true
+    // (and parks the queue) if it must wait for the next period.
+    bool maybe_throttle(task_queue& tq, sched_clock::duration runtime, sched_clock::time_point now);
+    // Resumes throttled queues whose budget was replenished, or all of them
+    void unthrottle_task_queues(bool all = false);
     void account_idle(sched_clock::duration idletime);
     void init_scheduling_group(scheduling_group sg, sstring name, float shares);
+    void destroy_scheduling_group_queue(scheduling_group sg);
+    // Returns the task queue of \c id, creating it if the group exists but
+    // has not been used on this shard yet; tasks of a destroyed group go to
+    // the main group.
+    task_queue& task_queue_of(unsigned id) {
+        auto q = id < _task_queues.size() ? _task_queues[id].get() : nullptr;
+        if (__builtin_expect(q != nullptr, true)) {
+            return *q;
+        }
+        return create_task_queue(id);
+    }
+    task_queue& create_task_queue(unsigned id);
     uint64_t tasks_processed() const;
     uint64_t min_vruntime() const;
 public:
     static boost::program_options::options_description get_options_description(std::chrono::duration<double> default_task_quota);
-    explicit reactor(unsigned id);
+    explicit reactor(unsigned id, reactor_backend_config backend_cfg = {}, thread_pool_config thread_pool_cfg = {});
     reactor(const reactor&) = delete;
     ~reactor();
     void operator=(const reactor&) = delete;
@@ -855,10 +1327,29 @@ class reactor {
         return *_io_queue;
     }
 
+    /// \cond internal
+    // Returns the queue of the I/O device, the default one if it was not
+    // configured with --io-device
+    io_queue& get_io_queue(dev_t device_id) {
+        if (_device_io_queues.empty()) {
+            return *_io_queue;
+        }
+        auto i = _device_io_queues.find(device_id);
+        return i != _device_io_queues.end() ? *i->second : *_io_queue;
+    }
+    /// \endcond
+
     io_priority_class register_one_priority_class(sstring name, uint32_t shares) {
         return io_queue::register_one_priority_class(std::move(name), shares);
     }
 
+    /// Registers an I/O priority class that, on top of its shares, is
+    /// capped to absolute rates, or has a latency goal; see
+    /// \ref io_priority_class_limits.
+    io_priority_class register_one_priority_class(sstring name, uint32_t shares, io_priority_class_limits limits) {
+        return io_queue::register_one_priority_class(std::move(name), shares, limits);
+    }
+
     void configure(boost::program_options::variables_map config);
 
     server_socket listen(socket_address sa, listen_options opts = {});
@@ -882,7 +1373,14 @@ class reactor {
 
     future<> write_all(pollable_fd_state& fd, const void* buffer, size_t size);
 
+    // Sends up to len bytes of f from offset to a socket with sendfile();
+    // fails with EINVAL if f is not a posix file, or the kernel cannot send
+    // it (such as O_DIRECT files, on older kernels)
+    future<size_t> sendfile(pollable_fd_state& fd, file& f, uint64_t offset, size_t len);
+
     future<file> open_file_dma(sstring name, open_flags flags, file_open_options options = {});
+    future<> open_files_dma(std::vector<sstring> names, open_flags flags,
+            std::function<void (size_t index, future<file> f)> on_open, file_open_options options = {});
     future<file> open_directory(sstring name);
     future<> make_directory(sstring name);
     future<> touch_directory(sstring name);
@@ -900,9 +1398,10 @@ class reactor {
     template <typename Func>
     future<io_event> submit_io(Func prepare_io);
     template <typename Func>
-    future<io_event> submit_io_read(const io_priority_class& priority_class, size_t len, Func prepare_io);
+    future<io_event> submit_io_read(io_queue& ioq, const io_priority_class& priority_class, size_t len, Func prepare_io);
     template <typename Func>
-    future<io_event> submit_io_write(const io_priority_class& priority_class, size_t len, Func prepare_io);
+    future<io_event> submit_io_write(io_queue& ioq, const io_priority_class& priority_class, size_t len, Func prepare_io,
+            bool dsync = false);
 
     int run();
     void exit(int ret);
@@ -921,9 +1420,14 @@ class reactor {
         _at_destroy_tasks->_q.push_back(make_task(default_scheduling_group(), std::forward<Func>(func)));
     }
 
+    /// \cond internal
+    // Queues \c object for destruction by \c dispose on shard \c cpu. Such
+    // requests are sent once per poll iteration, in one message per shard.
+    void add_foreign_disposal(unsigned cpu, void* object, void (*dispose)(void*));
+    /// \endcond
     void add_task(std::unique_ptr<task>&& t) {
         auto sg = t->group();
-        auto* q = _task_queues[sg._id].get();
+        auto* q = &task_queue_of(sg._id);
         bool was_empty = q->_q.empty();
         q->_q.push_back(std::move(t));
         if (was_empty) {
@@ -932,7 +1436,7 @@ class reactor {
     }
     void add_urgent_task(std::unique_ptr<task>&& t) {
         auto sg = t->group();
-        auto* q = _task_queues[sg._id].get();
+        auto* q = &task_queue_of(sg._id);
         bool was_empty = q->_q.empty();
         q->_q.push_front(std::move(t));
         if (was_empty) {
@@ -963,8 +1467,14 @@ class reactor {
 
     steady_clock_type::duration total_idle_time();
     steady_clock_type::duration total_busy_time();
+    /// Fraction of the last five seconds the reactor was busy, from 0 to 1
+    double utilization() const { return 1 - _load; }
 
     const io_stats& get_io_stats() const { return _io_stats; }
+    /// Returns the latency of the \c n open files of this shard tagged with
+    /// \ref file_open_options::latency_tag whose reads and writes took the
+    /// longest on average, slowest first.
+    std::vector<file_latency_stats> slowest_files(size_t n) const;
 #ifdef HAVE_OSV
     void timer_thread_func();
     void set_timer(sched::timer &tmr, s64 t);
@@ -1001,6 +1511,8 @@ class reactor {
     friend class pollable_fd;
     friend class pollable_fd_state;
     friend class posix_file_impl;
+    friend class append_challenged_posix_file_impl;
+    friend class mmap_data_source_impl;
     friend class blockdev_file_impl;
     friend class readable_eventfd;
     friend class timer<>;
@@ -1014,32 +1526,55 @@ class reactor {
     friend int ::_Unwind_RaiseException(void *h);
     metrics::metric_groups _metric_groups;
     friend future<scheduling_group> create_scheduling_group(sstring name, float shares);
+    friend future<> destroy_scheduling_group(scheduling_group sg);
 public:
     bool wait_and_process(int timeout = 0, const sigset_t* active_sigmask = nullptr) {
-        return _backend.wait_and_process(timeout, active_sigmask);
+        return _backend->wait_and_process(timeout, active_sigmask);
     }
 
     future<> readable(pollable_fd_state& fd) {
-        return _backend.readable(fd);
+        return _backend->readable(fd);
     }
     future<> writeable(pollable_fd_state& fd) {
-        return _backend.writeable(fd);
+        return _backend->writeable(fd);
     }
     void forget(pollable_fd_state& fd) {
-        _backend.forget(fd);
+        _backend->forget(fd);
     }
     future<> notified(reactor_notifier *n) {
-        return _backend.notified(n);
+        return _backend->notified(n);
     }
     void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
-        return _backend.abort_reader(fd, std::move(ex));
+        return _backend->abort_reader(fd, std::move(ex));
     }
     void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
-        return _backend.abort_writer(fd, std::move(ex));
+        return _backend->abort_writer(fd, std::move(ex));
     }
     void enable_timer(steady_clock_type::time_point when);
+    /// \cond internal
+    /// Checks for work that other shards hand to this one, and then call
+    /// \ref maybe_wakeup() for. It is polled along with the smp queues,
+    /// whose sleep protocol makes sure that a shard that went to sleep
+    /// before seeing the work is woken.
+    class remote_work_poller {
+    public:
+        virtual ~remote_work_poller() {}
+        // Returns true if work was done
+        virtual bool poll() = 0;
+        // Returns true if there is work to do, without doing it
+        virtual bool pure_poll() = 0;
+    };
+private:
+    std::vector<remote_work_poller*> _remote_work_pollers;
+public:
+    void register_remote_work_poller(remote_work_poller& p);
+    void unregister_remote_work_poller(remote_work_poller& p);
+    /// Wakes the shard if it sleeps; called from other shards, after they
+    /// made the work visible
+    void maybe_wakeup();
+    /// \endcond
     std::unique_ptr<reactor_notifier> make_reactor_notifier() {
-        return _backend.make_reactor_notifier();
+        return _backend->make_reactor_notifier();
     }
     /// Sets the "Strict DMA" flag.
     ///
@@ -1053,9 +1588,39 @@ class reactor {
     void set_strict_dma(bool value) {
         _strict_o_direct = value;
     }
+    /// Enables or disables per task type runtime accounting.
+    ///
+    /// When enabled, the reactor measures the execution time of every task
+    /// and exports its count, total and maximum runtime per scheduling group
+    /// and task type (the demangled type of the continuation) under the
+    /// \c scheduler metrics group. This adds two clock reads per task.
+    void set_task_accounting(bool value) {
+        _task_accounting = value;
+    }
     void set_bypass_fsync(bool value) {
         _bypass_fsync = value;
     }
+    /// Returns the samples collected by the sampling CPU profiler on this
+    /// shard, oldest first, or an empty vector if it is disabled (see
+    /// \c --cpu-profiler-frequency).
+    std::vector<cpu_profiler_sample> cpu_profiler_samples() {
+        return _cpu_profiler ? _cpu_profiler->samples() : std::vector<cpu_profiler_sample>();
+    }
+    /// Returns the latest reactor events recorded on this shard (see
+    /// \c --event-trace-size), as an \ref event_trace_dump_header followed
+    /// by its records, or an empty string if the event trace is disabled.
+    /// scripts/event_trace_to_chrome.py converts dumps to the Chrome trace
+    /// format, which Perfetto reads.
+    sstring event_trace_dump() const {
+        return _event_trace ? _event_trace->dump() : sstring();
+    }
+    /// \cond internal
+    void trace_event(event_trace_type type, uint16_t group, uint32_t arg = 0) noexcept {
+        if (__builtin_expect(bool(_event_trace), false)) {
+            _event_trace->record(type, group, arg);
+        }
+    }
+    /// \endcond
 };
 
 template <typename Func> // signature: bool ()
@@ -1091,12 +1656,15 @@ class smp {
     static std::vector<std::function<void ()>> _thread_loops; // for dpdk
     static std::experimental::optional<boost::barrier> _all_event_loops_done;
     static std::vector<reactor*> _reactors;
+    static std::vector<unsigned> _numa_nodes;
+    static std::vector<unsigned> _cache_domains;
     static smp_message_queue** _qs;
     static std::thread::id _tmain;
     static bool _using_dpdk;
 
     template <typename Func>
     using returns_future = is_future<std::result_of_t<Func()>>;
+    friend class reactor;
     template <typename Func>
     using returns_void = std::is_same<std::result_of_t<Func()>, void>;
 public:
@@ -1142,11 +1710,46 @@ class smp {
             return _qs[t][engine().cpu_id()].submit(std::forward<Func>(func));
         }
     }
+    /// Runs a self-contained function on any core.
+    ///
+    /// The function is queued on the local core, and runs there unless an
+    /// idle core steals it first (see \c --work-stealing); this spreads
+    /// CPU-bound background work over cores that have nothing else to do.
+    /// Since it may run on any core, \c func must not touch shard-local
+    /// state (including services and \c engine()), and must not return a
+    /// future. It runs in the current scheduling group.
+    ///
+    /// \param func a callable to run on some core. It is destroyed on the
+    ///          local core.
+    /// \return whatever \c func returns, as a future<> resolved on the
+    ///          local core.
+    template <typename Func>
+    static futurize_t<std::result_of_t<Func()>> submit_stealable(Func&& func) {
+        static_assert(!is_future<std::result_of_t<Func()>>::value, "stealable functions must not return a future");
+        auto t = std::make_unique<stealable_task_impl<std::decay_t<Func>>>(engine().cpu_id(), current_scheduling_group(),
+                std::decay_t<Func>(std::forward<Func>(func)));
+        auto f = t->get_future();
+        engine().add_stealable_task(std::move(t));
+        return f;
+    }
     static bool poll_queues();
     static bool pure_poll_queues();
     static boost::integer_range<unsigned> all_cpus() {
         return boost::irange(0u, count);
     }
+    // Returns the NUMA node the shard's memory and cpu were allocated from
+    static unsigned numa_node(unsigned shard) {
+        return shard < _numa_nodes.size() ? _numa_nodes[shard] : 0;
+    }
+    // Returns the last level cache (L3/CCX) domain of the shard's cpu; shards
+    // with the same domain and NUMA node share that cache
+    static unsigned cache_domain(unsigned shard) {
+        return shard < _cache_domains.size() ? _cache_domains[shard] : 0;
+    }
+    // Returns all shards ordered by their distance from \c shard: the shard
+    // itself, then those sharing its cache domain, then those on its NUMA
+    // node, then the rest. Useful to pick nearby peers for a shard to talk to.
+    static std::vector<unsigned> nearby_shards(unsigned shard);
     // Invokes func on all shards.
     // The returned future resolves when all async invocations finish.
     // The func may return void or future<>.
@@ -1161,12 +1764,25 @@ class smp {
 private:
     static void start_all_queues();
     static void pin(unsigned cpu_id);
-    static void allocate_reactor(unsigned id);
+    static void allocate_reactor(unsigned id, reactor_backend_config backend_cfg, thread_pool_config thread_pool_cfg);
     static void create_thread(std::function<void ()> thread_loop);
 public:
     static unsigned count;
 };
 
+inline
+void
+reactor::add_foreign_disposal(unsigned cpu, void* object, void (*dispose)(void*)) {
+    if (_foreign_disposals.size() <= cpu) {
+        _foreign_disposals.resize(smp::count);
+    }
+    auto& batch = _foreign_disposals[cpu];
+    if (batch.empty()) {
+        _foreign_disposal_targets.push_back(cpu);
+    }
+    batch.push_back(foreign_disposal{object, dispose});
+}
+
 inline
 pollable_fd_state::~pollable_fd_state() {
     engine().forget(*this);
@@ -1278,6 +1894,11 @@ future<size_t> pollable_fd::read_some(const std::vector<iovec>& iov) {
     return engine().read_some(*_s, iov);
 }
 
+inline
+future<size_t> pollable_fd::sendfile(file& f, uint64_t offset, size_t len) {
+    return engine().sendfile(*_s, f, offset, len);
+}
+
 inline
 future<> pollable_fd::write_all(const char* buffer, size_t size) {
     return engine().write_all(*_s, buffer, size);
@@ -1388,6 +2009,36 @@ future<size_t> pollable_fd::sendmsg(struct msghdr* msg) {
     });
 }
 
+inline
+future<size_t> pollable_fd::recvmmsg(struct mmsghdr* msgs, unsigned vlen) {
+    return engine().readable(*_s).then([this, msgs, vlen] {
+        auto r = get_file_desc().recvmmsg(msgs, vlen, 0);
+        if (!r) {
+            return recvmmsg(msgs, vlen);
+        }
+        // Unlike recvmsg(), a batch that is not full tells that the queue
+        // is empty, so there is no point in speculating then
+        if (*r == vlen) {
+            _s->speculate_epoll(EPOLLIN);
+        }
+        return make_ready_future<size_t>(*r);
+    });
+}
+
+inline
+future<size_t> pollable_fd::sendmmsg(struct mmsghdr* msgs, unsigned vlen) {
+    return engine().writeable(*_s).then([this, msgs, vlen] {
+        auto r = get_file_desc().sendmmsg(msgs, vlen, 0);
+        if (!r) {
+            return sendmmsg(msgs, vlen);
+        }
+        if (*r == vlen) {
+            _s->speculate_epoll(EPOLLOUT);
+        }
+        return make_ready_future<size_t>(*r);
+    });
+}
+
 inline
 future<size_t> pollable_fd::sendto(socket_address addr, const void* buf, size_t len) {
     return engine().writeable(*_s).then([this, buf, len, addr] () mutable {
@@ -85,6 +85,17 @@ size_t calculate_memory(configuration c, size_t available_memory, float panic_fa
     return mem;
 }
 
+cpu_placement parse_cpu_placement(const std::string& name) {
+    if (name == "spread") {
+        return cpu_placement::spread;
+    } else if (name == "ccx-dense") {
+        return cpu_placement::ccx_dense;
+    } else if (name == "smt-avoid") {
+        return cpu_placement::smt_avoid;
+    }
+    throw std::invalid_argument(format("unknown cpu placement {} (valid values: spread, ccx-dense, smt-avoid)", name));
+}
+
 }
 
 }
@@ -95,6 +106,8 @@ size_t calculate_memory(configuration c, size_t available_memory, float panic_fa
 #include "core/print.hh"
 #include <hwloc.h>
 #include <unordered_map>
+#include <algorithm>
+#include <tuple>
 #include <boost/range/irange.hpp>
 
 namespace seastar {
@@ -112,6 +125,22 @@ size_t div_roundup(size_t num, size_t denom) {
     return (num + denom - 1) / denom;
 }
 
+// Returns the logical index of the outermost cache above the pu, that is,
+// of the last level cache domain it belongs to.
+static unsigned find_cache_id(hwloc_topology_t& topology, hwloc_obj_t pu) {
+    hwloc_obj_t llc = nullptr;
+    for (auto obj = pu->parent; obj; obj = obj->parent) {
+#if HWLOC_API_VERSION >= 0x00020000
+        if (hwloc_obj_type_is_dcache(obj->type)) {
+#else
+        if (obj->type == HWLOC_OBJ_CACHE && obj->attr->cache.type != HWLOC_OBJ_CACHE_INSTRUCTION) {
+#endif
+            llc = obj;
+        }
+    }
+    return llc ? llc->logical_index : 0;
+}
+
 static unsigned find_memory_depth(hwloc_topology_t& topology) {
     auto depth = hwloc_get_type_depth(topology, HWLOC_OBJ_PU);
     auto obj = hwloc_get_next_obj_by_depth(topology, depth, nullptr);
@@ -243,6 +272,33 @@ allocate_io_queues(hwloc_topology_t& topology, configuration c, std::vector<cpu>
 }
 
 
+// Reorders the allocated cpus, and so the shard ids assigned to them, so
+// that neighbouring shards share cache domains as the policy asks.
+static void place_cpus(std::vector<cpu>& cpus, cpu_placement placement) {
+    if (placement == cpu_placement::spread) {
+        return;
+    }
+    // For each cpu, the number of SMT siblings that precede it
+    std::vector<std::pair<unsigned, cpu>> ranked;
+    std::unordered_map<unsigned, unsigned> seen_cores;
+    for (auto&& c : cpus) {
+        auto rank = seen_cores[c.core_id]++;
+        ranked.emplace_back(rank, std::move(c));
+    }
+    auto key = [placement] (const std::pair<unsigned, cpu>& rc) {
+        auto& c = rc.second;
+        auto rank = placement == cpu_placement::smt_avoid ? rc.first : 0;
+        return std::make_tuple(c.nodeid, c.cache_id, rank, c.core_id);
+    };
+    std::stable_sort(ranked.begin(), ranked.end(), [&key] (const auto& a, const auto& b) {
+        return key(a) < key(b);
+    });
+    cpus.clear();
+    for (auto&& rc : ranked) {
+        cpus.push_back(std::move(rc.second));
+    }
+}
+
 resources allocate(configuration c) {
     hwloc_topology_t topology;
     hwloc_topology_init(&topology);
@@ -296,6 +352,10 @@ resources allocate(configuration c) {
         auto node = hwloc_get_ancestor_obj_by_depth(topology, depth, pu);
         cpu this_cpu;
         this_cpu.cpu_id = cpu_id;
+        this_cpu.nodeid = hwloc_bitmap_first(node->nodeset);
+        auto core = hwloc_get_ancestor_obj_by_type(topology, HWLOC_OBJ_CORE, pu);
+        this_cpu.core_id = core ? core->logical_index : pu->logical_index;
+        this_cpu.cache_id = find_cache_id(topology, pu);
         remain = mem_per_proc - alloc_from_node(this_cpu, node, topo_used_mem, mem_per_proc);
 
         remains.emplace_back(std::move(this_cpu), remain);
@@ -322,6 +382,7 @@ resources allocate(configuration c) {
         ret.cpus.push_back(std::move(this_cpu));
     }
 
+    place_cpus(ret.cpus, c.placement);
     ret.io_queues = allocate_io_queues(topology, c, ret.cpus);
     return ret;
 }
@@ -376,7 +437,7 @@ resources allocate(configuration c) {
     auto procs = c.cpus.value_or(cpuset_procs);
     ret.cpus.reserve(procs);
     for (unsigned i = 0; i < procs; ++i) {
-        ret.cpus.push_back(cpu{i, {{mem / procs, 0}}});
+        ret.cpus.push_back(cpu{i, {{mem / procs, 0}}, 0, i});
     }
 
     ret.io_queues = allocate_io_queues(c, ret.cpus);
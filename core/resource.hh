@@ -40,6 +40,21 @@ using std::experimental::optional;
 
 using cpuset = std::set<unsigned>;
 
+// How shard ids are mapped onto the allocated cpus.
+enum class cpu_placement {
+    // hwloc's distribution order (the default)
+    spread,
+    // consecutive shards share an L3 cache domain (a CCX on AMD), and then a
+    // physical core, so that neighbouring shards share the most cache
+    ccx_dense,
+    // consecutive shards share an L3 cache domain, but use different
+    // physical cores before doubling up on SMT siblings
+    smt_avoid,
+};
+
+// Parses a --cpu-placement value; throws std::invalid_argument
+cpu_placement parse_cpu_placement(const std::string& name);
+
 struct configuration {
     optional<size_t> total_memory;
     optional<size_t> reserve_memory;  // if total_memory not specified
@@ -47,6 +62,7 @@ struct configuration {
     optional<cpuset> cpu_set;
     optional<unsigned> max_io_requests;
     optional<unsigned> io_queues;
+    cpu_placement placement = cpu_placement::spread;
 };
 
 struct memory {
@@ -71,6 +87,9 @@ struct io_queue_topology {
 struct cpu {
     unsigned cpu_id;
     std::vector<memory> mem;
+    unsigned nodeid = 0;   // NUMA node
+    unsigned core_id = 0;  // physical core; shared by SMT siblings
+    unsigned cache_id = 0; // last level cache (L3/CCX) domain
 };
 
 struct resources {
@@ -0,0 +1,172 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "deleter.hh"
+#include "temporary_buffer.hh"
+#include "scattered_message.hh"
+#include "sstring.hh"
+#include "net/packet.hh"
+
+namespace seastar {
+
+/// \addtogroup utilities
+/// @{
+
+/// Builds a large output, such as a response, out of many pieces without
+/// concatenating them.
+///
+/// Where appending to an \ref sstring reallocates and copies what was
+/// built so far, a rope keeps a list of fragments: small pieces are copied
+/// into the chunk it is filling, and large buffers that it can own (a
+/// \ref temporary_buffer, an sstring passed by value, or static data) are
+/// referenced as fragments of their own. The result is released as a
+/// \ref net::packet or a \ref scattered_message, which hand the fragments
+/// to the network as they are.
+template <typename CharType>
+class basic_rope {
+    using string_type = basic_sstring<CharType, uint32_t, 15>;
+    std::vector<temporary_buffer<CharType>> _fragments;
+    // The chunk being filled: its first _used characters hold data, and
+    // the rest has room for more
+    temporary_buffer<CharType> _current;
+    size_t _used = 0;
+    size_t _size = 0;
+    size_t _chunk_size;
+public:
+    static constexpr size_t default_chunk_size = 1024;
+    /// \param chunk_size size of the chunks small pieces are copied into;
+    ///        pieces of at least a quarter of it are referenced instead.
+    explicit basic_rope(size_t chunk_size = default_chunk_size)
+            : _chunk_size(std::max<size_t>(chunk_size, 16)) {
+    }
+    basic_rope(basic_rope&&) noexcept = default;
+    basic_rope& operator=(basic_rope&&) noexcept = default;
+
+    /// Total number of characters appended
+    size_t size() const {
+        return _size;
+    }
+    bool empty() const {
+        return !_size;
+    }
+
+    /// Copies \c n characters from \c p
+    void append(const CharType* p, size_t n) {
+        if (n > _current.size() - _used) {
+            seal();
+            _current = temporary_buffer<CharType>(std::max(n, _chunk_size));
+        }
+        std::copy_n(p, n, _current.get_write() + _used);
+        _used += n;
+        _size += n;
+    }
+    void append(const CharType* s) {
+        append(s, std::char_traits<CharType>::length(s));
+    }
+    void append(const string_type& s) {
+        append(s.begin(), s.size());
+    }
+    /// Takes \c buf over; it is copied if small.
+    void append(temporary_buffer<CharType> buf) {
+        if (copied(buf.size())) {
+            append(buf.get(), buf.size());
+            return;
+        }
+        seal();
+        _size += buf.size();
+        _fragments.push_back(std::move(buf));
+    }
+    /// Takes \c s over; it is copied if small.
+    void append(string_type&& s) {
+        if (copied(s.size())) {
+            append(s.begin(), s.size());
+            return;
+        }
+        append(std::move(s).release());
+    }
+    /// References \c n characters at \c p, which must live until the
+    /// rope's output is sent; they are copied if few.
+    void append_static(const CharType* p, size_t n) {
+        if (copied(n)) {
+            append(p, n);
+            return;
+        }
+        append(temporary_buffer<CharType>(const_cast<CharType*>(p), n, deleter()));
+    }
+    template <typename T>
+    basic_rope& operator<<(T&& x) {
+        append(std::forward<T>(x));
+        return *this;
+    }
+
+    /// Releases the rope's content as a packet, with one fragment per
+    /// fragment of the rope.
+    net::packet release_packet() && {
+        static_assert(std::is_same<CharType, char>::value, "packet works on char");
+        seal();
+        std::vector<net::fragment> frags;
+        frags.reserve(_fragments.size());
+        for (auto&& f : _fragments) {
+            frags.push_back(net::fragment{f.get_write(), f.size()});
+        }
+        auto d = make_object_deleter(std::move(_fragments));
+        _size = 0;
+        return net::packet(std::move(frags), std::move(d));
+    }
+    scattered_message<CharType> release_message() && {
+        return scattered_message<CharType>(std::move(*this).release_packet());
+    }
+    /// Copies the content into one string.
+    string_type linearize() const {
+        string_type ret(typename string_type::initialized_later(), _size);
+        auto p = ret.begin();
+        for (auto&& f : _fragments) {
+            p = std::copy_n(f.get(), f.size(), p);
+        }
+        std::copy_n(_current.get(), _used, p);
+        return ret;
+    }
+private:
+    bool copied(size_t n) const {
+        return n < _chunk_size / 4;
+    }
+    // Moves the filled part of the current chunk to the fragments; the
+    // rest of the chunk stays available for further copies
+    void seal() {
+        if (_used) {
+            _fragments.push_back(_current.share(0, _used));
+            _current.trim_front(_used);
+            _used = 0;
+        }
+    }
+};
+
+using rope = basic_rope<char>;
+
+/// @}
+
+}
@@ -41,6 +41,7 @@ class scattered_message {
     packet _p;
 public:
     scattered_message() {}
+    explicit scattered_message(packet p) : _p(std::move(p)) {}
     scattered_message(scattered_message&&) = default;
     scattered_message(const scattered_message&) = delete;
 
@@ -75,6 +76,14 @@ class scattered_message {
         }
     }
 
+    // The buffer is referred to, not copied, so a share() of one kept by
+    // the shard can be sent by many messages
+    void append(temporary_buffer<char_type> buf) {
+        if (buf.size()) {
+            _p = packet(std::move(_p), std::move(buf));
+        }
+    }
+
     template <typename size_type, size_type max_size, typename Callback>
     void append(const basic_sstring<char_type, size_type, max_size>& s, Callback callback) {
         if (s.size()) {
@@ -35,6 +35,11 @@ class reactor;
 
 class scheduling_group;
 
+namespace memory {
+
+struct allocation_group_stats;
+
+}
 
 /// Creates a scheduling group with a specified number of shares.
 ///
@@ -45,6 +50,18 @@ class scheduling_group;
 /// \return a scheduling group that can be used on any shard
 future<scheduling_group> create_scheduling_group(sstring name, float shares);
 
+/// Destroys a scheduling group.
+///
+/// Tasks still queued in the group on any shard are moved to the default
+/// group, as are tasks scheduled in it afterwards; the group's id may be
+/// reused by a later create_scheduling_group(). Must not be called from
+/// within the group itself.
+///
+/// \param sg the scheduling group to destroy; not the default group.
+/// \return a future that becomes ready when the group was destroyed on
+///         all shards.
+future<> destroy_scheduling_group(scheduling_group sg);
+
 /// \brief Identifies function calls that are accounted as a group
 ///
 /// A `scheduling_group` is a tag that can be used to mark a function call.
@@ -74,7 +91,33 @@ class scheduling_group {
     /// \param shares number of shares allotted to the group. Use numbers
     ///               in the 1-1000 range.
     void set_shares(float shares);
+    /// Caps the fraction of CPU time the group may use.
+    ///
+    /// Independently of its shares, the group is not allowed to run for
+    /// more than \c fraction of each 10ms period, even if the CPU would
+    /// otherwise be idle; once it used up its budget its tasks wait for the
+    /// next period. This keeps headroom for other groups' bursts. The
+    /// time spent waiting is exported as the group's \c throttled_time_ms
+    /// metric. The adjustment is local to the shard.
+    ///
+    /// \param fraction fraction of the CPU the group may use, in (0, 1];
+    ///                 1 (the default) means no cap.
+    void set_max_utilization(float fraction);
+    /// Marks the group as latency-critical.
+    ///
+    /// When a latency-critical group becomes runnable it is scheduled ahead
+    /// of all other groups, and the running task queue is asked to yield
+    /// at the next preemption check, instead of waiting for its turn by
+    /// virtual runtime. Once running, it is accounted and preempted
+    /// normally. Use it for small amounts of work with tight latency
+    /// requirements, possibly together with set_max_utilization(). The
+    /// adjustment is local to the shard.
+    void set_latency_critical(bool critical);
+    /// Returns the memory allocated by the group's tasks on this shard,
+    /// if the reactor runs with --memory-group-accounting.
+    memory::allocation_group_stats memory_stats() const;
     friend future<scheduling_group> create_scheduling_group(sstring name, float shares);
+    friend future<> destroy_scheduling_group(scheduling_group sg);
     friend class reactor;
 };
 
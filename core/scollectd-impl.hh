@@ -34,6 +34,8 @@ using duration = std::chrono::milliseconds;
 
 static const ipv4_addr default_addr("239.192.74.66:25826");
 static const std::chrono::milliseconds default_period(1s);
+// collectd's default network buffer size: fits in an ethernet frame
+static const size_t default_packet_size = 1452;
 
 class impl {
     net::udp_channel _chan;
@@ -42,6 +44,10 @@ class impl {
     sstring _host = "localhost";
     ipv4_addr _addr = default_addr;
     std::chrono::milliseconds _period = default_period;
+    size_t _packet_size = default_packet_size;
+    // overrides of _period, by metric group
+    std::unordered_map<sstring, duration> _group_periods;
+    uint64_t _tick = 0; // polls so far
     uint64_t _num_packets = 0;
     uint64_t _millis = 0;
     uint64_t _bytes = 0;
@@ -60,8 +66,10 @@ class impl {
     future<> send_notification(const type_instance_id & id,
             const sstring & msg);
     // initiates actual value polling -> send to target "loop"
-    void start(const sstring & host, const ipv4_addr & addr, const std::chrono::milliseconds period);
+    void start(const sstring & host, const ipv4_addr & addr, const std::chrono::milliseconds period,
+            size_t packet_size = default_packet_size);
     void stop();
+    void set_group_period(const sstring& group, duration period);
 
     value_list_map& get_value_list_map();
     const sstring& host() const {
@@ -71,6 +79,7 @@ class impl {
 private:
     void arm();
     void run();
+    duration group_period(const sstring& group) const;
 
 public:
     shared_ptr<value_list> get_values(const type_instance_id & id) const;
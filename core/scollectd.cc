@@ -78,7 +78,6 @@ seastar::metrics::impl::metric_id to_metrics_id(const type_instance_id & id) {
 
 const plugin_instance_id per_cpu_plugin_instance("#cpu");
 
-static const size_t payload_size = 1024;
 
 enum class part_type : uint16_t {
     Host = 0x0000, // The name of the host to associate with subsequent data values
@@ -103,7 +102,7 @@ typedef std::chrono::duration<uint64_t, std::ratio<1, 0x40000000>> collectd_hres
 // yet another writer type, this one to construct collectd network
 // protocol data.
 struct cpwriter {
-    typedef std::array<char, payload_size> buffer_type;
+    typedef std::vector<char> buffer_type;
     typedef buffer_type::iterator mark_type;
     typedef buffer_type::const_iterator const_mark_type;
 
@@ -111,10 +110,13 @@ struct cpwriter {
     mark_type _pos;
     bool _overflow = false;
 
+    // the parts written to the packet so far, which apply to the values
+    // that follow them until overridden
     std::unordered_map<uint16_t, sstring> _cache;
+    std::unordered_map<uint16_t, uint64_t> _numeric_cache;
 
-    cpwriter()
-            : _pos(_buf.begin()) {
+    explicit cpwriter(size_t packet_size = default_packet_size)
+            : _buf(packet_size), _pos(_buf.begin()) {
     }
     mark_type mark() const {
         return _pos;
@@ -135,6 +137,7 @@ struct cpwriter {
     void clear() {
         reset(_buf.begin());
         _cache.clear();
+        _numeric_cache.clear();
         _overflow = false;
     }
     const char * data() const {
@@ -235,6 +238,14 @@ struct cpwriter {
         write(t);
         return *this;
     }
+    cpwriter & put_cached(part_type type, uint64_t v) {
+        auto i = _numeric_cache.find(uint16_t(type));
+        if (i == _numeric_cache.end() || i->second != v) {
+            put(type, v);
+            _numeric_cache[uint16_t(type)] = v;
+        }
+        return *this;
+    }
     cpwriter & put(part_type type, const value_list & v) {
         auto s = v.size();
         auto sz = 6 + s + s * sizeof(uint64_t);
@@ -267,7 +278,7 @@ struct cpwriter {
                 std::chrono::duration_cast<std::chrono::seconds>(ts).count();
 
         put_cached(part_type::Host, host);
-        put(part_type::Time, uint64_t(lrts));
+        put_cached(part_type::Time, uint64_t(lrts));
         // Seems hi-res timestamp does not work very well with
         // at the very least my default collectd in fedora (or I did it wrong?)
         // Use lo-res ts for now, it is probably quite sufficient.
@@ -287,10 +298,10 @@ struct cpwriter {
         const auto ps = std::chrono::duration_cast<collectd_hres_duration>(
                         period).count();
             put(host, to_metrics_id(id));
-            put(part_type::Values, v);
             if (ps != 0) {
-                put(part_type::IntervalHr, ps);
+                put_cached(part_type::IntervalHr, ps);
             }
+            put(part_type::Values, v);
             return *this;
     }
 
@@ -300,10 +311,10 @@ struct cpwriter {
         const auto ps = std::chrono::duration_cast<collectd_hres_duration>(
                 period).count();
         put(host, id);
-        put(part_type::Values, v);
         if (ps != 0) {
-            put(part_type::IntervalHr, ps);
+            put_cached(part_type::IntervalHr, ps);
         }
+        put(part_type::Values, v);
         return *this;
     }
 };
@@ -325,22 +336,23 @@ future<> impl::send_metric(const type_instance_id & id,
     if (values.empty()) {
         return make_ready_future();
     }
-    cpwriter out;
+    cpwriter out(_packet_size);
     out.put(_host, duration(), id, values);
     return _chan.send(_addr, net::packet(out.data(), out.size()));
 }
 
 future<> impl::send_notification(const type_instance_id & id,
         const sstring & msg) {
-    cpwriter out;
+    cpwriter out(_packet_size);
     out.put(_host, to_metrics_id(id));
     out.put(part_type::Message, msg);
     return _chan.send(_addr, net::packet(out.data(), out.size()));
 }
 
 // initiates actual value polling -> send to target "loop"
-void impl::start(const sstring & host, const ipv4_addr & addr, const duration period) {
+void impl::start(const sstring & host, const ipv4_addr & addr, const duration period, size_t packet_size) {
     _period = period;
+    _packet_size = packet_size;
     _addr = addr;
     _host = host;
     _chan = engine().net().make_udp_channel();
@@ -383,93 +395,110 @@ void impl::arm() {
 }
 
 void impl::run() {
-    typedef size_t metric_family_id;
-    typedef seastar::metrics::impl::value_vector::iterator value_iterator;
-    typedef seastar::metrics::impl::metric_metadata_vector::iterator metadata_iterator;
-    typedef std::tuple<metric_family_id, metadata_iterator, value_iterator, cpwriter> context;
-
-    auto ctxt = make_lw_shared<context>();
-    foreign_ptr<shared_ptr<seastar::metrics::impl::values_copy>> vals =  seastar::metrics::impl::get_values();
+    // Fills packets with as many values as fit, and sends each as soon as
+    // it is full, without waiting for the previous ones: the datagrams
+    // queued in one task go out together.
+    struct context {
+        foreign_ptr<shared_ptr<seastar::metrics::impl::values_copy>> vals;
+        size_t family = 0;
+        cpwriter out;
+        std::vector<future<>> sent;
+        context(size_t packet_size) : out(packet_size) {}
+    };
+    auto ctxt = make_lw_shared<context>(_packet_size);
+    ctxt->vals = seastar::metrics::impl::get_values();
+    auto start = steady_clock_type::now();
+    auto tick = _tick++;
 
     // note we're doing this unsynced since we assume
     // all registrations to this instance will be done on the
     // same cpu, and without interuptions (no wait-states)
 
-    auto& values = vals->values;
-    auto metadata = vals->metadata;
-    std::get<metric_family_id>(*ctxt) = 0;
-    if (values.size() > 0) {
-        std::get<value_iterator>(*ctxt) = values[0].begin();
-        std::get<metadata_iterator>(*ctxt) = metadata->at(0).metrics.begin();
-    }
-
-    auto stop_when = [ctxt, metadata]() {
-        auto done = std::get<metric_family_id>(*ctxt) == metadata->size();
-        return done;
-    };
-    // append as many values as we can fit into a packet (1024 bytes)
-    auto send_packet = [this, ctxt, &values, metadata]() mutable {
-        auto start = steady_clock_type::now();
-        auto& mf = std::get<metric_family_id>(*ctxt);
-        auto & md_iterator = std::get<metadata_iterator>(*ctxt);
-        auto & i = std::get<value_iterator>(*ctxt);
-        auto & out = std::get<cpwriter>(*ctxt);
-
+    auto send_packet = [this, ctxt] {
+        auto& out = ctxt->out;
+        if (!out.empty()) {
+            ctxt->sent.push_back(_chan.send(_addr, net::packet(out.data(), out.size())));
+            ++_num_packets;
+            _bytes += out.size();
+        }
         out.clear();
-
-        bool out_of_space = false;
-        while (!out_of_space && mf < values.size()) {
-            while (i != values[mf].end()) {
-                if (i->type() == seastar::metrics::impl::data_type::HISTOGRAM) {
-                    ++i;
-                    ++md_iterator;
-                    continue;
-                }
-                auto m = out.mark();
-                out.put(_host, _period, md_iterator->id, *i);
+    };
+    auto stop_when = [ctxt] {
+        return ctxt->family == ctxt->vals->values.size();
+    };
+    auto add_family = [this, ctxt, tick, send_packet] () mutable {
+        auto mf = ctxt->family++;
+        auto& values = ctxt->vals->values[mf];
+        auto& metrics = ctxt->vals->metadata->at(mf).metrics;
+        if (metrics.empty()) {
+            return;
+        }
+        // all the metrics of a family are in the same group
+        auto period = group_period(metrics.front().id.group_name());
+        if (period == duration()) {
+            return;
+        }
+        // sent every so many polls
+        auto every = std::max(period / _period, duration::rep(1));
+        if (tick % every) {
+            return;
+        }
+        period = every * _period;
+        auto& out = ctxt->out;
+        auto md = metrics.begin();
+        for (auto i = values.begin(); i != values.end(); ++i, ++md) {
+            if (i->type() == seastar::metrics::impl::data_type::HISTOGRAM) {
+                continue;
+            }
+            auto m = out.mark();
+            out.put(_host, period, md->id, *i);
+            if (!out) {
+                out.reset(m);
+                send_packet();
+                out.put(_host, period, md->id, *i);
                 if (!out) {
-                    out.reset(m);
-                    out_of_space = true;
-                    break;
+                    // larger than a packet
+                    out.clear();
                 }
-                ++i;
-                ++md_iterator;
-            }
-            if (out_of_space) {
-                break;
             }
-            ++mf;
-            if (mf < values.size()) {
-                i = values[mf].begin();
-                md_iterator = metadata->at(mf).metrics.begin();
-            }
-        }
-        if (out.empty()) {
-            return make_ready_future();
         }
-        return _chan.send(_addr, net::packet(out.data(), out.size())).then([start, ctxt, this]() {
-                    auto & out = std::get<cpwriter>(*ctxt);
-                    auto now = steady_clock_type::now();
-                    // dogfood stats
-                    ++_num_packets;
-                    _millis += std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
-                    _bytes += out.size();
-                    _avg = double(_millis) / _num_packets;
-                }).then_wrapped([] (auto&& f) {
-                    try {
-                        f.get();
-                    } catch (std::exception & ex) {
-                        std::cout << "send failed: " << ex.what() << std::endl;
-                    } catch (...) {
-                        std::cout << "send failed: - unknown exception" << std::endl;
-                    }
-                });
     };
-    do_until(stop_when, send_packet).finally([this, vals = std::move(vals)]() mutable {
+    do_until(stop_when, [add_family] () mutable {
+        add_family();
+        return make_ready_future<>();
+    }).then([this, ctxt, start, send_packet] () mutable {
+        send_packet();
+        return when_all(ctxt->sent.begin(), ctxt->sent.end()).then([this, start] (std::vector<future<>> sent) {
+            // dogfood stats
+            _millis += std::chrono::duration_cast<std::chrono::milliseconds>(steady_clock_type::now() - start).count();
+            _avg = _num_packets ? double(_millis) / _num_packets : 0;
+            for (auto&& f : sent) {
+                try {
+                    f.get();
+                } catch (std::exception & ex) {
+                    std::cout << "send failed: " << ex.what() << std::endl;
+                } catch (...) {
+                    std::cout << "send failed: - unknown exception" << std::endl;
+                }
+            }
+        });
+    }).finally([this, ctxt] {
         arm();
     });
 }
 
+duration impl::group_period(const sstring& group) const {
+    auto i = _group_periods.find(group);
+    if (i == _group_periods.end()) {
+        return _period;
+    }
+    return i->second;
+}
+
+void impl::set_group_period(const sstring& group, duration period) {
+    _group_periods[group] = period;
+}
+
 std::vector<type_instance_id> impl::get_instance_ids() const {
     std::vector<type_instance_id> res;
     for (auto&& v: values()) {
@@ -513,18 +542,38 @@ void configure(const boost::program_options::variables_map & opts) {
     auto addr = ipv4_addr(opts["collectd-address"].as<std::string>());
     auto period = std::chrono::milliseconds(opts["collectd-poll-period"].as<unsigned>());
 
+    auto packet_size = std::max<size_t>(opts["collectd-packet-size"].as<unsigned>(), 64);
+
     auto host = (opts["collectd-hostname"].as<std::string>() == "")
             ? seastar::metrics::impl::get_local_impl()->get_config().hostname
             : sstring(opts["collectd-hostname"].as<std::string>());
 
+    std::vector<std::pair<sstring, duration>> group_periods;
+    if (opts.count("collectd-group-poll-period")) {
+        for (auto&& s : opts["collectd-group-poll-period"].as<std::vector<std::string>>()) {
+            auto eq = s.rfind('=');
+            if (eq == std::string::npos || eq == 0) {
+                throw std::invalid_argument("invalid --collectd-group-poll-period " + s + ", expected group=milliseconds");
+            }
+            group_periods.emplace_back(sstring(s.substr(0, eq)), duration(std::stoul(s.substr(eq + 1))));
+        }
+    }
+
     // Now create send loops on each cpu
     for (unsigned c = 0; c < smp::count; c++) {
         smp::submit_to(c, [=] () {
-            get_impl().start(host, addr, period);
+            for (auto&& gp : group_periods) {
+                get_impl().set_group_period(gp.first, gp.second);
+            }
+            get_impl().start(host, addr, period, packet_size);
         });
     }
 }
 
+void set_group_poll_period(const sstring& group, std::chrono::milliseconds period) {
+    get_impl().set_group_period(group, period);
+}
+
 boost::program_options::options_description get_options_description() {
     namespace bpo = boost::program_options;
     bpo::options_description opts("COLLECTD options");
@@ -534,6 +583,12 @@ boost::program_options::options_description get_options_description() {
             "address to send/broadcast metrics to")("collectd-poll-period",
             bpo::value<unsigned>()->default_value(1000),
             "poll period - frequency of sending counter metrics (default: 1000ms, 0 disables)")(
+            "collectd-group-poll-period",
+            bpo::value<std::vector<std::string>>(),
+            "group=milliseconds: poll period of the metrics of a group, rounded to a multiple of the poll period (0 disables the group's)")(
+            "collectd-packet-size",
+            bpo::value<unsigned>()->default_value(default_packet_size),
+            "maximum size of the packets sent, in bytes; values are packed into as few packets as possible")(
             "collectd-hostname",
             bpo::value<std::string>()->default_value(""),
             "Deprecated option, use metrics-hostname instead");
@@ -360,6 +360,10 @@ extern const plugin_instance_id per_cpu_plugin_instance;
 
 void configure(const boost::program_options::variables_map&);
 boost::program_options::options_description get_options_description();
+/// Sends the metrics of \c group every \c period, rounded to a multiple of
+/// the poll period, instead of every poll period; 0 stops sending them.
+/// Applies to the calling shard.
+void set_group_poll_period(const sstring& group, std::chrono::milliseconds period);
 void remove_polled_metric(const type_instance_id &);
 
 class plugin_instance_metrics;
@@ -170,6 +170,38 @@ future<file> open_file_dma(sstring name, open_flags flags);
 /// \relates file
 future<file> open_file_dma(sstring name, open_flags flags, file_open_options options);
 
+/// Opens or creates many files at once.
+///
+/// Meant for startup, when a great many files are to be opened: the opens
+/// are pipelined, across all syscall threads, or submitted to the kernel
+/// directly with io_uring where the reactor backend and kernel allow it.
+///
+/// \param names the names of the files to open or create
+/// \param flags various flags controlling the open process, for all files
+/// \param on_open called with the index of each file in \c names and the
+///        result of opening it, as soon as it is known
+/// \param options options for opening the files
+/// \return a future that resolves once all files were opened, or failed to
+///         be; errors are reported to \c on_open only.
+///
+/// \relates file
+future<> open_files_dma(std::vector<sstring> names, open_flags flags,
+        std::function<void (size_t index, future<file> f)> on_open, file_open_options options);
+
+/// Opens or creates many files at once; see the above overload.
+///
+/// \return the files, in the order of \c names; if any cannot be opened,
+///         those that were are closed, and the first error returned.
+///
+/// \relates file
+future<std::vector<file>> open_files_dma(std::vector<sstring> names, open_flags flags, file_open_options options);
+
+/// Opens or creates many files at once, with the default options; see the
+/// above overload.
+///
+/// \relates file
+future<std::vector<file>> open_files_dma(std::vector<sstring> names, open_flags flags);
+
 /// Checks if a given directory supports direct io
 ///
 /// Seastar bypasses the Operating System caches and issues direct io to the
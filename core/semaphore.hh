@@ -28,6 +28,8 @@
 #include <exception>
 #include "timer.hh"
 #include "expiring_fifo.hh"
+#include "shared_ptr.hh"
+#include "task.hh"
 
 namespace seastar {
 
@@ -107,6 +109,46 @@ class basic_semaphore {
         }
     };
     expiring_fifo<entry, expiry_handler, clock> _wait_list;
+    // Queued wakeup task, if any, which is told when the semaphore goes away
+    class pending_wakeup {
+        lw_shared_ptr<basic_semaphore*> _sem;
+    public:
+        pending_wakeup() = default;
+        pending_wakeup(pending_wakeup&&) = default;
+        pending_wakeup& operator=(pending_wakeup&&) = default;
+        ~pending_wakeup() {
+            clear();
+        }
+        explicit operator bool() const {
+            return bool(_sem);
+        }
+        void schedule(basic_semaphore* sem) {
+            _sem = make_lw_shared<basic_semaphore*>(sem);
+            seastar::schedule(make_task([s = _sem] {
+                if (auto sem = *s) {
+                    sem->_pending_wakeup.clear();
+                    sem->wake();
+                }
+            }));
+        }
+        void clear() {
+            if (_sem) {
+                *_sem = nullptr;
+                _sem = nullptr;
+            }
+        }
+    };
+    bool _defer_wakeups = false;
+    pending_wakeup _pending_wakeup;
+    // Serves the waiters that the units now suffice for, in FIFO order
+    void wake() {
+        while (!_wait_list.empty() && has_available_units(_wait_list.front().nr)) {
+            auto& x = _wait_list.front();
+            _count -= x.nr;
+            x.pr.set_value();
+            _wait_list.pop_front();
+        }
+    }
     bool has_available_units(size_t nr) const {
         return _count >= 0 && (static_cast<size_t>(_count) >= nr);
     }
@@ -195,11 +237,31 @@ class basic_semaphore {
             return;
         }
         _count += nr;
-        while (!_wait_list.empty() && has_available_units(_wait_list.front().nr)) {
-            auto& x = _wait_list.front();
-            _count -= x.nr;
-            x.pr.set_value();
-            _wait_list.pop_front();
+        if (!_defer_wakeups) {
+            wake();
+        } else if (!_pending_wakeup && !_wait_list.empty()) {
+            _pending_wakeup.schedule(this);
+        }
+    }
+
+    /// Makes \ref signal() leave the waiting to a task.
+    ///
+    /// When a burst of signals (say, of requests completing one by one)
+    /// meets a long wait list, waking the waiters from each signal walks
+    /// the list once per signal, in the middle of whatever the signalling
+    /// fiber is doing. With deferred wakeups, signal() only deposits the
+    /// units and queues a single task, which then wakes the waiters all
+    /// the signals made until it runs allow for, in FIFO order. Waiters
+    /// keep their priority meanwhile: \ref wait() and \ref try_wait()
+    /// do not take units while anyone waits.
+    ///
+    /// A semaphore with deferred wakeups may only be moved while no wakeup
+    /// is queued.
+    void defer_wakeups(bool defer = true) {
+        _defer_wakeups = defer;
+        if (!defer && _pending_wakeup) {
+            _pending_wakeup.clear();
+            wake();
         }
     }
 
@@ -474,6 +536,180 @@ with_semaphore(basic_semaphore<ExceptionFactory>& sem, size_t units, typename ba
 /// on error conditions.
 using semaphore = basic_semaphore<semaphore_default_exception_factory>;
 
+/// \cond internal
+namespace internal {
+
+template <typename Iterator, typename Func>
+struct max_concurrent_for_each_state {
+    Iterator begin;
+    Iterator end;
+    Func func;
+    size_t in_flight = 0;
+    bool launched_all = false;
+    std::exception_ptr ex;
+    promise<> pr;
+
+    max_concurrent_for_each_state(Iterator begin, Iterator end, Func&& func)
+        : begin(std::move(begin)), end(std::move(end)), func(std::move(func)) {}
+    void record(std::exception_ptr e) {
+        // We can only store one exception.  For more, use when_all().
+        if (!ex) {
+            ex = std::move(e);
+        }
+    }
+    void maybe_done() {
+        if (in_flight == 0 && launched_all) {
+            if (ex) {
+                pr.set_exception(std::move(ex));
+            } else {
+                pr.set_value();
+            }
+        }
+    }
+};
+
+}
+/// \endcond
+
+/// Run tasks in parallel, with bounded concurrency, sharing a semaphore.
+///
+/// Like parallel_for_each(), but each invocation of \c func holds one unit
+/// of \c sem until the future it returns resolves, so at most as many
+/// invocations as \c sem has units are in flight at a time; the next
+/// element is started as soon as one completes. Several loops (or other
+/// users) sharing \c sem share its budget, and are served in the order in
+/// which they asked for units.
+///
+/// Once an invocation fails, no further elements are started; the returned
+/// future resolves, with one of the exceptions, when those in flight have
+/// completed.
+///
+/// \param sem semaphore limiting the number of concurrent invocations
+/// \param begin an \c InputIterator designating the beginning of the range
+/// \param end an \c InputIterator designating the end of the range
+/// \param func Function to apply to each element in the range (returning
+///             \c void or a \c future<>)
+/// \return a \c future<> that resolves when all the function invocations
+///         complete.  If one or more return an exception, or \c sem was
+///         broken, the return value contains one of the exceptions.
+///
+/// \note The caller must guarantee that \c sem, and the range, are valid
+///       until the returned future resolves.
+///
+/// \related semaphore
+template <typename ExceptionFactory, typename Clock, typename Iterator, typename Func>
+inline
+future<>
+max_concurrent_for_each(basic_semaphore<ExceptionFactory, Clock>& sem, Iterator begin, Iterator end, Func&& func) {
+    using state = internal::max_concurrent_for_each_state<Iterator, std::decay_t<Func>>;
+    auto s = make_lw_shared<state>(std::move(begin), std::move(end), std::decay_t<Func>(std::forward<Func>(func)));
+    return repeat([s, &sem] {
+        if (s->begin == s->end || s->ex) {
+            return make_ready_future<stop_iteration>(stop_iteration::yes);
+        }
+        return get_units(sem, 1).then([s] (auto units) {
+            if (s->ex) {
+                return stop_iteration::yes;
+            }
+            ++s->in_flight;
+            futurize_apply(s->func, *s->begin++).then_wrapped([s, units = std::move(units)] (future<> f) {
+                if (f.failed()) {
+                    s->record(f.get_exception());
+                }
+                --s->in_flight;
+                s->maybe_done();
+            });
+            return stop_iteration::no;
+        });
+    }).then_wrapped([s] (future<> f) {
+        if (f.failed()) {
+            s->record(f.get_exception());
+        }
+        s->launched_all = true;
+        s->maybe_done();
+        return s->pr.get_future();
+    });
+}
+
+/// Run tasks in parallel, with bounded concurrency, sharing a semaphore
+/// (range version).
+///
+/// \see max_concurrent_for_each(basic_semaphore<ExceptionFactory, Clock>&, Iterator, Iterator, Func&&)
+///
+/// \related semaphore
+template <typename ExceptionFactory, typename Clock, typename Range, typename Func>
+inline
+future<>
+max_concurrent_for_each(basic_semaphore<ExceptionFactory, Clock>& sem, Range&& range, Func&& func) {
+    return max_concurrent_for_each(sem, std::begin(range), std::end(range), std::forward<Func>(func));
+}
+
+/// Run tasks in parallel, keeping at most \c max_concurrent of them in flight.
+///
+/// \see max_concurrent_for_each(basic_semaphore<ExceptionFactory, Clock>&, Iterator, Iterator, Func&&)
+template <typename Iterator, typename Func>
+inline
+future<>
+max_concurrent_for_each(Iterator begin, Iterator end, size_t max_concurrent, Func&& func) {
+    return do_with(semaphore(max_concurrent), [begin = std::move(begin), end = std::move(end),
+            func = std::forward<Func>(func)] (semaphore& sem) mutable {
+        return max_concurrent_for_each(sem, std::move(begin), std::move(end), std::move(func));
+    });
+}
+
+/// Run tasks in parallel, keeping at most \c max_concurrent of them in flight
+/// (range version).
+///
+/// \see max_concurrent_for_each(basic_semaphore<ExceptionFactory, Clock>&, Iterator, Iterator, Func&&)
+template <typename Range, typename Func>
+inline
+future<>
+max_concurrent_for_each(Range&& range, size_t max_concurrent, Func&& func) {
+    return max_concurrent_for_each(std::begin(range), std::end(range), max_concurrent, std::forward<Func>(func));
+}
+
+/// Asynchronous map/reduce transformation with bounded concurrency, sharing
+/// a semaphore.
+///
+/// Like map_reduce(Iterator, Iterator, Mapper&&, Initial, Reduce), but the
+/// mapper invocations are throttled by \c sem as with
+/// max_concurrent_for_each(). Results are reduced in completion order.
+///
+/// \related semaphore
+template <typename ExceptionFactory, typename Clock, typename Iterator, typename Mapper, typename Initial, typename Reduce>
+inline
+future<Initial>
+max_concurrent_map_reduce(basic_semaphore<ExceptionFactory, Clock>& sem, Iterator begin, Iterator end,
+        Mapper&& mapper, Initial initial, Reduce reduce) {
+    struct state {
+        Initial result;
+        Reduce reduce;
+    };
+    auto s = make_lw_shared(state{std::move(initial), std::move(reduce)});
+    return max_concurrent_for_each(sem, std::move(begin), std::move(end), [s, mapper = std::forward<Mapper>(mapper)] (auto&& v) mutable {
+        return futurize_apply(mapper, v).then([s] (auto result) {
+            s->result = s->reduce(std::move(s->result), std::move(result));
+        });
+    }).then([s] {
+        return make_ready_future<Initial>(std::move(s->result));
+    });
+}
+
+/// Asynchronous map/reduce transformation, keeping at most \c max_concurrent
+/// mapper invocations in flight.
+///
+/// \see max_concurrent_map_reduce(basic_semaphore<ExceptionFactory, Clock>&, Iterator, Iterator, Mapper&&, Initial, Reduce)
+template <typename Iterator, typename Mapper, typename Initial, typename Reduce>
+inline
+future<Initial>
+max_concurrent_map_reduce(Iterator begin, Iterator end, size_t max_concurrent, Mapper&& mapper, Initial initial, Reduce reduce) {
+    return do_with(semaphore(max_concurrent), [begin = std::move(begin), end = std::move(end),
+            mapper = std::forward<Mapper>(mapper), initial = std::move(initial), reduce = std::move(reduce)] (semaphore& sem) mutable {
+        return max_concurrent_map_reduce(sem, std::move(begin), std::move(end), std::move(mapper), std::move(initial),
+                std::move(reduce));
+    });
+}
+
 /// @}
 
 }
@@ -32,6 +32,36 @@ namespace seastar {
 template <typename T>
 class sharded;
 
+/// \cond internal
+namespace internal {
+
+// Orders all shards for a tree-shaped fan-out rooted at \c root: the root
+// first, then the rest of its cache domain and NUMA node, then the other
+// domains and nodes one after the other, so that contiguous subtrees mostly
+// stay within a cache domain.
+inline std::vector<unsigned> shard_tree_order(unsigned root) {
+    return smp::nearby_shards(root);
+}
+
+// Splits the shards of a subtree (the first being the subtree's root) into
+// the root alone followed by at most \c fanout subtrees of similar size.
+inline std::vector<std::vector<unsigned>> split_shard_tree(const std::vector<unsigned>& shards, unsigned fanout) {
+    std::vector<std::vector<unsigned>> ret;
+    ret.push_back({shards.front()});
+    size_t rest = shards.size() - 1;
+    size_t nr = std::min<size_t>(std::max(fanout, 1u), rest);
+    auto it = shards.begin() + 1;
+    for (size_t i = 0; i < nr; ++i) {
+        auto n = rest / nr + (i < rest % nr);
+        ret.emplace_back(it, it + n);
+        it += n;
+    }
+    return ret;
+}
+
+}
+/// \endcond
+
 /// if sharded service inherits from this class sharded::stop() will wait
 /// untill all references to a service on each shard will dissapper before
 /// returning. It is still service's own responcibility to track its references
@@ -199,6 +229,35 @@ class sharded {
     template <typename Func>
     future<> invoke_on_others(Func&& func);
 
+    /// Invoke a callable on all instances of \c Service, broadcasting it
+    /// along a tree of shards.
+    ///
+    /// Like invoke_on_all(), but the calling shard only messages at most
+    /// \c fanout shards, each of which forwards the call to its own subtree;
+    /// see map_reduce0_tree().
+    ///
+    /// \param func a callable with the signature `void (Service&)`
+    ///             or `future<> (Service&)`. It is copied to every shard.
+    /// \param fanout maximum number of children of each shard in the tree.
+    /// \return a `future<>` that becomes ready when all cores have
+    ///         processed the message.
+    template <typename Func>
+    future<> invoke_on_all_tree(Func func, unsigned fanout = 8);
+
+    /// Invoke several callables on all instances of \c Service, with a
+    /// single message per shard.
+    ///
+    /// Equivalent to calling invoke_on_all() once per callable, but each
+    /// shard receives all of them in one cross-shard message, and they
+    /// run concurrently there.
+    ///
+    /// \param funcs callables with the signature `void (Service&)`
+    ///             or `future<> (Service&)`.
+    /// \return a `future<>` that becomes ready when all cores have
+    ///         processed all the callables; it fails if any of them failed.
+    template <typename... Funcs>
+    future<> invoke_on_all_batched(Funcs... funcs);
+
     /// Invoke a method on all instances of `Service` and reduce the results using
     /// `Reducer`.
     ///
@@ -275,6 +334,35 @@ class sharded {
                             std::move(reduce));
     }
 
+    /// Applies a map function to all shards, then reduces the output along a
+    /// tree of shards.
+    ///
+    /// Like map_reduce0(), but instead of the calling shard messaging
+    /// every other shard and reducing all the results itself, it messages
+    /// at most \c fanout shards, each of which reduces the results of its
+    /// own subtree before replying. This keeps the calling shard from being
+    /// a bottleneck on machines with many shards. Subtrees are formed NUMA
+    /// node by NUMA node, so most of the traffic stays within a node.
+    ///
+    /// \param map callable with the signature `Value (Service&)` or
+    ///               `future<Value> (Service&)` (for some `Value` type).
+    /// \param initial the starting value of every subtree's fold, and so
+    ///               must be an identity of \c reduce (e.g. 0 for addition).
+    /// \param reduce binary function folding either a `Value` or another
+    ///               subtree's result into an `Initial`; must be associative
+    ///               and commutative, as the reduction order is unspecified.
+    /// \param fanout maximum number of children of each shard in the tree.
+    ///
+    /// \c map, \c initial and \c reduce are copied to the shards of the tree,
+    /// and must be safe to copy and use there.
+    template <typename Mapper, typename Initial, typename Reduce>
+    inline
+    future<Initial>
+    map_reduce0_tree(Mapper map, Initial initial, Reduce reduce, unsigned fanout = 8) {
+        return tree_map_reduce(internal::shard_tree_order(engine().cpu_id()), std::move(map), std::move(initial),
+                std::move(reduce), fanout);
+    }
+
     /// Applies a map function to all shards, and return a vector of the result.
     ///
     /// \param mapper callable with the signature `Value (Service&)` or
@@ -367,6 +455,43 @@ class sharded {
         }
         return inst;
     }
+
+    // Runs on shards.front(), which is the root of the subtree made of all
+    // of \c shards.
+    template <typename Mapper, typename Initial, typename Reduce>
+    future<Initial> tree_map_reduce(std::vector<unsigned> shards, Mapper map, Initial initial, Reduce reduce,
+            unsigned fanout) {
+        auto subtrees = internal::split_shard_tree(shards, fanout);
+        auto mapper = [this, map, initial, reduce, fanout] (const std::vector<unsigned>& subtree) {
+            if (subtree.size() == 1 && subtree.front() == engine().cpu_id()) {
+                return futurize_apply([this, &map] {
+                    return map(*get_local_service());
+                }).then([initial, reduce] (auto&& value) {
+                    return Initial(reduce(Initial(initial), std::move(value)));
+                });
+            }
+            return smp::submit_to(subtree.front(), [this, subtree, map, initial, reduce, fanout] () mutable {
+                return tree_map_reduce(std::move(subtree), std::move(map), std::move(initial), std::move(reduce), fanout);
+            });
+        };
+        return ::seastar::map_reduce(subtrees.begin(), subtrees.end(), std::move(mapper), std::move(initial),
+                std::move(reduce));
+    }
+
+    template <typename Func>
+    future<> tree_invoke(std::vector<unsigned> shards, Func func, unsigned fanout) {
+        auto subtrees = internal::split_shard_tree(shards, fanout);
+        return parallel_for_each(subtrees, [this, func, fanout] (const std::vector<unsigned>& subtree) {
+            if (subtree.size() == 1 && subtree.front() == engine().cpu_id()) {
+                return futurize_apply([this, &func] {
+                    return func(*get_local_service());
+                });
+            }
+            return smp::submit_to(subtree.front(), [this, subtree, func, fanout] () mutable {
+                return tree_invoke(std::move(subtree), std::move(func), fanout);
+            });
+        });
+    }
 };
 
 template <typename Service>
@@ -526,6 +651,32 @@ sharded<Service>::invoke_on_others(Func&& func) {
     });
 }
 
+template <typename Service>
+template <typename Func>
+inline
+future<>
+sharded<Service>::invoke_on_all_tree(Func func, unsigned fanout) {
+    static_assert(std::is_same<futurize_t<std::result_of_t<Func(Service&)>>, future<>>::value,
+                  "invoke_on_all_tree()'s func must return void or future<>");
+    return tree_invoke(internal::shard_tree_order(engine().cpu_id()), std::move(func), fanout);
+}
+
+template <typename Service>
+template <typename... Funcs>
+inline
+future<>
+sharded<Service>::invoke_on_all_batched(Funcs... funcs) {
+    return parallel_for_each(boost::irange<unsigned>(0, _instances.size()), [this, funcs...] (unsigned c) {
+        return smp::submit_to(c, [this, funcs...] {
+            auto inst = get_local_service();
+            std::vector<future<>> results;
+            results.reserve(sizeof...(Funcs));
+            (void)std::initializer_list<int>{(results.push_back(futurize_apply(funcs, *inst)), 0)...};
+            return when_all_succeed(results.begin(), results.end()).finally([inst] {});
+        });
+    });
+}
+
 template <typename Service>
 Service& sharded<Service>::local() {
     assert(local_is_initialized());
@@ -567,6 +718,33 @@ inline bool sharded<Service>::local_is_initialized() {
 ///
 /// \c foreign_ptr<> is a move-only object; it cannot be copied.
 ///
+/// \cond internal
+namespace internal {
+
+// Hands a pointer back to its owner shard for destruction, batched with
+// others going to the same shard (see reactor::add_foreign_disposal()).
+template <typename PtrType>
+struct foreign_disposer {
+    static void dispose_on(unsigned cpu, PtrType&& p) {
+        engine().add_foreign_disposal(cpu, new PtrType(std::move(p)), [] (void* obj) {
+            delete static_cast<PtrType*>(obj);
+        });
+    }
+};
+
+// No need for a holder for the common case
+template <typename T>
+struct foreign_disposer<std::unique_ptr<T>> {
+    static void dispose_on(unsigned cpu, std::unique_ptr<T>&& p) {
+        engine().add_foreign_disposal(cpu, p.release(), [] (void* obj) {
+            delete static_cast<T*>(obj);
+        });
+    }
+};
+
+}
+/// \endcond
+
 template <typename PtrType>
 class foreign_ptr {
 private:
@@ -597,11 +775,13 @@ class foreign_ptr {
     /// Moves a \c foreign_ptr<> to another object.
     foreign_ptr(foreign_ptr&& other) = default;
     /// Destroys the wrapped object on its original cpu.
+    ///
+    /// Objects destroyed on the same core are sent back to their original
+    /// cpus in batches, once per poll of the reactor, rather than with a
+    /// message each.
     ~foreign_ptr() {
         if (_value && !on_origin()) {
-            smp::submit_to(_cpu, [v = std::move(_value)] () mutable {
-                auto local(std::move(v));
-            });
+            internal::foreign_disposer<PtrType>::dispose_on(_cpu, std::move(_value));
         }
     }
     /// Creates a copy of this foreign ptr. Only works if the stored ptr is copyable.
@@ -632,6 +812,43 @@ foreign_ptr<T> make_foreign(T ptr) {
 template<typename T>
 struct is_smart_ptr<foreign_ptr<T>> : std::true_type {};
 
+/// Prepares a buffer to be handed off to another core.
+///
+/// Returns a buffer referring to the same data, whose memory is released
+/// on the current core when the returned buffer (and all its shares) are
+/// destroyed, whichever core that happens on. The release is batched with
+/// other foreign_ptr destructions.
+///
+/// \relates foreign_ptr
+template <typename CharType>
+temporary_buffer<CharType> make_foreign_buffer(temporary_buffer<CharType> buf) {
+    auto p = buf.get_write();
+    auto size = buf.size();
+    return temporary_buffer<CharType>(p, size,
+            make_object_deleter(make_foreign(std::make_unique<deleter>(buf.release()))));
+}
+
+/// Prepares several buffers to be handed off to another core together.
+///
+/// Like make_foreign_buffer(), but the memory of all the buffers is
+/// released at once, with a single cross-core disposal, once all of the
+/// returned buffers are destroyed.
+///
+/// \relates foreign_ptr
+template <typename CharType>
+std::vector<temporary_buffer<CharType>> make_foreign_buffers(std::vector<temporary_buffer<CharType>> bufs) {
+    std::vector<temporary_buffer<CharType>> ret;
+    ret.reserve(bufs.size());
+    for (auto& b : bufs) {
+        ret.emplace_back(b.get_write(), b.size(), deleter());
+    }
+    auto d = make_object_deleter(make_foreign(std::make_unique<std::vector<temporary_buffer<CharType>>>(std::move(bufs))));
+    for (auto& b : ret) {
+        b = temporary_buffer<CharType>(b.get_write(), b.size(), d.share());
+    }
+    return ret;
+}
+
 }
 
 /// @}
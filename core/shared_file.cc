@@ -0,0 +1,92 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include <cassert>
+#include "shared_file.hh"
+#include "reactor.hh"
+
+namespace seastar {
+
+shared_file::shared_file(file f)
+        : _owner(engine().cpu_id())
+        , _handle(f.dup())
+        , _files(new local_file[smp::count]) {
+    auto& l = _files[_owner];
+    l.f = std::move(f);
+    l.opened = true;
+}
+
+shared_file::~shared_file() {
+    assert(_closed);
+}
+
+file& shared_file::local() {
+    assert(!_closed);
+    auto& l = _files[engine().cpu_id()];
+    if (!l.opened) {
+        // shares the owner's file descriptor
+        l.f = _handle.to_file();
+        l.opened = true;
+    }
+    return l.f;
+}
+
+input_stream<char> shared_file::make_input_stream(uint64_t offset, uint64_t len, file_input_stream_options options) {
+    auto& f = local();
+    if (!options.dynamic_adjustments) {
+        auto& history = _files[engine().cpu_id()].history;
+        if (!history) {
+            history = make_lw_shared<file_input_stream_history>();
+        }
+        options.dynamic_adjustments = history;
+    }
+    return make_file_input_stream(f, offset, len, std::move(options));
+}
+
+future<> shared_file::close() {
+    assert(engine().cpu_id() == _owner && !_closed);
+    _closed = true;
+    return smp::invoke_on_all([this] {
+        auto& l = _files[engine().cpu_id()];
+        l.history = {};
+        if (!l.opened) {
+            return make_ready_future<>();
+        }
+        l.opened = false;
+        return l.f.close().finally([&l] {
+            l.f = file();
+        });
+    }).finally([this] {
+        // the handle holds the last reference to the descriptor; closing
+        // it as a file keeps the close(2) off the reactor thread
+        return do_with(file(std::move(_handle)), [] (file& f) {
+            return f.close();
+        });
+    });
+}
+
+future<std::unique_ptr<shared_file>> open_shared_file_dma(sstring name, open_flags flags, file_open_options options) {
+    return open_file_dma(std::move(name), flags, std::move(options)).then([] (file f) {
+        return std::make_unique<shared_file>(std::move(f));
+    });
+}
+
+}
@@ -0,0 +1,88 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <memory>
+#include "cacheline.hh"
+#include "file.hh"
+#include "fstream.hh"
+#include "seastar.hh"
+#include "shared_ptr.hh"
+
+namespace seastar {
+
+/// \addtogroup fileio-module
+/// @{
+
+/// A file opened once, and read from all shards.
+///
+/// Opening a data file on every shard costs a trip through the syscall
+/// thread per shard. A \c shared_file is opened by one shard; each shard
+/// then gets its own \ref file for it from \ref local(), without a syscall
+/// to open it, and issues its reads on its own I/O queue.
+///
+/// The streams that a shard makes with \ref make_input_stream() share the
+/// shard's read-ahead history for the file, for as long as the file is
+/// open, rather than only while they are open at the same time.
+///
+/// The object belongs to the shard that created it, which alone may close
+/// it; any shard may call \ref local() and \ref make_input_stream() until
+/// then. It must be closed with \ref close() before it is destroyed.
+class shared_file {
+    struct alignas(cache_line_size) local_file {
+        file f;
+        bool opened = false;
+        lw_shared_ptr<file_input_stream_history> history;
+    };
+    unsigned _owner;
+    file_handle _handle;
+    std::unique_ptr<local_file[]> _files; // by shard
+    bool _closed = false;
+public:
+    /// \param f an open file that can be duplicated, such as one opened by
+    ///        \ref open_file_dma(); it becomes the owner shard's file.
+    explicit shared_file(file f);
+    shared_file(const shared_file&) = delete;
+    shared_file& operator=(const shared_file&) = delete;
+    ~shared_file();
+    /// The calling shard's file; valid until the object is closed.
+    file& local();
+    /// Makes an input stream for a portion of the file, on the calling
+    /// shard; see \ref make_file_input_stream(). Unless \c options has a
+    /// history, it uses the shard's history for the file.
+    input_stream<char> make_input_stream(uint64_t offset, uint64_t len, file_input_stream_options options = {});
+    /// Closes the file on all the shards. The streams made from it must
+    /// have been closed.
+    future<> close();
+};
+
+/// Opens a file once, to read it from all shards; see \ref shared_file.
+///
+/// \param name the name of the file to open
+/// \param flags how to open it; reading is all that makes sense from
+///        more than one shard
+/// \param options options of the file for the calling shard
+future<std::unique_ptr<shared_file>> open_shared_file_dma(sstring name, open_flags flags, file_open_options options = {});
+
+/// @}
+
+}
@@ -23,6 +23,7 @@
 #define SHARED_PTR_HH_
 
 #include "shared_ptr_debug_helper.hh"
+#include <cstdint>
 #include <utility>
 #include <type_traits>
 #include <functional>
@@ -50,11 +51,21 @@ namespace seastar {
 // Both variants support shared_from_this() via enable_shared_from_this<>
 // and lw_enable_shared_from_this<>().
 //
+// Objects that are shared by the hundreds of millions can save the word of
+// lw_shared_ptr<> overhead by deriving from
+// enable_compact_lw_shared_from_this<> instead: its counter is 32 bits,
+// and the members of the derived class fill the rest of the word.
+// shared_ptr<> has no such variant, as its control block must be
+// polymorphic to destroy objects through pointers to their bases; objects
+// that do not need that should use lw_shared_ptr<> in the first place.
+//
 
 #ifndef DEBUG_SHARED_PTR
 using shared_ptr_counter_type = long;
+using compact_shared_ptr_counter_type = int32_t;
 #else
 using shared_ptr_counter_type = debug_shared_ptr_counter_type;
+using compact_shared_ptr_counter_type = debug_shared_ptr_counter_type;
 #endif
 
 template <typename T>
@@ -66,6 +77,9 @@ class shared_ptr;
 template <typename T>
 class enable_lw_shared_from_this;
 
+template <typename T>
+class enable_compact_lw_shared_from_this;
+
 template <typename T>
 class enable_shared_from_this;
 
@@ -97,6 +111,10 @@ struct lw_shared_ptr_counter_base {
     shared_ptr_counter_type _count = 0;
 };
 
+struct compact_lw_shared_ptr_counter_base {
+    compact_shared_ptr_counter_type _count = 0;
+};
+
 
 namespace internal {
 
@@ -106,6 +124,9 @@ struct lw_shared_ptr_accessors;
 template <class T>
 struct lw_shared_ptr_accessors_esft;
 
+template <class T>
+struct lw_shared_ptr_accessors_compact_esft;
+
 template <class T>
 struct lw_shared_ptr_accessors_no_esft;
 
@@ -152,6 +173,27 @@ class enable_lw_shared_from_this : private lw_shared_ptr_counter_base {
     friend class internal::lw_shared_ptr_accessors;
 };
 
+// Like enable_lw_shared_from_this<T>, but with a 32 bit counter: up to
+// 2^31 - 1 pointers may share an object, and the members of T that fit are
+// laid out in the rest of the counter's word.
+template <typename T>
+class enable_compact_lw_shared_from_this : private compact_lw_shared_ptr_counter_base {
+protected:
+    enable_compact_lw_shared_from_this() noexcept {}
+    enable_compact_lw_shared_from_this(enable_compact_lw_shared_from_this&&) noexcept {}
+    enable_compact_lw_shared_from_this(const enable_compact_lw_shared_from_this&) noexcept {}
+    enable_compact_lw_shared_from_this& operator=(const enable_compact_lw_shared_from_this&) noexcept { return *this; }
+    enable_compact_lw_shared_from_this& operator=(enable_compact_lw_shared_from_this&&) noexcept { return *this; }
+public:
+    lw_shared_ptr<T> shared_from_this();
+    lw_shared_ptr<const T> shared_from_this() const;
+
+    template <typename X>
+    friend class lw_shared_ptr;
+    template <typename X>
+    friend class internal::lw_shared_ptr_accessors_compact_esft;
+};
+
 template <typename T>
 struct shared_ptr_no_esft : private lw_shared_ptr_counter_base {
     T _value;
@@ -186,6 +228,7 @@ namespace internal {
 
 template <typename T>
 struct lw_shared_ptr_accessors_esft {
+    using counter_base = lw_shared_ptr_counter_base;
     using concrete_type = std::remove_const_t<T>;
     static T* to_value(lw_shared_ptr_counter_base* counter) {
         return static_cast<T*>(counter);
@@ -199,8 +242,23 @@ struct lw_shared_ptr_accessors_esft {
     }
 };
 
+template <typename T>
+struct lw_shared_ptr_accessors_compact_esft {
+    using counter_base = compact_lw_shared_ptr_counter_base;
+    using concrete_type = std::remove_const_t<T>;
+    static T* to_value(counter_base* counter) {
+        return static_cast<T*>(counter);
+    }
+    static void dispose(counter_base* counter) {
+        delete static_cast<T*>(counter);
+    }
+    static void instantiate_to_value(counter_base* p) {
+    }
+};
+
 template <typename T>
 struct lw_shared_ptr_accessors_no_esft {
+    using counter_base = lw_shared_ptr_counter_base;
     using concrete_type = shared_ptr_no_esft<T>;
     static T* to_value(lw_shared_ptr_counter_base* counter) {
         return &static_cast<concrete_type*>(counter)->_value;
@@ -215,12 +273,16 @@ struct lw_shared_ptr_accessors_no_esft {
 };
 
 // Generic case: lw_shared_ptr_deleter<T> is not specialized, select
-// implementation based on whether T inherits from enable_lw_shared_from_this<T>.
+// implementation based on whether T inherits from enable_lw_shared_from_this<T>
+// or enable_compact_lw_shared_from_this<T>.
 template <typename T, typename U = void>
 struct lw_shared_ptr_accessors : std::conditional_t<
          std::is_base_of<enable_lw_shared_from_this<T>, T>::value,
          lw_shared_ptr_accessors_esft<T>,
-         lw_shared_ptr_accessors_no_esft<T>> {
+         std::conditional_t<
+             std::is_base_of<enable_compact_lw_shared_from_this<T>, T>::value,
+             lw_shared_ptr_accessors_compact_esft<T>,
+             lw_shared_ptr_accessors_no_esft<T>>> {
 };
 
 // void_t is C++17, use this temporarily
@@ -230,6 +292,7 @@ using void_t = void;
 // Overload when lw_shared_ptr_deleter<T> specialized
 template <typename T>
 struct lw_shared_ptr_accessors<T, void_t<decltype(lw_shared_ptr_deleter<T>{})>> {
+    using counter_base = lw_shared_ptr_counter_base;
     using concrete_type = T;
     static T* to_value(lw_shared_ptr_counter_base* counter);
     static void dispose(lw_shared_ptr_counter_base* counter) {
@@ -247,9 +310,10 @@ template <typename T>
 class lw_shared_ptr {
     using accessors = internal::lw_shared_ptr_accessors<std::remove_const_t<T>>;
     using concrete_type = typename accessors::concrete_type;
-    mutable lw_shared_ptr_counter_base* _p = nullptr;
+    using counter_base = typename accessors::counter_base;
+    mutable counter_base* _p = nullptr;
 private:
-    lw_shared_ptr(lw_shared_ptr_counter_base* p) noexcept : _p(p) {
+    lw_shared_ptr(counter_base* p) noexcept : _p(p) {
         if (_p) {
             ++_p->_count;
         }
@@ -370,6 +434,9 @@ class lw_shared_ptr {
 
     template <typename U>
     friend class enable_lw_shared_from_this;
+
+    template <typename U>
+    friend class enable_compact_lw_shared_from_this;
 };
 
 template <typename T, typename... A>
@@ -404,6 +471,20 @@ enable_lw_shared_from_this<T>::shared_from_this() const {
     return lw_shared_ptr<const T>(const_cast<enable_lw_shared_from_this*>(this));
 }
 
+template <typename T>
+inline
+lw_shared_ptr<T>
+enable_compact_lw_shared_from_this<T>::shared_from_this() {
+    return lw_shared_ptr<T>(this);
+}
+
+template <typename T>
+inline
+lw_shared_ptr<const T>
+enable_compact_lw_shared_from_this<T>::shared_from_this() const {
+    return lw_shared_ptr<const T>(const_cast<enable_compact_lw_shared_from_this*>(this));
+}
+
 template <typename T>
 static inline
 std::ostream& operator<<(std::ostream& out, const lw_shared_ptr<T>& p) {
@@ -20,10 +20,62 @@
  */
 
 #pragma once
+#include <cassert>
+#include <type_traits>
 #include "core/sstring.hh"
 
 namespace seastar {
 
+// The size of the serialized form of T, for types whose serialized form
+// has the same size for every value.
+//
+// Arithmetic and enum types are fixed as serialized by their bytes;
+// serializers can specialize it for fixed-layout structs, using
+// fixed_serialized_size<> to add up their members. It lets them write a
+// whole struct with write_fixed(), with one bounds check for all of its
+// members, and lets measuring streams skip measuring it.
+template <typename T, typename Enable = void>
+struct serialized_size {
+    static constexpr bool is_fixed = false;
+};
+
+template <typename T>
+struct serialized_size<T, std::enable_if_t<std::is_arithmetic<T>::value || std::is_enum<T>::value>> {
+    static constexpr bool is_fixed = true;
+    static constexpr size_t value = sizeof(T);
+};
+
+template <typename... T>
+struct fixed_serialized_size;
+
+template <>
+struct fixed_serialized_size<> : std::integral_constant<size_t, 0> {};
+
+template <typename T0, typename... T>
+struct fixed_serialized_size<T0, T...>
+        : std::integral_constant<size_t, serialized_size<T0>::value + fixed_serialized_size<T...>::value> {
+    static_assert(serialized_size<T0>::is_fixed, "type does not have a fixed serialized size");
+};
+
+// Writes into room that was bounds-checked already, by write_fixed()
+class unchecked_memory_output_stream {
+    char* _p;
+public:
+    using has_with_stream = std::false_type;
+    explicit unchecked_memory_output_stream(char* p) : _p(p) {}
+    char* begin() { return _p; }
+
+    [[gnu::always_inline]]
+    void write(const char* p, size_t size) {
+        _p = std::copy_n(p, size, _p);
+    }
+
+    [[gnu::always_inline]]
+    void skip(size_t size) {
+        _p += size;
+    }
+};
+
 class measuring_output_stream {
     size_t _size = 0;
 public:
@@ -31,6 +83,13 @@ class measuring_output_stream {
         _size += size;
     }
 
+    // write_fixed(func) of the other output streams, which measures
+    // Size without calling func
+    template <size_t Size, typename Func>
+    void write_fixed(Func&&) {
+        _size += Size;
+    }
+
     size_t size() const {
         return _size;
     }
@@ -78,6 +137,22 @@ class simple_memory_output_stream {
         skip(size);
     }
 
+    // Checks once that Size bytes fit, and calls func with an
+    // unchecked_memory_output_stream into them; func must write exactly
+    // Size bytes.
+    template <size_t Size, typename Func>
+    [[gnu::always_inline]]
+    void write_fixed(Func&& func) {
+        if (Size > _size) {
+            throw std::out_of_range("serialization buffer overflow");
+        }
+        unchecked_memory_output_stream out(_p);
+        func(out);
+        assert(out.begin() == _p + Size);
+        _p += Size;
+        _size -= Size;
+    }
+
     [[gnu::always_inline]]
     const size_t size() const {
         return _size;
@@ -139,6 +214,29 @@ class fragmented_memory_output_stream {
             p += bv.size();
         });
     }
+    // Writes straight into the current fragment when the Size bytes fit
+    // in it; otherwise func writes into a local buffer, which is then
+    // copied into the fragments.
+    template <size_t Size, typename Func>
+    void write_fixed(Func&& func) {
+        if (Size > _size) {
+            throw std::out_of_range("serialization buffer overflow");
+        }
+        if (!_current.size() && _size) {
+            _current = simple(reinterpret_cast<char*>((*_it).get_write()), (*_it).size());
+            _it++;
+        }
+        if (__builtin_expect(_current.size() >= Size, true)) {
+            _size -= Size;
+            _current.write_fixed<Size>(std::forward<Func>(func));
+            return;
+        }
+        char buf[Size];
+        unchecked_memory_output_stream out(buf);
+        func(out);
+        assert(out.begin() == buf + Size);
+        write(buf, Size);
+    }
     const size_t size() const {
         return _size;
     }
@@ -261,6 +359,16 @@ class memory_output_stream {
         });
     }
 
+    // Writes Size bytes with func(unchecked_memory_output_stream&), with
+    // one dispatch and one bounds check for all of them
+    template <size_t Size, typename Func>
+    [[gnu::always_inline]]
+    void write_fixed(Func&& func) {
+        with_stream([&func] (auto& stream) {
+            stream.template write_fixed<Size>(std::forward<Func>(func));
+        });
+    }
+
     [[gnu::always_inline]]
     size_t size() const {
         return with_stream([] (auto& stream) {
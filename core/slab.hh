@@ -38,6 +38,24 @@ namespace seastar {
 
 static constexpr uint16_t SLAB_MAGIC_NUMBER = 0x51AB; // meant to be 'SLAB' :-)
 
+/*
+ * Eviction policy of the slab classes, chosen when the slab allocator is created.
+ * - lru: every access moves the item to the head of its slab class' list.
+ * - segmented_lru: new items enter a probation segment, and are promoted to a
+ *   protected one (which holds at most protected_share_percent of the items)
+ *   if accessed again before they reach its tail. So a scan of keys that are
+ *   read once only cycles through probation, and leaves the hot items alone.
+ * - clock: a single list scanned with second chance.
+ * Under segmented_lru and clock, accesses only set a referenced bit in the item,
+ * and items are moved when the eviction scan reaches them, so that hits don't
+ * write to the lists.
+ */
+enum class slab_eviction_policy {
+    lru,
+    segmented_lru,
+    clock,
+};
+
 /*
  * Item requirements
  * - Extend it to slab_item_base.
@@ -127,22 +145,40 @@ struct slab_page_desc {
 
 class slab_item_base {
     boost::intrusive::list_member_hook<> _lru_link;
+    bool _referenced = false; // accessed since the eviction scan last saw it
+    bool _protected = false; // in the protected segment
 
     template<typename Item>
     friend class slab_class;
 };
 
+struct slab_lru_stats {
+    uint64_t probation_hits = 0; // all hits, unless segmented_lru
+    uint64_t protected_hits = 0;
+    uint64_t promotions = 0;
+    uint64_t demotions = 0;
+    uint64_t second_chances = 0;
+};
+
 template<typename Item>
 class slab_class {
 private:
+    using lru_type = boost::intrusive::list<slab_item_base,
+        boost::intrusive::member_hook<slab_item_base, boost::intrusive::list_member_hook<>,
+        &slab_item_base::_lru_link>>;
+    static constexpr unsigned protected_share_percent = 80;
     boost::intrusive::list<slab_page_desc,
         boost::intrusive::member_hook<slab_page_desc, boost::intrusive::list_member_hook<>,
         &slab_page_desc::_free_pages_link>> _free_slab_pages;
-    boost::intrusive::list<slab_item_base,
-        boost::intrusive::member_hook<slab_item_base, boost::intrusive::list_member_hook<>,
-        &slab_item_base::_lru_link>> _lru;
+    lru_type _lru; // probation segment, under segmented_lru
+    lru_type _protected;
     size_t _size; // size of objects
     uint8_t _slab_class_id;
+    slab_eviction_policy _policy;
+    slab_lru_stats _lru_stats;
+    uint64_t _evictions = 0; // items evicted to make room for new ones
+    uint64_t _evictions_seen = 0; // by the previous rebalancing round
+    uint32_t _pages = 0;
 private:
     template<typename... Args>
     inline
@@ -152,31 +188,147 @@ class slab_class {
         return new_item;
     }
 
+    lru_type& segment_of(slab_item_base& item_ref) {
+        return item_ref._protected ? _protected : _lru;
+    }
+
+    void reference(slab_item_base& item_ref) {
+        if (item_ref._protected) {
+            _lru_stats.protected_hits++;
+        } else {
+            _lru_stats.probation_hits++;
+        }
+        // don't dirty the item's cache line on repeated hits
+        if (!item_ref._referenced) {
+            item_ref._referenced = true;
+        }
+    }
+
+    // Moves a probation item to the head of the protected segment, and demotes
+    // the tail of the latter if it grew past its share. Protected items that were
+    // accessed since they were promoted get a second chance instead.
+    void promote(slab_item_base& item_ref) {
+        _lru.erase(_lru.iterator_to(item_ref));
+        item_ref._protected = true;
+        _protected.push_front(item_ref);
+        _lru_stats.promotions++;
+        auto limit = (_lru.size() + _protected.size()) * protected_share_percent / 100;
+        while (_protected.size() > limit) {
+            auto& tail = _protected.back();
+            _protected.pop_back();
+            if (tail._referenced) {
+                tail._referenced = false;
+                _protected.push_front(tail);
+                _lru_stats.second_chances++;
+                continue;
+            }
+            tail._protected = false;
+            _lru.push_front(tail);
+            _lru_stats.demotions++;
+        }
+    }
+
+    // Second chance scan from the tail of a segment: referenced items are passed
+    // to keep(), which moves them away from the tail, and locked ones (which stay
+    // linked under the lazy policies) are moved to the head. Returns the first
+    // other item, or nullptr if there is none.
+    template<typename Func>
+    slab_item_base* scan(lru_type& segment, Func&& keep) {
+        auto n = 2 * (_lru.size() + _protected.size()) + 1;
+        while (n-- && !segment.empty()) {
+            auto& item_ref = segment.back();
+            if (!reinterpret_cast<Item&>(item_ref).is_unlocked()) {
+                segment.pop_back();
+                segment.push_front(item_ref);
+            } else if (item_ref._referenced) {
+                item_ref._referenced = false;
+                keep(item_ref);
+            } else {
+                return &item_ref;
+            }
+        }
+        return nullptr;
+    }
+
+    slab_item_base* pick_victim() {
+        switch (_policy) {
+        case slab_eviction_policy::lru:
+            return _lru.empty() ? nullptr : &_lru.back();
+        case slab_eviction_policy::clock:
+            return scan(_lru, [this] (slab_item_base& item_ref) {
+                _lru.pop_back();
+                _lru.push_front(item_ref);
+                _lru_stats.second_chances++;
+            });
+        case slab_eviction_policy::segmented_lru:
+            if (auto victim = scan(_lru, [this] (slab_item_base& item_ref) { promote(item_ref); })) {
+                return victim;
+            }
+            return scan(_protected, [this] (slab_item_base& item_ref) {
+                _protected.pop_back();
+                _protected.push_front(item_ref);
+                _lru_stats.second_chances++;
+            });
+        }
+        return nullptr;
+    }
+
     inline
     std::pair<void *, uint32_t> evict_lru_item(std::function<void (Item& item_ref)>& erase_func) {
-        if (_lru.empty()) {
+        auto victim_ref = pick_victim();
+        if (!victim_ref) {
             return { nullptr, 0U };
         }
 
-        Item& victim = reinterpret_cast<Item&>(_lru.back());
+        Item& victim = reinterpret_cast<Item&>(*victim_ref);
         uint32_t index = victim.get_slab_page_index();
         assert(victim.is_unlocked());
-        _lru.erase(_lru.iterator_to(reinterpret_cast<slab_item_base&>(victim)));
+        segment_of(*victim_ref).erase(segment_of(*victim_ref).iterator_to(*victim_ref));
+        _evictions++;
         // WARNING: You need to make sure that erase_func will not release victim back to slab.
         erase_func(victim);
 
         return { reinterpret_cast<void*>(&victim), index };
     }
 public:
-    slab_class(size_t size, uint8_t slab_class_id)
+    slab_class(size_t size, uint8_t slab_class_id, slab_eviction_policy policy = slab_eviction_policy::lru)
         : _size(size)
         , _slab_class_id(slab_class_id)
+        , _policy(policy)
     {
     }
     slab_class(slab_class&&) = default;
     ~slab_class() {
         _free_slab_pages.clear();
         _lru.clear();
+        _protected.clear();
+    }
+
+    const slab_lru_stats& lru_stats() const {
+        return _lru_stats;
+    }
+
+    size_t probation_size() const {
+        return _lru.size();
+    }
+
+    size_t protected_size() const {
+        return _protected.size();
+    }
+
+    uint32_t pages() const {
+        return _pages;
+    }
+
+    void remove_page() {
+        _pages--;
+    }
+
+    // Evictions since the previous call
+    uint64_t take_recent_evictions() {
+        auto recent = _evictions - _evictions_seen;
+        _evictions_seen = _evictions;
+        return recent;
     }
 
     size_t size() const {
@@ -188,7 +340,7 @@ class slab_class {
     }
 
     bool has_no_slab_pages() const {
-        return _lru.empty();
+        return _lru.empty() && _protected.empty();
     }
 
     template<typename... Args>
@@ -227,6 +379,7 @@ class slab_class {
 
         _free_slab_pages.push_front(*desc);
         insert_slab_page_desc(*desc);
+        _pages++;
 
         // first object from the allocated slab page is returned.
         return create_item(slab_page, slab_page_index, std::forward<Args>(args)...);
@@ -243,7 +396,8 @@ class slab_class {
 
     void free_item(Item *item, slab_page_desc& desc) {
         void *object = item;
-        _lru.erase(_lru.iterator_to(reinterpret_cast<slab_item_base&>(*item)));
+        auto& item_ref = reinterpret_cast<slab_item_base&>(*item);
+        segment_of(item_ref).erase(segment_of(item_ref).iterator_to(item_ref));
         desc.free_object(object);
         if (desc.size() == 1) {
             // push back desc into the list of slab pages with free objects.
@@ -253,18 +407,45 @@ class slab_class {
 
     void touch_item(Item *item) {
         auto& item_ref = reinterpret_cast<slab_item_base&>(*item);
+        if (_policy != slab_eviction_policy::lru) {
+            reference(item_ref);
+            return;
+        }
+        _lru_stats.probation_hits++;
         _lru.erase(_lru.iterator_to(item_ref));
         _lru.push_front(item_ref);
     }
 
-    void remove_item_from_lru(Item *item) {
+    /*
+     * An item is locked while it is referenced by someone else than the cache, and
+     * must not be evicted in the meantime. Under lru it is unlinked, and relinked
+     * at the head once unlocked, which accounts for the access; the lazy policies
+     * leave it linked, and skip it when scanning.
+     */
+    void lock_item(Item *item) {
         auto& item_ref = reinterpret_cast<slab_item_base&>(*item);
+        if (_policy != slab_eviction_policy::lru) {
+            reference(item_ref);
+            return;
+        }
+        _lru_stats.probation_hits++;
         _lru.erase(_lru.iterator_to(item_ref));
     }
 
+    void unlock_item(Item *item) {
+        if (_policy == slab_eviction_policy::lru) {
+            insert_item_into_lru(item);
+        }
+    }
+
+    void remove_item_from_lru(Item *item) {
+        auto& item_ref = reinterpret_cast<slab_item_base&>(*item);
+        segment_of(item_ref).erase(segment_of(item_ref).iterator_to(item_ref));
+    }
+
     void insert_item_into_lru(Item *item) {
         auto& item_ref = reinterpret_cast<slab_item_base&>(*item);
-        _lru.push_front(item_ref);
+        segment_of(item_ref).push_front(item_ref);
     }
 
     void remove_desc_from_free_list(slab_page_desc& desc) {
@@ -282,6 +463,7 @@ class slab_allocator {
     // erase_func() is used to remove the item from the cache using slab.
     std::function<void (Item& item_ref)> _erase_func;
     std::vector<slab_page_desc*> _slab_pages_vector;
+    std::vector<uint32_t> _free_slab_page_indexes; // of the null entries of _slab_pages_vector
     boost::intrusive::list<slab_page_desc,
         boost::intrusive::member_hook<slab_page_desc, boost::intrusive::list_member_hook<>,
         &slab_page_desc::_lru_link>> _slab_page_desc_lru;
@@ -290,9 +472,12 @@ class slab_allocator {
     struct collectd_stats {
         uint64_t allocs;
         uint64_t frees;
+        uint64_t moved_pages = 0;
+        uint64_t moved_page_evictions = 0;
     } _stats;
     memory::reclaimer *_reclaimer = nullptr;
     bool _reclaimed = false;
+    slab_eviction_policy _policy = slab_eviction_policy::lru;
 private:
     memory::reclaiming_result evict_lru_slab_page() {
         if (_slab_page_desc_lru.empty()) {
@@ -301,50 +486,65 @@ class slab_allocator {
             // That being said, this event is very unlikely to happen.
             return memory::reclaiming_result::reclaimed_nothing;
         }
-        // get descriptor of the least-recently-used slab page and related info.
+        // get descriptor of the least-recently-used slab page.
         auto& desc = _slab_page_desc_lru.back();
         assert(desc.refcnt() == 0);
-        uint8_t slab_class_id = desc.slab_class_id();
-        auto slab_class = get_slab_class(slab_class_id);
-        void *slab_page = desc.slab_page();
+        evict_slab_page(desc);
+        return memory::reclaiming_result::reclaimed_something;
+    }
 
+    /*
+     * Call func on every allocated item of a slab page.
+     */
+    template<typename Func>
+    void for_each_item(slab_page_desc& desc, Func&& func) {
+        auto slab_class = get_slab_class(desc.slab_class_id());
         auto& free_objects = desc.free_objects();
+        // sort the array of free objects for binary search.
+        std::sort(free_objects.begin(), free_objects.end());
+        uintptr_t object = reinterpret_cast<uintptr_t>(desc.slab_page());
+        auto object_size = slab_class->size();
+        auto objects = _max_object_size / object_size;
+        for (auto i = 0u; i < objects; i++, object += object_size) {
+            // if binary_search returns true, it means that object at the current
+            // offset isn't an item.
+            if (!desc.empty() && std::binary_search(free_objects.begin(), free_objects.end(), object)) {
+                continue;
+            }
+            func(reinterpret_cast<Item*>(object));
+        }
+    }
+
+    /*
+     * Erase all items of an unlocked slab page, and free it.
+     */
+    void evict_slab_page(slab_page_desc& desc) {
+        auto slab_class = get_slab_class(desc.slab_class_id());
         if (!desc.empty()) {
             // if not empty, remove desc from the list of slab pages with free objects.
             slab_class->remove_desc_from_free_list(desc);
-            // and sort the array of free objects for binary search later on.
-            std::sort(free_objects.begin(), free_objects.end());
         }
-        // remove desc from the list of slab page descriptors.
-        _slab_page_desc_lru.erase(_slab_page_desc_lru.iterator_to(desc));
+        if (_reclaimer) {
+            // remove desc from the list of slab page descriptors.
+            _slab_page_desc_lru.erase(_slab_page_desc_lru.iterator_to(desc));
+        }
         // remove desc from the slab page vector.
         _slab_pages_vector[desc.index()] = nullptr;
+        _free_slab_page_indexes.push_back(desc.index());
+        slab_class->remove_page();
 
-        // Iterate through objects in the slab page and if the object is an allocated
-        // item, the item should be removed from LRU and then erased.
-        uintptr_t object = reinterpret_cast<uintptr_t>(slab_page);
-        auto object_size = slab_class->size();
-        auto objects = _max_object_size / object_size;
-        for (auto i = 0u; i < objects; i++, object += object_size) {
-            if (!desc.empty()) {
-                // if binary_search returns true, it means that object at the current
-                // offset isn't an item.
-                if (std::binary_search(free_objects.begin(), free_objects.end(), object)) {
-                    continue;
-                }
-            }
-            Item* item = reinterpret_cast<Item*>(object);
+        // If the object is an allocated item, the item should be removed from LRU and then erased.
+        for_each_item(desc, [this, slab_class] (Item* item) {
             assert(item->is_unlocked());
             slab_class->remove_item_from_lru(item);
             _erase_func(*item);
             _stats.frees++;
-        }
+        });
 #ifdef DEBUG
-        printf("lru slab page eviction succeeded! desc_empty?=%d\n", desc.empty());
+        printf("slab page eviction succeeded! desc_empty?=%d\n", desc.empty());
 #endif
-        ::free(slab_page); // free slab page object
+        ::free(desc.slab_page()); // free slab page object
         delete &desc; // free its descriptor
-        return memory::reclaiming_result::reclaimed_something;
     }
 
     /*
@@ -367,13 +567,13 @@ class slab_allocator {
         while (_max_object_size / size > 1) {
             size = align_up(size, alignment);
             _slab_class_sizes.push_back(size);
-            _slab_classes.emplace_back(size, slab_class_id);
+            _slab_classes.emplace_back(size, slab_class_id, _policy);
             size *= growth_factor;
             assert(slab_class_id < std::numeric_limits<uint8_t>::max());
             slab_class_id++;
         }
         _slab_class_sizes.push_back(_max_object_size);
-        _slab_classes.emplace_back(_max_object_size, slab_class_id);
+        _slab_classes.emplace_back(_max_object_size, slab_class_id, _policy);
 
         // If slab limit is zero, enable reclaimer.
         if (!limit) {
@@ -398,14 +598,60 @@ class slab_allocator {
         return &_slab_classes[slab_class_id];
     }
 
+    uint64_t total_lru_stat(uint64_t slab_lru_stats::*stat) const {
+        uint64_t total = 0;
+        for (auto& slab_class : _slab_classes) {
+            total += slab_class.lru_stats().*stat;
+        }
+        return total;
+    }
+
+    template<typename Func>
+    size_t total_objects(Func size) const {
+        size_t total = 0;
+        for (auto& slab_class : _slab_classes) {
+            total += size(slab_class);
+        }
+        return total;
+    }
+
     void register_metrics() {
         namespace sm = seastar::metrics;
+        static auto segment_label = sm::label("segment");
+        auto probation = segment_label("probation");
+        auto protected_ = segment_label("protected");
         _metrics.add_group("slab", {
             sm::make_derive("malloc_total_operations", sm::description("Total number of slab malloc operations"), _stats.allocs),
             sm::make_derive("free_total_operations", sm::description("Total number of slab free operations"), _stats.frees),
             sm::make_gauge("malloc_objects", sm::description("Number of slab created objects currently in memory"), [this] {
                 return _stats.allocs - _stats.frees;
-            })
+            }),
+            // the hit ratio of a segment is its share of the hits over its share of the objects;
+            // all objects are in probation unless the policy is segmented_lru
+            sm::make_derive("lru_hits", sm::description("Accesses to objects, by the LRU segment that held them"), {probation}, [this] {
+                return total_lru_stat(&slab_lru_stats::probation_hits);
+            }),
+            sm::make_derive("lru_hits", sm::description("Accesses to objects, by the LRU segment that held them"), {protected_}, [this] {
+                return total_lru_stat(&slab_lru_stats::protected_hits);
+            }),
+            sm::make_gauge("lru_objects", sm::description("Objects that can be evicted, by LRU segment"), {probation}, [this] {
+                return total_objects([] (const slab_class<Item>& sc) { return sc.probation_size(); });
+            }),
+            sm::make_gauge("lru_objects", sm::description("Objects that can be evicted, by LRU segment"), {protected_}, [this] {
+                return total_objects([] (const slab_class<Item>& sc) { return sc.protected_size(); });
+            }),
+            sm::make_derive("lru_promotions", sm::description("Objects moved from probation to protected after a hit"), [this] {
+                return total_lru_stat(&slab_lru_stats::promotions);
+            }),
+            sm::make_derive("lru_demotions", sm::description("Objects moved back from protected to probation"), [this] {
+                return total_lru_stat(&slab_lru_stats::demotions);
+            }),
+            sm::make_derive("lru_second_chances", sm::description("Objects spared by the eviction scan because they were hit"), [this] {
+                return total_lru_stat(&slab_lru_stats::second_chances);
+            }),
+            sm::make_derive("rebalanced_pages", sm::description("Slab pages moved between slab classes"), _stats.moved_pages),
+            sm::make_derive("rebalanced_page_evictions", sm::description("Objects evicted to move their slab pages"),
+                    _stats.moved_page_evictions),
         });
     }
 
@@ -431,10 +677,12 @@ class slab_allocator {
     }
 
     slab_allocator(double growth_factor, uint64_t limit, uint64_t max_object_size,
-                   std::function<void (Item& item_ref)> erase_func)
+                   std::function<void (Item& item_ref)> erase_func,
+                   slab_eviction_policy policy = slab_eviction_policy::lru)
         : _erase_func(std::move(erase_func))
         , _max_object_size(max_object_size)
         , _available_slab_pages(limit / max_object_size)
+        , _policy(policy)
     {
         initialize_slab_allocator(growth_factor, limit);
         register_metrics();
@@ -469,15 +717,22 @@ class slab_allocator {
             _stats.allocs++;
         } else {
             if (can_allocate_page(*slab_class)) {
-                auto index_to_insert = _slab_pages_vector.size();
+                // reuse the index of a freed slab page, if any.
+                auto index_to_insert = _free_slab_page_indexes.empty() ? _slab_pages_vector.size()
+                        : _free_slab_page_indexes.back();
                 item = slab_class->create_from_new_page(_max_object_size, index_to_insert,
-                    [this](slab_page_desc& desc) {
+                    [this, index_to_insert](slab_page_desc& desc) {
                         if (_reclaimer) {
                             // insert desc into the LRU list of slab page descriptors.
                             _slab_page_desc_lru.push_front(desc);
                         }
                         // insert desc into the slab page vector.
-                        _slab_pages_vector.push_back(&desc);
+                        if (index_to_insert == _slab_pages_vector.size()) {
+                            _slab_pages_vector.push_back(&desc);
+                        } else {
+                            _slab_pages_vector[index_to_insert] = &desc;
+                            _free_slab_page_indexes.pop_back();
+                        }
                     },
                     std::forward<Args>(args)...);
                 if (_available_slab_pages > 0) {
@@ -501,9 +756,9 @@ class slab_allocator {
                 _slab_page_desc_lru.erase(_slab_page_desc_lru.iterator_to(desc));
             }
         }
-        // remove item from the lru of its slab class.
+        // protect item from eviction by its slab class.
         auto slab_class = get_slab_class(desc.slab_class_id());
-        slab_class->remove_item_from_lru(item);
+        slab_class->lock_item(item);
     }
 
     void unlock_item(Item *item) {
@@ -516,9 +771,9 @@ class slab_allocator {
                 _slab_page_desc_lru.push_front(desc);
             }
         }
-        // insert item into the lru of its slab class.
+        // make item evictable again by its slab class.
         auto slab_class = get_slab_class(desc.slab_class_id());
-        slab_class->insert_item_into_lru(item);
+        slab_class->unlock_item(item);
     }
 
     /**
@@ -544,6 +799,59 @@ class slab_allocator {
         }
     }
 
+    /**
+     * Move a slab page from a slab class that hasn't evicted items since the previous
+     * call to the class that evicted the most, by evicting the items of one of its
+     * pages; the latter class then gets the freed page when it next needs one.
+     * Meant to be called periodically, so that the memory follows the sizes of the
+     * items being stored. Classes are left with at least one page, and pages with
+     * locked items aren't moved.
+     * Returns true if a page was moved.
+     */
+    bool rebalance() {
+        if (!_erase_func) {
+            return false;
+        }
+        slab_class<Item>* hot = nullptr;
+        slab_class<Item>* cold = nullptr;
+        uint64_t hot_evictions = 0;
+        for (auto& slab_class : _slab_classes) {
+            auto evictions = slab_class.take_recent_evictions();
+            if (evictions > hot_evictions) {
+                hot = &slab_class;
+                hot_evictions = evictions;
+            } else if (!evictions && slab_class.pages() > 1 && (!cold || slab_class.pages() > cold->pages())) {
+                cold = &slab_class;
+            }
+        }
+        if (!hot || !cold || cold == hot) {
+            return false;
+        }
+        // the page of the cold class with the fewest items to evict.
+        slab_page_desc* victim = nullptr;
+        for (auto desc : _slab_pages_vector) {
+            if (!desc || get_slab_class(desc->slab_class_id()) != cold || (victim && desc->size() <= victim->size())) {
+                continue;
+            }
+            bool unlocked = true;
+            for_each_item(*desc, [&unlocked] (Item* item) {
+                unlocked = unlocked && item->is_unlocked();
+            });
+            if (unlocked) {
+                victim = desc;
+            }
+        }
+        if (!victim) {
+            return false;
+        }
+        auto frees = _stats.frees;
+        evict_slab_page(*victim);
+        _stats.moved_page_evictions += _stats.frees - frees;
+        _stats.moved_pages++;
+        _available_slab_pages++;
+        return true;
+    }
+
     /**
      * Helper function: Print all available slab classes and their respective properties.
      */
@@ -36,6 +36,7 @@
 #include <type_traits>
 #include <experimental/string_view>
 #include "core/temporary_buffer.hh"
+#include "core/byte_search.hh"
 
 namespace seastar {
 
@@ -80,6 +81,25 @@ class basic_sstring {
         return is_internal() ? u.internal.str : u.external.str;
     }
 
+    // Grows an external string to new_size, with realloc(), so that the
+    // seastar allocator may extend it in place; false if not external
+    bool grow_external(size_t new_size) {
+        if (is_internal()) {
+            return false;
+        }
+        if (size_type(new_size) != new_size) {
+            throw std::overflow_error("sstring overflow");
+        }
+        auto p = reinterpret_cast<char_type*>(std::realloc(u.external.str, new_size + 1));
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        u.external.str = p;
+        u.external.size = new_size;
+        p[new_size] = '\0';
+        return true;
+    }
+
     template <typename string_type, typename T>
     static inline string_type to_sstring_sprintf(T value, const char* fmt) {
         char tmp[sizeof(value) * 3 + 2];
@@ -267,38 +287,51 @@ class basic_sstring {
     }
 
     size_t find(char_type t, size_t pos = 0) const noexcept {
-        const char_type* it = str() + pos;
-        const char_type* end = str() + size();
-        while (it < end) {
-            if (*it == t) {
-                return it - str();
-            }
-            it++;
+        if (pos >= size()) {
+            return npos;
         }
-        return npos;
+        // memchr(), for char
+        auto it = traits_type::find(str() + pos, size() - pos, t);
+        return it ? it - str() : npos;
     }
 
     size_t find(const basic_sstring& s, size_t pos = 0) const noexcept {
+        if (pos >= size()) {
+            return npos;
+        }
+        if (sizeof(char_type) == 1) {
+            auto b = reinterpret_cast<const char*>(str());
+            auto e = b + size();
+            auto it = find_bytes(b + pos, e, reinterpret_cast<const char*>(s.str()), s.size());
+            return it != e ? it - b : npos;
+        }
         const char_type* it = str() + pos;
         const char_type* end = str() + size();
-        const char_type* c_str = s.str();
-        const char_type* c_str_end = s.str() + s.size();
-
-        while (it < end) {
-            auto i = it;
-            auto j = c_str;
-            while ( i < end && j < c_str_end && *i == *j) {
-                i++;
-                j++;
-            }
-            if (j == c_str_end) {
+        while (it && size_t(end - it) >= s.size()) {
+            if (traits_type::compare(it, s.str(), s.size()) == 0) {
                 return it - str();
             }
-            it++;
+            it = traits_type::find(it + 1, end - it - 1, s[0]);
         }
         return npos;
     }
 
+    /// Returns the position of the first character, at \c pos or after,
+    /// that is one of \c set, or npos if there is none.
+    size_t find_first_of(const basic_sstring& set, size_t pos = 0) const noexcept {
+        if (pos >= size()) {
+            return npos;
+        }
+        if (sizeof(char_type) == 1) {
+            auto b = reinterpret_cast<const char*>(str());
+            auto e = b + size();
+            auto it = seastar::find_first_of(b + pos, e, reinterpret_cast<const char*>(set.str()), set.size());
+            return it != e ? it - b : npos;
+        }
+        auto it = std::find_first_of(begin() + pos, end(), set.begin(), set.end());
+        return it != end() ? it - begin() : npos;
+    }
+
     /**
      * find_last_of find the last occurrence of c in the string.
      * When pos is specified, the search only includes characters
@@ -329,6 +362,14 @@ class basic_sstring {
      *  @return  Reference to this string.
      */
     basic_sstring& append (const char_type* s, size_t n) {
+        auto old_size = size();
+        // s may be part of this string, which growing would move
+        if (!std::less<const char_type*>()(s, end()) || !std::less<const char_type*>()(begin(), s + n)) {
+            if (grow_external(old_size + n)) {
+                std::copy(s, s + n, u.external.str + old_size);
+                return *this;
+            }
+        }
         basic_sstring ret(initialized_later(), size() + n);
         std::copy(begin(), end(), ret.begin());
         std::copy(s, s + n, ret.begin() + size());
@@ -342,7 +383,10 @@ class basic_sstring {
      *  @param c  if n greater than current size character to fill newly allocated space with.
      */
     void resize(size_t n, const char_type c  = '\0') {
-        if (n > size()) {
+        auto old_size = size();
+        if (n > old_size && grow_external(n)) {
+            std::fill(u.external.str + old_size, u.external.str + n, c);
+        } else if (n > old_size) {
             *this += basic_sstring(n - size(), c);
         } else if (n < size()) {
             if (is_internal()) {
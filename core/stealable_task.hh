@@ -0,0 +1,117 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <experimental/optional>
+#include "future.hh"
+#include "scheduling.hh"
+#include "util/spinlock.hh"
+
+namespace seastar {
+
+/// \cond internal
+
+// A self-contained closure that may run on any shard: queued on the shard
+// that submitted it, it is either run there or stolen by an idle shard. In
+// both cases its result is delivered, and the object destroyed, on the
+// submitting shard.
+class stealable_task {
+    unsigned _origin;
+    scheduling_group _sg;
+public:
+    stealable_task(unsigned origin, scheduling_group sg) : _origin(origin), _sg(sg) {}
+    virtual ~stealable_task() {}
+    // Runs the closure, on whichever shard took the task
+    virtual void run() noexcept = 0;
+    // Delivers the result and destroys the task; called on the origin
+    // shard, after run()
+    virtual void complete() noexcept = 0;
+    unsigned origin() const { return _origin; }
+    scheduling_group group() const { return _sg; }
+};
+
+template <typename Func>
+class stealable_task_impl final : public stealable_task {
+    using futurator = futurize<std::result_of_t<Func()>>;
+    Func _func;
+    typename futurator::promise_type _pr;
+    std::experimental::optional<typename futurator::type> _result;
+public:
+    stealable_task_impl(unsigned origin, scheduling_group sg, Func&& func)
+        : stealable_task(origin, sg), _func(std::move(func)) {}
+    typename futurator::type get_future() {
+        return _pr.get_future();
+    }
+    virtual void run() noexcept override {
+        // func does not return a future, so the result is ready right away
+        _result.emplace(futurator::apply(_func));
+    }
+    virtual void complete() noexcept override {
+        _result->forward_to(std::move(_pr));
+        delete this;
+    }
+};
+
+// Per-shard queue of stealable tasks. The owning shard takes the newest
+// task (its data is most likely still in cache), and thieves the oldest.
+class stealable_task_queue {
+    util::spinlock _lock;
+    std::deque<stealable_task*> _tasks;
+    std::atomic<size_t> _size = { 0 };
+public:
+    void push(stealable_task* t) {
+        std::lock_guard<util::spinlock> g(_lock);
+        _tasks.push_back(t);
+        _size.store(_tasks.size(), std::memory_order_relaxed);
+    }
+    stealable_task* pop_newest() {
+        std::lock_guard<util::spinlock> g(_lock);
+        if (_tasks.empty()) {
+            return nullptr;
+        }
+        auto t = _tasks.back();
+        _tasks.pop_back();
+        _size.store(_tasks.size(), std::memory_order_relaxed);
+        return t;
+    }
+    stealable_task* pop_oldest() {
+        std::lock_guard<util::spinlock> g(_lock);
+        if (_tasks.empty()) {
+            return nullptr;
+        }
+        auto t = _tasks.front();
+        _tasks.pop_front();
+        _size.store(_tasks.size(), std::memory_order_relaxed);
+        return t;
+    }
+    // Lock-free hint, for thieves to skip empty queues cheaply
+    size_t size() const {
+        return _size.load(std::memory_order_relaxed);
+    }
+};
+
+/// \endcond
+
+}
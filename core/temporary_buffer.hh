@@ -24,6 +24,7 @@
 
 #include "deleter.hh"
 #include "util/eclipse.hh"
+#include "byte_search.hh"
 #include <malloc.h>
 #include <algorithm>
 
@@ -140,6 +141,20 @@ class temporary_buffer {
     CharType operator[](size_t pos) const {
         return _buffer[pos];
     }
+    /// Returns a pointer to the first occurrence of \c c in the buffer,
+    /// or \ref end() if there is none.
+    const CharType* find(CharType c) const {
+        return find_first_of(&c, 1);
+    }
+    /// Returns a pointer to the first character of the buffer that is one
+    /// of the \c n characters at \c set, or \ref end() if there is none.
+    ///
+    /// \see seastar::find_first_of(const char*, const char*, const char*, size_t)
+    const CharType* find_first_of(const CharType* set, size_t n) const {
+        static_assert(sizeof(CharType) == 1, "temporary_buffer searches are for bytes");
+        auto b = reinterpret_cast<const char*>(_buffer);
+        return reinterpret_cast<const CharType*>(seastar::find_first_of(b, b + _size, reinterpret_cast<const char*>(set), n));
+    }
     /// Checks whether the buffer is empty.
     bool empty() const { return !size(); }
     /// Checks whether the buffer is not empty.
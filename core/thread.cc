@@ -22,8 +22,12 @@
 
 #include "thread.hh"
 #include "posix.hh"
+#include "align.hh"
 #include <ucontext.h>
+#include <sys/mman.h>
 #include <algorithm>
+#include <unordered_map>
+#include <vector>
 
 /// \cond internal
 
@@ -108,6 +112,178 @@ void jmp_buf_link::final_switch_out()
     setcontext(&g_current_context->context);
 }
 
+#elif defined(SEASTAR_ASM_CONTEXT_SWITCH)
+
+extern "C" {
+// Pushes the callee-saved registers on the current stack, stores its
+// pointer in *from, and pops them from the stack at to, returning to
+// where that stack switched out. Like longjmp(), it leaves the floating
+// point environment alone.
+void seastar_switch_context(void** from, void* to);
+// The bottom frame of a new thread, the return address of its initial
+// switch: calls the function in the first saved register, with the
+// thread_context in the second, and ends the stack for unwinders.
+void seastar_thread_entry();
+}
+
+#ifdef __x86_64__
+
+asm(R"(
+    .text
+    .globl seastar_switch_context
+    .hidden seastar_switch_context
+    .type seastar_switch_context, @function
+    .align 16
+seastar_switch_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    // a ret would be mispredicted, returning elsewhere than the call
+    popq %rcx
+    jmpq *%rcx
+    .size seastar_switch_context, .-seastar_switch_context
+
+    .globl seastar_thread_entry
+    .hidden seastar_thread_entry
+    .type seastar_thread_entry, @function
+    .align 16
+seastar_thread_entry:
+    .cfi_startproc
+    .cfi_undefined rip
+    movq %r12, %rdi
+    callq *%r13
+    ud2
+    .cfi_endproc
+    .size seastar_thread_entry, .-seastar_thread_entry
+)");
+
+// The registers seastar_switch_context() pops, from the stack pointer up
+struct initial_frame {
+    uint64_t r15, r14, r13, r12, rbx, rbp;
+    void (*ret)();
+};
+
+static void init_frame(initial_frame& f, void (*func)(thread_context*), thread_context* t) {
+    f = initial_frame{};
+    f.r13 = reinterpret_cast<uintptr_t>(func);
+    f.r12 = reinterpret_cast<uintptr_t>(t);
+    f.ret = seastar_thread_entry;
+}
+
+#else // __aarch64__
+
+asm(R"(
+    .text
+    .globl seastar_switch_context
+    .hidden seastar_switch_context
+    .type seastar_switch_context, %function
+    .align 4
+seastar_switch_context:
+    sub sp, sp, #160
+    stp x19, x20, [sp, #0]
+    stp x21, x22, [sp, #16]
+    stp x23, x24, [sp, #32]
+    stp x25, x26, [sp, #48]
+    stp x27, x28, [sp, #64]
+    stp x29, x30, [sp, #80]
+    stp d8, d9, [sp, #96]
+    stp d10, d11, [sp, #112]
+    stp d12, d13, [sp, #128]
+    stp d14, d15, [sp, #144]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp x19, x20, [sp, #0]
+    ldp x21, x22, [sp, #16]
+    ldp x23, x24, [sp, #32]
+    ldp x25, x26, [sp, #48]
+    ldp x27, x28, [sp, #64]
+    ldp x29, x30, [sp, #80]
+    ldp d8, d9, [sp, #96]
+    ldp d10, d11, [sp, #112]
+    ldp d12, d13, [sp, #128]
+    ldp d14, d15, [sp, #144]
+    add sp, sp, #160
+    // a ret would be mispredicted, returning elsewhere than the call
+    br x30
+    .size seastar_switch_context, .-seastar_switch_context
+
+    .globl seastar_thread_entry
+    .hidden seastar_thread_entry
+    .type seastar_thread_entry, %function
+    .align 4
+seastar_thread_entry:
+    .cfi_startproc
+    .cfi_undefined x30
+    mov x0, x20
+    blr x19
+    brk #0
+    .cfi_endproc
+    .size seastar_thread_entry, .-seastar_thread_entry
+)");
+
+// The registers seastar_switch_context() pops, from the stack pointer up
+struct initial_frame {
+    uint64_t x19, x20, x21_28[8], x29, x30;
+    uint64_t d8_15[8];
+};
+
+static void init_frame(initial_frame& f, void (*func)(thread_context*), thread_context* t) {
+    f = initial_frame{};
+    f.x19 = reinterpret_cast<uintptr_t>(func);
+    f.x20 = reinterpret_cast<uintptr_t>(t);
+    f.x30 = reinterpret_cast<uintptr_t>(seastar_thread_entry);
+}
+
+#endif
+
+inline void jmp_buf_link::initial_switch_in(void (*func)(thread_context*), char* stack, size_t stack_size)
+{
+    // once the frame is popped, the stack pointer is aligned for a call
+    auto top = align_down(stack + stack_size, 16);
+    auto frame = reinterpret_cast<initial_frame*>(top - sizeof(initial_frame));
+    init_frame(*frame, func, thread);
+    auto prev = std::exchange(g_current_context, this);
+    link = prev;
+    seastar_switch_context(&prev->sp, frame);
+}
+
+inline void jmp_buf_link::switch_in()
+{
+    auto prev = std::exchange(g_current_context, this);
+    link = prev;
+    seastar_switch_context(&prev->sp, sp);
+}
+
+inline void jmp_buf_link::switch_out()
+{
+    g_current_context = link;
+    seastar_switch_context(&sp, g_current_context->sp);
+}
+
+inline void jmp_buf_link::initial_switch_in_completed()
+{
+}
+
+inline void jmp_buf_link::final_switch_out()
+{
+    g_current_context = link;
+    // the stack is freed once the thread is joined, and never returned to
+    seastar_switch_context(&sp, g_current_context->sp);
+    abort();
+}
+
 #else
 
 inline void jmp_buf_link::initial_switch_in(ucontext_t* initial_context, const void*, size_t)
@@ -148,11 +324,94 @@ inline void jmp_buf_link::final_switch_out()
 
 #endif
 
-thread_context::thread_context(thread_attributes attr, std::function<void ()> func)
-        : _attr(std::move(attr))
+namespace {
+
+class stack_pool {
+    // Free stacks by mapping size
+    std::unordered_map<size_t, std::vector<char*>> _free;
+    // Only the top of a stack is touched by most threads; when a stack
+    // returns to the pool the rest is handed back to the kernel so that one
+    // deep recursion doesn't pin memory in the pool forever.
+    static constexpr size_t hot_stack_size = 16*1024;
+public:
 #ifdef SEASTAR_THREAD_STACK_GUARDS
-        , _stack_size(base_stack_size + getpagesize())
+    bool guard_pages = true;
+#else
+    bool guard_pages = false;
+#endif
+#ifdef ASAN_ENABLED
+    // Reused stacks would carry stale ASan poisoning from earlier threads
+    size_t max_cached = 0;
+#else
+    size_t max_cached = 64;
 #endif
+    thread_impl::stack_pool_stats stats;
+public:
+    std::pair<char*, bool> allocate(size_t size) {
+        auto it = _free.find(size);
+        if (it != _free.end() && !it->second.empty()) {
+            auto p = it->second.back();
+            it->second.pop_back();
+            --stats.cached;
+            ++stats.reuses;
+            return { p, guard_pages };
+        }
+        auto p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        if (guard_pages) {
+            auto r = ::mprotect(p, getpagesize(), PROT_NONE);
+            if (r == -1) {
+                ::munmap(p, size);
+                throw_system_error_on(true, "mprotect");
+            }
+        }
+        ++stats.allocations;
+        return { static_cast<char*>(p), guard_pages };
+    }
+    void release(char* p, size_t size, bool guarded) noexcept {
+        if (guarded == guard_pages && stats.cached < max_cached) {
+            try {
+                auto& free = _free[size];
+                free.push_back(p);
+                ++stats.cached;
+                if (size > hot_stack_size + getpagesize()) {
+                    ::madvise(p + getpagesize(), size - hot_stack_size - getpagesize(), MADV_DONTNEED);
+                }
+                return;
+            } catch (...) {
+                // fall through and unmap
+            }
+        }
+        ::munmap(p, size);
+        ++stats.releases;
+    }
+    void clear() noexcept {
+        for (auto& e : _free) {
+            for (auto p : e.second) {
+                ::munmap(p, e.first);
+                ++stats.releases;
+            }
+        }
+        _free.clear();
+        stats.cached = 0;
+    }
+};
+
+// Never destroyed: threads may still release their stacks while other
+// thread_local objects, such as the reactor, are being torn down.
+stack_pool& the_stack_pool() {
+    static thread_local std::aligned_storage_t<sizeof(stack_pool), alignof(stack_pool)> storage;
+    static thread_local stack_pool* pool = new (&storage) stack_pool;
+    return *pool;
+}
+
+}
+
+thread_context::thread_context(thread_attributes attr, std::function<void ()> func)
+        : _attr(std::move(attr))
         , _func(std::move(func))
         , _scheduling_group(_attr.sched_group.value_or(current_scheduling_group())) {
     setup();
@@ -160,37 +419,29 @@ thread_context::thread_context(thread_attributes attr, std::function<void ()> fu
 }
 
 thread_context::~thread_context() {
-#ifdef SEASTAR_THREAD_STACK_GUARDS
-    auto mp_result = mprotect(_stack.get(), getpagesize(), PROT_READ | PROT_WRITE);
-    assert(mp_result == 0);
-#endif
     _all_threads.erase(_all_threads.iterator_to(*this));
 }
 
 thread_context::stack_holder
 thread_context::make_stack() {
-#ifdef SEASTAR_THREAD_STACK_GUARDS
-    auto stack = stack_holder(new (with_alignment(getpagesize())) char[_stack_size]);
-#else
-    auto stack = stack_holder(new char[_stack_size]);
-#endif
-#ifdef ASAN_ENABLED
-    // Avoid ASAN false positive due to garbage on stack
-    std::fill_n(stack.get(), _stack_size, 0);
-#endif
-    return stack;
+    // One extra page at the bottom of the stack for the guard, whether
+    // or not it is protected, so that all stacks of a size are alike.
+    size_t page_size = getpagesize();
+    auto size = align_up(_attr.stack_size ? _attr.stack_size : base_stack_size, page_size) + page_size;
+    auto stack = the_stack_pool().allocate(size);
+    return stack_holder(stack.first, stack_deleter{size, stack.second});
 }
 
 void thread_context::stack_deleter::operator()(char* ptr) const noexcept {
-#ifdef SEASTAR_THREAD_STACK_GUARDS
-    operator delete[] (ptr, with_alignment(getpagesize()));
-#else
-    delete[] ptr;
-#endif
+    the_stack_pool().release(ptr, size, guarded);
 }
 
 void
 thread_context::setup() {
+    _context.thread = this;
+#ifdef SEASTAR_ASM_CONTEXT_SWITCH
+    _context.initial_switch_in(&thread_context::s_main_direct, _stack.get(), _stack_size);
+#else
     // use setcontext() for the initial jump, as it allows us
     // to set up a stack, but continue with longjmp() as it's
     // much faster.
@@ -199,18 +450,12 @@ thread_context::setup() {
     auto main = reinterpret_cast<void (*)()>(&thread_context::s_main);
     auto r = getcontext(&initial_context);
     throw_system_error_on(r == -1);
-#ifdef SEASTAR_THREAD_STACK_GUARDS
-    size_t page_size = getpagesize();
-    assert(align_up(_stack.get(), page_size) == _stack.get());
-    auto mp_status = mprotect(_stack.get(), page_size, PROT_READ);
-    throw_system_error_on(mp_status != 0, "mprotect");
-#endif
     initial_context.uc_stack.ss_sp = _stack.get();
     initial_context.uc_stack.ss_size = _stack_size;
     initial_context.uc_link = nullptr;
     makecontext(&initial_context, main, 2, int(q), int(q >> 32));
-    _context.thread = this;
     _context.initial_switch_in(&initial_context, _stack.get(), _stack_size);
+#endif
 }
 
 void
@@ -288,6 +533,11 @@ thread_context::s_main(int lo, int hi) {
     reinterpret_cast<thread_context*>(q)->main();
 }
 
+void
+thread_context::s_main_direct(thread_context* t) {
+    t->main();
+}
+
 void
 thread_context::main() {
 #ifdef __x86_64__
@@ -295,6 +545,8 @@ thread_context::main() {
     // unwinders don't try to trace back past this frame.
     // See https://github.com/scylladb/scylla/issues/1909.
     asm(".cfi_undefined rip");
+#elif defined(__aarch64__)
+    asm(".cfi_undefined x30");
 #elif defined(__PPC__)
     asm(".cfi_undefined lr");
 #else
@@ -337,6 +589,24 @@ void init() {
     g_current_context = &g_unthreaded_context;
 }
 
+void configure_stack_pool(bool guard_pages, size_t max_cached_stacks) {
+    auto& pool = the_stack_pool();
+    if (guard_pages != pool.guard_pages) {
+        pool.clear();
+    }
+    pool.guard_pages = guard_pages;
+#ifndef ASAN_ENABLED
+    pool.max_cached = max_cached_stacks;
+#endif
+    if (pool.stats.cached > pool.max_cached) {
+        pool.clear();
+    }
+}
+
+stack_pool_stats get_stack_pool_stats() {
+    return the_stack_pool().stats;
+}
+
 scheduling_group
 sched_group(const thread_context* thread) {
     return thread->_scheduling_group;
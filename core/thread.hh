@@ -84,6 +84,9 @@ class thread_attributes {
 public:
     thread_scheduling_group* scheduling_group = nullptr;  // FIXME: remove
     stdx::optional<seastar::scheduling_group> sched_group;
+    /// Size of the thread's stack, rounded up to a page; zero selects the
+    /// default of 128KB.
+    size_t stack_size = 0;
 };
 
 
@@ -95,18 +98,16 @@ extern thread_local jmp_buf_link g_unthreaded_context;
 // to this state to be captured.
 class thread_context {
     struct stack_deleter {
+        size_t size;
+        bool guarded;
         void operator()(char *ptr) const noexcept;
     };
     using stack_holder = std::unique_ptr<char[], stack_deleter>;
     static constexpr size_t base_stack_size = 128*1024;
 
     thread_attributes _attr;
-#ifdef SEASTAR_THREAD_STACK_GUARDS
-    const size_t _stack_size;
-#else
-    static constexpr size_t _stack_size = base_stack_size;
-#endif
     stack_holder _stack{make_stack()};
+    const size_t _stack_size = _stack.get_deleter().size;
     std::function<void ()> _func;
     jmp_buf_link _context;
     scheduling_group _scheduling_group;
@@ -131,6 +132,7 @@ class thread_context {
     static thread_local all_thread_list _all_threads;
 private:
     static void s_main(int lo, int hi); // all parameters MUST be 'int' for makecontext
+    static void s_main_direct(thread_context* t);
     void setup();
     void main();
     stack_holder make_stack();
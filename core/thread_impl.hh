@@ -35,12 +35,23 @@ using thread_clock = std::chrono::steady_clock;
 class thread_context;
 class scheduling_group;
 
+// Threads switch by saving and restoring the callee-saved registers
+// in assembly, where it is written for the architecture; elsewhere, or
+// with ASan, which must be told of stack switches, they use
+// setcontext() and longjmp().
+#if !defined(ASAN_ENABLED) && !defined(SEASTAR_NO_ASM_CONTEXT_SWITCH) && (defined(__x86_64__) || defined(__aarch64__))
+#define SEASTAR_ASM_CONTEXT_SWITCH
+#endif
+
 struct jmp_buf_link {
 #ifdef ASAN_ENABLED
     ucontext_t context;
     void* fake_stack = nullptr;
     const void* stack_bottom;
     size_t stack_size;
+#elif defined(SEASTAR_ASM_CONTEXT_SWITCH)
+    // While switched out, the stack pointer, below the saved registers
+    void* sp;
 #else
     jmp_buf jmpbuf;
 #endif
@@ -48,7 +59,12 @@ struct jmp_buf_link {
     thread_context* thread;
     std::experimental::optional<std::chrono::time_point<thread_clock>> yield_at = {};
 public:
+#ifdef SEASTAR_ASM_CONTEXT_SWITCH
+    // Starts the function at the top of a stack, where it must never return
+    void initial_switch_in(void (*func)(thread_context*), char* stack, size_t stack_size);
+#else
     void initial_switch_in(ucontext_t* initial_context, const void* stack_bottom, size_t stack_size);
+#endif
     void switch_in();
     void switch_out();
     void initial_switch_in_completed();
@@ -80,6 +96,21 @@ void switch_in(thread_context* to);
 void switch_out(thread_context* from);
 void init();
 
+// Thread stacks are mapped directly from the kernel, so that pages are only
+// committed when touched, and freed stacks are kept in a per-shard pool for
+// reuse.
+struct stack_pool_stats {
+    uint64_t allocations = 0; // stacks mapped from the kernel
+    uint64_t reuses = 0;      // stacks taken from the pool
+    uint64_t releases = 0;    // stacks unmapped
+    size_t cached = 0;        // free stacks held by the pool
+};
+
+// Sets whether new stacks get a guard page (PROT_NONE, set up once when the
+// stack is mapped) and how many free stacks the pool keeps.
+void configure_stack_pool(bool guard_pages, size_t max_cached_stacks);
+stack_pool_stats get_stack_pool_stats();
+
 }
 }
 /// \endcond
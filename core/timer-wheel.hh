@@ -0,0 +1,350 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <chrono>
+#include <limits>
+#include <bitset>
+#include <array>
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <boost/intrusive/list.hpp>
+#include "bitset-iter.hh"
+
+namespace seastar {
+
+/**
+ * A hierarchical timing wheel, with the same interface as timer_set.
+ *
+ * Time is divided into ticks of Granularity units of Timer::duration.
+ * A timer due in a tick t later than the current tick is kept at the
+ * level given by the most significant group of slot_bits bits in which t
+ * differs from the current tick, in the slot selected by those bits of t.
+ * The position of a timer is therefore a function of its timeout and the
+ * current tick alone, so insert() and remove() are O(1). expire() splices
+ * whole slots that became due into the expired list, and only re-sorts
+ * (cascades) the single slot the new current tick falls into on the
+ * highest level that changed.
+ *
+ * Timers due in the current tick are kept in a separate list and compared
+ * against their exact timeout on expiry, so that timers never expire
+ * early, even with a coarse granularity.
+ *
+ * The template type "Timer" should have a method named
+ * get_timeout() which returns Timer::time_point which denotes
+ * timer's expiration.
+ */
+template<typename Timer, boost::intrusive::list_member_hook<> Timer::*link, typename Timer::duration::rep Granularity = 1>
+class timer_wheel {
+public:
+    using time_point = typename Timer::time_point;
+    using timer_list_t = boost::intrusive::list<Timer, boost::intrusive::member_hook<Timer, boost::intrusive::list_member_hook<>, link>>;
+private:
+    using duration = typename Timer::duration;
+    using timestamp_t = typename Timer::duration::rep;
+    using tick_t = unsigned long;
+
+    static_assert(Granularity > 0, "granularity must be positive");
+    static_assert(std::numeric_limits<tick_t>::digits == 64, "tick_t must have 64 bits");
+
+    static constexpr timestamp_t max_timestamp = std::numeric_limits<timestamp_t>::max();
+    static constexpr int slot_bits = 6;
+    static constexpr int n_slots = 1 << slot_bits;
+    static constexpr int n_levels = (std::numeric_limits<tick_t>::digits + slot_bits - 1) / slot_bits;
+
+    struct level {
+        std::array<timer_list_t, n_slots> slots;
+        std::bitset<n_slots> non_empty;
+    };
+
+    std::array<level, n_levels> _levels;
+    // Timers due in the current tick (or earlier, if inserted late).
+    timer_list_t _due;
+    timestamp_t _last;
+    tick_t _current;
+    timestamp_t _next;
+private:
+    static timestamp_t get_timestamp(time_point _time_point)
+    {
+        return _time_point.time_since_epoch().count();
+    }
+
+    static timestamp_t get_timestamp(Timer& timer)
+    {
+        return get_timestamp(timer.get_timeout());
+    }
+
+    static tick_t get_tick(timestamp_t timestamp)
+    {
+        return timestamp > 0 ? tick_t(timestamp / Granularity) : 0;
+    }
+
+    // Level holding timers due in tick t; t must be later than _current.
+    int get_level(tick_t t) const
+    {
+        auto bit = std::numeric_limits<tick_t>::digits - 1 - bitsets::count_leading_zeros(t ^ _current);
+        return bit / slot_bits;
+    }
+
+    static int get_slot(tick_t t, int level)
+    {
+        return (t >> (level * slot_bits)) & (n_slots - 1);
+    }
+
+    timer_list_t& get_list(timestamp_t timestamp, int& level, int& slot)
+    {
+        auto t = get_tick(timestamp);
+        if (t <= _current) {
+            level = -1;
+            return _due;
+        }
+        level = get_level(t);
+        slot = get_slot(t, level);
+        return _levels[level].slots[slot];
+    }
+
+    void place(Timer& timer)
+    {
+        int level, slot;
+        get_list(get_timestamp(timer), level, slot).push_back(timer);
+        if (level >= 0) {
+            _levels[level].non_empty[slot] = true;
+        }
+    }
+
+    void expire_slot(timer_list_t& exp, int level, int slot)
+    {
+        exp.splice(exp.end(), _levels[level].slots[slot]);
+        _levels[level].non_empty[slot] = false;
+    }
+
+    timestamp_t earliest(const timer_list_t& list) const
+    {
+        auto ret = max_timestamp;
+        for (auto& timer : list) {
+            ret = std::min(ret, get_timestamp(const_cast<Timer&>(timer)));
+        }
+        return ret;
+    }
+public:
+    timer_wheel()
+        : _last(0)
+        , _current(0)
+        , _next(max_timestamp)
+    {
+    }
+
+    ~timer_wheel() {
+        auto cancel_all = [] (timer_list_t& list) {
+            while (!list.empty()) {
+                auto& timer = *list.begin();
+                timer.cancel();
+            }
+        };
+        cancel_all(_due);
+        for (auto&& level : _levels) {
+            for (auto&& list : level.slots) {
+                cancel_all(list);
+            }
+        }
+    }
+
+    /**
+     * Adds timer to the active set.
+     *
+     * The value returned by timer.get_timeout() is used as timer's expiry. The result
+     * of timer.get_timeout() must not change while the timer is in the active set.
+     *
+     * Preconditions:
+     *  - this timer must not be currently in the active set or in the expired set.
+     *
+     * Postconditions:
+     *  - this timer will be added to the active set until it is expired
+     *    by a call to expire() or removed by a call to remove().
+     *
+     * Returns true if and only if this timer's timeout is less than get_next_timeout().
+     * When this function returns true the caller should reschedule expire() to be
+     * called at timer.get_timeout() to ensure timers are expired in a timely manner.
+     */
+    bool insert(Timer& timer)
+    {
+        place(timer);
+        auto timestamp = get_timestamp(timer);
+        if (timestamp < _next) {
+            _next = timestamp;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Removes timer from the active set.
+     *
+     * Preconditions:
+     *  - timer must be currently in the active set. Note: it must not be in
+     *    the expired set.
+     *
+     * Postconditions:
+     *  - timer is no longer in the active set.
+     *  - this object will no longer hold any references to this timer.
+     */
+    void remove(Timer& timer)
+    {
+        int level, slot;
+        auto& list = get_list(get_timestamp(timer), level, slot);
+        list.erase(list.iterator_to(timer));
+        if (level >= 0 && list.empty()) {
+            _levels[level].non_empty[slot] = false;
+        }
+    }
+
+    /**
+     * Expires active timers.
+     *
+     * The time points passed to this function must be monotonically increasing.
+     * Use get_next_timeout() to query for the next time point.
+     *
+     * Preconditions:
+     *  - the time_point passed to this function must not be lesser than
+     *    the previous one passed to this function.
+     *
+     * Postconditons:
+     *  - all timers from the active set with Timer::get_timeout() <= now are moved
+     *    to the expired set.
+     */
+    timer_list_t expire(time_point now)
+    {
+        timer_list_t exp;
+        auto timestamp = get_timestamp(now);
+
+        if (timestamp < _last) {
+            abort();
+        }
+
+        auto t = get_tick(timestamp);
+        if (t != _current) {
+            // Everything below the highest level that changed, and the slots
+            // of that level between the old and the new current tick, is due.
+            auto top = get_level(t);
+            for (int l = 0; l < top; ++l) {
+                for (int s : bitsets::for_each_set(_levels[l].non_empty)) {
+                    expire_slot(exp, l, s);
+                }
+            }
+            auto target = get_slot(t, top);
+            for (int s : bitsets::for_each_set(_levels[top].non_empty)) {
+                if (s >= target) {
+                    break;
+                }
+                expire_slot(exp, top, s);
+            }
+            // Timers in the slot the new tick falls into move to lower levels.
+            timer_list_t cascade;
+            cascade.splice(cascade.end(), _levels[top].slots[target]);
+            _levels[top].non_empty[target] = false;
+            // Timers due in the old current tick are all earlier than now.
+            exp.splice(exp.end(), _due);
+            _current = t;
+            while (!cascade.empty()) {
+                auto& timer = *cascade.begin();
+                cascade.pop_front();
+                place(timer);
+            }
+        }
+
+        _last = timestamp;
+
+        for (auto i = _due.begin(); i != _due.end();) {
+            auto& timer = *i++;
+            if (timer.get_timeout() <= now) {
+                _due.erase(_due.iterator_to(timer));
+                exp.push_back(timer);
+            }
+        }
+
+        _next = max_timestamp;
+        if (!_due.empty()) {
+            _next = earliest(_due);
+        } else {
+            for (auto&& level : _levels) {
+                if (level.non_empty.any()) {
+                    _next = earliest(level.slots[bitsets::get_first_set(level.non_empty)]);
+                    break;
+                }
+            }
+        }
+        return exp;
+    }
+
+    /**
+     * Returns a time point at which expire() should be called
+     * in order to ensure timers are expired in a timely manner.
+     *
+     * Returned values are monotonically increasing.
+     */
+    time_point get_next_timeout() const
+    {
+        return time_point(duration(std::max(_last, _next)));
+    }
+
+    /**
+     * Clears both active and expired timer sets.
+     */
+    void clear()
+    {
+        _due.clear();
+        for (auto&& level : _levels) {
+            for (int s : bitsets::for_each_set(level.non_empty)) {
+                level.slots[s].clear();
+            }
+            level.non_empty.reset();
+        }
+    }
+
+    size_t size() const
+    {
+        size_t res = _due.size();
+        for (auto&& level : _levels) {
+            for (int s : bitsets::for_each_set(level.non_empty)) {
+                res += level.slots[s].size();
+            }
+        }
+        return res;
+    }
+
+    /**
+     * Returns true if and only if there are no timers in the active set.
+     */
+    bool empty() const
+    {
+        return _due.empty() && std::all_of(_levels.begin(), _levels.end(), [] (const level& l) {
+            return l.non_empty.none();
+        });
+    }
+
+    time_point now() {
+        return Timer::clock::now();
+    }
+};
+
+}
@@ -26,12 +26,17 @@
 #include <atomic>
 #include <functional>
 #include "future.hh"
+#include "util/noncopyable_function.hh"
 #include "timer-set.hh"
+#include "timer-wheel.hh"
 
 namespace seastar {
 
 using steady_clock_type = std::chrono::steady_clock;
 
+template <typename Clock>
+struct timer_container_selector;
+
 template <typename Clock = steady_clock_type>
 class timer {
 public:
@@ -39,7 +44,9 @@ class timer {
     typedef typename Clock::duration duration;
     typedef Clock clock;
 private:
-    using callback_t = std::function<void()>;
+    // Timer callbacks commonly capture a few pointers and a shared_ptr or
+    // two, which would not fit the default inline storage
+    using callback_t = noncopyable_function<void(), 64>;
     boost::intrusive::list_member_hook<> _link;
     callback_t _callback;
     time_point _expiry;
@@ -70,6 +77,10 @@ class timer {
     time_point get_timeout();
     friend class reactor;
     friend class timer_set<timer, &timer::_link>;
+    template <typename Timer, boost::intrusive::list_member_hook<> Timer::*link, typename Timer::duration::rep Granularity>
+    friend class timer_wheel;
+    template <typename C>
+    friend struct timer_container_selector;
 };
 
 }
@@ -0,0 +1,217 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <cmath>
+#include <random>
+#include <boost/range/irange.hpp>
+#include "tracing.hh"
+#include "reactor.hh"
+#include "circular_buffer.hh"
+#include "future-util.hh"
+
+namespace seastar {
+
+namespace tracing {
+
+namespace internal {
+
+thread_local trace_context current_context;
+
+}
+
+namespace {
+
+struct shard_state {
+    circular_buffer<span_record> spans;
+    size_t capacity = 4096;
+    // one in sample_interval root spans is sampled; 0 for none
+    uint64_t sample_interval = 0;
+    uint64_t until_sample = 0;
+    uint64_t dropped = 0;
+    std::mt19937_64 rng{std::random_device()()};
+
+    uint64_t new_id() {
+        uint64_t id;
+        do {
+            id = rng();
+        } while (!id);
+        return id;
+    }
+    bool sample() {
+        if (!sample_interval) {
+            return false;
+        }
+        if (until_sample) {
+            --until_sample;
+            return false;
+        }
+        until_sample = sample_interval - 1;
+        return true;
+    }
+};
+
+thread_local shard_state state;
+
+}
+
+span::span(const char* name, trace_context parent)
+        : _name(name) {
+    if (parent) {
+        _ctx.trace_id = parent.trace_id;
+        _parent_id = parent.span_id;
+    } else if (state.sample()) {
+        _ctx.trace_id = state.new_id();
+    } else {
+        return;
+    }
+    _ctx.span_id = state.new_id();
+    _start = std::chrono::steady_clock::now();
+}
+
+span::span(span&& x) noexcept
+        : _ctx(x._ctx)
+        , _parent_id(x._parent_id)
+        , _name(x._name)
+        , _detail(std::move(x._detail))
+        , _start(x._start) {
+    x._ctx = trace_context();
+}
+
+span& span::operator=(span&& x) noexcept {
+    if (this != &x) {
+        end();
+        _ctx = x._ctx;
+        _parent_id = x._parent_id;
+        _name = x._name;
+        _detail = std::move(x._detail);
+        _start = x._start;
+        x._ctx = trace_context();
+    }
+    return *this;
+}
+
+void span::end() noexcept {
+    if (!_ctx) {
+        return;
+    }
+    auto& s = state;
+    try {
+        if (s.spans.size() >= s.capacity) {
+            if (s.spans.empty()) {
+                ++s.dropped;
+                _ctx = trace_context();
+                return;
+            }
+            s.spans.pop_front();
+            ++s.dropped;
+        }
+        s.spans.push_back(span_record{_ctx.trace_id, _ctx.span_id, _parent_id, _name, std::move(_detail),
+                _start, std::chrono::steady_clock::now() - _start, engine().cpu_id()});
+    } catch (...) {
+        ++s.dropped;
+    }
+    _ctx = trace_context();
+}
+
+void set_sampling_rate(double rate) {
+    if (rate <= 0) {
+        state.sample_interval = 0;
+    } else {
+        state.sample_interval = std::max<uint64_t>(std::llround(1 / std::min(rate, 1.0)), 1);
+    }
+    state.until_sample = 0;
+}
+
+void set_buffer_capacity(size_t spans) {
+    auto& s = state;
+    s.capacity = spans;
+    while (s.spans.size() > s.capacity) {
+        s.spans.pop_front();
+        ++s.dropped;
+    }
+}
+
+uint64_t dropped_spans() noexcept {
+    return state.dropped;
+}
+
+std::vector<span_record> drain(size_t max) {
+    auto& s = state;
+    std::vector<span_record> ret;
+    auto n = std::min(max, s.spans.size());
+    ret.reserve(n);
+    while (n--) {
+        ret.push_back(std::move(s.spans.front()));
+        s.spans.pop_front();
+    }
+    return ret;
+}
+
+future<std::vector<span_record>> drain_all(size_t max_per_shard) {
+    return map_reduce(boost::irange(0u, smp::count), [max_per_shard] (unsigned shard) {
+        return smp::submit_to(shard, [max_per_shard] {
+            return drain(max_per_shard);
+        });
+    }, std::vector<span_record>(), [] (std::vector<span_record> all, std::vector<span_record> spans) {
+        std::move(spans.begin(), spans.end(), std::back_inserter(all));
+        return all;
+    });
+}
+
+static bool parse_hex(const char* p, size_t n, uint64_t& v) noexcept {
+    v = 0;
+    for (size_t i = 0; i < n; ++i) {
+        auto c = p[i];
+        unsigned d;
+        if (c >= '0' && c <= '9') {
+            d = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            d = c - 'a' + 10;
+        } else {
+            return false;
+        }
+        v = v << 4 | d;
+    }
+    return true;
+}
+
+trace_context parse_traceparent(const sstring& value) noexcept {
+    // version "-" trace-id "-" parent-id "-" flags, as in 00-<32>-<16>-<2>
+    trace_context ctx;
+    uint64_t version, trace_high, trace_low, parent, flags;
+    if (value.size() < 55 || value[2] != '-' || value[35] != '-' || value[52] != '-'
+            || !parse_hex(value.begin(), 2, version) || version == 0xff
+            || !parse_hex(value.begin() + 3, 16, trace_high)
+            || !parse_hex(value.begin() + 19, 16, trace_low)
+            || !parse_hex(value.begin() + 36, 16, parent)
+            || !parse_hex(value.begin() + 53, 2, flags)
+            || !(flags & 1) || !parent || (!trace_high && !trace_low)) {
+        return ctx;
+    }
+    ctx.trace_id = trace_low ? trace_low : trace_high;
+    ctx.span_id = parent;
+    return ctx;
+}
+
+}
+
+}
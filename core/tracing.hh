@@ -0,0 +1,171 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "sstring.hh"
+#include "future.hh"
+
+namespace seastar {
+
+/// \brief Lightweight request tracing.
+///
+/// A trace follows a request through the code that serves it, possibly on
+/// several shards and nodes, as a tree of \ref span "spans": timed, named
+/// sections of work. Traces are sampled: a shard starts a new trace for
+/// one in so many root spans (see \ref set_sampling_rate(); none by
+/// default), and spans started while a sampled trace is current join it.
+/// Spans of requests that are not sampled cost a thread-local read.
+///
+/// The current trace context is per shard, and is set with \ref
+/// context_scope for the synchronous part of the code that runs in it;
+/// code that continues in a continuation must capture \ref current() and
+/// set it again. The context is carried along by \ref smp::submit_to(),
+/// by rpc calls to servers that negotiated tracing, and httpd handlers
+/// run in the span of their request, which continues the trace of a
+/// W3C \c traceparent header.
+///
+/// Finished spans are kept in a per-shard ring buffer, from which an
+/// exporter pulls them in batches with \ref drain() or \ref drain_all();
+/// when it is full, the oldest spans are dropped.
+namespace tracing {
+
+/// Identifies the current span of a trace; a zero trace id means that
+/// the code is not traced.
+struct trace_context {
+    uint64_t trace_id = 0;
+    uint64_t span_id = 0;
+    explicit operator bool() const noexcept {
+        return trace_id != 0;
+    }
+};
+
+/// A finished span
+struct span_record {
+    uint64_t trace_id;
+    uint64_t span_id;
+    /// 0 for the root span of a trace
+    uint64_t parent_id;
+    /// a string literal naming the kind of work, such as "http"
+    const char* name;
+    /// what the span worked on, such as an url or an rpc verb
+    sstring detail;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::duration duration;
+    unsigned shard;
+};
+
+/// \cond internal
+namespace internal {
+extern thread_local trace_context current_context;
+}
+/// \endcond
+
+/// Returns the calling shard's current trace context
+inline trace_context current() noexcept {
+    return internal::current_context;
+}
+
+/// Makes a trace context current on the shard for the lifetime of the
+/// object, and restores the previous one when destroyed.
+class context_scope {
+    trace_context _saved;
+public:
+    explicit context_scope(trace_context ctx) noexcept : _saved(internal::current_context) {
+        internal::current_context = ctx;
+    }
+    context_scope(const context_scope&) = delete;
+    context_scope& operator=(const context_scope&) = delete;
+    ~context_scope() {
+        internal::current_context = _saved;
+    }
+};
+
+/// A timed section of the work of a trace, recorded when ended.
+///
+/// A span that is not sampled is inactive: it converts to \c false, and
+/// ending it does nothing.
+class span {
+    trace_context _ctx;
+    uint64_t _parent_id = 0;
+    const char* _name = nullptr;
+    sstring _detail;
+    std::chrono::steady_clock::time_point _start;
+public:
+    /// An inactive span
+    span() = default;
+    /// Starts a span, as a child of \c parent if it is traced, or else as
+    /// the root of a new trace if the shard samples it.
+    /// \param name a string literal
+    explicit span(const char* name, trace_context parent = current());
+    span(span&& x) noexcept;
+    span& operator=(span&& x) noexcept;
+    ~span() {
+        end();
+    }
+    /// Describes what the span works on; only worth formatting for
+    /// active spans
+    void set_detail(sstring detail) {
+        _detail = std::move(detail);
+    }
+    /// Records the span if it is active, and deactivates it
+    void end() noexcept;
+    explicit operator bool() const noexcept {
+        return bool(_ctx);
+    }
+    /// The context of children of the span
+    trace_context context() const noexcept {
+        return _ctx;
+    }
+};
+
+/// Starts a new trace for one in about 1/rate root spans started on the
+/// calling shard; 0 (the default) disables sampling, 1 traces all.
+void set_sampling_rate(double rate);
+
+/// Sets how many finished spans the calling shard keeps until they are
+/// drained (4096 by default).
+void set_buffer_capacity(size_t spans);
+
+/// Finished spans the calling shard dropped because its buffer was full
+uint64_t dropped_spans() noexcept;
+
+/// Removes and returns up to \c max of the calling shard's finished
+/// spans, oldest first.
+std::vector<span_record> drain(size_t max = std::numeric_limits<size_t>::max());
+
+/// Removes and returns up to \c max_per_shard finished spans from every
+/// shard.
+future<std::vector<span_record>> drain_all(size_t max_per_shard = std::numeric_limits<size_t>::max());
+
+/// Parses a W3C \c traceparent header value into the context it
+/// continues (the low 64 bits of its trace id), or returns an untraced
+/// context if it is malformed or not sampled.
+trace_context parse_traceparent(const sstring& value) noexcept;
+
+}
+
+}
@@ -0,0 +1,133 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include <algorithm>
+#include <limits>
+#include "tsc_clock.hh"
+
+#ifdef __x86_64__
+#include <cpuid.h>
+#endif
+
+namespace seastar {
+
+thread_local tsc_clock_impl::state tsc_clock_impl::_state;
+
+#ifdef __x86_64__
+
+static constexpr int64_t calibration_period_ns = 2000000;
+static constexpr int64_t recalibration_interval_ns = 100000000;
+
+// Whether the counter runs at a constant rate regardless of frequency
+// scaling and sleep states; virtual machines often hide it
+static bool has_invariant_tsc() {
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return edx & (1u << 8);
+}
+
+// Reads the counter and steady_clock together, taking the counter
+// halfway through the steady_clock read; the quickest of a few reads is
+// kept, as the first one, or an interrupted one, can take long enough to
+// throw the calibration off
+void tsc_clock_impl::sample(uint64_t& tsc, int64_t& ns) {
+    auto best = std::numeric_limits<uint64_t>::max();
+    tsc = 0;
+    ns = 0;
+    for (unsigned i = 0; i < 4; ++i) {
+        auto before = __rdtsc();
+        auto now = steady_ns();
+        auto after = __rdtsc();
+        if (after - before < best) {
+            best = after - before;
+            tsc = before + (after - before) / 2;
+            ns = now;
+        }
+    }
+}
+
+static uint64_t ticks_for(int64_t ns, uint64_t mult) {
+    return uint64_t(((unsigned __int128)ns << 32) / mult);
+}
+
+void tsc_clock_impl::calibrate() {
+    static const bool reliable = has_invariant_tsc();
+    auto& s = _state;
+    if (!reliable || s.calibrated) {
+        return;
+    }
+    uint64_t tsc0, tsc1;
+    int64_t ns0, ns1;
+    sample(tsc0, ns0);
+    while (steady_ns() - ns0 < calibration_period_ns) {
+    }
+    sample(tsc1, ns1);
+    auto ticks = tsc1 - tsc0;
+    auto ns = ns1 - ns0;
+    // between 100MHz and 10GHz, or the counter is not sane
+    if (tsc1 <= tsc0 || ticks < uint64_t(ns) / 10 || ticks > uint64_t(ns) * 10) {
+        return;
+    }
+    s.mult = uint64_t(((unsigned __int128)ns << 32) / ticks);
+    s.first_tsc = tsc0;
+    s.first_ns = ns0;
+    s.base_tsc = tsc1;
+    s.base_ns = ns1;
+    s.next_tsc = tsc1 + ticks_for(recalibration_interval_ns, s.mult);
+    s.calibrated = true;
+}
+
+int64_t tsc_clock_impl::recalibrate() {
+    auto& s = _state;
+    uint64_t tsc;
+    int64_t ns;
+    sample(tsc, ns);
+    // measuring the rate over all the time since calibration keeps its
+    // error small; a clock that got ahead of steady_clock is not set
+    // back, but slowed down until the next re-anchoring to catch up
+    auto current = convert(s, tsc);
+    if (tsc > s.first_tsc && ns > s.first_ns) {
+        s.mult = uint64_t(((unsigned __int128)(ns - s.first_ns) << 32) / (tsc - s.first_tsc));
+    }
+    s.next_tsc = tsc + ticks_for(recalibration_interval_ns, s.mult);
+    s.base_tsc = tsc;
+    s.base_ns = std::max(current, ns);
+    if (current > ns) {
+        auto ahead = std::min(current - ns, recalibration_interval_ns / 2);
+        s.mult -= uint64_t((unsigned __int128)s.mult * ahead / recalibration_interval_ns);
+    }
+    return convert(s, __rdtsc());
+}
+
+#else
+
+void tsc_clock_impl::calibrate() {
+}
+
+int64_t tsc_clock_impl::recalibrate() {
+    return steady_ns();
+}
+
+#endif
+
+}
@@ -0,0 +1,126 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+
+namespace seastar {
+
+/// \cond internal
+
+class tsc_clock;
+
+class tsc_clock_impl final {
+    // Per thread conversion of time stamp counter readings to
+    // steady_clock nanoseconds: base_ns + (tsc - base_tsc) * mult >> 32
+    struct state {
+        bool calibrated = false;
+        uint64_t base_tsc = 0;
+        int64_t base_ns = 0;
+        uint64_t mult = 0;
+        // once the counter reaches next_tsc, the conversion is re-anchored
+        // to steady_clock, with mult measured since first_tsc
+        uint64_t next_tsc = 0;
+        uint64_t first_tsc = 0;
+        int64_t first_ns = 0;
+    };
+    static thread_local state _state;
+
+    static int64_t steady_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    static int64_t convert(const state& s, uint64_t tsc) {
+        // a counter behind the base (another core's) reads as the base
+        auto delta = tsc > s.base_tsc ? tsc - s.base_tsc : 0;
+        return s.base_ns + int64_t((unsigned __int128)delta * s.mult >> 32);
+    }
+    static void sample(uint64_t& tsc, int64_t& ns);
+    static int64_t recalibrate();
+public:
+    static int64_t now_ns() {
+#ifdef __x86_64__
+        auto& s = _state;
+        if (s.calibrated) {
+            auto tsc = __rdtsc();
+            if (__builtin_expect(tsc >= s.next_tsc, false)) {
+                return recalibrate();
+            }
+            return convert(s, tsc);
+        }
+#endif
+        return steady_ns();
+    }
+    static void calibrate();
+    static bool calibrated() {
+        return _state.calibrated;
+    }
+};
+
+/// \endcond
+
+/// \brief High-resolution steady clock, cheap to read.
+///
+/// This clock reads the CPU's time stamp counter rather than calling into
+/// the kernel, and converts it to the time of \c std::chrono::steady_clock,
+/// so that its time points can be compared across threads. It is meant for
+/// fine grained accounting, where the cost of \c steady_clock::now() shows.
+///
+/// The conversion is calibrated per thread: Seastar calibrates the reactor
+/// threads at startup, and other threads may call \ref calibrate(). Threads
+/// that are not calibrated, and machines without an invariant time stamp
+/// counter, read \c steady_clock instead.
+class tsc_clock final {
+public:
+    using rep = int64_t;
+    using period = std::nano;
+    using duration = std::chrono::duration<rep, period>;
+    using time_point = std::chrono::time_point<tsc_clock, duration>;
+
+    static constexpr bool is_steady = true;
+
+    static time_point now() {
+        return time_point(duration(tsc_clock_impl::now_ns()));
+    }
+    /// The \c steady_clock time point of \c t, for arming timers
+    static std::chrono::steady_clock::time_point to_steady(time_point t) {
+        return std::chrono::steady_clock::time_point(
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(t.time_since_epoch()));
+    }
+    /// Calibrates the clock for the calling thread, busy waiting for a
+    /// couple of milliseconds. Does nothing if the time stamp counter is
+    /// not reliable.
+    static void calibrate() {
+        tsc_clock_impl::calibrate();
+    }
+    /// Whether the calling thread reads the time stamp counter.
+    static bool uses_tsc() {
+        return tsc_clock_impl::calibrated();
+    }
+};
+
+}
@@ -23,6 +23,8 @@
 #include "handlers.hh"
 #include "json/formatter.hh"
 #include "transformers.hh"
+#include "core/print.hh"
+#include <time.h>
 
 using namespace std;
 
@@ -33,6 +35,33 @@ namespace httpd {
 const sstring api_registry_builder::DEFAULT_PATH = "/api-doc";
 const sstring api_registry_builder::DEFAULT_DIR = ".";
 
+lw_shared_ptr<const cached_file> api_registry::build_index() const {
+    auto index = make_lw_shared<cached_file>();
+    index->content = json::formatter::to_json(_docs);
+    index->etag = sprint("\"%x-%x\"", uint64_t(index->content.size()),
+            uint64_t(std::hash<sstring>()(index->content)));
+    auto now = ::time(nullptr);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    char date[64];
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    index->last_modified = date;
+    auto gz = compress(index->content, content_encoding::gzip, 6);
+    if (gz.size() < index->content.size()) {
+        index->gzip_content = std::move(gz);
+    }
+    return index;
+}
+
+future<std::unique_ptr<reply>> api_registry::handle(const sstring& path,
+        std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+    if (!_index) {
+        _index = build_index();
+    }
+    file_interaction_handler::reply_cached(*_index, "json", *req, *rep);
+    return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+}
+
 }
 
 }
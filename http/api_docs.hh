@@ -98,6 +98,11 @@ class api_registry : public handler_base {
     sstring _file_directory;
     api_docs _docs;
     routes& _routes;
+    // the reply to the index, built on the first request after a
+    // registration
+    lw_shared_ptr<const cached_file> _index;
+private:
+    lw_shared_ptr<const cached_file> build_index() const;
 
 public:
     api_registry(routes& routes, const sstring& file_directory,
@@ -106,12 +111,13 @@ class api_registry : public handler_base {
                     routes) {
         _routes.put(GET, _base_path, this);
     }
+    /**
+     * Replies with the index of the registered APIs, which is kept along
+     * with its ETag and a gzip copy until the next registration, so
+     * that polling it neither reformats it nor compresses it again.
+     */
     future<std::unique_ptr<reply>> handle(const sstring& path,
-            std::unique_ptr<request> req, std::unique_ptr<reply> rep) override {
-        rep->_content = json::formatter::to_json(_docs);
-        rep->done("json");
-        return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
-    }
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep) override;
 
     void reg(const sstring& api, const sstring& description,
             const sstring& alternative_path = "") {
@@ -119,6 +125,7 @@ class api_registry : public handler_base {
         doc.description = description;
         doc.path = "/" + api;
         _docs.apis.push(doc);
+        _index = nullptr;
         sstring path =
                 (alternative_path == "") ?
                         _file_directory + api + ".json" : alternative_path;
@@ -0,0 +1,585 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <strings.h>
+#include "http/client.hh"
+#include "http/http_response_parser.hh"
+#include "http/reply.hh"
+#include "core/future-util.hh"
+#include "core/print.hh"
+#include "core/reactor.hh"
+#include "net/dns.hh"
+
+namespace seastar {
+
+namespace http {
+
+// Lines of chunk sizes and trailers longer than that are refused
+static constexpr size_t max_line_size = 8192;
+
+// A connection was closed before any of the response was read
+class connection_closed_error : public std::runtime_error {
+public:
+    connection_closed_error() : std::runtime_error("http connection closed before the response") {}
+};
+
+struct parsed_url {
+    bool tls;
+    sstring host;
+    uint16_t port;
+    // host and port, as sent in the Host header
+    sstring authority;
+    sstring target;
+};
+
+static parsed_url parse_url(const sstring& url) {
+    parsed_url u;
+    size_t pos;
+    if (url.find("http://") == 0) {
+        u.tls = false;
+        u.port = 80;
+        pos = 7;
+    } else if (url.find("https://") == 0) {
+        u.tls = true;
+        u.port = 443;
+        pos = 8;
+    } else {
+        throw std::invalid_argument(sprint("unsupported url %s", url));
+    }
+    auto path = std::min(url.find('/', pos), url.find('?', pos));
+    if (path == sstring::npos) {
+        path = url.size();
+    }
+    u.authority = url.substr(pos, path - pos);
+    auto colon = u.authority.find(':');
+    if (colon != sstring::npos) {
+        u.host = u.authority.substr(0, colon);
+        auto port = u.authority.substr(colon + 1);
+        char* end;
+        auto p = std::strtoul(port.c_str(), &end, 10);
+        if (port.empty() || *end || p > 65535) {
+            throw std::invalid_argument(sprint("bad port in url %s", url));
+        }
+        u.port = p;
+    } else {
+        u.host = u.authority;
+    }
+    if (u.host.empty()) {
+        throw std::invalid_argument(sprint("no host in url %s", url));
+    }
+    u.target = path == url.size() ? sstring("/") : url.substr(path);
+    if (u.target[0] == '?') {
+        u.target = "/" + u.target;
+    }
+    return u;
+}
+
+static sstring trim(const sstring& s) {
+    size_t b = 0;
+    size_t e = s.size();
+    while (b < e && (s[b] == ' ' || s[b] == '\t')) {
+        ++b;
+    }
+    while (e > b && (s[e - 1] == ' ' || s[e - 1] == '\t')) {
+        --e;
+    }
+    return s.substr(b, e - b);
+}
+
+// Reads a line ending with "\r\n", which is not returned
+static future<sstring> read_line(input_stream<char>& in) {
+    return do_with(sstring(), [&in] (sstring& line) {
+        return in.consume([&line] (temporary_buffer<char> buf) {
+            using unconsumed_remainder = input_stream<char>::unconsumed_remainder;
+            if (buf.empty()) {
+                throw std::runtime_error("http response ended early");
+            }
+            auto nl = buf.find('\n');
+            size_t n = nl - buf.begin();
+            if (line.size() + n > max_line_size) {
+                throw std::runtime_error("http response line too long");
+            }
+            line.append(buf.get(), n);
+            if (nl == buf.end()) {
+                return make_ready_future<unconsumed_remainder>();
+            }
+            buf.trim_front(n + 1);
+            return make_ready_future<unconsumed_remainder>(std::move(buf));
+        }).then([&line] {
+            if (!line.empty() && line[line.size() - 1] == '\r') {
+                line.resize(line.size() - 1);
+            }
+            return std::move(line);
+        });
+    });
+}
+
+static future<> skip(input_stream<char>& in) {
+    return repeat([&in] {
+        return in.read().then([] (temporary_buffer<char> buf) {
+            return buf.empty() ? stop_iteration::yes : stop_iteration::no;
+        });
+    });
+}
+
+// A response body of a known length
+class length_source_impl : public data_source_impl {
+    input_stream<char>& _in;
+    uint64_t _remaining;
+public:
+    length_source_impl(input_stream<char>& in, uint64_t length) : _in(in), _remaining(length) {}
+    virtual future<temporary_buffer<char>> get() override {
+        if (!_remaining) {
+            return make_ready_future<temporary_buffer<char>>();
+        }
+        return _in.read_up_to(_remaining).then([this] (temporary_buffer<char> buf) {
+            if (buf.empty()) {
+                throw std::runtime_error("http response body ended early");
+            }
+            _remaining -= buf.size();
+            return buf;
+        });
+    }
+};
+
+// A response body sent with the chunked transfer encoding
+class chunked_source_impl : public data_source_impl {
+    input_stream<char>& _in;
+    uint64_t _remaining = 0;
+    bool _done = false;
+    bool _in_chunk = false;
+private:
+    future<> skip_trailer() {
+        return repeat([this] {
+            return read_line(_in).then([] (sstring line) {
+                return line.empty() ? stop_iteration::yes : stop_iteration::no;
+            });
+        });
+    }
+public:
+    explicit chunked_source_impl(input_stream<char>& in) : _in(in) {}
+    virtual future<temporary_buffer<char>> get() override {
+        if (_done) {
+            return make_ready_future<temporary_buffer<char>>();
+        }
+        if (_remaining) {
+            return _in.read_up_to(_remaining).then([this] (temporary_buffer<char> buf) {
+                if (buf.empty()) {
+                    throw std::runtime_error("http response body ended early");
+                }
+                _remaining -= buf.size();
+                return buf;
+            });
+        }
+        return read_line(_in).then([this] (sstring line) {
+            if (_in_chunk) {
+                // the line ending the previous chunk's data
+                if (!line.empty()) {
+                    throw std::runtime_error("malformed http chunk");
+                }
+                _in_chunk = false;
+                return get();
+            }
+            char* end;
+            auto size = std::strtoull(line.c_str(), &end, 16);
+            if (end == line.c_str() || (*end && *end != ';' && *end != ' ')) {
+                throw std::runtime_error(sprint("malformed http chunk size %s", line));
+            }
+            if (!size) {
+                return skip_trailer().then([this] {
+                    _done = true;
+                    return temporary_buffer<char>();
+                });
+            }
+            _remaining = size;
+            _in_chunk = true;
+            return get();
+        });
+    }
+};
+
+// A response body that ends with the connection
+class eof_source_impl : public data_source_impl {
+    input_stream<char>& _in;
+public:
+    explicit eof_source_impl(input_stream<char>& in) : _in(in) {}
+    virtual future<temporary_buffer<char>> get() override {
+        return _in.read();
+    }
+};
+
+sstring response::get_header(const sstring& name) const {
+    for (auto&& h : headers) {
+        if (h.first.size() == name.size() && !strncasecmp(h.first.c_str(), name.c_str(), name.size())) {
+            return h.second;
+        }
+    }
+    return "";
+}
+
+class client::connection {
+    connected_socket _fd;
+    input_stream<char> _in;
+    output_stream<char> _out;
+    http_response_parser _parser;
+    // Resolve once the previous request is written, and its response read
+    future<> _write_tail = make_ready_future<>();
+    future<> _read_tail = make_ready_future<>();
+    uint64_t _responses = 0;
+    bool _connected = false;
+    bool _reusable = true;
+    bool _aborted = false;
+private:
+    void shutdown() {
+        _fd.shutdown_input();
+        _fd.shutdown_output();
+    }
+    future<> write_request(request& req, const parsed_url& url) {
+        sstring head = req.method + " " + url.target + " HTTP/1.1\r\nHost: " + url.authority + "\r\n";
+        for (auto&& h : req.headers) {
+            head += h.first + ": " + h.second + "\r\n";
+        }
+        if (req.body_writer) {
+            head += "Transfer-Encoding: chunked\r\n\r\n";
+            return _out.write(head).then([this, &req] {
+                return do_with(httpd::make_http_chunked_output_stream(_out), [&req] (output_stream<char>& body) {
+                    return req.body_writer(body).then([&body] {
+                        return body.close();
+                    });
+                });
+            }).then([this] {
+                return _out.write("0\r\n\r\n");
+            }).then([this] {
+                return _out.flush();
+            });
+        }
+        if (!req.body.empty() || (req.method != "GET" && req.method != "HEAD")) {
+            head += "Content-Length: " + to_sstring(req.body.size()) + "\r\n";
+        }
+        head += "\r\n";
+        return _out.write(head).then([this, &req] {
+            return _out.write(req.body);
+        }).then([this] {
+            return _out.flush();
+        });
+    }
+    data_source body_source(const response& rsp, bool head) {
+        if (head || rsp.status / 100 == 1 || rsp.status == 204 || rsp.status == 304) {
+            return data_source(std::make_unique<length_source_impl>(_in, 0));
+        }
+        if (rsp.get_header("Transfer-Encoding").find("chunked") != sstring::npos) {
+            return data_source(std::make_unique<chunked_source_impl>(_in));
+        }
+        auto length = rsp.get_header("Content-Length");
+        if (!length.empty()) {
+            char* end;
+            auto n = std::strtoull(length.c_str(), &end, 10);
+            if (*end) {
+                throw std::runtime_error(sprint("bad http Content-Length %s", length));
+            }
+            return data_source(std::make_unique<length_source_impl>(_in, n));
+        }
+        _reusable = false;
+        return data_source(std::make_unique<eof_source_impl>(_in));
+    }
+    future<> read_response(bool head, const body_handler& handle) {
+        _parser.init();
+        return _in.consume(_parser).then([this, head, &handle] {
+            if (_parser.eof()) {
+                throw connection_closed_error();
+            }
+            if (_parser._state != http_response_parser::state::done) {
+                throw std::runtime_error("malformed http response");
+            }
+            auto parsed = _parser.get_parsed_response();
+            auto rsp = make_lw_shared<response>();
+            rsp->status = parsed->_status;
+            rsp->version = std::move(parsed->_version);
+            for (auto&& h : parsed->_headers) {
+                rsp->headers.emplace(h.first, trim(h.second));
+            }
+            auto keep_alive = rsp->get_header("Connection");
+            if (rsp->version == "1.0" ? strcasecmp(keep_alive.c_str(), "keep-alive") : !strcasecmp(keep_alive.c_str(), "close")) {
+                _reusable = false;
+            }
+            auto body = make_lw_shared<input_stream<char>>(body_source(*rsp, head));
+            return handle(*rsp, *body).then([body] {
+                return skip(*body);
+            }).then([this, rsp, body] {
+                ++_responses;
+            });
+        });
+    }
+public:
+    // Requests sent, or waiting to be sent, on the connection
+    unsigned in_flight = 0;
+
+    // Requests may be sent before the connection is established; they are
+    // written once it is
+    explicit connection(future<connected_socket> connected) {
+        _write_tail = connected.then([this] (connected_socket fd) {
+            _fd = std::move(fd);
+            _in = _fd.input();
+            _out = _fd.output();
+            _connected = true;
+            if (_aborted) {
+                shutdown();
+            }
+        });
+    }
+    uint64_t responses() const {
+        return _responses;
+    }
+    // Whether more requests may be sent on the connection
+    bool reusable() const {
+        return _reusable;
+    }
+    // Fails the requests in flight on the connection
+    void abort() {
+        _reusable = false;
+        if (!_aborted) {
+            _aborted = true;
+            if (_connected) {
+                shutdown();
+            }
+        }
+    }
+    // Writes the request once the previous ones are written, and reads
+    // its response once theirs are read
+    future<> send(request& req, const parsed_url& url, const body_handler& handle) {
+        promise<> written;
+        promise<> read;
+        auto prev_write = std::exchange(_write_tail, written.get_future());
+        auto prev_read = std::exchange(_read_tail, read.get_future());
+        auto head = req.method == "HEAD";
+        return prev_write.then([this, &req, &url] {
+            if (_aborted) {
+                throw std::runtime_error("http connection aborted");
+            }
+            return write_request(req, url);
+        }).then_wrapped([written = std::move(written), prev_read = std::move(prev_read)] (future<> f) mutable {
+            written.set_value();
+            if (f.failed()) {
+                return f;
+            }
+            return std::move(prev_read);
+        }).then([this, head, &handle] {
+            return read_response(head, handle);
+        }).then_wrapped([this, read = std::move(read)] (future<> f) mutable {
+            read.set_value();
+            if (f.failed()) {
+                abort();
+            }
+            return f;
+        });
+    }
+    future<> close() {
+        if (!_connected) {
+            return make_ready_future<>();
+        }
+        return _out.close().handle_exception([] (std::exception_ptr) {}).then([this] {
+            return _in.close();
+        }).handle_exception([] (std::exception_ptr) {});
+    }
+};
+
+struct client::host_pool {
+    std::vector<lw_shared_ptr<connection>> connections;
+    // Requests that may be in flight to the host
+    semaphore slots;
+    explicit host_pool(size_t n) : slots(n) {}
+};
+
+struct client::request_state {
+    request req;
+    parsed_url url;
+    body_handler handle;
+    timer<>::clock::time_point deadline;
+    timer<> deadline_timer;
+    lw_shared_ptr<connection> conn;
+    bool timed_out = false;
+    request_state(request r, parsed_url u, body_handler h, timer<>::clock::duration timeout)
+            : req(std::move(r))
+            , url(std::move(u))
+            , handle(std::move(h))
+            , deadline(timer<>::clock::now() + timeout)
+            , deadline_timer([this] {
+                timed_out = true;
+                if (conn) {
+                    conn->abort();
+                }
+            }) {
+        deadline_timer.arm(deadline);
+    }
+};
+
+client::client(client_options options)
+        : _options(std::move(options)) {
+}
+
+client::~client() {
+}
+
+future<connected_socket> client::connect(const sstring& host, uint16_t port, bool tls) {
+    if (_options.connect) {
+        return _options.connect(host, port, tls);
+    }
+    return net::dns::resolve_name(host).then([this, host, port, tls] (net::inet_address addr) {
+        socket_address sa(ipv4_addr(addr, port));
+        if (tls) {
+            return tls::connect(_options.credentials, sa, host);
+        }
+        return engine().net().connect(sa);
+    });
+}
+
+lw_shared_ptr<client::connection> client::get_connection(host_pool& pool, request_state& state) {
+    lw_shared_ptr<connection> best;
+    for (auto&& c : pool.connections) {
+        if (c->reusable() && c->in_flight < _options.max_pipelined_requests && (!best || c->in_flight < best->in_flight)) {
+            best = c;
+        }
+    }
+    // pipeline only once no more connections may be opened
+    if (best && (!best->in_flight || pool.connections.size() >= _options.max_connections_per_host)) {
+        return best;
+    }
+    auto& url = state.url;
+    auto c = make_lw_shared<connection>(futurize_apply([this, &url] {
+        return connect(url.host, url.port, url.tls);
+    }));
+    pool.connections.push_back(c);
+    return c;
+}
+
+future<> client::release(host_pool& pool, lw_shared_ptr<connection> c) {
+    --c->in_flight;
+    if (c->reusable() || c->in_flight) {
+        return make_ready_future<>();
+    }
+    auto i = std::find(pool.connections.begin(), pool.connections.end(), c);
+    if (i != pool.connections.end()) {
+        pool.connections.erase(i);
+    }
+    return c->close().finally([c] {});
+}
+
+future<> client::send(host_pool& pool, request_state& state, bool retry) {
+    return get_units(pool.slots, 1, state.deadline).then([this, &pool, &state, retry] (auto slot) {
+        auto c = this->get_connection(pool, state);
+        auto reused = c->responses() > 0;
+        ++c->in_flight;
+        state.conn = c;
+        if (state.timed_out) {
+            c->abort();
+        }
+        return c->send(state.req, state.url, state.handle).then_wrapped([this, &pool, &state, c, reused, retry, slot = std::move(slot)] (future<> f) mutable {
+            state.conn = nullptr;
+            return this->release(pool, c).then([this, &pool, &state, reused, retry, f = std::move(f), slot = std::move(slot)] () mutable {
+                if (!f.failed()) {
+                    return make_ready_future<>();
+                }
+                auto ep = f.get_exception();
+                if (retry && reused && !state.timed_out && !state.req.body_writer) {
+                    try {
+                        std::rethrow_exception(ep);
+                    } catch (connection_closed_error&) {
+                        auto returned = std::move(slot);
+                        return this->send(pool, state, false);
+                    } catch (...) {
+                    }
+                }
+                return make_exception_future<>(std::move(ep));
+            });
+        });
+    });
+}
+
+future<> client::make_request(request req, body_handler handle) {
+    return with_gate(_gate, [this, &req, &handle] {
+        return futurize_apply([this, &req, &handle] {
+            auto url = parse_url(req.url);
+            if (url.tls && !_options.credentials && !_options.connect) {
+                throw std::invalid_argument(sprint("no credentials to request %s", req.url));
+            }
+            sstring key = sprint("%s://%s:%d", url.tls ? "https" : "http", url.host, url.port);
+            auto& pool = _pools[key];
+            if (!pool) {
+                pool = std::make_unique<host_pool>(_options.max_connections_per_host * _options.max_pipelined_requests);
+            }
+            auto timeout = req.timeout ? *req.timeout : _options.timeout;
+            auto state = std::make_unique<request_state>(std::move(req), std::move(url), std::move(handle), timeout);
+            auto& st = *state;
+            return send(*pool, st, true).handle_exception([&st] (std::exception_ptr ep) {
+                try {
+                    std::rethrow_exception(ep);
+                } catch (semaphore_timed_out&) {
+                    return make_exception_future<>(timed_out_error());
+                } catch (...) {
+                    if (st.timed_out) {
+                        return make_exception_future<>(timed_out_error());
+                    }
+                    return make_exception_future<>(std::move(ep));
+                }
+            }).finally([state = std::move(state)] {});
+        });
+    });
+}
+
+future<response> client::make_request(request req) {
+    auto rsp = make_lw_shared<response>();
+    return make_request(std::move(req), [rsp] (const response& r, input_stream<char>& body) {
+        rsp->status = r.status;
+        rsp->version = r.version;
+        rsp->headers = r.headers;
+        return repeat([rsp, &body] {
+            return body.read().then([rsp] (temporary_buffer<char> buf) {
+                if (buf.empty()) {
+                    return stop_iteration::yes;
+                }
+                rsp->body.append(buf.get(), buf.size());
+                return stop_iteration::no;
+            });
+        });
+    }).then([rsp] {
+        return std::move(*rsp);
+    });
+}
+
+future<> client::stop() {
+    return _gate.close().then([this] {
+        return parallel_for_each(_pools, [] (auto& p) {
+            return parallel_for_each(p.second->connections, [] (lw_shared_ptr<connection>& c) {
+                return c->close().finally([c] {});
+            });
+        });
+    }).then([this] {
+        _pools.clear();
+    });
+}
+
+}
+
+}
@@ -0,0 +1,183 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <experimental/optional>
+#include "core/future.hh"
+#include "core/gate.hh"
+#include "core/iostream.hh"
+#include "core/semaphore.hh"
+#include "core/shared_ptr.hh"
+#include "core/sstring.hh"
+#include "core/timer.hh"
+#include "net/api.hh"
+#include "net/tls.hh"
+#include "util/noncopyable_function.hh"
+
+namespace seastar {
+
+namespace http {
+
+/**
+ * A request to send with a client
+ */
+struct request {
+    sstring method = "GET";
+    /**
+     * An absolute url: http://host[:port][/path][?query], or https://...
+     */
+    sstring url;
+    /**
+     * Headers to send; the client adds Host, and the header that frames
+     * the body
+     */
+    std::unordered_map<sstring, sstring> headers;
+    /**
+     * The body, sent with a Content-Length, unless body_writer is set
+     */
+    sstring body;
+    /**
+     * Writes the body, which is sent with the chunked transfer encoding;
+     * the stream must not be closed by it. Requests with a body writer
+     * are not retried.
+     */
+    noncopyable_function<future<> (output_stream<char>& out)> body_writer;
+    /**
+     * Time the request may take, from when it is made until its response
+     * is read; the client's default if not set
+     */
+    std::experimental::optional<std::chrono::milliseconds> timeout;
+};
+
+/**
+ * A response received by a client
+ */
+struct response {
+    int status = 0;
+    sstring version;
+    std::unordered_map<sstring, sstring> headers;
+    /**
+     * The body, for requests made without a body handler
+     */
+    sstring body;
+
+    /**
+     * Looks up a header, ignoring the case of its name
+     * @return the value of the header, or an empty string
+     */
+    sstring get_header(const sstring& name) const;
+};
+
+struct client_options {
+    /**
+     * Connections the client may open to each host (scheme, host and port)
+     */
+    unsigned max_connections_per_host = 8;
+    /**
+     * Requests that may be sent on a connection before the response to
+     * the first of them is read; 1 disables pipelining
+     */
+    unsigned max_pipelined_requests = 1;
+    /**
+     * Time requests may take, unless they set their own
+     */
+    std::chrono::milliseconds timeout = std::chrono::seconds(30);
+    /**
+     * Credentials of https connections, which must be set for https urls
+     * to be requested
+     */
+    shared_ptr<tls::certificate_credentials> credentials;
+    /**
+     * Opens the client's connections. If not set, the host is resolved,
+     * and connected to with the default network stack, over TLS if tls
+     * is set.
+     */
+    std::function<future<connected_socket> (const sstring& host, uint16_t port, bool tls)> connect;
+};
+
+/**
+ * A per-shard HTTP/1.1 client.
+ *
+ * The client keeps a pool of keep-alive connections to each host it sends
+ * requests to, and reuses them for later requests; with pipelining enabled,
+ * several requests may be in flight on one connection, their responses
+ * being read in order. A request that fails on a reused connection, before
+ * any of its response is read, is retried once on a new connection, as the
+ * server may have closed the connection when it was idle.
+ *
+ * Requests that time out fail with timed_out_error, and the connection that
+ * they were sent on is closed, along with the requests pipelined on it.
+ * The client must be stopped with stop() before it is destroyed.
+ */
+class client {
+public:
+    /**
+     * Reads the body of a response; whatever it leaves unread is skipped
+     * once the returned future resolves
+     */
+    using body_handler = std::function<future<> (const response& rsp, input_stream<char>& body)>;
+private:
+    class connection;
+    struct host_pool;
+    struct request_state;
+    client_options _options;
+    // by "scheme://host:port"
+    std::unordered_map<sstring, std::unique_ptr<host_pool>> _pools;
+    gate _gate;
+private:
+    future<connected_socket> connect(const sstring& host, uint16_t port, bool tls);
+    lw_shared_ptr<connection> get_connection(host_pool& pool, request_state& state);
+    future<> send(host_pool& pool, request_state& state, bool retry);
+    future<> release(host_pool& pool, lw_shared_ptr<connection> c);
+public:
+    explicit client(client_options options = client_options());
+    client(const client&) = delete;
+    client& operator=(const client&) = delete;
+    ~client();
+
+    /**
+     * Sends a request, and reads its response, body included
+     */
+    future<response> make_request(request req);
+
+    /**
+     * Sends a request, and passes its response and a stream of its body
+     * to handle
+     * @return a future that resolves once handle's future does, and the
+     * rest of the body is skipped
+     */
+    future<> make_request(request req, body_handler handle);
+
+    /**
+     * Waits for the requests in progress, and closes the connections
+     */
+    future<> stop();
+};
+
+}
+
+}
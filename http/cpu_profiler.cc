@@ -0,0 +1,69 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "http/cpu_profiler.hh"
+#include "http/function_handlers.hh"
+#include "core/reactor.hh"
+#include "core/future-util.hh"
+#include "http/exception.hh"
+#include <boost/range/irange.hpp>
+
+namespace seastar {
+
+namespace httpd {
+
+static future<sstring> fold_shard_samples(unsigned shard, sstring group) {
+    return smp::submit_to(shard, [shard, group = std::move(group)] {
+        auto samples = engine().cpu_profiler_samples();
+        if (!group.empty()) {
+            samples.erase(std::remove_if(samples.begin(), samples.end(), [&group] (const cpu_profiler_sample& s) {
+                return s.sg.name() != group;
+            }), samples.end());
+        }
+        return fold_cpu_profiler_samples(samples, sprint("shard %d", shard));
+    });
+}
+
+void add_cpu_profiler_routes(routes& r, const sstring& path) {
+    r.put(GET, path, new function_handler([] (std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+        auto group = req->get_query_param("group");
+        auto shard_param = req->get_query_param("shard");
+        auto shards = boost::irange(0u, smp::count);
+        if (!shard_param.empty()) {
+            auto shard = unsigned(std::stoul(shard_param));
+            if (shard >= smp::count) {
+                throw bad_param_exception(sprint("invalid shard %s", shard_param));
+            }
+            shards = boost::irange(shard, shard + 1);
+        }
+        return map_reduce(shards, [group] (unsigned shard) {
+            return fold_shard_samples(shard, group);
+        }, sstring(), std::plus<sstring>()).then([rep = std::move(rep)] (sstring body) mutable {
+            rep->_content = std::move(body);
+            rep->done("txt");
+            return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+        });
+    }, "txt"));
+}
+
+}
+
+}
@@ -0,0 +1,42 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include "http/httpd.hh"
+
+namespace seastar {
+
+namespace httpd {
+
+/// Adds a GET handler on \c path that returns the CPU profiler samples of
+/// all shards in the folded stacks format (see fold_cpu_profiler_samples()),
+/// suitable for flamegraph.pl. Every stack starts with "shard N". The
+/// optional \c shard and \c group query parameters restrict the output to
+/// one shard and one scheduling group, respectively.
+///
+/// Samples are only collected when the reactor runs with
+/// \c --cpu-profiler-frequency.
+void add_cpu_profiler_routes(routes& r, const sstring& path = "/profile");
+
+}
+
+}
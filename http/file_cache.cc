@@ -0,0 +1,164 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <time.h>
+#include "http/file_cache.hh"
+#include "http/file_handler.hh"
+#include "http/mime_types.hh"
+#include "http/transformers.hh"
+#include "core/file.hh"
+#include "core/print.hh"
+#include "core/reactor.hh"
+
+namespace seastar {
+
+namespace httpd {
+
+file_cache::file_cache(file_cache_config cfg)
+        : _cfg(cfg)
+        , _reclaimer([this] (size_t bytes) { return evict(bytes); }, memory::reclaimer_scope::sync,
+                // the files can be read again from the disk
+                memory::reclaimer::default_priority / 2) {
+}
+
+file_cache::~file_cache() {
+    clear();
+}
+
+lw_shared_ptr<const cached_file> file_cache::get_fresh(const sstring& path) {
+    auto i = _entries.find(path);
+    if (i == _entries.end() || lowres_clock::now() - i->second.checked >= _cfg.revalidate_interval) {
+        return nullptr;
+    }
+    ++_hits;
+    _lru.erase(_lru.iterator_to(i->second));
+    _lru.push_front(i->second);
+    return i->second.file;
+}
+
+future<lw_shared_ptr<const cached_file>> file_cache::get(const sstring& path) {
+    if (auto cached = get_fresh(path)) {
+        return make_ready_future<lw_shared_ptr<const cached_file>>(std::move(cached));
+    }
+    return open_file_dma(path, open_flags::ro).then([this, path] (file f) {
+        return do_with(std::move(f), [this, path] (file& f) {
+            return f.stat().then([this, path, &f] (struct stat st) {
+                auto i = _entries.find(path);
+                if (i != _entries.end()) {
+                    auto& e = i->second;
+                    if (e.size == uint64_t(st.st_size) && e.mtime.tv_sec == st.st_mtim.tv_sec
+                            && e.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+                        ++_hits;
+                        e.checked = lowres_clock::now();
+                        _lru.erase(_lru.iterator_to(e));
+                        _lru.push_front(e);
+                        return make_ready_future<lw_shared_ptr<const cached_file>>(e.file);
+                    }
+                    erase(i);
+                }
+                ++_misses;
+                if (!S_ISREG(st.st_mode) || uint64_t(st.st_size) > _cfg.max_file_size) {
+                    return make_ready_future<lw_shared_ptr<const cached_file>>(nullptr);
+                }
+                return f.dma_read_bulk<char>(0, st.st_size).then([this, path, st] (temporary_buffer<char> data) {
+                    // a file that changed while it was read is served, but not cached
+                    auto complete = data.size() == uint64_t(st.st_size);
+                    auto file = load(path, std::move(data), st);
+                    if (complete) {
+                        insert(path, file, st);
+                    }
+                    return file;
+                });
+            }).finally([&f] {
+                return f.close();
+            });
+        });
+    });
+}
+
+lw_shared_ptr<const cached_file> file_cache::load(const sstring& path, temporary_buffer<char> data, const struct stat& st) const {
+    auto file = make_lw_shared<cached_file>();
+    file->content = sstring(data.get(), data.size());
+    file->etag = sprint("\"%x-%x-%x\"", uint64_t(st.st_size), uint64_t(st.st_mtim.tv_sec), uint64_t(st.st_mtim.tv_nsec));
+    struct tm tm;
+    gmtime_r(&st.st_mtim.tv_sec, &tm);
+    char date[64];
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    file->last_modified = date;
+    auto mime = mime_types::extension_to_type(file_interaction_handler::get_extension(path));
+    if (_cfg.gzip_level && compressible_mime_type(mime)) {
+        auto gz = compress(file->content, content_encoding::gzip, _cfg.gzip_level);
+        if (gz.size() < file->content.size()) {
+            file->gzip_content = std::move(gz);
+        }
+    }
+    return file;
+}
+
+void file_cache::insert(const sstring& path, lw_shared_ptr<const cached_file> file, const struct stat& st) {
+    auto i = _entries.find(path);
+    if (i != _entries.end()) {
+        // raced with another miss of the same file
+        erase(i);
+    }
+    auto size = path.size() + file->content.size() + file->gzip_content.size();
+    if (size > _cfg.capacity) {
+        return;
+    }
+    if (_used + size > _cfg.capacity) {
+        evict(_used + size - _cfg.capacity);
+    }
+    auto& e = _entries[path];
+    e.path = path;
+    e.file = std::move(file);
+    e.mtime = st.st_mtim;
+    e.size = st.st_size;
+    e.checked = lowres_clock::now();
+    _used += e.memory();
+    _lru.push_front(e);
+}
+
+void file_cache::erase(entries_type::iterator i) {
+    _lru.erase(_lru.iterator_to(i->second));
+    _used -= i->second.memory();
+    _entries.erase(i);
+}
+
+size_t file_cache::evict(size_t bytes) {
+    size_t freed = 0;
+    while (freed < bytes && !_lru.empty()) {
+        auto& e = _lru.back();
+        freed += e.memory();
+        erase(_entries.find(e.path));
+    }
+    return freed;
+}
+
+void file_cache::clear() {
+    while (!_entries.empty()) {
+        erase(_entries.begin());
+    }
+}
+
+}
+
+}
@@ -0,0 +1,153 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <boost/intrusive/list.hpp>
+#include "core/future.hh"
+#include "core/lowres_clock.hh"
+#include "core/memory.hh"
+#include "core/shared_ptr.hh"
+#include "core/sstring.hh"
+#include "core/temporary_buffer.hh"
+
+namespace seastar {
+
+namespace httpd {
+
+/**
+ * Settings of a file_cache
+ */
+struct file_cache_config {
+    /**
+     * Memory the cached files may take, in bytes
+     */
+    size_t capacity = 16 * 1024 * 1024;
+    /**
+     * Larger files are not cached
+     */
+    size_t max_file_size = 256 * 1024;
+    /**
+     * How long a cached file is served before checking again that it did
+     * not change on the disk
+     */
+    std::chrono::milliseconds revalidate_interval = std::chrono::seconds(1);
+    /**
+     * Level of the gzip copies kept of compressible files; 0 keeps none
+     */
+    int gzip_level = 6;
+};
+
+/**
+ * The content of a cached file, and what its replies are made of
+ */
+struct cached_file {
+    sstring content;
+    /**
+     * A gzip copy of the content; empty if the file is not of a
+     * compressible type, or does not get smaller
+     */
+    sstring gzip_content;
+    sstring etag;
+    sstring last_modified;
+};
+
+/**
+ * A per-shard cache of small static files, for the file handlers.
+ *
+ * Files are cached whole, along with their ETag and Last-Modified values,
+ * and a gzip copy, and are evicted in least recently used order when the
+ * cache is full, or when the shard's memory reclaimer needs memory. A
+ * cached file is checked against the disk once per revalidation interval,
+ * and read again if its size or modification time changed.
+ */
+class file_cache {
+    struct entry {
+        sstring path;
+        lw_shared_ptr<const cached_file> file;
+        struct timespec mtime;
+        uint64_t size;
+        lowres_clock::time_point checked;
+        boost::intrusive::list_member_hook<> lru_link;
+        size_t memory() const {
+            return path.size() + file->content.size() + file->gzip_content.size();
+        }
+    };
+    using entries_type = std::unordered_map<sstring, entry>;
+    using lru_type = boost::intrusive::list<entry,
+            boost::intrusive::member_hook<entry, boost::intrusive::list_member_hook<>, &entry::lru_link>,
+            boost::intrusive::constant_time_size<false>>;
+    file_cache_config _cfg;
+    entries_type _entries;
+    lru_type _lru; // most recently used first
+    size_t _used = 0;
+    uint64_t _hits = 0;
+    uint64_t _misses = 0;
+    memory::reclaimer _reclaimer;
+private:
+    void insert(const sstring& path, lw_shared_ptr<const cached_file> file, const struct stat& st);
+    void erase(entries_type::iterator i);
+    size_t evict(size_t bytes);
+    lw_shared_ptr<const cached_file> load(const sstring& path, temporary_buffer<char> data, const struct stat& st) const;
+public:
+    explicit file_cache(file_cache_config cfg = file_cache_config());
+    file_cache(const file_cache&) = delete;
+    file_cache& operator=(const file_cache&) = delete;
+    ~file_cache();
+
+    /**
+     * Returns a file from the cache, reading it first if it is not
+     * cached, or changed on the disk
+     * @return the file, or null if it is not a regular file small enough
+     * to be cached
+     */
+    future<lw_shared_ptr<const cached_file>> get(const sstring& path);
+
+    /**
+     * Returns a file from the cache, if it is there and was checked
+     * against the disk within the revalidation interval
+     * @return the file, or null
+     */
+    lw_shared_ptr<const cached_file> get_fresh(const sstring& path);
+
+    /**
+     * Drops all the cached files
+     */
+    void clear();
+
+    size_t used_memory() const {
+        return _used;
+    }
+    uint64_t hits() const {
+        return _hits;
+    }
+    uint64_t misses() const {
+        return _misses;
+    }
+};
+
+}
+
+}
@@ -27,6 +27,7 @@
 #include "core/shared_ptr.hh"
 #include "core/app-template.hh"
 #include "exception.hh"
+#include "transformers.hh"
 
 namespace seastar {
 
@@ -40,6 +41,13 @@ directory_handler::directory_handler(const sstring& doc_root,
 future<std::unique_ptr<reply>> directory_handler::handle(const sstring& path,
         std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
     sstring full_path = doc_root + req->param["path"];
+    if (cache && !transformer) {
+        // served without checking the file type
+        if (auto f = cache->get_fresh(full_path)) {
+            reply_cached(*f, get_extension(full_path), *req, *rep);
+            return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+        }
+    }
     auto h = this;
     return engine().file_type(full_path).then(
             [h, full_path, req = std::move(req), rep = std::move(rep)](auto val) mutable {
@@ -84,21 +92,102 @@ future<std::unique_ptr<reply>> file_interaction_handler::read(
         sstring file_name, std::unique_ptr<request> req,
         std::unique_ptr<reply> rep) {
     sstring extension = get_extension(file_name);
-    rep->write_body(extension, [req = std::move(req), extension, file_name, this] (output_stream<char>&& s) mutable {
+    if (cache && !transformer) {
+        return cache->get(file_name).then([this, file_name, extension,
+                req = std::move(req), rep = std::move(rep)] (lw_shared_ptr<const cached_file> f) mutable {
+            if (!f) {
+                return read_from_disk(file_name, extension, std::move(req), std::move(rep));
+            }
+            reply_cached(*f, extension, *req, *rep);
+            return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+        });
+    }
+    return read_from_disk(file_name, extension, std::move(req), std::move(rep));
+}
+
+// Whether an If-None-Match header lists the etag
+static bool etag_matches(const sstring& if_none_match, const sstring& etag) {
+    if (if_none_match == "*") {
+        return true;
+    }
+    size_t pos = 0;
+    while (pos < if_none_match.size()) {
+        auto end = if_none_match.find(',', pos);
+        if (end == sstring::npos) {
+            end = if_none_match.size();
+        }
+        auto tag = if_none_match.substr(pos, end - pos);
+        pos = end + 1;
+        auto b = tag.find('"');
+        auto e = tag.find_last_of('"');
+        if (b != sstring::npos && e > b && tag.substr(b, e - b + 1) == etag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void file_interaction_handler::reply_cached(const cached_file& f, const sstring& extension,
+        const request& req, reply& rep) {
+    rep._headers["ETag"] = f.etag;
+    rep._headers["Last-Modified"] = f.last_modified;
+    if (!f.gzip_content.empty()) {
+        rep._headers["Vary"] = "Accept-Encoding";
+    }
+    auto if_none_match = req.get_header("If-None-Match");
+    auto not_modified = if_none_match.empty()
+            ? req.get_header("If-Modified-Since") == f.last_modified
+            : etag_matches(if_none_match, f.etag);
+    if (not_modified) {
+        rep.set_status(reply::status_type::not_modified).done(extension);
+        return;
+    }
+    if (!f.gzip_content.empty() && accepted_encoding(req) == content_encoding::gzip) {
+        rep._headers["Content-Encoding"] = "gzip";
+        rep._content = f.gzip_content;
+    } else {
+        rep._content = f.content;
+    }
+    rep.done(extension);
+}
+
+future<std::unique_ptr<reply>> file_interaction_handler::read_from_disk(sstring file_name,
+        sstring extension, std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+    if (precompressed && !transformer && accepted_encoding(*req) == content_encoding::gzip) {
+        sstring gz = file_name + ".gz";
+        return engine().file_exists(gz).then([this, gz, file_name, extension,
+                req = std::move(req), rep = std::move(rep)] (bool exists) mutable {
+            if (exists) {
+                rep->_headers["Content-Encoding"] = "gzip";
+                rep->_headers["Vary"] = "Accept-Encoding";
+            }
+            send_file(exists ? gz : file_name, extension, std::move(req), *rep);
+            return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+        });
+    }
+    send_file(file_name, extension, std::move(req), *rep);
+    return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+}
+
+void file_interaction_handler::send_file(sstring file_name, sstring extension,
+        std::unique_ptr<request> req, reply& rep) {
+    rep.write_body(extension, [req = std::move(req), extension, file_name, this] (output_stream<char>&& s) mutable {
         return do_with(output_stream<char>(get_stream(std::move(req), extension, std::move(s))),
                 [this, file_name] (output_stream<char>& os) {
             return open_file_dma(file_name, open_flags::ro).then([&os, this] (file f) {
-                return do_with(input_stream<char>(make_file_input_stream(std::move(f))), [&os](input_stream<char>& is) {
-                    return copy(is, os).then([&os] {
+                // sent straight from the file, without copies where the connection allows it
+                return do_with(std::move(f), [&os] (file& f) {
+                    return f.size().then([&os, &f] (uint64_t size) {
+                        return os.write_file(f, 0, size);
+                    }).then([&os] {
                         return os.close();
-                    }).then([&is] {
-                        return is.close();
+                    }).then([&f] {
+                        return f.close();
                     });
                 });
             });
         });
     });
-    return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
 }
 
 bool file_interaction_handler::redirect_if_needed(const request& req,
@@ -23,6 +23,7 @@
 #define HTTP_FILE_HANDLER_HH_
 
 #include "handlers.hh"
+#include "file_cache.hh"
 #include "core/iostream.hh"
 
 namespace seastar {
@@ -80,6 +81,32 @@ class file_interaction_handler : public handler_base {
         return this;
     }
 
+    /**
+     * Allows serving a file from its precompressed copy, named as the file
+     * with a .gz suffix, when there is one and the client accepts gzip.
+     * Files are not served precompressed when a transformer is set.
+     * @param p whether to look for precompressed copies
+     * @return this
+     */
+    file_interaction_handler* set_precompressed(bool p = true) {
+        precompressed = p;
+        return this;
+    }
+
+    /**
+     * Allows serving the files from a cache, which the handlers of a shard
+     * may share. Cached files are replied to with ETag and Last-Modified
+     * headers, and conditional requests that match them with 304 (Not
+     * Modified); they are not served from the cache when a transformer is
+     * set.
+     * @param c the cache to use
+     * @return this
+     */
+    file_interaction_handler* set_cache(lw_shared_ptr<file_cache> c) {
+        cache = std::move(c);
+        return this;
+    }
+
     /**
      * if the url ends without a slash redirect
      * @param req the request
@@ -95,6 +122,13 @@ class file_interaction_handler : public handler_base {
      */
     static sstring get_extension(const sstring& file);
 
+    /**
+     * reply with a cached file, or with 304 if the request's conditions
+     * match it
+     */
+    static void reply_cached(const cached_file& f, const sstring& extension,
+            const request& req, reply& rep);
+
 protected:
 
     /**
@@ -105,7 +139,20 @@ class file_interaction_handler : public handler_base {
      */
     future<std::unique_ptr<reply> > read(sstring file,
             std::unique_ptr<request> req, std::unique_ptr<reply> rep);
+    /**
+     * send a file from the disk in the reply, with the content type of
+     * the given extension
+     */
+    void send_file(sstring file_name, sstring extension,
+            std::unique_ptr<request> req, reply& rep);
+    /**
+     * read a file from the disk, or its precompressed copy
+     */
+    future<std::unique_ptr<reply>> read_from_disk(sstring file_name, sstring extension,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep);
     file_transformer* transformer;
+    bool precompressed = false;
+    lw_shared_ptr<file_cache> cache;
 
     output_stream<char> get_stream(std::unique_ptr<request> req,
             const sstring& extension, output_stream<char>&& s);
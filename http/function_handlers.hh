@@ -24,6 +24,7 @@
 #include "handlers.hh"
 #include <functional>
 #include "json/json_elements.hh"
+#include "net/packet-data-source.hh"
 
 namespace seastar {
 
@@ -43,7 +44,8 @@ typedef std::function<sstring(const_req req, reply&)> handle_function;
 /**
  * A json request function is a lambda expression that gets only the request
  * as its parameter and return a json response.
- * Using the json response is done implicitly.
+ * Using the json response is done implicitly; a response made with
+ * json::stream_object() is streamed into the reply.
  */
 typedef std::function<json::json_return_type(const_req req)> json_request_function;
 
@@ -91,7 +93,7 @@ class function_handler : public handler_base {
             : _f_handle(
                     [_handle](std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
                         json::json_return_type res = _handle(*req.get());
-                        rep->_content += res._res;
+                        set_json_reply(*rep, std::move(res));
                         return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
                     }), _type("json") {
     }
@@ -100,7 +102,7 @@ class function_handler : public handler_base {
             : _f_handle(
                     [_handle](std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
                         return _handle(std::move(req)).then([rep = std::move(rep)](json::json_return_type res) mutable {
-                                    rep->_content += res._res;
+                                    set_json_reply(*rep, std::move(res));
                                     return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
                                 }
                         );
@@ -117,10 +119,57 @@ class function_handler : public handler_base {
     }
 
 protected:
+    static void set_json_reply(reply& rep, json::json_return_type&& res) {
+        if (res._body_writer) {
+            rep.write_body("json", std::move(res._body_writer));
+        } else {
+            rep._content += res._res;
+        }
+    }
+
     future_handler_function _f_handle;
     sstring _type;
 };
 
+/**
+ * A stream function reads the request body, if it wants it, from the
+ * request's content_stream, and writes the reply body to the output
+ * stream, which it must close when done.
+ */
+typedef std::function<future<>(request& req, output_stream<char> out)> stream_function;
+
+/**
+ * The stream handler streams both bodies, so that neither has to fit in
+ * memory: the function is called once the reply headers are sent, and
+ * the reply body goes out with the chunked transfer encoding.
+ */
+class stream_handler : public handler_base {
+public:
+    stream_handler(const stream_function& f, const sstring& type)
+            : _f(f), _type(type) {
+    }
+
+    future<std::unique_ptr<reply>> handle(const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep) override {
+        if (!req->content_length) {
+            req->content_stream = net::as_input_stream(net::packet());
+        }
+        rep->write_body(_type, [f = _f, req = std::move(req)] (output_stream<char>&& out) {
+            return f(*req, std::move(out));
+        });
+        rep->done();
+        return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+    }
+
+    bool reads_content_stream() const override {
+        return true;
+    }
+
+protected:
+    stream_function _f;
+    sstring _type;
+};
+
 }
 
 }
@@ -56,6 +56,15 @@ class handler_base {
 
     virtual ~handler_base() = default;
 
+    /**
+     * Whether the handler reads the request body from
+     * request::content_stream; if not, the body is read into
+     * request::content before the handler is called
+     */
+    virtual bool reads_content_stream() const {
+        return false;
+    }
+
     /**
      * Add a mandatory parameter
      * @param param a parameter name
@@ -0,0 +1,418 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <algorithm>
+#include <iterator>
+#include <type_traits>
+#include "hpack.hh"
+
+namespace seastar {
+
+namespace httpd {
+
+using std::experimental::string_view;
+
+namespace {
+
+// RFC 7541, appendix A; entry i has index i + 1
+const header_field static_table[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+constexpr uint64_t static_table_size = std::extent<decltype(static_table)>::value;
+
+// RFC 7541, appendix B. The code is canonical, so the lengths of the
+// codes of the symbols (the bytes, and EOS) are enough to rebuild it
+const uint8_t huffman_code_lengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+constexpr unsigned eos = 256;
+constexpr unsigned max_code_length = 30;
+
+struct huffman_code {
+    uint32_t codes[257];
+    // The first code of each length, how many codes have that length,
+    // and where their symbols start in symbols
+    uint32_t first[max_code_length + 1];
+    uint32_t count[max_code_length + 1] = {};
+    uint32_t offset[max_code_length + 1];
+    uint16_t symbols[257];
+    huffman_code() {
+        for (auto l : huffman_code_lengths) {
+            ++count[l];
+        }
+        uint32_t code = 0;
+        uint32_t n = 0;
+        for (unsigned l = 0; l <= max_code_length; ++l) {
+            first[l] = code;
+            offset[l] = n;
+            code = (code + count[l]) << 1;
+            n += count[l];
+        }
+        // the codes of one length are given in symbol order
+        uint32_t next_code[max_code_length + 1];
+        uint32_t next_symbol[max_code_length + 1];
+        std::copy(std::begin(first), std::end(first), next_code);
+        std::copy(std::begin(offset), std::end(offset), next_symbol);
+        for (unsigned s = 0; s <= eos; ++s) {
+            auto l = huffman_code_lengths[s];
+            codes[s] = next_code[l]++;
+            symbols[next_symbol[l]++] = s;
+        }
+    }
+};
+
+const huffman_code& huffman() {
+    static const huffman_code code;
+    return code;
+}
+
+size_t huffman_length(string_view s) {
+    uint64_t bits = 0;
+    for (unsigned char c : s) {
+        bits += huffman_code_lengths[c];
+    }
+    return (bits + 7) / 8;
+}
+
+void huffman_encode(string_view s, char* out) {
+    auto& h = huffman();
+    uint64_t acc = 0;
+    unsigned bits = 0;
+    for (unsigned char c : s) {
+        acc = (acc << huffman_code_lengths[c]) | h.codes[c];
+        bits += huffman_code_lengths[c];
+        while (bits >= 8) {
+            bits -= 8;
+            *out++ = char(acc >> bits);
+        }
+        acc &= (uint64_t(1) << bits) - 1;
+    }
+    if (bits) {
+        // padded with the most significant bits of EOS, all ones
+        *out++ = char((acc << (8 - bits)) | ((1u << (8 - bits)) - 1));
+    }
+}
+
+void encode_integer(std::vector<char>& out, uint8_t first_bits, unsigned prefix, uint64_t value) {
+    uint64_t max = (1u << prefix) - 1;
+    if (value < max) {
+        out.push_back(char(first_bits | value));
+        return;
+    }
+    out.push_back(char(first_bits | max));
+    value -= max;
+    while (value >= 128) {
+        out.push_back(char(0x80 | (value & 127)));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+void encode_string(std::vector<char>& out, string_view s) {
+    auto length = huffman_length(s);
+    if (length < s.size()) {
+        encode_integer(out, 0x80, 7, length);
+        auto pos = out.size();
+        out.resize(pos + length);
+        huffman_encode(s, &out[pos]);
+    } else {
+        encode_integer(out, 0, 7, s.size());
+        out.insert(out.end(), s.begin(), s.end());
+    }
+}
+
+class block_reader {
+    const uint8_t* _p;
+    const uint8_t* _end;
+public:
+    block_reader(const char* data, size_t size)
+            : _p(reinterpret_cast<const uint8_t*>(data)), _end(_p + size) {
+    }
+    bool empty() const {
+        return _p == _end;
+    }
+    uint8_t peek() const {
+        return *_p;
+    }
+    uint64_t integer(unsigned prefix) {
+        if (empty()) {
+            throw hpack_error("truncated header block");
+        }
+        uint64_t max = (1u << prefix) - 1;
+        uint64_t value = *_p++ & max;
+        if (value < max) {
+            return value;
+        }
+        unsigned shift = 0;
+        uint8_t b;
+        do {
+            if (empty()) {
+                throw hpack_error("truncated header block");
+            }
+            if (shift > 56) {
+                throw hpack_error("integer overflow in header block");
+            }
+            b = *_p++;
+            value += uint64_t(b & 127) << shift;
+            shift += 7;
+        } while (b & 128);
+        return value;
+    }
+    sstring string() {
+        if (empty()) {
+            throw hpack_error("truncated header block");
+        }
+        bool huffman_coded = *_p & 0x80;
+        auto length = integer(7);
+        if (length > uint64_t(_end - _p)) {
+            throw hpack_error("truncated header block");
+        }
+        string_view s(reinterpret_cast<const char*>(_p), length);
+        _p += length;
+        return huffman_coded ? hpack_huffman_decode(s) : sstring(s.data(), s.size());
+    }
+};
+
+size_t entry_size(const header_field& f) {
+    return f.name.size() + f.value.size() + 32;
+}
+
+}
+
+sstring hpack_huffman_encode(string_view s) {
+    sstring ret(sstring::initialized_later(), huffman_length(s));
+    huffman_encode(s, ret.begin());
+    return ret;
+}
+
+sstring hpack_huffman_decode(string_view s) {
+    auto& h = huffman();
+    // no code is shorter than 5 bits
+    sstring ret(sstring::initialized_later(), s.size() * 8 / 5);
+    auto out = ret.begin();
+    uint32_t code = 0;
+    unsigned length = 0;
+    for (unsigned char c : s) {
+        for (int bit = 7; bit >= 0; --bit) {
+            code = (code << 1) | ((c >> bit) & 1);
+            ++length;
+            if (code - h.first[length] < h.count[length]) {
+                auto symbol = h.symbols[h.offset[length] + code - h.first[length]];
+                if (symbol == eos) {
+                    throw hpack_error("EOS in a Huffman coded string");
+                }
+                *out++ = char(symbol);
+                code = 0;
+                length = 0;
+            } else if (length == max_code_length) {
+                throw hpack_error("invalid Huffman code");
+            }
+        }
+    }
+    // the padding is shorter than a byte, and a prefix of EOS
+    if (length > 7 || code != (1u << length) - 1) {
+        throw hpack_error("invalid Huffman code padding");
+    }
+    // resize() does not move the terminator
+    *out = '\0';
+    ret.resize(out - ret.begin());
+    return ret;
+}
+
+void hpack_encode(std::vector<char>& block, string_view name, string_view value) {
+    uint64_t name_index = 0;
+    for (uint64_t i = 0; i < static_table_size; ++i) {
+        if (string_view(static_table[i].name) == name) {
+            if (string_view(static_table[i].value) == value) {
+                encode_integer(block, 0x80, 7, i + 1);
+                return;
+            }
+            if (!name_index) {
+                name_index = i + 1;
+            }
+        }
+    }
+    // a literal field without indexing
+    encode_integer(block, 0, 4, name_index);
+    if (!name_index) {
+        encode_string(block, name);
+    }
+    encode_string(block, value);
+}
+
+hpack_decoder::hpack_decoder(size_t max_table_size)
+        : _max_table_size(max_table_size)
+        , _table_size_limit(max_table_size) {
+}
+
+const header_field& hpack_decoder::field_at(uint64_t index) {
+    if (index == 0) {
+        throw hpack_error("index 0 in header block");
+    }
+    if (index <= static_table_size) {
+        return static_table[index - 1];
+    }
+    index -= static_table_size + 1;
+    if (index >= _table.size()) {
+        throw hpack_error("index past the dynamic table in header block");
+    }
+    return _table[index];
+}
+
+void hpack_decoder::evict_to(size_t size) {
+    while (_table_size > size) {
+        _table_size -= entry_size(_table.back());
+        _table.pop_back();
+    }
+}
+
+void hpack_decoder::insert(header_field f) {
+    auto size = entry_size(f);
+    if (size > _max_table_size) {
+        // not an error: the table is just emptied
+        evict_to(0);
+        return;
+    }
+    evict_to(_max_table_size - size);
+    _table_size += size;
+    _table.push_front(std::move(f));
+}
+
+std::vector<header_field> hpack_decoder::decode(const char* data, size_t size) {
+    std::vector<header_field> fields;
+    block_reader r(data, size);
+    // table size updates come first
+    bool fields_started = false;
+    while (!r.empty()) {
+        auto b = r.peek();
+        if (b & 0x80) {
+            fields.push_back(field_at(r.integer(7)));
+        } else if ((b & 0xe0) == 0x20) {
+            auto max = r.integer(5);
+            if (fields_started) {
+                throw hpack_error("dynamic table size update after a header field");
+            }
+            if (max > _table_size_limit) {
+                throw hpack_error("dynamic table size update past the limit");
+            }
+            _max_table_size = max;
+            evict_to(max);
+            continue;
+        } else {
+            // with incremental indexing, without indexing, or never
+            // indexed
+            bool indexed = b & 0x40;
+            auto index = r.integer(indexed ? 6 : 4);
+            header_field f;
+            f.name = index ? field_at(index).name : r.string();
+            f.value = r.string();
+            if (indexed) {
+                insert(f);
+            }
+            fields.push_back(std::move(f));
+        }
+        fields_started = true;
+    }
+    return fields;
+}
+
+}
+
+}
@@ -0,0 +1,108 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <stdexcept>
+#include <vector>
+#include <experimental/string_view>
+#include "core/circular_buffer.hh"
+#include "core/sstring.hh"
+
+namespace seastar {
+
+namespace httpd {
+
+/**
+ * A malformed HPACK header block; it breaks the compression state of the
+ * connection, so the connection cannot go on
+ */
+class hpack_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * A header field of an HTTP/2 header block
+ */
+struct header_field {
+    sstring name;
+    sstring value;
+};
+
+/**
+ * Decodes the header blocks a peer sends on an HTTP/2 connection, as
+ * RFC 7541 (HPACK) describes, keeping the dynamic table the blocks
+ * update. The blocks must all be decoded, in the order they were sent.
+ */
+class hpack_decoder {
+    circular_buffer<header_field> _table; // newest first
+    size_t _table_size = 0;
+    // the size the encoder chose, and the most it may choose
+    size_t _max_table_size;
+    size_t _table_size_limit;
+private:
+    const header_field& field_at(uint64_t index);
+    void insert(header_field f);
+    void evict_to(size_t size);
+public:
+    /**
+     * @param max_table_size the SETTINGS_HEADER_TABLE_SIZE advertised to
+     * the peer
+     */
+    explicit hpack_decoder(size_t max_table_size = 4096);
+    /**
+     * Decodes a complete header block, throwing hpack_error if it is
+     * malformed
+     */
+    std::vector<header_field> decode(const char* data, size_t size);
+    /**
+     * The size of the dynamic table, as RFC 7541 counts it
+     */
+    size_t table_size() const {
+        return _table_size;
+    }
+};
+
+/**
+ * Appends the representation of a header field to a header block.
+ *
+ * Fields are never added to the dynamic table, so no encoding state is
+ * kept: names, and whole fields, are taken from the static table when
+ * they are in it, and strings are Huffman coded when that makes them
+ * shorter.
+ */
+void hpack_encode(std::vector<char>& block, std::experimental::string_view name, std::experimental::string_view value);
+
+/**
+ * Huffman codes a string, as HPACK does; exposed for the tests
+ */
+sstring hpack_huffman_encode(std::experimental::string_view s);
+
+/**
+ * Decodes a Huffman coded string, throwing hpack_error if it is malformed
+ */
+sstring hpack_huffman_decode(std::experimental::string_view s);
+
+}
+
+}
@@ -0,0 +1,909 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include "http2.hh"
+#include "httpd.hh"
+#include "reply.hh"
+#include "core/future-util.hh"
+
+namespace seastar {
+
+namespace httpd {
+
+using std::experimental::string_view;
+
+namespace {
+
+const string_view connection_preface("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+
+constexpr size_t frame_header_size = 9;
+// what the client may send; it is never raised with SETTINGS_MAX_FRAME_SIZE
+constexpr uint32_t max_frame_size = 16384;
+constexpr int64_t max_window_size = std::numeric_limits<int32_t>::max();
+constexpr uint32_t default_window_size = 65535;
+// of a header block received in several frames
+constexpr size_t max_header_block_size = 256 * 1024;
+
+namespace frame_type {
+constexpr uint8_t data = 0x0;
+constexpr uint8_t headers = 0x1;
+constexpr uint8_t priority = 0x2;
+constexpr uint8_t rst_stream = 0x3;
+constexpr uint8_t settings = 0x4;
+constexpr uint8_t push_promise = 0x5;
+constexpr uint8_t ping = 0x6;
+constexpr uint8_t goaway = 0x7;
+constexpr uint8_t window_update = 0x8;
+constexpr uint8_t continuation = 0x9;
+}
+
+namespace flags {
+constexpr uint8_t end_stream = 0x1;
+constexpr uint8_t ack = 0x1;
+constexpr uint8_t end_headers = 0x4;
+constexpr uint8_t padded = 0x8;
+constexpr uint8_t priority = 0x20;
+}
+
+namespace setting {
+constexpr uint16_t header_table_size = 0x1;
+constexpr uint16_t enable_push = 0x2;
+constexpr uint16_t max_concurrent_streams = 0x3;
+constexpr uint16_t initial_window_size = 0x4;
+constexpr uint16_t max_frame_size = 0x5;
+}
+
+// An error that ends the connection
+class connection_error : public std::runtime_error {
+    http2_error_code _code;
+public:
+    connection_error(http2_error_code code, const std::string& what)
+            : std::runtime_error(what), _code(code) {
+    }
+    http2_error_code code() const {
+        return _code;
+    }
+};
+
+class stream_reset_error : public std::runtime_error {
+public:
+    stream_reset_error() : std::runtime_error("HTTP/2 stream reset") {
+    }
+};
+
+uint32_t read_be32(const char* p) {
+    auto u = reinterpret_cast<const uint8_t*>(p);
+    return uint32_t(u[0]) << 24 | uint32_t(u[1]) << 16 | uint32_t(u[2]) << 8 | u[3];
+}
+
+void append_be32(sstring& s, uint32_t v) {
+    char b[4] = { char(v >> 24), char(v >> 16), char(v >> 8), char(v) };
+    s.append(b, 4);
+}
+
+sstring frame_head(uint8_t type, uint8_t flags, uint32_t stream_id, size_t length) {
+    sstring head(sstring::initialized_later(), frame_header_size);
+    auto p = head.begin();
+    p[0] = char(length >> 16);
+    p[1] = char(length >> 8);
+    p[2] = char(length);
+    p[3] = char(type);
+    p[4] = char(flags);
+    p[5] = char(stream_id >> 24);
+    p[6] = char(stream_id >> 16);
+    p[7] = char(stream_id >> 8);
+    p[8] = char(stream_id);
+    return head;
+}
+
+sstring frame(uint8_t type, uint8_t flags, uint32_t stream_id, const sstring& payload) {
+    return frame_head(type, flags, stream_id, payload.size()) + payload;
+}
+
+sstring window_update(uint32_t stream_id, uint32_t increment) {
+    sstring payload;
+    append_be32(payload, increment);
+    return frame(frame_type::window_update, 0, stream_id, payload);
+}
+
+sstring rst_stream(uint32_t stream_id, http2_error_code code) {
+    sstring payload;
+    append_be32(payload, uint32_t(code));
+    return frame(frame_type::rst_stream, 0, stream_id, payload);
+}
+
+// Drops the padding of a DATA or HEADERS frame
+void strip_padding(uint8_t frame_flags, temporary_buffer<char>& payload) {
+    if (!(frame_flags & flags::padded)) {
+        return;
+    }
+    if (payload.empty() || uint8_t(payload[0]) >= payload.size()) {
+        throw connection_error(http2_error_code::protocol_error, "bad padding");
+    }
+    auto padding = uint8_t(payload[0]);
+    payload.trim_front(1);
+    payload.trim(payload.size() - padding);
+}
+
+// "content-type" -> "Content-Type", as the handlers look headers up
+sstring canonical_header_name(const sstring& name) {
+    sstring ret = name;
+    bool word_start = true;
+    for (auto& c : ret) {
+        if (word_start) {
+            c = std::toupper(c);
+        }
+        word_start = c == '-';
+    }
+    return ret;
+}
+
+sstring lowercase(const sstring& s) {
+    sstring ret = s;
+    for (auto& c : ret) {
+        c = std::tolower(c);
+    }
+    return ret;
+}
+
+// Headers that only HTTP/1 connections have
+bool connection_specific(const sstring& name) {
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection"
+            || name == "transfer-encoding" || name == "upgrade";
+}
+
+}
+
+http2_stream::http2_stream(uint32_t id, int64_t send_window, int64_t recv_window)
+        : id(id), send_window(send_window), recv_window(recv_window) {
+}
+
+http2_stream::~http2_stream() {
+}
+
+void http2_stream::wake() {
+    if (body_waiter) {
+        body_waiter->set_value();
+        body_waiter = {};
+    }
+}
+
+// A request body, as the stream receives it
+class http2_body_source_impl : public data_source_impl {
+    http2_connection& _conn;
+    lw_shared_ptr<http2_stream> _stream;
+public:
+    http2_body_source_impl(http2_connection& conn, lw_shared_ptr<http2_stream> stream)
+            : _conn(conn), _stream(std::move(stream)) {
+    }
+    virtual future<temporary_buffer<char>> get() override {
+        auto& s = *_stream;
+        if (!s.body.empty()) {
+            auto buf = std::move(s.body.front());
+            s.body.pop_front();
+            if (s.buffer_body) {
+                return make_ready_future<temporary_buffer<char>>(std::move(buf));
+            }
+            s.unread -= buf.size();
+            auto size = buf.size();
+            return _conn.consumed(&s, size).then([buf = std::move(buf)] () mutable {
+                return std::move(buf);
+            });
+        }
+        if (s.reset) {
+            return make_exception_future<temporary_buffer<char>>(stream_reset_error());
+        }
+        if (!s.remote_open) {
+            return make_ready_future<temporary_buffer<char>>();
+        }
+        s.body_waiter = promise<>();
+        return s.body_waiter->get_future().then([this] {
+            return get();
+        });
+    }
+};
+
+// A reply body, sent in DATA frames as the windows allow
+class http2_body_sink_impl : public data_sink_impl {
+    http2_connection& _conn;
+    lw_shared_ptr<http2_stream> _stream;
+public:
+    http2_body_sink_impl(http2_connection& conn, lw_shared_ptr<http2_stream> stream)
+            : _conn(conn), _stream(std::move(stream)) {
+    }
+    virtual future<> put(net::packet p) override {
+        return do_with(std::move(p), [this] (net::packet& p) {
+            return do_for_each(p.fragments().begin(), p.fragments().end(), [this] (net::fragment f) {
+                return _conn.write_data(_stream, f.base, f.size, false);
+            });
+        });
+    }
+    virtual future<> put(temporary_buffer<char> buf) override {
+        return do_with(std::move(buf), [this] (temporary_buffer<char>& buf) {
+            return _conn.write_data(_stream, buf.get(), buf.size(), false);
+        });
+    }
+    virtual future<> close() override {
+        // the stream is ended once the body writer is done
+        return make_ready_future<>();
+    }
+};
+
+http2_connection::http2_connection(connection& conn, http_server& server, input_stream<char>& in,
+        output_stream<char>& out, const http2_config& cfg)
+        : _conn(conn), _server(server), _in(in), _out(out), _cfg(cfg) {
+}
+
+http2_connection::~http2_connection() {
+}
+
+future<> http2_connection::process(size_t preface_read) {
+    return _in.read_exactly(connection_preface.size() - preface_read).then([this, preface_read] (temporary_buffer<char> buf) {
+        if (string_view(buf.get(), buf.size()) != connection_preface.substr(preface_read)) {
+            // not HTTP/2: nothing to answer
+            return make_ready_future<>();
+        }
+        sstring settings;
+        auto add_setting = [&settings] (uint16_t id, uint32_t value) {
+            char b[2] = { char(id >> 8), char(id) };
+            settings.append(b, 2);
+            append_be32(settings, value);
+        };
+        add_setting(setting::max_concurrent_streams, _cfg.max_concurrent_streams);
+        add_setting(setting::initial_window_size, _cfg.stream_window_size);
+        auto preface = frame(frame_type::settings, 0, 0, settings);
+        if (_cfg.connection_window_size > default_window_size) {
+            preface += window_update(0, _cfg.connection_window_size - default_window_size);
+            _recv_window = _cfg.connection_window_size;
+        }
+        return with_semaphore(_write_sem, 1, [this, preface = std::move(preface)] {
+            return _out.write(preface).then([this] {
+                return _out.flush();
+            });
+        }).then([this] {
+            return read_frames();
+        }).handle_exception([this] (std::exception_ptr ep) {
+            auto code = http2_error_code::internal_error;
+            try {
+                std::rethrow_exception(ep);
+            } catch (connection_error& e) {
+                code = e.code();
+            } catch (hpack_error& e) {
+                code = http2_error_code::compression_error;
+            } catch (...) {
+                // the connection broke: nothing can be sent
+                ++_server._read_errors;
+                return make_ready_future<>();
+            }
+            sstring payload;
+            append_be32(payload, _last_stream_id);
+            append_be32(payload, uint32_t(code));
+            return with_semaphore(_write_sem, 1, [this, goaway = frame(frame_type::goaway, 0, 0, payload)] {
+                return _out.write(goaway).then([this] {
+                    return _out.flush();
+                });
+            }).handle_exception([] (std::exception_ptr) {});
+        });
+    }).finally([this] {
+        // the client is gone: what waits for it fails
+        for (auto&& s : _streams) {
+            s.second->reset = true;
+            s.second->wake();
+        }
+        _window_available.broken();
+        return _streams_gate.close().then([this] {
+            return _out.close().handle_exception([this] (std::exception_ptr) {
+                ++_server._respond_errors;
+            });
+        }).then([this] {
+            return _in.close();
+        });
+    });
+}
+
+future<> http2_connection::read_frames() {
+    return repeat([this] {
+        return _in.read_exactly(frame_header_size).then([this] (temporary_buffer<char> head) {
+            if (head.size() < frame_header_size) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            auto p = reinterpret_cast<const uint8_t*>(head.get());
+            frame_header h;
+            h.length = uint32_t(p[0]) << 16 | uint32_t(p[1]) << 8 | p[2];
+            h.type = p[3];
+            h.flags = p[4];
+            h.stream_id = read_be32(head.get() + 5) & 0x7fffffff;
+            if (h.length > max_frame_size) {
+                throw connection_error(http2_error_code::frame_size_error, "frame too large");
+            }
+            return _in.read_exactly(h.length).then([this, h] (temporary_buffer<char> payload) {
+                if (payload.size() < h.length) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return handle_frame(h, std::move(payload)).then([] {
+                    return stop_iteration::no;
+                });
+            });
+        });
+    });
+}
+
+future<> http2_connection::handle_frame(const frame_header& h, temporary_buffer<char> payload) {
+    if (_continued_stream && h.type != frame_type::continuation) {
+        throw connection_error(http2_error_code::protocol_error, "header block interrupted");
+    }
+    if (!_settings_received && h.type != frame_type::settings) {
+        throw connection_error(http2_error_code::protocol_error, "connection preface without SETTINGS");
+    }
+    switch (h.type) {
+    case frame_type::data:
+        return handle_data(h, std::move(payload));
+    case frame_type::headers:
+        return handle_headers(h, std::move(payload));
+    case frame_type::continuation:
+        return handle_continuation(h, std::move(payload));
+    case frame_type::settings:
+        return handle_settings(h, std::move(payload));
+    case frame_type::window_update:
+        return handle_window_update(h, std::move(payload));
+    case frame_type::rst_stream:
+        handle_rst_stream(h, std::move(payload));
+        return make_ready_future<>();
+    case frame_type::priority:
+        // streams are served in no particular order
+        if (!h.stream_id) {
+            throw connection_error(http2_error_code::protocol_error, "PRIORITY on stream 0");
+        }
+        if (h.length != 5) {
+            throw connection_error(http2_error_code::frame_size_error, "bad PRIORITY size");
+        }
+        return make_ready_future<>();
+    case frame_type::ping:
+        if (h.stream_id) {
+            throw connection_error(http2_error_code::protocol_error, "PING on a stream");
+        }
+        if (h.length != 8) {
+            throw connection_error(http2_error_code::frame_size_error, "bad PING size");
+        }
+        if (h.flags & flags::ack) {
+            return make_ready_future<>();
+        }
+        return do_with(std::move(payload), [this] (temporary_buffer<char>& payload) {
+            return write_frame(frame_type::ping, flags::ack, 0, payload.get(), payload.size());
+        });
+    case frame_type::goaway:
+        // the client opens no more streams, and closes the connection
+        // once it has the replies it wants
+        if (h.stream_id) {
+            throw connection_error(http2_error_code::protocol_error, "GOAWAY on a stream");
+        }
+        return make_ready_future<>();
+    case frame_type::push_promise:
+        throw connection_error(http2_error_code::protocol_error, "PUSH_PROMISE from a client");
+    default:
+        // extensions are ignored
+        return make_ready_future<>();
+    }
+}
+
+future<> http2_connection::handle_settings(const frame_header& h, temporary_buffer<char> payload) {
+    if (h.stream_id) {
+        throw connection_error(http2_error_code::protocol_error, "SETTINGS on a stream");
+    }
+    if (h.flags & flags::ack) {
+        if (h.length) {
+            throw connection_error(http2_error_code::frame_size_error, "SETTINGS ack with a payload");
+        }
+        return make_ready_future<>();
+    }
+    if (h.length % 6) {
+        throw connection_error(http2_error_code::frame_size_error, "bad SETTINGS size");
+    }
+    for (size_t pos = 0; pos < payload.size(); pos += 6) {
+        auto id = uint16_t(uint8_t(payload[pos]) << 8 | uint8_t(payload[pos + 1]));
+        auto value = read_be32(payload.get() + pos + 2);
+        switch (id) {
+        case setting::enable_push:
+            if (value > 1) {
+                throw connection_error(http2_error_code::protocol_error, "bad SETTINGS_ENABLE_PUSH");
+            }
+            break;
+        case setting::initial_window_size: {
+            if (value > max_window_size) {
+                throw connection_error(http2_error_code::flow_control_error, "bad SETTINGS_INITIAL_WINDOW_SIZE");
+            }
+            int64_t delta = int64_t(value) - _peer_initial_window;
+            for (auto&& s : _streams) {
+                s.second->send_window += delta;
+                if (s.second->send_window > max_window_size) {
+                    throw connection_error(http2_error_code::flow_control_error, "stream window overflow");
+                }
+            }
+            _peer_initial_window = value;
+            break;
+        }
+        case setting::max_frame_size:
+            if (value < 16384 || value > 16777215) {
+                throw connection_error(http2_error_code::protocol_error, "bad SETTINGS_MAX_FRAME_SIZE");
+            }
+            _peer_max_frame_size = value;
+            break;
+        default:
+            // SETTINGS_HEADER_TABLE_SIZE does not matter, as replies do
+            // not use the dynamic table; no streams are pushed
+            break;
+        }
+    }
+    _settings_received = true;
+    _window_available.broadcast();
+    return write_frame(frame_type::settings, flags::ack, 0, nullptr, 0);
+}
+
+future<> http2_connection::handle_window_update(const frame_header& h, temporary_buffer<char> payload) {
+    if (h.length != 4) {
+        throw connection_error(http2_error_code::frame_size_error, "bad WINDOW_UPDATE size");
+    }
+    auto increment = read_be32(payload.get()) & 0x7fffffff;
+    if (!h.stream_id) {
+        if (!increment) {
+            throw connection_error(http2_error_code::protocol_error, "empty WINDOW_UPDATE");
+        }
+        _send_window += increment;
+        if (_send_window > max_window_size) {
+            throw connection_error(http2_error_code::flow_control_error, "connection window overflow");
+        }
+        _window_available.broadcast();
+        return make_ready_future<>();
+    }
+    auto i = _streams.find(h.stream_id);
+    if (i == _streams.end()) {
+        if (h.stream_id > _last_stream_id) {
+            throw connection_error(http2_error_code::protocol_error, "WINDOW_UPDATE on an idle stream");
+        }
+        // the stream is closed already
+        return make_ready_future<>();
+    }
+    auto& s = *i->second;
+    if (!increment) {
+        return reset_stream(h.stream_id, http2_error_code::protocol_error);
+    }
+    s.send_window += increment;
+    if (s.send_window > max_window_size) {
+        return reset_stream(h.stream_id, http2_error_code::flow_control_error);
+    }
+    _window_available.broadcast();
+    return make_ready_future<>();
+}
+
+void http2_connection::handle_rst_stream(const frame_header& h, temporary_buffer<char> payload) {
+    if (!h.stream_id || h.stream_id > _last_stream_id) {
+        throw connection_error(http2_error_code::protocol_error, "RST_STREAM on an idle stream");
+    }
+    if (h.length != 4) {
+        throw connection_error(http2_error_code::frame_size_error, "bad RST_STREAM size");
+    }
+    auto i = _streams.find(h.stream_id);
+    if (i != _streams.end()) {
+        auto s = i->second;
+        s->reset = true;
+        s->wake();
+        close_stream(s);
+        _window_available.broadcast();
+    }
+}
+
+future<> http2_connection::handle_data(const frame_header& h, temporary_buffer<char> payload) {
+    if (!h.stream_id) {
+        throw connection_error(http2_error_code::protocol_error, "DATA on stream 0");
+    }
+    if (h.stream_id > _last_stream_id) {
+        throw connection_error(http2_error_code::protocol_error, "DATA on an idle stream");
+    }
+    // padding counts in the windows too
+    if (h.length > _recv_window) {
+        throw connection_error(http2_error_code::flow_control_error, "connection window exceeded");
+    }
+    _recv_window -= h.length;
+    strip_padding(h.flags, payload);
+    auto i = _streams.find(h.stream_id);
+    if (i == _streams.end() || !i->second->remote_open) {
+        // for a stream that was reset, or whose reply is sent
+        return consumed(nullptr, h.length).then([this, h, closed = i != _streams.end()] {
+            return closed ? reset_stream(h.stream_id, http2_error_code::stream_closed) : make_ready_future<>();
+        });
+    }
+    auto s = i->second;
+    if (h.length > s->recv_window) {
+        return consumed(nullptr, h.length).then([this, h] {
+            return reset_stream(h.stream_id, http2_error_code::flow_control_error);
+        });
+    }
+    s->recv_window -= h.length;
+    // what the handler does not read is given back at once
+    size_t credit = h.length - payload.size();
+    if (s->buffer_body) {
+        credit = h.length;
+    } else {
+        s->unread += payload.size();
+    }
+    if (!payload.empty()) {
+        s->body.push_back(std::move(payload));
+        s->wake();
+    }
+    if (h.flags & flags::end_stream) {
+        end_remote(s);
+    }
+    return consumed(s.get(), credit);
+}
+
+future<> http2_connection::handle_headers(const frame_header& h, temporary_buffer<char> payload) {
+    if (!h.stream_id) {
+        throw connection_error(http2_error_code::protocol_error, "HEADERS on stream 0");
+    }
+    strip_padding(h.flags, payload);
+    if (h.flags & flags::priority) {
+        if (payload.size() < 5) {
+            throw connection_error(http2_error_code::frame_size_error, "bad HEADERS size");
+        }
+        payload.trim_front(5);
+    }
+    _continued_stream = h.stream_id;
+    _header_flags = h.flags;
+    _header_block.assign(payload.begin(), payload.end());
+    if (h.flags & flags::end_headers) {
+        return end_headers();
+    }
+    return make_ready_future<>();
+}
+
+future<> http2_connection::handle_continuation(const frame_header& h, temporary_buffer<char> payload) {
+    if (!_continued_stream || h.stream_id != _continued_stream) {
+        throw connection_error(http2_error_code::protocol_error, "unexpected CONTINUATION");
+    }
+    if (_header_block.size() + payload.size() > max_header_block_size) {
+        throw connection_error(http2_error_code::enhance_your_calm, "header block too large");
+    }
+    _header_block.insert(_header_block.end(), payload.begin(), payload.end());
+    if (h.flags & flags::end_headers) {
+        return end_headers();
+    }
+    return make_ready_future<>();
+}
+
+future<> http2_connection::end_headers() {
+    auto id = _continued_stream;
+    _continued_stream = 0;
+    // decoded even if the stream is refused, to keep the table in step
+    auto fields = _decoder.decode(_header_block.data(), _header_block.size());
+    _header_block.clear();
+    bool end_stream = _header_flags & flags::end_stream;
+    auto i = _streams.find(id);
+    if (i != _streams.end()) {
+        // trailers, which are ignored
+        auto s = i->second;
+        if (!s->remote_open) {
+            return reset_stream(id, http2_error_code::stream_closed);
+        }
+        if (!end_stream) {
+            return reset_stream(id, http2_error_code::protocol_error);
+        }
+        end_remote(s);
+        return make_ready_future<>();
+    }
+    if (id % 2 == 0 || id <= _last_stream_id) {
+        throw connection_error(http2_error_code::protocol_error, "bad stream id");
+    }
+    _last_stream_id = id;
+    if (_streams.size() >= _cfg.max_concurrent_streams) {
+        return reset_stream(id, http2_error_code::refused_stream);
+    }
+    std::unique_ptr<request> req;
+    try {
+        req = make_request(std::move(fields));
+    } catch (std::exception&) {
+        return reset_stream(id, http2_error_code::protocol_error);
+    }
+    // the client uses the default window until it has our SETTINGS
+    auto s = make_lw_shared<http2_stream>(id, _peer_initial_window,
+            std::max(_cfg.stream_window_size, default_window_size));
+    _streams.emplace(id, s);
+    if (end_stream) {
+        s->remote_open = false;
+        dispatch(s, std::move(req));
+    } else if (req->content_length) {
+        dispatch(s, std::move(req));
+    } else {
+        s->buffer_body = true;
+        s->req = std::move(req);
+    }
+    return make_ready_future<>();
+}
+
+std::unique_ptr<request> http2_connection::make_request(std::vector<header_field> fields) {
+    auto req = std::make_unique<request>();
+    sstring authority;
+    for (auto&& f : fields) {
+        if (f.name.empty()) {
+            throw std::invalid_argument("empty header name");
+        }
+        if (f.name[0] == ':') {
+            if (f.name == ":method") {
+                req->_method = std::move(f.value);
+            } else if (f.name == ":path") {
+                req->_url = std::move(f.value);
+            } else if (f.name == ":authority") {
+                authority = std::move(f.value);
+            } else if (f.name == ":scheme") {
+                req->protocol_name = std::move(f.value);
+            } else {
+                throw std::invalid_argument("unknown pseudo-header");
+            }
+            continue;
+        }
+        auto name = canonical_header_name(f.name);
+        auto h = req->_headers.find(name);
+        if (h == req->_headers.end()) {
+            req->_headers.emplace(std::move(name), std::move(f.value));
+        } else {
+            // cookies may be split over several fields
+            h->second += (name == "Cookie" ? "; " : ", ") + f.value;
+        }
+    }
+    if (req->_method.empty() || req->_url.empty()) {
+        throw std::invalid_argument("missing pseudo-header");
+    }
+    if (!authority.empty() && !req->_headers.count("Host")) {
+        req->_headers["Host"] = std::move(authority);
+    }
+    req->_version = "2.0";
+    req->http_version_major = 2;
+    req->http_version_minor = 0;
+    auto length = req->_headers.find("Content-Length");
+    if (length != req->_headers.end()) {
+        req->content_length = std::stoull(length->second);
+    }
+    req->connection_ptr = &_conn;
+    return req;
+}
+
+void http2_connection::end_remote(lw_shared_ptr<http2_stream> s) {
+    s->remote_open = false;
+    s->wake();
+    if (s->req) {
+        auto req = std::move(s->req);
+        for (auto&& buf : s->body) {
+            req->content_length += buf.size();
+        }
+        dispatch(s, std::move(req));
+    }
+}
+
+void http2_connection::dispatch(lw_shared_ptr<http2_stream> s, std::unique_ptr<request> req) {
+    ++_server._requests_served;
+    if (req->content_length) {
+        req->content_stream = input_stream<char>(data_source(std::make_unique<http2_body_source_impl>(*this, s)));
+    }
+    auto url = connection::set_query_param(*req);
+    auto encoding = _server._compression ? accepted_encoding(*req) : content_encoding::identity;
+    // The stream is served in the background, the connection staying
+    // until it is done
+    with_gate(_streams_gate, [this, s, url = std::move(url), req = std::move(req), encoding] () mutable {
+        return _server._routes.handle(url, std::move(req), std::make_unique<reply>()).then(
+                [this, s, encoding] (std::unique_ptr<reply> rep) {
+            rep->set_version("2.0").done();
+            if (encoding != content_encoding::identity) {
+                connection::compress_reply(*rep, encoding, *_server._compression);
+            }
+            return send_reply(s, std::move(rep));
+        }).then_wrapped([this, s] (future<> f) {
+            bool failed = f.failed();
+            f.ignore_ready_future();
+            if (s->reset) {
+                close_stream(s);
+                return make_ready_future<>();
+            }
+            if (failed) {
+                ++_server._respond_errors;
+                return reset_stream(s->id, http2_error_code::internal_error).handle_exception([] (std::exception_ptr) {});
+            }
+            if (s->remote_open) {
+                // the reply is complete: the rest of the request is not
+                // needed
+                return reset_stream(s->id, http2_error_code::no_error).handle_exception([] (std::exception_ptr) {});
+            }
+            close_stream(s);
+            return make_ready_future<>();
+        });
+    });
+}
+
+future<> http2_connection::send_reply(lw_shared_ptr<http2_stream> s, std::unique_ptr<reply> rep) {
+    std::vector<char> block;
+    hpack_encode(block, ":status", to_sstring(static_cast<int>(rep->_status)));
+    hpack_encode(block, "server", "Seastar httpd");
+    hpack_encode(block, "date", _server._date);
+    auto encode_header = [&block] (const std::pair<const sstring, sstring>& h) {
+        auto name = lowercase(h.first);
+        if (!connection_specific(name) && name != "server" && name != "date" && name != "content-length") {
+            hpack_encode(block, name, h.second);
+        }
+    };
+    for (auto&& h : rep->_headers) {
+        if (!rep->_prepared || !rep->_prepared->_headers.count(h.first)) {
+            encode_header(h);
+        }
+    }
+    if (rep->_prepared) {
+        for (auto&& h : rep->_prepared->_headers) {
+            encode_header(h);
+        }
+    }
+    auto& content = rep->_prepared ? rep->_prepared->_content : rep->_content;
+    if (!rep->_body_writer) {
+        hpack_encode(block, "content-length", to_sstring(content.size()));
+    }
+    bool has_body = rep->_body_writer || !content.empty();
+    return write_headers(s, std::move(block), !has_body).then([this, s, rep = std::move(rep), has_body] () mutable {
+        if (!has_body) {
+            return make_ready_future<>();
+        }
+        if (rep->_body_writer) {
+            auto writer = std::move(rep->_body_writer);
+            auto out = output_stream<char>(data_sink(std::make_unique<http2_body_sink_impl>(*this, s)),
+                    _peer_max_frame_size, true);
+            return writer(std::move(out)).then([this, s] {
+                return write_data(s, nullptr, 0, true);
+            });
+        }
+        return do_with(std::move(rep), [this, s] (std::unique_ptr<reply>& rep) {
+            auto& content = rep->_prepared ? rep->_prepared->_content : rep->_content;
+            return write_data(s, content.begin(), content.size(), true);
+        });
+    });
+}
+
+future<> http2_connection::reset_stream(uint32_t id, http2_error_code code) {
+    auto i = _streams.find(id);
+    if (i != _streams.end()) {
+        auto s = i->second;
+        s->reset = true;
+        s->wake();
+        close_stream(s);
+        _window_available.broadcast();
+    }
+    return with_semaphore(_write_sem, 1, [this, f = rst_stream(id, code)] {
+        return _out.write(f).then([this] {
+            return _out.flush();
+        });
+    });
+}
+
+void http2_connection::close_stream(lw_shared_ptr<http2_stream> s) {
+    auto i = _streams.find(s->id);
+    if (i == _streams.end() || i->second != s) {
+        return;
+    }
+    _streams.erase(i);
+    // the unread body is not coming back from the handler
+    if (s->unread) {
+        _unacked += s->unread;
+        s->unread = 0;
+    }
+}
+
+future<> http2_connection::consumed(http2_stream* s, size_t n) {
+    sstring updates;
+    _unacked += n;
+    if (_unacked >= _cfg.connection_window_size / 2) {
+        updates += window_update(0, _unacked);
+        _recv_window += _unacked;
+        _unacked = 0;
+    }
+    if (s && s->remote_open && !s->reset) {
+        s->unacked += n;
+        if (s->unacked >= _cfg.stream_window_size / 2) {
+            updates += window_update(s->id, s->unacked);
+            s->recv_window += s->unacked;
+            s->unacked = 0;
+        }
+    }
+    if (updates.empty()) {
+        return make_ready_future<>();
+    }
+    return with_semaphore(_write_sem, 1, [this, updates = std::move(updates)] {
+        return _out.write(updates).then([this] {
+            return _out.flush();
+        });
+    });
+}
+
+future<> http2_connection::write_frame(uint8_t type, uint8_t frame_flags, uint32_t stream_id, const char* data, size_t size) {
+    return with_semaphore(_write_sem, 1, [this, head = frame_head(type, frame_flags, stream_id, size), data, size] {
+        return _out.write(head).then([this, data, size] {
+            return _out.write(data, size);
+        }).then([this] {
+            return _out.flush();
+        });
+    });
+}
+
+future<> http2_connection::write_headers(lw_shared_ptr<http2_stream> s, std::vector<char> block, bool end_stream) {
+    if (s->reset) {
+        return make_exception_future<>(stream_reset_error());
+    }
+    // a HEADERS frame, then CONTINUATION frames, back to back
+    sstring frames;
+    size_t pos = 0;
+    do {
+        auto n = std::min<size_t>(block.size() - pos, _peer_max_frame_size);
+        uint8_t frame_flags = pos + n == block.size() ? flags::end_headers : 0;
+        if (!pos) {
+            frame_flags |= end_stream ? flags::end_stream : 0;
+        }
+        frames += frame_head(pos ? frame_type::continuation : frame_type::headers, frame_flags, s->id, n);
+        frames.append(block.data() + pos, n);
+        pos += n;
+    } while (pos < block.size());
+    if (end_stream) {
+        s->local_open = false;
+    }
+    return with_semaphore(_write_sem, 1, [this, frames = std::move(frames)] {
+        return _out.write(frames).then([this] {
+            return _out.flush();
+        });
+    });
+}
+
+future<> http2_connection::write_data(lw_shared_ptr<http2_stream> s, const char* data, size_t size, bool end_stream) {
+    if (!size) {
+        if (!end_stream) {
+            return make_ready_future<>();
+        }
+        s->local_open = false;
+        return write_frame(frame_type::data, flags::end_stream, s->id, nullptr, 0);
+    }
+    return _window_available.wait([this, s] {
+        return s->reset || (_send_window > 0 && s->send_window > 0);
+    }).then([this, s, data, size, end_stream] {
+        if (s->reset) {
+            return make_exception_future<>(stream_reset_error());
+        }
+        auto n = size_t(std::min({int64_t(size), _send_window, s->send_window, int64_t(_peer_max_frame_size)}));
+        _send_window -= n;
+        s->send_window -= n;
+        bool last = n == size;
+        if (last && end_stream) {
+            s->local_open = false;
+        }
+        return write_frame(frame_type::data, last && end_stream ? flags::end_stream : 0, s->id, data, n).then(
+                [this, s, data, size, end_stream, n, last] {
+            return last ? make_ready_future<>() : write_data(s, data + n, size - n, end_stream);
+        });
+    });
+}
+
+}
+
+}
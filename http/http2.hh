@@ -0,0 +1,188 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <experimental/optional>
+#include "core/circular_buffer.hh"
+#include "core/condition-variable.hh"
+#include "core/gate.hh"
+#include "core/iostream.hh"
+#include "core/semaphore.hh"
+#include "core/shared_ptr.hh"
+#include "http/hpack.hh"
+
+namespace seastar {
+
+namespace httpd {
+
+class connection;
+class http_server;
+struct request;
+struct reply;
+
+/**
+ * Settings of the HTTP/2 connections of an http_server
+ */
+struct http2_config {
+    /**
+     * How many requests a client may have in flight on a connection
+     */
+    uint32_t max_concurrent_streams = 100;
+    /**
+     * How much of a request body a client may send ahead of its handler
+     * reading it, in bytes
+     */
+    uint32_t stream_window_size = 65535;
+    /**
+     * How much of the bodies of all its requests a client may send ahead
+     * of their handlers reading them, in bytes
+     */
+    uint32_t connection_window_size = 1024 * 1024;
+};
+
+/**
+ * The error codes of RFC 7540, section 7
+ */
+enum class http2_error_code : uint32_t {
+    no_error = 0x0,
+    protocol_error = 0x1,
+    internal_error = 0x2,
+    flow_control_error = 0x3,
+    settings_timeout = 0x4,
+    stream_closed = 0x5,
+    frame_size_error = 0x6,
+    refused_stream = 0x7,
+    cancel = 0x8,
+    compression_error = 0x9,
+    connect_error = 0xa,
+    enhance_your_calm = 0xb,
+    inadequate_security = 0xc,
+    http_1_1_required = 0xd,
+};
+
+// A request of an HTTP/2 connection, and its reply
+struct http2_stream {
+    uint32_t id;
+    // the client may send more of the request
+    bool remote_open = true;
+    // the reply is not all sent
+    bool local_open = true;
+    bool reset = false;
+    int64_t send_window;
+    int64_t recv_window;
+    // read by the handler, not yet given back to the stream's window
+    uint32_t unacked = 0;
+    // A request without a Content-Length is dispatched once its body is
+    // all received (and "read" as it arrives), so that its length is known
+    bool buffer_body = false;
+    std::unique_ptr<request> req;
+    // the body received and not read by the handler
+    circular_buffer<temporary_buffer<char>> body;
+    size_t unread = 0;
+    std::experimental::optional<promise<>> body_waiter;
+    http2_stream(uint32_t id, int64_t send_window, int64_t recv_window);
+    ~http2_stream();
+    void wake();
+};
+
+/**
+ * Serves the HTTP/2 (RFC 7540) requests of a connection.
+ *
+ * Each stream is dispatched to the server's routes as a request of its
+ * own, as soon as its headers arrive, and its reply is sent as soon as
+ * its handler completes, whatever the other streams do. Request
+ * headers are given to handlers with the capitalization HTTP/1 clients
+ * usually send ("Content-Type"). Replies are flow controlled per stream
+ * and for the connection, and request bodies are given back to the
+ * client's windows as the handlers read them.
+ */
+class http2_connection {
+    struct frame_header {
+        uint32_t length;
+        uint8_t type;
+        uint8_t flags;
+        uint32_t stream_id;
+    };
+    connection& _conn;
+    http_server& _server;
+    input_stream<char>& _in;
+    output_stream<char>& _out;
+    http2_config _cfg;
+    hpack_decoder _decoder;
+    std::unordered_map<uint32_t, lw_shared_ptr<http2_stream>> _streams;
+    uint32_t _last_stream_id = 0;
+    // the stream whose header block is continued, and the block so far
+    uint32_t _continued_stream = 0;
+    uint8_t _header_flags = 0;
+    std::vector<char> _header_block;
+    bool _settings_received = false;
+    uint32_t _peer_initial_window = 65535;
+    uint32_t _peer_max_frame_size = 16384;
+    int64_t _send_window = 65535;
+    int64_t _recv_window = 65535;
+    uint32_t _unacked = 0;
+    semaphore _write_sem = { 1 };
+    // signalled when windows open, or streams are reset
+    condition_variable _window_available;
+    gate _streams_gate;
+private:
+    future<> read_frames();
+    future<> handle_frame(const frame_header& h, temporary_buffer<char> payload);
+    future<> handle_data(const frame_header& h, temporary_buffer<char> payload);
+    future<> handle_headers(const frame_header& h, temporary_buffer<char> payload);
+    future<> handle_continuation(const frame_header& h, temporary_buffer<char> payload);
+    future<> handle_settings(const frame_header& h, temporary_buffer<char> payload);
+    future<> handle_window_update(const frame_header& h, temporary_buffer<char> payload);
+    void handle_rst_stream(const frame_header& h, temporary_buffer<char> payload);
+    future<> end_headers();
+    void end_remote(lw_shared_ptr<http2_stream> s);
+    std::unique_ptr<request> make_request(std::vector<header_field> fields);
+    void dispatch(lw_shared_ptr<http2_stream> s, std::unique_ptr<request> req);
+    future<> send_reply(lw_shared_ptr<http2_stream> s, std::unique_ptr<reply> rep);
+    future<> reset_stream(uint32_t id, http2_error_code code);
+    void close_stream(lw_shared_ptr<http2_stream> s);
+    // Gives n bytes read of the bodies back to the windows of the
+    // connection and, if s is given, of the stream
+    future<> consumed(http2_stream* s, size_t n);
+    future<> write_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const char* data, size_t size);
+    future<> write_headers(lw_shared_ptr<http2_stream> s, std::vector<char> block, bool end_stream);
+    future<> write_data(lw_shared_ptr<http2_stream> s, const char* data, size_t size, bool end_stream);
+    friend class http2_body_source_impl;
+    friend class http2_body_sink_impl;
+public:
+    http2_connection(connection& conn, http_server& server, input_stream<char>& in, output_stream<char>& out,
+            const http2_config& cfg);
+    ~http2_connection();
+    /**
+     * Serves the connection, from the client's connection preface, of
+     * which the caller may have read the first preface_read bytes,
+     * until it closes; then closes the streams
+     */
+    future<> process(size_t preface_read = 0);
+};
+
+}
+
+}
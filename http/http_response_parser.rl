@@ -27,6 +27,7 @@ namespace seastar {
 
 struct http_response {
     sstring _version;
+    int _status = 0;
     std::unordered_map<sstring, sstring> _headers;
 };
 
@@ -44,6 +45,10 @@ action store_version {
     _rsp->_version = str();
 }
 
+action store_status {
+    _rsp->_status = std::stoi(str());
+}
+
 action store_field_name {
     _field_name = str();
 }
@@ -80,7 +85,8 @@ http_version = 'HTTP/' (digit '.' digit) >mark %store_version;
 
 field = tchar+ >mark %store_field_name;
 value = any* >mark %store_value;
-start_line = http_version space digit digit digit space (any - cr - lf)* crlf;
+status_code = (digit digit digit) >mark %store_status;
+start_line = http_version space status_code space (any - cr - lf)* crlf;
 header_1st = (field sp_ht* ':' value :> crlf) %assign_field;
 header_cont = (sp_ht+ value sp_ht* crlf) %extend_field;
 header = header_1st header_cont*;
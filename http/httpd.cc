@@ -43,6 +43,51 @@ using namespace std::chrono_literals;
 namespace seastar {
 
 namespace httpd {
+
+// The part of a request body the handler did not read yet; finished once
+// the handler read it all, or is done with the body
+struct request_content {
+    size_t remaining;
+    bool finished = false;
+    promise<> done;
+    explicit request_content(size_t length) : remaining(length) {
+    }
+    void finish() {
+        if (!finished) {
+            finished = true;
+            done.set_value();
+        }
+    }
+};
+
+// A request body: up to its length of the connection's input
+class request_content_source_impl : public data_source_impl {
+    input_stream<char>& _in;
+    lw_shared_ptr<request_content> _content;
+public:
+    request_content_source_impl(input_stream<char>& in, lw_shared_ptr<request_content> content)
+            : _in(in), _content(std::move(content)) {
+    }
+    virtual ~request_content_source_impl() {
+        _content->finish();
+    }
+    virtual future<temporary_buffer<char>> get() override {
+        if (_content->finished || !_content->remaining) {
+            _content->finish();
+            return make_ready_future<temporary_buffer<char>>();
+        }
+        return _in.read_up_to(_content->remaining).then([content = _content] (temporary_buffer<char> buf) {
+            // an early eof cuts the body short
+            content->remaining = buf.empty() ? 0 : content->remaining - buf.size();
+            return buf;
+        });
+    }
+    virtual future<> close() override {
+        _content->finish();
+        return make_ready_future<>();
+    }
+};
+
 http_stats::http_stats(http_server& server, const sstring& name)
  {
     namespace sm = seastar::metrics;
@@ -65,7 +110,17 @@ sstring http_server_control::generate_server_name() {
 
 future<> connection::do_response_loop() {
     return _replies.pop_eventually().then(
-        [this] (std::unique_ptr<reply> resp) {
+        [] (future<std::unique_ptr<reply>> resp) {
+            return resp;
+        }).then_wrapped([this] (future<std::unique_ptr<reply>> f) {
+            if (f.failed()) {
+                // no reply to send in this one's place: give up on the
+                // connection, and unblock reading
+                _done = true;
+                _replies.abort(f.get_exception());
+                return make_exception_future<>(std::logic_error("Failed to generate a reply"));
+            }
+            auto resp = std::get<0>(f.get());
             if (!resp) {
                 // eof
                 return make_ready_future<>();
@@ -85,7 +140,7 @@ future<> connection::start_response() {
                 _server._respond_errors++;
                 _done = true;
                 _replies.abort(std::make_exception_ptr(std::logic_error("Unknown exception during body creation")));
-                _replies.push(std::unique_ptr<reply>());
+                _replies.push(make_ready_future<std::unique_ptr<reply>>());
                 f.ignore_ready_future();
                 return make_ready_future<>();
             }
@@ -97,7 +152,7 @@ future<> connection::start_response() {
                 // we should close it, so the client will disconnect
                 _done = true;
                 _replies.abort(std::make_exception_ptr(std::logic_error("Unknown exception during body creation")));
-                _replies.push(std::unique_ptr<reply>());
+                _replies.push(make_ready_future<std::unique_ptr<reply>>());
                 f.ignore_ready_future();
                 return make_ready_future<>();
             } else {
@@ -108,30 +163,97 @@ future<> connection::start_response() {
                 // flush failed. just close the connection
                 _done = true;
                 _replies.abort(std::make_exception_ptr(std::logic_error("Unknown exception during body creation")));
-                _replies.push(std::unique_ptr<reply>());
+                _replies.push(make_ready_future<std::unique_ptr<reply>>());
                 f.ignore_ready_future();
             }
-            _resp.reset();
+            recycle_reply();
             return make_ready_future<>();
         });
     }
-    set_headers(*_resp);
-    _resp->_headers["Content-Length"] = to_sstring(
-            _resp->_content.size());
-    return _write_buf.write(_resp->_response_line.begin(),
-            _resp->_response_line.size()).then([this] {
-        return _resp->write_reply_headers(*this);
-    }).then([this] {
-        return _write_buf.write("\r\n", 2);
-    }).then([this] {
-        return write_body();
+    if (_resp->_prepared) {
+        auto head = _resp->serialize_head(_server._common_headers, {}, false);
+        return _write_buf.write(head.get(), head.size()).then([this] {
+            auto& serialized = _resp->_prepared->_serialized;
+            return _write_buf.write(serialized.get(), serialized.size());
+        }).then([this] {
+            return _write_buf.flush();
+        }).then([this] {
+            recycle_reply();
+        });
+    }
+    auto head = _resp->serialize_head(_server._common_headers, _resp->_content.size());
+    return _write_buf.write(head.get(), head.size()).then([this] {
+        return _write_buf.write(_resp->_content.begin(), _resp->_content.size());
     }).then([this] {
         return _write_buf.flush();
     }).then([this] {
-        _resp.reset();
+        recycle_reply();
+    });
+}
+
+std::unique_ptr<reply> connection::make_reply() {
+    if (_free_replies.empty()) {
+        return std::make_unique<reply>();
+    }
+    auto rep = std::move(_free_replies.back());
+    _free_replies.pop_back();
+    return rep;
+}
+
+void connection::recycle_reply() {
+    if (_free_replies.size() < _server._pipeline_depth) {
+        _resp->reset();
+        _free_replies.push_back(std::move(_resp));
+    }
+    _resp.reset();
+}
+
+connection::connection(http_server& server, connected_socket&& fd,
+        socket_address addr, bool tls)
+        : _server(server), _fd(std::move(fd)), _read_buf(_fd.input()), _write_buf(
+                _fd.output()), _replies(server._pipeline_depth), _tls(tls) {
+    on_new_connection();
+}
+
+future<> connection::process() {
+    if (_tls && _server._http2) {
+        return tls::get_alpn_protocol(_fd).then_wrapped([this] (future<sstring> f) {
+            if (f.failed()) {
+                // the handshake failed
+                f.ignore_ready_future();
+                ++_server._read_errors;
+                return make_ready_future<>();
+            }
+            if (f.get0() == "h2") {
+                return serve_http2(0);
+            }
+            return process_http1();
+        });
+    }
+    return process_http1();
+}
+
+future<> connection::process_http1() {
+    // Launch read and write "threads" simultaneously:
+    return when_all(read(), respond()).then(
+            [this] (std::tuple<future<>, future<>> joined) {
+        // FIXME: notify any exceptions in joined?
+        std::get<0>(joined).ignore_ready_future();
+        std::get<1>(joined).ignore_ready_future();
+        if (_switch_to_http2) {
+            // the HTTP/1 parser read the start of the preface
+            return serve_http2(sizeof("PRI * HTTP/2.0\r\n\r\n") - 1);
+        }
+        return make_ready_future<>();
     });
 }
 
+future<> connection::serve_http2(size_t preface_read) {
+    auto h2 = std::make_unique<http2_connection>(*this, _server, _read_buf, _write_buf, *_server._http2);
+    auto& c = *h2;
+    return c.process(preface_read).finally([h2 = std::move(h2)] {});
+}
+
 connection::~connection() {
     --_server._current_connections;
     _server._connections.erase(_server._connections.iterator_to(*this));
@@ -153,25 +275,47 @@ future<> connection::read() {
             _server._read_errors++;
         }
         f.ignore_ready_future();
-        return _replies.push_eventually( {});
+        return _replies.push_eventually(make_ready_future<std::unique_ptr<reply>>());
     }).finally([this] {
-        return _read_buf.close();
+        return _switch_to_http2 ? make_ready_future<>() : _read_buf.close();
     });
 }
 future<> connection::read_one() {
-    _parser.init();
+    _parser.init(_server._header_views);
     return _read_buf.consume(_parser).then([this] () mutable {
         if (_parser.eof()) {
             _done = true;
             return make_ready_future<>();
         }
-        ++_server._requests_served;
         std::unique_ptr<httpd::request> req = _parser.get_parsed_request();
+        if (_server._http2 && req->_method == "PRI" && req->_url == "*" && req->_version == "2.0") {
+            _switch_to_http2 = true;
+            _done = true;
+            return make_ready_future<>();
+        }
+        ++_server._requests_served;
+        lw_shared_ptr<request_content> content;
+        auto length = req->header("Content-Length");
+        if (!length.empty()) {
+            req->content_length = std::stoull(std::string(length.data(), length.size()));
+        }
+        if (req->content_length) {
+            content = make_lw_shared<request_content>(req->content_length);
+            req->content_stream = input_stream<char>(data_source(
+                    std::make_unique<request_content_source_impl>(_read_buf, content)));
+        }
 
         return _replies.not_full().then([req = std::move(req), this] () mutable {
             return generate_reply(std::move(req));
-        }).then([this](bool done) {
+        }).then([this, content](bool done) {
             _done = done;
+            if (!content) {
+                return make_ready_future<>();
+            }
+            // the next request starts after the body
+            return content->done.get_future().then([this, content] {
+                return _read_buf.skip(content->remaining);
+            });
         });
     });
 }
@@ -183,31 +327,45 @@ future<> connection::respond() {
             _server._respond_errors++;
         }
         f.ignore_ready_future();
-        return _write_buf.close();
+        return _switch_to_http2 ? make_ready_future<>() : _write_buf.close();
     });
 }
 
-future<> connection::write_body() {
-    return _write_buf.write(_resp->_content.begin(),
-            _resp->_content.size());
+void connection::compress_reply(reply& rep, content_encoding enc, const compression_config& cfg) {
+    if (rep._status == reply::status_type::no_content || rep._status == reply::status_type::not_modified
+            || rep._headers.count("Content-Encoding")) {
+        return;
+    }
+    auto type = rep._headers.find("Content-Type");
+    if (type == rep._headers.end() || !compressible_mime_type(type->second)) {
+        return;
+    }
+    if (rep._body_writer) {
+        rep._body_writer = [enc, level = cfg.level, writer = std::move(rep._body_writer)] (output_stream<char>&& out) {
+            return writer(make_compressed_output_stream(std::move(out), enc, level));
+        };
+    } else if (rep._content.size() >= cfg.min_size) {
+        rep._content = compress(rep._content, enc, cfg.level);
+    } else {
+        return;
+    }
+    rep._headers["Content-Encoding"] = encoding_name(enc);
+    rep._headers["Vary"] = "Accept-Encoding";
 }
 
-void connection::set_headers(reply& resp) {
-    resp._headers["Server"] = "Seastar httpd";
-    resp._headers["Date"] = _server._date;
+const sstring& connection::common_headers() const {
+    return _server._common_headers;
 }
 
 future<bool> connection::generate_reply(std::unique_ptr<request> req) {
-    auto resp = std::make_unique<reply>();
+    auto resp = make_reply();
     bool conn_keep_alive = false;
     bool conn_close = false;
-    auto it = req->_headers.find("Connection");
-    if (it != req->_headers.end()) {
-        if (it->second == "Keep-Alive") {
-            conn_keep_alive = true;
-        } else if (it->second == "Close") {
-            conn_close = true;
-        }
+    auto conn_header = req->header("Connection");
+    if (conn_header == "Keep-Alive") {
+        conn_keep_alive = true;
+    } else if (conn_header == "Close") {
+        conn_close = true;
     }
     bool should_close;
     // TODO: Handle HTTP/2.0 when it releases
@@ -226,15 +384,19 @@ future<bool> connection::generate_reply(std::unique_ptr<request> req) {
     }
     sstring url = set_query_param(*req.get());
     sstring version = req->_version;
-    set_headers(*resp);
     resp->set_version(version);
-    return _server._routes.handle(url, std::move(req), std::move(resp)).
-    // Caller guarantees enough room
-    then([this, should_close, version = std::move(version)](std::unique_ptr<reply> rep) {
+    auto encoding = _server._compression ? accepted_encoding(*req) : content_encoding::identity;
+    // The handler runs while the following requests are read, and the
+    // caller guarantees room for its reply
+    _replies.push(_server._routes.handle(url, std::move(req), std::move(resp)).
+    then([this, version = std::move(version), encoding](std::unique_ptr<reply> rep) {
         rep->set_version(version).done();
-        this->_replies.push(std::move(rep));
-        return make_ready_future<bool>(should_close);
-    });
+        if (encoding != content_encoding::identity) {
+            compress_reply(*rep, encoding, *_server._compression);
+        }
+        return rep;
+    }));
+    return make_ready_future<bool>(should_close);
 }
 }
 
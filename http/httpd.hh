@@ -43,6 +43,9 @@
 #include <vector>
 #include <boost/intrusive/list.hpp>
 #include "http/routes.hh"
+#include "http/transformers.hh"
+#include "http/http2.hh"
+#include "net/tls.hh"
 
 namespace seastar {
 
@@ -70,29 +73,29 @@ class connection : public boost::intrusive::list_base_hook<> {
     http_request_parser _parser;
     std::unique_ptr<request> _req;
     std::unique_ptr<reply> _resp;
-    // null element marks eof
-    queue<std::unique_ptr<reply>> _replies { 10 };
+    // Replies of the requests being handled, in request order; at most
+    // the server's pipeline depth of them. A null reply marks eof
+    queue<future<std::unique_ptr<reply>>> _replies;
+    // Replies sent, kept for the next requests, at most the pipeline
+    // depth of them
+    std::vector<std::unique_ptr<reply>> _free_replies;
     bool _done = false;
+    bool _tls;
+    // The client sent the HTTP/2 connection preface: the connection is
+    // handed to an http2_connection once the replies before it are sent
+    bool _switch_to_http2 = false;
+private:
+    future<> process_http1();
+    future<> serve_http2(size_t preface_read);
+    std::unique_ptr<reply> make_reply();
+    void recycle_reply();
 public:
     connection(http_server& server, connected_socket&& fd,
-            socket_address addr)
-            : _server(server), _fd(std::move(fd)), _read_buf(_fd.input()), _write_buf(
-                    _fd.output()) {
-        on_new_connection();
-    }
+            socket_address addr, bool tls = false);
     ~connection();
     void on_new_connection();
 
-    future<> process() {
-        // Launch read and write "threads" simultaneously:
-        return when_all(read(), respond()).then(
-                [] (std::tuple<future<>, future<>> joined) {
-            // FIXME: notify any exceptions in joined?
-            std::get<0>(joined).ignore_ready_future();
-            std::get<1>(joined).ignore_ready_future();
-            return make_ready_future<>();
-        });
-    }
+    future<> process();
     void shutdown() {
         _fd.shutdown_input();
         _fd.shutdown_output();
@@ -102,25 +105,10 @@ class connection : public boost::intrusive::list_base_hook<> {
     future<> respond();
     future<> do_response_loop();
 
-    void set_headers(reply& resp);
+    // The Server and Date headers, serialized
+    const sstring& common_headers() const;
 
     future<> start_response();
-    future<> write_reply_headers(
-            std::unordered_map<sstring, sstring>::iterator hi) {
-        if (hi == _resp->_headers.end()) {
-            return make_ready_future<>();
-        }
-        return _write_buf.write(hi->first.begin(), hi->first.size()).then(
-                [this] {
-                    return _write_buf.write(": ", 2);
-                }).then([hi, this] {
-            return _write_buf.write(hi->second.begin(), hi->second.size());
-        }).then([this] {
-            return _write_buf.write("\r\n", 2);
-        }).then([hi, this] () mutable {
-            return write_reply_headers(++hi);
-        });
-    }
 
     static short hex_to_byte(char c) {
         if (c >='a' && c <= 'z') {
@@ -208,7 +196,8 @@ class connection : public boost::intrusive::list_base_hook<> {
 
     future<bool> generate_reply(std::unique_ptr<request> req);
 
-    future<> write_body();
+    // Compresses the reply with the coding, if it is worth it
+    static void compress_reply(reply& rep, content_encoding enc, const compression_config& cfg);
 
     output_stream<char>& out() {
         return _write_buf;
@@ -227,7 +216,18 @@ class http_server {
     uint64_t _read_errors = 0;
     uint64_t _respond_errors = 0;
     sstring _date = http_date();
-    timer<> _date_format_timer { [this] {_date = http_date();} };
+    // Headers sent with every reply, serialized once per date change
+    sstring _common_headers = common_headers(_date);
+    timer<> _date_format_timer { [this] {
+        _date = http_date();
+        _common_headers = common_headers(_date);
+    } };
+    size_t _pipeline_depth = 10;
+    std::experimental::optional<compression_config> _compression;
+    std::experimental::optional<http2_config> _http2;
+    // by listener: whether it accepts TLS connections
+    std::vector<bool> _tls_listeners;
+    bool _header_views = false;
     bool _stopping = false;
     promise<> _all_connections_stopped;
     future<> _stopped = _all_connections_stopped.get_future();
@@ -243,10 +243,68 @@ class http_server {
     explicit http_server(const sstring& name) : _stats(*this, name) {
         _date_format_timer.arm_periodic(1s);
     }
+    /**
+     * Sets how many requests pipelined on a connection may be handled at
+     * the same time, for connections accepted afterwards. Their replies
+     * are still sent in request order; a connection stops reading
+     * requests while that many wait for their turn.
+     */
+    void set_pipeline_depth(size_t depth) {
+        _pipeline_depth = std::max<size_t>(depth, 1);
+    }
+    size_t pipeline_depth() const {
+        return _pipeline_depth;
+    }
+    /**
+     * Compresses replies with gzip or deflate, for the clients that accept
+     * it. Only replies of a compressible content type, that are not
+     * encoded already, are compressed; they get a Vary: Accept-Encoding
+     * header.
+     */
+    void set_compression(compression_config cfg) {
+        _compression = cfg;
+    }
+    /**
+     * Parses the headers of requests into request::raw_headers, as views
+     * into the received head, rather than into request::_headers; this
+     * saves allocating strings for them. Handlers should then look
+     * headers up with request::get_header() or request::header(), or
+     * call request::materialize_headers() first.
+     */
+    void set_header_views(bool views = true) {
+        _header_views = views;
+    }
+    /**
+     * Serves HTTP/2 too, for connections accepted afterwards: to clients
+     * that start them with the HTTP/2 connection preface (h2c with prior
+     * knowledge), and to TLS clients that pick "h2" with ALPN. See
+     * http2_connection.
+     */
+    void set_http2(http2_config cfg = http2_config()) {
+        _http2 = cfg;
+    }
     future<> listen(ipv4_addr addr) {
         listen_options lo;
         lo.reuse_address = true;
         _listeners.push_back(engine().listen(make_ipv4_address(addr), lo));
+        _tls_listeners.resize(_listeners.size());
+        _stopped = when_all(std::move(_stopped), do_accepts(_listeners.size() - 1)).discard_result();
+        return make_ready_future<>();
+    }
+    /**
+     * Listens for TLS connections. If HTTP/2 is enabled, clients are
+     * offered it with ALPN: "h2" and "http/1.1" are set as the ALPN
+     * protocols of creds.
+     */
+    future<> listen(ipv4_addr addr, shared_ptr<tls::server_credentials> creds) {
+        if (_http2) {
+            creds->set_alpn_protocols({"h2", "http/1.1"});
+        }
+        listen_options lo;
+        lo.reuse_address = true;
+        _listeners.push_back(tls::listen(std::move(creds), make_ipv4_address(addr), lo));
+        _tls_listeners.resize(_listeners.size());
+        _tls_listeners.back() = true;
         _stopped = when_all(std::move(_stopped), do_accepts(_listeners.size() - 1)).discard_result();
         return make_ready_future<>();
     }
@@ -272,7 +330,8 @@ class http_server {
                 return;
             }
             auto cs_sa = f_cs_sa.get();
-            auto conn = new connection(*this, std::get<0>(std::move(cs_sa)), std::get<1>(std::move(cs_sa)));
+            bool tls = size_t(which) < _tls_listeners.size() && _tls_listeners[which];
+            auto conn = new connection(*this, std::get<0>(std::move(cs_sa)), std::get<1>(std::move(cs_sa)), tls);
             conn->process().then_wrapped([conn] (auto&& f) {
                 delete conn;
                 try {
@@ -314,9 +373,13 @@ class http_server {
         strftime(tmp, sizeof(tmp), "%d %b %Y %H:%M:%S GMT", &tm);
         return tmp;
     }
+    static sstring common_headers(const sstring& date) {
+        return "Server: Seastar httpd\r\nDate: " + date + "\r\n";
+    }
 private:
     boost::intrusive::list<connection> _connections;
     friend class seastar::httpd::connection;
+    friend class http2_connection;
     friend class http_server_tester;
 };
 
@@ -35,12 +35,7 @@ void path_description::set(routes& _routes, handler_base* handler) const {
     if (params.size() == 0)
         _routes.put(operations.method, path, handler);
     else {
-        match_rule* rule = new match_rule(handler);
-        rule->add_str(path);
-        for (auto i = params.begin(); i != params.end(); ++i) {
-            rule->add_param(std::get<0>(*i), std::get<1>(*i));
-        }
-        _routes.add(rule, operations.method);
+        _routes.add(operations.method, path, params, handler);
     }
 }
 
@@ -99,6 +99,16 @@ sstring reply::response_line() {
     return "HTTP/" + _version + status_strings::to_string(_status);
 }
 
+void reply::reset() {
+    _status = status_type::ok;
+    _headers.clear();
+    _version.reset();
+    _content.reset();
+    _response_line.reset();
+    _body_writer = {};
+    _prepared = nullptr;
+}
+
 class http_chunked_data_sink_impl : public data_sink_impl {
     output_stream<char>& _out;
 
@@ -123,6 +133,17 @@ class http_chunked_data_sink_impl : public data_sink_impl {
             return _out.write("\r\n", 2);
         });
     }
+    virtual future<> put_file(file& f, uint64_t offset, uint64_t len) override {
+        if (len == 0) {
+            return make_ready_future<>();
+        }
+        // one chunk, so that the connection's stream can send it from the file
+        return write_size(len).then([this, &f, offset, len] {
+            return _out.write_file(f, offset, len);
+        }).then([this] {
+            return _out.write("\r\n", 2);
+        });
+    }
     virtual future<> close() {
         return  make_ready_future<>();
     }
@@ -135,7 +156,7 @@ class http_chunked_data_sink : public data_sink {
                 out)) {}
 };
 
-static output_stream<char> make_http_chunked_output_stream(output_stream<char>& out) {
+output_stream<char> make_http_chunked_output_stream(output_stream<char>& out) {
     return output_stream<char>(http_chunked_data_sink(out), 32000, true);
 }
 
@@ -152,20 +173,89 @@ void reply::write_body(const sstring& content_type, const sstring& content) {
 
 future<> reply::write_reply_to_connection(connection& con) {
     add_header("Transfer-Encoding", "chunked");
-    return con.out().write(response_line()).then([this, &con] () mutable {
-        return write_reply_headers(con);
-    }).then([&con] () mutable {
-        return con.out().write("\r\n", 2);
-    }).then([this, &con] () mutable {
+    auto head = serialize_head(con.common_headers(), {});
+    return con.out().write(head.get(), head.size()).then([this, &con] () mutable {
         return _body_writer(make_http_chunked_output_stream(con.out()));
     });
 
 }
 
-future<> reply::write_reply_headers(connection& con) {
-    return do_for_each(_headers, [&con](auto& h) {
-        return con.out().write(h.first + ": " + h.second + "\r\n");
-    });
+temporary_buffer<char> reply::serialize_head(const sstring& common_headers, std::experimental::optional<size_t> content_length,
+        bool end) {
+    static const sstring content_length_name = "Content-Length: ";
+    auto skip = [this, &content_length] (const sstring& name) {
+        return name == "Server" || name == "Date" || (content_length && name == "Content-Length")
+                || (_prepared && _prepared->_headers.count(name));
+    };
+    auto line = _response_line.empty() ? response_line() : _response_line;
+    char length[24];
+    size_t length_size = 0;
+    size_t size = line.size() + common_headers.size() + (end ? 2 : 0);
+    if (content_length) {
+        length_size = snprintf(length, sizeof(length), "%zu\r\n", *content_length);
+        size += content_length_name.size() + length_size;
+    }
+    for (auto&& h : _headers) {
+        if (!skip(h.first)) {
+            size += h.first.size() + h.second.size() + 4;
+        }
+    }
+    temporary_buffer<char> buf(size);
+    auto p = buf.get_write();
+    auto append = [&p] (const char* s, size_t n) {
+        p = std::copy_n(s, n, p);
+    };
+    append(line.begin(), line.size());
+    append(common_headers.begin(), common_headers.size());
+    if (content_length) {
+        append(content_length_name.begin(), content_length_name.size());
+        append(length, length_size);
+    }
+    for (auto&& h : _headers) {
+        if (!skip(h.first)) {
+            append(h.first.begin(), h.first.size());
+            append(": ", 2);
+            append(h.second.begin(), h.second.size());
+            append("\r\n", 2);
+        }
+    }
+    if (end) {
+        append("\r\n", 2);
+    }
+    return buf;
+}
+
+reply::prepared::prepared(const reply& rep)
+        : _status(rep._status), _headers(rep._headers), _content(rep._content) {
+    static const sstring content_length_name = "Content-Length: ";
+    auto skip = [] (const sstring& name) {
+        return name == "Server" || name == "Date" || name == "Content-Length";
+    };
+    auto length = to_sstring(_content.size());
+    size_t size = content_length_name.size() + length.size() + 4 + _content.size();
+    for (auto&& h : _headers) {
+        if (!skip(h.first)) {
+            size += h.first.size() + h.second.size() + 4;
+        }
+    }
+    temporary_buffer<char> buf(size);
+    auto p = buf.get_write();
+    auto append = [&p] (const char* s, size_t n) {
+        p = std::copy_n(s, n, p);
+    };
+    for (auto&& h : _headers) {
+        if (!skip(h.first)) {
+            append(h.first.begin(), h.first.size());
+            append(": ", 2);
+            append(h.second.begin(), h.second.size());
+            append("\r\n", 2);
+        }
+    }
+    append(content_length_name.begin(), content_length_name.size());
+    append(length.begin(), length.size());
+    append("\r\n\r\n", 4);
+    append(_content.begin(), _content.size());
+    _serialized = std::move(buf);
 }
 
 }
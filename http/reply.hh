@@ -33,9 +33,11 @@
 
 #include "core/sstring.hh"
 #include <unordered_map>
+#include <experimental/optional>
 #include "http/mime_types.hh"
 #include "core/future-util.hh"
 #include "core/iostream.hh"
+#include "core/shared_ptr.hh"
 #include "util/noncopyable_function.hh"
 
 namespace seastar {
@@ -83,6 +85,33 @@ struct reply {
     sstring _content;
 
     sstring _response_line;
+
+    /**
+     * A reply serialized once, to be sent as is for any number of requests:
+     * the fixed replies a server sends over and over, like its 404s. A
+     * request's reply refers to it with \ref set_prepared(), rather than
+     * being built again. It is immutable, but not safe to share between
+     * shards, so each shard makes its own.
+     */
+    class prepared {
+        status_type _status;
+        std::unordered_map<sstring, sstring> _headers;
+        sstring _content;
+        // the headers other than Server and Date, Content-Length, the blank
+        // line ending them, and the content
+        temporary_buffer<char> _serialized;
+    public:
+        /**
+         * @param rep the reply to serialize, but for its version, which is
+         * each request's own
+         */
+        explicit prepared(const reply& rep);
+        friend struct reply;
+        friend class connection;
+        friend class http2_connection;
+    };
+    lw_shared_ptr<const prepared> _prepared;
+
     reply()
             : _status(status_type::ok) {
     }
@@ -97,6 +126,19 @@ struct reply {
         return *this;
     }
 
+    /**
+     * Sends a prepared reply's status, headers and content, instead of
+     * this reply's status and content; headers this reply has are sent
+     * too, unless the prepared reply has them.
+     */
+    reply& set_prepared(lw_shared_ptr<const prepared> p) {
+        _status = p->_status;
+        _content.reset();
+        _body_writer = {};
+        _prepared = std::move(p);
+        return *this;
+    }
+
     reply& set_status(status_type status, const sstring& content = "") {
         _status = status;
         if (content != "") {
@@ -137,6 +179,12 @@ struct reply {
     }
     sstring response_line();
 
+    /**
+     * Makes the reply as good as new, for another request, keeping the
+     * buckets of its header map
+     */
+    void reset();
+
     /*!
      * \brief use an output stream to write the message body
      *
@@ -168,13 +216,28 @@ struct reply {
 
 private:
     future<> write_reply_to_connection(connection& con);
-    future<> write_reply_headers(connection& connection);
+    // Serializes the response line, the headers and the blank line ending
+    // them into one buffer, sized up front. common_headers are serialized
+    // "name: value\r\n" lines shared by all replies of the server; they
+    // replace the reply's own Server and Date headers. A Content-Length
+    // header is added if content_length is given. The blank line is left
+    // out if !end, for a prepared reply's headers to follow.
+    temporary_buffer<char> serialize_head(const sstring& common_headers, std::experimental::optional<size_t> content_length,
+            bool end = true);
 
     noncopyable_function<future<>(output_stream<char>&&)> _body_writer;
     friend class routes;
     friend class connection;
+    friend class http2_connection;
 };
 
+/**
+ * Wraps a connection's stream in one that sends what is written to it as
+ * chunks of the chunked transfer encoding. Closing the returned stream
+ * does not send the last, empty, chunk that ends the body.
+ */
+output_stream<char> make_http_chunked_output_stream(output_stream<char>& out);
+
 } // namespace httpd
 
 }
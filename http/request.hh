@@ -32,8 +32,12 @@
 #define HTTP_REQUEST_HPP
 
 #include "core/sstring.hh"
+#include "core/iostream.hh"
+#include <array>
 #include <string>
 #include <vector>
+#include <experimental/optional>
+#include <experimental/string_view>
 #include <strings.h>
 #include "common.hh"
 
@@ -42,6 +46,90 @@ namespace seastar {
 namespace httpd {
 class connection;
 
+/**
+ * The header lines of a request, left in the request's head as it was
+ * received, and indexed by where their names and values are in it; so
+ * that parsing them allocates no strings.
+ */
+class header_views {
+public:
+    using string_view = std::experimental::string_view;
+private:
+    struct field {
+        uint32_t name;
+        uint32_t name_size;
+        uint32_t value;
+        uint32_t value_size;
+    };
+    // most requests have fewer headers
+    static constexpr size_t inline_fields = 16;
+    temporary_buffer<char> _head;
+    std::array<field, inline_fields> _inline;
+    std::vector<field> _more;
+    size_t _size = 0;
+private:
+    const field& at(size_t i) const {
+        return i < inline_fields ? _inline[i] : _more[i - inline_fields];
+    }
+    field& at(size_t i) {
+        return i < inline_fields ? _inline[i] : _more[i - inline_fields];
+    }
+public:
+    /**
+     * Adds a header, by the offsets of its name and value in the head
+     */
+    void add(uint32_t name, uint32_t name_size, uint32_t value, uint32_t value_size) {
+        field f{name, name_size, value, value_size};
+        if (_size < inline_fields) {
+            _inline[_size] = f;
+        } else {
+            _more.push_back(f);
+        }
+        ++_size;
+    }
+    /**
+     * Extends the value of the last header added up to an offset, over
+     * the lines it is folded on
+     */
+    void extend_last(uint32_t value_end) {
+        auto& f = at(_size - 1);
+        f.value_size = value_end - f.value;
+    }
+    void set_head(temporary_buffer<char> head) {
+        _head = std::move(head);
+    }
+    const temporary_buffer<char>& head() const {
+        return _head;
+    }
+    size_t size() const {
+        return _size;
+    }
+    string_view name(size_t i) const {
+        return string_view(_head.get() + at(i).name, at(i).name_size);
+    }
+    string_view value(size_t i) const {
+        return string_view(_head.get() + at(i).value, at(i).value_size);
+    }
+    /**
+     * Looks up a header, ignoring the case of its name
+     * @return the value of the last header of that name, if any
+     */
+    std::experimental::optional<string_view> find(string_view name) const {
+        for (size_t i = _size; i-- > 0;) {
+            auto& f = at(i);
+            if (f.name_size == name.size() && !strncasecmp(_head.get() + f.name, name.data(), name.size())) {
+                return value(i);
+            }
+        }
+        return std::experimental::nullopt;
+    }
+    void clear() {
+        _head = temporary_buffer<char>();
+        _more.clear();
+        _size = 0;
+    }
+};
+
 /**
  * A request received from a client.
  */
@@ -59,10 +147,27 @@ struct request {
     ctclass content_type_class;
     size_t content_length = 0;
     std::unordered_map<sstring, sstring> _headers;
+    /**
+     * The headers, for requests parsed with header views (see
+     * http_server::set_header_views()); _headers is then empty, unless
+     * filled by materialize_headers()
+     */
+    header_views raw_headers;
     std::unordered_map<sstring, sstring> query_parameters;
     connection* connection_ptr;
     parameters param;
+    /**
+     * The body of the request, of content_length bytes; read from
+     * content_stream before the handler runs, unless the handler reads
+     * the stream itself
+     */
     sstring content;
+    /**
+     * The body of the request, as it arrives; for handlers whose
+     * reads_content_stream() is true. What the handler leaves unread is
+     * skipped once the stream is destroyed or closed.
+     */
+    input_stream<char> content_stream;
     sstring protocol_name;
 
     /**
@@ -71,6 +176,9 @@ struct request {
      * @return a pointer to the header value, if it exists or empty string
      */
     sstring get_header(const sstring& name) const {
+        if (auto v = raw_headers.find(name)) {
+            return sstring(v->data(), v->size());
+        }
         auto res = _headers.find(name);
         if (res == _headers.end()) {
             return "";
@@ -78,6 +186,55 @@ struct request {
         return res->second;
     }
 
+    /**
+     * Search for a header without copying its value
+     * @param name the header name; the case of header views' names is
+     * ignored
+     * @return the header value, valid as long as the request, or an
+     * empty view
+     */
+    std::experimental::string_view header(std::experimental::string_view name) const {
+        if (auto v = raw_headers.find(name)) {
+            return *v;
+        }
+        auto res = _headers.find(sstring(name.data(), name.size()));
+        if (res == _headers.end()) {
+            return {};
+        }
+        return res->second;
+    }
+
+    /**
+     * Copies the headers kept as views into _headers, for code that
+     * looks them up there, and drops the views. Values folded over
+     * several lines are joined with spaces.
+     */
+    void materialize_headers() {
+        for (size_t i = 0; i < raw_headers.size(); ++i) {
+            auto name = raw_headers.name(i);
+            auto value = raw_headers.value(i);
+            sstring v;
+            bool folded = value.find_first_of("\r\n") != std::experimental::string_view::npos;
+            if (!folded) {
+                v = sstring(value.data(), value.size());
+            }
+            for (size_t j = 0; folded && j < value.size(); ++j) {
+                if (value[j] == '\r' || value[j] == '\n') {
+                    // an obsolete line folding
+                    while (j + 1 < value.size() && (value[j + 1] == '\r' || value[j + 1] == '\n'
+                            || value[j + 1] == ' ' || value[j + 1] == '\t')) {
+                        ++j;
+                    }
+                    v += " ";
+                } else {
+                    v.append(&value[j], 1);
+                }
+            }
+            _headers[sstring(name.data(), name.size())] = std::move(v);
+        }
+        raw_headers.clear();
+    }
+
     /**
      * Search for the first header of a given name
      * @param name the header name
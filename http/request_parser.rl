@@ -22,6 +22,7 @@
 #pragma once
 
 #include "core/ragel.hh"
+#include <algorithm>
 #include <memory>
 #include <unordered_map>
 #include "http/request.hh"
@@ -37,35 +38,68 @@ using namespace httpd;
 access _fsm_;
 
 action mark {
-    g.mark_start(p);
+    if (_views) {
+        _mark = offset(p);
+    } else {
+        g.mark_start(p);
+    }
 }
 
 action store_method {
-    _req->_method = str();
+    if (_views) {
+        _method = span(p);
+    } else {
+        _req->_method = str();
+    }
 }
 
 action store_uri {
-    _req->_url = str();
+    if (_views) {
+        _uri = span(p);
+    } else {
+        _req->_url = str();
+    }
 }
 
 action store_version {
-    _req->_version = str();
+    if (_views) {
+        _version = span(p);
+    } else {
+        _req->_version = str();
+    }
 }
 
 action store_field_name {
-    _field_name = str();
+    if (_views) {
+        _name = span(p);
+    } else {
+        _field_name = str();
+    }
 }
 
 action store_value {
-    _value = str();
+    if (_views) {
+        _value_span = span(p);
+    } else {
+        _value = str();
+    }
 }
 
 action assign_field {
-    _req->_headers[_field_name] = std::move(_value);
+    if (_views) {
+        _req->raw_headers.add(_name.start, _name.size, _value_span.start, _value_span.size);
+    } else {
+        _req->_headers[_field_name] = std::move(_value);
+    }
 }
 
 action extend_field  {
-    _req->_headers[_field_name] += sstring(" ") + std::move(_value);
+    if (_views) {
+        _req->raw_headers.extend_last(_value_span.start + _value_span.size);
+        _folded = true;
+    } else {
+        _req->_headers[_field_name] += sstring(" ") + std::move(_value);
+    }
 }
 
 action done {
@@ -110,11 +144,66 @@ public:
     sstring _field_name;
     sstring _value;
     state _state;
+private:
+    // Where an element is in the head, counting from the start of the
+    // request line
+    struct span_type {
+        uint32_t start;
+        uint32_t size;
+    };
+    // When parsing with header views: the part of the head in previous
+    // buffers, if it spans several, and its size
+    bool _views = false;
+    bool _folded = false;
+    // The most headers the requests parsed so far had, to size the header
+    // map of the next one up front, rather than rehash it as it fills
+    size_t _headers_hint = 0;
+    static constexpr size_t max_headers_hint = 64;
+    sstring _spilled;
+    uint32_t _offset = 0;
+    const char* _base = nullptr;
+    uint32_t _mark = 0;
+    span_type _method;
+    span_type _uri;
+    span_type _version;
+    span_type _name;
+    span_type _value_span;
+private:
+    uint32_t offset(const char* p) const {
+        return _offset + (p - _base);
+    }
+    span_type span(const char* p) const {
+        return span_type{_mark, offset(p) - _mark};
+    }
+    void finish_views(temporary_buffer<char> head) {
+        auto str = [&head] (span_type s) {
+            return sstring(head.get() + s.start, s.size);
+        };
+        _req->_method = str(_method);
+        _req->_url = str(_uri);
+        _req->_version = str(_version);
+        _req->raw_headers.set_head(std::move(head));
+        if (_folded) {
+            _req->materialize_headers();
+        }
+    }
 public:
-    void init() {
+    /**
+     * @param header_views whether to leave the headers in the request's
+     * head, and index them in request::raw_headers, rather than copy
+     * them into request::_headers
+     */
+    void init(bool header_views = false) {
         init_base();
         _req.reset(new httpd::request());
         _state = state::eof;
+        _views = header_views;
+        if (!_views && _headers_hint) {
+            _req->_headers.reserve(_headers_hint);
+        }
+        _folded = false;
+        _spilled.reset();
+        _offset = 0;
         %% write init;
     }
     char* parse(char* p, char* pe, char* eof) {
@@ -132,7 +221,36 @@ public:
         }
         return p;
     }
+    future<unconsumed_remainder> operator()(temporary_buffer<char> buf) {
+        if (!_views) {
+            return ragel_parser_base::operator()(std::move(buf));
+        }
+        _base = buf.get();
+        char* p = buf.get_write();
+        char* pe = p + buf.size();
+        char* eof = buf.empty() ? pe : nullptr;
+        char* parsed = parse(p, pe, eof);
+        if (parsed) {
+            size_t used = parsed - p;
+            if (_spilled.empty()) {
+                // the whole head is in this buffer: the views share it
+                finish_views(buf.share(0, used));
+            } else {
+                _spilled.append(p, used);
+                finish_views(temporary_buffer<char>(_spilled.begin(), _spilled.size()));
+            }
+            buf.trim_front(used);
+            return make_ready_future<unconsumed_remainder>(std::move(buf));
+        }
+        if (_fsm_cs != error) {
+            _spilled.append(p, buf.size());
+            _offset += buf.size();
+        }
+        return make_ready_future<unconsumed_remainder>();
+    }
     auto get_parsed_request() {
+        auto n = std::max(_headers_hint, _req->_headers.size());
+        _headers_hint = n < max_headers_hint ? n : max_headers_hint;
         return std::move(_req);
     }
     bool eof() const {
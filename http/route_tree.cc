@@ -0,0 +1,159 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <algorithm>
+#include <stdexcept>
+#include "route_tree.hh"
+
+namespace seastar {
+
+namespace httpd {
+
+// Splits a path the way matchers see a url: into segments that start
+// with a slash, but for the first one
+static std::vector<sstring> split_path(const sstring& path) {
+    std::vector<sstring> segments;
+    size_t pos = 0;
+    while (pos < path.size()) {
+        auto next = path.find('/', pos + 1);
+        if (next == sstring::npos) {
+            next = path.size();
+        }
+        segments.push_back(path.substr(pos, next - pos));
+        pos = next;
+    }
+    return segments;
+}
+
+static bool is_param_segment(const sstring& segment) {
+    return segment.size() > 3 && segment[0] == '/' && segment[1] == '{' && segment[segment.size() - 1] == '}';
+}
+
+route_tree::node& route_tree::child(node& n, const sstring& segment) {
+    auto i = std::lower_bound(n.children.begin(), n.children.end(), segment, [] (auto& c, const sstring& s) {
+        return c.first < s;
+    });
+    if (i == n.children.end() || i->first != segment) {
+        i = n.children.emplace(i, segment, std::make_unique<node>());
+    }
+    return *i->second;
+}
+
+void route_tree::add(const sstring& path, const std::vector<std::pair<sstring, bool>>& params, handler_base* handler, size_t seq) {
+    std::vector<node*> visited{&_root};
+    std::vector<sstring> names;
+    for (auto&& segment : split_path(path)) {
+        auto& n = *visited.back();
+        if (is_param_segment(segment)) {
+            if (!n.param) {
+                n.param = std::make_unique<node>();
+            }
+            visited.push_back(n.param.get());
+            names.push_back(segment.substr(2, segment.size() - 3));
+        } else {
+            visited.push_back(&child(n, segment));
+        }
+    }
+    route* r = &visited.back()->end;
+    for (size_t i = 0; i < params.size(); ++i) {
+        auto& n = *visited.back();
+        names.push_back(params[i].first);
+        if (params[i].second) {
+            if (i + 1 != params.size()) {
+                throw std::invalid_argument("only the last parameter of a route may take the rest of the url");
+            }
+            r = &n.rest;
+        } else {
+            if (!n.param) {
+                n.param = std::make_unique<node>();
+            }
+            visited.push_back(n.param.get());
+            r = &visited.back()->end;
+        }
+    }
+    if (seq < r->seq) {
+        r->handler = handler;
+        r->seq = seq;
+        r->params = std::move(names);
+        _values.resize(std::max(_values.size(), r->params.size()));
+        _best_values.resize(_values.size());
+    }
+    for (auto n : visited) {
+        n->min_seq = std::min(n->min_seq, seq);
+    }
+}
+
+void route_tree::lookup(const node& n, const sstring& url, size_t pos, size_t depth, const route*& best) const {
+    auto better = [&best] (const route& r) {
+        return r.handler && (!best || r.seq < best->seq);
+    };
+    if (best && n.min_seq >= best->seq) {
+        return;
+    }
+    if (pos + 1 >= url.size() && better(n.end)) {
+        best = &n.end;
+        std::copy_n(_values.begin(), depth, _best_values.begin());
+    }
+    if (better(n.rest)) {
+        best = &n.rest;
+        std::copy_n(_values.begin(), depth, _best_values.begin());
+        _best_values[depth] = string_view(url).substr(pos);
+    }
+    if (pos >= url.size()) {
+        return;
+    }
+    auto last = url.find('/', pos + 1);
+    if (last == sstring::npos) {
+        last = url.size();
+    }
+    auto segment = string_view(url).substr(pos, last - pos);
+    auto i = std::lower_bound(n.children.begin(), n.children.end(), segment, [] (auto& c, string_view s) {
+        return string_view(c.first) < s;
+    });
+    if (i != n.children.end() && string_view(i->first) == segment) {
+        lookup(*i->second, url, last, depth, best);
+    }
+    if (n.param) {
+        _values[depth] = segment;
+        lookup(*n.param, url, last, depth + 1, best);
+    }
+}
+
+route_tree::match route_tree::find(const sstring& url) const {
+    const route* best = nullptr;
+    lookup(_root, url, 0, 0, best);
+    return match(best, this);
+}
+
+void route_tree::match::set_params(parameters& params) const {
+    if (!_route) {
+        return;
+    }
+    for (size_t i = 0; i < _route->params.size(); ++i) {
+        auto& v = _tree->_best_values[i];
+        params.set(_route->params[i], sstring(v.data(), v.size()));
+    }
+}
+
+}
+
+}
@@ -0,0 +1,132 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <experimental/string_view>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "common.hh"
+#include "core/sstring.hh"
+
+namespace seastar {
+
+namespace httpd {
+
+class handler_base;
+
+/**
+ * A radix tree of url routes, each a static path followed by parameters;
+ * a path element of the form "{name}" is a parameter too.
+ *
+ * The tree matches a url the same way a match_rule built from the
+ * same path and parameters would, and, when several routes match it,
+ * picks the one added with the lowest sequence number, so it replaces a
+ * scan of match rules in insertion order. Matching visits one node per
+ * url segment, of each branch that can still match, and allocates
+ * nothing until the parameters of the chosen route are set.
+ *
+ * The tree does not own the handlers.
+ */
+class route_tree {
+    using string_view = std::experimental::string_view;
+    struct route {
+        handler_base* handler = nullptr;
+        size_t seq = std::numeric_limits<size_t>::max();
+        // the names of the parameters, by their order in the url
+        std::vector<sstring> params;
+    };
+    struct node {
+        // by the segment they match, "/" included
+        std::vector<std::pair<sstring, std::unique_ptr<node>>> children;
+        // the child matching any one segment, as a parameter
+        std::unique_ptr<node> param;
+        // the route ending at the node
+        route end;
+        // the route ending at the node with a parameter taking the rest
+        // of the url
+        route rest;
+        // the lowest sequence number of the routes in the subtree
+        size_t min_seq = std::numeric_limits<size_t>::max();
+    };
+    node _root;
+    // Scratch space of lookups: the parameter values on the path being
+    // searched, and those of the best route so far
+    mutable std::vector<string_view> _values;
+    mutable std::vector<string_view> _best_values;
+private:
+    node& child(node& n, const sstring& segment);
+    void lookup(const node& n, const sstring& url, size_t pos, size_t depth, const route*& best) const;
+public:
+    /**
+     * The route a url matched, until the tree is changed or searched
+     * again
+     */
+    class match {
+        const route* _route;
+        const route_tree* _tree;
+    public:
+        match(const route* r, const route_tree* tree) : _route(r), _tree(tree) {
+        }
+        handler_base* handler() const {
+            return _route ? _route->handler : nullptr;
+        }
+        /**
+         * The sequence number of the route matched, or the largest
+         * size_t if none did
+         */
+        size_t seq() const {
+            return _route ? _route->seq : std::numeric_limits<size_t>::max();
+        }
+        /**
+         * Sets the parameters of the route to the values in the url, each
+         * with its leading slash, as param_matcher does
+         */
+        void set_params(parameters& params) const;
+    };
+
+    route_tree() = default;
+    route_tree(route_tree&&) = default;
+
+    /**
+     * Adds a route; of identical routes, the one with the lowest sequence
+     * number is matched
+     * @param path the static path, which may contain "{name}" parameters
+     * @param params the parameters that follow the path, and whether each
+     * takes the rest of the url; only the last one may
+     * @param handler the handler to return when the route matches
+     * @param seq the sequence number of the route
+     */
+    void add(const sstring& path, const std::vector<std::pair<sstring, bool>>& params, handler_base* handler, size_t seq);
+
+    /**
+     * Finds the route matching a url
+     * @param url the url path, without a trailing slash
+     */
+    match find(const sstring& url) const;
+};
+
+}
+
+}
@@ -22,6 +22,7 @@
 #include "routes.hh"
 #include "reply.hh"
 #include "exception.hh"
+#include "core/tracing.hh"
 
 namespace seastar {
 
@@ -36,7 +37,12 @@ void verify_param(const request& req, const sstring& param) {
 }
 routes::routes() : _general_handler([this](std::exception_ptr eptr) mutable {
     return exception_reply(eptr);
-}) {}
+}) {
+    reply rep;
+    json_exception ex(not_found_exception("Not found"));
+    rep.set_status(reply::status_type::not_found, ex.to_json()).set_content_type("json");
+    _not_found = make_lw_shared<const reply::prepared>(rep);
+}
 
 routes::~routes() {
     for (int i = 0; i < NUM_OPERATION; i++) {
@@ -46,9 +52,12 @@ routes::~routes() {
     }
     for (int i = 0; i < NUM_OPERATION; i++) {
         for (auto r : _rules[i]) {
-            delete r;
+            delete r.rule;
         }
     }
+    for (auto h : _tree_handlers) {
+        delete h;
+    }
 
 }
 
@@ -83,8 +92,37 @@ std::unique_ptr<reply> routes::exception_reply(std::exception_ptr eptr) {
 }
 
 future<std::unique_ptr<reply> > routes::handle(const sstring& path, std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+    auto parent = tracing::current();
+    auto traceparent = req->_headers.find("traceparent");
+    if (traceparent != req->_headers.end()) {
+        parent = tracing::parse_traceparent(traceparent->second);
+    }
+    tracing::span sp("http", parent);
+    if (!sp) {
+        return do_handle(path, std::move(req), std::move(rep));
+    }
+    sp.set_detail(path);
+    tracing::context_scope scope(sp.context());
+    return do_handle(path, std::move(req), std::move(rep)).finally([sp = std::move(sp)] {});
+}
+
+future<std::unique_ptr<reply>> routes::do_handle(const sstring& path, std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
     handler_base* handler = get_handler(str2type(req->_method),
             normalize_url(path), req->param);
+    if (handler != nullptr && req->content_length && !handler->reads_content_stream()) {
+        auto& r = *req;
+        return r.content_stream.read_exactly(r.content_length).then([&r] (temporary_buffer<char> body) {
+            r.content = sstring(body.get(), body.size());
+            return r.content_stream.close();
+        }).then([this, handler, path, req = std::move(req), rep = std::move(rep)] () mutable {
+            return call_handler(handler, path, std::move(req), std::move(rep));
+        }).handle_exception(_general_handler);
+    }
+    return call_handler(handler, path, std::move(req), std::move(rep));
+}
+
+future<std::unique_ptr<reply>> routes::call_handler(handler_base* handler, const sstring& path,
+        std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
     if (handler != nullptr) {
         try {
             for (auto& i : handler->_mandatory_param) {
@@ -100,10 +138,7 @@ future<std::unique_ptr<reply> > routes::handle(const sstring& path, std::unique_
             rep = exception_reply(std::current_exception());
         }
     } else {
-        rep.reset(new reply());
-        json_exception ex(not_found_exception("Not found"));
-        rep->set_status(reply::status_type::not_found, ex.to_json()).done(
-                "json");
+        rep->set_prepared(_not_found);
     }
     return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
 }
@@ -122,25 +157,35 @@ handler_base* routes::get_handler(operation_type type, const sstring& url,
         return handler;
     }
 
-    for (auto rule = _rules[type].cbegin(); rule != _rules[type].cend();
+    auto m = _tree[type].find(url);
+    // match rules added before the tree's match take precedence
+    for (auto rule = _rules[type].cbegin(); rule != _rules[type].cend() && rule->seq < m.seq();
             ++rule) {
-        handler = (*rule)->get(url, params);
+        handler = rule->rule->get(url, params);
         if (handler != nullptr) {
             return handler;
         }
         params.clear();
     }
-    return nullptr;
+    m.set_params(params);
+    return m.handler();
 }
 
 routes& routes::add(operation_type type, const url& url,
         handler_base* handler) {
-    match_rule* rule = new match_rule(handler);
-    rule->add_str(url._path);
+    std::vector<std::pair<sstring, bool>> params;
     if (url._param != "") {
-        rule->add_param(url._param, true);
+        params.emplace_back(url._param, true);
     }
-    return add(rule, type);
+    return add(type, url._path, params, handler);
+}
+
+routes& routes::add(operation_type type, const sstring& path,
+        const std::vector<std::pair<sstring, bool>>& params,
+        handler_base* handler) {
+    _tree[type].add(path, params, handler, _next_seq++);
+    _tree_handlers.push_back(handler);
+    return *this;
 }
 
 }
@@ -23,6 +23,7 @@
 #define ROUTES_HH_
 
 #include "matchrules.hh"
+#include "route_tree.hh"
 #include "handlers.hh"
 #include "common.hh"
 #include "reply.hh"
@@ -74,6 +75,11 @@ class url {
  * (an optional leading slash is permitted) it is choosen
  * If not, the matching rules are used.
  * matching rules are evaluated by their insertion order
+ *
+ * Rules made of a path and parameters, added with a url or a
+ * path_description, are compiled into a route_tree, so finding them
+ * does not depend on their number; rules added as match_rule objects
+ * are still scanned, in their order among all rules.
  */
 class routes {
 public:
@@ -106,7 +112,7 @@ class routes {
      * @return it self
      */
     routes& add(match_rule* rule, operation_type type = GET) {
-        _rules[type].push_back(rule);
+        _rules[type].push_back({_next_seq++, rule});
         return *this;
     }
 
@@ -120,12 +126,30 @@ class routes {
      */
     routes& add(operation_type type, const url& url, handler_base* handler);
 
+    /**
+     * Add a rule made of a path and parameters, the same as a match_rule
+     * with a str matcher for the path followed by a param matcher for
+     * each parameter would be
+     * Example  routes.add(GET, "/api/{id}", {{"path", true}}, handler);
+     * @param type the operation type
+     * @param path the static path, "{name}" elements in it are parameters
+     * @param params the parameters after the path, and whether each
+     * matches until the end of the url
+     * @param handler the handler, which routes deletes
+     * @return it self
+     */
+    routes& add(operation_type type, const sstring& path,
+            const std::vector<std::pair<sstring, bool>>& params,
+            handler_base* handler);
+
     /**
      * the main entry point.
      * the general handler calls this method with the request
      * the method takes the headers from the request and find the
      * right handler.
      * It then call the handler with the parameters (if they exists) found in the url
+     * The request is traced in an "http" span, that continues the trace of
+     * its traceparent header if it has one.
      * @param path the url path found
      * @param req the http request
      * @param rep the http reply
@@ -144,6 +168,11 @@ class routes {
 
 private:
 
+    /**
+     * Find the handler of a request and call it, once its content is read
+     */
+    future<std::unique_ptr<reply>> do_handle(const sstring& path, std::unique_ptr<request> req, std::unique_ptr<reply> rep);
+
     /**
      * Search and return a handler by the operation type and url
      * @param type the http operation type
@@ -154,6 +183,13 @@ class routes {
     handler_base* get_handler(operation_type type, const sstring& url,
             parameters& params);
 
+    /**
+     * Call the handler found for a request, or reply with not found if
+     * there is none
+     */
+    future<std::unique_ptr<reply>> call_handler(handler_base* handler, const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep);
+
     /**
      * Normalize the url to remove the last / if exists
      * and get the parameter part
@@ -163,8 +199,16 @@ class routes {
      */
     sstring normalize_url(const sstring& url);
 
+    struct numbered_rule {
+        size_t seq;
+        match_rule* rule;
+    };
     std::unordered_map<sstring, handler_base*> _map[NUM_OPERATION];
-    std::vector<match_rule*> _rules[NUM_OPERATION];
+    std::vector<numbered_rule> _rules[NUM_OPERATION];
+    route_tree _tree[NUM_OPERATION];
+    std::vector<handler_base*> _tree_handlers;
+    // numbers rules of all kinds in their insertion order
+    size_t _next_seq = 0;
 public:
     using exception_handler_fun = std::function<std::unique_ptr<reply>(std::exception_ptr eptr)>;
     using exception_handler_id = size_t;
@@ -175,6 +219,8 @@ class routes {
     // that calls the exception_reply of the current object
     // is stored
     exception_handler_fun _general_handler;
+    // the reply to requests no handler matches
+    lw_shared_ptr<const reply::prepared> _not_found;
 public:
     /**
      * The exception_handler_fun expect to call
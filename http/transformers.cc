@@ -23,6 +23,10 @@
 #include "transformers.hh"
 #include <experimental/string_view>
 #include <list>
+#include <vector>
+#include <cstring>
+#include <strings.h>
+#include <zlib.h>
 
 namespace seastar {
 
@@ -304,6 +308,159 @@ temporary_buffer<char> buffer_replace::replace(temporary_buffer<char>& buf) {
     return std::move(buf);
 }
 
+content_encoding accepted_encoding(const request& req) {
+    auto accepted = req.get_header("Accept-Encoding");
+    // the q value of each coding; -1 when not listed
+    float gzip = -1, deflate = -1, any = -1;
+    size_t pos = 0;
+    while (pos < accepted.size()) {
+        auto end = accepted.find(',', pos);
+        if (end == sstring::npos) {
+            end = accepted.size();
+        }
+        std::experimental::string_view item(accepted.begin() + pos, end - pos);
+        pos = end + 1;
+        float q = 1;
+        auto params = item.find(';');
+        auto coding = item.substr(0, params);
+        if (params != std::experimental::string_view::npos) {
+            auto qpos = item.find("q=", params);
+            if (qpos != std::experimental::string_view::npos) {
+                q = std::strtof(sstring(item.substr(qpos + 2).data(), item.size() - qpos - 2).c_str(), nullptr);
+            }
+        }
+        while (!coding.empty() && (coding.front() == ' ' || coding.front() == '\t')) {
+            coding.remove_prefix(1);
+        }
+        while (!coding.empty() && (coding.back() == ' ' || coding.back() == '\t')) {
+            coding.remove_suffix(1);
+        }
+        auto is = [&coding] (const char* name) {
+            return coding.size() == strlen(name) && !strncasecmp(coding.data(), name, coding.size());
+        };
+        if (is("gzip")) {
+            gzip = q;
+        } else if (is("deflate")) {
+            deflate = q;
+        } else if (is("*")) {
+            any = q;
+        }
+    }
+    if (gzip < 0) {
+        gzip = any;
+    }
+    if (deflate < 0) {
+        deflate = any;
+    }
+    if (gzip > 0 && gzip >= deflate) {
+        return content_encoding::gzip;
+    }
+    if (deflate > 0) {
+        return content_encoding::deflate;
+    }
+    return content_encoding::identity;
+}
+
+const char* encoding_name(content_encoding enc) {
+    switch (enc) {
+    case content_encoding::gzip:
+        return "gzip";
+    case content_encoding::deflate:
+        return "deflate";
+    default:
+        return "identity";
+    }
+}
+
+bool compressible_mime_type(const sstring& mime) {
+    return mime.find("text/") == 0 || mime.find("json") != sstring::npos
+            || mime.find("javascript") != sstring::npos || mime.find("xml") != sstring::npos
+            || mime.find("svg") != sstring::npos;
+}
+
+/*!
+ * \brief zlib's deflate, producing the gzip or the deflate (zlib) format
+ */
+class deflater {
+    static constexpr size_t output_chunk = 16384;
+    z_stream _zs;
+public:
+    deflater(content_encoding enc, int level) {
+        std::memset(&_zs, 0, sizeof(_zs));
+        // 16 more window bits for a gzip header and trailer
+        auto window_bits = enc == content_encoding::gzip ? 15 + 16 : 15;
+        if (deflateInit2(&_zs, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("failed to initialize deflate");
+        }
+    }
+    deflater(const deflater&) = delete;
+    ~deflater() {
+        deflateEnd(&_zs);
+    }
+    /*!
+     * \brief compresses n bytes from p, and returns what zlib output so
+     * far; flush is Z_FINISH for the last call, and Z_NO_FLUSH otherwise
+     */
+    std::vector<temporary_buffer<char>> deflate(const char* p, size_t n, int flush) {
+        std::vector<temporary_buffer<char>> ret;
+        _zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(p));
+        _zs.avail_in = n;
+        do {
+            temporary_buffer<char> out(output_chunk);
+            _zs.next_out = reinterpret_cast<Bytef*>(out.get_write());
+            _zs.avail_out = out.size();
+            if (::deflate(&_zs, flush) == Z_STREAM_ERROR) {
+                throw std::runtime_error("deflate failed");
+            }
+            out.trim(out.size() - _zs.avail_out);
+            if (!out.empty()) {
+                ret.push_back(std::move(out));
+            }
+        } while (_zs.avail_out == 0);
+        return ret;
+    }
+};
+
+sstring compress(const sstring& content, content_encoding enc, int level) {
+    deflater d(enc, level);
+    sstring ret;
+    for (auto&& buf : d.deflate(content.begin(), content.size(), Z_FINISH)) {
+        ret.append(buf.get(), buf.size());
+    }
+    return ret;
+}
+
+class compressed_data_sink_impl : public data_sink_impl {
+    output_stream<char> _out;
+    deflater _deflater;
+private:
+    future<> write(std::vector<temporary_buffer<char>> bufs) {
+        return do_with(std::move(bufs), [this] (std::vector<temporary_buffer<char>>& bufs) {
+            return do_for_each(bufs, [this] (temporary_buffer<char>& buf) {
+                return _out.write(std::move(buf));
+            });
+        });
+    }
+public:
+    compressed_data_sink_impl(output_stream<char>&& out, content_encoding enc, int level)
+            : _out(std::move(out)), _deflater(enc, level) {
+    }
+    virtual future<> put(net::packet data) override { abort(); }
+    virtual future<> put(temporary_buffer<char> buf) override {
+        return write(_deflater.deflate(buf.get(), buf.size(), Z_NO_FLUSH));
+    }
+    virtual future<> close() override {
+        return write(_deflater.deflate(nullptr, 0, Z_FINISH)).then([this] {
+            return _out.close();
+        });
+    }
+};
+
+output_stream<char> make_compressed_output_stream(output_stream<char>&& s,
+        content_encoding enc, int level) {
+    return output_stream<char>(data_sink(std::make_unique<compressed_data_sink_impl>(std::move(s), enc, level)), 32000, true);
+}
+
 }
 
 }
@@ -55,6 +55,62 @@ class content_replace : public file_transformer {
     sstring extension;
 };
 
+/**
+ * The content codings replies may be compressed with
+ */
+enum class content_encoding {
+    identity,
+    deflate,
+    gzip,
+};
+
+/**
+ * Settings of reply compression
+ */
+struct compression_config {
+    /**
+     * zlib compression level, from 1 (fastest) to 9 (smallest output)
+     */
+    int level = 6;
+    /**
+     * Replies with a smaller content are sent as they are. Streamed
+     * replies, whose size is not known up front, are always compressed.
+     */
+    size_t min_size = 1024;
+};
+
+/**
+ * Picks the coding to compress the reply to a request with, according to
+ * its Accept-Encoding header; gzip is preferred over deflate
+ */
+content_encoding accepted_encoding(const request& req);
+
+/**
+ * The name of a coding, as used in the Content-Encoding header
+ */
+const char* encoding_name(content_encoding enc);
+
+/**
+ * Whether content of a mime type is worth compressing: text, json,
+ * javascript, xml and svg are
+ */
+bool compressible_mime_type(const sstring& mime);
+
+/**
+ * Compresses content with a coding
+ * @param level the zlib compression level
+ */
+sstring compress(const sstring& content, content_encoding enc, int level);
+
+/**
+ * Wraps a stream in one that compresses with a coding what is written to
+ * it. Closing the returned stream ends the compressed data, and closes
+ * the wrapped stream.
+ * @param level the zlib compression level
+ */
+output_stream<char> make_compressed_output_stream(output_stream<char>&& s,
+        content_encoding enc, int level);
+
 }
 
 }
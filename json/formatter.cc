@@ -21,7 +21,11 @@
 
 #include "formatter.hh"
 #include "json_elements.hh"
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <type_traits>
 
 namespace seastar {
 
@@ -51,9 +55,11 @@ sstring formatter::to_json(const sstring& str) {
 }
 
 sstring formatter::to_json(const char* str) {
-    sstring res = "\"";
-    res += str;
-    res += "\"";
+    auto len = strlen(str);
+    sstring res(sstring::initialized_later(), len + 2);
+    res[0] = '"';
+    std::copy_n(str, len, res.begin() + 1);
+    res[len + 1] = '"';
     return res;
 }
 
@@ -89,20 +95,167 @@ sstring formatter::to_json(bool b) {
 
 sstring formatter::to_json(const date_time& d) {
     char buff[50];
-    sstring res = "\"";
     strftime(buff, 50, TIME_FORMAT, &d);
-    res += buff;
-    return res + "\"";
+    return to_json(buff);
 }
 
 sstring formatter::to_json(const jsonable& obj) {
-    return obj.to_json();
+    rope r;
+    obj.append_to(r);
+    return r.linearize();
 }
 
 sstring formatter::to_json(unsigned long l) {
     return to_string(l);
 }
 
+future<> formatter::write(output_stream<char>& s, const sstring& str) {
+    return s.write(to_json(str));
+}
+
+future<> formatter::write(output_stream<char>& s, int n) {
+    return s.write(to_json(n));
+}
+
+future<> formatter::write(output_stream<char>& s, long n) {
+    return s.write(to_json(n));
+}
+
+future<> formatter::write(output_stream<char>& s, float f) {
+    return s.write(to_json(f));
+}
+
+future<> formatter::write(output_stream<char>& s, double d) {
+    return s.write(to_json(d));
+}
+
+future<> formatter::write(output_stream<char>& s, const char* str) {
+    return s.write(to_json(str));
+}
+
+future<> formatter::write(output_stream<char>& s, bool d) {
+    return s.write(to_json(d));
+}
+
+future<> formatter::write(output_stream<char>& s, const date_time& d) {
+    return s.write(to_json(d));
+}
+
+future<> formatter::write(output_stream<char>& s, const jsonable& obj) {
+    return obj.write(s);
+}
+
+future<> formatter::write(output_stream<char>& s, unsigned long l) {
+    return s.write(to_json(l));
+}
+
+void formatter::append_string(rope& r, const char* str, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    r.append("\"", 1);
+    auto end = str + len;
+    while (str != end) {
+        auto run = std::find_if(str, end, [] (char c) {
+            return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+        });
+        r.append(str, run - str);
+        if (run == end) {
+            break;
+        }
+        switch (*run) {
+        case '"': r.append("\\\"", 2); break;
+        case '\\': r.append("\\\\", 2); break;
+        case '\n': r.append("\\n", 2); break;
+        case '\r': r.append("\\r", 2); break;
+        case '\t': r.append("\\t", 2); break;
+        default: {
+            char esc[] = { '\\', 'u', '0', '0', hex[*run >> 4], hex[*run & 0xf] };
+            r.append(esc, sizeof(esc));
+        }
+        }
+        str = run + 1;
+    }
+    r.append("\"", 1);
+}
+
+// Formats n backwards from end, returning the start of the digits
+template<typename Unsigned>
+static char* format_unsigned(char* end, Unsigned n) {
+    do {
+        *--end = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    return end;
+}
+
+template<typename Signed>
+static void append_signed(rope& r, Signed n) {
+    using unsigned_type = std::make_unsigned_t<Signed>;
+    char buf[24];
+    auto end = buf + sizeof(buf);
+    auto p = format_unsigned(end, n < 0 ? -unsigned_type(n) : unsigned_type(n));
+    if (n < 0) {
+        *--p = '-';
+    }
+    r.append(p, end - p);
+}
+
+template<typename Float>
+static void append_float(rope& r, Float f, const char* type) {
+    if (std::isinf(f)) {
+        throw out_of_range(sstring("Infinite ") + type + " value is not supported");
+    } else if (std::isnan(f)) {
+        throw invalid_argument(sstring("Invalid ") + type + " value");
+    }
+    char buf[32];
+    auto n = snprintf(buf, sizeof(buf), "%g", double(f));
+    r.append(buf, n);
+}
+
+void formatter::append(rope& r, const char* str) {
+    append_string(r, str, strlen(str));
+}
+
+void formatter::append(rope& r, int n) {
+    append_signed(r, n);
+}
+
+void formatter::append(rope& r, long n) {
+    append_signed(r, n);
+}
+
+void formatter::append(rope& r, unsigned long l) {
+    char buf[24];
+    auto end = buf + sizeof(buf);
+    auto p = format_unsigned(end, l);
+    r.append(p, end - p);
+}
+
+void formatter::append(rope& r, float f) {
+    append_float(r, f, "float");
+}
+
+void formatter::append(rope& r, double d) {
+    append_float(r, d, "double");
+}
+
+void formatter::append(rope& r, bool b) {
+    if (b) {
+        r.append("true", 4);
+    } else {
+        r.append("false", 5);
+    }
+}
+
+void formatter::append(rope& r, const date_time& d) {
+    char buff[50];
+    auto n = strftime(buff, sizeof(buff), TIME_FORMAT, &d);
+    append_string(r, buff, n);
+}
+
+void formatter::append(rope& r, const jsonable& obj) {
+    obj.append_to(r);
+}
+
 }
 
 }
@@ -29,6 +29,9 @@
 #include <time.h>
 #include <sstream>
 #include "core/sstring.hh"
+#include "core/rope.hh"
+#include "core/iostream.hh"
+#include "core/future-util.hh"
 
 namespace seastar {
 
@@ -42,6 +45,14 @@ typedef struct tm date_time;
  * The formatter prints json values in a json format
  * it overload to_json method for each of the supported format
  * all to_json parameters are passed as a pointer
+ *
+ * The write methods print the same format into an output stream, one
+ * element at a time, so large collections are never formatted into a
+ * single string; the written value must live until the returned future
+ * resolves.
+ *
+ * The append methods print it into a rope, without allocating anything
+ * other than the rope's chunks; unlike to_json(), they escape strings.
  */
 class formatter {
     enum class state {
@@ -50,26 +61,47 @@ class formatter {
     static sstring begin(state);
     static sstring end(state);
 
+    // Containers are formatted into a rope, and copied into a string
+    // once, rather than concatenated element by element
+    template<typename K, typename V>
+    static void append_json(rope& r, state s, const std::pair<K, V>& p) {
+        if (s == state::array) {
+            r.append("{");
+            append_json(r, state::none, p);
+            r.append("}");
+        } else {
+            r.append(to_json(p.first));
+            r.append(":");
+            r.append(to_json(p.second));
+        }
+    }
+
+    // fallback template
+    template<typename T>
+    static void append_json(rope& r, state, const T& t) {
+        r.append(to_json(t));
+    }
+
     template<typename K, typename V>
     static sstring to_json(state s, const std::pair<K, V>& p) {
-        return s == state::array ?
-                        "{" + to_json(state::none, p) + "}" :
-                        to_json(p.first) + ":" + to_json(p.second);
+        rope r;
+        append_json(r, s, p);
+        return r.linearize();
     }
 
     template<typename Iter>
     static sstring to_json(state s, Iter i, Iter e) {
-        std::stringstream res;
-        res << begin(s);
+        rope r;
+        r.append(begin(s));
         size_t n = 0;
         while (i != e) {
             if (n++ != 0) {
-                res << ",";
+                r.append(",");
             }
-            res << to_json(s, *i++);
+            append_json(r, s, *i++);
         }
-        res << end(s);
-        return res.str();
+        r.append(end(s));
+        return r.linearize();
     }
 
     // fallback template
@@ -77,6 +109,74 @@ class formatter {
     static sstring to_json(state, const T& t) {
         return to_json(t);
     }
+
+    template<typename K, typename V>
+    static future<> write(output_stream<char>& s, state st, const std::pair<K, V>& p) {
+        if (st == state::array) {
+            return s.write("{").then([&s, &p] {
+                return write(s, state::none, p);
+            }).then([&s] {
+                return s.write("}");
+            });
+        }
+        return s.write(to_json(p.first) + ":").then([&s, &p] {
+            return write(s, p.second);
+        });
+    }
+
+    template<typename Iter>
+    static future<> write(output_stream<char>& s, state st, Iter i, Iter e) {
+        return s.write(begin(st)).then([&s, st, i, e] {
+            return do_for_each(i, e, [&s, st, first = true] (auto& m) mutable {
+                auto f = first ? make_ready_future<>() : s.write(",");
+                first = false;
+                return f.then([&s, st, &m] {
+                    return write(s, st, m);
+                });
+            });
+        }).then([&s, st] {
+            return s.write(end(st));
+        });
+    }
+
+    // fallback template
+    template<typename T>
+    static future<> write(output_stream<char>& s, state, const T& t) {
+        return write(s, t);
+    }
+
+    template<typename K, typename V>
+    static void append(rope& r, state s, const std::pair<K, V>& p) {
+        if (s == state::array) {
+            r.append("{", 1);
+            append(r, state::none, p);
+            r.append("}", 1);
+        } else {
+            append(r, p.first);
+            r.append(":", 1);
+            append(r, p.second);
+        }
+    }
+
+    template<typename Iter>
+    static void append(rope& r, state s, Iter i, Iter e) {
+        r.append(s == state::array ? "[" : "{", 1);
+        for (bool first = true; i != e; ++i, first = false) {
+            if (!first) {
+                r.append(",", 1);
+            }
+            append(r, s, *i);
+        }
+        r.append(s == state::array ? "]" : "}", 1);
+    }
+
+    // fallback template
+    template<typename T>
+    static void append(rope& r, state, const T& t) {
+        append(r, t);
+    }
+
+    static void append_string(rope& r, const char* str, size_t len);
 public:
 
     /**
@@ -169,6 +269,158 @@ class formatter {
      */
     static sstring to_json(unsigned long l);
 
+    /**
+     * write a json formated string to a stream
+     * @param s the stream to write to
+     * @param str the string to format
+     * @return a future that resolves when the value was written
+     */
+    static future<> write(output_stream<char>& s, const sstring& str);
+
+    /**
+     * write a json formated int to a stream
+     * @param s the stream to write to
+     * @param n the int to format
+     * @return a future that resolves when the value was written
+     */
+    static future<> write(output_stream<char>& s, int n);
+
+    /**
+     * write a json formated long to a stream
+     * @param s the stream to write to
+     * @param n the long to format
+     * @return a future that resolves when the value was written
+     */
+    static future<> write(output_stream<char>& s, long n);
+
+    /**
+     * write a json formated float to a stream
+     * @param s the stream to write to
+     * @param f the float to format
+     * @return a future that resolves when the value was written
+     */
+    static future<> write(output_stream<char>& s, float f);
+
+    /**
+     * write a json formated double to a stream
+     * @param s the stream to write to
+     * @param d the double to format
+     * @return a future that resolves when the value was written
+     */
+    static future<> write(output_stream<char>& s, double d);
+
+    /**
+     * write a json formated char* (treated as string) to a stream
+     * @param s the stream to write to
+     * @param str the char* to format
+     * @return a future that resolves when the value was written
+     */
+    static future<> write(output_stream<char>& s, const char* str);
+
+    /**
+     * write a json formated bool to a stream
+     * @param s the stream to write to
+     * @param d the bool to format
+     * @return a future that resolves when the value was written
+     */
+    static future<> write(output_stream<char>& s, bool d);
+
+    /**
+     * write a json formated list of a given vector of params to a stream
+     * @param s the stream to write to
+     * @param vec the vector to format
+     * @return a future that resolves when the value was written
+     */
+    template<typename... Args>
+    static future<> write(output_stream<char>& s, const std::vector<Args...>& vec) {
+        return write(s, state::array, vec.begin(), vec.end());
+    }
+
+    template<typename... Args>
+    static future<> write(output_stream<char>& s, const std::map<Args...>& map) {
+        return write(s, state::map, map.begin(), map.end());
+    }
+
+    template<typename... Args>
+    static future<> write(output_stream<char>& s, const std::unordered_map<Args...>& map) {
+        return write(s, state::map, map.begin(), map.end());
+    }
+
+    /**
+     * write a json formated date_time to a stream
+     * @param s the stream to write to
+     * @param d the date_time to format
+     * @return a future that resolves when the value was written
+     */
+    static future<> write(output_stream<char>& s, const date_time& d);
+
+    /**
+     * write a json formated json object to a stream
+     * @param s the stream to write to
+     * @param obj the json object to format
+     * @return a future that resolves when the value was written
+     */
+    static future<> write(output_stream<char>& s, const jsonable& obj);
+
+    /**
+     * write a json formated unsigned long to a stream
+     * @param s the stream to write to
+     * @param l unsigned long to format
+     * @return a future that resolves when the value was written
+     */
+    static future<> write(output_stream<char>& s, unsigned long l);
+
+    /**
+     * append a json formated string to a rope
+     * @param r the rope to append to
+     * @param str the string to format
+     */
+    static void append(rope& r, const sstring& str) {
+        append_string(r, str.c_str(), str.size());
+    }
+
+    static void append(rope& r, const std::string& str) {
+        append_string(r, str.data(), str.size());
+    }
+
+    static void append(rope& r, const char* str);
+
+    static void append(rope& r, int n);
+
+    static void append(rope& r, long n);
+
+    static void append(rope& r, unsigned long l);
+
+    static void append(rope& r, float f);
+
+    static void append(rope& r, double d);
+
+    static void append(rope& r, bool b);
+
+    static void append(rope& r, const date_time& d);
+
+    /**
+     * append a json formated json object to a rope
+     * @param r the rope to append to
+     * @param obj the json object to format
+     */
+    static void append(rope& r, const jsonable& obj);
+
+    template<typename... Args>
+    static void append(rope& r, const std::vector<Args...>& vec) {
+        append(r, state::array, vec.begin(), vec.end());
+    }
+
+    template<typename... Args>
+    static void append(rope& r, const std::map<Args...>& map) {
+        append(r, state::map, map.begin(), map.end());
+    }
+
+    template<typename... Args>
+    static void append(rope& r, const std::unordered_map<Args...>& map) {
+        append(r, state::map, map.begin(), map.end());
+    }
+
 private:
 
     static constexpr const char* TIME_FORMAT = "%a %b %d %I:%M:%S %Z %Y";
@@ -239,6 +239,30 @@ def create_enum_wrapper(model_name, name, values):
     res = res + Template("""      default: return \"\\\"Unknown\\\"\";
         }
      }
+        virtual future<> write(output_stream<char>& s) const {
+            switch(v) {
+        """).substitute({'wrapper' : wrapper})
+    for enum_entry in values:
+        res = res + "      case " + enum_name + "::" + enum_entry + ": return s.write(\"\\\"" + enum_entry + "\\\"\");\n"
+    res = res + Template("""      default: return s.write(\"\\\"Unknown\\\"\");
+        }
+     }
+        virtual void append_to(rope& r) const {
+            switch(v) {
+        """).substitute({'wrapper' : wrapper})
+    for enum_entry in values:
+        res = res + "      case " + enum_name + "::" + enum_entry + ": r.append(\"\\\"" + enum_entry + "\\\"\", " + str(len(enum_entry) + 2) + "); break;\n"
+    res = res + Template("""      default: r.append(\"\\\"Unknown\\\"\", 9);
+        }
+     }
+        void parse_json(json::reader& r) {
+            sstring s;
+            r.read(s);
+            v = $enum_name::NUM_ITEMS;
+        """).substitute({'enum_name': enum_name})
+    for enum_entry in values:
+        res = res + "      if (s == \"" + enum_entry + "\") { v = " + enum_name + "::" + enum_entry + "; }\n"
+    res = res + Template("""    }
     template<class T>
     $wrapper (const T& _v) {
     switch(_v) {
@@ -294,7 +318,8 @@ def create_h_file(data, hfile_name, api_name, init_method, base_api):
         hfile = open(config.outdir + "/" + hfile_name, "w")
     print_h_file_headers(hfile, api_name)
     add_include(hfile, ['"core/sstring.hh"', '"' + config.jsoninc +
-                       'json_elements.hh"', '"http/json_path.hh"'])
+                       'json_elements.hh"', '"' + config.jsoninc +
+                       'json_parser.hh"', '"http/json_path.hh"'])
 
     add_include(hfile, ['<iostream>', '<boost/range/irange.hpp>'])
     open_namespace(hfile, "seastar")
@@ -311,6 +336,8 @@ def create_h_file(data, hfile_name, api_name, init_method, base_api):
             member_init = ''
             member_assignment = ''
             member_copy = ''
+            member_append = ''
+            member_parse = ''
             for member_name in model["properties"]:
                 member = model["properties"][member_name]
                 if "description" in member:
@@ -329,6 +356,17 @@ def create_h_file(data, hfile_name, api_name, init_method, base_api):
                 member_init += member_name + '");\n'
                 member_assignment += "  " + member_name + " = " + "e." + member_name + ";\n"
                 member_copy += "  e." + member_name + " = " + member_name + ";\n"
+                # the key with the separator before it, which the first
+                # member skips
+                key = ', \\"' + member_name + '\\": '
+                member_append += "  if (" + member_name + "._set) {\n"
+                member_append += '    r.append("' + key + '" + (first ? 2 : 0), first ? ' + str(len(member_name) + 4) + ' : ' + str(len(member_name) + 6) + ');\n'
+                member_append += "    first = false;\n"
+                value = member_name + ("._elements" if member.get("type") == "array" else "()")
+                member_append += "    json::formatter::append(r, " + value + ");\n"
+                member_append += "  }\n"
+                member_parse += '    ' + ('} else ' if member_parse else '') + 'if (key == "' + member_name + '") {\n'
+                member_parse += '      json::parse(r, ' + member_name + ');\n'
             fprintln(hfile, "void register_params() {")
             fprintln(hfile, member_init)
             fprintln(hfile, '}')
@@ -354,6 +392,25 @@ def create_h_file(data, hfile_name, api_name, init_method, base_api):
             fprintln(hfile, member_copy)
             fprintln(hfile, "  return *this;")
             fprintln(hfile, "}")
+            fprintln(hfile, "virtual void append_to(rope& r) const override {")
+            fprintln(hfile, "  bool first = true;")
+            fprintln(hfile, '  r.append("{", 1);')
+            fprint(hfile, member_append)
+            fprintln(hfile, '  r.append("}", 1);')
+            fprintln(hfile, "}")
+            fprintln(hfile, "void parse_json(json::reader& r) {")
+            fprintln(hfile, "  r.begin_object();")
+            fprintln(hfile, "  std::experimental::string_view key;")
+            fprintln(hfile, "  while (r.next_key(key)) {")
+            if member_parse:
+                fprint(hfile, member_parse)
+                fprintln(hfile, "    } else {")
+                fprintln(hfile, "      r.skip();")
+                fprintln(hfile, "    }")
+            else:
+                fprintln(hfile, "    r.skip();")
+            fprintln(hfile, "  }")
+            fprintln(hfile, "}")
             fprintln(hfile, "};\n\n")
 
  #   print_ind_comment(hfile, "", "Initialize the path")
@@ -20,6 +20,7 @@
  */
 
 #include "json_elements.hh"
+#include "core/future-util.hh"
 #include <string.h>
 #include <string>
 #include <vector>
@@ -103,6 +104,43 @@ string json_base::to_json() const {
     return res.as_json();
 }
 
+future<> json_base::write(output_stream<char>& s) const {
+    return s.write("{").then([this, &s] {
+        return do_for_each(_elements, [&s, first = true] (json_base_element* element) mutable {
+            if (element == nullptr || element->_set == false) {
+                return make_ready_future<>();
+            }
+            auto head = (first ? "\"" : ", \"") + element->_name + "\": ";
+            first = false;
+            return s.write(head).then([&s, element] {
+                return element->write(s);
+            });
+        });
+    }).then([&s] {
+        return s.write("}");
+    });
+}
+
+void json_base::append_to(rope& r) const {
+    r.append("{", 1);
+    bool first = true;
+    for (auto element : _elements) {
+        if (element == nullptr || element->_set == false) {
+            continue;
+        }
+        if (first) {
+            r.append("\"", 1);
+            first = false;
+        } else {
+            r.append(", \"", 3);
+        }
+        r.append(element->_name.data(), element->_name.size());
+        r.append("\": ", 3);
+        element->append_to(r);
+    }
+    r.append("}", 1);
+}
+
 bool json_base::is_verify() const {
     for (auto i : _elements) {
         if (!i->is_verify()) {
@@ -26,8 +26,12 @@
 #include <vector>
 #include <time.h>
 #include <sstream>
+#include <memory>
 #include "formatter.hh"
 #include "core/sstring.hh"
+#include "core/do_with.hh"
+#include "core/iostream.hh"
+#include "util/noncopyable_function.hh"
 
 namespace seastar {
 
@@ -75,6 +79,24 @@ class json_base_element {
      */
     virtual std::string to_string() = 0;
 
+    /**
+     * write the internal value in a json format to a stream
+     * @param s the stream to write to
+     * @return a future that resolves when the value was written
+     */
+    virtual future<> write(output_stream<char>& s) {
+        return s.write(to_string());
+    }
+
+    /**
+     * append the internal value in a json format to a rope
+     * @param r the rope to append to
+     */
+    virtual void append_to(rope& r) {
+        auto s = to_string();
+        r.append(s.data(), s.size());
+    }
+
     std::string _name;
     bool _mandatory;
     bool _set;
@@ -121,6 +143,16 @@ class json_element : public json_base_element {
         return _value;
     }
 
+    /**
+     * The value, to be filled in place, as by a parser;
+     * also sets the set value to true.
+     * @return the value itself
+     */
+    T& value_for_update() {
+        _set = true;
+        return _value;
+    }
+
     /**
      * The to_string return the value
      * formated as a json value
@@ -131,6 +163,14 @@ class json_element : public json_base_element {
         return formatter::to_json(_value);
     }
 
+    virtual future<> write(output_stream<char>& s) override {
+        return formatter::write(s, _value);
+    }
+
+    virtual void append_to(rope& r) override {
+        formatter::append(r, _value);
+    }
+
 private:
     T _value;
 };
@@ -159,6 +199,14 @@ class json_list : public json_base_element {
         return formatter::to_json(_elements);
     }
 
+    virtual future<> write(output_stream<char>& s) override {
+        return formatter::write(s, _elements);
+    }
+
+    virtual void append_to(rope& r) override {
+        formatter::append(r, _elements);
+    }
+
     /**
      * Assignment can be done from any object that support const range
      * iteration and that it's elements can be assigned to the list elements
@@ -183,6 +231,28 @@ class jsonable {
      * @return the object formated.
      */
     virtual std::string to_json() const = 0;
+
+    /**
+     * write the object formated to a stream.
+     * The default formats it with to_json(); objects that can be
+     * large should write it piece by piece instead.
+     * @param s the stream to write to
+     * @return a future that resolves when the object was written
+     */
+    virtual future<> write(output_stream<char>& s) const {
+        return s.write(to_json());
+    }
+
+    /**
+     * append the object formated to a rope.
+     * The default copies what to_json() returns; objects formatted
+     * often should append it piece by piece instead.
+     * @param r the rope to append to
+     */
+    virtual void append_to(rope& r) const {
+        auto s = to_json();
+        r.append(s.data(), s.size());
+    }
 };
 
 /**
@@ -211,6 +281,20 @@ struct json_base : public jsonable {
      */
     virtual std::string to_json() const;
 
+    /**
+     * write the object formated to a stream, one element at a time.
+     * The object must live until the returned future resolves.
+     * @param s the stream to write to
+     * @return a future that resolves when the object was written
+     */
+    virtual future<> write(output_stream<char>& s) const override;
+
+    /**
+     * append the object formated to a rope, one element at a time.
+     * @param r the rope to append to
+     */
+    virtual void append_to(rope& r) const override;
+
     /**
      * Check that all mandatory elements are set
      * @return true if all mandatory parameters are set
@@ -260,10 +344,73 @@ struct json_return_type {
     json_return_type(const T& res) {
         _res = formatter::to_json(res);
     }
+    /**
+     * A reply body that is streamed rather than formatted up front,
+     * see stream_object()
+     */
+    using body_writer_type = noncopyable_function<future<>(output_stream<char>&&)>;
+    body_writer_type _body_writer;
+    json_return_type(body_writer_type&& body_writer)
+            : _body_writer(std::move(body_writer)) {
+    }
     json_return_type(json_return_type&&) = default;
     json_return_type& operator=(json_return_type&&) = default;
 };
 
+/**
+ * Returns a body writer, for reply::write_body() or a json_return_type,
+ * that writes the given value to the reply stream in a json format and
+ * closes it.
+ *
+ * Unlike formatter::to_json(), the value is never formatted into one
+ * string: large objects and lists go out piece by piece, as the stream
+ * accepts them.
+ * @param val the value to write
+ */
+template<typename T>
+json_return_type::body_writer_type stream_object(T val) {
+    return [val = std::make_unique<T>(std::move(val))] (output_stream<char>&& s) mutable {
+        return do_with(output_stream<char>(std::move(s)), std::move(val),
+                [] (output_stream<char>& s, std::unique_ptr<T>& val) {
+            return formatter::write(s, *val).finally([&s] {
+                return s.close();
+            });
+        });
+    };
+}
+
+/**
+ * Returns a body writer, like stream_object(), that writes a json list
+ * of fun(e) for each element e of the given range; the converted
+ * elements are created, written and destroyed one at a time.
+ * @param val the range to convert
+ * @param fun the conversion of an element to a json value
+ */
+template<typename Container, typename Func>
+json_return_type::body_writer_type stream_range_as_array(Container val, Func fun) {
+    auto range = std::make_unique<std::pair<Container, Func>>(std::move(val), std::move(fun));
+    return [range = std::move(range)] (output_stream<char>&& s) mutable {
+        return do_with(output_stream<char>(std::move(s)), std::move(range),
+                [] (output_stream<char>& s, std::unique_ptr<std::pair<Container, Func>>& range) {
+            return s.write("[").then([&s, &range] {
+                return do_for_each(range->first, [&s, &fun = range->second, first = true] (auto& e) mutable {
+                    auto f = first ? make_ready_future<>() : s.write(",");
+                    first = false;
+                    return f.then([&s, &fun, &e] {
+                        return do_with(fun(e), [&s] (auto& obj) {
+                            return formatter::write(s, obj);
+                        });
+                    });
+                });
+            }).then([&s] {
+                return s.write("]");
+            }).finally([&s] {
+                return s.close();
+            });
+        });
+    };
+}
+
 }
 
 }
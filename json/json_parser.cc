@@ -0,0 +1,372 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "json_parser.hh"
+#include "core/print.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <time.h>
+#include <type_traits>
+
+namespace seastar {
+
+namespace json {
+
+parse_error::parse_error(const std::string& what, size_t offset)
+        : std::runtime_error(what), _offset(offset) {
+}
+
+void reader::fail(const char* what) const {
+    throw parse_error(sprint("json parse error at offset %d: %s", offset(), what), offset());
+}
+
+void reader::expect(char c) {
+    if (peek() != c) {
+        char what[] = "expected ' '";
+        what[10] = c;
+        fail(what);
+    }
+    ++_p;
+}
+
+bool reader::next(char close) {
+    auto c = peek();
+    if (c == close) {
+        ++_p;
+        // the container is a value of its parent
+        _need_comma = true;
+        return false;
+    }
+    if (_need_comma) {
+        expect(',');
+        _need_comma = false;
+    }
+    return true;
+}
+
+bool reader::next_key(std::experimental::string_view& key) {
+    if (!next('}')) {
+        return false;
+    }
+    if (peek() != '"') {
+        fail("expected a key");
+    }
+    key = read_string(_key);
+    expect(':');
+    _need_comma = false;
+    return true;
+}
+
+static void append_utf8(sstring& buf, uint32_t cp) {
+    char out[4];
+    size_t n;
+    if (cp < 0x80) {
+        out[0] = cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        out[0] = 0xc0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3f);
+        n = 2;
+    } else if (cp < 0x10000) {
+        out[0] = 0xe0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3f);
+        out[2] = 0x80 | (cp & 0x3f);
+        n = 3;
+    } else {
+        out[0] = 0xf0 | (cp >> 18);
+        out[1] = 0x80 | ((cp >> 12) & 0x3f);
+        out[2] = 0x80 | ((cp >> 6) & 0x3f);
+        out[3] = 0x80 | (cp & 0x3f);
+        n = 4;
+    }
+    buf.append(out, n);
+}
+
+std::experimental::string_view reader::read_string(sstring& buf) {
+    expect('"');
+    auto start = _p;
+    auto special = std::find_if(_p, _end, [] (char c) { return c == '"' || c == '\\'; });
+    if (special == _end) {
+        fail("unterminated string");
+    }
+    _p = special + 1;
+    if (*special == '"') {
+        return std::experimental::string_view(start, special - start);
+    }
+    // escaped: unescape what follows the plain prefix
+    buf = sstring(start, special - start);
+    auto hex4 = [this] {
+        if (_end - _p < 4) {
+            fail("truncated \\u escape");
+        }
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) {
+            auto c = *_p++;
+            v <<= 4;
+            if (c >= '0' && c <= '9') {
+                v |= c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                v |= c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                v |= c - 'A' + 10;
+            } else {
+                fail("invalid \\u escape");
+            }
+        }
+        return v;
+    };
+    while (true) {
+        // _p follows a backslash
+        if (_p == _end) {
+            fail("unterminated string");
+        }
+        char c = *_p++;
+        switch (c) {
+        case '"': case '\\': case '/': buf.append(&c, 1); break;
+        case 'b': buf.append("\b", 1); break;
+        case 'f': buf.append("\f", 1); break;
+        case 'n': buf.append("\n", 1); break;
+        case 'r': buf.append("\r", 1); break;
+        case 't': buf.append("\t", 1); break;
+        case 'u': {
+            auto cp = hex4();
+            if (cp >= 0xd800 && cp < 0xdc00 && _end - _p >= 6 && _p[0] == '\\' && _p[1] == 'u') {
+                _p += 2;
+                auto low = hex4();
+                if (low < 0xdc00 || low >= 0xe000) {
+                    fail("invalid surrogate pair");
+                }
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+            }
+            append_utf8(buf, cp);
+            break;
+        }
+        default:
+            fail("invalid escape");
+        }
+        auto run = std::find_if(_p, _end, [] (char c) { return c == '"' || c == '\\'; });
+        if (run == _end) {
+            fail("unterminated string");
+        }
+        buf.append(_p, run - _p);
+        _p = run + 1;
+        if (*run == '"') {
+            return std::experimental::string_view(buf.c_str(), buf.size());
+        }
+    }
+}
+
+std::experimental::string_view reader::read_number() {
+    peek();
+    auto start = _p;
+    auto end = std::find_if(_p, _end, [] (char c) {
+        return !((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E');
+    });
+    if (end == start) {
+        fail("expected a number");
+    }
+    _p = end;
+    _need_comma = true;
+    return std::experimental::string_view(start, end - start);
+}
+
+template<typename Integer>
+Integer reader::read_integer() {
+    auto start = _p;
+    auto s = read_number();
+    auto p = s.begin();
+    bool negative = std::is_signed<Integer>::value && *p == '-';
+    if (negative) {
+        ++p;
+    }
+    using unsigned_type = std::make_unsigned_t<Integer>;
+    unsigned_type limit = unsigned_type(std::numeric_limits<Integer>::max()) + negative;
+    unsigned_type v = 0;
+    if (p == s.end()) {
+        _p = start;
+        fail("expected an integer");
+    }
+    for (; p != s.end(); ++p) {
+        if (*p < '0' || *p > '9') {
+            _p = start;
+            fail("expected an integer");
+        }
+        unsigned_type d = *p - '0';
+        if (v > (limit - d) / 10) {
+            _p = start;
+            fail("integer out of range");
+        }
+        v = v * 10 + d;
+    }
+    return negative ? Integer(-v) : Integer(v);
+}
+
+void reader::skip_literal(const char* literal, size_t len) {
+    peek();
+    if (size_t(_end - _p) < len || !std::equal(literal, literal + len, _p)) {
+        fail("invalid literal");
+    }
+    _p += len;
+    _need_comma = true;
+}
+
+bool reader::null() {
+    if (peek() != 'n') {
+        return false;
+    }
+    skip_literal("null", 4);
+    return true;
+}
+
+void reader::skip() {
+    switch (peek()) {
+    case '{': {
+        begin_object();
+        std::experimental::string_view key;
+        while (next_key(key)) {
+            skip();
+        }
+        break;
+    }
+    case '[':
+        begin_array();
+        while (next_element()) {
+            skip();
+        }
+        break;
+    case '"':
+        read_string(_key);
+        _need_comma = true;
+        break;
+    case 't':
+        skip_literal("true", 4);
+        break;
+    case 'f':
+        skip_literal("false", 5);
+        break;
+    case 'n':
+        skip_literal("null", 4);
+        break;
+    default:
+        read_number();
+    }
+}
+
+void reader::end() {
+    if (peek()) {
+        fail("unexpected text after the value");
+    }
+}
+
+void reader::read(sstring& value) {
+    if (peek() != '"') {
+        fail("expected a string");
+    }
+    auto s = read_string(value);
+    if (s.data() != value.c_str()) {
+        value = sstring(s.data(), s.size());
+    }
+    _need_comma = true;
+}
+
+void reader::read(std::string& value) {
+    if (peek() != '"') {
+        fail("expected a string");
+    }
+    auto s = read_string(_key);
+    value.assign(s.data(), s.size());
+    _need_comma = true;
+}
+
+void reader::read(int& value) {
+    value = read_integer<int>();
+}
+
+void reader::read(long& value) {
+    value = read_integer<long>();
+}
+
+void reader::read(unsigned long& value) {
+    value = read_integer<unsigned long>();
+}
+
+void reader::read(double& value) {
+    auto start = _p;
+    auto s = read_number();
+    // strtod() needs a terminated string
+    char buf[64];
+    if (s.size() >= sizeof(buf)) {
+        _p = start;
+        fail("number too long");
+    }
+    std::copy(s.begin(), s.end(), buf);
+    buf[s.size()] = 0;
+    char* end;
+    value = std::strtod(buf, &end);
+    if (end != buf + s.size()) {
+        _p = start;
+        fail("expected a number");
+    }
+}
+
+void reader::read(float& value) {
+    double d;
+    read(d);
+    value = d;
+}
+
+void reader::read(bool& value) {
+    switch (peek()) {
+    case 't':
+        skip_literal("true", 4);
+        value = true;
+        break;
+    case 'f':
+        skip_literal("false", 5);
+        value = false;
+        break;
+    default:
+        fail("expected a boolean");
+    }
+}
+
+void reader::read(date_time& value) {
+    auto start = _p;
+    sstring s;
+    read(s);
+    // the format of formatter::to_json(const date_time&), but strptime()
+    // cannot read the time zone it has before the year, so it is dropped
+    auto year = s.find_last_of(' ');
+    auto zone = year == sstring::npos ? year : s.find_last_of(' ', year - 1);
+    value = date_time();
+    if (zone == sstring::npos
+            || !strptime((s.substr(0, zone) + s.substr(year)).c_str(), "%a %b %d %I:%M:%S %Y", &value)) {
+        _p = start;
+        fail("expected a date");
+    }
+}
+
+}
+
+}
@@ -0,0 +1,240 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <experimental/string_view>
+#include "core/sstring.hh"
+#include "json_elements.hh"
+
+namespace seastar {
+
+namespace json {
+
+/**
+ * Thrown when a json text cannot be parsed, or does not match the
+ * object it is parsed into
+ */
+class parse_error : public std::runtime_error {
+    size_t _offset;
+public:
+    parse_error(const std::string& what, size_t offset);
+    /**
+     * @return the offset in the text where parsing stopped
+     */
+    size_t offset() const {
+        return _offset;
+    }
+};
+
+/**
+ * A streaming json parser, that reads a text one token at a time, as
+ * the code consuming it asks, rather than building a document first.
+ *
+ * The caller drives it in the shape it expects; an object is read by
+ * \ref begin_object() followed by \ref next_key() and a value for each
+ * key, an array by \ref begin_array() followed by \ref next_element()
+ * and a value for each element. Values it does not want are passed over
+ * with \ref skip(). Nothing is allocated other than the strings read.
+ *
+ * The code generated by json2code.py parses its objects with it, see
+ * \ref from_json().
+ */
+class reader {
+    const char* _begin;
+    const char* _p;
+    const char* _end;
+    // whether a value was read since the current container's last
+    // separator, so that the next member must be preceded by one
+    bool _need_comma = false;
+    // holds the last key, when it was escaped
+    sstring _key;
+private:
+    [[noreturn]] void fail(const char* what) const;
+    void skip_whitespace() {
+        while (_p != _end && (*_p == ' ' || *_p == '\n' || *_p == '\r' || *_p == '\t')) {
+            ++_p;
+        }
+    }
+    char peek() {
+        skip_whitespace();
+        return _p == _end ? 0 : *_p;
+    }
+    void expect(char c);
+    // Reads a string, returning it as it is in the text when it has no
+    // escapes, and unescaped into buf otherwise
+    std::experimental::string_view read_string(sstring& buf);
+    // Returns the text of a number
+    std::experimental::string_view read_number();
+    template<typename Integer>
+    Integer read_integer();
+    void skip_literal(const char* literal, size_t len);
+    bool next(char close);
+public:
+    reader(const char* text, size_t len)
+            : _begin(text), _p(text), _end(text + len) {
+    }
+    /// \param text the text to read, which must outlive the reader
+    explicit reader(const sstring& text)
+            : reader(text.c_str(), text.size()) {
+    }
+    reader(sstring&&) = delete;
+    reader(const reader&) = delete;
+    reader& operator=(const reader&) = delete;
+
+    /**
+     * @return the offset of the next token in the text
+     */
+    size_t offset() const {
+        return _p - _begin;
+    }
+
+    /**
+     * Reads the opening of an object
+     */
+    void begin_object() {
+        expect('{');
+        _need_comma = false;
+    }
+
+    /**
+     * Reads the key of the next member of the current object, which stays
+     * valid until the reader is used again; the member's value must be
+     * read next.
+     * @param key set to the key read
+     * @return false, having read the end of the object, if there are no
+     * more members
+     */
+    bool next_key(std::experimental::string_view& key);
+
+    /**
+     * Reads the opening of an array
+     */
+    void begin_array() {
+        expect('[');
+        _need_comma = false;
+    }
+
+    /**
+     * Moves to the next element of the current array, which must be read
+     * next.
+     * @return false, having read the end of the array, if there are no
+     * more elements
+     */
+    bool next_element() {
+        return next(']');
+    }
+
+    /**
+     * Reads a null, if it is the next value
+     * @return true if a null was read
+     */
+    bool null();
+
+    /**
+     * Passes over the next value, of any type
+     */
+    void skip();
+
+    /**
+     * Checks that nothing but white space is left in the text
+     */
+    void end();
+
+    void read(sstring& value);
+    void read(std::string& value);
+    void read(int& value);
+    void read(long& value);
+    void read(unsigned long& value);
+    void read(float& value);
+    void read(double& value);
+    void read(bool& value);
+    void read(date_time& value);
+};
+
+/**
+ * Parses a value of a type supported by \ref reader::read().
+ * @param r the reader to read from
+ * @param value the value to fill
+ */
+template<typename T>
+inline auto parse(reader& r, T& value) -> decltype(r.read(value)) {
+    r.read(value);
+}
+
+/**
+ * Parses an object with a parse_json(reader&) method, as the json2code.py
+ * generated objects have.
+ * @param r the reader to read from
+ * @param obj the object to fill
+ */
+template<typename T>
+inline auto parse(reader& r, T& obj) -> decltype(obj.parse_json(r)) {
+    obj.parse_json(r);
+}
+
+/**
+ * Parses the value of a \ref json_element, setting it; a null leaves
+ * it unset.
+ */
+template<typename T>
+inline void parse(reader& r, json_element<T>& e) {
+    if (!r.null()) {
+        parse(r, e.value_for_update());
+    }
+}
+
+/**
+ * Parses the elements of a \ref json_list, appending them; a null
+ * leaves it unset.
+ */
+template<typename T>
+inline void parse(reader& r, json_list<T>& l) {
+    if (r.null()) {
+        return;
+    }
+    l._set = true;
+    r.begin_array();
+    while (r.next_element()) {
+        l._elements.emplace_back();
+        parse(r, l._elements.back());
+    }
+}
+
+/**
+ * Parses a whole json text into obj
+ * @param text the text to parse
+ * @param obj the object to fill
+ * @throws parse_error if the text is not valid json, or does not match
+ * the object
+ */
+template<typename T>
+void from_json(const sstring& text, T& obj) {
+    reader r(text);
+    parse(r, obj);
+    r.end();
+}
+
+}
+
+}
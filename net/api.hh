@@ -37,6 +37,8 @@
 
 namespace seastar {
 
+class memory_account;
+
 static inline
 bool is_ip_unspecified(ipv4_addr &addr) {
     return addr.ip == 0;
@@ -92,6 +94,59 @@ struct sctp_keepalive_params {
 
 using keepalive_params = boost::variant<tcp_keepalive_params, sctp_keepalive_params>;
 
+/// Steers the received TCP and UDP packets of matching flows to a shard,
+/// instead of the one RSS picks; see \ref network_stack::add_flow_rule().
+/// Zero fields match anything, but a rule must match a port.
+struct flow_rule {
+    /// The port the packets are sent to, such as a listening port
+    uint16_t local_port = 0;
+    /// The sender of the packets; rules with an address match IPv4 only
+    ipv4_addr remote;
+    /// The shard that receives the matching packets
+    unsigned cpu = 0;
+};
+
+/// The state of a TCP connection, see \ref connected_socket::get_tcp_info().
+/// Fields the stack does not know are zero.
+struct tcp_connection_info {
+    /// Smoothed round-trip time
+    std::chrono::microseconds rtt{0};
+    /// Round-trip time variation
+    std::chrono::microseconds rtt_var{0};
+    /// Maximum segment size the connection sends
+    uint32_t mss = 0;
+    /// Congestion window, in bytes
+    uint32_t cwnd = 0;
+    /// Slow start threshold, in bytes
+    uint32_t ssthresh = 0;
+    /// Bytes sent and not yet acknowledged
+    uint32_t bytes_in_flight = 0;
+    /// Receive window the peer advertises, in bytes
+    uint32_t send_window = 0;
+    /// Receive window advertised to the peer, in bytes
+    uint32_t receive_window = 0;
+    /// Segments retransmitted since the connection started
+    uint64_t retransmits = 0;
+};
+
+/// The shard's budget for received data that the application has not
+/// consumed yet: the read buffers of posix connections, until they are
+/// freed, and the receive queues of native TCP connections.
+///
+/// By default its soft limit is an eighth of the shard's memory; change it
+/// with \ref memory_account::set_limits(). As the budget fills, posix
+/// connections read into smaller buffers and native TCP connections
+/// advertise smaller windows (see \ref receive_buffer_size()); over its
+/// soft limit, posix connections stop reading until buffers are freed.
+/// Read buffers must be freed on the shard that received them.
+memory_account& receive_memory();
+
+/// Returns the size of a receive buffer, or window, of at most \c size
+/// bytes: \c size while the \ref receive_memory() budget is less than half
+/// used, then shrinking linearly down to \c min_size as it reaches its soft
+/// limit.
+size_t receive_buffer_size(size_t size, size_t min_size);
+
 /// \cond internal
 class connected_socket_impl;
 class socket_impl;
@@ -117,6 +172,9 @@ class udp_datagram final {
     ipv4_addr get_src() { return _impl->get_src(); }
     ipv4_addr get_dst() { return _impl->get_dst(); }
     uint16_t get_dst_port() { return _impl->get_dst_port(); }
+    /// The datagram's payload. Its fragments point into the stack's receive
+    /// buffers (the NIC's on the native stack), uncopied; the packet may be
+    /// moved out, and the buffers are released when it is destroyed.
     packet& get_data() { return _impl->get_data(); }
 };
 
@@ -186,6 +244,31 @@ class connected_socket {
     void set_keepalive_parameters(const net::keepalive_params& p);
     /// Get TCP keepalive parameters
     net::keepalive_params get_keepalive_parameters() const;
+    /// Sets the TCP congestion control algorithm (TCP_CONGESTION), such as
+    /// "reno", "cubic" or "bbr".
+    ///
+    /// The posix stack may use any algorithm the kernel allows; the
+    /// native stack has the three above, and throws std::invalid_argument
+    /// for other names.
+    void set_congestion_control(const sstring& name);
+    /// Gets the TCP congestion control algorithm
+    sstring get_congestion_control() const;
+    /// Sends writes of at least \c bytes without copying them (0, the
+    /// default, disables it).
+    ///
+    /// The posix stack then sends them with MSG_ZEROCOPY, and holds on to
+    /// their buffers until the kernel is done with them, rather than only
+    /// until they are queued in the socket. Pinning pages costs more than
+    /// copying a few of them, so the threshold should be tens of
+    /// kilobytes; and the kernel copies loopback traffic anyway, which
+    /// stops the socket from trying. Kernels without MSG_ZEROCOPY keep on
+    /// copying, and the native stack never copies.
+    void set_zero_copy_threshold(size_t bytes);
+    /// Gets the connection's round-trip time, congestion and window state,
+    /// from TCP_INFO on the posix stack.
+    ///
+    /// Throws std::runtime_error for connections other than TCP.
+    net::tcp_connection_info get_tcp_info() const;
 
     /// Disables output to the socket.
     ///
@@ -285,6 +368,19 @@ class network_stack {
         return make_ready_future();
     }
     virtual bool has_per_core_namespace() = 0;
+    /// Adds a rule that sends the received packets of matching flows to
+    /// \c rule.cpu, for all shards. Devices that can are programmed to
+    /// deliver them to that shard's queue (NIC flow rules), sparing the
+    /// software forwarding others do. Other flow rules take precedence
+    /// over the later added ones.
+    ///
+    /// Connections that a new rule moves off their shard break, so rules
+    /// should be added before their ports are used, typically before
+    /// listening on them. Stacks that don't steer packets (posix) fail
+    /// the returned future.
+    virtual future<> add_flow_rule(net::flow_rule rule) {
+        return make_exception_future<>(std::runtime_error("flow rules are not supported by this network stack"));
+    }
 };
 
 }
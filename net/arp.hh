@@ -28,6 +28,7 @@
 #include "core/byteorder.hh"
 #include "ethernet.hh"
 #include "core/print.hh"
+#include "core/shared_future.hh"
 #include <unordered_map>
 
 namespace seastar {
@@ -89,6 +90,14 @@ class arp_for : public arp_for_protocol {
     using l3addr = typename L3::address_type;
 private:
     static constexpr auto max_waiters = 512;
+    // Entries older than this (in seconds) are refreshed, by a query sent
+    // while they are still used, by the shard owning the address...
+    static constexpr unsigned reachable_time = 60;
+    // ...or by any shard using them, if that shard didn't
+    static constexpr unsigned refresh_grace = 5;
+    // Queries, a second apart, after which an entry that was not refreshed
+    // is dropped
+    static constexpr unsigned refresh_queries = 3;
     enum oper {
         op_request = 1,
         op_reply = 2,
@@ -132,16 +141,34 @@ class arp_for : public arp_for_protocol {
             return 8 + 2 * (l2addr::size() + l3addr::size());
         }
     };
+    struct entry {
+        l2addr hwaddr;
+        lowres_clock::time_point learned;
+        // never refreshed: the broadcast and own addresses
+        bool permanent = false;
+    };
+    // The lookups waiting for an address share one promise, so a burst of
+    // packets to an unresolved address costs one query
     struct resolution {
-        std::vector<promise<l2addr>> _waiters;
+        shared_promise<l2addr> _resolved;
+        size_t _waiters = 0;
+        // of an entry still in use, which lookups don't wait for
+        bool _refresh = false;
+        unsigned _queries = 0;
+        // the refresh got no reply, and the entry was dropped
+        bool _failed = false;
         timer<> _timeout_timer;
     };
 private:
     l3addr _l3self = L3::broadcast_address();
-    std::unordered_map<l3addr, l2addr> _table;
+    // Each shard has its own copy, and learn() is called on all shards
+    // when a reply is received
+    std::unordered_map<l3addr, entry> _table;
     std::unordered_map<l3addr, resolution> _in_progress;
 private:
     packet make_query_packet(l3addr paddr);
+    resolution& start_resolution(const l3addr& paddr, bool refresh);
+    void maybe_refresh(const l3addr& paddr, const entry& e);
     virtual future<> received(packet p) override;
     future<> handle_request(arp_hdr* ah);
     l2addr l2self() { return _arp.l2self(); }
@@ -149,14 +176,14 @@ class arp_for : public arp_for_protocol {
 public:
     future<> send_query(const l3addr& paddr);
     explicit arp_for(arp& a) : arp_for_protocol(a, L3::arp_protocol_type()) {
-        _table[L3::broadcast_address()] = ethernet::broadcast_address();
+        _table[L3::broadcast_address()] = entry{ethernet::broadcast_address(), {}, true};
     }
     future<ethernet_address> lookup(const l3addr& addr);
     void learn(l2addr l2, l3addr l3);
     void run();
     void set_self_addr(l3addr addr) {
         _table.erase(_l3self);
-        _table[addr] = l2self();
+        _table[addr] = entry{l2self(), {}, true};
         _l3self = addr;
     }
     friend class arp;
@@ -209,47 +236,79 @@ class arp_queue_full_error : public arp_error {
 };
 
 template <typename L3>
-future<ethernet_address>
-arp_for<L3>::lookup(const l3addr& paddr) {
-    auto i = _table.find(paddr);
-    if (i != _table.end()) {
-        return make_ready_future<ethernet_address>(i->second);
-    }
+typename arp_for<L3>::resolution&
+arp_for<L3>::start_resolution(const l3addr& paddr, bool refresh) {
     auto j = _in_progress.find(paddr);
-    auto first_request = j == _in_progress.end();
-    auto& res = first_request ? _in_progress[paddr] : j->second;
-
-    if (first_request) {
-        res._timeout_timer.set_callback([paddr, this, &res] {
-            send_query(paddr);
-            for (auto& w : res._waiters) {
-                w.set_exception(arp_timeout_error());
+    if (j != _in_progress.end()) {
+        if (!j->second._failed) {
+            return j->second;
+        }
+        _in_progress.erase(j);
+    }
+    auto& res = _in_progress[paddr];
+    res._refresh = refresh;
+    res._timeout_timer.set_callback([paddr, this, &res] {
+        if (res._refresh) {
+            if (++res._queries == refresh_queries) {
+                // the neighbor is gone, or has a new address that it
+                // didn't announce: resolve it again on next use
+                _table.erase(paddr);
+                res._failed = true;
+                res._timeout_timer.cancel();
+                return;
             }
-            res._waiters.clear();
-        });
-        res._timeout_timer.arm_periodic(std::chrono::seconds(1));
+            send_query(paddr);
+            return;
+        }
         send_query(paddr);
+        res._resolved.set_exception(arp_timeout_error());
+        res._resolved = shared_promise<l2addr>();
+        res._waiters = 0;
+    });
+    res._timeout_timer.arm_periodic(std::chrono::seconds(1));
+    send_query(paddr);
+    return res;
+}
+
+template <typename L3>
+void
+arp_for<L3>::maybe_refresh(const l3addr& paddr, const entry& e) {
+    auto owner = std::hash<l3addr>()(paddr) % smp::count == engine().cpu_id();
+    auto refresh_age = std::chrono::seconds(owner ? reachable_time : reachable_time + refresh_grace);
+    if (lowres_clock::now() - e.learned >= refresh_age) {
+        start_resolution(paddr, true);
     }
+}
 
-    if (res._waiters.size() >= max_waiters) {
+template <typename L3>
+future<ethernet_address>
+arp_for<L3>::lookup(const l3addr& paddr) {
+    auto i = _table.find(paddr);
+    if (i != _table.end()) {
+        if (!i->second.permanent) {
+            maybe_refresh(paddr, i->second);
+        }
+        return make_ready_future<ethernet_address>(i->second.hwaddr);
+    }
+    auto& res = start_resolution(paddr, false);
+    if (res._waiters >= max_waiters) {
         return make_exception_future<ethernet_address>(arp_queue_full_error());
     }
-
-    res._waiters.emplace_back();
-    return res._waiters.back().get_future();
+    ++res._waiters;
+    return res._resolved.get_shared_future();
 }
 
 template <typename L3>
 void
 arp_for<L3>::learn(l2addr hwaddr, l3addr paddr) {
-    _table[paddr] = hwaddr;
+    auto& e = _table[paddr];
+    e.hwaddr = hwaddr;
+    e.learned = lowres_clock::now();
     auto i = _in_progress.find(paddr);
     if (i != _in_progress.end()) {
         auto& res = i->second;
         res._timeout_timer.cancel();
-        for (auto &&pr : res._waiters) {
-            pr.set_value(hwaddr);
-        }
+        res._resolved.set_value(hwaddr);
         _in_progress.erase(i);
     }
 }
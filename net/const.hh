@@ -27,7 +27,7 @@ namespace seastar {
 namespace net {
 
 enum class ip_protocol_num : uint8_t {
-    icmp = 1, tcp = 6, udp = 17, unused = 255
+    icmp = 1, tcp = 6, udp = 17, icmpv6 = 58, unused = 255
 };
 
 enum class eth_protocol_num : uint16_t {
@@ -23,6 +23,8 @@
 #include <experimental/string_view>
 
 #include <c-ares/ares.h>
+#include <arpa/nameser.h>
+#include <boost/intrusive/list.hpp>
 
 #include "ip.hh"
 #include "api.hh"
@@ -31,6 +33,7 @@
 #include "core/timer.hh"
 #include "core/reactor.hh"
 #include "core/gate.hh"
+#include "core/shared_future.hh"
 #include "util/log.hh"
 
 namespace seastar {
@@ -113,6 +116,8 @@ class net::dns_resolver::impl
         : _stack(stack)
         , _timeout(opts.timeout ? *opts.timeout : std::chrono::milliseconds(5000) /* from ares private */)
         , _timer(std::bind(&impl::poll_sockets, this))
+        , _cache_size(opts.cache_size ? *opts.cache_size : 1024)
+        , _negative_ttl(opts.negative_ttl ? *opts.negative_ttl : std::chrono::seconds(5))
     {
         static const ares_initializer a_init;
 
@@ -205,7 +210,182 @@ class net::dns_resolver::impl
         });
     }
 
-    future<hostent> get_host_by_name(sstring name, inet_address::family family)  {
+    future<hostent> get_host_by_name(sstring name, inet_address::family family) {
+        if (!_cache_size) {
+            return query_host_by_name(std::move(name), family);
+        }
+        cache_key k{std::move(name), family};
+        auto now = lowres_clock::now();
+        auto i = _cache.find(k);
+        if (i != _cache.end() && now < i->second.expiry) {
+            auto& e = i->second;
+            _lru.erase(_lru.iterator_to(e));
+            _lru.push_front(e);
+            if (now >= e.refresh && !_pending.count(k)) {
+                lookup(k).then_wrapped([] (future<hostent> f) {
+                    f.ignore_ready_future();
+                });
+            }
+            if (e.error) {
+                return make_exception_future<hostent>(e.error);
+            }
+            return make_ready_future<hostent>(e.host);
+        }
+        return lookup(k);
+    }
+private:
+    struct cache_key {
+        sstring name;
+        inet_address::family family;
+        bool operator==(const cache_key& x) const {
+            return family == x.family && name == x.name;
+        }
+        struct hash {
+            size_t operator()(const cache_key& k) const {
+                return std::hash<sstring>()(k.name) ^ size_t(k.family);
+            }
+        };
+    };
+    struct cache_entry {
+        cache_key key;
+        hostent host;
+        std::exception_ptr error; // of a name that doesn't exist
+        lowres_clock::time_point expiry;
+        lowres_clock::time_point refresh;
+        boost::intrusive::list_member_hook<> lru_link;
+    };
+    struct resolved {
+        hostent host;
+        uint32_t ttl; // 0 if not to be cached
+    };
+
+    // Queries for k, along with the other lookups of it in progress, and
+    // caches the answer
+    future<hostent> lookup(const cache_key& k) {
+        auto i = _pending.find(k);
+        if (i != _pending.end()) {
+            return i->second->get_shared_future();
+        }
+        auto sp = make_lw_shared<shared_promise<hostent>>();
+        _pending.emplace(k, sp);
+        search_host_by_name(k.name, k.family).then_wrapped([this, k, sp, me = shared_from_this()] (future<resolved> f) {
+            _pending.erase(k);
+            try {
+                auto r = f.get0();
+                if (r.ttl) {
+                    insert(k, r.host, {}, std::chrono::seconds(r.ttl));
+                }
+                sp->set_value(std::move(r.host));
+            } catch (std::system_error& e) {
+                if (e.code().category() == ares_errorc
+                        && (e.code().value() == ARES_ENOTFOUND || e.code().value() == ARES_ENODATA)) {
+                    insert(k, {}, std::current_exception(), _negative_ttl);
+                }
+                sp->set_exception(std::current_exception());
+            } catch (...) {
+                sp->set_exception(std::current_exception());
+            }
+        });
+        return sp->get_shared_future();
+    }
+    void insert(const cache_key& k, hostent host, std::exception_ptr error, std::chrono::seconds ttl) {
+        if (_closed) {
+            return;
+        }
+        auto now = lowres_clock::now();
+        auto r = _cache.emplace(k, cache_entry());
+        auto& e = r.first->second;
+        if (r.second) {
+            e.key = k;
+            _lru.push_front(e);
+        }
+        e.host = std::move(host);
+        e.error = std::move(error);
+        e.expiry = now + ttl;
+        // names still in use near the end of their ttl are queried again
+        e.refresh = e.error ? e.expiry : now + ttl * 9 / 10;
+        while (_cache.size() > _cache_size) {
+            auto key = _lru.back().key;
+            _lru.pop_back();
+            _cache.erase(key);
+        }
+    }
+
+    // Like ares_gethostbyname(), but from the records of the answer, so
+    // that their TTL is known
+    future<resolved> search_host_by_name(sstring name, inet_address::family family) {
+        union {
+            in_addr in;
+            in6_addr in6;
+        } addr;
+        if (inet_pton(int(family), name.c_str(), &addr) == 1) {
+            hostent e;
+            e.names.push_back(name);
+            if (family == inet_address::family::INET) {
+                e.addr_list.emplace_back(addr.in);
+            } else {
+                e.addr_list.emplace_back(addr.in6);
+            }
+            return make_ready_future<resolved>(resolved{std::move(e), 0});
+        }
+        ::hostent* host = nullptr;
+        if (ares_gethostbyname_file(_channel, name.c_str(), int(family), &host) == ARES_SUCCESS) {
+            auto e = make_hostent(*host);
+            ares_free_hostent(host);
+            return make_ready_future<resolved>(resolved{std::move(e), 0});
+        }
+
+        struct query {
+            promise<resolved> pr;
+            inet_address::family family;
+        };
+        auto q = new query{promise<resolved>(), family};
+        auto f = q->pr.get_future();
+
+        dns_log.debug("Search name {} ({})", name, family);
+
+        dns_call call(*this);
+
+        ares_search(_channel, name.c_str(), ns_c_in, family == inet_address::family::INET ? ns_t_a : ns_t_aaaa,
+                [](void* arg, int status, int timeouts, unsigned char* abuf, int alen) {
+            std::unique_ptr<query> q(reinterpret_cast<query*>(arg));
+            constexpr int max_addrs = 32;
+            ::hostent* host = nullptr;
+            int naddrs = max_addrs;
+            uint32_t ttl = std::numeric_limits<uint32_t>::max();
+            if (status == ARES_SUCCESS) {
+                if (q->family == inet_address::family::INET) {
+                    ares_addrttl ttls[max_addrs];
+                    status = ares_parse_a_reply(abuf, alen, &host, ttls, &naddrs);
+                    for (int i = 0; i < naddrs; ++i) {
+                        ttl = std::min(ttl, uint32_t(ttls[i].ttl));
+                    }
+                } else {
+                    ares_addr6ttl ttls[max_addrs];
+                    status = ares_parse_aaaa_reply(abuf, alen, &host, ttls, &naddrs);
+                    for (int i = 0; i < naddrs; ++i) {
+                        ttl = std::min(ttl, uint32_t(ttls[i].ttl));
+                    }
+                }
+            }
+            if (status != ARES_SUCCESS) {
+                dns_log.debug("Query failed: {}", status);
+                q->pr.set_exception(std::system_error(status, ares_errorc));
+                return;
+            }
+            auto e = make_hostent(*host);
+            ares_free_hostent(host);
+            q->pr.set_value(resolved{std::move(e), naddrs ? ttl : 0});
+        }, reinterpret_cast<void *>(q));
+
+        poll_sockets();
+
+        return f.finally([this] {
+            end_call();
+        });
+    }
+public:
+    future<hostent> query_host_by_name(sstring name, inet_address::family family) {
         auto p = new promise<hostent>();
         auto f = p->get_future();
 
@@ -277,6 +457,8 @@ class net::dns_resolver::impl
 
     future<> close() {
         _closed = true;
+        _lru.clear();
+        _cache.clear();
         ares_cancel(_channel);
         dns_log.trace("Shutting down {} sockets", _sockets.size());
         for (auto & p : _sockets) {
@@ -845,6 +1027,15 @@ class net::dns_resolver::impl
     timer<> _timer;
     gate _gate;
     bool _closed = false;
+
+    using lru_type = boost::intrusive::list<cache_entry,
+            boost::intrusive::member_hook<cache_entry, boost::intrusive::list_member_hook<>, &cache_entry::lru_link>,
+            boost::intrusive::constant_time_size<false>>;
+    size_t _cache_size;
+    std::chrono::seconds _negative_ttl;
+    std::unordered_map<cache_key, cache_entry, cache_key::hash> _cache;
+    lru_type _lru; // most recently used first
+    std::unordered_map<cache_key, lw_shared_ptr<shared_promise<hostent>>, cache_key::hash> _pending;
 };
 
 net::dns_resolver::dns_resolver()
@@ -79,6 +79,13 @@ class dns_resolver {
             tcp_port, udp_port;
         std::experimental::optional<std::vector<sstring>>
             domains;
+        // Names whose lookups are cached, for the TTL of their records;
+        // 0 disables the cache (default 1024)
+        std::experimental::optional<size_t>
+            cache_size;
+        // How long lookups of names that don't exist are cached (default 5s)
+        std::experimental::optional<std::chrono::seconds>
+            negative_ttl;
     };
 
     dns_resolver();
@@ -90,7 +97,14 @@ class dns_resolver {
     dns_resolver& operator=(dns_resolver&&) noexcept;
 
     /**
-     * Resolves a hostname to one or more addresses and aliases
+     * Resolves a hostname to one or more addresses and aliases.
+     *
+     * Unless disabled in the options, answers are cached per resolver
+     * for the TTL of their records, names that don't exist for the
+     * negative TTL, and concurrent lookups of a name share one query.
+     * A cached name looked up in the last tenth of its TTL is queried
+     * again in the background, so that names in use do not expire.
+     * Numeric addresses and names from the hosts file are not cached.
      */
     future<hostent> get_host_by_name(const sstring&, opt_family = {});
     /**
@@ -33,7 +33,9 @@
 #include "core/metrics.hh"
 #include "util/function_input_iterator.hh"
 #include "util/transform_iterator.hh"
+#include <algorithm>
 #include <atomic>
+#include <limits>
 #include <vector>
 #include <queue>
 #include <experimental/optional>
@@ -53,6 +55,9 @@
 #include <rte_eal.h>
 #include <rte_pci.h>
 #include <rte_ethdev.h>
+#if RTE_VERSION >= RTE_VERSION_NUM(17,2,0,0)
+#include <rte_flow.h>
+#endif
 #include <rte_cycles.h>
 #include <rte_memzone.h>
 
@@ -103,7 +108,14 @@ static constexpr uint16_t rx_gc_thresh           = 64;
 //
 static constexpr uint16_t mbufs_per_queue_tx     = 2 * default_ring_size;
 
-static constexpr uint16_t mbuf_cache_size        = 512;
+//
+// The pools of a queue are only used by the queue's shard, so their per-lcore
+// cache is the shard's own: let it hold as much of the pool as DPDK allows
+// (the cache is flushed at 1.5 times its size, which must not exceed the pool).
+//
+static constexpr unsigned mempool_cache_size(unsigned nr_mbufs) {
+    return std::min<unsigned>(RTE_MEMPOOL_CACHE_MAX_SIZE, nr_mbufs * 2 / 3);
+}
 static constexpr uint16_t mbuf_overhead          =
                                  sizeof(struct rte_mbuf) + RTE_PKTMBUF_HEADROOM;
 //
@@ -181,6 +193,11 @@ static constexpr const char* pktmbuf_pool_name   = "dpdk_pktmbuf_pool";
  * When doing reads from the NIC queues, use this batch size
  */
 static constexpr uint8_t packet_read_size        = 32;
+/*
+ * ...and up to this one while the bursts keep coming back full, that is while
+ * the queue is filling up faster than we read it
+ */
+static constexpr uint8_t max_packet_read_size    = 128;
 /******************************************************************************/
 
 struct port_stats {
@@ -195,6 +212,7 @@ struct port_stats {
 
         struct {
             uint64_t dropped;      // missed packets (e.g. full FIFO)
+            uint64_t no_mbufs;     // packets dropped for lack of Rx mbufs
             uint64_t crc;          // packets with CRC error
             uint64_t len;          // packets with a bad length
             uint64_t total;        // total number of erroneous received packets
@@ -221,6 +239,7 @@ struct port_stats {
         (rx_length_errors) \
         (rx_undersize_errors) \
         (rx_oversize_errors) \
+        (rx_mbuf_allocation_errors) \
         (tx_xon_packets) \
         (tx_xoff_packets)
 
@@ -260,6 +279,10 @@ class dpdk_xstats {
 
     uint64_t get_value(const xstat_id id) {
         auto off = _offsets[static_cast<int>(id)];
+        // not all PMDs have all the stats
+        if (off < 0) {
+            return 0;
+        }
         return _xstats[off].value;
     }
 
@@ -318,7 +341,19 @@ class dpdk_device : public device {
     seastar::metrics::metric_groups _metrics;
     bool _is_i40e_device = false;
     bool _is_vmxnet3_device = false;
+    // The stack is told the port checksums TCP and UDP, but it is done here
+    bool _sw_tx_csum_l4 = false;
+    // The port verifies only some of IPv4, TCP and UDP checksums; the
+    // packets it verified are marked in their offload_info
+    bool _rx_csum_per_packet = false;
     dpdk_xstats _xstats;
+    // DPDK's hugepage memory segments, by address
+    struct dma_region {
+        const char* va;
+        size_t len;
+        phys_addr_t pa;
+    };
+    std::vector<dma_region> _dma_regions;
 
 public:
     rte_eth_dev_info _dev_info = {};
@@ -364,6 +399,11 @@ class dpdk_device : public device {
      */
     void set_hw_flow_control();
 
+    /**
+     * Collects DPDK's memory segments, for translate_dpdk_memory().
+     */
+    void init_dma_regions();
+
 public:
     dpdk_device(uint8_t port_idx, uint16_t num_queues, bool use_lro,
                 bool enable_fc)
@@ -387,6 +427,8 @@ class dpdk_device : public device {
            show up only after port initization */
         _xstats.start();
 
+        init_dma_regions();
+
         _stats_collector.set_callback([&] {
             rte_eth_stats rte_stats = {};
             int rc = rte_eth_stats_get(_port_idx, &rte_stats);
@@ -408,6 +450,9 @@ class dpdk_device : public device {
                 _xstats.get_value(dpdk_xstats::xstat_id::rx_length_errors) +
                 _xstats.get_value(dpdk_xstats::xstat_id::rx_undersize_errors) +
                 _xstats.get_value(dpdk_xstats::xstat_id::rx_oversize_errors);
+            _stats.rx.bad.dropped     = rte_stats.imissed;
+            _stats.rx.bad.no_mbufs    =
+                _xstats.get_value(dpdk_xstats::xstat_id::rx_mbuf_allocation_errors);
             _stats.rx.bad.total       = rte_stats.ierrors;
 
             _stats.tx.good.pause_xon  =
@@ -434,6 +479,10 @@ class dpdk_device : public device {
                                             "A non-zero value of this counter indicated the overflow of ingress HW buffers. "
                                             "This usually happens because of a rate of a sender on the other side of the link is higher than we can process as a receiver."), {sm::shard_label(_stats_plugin_inst)}),
 
+            sm::make_derive("rx_no_mbufs", _stats.rx.bad.no_mbufs,
+                            sm::description("Counts a number of received packets dropped because a queue ran out of Rx mbufs. "
+                                            "A non-zero value of this metric means that a queue's pool is too small for the bursts it receives: see the queues' rx_mbufs_free."), {sm::shard_label(_stats_plugin_inst)}),
+
             sm::make_derive("rx_bad_length_errors", _stats.rx.bad.len,
                             sm::description("Counts a number of received packets with a bad length value. "
                                             "A non-zero value of this metric usually indicates a HW issue: e.g. bad cable."), {sm::shard_label(_stats_plugin_inst)}),
@@ -506,6 +555,26 @@ class dpdk_device : public device {
         assert(_redir_table.size());
         return _redir_table[hash & (_redir_table.size() - 1)];
     }
+    virtual unsigned hw_reta_size() override {
+        return _dev_info.reta_size && _num_queues > 1 ? _redir_table.size() : 0;
+    }
+    /**
+     * Point one entry of the RSS table, in the device and in the internal
+     * vector, to another queue.
+     *
+     * @param idx entry of the table
+     * @param qid queue it sends to from now on
+     */
+    virtual void update_hw_reta(unsigned idx, unsigned qid) override;
+#if RTE_VERSION >= RTE_VERSION_NUM(17,2,0,0)
+    /**
+     * Add rte_flow rules sending the IPv4 TCP and UDP packets that match
+     * rule to a queue. PMDs without flow API support refuse them.
+     *
+     * @return true if both rules were created
+     */
+    virtual bool install_flow_rule(const flow_rule& rule, unsigned qid) override;
+#endif
     uint8_t port_idx() { return _port_idx; }
     bool is_i40e_device() const {
         return _is_i40e_device;
@@ -513,6 +582,37 @@ class dpdk_device : public device {
     bool is_vmxnet3_device() const {
         return _is_vmxnet3_device;
     }
+    /**
+     * Translates memory that DPDK allocated from its hugepages (e.g. with
+     * rte_malloc()), which memory::translate() knows nothing about.
+     *
+     * @param va virtual address of the data
+     * @param len length of the data
+     *
+     * @return the physical address of va and the length of the physically
+     *         contiguous part of [va, va + len), or a zero sized
+     *         translation if va is not in DPDK's memory.
+     */
+    memory::translation translate_dpdk_memory(const char* va, size_t len) const {
+        auto i = std::upper_bound(_dma_regions.begin(), _dma_regions.end(), va,
+                [] (const char* a, const dma_region& r) { return a < r.va; });
+        if (i == _dma_regions.begin()) {
+            return {};
+        }
+        auto& r = *std::prev(i);
+        size_t off = va - r.va;
+        if (off >= r.len) {
+            return {};
+        }
+        return memory::translation(r.pa + off, std::min(len, r.len - off));
+    }
+    bool sw_tx_csum_l4() const {
+        return _sw_tx_csum_l4;
+    }
+
+    bool rx_csum_per_packet() const {
+        return _rx_csum_per_packet;
+    }
 
     virtual const rss_key_type& rss_key() const override { return _rss_key; }
 };
@@ -631,7 +731,8 @@ class dpdk_qp : public net::qp {
                 head->l2_len = sizeof(struct ether_hdr);
                 head->l3_len = oi.ip_hdr_len;
             }
-            if (qp.port().hw_features().tx_csum_l4_offload) {
+            // Packets checksummed by the stack (IPv6 ones) are left alone
+            if (qp.port().hw_features().tx_csum_l4_offload && oi.needs_csum && !qp.port().sw_tx_csum_l4()) {
                 if (oi.protocol == ip_protocol_num::tcp) {
                     head->ol_flags |= PKT_TX_TCP_CKSUM;
                     // TODO: Take a VLAN header into an account here
@@ -665,8 +766,16 @@ class dpdk_qp : public net::qp {
          */
         static tx_buf* from_packet_zc(packet&& p, dpdk_qp& qp) {
 
+            if (needs_sw_l4_csum(p, qp)) {
+                sw_l4_csum(p);
+            }
+
             // Too fragmented - linearize
             if (p.nr_frags() > max_frags) {
+                if (!HugetlbfsMemBackend) {
+                    // a linearized packet is in memory that has to be copied
+                    return from_packet_copy(std::move(p), qp);
+                }
                 p.linearize();
                 ++qp._stats.tx.linearized;
             }
@@ -679,7 +788,7 @@ class dpdk_qp : public net::qp {
             // Create a HEAD of the fragmented packet: check if frag0 has to be
             // copied and if yes - send it in a copy way
             //
-            if (!check_frag0(p)) {
+            if (!check_frag0(p, qp)) {
                 if (!copy_one_frag(qp, p.frag(0), head, last_seg, nsegs)) {
                     return nullptr;
                 }
@@ -721,6 +830,9 @@ class dpdk_qp : public net::qp {
                 (p.nr_frags() > 1 && qp.port().is_i40e_device() && i40e_should_linearize(head)) ||
                 (p.nr_frags() > vmxnet3_max_xmit_segment_frags && qp.port().is_vmxnet3_device())) {
                 me(head)->recycle();
+                if (!HugetlbfsMemBackend) {
+                    return from_packet_copy(std::move(p), qp);
+                }
                 p.linearize();
                 ++qp._stats.tx.linearized;
 
@@ -741,19 +853,30 @@ class dpdk_qp : public net::qp {
          *
          * @param p packet to copy
          * @param head head of the rte_mbuf's cluster
+         * @param sw_csum complete the L4 checksum while copying
          */
-        static void copy_packet_to_cluster(const packet& p, rte_mbuf* head) {
+        static void copy_packet_to_cluster(const packet& p, rte_mbuf* head, bool sw_csum) {
             rte_mbuf* cur_seg = head;
             size_t cur_seg_offset = 0;
             unsigned cur_frag_idx = 0;
             size_t cur_frag_offset = 0;
+            // The L4 header and payload are summed as they are copied
+            checksummer csum;
+            size_t csum_start = sw_csum ? l4_offset(p.offload_info()) : p.len();
+            size_t pos = 0;
 
             while (true) {
                 size_t to_copy = std::min(p.frag(cur_frag_idx).size - cur_frag_offset,
                                           inline_mbuf_data_size - cur_seg_offset);
 
-                memcpy(rte_pktmbuf_mtod_offset(cur_seg, void*, cur_seg_offset),
-                       p.frag(cur_frag_idx).base + cur_frag_offset, to_copy);
+                auto dst = rte_pktmbuf_mtod_offset(cur_seg, char*, cur_seg_offset);
+                auto src = p.frag(cur_frag_idx).base + cur_frag_offset;
+                auto plain = std::min(to_copy, csum_start - std::min(csum_start, pos));
+                memcpy(dst, src, plain);
+                if (plain < to_copy) {
+                    csum.copy_and_sum(dst + plain, src + plain, to_copy - plain);
+                }
+                pos += to_copy;
 
                 cur_frag_offset += to_copy;
                 cur_seg_offset += to_copy;
@@ -781,6 +904,58 @@ class dpdk_qp : public net::qp {
                     assert(cur_seg);
                 }
             }
+
+            if (sw_csum) {
+                auto c = final_l4_csum(p.offload_info(), csum);
+                memcpy(rte_pktmbuf_mtod_offset(head, char*, l4_csum_offset(p.offload_info())), &c, sizeof(c));
+            }
+        }
+
+        static size_t l4_offset(const offload_info& oi) {
+            // TODO: Take a VLAN header into an account here
+            return sizeof(struct ether_hdr) + oi.ip_hdr_len;
+        }
+
+        static size_t l4_csum_offset(const offload_info& oi) {
+            return l4_offset(oi) + (oi.protocol == ip_protocol_num::tcp ? 16 : 6);
+        }
+
+        // The stack left the pseudo header sum in the checksum field, which
+        // csum has summed along with the rest of the L4 data
+        static uint16_t final_l4_csum(const offload_info& oi, const checksummer& csum) {
+            auto c = csum.get();
+            if (oi.protocol == ip_protocol_num::udp && !c) {
+                // zero means no checksum for UDP
+                c = 0xffff;
+            }
+            return c;
+        }
+
+        static bool needs_sw_l4_csum(const packet& p, const dpdk_qp& qp) {
+            return qp.port().sw_tx_csum_l4() && p.offload_info().needs_csum;
+        }
+
+        /**
+         * Completes the L4 checksum in place, for packets that are not
+         * copied.
+         *
+         * @param p packet to checksum
+         */
+        static void sw_l4_csum(packet& p) {
+            auto& oi = p.offload_info_ref();
+            auto skip = l4_offset(oi);
+            checksummer csum;
+            for (auto&& f : p.fragments()) {
+                auto n = std::min(skip, size_t(f.size));
+                if (f.size > n) {
+                    csum.sum(f.base + n, f.size - n);
+                }
+                skip -= n;
+            }
+            auto c = final_l4_csum(oi, csum);
+            auto field = p.get_header(l4_csum_offset(oi), sizeof(c));
+            memcpy(field, &c, sizeof(c));
+            oi.needs_csum = false;
         }
 
         /**
@@ -835,7 +1010,7 @@ class dpdk_qp : public net::qp {
             head->pkt_len = p.len();
             head->nb_segs = nsegs;
 
-            copy_packet_to_cluster(p, head);
+            copy_packet_to_cluster(p, head, needs_sw_l4_csum(p, qp));
             set_cluster_offload_info(p, qp, head);
 
             return me(head);
@@ -957,7 +1132,7 @@ class dpdk_qp : public net::qp {
             static constexpr size_t max_frag_len = 15 * 1024; // 15K
 
             using namespace memory;
-            translation tr = translate(va, buf_len);
+            translation tr = qp.translate_tx(va, buf_len);
 
             //
             // Currently we break a buffer on a 15K boundary because 82599
@@ -1023,10 +1198,11 @@ class dpdk_qp : public net::qp {
          * headers.
          *
          * @param p packet to check
+         * @param qp dpdk_qp handle
          *
          * @return TRUE if packet is ok and FALSE otherwise.
          */
-        static bool check_frag0(packet& p)
+        static bool check_frag0(packet& p, dpdk_qp& qp)
         {
             using namespace memory;
 
@@ -1039,8 +1215,8 @@ class dpdk_qp : public net::qp {
             // go.
             //
             size_t frag0_size = p.frag(0).size;
-            void* base = p.frag(0).base;
-            translation tr = translate(base, frag0_size);
+            char* base = p.frag(0).base;
+            translation tr = qp.translate_tx(base, frag0_size);
 
             if (tr.size < frag0_size && tr.size < 128) {
                 return false;
@@ -1163,7 +1339,7 @@ class dpdk_qp : public net::qp {
                 _pool =
                     rte_mempool_xmem_create(name.c_str(),
                                        mbufs_per_queue_tx, inline_mbuf_size,
-                                       mbuf_cache_size,
+                                       mempool_cache_size(mbufs_per_queue_tx),
                                        sizeof(struct rte_pktmbuf_pool_private),
                                        rte_pktmbuf_pool_init, nullptr,
                                        rte_pktmbuf_init, nullptr,
@@ -1175,7 +1351,7 @@ class dpdk_qp : public net::qp {
                 _pool =
                      rte_mempool_create(name.c_str(),
                                        mbufs_per_queue_tx, inline_mbuf_size,
-                                       mbuf_cache_size,
+                                       mempool_cache_size(mbufs_per_queue_tx),
                                        sizeof(struct rte_pktmbuf_pool_private),
                                        rte_pktmbuf_pool_init, nullptr,
                                        rte_pktmbuf_init, nullptr,
@@ -1295,8 +1471,11 @@ class dpdk_qp : public net::qp {
                 return tx_buf::from_packet_zc(std::move(p), *this);
             });
         } else {
-            // "Copy"-send
+            // "Copy"-send, but for data in DPDK's memory
             return _send(pb, [&](packet&& p) {
+                if (has_dpdk_memory_frags(p)) {
+                    return tx_buf::from_packet_zc(std::move(p), *this);
+                }
                 return tx_buf::from_packet_copy(std::move(p), *this);
             });
         }
@@ -1304,7 +1483,58 @@ class dpdk_qp : public net::qp {
 
     dpdk_device& port() const { return *_dev; }
     tx_buf* get_tx_buf() { return _tx_buf_factory.get(); }
+
+    /**
+     * Translates the data of a packet being sent: seastar's memory (with
+     * the hugetlbfs backend), then DPDK's.
+     *
+     * The physically contiguous range of the last translation is
+     * remembered: the fragments of a packet, and the 15K slices of a large
+     * one, mostly fall into the same huge page, so that most translations
+     * are a range check.
+     *
+     * @param va virtual address of the data
+     * @param len length of the data
+     *
+     * @return the physical address of va and the length of the physically
+     *         contiguous part of [va, va + len), or a zero sized
+     *         translation if the data has to be copied.
+     */
+    memory::translation translate_tx(const char* va, size_t len) {
+        if (va >= _tx_tr_va && va < _tx_tr_end) {
+            return memory::translation(_tx_tr_pa + (va - _tx_tr_va), std::min(len, size_t(_tx_tr_end - va)));
+        }
+        constexpr auto whole = std::numeric_limits<size_t>::max();
+        auto tr = memory::translate(va, whole);
+        if (!tr.size) {
+            tr = _dev->translate_dpdk_memory(va, whole);
+            if (!tr.size) {
+                return tr;
+            }
+        }
+        _tx_tr_va = va;
+        _tx_tr_end = va + tr.size;
+        _tx_tr_pa = tr.addr;
+        return memory::translation(tr.addr, std::min(len, tr.size));
+    }
 private:
+    /**
+     * Without the hugetlbfs backend only data that DPDK allocated can be
+     * sent zero-copy, e.g. values of a cache kept in rte_malloc() memory.
+     *
+     * @param p packet to check
+     *
+     * @return TRUE if a fragment of p, worth not copying, is in DPDK's
+     *         memory.
+     */
+    bool has_dpdk_memory_frags(const packet& p) {
+        for (auto&& f : p.fragments()) {
+            if (f.size >= inline_mbuf_data_size && translate_tx(f.base, f.size).size) {
+                return true;
+            }
+        }
+        return false;
+    }
 
     template <class Func>
     uint32_t _send(circular_buffer<packet>& pb, Func packet_to_tx_buf_p) {
@@ -1460,6 +1690,9 @@ class dpdk_qp : public net::qp {
     std::vector<fragment> _frags;
     std::vector<char*> _bufs;
     size_t _num_rx_free_segs = 0;
+    // Adapted to the queue's occupancy by poll_rx_once()
+    uint16_t _rx_burst_size = packet_read_size;
+    uint64_t _rx_full_bursts = 0;
     reactor::poller _rx_gc_poller;
     std::unique_ptr<void, free_deleter> _rx_xmem;
     tx_buf_factory _tx_buf_factory;
@@ -1467,6 +1700,10 @@ class dpdk_qp : public net::qp {
     reactor::poller _tx_gc_poller;
     std::vector<rte_mbuf*> _tx_burst;
     uint16_t _tx_burst_idx = 0;
+    // The last range translate_tx() translated
+    const char* _tx_tr_va = nullptr;
+    const char* _tx_tr_end = nullptr;
+    phys_addr_t _tx_tr_pa = 0;
     static constexpr phys_addr_t page_mask = ~(memory::page_size - 1);
 };
 
@@ -1606,27 +1843,6 @@ int dpdk_device::init_port_start()
     // Enable HW CRC stripping
     port_conf.rxmode.hw_strip_crc = 1;
 
-#ifdef RTE_ETHDEV_HAS_LRO_SUPPORT
-    // Enable LRO
-    if (_use_lro && (_dev_info.rx_offload_capa & DEV_RX_OFFLOAD_TCP_LRO)) {
-        printf("LRO is on\n");
-        port_conf.rxmode.enable_lro = 1;
-        _hw_features.rx_lro = true;
-    } else
-#endif
-        printf("LRO is off\n");
-
-    // Check that all CSUM features are either all set all together or not set
-    // all together. If this assumption breaks we need to rework the below logic
-    // by splitting the csum offload feature bit into separate bits for IPv4,
-    // TCP and UDP.
-    assert(((_dev_info.rx_offload_capa & DEV_RX_OFFLOAD_IPV4_CKSUM) &&
-            (_dev_info.rx_offload_capa & DEV_RX_OFFLOAD_UDP_CKSUM) &&
-            (_dev_info.rx_offload_capa & DEV_RX_OFFLOAD_TCP_CKSUM)) ||
-           (!(_dev_info.rx_offload_capa & DEV_RX_OFFLOAD_IPV4_CKSUM) &&
-            !(_dev_info.rx_offload_capa & DEV_RX_OFFLOAD_UDP_CKSUM) &&
-            !(_dev_info.rx_offload_capa & DEV_RX_OFFLOAD_TCP_CKSUM)));
-
     // Set Rx checksum checking
     if (  (_dev_info.rx_offload_capa & DEV_RX_OFFLOAD_IPV4_CKSUM) &&
           (_dev_info.rx_offload_capa & DEV_RX_OFFLOAD_UDP_CKSUM) &&
@@ -1635,6 +1851,28 @@ int dpdk_device::init_port_start()
         port_conf.rxmode.hw_ip_checksum = 1;
         _hw_features.rx_csum_offload = 1;
     }
+#ifdef PKT_RX_L4_CKSUM_GOOD
+    else if (_dev_info.rx_offload_capa &
+             (DEV_RX_OFFLOAD_IPV4_CKSUM | DEV_RX_OFFLOAD_UDP_CKSUM | DEV_RX_OFFLOAD_TCP_CKSUM)) {
+        // The mbufs tell which checksums were verified, so the stack only
+        // verifies the others
+        printf("RX checksum offload partially supported\n");
+        port_conf.rxmode.hw_ip_checksum = 1;
+        _rx_csum_per_packet = true;
+    }
+#endif
+
+#ifdef RTE_ETHDEV_HAS_LRO_SUPPORT
+    // Enable LRO; the stack cannot verify the checksums of the segments the
+    // port merges, so it must verify them all
+    if (_use_lro && (_dev_info.rx_offload_capa & DEV_RX_OFFLOAD_TCP_LRO) &&
+        _hw_features.rx_csum_offload) {
+        printf("LRO is on\n");
+        port_conf.rxmode.enable_lro = 1;
+        _hw_features.rx_lro = true;
+    } else
+#endif
+        printf("LRO is off\n");
 
     if ((_dev_info.tx_offload_capa & DEV_TX_OFFLOAD_IPV4_CKSUM)) {
         printf("TX ip checksum offload supported\n");
@@ -1668,6 +1906,12 @@ int dpdk_device::init_port_start()
           (_dev_info.tx_offload_capa & DEV_TX_OFFLOAD_TCP_CKSUM)) {
         printf("TX TCP&UDP checksum offload supported\n");
         _hw_features.tx_csum_l4_offload = 1;
+    } else if (!(_dev_info.tx_offload_capa & DEV_TX_OFFLOAD_TCP_TSO)) {
+        // Checksum while copying to the tx buffers rather than in a pass of
+        // its own in the stack
+        printf("TX TCP&UDP checksum done by the driver\n");
+        _hw_features.tx_csum_l4_offload = 1;
+        _sw_tx_csum_l4 = true;
     }
 
     int retval;
@@ -1685,6 +1929,8 @@ int dpdk_device::init_port_start()
     }
 
     //rte_eth_promiscuous_enable(port_num);
+    // IPv6 neighbour discovery is done over multicast
+    rte_eth_allmulticast_enable(_port_idx);
     printf("done: \n");
 
     return 0;
@@ -1828,7 +2074,7 @@ bool dpdk_qp<HugetlbfsMemBackend>::init_rx_mbuf_pool()
         _pktmbuf_pool_rx =
                 rte_mempool_xmem_create(name.c_str(),
                                    mbufs_per_queue_rx, mbuf_overhead,
-                                   mbuf_cache_size,
+                                   mempool_cache_size(mbufs_per_queue_rx),
                                    sizeof(struct rte_pktmbuf_pool_private),
                                    rte_pktmbuf_pool_init, as_cookie(roomsz),
                                    rte_pktmbuf_init, nullptr,
@@ -1846,10 +2092,12 @@ bool dpdk_qp<HugetlbfsMemBackend>::init_rx_mbuf_pool()
         // 2) Bind data buffers to each of them.
         // 3) Return them back to the pool.
         //
-        for (int i = 0; i < mbufs_per_queue_rx; i++) {
-            rte_mbuf* m = rte_pktmbuf_alloc(_pktmbuf_pool_rx);
-            assert(m);
-            _rx_free_bufs.push_back(m);
+        _rx_free_bufs.resize(mbufs_per_queue_rx);
+        if (!_pktmbuf_pool_rx ||
+            rte_pktmbuf_alloc_bulk(_pktmbuf_pool_rx, _rx_free_bufs.data(),
+                                   _rx_free_bufs.size())) {
+            printf("Can't allocate the Rx mbufs\n");
+            return false;
         }
 
         for (auto&& m : _rx_free_bufs) {
@@ -1870,7 +2118,7 @@ bool dpdk_qp<HugetlbfsMemBackend>::init_rx_mbuf_pool()
         _pktmbuf_pool_rx =
                 rte_mempool_create(name.c_str(),
                                mbufs_per_queue_rx, inline_mbuf_size,
-                               mbuf_cache_size,
+                               mempool_cache_size(mbufs_per_queue_rx),
                                sizeof(struct rte_pktmbuf_pool_private),
                                rte_pktmbuf_pool_init, as_cookie(roomsz),
                                rte_pktmbuf_init, nullptr,
@@ -1963,6 +2211,17 @@ dpdk_qp<HugetlbfsMemBackend>::dpdk_qp(dpdk_device* dev, uint8_t qid,
         sm::make_derive(_queue_name + "_rx_no_memory_errors", _stats.rx.bad.no_mem,
                         sm::description("Counts a number of ingress packets received by this HW queue but dropped by the SW due to low memory. "
                                         "A non-zero value indicates that seastar doesn't have enough memory to handle the packet reception or the memory is too fragmented.")),
+
+        sm::make_derive(_queue_name + "_rx_full_bursts", _rx_full_bursts,
+                        sm::description("Counts the polls of this queue that read as many packets as they asked for, so that more were likely waiting. "
+                                        "A high rate means that the queue is often close to overflowing, and the reads are done in larger bursts.")),
+
+        sm::make_gauge(_queue_name + "_rx_burst_size", [this] { return _rx_burst_size; },
+                        sm::description("Number of packets currently read from this queue at a time")),
+
+        sm::make_gauge(_queue_name + "_rx_mbufs_free", [this] { return rte_mempool_avail_count(_pktmbuf_pool_rx); },
+                        sm::description("Number of mbufs left in this queue's Rx pool. "
+                                        "When it runs out the NIC drops the packets it receives: see rx_no_mbufs.")),
     });
 }
 
@@ -2169,14 +2428,33 @@ void dpdk_qp<HugetlbfsMemBackend>::process_packets(
             // code for ip, tcp and udp will assume they don't need to check
             // the checksum again, because we did this here.
         }
+#ifdef PKT_RX_L4_CKSUM_GOOD
+        else if (_dev->rx_csum_per_packet()) {
+            // Both bits set means the port did not verify it
+            auto ip_csum = m->ol_flags & PKT_RX_IP_CKSUM_MASK;
+            auto l4_csum = m->ol_flags & PKT_RX_L4_CKSUM_MASK;
+            if (ip_csum == PKT_RX_IP_CKSUM_BAD || l4_csum == PKT_RX_L4_CKSUM_BAD) {
+                _stats.rx.bad.inc_csum_err();
+                continue;
+            }
+            oi.rx_ip_csum_good = ip_csum == PKT_RX_IP_CKSUM_GOOD;
+            oi.rx_l4_csum_good = l4_csum == PKT_RX_L4_CKSUM_GOOD;
+        }
+#endif
+#ifdef PKT_RX_TIMESTAMP
+        if (m->ol_flags & PKT_RX_TIMESTAMP) {
+            oi.rx_timestamp = m->timestamp;
+        }
+#endif
 
         (*p).set_offload_info(oi);
         if (m->ol_flags & PKT_RX_RSS_HASH) {
             (*p).set_rss_hash(m->hash.rss);
         }
 
-        _dev->l2receive(std::move(*p));
+        rx_gro_add(std::move(*p));
     }
+    rx_gro_flush();
 
     _stats.rx.good.update_pkts_bunch(count);
     _stats.rx.good.update_frags_stats(nr_frags, bytes);
@@ -2190,11 +2468,25 @@ void dpdk_qp<HugetlbfsMemBackend>::process_packets(
 template <bool HugetlbfsMemBackend>
 bool dpdk_qp<HugetlbfsMemBackend>::poll_rx_once()
 {
-    struct rte_mbuf *buf[packet_read_size];
+    struct rte_mbuf *buf[max_packet_read_size];
 
     /* read a port */
     uint16_t rx_count = rte_eth_rx_burst(_dev->port_idx(), _qid,
-                                         buf, packet_read_size);
+                                         buf, _rx_burst_size);
+
+    //
+    // A full burst means that more packets are waiting: read more of them at
+    // a time, so that a microburst is drained before the ring overflows, and
+    // go back to small bursts once the queue is about empty.
+    //
+    if (rx_count == _rx_burst_size) {
+        ++_rx_full_bursts;
+        _rx_burst_size = std::min<uint16_t>(_rx_burst_size * 2,
+                                            max_packet_read_size);
+    } else if (rx_count < _rx_burst_size / 4) {
+        _rx_burst_size = std::max<uint16_t>(_rx_burst_size / 2,
+                                            packet_read_size);
+    }
 
     /* Now process the NIC packets read */
     if (likely(rx_count > 0)) {
@@ -2204,6 +2496,19 @@ bool dpdk_qp<HugetlbfsMemBackend>::poll_rx_once()
     return rx_count;
 }
 
+void dpdk_device::init_dma_regions()
+{
+    auto ms = rte_eal_get_physmem_layout();
+    for (unsigned i = 0; i < RTE_MAX_MEMSEG; i++) {
+        if (ms[i].addr && ms[i].len) {
+            _dma_regions.push_back(dma_region{static_cast<const char*>(ms[i].addr), ms[i].len, ms[i].phys_addr});
+        }
+    }
+    std::sort(_dma_regions.begin(), _dma_regions.end(), [] (const dma_region& a, const dma_region& b) {
+        return a.va < b.va;
+    });
+}
+
 void dpdk_device::set_rss_table()
 {
     if (_dev_info.reta_size == 0)
@@ -2233,6 +2538,85 @@ void dpdk_device::set_rss_table()
     }
 }
 
+void dpdk_device::update_hw_reta(unsigned idx, unsigned qid)
+{
+    assert(idx < _redir_table.size() && qid < _num_queues);
+
+    int reta_conf_size =
+        std::max(1, _dev_info.reta_size / RTE_RETA_GROUP_SIZE);
+    rte_eth_rss_reta_entry64 reta_conf[reta_conf_size];
+
+    // Only the masked entry is written
+    for (auto& x : reta_conf) {
+        x.mask = 0;
+    }
+    auto& group = reta_conf[idx / RTE_RETA_GROUP_SIZE];
+    group.mask = 1ULL << (idx % RTE_RETA_GROUP_SIZE);
+    group.reta[idx % RTE_RETA_GROUP_SIZE] = qid;
+
+    if (rte_eth_dev_rss_reta_update(_port_idx, reta_conf, _dev_info.reta_size)) {
+        throw std::runtime_error(sprint("Port %d: Failed to update an RSS indirection table entry", _port_idx));
+    }
+    _redir_table[idx] = qid;
+}
+
+#if RTE_VERSION >= RTE_VERSION_NUM(17,2,0,0)
+bool dpdk_device::install_flow_rule(const flow_rule& rule, unsigned qid)
+{
+    rte_flow_attr attr = {};
+    attr.ingress = 1;
+
+    rte_flow_item_ipv4 ip_spec = {}, ip_mask = {};
+    if (rule.remote.ip) {
+        ip_spec.hdr.src_addr = rte_cpu_to_be_32(rule.remote.ip);
+        ip_mask.hdr.src_addr = 0xffffffff;
+    }
+    auto src_port = rte_cpu_to_be_16(rule.remote.port);
+    auto src_mask = uint16_t(rule.remote.port ? 0xffff : 0);
+    auto dst_port = rte_cpu_to_be_16(rule.local_port);
+    auto dst_mask = uint16_t(rule.local_port ? 0xffff : 0);
+    rte_flow_item_tcp tcp_spec = {}, tcp_mask = {};
+    tcp_spec.hdr.src_port = src_port;
+    tcp_mask.hdr.src_port = src_mask;
+    tcp_spec.hdr.dst_port = dst_port;
+    tcp_mask.hdr.dst_port = dst_mask;
+    rte_flow_item_udp udp_spec = {}, udp_mask = {};
+    udp_spec.hdr.src_port = src_port;
+    udp_mask.hdr.src_port = src_mask;
+    udp_spec.hdr.dst_port = dst_port;
+    udp_mask.hdr.dst_port = dst_mask;
+
+    rte_flow_action_queue queue = {};
+    queue.index = qid;
+    rte_flow_action actions[2] = {};
+    actions[0].type = RTE_FLOW_ACTION_TYPE_QUEUE;
+    actions[0].conf = &queue;
+    actions[1].type = RTE_FLOW_ACTION_TYPE_END;
+
+    auto create = [&] (rte_flow_item_type l4_type, const void* l4_spec, const void* l4_mask) {
+        rte_flow_item pattern[4] = {};
+        pattern[0].type = RTE_FLOW_ITEM_TYPE_ETH;
+        pattern[1].type = RTE_FLOW_ITEM_TYPE_IPV4;
+        pattern[1].spec = &ip_spec;
+        pattern[1].mask = &ip_mask;
+        pattern[2].type = l4_type;
+        pattern[2].spec = l4_spec;
+        pattern[2].mask = l4_mask;
+        pattern[3].type = RTE_FLOW_ITEM_TYPE_END;
+        rte_flow_error error;
+        if (!rte_flow_create(_port_idx, &attr, pattern, actions, &error)) {
+            printf("Port %d: Failed to add a flow rule to queue %d: %s\n", _port_idx, qid,
+                   error.message ? error.message : "unknown error");
+            return false;
+        }
+        return true;
+    };
+    auto tcp_ok = create(RTE_FLOW_ITEM_TYPE_TCP, &tcp_spec, &tcp_mask);
+    auto udp_ok = create(RTE_FLOW_ITEM_TYPE_UDP, &udp_spec, &udp_mask);
+    return tcp_ok && udp_ok;
+}
+#endif
+
 std::unique_ptr<qp> dpdk_device::init_local_queue(boost::program_options::variables_map opts, uint16_t qid) {
 
     std::unique_ptr<qp> qp;
@@ -0,0 +1,157 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <algorithm>
+#include "gro.hh"
+#include "const.hh"
+#include "ip_checksum.hh"
+#include "core/byteorder.hh"
+
+namespace seastar {
+
+namespace net {
+
+// The Ethernet, IPv4 and TCP header fields this looks at
+static constexpr size_t eth_proto_off = 12;
+static constexpr size_t ip_len_off = 2;
+static constexpr size_t ip_frag_off = 6;
+static constexpr size_t ip_proto_off = 9;
+static constexpr size_t ip_csum_off = 10;
+static constexpr size_t ip_src_off = 12;
+static constexpr size_t ip_dst_off = 16;
+static constexpr size_t tcp_seq_off = 4;
+static constexpr size_t tcp_ack_off = 8;
+static constexpr size_t tcp_doff_off = 12;
+static constexpr size_t tcp_flags_off = 13;
+static constexpr size_t tcp_window_off = 14;
+static constexpr uint16_t ip_mf_and_offset = 0x3fff;
+static constexpr uint8_t tcp_psh = 0x08;
+static constexpr uint8_t tcp_ack = 0x10;
+// Headers with no IP options
+static constexpr size_t hdr_len_min = eth_hdr_len + ipv4_hdr_len_min + tcp_hdr_len_min;
+
+tcp_gro::tcp_gro() {
+    _flows.reserve(max_flows);
+}
+
+void tcp_gro::deliver(flow& f, circular_buffer<packet>& out) {
+    if (f.nr_segs > 1) {
+        auto iph = f.p.get_header(eth_hdr_len, ipv4_hdr_len_min + f.tcp_hdr_len);
+        auto th = iph + ipv4_hdr_len_min;
+        write_be<uint16_t>(iph + ip_len_off, f.p.len() - eth_hdr_len);
+        write_be<uint16_t>(iph + ip_csum_off, 0);
+        auto csum = ip_checksum(iph, ipv4_hdr_len_min);
+        std::copy_n(reinterpret_cast<const char*>(&csum), sizeof(csum), iph + ip_csum_off);
+        write_be<uint16_t>(th + tcp_window_off, f.window);
+        if (f.psh) {
+            th[tcp_flags_off] |= tcp_psh;
+        }
+    }
+    out.push_back(std::move(f.p));
+}
+
+void tcp_gro::add(packet p, circular_buffer<packet>& out) {
+    auto h = p.get_header(0, hdr_len_min);
+    if (!h || p.offload_info().vlan_tci
+            || read_be<uint16_t>(h + eth_proto_off) != uint16_t(eth_protocol_num::ipv4)) {
+        out.push_back(std::move(p));
+        return;
+    }
+    auto iph = h + eth_hdr_len;
+    size_t ip_len = read_be<uint16_t>(iph + ip_len_off);
+    size_t tcp_hdr_len = (uint8_t(iph[ipv4_hdr_len_min + tcp_doff_off]) >> 4) * 4;
+    if (uint8_t(iph[0]) != 0x45 // IPv4, no options
+            || uint8_t(iph[ip_proto_off]) != uint8_t(ip_protocol_num::tcp)
+            || (read_be<uint16_t>(iph + ip_frag_off) & ip_mf_and_offset)
+            || eth_hdr_len + ip_len != p.len() // padded
+            || tcp_hdr_len < tcp_hdr_len_min
+            || ipv4_hdr_len_min + tcp_hdr_len > ip_len) {
+        out.push_back(std::move(p));
+        return;
+    }
+    h = p.get_header(0, eth_hdr_len + ipv4_hdr_len_min + tcp_hdr_len);
+    iph = h + eth_hdr_len;
+    auto th = iph + ipv4_hdr_len_min;
+    auto src_ip = read_be<uint32_t>(iph + ip_src_off);
+    auto dst_ip = read_be<uint32_t>(iph + ip_dst_off);
+    auto src_port = read_be<uint16_t>(th);
+    auto dst_port = read_be<uint16_t>(th + 2);
+    auto seq = read_be<uint32_t>(th + tcp_seq_off);
+    auto ack = read_be<uint32_t>(th + tcp_ack_off);
+    auto window = read_be<uint16_t>(th + tcp_window_off);
+    uint8_t flags = th[tcp_flags_off];
+    size_t len = ip_len - ipv4_hdr_len_min - tcp_hdr_len;
+    bool mergeable = len && (flags & ~tcp_psh) == tcp_ack;
+
+    auto i = std::find_if(_flows.begin(), _flows.end(), [&] (const flow& f) {
+        return f.src_ip == src_ip && f.dst_ip == dst_ip && f.src_port == src_port && f.dst_port == dst_port;
+    });
+    if (i != _flows.end()) {
+        auto& f = *i;
+        auto fits = [&] {
+            if (!mergeable || seq != f.next_seq || ack != f.ack || tcp_hdr_len != f.tcp_hdr_len
+                    || len > f.seg_len || f.p.len() - eth_hdr_len + len > max_ip_len) {
+                return false;
+            }
+            auto fth = f.p.get_header(eth_hdr_len + ipv4_hdr_len_min, tcp_hdr_len);
+            return std::equal(th + tcp_hdr_len_min, th + tcp_hdr_len, fth + tcp_hdr_len_min);
+        };
+        if (fits()) {
+            p.trim_front(eth_hdr_len + ipv4_hdr_len_min + tcp_hdr_len);
+            f.p.append(std::move(p));
+            f.next_seq += len;
+            f.window = window;
+            f.psh = flags & tcp_psh;
+            ++f.nr_segs;
+            ++_merged;
+            // a short or pushed segment ends the run
+            if (f.psh || len < f.seg_len) {
+                deliver(f, out);
+                _flows.erase(i);
+            }
+            return;
+        }
+        deliver(f, out);
+        _flows.erase(i);
+    }
+    if (!mergeable || (flags & tcp_psh)) {
+        out.push_back(std::move(p));
+        return;
+    }
+    if (_flows.size() == max_flows) {
+        deliver(_flows.front(), out);
+        _flows.erase(_flows.begin());
+    }
+    _flows.push_back(flow{std::move(p), src_ip, dst_ip, src_port, dst_port, ack, uint32_t(seq + len),
+            window, uint16_t(len), 1, uint8_t(tcp_hdr_len), false});
+}
+
+void tcp_gro::flush(circular_buffer<packet>& out) {
+    for (auto&& f : _flows) {
+        deliver(f, out);
+    }
+    _flows.clear();
+}
+
+}
+
+}
@@ -0,0 +1,82 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <vector>
+#include "core/circular_buffer.hh"
+#include "packet.hh"
+
+namespace seastar {
+
+namespace net {
+
+// Software receive offload: coalesces the TCP segments of a received
+// batch of packets.
+//
+// A driver passes each packet of a batch, from its Ethernet header on,
+// to add(), and calls flush() at the end of the batch. In-order segments
+// of the same TCP/IPv4 flow, with the same acknowledgment and options and
+// no flags but ACK and PSH, are merged into one packet whose fragments
+// are the segments' payloads, up to 64k; its IP length and checksum are
+// updated, and it carries the last segment's window. TCP then handles
+// one packet, and makes one ACK decision, per merged run instead of per
+// segment. Other packets are passed on as they are.
+//
+// The merged packet's TCP checksum is not updated, so this is only usable
+// for devices that verify checksums on receive (rx_csum_offload).
+//
+// Packets are appended to out, in arrival order within each flow.
+class tcp_gro {
+    static constexpr unsigned max_flows = 8;
+    static constexpr size_t max_ip_len = 65535;
+    struct flow {
+        packet p;
+        uint32_t src_ip;
+        uint32_t dst_ip;
+        uint16_t src_port;
+        uint16_t dst_port;
+        uint32_t ack;
+        uint32_t next_seq;
+        uint16_t window;
+        uint16_t seg_len; // payload of the first segment
+        uint16_t nr_segs;
+        uint8_t tcp_hdr_len;
+        bool psh;
+    };
+    std::vector<flow> _flows; // oldest first
+    uint64_t _merged = 0;
+private:
+    void deliver(flow& f, circular_buffer<packet>& out);
+public:
+    tcp_gro();
+    void add(packet p, circular_buffer<packet>& out);
+    void flush(circular_buffer<packet>& out);
+    // Segments merged into a previous one
+    uint64_t merged() const {
+        return _merged;
+    }
+};
+
+}
+
+}
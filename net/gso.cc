@@ -0,0 +1,123 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <array>
+#include "gso.hh"
+#include "ip_checksum.hh"
+#include "core/byteorder.hh"
+
+namespace seastar {
+
+namespace net {
+
+// Offsets of the header fields in which the segments differ
+static constexpr size_t ip_len_off = 2;
+static constexpr size_t ip_id_off = 4;
+static constexpr size_t ip_csum_off = 10;
+static constexpr size_t ip_src_off = 12;
+static constexpr size_t tcp_seq_off = 4;
+static constexpr size_t tcp_flags_off = 13;
+static constexpr size_t tcp_csum_off = 16;
+// Flags that only the last segment carries
+static constexpr uint8_t tcp_last_flags = 0x01 | 0x08; // FIN, PSH
+
+static void write_nbo(char* p, uint16_t v) {
+    std::copy_n(reinterpret_cast<const char*>(&v), sizeof(v), p);
+}
+
+void tcp_gso_segment(packet p, const hw_features& hw, circular_buffer<packet>& out) {
+    auto oi = p.offload_info();
+    size_t mss = oi.tso_seg_size;
+    if (!mss || oi.protocol != ip_protocol_num::tcp) {
+        out.push_back(std::move(p));
+        return;
+    }
+    size_t ip_hdr_len = oi.ip_hdr_len;
+    size_t tcp_hdr_len = oi.tcp_hdr_len;
+    size_t hdr_len = eth_hdr_len + ip_hdr_len + tcp_hdr_len;
+    std::array<char, eth_hdr_len + 60 + 60> hdr;
+    auto h = p.get_header(0, hdr_len);
+    if (!h || hdr_len > hdr.size()) {
+        return;
+    }
+    std::copy_n(h, hdr_len, hdr.begin());
+    auto iph = hdr.data() + eth_hdr_len;
+    auto th = iph + ip_hdr_len;
+    auto ip_id = read_be<uint16_t>(iph + ip_id_off);
+    auto seq = read_be<uint32_t>(th + tcp_seq_off);
+    uint8_t flags = th[tcp_flags_off];
+    th[tcp_flags_off] = flags & ~tcp_last_flags;
+    write_be<uint16_t>(th + tcp_csum_off, 0);
+
+    // The pseudo header's addresses and protocol, and the TCP header but
+    // for the sequence number and the last segment's flags, are the same in
+    // all segments: sum them once
+    checksummer common;
+    common.sum(iph + ip_src_off, 8);
+    common.sum_many(uint8_t(0), uint8_t(ip_protocol_num::tcp));
+    if (!hw.tx_csum_l4_offload) {
+        write_be<uint32_t>(th + tcp_seq_off, 0);
+        common.sum(th, tcp_hdr_len);
+    }
+
+    size_t payload_len = p.len() - hdr_len;
+    uint16_t nr = 0;
+    for (size_t off = 0; off < payload_len; off += mss, ++nr) {
+        auto len = std::min(mss, payload_len - off);
+        bool last = off + len == payload_len;
+        auto seg = p.share(hdr_len + off, len);
+        auto csum = common;
+        csum.sum(uint16_t(tcp_hdr_len + len));
+        if (!hw.tx_csum_l4_offload) {
+            // the words of the header first: the payload may be odd-sized
+            csum.sum_many(uint32_t(seq + off), uint16_t(last ? flags & tcp_last_flags : 0));
+            csum.sum(seg);
+        }
+
+        auto sh = seg.prepend_uninitialized_header(hdr_len);
+        std::copy_n(hdr.data(), hdr_len, sh);
+        auto siph = sh + eth_hdr_len;
+        auto sth = siph + ip_hdr_len;
+        write_be<uint16_t>(siph + ip_len_off, ip_hdr_len + tcp_hdr_len + len);
+        write_be<uint16_t>(siph + ip_id_off, ip_id + nr);
+        if (!hw.tx_csum_ip_offload) {
+            write_be<uint16_t>(siph + ip_csum_off, 0);
+            write_nbo(siph + ip_csum_off, ip_checksum(siph, ip_hdr_len));
+        }
+        write_be<uint32_t>(sth + tcp_seq_off, seq + off);
+        if (last) {
+            sth[tcp_flags_off] = flags;
+        }
+        // with L4 checksum offload, the device expects the checksum of the
+        // pseudo header; otherwise, the full one
+        write_nbo(sth + tcp_csum_off, hw.tx_csum_l4_offload ? uint16_t(~csum.get()) : csum.get());
+
+        auto& soi = seg.offload_info_ref();
+        soi.tso_seg_size = 0;
+        soi.needs_csum = hw.tx_csum_l4_offload;
+        out.push_back(std::move(seg));
+    }
+}
+
+}
+
+}
@@ -0,0 +1,51 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include "core/circular_buffer.hh"
+#include "net.hh"
+#include "packet.hh"
+
+namespace seastar {
+
+namespace net {
+
+// Software segmentation offload, for devices without TSO.
+//
+// The TCP layer hands down super-segments of up to 64k of payload, with
+// offload_info::tso_seg_size set to the MSS, as it does for a device with
+// TSO; tcp_gso_segment() splits such a packet, from its Ethernet header
+// on, into the segments the device can send. The segments share the
+// super-segment's payload fragments and get a copy of its headers, with
+// the IP length and id, the TCP sequence number and the FIN and PSH flags
+// adjusted. The TCP checksum is summed once over the header fields common
+// to all segments and then completed per segment, or left to the device
+// if it offloads L4 checksums.
+//
+// The segments are appended to out; a packet without tso_seg_size, or that
+// fits in one segment, is appended as is.
+void tcp_gso_segment(packet p, const hw_features& hw, circular_buffer<packet>& out);
+
+}
+
+}
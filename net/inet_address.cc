@@ -120,6 +120,11 @@ std::ostream& seastar::net::operator<<(std::ostream& os, const inet_address::fam
 }
 
 std::ostream& operator<<(std::ostream& os, const socket_address& a) {
+    if (a.u.sa.sa_family == AF_INET6) {
+        return os << "[" << seastar::net::inet_address(a.as_posix_sockaddr_in6().sin6_addr)
+            << "]:" << a.u.in6.sin6_port
+            ;
+    }
     return os << seastar::net::inet_address(a.as_posix_sockaddr_in().sin_addr)
         << ":" << a.u.in.sin_port
         ;
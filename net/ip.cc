@@ -103,6 +103,7 @@ bool ipv4::needs_frag(packet& p, ip_protocol_num prot_num, net::hw_features hw_f
     }
 
     if ((prot_num == ip_protocol_num::tcp && hw_features.tx_tso) ||
+        (prot_num == ip_protocol_num::tcp && hw_features.tx_gso && p.offload_info().tso_seg_size) ||
         (prot_num == ip_protocol_num::udp && hw_features.tx_ufo)) {
         return false;
     }
@@ -117,8 +118,9 @@ ipv4::handle_received_packet(packet p, ethernet_address from) {
         return make_ready_future<>();
     }
 
-    // Skip checking csum of reassembled IP datagram
-    if (!hw_features().rx_csum_offload && !p.offload_info_ref().reassembled) {
+    // Skip checking csum of reassembled IP datagram, or of one the device checked
+    if (!hw_features().rx_csum_offload && !p.offload_info_ref().rx_ip_csum_good
+            && !p.offload_info_ref().reassembled) {
         checksummer csum;
         csum.sum(reinterpret_cast<char*>(iph), sizeof(*iph));
         if (csum.get() != 0) {
@@ -191,7 +193,7 @@ ipv4::handle_received_packet(packet p, ethernet_address from) {
                 hash_data.push_back(hton(h.dst_ip.ip));
                 auto forwarded = l4->forward(hash_data, ip_data, l4_offset);
                 if (forwarded) {
-                    cpu_id = _netif->hash2cpu(toeplitz_hash(_netif->rss_key(), hash_data));
+                    cpu_id = _netif->flow2cpu(hash_data);
                     // No need to forward if the dst cpu is the current cpu
                     if (cpu_id == engine().cpu_id()) {
                         l4->received(std::move(ip_data), h.src_ip, h.dst_ip);
@@ -106,6 +106,10 @@ struct ipv4_address {
 
 static inline bool is_unspecified(ipv4_address addr) { return addr.ip == 0; }
 
+inline socket_address make_socket_address(ipv4_address addr, uint16_t port) {
+    return make_ipv4_address(addr.ip, port);
+}
+
 std::ostream& operator<<(std::ostream& os, ipv4_address a);
 
 }
@@ -141,7 +145,11 @@ struct ipv4_traits {
     static void udp_pseudo_header_checksum(checksummer& csum, ipv4_address src, ipv4_address dst, uint16_t len) {
         csum.sum_many(src.ip.raw, dst.ip.raw, uint8_t(0), uint8_t(ip_protocol_num::udp), len);
     }
+    static void hash_address(forward_hash& out_hash_data, ipv4_address a) {
+        out_hash_data.push_back(hton(a.ip));
+    }
     static constexpr uint8_t ip_hdr_len_min = ipv4_hdr_len_min;
+    static constexpr int address_family = AF_INET;
 };
 
 template <ip_protocol_num ProtoNum>
@@ -179,13 +187,18 @@ struct l4connid {
                 && foreign_port == x.foreign_port;
     }
 
-    uint32_t hash(const rss_key_type& rss_key) {
+    // What l3_protocol forwards the connection's received packets by
+    forward_hash hash_data() const {
         forward_hash hash_data;
-        hash_data.push_back(hton(foreign_ip.ip));
-        hash_data.push_back(hton(local_ip.ip));
+        InetTraits::hash_address(hash_data, foreign_ip);
+        InetTraits::hash_address(hash_data, local_ip);
         hash_data.push_back(hton(foreign_port));
         hash_data.push_back(hton(local_port));
-        return toeplitz_hash(rss_key, hash_data);
+        return hash_data;
+    }
+
+    uint32_t hash(const rss_key_type& rss_key) {
+        return toeplitz_hash(rss_key, hash_data());
     }
 };
 
@@ -390,6 +403,10 @@ class ipv4 {
     explicit ipv4(interface* netif);
     void set_host_address(ipv4_address ip);
     ipv4_address host_address();
+    // The address packets to \c to are sent from
+    ipv4_address source_address(ipv4_address to) const {
+        return _host_address;
+    }
     void set_gw_address(ipv4_address ip);
     ipv4_address gw_address() const;
     void set_netmask_address(ipv4_address ip);
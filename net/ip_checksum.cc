@@ -22,17 +22,169 @@
 #include "ip_checksum.hh"
 #include "net.hh"
 #include <arpa/inet.h>
+#include <algorithm>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
 
 namespace seastar {
 
 namespace net {
 
+namespace {
+
+// Vector kernels sum whole blocks of 32-bit words, in memory byte order, into
+// 64-bit lanes: that is the same ones' complement sum as that of the 16-bit
+// words (RFC 1071), byte swapped on little endian machines. The lanes cannot
+// overflow for anything shorter than 4GB.
+struct bulk_kernels {
+    size_t block = 0;
+    uint16_t (*sum)(const char* data, size_t len) = nullptr;
+    uint16_t (*copy_and_sum)(char* dst, const char* src, size_t len) = nullptr;
+};
+
+// Below that, the scalar loop is as fast
+constexpr size_t bulk_min = 128;
+
+inline uint16_t fold(uint64_t s) {
+    s = (s & 0xffff'ffff) + (s >> 32);
+    while (s >> 16) {
+        s = (s & 0xffff) + (s >> 16);
+    }
+    return s;
+}
+
+#ifdef __x86_64__
+
+__attribute__((target("avx2")))
+inline __m256i sum_block_avx2(__m256i acc, __m256i v) {
+    auto zero = _mm256_setzero_si256();
+    acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, zero));
+    return _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, zero));
+}
+
+__attribute__((target("avx2")))
+inline uint16_t fold_avx2(__m256i acc) {
+    uint64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    return fold(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+
+__attribute__((target("avx2")))
+uint16_t sum_avx2(const char* data, size_t len) {
+    auto acc = _mm256_setzero_si256();
+    for (; len; len -= 32, data += 32) {
+        acc = sum_block_avx2(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)));
+    }
+    return fold_avx2(acc);
+}
+
+__attribute__((target("avx2")))
+uint16_t copy_and_sum_avx2(char* dst, const char* src, size_t len) {
+    auto acc = _mm256_setzero_si256();
+    for (; len; len -= 32, src += 32, dst += 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), v);
+        acc = sum_block_avx2(acc, v);
+    }
+    return fold_avx2(acc);
+}
+
+__attribute__((target("avx512f")))
+inline __m512i sum_block_avx512(__m512i acc, __m512i v) {
+    auto zero = _mm512_setzero_si512();
+    acc = _mm512_add_epi64(acc, _mm512_unpacklo_epi32(v, zero));
+    return _mm512_add_epi64(acc, _mm512_unpackhi_epi32(v, zero));
+}
+
+__attribute__((target("avx512f")))
+uint16_t sum_avx512(const char* data, size_t len) {
+    auto acc = _mm512_setzero_si512();
+    for (; len; len -= 64, data += 64) {
+        acc = sum_block_avx512(acc, _mm512_loadu_si512(data));
+    }
+    return fold(_mm512_reduce_add_epi64(acc));
+}
+
+__attribute__((target("avx512f")))
+uint16_t copy_and_sum_avx512(char* dst, const char* src, size_t len) {
+    auto acc = _mm512_setzero_si512();
+    for (; len; len -= 64, src += 64, dst += 64) {
+        auto v = _mm512_loadu_si512(src);
+        _mm512_storeu_si512(dst, v);
+        acc = sum_block_avx512(acc, v);
+    }
+    return fold(_mm512_reduce_add_epi64(acc));
+}
+
+#endif
+
+#ifdef __ARM_NEON
+
+uint16_t sum_neon(const char* data, size_t len) {
+    auto acc = vdupq_n_u64(0);
+    for (; len; len -= 16, data += 16) {
+        acc = vpadalq_u32(acc, vreinterpretq_u32_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(data))));
+    }
+    return fold(vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1));
+}
+
+uint16_t copy_and_sum_neon(char* dst, const char* src, size_t len) {
+    auto acc = vdupq_n_u64(0);
+    for (; len; len -= 16, src += 16, dst += 16) {
+        auto v = vld1q_u8(reinterpret_cast<const uint8_t*>(src));
+        vst1q_u8(reinterpret_cast<uint8_t*>(dst), v);
+        acc = vpadalq_u32(acc, vreinterpretq_u32_u8(v));
+    }
+    return fold(vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1));
+}
+
+#endif
+
+bulk_kernels select_bulk_kernels() {
+    bulk_kernels k;
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("avx512f")) {
+        k.block = 64;
+        k.sum = sum_avx512;
+        k.copy_and_sum = copy_and_sum_avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        k.block = 32;
+        k.sum = sum_avx2;
+        k.copy_and_sum = copy_and_sum_avx2;
+    }
+#elif defined(__ARM_NEON)
+    // part of the base architecture on aarch64, so nothing to detect
+    k.block = 16;
+    k.sum = sum_neon;
+    k.copy_and_sum = copy_and_sum_neon;
+#endif
+    return k;
+}
+
+const bulk_kernels& get_bulk_kernels() {
+    static const bulk_kernels k = select_bulk_kernels();
+    return k;
+}
+
+}
+
 void checksummer::sum(const char* data, size_t len) {
     auto orig_len = len;
     if (odd) {
         csum += uint8_t(*data++);
         --len;
     }
+    auto& k = get_bulk_kernels();
+    if (k.sum && len >= bulk_min) {
+        auto n = len & ~(k.block - 1);
+        csum += ntohs(k.sum(data, n));
+        data += n;
+        len -= n;
+    }
     auto p64 = reinterpret_cast<const packed<uint64_t>*>(data);
     while (len >= 8) {
         csum += ntohq(*p64++);
@@ -60,6 +212,26 @@ uint16_t checksummer::get() const {
     return htons(~csum);
 }
 
+void checksummer::copy_and_sum(char* dst, const char* src, size_t len) {
+    auto& k = get_bulk_kernels();
+    if (odd && len) {
+        *dst++ = *src;
+        sum(uint8_t(*src++));
+        --len;
+    }
+    if (k.copy_and_sum && len >= bulk_min) {
+        auto n = len & ~(k.block - 1);
+        csum += ntohs(k.copy_and_sum(dst, src, n));
+        dst += n;
+        src += n;
+        len -= n;
+    }
+    if (len) {
+        std::copy_n(src, len, dst);
+        sum(src, len);
+    }
+}
+
 void checksummer::sum(const packet& p) {
     for (auto&& f : p.fragments()) {
         sum(f.base, f.size);
@@ -38,6 +38,9 @@ struct checksummer {
     bool odd = false;
     void sum(const char* data, size_t len);
     void sum(const packet& p);
+    // Copies len bytes from src to dst, and sums them on the way, for
+    // the paths that copy the data anyway
+    void copy_and_sum(char* dst, const char* src, size_t len);
     void sum(uint8_t data) {
         if (!odd) {
             csum += data << 8;
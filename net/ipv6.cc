@@ -0,0 +1,447 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <arpa/inet.h>
+#include "ipv6.hh"
+#include "core/print.hh"
+#include "core/future-util.hh"
+
+namespace seastar {
+
+namespace net {
+
+ipv6_address::ipv6_address(const ::in6_addr& a) {
+    std::copy_n(a.s6_addr, size(), ip.begin());
+}
+
+ipv6_address::ipv6_address(const std::string& addr) {
+    ::in6_addr a;
+    if (::inet_pton(AF_INET6, addr.c_str(), &a) != 1) {
+        throw std::runtime_error(sprint("Wrong format for IPv6 address %s", addr));
+    }
+    std::copy_n(a.s6_addr, size(), ip.begin());
+}
+
+ipv6_address::ipv6_address(const socket_address& sa)
+    : ipv6_address(sa.u.in6.sin6_addr) {
+}
+
+bool ipv6_address::same_prefix(const ipv6_address& x, unsigned prefix_length) const {
+    auto bytes = std::min(prefix_length, 128u) / 8;
+    if (!std::equal(ip.begin(), ip.begin() + bytes, x.ip.begin())) {
+        return false;
+    }
+    auto bits = prefix_length % 8;
+    if (!bits || bytes == size()) {
+        return true;
+    }
+    uint8_t mask = 0xff << (8 - bits);
+    return !((ip[bytes] ^ x.ip[bytes]) & mask);
+}
+
+ipv6_address ipv6_address::solicited_node() const {
+    return ipv6_address(std::array<uint8_t, 16>{{0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0xff, ip[13], ip[14], ip[15]}});
+}
+
+ethernet_address ipv6_address::multicast_mac() const {
+    return ethernet_address({0x33, 0x33, ip[12], ip[13], ip[14], ip[15]});
+}
+
+ipv6_address ipv6_address::all_nodes() {
+    return ipv6_address(std::array<uint8_t, 16>{{0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01}});
+}
+
+ipv6_address ipv6_address::link_local(ethernet_address mac) {
+    auto& m = mac.mac;
+    return ipv6_address(std::array<uint8_t, 16>{{0xfe, 0x80, 0, 0, 0, 0, 0, 0,
+            uint8_t(m[0] ^ 0x02), m[1], m[2], 0xff, 0xfe, m[3], m[4], m[5]}});
+}
+
+bool is_unspecified(const ipv6_address& addr) {
+    return addr == ipv6_address();
+}
+
+socket_address make_socket_address(const ipv6_address& addr, uint16_t port) {
+    ::sockaddr_in6 sa = {};
+    sa.sin6_family = AF_INET6;
+    sa.sin6_port = htons(port);
+    std::copy(addr.ip.begin(), addr.ip.end(), sa.sin6_addr.s6_addr);
+    return socket_address(sa);
+}
+
+std::ostream& operator<<(std::ostream& os, const ipv6_address& a) {
+    char buf[INET6_ADDRSTRLEN];
+    return os << ::inet_ntop(AF_INET6, a.ip.data(), buf, sizeof(buf));
+}
+
+ipv6::ipv6(interface* netif)
+    : _netif(netif)
+    , _link_local_address(ipv6_address::link_local(netif->hw_address()))
+    , _hw_features(netif->hw_features())
+    , _l3(netif, eth_protocol_num::ipv6, [this] { return get_packet(); })
+    , _rx_packets(_l3.receive([this] (packet p, ethernet_address ea) {
+        return handle_received_packet(std::move(p), ea); },
+      [this] (forward_hash& out_hash_data, packet& p, size_t off) {
+        return forward(out_hash_data, p, off);}))
+    , _tcp(*this)
+    , _icmp(*this)
+    , _l4({ { uint8_t(ip_protocol_num::tcp), &_tcp }, { uint8_t(ip_protocol_num::icmpv6), &_icmp } })
+{
+    // The devices' checksum and segmentation offloads are set up for IPv4
+    // headers only, so IPv6 does without them
+    _hw_features.tx_csum_ip_offload = false;
+    _hw_features.tx_csum_l4_offload = false;
+    _hw_features.rx_csum_offload = false;
+    _hw_features.tx_tso = false;
+    _hw_features.tx_gso = false;
+    _hw_features.tx_ufo = false;
+}
+
+bool ipv6::forward(forward_hash& out_hash_data, packet& p, size_t off) {
+    auto iph = p.get_header<ipv6_hdr>(off);
+    if (!iph) {
+        return false;
+    }
+
+    ipv6_traits::hash_address(out_hash_data, iph->src_ip);
+    ipv6_traits::hash_address(out_hash_data, iph->dst_ip);
+
+    auto l4 = _l4[iph->next_header];
+    if (l4) {
+        l4->forward(out_hash_data, p, off + sizeof(ipv6_hdr));
+    }
+    return true;
+}
+
+bool ipv6::on_link(const ipv6_address& a) const {
+    return a.is_link_local() || a.is_multicast()
+            || (!is_unspecified(_host_address) && a.same_prefix(_host_address, _prefix_length));
+}
+
+bool ipv6::is_local(const ipv6_address& a) const {
+    return a == _link_local_address || (a == _host_address && !is_unspecified(a));
+}
+
+ipv6_address ipv6::source_address(const ipv6_address& to) const {
+    if (to.is_link_local() || to.is_multicast()) {
+        return _link_local_address;
+    }
+    return host_address();
+}
+
+future<>
+ipv6::handle_received_packet(packet p, ethernet_address from) {
+    auto iph = p.get_header<ipv6_hdr>(0);
+    if (!iph) {
+        return make_ready_future<>();
+    }
+
+    auto h = ntoh(*iph);
+    if (h.version() != 6) {
+        return make_ready_future<>();
+    }
+    size_t len = sizeof(ipv6_hdr) + h.payload_len;
+    if (p.len() < len) {
+        return make_ready_future<>();
+    }
+    if (p.len() > len) {
+        // Trim extra data in the packet beyond IP payload, like the
+        // Ethernet padding
+        p.trim_back(p.len() - len);
+    }
+
+    auto& dst = h.dst_ip;
+    if (!is_local(dst) && dst != ipv6_address::all_nodes()
+            && dst != _link_local_address.solicited_node()
+            && (is_unspecified(_host_address) || dst != _host_address.solicited_node())) {
+        return make_ready_future<>();
+    }
+
+    auto l4 = _l4[h.next_header];
+    if (l4) {
+        p.trim_front(sizeof(ipv6_hdr));
+        l4->received(std::move(p), h.src_ip, h.dst_ip, h.hop_limit);
+    }
+    return make_ready_future<>();
+}
+
+future<ethernet_address> ipv6::get_l2_dst_address(ipv6_address to) {
+    // Directly connected hosts are resolved themselves, the rest go through
+    // the default gateway
+    return _icmp.get_ndp().lookup(on_link(to) ? to : _gw_address);
+}
+
+void ipv6::send(ipv6_address to, ip_protocol_num proto_num, packet p, ethernet_address e_dst) {
+    if (p.len() + sizeof(ipv6_hdr) > hw_features().mtu) {
+        // Routers never fragment IPv6, and neither do we
+        return;
+    }
+    auto iph = p.prepend_header<ipv6_hdr>();
+    iph->ver_tc_flow = 6u << 28;
+    iph->payload_len = p.len() - sizeof(ipv6_hdr);
+    iph->next_header = uint8_t(proto_num);
+    // Neighbour discovery requires 255, and it confuses no other ICMPv6 peer
+    iph->hop_limit = proto_num == ip_protocol_num::icmpv6 ? 255 : 64;
+    iph->src_ip = source_address(to);
+    iph->dst_ip = to;
+    *iph = hton(*iph);
+    p.offload_info_ref().ip_hdr_len = sizeof(ipv6_hdr);
+
+    _packetq.push_back(l3_protocol::l3packet{eth_protocol_num::ipv6, e_dst, std::move(p)});
+}
+
+std::experimental::optional<l3_protocol::l3packet> ipv6::get_packet() {
+    if (_packetq.empty()) {
+        for (size_t i = 0; i < _pkt_providers.size(); i++) {
+            auto l4p = _pkt_providers[_pkt_provider_idx++]();
+            if (_pkt_provider_idx == _pkt_providers.size()) {
+                _pkt_provider_idx = 0;
+            }
+            if (l4p) {
+                auto l4pv = std::move(l4p.value());
+                send(l4pv.to, l4pv.proto_num, std::move(l4pv.p), l4pv.e_dst);
+                break;
+            }
+        }
+    }
+
+    std::experimental::optional<l3_protocol::l3packet> p;
+    if (!_packetq.empty()) {
+        p = std::move(_packetq.front());
+        _packetq.pop_front();
+    }
+    return p;
+}
+
+void ipv6::set_host_address(ipv6_address ip) {
+    _host_address = ip;
+}
+
+ipv6_address ipv6::host_address() const {
+    return is_unspecified(_host_address) ? _link_local_address : _host_address;
+}
+
+void ipv6::set_gw_address(ipv6_address ip) {
+    _gw_address = ip;
+}
+
+ipv6_address ipv6::gw_address() const {
+    return _gw_address;
+}
+
+void ipv6::set_prefix_length(unsigned prefix_length) {
+    if (prefix_length > 128) {
+        throw std::invalid_argument(sprint("Invalid IPv6 prefix length %d", prefix_length));
+    }
+    _prefix_length = prefix_length;
+}
+
+ipv6_icmp::ipv6_icmp(ipv6& inet)
+    : _inet_l4(inet)
+    , _ndp(inet, *this) {
+    _inet_l4.register_packet_provider([this] {
+        std::experimental::optional<ipv6_traits::l4packet> l4p;
+        if (!_packetq.empty()) {
+            l4p = std::move(_packetq.front());
+            _packetq.pop_front();
+            _queue_space.signal(l4p.value().p.len());
+        }
+        return l4p;
+    });
+}
+
+void ipv6_icmp::received(packet p, ipv6_address from, ipv6_address to, uint8_t hop_limit) {
+    auto hdr = p.get_header<icmpv6_hdr>(0);
+    if (!hdr) {
+        return;
+    }
+    checksummer csum;
+    ipv6_traits::pseudo_header_checksum(csum, from, to, ip_protocol_num::icmpv6, p.len());
+    csum.sum(p);
+    if (csum.get() != 0) {
+        return;
+    }
+
+    switch (hdr->type) {
+    case icmpv6_hdr::msg_type::echo_request: {
+        if (to.is_multicast()) {
+            return;
+        }
+        hdr->type = icmpv6_hdr::msg_type::echo_reply;
+        hdr->code = 0;
+        _inet_l4.get_l2_dst_address(from).then([this, from, p = std::move(p)] (ethernet_address e_dst) mutable {
+            send(from, e_dst, std::move(p));
+        });
+        break;
+    }
+    case icmpv6_hdr::msg_type::neighbor_solicitation:
+    case icmpv6_hdr::msg_type::neighbor_advertisement:
+        // Only on-link nodes may take part in neighbour discovery
+        if (hop_limit == 255) {
+            _ndp.received(std::move(p), from, to);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void ipv6_icmp::send(const ipv6_address& to, ethernet_address e_dst, packet p) {
+    if (!_queue_space.try_wait(p.len())) { // drop packets that do not fit the queue
+        return;
+    }
+    auto hdr = p.get_header<icmpv6_hdr>(0);
+    hdr->csum = 0;
+    checksummer csum;
+    ipv6_traits::pseudo_header_checksum(csum, _inet_l4._inet.source_address(to), to,
+            ip_protocol_num::icmpv6, p.len());
+    csum.sum(p);
+    hdr->csum = csum.get();
+    _packetq.emplace_back(ipv6_traits::l4packet{to, std::move(p), e_dst, ip_protocol_num::icmpv6});
+}
+
+packet ndp::make_message(icmpv6_hdr::msg_type type, uint8_t flags, const ipv6_address& target, option_type opt) {
+    packet p;
+    auto buf = p.prepend_uninitialized_header(msg_len + lladdr_option_len);
+    std::fill_n(buf, msg_len + lladdr_option_len, 0);
+    buf[0] = char(type);
+    buf[4] = char(flags);
+    target.write(buf + 8);
+    buf[msg_len] = char(opt);
+    buf[msg_len + 1] = lladdr_option_len / 8;
+    _inet.netif()->hw_address().write(buf + msg_len + 2);
+    return p;
+}
+
+void ndp::send_solicitation(const ipv6_address& target) {
+    auto to = target.solicited_node();
+    _icmp.send(to, to.multicast_mac(),
+            make_message(icmpv6_hdr::msg_type::neighbor_solicitation, 0, target, option_type::source_lladdr));
+}
+
+void ndp::send_advertisement(const ipv6_address& to, ethernet_address e_dst, const ipv6_address& target, bool solicited) {
+    uint8_t flags = flag_override | (solicited ? flag_solicited : 0);
+    _icmp.send(to, e_dst,
+            make_message(icmpv6_hdr::msg_type::neighbor_advertisement, flags, target, option_type::target_lladdr));
+}
+
+future<ethernet_address> ndp::lookup(const ipv6_address& addr) {
+    if (addr.is_multicast()) {
+        return make_ready_future<ethernet_address>(addr.multicast_mac());
+    }
+    auto i = _table.find(addr);
+    if (i != _table.end()) {
+        return make_ready_future<ethernet_address>(i->second);
+    }
+    auto j = _in_progress.find(addr);
+    auto first_request = j == _in_progress.end();
+    auto& res = first_request ? _in_progress[addr] : j->second;
+
+    if (first_request) {
+        res._timeout_timer.set_callback([addr, this, &res] {
+            send_solicitation(addr);
+            for (auto& w : res._waiters) {
+                w.set_exception(ndp_timeout_error());
+            }
+            res._waiters.clear();
+        });
+        res._timeout_timer.arm_periodic(std::chrono::seconds(1));
+        send_solicitation(addr);
+    }
+
+    if (res._waiters.size() >= max_waiters) {
+        return make_exception_future<ethernet_address>(ndp_queue_full_error());
+    }
+
+    res._waiters.emplace_back();
+    return res._waiters.back().get_future();
+}
+
+void ndp::learn(ethernet_address l2, const ipv6_address& l3) {
+    _table[l3] = l2;
+    auto i = _in_progress.find(l3);
+    if (i != _in_progress.end()) {
+        auto& res = i->second;
+        res._timeout_timer.cancel();
+        for (auto&& pr : res._waiters) {
+            pr.set_value(l2);
+        }
+        _in_progress.erase(i);
+    }
+}
+
+void ndp::received(packet p, const ipv6_address& from, const ipv6_address& to) {
+    if (p.len() < msg_len) {
+        return;
+    }
+    p.linearize();
+    auto len = p.len();
+    auto buf = p.get_header(0, len);
+    auto type = icmpv6_hdr::msg_type(buf[0]);
+    auto target = ipv6_address::read(buf + 8);
+    if (buf[1] != 0 || target.is_multicast()) {
+        return;
+    }
+
+    auto wanted = type == icmpv6_hdr::msg_type::neighbor_solicitation
+            ? option_type::source_lladdr : option_type::target_lladdr;
+    std::experimental::optional<ethernet_address> lladdr;
+    for (size_t off = msg_len; off + 2 <= len;) {
+        size_t opt_len = uint8_t(buf[off + 1]) * 8;
+        if (!opt_len || off + opt_len > len) {
+            return;
+        }
+        if (option_type(buf[off]) == wanted && opt_len >= lladdr_option_len) {
+            lladdr = ethernet_address::read(buf + off + 2);
+        }
+        off += opt_len;
+    }
+
+    if (type == icmpv6_hdr::msg_type::neighbor_advertisement) {
+        if (lladdr) {
+            ndp_learn(*lladdr, target);
+        }
+        return;
+    }
+
+    if (!_inet.is_local(target)) {
+        return;
+    }
+    if (is_unspecified(from)) {
+        // Another node checking that the address is free
+        auto all_nodes = ipv6_address::all_nodes();
+        send_advertisement(all_nodes, all_nodes.multicast_mac(), target, false);
+        return;
+    }
+    if (lladdr) {
+        ndp_learn(*lladdr, from);
+        send_advertisement(from, *lladdr, target, true);
+    } else {
+        _inet.get_l2_dst_address(from).then([this, from, target] (ethernet_address e_dst) {
+            send_advertisement(from, e_dst, target, true);
+        });
+    }
+}
+
+}
+
+}
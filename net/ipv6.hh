@@ -0,0 +1,361 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <array>
+#include <unordered_map>
+#include <vector>
+#include <netinet/in.h>
+#include "core/array_map.hh"
+#include "core/circular_buffer.hh"
+#include "core/semaphore.hh"
+#include "core/timer.hh"
+#include "ip.hh"
+
+namespace seastar {
+
+namespace net {
+
+class ipv6;
+class ipv6_icmp;
+template <ip_protocol_num ProtoNum>
+class ipv6_l4;
+
+// An IPv6 address, kept in network byte order
+struct ipv6_address {
+    ipv6_address() : ip{} {}
+    explicit ipv6_address(const std::array<uint8_t, 16>& ip) : ip(ip) {}
+    explicit ipv6_address(const ::in6_addr& a);
+    explicit ipv6_address(const std::string& addr);
+    explicit ipv6_address(const socket_address& sa);
+
+    std::array<uint8_t, 16> ip;
+
+    friend bool operator==(const ipv6_address& x, const ipv6_address& y) {
+        return x.ip == y.ip;
+    }
+    friend bool operator!=(const ipv6_address& x, const ipv6_address& y) {
+        return x.ip != y.ip;
+    }
+
+    static ipv6_address read(const char* p) {
+        ipv6_address ia;
+        std::copy_n(p, size(), reinterpret_cast<char*>(ia.ip.data()));
+        return ia;
+    }
+    static ipv6_address consume(const char*& p) {
+        auto ia = read(p);
+        p += size();
+        return ia;
+    }
+    void write(char* p) const {
+        std::copy_n(reinterpret_cast<const char*>(ip.data()), size(), p);
+    }
+    void produce(char*& p) const {
+        write(p);
+        p += size();
+    }
+    static constexpr size_t size() {
+        return 16;
+    }
+
+    bool is_multicast() const {
+        return ip[0] == 0xff;
+    }
+    bool is_link_local() const {
+        return ip[0] == 0xfe && (ip[1] & 0xc0) == 0x80;
+    }
+    // Whether the first prefix_length bits of the addresses are the same
+    bool same_prefix(const ipv6_address& x, unsigned prefix_length) const;
+    // ff02::1:ffXX:XXXX, where neighbour solicitations for the address go
+    ipv6_address solicited_node() const;
+    // The Ethernet address of a multicast address (RFC 2464)
+    ethernet_address multicast_mac() const;
+
+    static ipv6_address all_nodes();
+    // fe80::/64, with an interface identifier made from the MAC (RFC 4291)
+    static ipv6_address link_local(ethernet_address mac);
+} __attribute__((packed));
+
+bool is_unspecified(const ipv6_address& addr);
+
+socket_address make_socket_address(const ipv6_address& addr, uint16_t port);
+
+std::ostream& operator<<(std::ostream& os, const ipv6_address& a);
+
+}
+
+}
+
+namespace std {
+
+template <>
+struct hash<seastar::net::ipv6_address> {
+    size_t operator()(const seastar::net::ipv6_address& a) const {
+        uint64_t h[2];
+        std::copy_n(a.ip.data(), sizeof(h), reinterpret_cast<uint8_t*>(h));
+        return h[0] ^ (h[1] * 0x9e3779b97f4a7c15ull);
+    }
+};
+
+}
+
+namespace seastar {
+
+namespace net {
+
+struct ipv6_traits {
+    using address_type = ipv6_address;
+    using inet_type = ipv6_l4<ip_protocol_num::tcp>;
+    struct l4packet {
+        ipv6_address to;
+        packet p;
+        ethernet_address e_dst;
+        ip_protocol_num proto_num;
+    };
+    using packet_provider_type = std::function<std::experimental::optional<l4packet> ()>;
+    static void pseudo_header_checksum(checksummer& csum, const ipv6_address& src, const ipv6_address& dst,
+            ip_protocol_num proto_num, uint32_t len) {
+        csum.sum(reinterpret_cast<const char*>(src.ip.data()), src.size());
+        csum.sum(reinterpret_cast<const char*>(dst.ip.data()), dst.size());
+        csum.sum_many(len, uint16_t(0), uint16_t(proto_num));
+    }
+    static void tcp_pseudo_header_checksum(checksummer& csum, ipv6_address src, ipv6_address dst, uint16_t len) {
+        pseudo_header_checksum(csum, src, dst, ip_protocol_num::tcp, len);
+    }
+    static void udp_pseudo_header_checksum(checksummer& csum, ipv6_address src, ipv6_address dst, uint16_t len) {
+        pseudo_header_checksum(csum, src, dst, ip_protocol_num::udp, len);
+    }
+    static void hash_address(forward_hash& out_hash_data, const ipv6_address& a) {
+        for (auto b : a.ip) {
+            out_hash_data.push_back(b);
+        }
+    }
+    static constexpr uint8_t ip_hdr_len_min = ipv6_hdr_len_min;
+    static constexpr int address_family = AF_INET6;
+};
+
+template <ip_protocol_num ProtoNum>
+class ipv6_l4 {
+public:
+    ipv6& _inet;
+public:
+    ipv6_l4(ipv6& inet) : _inet(inet) {}
+    void register_packet_provider(ipv6_traits::packet_provider_type func);
+    future<ethernet_address> get_l2_dst_address(ipv6_address to);
+};
+
+class ipv6_protocol {
+public:
+    virtual ~ipv6_protocol() {}
+    virtual void received(packet p, ipv6_address from, ipv6_address to, uint8_t hop_limit) = 0;
+    virtual bool forward(forward_hash& out_hash_data, packet& p, size_t off) { return true; }
+};
+
+class ipv6_tcp final : public ipv6_protocol {
+    ipv6_l4<ip_protocol_num::tcp> _inet_l4;
+    std::unique_ptr<tcp<ipv6_traits>> _tcp;
+public:
+    ipv6_tcp(ipv6& inet);
+    ~ipv6_tcp();
+    virtual void received(packet p, ipv6_address from, ipv6_address to, uint8_t hop_limit) override;
+    virtual bool forward(forward_hash& out_hash_data, packet& p, size_t off) override;
+    friend class ipv6;
+};
+
+struct icmpv6_hdr {
+    enum class msg_type : uint8_t {
+        echo_request = 128,
+        echo_reply = 129,
+        neighbor_solicitation = 135,
+        neighbor_advertisement = 136,
+    };
+    msg_type type;
+    uint8_t code;
+    packed<uint16_t> csum;
+    template <typename Adjuster>
+    auto adjust_endianness(Adjuster a) {
+        return a(csum);
+    }
+} __attribute__((packed));
+
+class ndp_error : public std::runtime_error {
+public:
+    ndp_error(const std::string& msg) : std::runtime_error(msg) {}
+};
+
+class ndp_timeout_error : public ndp_error {
+public:
+    ndp_timeout_error() : ndp_error("NDP timeout") {}
+};
+
+class ndp_queue_full_error : public ndp_error {
+public:
+    ndp_queue_full_error() : ndp_error("NDP waiter's queue is full") {}
+};
+
+// Neighbour discovery (RFC 4861): the IPv6 counterpart of ARP. Only address
+// resolution is done; there are no router advertisements, redirects or
+// neighbour unreachability detection, and entries never expire.
+class ndp {
+    static constexpr size_t max_waiters = 512;
+    static constexpr size_t msg_len = 24; // ICMPv6 header, flags, target
+    static constexpr size_t lladdr_option_len = 8;
+    static constexpr uint8_t flag_solicited = 0x40;
+    static constexpr uint8_t flag_override = 0x20;
+    enum class option_type : uint8_t {
+        source_lladdr = 1,
+        target_lladdr = 2,
+    };
+    struct resolution {
+        std::vector<promise<ethernet_address>> _waiters;
+        timer<> _timeout_timer;
+    };
+    ipv6& _inet;
+    ipv6_icmp& _icmp;
+    std::unordered_map<ipv6_address, ethernet_address> _table;
+    std::unordered_map<ipv6_address, resolution> _in_progress;
+private:
+    packet make_message(icmpv6_hdr::msg_type type, uint8_t flags, const ipv6_address& target, option_type opt);
+    void send_solicitation(const ipv6_address& target);
+    void send_advertisement(const ipv6_address& to, ethernet_address e_dst, const ipv6_address& target, bool solicited);
+public:
+    ndp(ipv6& inet, ipv6_icmp& icmp) : _inet(inet), _icmp(icmp) {}
+    future<ethernet_address> lookup(const ipv6_address& addr);
+    void learn(ethernet_address l2, const ipv6_address& l3);
+    // Handles a neighbour solicitation or advertisement, ICMPv6 header included
+    void received(packet p, const ipv6_address& from, const ipv6_address& to);
+};
+
+class ipv6_icmp final : public ipv6_protocol {
+    ipv6_l4<ip_protocol_num::icmpv6> _inet_l4;
+    ndp _ndp;
+    circular_buffer<ipv6_traits::l4packet> _packetq;
+    semaphore _queue_space = {212992};
+public:
+    explicit ipv6_icmp(ipv6& inet);
+    virtual void received(packet p, ipv6_address from, ipv6_address to, uint8_t hop_limit) override;
+    // Checksums and queues an ICMPv6 message; drops it if the queue is full
+    void send(const ipv6_address& to, ethernet_address e_dst, packet p);
+    ndp& get_ndp() { return _ndp; }
+};
+
+// The IPv6 layer of the native stack. There is one, statically configured,
+// global address besides the link-local one, and a default gateway;
+// extension headers and fragments are not supported, and dropped.
+class ipv6 {
+public:
+    using clock_type = lowres_clock;
+    using address_type = ipv6_address;
+private:
+    interface* _netif;
+    std::vector<ipv6_traits::packet_provider_type> _pkt_providers;
+    ipv6_address _host_address;
+    ipv6_address _link_local_address;
+    ipv6_address _gw_address;
+    unsigned _prefix_length = 64;
+    net::hw_features _hw_features;
+    l3_protocol _l3;
+    subscription<packet, ethernet_address> _rx_packets;
+    ipv6_tcp _tcp;
+    ipv6_icmp _icmp;
+    array_map<ipv6_protocol*, 256> _l4;
+    circular_buffer<l3_protocol::l3packet> _packetq;
+    unsigned _pkt_provider_idx = 0;
+private:
+    future<> handle_received_packet(packet p, ethernet_address from);
+    bool forward(forward_hash& out_hash_data, packet& p, size_t off);
+    std::experimental::optional<l3_protocol::l3packet> get_packet();
+    bool on_link(const ipv6_address& a) const;
+public:
+    explicit ipv6(interface* netif);
+    void set_host_address(ipv6_address ip);
+    // The global address if there is one, the link-local one otherwise
+    ipv6_address host_address() const;
+    ipv6_address link_local_address() const {
+        return _link_local_address;
+    }
+    // The address packets to \c to are sent from
+    ipv6_address source_address(const ipv6_address& to) const;
+    // Whether packets sent to \c a are for this host
+    bool is_local(const ipv6_address& a) const;
+    void set_gw_address(ipv6_address ip);
+    ipv6_address gw_address() const;
+    void set_prefix_length(unsigned prefix_length);
+    unsigned prefix_length() const {
+        return _prefix_length;
+    }
+    interface* netif() const {
+        return _netif;
+    }
+    void send(ipv6_address to, ip_protocol_num proto_num, packet p, ethernet_address e_dst);
+    tcp<ipv6_traits>& get_tcp() { return *_tcp._tcp; }
+    // The interface's features, less the offloads that only know IPv4
+    const net::hw_features& hw_features() const { return _hw_features; }
+    void learn(ethernet_address l2, ipv6_address l3) {
+        _icmp.get_ndp().learn(l2, l3);
+    }
+    void register_packet_provider(ipv6_traits::packet_provider_type&& func) {
+        _pkt_providers.push_back(std::move(func));
+    }
+    future<ethernet_address> get_l2_dst_address(ipv6_address to);
+};
+
+template <ip_protocol_num ProtoNum>
+inline
+void ipv6_l4<ProtoNum>::register_packet_provider(ipv6_traits::packet_provider_type func) {
+    _inet.register_packet_provider([func = std::move(func)] {
+        auto l4p = func();
+        if (l4p) {
+            l4p.value().proto_num = ProtoNum;
+        }
+        return l4p;
+    });
+}
+
+template <ip_protocol_num ProtoNum>
+inline
+future<ethernet_address> ipv6_l4<ProtoNum>::get_l2_dst_address(ipv6_address to) {
+    return _inet.get_l2_dst_address(to);
+}
+
+struct ipv6_hdr {
+    packed<uint32_t> ver_tc_flow; // version, traffic class, flow label
+    packed<uint16_t> payload_len;
+    uint8_t next_header;
+    uint8_t hop_limit;
+    ipv6_address src_ip;
+    ipv6_address dst_ip;
+    template <typename Adjuster>
+    auto adjust_endianness(Adjuster a) {
+        return a(ver_tc_flow, payload_len);
+    }
+    unsigned version() const { return ver_tc_flow >> 28; }
+} __attribute__((packed));
+
+// Teaches all shards a neighbour's MAC
+void ndp_learn(ethernet_address l2, ipv6_address l3);
+
+}
+
+}
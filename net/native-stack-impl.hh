@@ -51,7 +51,7 @@ class native_server_socket_impl : public server_socket_impl {
 
 template <typename Protocol>
 native_server_socket_impl<Protocol>::native_server_socket_impl(Protocol& proto, uint16_t port, listen_options opt)
-    : _listener(proto.listen(port)) {
+    : _listener(proto.listen(port, opt.listen_backlog, std::move(opt.congestion_control))) {
 }
 
 template <typename Protocol>
@@ -60,7 +60,7 @@ native_server_socket_impl<Protocol>::accept() {
     return _listener.accept().then([] (typename Protocol::connection conn) {
         return make_ready_future<connected_socket, socket_address>(
                 connected_socket(std::make_unique<native_connected_socket_impl<Protocol>>(make_lw_shared(std::move(conn)))),
-                make_ipv4_address(conn.foreign_ip().ip, conn.foreign_port()));
+                make_socket_address(conn.foreign_ip(), conn.foreign_port()));
     });
 }
 
@@ -89,6 +89,9 @@ class native_connected_socket_impl : public connected_socket_impl {
     bool get_keepalive() const override;
     void set_keepalive_parameters(const keepalive_params&) override;
     keepalive_params get_keepalive_parameters() const override;
+    void set_congestion_control(const sstring& name) override;
+    sstring get_congestion_control() const override;
+    tcp_connection_info get_tcp_info() const override;
 };
 
 template <typename Protocol>
@@ -104,7 +107,7 @@ class native_socket_impl final : public socket_impl {
         assert(proto == transport::TCP);
 
         // FIXME: local is ignored since native stack does not support multiple IPs yet
-        assert(sa.as_posix_sockaddr().sa_family == AF_INET);
+        assert(sa.as_posix_sockaddr().sa_family == Protocol::address_family);
 
         _conn = make_lw_shared<typename Protocol::connection>(_proto.connect(sa));
         return _conn->connected().then([conn = _conn]() mutable {
@@ -229,6 +232,21 @@ keepalive_params native_connected_socket_impl<Protocol>::get_keepalive_parameter
     return tcp_keepalive_params {std::chrono::seconds(0), std::chrono::seconds(0), 0};
 }
 
+template <typename Protocol>
+void native_connected_socket_impl<Protocol>::set_congestion_control(const sstring& name) {
+    _conn->set_congestion_control(name);
+}
+
+template <typename Protocol>
+sstring native_connected_socket_impl<Protocol>::get_congestion_control() const {
+    return _conn->get_congestion_control();
+}
+
+template <typename Protocol>
+tcp_connection_info native_connected_socket_impl<Protocol>::get_tcp_info() const {
+    return _conn->get_tcp_info();
+}
+
 }
 
 }
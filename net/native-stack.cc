@@ -23,13 +23,16 @@
 #include "native-stack-impl.hh"
 #include "net.hh"
 #include "ip.hh"
+#include "ipv6.hh"
 #include "tcp-stack.hh"
 #include "tcp.hh"
 #include "udp.hh"
 #include "virtio.hh"
 #include "dpdk.hh"
+#include "xdp.hh"
 #include "proxy.hh"
 #include "dhcp.hh"
+#include "rss_balance.hh"
 #include <memory>
 #include <queue>
 #ifdef HAVE_OSV
@@ -55,6 +58,11 @@ void create_native_net_device(boost::program_options::variables_map opts) {
             !(opts.count("lro") && opts["lro"].as<std::string>() == "off"),
             !(opts.count("hw-fc") && opts["hw-fc"].as<std::string>() == "off"));
     } else
+#endif
+#ifdef HAVE_AF_XDP
+    if (opts.count("xdp-interface")) {
+        dev = create_xdp_net_device(opts);
+    } else
 #endif
     dev = create_virtio_net_device(opts);
 
@@ -65,6 +73,9 @@ void create_native_net_device(boost::program_options::variables_map opts) {
             uint16_t qid = engine().cpu_id();
             if (qid < sdev->hw_queues_count()) {
                 auto qp = sdev->init_local_queue(opts, qid);
+                if (opts["gro"].as<std::string>() == "on" && sdev->hw_features().rx_csum_offload) {
+                    qp->enable_gro();
+                }
                 std::map<unsigned, float> cpu_weights;
                 for (unsigned i = sdev->hw_queues_count() + qid % sdev->hw_queues_count(); i < smp::count; i+= sdev->hw_queues_count()) {
                     cpu_weights[i] = 1;
@@ -87,6 +98,14 @@ void create_native_net_device(boost::program_options::variables_map opts) {
                     create_native_stack(opts, sdev);
                 });
             }
+            auto period = opts["rss-rebalance-period"].as<unsigned>();
+            if (period && smp::count > 1) {
+                auto balancer = make_lw_shared<rss_balancer>(sdev, std::chrono::milliseconds(period));
+                balancer->start();
+                engine().at_exit([balancer] {
+                    return balancer->stop();
+                });
+            }
         });
     });
 }
@@ -98,6 +117,7 @@ class native_network_stack : public network_stack {
 private:
     interface _netif;
     ipv4 _inet;
+    ipv6 _inet6;
     bool _dhcp = false;
     promise<> _config;
     timer<> _timer;
@@ -108,6 +128,7 @@ class native_network_stack : public network_stack {
         _inet.set_packet_filter(filter);
     }
     using tcp4 = tcp<ipv4_traits>;
+    using tcp6 = tcp<ipv6_traits>;
 public:
     explicit native_network_stack(boost::program_options::variables_map opts, std::shared_ptr<device> dev);
     virtual server_socket listen(socket_address sa, listen_options opt) override;
@@ -121,10 +142,17 @@ class native_network_stack : public network_stack {
         return ready_promise.get_future();
     }
     virtual bool has_per_core_namespace() override { return true; };
+    virtual future<> add_flow_rule(flow_rule rule) override {
+        return _netif.add_flow_rule(rule);
+    }
     void arp_learn(ethernet_address l2, ipv4_address l3) {
         _inet.learn(l2, l3);
     }
+    void ndp_learn(ethernet_address l2, ipv6_address l3) {
+        _inet6.learn(l2, l3);
+    }
     friend class native_server_socket_impl<tcp4>;
+    friend class native_server_socket_impl<tcp6>;
 };
 
 thread_local promise<std::unique_ptr<network_stack>> native_network_stack::ready_promise;
@@ -140,12 +168,22 @@ add_native_net_options_description(boost::program_options::options_description &
 #ifdef HAVE_DPDK
     opts.add(get_dpdk_net_options_description());
 #endif
+#ifdef HAVE_AF_XDP
+    opts.add(get_xdp_net_options_description());
+#endif
 }
 
 native_network_stack::native_network_stack(boost::program_options::variables_map opts, std::shared_ptr<device> dev)
     : _netif(std::move(dev))
-    , _inet(&_netif) {
+    , _inet(&_netif)
+    , _inet6(&_netif) {
+    _netif.set_gso(opts["gso"].as<std::string>() == "on");
     _inet.get_udp().set_queue_size(opts["udpv4-queue-size"].as<int>());
+    _inet.get_tcp().set_rto_limits(std::chrono::milliseconds(opts["tcp-rto-min"].as<unsigned>()),
+            std::chrono::milliseconds(opts["tcp-rto-max"].as<unsigned>()));
+    _inet.get_tcp().set_timestamps(opts["tcp-timestamps"].as<bool>());
+    _inet.get_tcp().set_syn_cookies(opts["tcp-syn-cookies"].as<bool>());
+    _inet.get_tcp().set_max_receive_window(opts["tcp-max-receive-window"].as<unsigned>());
     _dhcp = opts["host-ipv4-addr"].defaulted()
             && opts["gw-ipv4-addr"].defaulted()
             && opts["netmask-ipv4-addr"].defaulted() && opts["dhcp"].as<bool>();
@@ -154,16 +192,52 @@ native_network_stack::native_network_stack(boost::program_options::variables_map
         _inet.set_gw_address(ipv4_address(opts["gw-ipv4-addr"].as<std::string>()));
         _inet.set_netmask_address(ipv4_address(opts["netmask-ipv4-addr"].as<std::string>()));
     }
+    if (!opts["host-ipv6-addr"].as<std::string>().empty()) {
+        _inet6.set_host_address(ipv6_address(opts["host-ipv6-addr"].as<std::string>()));
+    }
+    if (!opts["gw-ipv6-addr"].as<std::string>().empty()) {
+        _inet6.set_gw_address(ipv6_address(opts["gw-ipv6-addr"].as<std::string>()));
+    }
+    _inet6.set_prefix_length(opts["ipv6-prefix-length"].as<unsigned>());
+    _inet6.get_tcp().set_rto_limits(std::chrono::milliseconds(opts["tcp-rto-min"].as<unsigned>()),
+            std::chrono::milliseconds(opts["tcp-rto-max"].as<unsigned>()));
+    _inet6.get_tcp().set_timestamps(opts["tcp-timestamps"].as<bool>());
+    _inet6.get_tcp().set_syn_cookies(opts["tcp-syn-cookies"].as<bool>());
+    _inet6.get_tcp().set_max_receive_window(opts["tcp-max-receive-window"].as<unsigned>());
 }
 
 server_socket
 native_network_stack::listen(socket_address sa, listen_options opts) {
-    assert(sa.as_posix_sockaddr().sa_family == AF_INET);
-    return tcpv4_listen(_inet.get_tcp(), ntohs(sa.as_posix_sockaddr_in().sin_port), opts);
+    auto family = sa.as_posix_sockaddr().sa_family;
+    assert(family == AF_INET || family == AF_INET6);
+    if (family == AF_INET6) {
+        return tcpv6_listen(_inet6.get_tcp(), sa.port(), opts);
+    }
+    return tcpv4_listen(_inet.get_tcp(), sa.port(), opts);
 }
 
+// Connects over IPv4 or IPv6, as the address connected to is
+class native_inet_socket_impl final : public socket_impl {
+    ::seastar::socket _v4;
+    ::seastar::socket _v6;
+public:
+    native_inet_socket_impl(::seastar::socket v4, ::seastar::socket v6)
+        : _v4(std::move(v4)), _v6(std::move(v6)) {}
+    virtual future<connected_socket> connect(socket_address sa, socket_address local, transport proto = transport::TCP) override {
+        if (sa.as_posix_sockaddr().sa_family == AF_INET6) {
+            return _v6.connect(sa, local, proto);
+        }
+        return _v4.connect(sa, local, proto);
+    }
+    virtual void shutdown() override {
+        _v4.shutdown();
+        _v6.shutdown();
+    }
+};
+
 seastar::socket native_network_stack::socket() {
-    return tcpv4_socket(_inet.get_tcp());
+    return seastar::socket(std::make_unique<native_inet_socket_impl>(
+            tcpv4_socket(_inet.get_tcp()), tcpv6_socket(_inet6.get_tcp())));
 }
 
 using namespace std::chrono_literals;
@@ -245,6 +319,16 @@ void arp_learn(ethernet_address l2, ipv4_address l3)
     }
 }
 
+void ndp_learn(ethernet_address l2, ipv6_address l3)
+{
+    for (unsigned i = 0; i < smp::count; i++) {
+        smp::submit_to(i, [l2, l3] {
+            auto & ns = static_cast<native_network_stack&>(engine().net());
+            ns.ndp_learn(l2, l3);
+        });
+    }
+}
+
 void create_native_stack(boost::program_options::variables_map opts, std::shared_ptr<device> dev) {
     native_network_stack::ready_promise.set_value(std::unique_ptr<network_stack>(std::make_unique<native_network_stack>(opts, std::move(dev))));
 }
@@ -265,9 +349,33 @@ boost::program_options::options_description nns_options() {
         ("netmask-ipv4-addr",
                 boost::program_options::value<std::string>()->default_value("255.255.255.0"),
                 "static IPv4 netmask to use")
+        ("host-ipv6-addr",
+                boost::program_options::value<std::string>()->default_value(""),
+                "static global IPv6 address to use, besides the link-local one")
+        ("gw-ipv6-addr",
+                boost::program_options::value<std::string>()->default_value(""),
+                "static IPv6 gateway to use")
+        ("ipv6-prefix-length",
+                boost::program_options::value<unsigned>()->default_value(64),
+                "length of the on-link prefix of the static IPv6 address")
         ("udpv4-queue-size",
                 boost::program_options::value<int>()->default_value(ipv4_udp::default_queue_size),
                 "Default size of the UDPv4 per-channel packet queue")
+        ("tcp-rto-min",
+                boost::program_options::value<unsigned>()->default_value(1000),
+                "Minimum TCP retransmission timeout, in milliseconds")
+        ("tcp-rto-max",
+                boost::program_options::value<unsigned>()->default_value(60000),
+                "Maximum TCP retransmission timeout, in milliseconds")
+        ("tcp-timestamps",
+                boost::program_options::value<bool>()->default_value(true),
+                "Use TCP timestamps (RFC 7323) for round-trip time measurement and PAWS")
+        ("tcp-syn-cookies",
+                boost::program_options::value<bool>()->default_value(true),
+                "Answer SYNs with SYN cookies when a listener's backlog is full, rather than drop them")
+        ("tcp-max-receive-window",
+                boost::program_options::value<unsigned>()->default_value(6 << 20),
+                "Most a TCP receive window grows to as the application reads faster, in bytes (at most 8MB)")
         ("dhcp",
                 boost::program_options::value<bool>()->default_value(true),
                         "Use DHCP discovery")
@@ -280,6 +388,15 @@ boost::program_options::options_description nns_options() {
         ("lro",
                 boost::program_options::value<std::string>()->default_value("on"),
                 "Enable LRO")
+        ("gso",
+                boost::program_options::value<std::string>()->default_value("on"),
+                "Enable software TCP segmentation for devices without TSO")
+        ("gro",
+                boost::program_options::value<std::string>()->default_value("on"),
+                "Enable software TCP receive coalescing for devices that verify checksums")
+        ("rss-rebalance-period",
+                boost::program_options::value<unsigned>()->default_value(0),
+                "Milliseconds between moves of RSS buckets from the busiest shards to the idlest ones, by the packets they handled; new connections follow, established ones stay (0=never)")
         ;
 
     add_native_net_options_description(opts);
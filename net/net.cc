@@ -23,6 +23,7 @@
 #include <boost/asio/ip/address_v4.hpp>
 #include <boost/algorithm/string.hpp>
 #include "net.hh"
+#include "gso.hh"
 #include <utility>
 #include "toeplitz.hh"
 #include "core/metrics.hh"
@@ -143,6 +144,12 @@ qp::qp(bool register_copy_stats,
         // Rx
         sm::make_derive(_queue_name + "_rx_frags", _stats.rx.good.nr_frags,
                         sm::description(format("Counts a number of received fragments. Divide this value by a {} to get an average number of fragments in an Rx packet.", _queue_name + "_rx_packets"))),
+
+        //
+        // GRO merges rate: DERIVE:0:U
+        //
+        sm::make_derive(_queue_name + "_rx_gro_merged", [this] { return _gro ? _gro->merged() : 0; },
+                        sm::description("Counts a number of received TCP segments merged into the previous one by software GRO.")),
     });
 
     if (register_copy_stats) {
@@ -174,6 +181,17 @@ qp::qp(bool register_copy_stats,
 qp::~qp() {
 }
 
+void qp::rx_gro_flush() {
+    if (!_gro) {
+        return;
+    }
+    _gro->flush(_gro_out);
+    while (!_gro_out.empty()) {
+        _rx_stream.produce(std::move(_gro_out.front()));
+        _gro_out.pop_front();
+    }
+}
+
 void qp::configure_proxies(const std::map<unsigned, float>& cpu_weights) {
     assert(!cpu_weights.empty());
     if ((cpu_weights.size() == 1 && cpu_weights.begin()->first == engine().cpu_id())) {
@@ -210,6 +228,14 @@ void qp::build_sw_reta(const std::map<unsigned, float>& cpu_weights) {
     _sw_reta = reta;
 }
 
+std::vector<forward_hash> qp::list_flows() const {
+    std::vector<forward_hash> flows;
+    for (auto&& l : _flow_listers) {
+        l(flows);
+    }
+    return flows;
+}
+
 subscription<packet>
 device::receive(std::function<future<> (packet)> next_packet) {
     auto sub = _queues[engine().cpu_id()]->_rx_stream.listen(std::move(next_packet));
@@ -242,6 +268,11 @@ interface::interface(std::shared_ptr<device> dev)
     , _hw_features(_dev->hw_features()) {
     dev->local_queue().register_packet_provider([this, idx = 0u] () mutable {
             std::experimental::optional<packet> p;
+            if (!_gso_segments.empty()) {
+                p = std::move(_gso_segments.front());
+                _gso_segments.pop_front();
+                return p;
+            }
             for (size_t i = 0; i < _pkt_providers.size(); i++) {
                 auto l3p = _pkt_providers[idx++]();
                 if (idx == _pkt_providers.size())
@@ -253,6 +284,15 @@ interface::interface(std::shared_ptr<device> dev)
                     eh->src_mac = _hw_address;
                     eh->eth_proto = uint16_t(l3pv.proto_num);
                     *eh = hton(*eh);
+                    if (_hw_features.tx_gso && l3pv.p.offload_info().tso_seg_size) {
+                        tcp_gso_segment(std::move(l3pv.p), _hw_features, _gso_segments);
+                        if (_gso_segments.empty()) {
+                            continue;
+                        }
+                        p = std::move(_gso_segments.front());
+                        _gso_segments.pop_front();
+                        return p;
+                    }
                     p = std::move(l3pv.p);
                     return p;
                 }
@@ -275,6 +315,79 @@ unsigned interface::hash2cpu(uint32_t hash) {
     return _dev->hash2cpu(hash);
 }
 
+unsigned interface::flow2cpu(const forward_hash& flow) {
+    if (_dev->steers_flows()) {
+        if (auto cpu = _dev->steered_cpu(flow)) {
+            return *cpu;
+        }
+    }
+    return hash2cpu(toeplitz_hash(rss_key(), flow));
+}
+
+future<> interface::add_flow_rule(flow_rule rule) {
+    return _dev->add_flow_rule(rule);
+}
+
+// flow is laid out as l3_protocol::forward() makes it: the source and
+// destination addresses, then the source and destination ports, all in
+// network byte order
+static bool flow_rule_matches(const flow_rule& rule, const forward_hash& flow) {
+    size_t addr_size;
+    if (flow.size() == 2 * 4 + 4) {
+        addr_size = 4;
+    } else if (flow.size() == 2 * 16 + 4) {
+        addr_size = 16;
+    } else {
+        // not TCP or UDP, or a fragment: there are no ports to match
+        return false;
+    }
+    auto port = [&flow] (size_t off) {
+        return uint16_t(flow[off] << 8 | flow[off + 1]);
+    };
+    if (rule.remote.ip) {
+        if (addr_size != 4) {
+            return false;
+        }
+        auto ip = uint32_t(flow[0]) << 24 | uint32_t(flow[1]) << 16 | uint32_t(flow[2]) << 8 | flow[3];
+        if (ip != rule.remote.ip) {
+            return false;
+        }
+    }
+    return (!rule.remote.port || port(2 * addr_size) == rule.remote.port)
+            && (!rule.local_port || port(2 * addr_size + 2) == rule.local_port);
+}
+
+std::experimental::optional<unsigned> device::steered_cpu(const forward_hash& flow) {
+    for (auto& rule : local_queue()._flow_rules) {
+        if (flow_rule_matches(rule, flow)) {
+            return rule.cpu;
+        }
+    }
+    return {};
+}
+
+future<> device::add_flow_rule(flow_rule rule) {
+    if (rule.cpu >= smp::count) {
+        return make_exception_future<>(std::invalid_argument(sprint("flow rule for cpu %d, of %d", rule.cpu, smp::count)));
+    }
+    if (!rule.local_port && !rule.remote.port) {
+        return make_exception_future<>(std::invalid_argument("flow rule matches no port"));
+    }
+    return smp::submit_to(0, [this, rule] {
+        // the software rules first, so that whatever queue the packets
+        // arrive on, they are sent to rule.cpu
+        return smp::invoke_on_all([this, rule] {
+            local_queue()._flow_rules.push_back(rule);
+        }).then([this, rule] {
+            // queue q is polled by cpu q; where the NIC can't steer the
+            // flow, its packets arrive by RSS and are forwarded
+            if (rule.cpu < hw_queues_count()) {
+                install_flow_rule(rule, rule.cpu);
+            }
+        });
+    });
+}
+
 uint16_t interface::hw_queues_count() {
     return _dev->hw_queues_count();
 }
@@ -283,16 +396,42 @@ const rss_key_type& interface::rss_key() const {
     return _dev->rss_key();
 }
 
+void interface::register_flow_lister(flow_lister_type func) {
+    _dev->local_queue().register_flow_lister(std::move(func));
+}
+
+static __thread unsigned forward_queue_depth;
+
 void interface::forward(unsigned cpuid, packet p) {
-    static __thread unsigned queue_depth;
-
-    if (queue_depth < 1000) {
-        queue_depth++;
-        auto src_cpu = engine().cpu_id();
-        smp::submit_to(cpuid, [this, p = std::move(p), src_cpu]() mutable {
-            _dev->l2receive(p.free_on_cpu(src_cpu));
-        }).then([] {
-            queue_depth--;
+    if (forward_queue_depth < 1000) {
+        forward_queue_depth++;
+        if (_forward_batches.empty()) {
+            _forward_batches.resize(smp::count);
+        }
+        _forward_batches[cpuid].push_back(std::move(p));
+        if (!_forward_flush_scheduled) {
+            schedule(make_task([this] {
+                flush_forwarded();
+            }));
+            _forward_flush_scheduled = true;
+        }
+    }
+}
+
+void interface::flush_forwarded() {
+    _forward_flush_scheduled = false;
+    auto src_cpu = engine().cpu_id();
+    for (unsigned cpu = 0; cpu < _forward_batches.size(); ++cpu) {
+        if (_forward_batches[cpu].empty()) {
+            continue;
+        }
+        auto n = _forward_batches[cpu].size();
+        smp::submit_to(cpu, [this, batch = std::exchange(_forward_batches[cpu], {}), src_cpu] () mutable {
+            for (auto&& p : batch) {
+                _dev->l2receive(p.free_on_cpu(src_cpu));
+            }
+        }).then([n] {
+            forward_queue_depth -= n;
         });
     }
 }
@@ -303,18 +442,43 @@ future<> interface::dispatch_packet(packet p) {
         auto i = _proto_map.find(ntoh(eh->eth_proto));
         if (i != _proto_map.end()) {
             l3_rx_stream& l3 = i->second;
-            auto fw = _dev->forward_dst(engine().cpu_id(), [&p, &l3, this] () {
-                auto hwrss = p.rss_hash();
-                if (hwrss) {
-                    return hwrss.value();
-                } else {
-                    forward_hash data;
-                    if (l3.forward(data, p, sizeof(eth_hdr))) {
-                        return toeplitz_hash(rss_key(), data);
+            std::experimental::optional<uint32_t> hash;
+            forward_hash data;
+            bool have_data = false;
+            auto flow = [&] () -> const forward_hash* {
+                if (!have_data) {
+                    data = forward_hash();
+                    if (!l3.forward(data, p, sizeof(eth_hdr))) {
+                        return nullptr;
+                    }
+                    have_data = true;
+                }
+                return &data;
+            };
+            auto hashfn = [&] () {
+                if (!hash) {
+                    hash = p.rss_hash();
+                    if (!hash) {
+                        auto d = flow();
+                        hash = d ? toeplitz_hash(rss_key(), *d) : 0u;
+                        if (d) {
+                            // spare the cpu we forward to computing it again
+                            p.set_rss_hash(*hash);
+                        }
                     }
-                    return 0u;
                 }
-            });
+                return *hash;
+            };
+            std::experimental::optional<unsigned> steered;
+            if (_dev->steers_flows()) {
+                if (auto d = flow()) {
+                    steered = _dev->steered_cpu(*d);
+                }
+            }
+            auto fw = steered ? *steered : _dev->forward_dst(engine().cpu_id(), hashfn);
+            if (!steered && _dev->rss_balancing()) {
+                fw = _dev->rss_balance_dst(fw, hashfn(), flow);
+            }
             if (fw != engine().cpu_id()) {
                 forward(fw, std::move(p));
             } else {
@@ -31,6 +31,7 @@
 #include "ethernet.hh"
 #include "packet.hh"
 #include "const.hh"
+#include "gro.hh"
 #include <unordered_map>
 
 namespace seastar {
@@ -65,6 +66,33 @@ class forward_hash {
     const uint8_t& operator[](size_t idx) const {
         return data[idx];
     }
+    bool operator==(const forward_hash& x) const {
+        return end_idx == x.end_idx && std::equal(data, data + end_idx, x.data);
+    }
+    struct hasher {
+        size_t operator()(const forward_hash& h) const {
+            // FNV-1a
+            size_t r = 14695981039346656037ull;
+            for (size_t i = 0; i < h.end_idx; i++) {
+                r = (r ^ h.data[i]) * 1099511628211ull;
+            }
+            return r;
+        }
+    };
+};
+
+// Appends the flows that live on the shard, as l3_protocol forwards them
+using flow_lister_type = std::function<void (std::vector<forward_hash>&)>;
+
+// Per-shard state of rss_balancer: the packets handled by the shard, by
+// RSS bucket, and the flows of moved buckets that must still reach the
+// shard they were established on
+struct rss_balance_state {
+    std::vector<uint64_t> sw_packets; // by hw queue * qp::sw_reta_size + software table entry
+    std::vector<uint64_t> hw_packets; // by NIC redirection table entry
+    std::vector<bool> sw_pinned;      // buckets in pinned that have flows
+    std::vector<bool> hw_pinned;
+    std::unordered_map<forward_hash, unsigned, forward_hash::hasher> pinned; // flow -> cpu
 };
 
 struct hw_features {
@@ -72,12 +100,16 @@ struct hw_features {
     bool tx_csum_ip_offload = false;
     // Enable tx l4 (TCP or UDP) checksum offload
     bool tx_csum_l4_offload = false;
-    // Enable rx checksum offload
+    // Enable rx checksum offload, of all received packets; a device that
+    // verifies only some marks them in their offload_info instead
     bool rx_csum_offload = false;
     // LRO is enabled
     bool rx_lro = false;
     // Enable tx TCP segment offload
     bool tx_tso = false;
+    // Segment TCP in software, just before the device queue, when it has
+    // no TSO; see tcp_gso_segment()
+    bool tx_gso = false;
     // Enable tx UDP fragmentation offload
     bool tx_ufo = false;
     // Maximum Transmission Unit
@@ -119,20 +151,39 @@ class interface {
     ethernet_address _hw_address;
     net::hw_features _hw_features;
     std::vector<l3_protocol::packet_provider_type> _pkt_providers;
+    // Segments of a software-segmented packet, not yet picked up by the
+    // device queue
+    circular_buffer<packet> _gso_segments;
+    // Received packets to forward to other shards, by shard: they are sent
+    // in a single message per shard once the tasks that received them have
+    // run
+    std::vector<std::vector<packet>> _forward_batches;
+    bool _forward_flush_scheduled = false;
 private:
     future<> dispatch_packet(packet p);
+    void flush_forwarded();
 public:
     explicit interface(std::shared_ptr<device> dev);
     ethernet_address hw_address() { return _hw_address; }
     const net::hw_features& hw_features() const { return _hw_features; }
+    // Enables software segmentation, if the device has no TSO
+    void set_gso(bool enabled) {
+        _hw_features.tx_gso = enabled && !_hw_features.tx_tso;
+    }
     subscription<packet, ethernet_address> register_l3(eth_protocol_num proto_num,
             std::function<future<> (packet p, ethernet_address from)> next,
             std::function<bool (forward_hash&, packet&, size_t)> forward);
     void forward(unsigned cpuid, packet p);
     unsigned hash2cpu(uint32_t hash);
+    // The cpu that receives the packets of flow, as l3_protocol forwards
+    // them: the one a flow rule names, or else the one RSS picks
+    unsigned flow2cpu(const forward_hash& flow);
+    future<> add_flow_rule(flow_rule rule);
     void register_packet_provider(l3_protocol::packet_provider_type func) {
         _pkt_providers.push_back(std::move(func));
     }
+    // For rss_balancer, which keeps established flows on their shard
+    void register_flow_lister(flow_lister_type func);
     uint16_t hw_queues_count();
     const rss_key_type& rss_key() const;
     friend class l3_protocol;
@@ -214,17 +265,37 @@ struct qp_stats {
 class qp {
     using packet_provider_type = std::function<std::experimental::optional<packet> ()>;
     std::vector<packet_provider_type> _pkt_providers;
-    std::experimental::optional<std::array<uint8_t, 128>> _sw_reta;
+public:
+    static constexpr unsigned sw_reta_size = 128;
+private:
+    std::experimental::optional<std::array<uint8_t, sw_reta_size>> _sw_reta;
+    std::unique_ptr<rss_balance_state> _rss_balance;
+    std::vector<flow_rule> _flow_rules; // the same on all cpus
+    std::vector<flow_lister_type> _flow_listers;
     circular_buffer<packet> _proxy_packetq;
     stream<packet> _rx_stream;
     reactor::poller _tx_poller;
     circular_buffer<packet> _tx_packetq;
+    std::experimental::optional<tcp_gro> _gro;
+    circular_buffer<packet> _gro_out;
 
 protected:
     const std::string _stats_plugin_name;
     const std::string _queue_name;
     metrics::metric_groups _metrics;
     qp_stats _stats;
+protected:
+    // Drivers pass the packets of a received batch to rx_gro_add(), and
+    // call rx_gro_flush() at the end of the batch; without GRO, packets
+    // go up the stack at once.
+    void rx_gro_add(packet p) {
+        if (_gro) {
+            _gro->add(std::move(p), _gro_out);
+        } else {
+            _rx_stream.produce(std::move(p));
+        }
+    }
+    void rx_gro_flush();
 
 public:
     qp(bool register_copy_stats = false,
@@ -242,6 +313,11 @@ class qp {
         return sent;
     }
     virtual void rx_start() {};
+    // Coalesces received TCP segments, see tcp_gro; only for devices that
+    // verify checksums on receive
+    void enable_gro() {
+        _gro.emplace();
+    }
     void configure_proxies(const std::map<unsigned, float>& cpu_weights);
     // build REdirection TAble for cpu_weights map: target cpu -> weight
     void build_sw_reta(const std::map<unsigned, float>& cpu_weights);
@@ -251,8 +327,13 @@ class qp {
     void register_packet_provider(packet_provider_type func) {
         _pkt_providers.push_back(std::move(func));
     }
+    void register_flow_lister(flow_lister_type func) {
+        _flow_listers.push_back(std::move(func));
+    }
+    std::vector<forward_hash> list_flows() const;
     bool poll_tx();
     friend class device;
+    friend class rss_balancer;
 };
 
 class device {
@@ -277,16 +358,62 @@ class device {
     virtual unsigned hash2qid(uint32_t hash) {
         return hash % hw_queues_count();
     }
+    // The NIC redirection table, if rss_balancer may move its entries
+    // between queues: its size, a power of two, or 0. The table is
+    // reprogrammed from cpu 0, and hash2qid() follows it.
+    virtual unsigned hw_reta_size() { return 0; }
+    virtual void update_hw_reta(unsigned idx, unsigned qid) {
+        throw std::logic_error("no NIC redirection table");
+    }
+    // Programs the NIC to deliver the packets that rule matches to queue
+    // qid; false if it can't. Called on cpu 0.
+    virtual bool install_flow_rule(const flow_rule& rule, unsigned qid) { return false; }
+    future<> add_flow_rule(flow_rule rule);
+    bool steers_flows() {
+        return !local_queue()._flow_rules.empty();
+    }
+    // The cpu of the first flow rule flow matches, if any
+    std::experimental::optional<unsigned> steered_cpu(const forward_hash& flow);
     void set_local_queue(std::unique_ptr<qp> dev);
+    unsigned sw_reta_entry(uint32_t hash) const {
+        return (hash >> _rss_table_bits) % qp::sw_reta_size;
+    }
     template <typename Func>
     unsigned forward_dst(unsigned src_cpuid, Func&& hashfn) {
         auto& qp = queue_for_cpu(src_cpuid);
         if (!qp._sw_reta) {
             return src_cpuid;
         }
-        auto hash = hashfn() >> _rss_table_bits;
-        auto& reta = *qp._sw_reta;
-        return reta[hash % reta.size()];
+        return (*qp._sw_reta)[sw_reta_entry(hashfn())];
+    }
+    bool rss_balancing() {
+        return bool(local_queue()._rss_balance);
+    }
+    // Sends the flows pinned by rss_balancer to their cpu, instead of fw,
+    // the one picked by the redirection tables; packets are accounted to
+    // their buckets on the cpu that handles them. flow() returns the
+    // packet's forward_hash, or nullptr if it has none.
+    template <typename Func>
+    unsigned rss_balance_dst(unsigned fw, uint32_t hash, Func&& flow) {
+        auto& b = *local_queue()._rss_balance;
+        auto sw_bucket = hash2qid(hash) * qp::sw_reta_size + sw_reta_entry(hash);
+        auto hw_bucket = hash & (b.hw_packets.size() - 1);
+        if (b.sw_pinned[sw_bucket] || (!b.hw_pinned.empty() && b.hw_pinned[hw_bucket])) {
+            auto data = flow();
+            if (data) {
+                auto i = b.pinned.find(*data);
+                if (i != b.pinned.end()) {
+                    fw = i->second;
+                }
+            }
+        }
+        if (fw == engine().cpu_id()) {
+            b.sw_packets[sw_bucket]++;
+            if (!b.hw_packets.empty()) {
+                b.hw_packets[hw_bucket]++;
+            }
+        }
+        return fw;
     }
     virtual unsigned hash2cpu(uint32_t hash) {
         // there is an assumption here that qid == cpu_id which will
@@ -24,6 +24,8 @@
 #include <iostream>
 #include <algorithm>
 #include <cctype>
+#include <cstdlib>
+#include <utility>
 
 namespace seastar {
 
@@ -32,6 +34,98 @@ namespace net {
 constexpr size_t packet::internal_data_size;
 constexpr size_t packet::default_nr_frags;
 
+namespace {
+
+// Free impl blocks of the default size, kept by each shard to make
+// allocating packets cheaper than a trip to the allocator. A block freed on
+// another shard than the one that allocated it joins the freeing shard's
+// pool.
+struct impl_pool {
+    struct free_block {
+        free_block* next;
+    };
+    static constexpr size_t max_blocks = 512;
+    free_block* head = nullptr;
+    size_t nr_blocks = 0;
+    ~impl_pool() {
+        while (head) {
+            ::free(std::exchange(head, head->next));
+        }
+    }
+};
+
+thread_local impl_pool the_impl_pool;
+
+// Deleters of packets from other shards, freed on this one, waiting to be
+// run back on their shards: they are sent in a single message per shard
+// once the tasks that freed them have run, rather than in one each
+class remote_frees {
+    struct pending {
+        deleter d;
+        std::function<void()> cb;
+    };
+    std::vector<std::vector<pending>> _by_cpu;
+    bool _flush_scheduled = false;
+private:
+    void flush() {
+        _flush_scheduled = false;
+        for (unsigned cpu = 0; cpu < _by_cpu.size(); ++cpu) {
+            if (_by_cpu[cpu].empty()) {
+                continue;
+            }
+            smp::submit_to(cpu, [batch = std::exchange(_by_cpu[cpu], {})] () mutable {
+                // moved out of the capture, so that the deleters run here
+                // rather than where the work item is destroyed
+                auto frees = std::move(batch);
+                for (auto&& f : frees) {
+                    deleter d(std::move(f.d));
+                    f.cb();
+                }
+            });
+        }
+    }
+public:
+    void add(unsigned cpu, deleter d, std::function<void()> cb) {
+        if (_by_cpu.empty()) {
+            _by_cpu.resize(smp::count);
+        }
+        _by_cpu[cpu].push_back(pending{std::move(d), std::move(cb)});
+        if (!_flush_scheduled) {
+            schedule(make_task([this] {
+                flush();
+            }));
+            _flush_scheduled = true;
+        }
+    }
+};
+
+thread_local remote_frees the_remote_frees;
+
+}
+
+void* packet::allocate_block(size_t size) {
+    auto& pool = the_impl_pool;
+    if (size == impl::block_size(default_nr_frags) && pool.head) {
+        --pool.nr_blocks;
+        return std::exchange(pool.head, pool.head->next);
+    }
+    void* block;
+    if (posix_memalign(&block, cache_line_size, size)) {
+        throw std::bad_alloc();
+    }
+    return block;
+}
+
+void packet::free_block(void* block, size_t size) noexcept {
+    auto& pool = the_impl_pool;
+    if (size == impl::block_size(default_nr_frags) && pool.nr_blocks < impl_pool::max_blocks) {
+        pool.head = new (block) impl_pool::free_block{pool.head};
+        ++pool.nr_blocks;
+        return;
+    }
+    ::free(block);
+}
+
 void packet::linearize(size_t at_frag, size_t desired_size) {
     _impl->unuse_internal_data();
     size_t nr_frags = 0;
@@ -65,13 +159,7 @@ packet packet::free_on_cpu(unsigned cpu, std::function<void()> cb)
 {
     // make new deleter that runs old deleter on an origin cpu
     _impl->_deleter = make_deleter(deleter(), [d = std::move(_impl->_deleter), cpu, cb = std::move(cb)] () mutable {
-        smp::submit_to(cpu, [d = std::move(d), cb = std::move(cb)] () mutable {
-            // deleter needs to be moved from lambda capture to be destroyed here
-            // otherwise deleter destructor will be called on a cpu that called smp::submit_to()
-            // when work_item is destroyed.
-            deleter xxx(std::move(d));
-            cb();
-        });
+        the_remote_frees.add(cpu, std::move(d), std::move(cb));
     });
 
     return packet(impl::copy(_impl.get()));
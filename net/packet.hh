@@ -24,6 +24,7 @@
 
 #include "core/deleter.hh"
 #include "core/temporary_buffer.hh"
+#include "core/cacheline.hh"
 #include "const.hh"
 #include <vector>
 #include <cassert>
@@ -52,6 +53,12 @@ struct offload_info {
     uint16_t tso_seg_size = 0;
     // HW stripped VLAN header (CPU order)
     std::experimental::optional<uint16_t> vlan_tci;
+    // HW verified the received IP header / TCP or UDP checksum, on devices
+    // that do not verify all of them (see hw_features::rx_csum_offload)
+    bool rx_ip_csum_good = false;
+    bool rx_l4_csum_good = false;
+    // HW receive timestamp, in the device's clock units
+    std::experimental::optional<uint64_t> rx_timestamp;
 };
 
 // Zero-copy friendly packet class
@@ -78,7 +85,7 @@ struct offload_info {
 // allocations.  This is useful when adding headers.
 //
 class packet final {
-    // enough for lots of headers, not quite two cache lines:
+    // enough for lots of headers
     static constexpr size_t internal_data_size = 128 - 16;
     static constexpr size_t default_nr_frags = 4;
 
@@ -92,32 +99,67 @@ class packet final {
         fragment& operator[](size_t idx) { return _start[idx]; }
     };
 
+    struct impl;
+    struct impl_deleter {
+        void operator()(impl* p) const noexcept;
+    };
+    using impl_ptr = std::unique_ptr<impl, impl_deleter>;
+
+    // An impl is a single cache line aligned block: the fields below, then
+    // the fragment descriptors, as many as fill the block, then the
+    // internal data. Headers are prepended from the end of the block, so a
+    // packet with a few fragments and its headers touches one line for the
+    // descriptors and one or two for the headers. Blocks of the default
+    // size are recycled by a per-shard pool.
     struct impl {
         // when destroyed, virtual destructor will reclaim resources
         deleter _deleter;
         unsigned _len = 0;
         uint16_t _nr_frags = 0;
         uint16_t _allocated_frags;
+        uint16_t _headroom = internal_data_size; // in the internal data
         offload_info _offload_info;
         std::experimental::optional<uint32_t> _rss_hash;
-        char _data[internal_data_size]; // only _frags[0] may use
-        unsigned _headroom = internal_data_size; // in _data
-        // FIXME: share _data/_frags space
 
-        fragment _frags[];
+        // aligned so that the descriptors fill the block exactly
+        alignas(sizeof(fragment)) fragment _frags[];
 
-        impl(size_t nr_frags = default_nr_frags);
+        impl(size_t nr_frags);
         impl(const impl&) = delete;
-        impl(fragment frag, size_t nr_frags = default_nr_frags);
+        impl(size_t nr_frags, fragment frag);
 
         pseudo_vector fragments() { return { _frags, _nr_frags }; }
 
-        static std::unique_ptr<impl> allocate(size_t nr_frags) {
-            nr_frags = std::max(nr_frags, default_nr_frags);
-            return std::unique_ptr<impl>(new (nr_frags) impl(nr_frags));
+        // only _frags[0] may use the internal data, which ends the block
+        char* data() { return reinterpret_cast<char*>(_frags + _allocated_frags); }
+        const char* data() const { return reinterpret_cast<const char*>(_frags + _allocated_frags); }
+
+        static size_t block_size(size_t nr_frags) {
+            auto size = sizeof(impl) + nr_frags * sizeof(fragment) + internal_data_size;
+            return (size + cache_line_size - 1) & ~(cache_line_size - 1);
         }
 
-        static std::unique_ptr<impl> copy(impl* old, size_t nr) {
+        // Allocates an impl for at least nr_frags fragments
+        template <typename... Args>
+        static impl_ptr create(size_t nr_frags, Args&&... args) {
+            static_assert(internal_data_size % sizeof(fragment) == 0, "the internal data must end the block");
+            auto size = block_size(std::max(nr_frags, default_nr_frags));
+            nr_frags = (size - sizeof(impl) - internal_data_size) / sizeof(fragment);
+            assert(nr_frags == uint16_t(nr_frags));
+            auto block = allocate_block(size);
+            try {
+                return impl_ptr(new (block) impl(nr_frags, std::forward<Args>(args)...));
+            } catch (...) {
+                free_block(block, size);
+                throw;
+            }
+        }
+
+        static impl_ptr allocate(size_t nr_frags) {
+            return create(nr_frags);
+        }
+
+        static impl_ptr copy(impl* old, size_t nr) {
             auto n = allocate(nr);
             n->_deleter = std::move(old->_deleter);
             n->_len = old->_len;
@@ -130,33 +172,21 @@ class packet final {
             return n;
         }
 
-        static std::unique_ptr<impl> copy(impl* old) {
+        static impl_ptr copy(impl* old) {
             return copy(old, old->_nr_frags);
         }
 
-        static std::unique_ptr<impl> allocate_if_needed(std::unique_ptr<impl> old, size_t extra_frags) {
+        static impl_ptr allocate_if_needed(impl_ptr old, size_t extra_frags) {
             if (old->_allocated_frags >= old->_nr_frags + extra_frags) {
                 return old;
             }
             return copy(old.get(), std::max<size_t>(old->_nr_frags + extra_frags, 2 * old->_nr_frags));
         }
-        void* operator new(size_t size, size_t nr_frags = default_nr_frags) {
-            assert(nr_frags == uint16_t(nr_frags));
-            return ::operator new(size + nr_frags * sizeof(fragment));
-        }
-        // Matching the operator new above
-        void operator delete(void* ptr, size_t nr_frags) {
-            return ::operator delete(ptr);
-        }
-        // Since the above "placement delete" hides the global one, expose it
-        void operator delete(void* ptr) {
-            return ::operator delete(ptr);
-        }
 
         bool using_internal_data() const {
             return _nr_frags
-                    && _frags[0].base >= _data
-                    && _frags[0].base < _data + internal_data_size;
+                    && _frags[0].base >= data()
+                    && _frags[0].base < data() + internal_data_size;
         }
 
         void unuse_internal_data() {
@@ -177,13 +207,16 @@ class packet final {
             if (!using_internal_data()) {
                 return;
             }
-            to->_frags[0].base = to->_data + _headroom;
+            to->_frags[0].base = to->data() + to->_headroom;
             std::copy(_frags[0].base, _frags[0].base + _frags[0].size,
                     to->_frags[0].base);
         }
     };
-    packet(std::unique_ptr<impl>&& impl) : _impl(std::move(impl)) {}
-    std::unique_ptr<impl> _impl;
+    // Blocks of the default size come from, and go back to, the pool
+    static void* allocate_block(size_t size);
+    static void free_block(void* block, size_t size) noexcept;
+    packet(impl_ptr&& impl) : _impl(std::move(impl)) {}
+    impl_ptr _impl;
 public:
     static packet from_static_data(const char* data, size_t len) {
         return {fragment{const_cast<char*>(data), len}, deleter()};
@@ -230,7 +263,7 @@ class packet final {
     }
 
     unsigned len() const { return _impl->_len; }
-    unsigned memory() const { return len() +  sizeof(packet::impl); }
+    unsigned memory() const { return len() + impl::block_size(_impl->_allocated_frags); }
 
     fragment frag(unsigned idx) const { return _impl->_frags[idx]; }
     fragment& frag(unsigned idx) { return _impl->_frags[idx]; }
@@ -324,18 +357,25 @@ packet::packet(packet&& x) noexcept
     : _impl(std::move(x._impl)) {
 }
 
+inline
+void packet::impl_deleter::operator()(impl* p) const noexcept {
+    auto size = impl::block_size(p->_allocated_frags);
+    p->~impl();
+    free_block(p, size);
+}
+
 inline
 packet::impl::impl(size_t nr_frags)
     : _len(0), _allocated_frags(nr_frags) {
 }
 
 inline
-packet::impl::impl(fragment frag, size_t nr_frags)
-    : _len(frag.size), _allocated_frags(nr_frags) {
-    assert(_allocated_frags > _nr_frags);
+packet::impl::impl(size_t nr_frags, fragment frag)
+    : impl(nr_frags) {
+    _len = frag.size;
     if (frag.size <= internal_data_size) {
         _headroom -= frag.size;
-        _frags[0] = { _data + _headroom, frag.size };
+        _frags[0] = { data() + _headroom, frag.size };
     } else {
         auto buf = static_cast<char*>(::malloc(frag.size));
         if (!buf) {
@@ -360,7 +400,7 @@ packet::packet(size_t nr_frags)
 }
 
 inline
-packet::packet(fragment frag) : _impl(new impl(frag)) {
+packet::packet(fragment frag) : _impl(impl::create(1, frag)) {
 }
 
 inline
@@ -421,7 +461,7 @@ packet::allocate_headroom(size_t size) {
             _impl = impl::allocate_if_needed(std::move(_impl), 1);
             std::copy_backward(_impl->_frags, _impl->_frags + _impl->_nr_frags,
                     _impl->_frags + _impl->_nr_frags + 1);
-            _impl->_frags[0] = { _impl->_data + internal_data_size, 0 };
+            _impl->_frags[0] = { _impl->data() + internal_data_size, 0 };
             ++_impl->_nr_frags;
         }
         _impl->_headroom -= size;
@@ -553,10 +593,8 @@ void packet::trim_back(size_t how_much) {
     }
     _impl->_nr_frags = i + 1;
     if (how_much) {
+        // the headroom is before the data, which keeps its start
         _impl->_frags[i].size -= how_much;
-        if (i == 0 && _impl->using_internal_data()) {
-            _impl->_headroom += how_much;
-        }
     }
 }
 
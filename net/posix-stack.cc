@@ -23,8 +23,46 @@
 #include "net.hh"
 #include "packet.hh"
 #include "api.hh"
+#include "core/future-util.hh"
+#include "core/memory_account.hh"
+#include "core/align.hh"
+#include <array>
+#include <climits>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <netinet/sctp.h>
+#include <linux/errqueue.h>
+
+// For libc headers older than the kernel's UDP GSO support
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+// and than its MSG_ZEROCOPY support
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+// and than its kTLS support
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TLS_TX
+#define TLS_TX 1
+#endif
+#ifndef TLS_SET_RECORD_TYPE
+#define TLS_SET_RECORD_TYPE 1
+#endif
 
 namespace seastar {
 
@@ -32,6 +70,126 @@ namespace net {
 
 using namespace seastar;
 
+// Bytes moved by the posix connections of the shard
+static thread_local uint64_t connection_bytes = 0;
+
+void conntrack::load_balancer::count_bytes(size_t n) {
+    connection_bytes += n;
+}
+
+static uint64_t client_hash(const socket_address& a) {
+    uint64_t h;
+    if (a.u.sa.sa_family == AF_INET6) {
+        uint64_t w[2];
+        std::memcpy(w, &a.u.in6.sin6_addr, sizeof(w));
+        h = w[0] ^ w[1];
+    } else {
+        h = a.u.in.sin_addr.s_addr;
+    }
+    return (h * 0x9e3779b97f4a7c15) >> 32;
+}
+
+conntrack::load_balancer::load_balancer(listen_options::load_balancing_algorithm lba, bool sticky)
+        : _lba(lba)
+        , _sticky(sticky)
+        , _shards(smp::count) {
+}
+
+// The load of a connection, on average, with a floor so that they are
+// still spread over shards that look idle
+double conntrack::load_balancer::connection_load() const {
+    double load = 0;
+    unsigned connections = 0;
+    for (auto&& s : _shards) {
+        load += s.load;
+        connections += s.connections;
+    }
+    return std::max(connections ? load / connections : 0.0, 1e-3);
+}
+
+// In connection_count mode, connections are counted in units of the mean
+// number per shard, to compare with sticky_slack
+double conntrack::load_balancer::score(shard_id cpu, double unit) const {
+    auto& s = _shards[cpu];
+    if (_lba == listen_options::load_balancing_algorithm::connection_count) {
+        return s.connections / unit;
+    }
+    return s.load + s.pending;
+}
+
+shard_id conntrack::load_balancer::next_cpu(const socket_address& client) {
+    unsigned connections = 0;
+    for (auto&& s : _shards) {
+        connections += s.connections;
+    }
+    auto unit = std::max(1.0, double(connections) / _shards.size());
+    shard_id best = 0;
+    for (shard_id cpu = 1; cpu < _shards.size(); ++cpu) {
+        auto d = score(cpu, unit) - score(best, unit);
+        if (d < 0 || (d == 0 && _shards[cpu].connections < _shards[best].connections)) {
+            best = cpu;
+        }
+    }
+    auto cpu = best;
+    if (_sticky) {
+        auto preferred = shard_id(client_hash(client) % _shards.size());
+        if (score(preferred, unit) <= score(best, unit) + sticky_slack) {
+            cpu = preferred;
+        }
+    }
+    if (_lba == listen_options::load_balancing_algorithm::activity) {
+        _shards[cpu].pending += connection_load();
+    }
+    _shards[cpu].connections++;
+    return cpu;
+}
+
+void conntrack::load_balancer::update(const std::vector<shard_sample>& samples) {
+    std::vector<uint64_t> moved(samples.size());
+    uint64_t busiest = 0;
+    for (shard_id cpu = 0; cpu < samples.size(); ++cpu) {
+        moved[cpu] = samples[cpu].bytes - _shards[cpu].bytes;
+        _shards[cpu].bytes = samples[cpu].bytes;
+        busiest = std::max(busiest, moved[cpu]);
+    }
+    for (shard_id cpu = 0; cpu < samples.size(); ++cpu) {
+        auto& s = _shards[cpu];
+        auto traffic = busiest ? double(moved[cpu]) / busiest : 0.0;
+        s.load = (std::min(samples[cpu].utilization, 1.0) + traffic) / 2;
+        // the utilization is a five second average, which shows the
+        // recent connections only in part
+        s.pending /= 2;
+    }
+}
+
+void conntrack::load_balancer::sample() {
+    if (_sampling) {
+        return;
+    }
+    _sampling = true;
+    auto samples = make_lw_shared<std::vector<shard_sample>>(smp::count);
+    auto self = shared_from_this();
+    parallel_for_each(smp::all_cpus(), [samples] (shard_id cpu) {
+        return smp::submit_to(cpu, [] {
+            return shard_sample{engine().utilization(), connection_bytes};
+        }).then([samples, cpu] (shard_sample s) {
+            (*samples)[cpu] = s;
+        });
+    }).then([self, samples] {
+        self->update(*samples);
+    }).finally([self] {
+        self->_sampling = false;
+    });
+}
+
+void conntrack::load_balancer::start_sampling() {
+    if (_lba != listen_options::load_balancing_algorithm::activity) {
+        return;
+    }
+    _sampler.set_callback([this] { sample(); });
+    _sampler.arm_periodic(std::chrono::seconds(1));
+}
+
 template <transport Transport>
 class posix_connected_socket_operations;
 
@@ -63,6 +221,52 @@ class posix_connected_socket_operations<transport::TCP> {
             _fd.getsockopt<unsigned>(IPPROTO_TCP, TCP_KEEPCNT)
         };
     }
+    void set_congestion_control(file_desc& _fd, const sstring& name) {
+        _fd.setsockopt(IPPROTO_TCP, TCP_CONGESTION, name.c_str());
+    }
+    sstring get_congestion_control(file_desc& _fd) const {
+        char name[16] = {}; // TCP_CA_NAME_MAX
+        _fd.getsockopt(IPPROTO_TCP, TCP_CONGESTION, name, sizeof(name) - 1);
+        return name;
+    }
+    tcp_connection_info get_tcp_info(file_desc& _fd) const {
+        // struct tcp_info as recent kernels fill it; libc's stops at
+        // tcpi_total_retrans, and older kernels fill less
+        struct {
+            ::tcp_info base;
+            uint64_t pacing_rate, max_pacing_rate, bytes_acked, bytes_received;
+            uint32_t segs_out, segs_in, notsent_bytes, min_rtt, data_segs_in, data_segs_out;
+            uint64_t delivery_rate, busy_time, rwnd_limited, sndbuf_limited;
+            uint32_t delivered, delivered_ce;
+            uint64_t bytes_sent, bytes_retrans;
+            uint32_t dsack_dups, reord_seen, rcv_ooopack, snd_wnd, rcv_wnd;
+        } ti = {};
+        socklen_t len = sizeof(ti);
+        auto r = ::getsockopt(_fd.get(), IPPROTO_TCP, TCP_INFO, &ti, &len);
+        throw_system_error_on(r == -1, "getsockopt(TCP_INFO)");
+        auto has = [len] (size_t end) { return len >= end; };
+        auto& b = ti.base;
+        auto bytes = [&b] (uint64_t segments) {
+            // the ssthresh of a connection that saw no loss is "infinite"
+            return uint32_t(std::min<uint64_t>(segments * b.tcpi_snd_mss, std::numeric_limits<uint32_t>::max()));
+        };
+        tcp_connection_info info;
+        info.rtt = std::chrono::microseconds(b.tcpi_rtt);
+        info.rtt_var = std::chrono::microseconds(b.tcpi_rttvar);
+        info.mss = b.tcpi_snd_mss;
+        info.cwnd = bytes(b.tcpi_snd_cwnd);
+        info.ssthresh = bytes(b.tcpi_snd_ssthresh);
+        // as the kernel's tcp_packets_in_flight()
+        info.bytes_in_flight = bytes(b.tcpi_unacked - b.tcpi_sacked - b.tcpi_lost + b.tcpi_retrans);
+        if (has(offsetof(decltype(ti), snd_wnd) + sizeof(ti.snd_wnd))) {
+            info.send_window = ti.snd_wnd;
+        }
+        if (has(offsetof(decltype(ti), rcv_wnd) + sizeof(ti.rcv_wnd))) {
+            info.receive_window = ti.rcv_wnd;
+        }
+        info.retransmits = b.tcpi_total_retrans;
+        return info;
+    }
 };
 
 template <>
@@ -100,23 +304,223 @@ class posix_connected_socket_operations<transport::SCTP> {
             params.spp_pathmaxrxt
         };
     }
+    void set_congestion_control(file_desc& _fd, const sstring& name) {
+        throw std::runtime_error("SCTP congestion control is not selectable");
+    }
+    sstring get_congestion_control(file_desc& _fd) const {
+        return "sctp";
+    }
+    tcp_connection_info get_tcp_info(file_desc& _fd) const {
+        throw std::runtime_error("not a TCP connection");
+    }
+};
+
+// Reaps the completions of the shard's sockets that have zero-copy sends
+// in flight. The EPOLLERR that signals them is not something the reactor
+// waits for, so they are polled for, at most once per reap_period; and,
+// once none came for idle_period, as the peers are slow to acknowledge,
+// once per idle_period, from a timer that lets the reactor sleep.
+class posix_zero_copy_sender::poller {
+    static constexpr std::chrono::microseconds reap_period{50};
+    static constexpr std::chrono::milliseconds idle_period{1};
+    std::vector<lw_shared_ptr<posix_zero_copy_sender>> _senders;
+    std::experimental::optional<reactor::poller> _poller;
+    timer<> _timer;
+    bool _polling = false;
+    steady_clock_type::time_point _next_reap;
+    steady_clock_type::time_point _last_progress;
+private:
+    bool reap() {
+        bool reaped = false;
+        for (size_t i = 0; i < _senders.size();) {
+            auto& s = *_senders[i];
+            reaped |= s.reap();
+            if (s._in_flight.empty()) {
+                s._polled = false;
+                std::swap(_senders[i], _senders.back());
+                _senders.pop_back();
+            } else {
+                ++i;
+            }
+        }
+        return reaped;
+    }
+    bool poll() {
+        if (!_polling) {
+            return false;
+        }
+        auto now = steady_clock_type::now();
+        if (now < _next_reap) {
+            return false;
+        }
+        _next_reap = now + reap_period;
+        if (reap()) {
+            _last_progress = now;
+            return true;
+        }
+        if (_senders.empty() || now - _last_progress > idle_period) {
+            // the reactor poller is dropped by the timer, as it can't
+            // be from within itself
+            _polling = false;
+            _timer.arm_periodic(idle_period);
+        }
+        return false;
+    }
+    void on_timer() {
+        _poller = {};
+        if (reap()) {
+            start_polling();
+        } else if (_senders.empty()) {
+            _timer.cancel();
+        }
+    }
+    void start_polling() {
+        _timer.cancel();
+        _polling = true;
+        _last_progress = steady_clock_type::now();
+        if (!_poller) {
+            _poller = reactor::poller::simple([this] { return poll(); });
+        }
+    }
+public:
+    poller() : _timer([this] { on_timer(); }) {}
+    static poller& get() {
+        static thread_local std::unique_ptr<poller> instance;
+        if (!instance) {
+            instance = std::make_unique<poller>();
+            engine().at_exit([] {
+                instance.reset();
+                return make_ready_future<>();
+            });
+        }
+        return *instance;
+    }
+    void add(lw_shared_ptr<posix_zero_copy_sender> s) {
+        _senders.push_back(std::move(s));
+        if (!_polling) {
+            start_polling();
+        }
+    }
 };
 
+constexpr std::chrono::microseconds posix_zero_copy_sender::poller::reap_period;
+constexpr std::chrono::milliseconds posix_zero_copy_sender::poller::idle_period;
+
+void posix_zero_copy_sender::set_threshold(size_t bytes) {
+    if (bytes && !_enabled) {
+        try {
+            _fd->get_file_desc().setsockopt(SOL_SOCKET, SO_ZEROCOPY, 1);
+            _enabled = true;
+        } catch (std::system_error&) {
+            // kernels without MSG_ZEROCOPY: keep on copying
+            return;
+        }
+    }
+    _threshold = bytes;
+}
+
+future<> posix_zero_copy_sender::send(packet p) {
+    return do_with(std::move(p), [this, self = shared_from_this()] (packet& p) {
+        return repeat([this, &p] {
+            iovec* iov = reinterpret_cast<iovec*>(p.fragment_array());
+            msghdr mh = {};
+            mh.msg_iov = iov;
+            mh.msg_iovlen = p.nr_frags();
+            boost::optional<size_t> r;
+            try {
+                r = _fd->get_file_desc().sendmsg(&mh, MSG_NOSIGNAL | MSG_ZEROCOPY);
+            } catch (std::system_error& e) {
+                if (e.code() != std::error_code(ENOBUFS, std::system_category())) {
+                    throw;
+                }
+                // out of the memory for pinning pages the socket may use:
+                // copy this packet, until earlier sends complete
+                return _fd->write_all(p).then([] {
+                    return stop_iteration::yes;
+                });
+            }
+            if (!r) {
+                return _fd->writeable().then([] {
+                    return stop_iteration::no;
+                });
+            }
+            _in_flight.push_back(pending_send{_next_id++, p.share(), false});
+            if (*r == p.len()) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            p.trim_front(*r);
+            return make_ready_future<stop_iteration>(stop_iteration::no);
+        });
+    }).then([this, self = shared_from_this()] () mutable {
+        reap();
+        if (!_in_flight.empty() && !_polled) {
+            _polled = true;
+            poller::get().add(std::move(self));
+        }
+    });
+}
+
+void posix_zero_copy_sender::complete(uint32_t first, uint32_t last, bool copied) {
+    for (auto& s : _in_flight) {
+        if (uint32_t(s.id - first) <= uint32_t(last - first)) {
+            s.done = true;
+        }
+    }
+    _kernel_copies |= copied;
+}
+
+bool posix_zero_copy_sender::reap() {
+    struct {
+        alignas(struct cmsghdr) char buf[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+    } control;
+    bool reaped = false;
+    for (;;) {
+        msghdr mh = {};
+        mh.msg_control = control.buf;
+        mh.msg_controllen = sizeof(control.buf);
+        try {
+            if (!_fd->get_file_desc().recvmsg(&mh, MSG_ERRQUEUE)) {
+                break;
+            }
+        } catch (std::system_error&) {
+            break;
+        }
+        for (auto cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                    && !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            auto ee = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+            if (ee->ee_errno == 0 && ee->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                complete(ee->ee_info, ee->ee_data, ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+            }
+        }
+    }
+    while (!_in_flight.empty() && _in_flight.front().done) {
+        _in_flight.pop_front();
+        reaped = true;
+    }
+    return reaped;
+}
+
 template <transport Transport>
 class posix_connected_socket_impl final : public connected_socket_impl, posix_connected_socket_operations<Transport> {
     lw_shared_ptr<pollable_fd> _fd;
+    lw_shared_ptr<posix_zero_copy_sender> _zero_copy;
     using _ops = posix_connected_socket_operations<Transport>;
     conntrack::handle _handle;
+    bool _kernel_tls = false;
 private:
-    explicit posix_connected_socket_impl(lw_shared_ptr<pollable_fd> fd) : _fd(std::move(fd)) {}
+    explicit posix_connected_socket_impl(lw_shared_ptr<pollable_fd> fd)
+        : _fd(std::move(fd)), _zero_copy(make_lw_shared<posix_zero_copy_sender>(_fd)) {}
     explicit posix_connected_socket_impl(lw_shared_ptr<pollable_fd> fd, conntrack::handle&& handle)
-        : _fd(std::move(fd)), _handle(std::move(handle)) {}
+        : _fd(std::move(fd)), _zero_copy(make_lw_shared<posix_zero_copy_sender>(_fd)), _handle(std::move(handle)) {}
 public:
     virtual data_source source() override {
         return data_source(std::make_unique< posix_data_source_impl>(_fd));
     }
     virtual data_sink sink() override {
-        return data_sink(std::make_unique< posix_data_sink_impl>(_fd));
+        return data_sink(std::make_unique< posix_data_sink_impl>(_fd, _zero_copy));
     }
     virtual void shutdown_input() override {
         _fd->shutdown(SHUT_RD);
@@ -142,6 +546,59 @@ class posix_connected_socket_impl final : public connected_socket_impl, posix_co
     keepalive_params get_keepalive_parameters() const override {
         return _ops::get_keepalive_parameters(_fd->get_file_desc());
     }
+    void set_congestion_control(const sstring& name) override {
+        return _ops::set_congestion_control(_fd->get_file_desc(), name);
+    }
+    sstring get_congestion_control() const override {
+        return _ops::get_congestion_control(_fd->get_file_desc());
+    }
+    tcp_connection_info get_tcp_info() const override {
+        return _ops::get_tcp_info(_fd->get_file_desc());
+    }
+    void set_zero_copy_threshold(size_t bytes) override {
+        if (!_kernel_tls) {
+            _zero_copy->set_threshold(bytes);
+        }
+    }
+    bool set_kernel_tls_transmit(const void* crypto_info, size_t size) override {
+        auto fd = _fd->get_file_desc().get();
+        // the tls module may be missing; without TLS_TX set, it passes
+        // data through as it is
+        if (Transport != transport::TCP
+                || ::setsockopt(fd, SOL_TCP, TCP_ULP, "tls", 3) == -1
+                || ::setsockopt(fd, SOL_TLS, TLS_TX, crypto_info, size) == -1) {
+            return false;
+        }
+        _kernel_tls = true;
+        // kTLS sockets refuse MSG_ZEROCOPY
+        _zero_copy->set_threshold(0);
+        return true;
+    }
+    future<> send_kernel_tls_record(uint8_t type, temporary_buffer<char> data) override {
+        struct record {
+            temporary_buffer<char> data;
+            iovec iov;
+            msghdr mh = {};
+            union {
+                cmsghdr align;
+                char buf[CMSG_SPACE(sizeof(uint8_t))];
+            } control;
+        };
+        auto r = std::make_unique<record>();
+        r->data = std::move(data);
+        r->iov = { r->data.get_write(), r->data.size() };
+        r->mh.msg_iov = &r->iov;
+        r->mh.msg_iovlen = 1;
+        r->mh.msg_control = r->control.buf;
+        r->mh.msg_controllen = sizeof(r->control.buf);
+        auto cmsg = CMSG_FIRSTHDR(&r->mh);
+        cmsg->cmsg_level = SOL_TLS;
+        cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint8_t));
+        *CMSG_DATA(cmsg) = type;
+        auto& mh = r->mh;
+        return _fd->sendmsg(&mh).then([r = std::move(r)] (size_t) {});
+    }
     friend class posix_server_socket_impl<Transport>;
     friend class posix_ap_server_socket_impl<Transport>;
     friend class posix_reuseport_server_socket_impl<Transport>;
@@ -187,7 +644,7 @@ template <transport Transport>
 future<connected_socket, socket_address>
 posix_server_socket_impl<Transport>::accept() {
     return _lfd.accept().then([this] (pollable_fd fd, socket_address sa) {
-        auto cth = _conntrack.get_handle();
+        auto cth = _conntrack.get_handle(sa);
         auto cpu = cth.cpu();
         if (cpu == engine().cpu_id()) {
             std::unique_ptr<connected_socket_impl> csi(
@@ -280,11 +737,45 @@ posix_ap_server_socket_impl<Transport>::move_connected_socket(socket_address sa,
 
 future<temporary_buffer<char>>
 posix_data_source_impl::get() {
-    return _fd->read_some(_buf.get_write(), _buf_size).then([this] (size_t size) {
-        _buf.trim(size);
-        auto ret = std::move(_buf);
-        _buf = temporary_buffer<char>(_buf_size);
-        return make_ready_future<temporary_buffer<char>>(std::move(ret));
+    auto& budget = net::receive_memory();
+    if (budget.used() >= budget.soft_limit()) {
+        // the data read so far is not being consumed: wait until it is
+        return budget.wait_for_admission().then([this] {
+            return read();
+        });
+    }
+    return read();
+}
+
+future<temporary_buffer<char>>
+posix_data_source_impl::read() {
+    auto readable = _speculate_read ? make_ready_future<>() : _fd->readable();
+    _speculate_read = false;
+    return readable.then([this] {
+        static constexpr size_t min_buf_size = 1024;
+        auto size = net::receive_buffer_size(_buf_size, min_buf_size);
+        temporary_buffer<char> buf(size);
+        auto r = _fd->get_file_desc().read(buf.get_write(), size);
+        if (!r) {
+            return read();
+        }
+        _speculate_read = *r == size;
+        conntrack::load_balancer::count_bytes(*r);
+        if (!*r) {
+            return make_ready_future<temporary_buffer<char>>();
+        }
+        auto charged = size;
+        if (*r < size / 4) {
+            // don't hold a mostly empty buffer while the data waits to be consumed
+            buf = temporary_buffer<char>(buf.get(), *r);
+            charged = *r;
+        }
+        auto& budget = net::receive_memory();
+        budget.charge(charged);
+        auto p = buf.get_write();
+        auto n = *r;
+        return make_ready_future<temporary_buffer<char>>(temporary_buffer<char>(p, n,
+                make_deleter(buf.release(), [&budget, charged] { budget.release(charged); })));
     });
 }
 
@@ -313,15 +804,62 @@ std::vector<iovec> to_iovec(std::vector<temporary_buffer<char>>& buf_vec) {
 
 future<>
 posix_data_sink_impl::put(temporary_buffer<char> buf) {
+    conntrack::load_balancer::count_bytes(buf.size());
+    if (_zero_copy && _zero_copy->wants(buf.size())) {
+        return _zero_copy->send(packet(std::move(buf)));
+    }
     return _fd->write_all(buf.get(), buf.size()).then([d = buf.release()] {});
 }
 
 future<>
 posix_data_sink_impl::put(packet p) {
+    conntrack::load_balancer::count_bytes(p.len());
+    if (_zero_copy && _zero_copy->wants(p.len())) {
+        return _zero_copy->send(std::move(p));
+    }
     _p = std::move(p);
     return _fd->write_all(_p).then([this] { _p.reset(); });
 }
 
+future<>
+posix_data_sink_impl::put_file(file& f, uint64_t offset, uint64_t len) {
+    // limits how long a syscall thread is held by one connection
+    static constexpr uint64_t max_sendfile_size = 1 << 20;
+    struct progress {
+        uint64_t offset;
+        uint64_t len;
+        bool sent = false;
+    };
+    return do_with(progress{offset, len}, [this, &f] (progress& p) {
+        return repeat([this, &f, &p] {
+            if (!p.len) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            return _fd->sendfile(f, p.offset, std::min(p.len, max_sendfile_size)).then([&p] (size_t n) {
+                if (!n) {
+                    throw std::runtime_error(sprint("file ended %d bytes before the range to write did", p.len));
+                }
+                conntrack::load_balancer::count_bytes(n);
+                p.sent = true;
+                p.offset += n;
+                p.len -= n;
+                return stop_iteration::no;
+            });
+        }).handle_exception([this, &f, &p] (std::exception_ptr ep) {
+            // files that sendfile() can't read are read and sent from user space
+            try {
+                std::rethrow_exception(ep);
+            } catch (std::system_error& e) {
+                if (!p.sent && e.code() == std::error_code(EINVAL, std::system_category())) {
+                    return data_sink_impl::put_file(f, p.offset, p.len);
+                }
+            } catch (...) {
+            }
+            return make_exception_future<>(std::move(ep));
+        });
+    });
+}
+
 future<>
 posix_data_sink_impl::close() {
     _fd->shutdown(SHUT_WR);
@@ -334,12 +872,12 @@ posix_network_stack::listen(socket_address sa, listen_options opt) {
         return _reuseport ?
             server_socket(std::make_unique<posix_reuseport_server_tcp_socket_impl>(sa, engine().posix_listen(sa, opt)))
             :
-            server_socket(std::make_unique<posix_server_tcp_socket_impl>(sa, engine().posix_listen(sa, opt)));
+            server_socket(std::make_unique<posix_server_tcp_socket_impl>(sa, engine().posix_listen(sa, opt), opt));
     } else {
         return _reuseport ?
             server_socket(std::make_unique<posix_reuseport_server_sctp_socket_impl>(sa, engine().posix_listen(sa, opt)))
             :
-            server_socket(std::make_unique<posix_server_sctp_socket_impl>(sa, engine().posix_listen(sa, opt)));
+            server_socket(std::make_unique<posix_server_sctp_socket_impl>(sa, engine().posix_listen(sa, opt), opt));
     }
 }
 
@@ -367,63 +905,252 @@ posix_ap_network_stack::listen(socket_address sa, listen_options opt) {
     }
 }
 
+// Large enough for the IP_PKTINFO control message
 struct cmsg_with_pktinfo {
-    struct cmsghdrcmh;
-    struct in_pktinfo pktinfo;
+    alignas(struct cmsghdr) char buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
 };
 
-class posix_udp_channel : public udp_channel_impl {
+class posix_datagram : public udp_datagram_impl {
 private:
-    static constexpr int MAX_DATAGRAM_SIZE = 65507;
-    struct recv_ctx {
-        struct msghdr _hdr;
-        struct iovec _iov;
-        socket_address _src_addr;
-        char* _buffer;
-        cmsg_with_pktinfo _cmsg;
-
-        recv_ctx() {
-            memset(&_hdr, 0, sizeof(_hdr));
-            _hdr.msg_iov = &_iov;
-            _hdr.msg_iovlen = 1;
-            _hdr.msg_name = &_src_addr.u.sa;
-            _hdr.msg_namelen = sizeof(_src_addr.u.sas);
-            memset(&_cmsg, 0, sizeof(_cmsg));
-            _hdr.msg_control = &_cmsg;
-            _hdr.msg_controllen = sizeof(_cmsg);
+    ipv4_addr _src;
+    ipv4_addr _dst;
+    packet _p;
+public:
+    posix_datagram(ipv4_addr src, ipv4_addr dst, packet p) : _src(src), _dst(dst), _p(std::move(p)) {}
+    virtual ipv4_addr get_src() override { return _src; }
+    virtual ipv4_addr get_dst() override { return _dst; }
+    virtual uint16_t get_dst_port() override { return _dst.port; }
+    virtual packet& get_data() override { return _p; }
+};
+
+// Sends the datagrams queued in the same task quota together, with one
+// sendmmsg() call, and runs of equally sized datagrams to the same
+// destination as one UDP GSO message, which the kernel segments.
+class posix_udp_sender : public enable_lw_shared_from_this<posix_udp_sender> {
+    static constexpr size_t max_datagram_size = 65507;
+    static constexpr size_t max_gso_segments = 64;
+    static constexpr size_t max_messages = IOV_MAX;
+    struct datagram {
+        socket_address dst;
+        packet p;
+        promise<> sent;
+    };
+    struct gso_cmsg {
+        alignas(struct cmsghdr) char buf[CMSG_SPACE(sizeof(uint16_t))];
+    };
+    lw_shared_ptr<pollable_fd> _fd;
+    bool _gso;
+    std::vector<datagram> _queue;
+    bool _flushing = false;
+    // The batch being sent: its datagrams before _sent are done, and the
+    // messages were built from the next ones; a message ends before the
+    // datagram that its _ends entry indexes
+    std::vector<datagram> _batch;
+    size_t _sent = 0;
+    std::vector<mmsghdr> _msgs;
+    std::vector<iovec> _iovs;
+    std::vector<size_t> _ends;
+    std::vector<gso_cmsg> _cmsgs;
+private:
+    static bool same_destination(const socket_address& a, const socket_address& b) {
+        return a.u.in.sin_addr.s_addr == b.u.in.sin_addr.s_addr && a.u.in.sin_port == b.u.in.sin_port;
+    }
+    void build();
+    void complete(size_t end, std::exception_ptr ex);
+    future<> send_batch();
+    void flush();
+public:
+    posix_udp_sender(lw_shared_ptr<pollable_fd> fd, bool gso) : _fd(std::move(fd)), _gso(gso) {}
+    future<> send(socket_address dst, packet p) {
+        _queue.push_back(datagram{dst, std::move(p), promise<>()});
+        auto f = _queue.back().sent.get_future();
+        if (!_flushing) {
+            _flushing = true;
+            later().then([self = shared_from_this()] {
+                self->flush();
+            });
         }
+        return f;
+    }
+};
 
-        void prepare() {
-            _buffer = new char[MAX_DATAGRAM_SIZE];
-            _iov.iov_base = _buffer;
-            _iov.iov_len = MAX_DATAGRAM_SIZE;
+void posix_udp_sender::build() {
+    _msgs.clear();
+    _iovs.clear();
+    _ends.clear();
+    _cmsgs.clear();
+    std::vector<size_t> iov_starts;
+    for (auto i = _sent; i < _batch.size() && _msgs.size() < max_messages;) {
+        auto seg = _batch[i].p.len();
+        auto total = seg;
+        auto nr_iovs = _batch[i].p.nr_frags();
+        auto j = i + 1;
+        // all segments but the last must be seg bytes long
+        while (_gso && seg && j < _batch.size() && j - i < max_gso_segments
+                && _batch[j - 1].p.len() == seg
+                && _batch[j].p.len() && _batch[j].p.len() <= seg
+                && total + _batch[j].p.len() <= max_datagram_size
+                && nr_iovs + _batch[j].p.nr_frags() <= IOV_MAX
+                && same_destination(_batch[j].dst, _batch[i].dst)) {
+            total += _batch[j].p.len();
+            nr_iovs += _batch[j].p.nr_frags();
+            ++j;
         }
-    };
-    struct send_ctx {
-        struct msghdr _hdr;
-        std::vector<struct iovec> _iovecs;
-        socket_address _dst;
-        packet _p;
+        mmsghdr m = {};
+        m.msg_hdr.msg_name = &_batch[i].dst.u.sa;
+        m.msg_hdr.msg_namelen = sizeof(_batch[i].dst.u.in);
+        iov_starts.push_back(_iovs.size());
+        for (auto k = i; k < j; ++k) {
+            for (auto&& f : _batch[k].p.fragments()) {
+                _iovs.push_back(iovec{f.base, f.size});
+            }
+        }
+        m.msg_hdr.msg_iovlen = _iovs.size() - iov_starts.back();
+        if (j - i > 1) {
+            gso_cmsg c = {};
+            auto hdr = reinterpret_cast<cmsghdr*>(c.buf);
+            hdr->cmsg_level = SOL_UDP;
+            hdr->cmsg_type = UDP_SEGMENT;
+            hdr->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t size = seg;
+            std::memcpy(CMSG_DATA(hdr), &size, sizeof(size));
+            _cmsgs.push_back(c);
+            m.msg_hdr.msg_controllen = sizeof(c.buf);
+        }
+        _msgs.push_back(m);
+        _ends.push_back(j);
+        i = j;
+    }
+    // now that the vectors are complete, point into them
+    auto c = _cmsgs.begin();
+    for (size_t i = 0; i < _msgs.size(); ++i) {
+        auto& h = _msgs[i].msg_hdr;
+        h.msg_iov = &_iovs[iov_starts[i]];
+        if (h.msg_controllen) {
+            h.msg_control = c++->buf;
+        }
+    }
+}
 
-        send_ctx() {
-            memset(&_hdr, 0, sizeof(_hdr));
-            _hdr.msg_name = &_dst.u.sa;
-            _hdr.msg_namelen = sizeof(_dst.u.sas);
+void posix_udp_sender::complete(size_t end, std::exception_ptr ex) {
+    for (; _sent < end; ++_sent) {
+        auto& d = _batch[_sent];
+        if (ex) {
+            d.sent.set_exception(ex);
+        } else {
+            d.sent.set_value();
         }
+        d.p = packet();
+    }
+}
+
+future<> posix_udp_sender::send_batch() {
+    return repeat([this] {
+        if (_sent == _batch.size()) {
+            return make_ready_future<stop_iteration>(stop_iteration::yes);
+        }
+        build();
+        return _fd->sendmmsg(_msgs.data(), _msgs.size()).then_wrapped([this] (future<size_t> f) {
+            // sendmmsg() only fails if the first message does
+            try {
+                complete(_ends[f.get0() - 1], nullptr);
+            } catch (std::system_error& e) {
+                auto err = e.code().value();
+                if (_gso && _ends[0] - _sent > 1 && (err == EINVAL || err == EIO || err == EOPNOTSUPP)) {
+                    // the segments are larger than the route's MTU, or the
+                    // device cannot checksum them
+                    _gso = false;
+                } else {
+                    complete(_ends[0], std::current_exception());
+                }
+            } catch (...) {
+                complete(_ends[0], std::current_exception());
+            }
+            return stop_iteration::no;
+        });
+    });
+}
 
-        void prepare(ipv4_addr dst, packet p) {
-            _dst = make_ipv4_address(dst);
-            _p = std::move(p);
-            _iovecs = to_iovec(_p);
-            _hdr.msg_iov = _iovecs.data();
-            _hdr.msg_iovlen = _iovecs.size();
+void posix_udp_sender::flush() {
+    _batch = std::move(_queue);
+    _queue.clear();
+    _sent = 0;
+    send_batch().then([self = shared_from_this()] {
+        self->_batch.clear();
+        if (self->_queue.empty()) {
+            self->_flushing = false;
+        } else {
+            self->flush();
+        }
+    });
+}
+
+class posix_udp_channel : public udp_channel_impl {
+private:
+    static constexpr int MAX_DATAGRAM_SIZE = 65507;
+    // Receives with recvmmsg(), in batches that grow while they come back
+    // full, so that quiet channels keep a single buffer.
+    //
+    // Datagrams are not copied: each message is received into a slot of a
+    // shared slab, and the datagram's packet shares the piece it landed in,
+    // so the slab lives until the last of them is destroyed. The slots
+    // follow the previous batch's last datagram, so that small datagrams
+    // pack densely. A datagram that overflows its slot continues into the
+    // slot's spill buffer, which becomes the packet's second fragment.
+    struct recv_ctx {
+        static constexpr unsigned max_batch = 16;
+        static constexpr size_t slot_size = 2048;
+        static constexpr size_t slab_size = 4 * max_batch * slot_size;
+        struct slot {
+            struct iovec iov[2];
+            socket_address src;
+            cmsg_with_pktinfo cmsg;
+            temporary_buffer<char> spill;
+        };
+        std::array<slot, max_batch> slots;
+        std::array<struct mmsghdr, max_batch> msgs;
+        unsigned batch = 1;
+        temporary_buffer<char> slab;
+        size_t slab_used = 0;
+        circular_buffer<udp_datagram> ready;
+
+        void prepare() {
+            if (slab.size() - slab_used < batch * slot_size) {
+                slab = temporary_buffer<char>(slab_size);
+                slab_used = 0;
+            }
+            for (unsigned i = 0; i < batch; ++i) {
+                auto& s = slots[i];
+                if (!s.spill) {
+                    s.spill = temporary_buffer<char>(MAX_DATAGRAM_SIZE - slot_size);
+                }
+                s.iov[0].iov_base = slab.get_write() + slab_used + i * slot_size;
+                s.iov[0].iov_len = slot_size;
+                s.iov[1].iov_base = s.spill.get_write();
+                s.iov[1].iov_len = s.spill.size();
+                auto& h = msgs[i].msg_hdr;
+                memset(&h, 0, sizeof(h));
+                h.msg_iov = s.iov;
+                h.msg_iovlen = 2;
+                h.msg_name = &s.src.u.sa;
+                h.msg_namelen = sizeof(s.src.u.sas);
+                h.msg_control = s.cmsg.buf;
+                h.msg_controllen = sizeof(s.cmsg.buf);
+            }
         }
+        void harvest(unsigned n, uint16_t port);
     };
-    std::unique_ptr<pollable_fd> _fd;
+    lw_shared_ptr<pollable_fd> _fd;
     ipv4_addr _address;
     recv_ctx _recv;
-    send_ctx _send;
+    lw_shared_ptr<posix_udp_sender> _sender;
     bool _closed;
+private:
+    static bool gso_available(file_desc& fd) {
+        int size;
+        socklen_t len = sizeof(size);
+        return ::getsockopt(fd.get(), SOL_UDP, UDP_SEGMENT, &size, &len) == 0;
+    }
 public:
     posix_udp_channel(ipv4_addr bind_address)
             : _closed(false) {
@@ -435,7 +1162,9 @@ class posix_udp_channel : public udp_channel_impl {
         }
         fd.bind(sa.u.sa, sizeof(sa.u.sas));
         _address = ipv4_addr(fd.get_address());
-        _fd = std::make_unique<pollable_fd>(std::move(fd));
+        auto gso = gso_available(fd);
+        _fd = make_lw_shared<pollable_fd>(std::move(fd));
+        _sender = make_lw_shared<posix_udp_sender>(_fd, gso);
     }
     virtual ~posix_udp_channel() { if (!_closed) close(); };
     virtual future<udp_datagram> receive() override;
@@ -445,22 +1174,52 @@ class posix_udp_channel : public udp_channel_impl {
         _closed = true;
         _fd->abort_reader(std::make_exception_ptr(std::system_error(EPIPE, std::system_category())));
         _fd->abort_writer(std::make_exception_ptr(std::system_error(EPIPE, std::system_category())));
-        _fd.reset();
+        _fd = {};
     }
     virtual bool is_closed() const override { return _closed; }
 };
 
+void posix_udp_channel::recv_ctx::harvest(unsigned n, uint16_t port) {
+    for (unsigned i = 0; i < n; ++i) {
+        auto& s = slots[i];
+        auto& h = msgs[i].msg_hdr;
+        auto size = msgs[i].msg_len;
+        ipv4_addr dst(0u, port);
+        for (auto c = CMSG_FIRSTHDR(&h); c; c = CMSG_NXTHDR(&h, c)) {
+            if (c->cmsg_level == SOL_IP && c->cmsg_type == IP_PKTINFO) {
+                in_pktinfo pi;
+                std::memcpy(&pi, CMSG_DATA(c), sizeof(pi));
+                dst = ipv4_addr(ntohl(pi.ipi_addr.s_addr), port);
+            }
+        }
+        auto offset = slab_used + i * slot_size;
+        size_t head = size < slot_size ? size : slot_size;
+        packet data(slab.share(offset, head));
+        if (size > slot_size) {
+            auto spilled = std::move(s.spill);
+            spilled.trim(size - slot_size);
+            data = packet(std::move(data), std::move(spilled));
+        }
+        ready.push_back(udp_datagram(std::make_unique<posix_datagram>(s.src, dst, std::move(data))));
+        if (i + 1 == n) {
+            // the next batch starts after this datagram, kept aligned
+            slab_used = align_up(offset + head, alignof(std::max_align_t));
+        }
+    }
+    if (n == batch && batch < max_batch) {
+        batch *= 2;
+    }
+}
+
 future<> posix_udp_channel::send(ipv4_addr dst, const char *message) {
-    auto len = strlen(message);
-    return _fd->sendto(make_ipv4_address(dst), message, len)
-            .then([len] (size_t size) { assert(size == len); });
+    return send(dst, packet(message, strlen(message)));
 }
 
 future<> posix_udp_channel::send(ipv4_addr dst, packet p) {
-    auto len = p.len();
-    _send.prepare(dst, std::move(p));
-    return _fd->sendmsg(&_send._hdr)
-            .then([len] (size_t size) { assert(size == len); });
+    if (_closed) {
+        return make_exception_future<>(std::system_error(EPIPE, std::system_category()));
+    }
+    return _sender->send(make_ipv4_address(dst), std::move(p));
 }
 
 udp_channel
@@ -468,29 +1227,19 @@ posix_network_stack::make_udp_channel(ipv4_addr addr) {
     return udp_channel(std::make_unique<posix_udp_channel>(addr));
 }
 
-class posix_datagram : public udp_datagram_impl {
-private:
-    ipv4_addr _src;
-    ipv4_addr _dst;
-    packet _p;
-public:
-    posix_datagram(ipv4_addr src, ipv4_addr dst, packet p) : _src(src), _dst(dst), _p(std::move(p)) {}
-    virtual ipv4_addr get_src() override { return _src; }
-    virtual ipv4_addr get_dst() override { return _dst; }
-    virtual uint16_t get_dst_port() override { return _dst.port; }
-    virtual packet& get_data() override { return _p; }
-};
-
 future<udp_datagram>
 posix_udp_channel::receive() {
+    if (!_recv.ready.empty()) {
+        auto d = std::move(_recv.ready.front());
+        _recv.ready.pop_front();
+        return make_ready_future<udp_datagram>(std::move(d));
+    }
     _recv.prepare();
-    return _fd->recvmsg(&_recv._hdr).then([this] (size_t size) {
-        auto dst = ipv4_addr(_recv._cmsg.pktinfo.ipi_addr.s_addr, _address.port);
-        return make_ready_future<udp_datagram>(udp_datagram(std::make_unique<posix_datagram>(
-            _recv._src_addr, dst, packet(fragment{_recv._buffer, size}, make_deleter([buf = _recv._buffer] { delete[] buf; })))));
-    }).handle_exception([p = _recv._buffer](auto ep) {
-        delete[] p;
-        return make_exception_future<udp_datagram>(std::move(ep));
+    return _fd->recvmmsg(_recv.msgs.data(), _recv.batch).then([this] (size_t n) {
+        _recv.harvest(n, _address.port);
+        auto d = std::move(_recv.ready.front());
+        _recv.ready.pop_front();
+        return make_ready_future<udp_datagram>(std::move(d));
     });
 }
 
@@ -24,6 +24,7 @@
 
 #include "core/reactor.hh"
 #include "core/sharded.hh"
+#include "core/circular_buffer.hh"
 #include "stack.hh"
 #include <boost/program_options.hpp>
 
@@ -39,24 +40,53 @@ using namespace seastar;
 //
 // Right now this class is used by the posix_server_socket_impl, but it could be used by any other.
 class conntrack {
-    class load_balancer {
-        std::vector<unsigned> _cpu_load;
+public:
+    // Lives on the listening shard, and samples the load of the other
+    // shards from there, once a second.
+    //
+    // A shard's load is the mean of its reactor's utilization and of its
+    // connections' traffic relative to the busiest shard's. A connection
+    // given to a shard adds the mean load of a connection to it, until
+    // the next samples show it.
+    class load_balancer : public enable_lw_shared_from_this<load_balancer> {
+    public:
+        struct shard_sample {
+            double utilization;
+            uint64_t bytes; // moved by the shard's connections since it started
+        };
+    private:
+        struct shard {
+            unsigned connections = 0;
+            double load = 0;
+            double pending = 0;
+            uint64_t bytes = 0;
+        };
+        // How much busier than the least busy shard a client's shard may
+        // be for sticky_client to keep its connections there
+        static constexpr double sticky_slack = 0.25;
+        listen_options::load_balancing_algorithm _lba;
+        bool _sticky;
+        std::vector<shard> _shards;
+        timer<lowres_clock> _sampler;
+        bool _sampling = false;
+    private:
+        double score(shard_id cpu, double unit) const;
+        double connection_load() const;
+        void sample();
     public:
-        load_balancer() : _cpu_load(size_t(smp::count), 0) {}
+        explicit load_balancer(listen_options::load_balancing_algorithm lba = listen_options::load_balancing_algorithm::connection_count,
+                bool sticky = false);
         void closed_cpu(shard_id cpu) {
-            _cpu_load[cpu]--;
-        }
-        shard_id next_cpu() {
-            // FIXME: The naive algorithm will just round robin the connections around the shards.
-            // A more complex version can keep track of the amount of activity in each connection,
-            // and use that information.
-            auto min_el = std::min_element(_cpu_load.begin(), _cpu_load.end());
-            auto cpu = shard_id(std::distance(_cpu_load.begin(), min_el));
-            _cpu_load[cpu]++;
-            return cpu;
+            _shards[cpu].connections--;
         }
+        shard_id next_cpu(const socket_address& client);
+        // One sample per shard, in shard order
+        void update(const std::vector<shard_sample>& samples);
+        void start_sampling();
+        // Counts the bytes a connection of this shard moved
+        static void count_bytes(size_t n);
     };
-
+private:
     lw_shared_ptr<load_balancer> _lb;
     void closed_cpu(shard_id cpu) {
         _lb->closed_cpu(cpu);
@@ -89,30 +119,80 @@ class conntrack {
     };
     friend class handle;
 
-    conntrack() : _lb(make_lw_shared<load_balancer>()) {}
-    handle get_handle() {
-        return handle(_lb->next_cpu(), _lb);
+    explicit conntrack(const listen_options& opts = listen_options())
+            : _lb(make_lw_shared<load_balancer>(opts.lba, opts.sticky_client)) {
+        _lb->start_sampling();
+    }
+    handle get_handle(const socket_address& client) {
+        return handle(_lb->next_cpu(client), _lb);
     }
 };
 
+// Reads into buffers charged to net::receive_memory() until they are freed,
+// and only allocated once there is data to read, so that idle connections
+// hold none
 class posix_data_source_impl final : public data_source_impl {
     lw_shared_ptr<pollable_fd> _fd;
-    temporary_buffer<char> _buf;
     size_t _buf_size;
+    // The last read filled its buffer, so more data is likely waiting
+    bool _speculate_read = false;
+private:
+    future<temporary_buffer<char>> read();
 public:
     explicit posix_data_source_impl(lw_shared_ptr<pollable_fd> fd, size_t buf_size = 8192)
-        : _fd(std::move(fd)), _buf(buf_size), _buf_size(buf_size) {}
+        : _fd(std::move(fd)), _buf_size(buf_size) {}
     future<temporary_buffer<char>> get() override;
     future<> close() override;
 };
 
+// Sends the packets of a connected socket that opted in with
+// connected_socket::set_zero_copy_threshold() with MSG_ZEROCOPY: the kernel
+// transmits them from their own memory, so each is held until the socket's
+// error queue reports that the kernel is done with it.
+class posix_zero_copy_sender : public enable_lw_shared_from_this<posix_zero_copy_sender> {
+    struct pending_send {
+        uint32_t id;
+        packet p;
+        bool done;
+    };
+    class poller;
+    lw_shared_ptr<pollable_fd> _fd;
+    size_t _threshold = 0;
+    bool _enabled = false; // SO_ZEROCOPY is set
+    // The kernel copied the data anyway, as it does for loopback, so
+    // zero-copy is all cost and no gain
+    bool _kernel_copies = false;
+    bool _polled = false;
+    uint32_t _next_id = 0; // of the next send, as the kernel counts them
+    circular_buffer<pending_send> _in_flight;
+private:
+    void complete(uint32_t first, uint32_t last, bool copied);
+public:
+    explicit posix_zero_copy_sender(lw_shared_ptr<pollable_fd> fd) : _fd(std::move(fd)) {}
+    void set_threshold(size_t bytes);
+    bool wants(size_t len) const {
+        return _threshold && len >= _threshold && !_kernel_copies;
+    }
+    // Resolves once all of p is queued in the socket
+    future<> send(packet p);
+    // Releases the packets the kernel is done with; returns whether there
+    // were any
+    bool reap();
+    size_t in_flight() const {
+        return _in_flight.size();
+    }
+};
+
 class posix_data_sink_impl : public data_sink_impl {
     lw_shared_ptr<pollable_fd> _fd;
+    lw_shared_ptr<posix_zero_copy_sender> _zero_copy;
     packet _p;
 public:
-    explicit posix_data_sink_impl(lw_shared_ptr<pollable_fd> fd) : _fd(std::move(fd)) {}
+    explicit posix_data_sink_impl(lw_shared_ptr<pollable_fd> fd, lw_shared_ptr<posix_zero_copy_sender> zero_copy = {})
+        : _fd(std::move(fd)), _zero_copy(std::move(zero_copy)) {}
     future<> put(packet p) override;
     future<> put(temporary_buffer<char> buf) override;
+    future<> put_file(file& f, uint64_t offset, uint64_t len) override;
     future<> close() override;
 };
 
@@ -141,7 +221,8 @@ class posix_server_socket_impl : public server_socket_impl {
     pollable_fd _lfd;
     conntrack _conntrack;
 public:
-    explicit posix_server_socket_impl(socket_address sa, pollable_fd lfd) : _sa(sa), _lfd(std::move(lfd)) {}
+    explicit posix_server_socket_impl(socket_address sa, pollable_fd lfd, const listen_options& opts = listen_options())
+            : _sa(sa), _lfd(std::move(lfd)), _conntrack(opts) {}
     virtual future<connected_socket, socket_address> accept();
     virtual void abort_accept() override;
 };
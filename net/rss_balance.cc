@@ -0,0 +1,327 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <map>
+#include <set>
+#include <tuple>
+#include <boost/range/irange.hpp>
+#include "rss_balance.hh"
+#include "toeplitz.hh"
+#include "core/future-util.hh"
+#include "core/metrics.hh"
+#include "util/log.hh"
+
+namespace seastar {
+
+namespace net {
+
+static logger rss_log("rss_balancer");
+
+std::vector<rss_move> plan_rss_moves(std::vector<rss_bucket_load> buckets,
+        const std::vector<unsigned>& owners, unsigned max_moves, double min_imbalance) {
+    std::vector<rss_move> moves;
+    if (owners.size() < 2) {
+        return moves;
+    }
+    std::map<unsigned, uint64_t> load;
+    for (auto o : owners) {
+        load[o] = 0;
+    }
+    uint64_t total = 0;
+    for (auto&& b : buckets) {
+        auto i = load.find(b.owner);
+        if (i != load.end()) {
+            i->second += b.packets;
+            total += b.packets;
+        }
+    }
+    auto mean = double(total) / load.size();
+    auto by_load = [] (const std::pair<const unsigned, uint64_t>& a, const std::pair<const unsigned, uint64_t>& b) {
+        return a.second < b.second;
+    };
+    while (moves.size() < max_moves) {
+        auto hot = std::max_element(load.begin(), load.end(), by_load);
+        auto cold = std::min_element(load.begin(), load.end(), by_load);
+        auto gap = hot->second - cold->second;
+        if (gap == 0 || gap <= min_imbalance * mean) {
+            break;
+        }
+        // moving p changes the gap to |gap - 2p|: the bucket nearest to
+        // half of it is the best one, and any smaller than it helps; of
+        // two as good, the lighter one has fewer connections to pin
+        auto distance = [gap] (uint64_t p) {
+            return 2 * p > gap ? 2 * p - gap : gap - 2 * p;
+        };
+        rss_bucket_load* best = nullptr;
+        for (auto&& b : buckets) {
+            if (b.owner != hot->first || b.packets == 0 || b.packets >= gap) {
+                continue;
+            }
+            auto d = distance(b.packets);
+            if (!best || d < distance(best->packets)
+                    || (d == distance(best->packets) && b.packets < best->packets)) {
+                best = &b;
+            }
+        }
+        if (!best) {
+            break;
+        }
+        moves.push_back(rss_move{best->bucket, hot->first, cold->first});
+        hot->second -= best->packets;
+        cold->second += best->packets;
+        best->owner = cold->first;
+    }
+    return moves;
+}
+
+struct rss_balancer::shard_load {
+    std::vector<uint64_t> sw_packets;
+    std::vector<uint64_t> hw_packets;
+    std::experimental::optional<std::array<uint8_t, qp::sw_reta_size>> sw_reta;
+};
+
+struct rss_balancer::pins {
+    std::unordered_map<forward_hash, unsigned, forward_hash::hasher> flows;
+    std::vector<bool> sw_pinned;
+    std::vector<bool> hw_pinned;
+};
+
+rss_balancer::rss_balancer(std::shared_ptr<device> dev, std::chrono::milliseconds period)
+        : _dev(std::move(dev))
+        , _period(period)
+        , _hw(_dev->hw_reta_size() && _dev->hw_queues_count() == smp::count) {
+    namespace sm = metrics;
+    _metrics.add_group("rss_balancer", {
+        sm::make_derive("bucket_moves", _nr_moves,
+                sm::description("Counts the RSS buckets moved to another shard, to even out the shards' load")),
+        sm::make_gauge("pinned_flows", _nr_pinned,
+                sm::description("Connections kept on the shard they were established on, after their RSS bucket moved")),
+    });
+}
+
+unsigned rss_balancer::bucket_of(bool hw, uint32_t hash) {
+    if (hw) {
+        return hash & (_dev->hw_reta_size() - 1);
+    }
+    return _dev->hash2qid(hash) * qp::sw_reta_size + _dev->sw_reta_entry(hash);
+}
+
+future<> rss_balancer::start() {
+    assert(engine().cpu_id() == 0);
+    auto hw_size = _hw ? _dev->hw_reta_size() : 0;
+    return smp::invoke_on_all([this, hw_size] {
+        auto s = std::make_unique<rss_balance_state>();
+        s->sw_packets.resize(sw_buckets());
+        s->sw_pinned.resize(sw_buckets());
+        s->hw_packets.resize(hw_size);
+        s->hw_pinned.resize(hw_size);
+        _dev->local_queue()._rss_balance = std::move(s);
+    }).then([this] {
+        _timer.set_callback([this] {
+            with_gate(_gate, [this] {
+                return rebalance().handle_exception([] (std::exception_ptr ep) {
+                    rss_log.warn("Failed to rebalance RSS buckets: {}", ep);
+                }).then([this] {
+                    if (!_gate.is_closed()) {
+                        _timer.arm(_period);
+                    }
+                });
+            });
+        });
+        _timer.arm(_period);
+    });
+}
+
+future<> rss_balancer::stop() {
+    // the tables, and the pinned connections, stay as they are
+    _timer.cancel();
+    return _gate.close();
+}
+
+future<std::vector<rss_balancer::shard_load>> rss_balancer::collect() {
+    auto loads = make_lw_shared<std::vector<shard_load>>(smp::count);
+    return parallel_for_each(boost::irange(0u, smp::count), [this, loads] (unsigned cpu) {
+        return smp::submit_to(cpu, [this] {
+            auto& q = _dev->local_queue();
+            auto& s = *q._rss_balance;
+            shard_load l;
+            l.sw_packets = s.sw_packets;
+            l.hw_packets = s.hw_packets;
+            l.sw_reta = q._sw_reta;
+            std::fill(s.sw_packets.begin(), s.sw_packets.end(), 0);
+            std::fill(s.hw_packets.begin(), s.hw_packets.end(), 0);
+            return l;
+        }).then([loads, cpu] (shard_load l) {
+            (*loads)[cpu] = std::move(l);
+        });
+    }).then([loads] {
+        return std::move(*loads);
+    });
+}
+
+std::vector<rss_balancer::pending_move> rss_balancer::plan(const std::vector<shard_load>& loads) {
+    std::vector<pending_move> moves;
+    if (_hw) {
+        std::vector<rss_bucket_load> buckets;
+        for (unsigned idx = 0; idx < _dev->hw_reta_size(); idx++) {
+            uint64_t packets = 0;
+            for (auto&& l : loads) {
+                packets += l.hw_packets[idx];
+            }
+            // the entry of hash idx is idx
+            buckets.push_back(rss_bucket_load{idx, _dev->hash2qid(idx), packets});
+        }
+        std::vector<unsigned> queues(boost::irange(0u, smp::count).begin(), boost::irange(0u, smp::count).end());
+        for (auto&& m : plan_rss_moves(std::move(buckets), queues, max_moves, min_imbalance)) {
+            moves.push_back(pending_move{true, m});
+        }
+        return moves;
+    }
+    for (unsigned q = 0; q < _dev->hw_queues_count(); q++) {
+        auto& reta = loads[q].sw_reta;
+        if (!reta) {
+            // the queue handles all it receives
+            continue;
+        }
+        // buckets move between the cpus the queue was set up to forward
+        // to, which keeps a zero hw-queue-weight
+        std::set<unsigned> cpus(reta->begin(), reta->end());
+        std::vector<rss_bucket_load> buckets;
+        for (unsigned e = 0; e < qp::sw_reta_size; e++) {
+            auto bucket = q * qp::sw_reta_size + e;
+            uint64_t packets = 0;
+            for (auto&& l : loads) {
+                packets += l.sw_packets[bucket];
+            }
+            buckets.push_back(rss_bucket_load{bucket, (*reta)[e], packets});
+        }
+        for (auto&& m : plan_rss_moves(std::move(buckets), std::vector<unsigned>(cpus.begin(), cpus.end()), max_moves, min_imbalance)) {
+            moves.push_back(pending_move{false, m});
+        }
+    }
+    return moves;
+}
+
+future<> rss_balancer::apply(std::vector<pending_move> moves) {
+    return do_with(std::move(moves), [this] (std::vector<pending_move>& moves) {
+        return do_for_each(moves, [this] (pending_move& pm) {
+            auto& m = pm.m;
+            if (pm.hw) {
+                _dev->update_hw_reta(m.bucket, m.to);
+                ++_nr_moves;
+                return make_ready_future<>();
+            }
+            return smp::submit_to(m.bucket / qp::sw_reta_size, [this, e = m.bucket % qp::sw_reta_size, to = m.to] {
+                (*_dev->local_queue()._sw_reta)[e] = to;
+            }).then([this] {
+                ++_nr_moves;
+            });
+        });
+    });
+}
+
+future<> rss_balancer::refresh_pins() {
+    std::set<std::tuple<bool, unsigned, unsigned>> seen;
+    std::map<unsigned, std::vector<moved_bucket>> by_cpu;
+    for (auto&& m : _moved) {
+        if (seen.emplace(m.hw, m.bucket, m.cpu).second) {
+            by_cpu[m.cpu].push_back(m);
+        }
+    }
+    auto p = make_lw_shared<pins>();
+    p->sw_pinned.resize(sw_buckets());
+    p->hw_pinned.resize(_hw ? _dev->hw_reta_size() : 0);
+    auto live = make_lw_shared<std::vector<moved_bucket>>();
+    return do_with(std::move(by_cpu), [this, p, live] (std::map<unsigned, std::vector<moved_bucket>>& by_cpu) {
+        return parallel_for_each(by_cpu, [this, p, live] (std::pair<const unsigned, std::vector<moved_bucket>>& e) {
+            auto cpu = e.first;
+            return smp::submit_to(cpu, [this, buckets = e.second] {
+                // the connections of the buckets, and the buckets that have any
+                std::pair<std::vector<forward_hash>, std::vector<moved_bucket>> r;
+                std::vector<bool> has_flows(buckets.size());
+                for (auto&& f : _dev->local_queue().list_flows()) {
+                    auto hash = toeplitz_hash(_dev->rss_key(), f);
+                    for (size_t i = 0; i < buckets.size(); i++) {
+                        if (bucket_of(buckets[i].hw, hash) == buckets[i].bucket) {
+                            r.first.push_back(f);
+                            has_flows[i] = true;
+                            break;
+                        }
+                    }
+                }
+                for (size_t i = 0; i < buckets.size(); i++) {
+                    if (has_flows[i]) {
+                        r.second.push_back(buckets[i]);
+                    }
+                }
+                return r;
+            }).then([p, live, cpu] (std::pair<std::vector<forward_hash>, std::vector<moved_bucket>> r) {
+                for (auto&& f : r.first) {
+                    p->flows[f] = cpu;
+                }
+                for (auto&& m : r.second) {
+                    (m.hw ? p->hw_pinned : p->sw_pinned)[m.bucket] = true;
+                    live->push_back(m);
+                }
+            });
+        });
+    }).then([this, p, live] {
+        // buckets whose connections all closed are forgotten
+        _moved = std::move(*live);
+        _nr_pinned = p->flows.size();
+        auto& pr = *p;
+        return smp::invoke_on_all([this, &pr] {
+            auto& s = *_dev->local_queue()._rss_balance;
+            s.pinned = pr.flows;
+            s.sw_pinned = pr.sw_pinned;
+            s.hw_pinned = pr.hw_pinned;
+        }).finally([p] {});
+    });
+}
+
+future<> rss_balancer::rebalance() {
+    return collect().then([this] (std::vector<shard_load> loads) {
+        auto moves = plan(loads);
+        if (moves.empty()) {
+            // drops the pins of closed connections
+            return refresh_pins();
+        }
+        auto note_moved = [this, moves] {
+            for (auto&& pm : moves) {
+                _moved.push_back(moved_bucket{pm.hw, pm.m.bucket, pm.m.from});
+            }
+        };
+        // the connections of a bucket are pinned to its shard before the
+        // bucket moves, and then again, for those established meanwhile
+        note_moved();
+        return refresh_pins().then([this, moves] () mutable {
+            return apply(std::move(moves));
+        }).then([this, note_moved] {
+            note_moved();
+            return refresh_pins();
+        });
+    });
+}
+
+}
+
+}
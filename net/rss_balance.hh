@@ -0,0 +1,110 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include "core/gate.hh"
+#include "core/timer.hh"
+#include "core/metrics_registration.hh"
+#include "net.hh"
+
+namespace seastar {
+
+namespace net {
+
+struct rss_bucket_load {
+    unsigned bucket;
+    unsigned owner;
+    uint64_t packets;
+};
+
+struct rss_move {
+    unsigned bucket;
+    unsigned from;
+    unsigned to;
+};
+
+// Plans the moves of buckets that even out the load of owners: each one
+// moves, from the most to the least loaded owner, the bucket that brings
+// their loads closest, for as long as they differ by more than
+// min_imbalance of the mean load, up to max_moves. Buckets whose owner is
+// not in owners stay where they are.
+std::vector<rss_move> plan_rss_moves(std::vector<rss_bucket_load> buckets,
+        const std::vector<unsigned>& owners, unsigned max_moves, double min_imbalance);
+
+// Moves RSS buckets from the shards that handle the most packets to the
+// ones that handle the fewest, every period.
+//
+// With a queue per shard, and a NIC redirection table (see
+// device::hw_reta_size()), the buckets are the table's entries, and moving
+// one reprograms the NIC. With proxies, the buckets are the entries of
+// each hw queue's software table, and they move between the cpus the
+// queue forwards to.
+//
+// Only new flows of a moved bucket go to its new shard: the connections
+// established on the old one are pinned to it, on all shards, for as long
+// as they live; see device::rss_balance_dst(). Runs on cpu 0.
+class rss_balancer {
+    static constexpr unsigned max_moves = 8;
+    static constexpr double min_imbalance = 0.1;
+    struct moved_bucket {
+        bool hw;
+        unsigned bucket;
+        unsigned cpu; // that may still have connections of the bucket
+    };
+    struct pending_move {
+        bool hw;
+        rss_move m;
+    };
+    struct shard_load;
+    struct pins;
+    std::shared_ptr<device> _dev;
+    std::chrono::milliseconds _period;
+    bool _hw;
+    timer<> _timer;
+    gate _gate;
+    std::vector<moved_bucket> _moved;
+    uint64_t _nr_moves = 0;
+    size_t _nr_pinned = 0;
+    metrics::metric_groups _metrics;
+private:
+    unsigned sw_buckets() {
+        return _dev->hw_queues_count() * qp::sw_reta_size;
+    }
+    unsigned bucket_of(bool hw, uint32_t hash);
+    future<std::vector<shard_load>> collect();
+    std::vector<pending_move> plan(const std::vector<shard_load>& loads);
+    future<> apply(std::vector<pending_move> moves);
+    future<> refresh_pins();
+    future<> rebalance();
+public:
+    rss_balancer(std::shared_ptr<device> dev, std::chrono::milliseconds period);
+    future<> start();
+    future<> stop();
+};
+
+}
+
+}
@@ -24,6 +24,7 @@
 #include <sys/socket.h>
 #include <netinet/ip.h>
 #include "net/byteorder.hh"
+#include "core/sstring.hh"
 
 namespace seastar {
 
@@ -35,16 +36,23 @@ class socket_address {
         ::sockaddr_storage sas;
         ::sockaddr sa;
         ::sockaddr_in in;
+        ::sockaddr_in6 in6;
     } u;
     socket_address(sockaddr_in sa) {
         u.in = sa;
     }
+    socket_address(sockaddr_in6 sa) {
+        u.in6 = sa;
+    }
     socket_address(ipv4_addr);
     socket_address() = default;
     ::sockaddr& as_posix_sockaddr() { return u.sa; }
     ::sockaddr_in& as_posix_sockaddr_in() { return u.in; }
     const ::sockaddr& as_posix_sockaddr() const { return u.sa; }
     const ::sockaddr_in& as_posix_sockaddr_in() const { return u.in; }
+    const ::sockaddr_in6& as_posix_sockaddr_in6() const { return u.in6; }
+    /// The port, in host byte order, of an IPv4 or IPv6 address
+    uint16_t port() const;
 
     bool operator==(const socket_address&) const;
 };
@@ -64,6 +72,25 @@ class inet_address;
 struct listen_options {
     transport proto = transport::TCP;
     bool reuse_address = false;
+    /// TCP congestion control algorithm of the accepted connections, such
+    /// as "cubic" or "bbr"; empty for the stack's default
+    sstring congestion_control;
+    /// How a listener that accepts the connections of all shards on one
+    /// (the posix stack without SO_REUSEPORT) picks their shards
+    enum class load_balancing_algorithm {
+        /// the shard with the fewest connections
+        connection_count,
+        /// the least busy shard, judging by its reactor's utilization and
+        /// the traffic of its connections
+        activity,
+    };
+    load_balancing_algorithm lba = load_balancing_algorithm::activity;
+    /// Gives the connections from an address to the same shard, for cache
+    /// locality, unless it is much busier than the least busy one
+    bool sticky_client = false;
+    /// Connections waiting to be accepted, or still being established; the
+    /// native stack keeps as many on each shard
+    unsigned listen_backlog = 100;
     listen_options(bool rua = false)
         : reuse_address(rua)
     {}
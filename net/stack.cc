@@ -21,9 +21,30 @@
 
 #include "stack.hh"
 #include "core/reactor.hh"
+#include "core/memory_account.hh"
 
 namespace seastar {
 
+memory_account& net::receive_memory() {
+    static thread_local memory_account account("network_receive", memory::stats().total_memory() / 8);
+    return account;
+}
+
+size_t net::receive_buffer_size(size_t size, size_t min_size) {
+    auto& budget = receive_memory();
+    auto used = budget.used();
+    auto limit = budget.soft_limit();
+    if (used <= limit / 2 || size <= min_size) {
+        return size;
+    }
+    if (used >= limit) {
+        return min_size;
+    }
+    // what is left of the second half of the budget
+    auto left = double(limit - used) / (limit - limit / 2);
+    return min_size + size_t((size - min_size) * left);
+}
+
 net::udp_channel::udp_channel()
 {}
 
@@ -98,6 +119,18 @@ void connected_socket::set_keepalive_parameters(const net::keepalive_params& p)
 net::keepalive_params connected_socket::get_keepalive_parameters() const {
     return _csi->get_keepalive_parameters();
 }
+void connected_socket::set_congestion_control(const sstring& name) {
+    _csi->set_congestion_control(name);
+}
+sstring connected_socket::get_congestion_control() const {
+    return _csi->get_congestion_control();
+}
+void connected_socket::set_zero_copy_threshold(size_t bytes) {
+    _csi->set_zero_copy_threshold(bytes);
+}
+net::tcp_connection_info connected_socket::get_tcp_info() const {
+    return _csi->get_tcp_info();
+}
 
 void connected_socket::shutdown_output() {
     _csi->shutdown_output();
@@ -154,9 +187,20 @@ socket_address::socket_address(ipv4_addr addr)
     : socket_address(make_ipv4_address(addr))
 {}
 
+uint16_t socket_address::port() const {
+    if (u.sa.sa_family == AF_INET6) {
+        return ntohs(u.in6.sin6_port);
+    }
+    return ntohs(u.in.sin_port);
+}
+
 
 bool socket_address::operator==(const socket_address& a) const {
-    // TODO: handle ipv6
+    if (u.sa.sa_family == AF_INET6 || a.u.sa.sa_family == AF_INET6) {
+        return u.sa.sa_family == a.u.sa.sa_family
+                && u.in6.sin6_port == a.u.in6.sin6_port
+                && IN6_ARE_ADDR_EQUAL(&u.in6.sin6_addr, &a.u.in6.sin6_addr);
+    }
     return std::tie(u.in.sin_family, u.in.sin_port, u.in.sin_addr.s_addr)
                     == std::tie(a.u.in.sin_family, a.u.in.sin_port,
                                     a.u.in.sin_addr.s_addr);
@@ -41,6 +41,22 @@ class connected_socket_impl {
     virtual bool get_keepalive() const = 0;
     virtual void set_keepalive_parameters(const keepalive_params&) = 0;
     virtual keepalive_params get_keepalive_parameters() const = 0;
+    virtual void set_congestion_control(const sstring& name) = 0;
+    virtual sstring get_congestion_control() const = 0;
+    virtual tcp_connection_info get_tcp_info() const = 0;
+    // Stacks that copy nothing to begin with ignore it
+    virtual void set_zero_copy_threshold(size_t bytes) {}
+    // Has the kernel encrypt the TLS records sent from now on (kTLS),
+    // with the TLS_TX parameters in crypto_info; returns false, leaving
+    // the socket as it was, where that is not possible
+    virtual bool set_kernel_tls_transmit(const void* crypto_info, size_t size) {
+        return false;
+    }
+    // Sends a TLS record of a type other than application data, once
+    // set_kernel_tls_transmit() succeeded
+    virtual future<> send_kernel_tls_record(uint8_t type, temporary_buffer<char> data) {
+        return make_exception_future<>(std::logic_error("kernel TLS is not enabled"));
+    }
 };
 
 class socket_impl {
@@ -0,0 +1,291 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "tcp-congestion.hh"
+#include "core/print.hh"
+
+namespace seastar {
+
+namespace net {
+
+void tcp_reno::on_ack(tcp_congestion_state& s, uint32_t acked_bytes, clock_type::time_point now) {
+    if (s.cwnd < s.ssthresh) {
+        // In slow start phase
+        s.cwnd += std::min(acked_bytes, s.mss);
+    } else {
+        // In congestion avoidance phase
+        uint32_t round_up = 1;
+        s.cwnd += std::max(round_up, s.mss * s.mss / s.cwnd);
+    }
+}
+
+void tcp_reno::on_loss(tcp_congestion_state& s, uint32_t flight_size) {
+    s.ssthresh = std::max(flight_size / 2, 2 * s.mss);
+}
+
+constexpr double tcp_cubic::c;
+constexpr double tcp_cubic::beta;
+
+void tcp_cubic::on_ack(tcp_congestion_state& s, uint32_t acked_bytes, clock_type::time_point now) {
+    if (s.cwnd < s.ssthresh) {
+        s.cwnd += std::min(acked_bytes, s.mss);
+        return;
+    }
+    double mss = s.mss;
+    double cwnd = s.cwnd;
+    if (!_in_epoch) {
+        _in_epoch = true;
+        _epoch_start = now;
+        if (cwnd < _w_max) {
+            _k = std::cbrt((_w_max - cwnd) / mss / c);
+            _origin = _w_max;
+        } else {
+            _k = 0;
+            _origin = cwnd;
+        }
+        _w_est = cwnd;
+    }
+    // RFC8312 4.1: W_cubic(t + RTT)
+    auto t = std::chrono::duration<double>(now - _epoch_start + s.srtt).count();
+    auto target = _origin + c * std::pow(t - _k, 3) * mss;
+    // RFC8312 4.2: do at least as well as Reno would
+    _w_est += 3 * (1 - beta) / (1 + beta) * acked_bytes / cwnd * mss;
+    target = std::max(target, _w_est);
+    // and grow at most by half per round trip
+    target = std::min(target, 1.5 * cwnd);
+    if (target > cwnd) {
+        s.cwnd += std::max(uint32_t(1), uint32_t((target - cwnd) * acked_bytes / cwnd));
+    }
+}
+
+void tcp_cubic::on_loss(tcp_congestion_state& s, uint32_t flight_size) {
+    double cwnd = s.cwnd;
+    // RFC8312 4.6: fast convergence, to release bandwidth to new flows
+    _w_max = cwnd < _w_max ? cwnd * (1 + beta) / 2 : cwnd;
+    s.ssthresh = std::max(uint32_t(cwnd * beta), 2 * s.mss);
+    _in_epoch = false;
+}
+
+constexpr unsigned tcp_bbr::bw_filter_rounds;
+constexpr unsigned tcp_bbr::gain_cycle_length;
+constexpr double tcp_bbr::high_gain;
+
+// ProbeBW pacing gains: probe for more bandwidth for a round trip, drain
+// the queue that made, then cruise
+static constexpr std::array<double, 8> bbr_gain_cycle = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+static constexpr auto bbr_min_rtt_window = std::chrono::seconds(10);
+static constexpr auto bbr_probe_rtt_duration = std::chrono::milliseconds(200);
+
+tcp_bbr::tcp_bbr()
+        : _pacing_gain(high_gain)
+        , _cwnd_gain(high_gain) {
+}
+
+uint64_t tcp_bbr::bdp(double gain) const {
+    return uint64_t(gain * _bw * _min_rtt.count() / 1000000);
+}
+
+void tcp_bbr::update_bw(const tcp_rate_sample& rs) {
+    auto rate = rs.rate();
+    // An interval shorter than the round-trip time is ACK compression
+    if (!rate || rs.interval < _min_rtt) {
+        return;
+    }
+    // An application limited sample says nothing of the path, unless it
+    // is faster than what was seen
+    if (rs.app_limited && rate <= _bw) {
+        return;
+    }
+    auto& max_bw = _max_bw_by_round[_round % bw_filter_rounds];
+    max_bw = std::max(max_bw, rate);
+    _bw = *std::max_element(_max_bw_by_round.begin(), _max_bw_by_round.end());
+}
+
+void tcp_bbr::update_min_rtt(tcp_congestion_state& s, const tcp_rate_sample& rs, clock_type::time_point now) {
+    bool expired = _min_rtt.count() && now > _min_rtt_stamp + bbr_min_rtt_window;
+    if (rs.rtt.count() > 0 && (!_min_rtt.count() || rs.rtt <= _min_rtt || expired)) {
+        _min_rtt = rs.rtt;
+        _min_rtt_stamp = now;
+    }
+    if (expired && _mode != mode::probe_rtt) {
+        // drain the queue for a while, to see the propagation time again
+        _mode = mode::probe_rtt;
+        _pacing_gain = 1;
+        _cwnd_gain = 1;
+        _prior_cwnd = std::max(_prior_cwnd, s.cwnd);
+        _probe_rtt_done = {};
+    }
+}
+
+void tcp_bbr::check_full_pipe(const tcp_rate_sample& rs) {
+    if (_filled_pipe || rs.app_limited) {
+        return;
+    }
+    // the delivery rate grew by a quarter within the last three rounds
+    if (_bw >= _full_bw * 5 / 4) {
+        _full_bw = _bw;
+        _full_bw_rounds = 0;
+        return;
+    }
+    if (++_full_bw_rounds >= 3) {
+        _filled_pipe = true;
+    }
+}
+
+void tcp_bbr::enter_probe_bw(clock_type::time_point now) {
+    _mode = mode::probe_bw;
+    _cwnd_gain = 2;
+    // start at a random phase, but not at the draining one, so that flows
+    // sharing a bottleneck do not probe at the same time
+    auto r = unsigned(now.time_since_epoch().count() % (gain_cycle_length - 1));
+    _cycle_index = r ? r + 1 : 0;
+    _cycle_stamp = now;
+    _pacing_gain = bbr_gain_cycle[_cycle_index];
+}
+
+void tcp_bbr::update_mode(tcp_congestion_state& s, const tcp_rate_sample& rs, clock_type::time_point now) {
+    if (_mode == mode::startup && _filled_pipe) {
+        _mode = mode::drain;
+        _pacing_gain = 1 / high_gain;
+        _cwnd_gain = high_gain;
+    }
+    if (_mode == mode::drain && rs.bytes_in_flight <= bdp(1)) {
+        enter_probe_bw(now);
+    }
+    if (_mode == mode::probe_bw) {
+        bool advance = now - _cycle_stamp > _min_rtt;
+        if (_pacing_gain > 1) {
+            advance = advance && rs.bytes_in_flight >= bdp(_pacing_gain);
+        } else if (_pacing_gain < 1) {
+            advance = advance || rs.bytes_in_flight <= bdp(1);
+        }
+        if (advance) {
+            _cycle_index = (_cycle_index + 1) % gain_cycle_length;
+            _cycle_stamp = now;
+            _pacing_gain = bbr_gain_cycle[_cycle_index];
+        }
+    }
+    if (_mode == mode::probe_rtt) {
+        if (_probe_rtt_done == clock_type::time_point() && rs.bytes_in_flight <= 4 * s.mss) {
+            _probe_rtt_done = now + bbr_probe_rtt_duration;
+        } else if (_probe_rtt_done != clock_type::time_point() && now >= _probe_rtt_done) {
+            _min_rtt_stamp = now;
+            s.cwnd = std::max(s.cwnd, _prior_cwnd);
+            _prior_cwnd = 0;
+            if (_filled_pipe) {
+                enter_probe_bw(now);
+            } else {
+                _mode = mode::startup;
+                _pacing_gain = high_gain;
+                _cwnd_gain = high_gain;
+            }
+        }
+    }
+}
+
+void tcp_bbr::set_pacing_rate(tcp_congestion_state& s) {
+    uint64_t rate;
+    if (_bw) {
+        rate = _pacing_gain * _bw;
+    } else if (s.srtt.count()) {
+        rate = high_gain * s.cwnd * 1000000 / s.srtt.count();
+    } else {
+        return;
+    }
+    // Startup does not slow down before it finds the bandwidth
+    if (_filled_pipe || rate > s.pacing_rate) {
+        s.pacing_rate = rate;
+    }
+}
+
+void tcp_bbr::set_cwnd(tcp_congestion_state& s, const tcp_rate_sample& rs) {
+    uint64_t min_cwnd = 4 * s.mss;
+    if (_mode == mode::probe_rtt) {
+        s.cwnd = std::min<uint64_t>(s.cwnd, min_cwnd);
+        return;
+    }
+    auto target = bdp(_cwnd_gain);
+    // for the delayed and stretched ACKs of the path
+    target = target ? target + 3 * s.mss : std::numeric_limits<uint32_t>::max();
+    uint64_t cwnd = s.cwnd;
+    if (rs.in_recovery) {
+        // Packet conservation: send as much as was delivered
+        cwnd = std::max<uint64_t>(cwnd, rs.bytes_in_flight + rs.acked_bytes);
+        cwnd = std::min(cwnd, std::max(target, uint64_t(s.cwnd)));
+    } else if (_filled_pipe) {
+        cwnd = std::min(cwnd + rs.acked_bytes, target);
+    } else if (cwnd < target) {
+        cwnd += rs.acked_bytes;
+    }
+    s.cwnd = std::min<uint64_t>(std::max(cwnd, min_cwnd), std::numeric_limits<uint32_t>::max() / 2);
+}
+
+void tcp_bbr::on_rate_sample(tcp_congestion_state& s, const tcp_rate_sample& rs, clock_type::time_point now) {
+    if (rs.prior_delivered >= _next_round_delivered) {
+        // the ACK is for data sent after the previous round began
+        _next_round_delivered = rs.delivered;
+        ++_round;
+        _max_bw_by_round[_round % bw_filter_rounds] = 0;
+        update_bw(rs);
+        check_full_pipe(rs);
+    } else {
+        update_bw(rs);
+    }
+    update_min_rtt(s, rs, now);
+    update_mode(s, rs, now);
+    set_pacing_rate(s);
+    set_cwnd(s, rs);
+}
+
+void tcp_bbr::on_loss(tcp_congestion_state& s, uint32_t flight_size) {
+    // BBR does not take losses as a sign of congestion: it conserves
+    // packets during the recovery, and then resumes as it was
+    _prior_cwnd = std::max(_prior_cwnd, s.cwnd);
+    s.ssthresh = std::max(flight_size, 4 * s.mss);
+}
+
+void tcp_bbr::on_recovery_end(tcp_congestion_state& s) {
+    if (_prior_cwnd && _mode != mode::probe_rtt) {
+        s.cwnd = std::max(s.cwnd, _prior_cwnd);
+        _prior_cwnd = 0;
+    }
+}
+
+std::unique_ptr<tcp_congestion_control> make_tcp_congestion_control(const sstring& name) {
+    if (name == "reno") {
+        return std::make_unique<tcp_reno>();
+    } else if (name == "cubic") {
+        return std::make_unique<tcp_cubic>();
+    } else if (name == "bbr") {
+        return std::make_unique<tcp_bbr>();
+    }
+    throw std::invalid_argument(sprint("unknown TCP congestion control algorithm: %s", name));
+}
+
+}
+
+}
@@ -0,0 +1,207 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include "core/sstring.hh"
+#include "core/timer.hh"
+
+namespace seastar {
+
+namespace net {
+
+/// What a congestion control algorithm sees of, and sets for, the sending
+/// side of a native TCP connection. Sizes are in bytes.
+struct tcp_congestion_state {
+    using clock_type = steady_clock_type;
+    /// Sender maximum segment size
+    uint32_t mss = 536;
+    /// Congestion window
+    uint32_t cwnd = 0;
+    /// Slow start threshold
+    uint32_t ssthresh = 0;
+    /// Smoothed round-trip time, or zero before the first sample
+    std::chrono::microseconds srtt{0};
+    /// Rate data is sent at, in bytes per second; zero sends it as soon as
+    /// the windows allow
+    uint64_t pacing_rate = 0;
+};
+
+/// A delivery rate sample, taken when an ACK reports data delivered
+/// (draft-cheng-iccrg-delivery-rate-estimation).
+struct tcp_rate_sample {
+    /// Bytes the connection had delivered when the ACK arrived...
+    uint64_t delivered = 0;
+    /// ...and when the most recently sent segment it acknowledges was sent
+    uint64_t prior_delivered = 0;
+    /// Over which delivered - prior_delivered were delivered
+    std::chrono::microseconds interval{0};
+    /// Round-trip time of that segment, or zero if it was retransmitted
+    std::chrono::microseconds rtt{0};
+    /// Bytes this ACK newly acknowledged or SACKed
+    uint32_t acked_bytes = 0;
+    /// Bytes still unacknowledged after the ACK
+    uint32_t bytes_in_flight = 0;
+    /// The sender had nothing to send while the interval's data was in
+    /// flight, so the rate may be below what the path can do
+    bool app_limited = false;
+    /// The connection is repairing a loss
+    bool in_recovery = false;
+    /// Delivery rate in bytes per second, or zero if unknown
+    uint64_t rate() const {
+        return interval.count() > 0 ? (delivered - prior_delivered) * 1000000 / interval.count() : 0;
+    }
+};
+
+/// Congestion control algorithm of a native TCP connection.
+///
+/// The connection runs loss detection and recovery (RFC 5681, 6582 and
+/// 6675) itself, and asks the algorithm how the congestion window grows,
+/// and how far it shrinks when data is lost; algorithms that model the
+/// path may also set a pacing rate from delivery rate samples.
+class tcp_congestion_control {
+public:
+    using clock_type = tcp_congestion_state::clock_type;
+    virtual ~tcp_congestion_control() {}
+    virtual const char* name() const = 0;
+    /// Called for each segment acknowledged outside of SACK-based recovery
+    virtual void on_ack(tcp_congestion_state& s, uint32_t acked_bytes, clock_type::time_point now) = 0;
+    /// Called when a loss is detected, before the connection enters
+    /// recovery or retransmits after a timeout; sets \c s.ssthresh
+    virtual void on_loss(tcp_congestion_state& s, uint32_t flight_size) = 0;
+    /// Called when the losses are repaired, after the connection set
+    /// \c s.cwnd back from its recovery value
+    virtual void on_recovery_end(tcp_congestion_state& s) {}
+    /// Whether the connection should take delivery rate samples
+    virtual bool needs_rate_samples() const {
+        return false;
+    }
+    /// Called after processing an ACK that delivered data, if
+    /// \ref needs_rate_samples()
+    virtual void on_rate_sample(tcp_congestion_state& s, const tcp_rate_sample& rs, clock_type::time_point now) {}
+};
+
+/// RFC 5681 slow start and congestion avoidance: cwnd grows by one segment
+/// per round trip, and halves on loss.
+class tcp_reno final : public tcp_congestion_control {
+public:
+    virtual const char* name() const override {
+        return "reno";
+    }
+    virtual void on_ack(tcp_congestion_state& s, uint32_t acked_bytes, clock_type::time_point now) override;
+    virtual void on_loss(tcp_congestion_state& s, uint32_t flight_size) override;
+};
+
+/// CUBIC (RFC 8312): cwnd grows as a cubic function of the time since the
+/// last loss, independently of the round-trip time, so that it regains
+/// large windows quickly on high bandwidth-delay product paths; it follows
+/// Reno where Reno would do better.
+class tcp_cubic final : public tcp_congestion_control {
+    // W_max, K and W_est of RFC 8312, in bytes and seconds
+    double _w_max = 0;
+    double _k = 0;
+    double _origin = 0;
+    double _w_est = 0;
+    clock_type::time_point _epoch_start;
+    bool _in_epoch = false;
+public:
+    static constexpr double c = 0.4;
+    static constexpr double beta = 0.7;
+    virtual const char* name() const override {
+        return "cubic";
+    }
+    virtual void on_ack(tcp_congestion_state& s, uint32_t acked_bytes, clock_type::time_point now) override;
+    virtual void on_loss(tcp_congestion_state& s, uint32_t flight_size) override;
+};
+
+/// BBR (draft-cardwell-iccrg-bbr-congestion-control): rather than react to
+/// losses, models the path's bottleneck bandwidth and round-trip
+/// propagation time from delivery rate samples, paces data at the former,
+/// and keeps about one bandwidth-delay product in flight.
+class tcp_bbr final : public tcp_congestion_control {
+    enum class mode { startup, drain, probe_bw, probe_rtt };
+    static constexpr unsigned bw_filter_rounds = 10;
+    static constexpr unsigned gain_cycle_length = 8;
+    mode _mode = mode::startup;
+    // Max delivery rate over the last bw_filter_rounds rounds, by round
+    std::array<uint64_t, bw_filter_rounds> _max_bw_by_round{};
+    uint64_t _bw = 0;
+    std::chrono::microseconds _min_rtt{0};
+    clock_type::time_point _min_rtt_stamp;
+    // Round trips are counted in delivered data
+    uint64_t _round = 0;
+    uint64_t _next_round_delivered = 0;
+    // Startup ends when the delivery rate stops growing
+    uint64_t _full_bw = 0;
+    unsigned _full_bw_rounds = 0;
+    bool _filled_pipe = false;
+    unsigned _cycle_index = 0;
+    clock_type::time_point _cycle_stamp;
+    // Zero until the ProbeRTT inflight is reached
+    clock_type::time_point _probe_rtt_done;
+    double _pacing_gain;
+    double _cwnd_gain;
+    // cwnd before loss recovery or ProbeRTT, restored after them
+    uint32_t _prior_cwnd = 0;
+private:
+    uint64_t bdp(double gain) const;
+    void update_bw(const tcp_rate_sample& rs);
+    void update_min_rtt(tcp_congestion_state& s, const tcp_rate_sample& rs, clock_type::time_point now);
+    void check_full_pipe(const tcp_rate_sample& rs);
+    void update_mode(tcp_congestion_state& s, const tcp_rate_sample& rs, clock_type::time_point now);
+    void set_pacing_rate(tcp_congestion_state& s);
+    void set_cwnd(tcp_congestion_state& s, const tcp_rate_sample& rs);
+    void enter_probe_bw(clock_type::time_point now);
+public:
+    static constexpr double high_gain = 2.885; // 2 / ln(2)
+    tcp_bbr();
+    virtual const char* name() const override {
+        return "bbr";
+    }
+    virtual void on_ack(tcp_congestion_state& s, uint32_t acked_bytes, clock_type::time_point now) override {}
+    virtual void on_loss(tcp_congestion_state& s, uint32_t flight_size) override;
+    virtual void on_recovery_end(tcp_congestion_state& s) override;
+    virtual bool needs_rate_samples() const override {
+        return true;
+    }
+    virtual void on_rate_sample(tcp_congestion_state& s, const tcp_rate_sample& rs, clock_type::time_point now) override;
+    /// Estimated bottleneck bandwidth, in bytes per second
+    uint64_t bandwidth() const {
+        return _bw;
+    }
+    /// Estimated round-trip propagation time
+    std::chrono::microseconds min_rtt() const {
+        return _min_rtt;
+    }
+};
+
+/// Creates the congestion control algorithm called \c name: "reno",
+/// "cubic" or "bbr", as Linux calls them; throws std::invalid_argument for
+/// other names.
+std::unique_ptr<tcp_congestion_control> make_tcp_congestion_control(const sstring& name);
+
+}
+
+}
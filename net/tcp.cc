@@ -22,9 +22,11 @@
 #include "tcp.hh"
 #include "tcp-stack.hh"
 #include "ip.hh"
+#include "ipv6.hh"
 #include "core/align.hh"
 #include "core/future.hh"
 #include "native-stack-impl.hh"
+#include <algorithm>
 
 namespace seastar {
 
@@ -59,6 +61,13 @@ void tcp_option::parse(uint8_t* beg1, uint8_t* end1) {
             _sack_received = true;
             beg += option_len::sack;
             break;
+        case option_kind::timestamps:
+            if (_timestamps_enabled) {
+                _timestamps_received = true;
+                _ts_recent = timestamps::read(beg).t1;
+            }
+            beg += option_len::timestamps;
+            break;
         case option_kind::nop:
             beg += option_len::nop;
             break;
@@ -77,6 +86,46 @@ void tcp_option::parse(uint8_t* beg1, uint8_t* end1) {
     }
 }
 
+const char* tcp_option::find(const uint8_t* beg1, const uint8_t* end1, option_kind wanted, uint8_t min_len) {
+    const char* beg = reinterpret_cast<const char*>(beg1);
+    const char* end = reinterpret_cast<const char*>(end1);
+    while (beg < end) {
+        auto kind = option_kind(*beg);
+        if (kind == option_kind::eol) {
+            break;
+        }
+        if (kind == option_kind::nop) {
+            beg += option_len::nop;
+            continue;
+        }
+        if (beg + 1 >= end) {
+            break;
+        }
+        auto len = uint8_t(beg[1]);
+        if (len == 0 || beg + len > end) {
+            break;
+        }
+        if (kind == wanted) {
+            return len >= min_len ? beg : nullptr;
+        }
+        beg += len;
+    }
+    return nullptr;
+}
+
+tcp_option::sack_blocks tcp_option::parse_sack_blocks(const uint8_t* beg, const uint8_t* end) {
+    auto p = find(beg, end, option_kind::sack_blocks, uint8_t(option_len::sack_blocks));
+    return p ? sack_blocks::read(p) : sack_blocks();
+}
+
+std::experimental::optional<tcp_option::timestamps> tcp_option::parse_timestamps(const uint8_t* beg, const uint8_t* end) {
+    auto p = find(beg, end, option_kind::timestamps, uint8_t(option_len::timestamps));
+    if (!p) {
+        return {};
+    }
+    return timestamps::read(p);
+}
+
 uint8_t tcp_option::fill(void* h, const tcp_hdr* th, uint8_t options_size) {
     auto hdr = reinterpret_cast<char*>(h);
     auto off = hdr + tcp_hdr::len;
@@ -99,6 +148,25 @@ uint8_t tcp_option::fill(void* h, const tcp_hdr* th, uint8_t options_size) {
             off += win_scale.len;
             size += win_scale.len;
         }
+        if (_sack_received || !ack_on) {
+            auto sack = tcp_option::sack();
+            sack.write(off);
+            off += sack.len;
+            size += sack.len;
+        }
+    } else if (ack_on && _sack_received && _local_sack.nr) {
+        _local_sack.write(off);
+        off += _local_sack.size();
+        size += _local_sack.size();
+    }
+    if (_timestamps_received || (syn_on && !ack_on && _timestamps_enabled)) {
+        auto ts = tcp_option::timestamps();
+        ts.t1 = _ts_val;
+        // RFC7323: TSecr is only valid with ACK
+        ts.t2 = ack_on ? _ts_recent : 0;
+        ts.write(off);
+        off += ts.len;
+        size += ts.len;
     }
     if (size > 0) {
         // Insert NOP option
@@ -127,6 +195,14 @@ uint8_t tcp_option::get_size(bool syn_on, bool ack_on) {
         if (_win_scale_received || !ack_on) {
             size += option_len::win_scale;
         }
+        if (_sack_received || !ack_on) {
+            size += option_len::sack;
+        }
+    } else if (ack_on && _sack_received && _local_sack.nr) {
+        size += _local_sack.size();
+    }
+    if (_timestamps_received || (syn_on && !ack_on && _timestamps_enabled)) {
+        size += option_len::timestamps;
     }
     if (size > 0) {
         size += option_len::eol;
@@ -136,6 +212,94 @@ uint8_t tcp_option::get_size(bool syn_on, bool ack_on) {
     return size;
 }
 
+void tcp_reassembly::drop_back() {
+    auto& r = _ranges.back();
+    _bytes -= uint32_t(r.end - r.begin);
+    _ranges.pop_back();
+}
+
+bool tcp_reassembly::insert(tcp_seq seq, packet p) {
+    auto end = seq + p.len();
+    if (seq == end) {
+        return true;
+    }
+    // the first range that the segment overlaps or touches, which is
+    // mostly the last one, or none
+    size_t i;
+    if (_ranges.empty() || _ranges.back().end <= seq) {
+        i = _ranges.empty() || _ranges.back().end < seq ? _ranges.size() : _ranges.size() - 1;
+    } else {
+        i = std::lower_bound(_ranges.begin(), _ranges.end(), seq, [] (const range& r, tcp_seq s) {
+            return r.end < s;
+        }) - _ranges.begin();
+    }
+    auto fresh = [&] {
+        return i == _ranges.size() || end < _ranges[i].begin;
+    };
+
+    // make room, from what is further than the segment
+    bool complete = true;
+    auto first_droppable = fresh() ? i : i + 1;
+    while (_ranges.size() > first_droppable
+            && (_bytes + p.len() > _max_bytes || (fresh() && _ranges.size() >= _max_ranges))) {
+        drop_back();
+    }
+    if (_bytes + p.len() > _max_bytes) {
+        auto room = _max_bytes > _bytes ? _max_bytes - _bytes : 0;
+        if (!room) {
+            return false;
+        }
+        p.trim_back(p.len() - room);
+        end = seq + p.len();
+        complete = false;
+    }
+    if (fresh()) {
+        if (_ranges.size() >= _max_ranges) {
+            return false;
+        }
+        range r{seq, end, {}};
+        r.segments.push_back(std::move(p));
+        _ranges.insert(_ranges.begin() + i, std::move(r));
+        _bytes += uint32_t(end - seq);
+        return complete;
+    }
+
+    // add what is missing to the range, before and after it, joining the
+    // ranges the segment fills the gaps to
+    auto* r = &_ranges[i];
+    if (seq < r->begin) {
+        uint32_t n = r->begin - seq;
+        r->segments.push_front(p.share(0, n));
+        r->begin = seq;
+        _bytes += n;
+    }
+    while (r->end < end) {
+        uint32_t left = end - r->end;
+        p.trim_front(p.len() - left);
+        auto next = i + 1 < _ranges.size() ? &_ranges[i + 1] : nullptr;
+        uint32_t n = next ? std::min(left, uint32_t(next->begin - r->end)) : left;
+        r->segments.push_back(n == left ? std::move(p) : p.share(0, n));
+        r->end += n;
+        _bytes += n;
+        if (!next || r->end != next->begin) {
+            break;
+        }
+        for (auto&& q : next->segments) {
+            r->segments.push_back(std::move(q));
+        }
+        r->end = next->end;
+        _ranges.erase(_ranges.begin() + i + 1);
+    }
+    return complete;
+}
+
+tcp_reassembly::range tcp_reassembly::pop_front() {
+    auto r = std::move(_ranges.front());
+    _bytes -= uint32_t(r.end - r.begin);
+    _ranges.erase(_ranges.begin());
+    return r;
+}
+
 ipv4_tcp::ipv4_tcp(ipv4& inet)
 	: _inet_l4(inet), _tcp(std::make_unique<tcp<ipv4_traits>>(_inet_l4)) {
 }
@@ -164,6 +328,33 @@ tcpv4_socket(tcp<ipv4_traits>& tcpv4) {
             tcpv4));
 }
 
+ipv6_tcp::ipv6_tcp(ipv6& inet)
+    : _inet_l4(inet), _tcp(std::make_unique<tcp<ipv6_traits>>(_inet_l4)) {
+}
+
+ipv6_tcp::~ipv6_tcp() {
+}
+
+void ipv6_tcp::received(packet p, ipv6_address from, ipv6_address to, uint8_t hop_limit) {
+    _tcp->received(std::move(p), from, to);
+}
+
+bool ipv6_tcp::forward(forward_hash& out_hash_data, packet& p, size_t off) {
+    return _tcp->forward(out_hash_data, p, off);
+}
+
+server_socket
+tcpv6_listen(tcp<ipv6_traits>& tcpv6, uint16_t port, listen_options opts) {
+    return server_socket(std::make_unique<native_server_socket_impl<tcp<ipv6_traits>>>(
+            tcpv6, port, opts));
+}
+
+::seastar::socket
+tcpv6_socket(tcp<ipv6_traits>& tcpv6) {
+    return ::seastar::socket(std::make_unique<native_socket_impl<tcp<ipv6_traits>>>(
+            tcpv6));
+}
+
 }
 
 }
@@ -28,15 +28,21 @@
 #include "core/print.hh"
 #include "core/byteorder.hh"
 #include "core/metrics.hh"
+#include "core/flat_hash_map.hh"
+#include "core/chunked_fifo.hh"
+#include "core/memory_account.hh"
 #include "net.hh"
 #include "ip_checksum.hh"
 #include "ip.hh"
 #include "const.hh"
-#include "packet-util.hh"
+#include "core/circular_buffer.hh"
+#include "tcp-congestion.hh"
 #include <unordered_map>
 #include <map>
 #include <functional>
 #include <deque>
+#include <vector>
+#include <array>
 #include <chrono>
 #include <experimental/optional>
 #include <random>
@@ -97,8 +103,9 @@ void tcp_debug(const char* fmt, Args&&... args) {
 
 struct tcp_option {
     // The kind and len field are fixed and defined in TCP protocol
-    enum class option_kind: uint8_t { mss = 2, win_scale = 3, sack = 4, timestamps = 8,  nop = 1, eol = 0 };
-    enum class option_len:  uint8_t { mss = 4, win_scale = 3, sack = 2, timestamps = 10, nop = 1, eol = 1 };
+    enum class option_kind: uint8_t { mss = 2, win_scale = 3, sack = 4, sack_blocks = 5, timestamps = 8,  nop = 1, eol = 0 };
+    // sack_blocks is the length without the blocks
+    enum class option_len:  uint8_t { mss = 4, win_scale = 3, sack = 2, sack_blocks = 2, timestamps = 10, nop = 1, eol = 1 };
     static void write(char* p, option_kind kind, option_len len) {
         p[0] = static_cast<uint8_t>(kind);
         if (static_cast<uint8_t>(len) > 1) {
@@ -133,6 +140,7 @@ struct tcp_option {
             p[2] = shift;
         }
     };
+    // SACK permitted
     struct sack {
         static constexpr option_kind kind = option_kind::sack;
         static constexpr option_len len = option_len::sack;
@@ -143,6 +151,39 @@ struct tcp_option {
             tcp_option::write(p, kind, len);
         }
     };
+    // Blocks of data received out of order (RFC 2018), as the sequence
+    // numbers of their first byte and of the byte after their last
+    struct sack_blocks {
+        static constexpr option_kind kind = option_kind::sack_blocks;
+        static constexpr unsigned max_blocks = 4;
+        static constexpr uint8_t block_len = 8;
+        unsigned nr = 0;
+        std::array<std::pair<uint32_t, uint32_t>, max_blocks> blocks;
+        uint8_t size() const {
+            return uint8_t(option_len::sack_blocks) + nr * block_len;
+        }
+        static tcp_option::sack_blocks read(const char* p) {
+            tcp_option::sack_blocks x;
+            auto len = uint8_t(p[1]);
+            x.nr = len < uint8_t(option_len::sack_blocks) ? 0 : (len - uint8_t(option_len::sack_blocks)) / block_len;
+            if (x.nr > max_blocks) {
+                x.nr = max_blocks;
+            }
+            for (unsigned i = 0; i < x.nr; ++i) {
+                x.blocks[i].first = read_be<uint32_t>(p + 2 + i * block_len);
+                x.blocks[i].second = read_be<uint32_t>(p + 6 + i * block_len);
+            }
+            return x;
+        }
+        void write(char* p) const {
+            p[0] = static_cast<uint8_t>(kind);
+            p[1] = size();
+            for (unsigned i = 0; i < nr; ++i) {
+                write_be<uint32_t>(p + 2 + i * block_len, blocks[i].first);
+                write_be<uint32_t>(p + 6 + i * block_len, blocks[i].second);
+            }
+        }
+    };
     struct timestamps {
         static constexpr option_kind kind = option_kind::timestamps;
         static constexpr option_len len = option_len::timestamps;
@@ -179,6 +220,10 @@ struct tcp_option {
     void parse(uint8_t* beg, uint8_t* end);
     uint8_t fill(void* h, const tcp_hdr* th, uint8_t option_size);
     uint8_t get_size(bool syn_on, bool ack_on);
+    // Returns the SACK blocks of a segment's options
+    static sack_blocks parse_sack_blocks(const uint8_t* beg, const uint8_t* end);
+    // Returns the timestamps of a segment's options, if it has them
+    static std::experimental::optional<timestamps> parse_timestamps(const uint8_t* beg, const uint8_t* end);
 
     // For option negotiattion
     bool _mss_received = false;
@@ -191,6 +236,16 @@ struct tcp_option {
     uint16_t _local_mss;
     uint8_t _remote_win_scale = 0;
     uint8_t _local_win_scale = 0;
+    // Sent with ACKs when the remote permitted SACK
+    sack_blocks _local_sack;
+    // RFC7323: offered in our SYN, and accepted in the remote's, if set
+    bool _timestamps_enabled = true;
+    // TSval of the next segment, and TS.Recent, TSecr of our ACKs
+    uint32_t _ts_val = 0;
+    uint32_t _ts_recent = 0;
+private:
+    // Returns the option of kind wanted, if it is at least min_len long
+    static const char* find(const uint8_t* beg, const uint8_t* end, option_kind wanted, uint8_t min_len);
 };
 inline char*& operator+=(char*& x, tcp_option::option_len len) { x += uint8_t(len); return x; }
 inline const char*& operator+=(const char*& x, tcp_option::option_len len) { x += uint8_t(len); return x; }
@@ -286,8 +341,64 @@ struct tcp_hdr {
     }
 };
 
-struct tcp_tag {};
-using tcp_packet_merger = packet_merger<tcp_seq, tcp_tag>;
+/**
+ * The out of order data of a connection: the disjoint, non-adjacent
+ * ranges of sequence space received past RCV.NXT, in order.
+ *
+ * The segments of a range are kept as they arrived, as a list of packets,
+ * so that neither storing nor delivering them copies or linearizes data;
+ * only the parts of a segment that are already held are trimmed off it.
+ * Segments mostly extend the last range, which is found first. The ranges
+ * are the SACK blocks the receiver sends.
+ *
+ * The data held is bounded, by bytes and by ranges: to make room, the
+ * ranges furthest from RCV.NXT are dropped, or the new segment is if it is
+ * the furthest; the sender retransmits them.
+ */
+class tcp_reassembly {
+public:
+    struct range {
+        tcp_seq begin;
+        tcp_seq end;
+        circular_buffer<packet> segments;
+    };
+private:
+    std::vector<range> _ranges;
+    size_t _bytes = 0;
+    size_t _max_bytes;
+    size_t _max_ranges;
+private:
+    void drop_back();
+public:
+    explicit tcp_reassembly(size_t max_bytes = 256 * 1024, size_t max_ranges = 64)
+            : _max_bytes(max_bytes), _max_ranges(max_ranges) {
+    }
+    void set_max_bytes(size_t max_bytes) {
+        _max_bytes = max_bytes;
+    }
+    /**
+     * Stores the data of a segment that begins past RCV.NXT
+     * @return false if limits kept some of it from being stored
+     */
+    bool insert(tcp_seq seq, packet p);
+    /**
+     * Removes the first range, which RCV.NXT reached
+     */
+    range pop_front();
+    const std::vector<range>& ranges() const {
+        return _ranges;
+    }
+    bool empty() const {
+        return _ranges.empty();
+    }
+    size_t bytes() const {
+        return _bytes;
+    }
+    void clear() {
+        _ranges.clear();
+        _bytes = 0;
+    }
+};
 
 template <typename InetTraits>
 class tcp {
@@ -296,6 +407,7 @@ class tcp {
     using inet_type = typename InetTraits::inet_type;
     using connid = l4connid<InetTraits>;
     using connid_hash = typename connid::connid_hash;
+    static constexpr int address_family = InetTraits::address_family;
     class connection;
     class listener;
 private:
@@ -327,6 +439,19 @@ class tcp {
             uint16_t data_len;
             unsigned nr_transmits;
             clock_type::time_point tx_time;
+            // of the first byte the segment still holds
+            tcp_seq seq;
+            // the remote reported it received it out of order
+            bool sacked = false;
+            // during the current SACK-based loss recovery
+            bool retransmitted = false;
+            // The connection's delivery state when it was sent, for rate
+            // samples
+            steady_clock_type::time_point sent_time = {};
+            uint64_t delivered = 0;
+            steady_clock_type::time_point delivered_time = {};
+            steady_clock_type::time_point first_sent_time = {};
+            bool app_limited = false;
         };
         struct send {
             tcp_seq unacknowledged;
@@ -339,7 +464,9 @@ class tcp {
             tcp_seq wl2;
             tcp_seq initial;
             std::deque<unacked_segment> data;
-            std::deque<packet> unsent;
+            // only pushed and popped, so it reuses its chunks rather
+            // than allocating as the stream advances
+            chunked_fifo<packet> unsent;
             uint32_t unsent_len = 0;
             bool closed = false;
             promise<> _window_opened;
@@ -356,10 +483,9 @@ class tcp {
             std::chrono::milliseconds srtt;
             bool first_rto_sample = true;
             clock_type::time_point syn_tx_time;
-            // Congestion window
-            uint32_t cwnd;
-            // Slow start threshold
-            uint32_t ssthresh;
+            // Congestion window and slow start threshold, as the
+            // congestion control sets them
+            tcp_congestion_state cong;
             // Duplicated ACKs
             uint16_t dupacks = 0;
             unsigned syn_retransmit = 0;
@@ -367,33 +493,85 @@ class tcp {
             uint32_t limited_transfer = 0;
             uint32_t partial_ack = 0;
             tcp_seq recover;
+            // In SACK-based loss recovery (RFC 6675), until recover is acked
+            bool sack_recovery = false;
             bool window_probe = false;
             uint8_t zero_window_probing_out = 0;
         } _snd;
         struct receive {
             tcp_seq next;
+            // The most that is accepted, and advertised; see space
             uint32_t window;
             uint8_t window_scale;
             uint16_t mss;
             tcp_seq urgent;
             tcp_seq initial;
             std::deque<packet> data;
-            tcp_packet_merger out_of_order;
+            // Bytes in data, charged to net::receive_memory()
+            size_t data_size = 0;
+            // Sent in the last segment, in bytes
+            uint32_t advertised_window = 0;
+            // Dynamic right-sizing, as Linux does: the window advertised
+            // grows from a small one to twice what the application reads
+            // in a round trip, up to window, so that the sender is not
+            // held back by it while the application keeps up.
+            uint32_t space;
+            // Read since space was last adjusted, and when that was
+            uint64_t space_copied = 0;
+            steady_clock_type::time_point space_time;
+            // The round trip time as the receiver sees it, from the
+            // timestamps or by timing a window, and that window's end
+            steady_clock_type::duration rtt = steady_clock_type::duration(0);
+            tcp_seq rtt_seq;
+            steady_clock_type::time_point rtt_time;
+            tcp_reassembly out_of_order;
+            // Sequence number of the last segment received out of order
+            tcp_seq last_out_of_order;
+            // Acknowledged by the last ACK we sent (Last.ACK.sent)
+            tcp_seq last_ack_sent;
             std::experimental::optional<promise<>> _data_received_promise;
         } _rcv;
         tcp_option _option;
+        std::unique_ptr<tcp_congestion_control> _cc;
+        // Delivery rate estimation (draft-cheng-iccrg-delivery-rate-estimation),
+        // for congestion control that asks for rate samples
+        struct delivery {
+            bool sampling = false;
+            // Bytes acknowledged or SACKed so far
+            uint64_t delivered = 0;
+            steady_clock_type::time_point delivered_time;
+            steady_clock_type::time_point first_sent_time;
+            // delivered once the data in flight when the sender ran out of
+            // data is delivered, or 0 if it has data to send
+            uint64_t app_limited = 0;
+            // The sample the ACK being processed gives, taken from the
+            // most recently sent segment it delivered
+            bool have_sample = false;
+            uint64_t prior_delivered = 0;
+            steady_clock_type::time_point prior_time;
+            steady_clock_type::duration send_elapsed;
+            std::chrono::microseconds rtt;
+            bool sample_app_limited = false;
+            uint32_t acked_bytes = 0;
+        } _delivery;
+        // Pacing, when the congestion control sets a rate: data is not
+        // sent before _next_send
+        timer<> _pacing;
+        steady_clock_type::time_point _next_send;
         timer<lowres_clock> _delayed_ack;
         // Retransmission timeout
         std::chrono::milliseconds _rto{1000};
         std::chrono::milliseconds _persist_time_out{1000};
-        static constexpr std::chrono::milliseconds _rto_min{1000};
-        static constexpr std::chrono::milliseconds _rto_max{60000};
+        // TSecr of the segment being processed, if it has one and it
+        // acknowledges data (RFC7323 RTTM)
+        uint32_t _ts_ecr = 0;
         // Clock granularity
         static constexpr std::chrono::milliseconds _rto_clk_granularity{1};
         static constexpr uint16_t _max_nr_retransmit{5};
         timer<lowres_clock> _retransmit;
         timer<lowres_clock> _persist;
         uint16_t _nr_full_seg_received = 0;
+        uint64_t _retransmits = 0;
         struct isn_secret {
             // 512 bits secretkey for ISN generating
             uint32_t key[16];
@@ -410,12 +588,19 @@ class tcp {
         tcp_seq get_isn();
         circular_buffer<typename InetTraits::l4packet> _packetq;
         bool _poll_active = false;
+        // counted in its listener's pending connections, until established
+        bool _listen_pending = false;
     public:
         tcb(tcp& t, connid id);
         void input_handle_listen_state(tcp_hdr* th, packet p);
+        // Establishes a connection from the ACK of a SYN cookie, whose
+        // sequence number was iss and which encoded the remote's mss
+        void input_handle_syn_cookie_ack(tcp_hdr* th, tcp_seq iss, uint16_t mss, packet p);
         void input_handle_syn_sent_state(tcp_hdr* th, packet p);
         void input_handle_other_state(tcp_hdr* th, packet p);
-        void output_one(bool data_retransmit = false);
+        // Retransmits seg, by default the first unacknowledged segment, when
+        // data_retransmit is set
+        void output_one(bool data_retransmit = false, unacked_segment* seg = nullptr);
         future<> wait_for_data();
         void abort_reader();
         future<> wait_for_all_data_acked();
@@ -452,6 +637,7 @@ class tcp {
         future<> connect_done() {
             return _connect_done.get_future();
         }
+        void set_congestion_control(std::unique_ptr<tcp_congestion_control> cc);
         tcp_state& state() {
             return _state;
         }
@@ -460,12 +646,32 @@ class tcp {
         bool merge_out_of_order();
         void insert_out_of_order(tcp_seq seq, packet p);
         void trim_receive_data_after_window();
+        void queue_received_data(packet p);
+        void release_received_data();
+        void init_receive_window();
+        void measure_receive_rtt();
+        void adjust_receive_space(size_t copied);
+        uint32_t advertised_window() const;
         bool should_send_ack(uint16_t seg_len);
         void clear_delayed_ack();
         packet get_transmit_packet();
-        void retransmit_one() {
+        void retransmit_one(unacked_segment* seg = nullptr) {
             bool data_retransmit = true;
-            output_one(data_retransmit);
+            ++_retransmits;
+            output_one(data_retransmit, seg);
+        }
+        tcp_connection_info get_tcp_info() const {
+            tcp_connection_info info;
+            info.rtt = _snd.srtt;
+            info.rtt_var = _snd.rttvar;
+            info.mss = _snd.mss;
+            info.cwnd = _snd.cong.cwnd;
+            info.ssthresh = _snd.cong.ssthresh;
+            info.bytes_in_flight = _snd.next - _snd.unacknowledged;
+            info.send_window = _snd.window;
+            info.receive_window = _rcv.advertised_window;
+            info.retransmits = _retransmits;
+            return info;
         }
         void start_retransmit_timer() {
             auto now = clock_type::now();
@@ -492,22 +698,61 @@ class tcp {
         void persist();
         void retransmit();
         void fast_retransmit();
+        // SACK-based loss recovery, RFC 6675
+        bool sack_permitted() const {
+            return _option._sack_received;
+        }
+        static constexpr unsigned dupthresh = 3;
+        bool update_scoreboard(const tcp_option::sack_blocks& sb, tcp_seq seg_ack);
+        // Whether the first unacknowledged segment is deemed lost: more than
+        // (DupThresh - 1) * SMSS bytes above it were SACKed
+        bool first_segment_lost();
+        // Bytes deemed in flight: not SACKed nor lost, plus those
+        // retransmitted during this recovery
+        uint32_t pipe();
+        // The next segment to retransmit (NextSeg() rule 1, or rule 3 if
+        // allow_not_lost), or nullptr
+        unacked_segment* next_segment_to_retransmit(bool allow_not_lost);
+        void enter_sack_recovery();
+        void sack_recovery_output_one();
+        bool sack_recovery_can_send();
+        void update_local_sack();
         void update_rto(clock_type::time_point tx_time);
-        void update_cwnd(uint32_t acked_bytes);
+        void update_rto(std::chrono::milliseconds rtt);
+        // RFC7323 timestamp clock: milliseconds, from a per-connection
+        // offset
+        uint32_t ts_now() {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(steady_clock_type::now().time_since_epoch());
+            return uint32_t(ms.count()) + _snd.initial.raw;
+        }
+        void update_cwnd(uint32_t acked_bytes, tcp_congestion_control::clock_type::time_point now);
+        // Delivery rate estimation
+        void record_delivery_state(unacked_segment& seg);
+        void segment_delivered(const unacked_segment& seg, uint32_t bytes);
+        void take_rate_sample();
+        // Whether data must wait for the pacing timer
+        bool paced();
         void cleanup();
         uint32_t can_send() {
             if (_snd.window_probe) {
                 return 1;
             }
+            if (_snd.cong.pacing_rate && paced()) {
+                return 0;
+            }
             // Can not send more than advertised window allows
             auto x = std::min(uint32_t(_snd.unacknowledged + _snd.window - _snd.next), _snd.unsent_len);
             // Can not send more than congestion window allows
-            x = std::min(_snd.cwnd, x);
-            if (_snd.dupacks == 1 || _snd.dupacks == 2) {
+            x = std::min(_snd.cong.cwnd, x);
+            if (_snd.sack_recovery) {
+                // RFC6675 Step (C): send while the pipe leaves room in cwnd
+                auto in_pipe = pipe();
+                x = in_pipe < _snd.cong.cwnd ? std::min(x, _snd.cong.cwnd - in_pipe) : 0;
+            } else if (_snd.dupacks == 1 || _snd.dupacks == 2) {
                 // RFC5681 Step 3.1
                 // Send cwnd + 2 * smss per RFC3042
                 auto flight = flight_size();
-                auto max = _snd.cwnd + 2 * _snd.mss;
+                auto max = _snd.cong.cwnd + 2 * _snd.mss;
                 x = flight <= max ? std::min(x, max - flight) : 0;
                 _snd.limited_transfer += x;
             } else if (_snd.dupacks >= 3) {
@@ -618,22 +863,61 @@ class tcp {
             _snd.dupacks = 0;
             _snd.limited_transfer = 0;
             _snd.partial_ack = 0;
+            if (_snd.sack_recovery) {
+                _snd.sack_recovery = false;
+                for (auto& seg : _snd.data) {
+                    seg.retransmitted = false;
+                }
+            }
         }
         uint32_t data_segment_acked(tcp_seq seg_ack);
         bool segment_acceptable(tcp_seq seg_seq, unsigned seg_len);
         void init_from_options(tcp_hdr* th, uint8_t* opt_start, uint8_t* opt_end);
         friend class connection;
+        friend class tcp;
     };
     inet_type& _inet;
-    std::unordered_map<connid, lw_shared_ptr<tcb>, connid_hash> _tcbs;
-    std::unordered_map<uint16_t, listener*> _listening;
+    // looked up by every segment received
+    flat_hash_map<connid, lw_shared_ptr<tcb>, connid_hash> _tcbs;
+    flat_hash_map<uint16_t, listener*> _listening;
     std::random_device _rd;
     std::default_random_engine _e;
     std::uniform_int_distribution<uint16_t> _port_dist{41952, 65535};
     circular_buffer<std::pair<lw_shared_ptr<tcb>, ethernet_address>> _poll_tcbs;
     // queue for packets that do not belong to any tcb
-    circular_buffer<ipv4_traits::l4packet> _packetq;
+    circular_buffer<typename InetTraits::l4packet> _packetq;
     semaphore _queue_space = {212992};
+    struct stats {
+        uint64_t sack_recoveries = 0;
+        uint64_t sack_retransmits = 0;
+        uint64_t dsacks_received = 0;
+        uint64_t paws_rejected = 0;
+        uint64_t syn_cookies_sent = 0;
+        uint64_t syn_cookies_accepted = 0;
+        uint64_t syn_cookies_rejected = 0;
+        uint64_t listen_drops = 0;
+        uint64_t accept_queue_overflows = 0;
+        uint64_t out_of_order_drops = 0;
+    } _stats;
+    // RFC6298 bounds of the retransmission timeout
+    std::chrono::milliseconds _rto_min{1000};
+    std::chrono::milliseconds _rto_max{60000};
+    bool _timestamps = true;
+    // Ceiling of the receive windows, as Linux's tcp_rmem
+    uint32_t _max_receive_window = 6 << 20;
+    // SYN cookies (RFC4987): when a listener has as many connections
+    // pending as its backlog allows, SYNs are answered without allocating
+    // a tcb, with an initial sequence number that encodes the connection
+    // and its MSS, so that the connection can be created from the ACK.
+    //
+    // The cookie holds, from the top, 5 bits of the 64 second period it
+    // was made in, 2 bits of MSS index and a 25 bit MAC of the connection
+    // and the period.
+    static constexpr unsigned syn_cookie_period_s = 64;
+    bool _syn_cookies = true;
+    uint32_t _syn_cookie_secret[16];
+    // cookies are only accepted for two periods after one was sent
+    std::experimental::optional<lowres_clock::time_point> _last_syn_cookie;
     metrics::metric_groups _metrics;
 public:
     class connection {
@@ -671,6 +955,17 @@ class tcp {
         uint16_t foreign_port() {
             return _tcb->_foreign_port;
         }
+        // Switches to the congestion control algorithm called name (see
+        // make_tcp_congestion_control())
+        void set_congestion_control(const sstring& name) {
+            _tcb->set_congestion_control(make_tcp_congestion_control(name));
+        }
+        sstring get_congestion_control() const {
+            return _tcb->_cc->name();
+        }
+        tcp_connection_info get_tcp_info() const {
+            return _tcb->get_tcp_info();
+        }
         void shutdown_connect();
         void close_read();
         void close_write();
@@ -680,14 +975,16 @@ class tcp {
         uint16_t _port;
         queue<connection> _q;
         size_t _pending = 0;
+        // of the accepted connections; empty for the default
+        sstring _congestion_control;
     private:
-        listener(tcp& t, uint16_t port, size_t queue_length)
-            : _tcp(t), _port(port), _q(queue_length) {
+        listener(tcp& t, uint16_t port, size_t queue_length, sstring congestion_control)
+            : _tcp(t), _port(port), _q(queue_length), _congestion_control(std::move(congestion_control)) {
             _tcp._listening.emplace(_port, this);
         }
     public:
         listener(listener&& x)
-            : _tcp(x._tcp), _port(x._port), _q(std::move(x._q)) {
+            : _tcp(x._tcp), _port(x._port), _q(std::move(x._q)), _congestion_control(std::move(x._congestion_control)) {
             _tcp._listening[_port] = this;
             x._port = 0;
         }
@@ -705,28 +1002,87 @@ class tcp {
             _q.abort(std::make_exception_ptr(std::system_error(ECONNABORTED, std::system_category())));
         }
         bool full() { return _pending + _q.size() >= _q.max_size(); }
+        bool accept_queue_full() { return _q.size() >= _q.max_size(); }
         void inc_pending() { _pending++; }
         void dec_pending() { _pending--; }
         friend class tcp;
     };
 public:
     explicit tcp(inet_type& inet);
+    // Bounds of the retransmission timeout, [1s, 60s] by default as in
+    // RFC6298; datacenters may want a much lower minimum, though the
+    // retransmission timer only has the granularity of lowres_clock
+    void set_rto_limits(std::chrono::milliseconds min, std::chrono::milliseconds max) {
+        if (min.count() <= 0 || max < min) {
+            throw std::invalid_argument(sprint("bad TCP RTO limits: min %dms, max %dms", min.count(), max.count()));
+        }
+        _rto_min = min;
+        _rto_max = max;
+    }
+    // Whether new connections use RFC7323 timestamps, if the remote does
+    void set_timestamps(bool enabled) {
+        _timestamps = enabled;
+    }
+    // Ceiling of the receive window of new connections, which grows to it
+    // as the applications read faster; windows are scaled by 2^7, so no
+    // more than 8MB is advertised
+    void set_max_receive_window(uint32_t bytes) {
+        if (bytes < 0xffff) {
+            throw std::invalid_argument(sprint("bad TCP maximum receive window: %d bytes", bytes));
+        }
+        _max_receive_window = bytes;
+    }
+    // Whether listeners with a full backlog answer SYNs with cookies,
+    // rather than drop them
+    void set_syn_cookies(bool enabled) {
+        _syn_cookies = enabled;
+    }
     void received(packet p, ipaddr from, ipaddr to);
     bool forward(forward_hash& out_hash_data, packet& p, size_t off);
-    listener listen(uint16_t port, size_t queue_length = 100);
+    // congestion_control names the algorithm of the accepted connections,
+    // as make_tcp_congestion_control() does; they use Reno if it is empty
+    listener listen(uint16_t port, size_t queue_length = 100, sstring congestion_control = {});
     connection connect(socket_address sa);
     const net::hw_features& hw_features() const { return _inet._inet.hw_features(); }
     future<> poll_tcb(ipaddr to, lw_shared_ptr<tcb> tcb);
     void add_connected_tcb(lw_shared_ptr<tcb> tcbp, uint16_t local_port) {
+        auto pending = std::exchange(tcbp->_listen_pending, false);
+        auto it = _listening.find(local_port);
+        if (it != _listening.end()) {
+            if (pending) {
+                it->second->dec_pending();
+            }
+            if (!it->second->_q.push(connection(tcbp))) {
+                ++_stats.accept_queue_overflows;
+            }
+        }
+    }
+    // A connection counted in its listener's pending ones closed before
+    // it was established
+    void drop_pending(uint16_t local_port) {
         auto it = _listening.find(local_port);
         if (it != _listening.end()) {
-            it->second->_q.push(connection(tcbp));
             it->second->dec_pending();
         }
     }
 private:
     void send_packet_without_tcb(ipaddr from, ipaddr to, packet p);
+    // Fills in the checksum of p, a segment with no payload, and sends it
+    void send_segment_without_tcb(ipaddr local_ip, ipaddr foreign_ip, packet p);
     void respond_with_reset(tcp_hdr* rth, ipaddr local_ip, ipaddr foreign_ip);
+    static uint16_t syn_cookie_mss(unsigned index) {
+        static const uint16_t mss[] = { 536, 1300, 1440, 1460 };
+        return mss[index];
+    }
+    static uint32_t syn_cookie_period() {
+        return std::chrono::duration_cast<std::chrono::seconds>(lowres_clock::now().time_since_epoch()).count() / syn_cookie_period_s;
+    }
+    uint32_t syn_cookie_mac(const connid& id, tcp_seq remote_isn, uint32_t period);
+    tcp_seq make_syn_cookie(const connid& id, tcp_seq remote_isn, unsigned mss_index);
+    // The MSS a valid cookie encodes
+    std::experimental::optional<uint16_t> check_syn_cookie(const connid& id, tcp_seq remote_isn, tcp_seq cookie);
+    void send_syn_cookie(tcp_hdr* rth, const connid& id, packet p);
+    void accept_syn_cookie(tcp_hdr* th, const connid& id, listener& l, packet p);
     friend class listener;
 };
 
@@ -737,9 +1093,37 @@ tcp<InetTraits>::tcp(inet_type& inet)
     namespace sm = metrics;
 
     _metrics.add_group("tcp", {
-        sm::make_derive("linearizations", [] { return tcp_packet_merger::linearizations(); },
-                        sm::description("Counts a number of times a buffer linearization was invoked during the buffers merge process. "
-                                        "Divide it by a total TCP receive packet rate to get an everage number of lineraizations per TCP packet."))
+        sm::make_derive("out_of_order_drops", _stats.out_of_order_drops,
+                        sm::description("Counts the out of order segments, or parts of them, dropped because their connection held as much out of order data as it may")),
+        sm::make_derive("sack_recoveries", _stats.sack_recoveries,
+                        sm::description("Counts the times connections entered SACK-based loss recovery")),
+        sm::make_derive("sack_retransmits", _stats.sack_retransmits,
+                        sm::description("Counts the segments retransmitted during SACK-based loss recovery")),
+        sm::make_derive("dsacks_received", _stats.dsacks_received,
+                        sm::description("Counts the D-SACK blocks received, each reporting a segment the remote received twice; "
+                                        "a high rate means retransmissions were spurious")),
+        sm::make_derive("paws_rejected", _stats.paws_rejected,
+                        sm::description("Counts the segments dropped because their timestamp was older than the connection's (PAWS)")),
+        sm::make_derive("syn_cookies_sent", _stats.syn_cookies_sent,
+                        sm::description("Counts the SYNs answered with a cookie, because their listener's backlog was full")),
+        sm::make_derive("syn_cookies_accepted", _stats.syn_cookies_accepted,
+                        sm::description("Counts the connections established from the ACK of a SYN cookie")),
+        sm::make_derive("syn_cookies_rejected", _stats.syn_cookies_rejected,
+                        sm::description("Counts the ACKs to a listening port that carried no valid SYN cookie")),
+        sm::make_derive("listen_drops", _stats.listen_drops,
+                        sm::description("Counts the SYNs dropped because their listener's backlog was full and SYN cookies are disabled")),
+        sm::make_derive("accept_queue_overflows", _stats.accept_queue_overflows,
+                        sm::description("Counts the established connections dropped because their listener's accept queue was full")),
+    });
+    std::uniform_int_distribution<uint32_t> dist{};
+    for (auto& k : _syn_cookie_secret) {
+        k = dist(_e);
+    }
+
+    _inet._inet.netif()->register_flow_lister([this] (std::vector<forward_hash>& flows) {
+        for (auto&& c : _tcbs) {
+            flows.push_back(c.first.hash_data());
+        }
     });
 
     _inet.register_packet_provider([this, tcb_polled = 0u] () mutable {
@@ -775,23 +1159,27 @@ future<> tcp<InetTraits>::poll_tcb(ipaddr to, lw_shared_ptr<tcb> tcb) {
 }
 
 template <typename InetTraits>
-auto tcp<InetTraits>::listen(uint16_t port, size_t queue_length) -> listener {
-    return listener(*this, port, queue_length);
+auto tcp<InetTraits>::listen(uint16_t port, size_t queue_length, sstring congestion_control) -> listener {
+    if (!congestion_control.empty()) {
+        // throws if there is no such algorithm
+        make_tcp_congestion_control(congestion_control);
+    }
+    return listener(*this, port, queue_length, std::move(congestion_control));
 }
 
 template <typename InetTraits>
 auto tcp<InetTraits>::connect(socket_address sa) -> connection {
     uint16_t src_port;
     connid id;
-    auto src_ip = _inet._inet.host_address();
-    auto dst_ip = ipv4_address(sa);
-    auto dst_port = net::ntoh(sa.u.in.sin_port);
+    auto dst_ip = ipaddr(sa);
+    auto src_ip = _inet._inet.source_address(dst_ip);
+    auto dst_port = sa.port();
 
     do {
         src_port = _port_dist(_e);
         id = connid{src_ip, dst_ip, src_port, dst_port};
     } while (_inet._inet.netif()->hw_queues_count() > 1 &&
-             (_inet._inet.netif()->hash2cpu(id.hash(_inet._inet.netif()->rss_key())) != engine().cpu_id()
+             (_inet._inet.netif()->flow2cpu(id.hash_data()) != engine().cpu_id()
               || _tcbs.find(id) != _tcbs.end()));
 
     auto tcbp = make_lw_shared<tcb>(*this, id);
@@ -825,7 +1213,7 @@ void tcp<InetTraits>::received(packet p, ipaddr from, ipaddr to) {
         return;
     }
 
-    if (!hw_features().rx_csum_offload) {
+    if (!hw_features().rx_csum_offload && !p.offload_info_ref().rx_l4_csum_good) {
         checksummer csum;
         InetTraits::tcp_pseudo_header_checksum(csum, from, to, p.len());
         csum.sum(p);
@@ -839,7 +1227,7 @@ void tcp<InetTraits>::received(packet p, ipaddr from, ipaddr to) {
     lw_shared_ptr<tcb> tcbp;
     if (tcbi == _tcbs.end()) {
         auto listener = _listening.find(id.local_port);
-        if (listener == _listening.end() || listener->second->full()) {
+        if (listener == _listening.end()) {
             // 1) In CLOSE state
             // 1.1 all data in the incoming segment is discarded.  An incoming
             // segment containing a RST is discarded. An incoming segment not
@@ -857,20 +1245,36 @@ void tcp<InetTraits>::received(packet p, ipaddr from, ipaddr to) {
             }
             // 2.2 second check for an ACK
             if (h.f_ack) {
-                // Any acknowledgment is bad if it arrives on a connection
-                // still in the LISTEN state.
+                // Unless it acknowledges a SYN cookie, any acknowledgment
+                // is bad if it arrives on a connection still in the LISTEN
+                // state.
                 // <SEQ=SEG.ACK><CTL=RST>
+                if (!h.f_syn && _last_syn_cookie
+                        && lowres_clock::now() - *_last_syn_cookie < std::chrono::seconds(2 * syn_cookie_period_s)) {
+                    return accept_syn_cookie(&h, id, *listener->second, std::move(p));
+                }
                 return respond_with_reset(&h, id.local_ip, id.foreign_ip);
             }
             // 2.3 third check for a SYN
             if (h.f_syn) {
                 // check the security
                 // NOTE: Ignored for now
+                if (listener->second->full()) {
+                    if (_syn_cookies) {
+                        return send_syn_cookie(&h, id, std::move(p));
+                    }
+                    // the remote retries, rather than fail on a reset
+                    ++_stats.listen_drops;
+                    return;
+                }
                 tcbp = make_lw_shared<tcb>(*this, id);
+                if (!listener->second->_congestion_control.empty()) {
+                    tcbp->set_congestion_control(make_tcp_congestion_control(listener->second->_congestion_control));
+                }
                 _tcbs.insert({id, tcbp});
-                // TODO: we need to remove the tcb and decrease the pending if
-                // it stays SYN_RECEIVED state forever.
+                // until it is established, or closes
                 listener->second->inc_pending();
+                tcbp->_listen_pending = true;
 
                 return tcbp->input_handle_listen_state(&h, std::move(p));
             }
@@ -898,7 +1302,7 @@ template <typename InetTraits>
 void tcp<InetTraits>::send_packet_without_tcb(ipaddr from, ipaddr to, packet p) {
     if (_queue_space.try_wait(p.len())) { // drop packets that do not fit the queue
         _inet.get_l2_dst_address(to).then([this, to, p = std::move(p)] (ethernet_address e_dst) mutable {
-                _packetq.emplace_back(ipv4_traits::l4packet{to, std::move(p), e_dst, ip_protocol_num::tcp});
+                _packetq.emplace_back(typename InetTraits::l4packet{to, std::move(p), e_dst, ip_protocol_num::tcp});
         });
     }
 }
@@ -919,9 +1323,12 @@ tcp<InetTraits>::tcb::tcb(tcp& t, connid id)
     , _foreign_ip(id.foreign_ip)
     , _local_port(id.local_port)
     , _foreign_port(id.foreign_port)
+    , _cc(std::make_unique<tcp_reno>())
+    , _pacing([this] { output(); })
     , _delayed_ack([this] { _nr_full_seg_received = 0; output(); })
     , _retransmit([this] { retransmit(); })
     , _persist([this] { persist(); }) {
+    _option._timestamps_enabled = _tcp._timestamps;
 }
 
 template <typename InetTraits>
@@ -952,9 +1359,16 @@ void tcp<InetTraits>::respond_with_reset(tcp_hdr* rth, ipaddr local_ip, ipaddr f
     h.checksum = 0;
     h.write(th);
 
+    send_segment_without_tcb(local_ip, foreign_ip, std::move(p));
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::send_segment_without_tcb(ipaddr local_ip, ipaddr foreign_ip, packet p) {
+    auto len = p.len();
+    auto th = p.get_header(0, len);
     checksummer csum;
     offload_info oi;
-    InetTraits::tcp_pseudo_header_checksum(csum, local_ip, foreign_ip, tcp_hdr::len);
+    InetTraits::tcp_pseudo_header_checksum(csum, local_ip, foreign_ip, len);
     uint16_t checksum;
     if (hw_features().tx_csum_l4_offload) {
         checksum = ~csum.get();
@@ -967,25 +1381,119 @@ void tcp<InetTraits>::respond_with_reset(tcp_hdr* rth, ipaddr local_ip, ipaddr f
     tcp_hdr::write_nbo_checksum(th, checksum);
 
     oi.protocol = ip_protocol_num::tcp;
-    oi.tcp_hdr_len = tcp_hdr::len;
+    oi.tcp_hdr_len = len;
     p.set_offload_info(oi);
 
     send_packet_without_tcb(local_ip, foreign_ip, std::move(p));
 }
 
+template <typename InetTraits>
+uint32_t tcp<InetTraits>::syn_cookie_mac(const connid& id, tcp_seq remote_isn, uint32_t period) {
+    uint32_t hash[4];
+    hash[0] = std::hash<ipaddr>()(id.local_ip);
+    hash[1] = std::hash<ipaddr>()(id.foreign_ip);
+    hash[2] = (uint32_t(id.local_port) << 16) + id.foreign_port;
+    hash[3] = remote_isn.raw ^ period;
+    CryptoPP::Weak::MD5::Transform(hash, _syn_cookie_secret);
+    return hash[0] & ((1u << 25) - 1);
+}
+
+template <typename InetTraits>
+tcp_seq tcp<InetTraits>::make_syn_cookie(const connid& id, tcp_seq remote_isn, unsigned mss_index) {
+    auto period = syn_cookie_period();
+    return make_seq(((period & 31) << 27) | (mss_index << 25) | syn_cookie_mac(id, remote_isn, period));
+}
+
+template <typename InetTraits>
+std::experimental::optional<uint16_t> tcp<InetTraits>::check_syn_cookie(const connid& id, tcp_seq remote_isn, tcp_seq cookie) {
+    auto now = syn_cookie_period();
+    // made in this period or the previous one
+    for (auto period : { now, now - 1 }) {
+        if ((cookie.raw >> 27) == (period & 31)
+                && (cookie.raw & ((1u << 25) - 1)) == syn_cookie_mac(id, remote_isn, period)) {
+            return syn_cookie_mss((cookie.raw >> 25) & 3);
+        }
+    }
+    return std::experimental::nullopt;
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::send_syn_cookie(tcp_hdr* rth, const connid& id, packet p) {
+    auto hdr = reinterpret_cast<uint8_t*>(p.get_header(0, rth->data_offset * 4));
+    if (!hdr) {
+        return;
+    }
+    tcp_option opt;
+    opt.parse(hdr + tcp_hdr::len, hdr + rth->data_offset * 4);
+    auto mss = std::min<uint16_t>(opt._remote_mss, hw_features().mtu - net::tcp_hdr_len_min - InetTraits::ip_hdr_len_min);
+    unsigned mss_index = 0;
+    while (mss_index < 3 && syn_cookie_mss(mss_index + 1) <= mss) {
+        ++mss_index;
+    }
+    _last_syn_cookie = lowres_clock::now();
+    ++_stats.syn_cookies_sent;
+
+    // <SEQ=cookie><ACK=SEG.SEQ+1><CTL=SYN,ACK>, with the MSS option only:
+    // the remote's other options are not kept
+    packet out;
+    auto len = tcp_hdr::len + uint8_t(tcp_option::option_len::mss);
+    auto th = out.prepend_uninitialized_header(len);
+    auto h = tcp_hdr{};
+    h.src_port = rth->dst_port;
+    h.dst_port = rth->src_port;
+    h.seq = make_syn_cookie(id, rth->seq, mss_index);
+    h.ack = rth->seq + 1;
+    h.f_syn = true;
+    h.f_ack = true;
+    h.window = 29200;
+    h.data_offset = len / 4;
+    h.checksum = 0;
+    h.write(th);
+    tcp_option::mss{syn_cookie_mss(mss_index)}.write(th + tcp_hdr::len);
+
+    send_segment_without_tcb(id.local_ip, id.foreign_ip, std::move(out));
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::accept_syn_cookie(tcp_hdr* th, const connid& id, listener& l, packet p) {
+    auto iss = th->ack - 1;
+    auto mss = check_syn_cookie(id, th->seq - 1, iss);
+    if (!mss) {
+        ++_stats.syn_cookies_rejected;
+        return respond_with_reset(th, id.local_ip, id.foreign_ip);
+    }
+    if (l.accept_queue_full()) {
+        // the remote retransmits, and may find room then
+        ++_stats.accept_queue_overflows;
+        return;
+    }
+    ++_stats.syn_cookies_accepted;
+    auto tcbp = make_lw_shared<tcb>(*this, id);
+    if (!l._congestion_control.empty()) {
+        tcbp->set_congestion_control(make_tcp_congestion_control(l._congestion_control));
+    }
+    _tcbs.insert({id, tcbp});
+    tcbp->input_handle_syn_cookie_ack(th, iss, *mss, std::move(p));
+}
+
 template <typename InetTraits>
 uint32_t tcp<InetTraits>::tcb::data_segment_acked(tcp_seq seg_ack) {
     uint32_t total_acked_bytes = 0;
+    auto now = tcp_congestion_control::clock_type::now();
     // Full ACK of segment
     while (!_snd.data.empty()
             && (_snd.unacknowledged + _snd.data.front().p.len() <= seg_ack)) {
         auto acked_bytes = _snd.data.front().p.len();
         _snd.unacknowledged += acked_bytes;
-        // Ignore retransmitted segments when setting the RTO
-        if (_snd.data.front().nr_transmits == 0) {
+        // Ignore retransmitted segments when setting the RTO, unless
+        // the timestamps say which transmit this acknowledges
+        if (_snd.data.front().nr_transmits == 0 && !_ts_ecr) {
             update_rto(_snd.data.front().tx_time);
         }
-        update_cwnd(acked_bytes);
+        if (_delivery.sampling && !_snd.data.front().sacked) {
+            segment_delivered(_snd.data.front(), acked_bytes);
+        }
+        update_cwnd(acked_bytes, now);
         total_acked_bytes += acked_bytes;
         _snd.current_queue_space -= _snd.data.front().data_len;
         signal_send_available();
@@ -996,12 +1504,23 @@ uint32_t tcp<InetTraits>::tcb::data_segment_acked(tcp_seq seg_ack) {
         auto acked_bytes = seg_ack - _snd.unacknowledged;
         if (!_snd.data.empty()) {
             auto& unacked_seg = _snd.data.front();
+            if (_delivery.sampling && !unacked_seg.sacked) {
+                segment_delivered(unacked_seg, acked_bytes);
+            }
             unacked_seg.p.trim_front(acked_bytes);
+            unacked_seg.seq = seg_ack;
         }
         _snd.unacknowledged = seg_ack;
-        update_cwnd(acked_bytes);
+        update_cwnd(acked_bytes, now);
         total_acked_bytes += acked_bytes;
     }
+    // RFC7323 4.1: one sample per ACK, retransmissions included
+    if (_ts_ecr && total_acked_bytes) {
+        auto rtt = ts_now() - _ts_ecr;
+        if (int32_t(rtt) >= 0) {
+            update_rto(std::chrono::milliseconds(rtt));
+        }
+    }
     return total_acked_bytes;
 }
 
@@ -1036,13 +1555,17 @@ void tcp<InetTraits>::tcb::init_from_options(tcp_hdr* th, uint8_t* opt_start, ui
     // Local receive window scale factor
     _rcv.window_scale = _option._local_win_scale;
 
-    // Maximum segment size remote can receive
+    // Maximum segment size remote can receive; it does not count the
+    // options, so leave room for the timestamps every segment carries
     _snd.mss = _option._remote_mss;
+    if (_option._timestamps_received) {
+        _snd.mss -= uint8_t(tcp_option::option_len::timestamps) + 2; // with its padding
+    }
+    _snd.cong.mss = _snd.mss;
     // Maximum segment size local can receive
     _rcv.mss = _option._local_mss = local_mss();
 
-    // Linux's default window size
-    _rcv.window = 29200 << _rcv.window_scale;
+    init_receive_window();
     _snd.window = th->window << _snd.window_scale;
 
     // Segment sequence number used for last window update
@@ -1052,15 +1575,15 @@ void tcp<InetTraits>::tcb::init_from_options(tcp_hdr* th, uint8_t* opt_start, ui
 
     // Setup initial congestion window
     if (2190 < _snd.mss) {
-        _snd.cwnd = 2 * _snd.mss;
+        _snd.cong.cwnd = 2 * _snd.mss;
     } else if (1095 < _snd.mss && _snd.mss <= 2190) {
-        _snd.cwnd = 3 * _snd.mss;
+        _snd.cong.cwnd = 3 * _snd.mss;
     } else {
-        _snd.cwnd = 4 * _snd.mss;
+        _snd.cong.cwnd = 4 * _snd.mss;
     }
 
     // Setup initial slow start threshold
-    _snd.ssthresh = th->window << _snd.window_scale;
+    _snd.cong.ssthresh = th->window << _snd.window_scale;
 }
 
 template <typename InetTraits>
@@ -1092,6 +1615,30 @@ void tcp<InetTraits>::tcb::input_handle_listen_state(tcp_hdr* th, packet p) {
     do_syn_received();
 }
 
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::input_handle_syn_cookie_ack(tcp_hdr* th, tcp_seq iss, uint16_t mss, packet p) {
+    // IRS is SEG.SEQ-1, and the SYN-ACK was sent with ISS
+    _rcv.initial = th->seq - 1;
+    _rcv.next = th->seq;
+    _rcv.urgent = _rcv.next;
+    _snd.initial = iss;
+    _snd.unacknowledged = iss + 1;
+    _snd.next = iss + 1;
+    _snd.recover = iss + 1;
+
+    // the SYN's options are lost, but for the MSS: no window scaling,
+    // timestamps or SACK
+    _option._remote_mss = mss;
+    init_from_options(th, nullptr, nullptr);
+
+    tcp_debug("syn cookie: LISTEN -> ESTABLISHED\n");
+    _state = ESTABLISHED;
+    _connect_done.set_value();
+    _tcp.add_connected_tcb(this->shared_from_this(), _local_port);
+    // and whatever data the ACK carries
+    input_handle_other_state(th, std::move(p));
+}
+
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::input_handle_syn_sent_state(tcp_hdr* th, packet p) {
     auto opt_len = th->data_offset * 4 - tcp_hdr::len;
@@ -1164,6 +1711,18 @@ void tcp<InetTraits>::tcb::input_handle_syn_sent_state(tcp_hdr* th, packet p) {
 
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
+    tcp_option::sack_blocks sack_blocks;
+    std::experimental::optional<tcp_option::timestamps> ts;
+    if ((sack_permitted() || _option._timestamps_received) && th->data_offset * 4 > tcp_hdr::len) {
+        auto opt_start = reinterpret_cast<uint8_t*>(p.get_header(0, th->data_offset * 4)) + tcp_hdr::len;
+        auto opt_end = opt_start + (th->data_offset * 4 - tcp_hdr::len);
+        if (sack_permitted()) {
+            sack_blocks = tcp_option::parse_sack_blocks(opt_start, opt_end);
+        }
+        if (_option._timestamps_received) {
+            ts = tcp_option::parse_timestamps(opt_start, opt_end);
+        }
+    }
     p.trim_front(th->data_offset * 4);
     bool do_output = false;
     bool do_output_data = false;
@@ -1171,12 +1730,32 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
     auto seg_ack = th->ack;
     auto seg_len = p.len();
 
+    // RFC7323 5.3: PAWS, drop segments older than the last in-sequence
+    // one, as they may be from a previous use of the sequence space
+    if (ts && !th->f_rst && int32_t(ts->t1 - _option._ts_recent) < 0) {
+        ++_tcp._stats.paws_rejected;
+        //<SEQ=SND.NXT><ACK=RCV.NXT><CTL=ACK>
+        return output();
+    }
+
     // 4.1 first check sequence number
     if (!segment_acceptable(seg_seq, seg_len)) {
         //<SEQ=SND.NXT><ACK=RCV.NXT><CTL=ACK>
         return output();
     }
 
+    if (ts) {
+        // RFC7323 4.3: echo the timestamp of the segment that the next
+        // ACK acknowledges
+        if (seg_seq <= _rcv.last_ack_sent) {
+            _option._ts_recent = ts->t1;
+        }
+        // A TSecr is valid only on ACKs
+        _ts_ecr = th->f_ack ? ts->t2 : 0;
+    } else {
+        _ts_ecr = 0;
+    }
+
     // In the following it is assumed that the segment is the idealized
     // segment that begins at RCV.NXT and does not exceed the window.
     if (seg_seq < _rcv.next) {
@@ -1283,6 +1862,8 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
         if (in_state(ESTABLISHED | CLOSE_WAIT)){
             // When we are in zero window probing phase and packets_out = 0 we bypass "duplicated ack" check
             auto packets_out = _snd.next - _snd.unacknowledged - _snd.zero_window_probing_out;
+            // RFC6675: record what the remote received out of order
+            bool newly_sacked = sack_blocks.nr && seg_ack <= _snd.next && update_scoreboard(sack_blocks, seg_ack);
             // If SND.UNA < SEG.ACK =< SND.NXT then, set SND.UNA <- SEG.ACK.
             if (_snd.unacknowledged < seg_ack && seg_ack <= _snd.next) {
                 // Remote ACKed data we sent
@@ -1308,13 +1889,26 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                     }
                 };
 
-                if (_snd.dupacks >= 3) {
+                if (_snd.sack_recovery) {
+                    if (seg_ack > _snd.recover) {
+                        tcp_debug("ack: sack recovery full_ack\n");
+                        // RFC6675 Step (A): the losses were repaired
+                        _snd.cong.cwnd = _snd.cong.ssthresh;
+                        _cc->on_recovery_end(_snd.cong);
+                        exit_fast_recovery();
+                        set_retransmit_timer();
+                    } else {
+                        // RFC6675 Step (C): keep repairing as the pipe drains
+                        start_retransmit_timer();
+                    }
+                } else if (_snd.dupacks >= 3) {
                     // We are in fast retransmit / fast recovery phase
                     uint32_t smss = _snd.mss;
                     if (seg_ack > _snd.recover) {
                         tcp_debug("ack: full_ack\n");
                         // Set cwnd to min (ssthresh, max(FlightSize, SMSS) + SMSS)
-                        _snd.cwnd = std::min(_snd.ssthresh, std::max(flight_size(), smss) + smss);
+                        _snd.cong.cwnd = std::min(_snd.cong.ssthresh, std::max(flight_size(), smss) + smss);
+                        _cc->on_recovery_end(_snd.cong);
                         // Exit the fast recovery procedure
                         exit_fast_recovery();
                         set_retransmit_timer();
@@ -1324,11 +1918,11 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                         fast_retransmit();
                         // Deflate the congestion window by the amount of new data
                         // acknowledged by the Cumulative Acknowledgment field
-                        _snd.cwnd -= acked_bytes;
+                        _snd.cong.cwnd -= std::min(acked_bytes, _snd.cong.cwnd);
                         // If the partial ACK acknowledges at least one SMSS of new
                         // data, then add back SMSS bytes to the congestion window
                         if (acked_bytes >= smss) {
-                            _snd.cwnd += smss;
+                            _snd.cong.cwnd += smss;
                         }
                         // Send a new segment if permitted by the new value of
                         // cwnd.  Do not exit the fast recovery procedure For
@@ -1363,7 +1957,17 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                 _snd.dupacks++;
                 uint32_t smss = _snd.mss;
                 // 3 duplicated ACKs trigger a fast retransmit
-                if (_snd.dupacks == 1 || _snd.dupacks == 2) {
+                if (_snd.sack_recovery) {
+                    // RFC6675 Step (C): the pipe drained
+                    do_output_data = true;
+                } else if (sack_permitted() && _snd.dupacks >= dupthresh) {
+                    // RFC6675 Step (4), unless this is a loss of the
+                    // recovery that just ended (RFC6582 Step 3.2)
+                    if (seg_ack - 1 > _snd.recover) {
+                        enter_sack_recovery();
+                    }
+                    do_output_data = true;
+                } else if (_snd.dupacks == 1 || _snd.dupacks == 2) {
                     // RFC5681 Step 3.1
                     // Send cwnd + 2 * smss per RFC3042
                     do_output_data = true;
@@ -1372,16 +1976,16 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                     if (seg_ack - 1 > _snd.recover) {
                         _snd.recover = _snd.next - 1;
                         // RFC5681 Step 3.2
-                        _snd.ssthresh = std::max((flight_size() - _snd.limited_transfer) / 2, 2 * smss);
+                        _cc->on_loss(_snd.cong, flight_size() - _snd.limited_transfer);
                         fast_retransmit();
                     } else {
                         // Do not enter fast retransmit and do not reset ssthresh
                     }
                     // RFC5681 Step 3.3
-                    _snd.cwnd = _snd.ssthresh + 3 * smss;
+                    _snd.cong.cwnd = _snd.cong.ssthresh + 3 * smss;
                 } else if (_snd.dupacks > 3) {
                     // RFC5681 Step 3.4
-                    _snd.cwnd += smss;
+                    _snd.cong.cwnd += smss;
                     // RFC5681 Step 3.5
                     do_output_data = true;
                 }
@@ -1393,6 +1997,16 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                 update_window();
                 do_output_data = true;
             }
+            if (_delivery.sampling) {
+                take_rate_sample();
+            }
+            // RFC6675 Step (4): SACKed data shows a loss before three
+            // duplicate ACKs arrive, such as when ACKs are lost or carry data
+            if (newly_sacked && !_snd.sack_recovery && !_snd.data.empty()
+                    && seg_ack - 1 > _snd.recover && first_segment_lost()) {
+                enter_sack_recovery();
+                do_output_data = true;
+            }
         }
         // FIN_WAIT_1 STATE
         if (in_state(FIN_WAIT_1)) {
@@ -1451,8 +2065,9 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
             // RCV.NXT over the data accepted, and adjusts RCV.WND as
             // apporopriate to the current buffer availability.  The total of
             // RCV.NXT and RCV.WND should not be reduced.
-            _rcv.data.push_back(std::move(p));
+            queue_received_data(std::move(p));
             _rcv.next += seg_len;
+            measure_receive_rtt();
             auto merged = merge_out_of_order();
             signal_data_received();
             // Send an acknowledgment of the form:
@@ -1528,7 +2143,7 @@ packet tcp<InetTraits>::tcb::get_transmit_packet() {
     auto can_send = this->can_send();
     // Max number of TCP payloads we can pass to NIC
     uint32_t len;
-    if (_tcp.hw_features().tx_tso) {
+    if (_tcp.hw_features().tx_tso || _tcp.hw_features().tx_gso) {
         // FIXME: Info tap device the size of the splitted packet
         len = _tcp.hw_features().max_packet_len - net::tcp_hdr_len_min - InetTraits::ip_hdr_len_min;
     } else {
@@ -1569,17 +2184,26 @@ packet tcp<InetTraits>::tcb::get_transmit_packet() {
 }
 
 template <typename InetTraits>
-void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
+void tcp<InetTraits>::tcb::output_one(bool data_retransmit, unacked_segment* seg) {
     if (in_state(CLOSED)) {
         return;
     }
 
-    packet p = data_retransmit ? _snd.data.front().p.share() : get_transmit_packet();
+    if (data_retransmit && !seg) {
+        seg = &_snd.data.front();
+    }
+    packet p = data_retransmit ? seg->p.share() : get_transmit_packet();
     packet clone = p.share();  // early clone to prevent share() from calling packet::unuse_internal_data() on header.
     uint16_t len = p.len();
     bool syn_on = syn_needs_on();
     bool ack_on = ack_needs_on();
+    if (ack_on && !syn_on && sack_permitted()) {
+        update_local_sack();
+    }
 
+    if (_option._timestamps_enabled) {
+        _option._ts_val = ts_now();
+    }
     auto options_size = _option.get_size(syn_on, ack_on);
     auto th = p.prepend_uninitialized_header(tcp_hdr::len + options_size);
     auto h = tcp_hdr{};
@@ -1597,15 +2221,19 @@ void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
 
     tcp_seq seq;
     if (data_retransmit) {
-        seq = _snd.unacknowledged;
+        seq = seg->seq;
     } else {
         seq = syn_on ? _snd.initial : _snd.next;
         _snd.next += len;
     }
     h.seq = seq;
     h.ack = _rcv.next;
+    if (ack_on) {
+        _rcv.last_ack_sent = _rcv.next;
+    }
     h.data_offset = (tcp_hdr::len + options_size) / 4;
-    h.window = _rcv.window >> _rcv.window_scale;
+    _rcv.advertised_window = advertised_window();
+    h.window = _rcv.advertised_window >> _rcv.window_scale;
     h.checksum = 0;
 
     // FIXME: does the FIN have to fit in the window?
@@ -1621,6 +2249,8 @@ void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
     uint16_t pseudo_hdr_seg_len = 0;
 
     oi.tcp_hdr_len = tcp_hdr::len + options_size;
+    // Segmented by the device, or by tcp_gso_segment() just before it
+    bool segment_offload = len > _snd.mss && (_tcp.hw_features().tx_tso || _tcp.hw_features().tx_gso);
 
     if (_tcp.hw_features().tx_csum_l4_offload) {
         oi.needs_csum = true;
@@ -1634,7 +2264,7 @@ void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
         // segment length set to 0. All the rest is the same as for a TCP Tx
         // CSUM offload case.
         //
-        if (_tcp.hw_features().tx_tso && len > _snd.mss) {
+        if (segment_offload) {
             oi.tso_seg_size = _snd.mss;
         } else {
             pseudo_hdr_seg_len = tcp_hdr::len + options_size + len;
@@ -1642,6 +2272,9 @@ void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
     } else {
         pseudo_hdr_seg_len = tcp_hdr::len + options_size + len;
         oi.needs_csum = false;
+        if (segment_offload) {
+            oi.tso_seg_size = _snd.mss;
+        }
     }
 
     InetTraits::tcp_pseudo_header_checksum(csum, _local_ip, _foreign_ip,
@@ -1650,6 +2283,9 @@ void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
     uint16_t checksum;
     if (_tcp.hw_features().tx_csum_l4_offload) {
         checksum = ~csum.get();
+    } else if (oi.tso_seg_size) {
+        // each segment is checksummed when the packet is split
+        checksum = 0;
     } else {
         csum.sum(p);
         checksum = csum.get();
@@ -1665,11 +2301,20 @@ void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
         if (len) {
             unsigned nr_transmits = 0;
             _snd.data.emplace_back(unacked_segment{std::move(clone),
-                                   len, nr_transmits, now});
+                                   len, nr_transmits, now, seq});
+            if (_delivery.sampling) {
+                record_delivery_state(_snd.data.back());
+            }
         }
         if (!_retransmit.armed()) {
             start_retransmit_timer(now);
         }
+    } else if (data_retransmit && _delivery.sampling) {
+        record_delivery_state(*seg);
+    }
+    if (len && _snd.cong.pacing_rate) {
+        auto gap = std::chrono::nanoseconds(uint64_t(len) * 1000000000 / _snd.cong.pacing_rate);
+        _next_send = std::max(steady_clock_type::now(), _next_send) + gap;
     }
 
 
@@ -1719,8 +2364,7 @@ void tcp<InetTraits>::tcb::connect() {
     _rcv.window_scale = _option._local_win_scale = 7;
     // Maximum segment size local can receive
     _rcv.mss = _option._local_mss = local_mss();
-    // Linux's default window size
-    _rcv.window = 29200 << _rcv.window_scale;
+    init_receive_window();
 
     do_syn_sent();
 }
@@ -1732,9 +2376,107 @@ packet tcp<InetTraits>::tcb::read() {
         p.append(std::move(q));
     }
     _rcv.data.clear();
+    release_received_data();
+    adjust_receive_space(p.len());
+    // If the window was about closed, or has grown, tell the peer about
+    // the room made
+    if (_rcv.advertised_window < advertised_window() / 2) {
+        output();
+    }
     return p;
 }
 
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::queue_received_data(packet p) {
+    _rcv.data_size += p.len();
+    receive_memory().charge(p.len());
+    _rcv.data.push_back(std::move(p));
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::release_received_data() {
+    receive_memory().release(_rcv.data_size);
+    _rcv.data_size = 0;
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::init_receive_window() {
+    _rcv.window = std::min(_tcp._max_receive_window, uint32_t(0xffff) << _rcv.window_scale);
+    // start with what an unscaled window can say, as Linux does
+    _rcv.space = std::min(_rcv.window, uint32_t(0xffff));
+    _rcv.space_time = steady_clock_type::now();
+    // what is out of order is within the window
+    _rcv.out_of_order.set_max_bytes(_rcv.window);
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::measure_receive_rtt() {
+    auto now = steady_clock_type::now();
+    steady_clock_type::duration m;
+    if (_ts_ecr) {
+        // the segment answers the ACK whose timestamp it echoes
+        auto ms = int32_t(ts_now() - _ts_ecr);
+        if (ms < 0) {
+            return;
+        }
+        m = std::chrono::milliseconds(std::max(ms, 1));
+    } else {
+        // time a window, from when it is advertised to when its end
+        // arrives; an overestimate when the sender is not limited by it
+        bool timing = _rcv.rtt_time != steady_clock_type::time_point();
+        if (timing && _rcv.next < _rcv.rtt_seq) {
+            return;
+        }
+        m = now - _rcv.rtt_time;
+        _rcv.rtt_seq = _rcv.next + std::max(_rcv.advertised_window, uint32_t(_rcv.mss));
+        _rcv.rtt_time = now;
+        if (!timing) {
+            return;
+        }
+    }
+    // as the window grows the samples grow less reliable, so the
+    // smallest one is kept, and larger ones are let in slowly
+    if (_rcv.rtt.count() == 0 || m < _rcv.rtt) {
+        _rcv.rtt = m;
+    } else {
+        _rcv.rtt += (m - _rcv.rtt) / 8;
+    }
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::adjust_receive_space(size_t copied) {
+    _rcv.space_copied += copied;
+    auto now = steady_clock_type::now();
+    if (_rcv.rtt.count() == 0 || now - _rcv.space_time < _rcv.rtt) {
+        return;
+    }
+    // As the shard's receive budget fills, the window is shrunk, and
+    // grows from there again once there is room
+    auto budget = receive_buffer_size(_rcv.space, _rcv.mss);
+    if (budget < _rcv.space) {
+        _rcv.space = budget;
+    } else {
+        // room for two round trips' reads, and some segments of slack,
+        // so that the sender can grow its rate while we measure it
+        auto wanted = 2 * _rcv.space_copied + 16 * _rcv.mss;
+        if (wanted > _rcv.space) {
+            _rcv.space = std::min(uint64_t(_rcv.window), wanted);
+        }
+    }
+    _rcv.space_copied = 0;
+    _rcv.space_time = now;
+}
+
+// The receive window, less the data not read yet, and shrunk as the shard's
+// receive budget fills. It is only advertised: segments are still accepted
+// within _rcv.window, so data the peer sent before the window shrank, or
+// grew less than it can, isn't dropped.
+template <typename InetTraits>
+uint32_t tcp<InetTraits>::tcb::advertised_window() const {
+    uint32_t window = receive_buffer_size(_rcv.space, _rcv.mss);
+    return window > _rcv.data_size ? window - _rcv.data_size : 0;
+}
+
 template <typename InetTraits>
 future<> tcp<InetTraits>::tcb::wait_send_available() {
     if (_snd.max_queue_space > _snd.current_queue_space) {
@@ -1826,43 +2568,35 @@ void tcp<InetTraits>::tcb::clear_delayed_ack() {
 template <typename InetTraits>
 bool tcp<InetTraits>::tcb::merge_out_of_order() {
     bool merged = false;
-    if (_rcv.out_of_order.map.empty()) {
-        return merged;
-    }
-    for (auto it = _rcv.out_of_order.map.begin(); it != _rcv.out_of_order.map.end();) {
-        auto& p = it->second;
-        auto seg_beg = it->first;
-        auto seg_len = p.len();
-        auto seg_end = seg_beg + seg_len;
-        if (seg_beg <= _rcv.next && _rcv.next < seg_end) {
-            // This segment has been received out of order and its previous
-            // segment has been received now
-            auto trim = _rcv.next - seg_beg;
-            if (trim) {
-                p.trim_front(trim);
-                seg_len -= trim;
+    // as the ranges do not touch, only the first can be reached
+    while (!_rcv.out_of_order.empty() && _rcv.out_of_order.ranges().front().begin <= _rcv.next) {
+        auto r = _rcv.out_of_order.pop_front();
+        if (r.end <= _rcv.next) {
+            // received again in order already
+            continue;
+        }
+        uint32_t trim = _rcv.next - r.begin;
+        for (auto&& p : r.segments) {
+            if (trim >= p.len()) {
+                trim -= p.len();
+                continue;
             }
-            _rcv.next += seg_len;
-            _rcv.data.push_back(std::move(p));
-            // Since c++11, erase() always returns the value of the following element
-            it = _rcv.out_of_order.map.erase(it);
-            merged = true;
-        } else if (_rcv.next >= seg_end) {
-            // This segment has been receive already, drop it
-            it = _rcv.out_of_order.map.erase(it);
-        } else {
-            // seg_beg > _rcv.need, can not merge. Note, seg_beg can grow only,
-            // so we can stop looking here.
-            it++;
-            break;
+            p.trim_front(trim);
+            trim = 0;
+            queue_received_data(std::move(p));
         }
+        _rcv.next = r.end;
+        merged = true;
     }
     return merged;
 }
 
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::insert_out_of_order(tcp_seq seg, packet p) {
-    _rcv.out_of_order.merge(seg, std::move(p));
+    _rcv.last_out_of_order = seg;
+    if (!_rcv.out_of_order.insert(seg, std::move(p))) {
+        ++_tcp._stats.out_of_order_drops;
+    }
 }
 
 template <typename InetTraits>
@@ -1881,7 +2615,7 @@ void tcp<InetTraits>::tcb::persist() {
 
     output();
     // Perform binary exponential back-off per RFC1122
-    _persist_time_out = std::min(_persist_time_out * 2, _rto_max);
+    _persist_time_out = std::min(_persist_time_out * 2, _tcp._rto_max);
     start_persist_timer();
 }
 
@@ -1890,7 +2624,7 @@ void tcp<InetTraits>::tcb::retransmit() {
     auto output_update_rto = [this] {
         output();
         // According to RFC6298, Update RTO <- RTO * 2 to perform binary exponential back-off
-        this->_rto = std::min(this->_rto * 2, this->_rto_max);
+        this->_rto = std::min(this->_rto * 2, this->_tcp._rto_max);
         start_retransmit_timer();
     };
 
@@ -1920,6 +2654,11 @@ void tcp<InetTraits>::tcb::retransmit() {
         return;
     }
 
+    // RFC2018: the remote may have dropped what it SACKed
+    for (auto& seg : _snd.data) {
+        seg.sacked = false;
+    }
+
     // If there are unacked data, retransmit the earliest segment
     auto& unacked_seg = _snd.data.front();
 
@@ -1927,12 +2666,12 @@ void tcp<InetTraits>::tcb::retransmit() {
     // Update ssthresh only for the first retransmit
     uint32_t smss = _snd.mss;
     if (unacked_seg.nr_transmits == 0) {
-        _snd.ssthresh = std::max(flight_size() / 2, 2 * smss);
+        _cc->on_loss(_snd.cong, flight_size());
     }
     // RFC6582 Step 4
     _snd.recover = _snd.next - 1;
     // Start the slow start process
-    _snd.cwnd = smss;
+    _snd.cong.cwnd = smss;
     // End fast recovery
     exit_fast_recovery();
 
@@ -1958,10 +2697,180 @@ void tcp<InetTraits>::tcb::fast_retransmit() {
     }
 }
 
+template <typename InetTraits>
+bool tcp<InetTraits>::tcb::update_scoreboard(const tcp_option::sack_blocks& sb, tcp_seq seg_ack) {
+    bool newly_sacked = false;
+    for (unsigned i = 0; i < sb.nr; ++i) {
+        auto left = make_seq(sb.blocks[i].first);
+        auto right = make_seq(sb.blocks[i].second);
+        // RFC2883: a first block below the cumulative ACK, or within the
+        // second block, is a D-SACK: it reports data received twice, rather
+        // than data received out of order
+        if (i == 0 && (right <= seg_ack || (sb.nr > 1 && make_seq(sb.blocks[1].first) <= left
+                && right <= make_seq(sb.blocks[1].second)))) {
+            ++_tcp._stats.dsacks_received;
+            continue;
+        }
+        if (right <= left || left < _snd.unacknowledged || right > _snd.next) {
+            // bogus, or about data acknowledged since
+            continue;
+        }
+        for (auto& seg : _snd.data) {
+            if (seg.seq >= right) {
+                break;
+            }
+            if (!seg.sacked && left <= seg.seq && seg.seq + seg.p.len() <= right) {
+                seg.sacked = true;
+                newly_sacked = true;
+                if (_delivery.sampling) {
+                    segment_delivered(seg, seg.p.len());
+                }
+            }
+        }
+    }
+    return newly_sacked;
+}
+
+template <typename InetTraits>
+bool tcp<InetTraits>::tcb::first_segment_lost() {
+    uint32_t sacked = 0;
+    for (auto& seg : _snd.data) {
+        if (seg.sacked) {
+            sacked += seg.p.len();
+        }
+    }
+    return !_snd.data.front().sacked && sacked > (dupthresh - 1) * _snd.mss;
+}
+
+template <typename InetTraits>
+uint32_t tcp<InetTraits>::tcb::pipe() {
+    uint32_t in_pipe = 0;
+    uint32_t sacked_above = 0;
+    for (auto i = _snd.data.rbegin(); i != _snd.data.rend(); ++i) {
+        auto len = i->p.len();
+        if (i->sacked) {
+            sacked_above += len;
+            continue;
+        }
+        // RFC6675 IsLost()
+        if (sacked_above <= (dupthresh - 1) * _snd.mss) {
+            in_pipe += len;
+        }
+        if (i->retransmitted) {
+            in_pipe += len;
+        }
+    }
+    return in_pipe;
+}
+
+template <typename InetTraits>
+typename tcp<InetTraits>::tcb::unacked_segment*
+tcp<InetTraits>::tcb::next_segment_to_retransmit(bool allow_not_lost) {
+    uint32_t sacked_above = 0;
+    for (auto& seg : _snd.data) {
+        if (seg.sacked) {
+            sacked_above += seg.p.len();
+        }
+    }
+    unacked_segment* not_lost = nullptr;
+    for (auto& seg : _snd.data) {
+        if (!sacked_above) {
+            // nothing the remote received beyond this
+            break;
+        }
+        if (seg.sacked) {
+            sacked_above -= seg.p.len();
+            continue;
+        }
+        if (seg.retransmitted) {
+            continue;
+        }
+        if (sacked_above > (dupthresh - 1) * _snd.mss) {
+            return &seg;
+        }
+        if (!not_lost) {
+            not_lost = &seg;
+        }
+    }
+    return allow_not_lost ? not_lost : nullptr;
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::enter_sack_recovery() {
+    tcp_debug("sack recovery: una=%d next=%d\n", _snd.unacknowledged, _snd.next);
+    // RFC6675 Step (4.1) and (4.2)
+    _snd.recover = _snd.next - 1;
+    _cc->on_loss(_snd.cong, flight_size());
+    _snd.cong.cwnd = _snd.cong.ssthresh;
+    _snd.sack_recovery = true;
+    ++_tcp._stats.sack_recoveries;
+    // RFC6675 Step (4.3): retransmit the first unacknowledged segment now,
+    // and the other losses as the pipe allows
+    auto& seg = _snd.data.front();
+    seg.retransmitted = true;
+    seg.nr_transmits++;
+    ++_tcp._stats.sack_retransmits;
+    retransmit_one(&seg);
+    output();
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::sack_recovery_output_one() {
+    // RFC6675 Step (C): NextSeg() rule 1 (lost segments), then rule 2 (new
+    // data, which output_one() sends as can_send() allows), then rule 3
+    if (_snd.cong.cwnd >= pipe() + _snd.mss) {
+        auto seg = next_segment_to_retransmit(false);
+        if (!seg && !can_send()) {
+            seg = next_segment_to_retransmit(true);
+        }
+        if (seg) {
+            seg->retransmitted = true;
+            seg->nr_transmits++;
+            ++_tcp._stats.sack_retransmits;
+            return retransmit_one(seg);
+        }
+    }
+    output_one();
+}
+
+template <typename InetTraits>
+bool tcp<InetTraits>::tcb::sack_recovery_can_send() {
+    if (_snd.cong.cwnd < pipe() + _snd.mss) {
+        return false;
+    }
+    return next_segment_to_retransmit(true) || (can_send() > 0 && _snd.window > 0);
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::update_local_sack() {
+    auto& sb = _option._local_sack;
+    sb.nr = 0;
+    // with the 10 bytes of timestamps, only three blocks fit
+    unsigned max_blocks = tcp_option::sack_blocks::max_blocks - (_option._timestamps_received ? 1 : 0);
+    for (auto&& r : _rcv.out_of_order.ranges()) {
+        auto left = r.begin;
+        auto right = r.end;
+        auto block = std::make_pair(left.raw, right.raw);
+        // RFC2018: the first block holds the most recently received segment
+        if (left <= _rcv.last_out_of_order && _rcv.last_out_of_order < right) {
+            auto n = sb.nr < max_blocks ? sb.nr + 1 : sb.nr;
+            std::copy_backward(sb.blocks.begin(), sb.blocks.begin() + n - 1, sb.blocks.begin() + n);
+            sb.blocks[0] = block;
+            sb.nr = n;
+        } else if (sb.nr < max_blocks) {
+            sb.blocks[sb.nr++] = block;
+        }
+    }
+}
+
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::update_rto(clock_type::time_point tx_time) {
+    update_rto(std::chrono::duration_cast<std::chrono::milliseconds>(clock_type::now() - tx_time));
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::update_rto(std::chrono::milliseconds R) {
     // Update RTO according to RFC6298
-    auto R = std::chrono::duration_cast<std::chrono::milliseconds>(clock_type::now() - tx_time);
     if (_snd.first_rto_sample) {
         _snd.first_rto_sample = false;
         // RTTVAR <- R/2
@@ -1976,36 +2885,124 @@ void tcp<InetTraits>::tcb::update_rto(clock_type::time_point tx_time) {
         _snd.rttvar = _snd.rttvar * 3 / 4 + delta / 4;
         _snd.srtt = _snd.srtt * 7 / 8 +  R / 8;
     }
+    _snd.cong.srtt = _snd.srtt;
     // RTO <- SRTT + max(G, K * RTTVAR)
     _rto =  _snd.srtt + std::max(_rto_clk_granularity, 4 * _snd.rttvar);
 
-    // Make sure 1 sec << _rto << 60 sec
-    _rto = std::max(_rto, _rto_min);
-    _rto = std::min(_rto, _rto_max);
+    // Make sure rto_min (1 sec by default) << _rto << rto_max (60 sec)
+    _rto = std::max(_rto, _tcp._rto_min);
+    _rto = std::min(_rto, _tcp._rto_max);
 }
 
 template <typename InetTraits>
-void tcp<InetTraits>::tcb::update_cwnd(uint32_t acked_bytes) {
-    uint32_t smss = _snd.mss;
-    if (_snd.cwnd < _snd.ssthresh) {
-        // In slow start phase
-        _snd.cwnd += std::min(acked_bytes, smss);
-    } else {
-        // In congestion avoidance phase
-        uint32_t round_up = 1;
-        _snd.cwnd += std::max(round_up, smss * smss / _snd.cwnd);
+void tcp<InetTraits>::tcb::update_cwnd(uint32_t acked_bytes, tcp_congestion_control::clock_type::time_point now) {
+    if (_snd.sack_recovery) {
+        // RFC6675: cwnd is set on leaving recovery, and does not grow in it
+        return;
+    }
+    _cc->on_ack(_snd.cong, acked_bytes, now);
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::set_congestion_control(std::unique_ptr<tcp_congestion_control> cc) {
+    _cc = std::move(cc);
+    _snd.cong.pacing_rate = 0;
+    _delivery = delivery();
+    _delivery.sampling = _cc->needs_rate_samples();
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::record_delivery_state(unacked_segment& seg) {
+    auto now = steady_clock_type::now();
+    if (_snd.data.size() == 1) {
+        // nothing else in flight: the sample interval starts now
+        _delivery.first_sent_time = now;
+        _delivery.delivered_time = now;
+    }
+    uint32_t in_flight = _snd.next - _snd.unacknowledged;
+    if (_snd.unsent_len == 0 && in_flight < _snd.cong.cwnd) {
+        // the application does not keep the window full
+        _delivery.app_limited = std::max<uint64_t>(_delivery.delivered + in_flight, 1);
+    }
+    seg.sent_time = now;
+    seg.delivered = _delivery.delivered;
+    seg.delivered_time = _delivery.delivered_time;
+    seg.first_sent_time = _delivery.first_sent_time;
+    seg.app_limited = _delivery.app_limited != 0;
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::segment_delivered(const unacked_segment& seg, uint32_t bytes) {
+    auto now = steady_clock_type::now();
+    _delivery.delivered += bytes;
+    _delivery.delivered_time = now;
+    _delivery.acked_bytes += bytes;
+    // not sent since sampling started
+    if (seg.sent_time == steady_clock_type::time_point()) {
+        return;
+    }
+    if (!_delivery.have_sample || seg.delivered >= _delivery.prior_delivered) {
+        _delivery.have_sample = true;
+        _delivery.prior_delivered = seg.delivered;
+        _delivery.prior_time = seg.delivered_time;
+        _delivery.send_elapsed = seg.sent_time - seg.first_sent_time;
+        _delivery.rtt = seg.nr_transmits ? std::chrono::microseconds(0)
+                : std::chrono::duration_cast<std::chrono::microseconds>(now - seg.sent_time);
+        _delivery.sample_app_limited = seg.app_limited;
+        _delivery.first_sent_time = seg.sent_time;
     }
 }
 
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::take_rate_sample() {
+    if (!_delivery.have_sample) {
+        return;
+    }
+    _delivery.have_sample = false;
+    if (_delivery.app_limited && _delivery.delivered > _delivery.app_limited) {
+        _delivery.app_limited = 0;
+    }
+    tcp_rate_sample rs;
+    rs.delivered = _delivery.delivered;
+    rs.prior_delivered = _delivery.prior_delivered;
+    // the slower of the send and the ACK rates, which ACK compression or
+    // bursts cannot inflate
+    auto ack_elapsed = _delivery.delivered_time - _delivery.prior_time;
+    rs.interval = std::chrono::duration_cast<std::chrono::microseconds>(std::max(_delivery.send_elapsed, ack_elapsed));
+    rs.rtt = _delivery.rtt;
+    rs.acked_bytes = _delivery.acked_bytes;
+    rs.bytes_in_flight = _snd.next - _snd.unacknowledged;
+    rs.app_limited = _delivery.sample_app_limited;
+    rs.in_recovery = _snd.sack_recovery || _snd.dupacks >= 3;
+    _delivery.acked_bytes = 0;
+    _cc->on_rate_sample(_snd.cong, rs, steady_clock_type::now());
+}
+
+template <typename InetTraits>
+bool tcp<InetTraits>::tcb::paced() {
+    if (steady_clock_type::now() >= _next_send) {
+        return false;
+    }
+    if (!_pacing.armed()) {
+        _pacing.arm(_next_send);
+    }
+    return true;
+}
+
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::cleanup() {
     _snd.unsent.clear();
     _snd.data.clear();
-    _rcv.out_of_order.map.clear();
+    _rcv.out_of_order.clear();
     _rcv.data.clear();
+    release_received_data();
     stop_retransmit_timer();
+    _pacing.cancel();
     clear_delayed_ack();
     remove_from_tcbs();
+    if (std::exchange(_listen_pending, false)) {
+        _tcp.drop_pending(_local_port);
+    }
 }
 
 template <typename InetTraits>
@@ -2016,8 +3013,8 @@ tcp_seq tcp<InetTraits>::tcb::get_isn() {
     //   M is the 4 microsecond timer
     using namespace std::chrono;
     uint32_t hash[4];
-    hash[0] = _local_ip.ip;
-    hash[1] = _foreign_ip.ip;
+    hash[0] = std::hash<ipaddr>()(_local_ip);
+    hash[1] = std::hash<ipaddr>()(_foreign_ip);
     hash[2] = (_local_port << 16) + _foreign_port;
     hash[3] = _isn_secret.key[15];
     CryptoPP::Weak::MD5::Transform(hash, _isn_secret.key);
@@ -2031,7 +3028,11 @@ template <typename InetTraits>
 std::experimental::optional<typename InetTraits::l4packet> tcp<InetTraits>::tcb::get_packet() {
     _poll_active = false;
     if (_packetq.empty()) {
-        output_one();
+        if (_snd.sack_recovery) {
+            sack_recovery_output_one();
+        } else {
+            output_one();
+        }
     }
 
     if (in_state(CLOSED)) {
@@ -2042,7 +3043,8 @@ std::experimental::optional<typename InetTraits::l4packet> tcp<InetTraits>::tcb:
 
     auto p = std::move(_packetq.front());
     _packetq.pop_front();
-    if (!_packetq.empty() || (_snd.dupacks < 3 && can_send() > 0 && (_snd.window > 0))) {
+    if (!_packetq.empty() || (_snd.sack_recovery && sack_recovery_can_send())
+            || (!_snd.sack_recovery && _snd.dupacks < 3 && can_send() > 0 && (_snd.window > 0))) {
         // If there are packets to send in the queue or tcb is allowed to send
         // more add tcp back to polling set to keep sending. In addition, dupacks >= 3
         // is an indication that an segment is lost, stop sending more in this case.
@@ -2077,10 +3079,7 @@ template <typename InetTraits>
 constexpr uint16_t tcp<InetTraits>::tcb::_max_nr_retransmit;
 
 template <typename InetTraits>
-constexpr std::chrono::milliseconds tcp<InetTraits>::tcb::_rto_min;
-
-template <typename InetTraits>
-constexpr std::chrono::milliseconds tcp<InetTraits>::tcb::_rto_max;
+constexpr unsigned tcp<InetTraits>::tcb::dupthresh;
 
 template <typename InetTraits>
 constexpr std::chrono::milliseconds tcp<InetTraits>::tcb::_rto_clk_granularity;
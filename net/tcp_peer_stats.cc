@@ -0,0 +1,95 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include "tcp_peer_stats.hh"
+#include "core/metrics.hh"
+
+namespace seastar {
+
+namespace net {
+
+tcp_peer_stats::tcp_peer_stats(sstring name, size_t max_peers)
+        : _name(std::move(name))
+        , _max_peers(std::max<size_t>(max_peers, 1)) {
+}
+
+void tcp_peer_stats::register_metrics(peer& p) {
+    namespace sm = metrics;
+    static auto stats_label = sm::label("stats");
+    static auto peer_label = sm::label("peer");
+    std::vector<sm::label_instance> labels = { stats_label(_name), peer_label(p.name) };
+    auto& s = p.summary;
+    p.metrics.add_group("tcp_peer", {
+        sm::make_derive("samples", s.samples, sm::description("Connection samples taken"), labels),
+        sm::make_gauge("rtt_us", [&s] { return s.rtt.count(); },
+                sm::description("Moving average of the sampled smoothed round-trip times, in microseconds"), labels),
+        sm::make_gauge("rtt_var_us", [&s] { return s.rtt_var.count(); },
+                sm::description("Moving average of the sampled round-trip time variations, in microseconds"), labels),
+        sm::make_gauge("max_rtt_us", [&s] { return s.max_rtt.count(); },
+                sm::description("Highest sampled round-trip time, in microseconds"), labels),
+        sm::make_gauge("cwnd", s.cwnd, sm::description("Last sampled congestion window, in bytes"), labels),
+        sm::make_gauge("bytes_in_flight", s.bytes_in_flight, sm::description("Last sampled unacknowledged bytes"), labels),
+    });
+}
+
+void tcp_peer_stats::record(const sstring& name, const tcp_connection_info& info) {
+    auto i = _index.find(name);
+    if (i == _index.end()) {
+        if (_peers.size() == _max_peers) {
+            _index.erase(_peers.back().name);
+            _peers.pop_back();
+        }
+        _peers.emplace_front();
+        _peers.front().name = name;
+        register_metrics(_peers.front());
+        i = _index.emplace(name, _peers.begin()).first;
+    } else {
+        _peers.splice(_peers.begin(), _peers, i->second);
+    }
+    auto& s = i->second->summary;
+    auto average = [first = !s.samples] (std::chrono::microseconds& avg, std::chrono::microseconds sample) {
+        avg = first ? sample : avg + (sample - avg) / 8;
+    };
+    average(s.rtt, info.rtt);
+    average(s.rtt_var, info.rtt_var);
+    s.max_rtt = std::max(s.max_rtt, info.rtt);
+    s.cwnd = info.cwnd;
+    s.bytes_in_flight = info.bytes_in_flight;
+    ++s.samples;
+}
+
+auto tcp_peer_stats::get(const sstring& name) const -> const peer_summary* {
+    auto i = _index.find(name);
+    return i == _index.end() ? nullptr : &i->second->summary;
+}
+
+void tcp_peer_stats::forget(const sstring& name) {
+    auto i = _index.find(name);
+    if (i != _index.end()) {
+        _peers.erase(i->second);
+        _index.erase(i);
+    }
+}
+
+}
+
+}
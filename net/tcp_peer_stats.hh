@@ -0,0 +1,95 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <list>
+#include <unordered_map>
+#include "api.hh"
+#include "core/metrics_registration.hh"
+#include "core/sstring.hh"
+
+namespace seastar {
+
+namespace net {
+
+/// \addtogroup networking-module
+/// @{
+
+/// Aggregates \ref tcp_connection_info samples of the connections to each
+/// peer, for spotting the peers behind latency outliers and for client
+/// side load balancing.
+///
+/// The application samples its connections (with
+/// \ref connected_socket::get_tcp_info()), for instance after each
+/// request, under a name of its choosing for the peer, such as its
+/// address. The aggregates are exported as metrics of the "tcp_peer"
+/// group, labelled with the name of the aggregator, which must be unique
+/// on the shard, and of the peer. At most \c max_peers peers are tracked,
+/// the least recently sampled one being dropped to make room for another.
+class tcp_peer_stats {
+public:
+    struct peer_summary {
+        uint64_t samples = 0;
+        /// Moving averages of the sampled values, weighing the last
+        /// sample by 1/8 as TCP smooths its round-trip time
+        std::chrono::microseconds rtt{0};
+        std::chrono::microseconds rtt_var{0};
+        /// Highest sampled round-trip time
+        std::chrono::microseconds max_rtt{0};
+        /// As last sampled
+        uint32_t cwnd = 0;
+        uint32_t bytes_in_flight = 0;
+    };
+private:
+    struct peer {
+        sstring name;
+        peer_summary summary;
+        metrics::metric_groups metrics;
+    };
+    using peer_list = std::list<peer>;
+    sstring _name;
+    size_t _max_peers;
+    peer_list _peers; // most recently sampled first
+    std::unordered_map<sstring, peer_list::iterator> _index;
+private:
+    void register_metrics(peer& p);
+public:
+    explicit tcp_peer_stats(sstring name, size_t max_peers = 1024);
+    tcp_peer_stats(const tcp_peer_stats&) = delete;
+    tcp_peer_stats& operator=(const tcp_peer_stats&) = delete;
+    void record(const sstring& peer, const tcp_connection_info& info);
+    /// The aggregates of peer, or nullptr if it is not tracked
+    const peer_summary* get(const sstring& peer) const;
+    /// Stops tracking peer, for instance once it left the cluster
+    void forget(const sstring& peer);
+    size_t size() const {
+        return _peers.size();
+    }
+};
+
+/// @}
+
+}
+
+}
@@ -21,15 +21,20 @@
 
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
+#include <linux/tls.h>
 
 #include <experimental/optional>
+#include <list>
 #include <system_error>
+#include <unordered_map>
+#include <vector>
 
 #include "core/reactor.hh"
 #include "core/thread.hh"
 #include "core/sstring.hh"
 #include "core/semaphore.hh"
 #include "core/timer.hh"
+#include "core/metrics.hh"
 #include "tls.hh"
 #include "stack.hh"
 
@@ -40,6 +45,9 @@ class net::get_impl {
     static std::unique_ptr<connected_socket_impl> get(connected_socket s) {
         return std::move(s._csi);
     }
+    static connected_socket_impl* peek(connected_socket& s) {
+        return s._csi.get();
+    }
 };
 
 class blob_wrapper: public gnutls_datum_t {
@@ -313,7 +321,72 @@ class tls::certificate_credentials::impl: public gnutlsobj {
     gnutls_priority_t get_priority() const {
         return _priority.get();
     }
+    void set_session_ticket_key(const blob& key) {
+        // the size of a gnutls_session_ticket_key_generate() key
+        if (key.size() != 64) {
+            throw std::invalid_argument(sprint("Session ticket key must be 64 bytes, not %d", key.size()));
+        }
+        _session_ticket_key = sstring(key.data(), key.size());
+    }
+    const sstring& session_ticket_key() const {
+        return _session_ticket_key;
+    }
+    void set_session_cache_size(size_t max_servers) {
+        _session_cache_size = max_servers;
+        while (_sessions.size() > _session_cache_size) {
+            drop_session(std::prev(_sessions.end()));
+        }
+    }
+    bool caches_sessions() const {
+        return _session_cache_size != 0;
+    }
+    void set_kernel_tls(bool enable) {
+        _kernel_tls = enable;
+    }
+    bool kernel_tls() const {
+        return _kernel_tls;
+    }
+    void set_handshake_offload(bool enable) {
+        _handshake_offload = enable;
+    }
+    bool offloads_handshakes() const {
+        return _handshake_offload;
+    }
+    void set_alpn_protocols(std::vector<sstring> protocols) {
+        _alpn_protocols = std::move(protocols);
+    }
+    const std::vector<sstring>& alpn_protocols() const {
+        return _alpn_protocols;
+    }
+    const sstring* find_session(const sstring& server) {
+        auto i = _session_index.find(server);
+        if (i == _session_index.end()) {
+            return nullptr;
+        }
+        _sessions.splice(_sessions.begin(), _sessions, i->second);
+        return &i->second->second;
+    }
+    void cache_session(const sstring& server, sstring data) {
+        auto i = _session_index.find(server);
+        if (i != _session_index.end()) {
+            i->second->second = std::move(data);
+            _sessions.splice(_sessions.begin(), _sessions, i->second);
+            return;
+        }
+        if (_sessions.size() == _session_cache_size) {
+            drop_session(std::prev(_sessions.end()));
+        }
+        _sessions.emplace_front(server, std::move(data));
+        _session_index.emplace(server, _sessions.begin());
+    }
 private:
+    using session_list = std::list<std::pair<sstring, sstring>>;
+
+    void drop_session(session_list::iterator i) {
+        _session_index.erase(i->first);
+        _sessions.erase(i);
+    }
+
     friend class credentials_builder;
     friend class session;
 
@@ -335,6 +408,15 @@ class tls::certificate_credentials::impl: public gnutlsobj {
     client_auth _client_auth = client_auth::NONE;
     bool _load_system_trust = false;
     semaphore _system_trust_sem {1};
+    sstring _session_ticket_key;
+    bool _kernel_tls = false;
+    bool _handshake_offload = false;
+    std::vector<sstring> _alpn_protocols;
+    // client sessions to resume: (server name, session data), most
+    // recently used first
+    size_t _session_cache_size = 0;
+    session_list _sessions;
+    std::unordered_map<sstring, session_list::iterator> _session_index;
 };
 
 tls::certificate_credentials::certificate_credentials()
@@ -408,6 +490,22 @@ void tls::certificate_credentials::set_priority_string(const sstring& prio) {
     _impl->set_priority_string(prio);
 }
 
+void tls::certificate_credentials::enable_session_cache(size_t max_servers) {
+    _impl->set_session_cache_size(max_servers);
+}
+
+void tls::certificate_credentials::enable_kernel_tls() {
+    _impl->set_kernel_tls(true);
+}
+
+void tls::certificate_credentials::enable_handshake_offload() {
+    _impl->set_handshake_offload(true);
+}
+
+void tls::certificate_credentials::set_alpn_protocols(std::vector<sstring> protocols) {
+    _impl->set_alpn_protocols(std::move(protocols));
+}
+
 tls::server_credentials::server_credentials(shared_ptr<dh_params> dh)
     : server_credentials(*dh)
 {}
@@ -424,6 +522,19 @@ void tls::server_credentials::set_client_auth(client_auth ca) {
     _impl->set_client_auth(ca);
 }
 
+void tls::server_credentials::enable_session_tickets(const blob& key) {
+    _impl->set_session_ticket_key(key);
+}
+
+sstring tls::generate_session_ticket_key() {
+    gnutlsobj init;
+    gnutls_datum_t key;
+    gtls_chk(gnutls_session_ticket_key_generate(&key));
+    sstring res(reinterpret_cast<const char*>(key.data), key.size);
+    gnutls_free(key.data);
+    return res;
+}
+
 static const sstring dh_level_key = "dh_level";
 static const sstring x509_trust_key = "x509_trust";
 static const sstring x509_crl_key = "x509_crl";
@@ -475,6 +586,27 @@ void tls::credentials_builder::set_priority_string(const sstring& prio) {
     _priority = prio;
 }
 
+void tls::credentials_builder::enable_session_cache(size_t max_servers) {
+    _session_cache_size = max_servers;
+}
+
+void tls::credentials_builder::enable_kernel_tls() {
+    _kernel_tls = true;
+}
+
+void tls::credentials_builder::enable_handshake_offload() {
+    _handshake_offload = true;
+}
+
+void tls::credentials_builder::set_alpn_protocols(std::vector<sstring> protocols) {
+    _alpn_protocols = std::move(protocols);
+}
+
+void tls::credentials_builder::enable_session_tickets(const blob& key) {
+    // generated here, so that the credentials built on all shards share it
+    _session_ticket_key = key.empty() ? generate_session_ticket_key() : sstring(key.data(), key.size());
+}
+
 void tls::credentials_builder::apply_to(certificate_credentials& creds) const {
     // Could potentially be templated down, but why bother...
     {
@@ -520,6 +652,10 @@ void tls::credentials_builder::apply_to(certificate_credentials& creds) const {
     }
 
     creds._impl->set_client_auth(_client_auth);
+    creds._impl->set_session_cache_size(_session_cache_size);
+    creds._impl->set_kernel_tls(_kernel_tls);
+    creds._impl->set_handshake_offload(_handshake_offload);
+    creds._impl->set_alpn_protocols(_alpn_protocols);
 }
 
 shared_ptr<tls::certificate_credentials> tls::credentials_builder::build_certificate_credentials() const {
@@ -535,11 +671,110 @@ shared_ptr<tls::server_credentials> tls::credentials_builder::build_server_crede
     }
     auto creds = make_shared<server_credentials>(dh_params(boost::any_cast<dh_params::level>(i->second)));
     apply_to(*creds);
+    if (!_session_ticket_key.empty()) {
+        creds->enable_session_tickets(_session_ticket_key);
+    }
     return creds;
 }
 
 namespace tls {
 
+template <typename CryptoInfo>
+static sstring aes_gcm_crypto_info(unsigned cipher, bool tls13, const gnutls_datum_t& iv,
+        const gnutls_datum_t& key, const unsigned char* seq) {
+    CryptoInfo info = {};
+    constexpr auto salt_size = sizeof(info.salt);
+    constexpr auto iv_size = sizeof(info.iv);
+    if (key.size != sizeof(info.key) || iv.size < (tls13 ? salt_size + iv_size : salt_size)) {
+        return {};
+    }
+    info.info.cipher_type = cipher;
+#ifdef TLS_1_3_VERSION
+    info.info.version = tls13 ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+#else
+    info.info.version = TLS_1_2_VERSION;
+#endif
+    // the explicit part of TLS 1.2 nonces starts as the sequence number
+    std::copy_n(tls13 ? iv.data + salt_size : seq, iv_size, info.iv);
+    std::copy_n(iv.data, salt_size, info.salt);
+    std::copy_n(key.data, sizeof(info.key), info.key);
+    std::copy_n(seq, sizeof(info.rec_seq), info.rec_seq);
+    return sstring(reinterpret_cast<const char*>(&info), sizeof(info));
+}
+
+// The kTLS transmit parameters continuing the write state of session,
+// or an empty string if the kernel cannot take it over
+static sstring kernel_tls_transmit_info(gnutls_session_t session) {
+    bool tls13 = false;
+    switch (gnutls_protocol_get_version(session)) {
+    case GNUTLS_TLS1_2:
+        break;
+#if GNUTLS_VERSION_NUMBER >= 0x030603 && defined(TLS_1_3_VERSION)
+    case GNUTLS_TLS1_3:
+        tls13 = true;
+        break;
+#endif
+    default:
+        return {};
+    }
+    gnutls_datum_t mac_key, iv, key;
+    unsigned char seq[8];
+    if (gnutls_record_get_state(session, 0, &mac_key, &iv, &key, seq) < 0) {
+        return {};
+    }
+    switch (gnutls_cipher_get(session)) {
+    case GNUTLS_CIPHER_AES_128_GCM:
+        return aes_gcm_crypto_info<tls12_crypto_info_aes_gcm_128>(TLS_CIPHER_AES_GCM_128, tls13, iv, key, seq);
+#ifdef TLS_CIPHER_AES_GCM_256
+    case GNUTLS_CIPHER_AES_256_GCM:
+        return aes_gcm_crypto_info<tls12_crypto_info_aes_gcm_256>(TLS_CIPHER_AES_GCM_256, tls13, iv, key, seq);
+#endif
+    default:
+        return {};
+    }
+}
+
+// Handshakes of the shard's sessions
+struct handshake_stats {
+    using clock_type = std::chrono::steady_clock;
+    uint64_t handshakes = 0;
+    clock_type::duration handshake_time = {};
+    // handshake steps run as stealable tasks
+    uint64_t offloaded_steps = 0;
+    uint64_t stolen_steps = 0;
+    size_t queued_steps = 0;
+    clock_type::duration queue_time = {};
+    clock_type::duration step_time = {};
+    metrics::metric_groups metrics;
+
+    handshake_stats() {
+        namespace sm = metrics;
+        auto us = [] (const clock_type::duration& d) {
+            return [&d] { return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); };
+        };
+        metrics.add_group("tls", {
+            sm::make_derive("handshakes", handshakes, sm::description("Handshakes completed")),
+            sm::make_derive("handshake_time_us", us(handshake_time),
+                    sm::description("Total time from the start to the end of the completed handshakes, in microseconds")),
+            sm::make_derive("offloaded_handshake_steps", offloaded_steps,
+                    sm::description("Handshake steps run as stealable tasks")),
+            sm::make_derive("stolen_handshake_steps", stolen_steps,
+                    sm::description("Offloaded handshake steps run by another shard")),
+            sm::make_queue_length("offloaded_handshake_queue_length", queued_steps,
+                    sm::description("Offloaded handshake steps waiting to run, or running")),
+            sm::make_derive("offloaded_handshake_queue_time_us", us(queue_time),
+                    sm::description("Total time offloaded handshake steps waited before running, in microseconds")),
+            sm::make_derive("offloaded_handshake_step_time_us", us(step_time),
+                    sm::description("Total time spent running offloaded handshake steps, in microseconds")),
+        });
+    }
+};
+
+static handshake_stats& get_handshake_stats() {
+    static thread_local handshake_stats stats;
+    return stats;
+}
+
 /**
  * Session wraps gnutls session, and is the
  * actual conduit for an TLS/SSL data flow.
@@ -583,6 +818,17 @@ class session : public enable_lw_shared_from_this<session> {
                     gnutls_certificate_server_set_request(*this, GNUTLS_CERT_REQUIRE);
                     break;
             }
+            auto& key = _creds->_impl->session_ticket_key();
+            if (!key.empty()) {
+                blob_wrapper w(key);
+                gtls_chk(gnutls_session_ticket_enable_server(*this, &w));
+            }
+        }
+        if (_type == type::CLIENT && !_hostname.empty() && _creds->_impl->caches_sessions()) {
+            // a session the server no longer knows just gets a full handshake
+            if (auto data = _creds->_impl->find_session(_hostname)) {
+                gtls_chk(gnutls_session_set_data(*this, data->data(), data->size()));
+            }
         }
 
         auto prio = _creds->_impl->get_priority();
@@ -590,6 +836,16 @@ class session : public enable_lw_shared_from_this<session> {
             gtls_chk(gnutls_priority_set(*this, prio));
         }
 
+        auto& protocols = _creds->_impl->alpn_protocols();
+        if (!protocols.empty()) {
+            std::vector<gnutls_datum_t> names;
+            for (auto& p : protocols) {
+                names.push_back(gnutls_datum_t{reinterpret_cast<unsigned char*>(const_cast<char*>(p.data())), unsigned(p.size())});
+            }
+            gtls_chk(gnutls_alpn_set_protocols(*this, names.data(), names.size(),
+                    _type == type::SERVER ? GNUTLS_ALPN_SERVER_PRECEDENCE : 0));
+        }
+
         gnutls_transport_set_ptr(*this, this);
         gnutls_transport_set_vec_push_function(*this, &vec_push_wrapper);
         gnutls_transport_set_pull_function(*this, &pull_wrapper);
@@ -625,8 +881,51 @@ class session : public enable_lw_shared_from_this<session> {
         if (_connected) {
             return make_ready_future<>();
         }
-        try {
+        if (_creds->_impl->offloads_handshakes()) {
+            return do_offloaded_handshake();
+        }
+        return handshake_step_done(gnutls_handshake(*this));
+    }
+    // Runs the next gnutls_handshake() call, the one that does the public
+    // key operations, as a stealable task. While it runs, on whichever shard,
+    // the session must not be touched: the handshake holds both semaphores,
+    // pull() only reads _input, and vec_push() leaves the records it is
+    // given in _offloaded_output, which is sent from this shard afterwards.
+    future<> do_offloaded_handshake() {
+        using clock_type = handshake_stats::clock_type;
+        struct step_result {
+            int res;
+            bool stolen;
+            clock_type::duration queue_time;
+            clock_type::duration run_time;
+        };
+        auto& stats = get_handshake_stats();
+        ++stats.queued_steps;
+        _offloading = true;
+        return smp::submit_stealable([this, origin = engine().cpu_id(), queued = clock_type::now()] {
+            auto started = clock_type::now();
             auto res = gnutls_handshake(*this);
+            return step_result{res, engine().cpu_id() != origin, started - queued, clock_type::now() - started};
+        }).then([this, me = shared_from_this(), &stats] (step_result r) {
+            _offloading = false;
+            --stats.queued_steps;
+            ++stats.offloaded_steps;
+            stats.stolen_steps += r.stolen;
+            stats.queue_time += r.queue_time;
+            stats.step_time += r.run_time;
+            if (!_offloaded_output.empty()) {
+                temporary_buffer<char> buf(_offloaded_output.data(), _offloaded_output.size());
+                _offloaded_output.clear();
+                _output_pending = _output_pending.then([this, buf = std::move(buf)] () mutable {
+                    return _out.put(std::move(buf));
+                });
+            }
+            return handshake_step_done(r.res);
+        });
+    }
+    // Acts on the result of a gnutls_handshake() call
+    future<> handshake_step_done(int res) {
+        try {
             if (res < 0) {
                 switch (res) {
                 case GNUTLS_E_AGAIN:
@@ -655,8 +954,16 @@ class session : public enable_lw_shared_from_this<session> {
                 verify();
             }
             _connected = true;
+            save_session();
             // make sure we reset output_pending
-            return wait_for_output();
+            return wait_for_output().then([this] {
+                // the handshake is all sent, so what follows can be
+                // encrypted by the kernel
+                if (_creds->_impl->kernel_tls()) {
+                    auto info = kernel_tls_transmit_info(*this);
+                    _kernel_transmit = !info.empty() && _sock->set_kernel_tls_transmit(info.data(), info.size());
+                }
+            });
         } catch (...) {
             return make_exception_future<>(std::current_exception());
         }
@@ -672,7 +979,15 @@ class session : public enable_lw_shared_from_this<session> {
         // acquire both semaphores to sync both read & write
         return with_semaphore(_in_sem, 1, [this] {
             return with_semaphore(_out_sem, 1, [this] {
-                return do_handshake();
+                if (_connected) {
+                    return make_ready_future<>();
+                }
+                auto started = handshake_stats::clock_type::now();
+                return do_handshake().then([started] {
+                    auto& stats = get_handshake_stats();
+                    ++stats.handshakes;
+                    stats.handshake_time += handshake_stats::clock_type::now() - started;
+                });
             });
         });
     }
@@ -722,6 +1037,28 @@ class session : public enable_lw_shared_from_this<session> {
         return from_transport_ptr(ptr)->pull(dst, len);
     }
 
+    // Keeps the client session in the credentials, for the next
+    // connection to the same server to resume
+    void save_session() {
+        if (_type != type::CLIENT || _hostname.empty() || !_connected || _error
+                || !_creds->_impl->caches_sessions()) {
+            return;
+        }
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+        // TLS 1.3 sessions can only be resumed with a ticket, which the
+        // server sends after the handshake; close() tries again
+        if (gnutls_protocol_get_version(*this) == GNUTLS_TLS1_3
+                && !(gnutls_session_get_flags(*this) & GNUTLS_SFLAGS_SESSION_TICKET)) {
+            return;
+        }
+#endif
+        gnutls_datum_t data;
+        if (gnutls_session_get_data2(*this, &data) == GNUTLS_E_SUCCESS) {
+            _creds->_impl->cache_session(_hostname, sstring(reinterpret_cast<const char*>(data.data), data.size));
+            gnutls_free(data.data);
+        }
+    }
+
     void verify() {
         unsigned int status;
         auto res = gnutls_certificate_verify_peers3(*this,
@@ -783,6 +1120,11 @@ class session : public enable_lw_shared_from_this<session> {
                     // server requests new HS. must release semaphore, so set new state
                     // and return nada.
                     assert(_type == type::CLIENT); // should never get this in server session
+                    if (_kernel_transmit) {
+                        // the kernel has our write state now
+                        _error = true;
+                        return make_exception_future<temporary_buffer<char>>(std::system_error(n, glts_errorc));
+                    }
                     _connected = false;
                     return make_ready_future<temporary_buffer<char>>();
                 default:
@@ -807,6 +1149,9 @@ class session : public enable_lw_shared_from_this<session> {
 
     typedef net::fragment* frag_iter;
 
+    // Writes are corked: gnutls buffers the plain text, rather than sending
+    // a record for each fragment, until a full record's worth is buffered
+    // or the stream is flushed, see uncork().
     future<> do_put(frag_iter i, frag_iter e) {
         assert(_output_pending.available());
         return do_for_each(i, e, [this](net::fragment& f) {
@@ -817,18 +1162,46 @@ class session : public enable_lw_shared_from_this<session> {
                 if (off == size) {
                     return make_ready_future<stop_iteration>(stop_iteration::yes);
                 }
-                auto res = gnutls_record_send(*this, ptr + off, size - off);
-                if (res > 0) { // don't really need to check, but...
-                    off += res;
+                if (!_corked) {
+                    gnutls_record_cork(*this);
+                }
+                auto res = gnutls_record_send(*this, ptr + off, std::min(size - off, max_record_size - _corked));
+                if (res < 0) {
+                    return handle_output_error(res).then([] {
+                        return make_ready_future<stop_iteration>(stop_iteration::no);
+                    });
                 }
-                // what will we wait for? error or results...
-                auto f = res < 0 ? handle_output_error(res) : wait_for_output();
-                return f.then([] {
+                off += res;
+                _corked += res;
+                if (_corked < max_record_size) {
+                    return make_ready_future<stop_iteration>(stop_iteration::no);
+                }
+                return uncork().then([] {
                     return make_ready_future<stop_iteration>(stop_iteration::no);
                 });
             });
         });
     }
+    // Sends what was corked, as records that vec_push() gathers into a
+    // single packet. Must hold _out_sem.
+    future<> uncork() {
+        if (!_corked || _error) {
+            return make_ready_future<>();
+        }
+        assert(_output_pending.available());
+        _gathering = true;
+        auto res = gnutls_record_uncork(*this, 0);
+        _gathering = false;
+        _corked = 0;
+        auto gathered = std::exchange(_gathered, net::packet());
+        if (res < 0) {
+            return handle_output_error(res);
+        }
+        if (gathered.len()) {
+            _output_pending = _out.put(std::move(gathered));
+        }
+        return wait_for_output();
+    }
     future<> put(net::packet p) {
         if (_error || _shutdown) {
             return make_exception_future<>(std::system_error(EINVAL, std::system_category()));
@@ -838,10 +1211,35 @@ class session : public enable_lw_shared_from_this<session> {
                return put(std::move(p));
             });
         }
+        if (_kernel_transmit) {
+            return with_semaphore(_out_sem, 1, [this, p = std::move(p)] () mutable {
+                return _out.put(std::move(p));
+            });
+        }
         auto i = p.fragments().begin();
         auto e = p.fragments().end();
         return with_semaphore(_out_sem, 1, std::bind(&session::do_put, this, i, e)).finally([p = std::move(p)] {});
     }
+    bool kernel_transmits() const {
+        return _kernel_transmit;
+    }
+    // Only once handshaken
+    sstring alpn_protocol() {
+        gnutls_datum_t p;
+        if (gnutls_alpn_get_selected_protocol(*this, &p) != GNUTLS_E_SUCCESS) {
+            return {};
+        }
+        return sstring(reinterpret_cast<const char*>(p.data), p.size);
+    }
+    // Only once kernel_transmits()
+    future<> put_file(file& f, uint64_t offset, uint64_t len) {
+        if (_error || _shutdown) {
+            return make_exception_future<>(std::system_error(EINVAL, std::system_category()));
+        }
+        return with_semaphore(_out_sem, 1, [this, &f, offset, len] {
+            return _out.put_file(f, offset, len);
+        });
+    }
 
     ssize_t pull(void* dst, size_t len) {
         if (eof()) {
@@ -859,6 +1257,46 @@ class session : public enable_lw_shared_from_this<session> {
         return n;
     }
     ssize_t vec_push(const giovec_t * iov, int iovcnt) {
+        if (_kernel_transmit) {
+            // gnutls' write state is stale, so it may not send records
+            // (key updates, alerts) any more
+            gnutls_transport_set_errno(*this, EIO);
+            return -1;
+        }
+        if (_offloading) {
+            // possibly on another shard: see do_offloaded_handshake()
+            try {
+                size_t n = 0;
+                for (int i = 0; i < iovcnt; ++i) {
+                    auto p = reinterpret_cast<const char *>(iov[i].iov_base);
+                    _offloaded_output.insert(_offloaded_output.end(), p, p + iov[i].iov_len);
+                    n += iov[i].iov_len;
+                }
+                return n;
+            } catch (...) {
+                gnutls_transport_set_errno(*this, EIO);
+                return -1;
+            }
+        }
+        if (_gathering) {
+            // see uncork(); one buffer for all of this push's records
+            try {
+                size_t n = 0;
+                for (int i = 0; i < iovcnt; ++i) {
+                    n += iov[i].iov_len;
+                }
+                temporary_buffer<char> buf(n);
+                auto p = buf.get_write();
+                for (int i = 0; i < iovcnt; ++i) {
+                    p = std::copy_n(reinterpret_cast<const char *>(iov[i].iov_base), iov[i].iov_len, p);
+                }
+                _gathered = net::packet(std::move(_gathered), std::move(buf));
+                return n;
+            } catch (...) {
+                gnutls_transport_set_errno(*this, EIO);
+                return -1;
+            }
+        }
         if (!_output_pending.available()) {
             gnutls_transport_set_errno(*this, EAGAIN);
             return -1;
@@ -901,6 +1339,16 @@ class session : public enable_lw_shared_from_this<session> {
         if (_error || !_connected) {
             return make_ready_future();
         }
+        if (_kernel_transmit) {
+            // close_notify warning alert
+            static constexpr uint8_t alert_record_type = 21;
+            static const char close_notify[] = { 1, 0 };
+            return _sock->send_kernel_tls_record(alert_record_type,
+                    temporary_buffer<char>(close_notify, sizeof(close_notify))).handle_exception([this] (auto ep) {
+                _error = true;
+                return make_exception_future(ep);
+            });
+        }
         auto res = gnutls_bye(*this, GNUTLS_SHUT_WR);
         if (res < 0) {
             switch (res) {
@@ -943,13 +1391,15 @@ class session : public enable_lw_shared_from_this<session> {
         // read from input until we see EOF. Any other reader
         // before us will get it instead of us, and mark _eof = true
         // in which case we will be no-op.
-        return with_semaphore(_out_sem, 1,
-                        std::bind(&session::do_shutdown, this)).then(
+        return with_semaphore(_out_sem, 1, [this] {
+                            return uncork().then(std::bind(&session::do_shutdown, this));
+                        }).then(
                         std::bind(&session::wait_for_eof, this));
     }
     void close() {
         // only do once.
         if (!std::exchange(_shutdown, true)) {
+            save_session();
             auto me = shared_from_this();
             // running in background. try to bye-handshake us nicely, but after 10s we forcefully close.
             with_timeout(timer<>::clock::now() + std::chrono::seconds(10), shutdown()).finally([this] {
@@ -967,7 +1417,11 @@ class session : public enable_lw_shared_from_this<session> {
     }
     // helper for sink
     future<> flush() {
-        return _out.flush();
+        return with_semaphore(_out_sem, 1, [this] {
+            return uncork();
+        }).then([this] {
+            return _out.flush();
+        });
     }
 
     seastar::net::connected_socket_impl & socket() const {
@@ -990,8 +1444,18 @@ class session : public enable_lw_shared_from_this<session> {
     bool _shutdown = false;
     bool _connected = false;
     bool _error = false;
+    bool _kernel_transmit = false;
+    bool _offloading = false;
+    bool _gathering = false;
+
+    // plain text bytes gnutls holds corked, and the records of the current
+    // uncork(), see do_put()
+    static constexpr size_t max_record_size = 16384;
+    size_t _corked = 0;
+    net::packet _gathered;
 
     future<> _output_pending;
+    std::vector<char> _offloaded_output;
     buf_type _input;
 
     // modify this to a unique_ptr to handle exceptions in our constructor.
@@ -1056,6 +1520,18 @@ class tls_connected_socket_impl : public net::connected_socket_impl, public sess
     net::keepalive_params get_keepalive_parameters() const override {
         return _session->socket().get_keepalive_parameters();
     }
+    void set_congestion_control(const sstring& name) override {
+        _session->socket().set_congestion_control(name);
+    }
+    sstring get_congestion_control() const override {
+        return _session->socket().get_congestion_control();
+    }
+    net::tcp_connection_info get_tcp_info() const override {
+        return _session->socket().get_tcp_info();
+    }
+    void set_zero_copy_threshold(size_t bytes) override {
+        _session->socket().set_zero_copy_threshold(bytes);
+    }
 };
 
 
@@ -1086,6 +1562,12 @@ class tls_connected_socket_impl::sink_impl: public data_sink_impl, public sessio
     future<> put(net::packet p) override {
         return _session->put(std::move(p));
     }
+    future<> put_file(file& f, uint64_t offset, uint64_t len) override {
+        if (_session->kernel_transmits()) {
+            return _session->put_file(f, offset, len);
+        }
+        return data_sink_impl::put_file(f, offset, len);
+    }
     future<> close() override {
         _session->close();
         return make_ready_future<>();
@@ -1166,6 +1648,17 @@ future<connected_socket> tls::wrap_client(shared_ptr<certificate_credentials> cr
     return make_ready_future<connected_socket>(std::move(sock));
 }
 
+future<sstring> tls::get_alpn_protocol(connected_socket& s) {
+    auto tls_socket = dynamic_cast<tls_connected_socket_impl*>(net::get_impl::peek(s));
+    if (!tls_socket) {
+        return make_ready_future<sstring>();
+    }
+    auto sess = tls_socket->_session;
+    return sess->handshake().then([sess] {
+        return sess->alpn_protocol();
+    });
+}
+
 future<connected_socket> tls::wrap_server(shared_ptr<server_credentials> cred, connected_socket&& s) {
     session::session_ref sess(make_lw_shared<session>(session::type::SERVER, std::move(cred), std::move(s)));
     connected_socket sock(std::make_unique<tls_connected_socket_impl>(std::move(sess)));
@@ -21,7 +21,9 @@
 #pragma once
 
 #include <experimental/string_view>
+#include <map>
 #include <vector>
+#include <boost/any.hpp>
 
 #include "core/future.hh"
 #include "core/sstring.hh"
@@ -154,6 +156,47 @@ namespace tls {
          * Allows specifying order and allowance for handshake alg.
          */
         void set_priority_string(const sstring&);
+
+        /**
+         * Keeps the sessions of client connections made with these
+         * credentials, by server name, so that reconnecting to a server
+         * resumes its last session (with a short handshake), if the server
+         * allows it. Only connections given a server name take part; at
+         * most \c max_servers sessions are kept, least recently used ones
+         * being dropped first.
+         *
+         * Sessions are kept per credentials object, hence per shard.
+         */
+        void enable_session_cache(size_t max_servers = 256);
+
+        /**
+         * Hands the encryption of the records sent on connections made with
+         * these credentials to the kernel (Linux kTLS), once their handshake
+         * is done; data is then written to the socket without being copied
+         * or encrypted in user space, and files are sent with sendfile().
+         *
+         * Only the posix stack supports it, with the AES-GCM ciphers; other
+         * connections keep encrypting in user space. Connections whose peer
+         * later asks for a renegotiation or a TLS 1.3 key update fail.
+         */
+        void enable_kernel_tls();
+
+        /**
+         * Runs the handshakes of connections made with these credentials,
+         * whose public key operations can take milliseconds, as stealable
+         * tasks (see \ref smp::submit_stealable()): an idle shard may run
+         * them, rather than delaying the other tasks of the connection's
+         * shard. The rest of the connection's life stays on its shard.
+         */
+        void enable_handshake_offload();
+
+        /**
+         * Negotiates an application protocol (ALPN) on connections made
+         * with these credentials: a client offers \c protocols to the
+         * server, a server picks the first of \c protocols that the client
+         * offers. See \ref get_alpn_protocol().
+         */
+        void set_alpn_protocols(std::vector<sstring> protocols);
     private:
         class impl;
         friend class session;
@@ -189,8 +232,24 @@ namespace tls {
         server_credentials& operator=(const server_credentials&) = delete;
 
         void set_client_auth(client_auth);
+
+        /**
+         * Enables TLS session tickets, with which clients can resume
+         * their sessions with a short handshake.
+         *
+         * Tickets are encrypted with keys derived from \c key, a master
+         * key made by \ref generate_session_ticket_key(). Every shard, and
+         * server, that should accept the tickets issued by the others must
+         * use the same master key; the derived keys rotate with the ticket
+         * lifetime, in step on all of them. Setting a new master key on
+         * all shards invalidates the tickets issued before.
+         */
+        void enable_session_tickets(const blob& key);
     };
 
+    /** Creates a random master key for \ref server_credentials::enable_session_tickets() */
+    sstring generate_session_ticket_key();
+
     /**
      * Intentionally "primitive", and more importantly, copyable
      * container for certificate credentials options.
@@ -213,6 +272,16 @@ namespace tls {
         future<> set_system_trust();
         void set_client_auth(client_auth);
         void set_priority_string(const sstring&);
+        void enable_session_cache(size_t max_servers = 256);
+        void enable_kernel_tls();
+        void enable_handshake_offload();
+        void set_alpn_protocols(std::vector<sstring> protocols);
+        /**
+         * Enables session tickets on the built server credentials, all
+         * sharing the master key \c key, or one generated now if it is
+         * empty.
+         */
+        void enable_session_tickets(const blob& key = {});
 
         void apply_to(certificate_credentials&) const;
 
@@ -223,6 +292,11 @@ namespace tls {
         std::multimap<sstring, boost::any> _blobs;
         client_auth _client_auth = client_auth::NONE;
         sstring _priority;
+        size_t _session_cache_size = 0;
+        sstring _session_ticket_key;
+        bool _kernel_tls = false;
+        bool _handshake_offload = false;
+        std::vector<sstring> _alpn_protocols;
     };
 
     /**
@@ -267,6 +341,14 @@ namespace tls {
     // Wraps an existing server socket in SSL
     server_socket listen(shared_ptr<server_credentials>, server_socket);
     /// @}
+
+    /**
+     * Returns the application protocol negotiated with ALPN on a
+     * connection, once its handshake is done (see
+     * \ref certificate_credentials::set_alpn_protocols()). It is empty if
+     * none was, or if the connection is not a TLS one.
+     */
+    future<sstring> get_alpn_protocol(connected_socket&);
 }
 }
 
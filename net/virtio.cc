@@ -67,13 +67,56 @@ phys virt_to_phys(void* p) {
 
 #endif
 
+// Kernels before 4.x took up to 8 queues per tap device, later ones 256
+static constexpr unsigned max_tap_queues = 256;
+
+// Attaches tap_fd to a queue of the tap device; a device created with
+// multi_queue takes one queue per shard, each served by its own vhost
+// instance, and spreads the flows between them: to the queue that last
+// sent on the flow, or by the flow's hash
+static void attach_tap_queue(file_desc& tap_fd, const std::string& tap_device, bool multi_queue) {
+    assert(tap_device.size() + 1 <= IFNAMSIZ);
+    ifreq ifr = {};
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_ONE_QUEUE | IFF_VNET_HDR;
+    if (multi_queue) {
+        ifr.ifr_flags |= IFF_MULTI_QUEUE;
+    }
+    strcpy(ifr.ifr_ifrn.ifrn_name, tap_device.c_str());
+    tap_fd.ioctl(TUNSETIFF, ifr);
+}
+
 class device : public net::device {
 private:
     boost::program_options::variables_map _opts;
     net::hw_features _hw_features;
     uint64_t _features;
+    uint16_t _queues;
 
 private:
+    uint16_t setup_queues() {
+        unsigned wanted = _opts.count("virtio-queues") ? _opts["virtio-queues"].as<unsigned>() : 1;
+        if (!wanted || wanted > smp::count) {
+            wanted = smp::count;
+        }
+        wanted = std::min(wanted, max_tap_queues);
+#ifdef HAVE_OSV
+        if (osv::assigned_virtio::get && osv::assigned_virtio::get()) {
+            // VIRTIO_NET_F_MQ needs the control virtqueue, which we don't drive
+            return 1;
+        }
+#endif
+        if (wanted == 1) {
+            return 1;
+        }
+        // tap devices created without multi_queue refuse a multi-queue attach
+        try {
+            file_desc tap_fd(file_desc::open("/dev/net/tun", O_RDWR | O_NONBLOCK));
+            attach_tap_queue(tap_fd, _opts["tap-device"].as<std::string>(), true);
+        } catch (std::system_error&) {
+            return 1;
+        }
+        return wanted;
+    }
     uint64_t setup_features() {
         int64_t seastar_supported_features = VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_NET_F_MRG_RXBUF;
 
@@ -116,7 +159,7 @@ class device : public net::device {
 
 public:
     device(boost::program_options::variables_map opts)
-       : _opts(opts), _features(setup_features())
+       : _opts(opts), _features(setup_features()), _queues(setup_queues())
        {}
     ethernet_address hw_address() override {
         return { 0x12, 0x23, 0x34, 0x56, 0x67, 0x78 };
@@ -130,6 +173,10 @@ class device : public net::device {
         return _features;
     }
 
+    virtual uint16_t hw_queues_count() override {
+        return _queues;
+    }
+
     virtual std::unique_ptr<net::qp> init_local_queue(boost::program_options::variables_map opts, uint16_t qid) override;
 };
 
@@ -462,6 +509,9 @@ bool vring<BufferChain, Completion>::do_complete() {
         }
         _free_last = id;
     }
+    if (count) {
+        _complete.end_bunch();
+    }
     return count;
 }
 
@@ -505,6 +555,7 @@ class qp : public net::qp {
                 q._ring.available_descriptors().signal(p.nr_frags());
             }
             void bunch(uint64_t c) {}
+            void end_bunch() {}
         };
         qp& _dev;
         vring<packet_as_buffer_chain, complete> _ring;
@@ -535,6 +586,9 @@ class qp : public net::qp {
             void bunch(uint64_t c) {
                 q.update_rx_count(c);
             }
+            void end_bunch() {
+                q._dev.rx_gro_flush();
+            }
         };
         qp& _dev;
         vring<single_buffer, complete> _ring;
@@ -735,7 +789,7 @@ qp::rxq::complete_buffer(single_buffer&& bc, size_t len) {
 
         _dev._stats.rx.good.update_frags_stats(p.nr_frags(), p.len());
 
-        _dev._dev->l2receive(std::move(p));
+        _dev.rx_gro_add(std::move(p));
 
 
         _ring.available_descriptors().signal(_fragments.size());
@@ -806,7 +860,7 @@ class qp_vhost : public qp {
     // this driver, as as soon as we close it, vhost stops servicing us.
     file_desc _vhost_fd;
 public:
-    qp_vhost(device* dev, boost::program_options::variables_map opts);
+    qp_vhost(device* dev, boost::program_options::variables_map opts, bool multi_queue);
 };
 
 static size_t config_ring_size(boost::program_options::variables_map &opts) {
@@ -817,7 +871,7 @@ static size_t config_ring_size(boost::program_options::variables_map &opts) {
     }
 }
 
-qp_vhost::qp_vhost(device *dev, boost::program_options::variables_map opts)
+qp_vhost::qp_vhost(device *dev, boost::program_options::variables_map opts, bool multi_queue)
     : qp(dev, config_ring_size(opts), config_ring_size(opts))
     , _vhost_fd(file_desc::open("/dev/vhost-net", O_RDWR))
 {
@@ -838,11 +892,7 @@ qp_vhost::qp_vhost(device *dev, boost::program_options::variables_map opts)
     // this fd to VHOST_NET_SET_BACKEND, the Linux kernel keeps the reference
     // to it and it's fine to close the file descriptor.
     file_desc tap_fd(file_desc::open("/dev/net/tun", O_RDWR | O_NONBLOCK));
-    assert(tap_device.size() + 1 <= IFNAMSIZ);
-    ifreq ifr = {};
-    ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_ONE_QUEUE | IFF_VNET_HDR;
-    strcpy(ifr.ifr_ifrn.ifrn_name, tap_device.c_str());
-    tap_fd.ioctl(TUNSETIFF, ifr);
+    attach_tap_queue(tap_fd, tap_device, multi_queue);
     unsigned int offload = 0;
     auto hw_features = _dev->hw_features();
     if (hw_features.tx_csum_l4_offload && hw_features.rx_csum_offload) {
@@ -974,10 +1024,7 @@ qp_osv::qp_osv(device *dev, osv::assigned_virtio &virtio,
 #endif
 
 std::unique_ptr<net::qp> device::init_local_queue(boost::program_options::variables_map opts, uint16_t qid) {
-    static bool called = false;
-    assert(!qid);
-    assert(!called);
-    called = true;
+    assert(qid < _queues);
 
 #ifdef HAVE_OSV
     if (osv::assigned_virtio::get && osv::assigned_virtio::get()) {
@@ -985,7 +1032,7 @@ std::unique_ptr<net::qp> device::init_local_queue(boost::program_options::variab
         return std::make_unique<qp_osv>(this, *osv::assigned_virtio::get(), opts);
     }
 #endif
-    return std::make_unique<qp_vhost>(this, opts);
+    return std::make_unique<qp_vhost>(this, opts, _queues > 1);
 }
 
 }
@@ -1011,6 +1058,10 @@ get_virtio_net_options_description()
         ("virtio-ring-size",
                 boost::program_options::value<unsigned>()->default_value(256),
                 "Virtio ring size (must be power-of-two)")
+        ("virtio-queues",
+                boost::program_options::value<unsigned>()->default_value(0),
+                "Number of queue pairs, each with its own vhost instance, or 0 for one per shard; "
+                "more than one needs a tap device created with multi_queue")
         ;
     return opts;
 }
@@ -0,0 +1,738 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#ifdef HAVE_AF_XDP
+
+#include "xdp.hh"
+#include "core/posix.hh"
+#include "core/reactor.hh"
+#include "core/print.hh"
+#include "util/log.hh"
+#include "ip.hh"
+#include "const.hh"
+#include <boost/algorithm/string.hpp>
+#include <cmath>
+#include <vector>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+#include <linux/ethtool.h>
+#include <linux/if_xdp.h>
+#include <linux/sockios.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+namespace seastar {
+
+using namespace net;
+
+namespace xdp {
+
+static logger xdp_log("xdp");
+
+// Frames of the per queue UMEM area, which the kernel receives into and
+// transmits from; a packet must fit in one
+static constexpr uint32_t frame_size = 2048;
+static constexpr uint32_t ring_size = 2048;
+// Half of the frames are for receiving, the other half for transmitting
+static constexpr uint32_t nr_frames = 2 * ring_size;
+static constexpr uint32_t rx_batch = 64;
+// Received frames that packets may hold before their data is copied
+// instead, so that the fill ring does not run dry while the stack keeps
+// packets in reassembly and receive queues
+static constexpr uint32_t rx_hold_max = ring_size / 2;
+// ETH_RSS_HASH_TOP, which the kernel does not export
+static constexpr uint8_t rss_hash_toeplitz = 1;
+
+static int sys_bpf(int cmd, union bpf_attr& attr) {
+    return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+
+// Assembles a BPF program; jumps go to labels that are resolved by
+// finish()
+class bpf_assembler {
+    std::vector<bpf_insn> _insns;
+    std::vector<int> _labels;
+    std::vector<std::pair<size_t, unsigned>> _jumps;
+private:
+    void emit(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+        bpf_insn i = {};
+        i.code = code;
+        i.dst_reg = dst;
+        i.src_reg = src;
+        i.off = off;
+        i.imm = imm;
+        _insns.push_back(i);
+    }
+    void emit_jump(uint8_t code, uint8_t dst, uint8_t src, int32_t imm, unsigned label) {
+        _jumps.emplace_back(_insns.size(), label);
+        emit(code, dst, src, 0, imm);
+    }
+public:
+    unsigned new_label() {
+        _labels.push_back(-1);
+        return _labels.size() - 1;
+    }
+    void bind(unsigned label) {
+        _labels[label] = _insns.size();
+    }
+    void load(uint8_t size, uint8_t dst, uint8_t src, int16_t off) {
+        emit(BPF_LDX | BPF_MEM | size, dst, src, off, 0);
+    }
+    void store(uint8_t size, uint8_t dst, int16_t off, uint8_t src) {
+        emit(BPF_STX | BPF_MEM | size, dst, src, off, 0);
+    }
+    void alu(uint8_t op, uint8_t dst, int32_t imm) {
+        emit(BPF_ALU64 | op | BPF_K, dst, 0, 0, imm);
+    }
+    void alu_reg(uint8_t op, uint8_t dst, uint8_t src) {
+        emit(BPF_ALU64 | op | BPF_X, dst, src, 0, 0);
+    }
+    // src is BPF_PSEUDO_MAP_FD when imm is a map
+    void load_imm64(uint8_t dst, uint64_t imm, uint8_t src = 0) {
+        emit(BPF_LD | BPF_DW | BPF_IMM, dst, src, 0, int32_t(uint32_t(imm)));
+        emit(0, 0, 0, 0, int32_t(uint32_t(imm >> 32)));
+    }
+    // imm is sign extended, so it is for small constants only
+    void jump(uint8_t op, uint8_t dst, int32_t imm, unsigned label) {
+        emit_jump(BPF_JMP | op | BPF_K, dst, 0, imm, label);
+    }
+    void jump_reg(uint8_t op, uint8_t dst, uint8_t src, unsigned label) {
+        emit_jump(BPF_JMP | op | BPF_X, dst, src, 0, label);
+    }
+    void jump(unsigned label) {
+        emit_jump(BPF_JMP | BPF_JA, 0, 0, 0, label);
+    }
+    void call(int32_t func) {
+        emit(BPF_JMP | BPF_CALL, 0, 0, 0, func);
+    }
+    void exit() {
+        emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+    }
+    std::vector<bpf_insn> finish() {
+        for (auto&& j : _jumps) {
+            assert(_labels[j.second] >= 0);
+            _insns[j.first].off = _labels[j.second] - int(j.first) - 1;
+        }
+        return std::move(_insns);
+    }
+};
+
+// A ring shared with the kernel; we produce into the fill and tx rings,
+// and consume from the rx and completion rings
+template <typename Desc>
+class ring {
+    void* _map = nullptr;
+    size_t _map_len = 0;
+    uint32_t* _producer;
+    uint32_t* _consumer;
+    uint32_t* _flags;
+    Desc* _descs;
+    uint32_t _mask;
+    uint32_t _cached_prod;
+    uint32_t _cached_cons;
+public:
+    ring() = default;
+    ring(const ring&) = delete;
+    ~ring() {
+        if (_map) {
+            ::munmap(_map, _map_len);
+        }
+    }
+    void map(int fd, off_t pgoff, const xdp_ring_offset& off, uint32_t size) {
+        _map_len = off.desc + size * sizeof(Desc);
+        _map = ::mmap(nullptr, _map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+        throw_system_error_on(_map == MAP_FAILED, "mmap");
+        auto base = static_cast<char*>(_map);
+        _producer = reinterpret_cast<uint32_t*>(base + off.producer);
+        _consumer = reinterpret_cast<uint32_t*>(base + off.consumer);
+        _flags = reinterpret_cast<uint32_t*>(base + off.flags);
+        _descs = reinterpret_cast<Desc*>(base + off.desc);
+        _mask = size - 1;
+        _cached_prod = *_producer;
+        _cached_cons = *_consumer;
+    }
+    bool needs_wakeup() const {
+#ifdef XDP_RING_NEED_WAKEUP
+        return __atomic_load_n(_flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP;
+#else
+        return true;
+#endif
+    }
+    // Producer side: slots i < free_space() past the last submitted one
+    // may be written, then submitted
+    uint32_t free_space() const {
+        return _mask + 1 - (_cached_prod - __atomic_load_n(_consumer, __ATOMIC_ACQUIRE));
+    }
+    Desc& next(uint32_t i) {
+        return _descs[(_cached_prod + i) & _mask];
+    }
+    void submit(uint32_t n) {
+        _cached_prod += n;
+        __atomic_store_n(_producer, _cached_prod, __ATOMIC_RELEASE);
+    }
+    // Consumer side: slots i < available() past the last released one may
+    // be read, then released
+    uint32_t available() const {
+        return __atomic_load_n(_producer, __ATOMIC_ACQUIRE) - _cached_cons;
+    }
+    const Desc& peek(uint32_t i) const {
+        return _descs[(_cached_cons + i) & _mask];
+    }
+    void release(uint32_t n) {
+        _cached_cons += n;
+        __atomic_store_n(_consumer, _cached_cons, __ATOMIC_RELEASE);
+    }
+};
+
+class device : public net::device {
+    sstring _ifname;
+    unsigned _ifindex;
+    file_desc _ctl;
+    ethernet_address _hw_address;
+    net::hw_features _hw_features;
+    uint16_t _num_queues;
+    bool _zerocopy;
+    std::vector<uint32_t> _redir_table;
+    int _xsks_map = -1;
+    int _ports_map = -1;
+    int _prog = -1;
+    int _link = -1;
+private:
+    bool ethtool(void* data) {
+        ifreq ifr = {};
+        ::strncpy(ifr.ifr_name, _ifname.c_str(), IF_NAMESIZE - 1);
+        ifr.ifr_data = static_cast<char*>(data);
+        return ::ioctl(_ctl.get(), SIOCETHTOOL, &ifr) == 0;
+    }
+    ifreq ifreq_for(int request) {
+        ifreq ifr = {};
+        ::strncpy(ifr.ifr_name, _ifname.c_str(), IF_NAMESIZE - 1);
+        _ctl.ioctl(request, ifr);
+        return ifr;
+    }
+    uint16_t queues_count();
+    bool write_rss(bool with_key);
+    void setup_rss();
+    int create_map(bpf_map_type type, uint32_t key_size, uint32_t value_size, uint32_t max_entries);
+    void update_map(int map, uint32_t key, uint32_t value);
+    void load_program(ipv4_address addr, const std::vector<uint16_t>& ports);
+public:
+    explicit device(boost::program_options::variables_map opts);
+    ~device();
+    const sstring& ifname() const {
+        return _ifname;
+    }
+    unsigned ifindex() const {
+        return _ifindex;
+    }
+    bool zerocopy() const {
+        return _zerocopy;
+    }
+    // Steers the packets the program takes from queue qid to the socket
+    void register_socket(uint16_t qid, int fd) {
+        update_map(_xsks_map, qid, fd);
+    }
+    virtual ethernet_address hw_address() override {
+        return _hw_address;
+    }
+    virtual net::hw_features hw_features() override {
+        return _hw_features;
+    }
+    virtual uint16_t hw_queues_count() override {
+        return _num_queues;
+    }
+    virtual unsigned hash2qid(uint32_t hash) override {
+        if (_redir_table.empty()) {
+            return 0;
+        }
+        return _redir_table[hash & (_redir_table.size() - 1)];
+    }
+    virtual unsigned hw_reta_size() override {
+        return _num_queues > 1 ? _redir_table.size() : 0;
+    }
+    virtual void update_hw_reta(unsigned idx, unsigned qid) override {
+        assert(idx < _redir_table.size() && qid < _num_queues);
+        auto old = _redir_table[idx];
+        _redir_table[idx] = qid;
+        if (!write_rss(false)) {
+            _redir_table[idx] = old;
+            throw std::runtime_error(sprint("%s: failed to update an RSS indirection table entry", _ifname));
+        }
+    }
+    virtual std::unique_ptr<net::qp> init_local_queue(boost::program_options::variables_map opts, uint16_t qid) override;
+};
+
+class qp : public net::qp {
+    struct free_deleter {
+        void operator()(char* p) const {
+            ::free(p);
+        }
+    };
+    device* _dev;
+    uint16_t _qid;
+    // Before _xsk, so that the kernel lets go of it first
+    std::unique_ptr<char[], free_deleter> _umem;
+    file_desc _xsk;
+    bool _need_wakeup = false;
+    ring<uint64_t> _fill;
+    ring<uint64_t> _comp;
+    ring<xdp_desc> _rx;
+    ring<xdp_desc> _tx;
+    std::vector<uint64_t> _rx_free; // received into, to go back to the fill ring
+    std::vector<uint64_t> _tx_free;
+    uint32_t _rx_held = 0;
+    std::experimental::optional<reactor::poller> _rx_poller;
+private:
+    bool bind(uint16_t flags);
+    packet make_rx_packet(uint64_t addr, uint32_t len);
+    void refill();
+    void reclaim_tx();
+    bool poll_rx_once();
+public:
+    qp(device* dev, uint16_t qid);
+    virtual future<> send(packet p) override {
+        abort();
+    }
+    virtual uint32_t send(circular_buffer<packet>& pb) override;
+    virtual void rx_start() override {
+        _rx_poller = reactor::poller::simple([this] { return poll_rx_once(); });
+    }
+};
+
+device::device(boost::program_options::variables_map opts)
+        : _ifname(opts["xdp-interface"].as<std::string>())
+        , _ifindex(if_nametoindex(_ifname.c_str()))
+        , _ctl(file_desc::socket(AF_INET, SOCK_DGRAM))
+        , _zerocopy(opts["xdp-zerocopy"].as<std::string>() != "off") {
+    if (!_ifindex) {
+        throw std::runtime_error(sprint("xdp: no network interface %s", _ifname));
+    }
+    auto hw = ifreq_for(SIOCGIFHWADDR);
+    std::copy_n(hw.ifr_hwaddr.sa_data, _hw_address.mac.size(), _hw_address.mac.begin());
+    auto mtu = ifreq_for(SIOCGIFMTU).ifr_mtu;
+    _hw_features.tx_csum_ip_offload = false;
+    _hw_features.tx_csum_l4_offload = false;
+    _hw_features.rx_csum_offload = false;
+    _hw_features.tx_tso = false;
+    _hw_features.mtu = std::min<uint32_t>(mtu, frame_size - eth_hdr_len);
+
+    // The UMEM areas are pinned; older kernels charge them to RLIMIT_MEMLOCK
+    rlimit unlimited = { RLIM_INFINITY, RLIM_INFINITY };
+    ::setrlimit(RLIMIT_MEMLOCK, &unlimited);
+
+    _num_queues = std::min<uint16_t>(queues_count(), smp::count);
+    setup_rss();
+
+    std::vector<uint16_t> ports;
+    auto ports_opt = opts["xdp-ports"].as<std::string>();
+    if (!ports_opt.empty()) {
+        std::vector<std::string> tokens;
+        boost::split(tokens, ports_opt, boost::is_any_of(","));
+        for (auto&& t : tokens) {
+            auto port = std::stoul(t);
+            if (!port || port > 65535) {
+                throw std::invalid_argument(sprint("xdp: bad port %s", t));
+            }
+            ports.push_back(port);
+        }
+    }
+    load_program(ipv4_address(opts["host-ipv4-addr"].as<std::string>()), ports);
+    xdp_log.info("{}: {} queues, program attached", _ifname, _num_queues);
+}
+
+device::~device() {
+    for (auto fd : { _link, _prog, _ports_map, _xsks_map }) {
+        if (fd != -1) {
+            ::close(fd);
+        }
+    }
+}
+
+uint16_t device::queues_count() {
+    ethtool_channels ch = {};
+    ch.cmd = ETHTOOL_GCHANNELS;
+    if (!ethtool(&ch)) {
+        return 1;
+    }
+    return std::max(1U, std::max(ch.combined_count, ch.rx_count));
+}
+
+// Writes _redir_table, and our key if with_key, to the NIC
+bool device::write_rss(bool with_key) {
+    auto key_size = with_key ? rss_key().size() : 0;
+    std::vector<uint32_t> buf((sizeof(ethtool_rxfh) + _redir_table.size() * sizeof(uint32_t) + key_size + 3) / 4);
+    auto rxfh = reinterpret_cast<ethtool_rxfh*>(buf.data());
+    rxfh->cmd = ETHTOOL_SRSSH;
+    rxfh->indir_size = _redir_table.size();
+    rxfh->key_size = key_size;
+    rxfh->hfunc = with_key ? rss_hash_toeplitz : 0;
+    std::copy(_redir_table.begin(), _redir_table.end(), rxfh->rss_config);
+    std::copy_n(rss_key().data(), key_size, reinterpret_cast<uint8_t*>(rxfh->rss_config + _redir_table.size()));
+    return ethtool(rxfh);
+}
+
+// The stack computes the Toeplitz hash of the packets it receives and
+// picks connection ports with hash2qid(), so the NIC must spread flows the
+// same way: with our key, and an indirection table we know. If it cannot
+// take the key, all the traffic is sent to queue 0 instead.
+void device::setup_rss() {
+    ethtool_rxfh rxfh = {};
+    rxfh.cmd = ETHTOOL_GRSSH;
+    if (!ethtool(&rxfh) || !rxfh.indir_size) {
+        if (_num_queues > 1) {
+            xdp_log.warn("{}: cannot configure RSS, using one queue", _ifname);
+        }
+        _num_queues = 1;
+        return;
+    }
+    _redir_table.resize(rxfh.indir_size);
+    _rss_table_bits = std::lround(std::log2(rxfh.indir_size));
+    for (uint32_t i = 0; i < _redir_table.size(); ++i) {
+        _redir_table[i] = i % _num_queues;
+    }
+    if (_num_queues > 1 && rxfh.key_size == rss_key().size() && write_rss(true)) {
+        return;
+    }
+    if (_num_queues > 1) {
+        xdp_log.warn("{}: cannot set the RSS key, using one queue", _ifname);
+    }
+    _num_queues = 1;
+    std::fill(_redir_table.begin(), _redir_table.end(), 0);
+    if (!write_rss(false)) {
+        xdp_log.warn("{}: cannot steer all traffic to queue 0; traffic on other queues goes to the kernel", _ifname);
+    }
+}
+
+int device::create_map(bpf_map_type type, uint32_t key_size, uint32_t value_size, uint32_t max_entries) {
+    union bpf_attr attr = {};
+    attr.map_type = type;
+    attr.key_size = key_size;
+    attr.value_size = value_size;
+    attr.max_entries = max_entries;
+    auto fd = sys_bpf(BPF_MAP_CREATE, attr);
+    throw_system_error_on(fd == -1, "bpf(BPF_MAP_CREATE)");
+    return fd;
+}
+
+void device::update_map(int map, uint32_t key, uint32_t value) {
+    union bpf_attr attr = {};
+    attr.map_fd = map;
+    attr.key = reinterpret_cast<uintptr_t>(&key);
+    attr.value = reinterpret_cast<uintptr_t>(&value);
+    attr.flags = BPF_ANY;
+    throw_system_error_on(sys_bpf(BPF_MAP_UPDATE_ELEM, attr) == -1, "bpf(BPF_MAP_UPDATE_ELEM)");
+}
+
+// The program redirects to the queue's socket the IPv4 packets for addr,
+// and the ARP packets asking for it. With ports, addr is shared with the
+// kernel: only TCP and UDP packets to these ports are redirected, and the
+// stack learns the MAC addresses of its peers from the packets they send,
+// so only servers work. Everything else, including the packets of queues
+// without a socket, is passed to the kernel.
+void device::load_program(ipv4_address addr, const std::vector<uint16_t>& ports) {
+    _xsks_map = create_map(BPF_MAP_TYPE_XSKMAP, sizeof(uint32_t), sizeof(uint32_t), _num_queues);
+    if (!ports.empty()) {
+        _ports_map = create_map(BPF_MAP_TYPE_ARRAY, sizeof(uint32_t), sizeof(uint32_t), 65536);
+        for (auto port : ports) {
+            // keyed by the port as it is in the packet
+            update_map(_ports_map, htons(port), 1);
+        }
+    }
+
+    // r6: context, r2: packet data, r3: its end; loaded halfwords and words
+    // are in network order
+    enum { r0, r1, r2, r3, r4, r5, r6, r7, r8, r10 = 10 };
+    bpf_assembler a;
+    auto pass = a.new_label();
+    auto redirect = a.new_label();
+    auto arp = a.new_label();
+    auto l4 = a.new_label();
+    a.alu_reg(BPF_MOV, r6, r1);
+    a.load(BPF_W, r2, r6, offsetof(xdp_md, data));
+    a.load(BPF_W, r3, r6, offsetof(xdp_md, data_end));
+    a.alu_reg(BPF_MOV, r4, r2);
+    // long enough for ARP, and for IPv4 as frames are at least 60 bytes
+    a.alu(BPF_ADD, r4, 42);
+    a.jump_reg(BPF_JGT, r4, r3, pass);
+    a.load_imm64(r8, htonl(addr.ip));
+    a.load(BPF_H, r5, r2, 12);
+    if (ports.empty()) {
+        a.jump(BPF_JEQ, r5, htons(uint16_t(eth_protocol_num::arp)), arp);
+    }
+    a.jump(BPF_JNE, r5, htons(uint16_t(eth_protocol_num::ipv4)), pass);
+    a.load(BPF_W, r5, r2, 30);
+    a.jump_reg(BPF_JNE, r5, r8, pass);
+    if (ports.empty()) {
+        a.jump(redirect);
+        a.bind(arp);
+        // target protocol address
+        a.load(BPF_W, r5, r2, 38);
+        a.jump_reg(BPF_JNE, r5, r8, pass);
+    } else {
+        // fragments other than the first have no ports
+        a.load(BPF_H, r5, r2, 20);
+        a.alu(BPF_AND, r5, htons(0x1fff));
+        a.jump(BPF_JNE, r5, 0, pass);
+        a.load(BPF_B, r5, r2, 23);
+        a.jump(BPF_JEQ, r5, uint8_t(ip_protocol_num::tcp), l4);
+        a.jump(BPF_JNE, r5, uint8_t(ip_protocol_num::udp), pass);
+        a.bind(l4);
+        a.load(BPF_B, r5, r2, 14);
+        a.alu(BPF_AND, r5, 0x0f);
+        a.alu(BPF_LSH, r5, 2);
+        a.alu_reg(BPF_ADD, r2, r5);
+        a.alu_reg(BPF_MOV, r4, r2);
+        a.alu(BPF_ADD, r4, eth_hdr_len + 4);
+        a.jump_reg(BPF_JGT, r4, r3, pass);
+        a.load(BPF_H, r5, r2, eth_hdr_len + 2);
+        a.store(BPF_W, r10, -4, r5);
+        a.load_imm64(r1, _ports_map, BPF_PSEUDO_MAP_FD);
+        a.alu_reg(BPF_MOV, r2, r10);
+        a.alu(BPF_ADD, r2, -4);
+        a.call(BPF_FUNC_map_lookup_elem);
+        a.jump(BPF_JEQ, r0, 0, pass);
+        a.load(BPF_W, r5, r0, 0);
+        a.jump(BPF_JEQ, r5, 0, pass);
+    }
+    a.bind(redirect);
+    a.load_imm64(r1, _xsks_map, BPF_PSEUDO_MAP_FD);
+    a.load(BPF_W, r2, r6, offsetof(xdp_md, rx_queue_index));
+    // what to return when the queue has no socket
+    a.alu(BPF_MOV, r3, XDP_PASS);
+    a.call(BPF_FUNC_redirect_map);
+    a.exit();
+    a.bind(pass);
+    a.alu(BPF_MOV, r0, XDP_PASS);
+    a.exit();
+    auto insns = a.finish();
+
+    static const char license[] = "Apache-2.0";
+    std::vector<char> log(64 * 1024);
+    union bpf_attr attr = {};
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = reinterpret_cast<uintptr_t>(insns.data());
+    attr.insn_cnt = insns.size();
+    attr.license = reinterpret_cast<uintptr_t>(license);
+    attr.log_buf = reinterpret_cast<uintptr_t>(log.data());
+    attr.log_size = log.size();
+    attr.log_level = 1;
+    _prog = sys_bpf(BPF_PROG_LOAD, attr);
+    if (_prog == -1) {
+        throw std::runtime_error(sprint("xdp: cannot load the XDP program: %s\n%s", strerror(errno), log.data()));
+    }
+
+    // The program stays attached while the link is open, so it goes away
+    // with the process
+    attr = {};
+    attr.link_create.prog_fd = _prog;
+    attr.link_create.target_ifindex = _ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    _link = sys_bpf(BPF_LINK_CREATE, attr);
+    throw_system_error_on(_link == -1, "bpf(BPF_LINK_CREATE)");
+}
+
+std::unique_ptr<net::qp> device::init_local_queue(boost::program_options::variables_map opts, uint16_t qid) {
+    return std::make_unique<qp>(this, qid);
+}
+
+qp::qp(device* dev, uint16_t qid)
+        : net::qp(true, "network", qid)
+        , _dev(dev)
+        , _qid(qid)
+        , _umem(static_cast<char*>(::aligned_alloc(4096, size_t(nr_frames) * frame_size)))
+        , _xsk(file_desc::socket(AF_XDP, SOCK_RAW)) {
+    if (!_umem) {
+        throw std::bad_alloc();
+    }
+    xdp_umem_reg mr = {};
+    mr.addr = reinterpret_cast<uintptr_t>(_umem.get());
+    mr.len = size_t(nr_frames) * frame_size;
+    mr.chunk_size = frame_size;
+    mr.headroom = 0;
+    _xsk.setsockopt(SOL_XDP, XDP_UMEM_REG, mr);
+    int size = ring_size;
+    _xsk.setsockopt(SOL_XDP, XDP_UMEM_FILL_RING, size);
+    _xsk.setsockopt(SOL_XDP, XDP_UMEM_COMPLETION_RING, size);
+    _xsk.setsockopt(SOL_XDP, XDP_RX_RING, size);
+    _xsk.setsockopt(SOL_XDP, XDP_TX_RING, size);
+    auto off = _xsk.getsockopt<xdp_mmap_offsets>(SOL_XDP, XDP_MMAP_OFFSETS);
+    _fill.map(_xsk.get(), XDP_UMEM_PGOFF_FILL_RING, off.fr, ring_size);
+    _comp.map(_xsk.get(), XDP_UMEM_PGOFF_COMPLETION_RING, off.cr, ring_size);
+    _rx.map(_xsk.get(), XDP_PGOFF_RX_RING, off.rx, ring_size);
+    _tx.map(_xsk.get(), XDP_PGOFF_TX_RING, off.tx, ring_size);
+
+    for (uint32_t i = 0; i < ring_size; ++i) {
+        _fill.next(i) = uint64_t(i) * frame_size;
+    }
+    _fill.submit(ring_size);
+    _rx_free.reserve(ring_size);
+    _tx_free.reserve(ring_size);
+    for (uint32_t i = ring_size; i < nr_frames; ++i) {
+        _tx_free.push_back(uint64_t(i) * frame_size);
+    }
+
+    // Zero copy needs a driver that supports it; otherwise the kernel
+    // copies between its buffers and the UMEM
+    uint16_t wakeup = 0;
+#ifdef XDP_USE_NEED_WAKEUP
+    wakeup = XDP_USE_NEED_WAKEUP;
+#endif
+    bool zc = _dev->zerocopy() && bind(XDP_ZEROCOPY | wakeup);
+    if (!zc && !bind(XDP_COPY | wakeup)) {
+        throw std::system_error(errno, std::system_category(),
+                sprint("xdp: cannot bind a socket to %s queue %d", _dev->ifname(), qid));
+    }
+    _need_wakeup = wakeup;
+    xdp_log.info("{} queue {}: {} mode", _dev->ifname(), qid, zc ? "zero-copy" : "copy");
+    _dev->register_socket(qid, _xsk.get());
+}
+
+bool qp::bind(uint16_t flags) {
+    sockaddr_xdp sxdp = {};
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = _dev->ifindex();
+    sxdp.sxdp_queue_id = _qid;
+    sxdp.sxdp_flags = flags;
+    return ::bind(_xsk.get(), reinterpret_cast<sockaddr*>(&sxdp), sizeof(sxdp)) == 0;
+}
+
+packet qp::make_rx_packet(uint64_t addr, uint32_t len) {
+    auto frame = addr & ~uint64_t(frame_size - 1);
+    fragment f{_umem.get() + addr, len};
+    if (_rx_held >= rx_hold_max) {
+        _rx_free.push_back(frame);
+        _stats.rx.good.update_copy_stats(1, len);
+        return packet(f);
+    }
+    ++_rx_held;
+    return packet(f, make_deleter(deleter(), [this, frame] {
+        --_rx_held;
+        _rx_free.push_back(frame);
+    }));
+}
+
+void qp::refill() {
+    auto n = std::min<uint32_t>(_rx_free.size(), _fill.free_space());
+    for (uint32_t i = 0; i < n; ++i) {
+        _fill.next(i) = _rx_free[_rx_free.size() - n + i];
+    }
+    _rx_free.resize(_rx_free.size() - n);
+    _fill.submit(n);
+    if (n && (!_need_wakeup || _fill.needs_wakeup())) {
+        ::recvfrom(_xsk.get(), nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+    }
+}
+
+bool qp::poll_rx_once() {
+    auto n = std::min(_rx.available(), rx_batch);
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        auto& d = _rx.peek(i);
+        bytes += d.len;
+        rx_gro_add(make_rx_packet(d.addr, d.len));
+    }
+    _rx.release(n);
+    if (n) {
+        rx_gro_flush();
+        _stats.rx.good.update_pkts_bunch(n);
+        _stats.rx.good.update_frags_stats(n, bytes);
+    }
+    refill();
+    return n;
+}
+
+void qp::reclaim_tx() {
+    auto n = _comp.available();
+    for (uint32_t i = 0; i < n; ++i) {
+        _tx_free.push_back(_comp.peek(i));
+    }
+    _comp.release(n);
+}
+
+// Packets are copied into transmit frames: the kernel only sends from the
+// UMEM
+uint32_t qp::send(circular_buffer<packet>& pb) {
+    reclaim_tx();
+    auto space = std::min<uint32_t>(_tx_free.size(), _tx.free_space());
+    uint32_t queued = 0, done = 0;
+    uint64_t nr_frags = 0, bytes = 0;
+    while (!pb.empty() && queued < space) {
+        auto& p = pb.front();
+        // the MTU keeps them out, as we do not do TSO
+        if (p.len() <= frame_size) {
+            auto frame = _tx_free.back();
+            _tx_free.pop_back();
+            auto out = _umem.get() + frame;
+            for (auto&& f : p.fragments()) {
+                out = std::copy_n(f.base, f.size, out);
+            }
+            auto& d = _tx.next(queued++);
+            d.addr = frame;
+            d.len = p.len();
+            d.options = 0;
+            nr_frags += p.nr_frags();
+            bytes += p.len();
+        }
+        pb.pop_front();
+        ++done;
+    }
+    _tx.submit(queued);
+    if (queued && (!_need_wakeup || _tx.needs_wakeup())) {
+        ::sendto(_xsk.get(), nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+    }
+    _stats.tx.good.update_frags_stats(nr_frags, bytes);
+    _stats.tx.good.update_copy_stats(nr_frags, bytes);
+    return done;
+}
+
+}
+
+boost::program_options::options_description
+get_xdp_net_options_description()
+{
+    boost::program_options::options_description opts(
+            "AF_XDP net options");
+    opts.add_options()
+        ("xdp-interface",
+                boost::program_options::value<std::string>(),
+                "Use AF_XDP sockets on this network interface, one per queue, for the traffic "
+                "to host-ipv4-addr (use with --dhcp 0)")
+        ("xdp-ports",
+                boost::program_options::value<std::string>()->default_value(""),
+                "Comma separated TCP and UDP ports to take from the interface: host-ipv4-addr is then "
+                "shared with the kernel, which keeps the other traffic (servers only)")
+        ("xdp-zerocopy",
+                boost::program_options::value<std::string>()->default_value("on"),
+                "Use zero-copy mode if the driver supports it (on / off)")
+        ;
+    return opts;
+}
+
+std::unique_ptr<net::device> create_xdp_net_device(boost::program_options::variables_map opts) {
+    return std::make_unique<xdp::device>(opts);
+}
+
+}
+
+#endif // HAVE_AF_XDP
@@ -29,21 +29,6 @@ namespace rpc {
 const sstring lz4_compressor::factory::_name = "LZ4";
 
 
-static temporary_buffer<char> linearize(boost::variant<std::vector<temporary_buffer<char>>, temporary_buffer<char>>& v, uint32_t size) {
-    auto* one = boost::get<temporary_buffer<char>>(&v);
-    if (one) {
-        // no need to linearize
-        return std::move(*one);
-    } else {
-        temporary_buffer<char> src(size);
-        auto p = src.get_write();
-        for (auto&& b : boost::get<std::vector<temporary_buffer<char>>>(v)) {
-            p = std::copy_n(b.begin(), b.size(), p);
-        }
-        return src;
-    }
-}
-
 snd_buf lz4_compressor::compress(size_t head_space, snd_buf data) {
     head_space += 4;
     temporary_buffer<char> dst(head_space + LZ4_compressBound(data.size));
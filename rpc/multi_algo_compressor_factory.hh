@@ -33,7 +33,9 @@ namespace rpc {
 // This is meta compressor factory. It gets an array of regular factories that
 // support one compression algorithm each and negotiates common compression algorithm
 // that is supported both by a client and a server. The order of algorithm preferences
-// is the order they appear in clien's list
+// is the order they appear in clien's list, so the preference is per link: clients
+// of bandwidth bound links can list, say, zstd with a dictionary, then zstd, then
+// LZ4, and other clients LZ4 first, against the same server
 class multi_algo_compressor_factory : public rpc::compressor::factory {
     std::vector<const rpc::compressor::factory*> _factories;
     sstring _features;
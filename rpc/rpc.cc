@@ -1,10 +1,15 @@
 #include "rpc.hh"
+#include "core/metrics.hh"
 
 namespace seastar {
 
 namespace rpc {
   no_wait_type no_wait;
 
+  namespace internal {
+  thread_local lw_shared_ptr<request_cancellation> current_cancellation;
+  }
+
   constexpr size_t snd_buf::chunk_size;
 
   snd_buf::snd_buf(size_t size_) : size(size_) {
@@ -21,6 +26,147 @@ namespace rpc {
       }
   }
 
+  temporary_buffer<char> linearize(boost::variant<std::vector<temporary_buffer<char>>, temporary_buffer<char>>& v, uint32_t size) {
+      auto* one = boost::get<temporary_buffer<char>>(&v);
+      if (one) {
+          // no need to linearize
+          return std::move(*one);
+      } else {
+          temporary_buffer<char> src(size);
+          auto p = src.get_write();
+          for (auto&& b : boost::get<std::vector<temporary_buffer<char>>>(v)) {
+              p = std::copy_n(b.begin(), b.size(), p);
+          }
+          return src;
+      }
+  }
+
+  snd_buf frame_measuring_stream::make_buffer(size_t head_space) {
+      if (_fragments.empty()) {
+          return snd_buf(head_space + size());
+      }
+      std::vector<temporary_buffer<char>> v;
+      auto add = [&v] (size_t size) {
+          while (size) {
+              v.push_back(temporary_buffer<char>(std::min(snd_buf::chunk_size, size)));
+              size -= v.back().size();
+          }
+      };
+      // the serialized bytes are laid out around the fragments, and the
+      // head space goes in front of the first chunk
+      size_t pos = 0;
+      for (auto&& f : _fragments) {
+          add(head_space + f.first - pos);
+          pos = head_space + f.first + f.second.size();
+          v.push_back(std::move(f.second));
+      }
+      add(head_space + size() - pos);
+      _fragments.clear();
+      snd_buf ret;
+      ret.size = head_space + size();
+      ret.bufs = std::move(v);
+      return ret;
+  }
+
+  temporary_buffer<char> rcv_buf_stream::read_fragment(size_t size) {
+      auto pos = _buf.size - this->size();
+      temporary_buffer<char>* in = boost::get<temporary_buffer<char>>(&_buf.bufs);
+      if (!in) {
+          for (auto&& b : boost::get<std::vector<temporary_buffer<char>>>(_buf.bufs)) {
+              if (pos < b.size()) {
+                  in = &b;
+                  break;
+              }
+              pos -= b.size();
+          }
+      }
+      if (!size || !in || pos + size > in->size()) {
+          // spans buffers, or is past the end
+          temporary_buffer<char> b(size);
+          read(b.get_write(), size);
+          return b;
+      }
+      skip(size);
+      return in->share(pos, size);
+  }
+
+  constexpr unsigned log2_histogram::nr_buckets;
+
+  void log2_histogram::add(uint64_t v) noexcept {
+      unsigned b = v > 1 ? std::numeric_limits<unsigned long long>::digits - 1 - __builtin_clzll(v) : 0;
+      ++buckets[std::min(b, nr_buckets - 1)];
+      sum += v;
+  }
+
+  metrics::histogram log2_histogram::to_metrics() const {
+      metrics::histogram h;
+      h.sample_sum = sum;
+      h.buckets.resize(nr_buckets);
+      for (unsigned i = 0; i < nr_buckets; ++i) {
+          h.sample_count += buckets[i];
+          h.buckets[i].count = buckets[i];
+          h.buckets[i].upper_bound = double((uint64_t(2) << i) - 1);
+      }
+      return h;
+  }
+
+  verb_metrics::verb& verb_metrics::get(uint64_t v) {
+      auto& vp = _verbs[v];
+      if (vp) {
+          return *vp;
+      }
+      vp = std::make_unique<verb>();
+      namespace sm = metrics;
+      static auto protocol_label = sm::label("protocol");
+      static auto verb_label = sm::label("verb");
+      std::vector<sm::label_instance> labels{protocol_label(_name), verb_label(v)};
+      auto& h = *vp;
+      h.metrics.add_group("rpc_verb", {
+          sm::make_histogram("request_bytes", sm::description("Sizes of the requests the server received"), labels,
+                  [&h] { return h.request_bytes.to_metrics(); }),
+          sm::make_histogram("response_bytes", sm::description("Sizes of the responses the server sent"), labels,
+                  [&h] { return h.response_bytes.to_metrics(); }),
+          sm::make_histogram("handler_latency_us", sm::description("Time from a request's arrival at the server to its response being queued"), labels,
+                  [&h] { return h.handler_latency.to_metrics(); }),
+          sm::make_histogram("response_queue_time_us", sm::description("Time responses waited in the server connections' send queues"), labels,
+                  [&h] { return h.response_queue_time.to_metrics(); }),
+          sm::make_histogram("round_trip_latency_us", sm::description("Time from a client's call to its reply"), labels,
+                  [&h] { return h.round_trip_latency.to_metrics(); }),
+          sm::make_histogram("request_queue_time_us", sm::description("Time requests waited in the client connections' send queues"), labels,
+                  [&h] { return h.request_queue_time.to_metrics(); }),
+      });
+      return h;
+  }
+
+  constexpr unsigned compression_sampler::window;
+
+  bool compression_sampler::should_compress(uint64_t verb) {
+      auto& v = _verbs[verb];
+      return v.compress || ++v.frames % window == 0;
+  }
+
+  void compression_sampler::record(uint64_t verb, size_t raw, size_t compressed) {
+      auto& v = _verbs[verb];
+      // worth it if it saves at least a tenth
+      auto pays = [] (uint64_t raw, uint64_t compressed) {
+          return compressed * 10 < raw * 9;
+      };
+      if (!v.compress) {
+          if (pays(raw, compressed)) {
+              v = verb_state();
+          }
+          return;
+      }
+      v.raw += raw;
+      v.compressed += compressed;
+      if (++v.frames == window) {
+          v.compress = pays(v.raw, v.compressed);
+          v.frames = 0;
+          v.raw = 0;
+          v.compressed = 0;
+      }
+  }
+
   temporary_buffer<char>& snd_buf::front() {
       auto *one = boost::get<temporary_buffer<char>>(&bufs);
       if (one) {
@@ -29,6 +175,172 @@ namespace rpc {
           return boost::get<std::vector<temporary_buffer<char>>>(bufs).front();
       }
   }
+
+  // Bytes a frame of the given buffer size is charged against the window
+  static size_t stream_frame_charge(size_t size, size_t window) {
+      return std::min(size, window);
+  }
+
+  stream_channel::stream_channel(stream_transport* transport, id_type id, size_t window, size_t peer_window)
+          : _transport(transport), _id(id), _window(window), _peer_window(peer_window), _credit(peer_window) {
+  }
+
+  void stream_channel::send_control(stream_frame_kind kind, std::experimental::optional<uint32_t> arg) {
+      if (!_transport) {
+          return;
+      }
+      snd_buf data(stream_head_space + (arg ? 4 : 0));
+      auto p = data.front().get_write() + stream_head_space - 4;
+      write_le<uint32_t>(p, uint32_t(kind));
+      if (arg) {
+          write_le<uint32_t>(p + 4, *arg);
+      }
+      _transport->send_stream_frame(_id, std::move(data));
+  }
+
+  void stream_channel::send_eos() {
+      if (_eos_sent) {
+          return;
+      }
+      _closing = true;
+      _eos_sent = true;
+      send_control(stream_frame_kind::eos);
+      maybe_release();
+  }
+
+  void stream_channel::wake_reader() {
+      if (_readable) {
+          auto p = std::move(*_readable);
+          _readable = std::experimental::nullopt;
+          p.set_value();
+      }
+  }
+
+  void stream_channel::maybe_release() {
+      if (_transport && !_sinks && !_sources && _eos_sent && _eos_received) {
+          auto t = std::exchange(_transport, nullptr);
+          t->release_stream(_id);
+      }
+  }
+
+  void stream_channel::detach_sink() {
+      if (!--_sinks) {
+          send_eos();
+      }
+  }
+
+  void stream_channel::detach_source() {
+      if (!--_sources && !_eos_received && !_abandon_sent) {
+          _abandon_sent = true;
+          _incoming.clear();
+          send_control(stream_frame_kind::abandon);
+      }
+      if (!_sinks && !_sources) {
+          send_eos();
+      }
+      maybe_release();
+  }
+
+  future<> stream_channel::send(snd_buf data) {
+      if (_error) {
+          return make_exception_future<>(_error);
+      }
+      if (_closing) {
+          return make_exception_future<>(stream_closed());
+      }
+      write_le<uint32_t>(data.front().get_write() + stream_head_space - 4, uint32_t(stream_frame_kind::data));
+      auto charge = stream_frame_charge(data.size - stream_head_space + 4, _peer_window);
+      return _credit.wait(charge).then([self = shared_from_this(), data = std::move(data)] () mutable {
+          if (self->_eos_sent) {
+              return make_exception_future<>(stream_closed());
+          }
+          if (!self->_transport || !self->_transport->send_stream_frame(self->_id, std::move(data))) {
+              return make_exception_future<>(closed_error());
+          }
+          return make_ready_future<>();
+      });
+  }
+
+  future<> stream_channel::close() {
+      if (_closing) {
+          return make_ready_future<>();
+      }
+      _closing = true;
+      // queued behind the messages waiting for credit
+      return _credit.wait(0).then_wrapped([self = shared_from_this()] (future<> f) {
+          f.ignore_ready_future();
+          self->send_eos();
+      });
+  }
+
+  future<std::experimental::optional<rcv_buf>> stream_channel::receive() {
+      if (!_incoming.empty()) {
+          auto m = std::move(_incoming.front());
+          _incoming.pop_front();
+          _consumed += stream_frame_charge(m.data.size, _window);
+          // returning credit in halves of the window keeps the sender busy;
+          // returning all of it once drained keeps large messages flowing
+          if (!_eos_received && (_consumed >= _window / 2 || _incoming.empty())) {
+              send_control(stream_frame_kind::credit, uint32_t(std::exchange(_consumed, 0)));
+          }
+          return make_ready_future<std::experimental::optional<rcv_buf>>(std::move(m.data));
+      }
+      if (_error) {
+          return make_exception_future<std::experimental::optional<rcv_buf>>(_error);
+      }
+      if (_eos_received) {
+          return make_ready_future<std::experimental::optional<rcv_buf>>();
+      }
+      assert(!_readable);
+      _readable = promise<>();
+      return _readable->get_future().then([self = shared_from_this()] {
+          return self->receive();
+      });
+  }
+
+  void stream_channel::deliver(rcv_buf frame, std::experimental::optional<resource_permit> permit) {
+      auto in = make_deserializer_stream(frame);
+      uint32_t v32;
+      in.read(reinterpret_cast<char*>(&v32), 4);
+      switch (stream_frame_kind(le_to_cpu(v32))) {
+      case stream_frame_kind::data:
+          if (_eos_received) {
+              throw rpc_protocol_error();
+          }
+          if (!_abandon_sent) {
+              _incoming.push_back(message{std::move(frame), std::move(permit)});
+              wake_reader();
+          }
+          break;
+      case stream_frame_kind::credit:
+          in.read(reinterpret_cast<char*>(&v32), 4);
+          _credit.signal(le_to_cpu(v32));
+          break;
+      case stream_frame_kind::eos:
+          _eos_received = true;
+          wake_reader();
+          maybe_release();
+          break;
+      case stream_frame_kind::abandon:
+          _credit.broken(std::make_exception_ptr(stream_closed()));
+          send_eos();
+          break;
+      default:
+          throw rpc_protocol_error();
+      }
+  }
+
+  void stream_channel::abort(std::exception_ptr ex) {
+      _transport = nullptr;
+      _error = ex;
+      _incoming.clear();
+      _credit.broken(ex);
+      if (_readable) {
+          auto p = std::move(*_readable);
+          _readable = std::experimental::nullopt;
+          p.set_exception(ex);
+      }
+  }
 }
 
 }
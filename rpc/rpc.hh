@@ -23,7 +23,9 @@
 
 #include <unordered_map>
 #include <unordered_set>
+#include <limits>
 #include <list>
+#include <deque>
 #include "core/future.hh"
 #include "net/api.hh"
 #include "core/reactor.hh"
@@ -31,8 +33,12 @@
 #include "core/shared_ptr.hh"
 #include "core/condition-variable.hh"
 #include "core/gate.hh"
+#include "core/shared_future.hh"
+#include "core/metrics_registration.hh"
+#include "core/metrics_types.hh"
 #include "rpc/rpc_types.hh"
 #include "core/byteorder.hh"
+#include "core/tracing.hh"
 
 namespace seastar {
 
@@ -71,6 +77,7 @@ struct resource_limits {
     size_t basic_request_size = 0; ///< Minimum request footprint in memory
     unsigned bloat_factor = 1;     ///< Serialized size multiplied by this to estimate memory used by request
     size_t max_memory = rpc_semaphore::max_counter(); ///< Maximum amount of memory that may be consumed by all requests
+    size_t stream_window = 1 << 20; ///< Bytes a client may send on a stream before the server consumes them; buffered stream data counts against max_memory
 };
 
 struct client_options {
@@ -78,11 +85,47 @@ struct client_options {
     bool tcp_nodelay = true;
     compressor::factory* compressor_factory = nullptr;
     bool send_timeout_data = true;
+    bool send_trace_context = true; ///< Continue callers' traces on the server, if it supports it
+    size_t stream_window = 1 << 20; ///< Bytes the server may send on a stream before the client consumes them
+    size_t compression_threshold = 128; ///< Frames smaller than this are sent uncompressed, if the server supports it
+    bool adaptive_compression = true; ///< Stop compressing the frames of verbs that do not shrink, if the server supports it
+    bool send_cancellations = true; ///< Tell the server about calls that are cancelled or time out, if it supports it
 };
 
 struct server_options {
     compressor::factory* compressor_factory = nullptr;
     bool tcp_nodelay = true;
+    size_t compression_threshold = 128; ///< Frames smaller than this are sent uncompressed, if the client supports it
+    bool adaptive_compression = true; ///< Stop compressing the frames of verbs that do not shrink, if the client supports it
+    /// If set, a server listening on an address also listens on port
+    /// shard_port_base + its shard, and tells clients so; connections to
+    /// that port are served by that shard. Stacks that spread connections
+    /// by RSS need the ports steered with network_stack::add_flow_rule().
+    uint16_t shard_port_base = 0;
+    /// Reject requests, with \ref overloaded_error, rather than queue them
+    /// until memory is available, if they would likely expire before then;
+    /// requests that have expired on arrival are dropped regardless
+    bool shed_load = true;
+};
+
+/// A class of verbs, whose messages connections queue separately from the
+/// other classes', and whose requests servers limit separately; see
+/// \ref protocol::set_priority_classes()
+struct priority_class_config {
+    /// Share of a connection's bandwidth the class gets when it is
+    /// contended, relative to the other classes' weights
+    unsigned weight = 1;
+    /// Memory its requests may take on a server at once, estimated as for
+    /// resource_limits; class 0 uses resource_limits::max_memory instead
+    size_t max_memory = rpc_semaphore::max_counter();
+};
+
+/// Which server shard serves a connection, as the server tells the client
+struct shard_info {
+    unsigned shard = 0;
+    unsigned shard_count = 1;
+    /// Connections to port_base + N are served by shard N, if set
+    uint16_t port_base = 0;
 };
 
 inline
@@ -99,6 +142,69 @@ struct negotiation_frame {
 enum class protocol_features : uint32_t {
     COMPRESS = 0,
     TIMEOUT = 1,
+    STREAMS = 2,
+    UNCOMPRESSED_FRAMES = 3, // compressed connections may carry uncompressed frames
+    SHARD_INFO = 4, // the server tells the client which shard serves the connection
+    TRACING = 5, // requests carry the trace context of the caller (see tracing.hh)
+    CANCEL = 6, // clients tell the server about requests they cancelled (see request_cancellation)
+};
+
+// Flags a frame sent uncompressed on a compressed connection, in its length
+static constexpr uint32_t uncompressed_frame_flag = 1u << 31;
+
+// Decides, per verb, whether compressing its frames pays off, from how
+// much they shrank. Frames of verbs that do not compress are still
+// compressed once in a while, to notice if they start to.
+class compression_sampler {
+    struct verb_state {
+        bool compress = true;
+        unsigned frames = 0;
+        uint64_t raw = 0;
+        uint64_t compressed = 0;
+    };
+    std::unordered_map<uint64_t, verb_state> _verbs;
+public:
+    // Frames sampled before deciding, and one in this many frames of a
+    // verb that does not compress is sampled
+    static constexpr unsigned window = 64;
+    bool should_compress(uint64_t verb);
+    void record(uint64_t verb, size_t raw, size_t compressed);
+};
+
+// Distribution of values in power-of-two buckets: bucket i holds the
+// values in [2^i, 2^(i+1)), bucket 0 also zero
+struct log2_histogram {
+    static constexpr unsigned nr_buckets = 32;
+    std::array<uint64_t, nr_buckets> buckets = {};
+    uint64_t sum = 0;
+    void add(uint64_t v) noexcept;
+    void add_us(rpc_clock_type::duration d) noexcept {
+        add(std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(d).count(), 0));
+    }
+    metrics::histogram to_metrics() const;
+};
+
+// Size and latency distributions of a protocol's messages, by verb,
+// exported on first use of each verb
+class verb_metrics {
+public:
+    struct verb {
+        // as seen by the server
+        log2_histogram request_bytes;
+        log2_histogram response_bytes;
+        log2_histogram handler_latency;      // from the request's arrival to its response being queued
+        log2_histogram response_queue_time;  // in the connection's send queue
+        // as seen by the client
+        log2_histogram round_trip_latency;
+        log2_histogram request_queue_time;
+        metrics::metric_groups metrics;
+    };
+private:
+    sstring _name;
+    std::unordered_map<uint64_t, std::unique_ptr<verb>> _verbs;
+public:
+    explicit verb_metrics(sstring name) : _name(std::move(name)) {}
+    verb& get(uint64_t v);
 };
 
 // internal representation of feature data
@@ -108,12 +214,194 @@ using feature_map = std::map<protocol_features, sstring>;
 template <typename Function>
 struct signature;
 
+// Streams are carried by the connection of the call that opened them; a
+// client sends their frames as requests of this type, with the stream id
+// in place of the message id, and a server as replies to the stream id.
+static constexpr uint64_t stream_frame_type = std::numeric_limits<uint64_t>::max();
+
+// A client cancels a request it sent with an empty request of this type,
+// with the request's message id.
+static constexpr uint64_t cancel_frame_type = stream_frame_type - 1;
+
+enum class stream_frame_kind : uint32_t {
+    data = 0,    // a message
+    credit = 1,  // followed by the number of bytes the receiver consumed
+    eos = 2,     // the sender will send nothing more
+    abandon = 3, // the receiver wants nothing more
+};
+
+// Head room left in front of a stream frame, for the connection's frame
+// header and the frame kind
+static constexpr size_t stream_head_space = 48;
+
+class stream_channel;
+
+// What a stream needs from the connection that carries it
+class stream_transport {
+public:
+    virtual ~stream_transport() {}
+    // Queues a frame built with stream_head_space bytes of head room;
+    // returns false if the connection is closed
+    virtual bool send_stream_frame(id_type id, snd_buf data) = 0;
+    virtual lw_shared_ptr<stream_channel> open_stream(id_type id) = 0;
+    virtual void release_stream(id_type id) = 0;
+};
+
+// State of one stream on a connection, shared by the sinks and sources
+// attached to it locally.
+//
+// Flow control is by credit: a sink may have at most the peer's window of
+// bytes sent and not yet consumed by the peer's source, which returns the
+// bytes it consumes as credit frames. A message larger than the window is
+// charged the whole window.
+class stream_channel : public enable_lw_shared_from_this<stream_channel> {
+    struct message {
+        rcv_buf data;
+        std::experimental::optional<resource_permit> permit;
+    };
+    stream_transport* _transport; // null once released or aborted
+    id_type _id;
+    size_t _window;      // what we may buffer
+    size_t _peer_window; // what the peer may buffer
+    semaphore _credit;
+    std::deque<message> _incoming;
+    std::experimental::optional<promise<>> _readable;
+    size_t _consumed = 0; // not yet returned as credit
+    unsigned _sinks = 0;
+    unsigned _sources = 0;
+    bool _closing = false;
+    bool _eos_sent = false;
+    bool _eos_received = false;
+    bool _abandon_sent = false;
+    std::exception_ptr _error;
+private:
+    void send_control(stream_frame_kind kind, std::experimental::optional<uint32_t> arg = {});
+    void send_eos();
+    void wake_reader();
+    void maybe_release();
+public:
+    stream_channel(stream_transport* transport, id_type id, size_t window, size_t peer_window);
+    id_type id() const {
+        return _id;
+    }
+    void attach_sink() {
+        ++_sinks;
+    }
+    void attach_source() {
+        ++_sources;
+    }
+    // The last sink going sends the end of the stream; the last source
+    // going before it, tells the peer to stop sending.
+    void detach_sink();
+    void detach_source();
+    // Sends a data frame built with stream_head_space bytes of head room,
+    // once the peer has room for it; resolves when it is queued on the
+    // connection.
+    future<> send(snd_buf data);
+    // Ends the stream, after the messages already sent.
+    future<> close();
+    // The next message, with its 4 byte kind, or nothing at the end of
+    // the stream.
+    future<std::experimental::optional<rcv_buf>> receive();
+    // Handles a frame from the peer; permit holds the memory it takes
+    // while buffered.
+    void deliver(rcv_buf frame, std::experimental::optional<resource_permit> permit);
+    // The connection is gone.
+    void abort(std::exception_ptr ex);
+};
+
+template <typename... T>
+class source;
+
+/// The sending end of an rpc stream.
+///
+/// A client makes one with \ref protocol::client::make_stream_sink(), and
+/// passes it to a verb whose handler takes an \ref source of the same
+/// types; a handler makes one for the opposite direction of the same
+/// stream with \ref source::make_sink(). Messages are pipelined on the
+/// call's connection and flow controlled, so that a slow receiver does not
+/// hold up the other calls and streams of the connection.
+template <typename... T>
+class sink {
+public:
+    class impl {
+    protected:
+        lw_shared_ptr<stream_channel> _channel;
+    public:
+        explicit impl(lw_shared_ptr<stream_channel> channel) : _channel(std::move(channel)) {
+            _channel->attach_sink();
+        }
+        virtual ~impl() {
+            _channel->detach_sink();
+        }
+        virtual future<> operator()(const T&... args) = 0;
+        const lw_shared_ptr<stream_channel>& channel() const {
+            return _channel;
+        }
+    };
+private:
+    shared_ptr<impl> _impl;
+public:
+    explicit sink(shared_ptr<impl> impl) : _impl(std::move(impl)) {}
+    /// Sends a message; resolves once the receiver has room for it, or
+    /// fails with \ref stream_closed if the receiver went away.
+    future<> operator()(const T&... args) {
+        return (*_impl)(args...);
+    }
+    /// Ends the stream; it also ends once all copies of the sink are gone.
+    future<> close() {
+        return _impl->channel()->close();
+    }
+    id_type get_id() const {
+        return _impl->channel()->id();
+    }
+    /// Makes a source for the messages the peer sends back on the stream.
+    template <typename Serializer, typename... In>
+    source<In...> make_source();
+};
+
+/// The receiving end of an rpc stream.
+template <typename... T>
+class source {
+public:
+    class impl {
+    protected:
+        lw_shared_ptr<stream_channel> _channel;
+    public:
+        explicit impl(lw_shared_ptr<stream_channel> channel) : _channel(std::move(channel)) {
+            _channel->attach_source();
+        }
+        virtual ~impl() {
+            _channel->detach_source();
+        }
+        virtual future<std::experimental::optional<std::tuple<T...>>> operator()() = 0;
+        const lw_shared_ptr<stream_channel>& channel() const {
+            return _channel;
+        }
+    };
+private:
+    shared_ptr<impl> _impl;
+public:
+    explicit source(shared_ptr<impl> impl) : _impl(std::move(impl)) {}
+    /// Returns the next message, or nothing once the peer ended the
+    /// stream. Only one call may be outstanding at a time.
+    future<std::experimental::optional<std::tuple<T...>>> operator()() {
+        return (*_impl)();
+    }
+    id_type get_id() const {
+        return _impl->channel()->id();
+    }
+    /// Makes a sink for sending messages back to the peer on the stream.
+    template <typename Serializer, typename... Out>
+    sink<Out...> make_sink();
+};
+
 // MsgType is a type that holds type of a message. The type should be hashable
 // and serializable. It is preferable to use enum for message types, but
 // do not forget to provide hash function for it
 template<typename Serializer, typename MsgType = uint32_t>
 class protocol {
-    class connection {
+    class connection : public stream_transport {
     protected:
         connected_socket _fd;
         input_stream<char> _read_buf;
@@ -128,8 +416,10 @@ class protocol {
             snd_buf buf;
             std::experimental::optional<promise<>> p = promise<>();
             cancellable* pcancel = nullptr;
-            outgoing_entry(snd_buf b) : buf(std::move(b)) {}
-            outgoing_entry(outgoing_entry&& o) : t(std::move(o.t)), buf(std::move(o.buf)), p(std::move(o.p)), pcancel(o.pcancel) {
+            std::experimental::optional<uint64_t> verb; // for compression sampling and verb metrics
+            std::experimental::optional<rpc_clock_type::time_point> queued; // if verb metrics are enabled
+            outgoing_entry(snd_buf b, std::experimental::optional<uint64_t> v) : buf(std::move(b)), verb(v) {}
+            outgoing_entry(outgoing_entry&& o) : t(std::move(o.t)), buf(std::move(o.buf)), p(std::move(o.p)), pcancel(o.pcancel), verb(o.verb), queued(o.queued) {
                 o.p = std::experimental::nullopt;
             }
             ~outgoing_entry() {
@@ -143,17 +433,96 @@ class protocol {
             }
         };
         friend outgoing_entry;
-        std::list<outgoing_entry> _outgoing_queue;
+        // The messages of a priority class waiting to be sent; send_loop()
+        // takes from them by weighted fair queueing, counting bytes
+        struct lane {
+            std::list<outgoing_entry> queue;
+            unsigned weight;
+            double finish = 0; // virtual time when what the lane sent ends
+            explicit lane(unsigned w) : weight(w) {}
+        };
+        std::vector<lane> _lanes; // by priority class
+        double _vtime = 0;
         condition_variable _outgoing_queue_cond;
         future<> _send_loop_stopped = make_ready_future<>();
         std::unique_ptr<compressor> _compressor;
         bool _timeout_negotiated = false;
+        bool _tracing_negotiated = false;
+        bool _uncompressed_frames_negotiated = false;
+        size_t _compression_threshold = 0;
+        bool _adaptive_compression = false;
+        bool _streams_negotiated = false;
+        bool _cancel_negotiated = false;
+        size_t _stream_window = 0;
+        size_t _peer_stream_window = 0;
+        std::unordered_map<id_type, lw_shared_ptr<stream_channel>> _streams;
+
+        static sstring stream_window_feature(size_t window) {
+            sstring ret(sstring::initialized_later(), 4);
+            write_le<uint32_t>(ret.begin(), std::min<size_t>(window, std::numeric_limits<uint32_t>::max()));
+            return ret;
+        }
+        void negotiate_streams(const sstring& peer_window) {
+            if (peer_window.size() == 4) {
+                _streams_negotiated = true;
+                _peer_stream_window = std::max<size_t>(read_le<uint32_t>(peer_window.begin()), 1);
+            }
+        }
+        // Hands a stream frame to its stream; frames for unknown streams
+        // open them only if create is set
+        void receive_stream_frame(id_type id, rcv_buf data, bool create, std::experimental::optional<resource_permit> permit = {}) {
+            lw_shared_ptr<stream_channel> chan;
+            auto it = _streams.find(id);
+            if (it != _streams.end()) {
+                chan = it->second;
+            } else if (create) {
+                chan = open_stream(id);
+            } else {
+                return;
+            }
+            chan->deliver(std::move(data), std::move(permit));
+        }
+        void abort_streams() {
+            auto streams = std::move(_streams);
+            for (auto&& s : streams) {
+                s.second->abort(std::make_exception_ptr(closed_error()));
+            }
+        }
 
-        snd_buf compress(snd_buf buf) {
+        bool worth_compressing(const snd_buf& buf, std::experimental::optional<uint64_t> verb) {
+            if (!_uncompressed_frames_negotiated || buf.size >= uncompressed_frame_flag) {
+                return true;
+            }
+            if (buf.size < _compression_threshold) {
+                return false;
+            }
+            return !_adaptive_compression || !verb || _proto._compression_sampler.should_compress(*verb);
+        }
+
+        snd_buf compress(snd_buf buf, std::experimental::optional<uint64_t> verb = {}) {
             if (_compressor) {
+                if (!worth_compressing(buf, verb)) {
+                    // prepend the frame length
+                    std::vector<temporary_buffer<char>> v;
+                    v.push_back(temporary_buffer<char>(4));
+                    write_le<uint32_t>(v.front().get_write(), buf.size | uncompressed_frame_flag);
+                    if (auto* one = boost::get<temporary_buffer<char>>(&buf.bufs)) {
+                        v.push_back(std::move(*one));
+                    } else {
+                        auto& bufs = boost::get<std::vector<temporary_buffer<char>>>(buf.bufs);
+                        std::move(bufs.begin(), bufs.end(), std::back_inserter(v));
+                    }
+                    buf.bufs = std::move(v);
+                    buf.size += 4;
+                    return std::move(buf);
+                }
+                auto raw = buf.size;
                 buf = _compressor->compress(4, std::move(buf));
                 static_assert(snd_buf::chunk_size >= 4, "send buffer chunk size is too small");
                 write_le<uint32_t>(buf.front().get_write(), buf.size - 4);
+                if (_adaptive_compression && verb) {
+                    _proto._compression_sampler.record(*verb, raw, buf.size - 4);
+                }
                 return std::move(buf);
             }
             return std::move(buf);
@@ -177,42 +546,84 @@ class protocol {
             request,
             response
         };
+        // Bytes of queued messages written out with a single flush
+        static constexpr size_t max_send_batch = 256 * 1024;
+        // Takes d off the queue, so it can no longer time out or be
+        // cancelled, and makes its frame
+        template<outgoing_queue_type QueueType>
+        void prepare_send(outgoing_entry& d) {
+            d.t.cancel(); // cancel timeout timer
+            if (d.pcancel) {
+                d.pcancel->cancel_send = std::function<void()>(); // request is no longer cancellable
+            }
+            if (QueueType == outgoing_queue_type::request) {
+                static_assert(snd_buf::chunk_size >= 24, "send buffer chunk size is too small");
+                if (!_tracing_negotiated) {
+                    d.buf.front().trim_front(16);
+                    d.buf.size -= 16;
+                }
+                if (_timeout_negotiated) {
+                    auto expire = d.t.get_timeout();
+                    uint64_t left = 0;
+                    if (expire != typename timer<rpc_clock_type>::time_point()) {
+                        left = std::chrono::duration_cast<std::chrono::milliseconds>(expire - timer<rpc_clock_type>::clock::now()).count();
+                    }
+                    write_le<uint64_t>(d.buf.front().get_write() + (_tracing_negotiated ? 16 : 0), left);
+                } else {
+                    if (_tracing_negotiated) {
+                        // keep the trace context, which comes first
+                        auto p = d.buf.front().get_write();
+                        std::memmove(p + 8, p, 16);
+                    }
+                    d.buf.front().trim_front(8);
+                    d.buf.size -= 8;
+                }
+            }
+            if (d.queued) {
+                auto& vm = _proto._verb_metrics->get(*d.verb);
+                auto& h = QueueType == outgoing_queue_type::request ? vm.request_queue_time : vm.response_queue_time;
+                h.add_us(rpc_clock_type::now() - *d.queued);
+            }
+            d.buf = compress(std::move(d.buf), d.verb);
+        }
         template<outgoing_queue_type QueueType>
         void send_loop() {
             _send_loop_stopped = do_until([this] { return _error; }, [this] {
-                return _outgoing_queue_cond.wait([this] { return !_outgoing_queue.empty(); }).then([this] {
+                return _outgoing_queue_cond.wait([this] { return outgoing_queue_size() != 0; }).then([this] {
                     // despite using wait with predicated above _outgoing_queue can still be empty here if
                     // there is only one entry on the list and its expire timer runs after wait() returned ready future,
                     // but before this continuation runs.
-                    if (_outgoing_queue.empty()) {
+                    if (!outgoing_queue_size()) {
                         return make_ready_future();
                     }
-                    auto d = std::move(_outgoing_queue.front());
-                    _outgoing_queue.pop_front();
-                    d.t.cancel(); // cancel timeout timer
-                    if (d.pcancel) {
-                        d.pcancel->cancel_send = std::function<void()>(); // request is no longer cancellable
-                    }
-                    if (QueueType == outgoing_queue_type::request) {
-                        static_assert(snd_buf::chunk_size >= 8, "send buffer chunk size is too small");
-                        if (_timeout_negotiated) {
-                            auto expire = d.t.get_timeout();
-                            uint64_t left = 0;
-                            if (expire != typename timer<rpc_clock_type>::time_point()) {
-                                left = std::chrono::duration_cast<std::chrono::milliseconds>(expire - timer<rpc_clock_type>::clock::now()).count();
-                            }
-                            write_le<uint64_t>(d.buf.front().get_write(), left);
-                        } else {
-                            d.buf.front().trim_front(8);
-                            d.buf.size -= 8;
+                    // Sends what is queued now, up to max_send_batch bytes,
+                    // with one flush; what is queued meanwhile waits for the
+                    // next batch, and can still time out or be cancelled.
+                    // Entries are spliced, so that cancellables keep
+                    // pointing at them
+                    std::list<outgoing_entry> batch;
+                    size_t bytes = 0;
+                    while (auto* l = next_lane()) {
+                        auto& q = l->queue;
+                        auto size = q.front().buf.size;
+                        if (!batch.empty() && bytes + size > max_send_batch) {
+                            break;
                         }
+                        bytes += size;
+                        _vtime = std::max(l->finish, _vtime);
+                        l->finish = _vtime + double(size) / l->weight;
+                        batch.splice(batch.end(), q, q.begin());
+                        prepare_send<QueueType>(batch.back());
                     }
-                    d.buf = compress(std::move(d.buf));
-                    auto f = send_buffer(std::move(d.buf)).then([this] {
-                        _stats.sent_messages++;
-                        return _write_buf.flush();
+                    return do_with(std::move(batch), [this] (std::list<outgoing_entry>& batch) {
+                        return do_for_each(batch, [this] (outgoing_entry& d) {
+                            return send_buffer(std::move(d.buf)).then([this] {
+                                _stats.sent_messages++;
+                            });
+                        }).then([this] {
+                            return _write_buf.flush();
+                        });
                     });
-                    return f.finally([d = std::move(d)] {});
                 });
             }).handle_exception([this] (std::exception_ptr eptr) {
                 _error = true;
@@ -226,14 +637,44 @@ class protocol {
                 _fd.shutdown_output();
             }
             return _send_loop_stopped.finally([this] {
-                _outgoing_queue.clear();
+                abort_streams();
+                for (auto&& l : _lanes) {
+                    l.queue.clear();
+                }
                 return _connected ? _write_buf.close() : make_ready_future();
             });
         }
 
+        // The non-empty lane whose turn it is to send
+        lane* next_lane() {
+            lane* ret = nullptr;
+            for (auto&& l : _lanes) {
+                if (!l.queue.empty() && (!ret || std::max(l.finish, _vtime) < std::max(ret->finish, _vtime))) {
+                    ret = &l;
+                }
+            }
+            return ret;
+        }
+        void init_lanes() {
+            for (auto&& c : _proto._priority_classes) {
+                _lanes.emplace_back(c.weight);
+            }
+        }
+        size_t outgoing_queue_size() const {
+            size_t ret = 0;
+            for (auto&& l : _lanes) {
+                ret += l.queue.size();
+            }
+            return ret;
+        }
+
     public:
-        connection(connected_socket&& fd, protocol& proto) : _fd(std::move(fd)), _read_buf(_fd.input()), _write_buf(_fd.output()), _proto(proto), _connected(true) {}
-        connection(protocol& proto) : _proto(proto) {}
+        connection(connected_socket&& fd, protocol& proto) : _fd(std::move(fd)), _read_buf(_fd.input()), _write_buf(_fd.output()), _proto(proto), _connected(true) {
+            init_lanes();
+        }
+        connection(protocol& proto) : _proto(proto) {
+            init_lanes();
+        }
         void set_socket(connected_socket&& fd) {
             if (_connected) {
                 throw std::runtime_error("already connected");
@@ -251,31 +692,48 @@ class protocol {
         }
         // functions below are public because they are used by external heavily templated functions
         // and I am not smart enough to know how to define them as friends
-        future<> send(snd_buf buf, std::experimental::optional<rpc_clock_type::time_point> timeout = {}, cancellable* cancel = nullptr) {
+        // verb, if given, is the one whose compression the frame samples
+        future<> send(snd_buf buf, std::experimental::optional<rpc_clock_type::time_point> timeout = {}, cancellable* cancel = nullptr,
+                std::experimental::optional<uint64_t> verb = {}) {
             if (!_error) {
                 if (timeout && *timeout <= rpc_clock_type::now()) {
                     return make_ready_future<>();
                 }
-                _outgoing_queue.emplace_back(std::move(buf));
-                auto deleter = [this, it = std::prev(_outgoing_queue.cend())] {
-                    _outgoing_queue.erase(it);
+                auto cls = verb ? _proto.priority_class_of(*verb) : 0;
+                auto& q = _lanes[cls < _lanes.size() ? cls : 0].queue;
+                q.emplace_back(std::move(buf), verb);
+                if (verb && *verb != stream_frame_type && _proto._verb_metrics) {
+                    q.back().queued = rpc_clock_type::now();
+                }
+                auto deleter = [&q, it = std::prev(q.cend())] {
+                    q.erase(it);
                 };
                 if (timeout) {
-                    auto& t = _outgoing_queue.back().t;
+                    auto& t = q.back().t;
                     t.set_callback(deleter);
                     t.arm(timeout.value());
                 }
                 if (cancel) {
                     cancel->cancel_send = std::move(deleter);
-                    cancel->send_back_pointer = &_outgoing_queue.back().pcancel;
-                    _outgoing_queue.back().pcancel = cancel;
+                    cancel->send_back_pointer = &q.back().pcancel;
+                    q.back().pcancel = cancel;
                 }
                 _outgoing_queue_cond.signal();
-                return _outgoing_queue.back().p->get_future();
+                return q.back().p->get_future();
             } else {
                 return make_exception_future<>(closed_error());
             }
         }
+        virtual lw_shared_ptr<stream_channel> open_stream(id_type id) override {
+            auto it = _streams.find(id);
+            if (it == _streams.end()) {
+                it = _streams.emplace(id, make_lw_shared<stream_channel>(this, id, _stream_window, _peer_stream_window)).first;
+            }
+            return it->second;
+        }
+        virtual void release_stream(id_type id) override {
+            _streams.erase(id);
+        }
         bool error() { return _error; }
         auto& serializer() { return _proto._serializer; }
         auto& get_protocol() { return _proto; }
@@ -295,11 +753,13 @@ class protocol {
         class connection : public protocol::connection, public enable_lw_shared_from_this<connection> {
             server& _server;
             client_info _info;
+            // of the requests being handled, when the client may cancel them
+            request_cancellation::registry _cancellations;
         private:
             future<> negotiate_protocol(input_stream<char>& in);
-            future<std::experimental::optional<uint64_t>, MsgType, int64_t, std::experimental::optional<rcv_buf>>
+            future<std::experimental::optional<uint64_t>, MsgType, int64_t, tracing::trace_context, std::experimental::optional<rcv_buf>>
             read_request_frame(input_stream<char>& in);
-            future<std::experimental::optional<uint64_t>, MsgType, int64_t, std::experimental::optional<rcv_buf>>
+            future<std::experimental::optional<uint64_t>, MsgType, int64_t, tracing::trace_context, std::experimental::optional<rcv_buf>>
             read_request_frame_compressed(input_stream<char>& in);
             feature_map negotiate(feature_map requested);
             void send_loop() {
@@ -308,12 +768,14 @@ class protocol {
         public:
             connection(server& s, connected_socket&& fd, socket_address&& addr, protocol& proto);
             future<> process();
-            future<> respond(int64_t msg_id, snd_buf&& data, std::experimental::optional<rpc_clock_type::time_point> timeout);
+            virtual bool send_stream_frame(id_type id, snd_buf data) override;
+            future<> respond(int64_t msg_id, snd_buf&& data, std::experimental::optional<rpc_clock_type::time_point> timeout,
+                    std::experimental::optional<uint64_t> verb = {});
             client_info& info() { return _info; }
             const client_info& info() const { return _info; }
             stats get_stats() const {
                 stats res = this->_stats;
-                res.pending = this->_outgoing_queue.size();
+                res.pending = this->outgoing_queue_size();
                 return res;
             }
 
@@ -324,16 +786,60 @@ class protocol {
                 return ipv4_addr(_info.addr);
             }
             // Resources will be released when this goes out of scope
-            future<resource_permit> wait_for_resources(size_t memory_consumed,  std::experimental::optional<rpc_clock_type::time_point> timeout) {
+            future<resource_permit> wait_for_resources(size_t memory_consumed,  std::experimental::optional<rpc_clock_type::time_point> timeout,
+                    unsigned priority_class = 0) {
+                auto& sem = _server.resources(priority_class).available;
                 if (timeout) {
-                    return get_units(_server._resources_available, memory_consumed, *timeout);
+                    return get_units(sem, memory_consumed, *timeout);
                 } else {
-                    return get_units(_server._resources_available, memory_consumed);
+                    return get_units(sem, memory_consumed);
                 }
             }
             size_t estimate_request_size(size_t serialized_size) {
                 return rpc::estimate_request_size(_server._limits, serialized_size);
             }
+            enum class admission { accept, expired, overloaded };
+            // Whether a request that arrived now, and expires at timeout,
+            // should be dispatched, dropped or rejected
+            admission admit(size_t memory_consumed, std::experimental::optional<rpc_clock_type::time_point> timeout,
+                    rpc_clock_type::time_point now, unsigned priority_class = 0);
+            void count_shed(admission a) {
+                if (a == admission::expired) {
+                    _server._shed_stats.expired++;
+                    this->_stats.shed_expired++;
+                } else if (a == admission::overloaded) {
+                    _server._shed_stats.overloaded++;
+                    this->_stats.shed_overloaded++;
+                }
+            }
+            // Records that a request waited for memory
+            void resources_waited(rpc_clock_type::duration d, unsigned priority_class = 0) {
+                // moving average over about eight requests
+                auto& wait = _server.resources(priority_class).wait;
+                wait += (d - wait) / 8;
+            }
+            future<> respond_overloaded(int64_t msg_id, std::experimental::optional<rpc_clock_type::time_point> timeout);
+            // Registers a request the client may cancel, until the result
+            // is gone; null if it cannot
+            lw_shared_ptr<request_cancellation> track_cancellation(int64_t msg_id) {
+                if (!this->_cancel_negotiated) {
+                    return nullptr;
+                }
+                return make_lw_shared<request_cancellation>(_cancellations, msg_id);
+            }
+            // A request already replied to, or dropped, is no longer known
+            void cancel_request(int64_t msg_id) {
+                auto it = _cancellations.find(msg_id);
+                if (it != _cancellations.end() && !it->second->cancelled()) {
+                    it->second->cancel();
+                    this->_stats.cancelled++;
+                }
+            }
+            void cancel_all_requests() {
+                for (auto&& c : std::exchange(_cancellations, {})) {
+                    c.second->detach();
+                }
+            }
             size_t max_request_size() const {
                 return _server._limits.max_memory;
             }
@@ -345,11 +851,31 @@ class protocol {
         protocol& _proto;
         server_socket _ss;
         resource_limits _limits;
-        rpc_semaphore _resources_available;
+        struct class_resources {
+            rpc_semaphore available;
+            rpc_clock_type::duration wait{}; // average time requests waited for memory
+            explicit class_resources(size_t max_memory) : available(max_memory) {}
+        };
+        std::deque<class_resources> _resources; // by priority class
         std::unordered_set<lw_shared_ptr<connection>> _conns;
         promise<> _ss_stopped;
         gate _reply_gate;
         server_options _options;
+        std::experimental::optional<server_socket> _shard_ss;
+        promise<> _shard_ss_stopped;
+    public:
+        struct shed_stats {
+            uint64_t expired = 0;
+            uint64_t overloaded = 0;
+        };
+    private:
+        shed_stats _shed_stats;
+    private:
+        class_resources& resources(unsigned priority_class) {
+            return _resources[priority_class < _resources.size() ? priority_class : 0];
+        }
+        void accept(server_socket& ss, promise<>& stopped);
+        void listen_on_shard_port(ipv4_addr addr);
     public:
         server(protocol& proto, ipv4_addr addr, resource_limits memory_limit = resource_limits());
         server(protocol& proto, server_options opts, ipv4_addr addr, resource_limits memory_limit = resource_limits());
@@ -358,8 +884,15 @@ class protocol {
         void accept();
         future<> stop() {
             _ss.abort_accept();
-            _resources_available.broken();
-            return when_all(_ss_stopped.get_future(),
+            if (_shard_ss) {
+                _shard_ss->abort_accept();
+            } else {
+                _shard_ss_stopped.set_value();
+            }
+            for (auto&& r : _resources) {
+                r.available.broken();
+            }
+            return when_all(_ss_stopped.get_future(), _shard_ss_stopped.get_future(),
                 parallel_for_each(_conns, [] (lw_shared_ptr<connection> conn) {
                     return conn->stop();
                 }),
@@ -375,6 +908,11 @@ class protocol {
         gate& reply_gate() {
             return _reply_gate;
         }
+        /// Requests dropped because they had expired, and rejected because
+        /// they would have, by all connections
+        const shed_stats& get_shed_stats() const {
+            return _shed_stats;
+        }
         friend connection;
     };
 
@@ -417,6 +955,8 @@ class protocol {
         std::unordered_map<id_type, std::unique_ptr<reply_handler_base>> _outstanding;
         ipv4_addr _server_addr;
         client_options _options;
+        shared_promise<> _negotiated;
+        std::experimental::optional<shard_info> _peer_shard_info;
     private:
         future<> negotiate_protocol(input_stream<char>& in);
         void negotiate(feature_map server_features);
@@ -451,7 +991,7 @@ class protocol {
         stats get_stats() const {
             stats res = this->_stats;
             res.wait_reply = _outstanding.size();
-            res.pending = this->_outgoing_queue.size();
+            res.pending = this->outgoing_queue_size();
             return res;
         }
 
@@ -459,6 +999,16 @@ class protocol {
             return this->_stats;
         }
         auto next_message_id() { return _message_id++; }
+        /// Which server shard serves the connection, once it is
+        /// established, if the server tells
+        const std::experimental::optional<shard_info>& peer_shard_info() const {
+            return _peer_shard_info;
+        }
+        virtual bool send_stream_frame(id_type id, snd_buf data) override;
+        /// Opens a stream on the connection, once it is established, and
+        /// returns its sink; fails if the server does not support streams.
+        template <typename... T>
+        future<sink<T...>> make_stream_sink();
         void wait_for_reply(id_type id, std::unique_ptr<reply_handler_base>&& h, std::experimental::optional<rpc_clock_type::time_point> timeout, cancellable* cancel) {
             if (timeout) {
                 h->t.set_callback(std::bind(std::mem_fn(&client::wait_timed_out), this, id));
@@ -468,6 +1018,7 @@ class protocol {
                 cancel->cancel_wait = [this, id] {
                     _outstanding[id]->cancel();
                     _outstanding.erase(id);
+                    send_cancel(id);
                 };
                 h->pcancel = cancel;
                 cancel->wait_back_pointer = &h->pcancel;
@@ -478,7 +1029,11 @@ class protocol {
             this->_stats.timeout++;
             _outstanding[id]->timeout();
             _outstanding.erase(id);
+            send_cancel(id);
         }
+        // Tells the server to give up on a request; one it has not received
+        // is not known to it, and ignored
+        void send_cancel(id_type id);
 
         future<> stop() {
             if (!this->_error) {
@@ -491,15 +1046,112 @@ class protocol {
             return _server_addr;
         }
     };
+
+    /// Connections to a set of servers, for calls that should be served by
+    /// a given shard of the server.
+    ///
+    /// \ref get() returns a connection to the server that the shard serves,
+    /// if the server listens on shard ports (see \ref server_options::shard_port_base),
+    /// and any connection to it otherwise, or until the server told which
+    /// ports it uses. The pool keeps up to connections_per_shard connections
+    /// to each server shard; it returns the one with the fewest calls queued
+    /// and waiting for replies, and only opens another when that one is busy.
+    /// Connections that fail are closed, and replaced on the next get().
+    class client_pool {
+    public:
+        using socket_factory = std::function<socket ()>;
+    private:
+        using connections = std::vector<std::unique_ptr<client>>;
+        protocol& _proto;
+        client_options _options;
+        unsigned _connections_per_shard;
+        socket_factory _socket_factory;
+        struct server_state {
+            connections any; // to the server's address
+            std::vector<connections> shards; // to its shard ports
+            std::experimental::optional<shard_info> info;
+        };
+        std::unordered_map<uint64_t, server_state> _servers;
+        gate _closing; // failed connections being stopped
+    private:
+        client& pick(connections& conns, ipv4_addr addr);
+        void close_failed(connections& conns);
+    public:
+        /// \param socket_factory makes the sockets of the connections; by
+        ///        default, they use the stack of the shard
+        client_pool(protocol& proto, client_options options = client_options(), unsigned connections_per_shard = 1,
+                socket_factory factory = socket_factory());
+        client_pool(const client_pool&) = delete;
+        client_pool& operator=(const client_pool&) = delete;
+        /// Returns a connection to \c addr that \c shard of the server
+        /// serves, if it can. The connection lives until \ref stop()
+        /// resolves, even if it fails.
+        client& get(ipv4_addr addr, unsigned shard);
+        /// Number of open connections
+        size_t size() const;
+        /// Closes the connections; the pool may be destroyed once the
+        /// returned future resolves.
+        future<> stop();
+    };
     friend server;
 private:
     using rpc_handler = std::function<future<> (lw_shared_ptr<typename server::connection>, std::experimental::optional<rpc_clock_type::time_point> timeout, int64_t msgid,
                                                 rcv_buf data)>;
     std::unordered_map<MsgType, rpc_handler> _handlers;
     Serializer _serializer;
+    compression_sampler _compression_sampler;
+    std::unique_ptr<verb_metrics> _verb_metrics;
+    std::vector<priority_class_config> _priority_classes{1};
+    std::unordered_map<uint64_t, unsigned> _verb_classes;
     std::function<void(const sstring&)> _logger;
+private:
+    template<typename Func>
+    auto register_handler(MsgType t, std::experimental::optional<scheduling_group> sg, Func&& func);
 public:
     protocol(Serializer&& serializer) : _serializer(std::forward<Serializer>(serializer)) {}
+
+    /// Sets the priority classes verbs can be put in with
+    /// \ref set_priority_class(); verbs are in class 0 unless put in
+    /// another. Connections queue the messages of each class separately,
+    /// and send them in proportion to the classes' weights when the link is
+    /// contended, so that small messages of a latency sensitive class do
+    /// not wait behind bulk transfers; servers limit the memory the
+    /// requests of each class take separately.
+    ///
+    /// Takes effect for the clients and servers created afterwards.
+    void set_priority_classes(std::vector<priority_class_config> classes) {
+        if (classes.empty() || std::any_of(classes.begin(), classes.end(), [] (auto& c) { return !c.weight; })) {
+            throw std::invalid_argument("priority classes must be given, with non-zero weights");
+        }
+        _priority_classes = std::move(classes);
+    }
+    /// Puts a verb's requests and responses in a priority class
+    void set_priority_class(MsgType t, unsigned priority_class) {
+        if (priority_class >= _priority_classes.size()) {
+            throw std::invalid_argument(sprint("no priority class %d", priority_class));
+        }
+        _verb_classes[uint64_t(t)] = priority_class;
+    }
+    unsigned priority_class_of(uint64_t verb) const {
+        auto i = _verb_classes.find(verb);
+        return i != _verb_classes.end() ? i->second : 0;
+    }
+
+    /// Exports histograms of the protocol's message sizes and latencies,
+    /// by verb, in the "rpc_verb" metrics group. Servers record the sizes
+    /// of requests and responses, and how long handlers took to respond;
+    /// clients, the round trip latency of calls; both, the time messages
+    /// wait in the connection's send queue.
+    ///
+    /// \param name labels the protocol's metrics, so it must be unique on
+    ///        the shard
+    void enable_verb_metrics(sstring name) {
+        _verb_metrics = std::make_unique<verb_metrics>(std::move(name));
+    }
+    // The histograms of a verb, or nullptr if verb metrics are disabled
+    verb_metrics::verb* get_verb_metrics(MsgType t) {
+        return _verb_metrics ? &_verb_metrics->get(uint64_t(t)) : nullptr;
+    }
     template<typename Func>
     auto make_client(MsgType t);
 
@@ -509,6 +1161,11 @@ class protocol {
     template<typename Func>
     auto register_handler(MsgType t, Func&& func);
 
+    /// Registers a handler, like the above, that runs in a \ref scheduling_group
+    /// rather than in the group of the server's connection
+    template<typename Func>
+    auto register_handler(MsgType t, scheduling_group sg, Func&& func);
+
     void unregister_handler(MsgType t) {
         _handlers.erase(t);
     }
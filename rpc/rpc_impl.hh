@@ -39,6 +39,7 @@ namespace rpc {
 enum class exception_type : uint32_t {
     USER = 0,
     UNKNOWN_VERB = 1,
+    OVERLOADED = 2,
 };
 
 template<typename T>
@@ -199,27 +200,34 @@ inline void marshall_one(Serializer& serializer, Output& out, const T& arg) {
     serialize_helper_type::serialize(serializer, out, arg);
 }
 
+// a sink is sent as the id of its stream
+template <typename Serializer, typename Output, typename... T>
+inline void marshall_one(Serializer& serializer, Output& out, const sink<T...>& arg) {
+    uint64_t id = cpu_to_le(uint64_t(arg.get_id()));
+    out.write(reinterpret_cast<const char*>(&id), sizeof(id));
+}
+
 template <typename Serializer, typename Output, typename... T>
 inline void do_marshall(Serializer& serializer, Output& out, const T&... args) {
     // C++ guarantees that brace-initialization expressions are evaluted in order
     (void)std::initializer_list<int>{(marshall_one(serializer, out, args), 1)...};
 }
 
-static inline memory_output_stream<snd_buf::iterator> make_serializer_stream(snd_buf& output) {
+static inline snd_buf_stream make_serializer_stream(snd_buf& output) {
     auto* b = boost::get<temporary_buffer<char>>(&output.bufs);
     if (b) {
-        return memory_output_stream<snd_buf::iterator>(memory_output_stream<snd_buf::iterator>::simple(b->get_write(), b->size()));
+        return snd_buf_stream(memory_output_stream<snd_buf::iterator>::simple(b->get_write(), b->size()));
     } else {
         auto& ar = boost::get<std::vector<temporary_buffer<char>>>(output.bufs);
-        return memory_output_stream<snd_buf::iterator>(memory_output_stream<snd_buf::iterator>::fragmented(ar.begin(), output.size));
+        return snd_buf_stream(memory_output_stream<snd_buf::iterator>::fragmented(ar.begin(), output.size));
     }
 }
 
 template <typename Serializer, typename... T>
 inline snd_buf marshall(Serializer& serializer, size_t head_space, const T&... args) {
-    measuring_output_stream measure;
+    frame_measuring_stream measure;
     do_marshall(serializer, measure, args...);
-    snd_buf ret(measure.size() + head_space);
+    auto ret = measure.make_buffer(head_space);
     auto out = make_serializer_stream(ret);
     out.skip(head_space);
     do_marshall(serializer, out, args...);
@@ -227,20 +235,20 @@ inline snd_buf marshall(Serializer& serializer, size_t head_space, const T&... a
 }
 
 template <typename Serializer, typename Input>
-inline std::tuple<> do_unmarshall(Serializer& serializer, Input& in) {
+inline std::tuple<> do_unmarshall(Serializer& serializer, Input& in, stream_transport* streams) {
     return std::make_tuple();
 }
 
 template<typename Serializer, typename Input, typename T>
 struct unmarshal_one {
-    static T doit(Serializer& serializer, Input& in) {
+    static T doit(Serializer& serializer, Input& in, stream_transport* streams) {
         return read(serializer, in, type<T>());
     }
 };
 
 template<typename Serializer, typename Input, typename T>
 struct unmarshal_one<Serializer, Input, optional<T>> {
-    static optional<T> doit(Serializer& serializer, Input& in) {
+    static optional<T> doit(Serializer& serializer, Input& in, stream_transport* streams) {
         if (in.size()) {
             return optional<T>(read(serializer, in, type<typename remove_optional<T>::type>()));
         } else {
@@ -249,18 +257,84 @@ struct unmarshal_one<Serializer, Input, optional<T>> {
     }
 };
 
+template <typename Serializer, typename... T>
+class source_impl;
+
+// a source is received as the id of the stream, on the connection that
+// carries it
+template<typename Serializer, typename Input, typename... T>
+struct unmarshal_one<Serializer, Input, source<T...>> {
+    static source<T...> doit(Serializer& serializer, Input& in, stream_transport* streams) {
+        uint64_t id;
+        in.read(reinterpret_cast<char*>(&id), sizeof(id));
+        if (!streams) {
+            throw rpc_protocol_error();
+        }
+        return source<T...>(make_shared<source_impl<Serializer, T...>>(serializer, streams->open_stream(id_type(le_to_cpu(id)))));
+    }
+};
+
 template <typename Serializer, typename Input, typename T0, typename... Trest>
-inline std::tuple<T0, Trest...> do_unmarshall(Serializer& serializer, Input& in) {
+inline std::tuple<T0, Trest...> do_unmarshall(Serializer& serializer, Input& in, stream_transport* streams) {
     // FIXME: something less recursive
-    auto first = std::make_tuple(unmarshal_one<Serializer, Input, T0>::doit(serializer, in));
-    auto rest = do_unmarshall<Serializer, Input, Trest...>(serializer, in);
+    auto first = std::make_tuple(unmarshal_one<Serializer, Input, T0>::doit(serializer, in, streams));
+    auto rest = do_unmarshall<Serializer, Input, Trest...>(serializer, in, streams);
     return std::tuple_cat(std::move(first), std::move(rest));
 }
 
 template <typename Serializer, typename... T>
-inline std::tuple<T...> unmarshall(Serializer& serializer, rcv_buf input) {
+inline std::tuple<T...> unmarshall(Serializer& serializer, rcv_buf input, stream_transport* streams = nullptr) {
     auto in = make_deserializer_stream(input);
-    return do_unmarshall<Serializer, decltype(in), T...>(serializer, in);
+    return do_unmarshall<Serializer, decltype(in), T...>(serializer, in, streams);
+}
+
+template <typename Serializer, typename... T>
+class sink_impl final : public sink<T...>::impl {
+    Serializer& _serializer;
+public:
+    sink_impl(Serializer& serializer, lw_shared_ptr<stream_channel> channel)
+            : sink<T...>::impl(std::move(channel)), _serializer(serializer) {}
+    virtual future<> operator()(const T&... args) override {
+        return this->_channel->send(marshall(_serializer, stream_head_space, args...));
+    }
+    Serializer& serializer() {
+        return _serializer;
+    }
+};
+
+template <typename Serializer, typename... T>
+class source_impl final : public source<T...>::impl {
+    Serializer& _serializer;
+public:
+    source_impl(Serializer& serializer, lw_shared_ptr<stream_channel> channel)
+            : source<T...>::impl(std::move(channel)), _serializer(serializer) {}
+    virtual future<std::experimental::optional<std::tuple<T...>>> operator()() override {
+        return this->_channel->receive().then([&serializer = _serializer] (std::experimental::optional<rcv_buf> data) {
+            if (!data) {
+                return std::experimental::optional<std::tuple<T...>>();
+            }
+            auto in = make_deserializer_stream(*data);
+            in.skip(4); // frame kind
+            return std::experimental::make_optional(do_unmarshall<Serializer, decltype(in), T...>(serializer, in, nullptr));
+        });
+    }
+    Serializer& serializer() {
+        return _serializer;
+    }
+};
+
+template <typename... T>
+template <typename Serializer, typename... In>
+source<In...> sink<T...>::make_source() {
+    auto& serializer = static_cast<sink_impl<Serializer, T...>&>(*_impl).serializer();
+    return source<In...>(make_shared<source_impl<Serializer, In...>>(serializer, _impl->channel()));
+}
+
+template <typename... T>
+template <typename Serializer, typename... Out>
+sink<Out...> source<T...>::make_sink() {
+    auto& serializer = static_cast<source_impl<Serializer, T...>&>(*_impl).serializer();
+    return sink<Out...>(make_shared<sink_impl<Serializer, Out...>>(serializer, _impl->channel()));
 }
 
 inline std::exception_ptr unmarshal_exception(rcv_buf& d) {
@@ -286,6 +360,9 @@ inline std::exception_ptr unmarshal_exception(rcv_buf& d) {
         ex = std::make_exception_ptr(unknown_verb_error(le_to_cpu(v64)));
         break;
     }
+    case exception_type::OVERLOADED:
+        ex = std::make_exception_ptr(overloaded_error());
+        break;
     default:
         ex = std::make_exception_ptr(unknown_exception_error());
         break;
@@ -383,18 +460,37 @@ auto send_helper(MsgType xt, signature<Ret (InArgs...)> xsig) {
 
             // send message
             auto msg_id = dst.next_message_id();
-            snd_buf data = marshall(dst.serializer(), 28, args...);
-            static_assert(snd_buf::chunk_size >= 28, "send buffer chunk size is too small");
-            auto p = data.front().get_write() + 8; // 8 extra bytes for expiration timer
+            tracing::span sp("rpc_client");
+            if (sp) {
+                sp.set_detail(to_sstring(uint64_t(t)));
+            }
+            snd_buf data = marshall(dst.serializer(), 44, args...);
+            static_assert(snd_buf::chunk_size >= 44, "send buffer chunk size is too small");
+            // 16 bytes for the trace context, dropped unless the server
+            // takes it, and 8 for the expiration timer
+            auto p = data.front().get_write();
+            write_le<uint64_t>(p, sp.context().trace_id);
+            write_le<uint64_t>(p + 8, sp.context().span_id);
+            p += 24;
             write_le<uint64_t>(p, uint64_t(t));
             write_le<int64_t>(p + 8, msg_id);
-            write_le<uint32_t>(p + 16, data.size - 28);
+            write_le<uint32_t>(p + 16, data.size - 44);
 
             // prepare reply handler, if return type is now_wait_type this does nothing, since no reply will be sent
             using wait = wait_signature_t<Ret>;
-            return when_all(dst.send(std::move(data), timeout, cancel), wait_for_reply<Serializer, MsgType>(wait(), timeout, cancel, dst, msg_id, sig)).then([] (auto r) {
+            auto f = when_all(dst.send(std::move(data), timeout, cancel, uint64_t(t)), wait_for_reply<Serializer, MsgType>(wait(), timeout, cancel, dst, msg_id, sig)).then([] (auto r) {
                     return std::move(std::get<1>(r)); // return future of wait_for_reply
             });
+            if (sp) {
+                f = f.finally([sp = std::move(sp)] {});
+            }
+            auto vm = dst.get_protocol().get_verb_metrics(t);
+            if (!vm || !std::is_same<wait, wait_type>::value) {
+                return f;
+            }
+            return f.finally([vm, sent = rpc_clock_type::now()] {
+                vm->round_trip_latency.add_us(rpc_clock_type::now() - sent);
+            });
         }
         auto operator()(typename protocol<Serializer, MsgType>::client& dst, const InArgs&... args) {
             return send(dst, {}, nullptr, args...);
@@ -416,17 +512,53 @@ auto send_helper(MsgType xt, signature<Ret (InArgs...)> xsig) {
 template <typename Serializer, typename MsgType>
 inline
 future<>
-protocol<Serializer, MsgType>::server::connection::respond(int64_t msg_id, snd_buf&& data, std::experimental::optional<rpc_clock_type::time_point> timeout) {
+protocol<Serializer, MsgType>::server::connection::respond(int64_t msg_id, snd_buf&& data, std::experimental::optional<rpc_clock_type::time_point> timeout,
+        std::experimental::optional<uint64_t> verb) {
     static_assert(snd_buf::chunk_size >= 12, "send buffer chunk size is too small");
     auto p = data.front().get_write();
     write_le<int64_t>(p, msg_id);
     write_le<uint32_t>(p + 8, data.size - 12);
-    return this->send(std::move(data), timeout);
+    return this->send(std::move(data), timeout, nullptr, verb);
+}
+
+template <typename Serializer, typename MsgType>
+typename protocol<Serializer, MsgType>::server::connection::admission
+protocol<Serializer, MsgType>::server::connection::admit(size_t memory_consumed, std::experimental::optional<rpc_clock_type::time_point> timeout,
+        rpc_clock_type::time_point now, unsigned priority_class) {
+    auto ret = admission::accept;
+    if (timeout) {
+        auto& r = _server.resources(priority_class);
+        auto must_wait = r.available.waiters() || r.available.available_units() < ssize_t(memory_consumed);
+        if (*timeout <= now) {
+            ret = admission::expired;
+        } else if (_server._options.shed_load && must_wait && *timeout - now < r.wait) {
+            ret = admission::overloaded;
+        }
+    }
+    count_shed(ret);
+    return ret;
+}
+
+template <typename Serializer, typename MsgType>
+future<>
+protocol<Serializer, MsgType>::server::connection::respond_overloaded(int64_t msg_id, std::experimental::optional<rpc_clock_type::time_point> timeout) {
+    // sent without waiting for memory, which the server lacks
+    snd_buf data(20);
+    static_assert(snd_buf::chunk_size >= 20, "send buffer chunk size is too small");
+    auto p = data.front().get_write() + 12;
+    write_le<uint32_t>(p, uint32_t(exception_type::OVERLOADED));
+    write_le<uint32_t>(p + 4, uint32_t(0));
+    try {
+        with_gate(_server._reply_gate, [this, timeout, msg_id, data = std::move(data)] () mutable {
+            return this->respond(-msg_id, std::move(data), timeout).then([c = this->shared_from_this()] {});
+        });
+    } catch (gate_closed_exception&) {/* ignore */}
+    return make_ready_future<>();
 }
 
 template<typename Serializer, typename MsgType, typename... RetTypes>
 inline future<> reply(wait_type, future<RetTypes...>&& ret, int64_t msg_id, lw_shared_ptr<typename protocol<Serializer, MsgType>::server::connection> client,
-        std::experimental::optional<rpc_clock_type::time_point> timeout) {
+        std::experimental::optional<rpc_clock_type::time_point> timeout, MsgType verb) {
     if (!client->error()) {
         snd_buf data;
         try {
@@ -445,7 +577,10 @@ inline future<> reply(wait_type, future<RetTypes...>&& ret, int64_t msg_id, lw_s
             msg_id = -msg_id;
         }
 
-        return client->respond(msg_id, std::move(data), timeout);
+        if (auto vm = client->get_protocol().get_verb_metrics(verb)) {
+            vm->response_bytes.add(data.size - 12);
+        }
+        return client->respond(msg_id, std::move(data), timeout, uint64_t(verb));
     } else {
         ret.ignore_ready_future();
         return make_ready_future<>();
@@ -454,7 +589,8 @@ inline future<> reply(wait_type, future<RetTypes...>&& ret, int64_t msg_id, lw_s
 
 // specialization for no_wait_type which does not send a reply
 template<typename Serializer, typename MsgType>
-inline future<> reply(no_wait_type, future<no_wait_type>&& r, int64_t msgid, lw_shared_ptr<typename protocol<Serializer, MsgType>::server::connection> client, std::experimental::optional<rpc_clock_type::time_point> timeout) {
+inline future<> reply(no_wait_type, future<no_wait_type>&& r, int64_t msgid, lw_shared_ptr<typename protocol<Serializer, MsgType>::server::connection> client, std::experimental::optional<rpc_clock_type::time_point> timeout,
+        MsgType verb) {
     try {
         r.get();
     } catch (std::exception& ex) {
@@ -487,36 +623,79 @@ auto lref_to_cref(T& x) {
 // Creates lambda to handle RPC message on a server.
 // The lambda unmarshalls all parameters, calls a handler, marshall return values and sends them back to a client
 template <typename Serializer, typename MsgType, typename Func, typename Ret, typename... InArgs, typename WantClientInfo, typename WantTimePoint>
-auto recv_helper(signature<Ret (InArgs...)> sig, Func&& func, WantClientInfo wci, WantTimePoint wtp) {
+auto recv_helper(MsgType verb, std::experimental::optional<scheduling_group> sg, signature<Ret (InArgs...)> sig, Func&& func, WantClientInfo wci, WantTimePoint wtp) {
     using signature = decltype(sig);
     using wait_style = wait_signature_t<Ret>;
-    return [func = lref_to_cref(std::forward<Func>(func))](lw_shared_ptr<typename protocol<Serializer, MsgType>::server::connection> client,
+    using server_connection = typename protocol<Serializer, MsgType>::server::connection;
+    return [verb, sg, func = lref_to_cref(std::forward<Func>(func))](lw_shared_ptr<typename protocol<Serializer, MsgType>::server::connection> client,
                                                            std::experimental::optional<rpc_clock_type::time_point> timeout,
                                                            int64_t msg_id,
                                                            rcv_buf data) mutable {
+        auto vm = client->get_protocol().get_verb_metrics(verb);
+        auto arrived = rpc_clock_type::now();
+        if (vm) {
+            vm->request_bytes.add(data.size);
+        }
+        // covers the wait for resources too; a child of the caller's span if
+        // the connection carries it
+        tracing::span sp("rpc_server");
+        if (sp) {
+            sp.set_detail(to_sstring(uint64_t(verb)));
+        }
         auto memory_consumed = client->estimate_request_size(data.size);
+        auto cls = client->get_protocol().priority_class_of(uint64_t(verb));
+        switch (client->admit(memory_consumed, timeout, arrived, cls)) {
+        case server_connection::admission::accept:
+            break;
+        case server_connection::admission::expired:
+            return make_ready_future();
+        case server_connection::admission::overloaded:
+            return client->respond_overloaded(msg_id, timeout);
+        }
         if (memory_consumed > client->max_request_size()) {
             auto err = sprint("request size %d large than memory limit %d", memory_consumed, client->max_request_size());
             client->get_protocol().log(client->peer_address(), err);
-            with_gate(client->get_server().reply_gate(), [client, timeout, msg_id, err = std::move(err)] {
-                return reply<Serializer, MsgType>(wait_style(), futurize<Ret>::make_exception_future(std::runtime_error(err.c_str())), msg_id, client, timeout);
+            with_gate(client->get_server().reply_gate(), [client, timeout, msg_id, verb, err = std::move(err)] {
+                return reply<Serializer, MsgType>(wait_style(), futurize<Ret>::make_exception_future(std::runtime_error(err.c_str())), msg_id, client, timeout, verb);
             });
             return make_ready_future();
         }
+        // no_wait requests are not waited for, so not cancelled either
+        auto cancellation = std::is_same<wait_style, wait_type>::value ? client->track_cancellation(msg_id) : nullptr;
         // note: apply is executed asynchronously with regards to networking so we cannot chain futures here by doing "return apply()"
-        auto f = client->wait_for_resources(memory_consumed, timeout).then([client, timeout, msg_id, data = std::move(data), &func] (auto permit) mutable {
+        auto f = client->wait_for_resources(memory_consumed, timeout, cls).then([client, timeout, msg_id, verb, sg, cls, vm, arrived, data = std::move(data), sp = std::move(sp), cancellation, &func] (auto permit) mutable {
+            client->resources_waited(rpc_clock_type::now() - arrived, cls);
+            if (cancellation && cancellation->cancelled()) {
+                // cancelled while it waited
+                return;
+            }
             try {
-                with_gate(client->get_server().reply_gate(), [client, timeout, msg_id, data = std::move(data), permit = std::move(permit), &func] () mutable {
-                    auto args = unmarshall<Serializer, InArgs...>(client->serializer(), std::move(data));
-                    return apply(func, client->info(), timeout, WantClientInfo(), WantTimePoint(), signature(), std::move(args)).then_wrapped([client, timeout, msg_id, permit = std::move(permit)] (futurize_t<Ret> ret) mutable {
-                        return reply<Serializer, MsgType>(wait_style(), std::move(ret), msg_id, client, timeout).then([permit = std::move(permit)] {});
+                with_gate(client->get_server().reply_gate(), [client, timeout, msg_id, verb, sg, vm, arrived, data = std::move(data), permit = std::move(permit), sp = std::move(sp), cancellation = std::move(cancellation), &func] () mutable {
+                    auto args = unmarshall<Serializer, InArgs...>(client->serializer(), std::move(data), client.get());
+                    auto handle = [client, timeout, &func, trace = sp.context(), cancellation, args = std::move(args)] () mutable {
+                        tracing::context_scope scope(trace);
+                        cancellation_scope cscope(std::move(cancellation));
+                        return apply(func, client->info(), timeout, WantClientInfo(), WantTimePoint(), signature(), std::move(args));
+                    };
+                    return (sg ? with_scheduling_group(*sg, std::move(handle)) : handle()).then_wrapped([client, timeout, msg_id, verb, vm, arrived, permit = std::move(permit), sp = std::move(sp), cancellation = std::move(cancellation)] (futurize_t<Ret> ret) mutable {
+                        if (vm) {
+                            vm->handler_latency.add_us(rpc_clock_type::now() - arrived);
+                        }
+                        if (cancellation && cancellation->cancelled()) {
+                            // nobody waits for the reply
+                            ret.ignore_ready_future();
+                            return make_ready_future<>();
+                        }
+                        return reply<Serializer, MsgType>(wait_style(), std::move(ret), msg_id, client, timeout, verb).then([permit = std::move(permit), sp = std::move(sp)] {});
                     });
                 });
             } catch (gate_closed_exception&) {/* ignore */ }
         });
 
         if (timeout) {
-            f = f.handle_exception_type([] (semaphore_timed_out&) { /* ignore */ });
+            f = f.handle_exception_type([client] (semaphore_timed_out&) {
+                client->count_shed(server_connection::admission::expired);
+            });
         }
 
         return std::move(f);
@@ -559,8 +738,18 @@ class client_function_type {
 
     // if return type is smart ptr take a type it points to instead
     using return_type = typename drop_smart_ptr<Ret>::type;
+
+    // a source the handler receives is a sink the client sends
+    template<typename T>
+    struct arg_type {
+        using type = typename remove_optional<T>::type;
+    };
+    template<typename... T>
+    struct arg_type<source<T...>> {
+        using type = sink<T...>;
+    };
 public:
-    using type = return_type(typename remove_optional<In>::type...);
+    using type = return_type(typename arg_type<In>::type...);
 };
 
 template<typename Serializer, typename MsgType>
@@ -579,16 +768,90 @@ auto protocol<Serializer, MsgType>::make_client(MsgType t) {
 template<typename Serializer, typename MsgType>
 template<typename Func>
 auto protocol<Serializer, MsgType>::register_handler(MsgType t, Func&& func) {
+    return register_handler(t, std::experimental::optional<scheduling_group>(), std::forward<Func>(func));
+}
+
+template<typename Serializer, typename MsgType>
+template<typename Func>
+auto protocol<Serializer, MsgType>::register_handler(MsgType t, scheduling_group sg, Func&& func) {
+    return register_handler(t, std::experimental::make_optional(sg), std::forward<Func>(func));
+}
+
+template<typename Serializer, typename MsgType>
+template<typename Func>
+auto protocol<Serializer, MsgType>::register_handler(MsgType t, std::experimental::optional<scheduling_group> sg, Func&& func) {
     using sig_type = signature<typename function_traits<Func>::signature>;
     using clean_sig_type = typename sig_type::clean;
     using want_client_info = typename sig_type::want_client_info;
     using want_time_point = typename sig_type::want_time_point;
-    auto recv = recv_helper<Serializer, MsgType>(clean_sig_type(), std::forward<Func>(func),
+    auto recv = recv_helper<Serializer, MsgType>(t, sg, clean_sig_type(), std::forward<Func>(func),
             want_client_info(), want_time_point());
     register_receiver(t, make_copyable_function(std::move(recv)));
     return make_client(clean_sig_type(), t);
 }
 
+template<typename Serializer, typename MsgType>
+bool protocol<Serializer, MsgType>::server::connection::send_stream_frame(id_type id, snd_buf data) {
+    if (this->_error) {
+        return false;
+    }
+    // sent as a reply to the stream id
+    static_assert(stream_head_space >= 16, "stream head space is too small");
+    data.front().trim_front(stream_head_space - 16);
+    data.size -= stream_head_space - 16;
+    auto p = data.front().get_write();
+    write_le<int64_t>(p, id);
+    write_le<uint32_t>(p + 8, data.size - 12);
+    this->send(std::move(data), {}, nullptr, stream_frame_type);
+    return true;
+}
+
+template<typename Serializer, typename MsgType>
+bool protocol<Serializer, MsgType>::client::send_stream_frame(id_type id, snd_buf data) {
+    if (this->_error) {
+        return false;
+    }
+    static_assert(stream_head_space >= 48, "stream head space is too small");
+    // 16 bytes of (no) trace context and 8 for the expiration timer
+    auto p = data.front().get_write();
+    std::fill_n(p, 24, 0);
+    p += 24;
+    write_le<uint64_t>(p, stream_frame_type);
+    write_le<int64_t>(p + 8, id);
+    write_le<uint32_t>(p + 16, data.size - 44);
+    this->send(std::move(data), {}, nullptr, stream_frame_type);
+    return true;
+}
+
+template<typename Serializer, typename MsgType>
+void protocol<Serializer, MsgType>::client::send_cancel(id_type id) {
+    if (!this->_cancel_negotiated || this->_error) {
+        return;
+    }
+    // a request frame with nothing after its header
+    snd_buf data(44);
+    static_assert(snd_buf::chunk_size >= 44, "send buffer chunk size is too small");
+    auto p = data.front().get_write();
+    std::fill_n(p, 24, 0);
+    p += 24;
+    write_le<uint64_t>(p, cancel_frame_type);
+    write_le<int64_t>(p + 8, id);
+    write_le<uint32_t>(p + 16, 0);
+    this->send(std::move(data));
+}
+
+template<typename Serializer, typename MsgType>
+template<typename... T>
+future<sink<T...>> protocol<Serializer, MsgType>::client::make_stream_sink() {
+    return _negotiated.get_shared_future().then([this] {
+        if (!this->_streams_negotiated) {
+            return make_exception_future<sink<T...>>(error("server does not support rpc streams"));
+        }
+        auto channel = this->open_stream(next_message_id());
+        return make_ready_future<sink<T...>>(make_shared<sink_impl<Serializer, T...>>(this->serializer(), std::move(channel)));
+    });
+}
+
 template<typename Serializer, typename MsgType>
 protocol<Serializer, MsgType>::server::server(protocol<Serializer, MsgType>& proto, ipv4_addr addr, resource_limits limits)
     : server(proto, engine().listen(addr, listen_options(true)), limits, server_options{})
@@ -597,12 +860,30 @@ protocol<Serializer, MsgType>::server::server(protocol<Serializer, MsgType>& pro
 template<typename Serializer, typename MsgType>
 protocol<Serializer, MsgType>::server::server(protocol<Serializer, MsgType>& proto, server_options opts, ipv4_addr addr, resource_limits limits)
     : server(proto, engine().listen(addr, listen_options(true)), limits, opts)
-{}
+{
+    if (opts.shard_port_base) {
+        listen_on_shard_port(addr);
+    }
+}
+
+template<typename Serializer, typename MsgType>
+void protocol<Serializer, MsgType>::server::listen_on_shard_port(ipv4_addr addr) {
+    auto port = uint32_t(_options.shard_port_base) + engine().cpu_id();
+    if (port > std::numeric_limits<uint16_t>::max()) {
+        throw std::invalid_argument(sprint("shard port %d is out of range", port));
+    }
+    _shard_ss = engine().listen(ipv4_addr(addr.ip, port), listen_options(true));
+    accept(*_shard_ss, _shard_ss_stopped);
+}
 
 template<typename Serializer, typename MsgType>
 protocol<Serializer, MsgType>::server::server(protocol<Serializer, MsgType>& proto, server_socket ss, resource_limits limits, server_options opts)
-        : _proto(proto), _ss(std::move(ss)), _limits(limits), _resources_available(limits.max_memory), _options(opts)
+        : _proto(proto), _ss(std::move(ss)), _limits(limits), _options(opts)
 {
+    _resources.emplace_back(limits.max_memory);
+    for (size_t i = 1; i < proto._priority_classes.size(); ++i) {
+        _resources.emplace_back(proto._priority_classes[i].max_memory);
+    }
     accept();
 }
 
@@ -613,19 +894,24 @@ protocol<Serializer, MsgType>::server::server(protocol<Serializer, MsgType>& pro
 
 template<typename Serializer, typename MsgType>
 void protocol<Serializer, MsgType>::server::accept() {
-    keep_doing([this] () mutable {
-        return _ss.accept().then([this] (connected_socket fd, socket_address addr) mutable {
+    accept(_ss, _ss_stopped);
+}
+
+template<typename Serializer, typename MsgType>
+void protocol<Serializer, MsgType>::server::accept(server_socket& ss, promise<>& stopped) {
+    keep_doing([this, &ss] () mutable {
+        return ss.accept().then([this] (connected_socket fd, socket_address addr) mutable {
             fd.set_nodelay(_options.tcp_nodelay);
             auto conn = make_lw_shared<connection>(*this, std::move(fd), std::move(addr), _proto);
             _conns.insert(conn);
             conn->process();
         });
-    }).then_wrapped([this] (future<>&& f){
+    }).then_wrapped([&stopped] (future<>&& f){
         try {
             f.get();
             assert(false);
         } catch (...) {
-            _ss_stopped.set_value();
+            stopped.set_value();
         }
     });
 }
@@ -806,12 +1092,15 @@ protocol<Serializer, MsgType>::read_frame_compressed(const Info& info, std::uniq
             }
             auto ptr = compress_header.get();
             auto size = read_le<uint32_t>(ptr);
-            return read_rcv_buf(in, size).then([this, size, &compressor, &info] (rcv_buf compressed_data) {
+            // the peer sent this frame as is (see connection::compress())
+            auto raw = bool(size & uncompressed_frame_flag);
+            size &= ~uncompressed_frame_flag;
+            return read_rcv_buf(in, size).then([this, size, raw, &compressor, &info] (rcv_buf compressed_data) {
                 if (compressed_data.size != size) {
                     log(info, sprint("unexpected eof on a %s while reading compressed data: expected %d got %d", FrameType::role(), size, compressed_data.size));
                     return FrameType::empty_value();
                 }
-                auto eb = compressor->decompress(std::move(compressed_data));
+                auto eb = raw ? std::move(compressed_data) : compressor->decompress(std::move(compressed_data));
                 net::packet p;
                 auto* one = boost::get<temporary_buffer<char>>(&eb.bufs);
                 if (one) {
@@ -850,6 +1139,37 @@ protocol<Serializer, MsgType>::server::connection::negotiate(feature_map request
             this->_timeout_negotiated = true;
             ret[protocol_features::TIMEOUT] = "";
             break;
+        case protocol_features::TRACING:
+            this->_tracing_negotiated = true;
+            ret[protocol_features::TRACING] = "";
+            break;
+        case protocol_features::CANCEL:
+            this->_cancel_negotiated = true;
+            ret[protocol_features::CANCEL] = "";
+            break;
+        case protocol_features::STREAMS:
+            this->_stream_window = std::max<size_t>(std::min(_server._limits.stream_window, _server._limits.max_memory), 1);
+            this->negotiate_streams(e.second);
+            if (this->_streams_negotiated) {
+                ret[protocol_features::STREAMS] = this->stream_window_feature(this->_stream_window);
+            }
+            break;
+        case protocol_features::UNCOMPRESSED_FRAMES:
+            if (_server._options.compressor_factory) {
+                this->_uncompressed_frames_negotiated = true;
+                this->_compression_threshold = _server._options.compression_threshold;
+                this->_adaptive_compression = _server._options.adaptive_compression;
+                ret[protocol_features::UNCOMPRESSED_FRAMES] = "";
+            }
+            break;
+        case protocol_features::SHARD_INFO: {
+            sstring info(sstring::initialized_later(), 12);
+            write_le<uint32_t>(info.begin(), engine().cpu_id());
+            write_le<uint32_t>(info.begin() + 4, smp::count);
+            write_le<uint32_t>(info.begin() + 8, _server._options.shard_port_base);
+            ret[protocol_features::SHARD_INFO] = std::move(info);
+        }
+        break;
         default:
             // nothing to do
             ;
@@ -870,8 +1190,8 @@ protocol<Serializer, MsgType>::server::connection::negotiate_protocol(input_stre
 template<typename MsgType>
 struct request_frame {
     using opt_buf_type = std::experimental::optional<rcv_buf>;
-    using return_type = future<std::experimental::optional<uint64_t>, MsgType, int64_t, opt_buf_type>;
-    using header_type = std::tuple<std::experimental::optional<uint64_t>, MsgType, int64_t, uint32_t>;
+    using return_type = future<std::experimental::optional<uint64_t>, MsgType, int64_t, tracing::trace_context, opt_buf_type>;
+    using header_type = std::tuple<std::experimental::optional<uint64_t>, MsgType, int64_t, uint32_t, tracing::trace_context>;
     static size_t header_size() {
         return 20;
     }
@@ -879,19 +1199,19 @@ struct request_frame {
         return "server";
     }
     static auto empty_value() {
-        return make_ready_future<std::experimental::optional<uint64_t>, MsgType, int64_t, opt_buf_type>(std::experimental::nullopt, MsgType(0), 0, std::experimental::nullopt);
+        return make_ready_future<std::experimental::optional<uint64_t>, MsgType, int64_t, tracing::trace_context, opt_buf_type>(std::experimental::nullopt, MsgType(0), 0, tracing::trace_context(), std::experimental::nullopt);
     }
     static header_type decode_header(const char* ptr) {
         auto type = MsgType(read_le<uint64_t>(ptr));
         auto msgid = read_le<int64_t>(ptr + 8);
         auto size = read_le<uint32_t>(ptr + 16);
-        return std::make_tuple(std::experimental::nullopt, type, msgid, size);
+        return std::make_tuple(std::experimental::nullopt, type, msgid, size, tracing::trace_context());
     }
     static uint32_t get_size(const header_type& t) {
         return std::get<3>(t);
     }
     static auto make_value(const header_type& t, rcv_buf data) {
-        return make_ready_future<std::experimental::optional<uint64_t>, MsgType, int64_t, opt_buf_type>(std::get<0>(t), std::get<1>(t), std::get<2>(t), std::move(data));
+        return make_ready_future<std::experimental::optional<uint64_t>, MsgType, int64_t, tracing::trace_context, opt_buf_type>(std::get<0>(t), std::get<1>(t), std::get<2>(t), std::get<4>(t), std::move(data));
     }
 };
 
@@ -908,9 +1228,31 @@ struct request_frame_with_timeout : request_frame<MsgType> {
     }
 };
 
+// A request frame of a connection that negotiated TRACING: the frame
+// header is preceded by the trace context of the caller
+template<typename Frame>
+struct traced_request_frame : Frame {
+    static size_t header_size() {
+        return Frame::header_size() + 16;
+    }
+    static auto decode_header(const char* ptr) {
+        auto h = Frame::decode_header(ptr + 16);
+        std::get<4>(h).trace_id = read_le<uint64_t>(ptr);
+        std::get<4>(h).span_id = read_le<uint64_t>(ptr + 8);
+        return h;
+    }
+};
+
 template <typename Serializer, typename MsgType>
-future<std::experimental::optional<uint64_t>, MsgType, int64_t, std::experimental::optional<rcv_buf>>
+future<std::experimental::optional<uint64_t>, MsgType, int64_t, tracing::trace_context, std::experimental::optional<rcv_buf>>
 protocol<Serializer, MsgType>::server::connection::read_request_frame(input_stream<char>& in) {
+    if (this->_tracing_negotiated) {
+        if (this->_timeout_negotiated) {
+            return this->_server._proto.template read_frame<traced_request_frame<request_frame_with_timeout<MsgType>>>(_info, in);
+        } else {
+            return this->_server._proto.template read_frame<traced_request_frame<request_frame<MsgType>>>(_info, in);
+        }
+    }
     if (this->_timeout_negotiated) {
         return this->_server._proto.template read_frame<request_frame_with_timeout<MsgType>>(_info, in);
     } else {
@@ -919,8 +1261,15 @@ protocol<Serializer, MsgType>::server::connection::read_request_frame(input_stre
 }
 
 template <typename Serializer, typename MsgType>
-future<std::experimental::optional<uint64_t>, MsgType, int64_t, std::experimental::optional<rcv_buf>>
+future<std::experimental::optional<uint64_t>, MsgType, int64_t, tracing::trace_context, std::experimental::optional<rcv_buf>>
 protocol<Serializer, MsgType>::server::connection::read_request_frame_compressed(input_stream<char>& in) {
+    if (this->_tracing_negotiated) {
+        if (this->_timeout_negotiated) {
+            return this->_server._proto.template read_frame_compressed<traced_request_frame<request_frame_with_timeout<MsgType>>>(_info, this->_compressor, in);
+        } else {
+            return this->_server._proto.template read_frame_compressed<traced_request_frame<request_frame<MsgType>>>(_info, this->_compressor, in);
+        }
+    }
     if (this->_timeout_negotiated) {
         return this->_server._proto.template read_frame_compressed<request_frame_with_timeout<MsgType>>(_info, this->_compressor, in);
     } else {
@@ -944,6 +1293,29 @@ protocol<Serializer, MsgType>::client::negotiate(feature_map provided) {
         case protocol_features::TIMEOUT:
             this->_timeout_negotiated = true;
             break;
+        case protocol_features::TRACING:
+            this->_tracing_negotiated = true;
+            break;
+        case protocol_features::CANCEL:
+            this->_cancel_negotiated = true;
+            break;
+        case protocol_features::STREAMS:
+            this->negotiate_streams(e.second);
+            break;
+        case protocol_features::UNCOMPRESSED_FRAMES:
+            this->_uncompressed_frames_negotiated = true;
+            this->_compression_threshold = _options.compression_threshold;
+            this->_adaptive_compression = _options.adaptive_compression;
+            break;
+        case protocol_features::SHARD_INFO:
+            if (e.second.size() == 12) {
+                shard_info info;
+                info.shard = read_le<uint32_t>(e.second.begin());
+                info.shard_count = std::max<uint32_t>(read_le<uint32_t>(e.second.begin() + 4), 1);
+                info.port_base = read_le<uint32_t>(e.second.begin() + 8);
+                _peer_shard_info = info;
+            }
+            break;
         default:
             // nothing to do
             ;
@@ -956,17 +1328,28 @@ future<> protocol<Serializer, MsgType>::server::connection::process() {
     return this->negotiate_protocol(this->_read_buf).then([this] () mutable {
         send_loop();
         return do_until([this] { return this->_read_buf.eof() || this->_error; }, [this] () mutable {
-            return this->read_request_frame_compressed(this->_read_buf).then([this] (std::experimental::optional<uint64_t> expire, MsgType type, int64_t msg_id, std::experimental::optional<rcv_buf> data) {
+            return this->read_request_frame_compressed(this->_read_buf).then([this] (std::experimental::optional<uint64_t> expire, MsgType type, int64_t msg_id, tracing::trace_context trace, std::experimental::optional<rcv_buf> data) {
                 if (!data) {
                     this->_error = true;
                     return make_ready_future<>();
                 } else {
+                    if (this->_streams_negotiated && type == MsgType(stream_frame_type)) {
+                        // buffered stream messages count against the server's memory limit
+                        auto permit = consume_units(_server.resources(0).available, data->size);
+                        this->receive_stream_frame(msg_id, std::move(data.value()), true, std::move(permit));
+                        return make_ready_future<>();
+                    }
+                    if (this->_cancel_negotiated && type == MsgType(cancel_frame_type)) {
+                        this->cancel_request(msg_id);
+                        return make_ready_future<>();
+                    }
                     std::experimental::optional<rpc_clock_type::time_point> timeout;
                     if (expire && *expire) {
                         timeout = rpc_clock_type::now() + std::chrono::milliseconds(*expire);
                     }
                     auto it = _server._proto._handlers.find(type);
                     if (it != _server._proto._handlers.end()) {
+                        tracing::context_scope scope(trace);
                         return it->second(this->shared_from_this(), timeout, msg_id, std::move(data.value()));
                     } else {
                         return this->wait_for_resources(28, timeout).then([this, timeout, msg_id, type] (auto permit) {
@@ -992,6 +1375,8 @@ future<> protocol<Serializer, MsgType>::server::connection::process() {
             log_exception(*this, "server connection dropped", f.get_exception());
         }
         this->_error = true;
+        // nobody is left to reply to
+        this->cancel_all_requests();
         return this->stop_send_loop().then_wrapped([this] (future<> f) {
             f.ignore_ready_future();
             this->_server._conns.erase(this->shared_from_this());
@@ -1054,6 +1439,7 @@ protocol<Serializer, MsgType>::client::read_response_frame_compressed(input_stre
 template<typename Serializer, typename MsgType>
 protocol<Serializer, MsgType>::client::client(protocol& proto, client_options ops, socket socket, ipv4_addr addr, ipv4_addr local)
         : protocol<Serializer, MsgType>::connection(proto), _socket(std::move(socket)), _server_addr(addr), _options(ops) {
+    this->_stream_window = std::max<size_t>(_options.stream_window, 1);
     _socket.connect(addr, local).then([this, ops = std::move(ops)] (connected_socket fd) {
         fd.set_nodelay(ops.tcp_nodelay);
         if (ops.keepalive) {
@@ -1065,19 +1451,32 @@ protocol<Serializer, MsgType>::client::client(protocol& proto, client_options op
         feature_map features;
         if (_options.compressor_factory) {
             features[protocol_features::COMPRESS] = _options.compressor_factory->supported();
+            features[protocol_features::UNCOMPRESSED_FRAMES] = "";
         }
         if (_options.send_timeout_data) {
             features[protocol_features::TIMEOUT] = "";
         }
+        if (_options.send_trace_context) {
+            features[protocol_features::TRACING] = "";
+        }
+        if (_options.send_cancellations) {
+            features[protocol_features::CANCEL] = "";
+        }
+        features[protocol_features::STREAMS] = this->stream_window_feature(this->_stream_window);
+        features[protocol_features::SHARD_INFO] = "";
         send_negotiation_frame(*this, std::move(features));
 
         return this->negotiate_protocol(this->_read_buf).then([this] () {
+            _negotiated.set_value();
             send_loop();
             return do_until([this] { return this->_read_buf.eof() || this->_error; }, [this] () mutable {
                 return this->read_response_frame_compressed(this->_read_buf).then([this] (int64_t msg_id, std::experimental::optional<rcv_buf> data) {
                     auto it = _outstanding.find(std::abs(msg_id));
                     if (!data) {
                         this->_error = true;
+                    } else if (this->_streams.count(msg_id)) {
+                        // stream ids come from the message ids, so never clash with a reply
+                        this->receive_stream_frame(msg_id, std::move(data.value()), false);
                     } else if (it != _outstanding.end()) {
                         auto handler = std::move(it->second);
                         _outstanding.erase(it);
@@ -1106,6 +1505,9 @@ protocol<Serializer, MsgType>::client::client(protocol& proto, client_options op
             log_exception(*this, this->_connected ? "client connection dropped" : "fail to connect", f.get_exception());
         }
         this->_error = true;
+        if (!_negotiated.available()) {
+            _negotiated.set_exception(closed_error());
+        }
         this->stop_send_loop().then_wrapped([this] (future<> f) {
             f.ignore_ready_future();
             this->_stopped.set_value();
@@ -1129,6 +1531,104 @@ protocol<Serializer, MsgType>::client::client(protocol<Serializer, MsgType>& pro
     : client(proto, client_options{}, std::move(socket), addr, local)
 {}
 
+template<typename Serializer, typename MsgType>
+protocol<Serializer, MsgType>::client_pool::client_pool(protocol<Serializer, MsgType>& proto, client_options options,
+        unsigned connections_per_shard, socket_factory factory)
+    : _proto(proto), _options(options), _connections_per_shard(std::max(connections_per_shard, 1u)), _socket_factory(std::move(factory))
+{}
+
+template<typename Serializer, typename MsgType>
+void protocol<Serializer, MsgType>::client_pool::close_failed(connections& conns) {
+    auto failed = std::stable_partition(conns.begin(), conns.end(), [] (const std::unique_ptr<client>& c) {
+        return !c->error();
+    });
+    for (auto i = failed; i != conns.end(); ++i) {
+        _closing.enter();
+        auto f = (*i)->stop();
+        f.finally([this, c = std::move(*i)] {
+            _closing.leave();
+        });
+    }
+    conns.erase(failed, conns.end());
+}
+
+template<typename Serializer, typename MsgType>
+typename protocol<Serializer, MsgType>::client&
+protocol<Serializer, MsgType>::client_pool::pick(connections& conns, ipv4_addr addr) {
+    close_failed(conns);
+    client* best = nullptr;
+    size_t best_load = 0;
+    for (auto&& c : conns) {
+        auto st = c->get_stats();
+        auto load = st.pending + st.wait_reply;
+        if (!best || load < best_load) {
+            best = c.get();
+            best_load = load;
+        }
+    }
+    if (!best || (best_load && conns.size() < _connections_per_shard)) {
+        if (_socket_factory) {
+            conns.push_back(std::make_unique<client>(_proto, _options, _socket_factory(), addr));
+        } else {
+            conns.push_back(std::make_unique<client>(_proto, _options, addr));
+        }
+        best = conns.back().get();
+    }
+    return *best;
+}
+
+template<typename Serializer, typename MsgType>
+typename protocol<Serializer, MsgType>::client&
+protocol<Serializer, MsgType>::client_pool::get(ipv4_addr addr, unsigned shard) {
+    auto& s = _servers[uint64_t(addr.ip) << 16 | addr.port];
+    if (!s.info) {
+        // learnt from any connection to the server's address
+        for (auto&& c : s.any) {
+            if (c->peer_shard_info()) {
+                s.info = c->peer_shard_info();
+                s.shards.resize(s.info->shard_count);
+                break;
+            }
+        }
+    }
+    if (!s.info || !s.info->port_base) {
+        return pick(s.any, addr);
+    }
+    shard %= s.info->shard_count;
+    return pick(s.shards[shard], ipv4_addr(addr.ip, s.info->port_base + shard));
+}
+
+template<typename Serializer, typename MsgType>
+size_t protocol<Serializer, MsgType>::client_pool::size() const {
+    size_t ret = 0;
+    for (auto&& e : _servers) {
+        ret += e.second.any.size();
+        for (auto&& conns : e.second.shards) {
+            ret += conns.size();
+        }
+    }
+    return ret;
+}
+
+template<typename Serializer, typename MsgType>
+future<> protocol<Serializer, MsgType>::client_pool::stop() {
+    return parallel_for_each(_servers, [] (auto& e) {
+        return parallel_for_each(e.second.any, [] (auto& c) {
+            return c->stop();
+        }).then([&e] {
+            return parallel_for_each(e.second.shards, [] (connections& conns) {
+                return parallel_for_each(conns, [] (auto& c) {
+                    return c->stop();
+                });
+            });
+        });
+    }).then([this] {
+        return _closing.close();
+    }).then([this] {
+        _servers.clear();
+    });
+}
+
 }
 
 }
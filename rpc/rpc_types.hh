@@ -31,6 +31,8 @@
 #include "core/timer.hh"
 #include "core/simple-stream.hh"
 #include "core/lowres_clock.hh"
+#include "core/shared_ptr.hh"
+#include <unordered_map>
 
 namespace seastar {
 
@@ -50,6 +52,9 @@ struct stats {
     counter_type sent_messages = 0;
     counter_type wait_reply = 0;
     counter_type timeout = 0;
+    counter_type shed_expired = 0; // requests dropped because they had expired
+    counter_type shed_overloaded = 0; // requests rejected because they would likely expire waiting
+    counter_type cancelled = 0; // requests the client cancelled, or gave up waiting for, before they were replied to
 };
 
 
@@ -108,6 +113,16 @@ class canceled_error : public error {
     canceled_error() : error("rpc call was canceled") {}
 };
 
+class overloaded_error : public error {
+public:
+    overloaded_error() : error("rpc server is overloaded") {}
+};
+
+class stream_closed : public error {
+public:
+    stream_closed() : error("rpc stream was closed") {}
+};
+
 struct no_wait_type {};
 
 // return this from a callback if client does not want to waiting for a reply
@@ -163,6 +178,83 @@ struct cancellable {
     }
 };
 
+/// Tells the handler of a request whether its caller cancelled it, or gave
+/// up waiting for its reply, so that it can stop working on it.
+///
+/// Clients tell servers that negotiated it, when a \ref cancellable fires
+/// or the call times out. A request cancelled while waiting for memory is
+/// dropped without running, and the reply of one cancelled while running
+/// is not sent; a handler that wants to stop early keeps the request's
+/// cancellation, from \ref current_request_cancellation(), and checks it.
+/// Requests are also cancelled when their connection is closed.
+class request_cancellation {
+public:
+    using registry = std::unordered_map<int64_t, request_cancellation*>;
+private:
+    registry* _registry; // of the connection, until it is closed
+    int64_t _id;
+    bool _cancelled = false;
+public:
+    request_cancellation(registry& r, int64_t id) : _registry(&r), _id(id) {
+        r[id] = this;
+    }
+    request_cancellation(const request_cancellation&) = delete;
+    request_cancellation& operator=(const request_cancellation&) = delete;
+    ~request_cancellation() {
+        if (_registry) {
+            _registry->erase(_id);
+        }
+    }
+    bool cancelled() const {
+        return _cancelled;
+    }
+    /// Throws \ref canceled_error if the request was cancelled
+    void check() const {
+        if (_cancelled) {
+            throw canceled_error();
+        }
+    }
+    /// \cond internal
+    void cancel() {
+        _cancelled = true;
+    }
+    // the connection is going away
+    void detach() {
+        _registry = nullptr;
+        _cancelled = true;
+    }
+    /// \endcond
+};
+
+/// \cond internal
+namespace internal {
+extern thread_local lw_shared_ptr<request_cancellation> current_cancellation;
+}
+/// \endcond
+
+/// The cancellation of the request whose handler is being called, null if
+/// its client cannot cancel it. Only set for the synchronous part of the
+/// handler, which must keep it to check it later.
+inline lw_shared_ptr<request_cancellation> current_request_cancellation() {
+    return internal::current_cancellation;
+}
+
+/// \cond internal
+// Makes a request's cancellation current while its handler is called
+class cancellation_scope {
+    lw_shared_ptr<request_cancellation> _saved;
+public:
+    explicit cancellation_scope(lw_shared_ptr<request_cancellation> c) noexcept
+            : _saved(std::exchange(internal::current_cancellation, std::move(c))) {
+    }
+    cancellation_scope(const cancellation_scope&) = delete;
+    cancellation_scope& operator=(const cancellation_scope&) = delete;
+    ~cancellation_scope() {
+        internal::current_cancellation = std::move(_saved);
+    }
+};
+/// \endcond
+
 struct rcv_buf {
     uint32_t size = 0;
     boost::variant<std::vector<temporary_buffer<char>>, temporary_buffer<char>> bufs;
@@ -182,13 +274,84 @@ struct snd_buf {
     temporary_buffer<char>& front();
 };
 
-static inline memory_input_stream<rcv_buf::iterator> make_deserializer_stream(rcv_buf& input) {
+// Moves the data of a send or receive buffer out into one buffer
+temporary_buffer<char> linearize(boost::variant<std::vector<temporary_buffer<char>>, temporary_buffer<char>>& v, uint32_t size);
+
+// Measures a frame before it is serialized, and collects the buffers
+// appended to it by reference (see write_fragment())
+class frame_measuring_stream : public measuring_output_stream {
+    // each with the number of bytes serialized before it
+    std::vector<std::pair<size_t, temporary_buffer<char>>> _fragments;
+public:
+    void write_fragment(const temporary_buffer<char>& b) {
+        if (!b.empty()) {
+            // sharing only adds a reference to the data
+            _fragments.emplace_back(size(), const_cast<temporary_buffer<char>&>(b).share());
+            write(b.get(), b.size());
+        }
+    }
+    // Returns a buffer for the frame, with head_space bytes in front, that
+    // holds the collected buffers in place
+    snd_buf make_buffer(size_t head_space);
+};
+
+// Serializes a frame into a buffer made by frame_measuring_stream, which
+// already holds the buffers appended by reference
+class snd_buf_stream : public memory_output_stream<snd_buf::iterator> {
+public:
+    using memory_output_stream<snd_buf::iterator>::memory_output_stream;
+    void write_fragment(const temporary_buffer<char>& b) {
+        skip(b.size());
+    }
+};
+
+// Deserializes a received frame, and hands out parts of it without
+// copying them (see read_fragment())
+class rcv_buf_stream : public memory_input_stream<rcv_buf::iterator> {
+    rcv_buf& _buf;
+public:
+    rcv_buf_stream(memory_input_stream<rcv_buf::iterator> in, rcv_buf& buf)
+            : memory_input_stream<rcv_buf::iterator>(std::move(in)), _buf(buf) {}
+    temporary_buffer<char> read_fragment(size_t size);
+};
+
+// Appends b to a frame being serialized. The frames of rpc messages refer
+// to b instead of copying it, so its data must not change until the
+// message is sent; other output streams copy it.
+template <typename Output>
+inline void write_fragment(Output& out, const temporary_buffer<char>& b) {
+    out.write(b.get(), b.size());
+}
+
+inline void write_fragment(frame_measuring_stream& out, const temporary_buffer<char>& b) {
+    out.write_fragment(b);
+}
+
+inline void write_fragment(snd_buf_stream& out, const temporary_buffer<char>& b) {
+    out.write_fragment(b);
+}
+
+// Reads size bytes from a frame being deserialized. Parts of rpc messages
+// that were received into one buffer are shared rather than copied, and
+// keep that buffer alive.
+template <typename Input>
+inline temporary_buffer<char> read_fragment(Input& in, size_t size) {
+    temporary_buffer<char> b(size);
+    in.read(b.get_write(), size);
+    return b;
+}
+
+inline temporary_buffer<char> read_fragment(rcv_buf_stream& in, size_t size) {
+    return in.read_fragment(size);
+}
+
+static inline rcv_buf_stream make_deserializer_stream(rcv_buf& input) {
     auto* b = boost::get<temporary_buffer<char>>(&input.bufs);
     if (b) {
-        return memory_input_stream<rcv_buf::iterator>(memory_input_stream<rcv_buf::iterator>::simple(b->begin(), b->size()));
+        return rcv_buf_stream(memory_input_stream<rcv_buf::iterator>::simple(b->begin(), b->size()), input);
     } else {
         auto& ar = boost::get<std::vector<temporary_buffer<char>>>(input.bufs);
-        return memory_input_stream<rcv_buf::iterator>(memory_input_stream<rcv_buf::iterator>::fragmented(ar.begin(), input.size));
+        return rcv_buf_stream(memory_input_stream<rcv_buf::iterator>::fragmented(ar.begin(), input.size), input);
     }
 }
 
@@ -0,0 +1,134 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#ifdef HAVE_ZSTD
+
+#include "zstd_compressor.hh"
+#include "core/byteorder.hh"
+#include "core/print.hh"
+
+namespace seastar {
+
+namespace rpc {
+
+// A dictionary, compiled once for all the connections of a factory; being
+// read only, it may be shared by shards
+class zstd_compressor::dictionary {
+    std::unique_ptr<ZSTD_CDict, size_t (*)(ZSTD_CDict*)> _cdict;
+    std::unique_ptr<ZSTD_DDict, size_t (*)(ZSTD_DDict*)> _ddict;
+public:
+    dictionary(const sstring& dict, int level)
+            : _cdict(ZSTD_createCDict(dict.data(), dict.size(), level), ZSTD_freeCDict)
+            , _ddict(ZSTD_createDDict(dict.data(), dict.size()), ZSTD_freeDDict) {
+        if (!_cdict || !_ddict) {
+            throw std::bad_alloc();
+        }
+    }
+    const ZSTD_CDict* cdict() const {
+        return _cdict.get();
+    }
+    const ZSTD_DDict* ddict() const {
+        return _ddict.get();
+    }
+};
+
+zstd_compressor::factory::factory(int level, sstring dict)
+        : _name("ZSTD"), _level(level) {
+    if (level < ZSTD_minCLevel() || level > ZSTD_maxCLevel()) {
+        throw std::invalid_argument(sprint("zstd compression level %d out of range [%d, %d]", level, ZSTD_minCLevel(), ZSTD_maxCLevel()));
+    }
+    if (!dict.empty()) {
+        auto id = ZSTD_getDictID_fromDict(dict.data(), dict.size());
+        if (!id) {
+            throw std::invalid_argument("rpc zstd dictionary is not a trained dictionary");
+        }
+        _name += ":" + to_sstring(id);
+        _dict = std::make_shared<const dictionary>(dict, level);
+    }
+}
+
+std::unique_ptr<rpc::compressor> zstd_compressor::factory::negotiate(sstring feature, bool is_server) const {
+    return feature == _name ? std::make_unique<zstd_compressor>(_level, _dict) : nullptr;
+}
+
+zstd_compressor::zstd_compressor(int level, std::shared_ptr<const dictionary> dict)
+        : _cctx(ZSTD_createCCtx(), ZSTD_freeCCtx)
+        , _dctx(ZSTD_createDCtx(), ZSTD_freeDCtx)
+        , _level(level)
+        , _dict(std::move(dict)) {
+    if (!_cctx || !_dctx) {
+        throw std::bad_alloc();
+    }
+}
+
+zstd_compressor::~zstd_compressor() {
+}
+
+snd_buf zstd_compressor::compress(size_t head_space, snd_buf data) {
+    head_space += 4;
+    temporary_buffer<char> src = linearize(data.bufs, data.size);
+    auto bound = ZSTD_compressBound(src.size());
+    temporary_buffer<char> dst(head_space + bound);
+    auto size = _dict
+            ? ZSTD_compress_usingCDict(_cctx.get(), dst.get_write() + head_space, bound, src.begin(), src.size(), _dict->cdict())
+            : ZSTD_compressCCtx(_cctx.get(), dst.get_write() + head_space, bound, src.begin(), src.size(), _level);
+    if (ZSTD_isError(size)) {
+        throw std::runtime_error(sprint("RPC frame zstd compression failure: %s", ZSTD_getErrorName(size)));
+    }
+    dst.trim(size + head_space);
+    write_le<uint32_t>(dst.get_write() + (head_space - 4), data.size);
+    return snd_buf(std::move(dst));
+}
+
+rcv_buf zstd_compressor::decompress(rcv_buf data) {
+    if (data.size < 4) {
+        return rcv_buf();
+    }
+    auto in = make_deserializer_stream(data);
+    uint32_t v32;
+    in.read(reinterpret_cast<char*>(&v32), 4);
+    auto size = le_to_cpu(v32);
+    temporary_buffer<char> src = linearize(data.bufs, data.size);
+    src.trim_front(4);
+    if (!size) {
+        // an uncompressed frame
+        rcv_buf rb(src.size());
+        rb.bufs = std::move(src);
+        return rb;
+    }
+    rcv_buf rb(size);
+    rb.bufs = temporary_buffer<char>(size);
+    auto& dst = boost::get<temporary_buffer<char>>(rb.bufs);
+    auto ret = _dict
+            ? ZSTD_decompress_usingDDict(_dctx.get(), dst.get_write(), dst.size(), src.begin(), src.size(), _dict->ddict())
+            : ZSTD_decompressDCtx(_dctx.get(), dst.get_write(), dst.size(), src.begin(), src.size());
+    if (ZSTD_isError(ret) || ret != size) {
+        throw std::runtime_error("RPC frame zstd decompression failure");
+    }
+    return rb;
+}
+
+}
+
+}
+
+#endif // HAVE_ZSTD
@@ -0,0 +1,77 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#ifdef HAVE_ZSTD
+
+#include <memory>
+#include "core/sstring.hh"
+#include "rpc/rpc_types.hh"
+#include <zstd.h>
+
+namespace seastar {
+
+namespace rpc {
+    // Zstandard compression of rpc frames, optionally primed with a
+    // pre-trained dictionary for small, repetitive messages.
+    //
+    // Peers use a dictionary only if both have the same one: a factory with
+    // a dictionary advertises "ZSTD:<dictionary id>", one without "ZSTD".
+    // To fall back to plain zstd, or LZ4, with peers that lack the
+    // dictionary, list their factories after it in a
+    // multi_algo_compressor_factory. The level applies to what this side
+    // sends.
+    class zstd_compressor : public compressor {
+    public:
+        class dictionary;
+        class factory: public rpc::compressor::factory {
+            sstring _name;
+            int _level;
+            std::shared_ptr<const dictionary> _dict;
+        public:
+            // dict, if not empty, is a dictionary trained with zstd --train
+            // or ZDICT_trainFromBuffer()
+            explicit factory(int level = ZSTD_CLEVEL_DEFAULT, sstring dict = {});
+            virtual const sstring& supported() const override {
+                return _name;
+            }
+            virtual std::unique_ptr<rpc::compressor> negotiate(sstring feature, bool is_server) const override;
+        };
+    private:
+        std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> _cctx;
+        std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> _dctx;
+        int _level;
+        std::shared_ptr<const dictionary> _dict;
+    public:
+        zstd_compressor(int level, std::shared_ptr<const dictionary> dict);
+        ~zstd_compressor();
+        // compress data, leaving head_space empty in returned buffer
+        snd_buf compress(size_t head_space, snd_buf data) override;
+        // decompress data
+        rcv_buf decompress(rcv_buf data) override;
+    };
+}
+
+}
+
+#endif // HAVE_ZSTD
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+#
+# This file is open source software, licensed to you under the terms
+# of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+# distributed with this work for additional information regarding copyright
+# ownership.  You may not use this file except in compliance with the License.
+#
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+# Copyright (C) 2018 ScyllaDB
+
+# Converts reactor event trace dumps (see --event-trace-size and
+# reactor::event_trace_dump()) to the Chrome trace event format, which
+# chrome://tracing and Perfetto (ui.perfetto.dev) open. Each shard's dump
+# becomes a thread of one process.
+
+import argparse
+import json
+import struct
+import sys
+
+HEADER = struct.Struct('=8sII2Q2QQQ')
+RECORD = struct.Struct('=QIHBB')
+
+EVENTS = ['task_start', 'task_end', 'poll', 'io_submit', 'io_complete',
+          'smp_send', 'smp_receive', 'timer_fire', 'stall']
+
+
+def read_dump(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    magic, shard, _, tsc0, tsc1, ns0, ns1, nr_records, recorded = HEADER.unpack_from(data)
+    if magic != b'SSEVTRC1':
+        raise ValueError('{}: not an event trace dump'.format(path))
+    if tsc1 == tsc0:
+        ns_per_tick = 1.0
+    else:
+        ns_per_tick = (ns1 - ns0) / (tsc1 - tsc0)
+
+    def to_us(tsc):
+        return (ns0 + (tsc - tsc0) * ns_per_tick) / 1000
+
+    records = []
+    for i in range(nr_records):
+        tsc, arg, group, type, _ = RECORD.unpack_from(data, HEADER.size + i * RECORD.size)
+        records.append((to_us(tsc), EVENTS[type] if type < len(EVENTS) else str(type), group, arg))
+    if recorded > nr_records:
+        sys.stderr.write('{}: shard {}: {} older events were overwritten\n'.format(path, shard, recorded - nr_records))
+    return shard, records
+
+
+def convert(dumps):
+    events = []
+    for path in dumps:
+        shard, records = read_dump(path)
+        events.append({'ph': 'M', 'name': 'thread_name', 'pid': 0, 'tid': shard,
+                       'args': {'name': 'shard {}'.format(shard)}})
+        # I/O requests of a class complete in order of their submission
+        # closely enough to pair them up for display
+        pending_io = {}
+        task = None
+        for ts, name, group, arg in records:
+            if name == 'task_start':
+                task = (ts, group)
+            elif name == 'task_end':
+                if task:
+                    events.append({'ph': 'X', 'name': 'task', 'cat': 'sched', 'pid': 0, 'tid': shard,
+                                   'ts': task[0], 'dur': ts - task[0], 'args': {'group': task[1]}})
+                task = None
+            elif name == 'io_submit':
+                pending_io.setdefault(group, []).append(ts)
+            elif name == 'io_complete' and pending_io.get(group):
+                start = pending_io[group].pop(0)
+                events.append({'ph': 'X', 'name': 'io', 'cat': 'io', 'pid': 0, 'tid': shard,
+                               'ts': start, 'dur': ts - start, 'args': {'class': group, 'bytes': arg}})
+            else:
+                events.append({'ph': 'i', 's': 't', 'name': name, 'cat': 'reactor', 'pid': 0, 'tid': shard,
+                               'ts': ts, 'args': {'group': group, 'arg': arg}})
+    return {'traceEvents': events, 'displayTimeUnit': 'ns'}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert seastar reactor event trace dumps to the Chrome trace format')
+    parser.add_argument('dumps', nargs='+', help='event trace dumps, one per shard')
+    parser.add_argument('-o', '--output', help='output file (default: stdout)')
+    args = parser.parse_args()
+    trace = convert(args.dumps)
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
@@ -25,15 +25,35 @@ import re
 
 boost_tests = [
     'alloc_test',
+    'allocation_test',
+    'memory_account_test',
+    'object_pool_test',
+    'node_shared_test',
+    'cross_shard_queue_test',
     'futures_test',
     'thread_test',
     'memcached/test_ascii_parser',
+    'memcached/test_binary_parser',
+    'memcached/test_item_index',
+    'memcached/test_hot_keys',
     'sstring_test',
     'unwind_test',
     'defer_test',
     'output_stream_test',
     'httpd',
     'fstream_test',
+    'block_cache_test',
+    'tracing_test',
+    'metrics_mmap_test',
+    'block_stream_test',
+    'tcp_congestion_test',
+    'tcp_reassembly_test',
+    'gso_test',
+    'gro_test',
+    'ipv6_test',
+    'checksum_test',
+    'rss_balance_test',
+    'conntrack_test',
     'foreign_ptr_test',
     'semaphore_test',
     'expiring_fifo_test',
@@ -41,15 +61,29 @@ boost_tests = [
     'weak_ptr_test',
     'fileiotest',
     'packet_test',
+    'rope_test',
     'tls_test',
     'rpc_test',
     'connect_test',
+    'udp_batch_test',
+    'tcp_zero_copy_test',
     'json_formatter_test',
     'execution_stage_test',
+    'coroutines_test',
+    'scheduling_group_test',
     'lowres_clock_test',
+    'tsc_clock_test',
     'program_options_test',
     'tuple_utils_test',
     'noncopyable_function_test',
+    'flat_hash_map_test',
+    'simple_stream_test',
+    'timer_wheel_test',
+    'adaptive_poll_test',
+    'arena_test',
+    'hdr_histogram_test',
+    'event_trace_test',
+    'log_test',
 ]
 
 other_tests = [
@@ -0,0 +1,76 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "core/adaptive_poll.hh"
+
+using namespace seastar;
+using namespace std::chrono_literals;
+
+BOOST_AUTO_TEST_CASE(test_starts_at_wakeup_cost) {
+    adaptive_poll_time apt(200us);
+    BOOST_REQUIRE(apt.poll_time() == 200us);
+}
+
+BOOST_AUTO_TEST_CASE(test_short_idle_periods) {
+    adaptive_poll_time apt(200us);
+    for (int i = 0; i < 1000; ++i) {
+        apt.record_idle_period(20us);
+    }
+    // polls just long enough to catch the typical idle period
+    BOOST_REQUIRE(apt.poll_time() >= 20us);
+    BOOST_REQUIRE(apt.poll_time() <= 64us);
+}
+
+BOOST_AUTO_TEST_CASE(test_long_idle_periods) {
+    adaptive_poll_time apt(200us);
+    for (int i = 0; i < 1000; ++i) {
+        apt.record_idle_period(10ms);
+    }
+    // polling is wasted, sleep immediately
+    BOOST_REQUIRE(apt.poll_time() == 0us);
+}
+
+BOOST_AUTO_TEST_CASE(test_adapts_to_change) {
+    adaptive_poll_time apt(200us);
+    for (int i = 0; i < 5000; ++i) {
+        apt.record_idle_period(10ms);
+    }
+    BOOST_REQUIRE(apt.poll_time() == 0us);
+    for (int i = 0; i < 5000; ++i) {
+        apt.record_idle_period(5us);
+    }
+    BOOST_REQUIRE(apt.poll_time() > 0us);
+    BOOST_REQUIRE(apt.poll_time() <= 16us);
+}
+
+BOOST_AUTO_TEST_CASE(test_mixed_idle_periods) {
+    adaptive_poll_time apt(200us);
+    // mostly short periods with a tail of long ones: still worth polling
+    // for the short ones
+    for (int i = 0; i < 1000; ++i) {
+        apt.record_idle_period(i % 10 ? 30us : 50ms);
+    }
+    BOOST_REQUIRE(apt.poll_time() >= 30us);
+    BOOST_REQUIRE(apt.poll_time() <= 400us);
+}
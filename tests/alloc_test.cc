@@ -23,6 +23,8 @@
 #include "core/memory.hh"
 #include "core/reactor.hh"
 #include <vector>
+#include <sstream>
+#include <malloc.h>
 
 using namespace seastar;
 
@@ -61,3 +63,154 @@ SEASTAR_TEST_CASE(test_live_objects_counter_with_cross_cpu_free) {
         BOOST_REQUIRE(memory::stats().live_objects() < std::numeric_limits<size_t>::max() / 2);
     });
 }
+
+SEASTAR_TEST_CASE(test_cross_cpu_frees_are_batched) {
+    return smp::submit_to(1, [] {
+        auto ret = std::vector<std::unique_ptr<int>>(10000);
+        for (auto& o : ret) {
+            o = std::make_unique<int>(0);
+        }
+        return ret;
+    }).then([] (auto&& vec) {
+        auto before = memory::stats();
+        for (auto& o : vec) {
+            o.reset(); // cause cross-cpu free
+        }
+        memory::flush_cross_cpu_frees();
+        auto after = memory::stats();
+#ifndef DEFAULT_ALLOCATOR
+        BOOST_REQUIRE_EQUAL(after.cross_cpu_frees() - before.cross_cpu_frees(), 10000);
+        auto batches = after.cross_cpu_free_batches() - before.cross_cpu_free_batches();
+        BOOST_REQUIRE_GE(batches, 1);
+        BOOST_REQUIRE_LE(batches, 10000 / 128 + 1);
+#endif
+    });
+}
+
+SEASTAR_TEST_CASE(test_small_pool_stats) {
+#ifndef DEFAULT_ALLOCATOR
+    // find the pool serving 100-byte allocations
+    unsigned idx = 0;
+    while (memory::get_small_pool_stats(idx).object_size < 100) {
+        ++idx;
+    }
+    auto before = memory::get_small_pool_stats(idx);
+    std::vector<void*> objs;
+    objs.reserve(10000);
+    for (int i = 0; i < 10000; ++i) {
+        objs.push_back(malloc(100));
+    }
+    auto during = memory::get_small_pool_stats(idx);
+    BOOST_REQUIRE_EQUAL(during.live_objects, before.live_objects + 10000);
+    BOOST_REQUIRE_GE(during.memory, during.live_objects * during.object_size);
+    for (auto o : objs) {
+        free(o);
+    }
+    auto after = memory::get_small_pool_stats(idx);
+    BOOST_REQUIRE_EQUAL(after.live_objects, before.live_objects);
+
+    size_t free_span_memory = 0;
+    for (unsigned i = 0; i < memory::nr_free_span_orders(); ++i) {
+        free_span_memory += memory::get_free_span_stats(i).free_memory;
+    }
+    BOOST_REQUIRE_EQUAL(free_span_memory, memory::stats().free_memory());
+
+    std::ostringstream os;
+    memory::dump_allocator_stats(os);
+    BOOST_REQUIRE(!os.str().empty());
+#endif
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_sampled_heap_profile) {
+#if defined(SEASTAR_HEAPPROF) && !defined(DEFAULT_ALLOCATOR)
+    auto estimated_live = [] {
+        size_t total = 0;
+        for (auto&& site : memory::get_heap_profile()) {
+            total += site.estimated_size;
+        }
+        return total;
+    };
+    memory::set_heap_profiling_sample_interval(64 * 1024);
+    memory::set_heap_profiling_enabled(true);
+    auto before = estimated_live();
+    std::vector<std::unique_ptr<char[]>> objs;
+    objs.reserve(100000);
+    for (int i = 0; i < 100000; ++i) {
+        objs.emplace_back(new char[1000]);
+    }
+    auto during = estimated_live() - before;
+    objs.clear();
+    auto after = estimated_live();
+    memory::set_heap_profiling_enabled(false);
+    memory::set_heap_profiling_sample_interval(0);
+    // ~100MB allocated, about 1500 samples
+    BOOST_REQUIRE_GT(during, 80000000);
+    BOOST_REQUIRE_LT(during, 120000000);
+    BOOST_REQUIRE_LT(after, before + 1000000);
+#endif
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_large_allocations_are_huge_page_aligned) {
+#ifndef DEFAULT_ALLOCATOR
+    auto before = memory::get_huge_page_stats();
+    auto obj = malloc(8 << 20);
+    BOOST_REQUIRE(obj != nullptr);
+    BOOST_REQUIRE_EQUAL(reinterpret_cast<uintptr_t>(obj) % memory::huge_page_size, 0);
+    auto during = memory::get_huge_page_stats();
+    BOOST_REQUIRE_EQUAL(during.huge_aligned_allocations, before.huge_aligned_allocations + 1);
+    BOOST_REQUIRE_EQUAL(during.huge_aligned_memory, before.huge_aligned_memory + (8 << 20));
+    free(obj);
+    auto after = memory::get_huge_page_stats();
+    BOOST_REQUIRE_EQUAL(after.huge_aligned_allocations, before.huge_aligned_allocations);
+    BOOST_REQUIRE_EQUAL(after.huge_aligned_memory, before.huge_aligned_memory);
+#endif
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_allocations_are_attributed_to_scheduling_groups) {
+#ifndef DEFAULT_ALLOCATOR
+    return create_scheduling_group("alloc_test", 100).then([] (scheduling_group sg) {
+        memory::set_allocation_group_tracking(true);
+        auto before = sg.memory_stats();
+        return with_scheduling_group(sg, [] {
+            return std::unique_ptr<char[]>(new char[1 << 20]);
+        }).then([sg, before] (std::unique_ptr<char[]> obj) {
+            auto during = sg.memory_stats();
+            BOOST_REQUIRE_GE(during.allocations, before.allocations + 1);
+            BOOST_REQUIRE_GE(during.allocated_bytes, before.allocated_bytes + (1 << 20));
+            BOOST_REQUIRE_EQUAL(during.live_large_memory, before.live_large_memory + (1 << 20));
+            obj.reset();
+            auto after = sg.memory_stats();
+            BOOST_REQUIRE_EQUAL(after.live_large_memory, before.live_large_memory);
+            memory::set_allocation_group_tracking(false);
+            return destroy_scheduling_group(sg);
+        });
+    });
+#else
+    return make_ready_future<>();
+#endif
+}
+
+SEASTAR_TEST_CASE(test_large_allocations_grow_in_place) {
+#ifndef DEFAULT_ALLOCATOR
+    auto obj = static_cast<char*>(malloc(4 << 20));
+    BOOST_REQUIRE(obj != nullptr);
+    std::fill_n(obj, 1 << 20, 'x');
+    // shrinking frees the pages that follow, which growing takes back
+    BOOST_REQUIRE_EQUAL(realloc(obj, 1 << 20), obj);
+    BOOST_REQUIRE_EQUAL(realloc(obj, 3 << 20), obj);
+    BOOST_REQUIRE_EQUAL(malloc_usable_size(obj), size_t(3 << 20));
+    BOOST_REQUIRE(memory::try_expand(obj, 4 << 20));
+    BOOST_REQUIRE_EQUAL(malloc_usable_size(obj), size_t(4 << 20));
+    BOOST_REQUIRE(std::all_of(obj, obj + (1 << 20), [] (char c) { return c == 'x'; }));
+    free(obj);
+
+    // small objects never grow
+    auto small = malloc(100);
+    BOOST_REQUIRE(!memory::try_expand(small, 200));
+    free(small);
+#endif
+    return make_ready_future<>();
+}
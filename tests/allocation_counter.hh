@@ -0,0 +1,61 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include "core/memory.hh"
+
+namespace seastar {
+
+// Counts the allocations and frees the calling shard makes while it
+// lives. With the default allocator (debug builds) nothing is counted, so
+// tests asserting on the counts pass vacuously there.
+class allocation_counter {
+    uint64_t _mallocs = memory::stats().mallocs();
+    uint64_t _frees = memory::stats().frees();
+public:
+    uint64_t allocations() const {
+        return memory::stats().mallocs() - _mallocs;
+    }
+    uint64_t frees() const {
+        return memory::stats().frees() - _frees;
+    }
+};
+
+// The fewest allocations a call of func() made, over tries calls. Code
+// that is preempted, or that fills a pool or a buffer now and then, may
+// allocate on some calls but not on most: the minimum is the cost of the
+// common path.
+template <typename Func>
+uint64_t min_allocations(Func&& func, unsigned tries = 10) {
+    auto ret = std::numeric_limits<uint64_t>::max();
+    for (unsigned i = 0; i < tries; ++i) {
+        allocation_counter counter;
+        func();
+        ret = std::min(ret, counter.allocations());
+    }
+    return ret;
+}
+
+}
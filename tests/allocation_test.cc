@@ -0,0 +1,188 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+// Tests that hot paths allocate no more than they do now, so that new
+// allocations on them show up here rather than in production profiles.
+// The bounds on the networking paths are ceilings with headroom: they catch
+// allocations per byte, per header or per layer, not any single one.
+
+#include <string>
+#include "tests/test-utils.hh"
+#include "tests/allocation_counter.hh"
+#include "tests/loopback_socket.hh"
+#include "core/reactor.hh"
+#include "core/thread.hh"
+#include "http/httpd.hh"
+#include "http/function_handlers.hh"
+#include "net/ip.hh"
+#include "net/tcp.hh"
+
+using namespace seastar;
+
+SEASTAR_TEST_CASE(test_ready_future_chain_does_not_allocate) {
+    auto allocations = min_allocations([] {
+        auto f = make_ready_future<int>(0).then([] (int x) {
+            return x + 1;
+        }).then([] (int x) {
+            return make_ready_future<int>(x + 1);
+        }).then([] (int x) {
+            return x + 1;
+        });
+        // deferred if preemption was due; min_allocations() skips that call
+        if (f.available()) {
+            BOOST_REQUIRE_EQUAL(f.get0(), 3);
+        }
+    });
+    BOOST_REQUIRE_EQUAL(allocations, 0u);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_submit_to_round_trip_allocations) {
+    if (smp::count < 2) {
+        return make_ready_future<>();
+    }
+    return seastar::async([] {
+        auto round_trip = [] {
+            BOOST_REQUIRE_EQUAL(smp::submit_to(1, [] { return 7; }).get0(), 7);
+        };
+        round_trip();
+        // the work item has a preallocated slot; only the task waiting
+        // for the reply is allocated
+        BOOST_REQUIRE_LE(min_allocations(round_trip), 1u);
+    });
+}
+
+// A device that receives what it sends, for running the native stack
+// without a NIC
+class loopback_qp : public net::qp {
+    net::device& _dev;
+    circular_buffer<net::packet> _looped;
+    // delivers outside of the transmit poller, as a NIC would
+    reactor::poller _rx_poller{reactor::poller::simple([this] { return deliver(); })};
+private:
+    bool deliver() {
+        if (_looped.empty()) {
+            return false;
+        }
+        auto looped = std::move(_looped);
+        while (!looped.empty()) {
+            _dev.l2receive(std::move(looped.front()));
+            looped.pop_front();
+        }
+        return true;
+    }
+public:
+    explicit loopback_qp(net::device& dev) : _dev(dev) {}
+    virtual future<> send(net::packet p) override {
+        _looped.push_back(std::move(p));
+        return make_ready_future<>();
+    }
+};
+
+class loopback_device : public net::device {
+    std::unique_ptr<loopback_qp> _qp = std::make_unique<loopback_qp>(*this);
+public:
+    loopback_device() {
+        _queues[engine().cpu_id()] = _qp.get();
+    }
+    virtual net::ethernet_address hw_address() override {
+        return { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    }
+    virtual net::hw_features hw_features() override {
+        return net::hw_features();
+    }
+    virtual std::unique_ptr<net::qp> init_local_queue(boost::program_options::variables_map, uint16_t) override {
+        abort();
+    }
+};
+
+struct native_loopback_stack {
+    std::shared_ptr<loopback_device> dev = std::make_shared<loopback_device>();
+    net::interface netif{dev};
+    net::ipv4 inet{&netif};
+    native_loopback_stack() {
+        inet.set_host_address(net::ipv4_address("10.0.0.1"));
+        inet.learn(dev->hw_address(), inet.host_address());
+    }
+};
+
+SEASTAR_TEST_CASE(test_native_tcp_loopback_allocations) {
+    return seastar::async([] {
+        // never destroyed: the stack's pollers and timers may outlive the
+        // test
+        static auto& stack = *new native_loopback_stack;
+        auto& tcp = stack.inet.get_tcp();
+        auto listener = tcp.listen(10000);
+        auto accepted = listener.accept();
+        auto client = tcp.connect(socket_address(ipv4_addr(stack.inet.host_address().ip, 10000)));
+        client.connected().get();
+        auto server = accepted.get0();
+
+        static const char payload[] = "a segment through the native stack";
+        auto round_trip = [&client, &server] {
+            client.send(net::packet(payload, sizeof(payload))).get();
+            size_t received = 0;
+            while (received < sizeof(payload)) {
+                server.wait_for_data().get();
+                received += server.read().len();
+            }
+        };
+        round_trip();
+        BOOST_REQUIRE_LE(min_allocations(round_trip), 32u);
+        client.close_write();
+        server.close_write();
+    });
+}
+
+SEASTAR_TEST_CASE(test_http_request_allocations) {
+    return seastar::async([] {
+        loopback_connection_factory lcf;
+        httpd::http_server server("test_http_request_allocations");
+        httpd::http_server_tester::listeners(server).emplace_back(lcf.get_server_socket());
+        server._routes.put(httpd::GET, "/", new httpd::function_handler([] (httpd::const_req req) {
+            return "hello";
+        }, "txt"));
+        auto accepted = server.do_accepts(0);
+
+        loopback_socket_impl lsi(lcf);
+        auto c_socket = lsi.connect(socket_address(ipv4_addr()), socket_address(ipv4_addr())).get0();
+        auto input = c_socket.input();
+        auto output = c_socket.output();
+        auto request = [&input, &output] {
+            output.write("GET / HTTP/1.1\r\nHost: myhost.org\r\n\r\n").get();
+            output.flush().get();
+            std::string reply;
+            while (reply.find("\r\n\r\nhello") == std::string::npos) {
+                auto buf = input.read().get0();
+                BOOST_REQUIRE(!buf.empty());
+                reply.append(buf.get(), buf.size());
+            }
+        };
+        request();
+        // both the client and the server side are counted
+        BOOST_REQUIRE_LE(min_allocations(request), 64u);
+        output.close().get();
+        input.close().get();
+        server.stop().get();
+        accepted.get();
+    });
+}
@@ -0,0 +1,93 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "core/arena.hh"
+#include <cstring>
+#include <map>
+#include <vector>
+
+using namespace seastar;
+
+BOOST_AUTO_TEST_CASE(test_arena_allocations_are_aligned_and_distinct) {
+    arena a(4096);
+    std::vector<char*> ptrs;
+    for (size_t i = 1; i < 1000; ++i) {
+        auto align = size_t(1) << (i % 5);
+        auto p = static_cast<char*>(a.allocate(i % 100 + 1, align));
+        BOOST_REQUIRE_EQUAL(reinterpret_cast<uintptr_t>(p) % align, 0);
+        std::memset(p, i, i % 100 + 1);
+        ptrs.push_back(p);
+    }
+    for (size_t i = 1; i < 1000; ++i) {
+        auto p = ptrs[i - 1];
+        for (size_t j = 0; j < i % 100 + 1; ++j) {
+            BOOST_REQUIRE_EQUAL(p[j], char(i));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_arena_large_allocations) {
+    arena a(4096);
+    auto small = static_cast<char*>(a.allocate(16));
+    auto large = static_cast<char*>(a.allocate(100000));
+    std::memset(large, 1, 100000);
+    // the current chunk is still used for small allocations
+    auto small2 = static_cast<char*>(a.allocate(16));
+    BOOST_REQUIRE(small2 > small && small2 < small + 4096);
+    BOOST_REQUIRE_EQUAL(a.allocated_bytes(), 100032);
+    a.reset();
+    BOOST_REQUIRE_EQUAL(a.allocated_bytes(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_arena_allocator_with_containers) {
+    arena a;
+    using alloc = arena_allocator<std::pair<const int, int>>;
+    std::map<int, int, std::less<int>, alloc> m{std::less<int>(), alloc(a)};
+    std::vector<int, arena_allocator<int>> v{arena_allocator<int>(a)};
+    for (int i = 0; i < 10000; ++i) {
+        m.emplace(i, i * 2);
+        v.push_back(i);
+    }
+    BOOST_REQUIRE_EQUAL(m.size(), 10000);
+    BOOST_REQUIRE_EQUAL(m[5000], 10000);
+    BOOST_REQUIRE_EQUAL(v[9999], 9999);
+}
+
+BOOST_AUTO_TEST_CASE(test_arena_recycles_chunks) {
+    arena_chunk_cache cache(4096, 4);
+    {
+        arena a(cache);
+        for (int i = 0; i < 1000; ++i) {
+            a.allocate(64);
+        }
+    }
+    // 1000 * 64 bytes span many chunks, but only 4 are kept
+    BOOST_REQUIRE_EQUAL(cache.size(), 4);
+    {
+        arena a(cache);
+        a.allocate(64);
+        BOOST_REQUIRE_EQUAL(cache.size(), 3);
+    }
+    BOOST_REQUIRE_EQUAL(cache.size(), 4);
+}
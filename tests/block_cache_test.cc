@@ -0,0 +1,185 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include "tests/test-utils.hh"
+#include "core/block_cache.hh"
+#include "core/thread.hh"
+#include "core/reactor.hh"
+
+using namespace seastar;
+
+// A file in memory, that counts the reads that reach it
+class memory_file final : public file_impl {
+    std::vector<uint8_t> _data;
+public:
+    unsigned reads = 0;
+    explicit memory_file(size_t size) : _data(size) {
+        for (size_t i = 0; i < size; ++i) {
+            _data[i] = uint8_t(i % 251);
+        }
+    }
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class&) override {
+        auto p = static_cast<const uint8_t*>(buffer);
+        if (pos + len > _data.size()) {
+            _data.resize(pos + len);
+        }
+        std::copy_n(p, len, _data.begin() + pos);
+        return make_ready_future<size_t>(len);
+    }
+    virtual future<size_t> write_dma(uint64_t, std::vector<iovec>, const io_priority_class&) override {
+        throw std::bad_function_call();
+    }
+    virtual future<size_t> read_dma(uint64_t, void*, size_t, const io_priority_class&) override {
+        throw std::bad_function_call();
+    }
+    virtual future<size_t> read_dma(uint64_t, std::vector<iovec>, const io_priority_class&) override {
+        throw std::bad_function_call();
+    }
+    virtual future<> flush() override {
+        return make_ready_future<>();
+    }
+    virtual future<struct stat> stat() override {
+        throw std::bad_function_call();
+    }
+    virtual future<> truncate(uint64_t length) override {
+        _data.resize(length);
+        return make_ready_future<>();
+    }
+    virtual future<> discard(uint64_t, uint64_t) override {
+        throw std::bad_function_call();
+    }
+    virtual future<> allocate(uint64_t, uint64_t) override {
+        throw std::bad_function_call();
+    }
+    virtual future<uint64_t> size() override {
+        return make_ready_future<uint64_t>(_data.size());
+    }
+    virtual future<> close() override {
+        return make_ready_future<>();
+    }
+    virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)>) override {
+        throw std::bad_function_call();
+    }
+    virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class&) override {
+        ++reads;
+        offset = std::min<uint64_t>(offset, _data.size());
+        auto len = std::min<uint64_t>(range_size, _data.size() - offset);
+        return make_ready_future<temporary_buffer<uint8_t>>(temporary_buffer<uint8_t>(_data.data() + offset, len));
+    }
+};
+
+static bool has_pattern(const temporary_buffer<uint8_t>& buf, uint64_t offset) {
+    for (size_t i = 0; i < buf.size(); ++i) {
+        if (buf[i] != uint8_t((offset + i) % 251)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static block_cache_config small_cache(size_t blocks) {
+    block_cache_config cfg;
+    cfg.block_size = 4096;
+    cfg.capacity = blocks * cfg.block_size;
+    return cfg;
+}
+
+SEASTAR_TEST_CASE(test_reads_are_cached) {
+    return seastar::async([] {
+        block_cache cache("test_reads_are_cached", small_cache(16));
+        auto mf = make_shared<memory_file>(10 * 4096 + 100);
+        auto f = make_cached_file(file(mf), cache);
+
+        auto buf = f.dma_read_bulk<uint8_t>(1000, 6000).get0();
+        BOOST_REQUIRE_EQUAL(buf.size(), 6000u);
+        BOOST_REQUIRE(has_pattern(buf, 1000));
+        BOOST_REQUIRE_EQUAL(mf->reads, 2u);
+
+        // the same blocks, again
+        buf = f.dma_read_bulk<uint8_t>(0, 8192).get0();
+        BOOST_REQUIRE(has_pattern(buf, 0));
+        BOOST_REQUIRE_EQUAL(mf->reads, 2u);
+        BOOST_REQUIRE_EQUAL(cache.hits(), 2u);
+
+        std::vector<uint8_t> out(4096);
+        BOOST_REQUIRE_EQUAL(f.dma_read(4096, out.data(), out.size()).get0(), 4096u);
+        BOOST_REQUIRE_EQUAL(out[0], uint8_t(4096 % 251));
+        BOOST_REQUIRE_EQUAL(mf->reads, 2u);
+
+        // the last, partial, block is read but not cached
+        buf = f.dma_read_bulk<uint8_t>(10 * 4096, 4096).get0();
+        BOOST_REQUIRE_EQUAL(buf.size(), 100u);
+        BOOST_REQUIRE(has_pattern(buf, 10 * 4096));
+        f.dma_read_bulk<uint8_t>(10 * 4096, 4096).get();
+        BOOST_REQUIRE_EQUAL(mf->reads, 4u);
+        f.close().get();
+        BOOST_REQUIRE_EQUAL(cache.used_memory(), 0u);
+    });
+}
+
+SEASTAR_TEST_CASE(test_writes_invalidate) {
+    return seastar::async([] {
+        block_cache cache("test_writes_invalidate", small_cache(16));
+        auto mf = make_shared<memory_file>(4 * 4096);
+        auto f = make_cached_file(file(mf), cache);
+
+        f.dma_read_bulk<uint8_t>(0, 4 * 4096).get();
+        BOOST_REQUIRE_EQUAL(mf->reads, 4u);
+
+        auto wbuf = temporary_buffer<uint8_t>::aligned(4096, 4096);
+        std::fill_n(wbuf.get_write(), wbuf.size(), 7);
+        f.dma_write(4096, wbuf.get(), wbuf.size()).get();
+
+        auto buf = f.dma_read_bulk<uint8_t>(4096, 4096).get0();
+        BOOST_REQUIRE(std::all_of(buf.begin(), buf.end(), [] (uint8_t c) { return c == 7; }));
+        BOOST_REQUIRE_EQUAL(mf->reads, 5u);
+        // the other blocks are still cached
+        buf = f.dma_read_bulk<uint8_t>(2 * 4096, 4096).get0();
+        BOOST_REQUIRE(has_pattern(buf, 2 * 4096));
+        BOOST_REQUIRE_EQUAL(mf->reads, 5u);
+        f.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_least_recently_used_is_evicted) {
+    return seastar::async([] {
+        block_cache cache("test_least_recently_used_is_evicted", small_cache(2));
+        auto mf = make_shared<memory_file>(4 * 4096);
+        auto f = make_cached_file(file(mf), cache);
+
+        f.dma_read_bulk<uint8_t>(0, 4096).get();
+        f.dma_read_bulk<uint8_t>(4096, 4096).get();
+        // block 0 becomes the most recently used, so block 1 goes
+        f.dma_read_bulk<uint8_t>(0, 4096).get();
+        f.dma_read_bulk<uint8_t>(2 * 4096, 4096).get();
+        BOOST_REQUIRE_EQUAL(mf->reads, 3u);
+        BOOST_REQUIRE_EQUAL(cache.used_memory(), 2 * 4096u);
+
+        f.dma_read_bulk<uint8_t>(0, 4096).get();
+        BOOST_REQUIRE_EQUAL(mf->reads, 3u);
+        f.dma_read_bulk<uint8_t>(4096, 4096).get();
+        BOOST_REQUIRE_EQUAL(mf->reads, 4u);
+        f.close().get();
+    });
+}
@@ -0,0 +1,121 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include <vector>
+#include "tests/test-utils.hh"
+#include "core/block_stream.hh"
+#include "core/crc32c.hh"
+#include "core/fstream.hh"
+#include "core/reactor.hh"
+#include "core/seastar.hh"
+#include "core/thread.hh"
+
+using namespace seastar;
+
+// Compressible, but not trivially so
+static std::vector<char> make_data(size_t size) {
+    std::vector<char> data(size);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = char((i / 7) % 13 + (i % 1000 == 0 ? i / 1000 : 0));
+    }
+    return data;
+}
+
+static void write_block_stream(sstring name, const std::vector<char>& data, block_stream_options options) {
+    auto f = open_file_dma(name, open_flags::rw | open_flags::create | open_flags::truncate).get0();
+    auto out = make_block_output_stream(make_file_output_stream(std::move(f)), options);
+    // in pieces that straddle the blocks
+    for (size_t pos = 0; pos < data.size(); pos += 10000) {
+        out.write(data.data() + pos, std::min<size_t>(10000, data.size() - pos)).get();
+    }
+    out.close().get();
+}
+
+static std::vector<char> read_block_stream(sstring name) {
+    auto f = open_file_dma(name, open_flags::ro).get0();
+    auto in = make_block_input_stream(make_file_input_stream(std::move(f)));
+    std::vector<char> ret;
+    std::exception_ptr ex;
+    try {
+        while (true) {
+            auto buf = in.read().get0();
+            if (buf.empty()) {
+                break;
+            }
+            ret.insert(ret.end(), buf.begin(), buf.end());
+        }
+    } catch (...) {
+        ex = std::current_exception();
+    }
+    in.close().get();
+    if (ex) {
+        std::rethrow_exception(ex);
+    }
+    return ret;
+}
+
+SEASTAR_TEST_CASE(test_crc32c) {
+    const char* check = "123456789";
+    BOOST_REQUIRE_EQUAL(crc32c(0, check, 9), 0xe3069283u);
+    // in pieces
+    BOOST_REQUIRE_EQUAL(crc32c(crc32c(0, check, 4), check + 4, 5), 0xe3069283u);
+    BOOST_REQUIRE_EQUAL(crc32c(0, check, 0), 0u);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_block_stream_round_trip) {
+    return seastar::async([] {
+        auto data = make_data(300 * 1000);
+        for (auto compression : {block_compression::none, block_compression::lz4}) {
+            for (auto checksum : {false, true}) {
+                block_stream_options options;
+                options.block_size = 32 * 1024;
+                options.checksum = checksum;
+                options.compression = compression;
+                write_block_stream("testfile.tmp", data, options);
+                auto size = file_size("testfile.tmp").get0();
+                if (compression == block_compression::lz4) {
+                    BOOST_REQUIRE_LT(size, data.size());
+                }
+                BOOST_REQUIRE(read_block_stream("testfile.tmp") == data);
+            }
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_block_stream_detects_corruption) {
+    return seastar::async([] {
+        auto data = make_data(100 * 1000);
+        block_stream_options options;
+        options.block_size = 16 * 1024;
+        write_block_stream("testfile.tmp", data, options);
+
+        auto f = open_file_dma("testfile.tmp", open_flags::rw).get0();
+        auto buf = f.dma_read<char>(0, 4096).get0();
+        auto copy = allocate_dma_buffer<char>(4096, 4096);
+        std::copy(buf.begin(), buf.end(), copy.get_write());
+        copy.get_write()[1000] ^= 1;
+        f.dma_write(0, copy.get(), 4096).get();
+        f.close().get();
+
+        BOOST_REQUIRE_THROW(read_block_stream("testfile.tmp"), block_stream_error);
+    });
+}
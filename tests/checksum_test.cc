@@ -0,0 +1,110 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#define BOOST_TEST_MODULE checksum
+
+#include <boost/test/included/unit_test.hpp>
+#include <random>
+#include <vector>
+#include "net/ip_checksum.hh"
+
+using namespace seastar;
+using namespace net;
+
+// RFC 1071, one 16-bit word at a time
+static uint16_t reference_checksum(const std::vector<uint8_t>& data) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < data.size(); i += 2) {
+        sum += uint16_t(data[i] << 8) | (i + 1 < data.size() ? data[i + 1] : 0);
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return htons(~sum);
+}
+
+static std::vector<uint8_t> random_data(std::default_random_engine& e, size_t len) {
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<uint8_t> data(len);
+    for (auto& b : data) {
+        b = byte(e);
+    }
+    return data;
+}
+
+BOOST_AUTO_TEST_CASE(test_sum_matches_reference) {
+    std::default_random_engine e(17);
+    for (size_t len : {0, 1, 7, 64, 127, 128, 129, 255, 1000, 1460, 1500, 4097, 9000, 65535}) {
+        auto data = random_data(e, len);
+        auto expected = reference_checksum(data);
+        BOOST_REQUIRE_EQUAL(ip_checksum(data.data(), data.size()), expected);
+
+        // summed in pieces, some of them at odd offsets
+        std::uniform_int_distribution<size_t> cut(0, len);
+        for (int i = 0; i < 10; ++i) {
+            auto a = cut(e);
+            auto b = cut(e);
+            if (a > b) {
+                std::swap(a, b);
+            }
+            checksummer csum;
+            auto p = reinterpret_cast<const char*>(data.data());
+            csum.sum(p, a);
+            if (b > a) {
+                csum.sum(p + a, b - a);
+            }
+            if (len > b) {
+                csum.sum(p + b, len - b);
+            }
+            BOOST_REQUIRE_EQUAL(csum.get(), expected);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_all_ones) {
+    // sums that fold to 0xffff, where the carries matter most
+    std::vector<uint8_t> data(65534, 0xff);
+    BOOST_REQUIRE_EQUAL(ip_checksum(data.data(), data.size()), reference_checksum(data));
+    data.assign(4096, 0);
+    BOOST_REQUIRE_EQUAL(ip_checksum(data.data(), data.size()), 0xffff);
+}
+
+BOOST_AUTO_TEST_CASE(test_copy_and_sum) {
+    std::default_random_engine e(42);
+    for (size_t len : {0, 3, 100, 128, 1448, 2049, 9001}) {
+        auto data = random_data(e, len);
+        for (size_t head : {0, 1, 2, 5}) {
+            if (head > len) {
+                continue;
+            }
+            std::vector<uint8_t> out(len + 1, 0xaa);
+            auto src = reinterpret_cast<const char*>(data.data());
+            auto dst = reinterpret_cast<char*>(out.data()) + 1;
+            checksummer csum;
+            csum.sum(src, head);
+            csum.copy_and_sum(dst + head, src + head, len - head);
+            BOOST_REQUIRE_EQUAL(csum.get(), reference_checksum(data));
+            BOOST_REQUIRE(std::equal(data.begin() + head, data.end(), out.begin() + 1 + head));
+            BOOST_REQUIRE_EQUAL(out[0], 0xaa);
+        }
+    }
+}
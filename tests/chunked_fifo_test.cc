@@ -27,6 +27,8 @@
 #include <stdlib.h>
 #include <chrono>
 #include <deque>
+#include <numeric>
+#include <vector>
 #include "core/circular_buffer.hh"
 
 using namespace seastar;
@@ -210,6 +212,84 @@ BOOST_AUTO_TEST_CASE(chunked_fifo_construct_fail2) {
     BOOST_REQUIRE_EQUAL(fifo.empty(), true);
 }
 
+BOOST_AUTO_TEST_CASE(chunked_fifo_bulk) {
+    chunked_fifo<int, 8> fifo;
+    std::vector<int> in(30);
+    std::iota(in.begin(), in.end(), 0);
+    // start in the middle of a chunk, so that its items wrap around
+    fifo.push_back(-1);
+    fifo.push_back(-1);
+    fifo.pop_front_n(1);
+    fifo.push_back_n(in.begin(), in.size());
+    fifo.pop_front();
+    BOOST_REQUIRE_EQUAL(fifo.size(), 30);
+    BOOST_REQUIRE_EQUAL(fifo.front(), 0);
+    BOOST_REQUIRE_EQUAL(fifo.back(), 29);
+
+    std::vector<int> out;
+    auto popped = fifo.pop_front_n(20, [&] (int* p, size_t n) {
+        BOOST_REQUIRE(n <= 8);
+        out.insert(out.end(), p, p + n);
+    });
+    BOOST_REQUIRE_EQUAL(popped, 20);
+    BOOST_REQUIRE_EQUAL(fifo.size(), 10);
+    BOOST_REQUIRE_EQUAL(fifo.front(), 20);
+    BOOST_REQUIRE(std::equal(out.begin(), out.end(), in.begin()));
+
+    BOOST_REQUIRE_EQUAL(fifo.pop_front_n(100, [] (int*, size_t) {}), 10);
+    BOOST_REQUIRE(fifo.empty());
+}
+
+BOOST_AUTO_TEST_CASE(chunked_fifo_bulk_construct_fail) {
+    // Items pushed before the failure stay, and no empty chunk is left
+    class my_exception {};
+    struct typ {
+        int v;
+        typ(int x) : v(x) {
+            if (x == 5) {
+                throw my_exception();
+            }
+        }
+    };
+    chunked_fifo<typ, 4> fifo;
+    std::vector<int> in = {1, 2, 3, 4, 5, 6};
+    try {
+        fifo.push_back_n(in.begin(), in.size());
+        BOOST_FAIL("expected an exception");
+    } catch (my_exception) {
+        // expected
+    }
+    BOOST_REQUIRE_EQUAL(fifo.size(), 4);
+    BOOST_REQUIRE_EQUAL(fifo.back().v, 4);
+    fifo.pop_front_n(4);
+    BOOST_REQUIRE(fifo.empty());
+}
+
+BOOST_AUTO_TEST_CASE(chunked_fifo_free_chunks) {
+    chunked_fifo<int, 4> fifo;
+    fifo.set_max_free_chunks(3);
+    std::vector<int> in(16);
+    fifo.push_back_n(in.begin(), in.size());
+    BOOST_REQUIRE_EQUAL(fifo.free_chunks(), 0);
+    fifo.pop_front_n(16);
+    // the fourth chunk is freed
+    BOOST_REQUIRE_EQUAL(fifo.free_chunks(), 3);
+    fifo.push_back_n(in.begin(), 10);
+    BOOST_REQUIRE_EQUAL(fifo.free_chunks(), 0);
+    fifo.shrink_to_fit();
+    fifo.clear();
+    BOOST_REQUIRE_EQUAL(fifo.free_chunks(), 3);
+    fifo.shrink_to_fit();
+    BOOST_REQUIRE_EQUAL(fifo.free_chunks(), 0);
+
+    // reserve() keeps working with a partially filled back chunk
+    fifo.push_back(1);
+    fifo.reserve(2);
+    BOOST_REQUIRE_EQUAL(fifo.free_chunks(), 0);
+    fifo.reserve(10);
+    BOOST_REQUIRE_EQUAL(fifo.free_chunks(), 2);
+}
+
 // Enable the following to run some benchmarks on different queue options
 #if 0
 // Unfortunately, C++ lacks the trivial feature of converting a type's name,
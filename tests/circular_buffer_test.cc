@@ -26,6 +26,8 @@
 #include <stdlib.h>
 #include <chrono>
 #include <deque>
+#include <numeric>
+#include <vector>
 #include "core/circular_buffer.hh"
 
 using namespace seastar;
@@ -107,3 +109,37 @@ BOOST_AUTO_TEST_CASE(test_erasing_in_the_middle) {
     BOOST_REQUIRE_EQUAL(*i++, 9);
     BOOST_REQUIRE(i == buf.end());
 }
+
+BOOST_AUTO_TEST_CASE(test_bulk_push_and_pop) {
+    circular_buffer<int> buf;
+    buf.reserve(16);
+    // wrap around the end of the storage
+    for (int i = 0; i < 10; ++i) {
+        buf.push_back(-1);
+    }
+    buf.pop_front_n(10);
+
+    std::vector<int> in(12);
+    std::iota(in.begin(), in.end(), 0);
+    buf.push_back_n(in.begin(), in.size());
+    BOOST_REQUIRE_EQUAL(buf.capacity(), 16u);
+    BOOST_REQUIRE_EQUAL(buf.size(), 12u);
+
+    std::vector<int> out;
+    unsigned runs = 0;
+    auto popped = buf.pop_front_n(100, [&] (int* p, size_t n) {
+        ++runs;
+        out.insert(out.end(), p, p + n);
+    });
+    BOOST_REQUIRE_EQUAL(popped, 12u);
+    BOOST_REQUIRE_EQUAL(runs, 2u);
+    BOOST_REQUIRE(out == in);
+    BOOST_REQUIRE(buf.empty());
+
+    // grows once, to fit all the items
+    buf.push_back_n(in.begin(), in.size());
+    buf.push_back_n(in.begin(), in.size());
+    BOOST_REQUIRE_EQUAL(buf.size(), 24u);
+    BOOST_REQUIRE_EQUAL(buf.capacity(), 32u);
+    BOOST_REQUIRE_EQUAL(buf[12], 0);
+}
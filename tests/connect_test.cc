@@ -1,6 +1,8 @@
 #include "tests/test-utils.hh"
 
 #include "net/ip.hh"
+#include "net/tcp_peer_stats.hh"
+#include "core/thread.hh"
 
 #include <random>
 
@@ -69,3 +71,43 @@ SEASTAR_TEST_CASE(test_accept_after_abort) {
         });
     });
 }
+
+SEASTAR_TEST_CASE(test_tcp_info) {
+    return seastar::async([] {
+        std::random_device rnd;
+        auto distr = std::uniform_int_distribution<uint16_t>(12000, 65000);
+        auto sa = make_ipv4_address({"127.0.0.1", distr(rnd)});
+        auto listener = engine().net().listen(sa, listen_options());
+        auto accepted = listener.accept();
+        auto client = engine().net().connect(sa).get0();
+        auto server = std::get<0>(accepted.get());
+
+        auto out = client.output();
+        auto in = server.input();
+        out.write(sstring(100 * 1024, 'x')).get();
+        out.flush().get();
+        in.read_exactly(100 * 1024).get();
+
+        auto info = client.get_tcp_info();
+        BOOST_REQUIRE_GT(info.mss, 0u);
+        BOOST_REQUIRE_GE(info.cwnd, info.mss);
+        BOOST_REQUIRE_EQUAL(info.retransmits, 0u);
+
+        tcp_peer_stats stats("test_tcp_info", 2);
+        stats.record("a", info);
+        info.rtt = std::chrono::microseconds(800);
+        stats.record("b", info);
+        stats.record("b", info);
+        stats.record("a", info);
+        // "b" is the least recently sampled
+        stats.record("c", info);
+        BOOST_REQUIRE_EQUAL(stats.size(), 2u);
+        BOOST_REQUIRE(!stats.get("b"));
+        BOOST_REQUIRE_EQUAL(stats.get("a")->samples, 2u);
+        BOOST_REQUIRE_EQUAL(stats.get("c")->rtt.count(), 800);
+        BOOST_REQUIRE_EQUAL(stats.get("c")->max_rtt.count(), 800);
+        stats.forget("c");
+        BOOST_REQUIRE_EQUAL(stats.size(), 1u);
+        out.close().get();
+    });
+}
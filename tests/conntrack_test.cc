@@ -0,0 +1,109 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <vector>
+#include "tests/test-utils.hh"
+#include "net/posix-stack.hh"
+
+using namespace seastar;
+using namespace net;
+
+using lba = listen_options::load_balancing_algorithm;
+using load_balancer = conntrack::load_balancer;
+
+static socket_address client(uint32_t ip) {
+    sockaddr_in sa = {};
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(ip);
+    return socket_address(sa);
+}
+
+static std::vector<load_balancer::shard_sample> idle_samples() {
+    return std::vector<load_balancer::shard_sample>(smp::count, load_balancer::shard_sample{0, 0});
+}
+
+SEASTAR_TEST_CASE(test_connection_count_spreads) {
+    load_balancer lb(lba::connection_count);
+    std::vector<unsigned> connections(smp::count);
+    for (unsigned i = 0; i < 4 * smp::count; i++) {
+        connections[lb.next_cpu(client(i))]++;
+    }
+    for (auto c : connections) {
+        BOOST_REQUIRE_EQUAL(c, 4u);
+    }
+    lb.closed_cpu(0);
+    BOOST_REQUIRE_EQUAL(lb.next_cpu(client(0)), 0u);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_busy_shard_is_avoided) {
+    if (smp::count < 2) {
+        return make_ready_future<>();
+    }
+    load_balancer lb(lba::activity);
+    auto samples = idle_samples();
+    samples[0].utilization = 0.9;
+    lb.update(samples);
+    for (unsigned i = 0; i < 10; i++) {
+        BOOST_REQUIRE_NE(lb.next_cpu(client(i)), 0u);
+    }
+
+    // as busy, but shard 1 moves more bytes
+    samples = idle_samples();
+    samples[1].bytes = 1 << 20;
+    lb.update(samples);
+    for (unsigned i = 0; i < 10; i++) {
+        BOOST_REQUIRE_NE(lb.next_cpu(client(i)), 1u);
+    }
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_idle_shards_share_connections) {
+    load_balancer lb(lba::activity);
+    lb.update(idle_samples());
+    std::vector<unsigned> connections(smp::count);
+    for (unsigned i = 0; i < 2 * smp::count; i++) {
+        connections[lb.next_cpu(client(i))]++;
+    }
+    for (auto c : connections) {
+        BOOST_REQUIRE_EQUAL(c, 2u);
+    }
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_sticky_client) {
+    if (smp::count < 2) {
+        return make_ready_future<>();
+    }
+    load_balancer lb(lba::activity, true);
+    lb.update(idle_samples());
+    auto cpu = lb.next_cpu(client(0x0a000001));
+    for (unsigned i = 0; i < 10; i++) {
+        BOOST_REQUIRE_EQUAL(lb.next_cpu(client(0x0a000001)), cpu);
+    }
+    // unless its shard is much busier than the others
+    auto samples = idle_samples();
+    samples[cpu].utilization = 1;
+    lb.update(samples);
+    BOOST_REQUIRE_NE(lb.next_cpu(client(0x0a000001)), cpu);
+    return make_ready_future<>();
+}
@@ -0,0 +1,117 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "core/coroutine.hh"
+#include "core/sleep.hh"
+#include "test-utils.hh"
+
+using namespace seastar;
+using namespace std::chrono_literals;
+
+#ifndef SEASTAR_COROUTINES_ENABLED
+
+SEASTAR_TEST_CASE(test_coroutines_not_compiled_in) {
+    return make_ready_future<>();
+}
+
+#else
+
+namespace {
+
+future<int> old_fashioned_continuations() {
+    return later().then([] {
+        return 42;
+    });
+}
+
+future<int> simple_coroutine() {
+    co_await later();
+    co_return 53;
+}
+
+future<int> ready_coroutine() {
+    co_return 64;
+}
+
+future<> failing_coroutine() {
+    co_await sleep(1ms);
+    throw std::runtime_error("expected");
+}
+
+future<int> summing_coroutine(int n) {
+    int sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += co_await make_ready_future<int>(i);
+        co_await later();
+    }
+    co_return sum;
+}
+
+future<std::tuple<int, double>> tuple_coroutine() {
+    co_await sleep(1ms);
+    co_return std::make_tuple(1, 2.5);
+}
+
+future<int> forwarding_coroutine() {
+    co_return old_fashioned_continuations();
+}
+
+}
+
+SEASTAR_TEST_CASE(test_simple_coroutines) {
+    BOOST_REQUIRE_EQUAL(co_await old_fashioned_continuations(), 42);
+    BOOST_REQUIRE_EQUAL(co_await simple_coroutine(), 53);
+    BOOST_REQUIRE_EQUAL(co_await ready_coroutine(), 64);
+    BOOST_REQUIRE_EQUAL(co_await forwarding_coroutine(), 42);
+    BOOST_REQUIRE_EQUAL(co_await summing_coroutine(100), 4950);
+    BOOST_REQUIRE(co_await tuple_coroutine() == std::make_tuple(1, 2.5));
+}
+
+SEASTAR_TEST_CASE(test_failing_coroutine) {
+    bool caught = false;
+    try {
+        co_await failing_coroutine();
+    } catch (const std::runtime_error&) {
+        caught = true;
+    }
+    BOOST_REQUIRE(caught);
+}
+
+SEASTAR_TEST_CASE(test_abandoned_coroutine) {
+    // The coroutine is destroyed, without being resumed, when the promise it
+    // waits on goes away
+    auto pr = std::make_unique<promise<>>();
+    bool destroyed = false;
+    struct set_on_destroy {
+        bool& flag;
+        ~set_on_destroy() { flag = true; }
+    };
+    auto f = [] (future<> f, bool& flag) -> future<> {
+        set_on_destroy d{flag};
+        co_await std::move(f);
+    }(pr->get_future(), destroyed);
+    BOOST_REQUIRE(!destroyed);
+    pr.reset();
+    BOOST_REQUIRE(destroyed);
+    co_return;
+}
+
+#endif
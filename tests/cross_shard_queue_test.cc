@@ -0,0 +1,108 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "tests/test-utils.hh"
+#include "core/cross_shard_queue.hh"
+#include "core/thread.hh"
+#include "core/sleep.hh"
+#include <boost/iterator/counting_iterator.hpp>
+#include <vector>
+
+using namespace seastar;
+
+SEASTAR_TEST_CASE(test_values_keep_the_order_of_their_producer) {
+    return seastar::async([] {
+        constexpr unsigned per_shard = 10000;
+        cross_shard_queue<std::pair<unsigned, unsigned>> q(64);
+        auto& qr = q;
+        auto pushed = parallel_for_each(smp::all_cpus(), [&qr] (unsigned s) {
+            return smp::submit_to(s, [&qr, s] {
+                return do_for_each(boost::counting_iterator<unsigned>(0), boost::counting_iterator<unsigned>(per_shard), [&qr, s] (unsigned i) {
+                    return qr.push_eventually(std::make_pair(s, i));
+                });
+            });
+        });
+        std::vector<unsigned> next(smp::count);
+        unsigned popped = 0;
+        while (popped < smp::count * per_shard) {
+            auto v = q.pop_eventually().get0();
+            BOOST_REQUIRE_EQUAL(v.second, next[v.first]++);
+            ++popped;
+        }
+        pushed.get();
+        BOOST_REQUIRE(q.empty());
+    });
+}
+
+SEASTAR_TEST_CASE(test_bulk_push_and_consume) {
+    return seastar::async([] {
+        cross_shard_queue<std::unique_ptr<int>> q(16);
+        BOOST_REQUIRE_EQUAL(q.capacity(), 16u);
+        std::vector<std::unique_ptr<int>> values;
+        for (int i = 0; i < 20; ++i) {
+            values.push_back(std::make_unique<int>(i));
+        }
+        // only as many as fit are moved
+        BOOST_REQUIRE_EQUAL(q.try_push_bulk(values.begin(), values.size()), 16u);
+        BOOST_REQUIRE(values[15] == nullptr);
+        BOOST_REQUIRE(values[16] != nullptr);
+        BOOST_REQUIRE(!q.try_push(std::move(values[16])));
+        BOOST_REQUIRE(values[16] != nullptr);
+
+        int expected = 0;
+        BOOST_REQUIRE_EQUAL(q.consume([&expected] (std::unique_ptr<int> v) {
+            BOOST_REQUIRE_EQUAL(*v, expected++);
+        }, 10), 10u);
+        BOOST_REQUIRE_EQUAL(q.try_push_bulk(values.begin() + 16, 4), 4u);
+        BOOST_REQUIRE_EQUAL(q.consume([&expected] (std::unique_ptr<int> v) {
+            BOOST_REQUIRE_EQUAL(*v, expected++);
+        }), 10u);
+        BOOST_REQUIRE_EQUAL(expected, 20);
+        BOOST_REQUIRE(!q.try_pop());
+    });
+}
+
+SEASTAR_TEST_CASE(test_full_queue_holds_producers_back) {
+    return seastar::async([] {
+        cross_shard_queue<unsigned> q(4);
+        auto& qr = q;
+        auto producer = smp::count - 1;
+        auto pushed = smp::submit_to(producer, [&qr] {
+            std::vector<unsigned> values;
+            for (unsigned i = 0; i < 100; ++i) {
+                values.push_back(i);
+            }
+            return qr.push_bulk_eventually(std::move(values));
+        });
+        // the producer fills the queue and waits until we pop
+        q.not_empty().get();
+        sleep(std::chrono::milliseconds(10)).get();
+        BOOST_REQUIRE(!pushed.available());
+        unsigned expected = 0;
+        while (expected < 100) {
+            q.not_empty().get();
+            q.consume([&expected] (unsigned v) {
+                BOOST_REQUIRE_EQUAL(v, expected++);
+            });
+        }
+        pushed.get();
+    });
+}
@@ -123,6 +123,49 @@ future<> test_map_reduce() {
     });
 }
 
+future<> test_map_reduce_tree() {
+    return do_with_distributed<X>([] (distributed<X>& x) {
+        return x.start().then([&x] {
+            return parallel_for_each(boost::irange(1u, 4u), [&x] (unsigned fanout) {
+                return x.map_reduce0_tree(std::mem_fn(&X::cpu_id_squared),
+                                          0,
+                                          std::plus<int>(),
+                                          fanout).then([] (int result) {
+                    int n = smp::count - 1;
+                    if (result != (n * (n + 1) * (2*n + 1)) / 6) {
+                        throw std::runtime_error("map_reduce0_tree failed");
+                    }
+                });
+            });
+        });
+    });
+}
+
+struct Z {
+    unsigned calls = 0;
+    void call() { ++calls; }
+    future<> stop() { return make_ready_future<>(); }
+};
+
+future<> test_invoke_on_all_tree_and_batched() {
+    return do_with_distributed<Z>([] (distributed<Z>& z) {
+        return z.start().then([&z] {
+            return z.invoke_on_all_tree([] (Z& z) { z.call(); }, 2);
+        }).then([&z] {
+            return z.invoke_on_all_batched([] (Z& z) { z.call(); }, [] (Z& z) {
+                z.call();
+                return make_ready_future<>();
+            });
+        }).then([&z] {
+            return z.map_reduce0([] (Z& z) { return z.calls; }, 0u, std::plus<unsigned>());
+        }).then([] (unsigned calls) {
+            if (calls != 3 * smp::count) {
+                throw std::runtime_error("invoke_on_all_tree or invoke_on_all_batched missed a shard");
+            }
+        });
+    });
+}
+
 future<> test_async() {
     return do_with_distributed<async_service>([] (distributed<async_service>& x) {
         return x.start().then([&x] {
@@ -172,6 +215,10 @@ int main(int argc, char** argv) {
             return test_constructor_argument_is_passed_to_each_core();
         }).then([] {
             return test_map_reduce();
+        }).then([] {
+            return test_map_reduce_tree();
+        }).then([] {
+            return test_invoke_on_all_tree_and_batched();
         }).then([] {
             return test_async();
         }).then([] {
@@ -51,8 +51,7 @@ static future<> test_resolve(dns_resolver::options opts) {
     });
 }
 
-static future<> test_bad_name(dns_resolver::options opts) {
-    auto d = ::make_lw_shared<dns_resolver>(std::move(opts));
+static future<> test_bad_name_with(lw_shared_ptr<dns_resolver> d) {
     return d->get_host_by_name("apa.ninja.gnu", inet_address::family::INET).then_wrapped([d](future<hostent> f) {
         try {
             f.get();
@@ -60,7 +59,12 @@ static future<> test_bad_name(dns_resolver::options opts) {
         } catch (...) {
             // ok.
         }
-    }).finally([d]{
+    });
+}
+
+static future<> test_bad_name(dns_resolver::options opts) {
+    auto d = ::make_lw_shared<dns_resolver>(std::move(opts));
+    return test_bad_name_with(d).finally([d]{
         return d->close();
     });
 }
@@ -103,3 +107,48 @@ SEASTAR_TEST_CASE(test_bad_name_tcp) {
     return test_bad_name(opts);
 }
 
+
+SEASTAR_TEST_CASE(test_cached_resolve) {
+    auto d = ::make_lw_shared<dns_resolver>(dns_resolver::options());
+    // concurrent lookups share a query, later ones are served from the cache
+    auto f1 = d->get_host_by_name(google_name, inet_address::family::INET);
+    auto f2 = d->get_host_by_name(google_name, inet_address::family::INET);
+    return when_all(std::move(f1), std::move(f2)).then([d] (std::tuple<future<hostent>, future<hostent>> r) {
+        auto e1 = std::get<0>(r).get0();
+        auto e2 = std::get<1>(r).get0();
+        BOOST_REQUIRE(e1.addr_list == e2.addr_list);
+        return d->get_host_by_name(google_name, inet_address::family::INET).then([e1] (hostent e) {
+            BOOST_REQUIRE(e.addr_list == e1.addr_list);
+        });
+    }).finally([d] {
+        return d->close();
+    });
+}
+
+SEASTAR_TEST_CASE(test_bad_name_cached) {
+    auto d = ::make_lw_shared<dns_resolver>(dns_resolver::options());
+    return test_bad_name_with(d).then([d] {
+        // the answer that the name doesn't exist is cached too
+        return test_bad_name_with(d);
+    }).finally([d] {
+        return d->close();
+    });
+}
+
+SEASTAR_TEST_CASE(test_numeric_address) {
+    dns_resolver::options opts;
+    opts.cache_size = 0;
+    auto d = ::make_lw_shared<dns_resolver>(opts);
+    return d->get_host_by_name("127.0.0.1", inet_address::family::INET).then([d] (hostent e) {
+        BOOST_REQUIRE(e.addr_list.front() == inet_address("127.0.0.1"));
+        dns_resolver::options opts;
+        auto cached = ::make_lw_shared<dns_resolver>(opts);
+        return cached->get_host_by_name("127.0.0.1", inet_address::family::INET).then([] (hostent e) {
+            BOOST_REQUIRE(e.addr_list.front() == inet_address("127.0.0.1"));
+        }).finally([cached] {
+            return cached->close();
+        });
+    }).finally([d] {
+        return d->close();
+    });
+}
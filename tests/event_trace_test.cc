@@ -0,0 +1,102 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "core/event_trace.hh"
+
+using namespace seastar;
+
+static std::vector<event_trace_record> records_of(const sstring& dump, event_trace_dump_header& h) {
+    BOOST_REQUIRE_GE(dump.size(), sizeof(h));
+    std::memcpy(&h, dump.begin(), sizeof(h));
+    BOOST_REQUIRE_EQUAL(sstring(h.magic, sizeof(h.magic)), "SSEVTRC1");
+    BOOST_REQUIRE_EQUAL(dump.size(), sizeof(h) + h.nr_records * sizeof(event_trace_record));
+    std::vector<event_trace_record> ret(h.nr_records);
+    std::memcpy(ret.data(), dump.begin() + sizeof(h), ret.size() * sizeof(event_trace_record));
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(test_records_in_order) {
+    event_trace t(3, 8, "");
+    t.record(event_trace_type::task_start, 2, 0);
+    t.record(event_trace_type::task_end, 2, 0);
+    t.record(event_trace_type::smp_send, 0, 5);
+    event_trace_dump_header h;
+    auto records = records_of(t.dump(), h);
+    BOOST_REQUIRE_EQUAL(h.shard, 3u);
+    BOOST_REQUIRE_EQUAL(h.recorded, 3u);
+    BOOST_REQUIRE_EQUAL(records.size(), 3u);
+    BOOST_REQUIRE(records[0].type == event_trace_type::task_start);
+    BOOST_REQUIRE_EQUAL(records[0].group, 2u);
+    BOOST_REQUIRE(records[2].type == event_trace_type::smp_send);
+    BOOST_REQUIRE_EQUAL(records[2].arg, 5u);
+    BOOST_REQUIRE_LE(records[0].tsc, records[2].tsc);
+    BOOST_REQUIRE_LE(h.anchor_ns[0], h.anchor_ns[1]);
+}
+
+BOOST_AUTO_TEST_CASE(test_ring_keeps_latest) {
+    // rounded up to 8
+    event_trace t(0, 5, "");
+    for (uint32_t i = 0; i < 20; ++i) {
+        t.record(event_trace_type::poll, 0, i);
+    }
+    event_trace_dump_header h;
+    auto records = records_of(t.dump(), h);
+    BOOST_REQUIRE_EQUAL(h.recorded, 20u);
+    BOOST_REQUIRE_EQUAL(records.size(), 8u);
+    for (uint32_t i = 0; i < 8; ++i) {
+        BOOST_REQUIRE_EQUAL(records[i].arg, 12 + i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_dump_on_stall) {
+    char path[] = "/tmp/event_trace_testXXXXXX";
+    auto fd = ::mkstemp(path);
+    BOOST_REQUIRE_NE(fd, -1);
+    ::close(fd);
+    {
+        event_trace t(1, 4, path);
+        for (uint32_t i = 0; i < 6; ++i) {
+            t.record(event_trace_type::timer_fire, 0, i);
+        }
+        t.dump_on_stall();
+        auto expected = t.dump();
+        FILE* f = ::fopen(path, "r");
+        BOOST_REQUIRE(f);
+        std::vector<char> buf(4096);
+        auto n = ::fread(buf.data(), 1, buf.size(), f);
+        ::fclose(f);
+        event_trace_dump_header h;
+        auto records = records_of(sstring(buf.data(), n), h);
+        BOOST_REQUIRE_EQUAL(records.size(), 4u);
+        BOOST_REQUIRE_EQUAL(records[0].arg, 2u);
+        BOOST_REQUIRE_EQUAL(records[3].arg, 5u);
+        BOOST_REQUIRE_EQUAL(n, expected.size());
+    }
+    ::unlink(path);
+}
@@ -20,12 +20,14 @@
  */
 
 #include <algorithm>
+#include <numeric>
 #include <random>
 #include <vector>
 
 #include "core/thread.hh"
 #include "test-utils.hh"
 #include "core/execution_stage.hh"
+#include "core/sleep.hh"
 
 using namespace seastar;
 
@@ -286,3 +288,38 @@ SEASTAR_TEST_CASE(test_unique_stage_names_are_enforced) {
         stage().get();
     });
 }
+
+SEASTAR_TEST_CASE(test_latency_target) {
+    return seastar::async([] {
+        auto stage = seastar::make_execution_stage("test", [] (int x) { return x; });
+        stage.set_latency_target(std::chrono::milliseconds(100));
+        BOOST_REQUIRE_EQUAL(stage.batch_limit(), 16u);
+
+        for (auto round = 0; round < 10; round++) {
+            std::vector<future<int>> fs;
+            for (auto i = 0; i < 1000; i++) {
+                fs.emplace_back(stage(i));
+            }
+            for (auto i = 0; i < 1000; i++) {
+                BOOST_REQUIRE_EQUAL(fs[i].get0(), i);
+            }
+        }
+        auto& stats = stage.get_stats();
+        BOOST_REQUIRE_EQUAL(stats.function_calls_executed, 10'000u);
+        auto batches = std::accumulate(stats.batch_size_histogram.begin(), stats.batch_size_histogram.end(), uint64_t(0));
+        auto waits = std::accumulate(stats.wait_time_histogram.begin(), stats.wait_time_histogram.end(), uint64_t(0));
+        BOOST_REQUIRE_EQUAL(stats.batch_size_sum, 10'000u);
+        BOOST_REQUIRE_EQUAL(waits, 10'000u);
+        BOOST_REQUIRE_LE(batches, stats.tasks_scheduled);
+
+        // an unreachable target shrinks the batch to a single call
+        stage.set_latency_target(std::chrono::microseconds(1));
+        for (auto i = 0; i < 100; i++) {
+            seastar::sleep(std::chrono::milliseconds(1)).get();
+            auto f = stage(i);
+            seastar::sleep(std::chrono::milliseconds(1)).get();
+            BOOST_REQUIRE_EQUAL(f.get0(), i);
+        }
+        BOOST_REQUIRE_EQUAL(stage.batch_limit(), 1u);
+    });
+}
@@ -185,5 +185,56 @@ SEASTAR_TEST_CASE(test_expiry_operations) {
         BOOST_REQUIRE_EQUAL(fifo.front(), 5);
         fifo.pop_front();
         BOOST_REQUIRE_EQUAL(fifo.size(), 0);
+
+        expired.clear();
+
+        // timeouts out of push order, and popping the earliest to expire
+        fifo.push_back(1, manual_clock::now() + 3s);
+        fifo.push_back(2, manual_clock::now() + 1s);
+        fifo.push_back(3, manual_clock::now() + 2s);
+        fifo.push_back(4, manual_clock::now() + 4s);
+        fifo.push_back(5, manual_clock::now() + 1s);
+
+        manual_clock::advance(1s);
+        later().get();
+
+        BOOST_REQUIRE(expired == std::vector<int>({2, 5}));
+        BOOST_REQUIRE_EQUAL(fifo.size(), 3);
+        BOOST_REQUIRE_EQUAL(fifo.front(), 1);
+        fifo.pop_front();
+        BOOST_REQUIRE_EQUAL(fifo.front(), 3);
+
+        manual_clock::advance(2s);
+        later().get();
+
+        BOOST_REQUIRE(expired == std::vector<int>({2, 5, 3}));
+        BOOST_REQUIRE_EQUAL(fifo.size(), 1);
+        BOOST_REQUIRE_EQUAL(fifo.front(), 4);
+        fifo.pop_front();
+        BOOST_REQUIRE(fifo.empty());
+
+        manual_clock::advance(2s);
+        later().get();
+        BOOST_REQUIRE_EQUAL(expired.size(), 3);
+
+        expired.clear();
+
+        // the timer still fires for a popped element, and then moves on
+        fifo.push_back(1, manual_clock::now() + 1s);
+        fifo.push_back(2, manual_clock::now() + 2s);
+        fifo.pop_front();
+
+        manual_clock::advance(1s);
+        later().get();
+
+        BOOST_REQUIRE(expired.empty());
+        BOOST_REQUIRE_EQUAL(fifo.size(), 1);
+        BOOST_REQUIRE_EQUAL(fifo.front(), 2);
+
+        manual_clock::advance(1s);
+        later().get();
+
+        BOOST_REQUIRE(expired == std::vector<int>({2}));
+        BOOST_REQUIRE(fifo.empty());
     });
 }
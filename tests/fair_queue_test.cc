@@ -329,3 +329,58 @@ SEASTAR_TEST_CASE(test_fair_queue_random_run) {
        return env->verify(sprint("random_run (%d msec)", reqs / 10), {1, 1}, expected_error);
     }).then([env] {});
 }
+
+// Requests are limited by their total size in flight, not only by count.
+SEASTAR_TEST_CASE(test_fair_queue_bytes_limit) {
+    fair_queue::config cfg;
+    cfg.max_bytes_count = 100;
+    auto fq = make_lw_shared<fair_queue>(cfg);
+    auto pc = fq->register_priority_class(1);
+    auto pr = make_lw_shared<promise<>>();
+    fair_queue_request_descriptor big;
+    big.size = 100;
+    auto first = fq->queue(pc, big, [pr] {
+        return pr->get_future();
+    });
+    auto second = fq->queue(pc, big, [] {});
+    BOOST_REQUIRE_EQUAL(fq->requests_currently_executing(), 1u);
+    BOOST_REQUIRE_EQUAL(fq->waiters(), 1u);
+    pr->set_value();
+    return when_all(std::move(first), std::move(second)).discard_result().then([fq, pc] {
+        BOOST_REQUIRE_EQUAL(fq->requests_currently_executing(), 0u);
+        BOOST_REQUIRE_EQUAL(fq->waiters(), 0u);
+        fq->unregister_priority_class(pc);
+    });
+}
+
+// Queues that share their capacity do not exceed it together, and pick up
+// what the others returned when polled.
+SEASTAR_TEST_CASE(test_fair_queue_shared_capacity) {
+    auto shared = make_lw_shared<fair_queue_shared_capacity>();
+    fair_queue::config cfg;
+    cfg.capacity = 1;
+    cfg.shared_capacity = shared.get();
+    auto fq1 = make_lw_shared<fair_queue>(cfg);
+    auto fq2 = make_lw_shared<fair_queue>(cfg);
+    auto pc1 = fq1->register_priority_class(1);
+    auto pc2 = fq2->register_priority_class(1);
+    auto pr = make_lw_shared<promise<>>();
+    auto first = fq1->queue(pc1, fair_queue_request_descriptor(), [pr] {
+        return pr->get_future();
+    });
+    auto second = make_lw_shared(fq2->queue(pc2, fair_queue_request_descriptor(), [] {}));
+    BOOST_REQUIRE_EQUAL(shared->requests_executing(), 1u);
+    BOOST_REQUIRE_EQUAL(fq2->waiters(), 1u);
+    BOOST_REQUIRE(!fq2->can_dispatch_pending());
+    pr->set_value();
+    return std::move(first).then([=] {
+        BOOST_REQUIRE_EQUAL(fq2->waiters(), 1u);
+        BOOST_REQUIRE(fq2->can_dispatch_pending());
+        BOOST_REQUIRE(fq2->dispatch_pending());
+        return std::move(*second);
+    }).then([=] {
+        BOOST_REQUIRE_EQUAL(shared->requests_executing(), 0u);
+        fq1->unregister_priority_class(pc1);
+        fq2->unregister_priority_class(pc2);
+    });
+}
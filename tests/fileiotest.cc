@@ -24,6 +24,13 @@
 #include "core/semaphore.hh"
 #include "core/file.hh"
 #include "core/reactor.hh"
+#include "core/thread.hh"
+#include "core/future-util.hh"
+#include "core/seastar.hh"
+#include "core/dma_buffer_pool.hh"
+#include "core/shared_file.hh"
+#include <boost/range/irange.hpp>
+#include <set>
 
 using namespace seastar;
 
@@ -71,3 +78,324 @@ SEASTAR_TEST_CASE(test1) {
 }
 
 
+
+SEASTAR_TEST_CASE(test_append_extension) {
+    return seastar::async([] {
+        static constexpr size_t nr_writes = 256;
+        file_open_options options;
+        options.append_extension_size = 64 * 1024;
+        auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate, options).get0();
+        auto wbuf = allocate_aligned_buffer<unsigned char>(4096, 4096);
+        std::fill(wbuf.get(), wbuf.get() + 4096, 'x');
+        parallel_for_each(boost::irange<size_t>(0, nr_writes), [&] (size_t i) {
+            return f.dma_write(i * 4096, wbuf.get(), 4096).then([] (size_t ret) {
+                BOOST_REQUIRE_EQUAL(ret, 4096u);
+            });
+        }).get();
+        // the file may have been extended further, but not its size
+        BOOST_REQUIRE_EQUAL(f.size().get0(), nr_writes * 4096);
+        f.flush().get();
+        f.close().get();
+
+        f = open_file_dma("testfile.tmp", open_flags::ro).get0();
+        BOOST_REQUIRE_EQUAL(f.size().get0(), nr_writes * 4096);
+        f.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_scan_directory) {
+    return seastar::async([] {
+        static constexpr unsigned nr_files = 3000;
+        touch_directory("testdir.tmp").get();
+        parallel_for_each(boost::irange(0u, nr_files), [] (unsigned i) {
+            return open_file_dma(sprint("testdir.tmp/%d", i), open_flags::rw | open_flags::create).then([i] (file f) {
+                return f.truncate(i).then([f] () mutable {
+                    return f.close();
+                }).finally([f] {});
+            });
+        }).get();
+
+        auto dir = open_directory("testdir.tmp").get0();
+        directory_scan_options options;
+        options.buffer_size = 16 * 1024;
+        options.stat = true;
+        std::set<unsigned> seen;
+        unsigned batches = 0;
+        auto sub = dir.scan_directory([&] (std::vector<directory_scan_entry> batch) {
+            ++batches;
+            for (auto&& e : batch) {
+                auto i = unsigned(std::stoul(e.name));
+                BOOST_REQUIRE(e.type && *e.type == directory_entry_type::regular);
+                BOOST_REQUIRE(e.stat);
+                BOOST_REQUIRE_EQUAL(e.stat->st_size, off_t(i));
+                BOOST_REQUIRE(seen.insert(i).second);
+            }
+            return make_ready_future<>();
+        }, options);
+        sub.done().get();
+        dir.close().get();
+        BOOST_REQUIRE_EQUAL(seen.size(), nr_files);
+        BOOST_REQUIRE_GT(batches, 1u);
+        BOOST_REQUIRE_LT(batches, nr_files / 10);
+
+        parallel_for_each(boost::irange(0u, nr_files), [] (unsigned i) {
+            return remove_file(sprint("testdir.tmp/%d", i));
+        }).get();
+        remove_file("testdir.tmp").get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_open_files_dma) {
+    return seastar::async([] {
+        static constexpr unsigned nr_files = 200;
+        touch_directory("testdir.tmp").get();
+        std::vector<sstring> names;
+        for (unsigned i = 0; i < nr_files; ++i) {
+            names.push_back(sprint("testdir.tmp/%d", i));
+        }
+        auto files = open_files_dma(names, open_flags::rw | open_flags::create).get0();
+        BOOST_REQUIRE_EQUAL(files.size(), nr_files);
+        parallel_for_each(boost::irange(0u, nr_files), [&] (unsigned i) {
+            return files[i].truncate(i * 4096).then([&files, i] {
+                return files[i].close();
+            });
+        }).get();
+
+        names.push_back("testdir.tmp/missing");
+        std::vector<int> failed(names.size());
+        files.clear();
+        files.resize(names.size());
+        open_files_dma(names, open_flags::ro, [&] (size_t i, future<file> f) {
+            try {
+                files[i] = f.get0();
+            } catch (std::system_error& e) {
+                failed[i] = e.code().value();
+            }
+        }, file_open_options()).get();
+        for (unsigned i = 0; i < nr_files; ++i) {
+            BOOST_REQUIRE_EQUAL(failed[i], 0);
+            BOOST_REQUIRE_EQUAL(files[i].size().get0(), i * 4096u);
+            files[i].close().get();
+        }
+        BOOST_REQUIRE_EQUAL(failed.back(), ENOENT);
+        BOOST_REQUIRE_THROW(open_files_dma(names, open_flags::ro).get(), std::system_error);
+
+        parallel_for_each(boost::irange(0u, nr_files), [&] (unsigned i) {
+            return remove_file(names[i]);
+        }).get();
+        remove_file("testdir.tmp").get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_merged_reads) {
+    return seastar::async([] {
+        static constexpr size_t size = 64 * 1024 + 100;
+        auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto wbuf = allocate_aligned_buffer<unsigned char>(align_up(size, size_t(4096)), 4096);
+        for (size_t i = 0; i < size; ++i) {
+            wbuf.get()[i] = i % 251;
+        }
+        f.dma_write(0, wbuf.get(), align_up(size, size_t(4096))).get();
+        f.truncate(size).get();
+        f.close().get();
+
+        file_open_options options;
+        options.merge_reads = true;
+        f = open_file_dma("testfile.tmp", open_flags::ro, options).get0();
+        struct range {
+            uint64_t offset;
+            size_t len;
+        };
+        // adjacent, overlapping, disjoint and past the end of the file
+        std::vector<range> ranges = {
+            {0, 4096}, {4096, 4096}, {1000, 9000}, {20000, 100}, {40960, 8192}, {size - 50, 4096}, {size + 4096, 4096},
+        };
+        std::vector<temporary_buffer<uint8_t>> bufs(ranges.size());
+        parallel_for_each(boost::irange<size_t>(0, ranges.size()), [&] (size_t i) {
+            return f.dma_read_bulk<uint8_t>(ranges[i].offset, ranges[i].len).then([&bufs, i] (temporary_buffer<uint8_t> buf) {
+                bufs[i] = std::move(buf);
+            });
+        }).get();
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            auto offset = ranges[i].offset;
+            auto expected = std::min<uint64_t>(ranges[i].len, std::max<uint64_t>(size, offset) - offset);
+            BOOST_REQUIRE_GE(bufs[i].size(), expected);
+            BOOST_REQUIRE(std::equal(bufs[i].get(), bufs[i].get() + expected, wbuf.get() + std::min<uint64_t>(offset, size)));
+        }
+        f.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_batched_discards) {
+    return seastar::async([] {
+        static constexpr size_t size = 64 * 1024;
+        file_open_options options;
+        options.batch_discards = true;
+        auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate, options).get0();
+        auto wbuf = allocate_aligned_buffer<unsigned char>(size, 4096);
+        std::fill_n(wbuf.get(), size, 7);
+        f.dma_write(0, wbuf.get(), size).get();
+
+        // adjacent and overlapping ranges are merged, the others issued apart
+        std::vector<std::pair<uint64_t, uint64_t>> discarded = { {0, 8192}, {4096, 4096}, {8192, 4096}, {32768, 4096} };
+        parallel_for_each(discarded, [&f] (std::pair<uint64_t, uint64_t> r) {
+            return f.discard(r.first, r.second);
+        }).get();
+        // close() issues the discards still queued
+        auto last = f.discard(49152, 4096);
+        discarded.emplace_back(49152, 4096);
+        f.close().get();
+        last.get();
+
+        f = open_file_dma("testfile.tmp", open_flags::ro).get0();
+        auto rbuf = allocate_aligned_buffer<unsigned char>(size, 4096);
+        BOOST_REQUIRE_EQUAL(f.dma_read(0, rbuf.get(), size).get0(), size);
+        for (size_t i = 0; i < size; ++i) {
+            auto in_discarded = std::any_of(discarded.begin(), discarded.end(), [i] (std::pair<uint64_t, uint64_t> r) {
+                return i >= r.first && i < r.first + r.second;
+            });
+            BOOST_REQUIRE_EQUAL(rbuf.get()[i], in_discarded ? 0 : 7);
+        }
+        f.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_file_latency_tracking) {
+    return seastar::async([] {
+        file_open_options options;
+        options.latency_tag = "tracked";
+        auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate, options).get0();
+        auto buf = allocate_aligned_buffer<unsigned char>(4096, 4096);
+        std::fill_n(buf.get(), 4096, 1);
+        f.dma_write(0, buf.get(), 4096).get();
+        f.dma_read(0, buf.get(), 4096).get();
+
+        auto find = [] () -> std::experimental::optional<file_latency_stats> {
+            for (auto&& s : engine().slowest_files(std::numeric_limits<size_t>::max())) {
+                if (s.tag == "tracked") {
+                    return s;
+                }
+            }
+            return {};
+        };
+        auto stats = find();
+        BOOST_REQUIRE(stats);
+        BOOST_REQUIRE_EQUAL(stats->ops, 2u);
+        BOOST_REQUIRE(stats->max_latency <= stats->total_latency);
+        f.close().get();
+        f = file();
+        BOOST_REQUIRE(!find());
+    });
+}
+
+SEASTAR_TEST_CASE(test_dsync_writes) {
+    return seastar::async([] {
+        auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate | open_flags::dsync).get0();
+        auto buf = allocate_aligned_buffer<unsigned char>(4096, 4096);
+        std::fill_n(buf.get(), 4096, 7);
+        auto before = engine().get_io_stats().aio_dsync_writes;
+        BOOST_REQUIRE_EQUAL(f.dma_write(0, buf.get(), 4096).get0(), 4096u);
+        BOOST_REQUIRE_EQUAL(engine().get_io_stats().aio_dsync_writes, before + 1);
+        std::fill_n(buf.get(), 4096, 0);
+        f.dma_read(0, buf.get(), 4096).get();
+        BOOST_REQUIRE(std::all_of(buf.get(), buf.get() + 4096, [] (unsigned char c) { return c == 7; }));
+        f.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_dma_buffer_pool) {
+    return seastar::async([] {
+        auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto wbuf = allocate_dma_buffer<char>(f.memory_dma_alignment(), 128 * 1024);
+        BOOST_REQUIRE_EQUAL(reinterpret_cast<uintptr_t>(wbuf.get()) % f.memory_dma_alignment(), 0u);
+        std::fill_n(wbuf.get_write(), wbuf.size(), 'x');
+        f.dma_write(0, wbuf.get(), wbuf.size()).get();
+        auto p = wbuf.get();
+        wbuf = {};
+
+        // a read of the same size reuses the buffer just freed
+        auto before = get_dma_buffer_pool_stats();
+        auto rbuf = f.dma_read<char>(0, 128 * 1024).get0();
+        auto after = get_dma_buffer_pool_stats();
+        BOOST_REQUIRE_EQUAL(rbuf.get(), p);
+        BOOST_REQUIRE_EQUAL(after.hits, before.hits + 1);
+        BOOST_REQUIRE(std::all_of(rbuf.begin(), rbuf.end(), [] (char c) { return c == 'x'; }));
+        BOOST_REQUIRE_EQUAL(after.used_bytes, before.used_bytes + 128 * 1024);
+        rbuf = {};
+
+        // sizes far from a standard one are not pooled
+        auto odd = allocate_dma_buffer<char>(4096, 5000);
+        BOOST_REQUIRE_EQUAL(get_dma_buffer_pool_stats().bypassed, after.bypassed + 1);
+        odd = {};
+
+        drop_cached_dma_buffers();
+        BOOST_REQUIRE_EQUAL(get_dma_buffer_pool_stats().cached_bytes, 0u);
+        f.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_buffered_reads) {
+    return seastar::async([] {
+        // tmpfs does not support O_DIRECT, so its files are read through
+        // the page cache
+        if (!file_exists("/dev/shm").get0()) {
+            return;
+        }
+        sstring name = "/dev/shm/seastar_fileiotest.tmp";
+        auto f = open_file_dma(name, open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto wbuf = allocate_dma_buffer<char>(4096, 3 * 4096);
+        for (size_t i = 0; i < wbuf.size(); ++i) {
+            wbuf.get_write()[i] = char(i % 251);
+        }
+        f.dma_write(0, wbuf.get(), wbuf.size()).get();
+
+        auto rbuf = f.dma_read<char>(100, 2 * 4096).get0();
+        BOOST_REQUIRE_EQUAL(rbuf.size(), 2 * 4096u);
+        for (size_t i = 0; i < rbuf.size(); ++i) {
+            BOOST_REQUIRE_EQUAL(rbuf[i], char((100 + i) % 251));
+        }
+        // and up to the end of the file
+        rbuf = f.dma_read<char>(2 * 4096, 2 * 4096).get0();
+        BOOST_REQUIRE_EQUAL(rbuf.size(), 4096u);
+        BOOST_REQUIRE_EQUAL(rbuf[0], char((2 * 4096) % 251));
+        f.close().get();
+        remove_file(name).get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_shared_file) {
+    return seastar::async([] {
+        static constexpr size_t size = 3 * 4096;
+        auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto wbuf = allocate_dma_buffer<char>(4096, size);
+        for (size_t i = 0; i < size; ++i) {
+            wbuf.get_write()[i] = char(i % 251);
+        }
+        f.dma_write(0, wbuf.get(), size).get();
+        f.close().get();
+
+        auto sf = open_shared_file_dma("testfile.tmp", open_flags::ro).get0();
+        // checked here, as Boost.Test is not thread safe
+        std::vector<int> ok(smp::count);
+        smp::invoke_on_all([sf = sf.get(), &ok] {
+            auto offset = engine().cpu_id() % 2 * 4096;
+            return sf->local().dma_read<char>(offset, 4096).then([sf, offset, &ok] (temporary_buffer<char> buf) {
+                bool good = buf.size() == 4096;
+                for (size_t i = 0; good && i < buf.size(); ++i) {
+                    good = buf[i] == char((offset + i) % 251);
+                }
+                auto in = make_lw_shared(sf->make_input_stream(100, size));
+                return in->read_exactly(size - 100).then([in, good, &ok] (temporary_buffer<char> buf) {
+                    bool same = buf.size() == size - 100;
+                    for (size_t i = 0; same && i < buf.size(); ++i) {
+                        same = buf[i] == char((100 + i) % 251);
+                    }
+                    ok[engine().cpu_id()] = good && same;
+                    return in->close();
+                });
+            });
+        }).get();
+        BOOST_REQUIRE(std::all_of(ok.begin(), ok.end(), [] (int x) { return x; }));
+        sf->close().get();
+    });
+}
@@ -0,0 +1,133 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "core/flat_hash_map.hh"
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+using namespace seastar;
+
+BOOST_AUTO_TEST_CASE(test_insert_find_erase) {
+    flat_hash_map<int, std::string> m;
+    BOOST_REQUIRE(m.empty());
+    BOOST_REQUIRE(m.find(1) == m.end());
+    BOOST_REQUIRE(m.begin() == m.end());
+    BOOST_REQUIRE(m.insert({1, "one"}).second);
+    BOOST_REQUIRE(!m.insert({1, "uno"}).second);
+    m[2] = "two";
+    BOOST_REQUIRE_EQUAL(m.size(), 2u);
+    BOOST_REQUIRE_EQUAL(m.find(1)->second, "one");
+    BOOST_REQUIRE_EQUAL(m[2], "two");
+    BOOST_REQUIRE_EQUAL(m.count(3), 0u);
+    BOOST_REQUIRE_EQUAL(m.erase(1), 1u);
+    BOOST_REQUIRE_EQUAL(m.erase(1), 0u);
+    BOOST_REQUIRE_EQUAL(m.size(), 1u);
+    BOOST_REQUIRE(m.begin()->first == 2);
+    m.clear();
+    BOOST_REQUIRE(m.empty());
+    BOOST_REQUIRE(m.find(2) == m.end());
+}
+
+BOOST_AUTO_TEST_CASE(test_against_unordered_map) {
+    flat_hash_map<uint32_t, std::unique_ptr<uint32_t>> m;
+    std::unordered_map<uint32_t, uint32_t> ref;
+    std::default_random_engine rnd(0);
+    // a narrow key range, so that erasures and reinsertions of the same
+    // keys leave deleted slots to reuse and to clean up
+    std::uniform_int_distribution<uint32_t> key(0, 3000);
+    for (unsigned i = 0; i < 200000; ++i) {
+        auto k = key(rnd);
+        switch (rnd() % 3) {
+        case 0:
+        case 1:
+            BOOST_REQUIRE_EQUAL(m.try_emplace(k, std::make_unique<uint32_t>(i)).second, ref.emplace(k, i).second);
+            break;
+        case 2:
+            BOOST_REQUIRE_EQUAL(m.erase(k), ref.erase(k));
+            break;
+        }
+        BOOST_REQUIRE_EQUAL(m.size(), ref.size());
+        auto it = m.find(k);
+        auto rit = ref.find(k);
+        BOOST_REQUIRE_EQUAL(it == m.end(), rit == ref.end());
+        if (rit != ref.end()) {
+            BOOST_REQUIRE_EQUAL(*it->second, rit->second);
+        }
+    }
+    size_t n = 0;
+    for (auto&& kv : m) {
+        BOOST_REQUIRE_EQUAL(*kv.second, ref.at(kv.first));
+        ++n;
+    }
+    BOOST_REQUIRE_EQUAL(n, ref.size());
+    // the table stays at most seven eighths full, at least half of it live
+    BOOST_REQUIRE(m.capacity() * 7 / 8 >= m.size());
+}
+
+BOOST_AUTO_TEST_CASE(test_erase_while_iterating) {
+    flat_hash_map<int, int> m;
+    for (int i = 0; i < 1000; ++i) {
+        m[i] = i;
+    }
+    for (auto it = m.begin(); it != m.end();) {
+        if (it->first % 2) {
+            it = m.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    BOOST_REQUIRE_EQUAL(m.size(), 500u);
+    for (int i = 0; i < 1000; ++i) {
+        BOOST_REQUIRE_EQUAL(m.count(i), i % 2 ? 0u : 1u);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_reserve_and_move) {
+    flat_hash_map<std::string, int> m;
+    m.reserve(100);
+    auto capacity = m.capacity();
+    for (int i = 0; i < 100; ++i) {
+        m[std::to_string(i)] = i;
+    }
+    BOOST_REQUIRE_EQUAL(m.capacity(), capacity);
+    auto m2 = std::move(m);
+    BOOST_REQUIRE(m.empty());
+    BOOST_REQUIRE(m.find("7") == m.end());
+    BOOST_REQUIRE_EQUAL(m2.size(), 100u);
+    BOOST_REQUIRE_EQUAL(m2["7"], 7);
+}
+
+BOOST_AUTO_TEST_CASE(test_set) {
+    flat_hash_set<std::string> s;
+    BOOST_REQUIRE(s.insert("a").second);
+    BOOST_REQUIRE(!s.insert("a").second);
+    BOOST_REQUIRE(s.insert("b").second);
+    BOOST_REQUIRE_EQUAL(s.size(), 2u);
+    BOOST_REQUIRE_EQUAL(s.count("a"), 1u);
+    BOOST_REQUIRE_EQUAL(*s.find("b"), "b");
+    s.erase("a");
+    BOOST_REQUIRE_EQUAL(s.count("a"), 0u);
+}
@@ -425,3 +425,163 @@ SEASTAR_TEST_CASE(test_fstream_slow_start) {
         read_while_file_at_full_speed(make_fstream());
     });
 }
+
+SEASTAR_TEST_CASE(test_fstream_history_shared_by_file) {
+    return seastar::async([] {
+        static constexpr size_t file_size = 16 * 1024 * 1024;
+        static constexpr size_t buffer_size = 256 * 1024;
+
+        auto mock_file = make_shared<mock_read_only_file>(file_size);
+        mock_file->set_allowed_read_requests(std::numeric_limits<size_t>::max());
+
+        file_input_stream_options options{};
+        options.buffer_size = buffer_size;
+        options.read_ahead = 1;
+        options.share_history_by_file = true;
+
+        auto make_fstream = [&] {
+            return make_file_input_stream(file(mock_file), 0, file_size, options);
+        };
+        auto read_whole = [] (input_stream<char>& in) {
+            while (!in.read().get0().empty()) {
+            }
+        };
+        size_t max_read = 0;
+        mock_file->set_read_size_verifier([&] (size_t length) {
+            max_read = std::max(max_read, length);
+        });
+
+        {
+            BOOST_TEST_MESSAGE("First stream starts slow, and reaches full buffer size");
+            auto first = make_fstream();
+            read_whole(first);
+            BOOST_REQUIRE_EQUAL(max_read, buffer_size);
+
+            BOOST_TEST_MESSAGE("A concurrent stream of the same file starts at full speed");
+            mock_file->set_expected_read_size(buffer_size);
+            auto second = make_fstream();
+            auto buf = second.read().get0();
+            BOOST_REQUIRE_EQUAL(buf.size(), buffer_size);
+            second.close().get();
+            first.close().get();
+        }
+
+        BOOST_TEST_MESSAGE("Once they are closed, the history goes away");
+        size_t min_read = buffer_size;
+        mock_file->set_read_size_verifier([&] (size_t length) {
+            min_read = std::min(min_read, length);
+        });
+        auto third = make_fstream();
+        third.read().get();
+        BOOST_REQUIRE_LT(min_read, buffer_size);
+        third.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_fstream_coalesced_writes) {
+    return seastar::async([] {
+        static constexpr size_t size = 1024 * 1024 + 100;
+        auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        file_output_stream_options options;
+        options.buffer_size = 8192;
+        options.coalesce_size = 128 * 1024;
+        options.write_behind = 4;
+        auto out = make_file_output_stream(f, options);
+        std::vector<char> data(size);
+        std::iota(data.begin(), data.end(), 0);
+        // odd-sized writes, so that the stream's buffers are split
+        for (size_t pos = 0; pos < size; pos += 3000) {
+            out.write(data.data() + pos, std::min<size_t>(3000, size - pos)).get();
+        }
+        out.close().get();
+
+        f = open_file_dma("testfile.tmp", open_flags::ro).get0();
+        BOOST_REQUIRE_EQUAL(f.size().get0(), size);
+        auto in = make_file_input_stream(f);
+        auto readback = in.read_exactly(size).get0();
+        BOOST_REQUIRE(std::equal(readback.begin(), readback.end(), data.begin()));
+        in.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_mmap_input_stream) {
+    return seastar::async([] {
+        static constexpr size_t size = 300 * 1024 + 17;
+        auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto out = make_file_output_stream(f);
+        std::vector<char> data(size);
+        std::iota(data.begin(), data.end(), 0);
+        out.write(data.data(), data.size()).get();
+        out.close().get();
+
+        f = open_file_dma("testfile.tmp", open_flags::ro).get0();
+        mmap_input_stream_options options;
+        options.buffer_size = 64 * 1024;
+        auto in = make_mmap_input_stream(f, options);
+        size_t pos = 0;
+        temporary_buffer<char> held;
+        while (auto buf = in.read().get0()) {
+            BOOST_REQUIRE_LE(buf.size(), options.buffer_size);
+            BOOST_REQUIRE(std::equal(buf.begin(), buf.end(), data.begin() + pos));
+            pos += buf.size();
+            held = std::move(buf);
+        }
+        BOOST_REQUIRE_EQUAL(pos, size);
+        in.close().get();
+        f.close().get();
+        // the mapping outlives the stream and the file
+        BOOST_REQUIRE(std::equal(held.begin(), held.end(), data.end() - held.size()));
+
+        f = open_file_dma("testfile.tmp", open_flags::ro).get0();
+        in = make_mmap_input_stream(f, options);
+        in.skip(size - 100).get();
+        auto tail = in.read_exactly(100).get0();
+        BOOST_REQUIRE(std::equal(tail.begin(), tail.end(), data.end() - 100));
+        in.close().get();
+        f.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_write_file_to_socket) {
+    return seastar::async([] {
+        static constexpr size_t size = 3 * 1024 * 1024 + 100;
+        auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto wbuf = allocate_aligned_buffer<char>(align_up(size, size_t(4096)), 4096);
+        for (size_t i = 0; i < size; ++i) {
+            wbuf.get()[i] = char(i % 251);
+        }
+        f.dma_write(0, wbuf.get(), align_up(size, size_t(4096))).get();
+        f.truncate(size).get();
+
+        listen_options opts;
+        opts.reuse_address = true;
+        auto addr = make_ipv4_address({0x7f000001, 4713});
+        auto server = engine().listen(addr, opts);
+        auto accepted = server.accept();
+        auto client = engine().connect(addr).get0();
+        auto conn = std::get<0>(accepted.get());
+
+        // unaligned, and after buffered data
+        static constexpr uint64_t offset = 1000;
+        auto out = conn.output();
+        auto sent = out.write("header").then([&out, &f] {
+            return out.write_file(f, offset, size - offset);
+        }).then([&out] {
+            return out.close();
+        });
+        auto in = client.input();
+        std::string received;
+        while (true) {
+            auto buf = in.read().get0();
+            if (buf.empty()) {
+                break;
+            }
+            received.append(buf.get(), buf.size());
+        }
+        sent.get();
+        BOOST_REQUIRE_EQUAL(received.size(), 6 + size - offset);
+        BOOST_REQUIRE_EQUAL(received.substr(0, 6), "header");
+        BOOST_REQUIRE(std::equal(received.begin() + 6, received.end(), wbuf.get() + offset));
+        f.close().get();
+    });
+}
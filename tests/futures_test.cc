@@ -906,3 +906,24 @@ SEASTAR_TEST_CASE(test_when_all_succeed_vector) {
         BOOST_REQUIRE(ret);
     });
 }
+
+#ifndef DEBUG
+SEASTAR_TEST_CASE(test_ready_value_continuations_run_inline_when_preempted) {
+    auto saved = g_need_preempt;
+    g_need_preempt = true;
+    auto f = make_ready_future<int>(1).then([] (int x) {
+        return x + 1;
+    }).then_wrapped([] (future<int> f) {
+        return f.get0() * 2;
+    });
+    // a continuation returning a future still defers
+    auto g = make_ready_future<>().then([] {
+        return make_ready_future<>();
+    });
+    g_need_preempt = saved;
+    BOOST_REQUIRE(f.available());
+    BOOST_REQUIRE_EQUAL(f.get0(), 4);
+    BOOST_REQUIRE(!g.available());
+    return g;
+}
+#endif
@@ -0,0 +1,190 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+
+#define BOOST_TEST_MODULE gro
+
+#include <boost/test/included/unit_test.hpp>
+#include <vector>
+#include "net/gro.hh"
+#include "net/const.hh"
+#include "net/ip_checksum.hh"
+#include "core/byteorder.hh"
+
+using namespace seastar;
+using namespace net;
+
+static constexpr size_t ip_hdr_len = 20;
+static constexpr size_t tcp_hdr_len = 32; // with the timestamps option
+static constexpr size_t hdr_len = eth_hdr_len + ip_hdr_len + tcp_hdr_len;
+static constexpr uint16_t mss = 1448;
+static constexpr uint8_t ack = 0x10;
+static constexpr uint8_t psh = 0x08;
+static constexpr uint8_t syn = 0x02;
+
+struct segment {
+    uint32_t seq;
+    size_t len = mss;
+    uint8_t flags = ack;
+    uint16_t src_port = 10000;
+    uint32_t tsval = 1;
+    uint16_t window = 1000;
+};
+
+static packet make_packet(const segment& s) {
+    std::vector<char> v(hdr_len + s.len);
+    auto iph = v.data() + eth_hdr_len;
+    write_be<uint16_t>(v.data() + 12, uint16_t(eth_protocol_num::ipv4));
+    iph[0] = 0x45;
+    write_be<uint16_t>(iph + 2, ip_hdr_len + tcp_hdr_len + s.len);
+    iph[8] = 64;
+    iph[9] = uint8_t(ip_protocol_num::tcp);
+    write_be<uint32_t>(iph + 12, 0x0a000001);
+    write_be<uint32_t>(iph + 16, 0x0a000002);
+    auto csum = ip_checksum(iph, ip_hdr_len);
+    std::copy_n(reinterpret_cast<const char*>(&csum), 2, iph + 10);
+    auto th = iph + ip_hdr_len;
+    write_be<uint16_t>(th + 0, s.src_port);
+    write_be<uint16_t>(th + 2, 80);
+    write_be<uint32_t>(th + 4, s.seq);
+    write_be<uint32_t>(th + 8, 12345);
+    th[12] = (tcp_hdr_len / 4) << 4;
+    th[13] = s.flags;
+    write_be<uint16_t>(th + 14, s.window);
+    th[20] = 1;
+    th[21] = 1;
+    th[22] = 8;
+    th[23] = 10;
+    write_be<uint32_t>(th + 24, s.tsval);
+    write_be<uint32_t>(th + 28, 2);
+    for (size_t i = 0; i < s.len; ++i) {
+        v[hdr_len + i] = char((s.seq + i) % 251);
+    }
+    return packet(v.data(), v.size());
+}
+
+static std::vector<char> linear(const packet& p) {
+    std::vector<char> v;
+    for (auto&& f : p.fragments()) {
+        v.insert(v.end(), f.base, f.base + f.size);
+    }
+    return v;
+}
+
+static uint32_t seq_of(const packet& p) {
+    return read_be<uint32_t>(linear(p).data() + eth_hdr_len + ip_hdr_len + 4);
+}
+
+// Checks the headers of a packet merged from segments starting at seq
+static void check_merged(const packet& p, uint32_t seq, size_t len) {
+    auto v = linear(p);
+    BOOST_REQUIRE_EQUAL(v.size(), hdr_len + len);
+    auto iph = v.data() + eth_hdr_len;
+    BOOST_REQUIRE_EQUAL(read_be<uint16_t>(iph + 2), ip_hdr_len + tcp_hdr_len + len);
+    BOOST_REQUIRE_EQUAL(ip_checksum(iph, ip_hdr_len), 0);
+    BOOST_REQUIRE_EQUAL(read_be<uint32_t>(iph + ip_hdr_len + 4), seq);
+    for (size_t i = 0; i < len; ++i) {
+        BOOST_REQUIRE_EQUAL(v[hdr_len + i], char((seq + i) % 251));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_in_order_segments_are_merged) {
+    tcp_gro gro;
+    circular_buffer<packet> out;
+    for (unsigned i = 0; i < 4; ++i) {
+        segment s{i * mss};
+        s.window = 1000 + i;
+        gro.add(make_packet(s), out);
+    }
+    BOOST_REQUIRE(out.empty());
+    gro.flush(out);
+    BOOST_REQUIRE_EQUAL(out.size(), 1u);
+    check_merged(out.front(), 0, 4 * mss);
+    BOOST_REQUIRE_EQUAL(out.front().nr_frags(), 4u);
+    // the last segment's window
+    BOOST_REQUIRE_EQUAL(read_be<uint16_t>(linear(out.front()).data() + eth_hdr_len + ip_hdr_len + 14), 1003);
+    BOOST_REQUIRE_EQUAL(gro.merged(), 3u);
+}
+
+BOOST_AUTO_TEST_CASE(test_flows_are_kept_apart) {
+    tcp_gro gro;
+    circular_buffer<packet> out;
+    segment a0{0};
+    segment b0{0};
+    b0.src_port = 10001;
+    segment a1{mss};
+    segment a3{3 * mss}; // a gap
+    gro.add(make_packet(a0), out);
+    gro.add(make_packet(b0), out);
+    gro.add(make_packet(a1), out);
+    gro.add(make_packet(a3), out);
+    gro.flush(out);
+    BOOST_REQUIRE_EQUAL(out.size(), 3u);
+    check_merged(out[0], 0, 2 * mss);
+    check_merged(out[1], 0, mss);
+    check_merged(out[2], 3 * mss, mss);
+    BOOST_REQUIRE_EQUAL(gro.merged(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(test_runs_end) {
+    tcp_gro gro;
+    circular_buffer<packet> out;
+    gro.add(make_packet(segment{0}), out);
+    // a pushed segment is merged, and ends the run
+    segment s1{mss};
+    s1.flags = ack | psh;
+    gro.add(make_packet(s1), out);
+    BOOST_REQUIRE_EQUAL(out.size(), 1u);
+    check_merged(out[0], 0, 2 * mss);
+    BOOST_REQUIRE(linear(out[0])[eth_hdr_len + ip_hdr_len + 13] & psh);
+
+    // segments with other options are not
+    gro.add(make_packet(segment{2 * mss}), out);
+    segment s3{3 * mss};
+    s3.tsval = 2;
+    gro.add(make_packet(s3), out);
+    // nor is a SYN, or a pure ACK
+    segment s4{0};
+    s4.flags = syn;
+    s4.src_port = 10001;
+    gro.add(make_packet(s4), out);
+    segment s5{4 * mss};
+    s5.len = 0;
+    gro.add(make_packet(s5), out);
+    gro.flush(out);
+    BOOST_REQUIRE_EQUAL(out.size(), 5u);
+    BOOST_REQUIRE_EQUAL(seq_of(out[1]), 2 * mss);
+    BOOST_REQUIRE_EQUAL(seq_of(out[2]), 0u);
+    BOOST_REQUIRE_EQUAL(seq_of(out[3]), 3 * mss);
+    BOOST_REQUIRE_EQUAL(seq_of(out[4]), 4 * mss);
+    BOOST_REQUIRE_EQUAL(gro.merged(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(test_non_tcp_passes_through) {
+    tcp_gro gro;
+    circular_buffer<packet> out;
+    auto p = make_packet(segment{0});
+    auto v = linear(p);
+    v[eth_hdr_len + 9] = char(ip_protocol_num::udp);
+    gro.add(packet(v.data(), v.size()), out);
+    BOOST_REQUIRE_EQUAL(out.size(), 1u);
+}
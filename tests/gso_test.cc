@@ -0,0 +1,177 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+
+#define BOOST_TEST_MODULE gso
+
+#include <boost/test/included/unit_test.hpp>
+#include <vector>
+#include "net/gso.hh"
+#include "net/ip_checksum.hh"
+#include "core/byteorder.hh"
+
+using namespace seastar;
+using namespace net;
+
+static constexpr size_t ip_hdr_len = 20;
+static constexpr size_t tcp_hdr_len = 32; // with the timestamps option
+static constexpr size_t hdr_len = eth_hdr_len + ip_hdr_len + tcp_hdr_len;
+static constexpr uint16_t mss = 1448;
+static constexpr uint32_t first_seq = 0xffffff00; // wraps
+static constexpr uint8_t ack_psh_fin = 0x10 | 0x08 | 0x01;
+
+static std::vector<char> make_payload(size_t len) {
+    std::vector<char> v(len);
+    for (size_t i = 0; i < len; ++i) {
+        v[i] = char(i % 251);
+    }
+    return v;
+}
+
+// A super-segment as the TCP and IP layers pass it to the interface, its
+// payload in two fragments
+static packet make_super_segment(const std::vector<char>& payload) {
+    packet p(payload.data(), 1000);
+    p.append(packet(payload.data() + 1000, payload.size() - 1000));
+    auto h = p.prepend_uninitialized_header(hdr_len);
+    std::fill_n(h, hdr_len, 0);
+    auto iph = h + eth_hdr_len;
+    iph[0] = 0x45;
+    write_be<uint16_t>(iph + 2, ip_hdr_len + tcp_hdr_len + payload.size());
+    write_be<uint16_t>(iph + 4, 7);
+    iph[8] = 64;
+    iph[9] = uint8_t(ip_protocol_num::tcp);
+    write_be<uint32_t>(iph + 12, 0x0a000001);
+    write_be<uint32_t>(iph + 16, 0x0a000002);
+    auto th = iph + ip_hdr_len;
+    write_be<uint16_t>(th + 0, 10000);
+    write_be<uint16_t>(th + 2, 80);
+    write_be<uint32_t>(th + 4, first_seq);
+    write_be<uint32_t>(th + 8, 12345);
+    th[12] = (tcp_hdr_len / 4) << 4;
+    th[13] = ack_psh_fin;
+    write_be<uint16_t>(th + 14, 29200);
+    // NOP, NOP, timestamps
+    th[20] = 1;
+    th[21] = 1;
+    th[22] = 8;
+    th[23] = 10;
+    write_be<uint32_t>(th + 24, 1);
+    write_be<uint32_t>(th + 28, 2);
+    offload_info oi;
+    oi.protocol = ip_protocol_num::tcp;
+    oi.ip_hdr_len = ip_hdr_len;
+    oi.tcp_hdr_len = tcp_hdr_len;
+    oi.tso_seg_size = mss;
+    p.set_offload_info(oi);
+    return p;
+}
+
+static std::vector<char> linear(const packet& p) {
+    std::vector<char> v;
+    for (auto&& f : p.fragments()) {
+        v.insert(v.end(), f.base, f.base + f.size);
+    }
+    return v;
+}
+
+// Checks the headers and payloads of the segments, but for the TCP checksum
+static void check_segments(circular_buffer<packet>& segs, const std::vector<char>& payload) {
+    BOOST_REQUIRE_EQUAL(segs.size(), (payload.size() + mss - 1) / mss);
+    size_t off = 0;
+    for (size_t i = 0; i < segs.size(); ++i) {
+        auto& seg = segs[i];
+        auto len = std::min<size_t>(mss, payload.size() - off);
+        bool last = i == segs.size() - 1;
+        BOOST_REQUIRE_EQUAL(seg.len(), hdr_len + len);
+        BOOST_REQUIRE_EQUAL(seg.offload_info().tso_seg_size, 0);
+        auto v = linear(seg);
+        auto iph = v.data() + eth_hdr_len;
+        auto th = iph + ip_hdr_len;
+        BOOST_REQUIRE_EQUAL(read_be<uint16_t>(iph + 2), ip_hdr_len + tcp_hdr_len + len);
+        BOOST_REQUIRE_EQUAL(read_be<uint16_t>(iph + 4), 7 + i);
+        BOOST_REQUIRE_EQUAL(read_be<uint32_t>(th + 4), uint32_t(first_seq + off));
+        BOOST_REQUIRE_EQUAL(int(uint8_t(th[13])), last ? ack_psh_fin : 0x10);
+        BOOST_REQUIRE_EQUAL(read_be<uint32_t>(th + 24), 1u);
+        BOOST_REQUIRE(std::equal(v.begin() + hdr_len, v.end(), payload.begin() + off));
+        off += len;
+    }
+}
+
+static checksummer pseudo_header(const std::vector<char>& seg) {
+    checksummer csum;
+    csum.sum(seg.data() + eth_hdr_len + 12, 8);
+    csum.sum_many(uint8_t(0), uint8_t(ip_protocol_num::tcp), uint16_t(seg.size() - eth_hdr_len - ip_hdr_len));
+    return csum;
+}
+
+BOOST_AUTO_TEST_CASE(test_software_checksums) {
+    hw_features hw;
+    hw.tx_gso = true;
+    // an odd-sized last segment
+    auto payload = make_payload(5 * mss + 333);
+    circular_buffer<packet> segs;
+    tcp_gso_segment(make_super_segment(payload), hw, segs);
+    check_segments(segs, payload);
+    for (auto&& seg : segs) {
+        auto v = linear(seg);
+        BOOST_REQUIRE_EQUAL(ip_checksum(v.data() + eth_hdr_len, ip_hdr_len), 0);
+        auto csum = pseudo_header(v);
+        csum.sum(v.data() + eth_hdr_len + ip_hdr_len, v.size() - eth_hdr_len - ip_hdr_len);
+        BOOST_REQUIRE_EQUAL(csum.get(), 0);
+        BOOST_REQUIRE(!seg.offload_info().needs_csum);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_offloaded_checksums) {
+    hw_features hw;
+    hw.tx_gso = true;
+    hw.tx_csum_ip_offload = true;
+    hw.tx_csum_l4_offload = true;
+    auto payload = make_payload(3 * mss);
+    circular_buffer<packet> segs;
+    tcp_gso_segment(make_super_segment(payload), hw, segs);
+    check_segments(segs, payload);
+    for (auto&& seg : segs) {
+        auto v = linear(seg);
+        // left to the device: the IP checksum is zero, the TCP one that
+        // of the pseudo header
+        BOOST_REQUIRE_EQUAL(read_be<uint16_t>(v.data() + eth_hdr_len + 10), 0);
+        uint16_t expected = ~pseudo_header(v).get();
+        uint16_t actual;
+        std::copy_n(v.data() + eth_hdr_len + ip_hdr_len + 16, 2, reinterpret_cast<char*>(&actual));
+        BOOST_REQUIRE_EQUAL(actual, expected);
+        BOOST_REQUIRE(seg.offload_info().needs_csum);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_unsegmented_packets_pass_through) {
+    hw_features hw;
+    hw.tx_gso = true;
+    auto payload = make_payload(3000);
+    auto p = make_super_segment(payload);
+    p.offload_info_ref().tso_seg_size = 0;
+    circular_buffer<packet> segs;
+    tcp_gso_segment(std::move(p), hw, segs);
+    BOOST_REQUIRE_EQUAL(segs.size(), 1u);
+    BOOST_REQUIRE_EQUAL(segs.front().len(), hdr_len + payload.size());
+}
@@ -0,0 +1,123 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "core/hdr_histogram.hh"
+
+using namespace seastar;
+
+BOOST_AUTO_TEST_CASE(test_small_values_are_exact) {
+    hdr_histogram h(3, 1000);
+    for (uint64_t v = 0; v < 8; ++v) {
+        h.record(v);
+    }
+    BOOST_REQUIRE_EQUAL(h.count(), 8u);
+    BOOST_REQUIRE_EQUAL(h.sum(), 28u);
+    BOOST_REQUIRE_EQUAL(h.min(), 0u);
+    BOOST_REQUIRE_EQUAL(h.max(), 7u);
+    BOOST_REQUIRE_EQUAL(h.value_at_quantile(0), 0u);
+    BOOST_REQUIRE_EQUAL(h.percentile(50), 3u);
+    BOOST_REQUIRE_EQUAL(h.value_at_quantile(1), 7u);
+}
+
+BOOST_AUTO_TEST_CASE(test_percentiles_are_within_precision) {
+    std::mt19937 rng(7);
+    std::lognormal_distribution<double> dist(10, 2);
+    hdr_histogram h(5, uint64_t(1) << 40);
+    std::vector<uint64_t> values;
+    for (int i = 0; i < 100000; ++i) {
+        auto v = uint64_t(dist(rng));
+        values.push_back(v);
+        h.record(v);
+    }
+    std::sort(values.begin(), values.end());
+    for (double q : {0.1, 0.5, 0.9, 0.99, 0.999}) {
+        auto exact = values[size_t(q * values.size()) - 1];
+        auto got = h.value_at_quantile(q);
+        BOOST_REQUIRE_GE(got, exact);
+        BOOST_REQUIRE_LE(got, exact + exact / 32 + 1);
+    }
+    BOOST_REQUIRE_EQUAL(h.value_at_quantile(1), values.back());
+}
+
+BOOST_AUTO_TEST_CASE(test_large_values_are_clamped) {
+    hdr_histogram h(2, 100);
+    h.record(1000);
+    h.record(5);
+    BOOST_REQUIRE_EQUAL(h.count(), 2u);
+    BOOST_REQUIRE_EQUAL(h.max(), 1000u);
+    BOOST_REQUIRE_EQUAL(h.value_at_quantile(1), 1000u);
+    BOOST_REQUIRE_EQUAL(h.sum(), 1005u);
+}
+
+BOOST_AUTO_TEST_CASE(test_merge) {
+    hdr_histogram a, b;
+    for (uint64_t v = 1; v <= 1000; ++v) {
+        (v % 2 ? a : b).record(v);
+    }
+    a += b;
+    BOOST_REQUIRE_EQUAL(a.count(), 1000u);
+    BOOST_REQUIRE_EQUAL(a.min(), 1u);
+    BOOST_REQUIRE_EQUAL(a.max(), 1000u);
+    auto median = a.percentile(50);
+    BOOST_REQUIRE(median >= 500 && median <= 500 + 500 / 32);
+    hdr_histogram c(3);
+    BOOST_REQUIRE_THROW(a += c, std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(test_to_metrics) {
+    hdr_histogram h(4, 1000);
+    for (uint64_t v = 0; v < 1000; ++v) {
+        h.record(v);
+    }
+    auto m = h.to_metrics();
+    BOOST_REQUIRE_EQUAL(m.sample_count, 1000u);
+    // [0, 15], then one bucket per power of two
+    BOOST_REQUIRE_EQUAL(m.buckets[0].upper_bound, 15);
+    BOOST_REQUIRE_EQUAL(m.buckets[0].count, 16u);
+    BOOST_REQUIRE_EQUAL(m.buckets[1].upper_bound, 31);
+    BOOST_REQUIRE_EQUAL(m.buckets[1].count, 16u);
+    BOOST_REQUIRE_EQUAL(m.buckets[2].upper_bound, 63);
+    uint64_t total = 0;
+    for (auto&& b : m.buckets) {
+        total += b.count;
+    }
+    BOOST_REQUIRE_EQUAL(total, 1000u);
+    BOOST_REQUIRE_EQUAL(m.buckets.back().upper_bound, 1000);
+
+    auto fine = h.to_metrics(2);
+    BOOST_REQUIRE_EQUAL(fine.buckets[0].upper_bound, 3);
+    BOOST_REQUIRE_GT(fine.buckets.size(), m.buckets.size());
+
+    // histograms configured alike export the same buckets, which are
+    // added up when shards are aggregated
+    hdr_histogram other(4, 1000);
+    other.record(20);
+    auto sum = m + other.to_metrics();
+    BOOST_REQUIRE_EQUAL(sum.sample_count, 1001u);
+    BOOST_REQUIRE_EQUAL(sum.buckets[1].count, 17u);
+}
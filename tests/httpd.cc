@@ -4,8 +4,14 @@
 
 #include "http/httpd.hh"
 #include "http/handlers.hh"
+#include "http/function_handlers.hh"
 #include "http/matcher.hh"
 #include "http/matchrules.hh"
+#include "http/route_tree.hh"
+#include "http/client.hh"
+#include "http/file_cache.hh"
+#include "http/api_docs.hh"
+#include "http/hpack.hh"
 #include "json/formatter.hh"
 #include "http/routes.hh"
 #include "http/exception.hh"
@@ -14,6 +20,12 @@
 #include "tests/test-utils.hh"
 #include "loopback_socket.hh"
 #include <boost/algorithm/string.hpp>
+#include <boost/range/irange.hpp>
+#include <zlib.h>
+#include <fstream>
+#include <map>
+#include <set>
+#include <unistd.h>
 #include "core/thread.hh"
 #include "util/noncopyable_function.hh"
 
@@ -34,6 +46,16 @@ SEASTAR_TEST_CASE(test_reply)
     reply r;
     r.set_content_type("txt");
     BOOST_REQUIRE_EQUAL(r._headers["Content-Type"], sstring("text/plain"));
+    r.set_status(reply::status_type::not_found, "missing").set_version("1.1").done();
+    auto buckets = r._headers.bucket_count();
+    r.reset();
+    BOOST_REQUIRE(r._status == reply::status_type::ok);
+    BOOST_REQUIRE(r._headers.empty());
+    BOOST_REQUIRE_EQUAL(r._headers.bucket_count(), buckets);
+    BOOST_REQUIRE(r._content.empty() && r._version.empty() && r._response_line.empty());
+    r.set_prepared(make_lw_shared<const reply::prepared>(reply()));
+    r.reset();
+    BOOST_REQUIRE(!r._prepared);
     return make_ready_future<>();
 }
 
@@ -114,6 +136,49 @@ SEASTAR_TEST_CASE(test_decode_url) {
     return make_ready_future<>();
 }
 
+SEASTAR_TEST_CASE(test_route_tree)
+{
+    handl h1, h2, h3, h4, h5;
+    route_tree tree;
+    tree.add("/hello", {{"param", false}}, &h1, 0);
+    tree.add("/hello/world", {}, &h2, 1);
+    tree.add("/hello/{a}/x", {{"b", false}}, &h3, 2);
+    tree.add("/file", {{"path", true}}, &h4, 3);
+    // added after the first route, which matches the same urls
+    tree.add("/hello", {{"param", false}}, &h5, 4);
+
+    parameters params;
+    auto m = tree.find("/hello/val1");
+    BOOST_REQUIRE(m.handler() == &h1);
+    m.set_params(params);
+    BOOST_REQUIRE_EQUAL(params["param"], "val1");
+
+    // matches the first route too, which was added before
+    BOOST_REQUIRE(tree.find("/hello/world").handler() == &h1);
+    BOOST_REQUIRE(tree.find("/hell/val1").handler() == nullptr);
+    BOOST_REQUIRE(tree.find("/hello/val1/val2").handler() == nullptr);
+
+    params.clear();
+    m = tree.find("/hello/v1/x/v2");
+    BOOST_REQUIRE(m.handler() == &h3);
+    m.set_params(params);
+    BOOST_REQUIRE_EQUAL(params["a"], "v1");
+    BOOST_REQUIRE_EQUAL(params["b"], "v2");
+
+    params.clear();
+    m = tree.find("/file/etc/hosts");
+    BOOST_REQUIRE(m.handler() == &h4);
+    BOOST_REQUIRE_EQUAL(m.seq(), 3u);
+    m.set_params(params);
+    BOOST_REQUIRE_EQUAL(params.path("path"), "/etc/hosts");
+    m = tree.find("/file");
+    BOOST_REQUIRE(m.handler() == &h4);
+    BOOST_REQUIRE(tree.find("/files").handler() == nullptr);
+
+    BOOST_REQUIRE_THROW(tree.add("/x", {{"a", true}, {"b", false}}, &h1, 5), std::invalid_argument);
+    return make_ready_future<>();
+}
+
 SEASTAR_TEST_CASE(test_routes) {
     handl* h1 = new handl();
     handl* h2 = new handl();
@@ -423,6 +488,122 @@ class test_client_server {
     }
 };
 
+SEASTAR_TEST_CASE(test_pipelined_requests_are_handled_concurrently) {
+    return seastar::async([] {
+        class test_handler : public handler_base {
+            std::function<future<> ()> _run;
+            sstring _body;
+        public:
+            test_handler(std::function<future<> ()> run, sstring body) : _run(std::move(run)), _body(std::move(body)) {
+            }
+            future<std::unique_ptr<reply>> handle(const sstring& path,
+                    std::unique_ptr<request> req, std::unique_ptr<reply> rep) override {
+                return _run().then([rep = std::move(rep), body = _body] () mutable {
+                    rep->_content = body;
+                    rep->done("txt");
+                    return std::move(rep);
+                });
+            }
+        };
+        loopback_connection_factory lcf;
+        http_server server("test_pipelining");
+        httpd::http_server_tester::listeners(server).emplace_back(lcf.get_server_socket());
+        // the first request is handled only once the second one is
+        semaphore fast_handled(0);
+        server._routes.put(GET, "/slow", new test_handler([&fast_handled] { return fast_handled.wait(); }, "slow-body"));
+        server._routes.put(GET, "/fast", new test_handler([&fast_handled] {
+            fast_handled.signal();
+            return make_ready_future<>();
+        }, "fast-body"));
+        auto accepted = server.do_accepts(0);
+
+        loopback_socket_impl lsi(lcf);
+        auto c_socket = lsi.connect(socket_address(ipv4_addr()), socket_address(ipv4_addr())).get0();
+        auto input = c_socket.input();
+        auto output = c_socket.output();
+        output.write(sstring("GET /slow HTTP/1.1\r\nHost: myhost.org\r\n\r\n"
+                "GET /fast HTTP/1.1\r\nHost: myhost.org\r\n\r\n")).get();
+        output.flush().get();
+        std::string replies;
+        while (replies.find("fast-body") == std::string::npos) {
+            auto buf = input.read().get0();
+            BOOST_REQUIRE(!buf.empty());
+            replies.append(buf.get(), buf.size());
+        }
+        // replies go in request order
+        BOOST_REQUIRE_LT(replies.find("slow-body"), replies.find("fast-body"));
+        output.close().get();
+        input.close().get();
+        server.stop().get();
+        accepted.get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_request_bodies) {
+    return seastar::async([] {
+        loopback_connection_factory lcf;
+        http_server server("test_request_bodies");
+        httpd::http_server_tester::listeners(server).emplace_back(lcf.get_server_socket());
+        server._routes.put(POST, "/buffered", new function_handler([] (const_req req) {
+            return "got:" + req.content;
+        }, "txt"));
+        server._routes.put(POST, "/echo", new stream_handler([] (request& req, output_stream<char> out) {
+            return do_with(std::move(out), [&req] (output_stream<char>& out) {
+                return repeat([&req, &out] {
+                    return req.content_stream.read().then([&out] (temporary_buffer<char> buf) {
+                        if (buf.empty()) {
+                            return make_ready_future<stop_iteration>(stop_iteration::yes);
+                        }
+                        return out.write(buf.get(), buf.size()).then([] {
+                            return stop_iteration::no;
+                        });
+                    });
+                }).then([&out] {
+                    return out.close();
+                });
+            });
+        }, "txt"));
+        // does not read the body, which the connection then skips
+        server._routes.put(POST, "/ignore", new stream_handler([] (request& req, output_stream<char> out) {
+            return do_with(std::move(out), [] (output_stream<char>& out) {
+                return out.write("ignored").then([&out] {
+                    return out.close();
+                });
+            });
+        }, "txt"));
+        auto accepted = server.do_accepts(0);
+
+        loopback_socket_impl lsi(lcf);
+        auto c_socket = lsi.connect(socket_address(ipv4_addr()), socket_address(ipv4_addr())).get0();
+        auto input = c_socket.input();
+        auto output = c_socket.output();
+        output.write(sstring("POST /buffered HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+                "POST /echo HTTP/1.1\r\nContent-Length: 10\r\n\r\n0123456789"
+                "POST /ignore HTTP/1.1\r\nContent-Length: 4\r\n\r\nzzzz"
+                "POST /buffered HTTP/1.1\r\nContent-Length: 3\r\n\r\nxyz")).get();
+        output.flush().get();
+        std::string replies;
+        while (replies.find("got:xyz") == std::string::npos) {
+            auto buf = input.read().get0();
+            BOOST_REQUIRE(!buf.empty());
+            replies.append(buf.get(), buf.size());
+        }
+        auto abc = replies.find("got:abc");
+        auto echoed = replies.find("0123456789");
+        auto ignored = replies.find("ignored");
+        BOOST_REQUIRE(abc != std::string::npos);
+        BOOST_REQUIRE(echoed != std::string::npos);
+        BOOST_REQUIRE(ignored != std::string::npos);
+        BOOST_REQUIRE_LT(abc, echoed);
+        BOOST_REQUIRE_LT(echoed, ignored);
+        BOOST_REQUIRE(replies.find("zzzz") == std::string::npos);
+        output.close().get();
+        input.close().get();
+        server.stop().get();
+        accepted.get();
+    });
+}
+
 SEASTAR_TEST_CASE(test_message_with_error_non_empty_body) {
     std::vector<std::tuple<bool, size_t>> tests = {
         std::make_tuple(true, 100),
@@ -450,3 +631,672 @@ SEASTAR_TEST_CASE(test_http_client_server_full) {
     return test_client_server::run(tests);
 }
 
+
+SEASTAR_TEST_CASE(test_native_client) {
+    return seastar::async([] {
+        loopback_connection_factory lcf;
+        http_server server("test_native_client");
+        httpd::http_server_tester::listeners(server).emplace_back(lcf.get_server_socket());
+        server._routes.put(GET, "/hello", new function_handler([] (const_req req) {
+            return "hello";
+        }, "txt"));
+        // replies with a chunked body
+        server._routes.put(POST, "/echo", new stream_handler([] (request& req, output_stream<char> out) {
+            return do_with(std::move(out), [&req] (output_stream<char>& out) {
+                return repeat([&req, &out] {
+                    return req.content_stream.read().then([&out] (temporary_buffer<char> buf) {
+                        if (buf.empty()) {
+                            return make_ready_future<stop_iteration>(stop_iteration::yes);
+                        }
+                        return out.write(buf.get(), buf.size()).then([] {
+                            return stop_iteration::no;
+                        });
+                    });
+                }).then([&out] {
+                    return out.close();
+                });
+            });
+        }, "txt"));
+        semaphore release(0);
+        server._routes.put(GET, "/stuck", new function_handler([&release] (std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+            return release.wait().then([rep = std::move(rep)] () mutable {
+                return std::move(rep);
+            });
+        }, "txt"));
+        auto accepted = server.do_accepts(0);
+        auto loopback_connect = [&lcf] (const sstring&, uint16_t, bool) {
+            return do_with(loopback_socket_impl(lcf), [] (loopback_socket_impl& lsi) {
+                return lsi.connect(socket_address(ipv4_addr()), socket_address(ipv4_addr()));
+            });
+        };
+
+        http::client_options opts;
+        opts.connect = loopback_connect;
+        http::client c(opts);
+        http::request req;
+        req.url = "http://localhost/hello";
+        auto rsp = c.make_request(std::move(req)).get0();
+        BOOST_REQUIRE_EQUAL(rsp.status, 200);
+        BOOST_REQUIRE_EQUAL(rsp.body, "hello");
+
+        sstring big(sstring::initialized_later(), 100000);
+        std::fill(big.begin(), big.end(), 'x');
+        req = http::request();
+        req.method = "POST";
+        req.url = "http://localhost/echo";
+        req.body = big;
+        rsp = c.make_request(std::move(req)).get0();
+        BOOST_REQUIRE_EQUAL(rsp.status, 200);
+        BOOST_REQUIRE(rsp.body == big);
+
+        req = http::request();
+        req.url = "http://localhost/missing";
+        rsp = c.make_request(std::move(req)).get0();
+        BOOST_REQUIRE_EQUAL(rsp.status, 404);
+
+        // the body is streamed to the handler, which leaves some unread
+        req = http::request();
+        req.method = "POST";
+        req.url = "http://localhost/echo";
+        req.body = big;
+        size_t streamed = 0;
+        c.make_request(std::move(req), [&streamed] (const http::response& rsp, input_stream<char>& body) {
+            BOOST_REQUIRE_EQUAL(rsp.status, 200);
+            return body.read().then([&streamed] (temporary_buffer<char> buf) {
+                streamed = buf.size();
+            });
+        }).get();
+        BOOST_REQUIRE_GT(streamed, 0u);
+        BOOST_REQUIRE_LT(streamed, big.size());
+        // all went over the one connection
+        BOOST_REQUIRE_EQUAL(server.total_connections(), 1u);
+        c.stop().get();
+
+        // pipelined on one connection
+        opts.max_connections_per_host = 1;
+        opts.max_pipelined_requests = 4;
+        http::client pipelining(opts);
+        parallel_for_each(boost::irange(0, 8), [&pipelining] (int) {
+            http::request req;
+            req.url = "http://localhost/hello";
+            return pipelining.make_request(std::move(req)).then([] (http::response rsp) {
+                BOOST_REQUIRE_EQUAL(rsp.body, "hello");
+            });
+        }).get();
+        BOOST_REQUIRE_EQUAL(server.total_connections(), 2u);
+
+        req = http::request();
+        req.url = "http://localhost/stuck";
+        req.timeout = std::chrono::milliseconds(10);
+        BOOST_REQUIRE_THROW(pipelining.make_request(std::move(req)).get(), timed_out_error);
+        release.signal();
+        // a new connection replaces the aborted one
+        req = http::request();
+        req.url = "http://localhost/hello";
+        rsp = pipelining.make_request(std::move(req)).get0();
+        BOOST_REQUIRE_EQUAL(rsp.body, "hello");
+        BOOST_REQUIRE_EQUAL(server.total_connections(), 3u);
+        pipelining.stop().get();
+
+        server.stop().get();
+        accepted.get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_prepared_reply) {
+    return seastar::async([] {
+        loopback_connection_factory lcf;
+        http_server server("test_prepared_reply");
+        httpd::http_server_tester::listeners(server).emplace_back(lcf.get_server_socket());
+        reply gone;
+        gone.set_status(reply::status_type::not_found, "gone").set_content_type("txt");
+        gone.add_header("X-Prepared", "yes");
+        auto prepared = make_lw_shared<const reply::prepared>(gone);
+        server._routes.put(GET, "/gone", new function_handler([prepared] (std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+            rep->add_header("X-Own", "also");
+            rep->set_prepared(prepared);
+            return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+        }, "txt"));
+        auto accepted = server.do_accepts(0);
+        http::client_options opts;
+        opts.connect = [&lcf] (const sstring&, uint16_t, bool) {
+            return do_with(loopback_socket_impl(lcf), [] (loopback_socket_impl& lsi) {
+                return lsi.connect(socket_address(ipv4_addr()), socket_address(ipv4_addr()));
+            });
+        };
+        http::client c(opts);
+        // twice over one connection, the second from a recycled reply
+        for (int i = 0; i < 2; ++i) {
+            http::request req;
+            req.url = "http://localhost/gone";
+            auto rsp = c.make_request(std::move(req)).get0();
+            BOOST_REQUIRE_EQUAL(rsp.status, 404);
+            BOOST_REQUIRE_EQUAL(rsp.body, "gone");
+            BOOST_REQUIRE_EQUAL(rsp.get_header("Content-Type"), "text/plain");
+            BOOST_REQUIRE_EQUAL(rsp.get_header("X-Prepared"), "yes");
+            BOOST_REQUIRE_EQUAL(rsp.get_header("X-Own"), "also");
+            BOOST_REQUIRE_EQUAL(rsp.get_header("Server"), "Seastar httpd");
+        }
+        // the routes' own prepared reply
+        http::request req;
+        req.url = "http://localhost/missing";
+        auto rsp = c.make_request(std::move(req)).get0();
+        BOOST_REQUIRE_EQUAL(rsp.status, 404);
+        BOOST_REQUIRE_EQUAL(rsp.body, json_exception(not_found_exception("Not found")).to_json());
+        c.stop().get();
+        server.stop().get();
+        accepted.get();
+    });
+}
+
+static sstring inflate(const sstring& in) {
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    // detects the gzip and zlib formats
+    BOOST_REQUIRE_EQUAL(inflateInit2(&zs, 15 + 32), Z_OK);
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.begin()));
+    zs.avail_in = in.size();
+    sstring out;
+    int r;
+    do {
+        char buf[4096];
+        zs.next_out = reinterpret_cast<Bytef*>(buf);
+        zs.avail_out = sizeof(buf);
+        r = ::inflate(&zs, Z_NO_FLUSH);
+        BOOST_REQUIRE(r == Z_OK || r == Z_STREAM_END);
+        out.append(buf, sizeof(buf) - zs.avail_out);
+    } while (r != Z_STREAM_END);
+    inflateEnd(&zs);
+    return out;
+}
+
+SEASTAR_TEST_CASE(test_accepted_encoding) {
+    auto encoding = [] (sstring accepted) {
+        request req;
+        req._headers["Accept-Encoding"] = accepted;
+        return accepted_encoding(req);
+    };
+    BOOST_REQUIRE(encoding("") == content_encoding::identity);
+    BOOST_REQUIRE(encoding("gzip") == content_encoding::gzip);
+    BOOST_REQUIRE(encoding("deflate, gzip") == content_encoding::gzip);
+    BOOST_REQUIRE(encoding("deflate, GZIP;q=0.5") == content_encoding::deflate);
+    BOOST_REQUIRE(encoding("gzip;q=0, deflate;q=0") == content_encoding::identity);
+    BOOST_REQUIRE(encoding("*") == content_encoding::gzip);
+    BOOST_REQUIRE(encoding("br, *;q=0.1, gzip;q=0") == content_encoding::deflate);
+    sstring text(sstring::initialized_later(), 10000);
+    for (size_t i = 0; i < text.size(); ++i) {
+        text[i] = 'a' + i % 7;
+    }
+    auto gz = compress(text, content_encoding::gzip, 6);
+    BOOST_REQUIRE_LT(gz.size(), text.size() / 5);
+    BOOST_REQUIRE(inflate(gz) == text);
+    BOOST_REQUIRE(inflate(compress(text, content_encoding::deflate, 1)) == text);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_reply_compression) {
+    return seastar::async([] {
+        loopback_connection_factory lcf;
+        http_server server("test_reply_compression");
+        httpd::http_server_tester::listeners(server).emplace_back(lcf.get_server_socket());
+        compression_config cfg;
+        cfg.min_size = 100;
+        server.set_compression(cfg);
+        sstring big(sstring::initialized_later(), 10000);
+        for (size_t i = 0; i < big.size(); ++i) {
+            big[i] = 'a' + i % 7;
+        }
+        server._routes.put(GET, "/big", new function_handler([big] (const_req req) {
+            return big;
+        }, "json"));
+        server._routes.put(GET, "/small", new function_handler([] (const_req req) {
+            return "small";
+        }, "json"));
+        server._routes.put(GET, "/image", new function_handler([big] (const_req req) {
+            return big;
+        }, "png"));
+        server._routes.put(GET, "/stream", new stream_handler([big] (request& req, output_stream<char> out) {
+            return do_with(std::move(out), [big] (output_stream<char>& out) {
+                return out.write(big).then([&out, big] {
+                    return out.write(big);
+                }).then([&out] {
+                    return out.close();
+                });
+            });
+        }, "txt"));
+        auto accepted = server.do_accepts(0);
+
+        http::client_options opts;
+        opts.connect = [&lcf] (const sstring&, uint16_t, bool) {
+            return do_with(loopback_socket_impl(lcf), [] (loopback_socket_impl& lsi) {
+                return lsi.connect(socket_address(ipv4_addr()), socket_address(ipv4_addr()));
+            });
+        };
+        http::client c(opts);
+        auto get = [&c] (sstring path, sstring accepted) {
+            http::request req;
+            req.url = "http://localhost" + path;
+            if (!accepted.empty()) {
+                req.headers["Accept-Encoding"] = accepted;
+            }
+            return c.make_request(std::move(req)).get0();
+        };
+        auto rsp = get("/big", "gzip");
+        BOOST_REQUIRE_EQUAL(rsp.get_header("Content-Encoding"), "gzip");
+        BOOST_REQUIRE_EQUAL(rsp.get_header("Vary"), "Accept-Encoding");
+        BOOST_REQUIRE_LT(rsp.body.size(), big.size());
+        BOOST_REQUIRE(inflate(rsp.body) == big);
+
+        rsp = get("/big", "deflate");
+        BOOST_REQUIRE_EQUAL(rsp.get_header("Content-Encoding"), "deflate");
+        BOOST_REQUIRE(inflate(rsp.body) == big);
+
+        rsp = get("/stream", "gzip");
+        BOOST_REQUIRE_EQUAL(rsp.get_header("Content-Encoding"), "gzip");
+        BOOST_REQUIRE(inflate(rsp.body) == big + big);
+
+        // not accepted, too small, and not compressible
+        for (auto path : {"/big", "/small", "/image"}) {
+            rsp = get(path, sstring(path) == "/big" ? "" : "gzip");
+            BOOST_REQUIRE_EQUAL(rsp.get_header("Content-Encoding"), "");
+        }
+        BOOST_REQUIRE_EQUAL(rsp.body.size(), big.size());
+        c.stop().get();
+        server.stop().get();
+        accepted.get();
+    });
+}
+
+static void write_test_file(const sstring& name, const sstring& content) {
+    std::ofstream out(name.c_str(), std::ios::trunc);
+    out << content;
+}
+
+SEASTAR_TEST_CASE(test_file_cache) {
+    return seastar::async([] {
+        sstring name = "file_cache_test.html";
+        sstring page(sstring::initialized_later(), 4000);
+        for (size_t i = 0; i < page.size(); ++i) {
+            page[i] = 'a' + i % 7;
+        }
+        write_test_file(name, page);
+        file_cache_config cfg;
+        cfg.revalidate_interval = std::chrono::milliseconds(0);
+        cfg.max_file_size = 5000;
+        auto cache = make_lw_shared<file_cache>(cfg);
+
+        auto f = cache->get(name).get0();
+        BOOST_REQUIRE(f);
+        BOOST_REQUIRE(f->content == page);
+        BOOST_REQUIRE(!f->gzip_content.empty());
+        BOOST_REQUIRE(inflate(f->gzip_content) == page);
+        BOOST_REQUIRE_EQUAL(cache->misses(), 1u);
+        auto etag = f->etag;
+        BOOST_REQUIRE(cache->get(name).get0() == f);
+        BOOST_REQUIRE_EQUAL(cache->hits(), 1u);
+        // nothing is fresh without a revalidation interval
+        BOOST_REQUIRE(!cache->get_fresh(name));
+
+        // a changed file is read again
+        write_test_file(name, "changed");
+        f = cache->get(name).get0();
+        BOOST_REQUIRE_EQUAL(f->content, "changed");
+        BOOST_REQUIRE(f->etag != etag);
+        BOOST_REQUIRE_EQUAL(cache->misses(), 2u);
+
+        // too large to be cached
+        write_test_file(name, page + page);
+        BOOST_REQUIRE(!cache->get(name).get0());
+        BOOST_REQUIRE_EQUAL(cache->used_memory(), 0u);
+
+        // served by a file handler
+        write_test_file(name, page);
+        loopback_connection_factory lcf;
+        http_server server("test_file_cache");
+        httpd::http_server_tester::listeners(server).emplace_back(lcf.get_server_socket());
+        auto handler = new file_handler(name, nullptr, false);
+        handler->set_cache(cache);
+        server._routes.put(GET, "/page", handler);
+        auto accepted = server.do_accepts(0);
+        http::client_options opts;
+        opts.connect = [&lcf] (const sstring&, uint16_t, bool) {
+            return do_with(loopback_socket_impl(lcf), [] (loopback_socket_impl& lsi) {
+                return lsi.connect(socket_address(ipv4_addr()), socket_address(ipv4_addr()));
+            });
+        };
+        http::client c(opts);
+        auto get = [&c] (std::unordered_map<sstring, sstring> headers) {
+            http::request req;
+            req.url = "http://localhost/page";
+            req.headers = std::move(headers);
+            return c.make_request(std::move(req)).get0();
+        };
+        auto rsp = get({});
+        BOOST_REQUIRE_EQUAL(rsp.status, 200);
+        BOOST_REQUIRE(rsp.body == page);
+        etag = rsp.get_header("ETag");
+        BOOST_REQUIRE(!etag.empty());
+        BOOST_REQUIRE(!rsp.get_header("Last-Modified").empty());
+
+        rsp = get({{"If-None-Match", "\"other\", " + etag}});
+        BOOST_REQUIRE_EQUAL(rsp.status, 304);
+        BOOST_REQUIRE(rsp.body.empty());
+        rsp = get({{"If-None-Match", "\"other\""}});
+        BOOST_REQUIRE_EQUAL(rsp.status, 200);
+
+        rsp = get({{"Accept-Encoding", "gzip"}});
+        BOOST_REQUIRE_EQUAL(rsp.get_header("Content-Encoding"), "gzip");
+        BOOST_REQUIRE(inflate(rsp.body) == page);
+
+        c.stop().get();
+        server.stop().get();
+        accepted.get();
+        ::unlink(name.c_str());
+    });
+}
+
+SEASTAR_TEST_CASE(test_api_docs_index) {
+    return seastar::async([] {
+        routes r;
+        api_registry_builder rb;
+        rb.set_api_doc(r);
+        for (int i = 0; i < 20; ++i) {
+            rb.register_function(r, sprint("api%d", i), "an api");
+        }
+        auto index = r.get_exact_match(GET, api_registry_builder::DEFAULT_PATH);
+        BOOST_REQUIRE(index);
+        auto get = [index] (std::unordered_map<sstring, sstring> headers) {
+            auto req = std::make_unique<request>();
+            req->_headers = std::move(headers);
+            return index->handle(api_registry_builder::DEFAULT_PATH, std::move(req), std::make_unique<reply>()).get0();
+        };
+        auto rep = get({});
+        BOOST_REQUIRE(rep->_status == reply::status_type::ok);
+        BOOST_REQUIRE(rep->_content.find("\"/api19\"") != sstring::npos);
+        auto etag = rep->_headers["ETag"];
+        BOOST_REQUIRE(!etag.empty());
+        BOOST_REQUIRE_EQUAL(get({})->_headers["ETag"], etag);
+
+        rep = get({{"If-None-Match", etag}});
+        BOOST_REQUIRE(rep->_status == reply::status_type::not_modified);
+        rep = get({{"Accept-Encoding", "gzip"}});
+        BOOST_REQUIRE_EQUAL(rep->_headers["Content-Encoding"], "gzip");
+        BOOST_REQUIRE(inflate(rep->_content).find("\"/api19\"") != sstring::npos);
+
+        // a registration changes the index
+        rb.register_function(r, "api20", "another api");
+        rep = get({{"If-None-Match", etag}});
+        BOOST_REQUIRE(rep->_status == reply::status_type::ok);
+        BOOST_REQUIRE(rep->_content.find("\"/api20\"") != sstring::npos);
+        BOOST_REQUIRE(rep->_headers["ETag"] != etag);
+    });
+}
+
+// Hands out the buffers one by one, as a connection would
+class buffers_source_impl : public data_source_impl {
+    std::vector<temporary_buffer<char>> _bufs;
+    size_t _next = 0;
+public:
+    explicit buffers_source_impl(std::vector<temporary_buffer<char>> bufs) : _bufs(std::move(bufs)) {}
+    virtual future<temporary_buffer<char>> get() override {
+        if (_next == _bufs.size()) {
+            return make_ready_future<temporary_buffer<char>>();
+        }
+        return make_ready_future<temporary_buffer<char>>(std::move(_bufs[_next++]));
+    }
+};
+
+static std::unique_ptr<request> parse_request(std::vector<sstring> parts, bool views) {
+    std::vector<temporary_buffer<char>> bufs;
+    for (auto&& p : parts) {
+        bufs.emplace_back(p.begin(), p.size());
+    }
+    input_stream<char> in(data_source(std::make_unique<buffers_source_impl>(std::move(bufs))));
+    http_request_parser parser;
+    parser.init(views);
+    in.consume(parser).get();
+    BOOST_REQUIRE(parser._state == http_request_parser::state::done);
+    return parser.get_parsed_request();
+}
+
+SEASTAR_TEST_CASE(test_header_views) {
+    return seastar::async([] {
+        sstring head = "GET /a/long/path/to/some/resource?x=1 HTTP/1.1\r\nHost: example.org\r\n"
+                "accept-encoding: gzip\r\nX-Dup: 1\r\nX-Dup: 2\r\n\r\n";
+        sstring next = "GET / HTTP/1.1\r\n\r\n";
+        for (size_t split : {size_t(0), size_t(10), size_t(60), size_t(head.size() - 1)}) {
+            std::vector<sstring> parts;
+            if (split) {
+                parts = {head.substr(0, split), head.substr(split) + next};
+            } else {
+                parts = {head + next};
+            }
+            auto req = parse_request(parts, true);
+            BOOST_REQUIRE_EQUAL(req->_method, "GET");
+            BOOST_REQUIRE_EQUAL(req->_url, "/a/long/path/to/some/resource?x=1");
+            BOOST_REQUIRE_EQUAL(req->_version, "1.1");
+            BOOST_REQUIRE(req->_headers.empty());
+            BOOST_REQUIRE_EQUAL(req->raw_headers.size(), 4u);
+            BOOST_REQUIRE_EQUAL(req->get_header("Host"), "example.org");
+            BOOST_REQUIRE(req->header("Accept-Encoding") == "gzip");
+            BOOST_REQUIRE(req->header("X-Dup") == "2");
+            BOOST_REQUIRE(req->header("Missing").empty());
+            req->materialize_headers();
+            BOOST_REQUIRE_EQUAL(req->_headers["accept-encoding"], "gzip");
+            BOOST_REQUIRE_EQUAL(req->get_header("X-Dup"), "2");
+
+            auto copied = parse_request(parts, false);
+            BOOST_REQUIRE_EQUAL(copied->_url, req->_url);
+            BOOST_REQUIRE_EQUAL(copied->raw_headers.size(), 0u);
+            BOOST_REQUIRE_EQUAL(copied->_headers["Host"], "example.org");
+        }
+        // folded values do not fit views, and are copied
+        auto req = parse_request({"GET / HTTP/1.1\r\nX-Folded: first\r\n  second\r\nHost: h\r\n\r\n"}, true);
+        BOOST_REQUIRE_EQUAL(req->raw_headers.size(), 0u);
+        BOOST_REQUIRE_EQUAL(req->get_header("X-Folded"), "first second");
+        BOOST_REQUIRE_EQUAL(req->get_header("Host"), "h");
+    });
+}
+
+static sstring unhex(const char* hex) {
+    sstring ret;
+    for (; hex[0] && hex[1]; hex += 2) {
+        char c = char(std::stoi(std::string(hex, 2), nullptr, 16));
+        ret.append(&c, 1);
+    }
+    return ret;
+}
+
+SEASTAR_TEST_CASE(test_hpack) {
+    // the request examples of RFC 7541, appendix C.3 and C.4: the same
+    // requests, without and with Huffman coding
+    std::vector<std::vector<const char*>> examples = {
+        {"828684410f7777772e6578616d706c652e636f6d",
+         "828684be58086e6f2d6361636865",
+         "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565"},
+        {"828684418cf1e3c2e5f23a6ba0ab90f4ff",
+         "828684be5886a8eb10649cbf",
+         "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"},
+    };
+    for (auto&& blocks : examples) {
+        hpack_decoder d;
+        auto b = unhex(blocks[0]);
+        auto fields = d.decode(b.begin(), b.size());
+        BOOST_REQUIRE_EQUAL(fields.size(), 4u);
+        BOOST_REQUIRE_EQUAL(fields[0].name, ":method");
+        BOOST_REQUIRE_EQUAL(fields[0].value, "GET");
+        BOOST_REQUIRE_EQUAL(fields[3].name, ":authority");
+        BOOST_REQUIRE_EQUAL(fields[3].value, "www.example.com");
+        BOOST_REQUIRE_EQUAL(d.table_size(), 57u);
+        b = unhex(blocks[1]);
+        fields = d.decode(b.begin(), b.size());
+        BOOST_REQUIRE_EQUAL(fields.size(), 5u);
+        BOOST_REQUIRE_EQUAL(fields[3].value, "www.example.com");
+        BOOST_REQUIRE_EQUAL(fields[4].name, "cache-control");
+        BOOST_REQUIRE_EQUAL(fields[4].value, "no-cache");
+        BOOST_REQUIRE_EQUAL(d.table_size(), 110u);
+        b = unhex(blocks[2]);
+        fields = d.decode(b.begin(), b.size());
+        BOOST_REQUIRE_EQUAL(fields.size(), 5u);
+        BOOST_REQUIRE_EQUAL(fields[2].value, "/index.html");
+        BOOST_REQUIRE_EQUAL(fields[4].name, "custom-key");
+        BOOST_REQUIRE_EQUAL(fields[4].value, "custom-value");
+        BOOST_REQUIRE_EQUAL(d.table_size(), 164u);
+    }
+
+    BOOST_REQUIRE_EQUAL(hpack_huffman_encode("www.example.com"), unhex("f1e3c2e5f23a6ba0ab90f4ff"));
+    sstring all_bytes;
+    for (int c = 0; c < 256; ++c) {
+        char b = char(c);
+        all_bytes.append(&b, 1);
+    }
+    BOOST_REQUIRE_EQUAL(hpack_huffman_decode(hpack_huffman_encode(all_bytes)), all_bytes);
+    // EOS, and padding that is not all ones
+    BOOST_REQUIRE_THROW(hpack_huffman_decode(unhex("ffffffff")), hpack_error);
+    BOOST_REQUIRE_THROW(hpack_huffman_decode(unhex("f1e3c2e5f23a6ba0ab90f4fe")), hpack_error);
+
+    std::vector<char> block;
+    hpack_encode(block, ":status", "200");
+    hpack_encode(block, "content-type", "text/plain");
+    hpack_encode(block, "x-long", sstring(300, 'x'));
+    BOOST_REQUIRE_EQUAL(block[0], char(0x88));
+    hpack_decoder d;
+    auto fields = d.decode(block.data(), block.size());
+    BOOST_REQUIRE_EQUAL(fields.size(), 3u);
+    BOOST_REQUIRE_EQUAL(fields[1].value, "text/plain");
+    BOOST_REQUIRE_EQUAL(fields[2].name, "x-long");
+    BOOST_REQUIRE_EQUAL(fields[2].value, sstring(300, 'x'));
+    BOOST_REQUIRE_EQUAL(d.table_size(), 0u);
+    // an index past the tables
+    BOOST_REQUIRE_THROW(d.decode("\xbe", 1), hpack_error);
+    return make_ready_future<>();
+}
+
+static sstring h2_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const sstring& payload) {
+    char head[9] = { char(payload.size() >> 16), char(payload.size() >> 8), char(payload.size()),
+            char(type), char(flags), char(stream_id >> 24), char(stream_id >> 16), char(stream_id >> 8), char(stream_id) };
+    return sstring(head, 9) + payload;
+}
+
+static sstring h2_headers(uint32_t stream_id, bool end_stream, std::vector<std::pair<sstring, sstring>> fields) {
+    std::vector<char> block;
+    for (auto&& f : fields) {
+        hpack_encode(block, f.first, f.second);
+    }
+    return h2_frame(0x1, 0x4 | (end_stream ? 0x1 : 0), stream_id, sstring(block.data(), block.size()));
+}
+
+struct h2_received_frame {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream_id;
+    temporary_buffer<char> payload;
+};
+
+static h2_received_frame h2_read_frame(input_stream<char>& in) {
+    auto head = in.read_exactly(9).get0();
+    BOOST_REQUIRE_EQUAL(head.size(), 9u);
+    auto p = reinterpret_cast<const uint8_t*>(head.get());
+    h2_received_frame f;
+    size_t length = p[0] << 16 | p[1] << 8 | p[2];
+    f.type = p[3];
+    f.flags = p[4];
+    f.stream_id = (p[5] & 0x7f) << 24 | p[6] << 16 | p[7] << 8 | p[8];
+    f.payload = in.read_exactly(length).get0();
+    BOOST_REQUIRE_EQUAL(f.payload.size(), length);
+    return f;
+}
+
+SEASTAR_TEST_CASE(test_http2) {
+    return seastar::async([] {
+        loopback_connection_factory lcf;
+        http_server server("test_http2");
+        server.set_http2();
+        httpd::http_server_tester::listeners(server).emplace_back(lcf.get_server_socket());
+        server._routes.put(GET, "/hello", new function_handler([] (const_req req) {
+            return "hello " + req.get_header("User-Agent");
+        }, "txt"));
+        server._routes.put(POST, "/echo", new stream_handler([] (request& req, output_stream<char> out) {
+            return do_with(std::move(out), [&req] (output_stream<char>& out) {
+                return repeat([&req, &out] {
+                    return req.content_stream.read().then([&out] (temporary_buffer<char> buf) {
+                        if (buf.empty()) {
+                            return make_ready_future<stop_iteration>(stop_iteration::yes);
+                        }
+                        return out.write(buf.get(), buf.size()).then([] {
+                            return stop_iteration::no;
+                        });
+                    });
+                }).then([&out] {
+                    return out.close();
+                });
+            });
+        }, "txt"));
+        server._routes.put(POST, "/buffered", new function_handler([] (const_req req) {
+            return "got:" + req.content;
+        }, "txt"));
+        auto accepted = server.do_accepts(0);
+
+        loopback_socket_impl lsi(lcf);
+        auto c_socket = lsi.connect(socket_address(ipv4_addr()), socket_address(ipv4_addr())).get0();
+        auto input = c_socket.input();
+        auto output = c_socket.output();
+        sstring client = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" + h2_frame(0x4, 0, 0, "");
+        client += h2_headers(1, true, {{":method", "GET"}, {":scheme", "http"}, {":path", "/hello"},
+                {":authority", "localhost"}, {"user-agent", "test"}});
+        // with a Content-Length, dispatched before its body arrives
+        client += h2_headers(3, false, {{":method", "POST"}, {":scheme", "http"}, {":path", "/echo"},
+                {"content-length", "10"}});
+        client += h2_frame(0x0, 0, 3, "01234");
+        // without, dispatched once it is all received
+        client += h2_headers(5, false, {{":method", "POST"}, {":scheme", "http"}, {":path", "/buffered"}});
+        client += h2_frame(0x0, 0x1, 5, "abc");
+        client += h2_frame(0x0, 0x1, 3, "56789");
+        client += h2_frame(0x6, 0, 0, "pingpong");
+        output.write(client).get();
+        output.flush().get();
+
+        hpack_decoder decoder;
+        std::map<uint32_t, sstring> status;
+        std::map<uint32_t, sstring> bodies;
+        std::set<uint32_t> ended;
+        bool settings = false;
+        bool settings_ack = false;
+        bool ping_ack = false;
+        while (ended.size() < 3 || !ping_ack || !settings_ack) {
+            auto f = h2_read_frame(input);
+            if (f.type == 0x4) {
+                (f.flags & 0x1 ? settings_ack : settings) = true;
+            } else if (f.type == 0x6) {
+                BOOST_REQUIRE(f.flags & 0x1);
+                BOOST_REQUIRE_EQUAL(sstring(f.payload.get(), f.payload.size()), "pingpong");
+                ping_ack = true;
+            } else if (f.type == 0x1) {
+                BOOST_REQUIRE(f.flags & 0x4);
+                for (auto&& field : decoder.decode(f.payload.get(), f.payload.size())) {
+                    if (field.name == ":status") {
+                        status[f.stream_id] = field.value;
+                    }
+                }
+            } else if (f.type == 0x0) {
+                bodies[f.stream_id] += sstring(f.payload.get(), f.payload.size());
+            }
+            if ((f.type == 0x0 || f.type == 0x1) && (f.flags & 0x1)) {
+                ended.insert(f.stream_id);
+            }
+        }
+        BOOST_REQUIRE(settings);
+        BOOST_REQUIRE_EQUAL(status[1], "200");
+        BOOST_REQUIRE_EQUAL(status[3], "200");
+        BOOST_REQUIRE_EQUAL(status[5], "200");
+        BOOST_REQUIRE(bodies[1].find("hello test") != sstring::npos);
+        BOOST_REQUIRE_EQUAL(bodies[3], "0123456789");
+        BOOST_REQUIRE(bodies[5].find("got:abc") != sstring::npos);
+        BOOST_REQUIRE_EQUAL(server.requests_served(), 3u);
+
+        output.close().get();
+        input.close().get();
+        server.stop().get();
+        accepted.get();
+    });
+}
@@ -0,0 +1,96 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#define BOOST_TEST_MODULE ipv6
+
+#include <boost/test/included/unit_test.hpp>
+#include <sstream>
+#include <vector>
+#include "net/ipv6.hh"
+
+using namespace seastar;
+using namespace net;
+
+static std::string to_string(const ipv6_address& a) {
+    std::ostringstream os;
+    os << a;
+    return os.str();
+}
+
+BOOST_AUTO_TEST_CASE(test_parse_and_print) {
+    auto a = ipv6_address("2001:db8::1");
+    BOOST_REQUIRE_EQUAL(a.ip[0], 0x20);
+    BOOST_REQUIRE_EQUAL(a.ip[1], 0x01);
+    BOOST_REQUIRE_EQUAL(a.ip[15], 0x01);
+    BOOST_REQUIRE_EQUAL(to_string(a), "2001:db8::1");
+    BOOST_REQUIRE(!is_unspecified(a));
+    BOOST_REQUIRE(is_unspecified(ipv6_address("::")));
+    BOOST_REQUIRE_THROW(ipv6_address("192.168.0.1"), std::runtime_error);
+
+    auto sa = make_socket_address(a, 8080);
+    BOOST_REQUIRE_EQUAL(sa.port(), 8080);
+    BOOST_REQUIRE(ipv6_address(sa) == a);
+    BOOST_REQUIRE(sa == make_socket_address(a, 8080));
+    BOOST_REQUIRE(!(sa == make_socket_address(a, 8081)));
+}
+
+BOOST_AUTO_TEST_CASE(test_scopes_and_prefixes) {
+    BOOST_REQUIRE(ipv6_address("fe80::1").is_link_local());
+    BOOST_REQUIRE(!ipv6_address("2001:db8::1").is_link_local());
+    BOOST_REQUIRE(ipv6_address("ff02::1").is_multicast());
+    BOOST_REQUIRE(ipv6_address::all_nodes() == ipv6_address("ff02::1"));
+
+    auto a = ipv6_address("2001:db8:0:1::1");
+    BOOST_REQUIRE(a.same_prefix(ipv6_address("2001:db8:0:1:ffff::"), 64));
+    BOOST_REQUIRE(!a.same_prefix(ipv6_address("2001:db8:0:2::1"), 64));
+    BOOST_REQUIRE(a.same_prefix(ipv6_address("2001:db8:0:3::1"), 62));
+    BOOST_REQUIRE(!a.same_prefix(ipv6_address("2001:db8:0:3::1"), 63));
+    BOOST_REQUIRE(a.same_prefix(a, 128));
+    BOOST_REQUIRE(!a.same_prefix(ipv6_address("2001:db8:0:1::2"), 128));
+}
+
+BOOST_AUTO_TEST_CASE(test_neighbour_discovery_addresses) {
+    auto a = ipv6_address("2001:db8::12:3456:789a");
+    BOOST_REQUIRE(a.solicited_node() == ipv6_address("ff02::1:ff56:789a"));
+    auto mac = a.solicited_node().multicast_mac();
+    BOOST_REQUIRE(mac.mac == (std::array<uint8_t, 6>{{0x33, 0x33, 0xff, 0x56, 0x78, 0x9a}}));
+
+    auto ll = ipv6_address::link_local(ethernet_address({0x52, 0x54, 0x00, 0x12, 0x34, 0x56}));
+    BOOST_REQUIRE_EQUAL(to_string(ll), "fe80::5054:ff:fe12:3456");
+}
+
+BOOST_AUTO_TEST_CASE(test_pseudo_header_checksum) {
+    auto src = ipv6_address("2001:db8::1");
+    auto dst = ipv6_address("fe80::abcd:1234");
+    std::vector<uint8_t> payload = {0x80, 0x00, 0x00, 0x00, 0x12, 0x34, 0x00, 0x01, 'p', 'i', 'n', 'g', '!'};
+
+    checksummer csum;
+    ipv6_traits::pseudo_header_checksum(csum, src, dst, ip_protocol_num::icmpv6, payload.size());
+    csum.sum(reinterpret_cast<const char*>(payload.data()), payload.size());
+
+    // The pseudo header spelled out as RFC 8200 lays it out
+    std::vector<uint8_t> buf(src.ip.begin(), src.ip.end());
+    buf.insert(buf.end(), dst.ip.begin(), dst.ip.end());
+    buf.insert(buf.end(), {0, 0, 0, uint8_t(payload.size()), 0, 0, 0, 58});
+    buf.insert(buf.end(), payload.begin(), payload.end());
+    BOOST_REQUIRE_EQUAL(csum.get(), ip_checksum(buf.data(), buf.size()));
+}
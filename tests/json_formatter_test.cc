@@ -28,6 +28,9 @@
 #include "core/do_with.hh"
 #include "core/future-util.hh"
 #include "json/formatter.hh"
+#include "json/json_elements.hh"
+#include "json/json_parser.hh"
+#include "core/vector-data-sink.hh"
 
 using namespace seastar;
 using namespace json;
@@ -52,3 +55,136 @@ SEASTAR_TEST_CASE(test_collections) {
 
     return make_ready_future();
 }
+
+struct test_object : public json_base {
+    json_element<sstring> name;
+    json_element<int> count;
+    json_list<long> values;
+
+    void register_params() {
+        add(&name, "name");
+        add(&count, "count");
+        add(&values, "values");
+    }
+    test_object() {
+        register_params();
+    }
+    test_object(const test_object& o) {
+        register_params();
+        name = o.name;
+        count = o.count;
+        values = o.values;
+    }
+    // as json2code.py generates it
+    void parse_json(reader& r) {
+        r.begin_object();
+        std::experimental::string_view key;
+        while (r.next_key(key)) {
+            if (key == "name") {
+                json::parse(r, name);
+            } else if (key == "count") {
+                json::parse(r, count);
+            } else if (key == "values") {
+                json::parse(r, values);
+            } else {
+                r.skip();
+            }
+        }
+    }
+};
+
+// Streams the value through a small buffer, so that it goes out in
+// many pieces
+template<typename Writer>
+static future<sstring> stream_to_string(Writer w) {
+    return do_with(vector_data_sink::vector_type(), [w = std::move(w)] (vector_data_sink::vector_type& v) mutable {
+        return w(output_stream<char>(data_sink(std::make_unique<vector_data_sink>(v)), 8)).then([&v] {
+            sstring res;
+            for (auto&& p : v) {
+                for (auto&& f : p.fragments()) {
+                    res += sstring(f.base, f.size);
+                }
+            }
+            return res;
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_stream_collections) {
+    auto m = std::map<int, std::vector<int>>({{1, {2, 3}}, {4, {}}});
+    return stream_to_string(stream_object(m)).then([m] (sstring res) {
+        BOOST_CHECK_EQUAL(res, formatter::to_json(m));
+    });
+}
+
+SEASTAR_TEST_CASE(test_stream_object) {
+    test_object obj;
+    obj.name = "apa";
+    obj.values = std::vector<long>({1, 2, 3});
+    return stream_to_string(stream_object(obj)).then([obj] (sstring res) {
+        BOOST_CHECK_EQUAL(res, "{\"name\": \"apa\", \"values\": [1,2,3]}");
+        BOOST_CHECK_EQUAL(res, sstring(obj.to_json()));
+    });
+}
+
+SEASTAR_TEST_CASE(test_stream_range_as_array) {
+    std::vector<int> v({1, 2, 3});
+    return stream_to_string(stream_range_as_array(v, [] (int i) {
+        test_object obj;
+        obj.count = i;
+        return obj;
+    })).then([] (sstring res) {
+        BOOST_CHECK_EQUAL(res, "[{\"count\": 1},{\"count\": 2},{\"count\": 3}]");
+    });
+}
+
+template<typename T>
+static sstring append_to_string(const T& val) {
+    rope r(16);
+    formatter::append(r, val);
+    return r.linearize();
+}
+
+SEASTAR_TEST_CASE(test_append) {
+    BOOST_CHECK_EQUAL(append_to_string(-42), "-42");
+    BOOST_CHECK_EQUAL(append_to_string(std::numeric_limits<long>::min()), formatter::to_json(std::numeric_limits<long>::min()));
+    BOOST_CHECK_EQUAL(append_to_string(3.5), "3.5");
+    BOOST_CHECK_EQUAL(append_to_string(false), "false");
+    BOOST_CHECK_EQUAL(append_to_string(sstring("a\"b\\\n\x01")), "\"a\\\"b\\\\\\n\\u0001\"");
+    auto m = std::map<int, std::vector<int>>({{1, {2, 3}}, {4, {}}});
+    BOOST_CHECK_EQUAL(append_to_string(m), formatter::to_json(m));
+
+    test_object obj;
+    obj.name = "apa";
+    obj.values = std::vector<long>({1, 2, 3});
+    BOOST_CHECK_EQUAL(append_to_string(obj), sstring(obj.to_json()));
+    return make_ready_future();
+}
+
+SEASTAR_TEST_CASE(test_parse_object) {
+    test_object obj;
+    from_json("{ \"unknown\": {\"a\": [1, null, \"x\"]}, \"name\": \"a\\\"p\\u00e9\","
+            " \"count\": -3, \"values\": [1, 20000000000] }", obj);
+    BOOST_CHECK_EQUAL(obj.name(), "a\"p\xc3\xa9");
+    BOOST_CHECK_EQUAL(obj.count(), -3);
+    BOOST_CHECK_EQUAL(obj.values._elements, std::vector<long>({1, 20000000000}));
+
+    // what is formatted parses back
+    test_object copy;
+    from_json(formatter::to_json(obj), copy);
+    BOOST_CHECK_EQUAL(copy.to_json(), obj.to_json());
+
+    test_object unset;
+    from_json("{\"count\": null}", unset);
+    BOOST_CHECK(!unset.count._set);
+    return make_ready_future();
+}
+
+SEASTAR_TEST_CASE(test_parse_errors) {
+    for (auto text : { "{\"count\": 1 \"name\": \"x\"}", "{\"count\": \"1\"}", "{\"count\": 2147483648}",
+            "{\"values\": [1,]}", "{\"name\": \"x}", "{} {}" }) {
+        test_object obj;
+        BOOST_CHECK_THROW(from_json(text, obj), parse_error);
+    }
+    return make_ready_future();
+}
@@ -0,0 +1,134 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "util/lazy.hh"
+#include "util/log.hh"
+
+using namespace seastar;
+using namespace std::chrono_literals;
+
+static logger test_logger("log_test");
+
+// Captures what is written to std::cout while it lives
+class cout_capture {
+    std::ostringstream _out;
+    std::streambuf* _old;
+public:
+    cout_capture() : _old(std::cout.rdbuf(_out.rdbuf())) {}
+    ~cout_capture() {
+        std::cout.rdbuf(_old);
+    }
+    std::string str() const {
+        return _out.str();
+    }
+};
+
+static size_t count(const std::string& s, const std::string& what) {
+    size_t n = 0;
+    for (auto p = s.find(what); p != std::string::npos; p = s.find(what, p + 1)) {
+        ++n;
+    }
+    return n;
+}
+
+BOOST_AUTO_TEST_CASE(test_rate_limit) {
+    cout_capture out;
+    logger::rate_limit rl(1h);
+    for (int i = 0; i < 10; ++i) {
+        test_logger.log(log_level::info, rl, "message {}", i);
+    }
+    BOOST_REQUIRE_EQUAL(count(out.str(), "message"), 1u);
+    BOOST_REQUIRE_EQUAL(count(out.str(), "message 0"), 1u);
+    BOOST_REQUIRE_EQUAL(rl.dropped_messages(), 9u);
+
+    logger::rate_limit fast(0ms);
+    test_logger.log(log_level::info, fast, "first");
+    test_logger.log(log_level::info, fast, "second");
+    BOOST_REQUIRE_EQUAL(count(out.str(), "first"), 1u);
+    BOOST_REQUIRE_EQUAL(count(out.str(), "second"), 1u);
+    BOOST_REQUIRE_EQUAL(count(out.str(), "rate limiting dropped"), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_rate_limit_reports_dropped) {
+    cout_capture out;
+    logger::rate_limit rl(50ms);
+    test_logger.log(log_level::info, rl, "burst");
+    test_logger.log(log_level::info, rl, "burst");
+    test_logger.log(log_level::info, rl, "burst");
+    std::this_thread::sleep_for(60ms);
+    test_logger.log(log_level::info, rl, "burst");
+    BOOST_REQUIRE_EQUAL(count(out.str(), "burst"), 2u);
+    BOOST_REQUIRE_EQUAL(count(out.str(), "(rate limiting dropped 2 similar messages) burst"), 1u);
+    BOOST_REQUIRE_EQUAL(rl.dropped_messages(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_async) {
+    cout_capture out;
+    logger::set_async_enabled(true, 4);
+    for (int i = 0; i < 100; ++i) {
+        test_logger.info("async {}", i);
+    }
+    auto dropped = logger::async_dropped_messages();
+    BOOST_REQUIRE_LE(dropped, 96u);
+    // the writer thread writes what was not dropped, and reports the rest
+    for (int i = 0; i < 200 && count(out.str(), "async ") < 100 - dropped; ++i) {
+        std::this_thread::sleep_for(10ms);
+    }
+    if (dropped) {
+        for (int i = 0; i < 200 && count(out.str(), "asynchronous logging dropped") == 0; ++i) {
+            std::this_thread::sleep_for(10ms);
+        }
+    }
+    logger::set_async_enabled(false);
+    BOOST_REQUIRE_EQUAL(count(out.str(), "async "), 100 - dropped);
+    BOOST_REQUIRE_EQUAL(count(out.str(), "async 0\n"), 1u);
+    if (dropped) {
+        BOOST_REQUIRE_EQUAL(count(out.str(), "asynchronous logging dropped"), 1u);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_disabled_arguments_are_not_evaluated) {
+    cout_capture out;
+    int evaluations = 0;
+    auto expensive = [&] {
+        ++evaluations;
+        return 42;
+    };
+    test_logger.set_level(log_level::info);
+    SEASTAR_LOG_DEBUG(test_logger, "value {}", expensive());
+    SEASTAR_LOG_TRACE(test_logger, "value {}", expensive());
+    test_logger.debug("value {}", value_of(expensive));
+    BOOST_REQUIRE_EQUAL(evaluations, 0);
+    BOOST_REQUIRE_EQUAL(out.str(), "");
+
+    test_logger.set_level(log_level::debug);
+    SEASTAR_LOG_DEBUG(test_logger, "value {}", expensive());
+    SEASTAR_LOG(test_logger, log_level::info, "value {}", expensive());
+    test_logger.set_level(log_level::info);
+    BOOST_REQUIRE_EQUAL(evaluations, max_compiled_log_level >= log_level::debug ? 2 : 1);
+}
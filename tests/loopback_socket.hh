@@ -133,6 +133,13 @@ class loopback_connected_socket_impl : public net::connected_socket_impl {
     net::keepalive_params get_keepalive_parameters() const override {
         return net::tcp_keepalive_params {std::chrono::seconds(0), std::chrono::seconds(0), 0};
     }
+    void set_congestion_control(const sstring& name) override {}
+    sstring get_congestion_control() const override {
+        return "reno";
+    }
+    net::tcp_connection_info get_tcp_info() const override {
+        return {};
+    }
 };
 
 class loopback_server_socket_impl : public net::server_socket_impl {
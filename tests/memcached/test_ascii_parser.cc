@@ -333,3 +333,46 @@ SEASTAR_TEST_CASE(test_multiple_requests_in_one_stream) {
         });
     });
 }
+
+SEASTAR_TEST_CASE(test_meta_commands_are_parsed) {
+    return for_each_fragment_size([] (auto make_packet) {
+        return make_ready_future<>()
+                .then([make_packet] {
+            return parse(make_packet({"mn\r\n"}))
+                    .then([] (auto p) {
+                BOOST_REQUIRE(p->_state == parser_type::state::cmd_meta_noop);
+            });
+        }).then([make_packet] {
+            return parse(make_packet({"mg key1\r\n"}))
+                    .then([] (auto p) {
+                BOOST_REQUIRE(p->_state == parser_type::state::cmd_meta_get);
+                BOOST_REQUIRE(p->_key.key() == "key1");
+                BOOST_REQUIRE(p->_meta_flags.empty());
+            });
+        }).then([make_packet] {
+            return parse(make_packet({"mg key1 v f Oabc\r\n"}))
+                    .then([] (auto p) {
+                BOOST_REQUIRE(p->_state == parser_type::state::cmd_meta_get);
+                BOOST_REQUIRE(p->_key.key() == "key1");
+                BOOST_REQUIRE_EQUAL(p->_meta_flags, std::vector<sstring>({"v", "f", "Oabc"}));
+            });
+        }).then([make_packet] {
+            return parse(make_packet({"ms key2 5 F3 T10\r\n", "hello\r\n"}))
+                    .then([] (auto p) {
+                BOOST_REQUIRE(p->_state == parser_type::state::cmd_meta_set);
+                BOOST_REQUIRE(p->_key.key() == "key2");
+                BOOST_REQUIRE(p->_size == 5);
+                BOOST_REQUIRE(p->_size_str == "5");
+                BOOST_REQUIRE_EQUAL(p->_meta_flags, std::vector<sstring>({"F3", "T10"}));
+                BOOST_REQUIRE(p->_blob == "hello");
+            });
+        }).then([make_packet] {
+            return parse(make_packet({"md key3 q\r\n"}))
+                    .then([] (auto p) {
+                BOOST_REQUIRE(p->_state == parser_type::state::cmd_meta_delete);
+                BOOST_REQUIRE(p->_key.key() == "key3");
+                BOOST_REQUIRE_EQUAL(p->_meta_flags, std::vector<sstring>({"q"}));
+            });
+        });
+    });
+}
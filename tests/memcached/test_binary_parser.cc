@@ -0,0 +1,133 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include "tests/test-utils.hh"
+#include "core/shared_ptr.hh"
+#include "net/packet-data-source.hh"
+#include "apps/memcached/binary.hh"
+#include "core/future-util.hh"
+
+using namespace seastar;
+using namespace net;
+using namespace memcache;
+
+using parser_type = memcache_binary_parser;
+
+static std::string make_request(binary::opcode op, std::string extras, std::string key, std::string value,
+        uint32_t opaque = 0, uint64_t cas = 0) {
+    binary::header h;
+    h.magic = binary::request_magic;
+    h.opcode = uint8_t(op);
+    h.key_length = key.size();
+    h.extras_length = extras.size();
+    h.data_type = 0;
+    h.vbucket_or_status = 0;
+    h.body_length = extras.size() + key.size() + value.size();
+    h.opaque = opaque;
+    h.cas = cas;
+    std::string ret(binary::header_size, '\0');
+    h.write(&ret[0]);
+    return ret + extras + key + value;
+}
+
+static packet make_packet(const std::string& data, size_t buffer_size) {
+    packet p;
+    for (size_t pos = 0; pos < data.size(); pos += buffer_size) {
+        auto now = std::min(pos + buffer_size, data.size()) - pos;
+        p.append(packet(data.data() + pos, now));
+    }
+    return p;
+}
+
+static auto make_input_stream(packet&& p) {
+    return input_stream<char>(data_source(
+            std::make_unique<packet_data_source>(std::move(p))));
+}
+
+auto for_each_fragment_size = [] (auto&& func) {
+    auto buffer_sizes = { 100000, 1000, 100, 10, 5, 2, 1 };
+    return do_for_each(buffer_sizes.begin(), buffer_sizes.end(), [func] (size_t buffer_size) {
+        return func(buffer_size);
+    });
+};
+
+SEASTAR_TEST_CASE(test_requests_are_parsed) {
+    return for_each_fragment_size([] (size_t buffer_size) {
+        auto data = make_request(binary::opcode::set, std::string("\0\0\0\1\0\0\0\2", 8), "key1", "value", 7, 9)
+                + make_request(binary::opcode::getkq, "", "key2", "", 8)
+                + make_request(binary::opcode::noop, "", "", "");
+        auto is = make_lw_shared<input_stream<char>>(make_input_stream(make_packet(data, buffer_size)));
+        auto p = make_lw_shared<parser_type>();
+        p->init();
+        return is->consume(*p).then([is, p] {
+            BOOST_REQUIRE(p->_state == parser_type::state::done);
+            BOOST_REQUIRE_EQUAL(p->_header.opcode, uint8_t(binary::opcode::set));
+            BOOST_REQUIRE_EQUAL(p->_header.opaque, 7u);
+            BOOST_REQUIRE_EQUAL(p->_header.cas, 9u);
+            BOOST_REQUIRE_EQUAL(p->_extras.size(), 8u);
+            BOOST_REQUIRE_EQUAL(read_be<uint32_t>(p->_extras.begin()), 1u);
+            BOOST_REQUIRE_EQUAL(p->_key, "key1");
+            BOOST_REQUIRE_EQUAL(p->_value, "value");
+            p->init();
+            return is->consume(*p);
+        }).then([is, p] {
+            BOOST_REQUIRE(p->_state == parser_type::state::done);
+            BOOST_REQUIRE_EQUAL(p->_header.opcode, uint8_t(binary::opcode::getkq));
+            BOOST_REQUIRE_EQUAL(p->_header.opaque, 8u);
+            BOOST_REQUIRE_EQUAL(p->_key, "key2");
+            BOOST_REQUIRE_EQUAL(p->_value, "");
+            p->init();
+            return is->consume(*p);
+        }).then([is, p] {
+            BOOST_REQUIRE(p->_state == parser_type::state::done);
+            BOOST_REQUIRE_EQUAL(p->_header.opcode, uint8_t(binary::opcode::noop));
+            p->init();
+            return is->consume(*p);
+        }).then([is, p] {
+            BOOST_REQUIRE(p->_state == parser_type::state::eof);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_truncated_request_is_an_error) {
+    return for_each_fragment_size([] (size_t buffer_size) {
+        auto data = make_request(binary::opcode::set, std::string(8, '\0'), "key", "value");
+        data.resize(data.size() - 1);
+        auto is = make_lw_shared<input_stream<char>>(make_input_stream(make_packet(data, buffer_size)));
+        auto p = make_lw_shared<parser_type>();
+        p->init();
+        return is->consume(*p).then([is, p] {
+            BOOST_REQUIRE(p->_state == parser_type::state::error);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_bad_magic_is_an_error) {
+    auto data = make_request(binary::opcode::noop, "", "", "");
+    data[0] = char(binary::response_magic);
+    auto is = make_lw_shared<input_stream<char>>(make_input_stream(make_packet(data, 100)));
+    auto p = make_lw_shared<parser_type>();
+    p->init();
+    return is->consume(*p).then([is, p] {
+        BOOST_REQUIRE(p->_state == parser_type::state::error);
+    });
+}
@@ -0,0 +1,69 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+
+#define BOOST_TEST_MODULE memcached
+
+#include <boost/test/included/unit_test.hpp>
+#include <chrono>
+#include "apps/memcached/hot_keys.hh"
+
+using namespace memcache;
+using namespace std::chrono_literals;
+
+using clock_type = std::chrono::steady_clock;
+
+static unsigned count_hot(hot_key_detector<clock_type>& d, size_t hash, unsigned reads, clock_type::time_point now) {
+    unsigned hot = 0;
+    for (unsigned i = 0; i < reads; ++i) {
+        hot += d.record(hash, now);
+    }
+    return hot;
+}
+
+BOOST_AUTO_TEST_CASE(test_disabled_by_default) {
+    hot_key_detector<clock_type> d;
+    BOOST_REQUIRE(!d.enabled());
+    BOOST_REQUIRE_EQUAL(count_hot(d, 1, 100000, clock_type::now()), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_hot_key_is_reported_once_per_second) {
+    hot_key_detector<clock_type> d(1000);
+    auto now = clock_type::now();
+    BOOST_REQUIRE_EQUAL(count_hot(d, 42, 900, now), 0u);
+    BOOST_REQUIRE_EQUAL(count_hot(d, 42, 10000, now), 1u);
+    // the counts restart with the next second
+    BOOST_REQUIRE_EQUAL(count_hot(d, 42, 10000, now + 1s), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(test_cold_keys_are_not_reported) {
+    hot_key_detector<clock_type> d(1000);
+    auto now = clock_type::now();
+    unsigned hot = 0;
+    // many keys, each read a few times, share the counters
+    for (unsigned round = 0; round < 10; ++round) {
+        for (size_t key = 0; key < 1000; ++key) {
+            hot += d.record(key * 0x9e3779b97f4a7c15ULL, now);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(hot, 0u);
+}
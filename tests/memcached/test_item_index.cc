@@ -0,0 +1,156 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+
+#define BOOST_TEST_MODULE memcached
+
+#include <boost/test/included/unit_test.hpp>
+#include <memory>
+#include <set>
+#include <vector>
+#include "apps/memcached/item_index.hh"
+
+using namespace memcache;
+
+struct entry {
+    size_t hash;
+    unsigned id;
+};
+
+struct entry_hash {
+    size_t operator()(const entry& e) const {
+        return e.hash;
+    }
+};
+
+using index_type = item_index<entry, entry_hash>;
+
+static entry* find(index_type& index, const entry& e) {
+    return index.find(e.hash, [&e] (const entry& x) { return x.id == e.id; });
+}
+
+static std::vector<std::unique_ptr<entry>> make_entries(unsigned n, size_t (*hash)(unsigned)) {
+    std::vector<std::unique_ptr<entry>> entries;
+    for (unsigned i = 0; i < n; ++i) {
+        entries.emplace_back(new entry{hash(i), i});
+    }
+    return entries;
+}
+
+static size_t spread_hash(unsigned i) {
+    return size_t(i) * 0x9e3779b97f4a7c15ULL;
+}
+
+BOOST_AUTO_TEST_CASE(test_insert_find_erase) {
+    index_type index(1);
+    auto entries = make_entries(10000, spread_hash);
+    for (auto& e : entries) {
+        BOOST_REQUIRE(!find(index, *e));
+        index.insert(e.get());
+        BOOST_REQUIRE_EQUAL(find(index, *e), e.get());
+    }
+    BOOST_REQUIRE_EQUAL(index.size(), entries.size());
+    BOOST_REQUIRE(index.resizes() > 0);
+    for (auto& e : entries) {
+        BOOST_REQUIRE_EQUAL(find(index, *e), e.get());
+    }
+    for (unsigned i = 0; i < entries.size(); i += 2) {
+        BOOST_REQUIRE(index.erase(entries[i].get()));
+        BOOST_REQUIRE(!index.erase(entries[i].get()));
+    }
+    BOOST_REQUIRE_EQUAL(index.size(), entries.size() / 2);
+    for (unsigned i = 0; i < entries.size(); ++i) {
+        BOOST_REQUIRE_EQUAL(find(index, *entries[i]), i % 2 ? entries[i].get() : nullptr);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_colliding_hashes) {
+    // every entry has the same tag and home group
+    index_type index(4);
+    auto entries = make_entries(100, [] (unsigned) { return size_t(42); });
+    for (auto& e : entries) {
+        index.insert(e.get());
+    }
+    for (auto& e : entries) {
+        BOOST_REQUIRE_EQUAL(find(index, *e), e.get());
+    }
+    for (unsigned i = 0; i < 50; ++i) {
+        BOOST_REQUIRE(index.erase(entries[i].get()));
+    }
+    for (unsigned i = 0; i < entries.size(); ++i) {
+        BOOST_REQUIRE_EQUAL(find(index, *entries[i]), i >= 50 ? entries[i].get() : nullptr);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_resizing_is_incremental) {
+    index_type index(64);
+    auto entries = make_entries(64 * index_type::group_slots * 3, spread_hash);
+    bool seen_resizing = false;
+    for (auto& e : entries) {
+        index.insert(e.get());
+        if (index.resizing()) {
+            seen_resizing = true;
+            // both tables are searched meanwhile
+            BOOST_REQUIRE_EQUAL(find(index, *entries.front()), entries.front().get());
+        }
+    }
+    BOOST_REQUIRE(seen_resizing);
+    for (auto& e : entries) {
+        BOOST_REQUIRE_EQUAL(find(index, *e), e.get());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_tombstones_do_not_exhaust_the_index) {
+    index_type index(8);
+    auto entries = make_entries(100000, spread_hash);
+    // churn through many more entries than the index holds at a time
+    for (unsigned i = 0; i < entries.size(); ++i) {
+        index.insert(entries[i].get());
+        if (i >= 10) {
+            BOOST_REQUIRE(index.erase(entries[i - 10].get()));
+        }
+    }
+    BOOST_REQUIRE_EQUAL(index.size(), 10u);
+    BOOST_REQUIRE(index.capacity() <= 8 * index_type::group_slots);
+}
+
+BOOST_AUTO_TEST_CASE(test_visit_and_clear) {
+    index_type index(2);
+    auto entries = make_entries(1000, spread_hash);
+    for (auto& e : entries) {
+        index.insert(e.get());
+    }
+    std::set<unsigned> visited;
+    size_t position = 0;
+    while (position < index.positions()) {
+        position = index.for_each(position, 3, [&visited] (entry* e) {
+            BOOST_REQUIRE(visited.insert(e->id).second);
+        });
+    }
+    BOOST_REQUIRE_EQUAL(visited.size(), entries.size());
+
+    size_t disposed = 0;
+    index.clear_and_dispose([&disposed] (entry*) { ++disposed; });
+    BOOST_REQUIRE_EQUAL(disposed, entries.size());
+    BOOST_REQUIRE_EQUAL(index.size(), 0u);
+    BOOST_REQUIRE(!find(index, *entries.front()));
+}
@@ -219,6 +219,66 @@ class TcpSpecificTests(MemcacheTest):
             time.sleep(0.1)
             self.assertEquals(curr_connections, int(self.getStat('curr_connections', call_fn=conn)))
 
+    def binary_call(self, requests):
+        s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        s.settimeout(1)
+        s.connect(server_addr)
+        s.send(b''.join(requests))
+        s.shutdown(socket.SHUT_WR)
+        data = recv_all(s)
+        s.close()
+        responses = []
+        while data:
+            magic, opcode, key_len, extras_len, _, status, body_len, opaque, cas = struct.unpack_from('>BBHBBHIIQ', data)
+            self.assertEqual(magic, 0x81)
+            body = data[24:24 + body_len]
+            responses.append((opcode, status, opaque, cas, body[:extras_len],
+                body[extras_len:extras_len + key_len], body[extras_len + key_len:]))
+            data = data[24 + body_len:]
+        return responses
+
+    @staticmethod
+    def binary_request(opcode, key=b'', value=b'', extras=b'', opaque=0, cas=0):
+        return struct.pack('>BBHBBHIIQ', 0x80, opcode, len(key), len(extras), 0, 0,
+            len(extras) + len(key) + len(value), opaque, cas) + extras + key + value
+
+    def test_binary_protocol(self):
+        req = self.binary_request
+        set_extras = struct.pack('>II', 5, 0)
+        r = self.binary_call([req(0x01, b'key', b'hello', set_extras, opaque=1),
+            req(0x00, b'key', opaque=2),
+            req(0x0c, b'missing', opaque=3),
+            req(0x0d, b'missing', opaque=4),
+            req(0x0d, b'key', opaque=5),
+            req(0x0a, opaque=6)])
+        self.assertEqual([(x[0], x[1], x[2]) for x in r],
+            [(0x01, 0, 1), (0x00, 0, 2), (0x0c, 1, 3), (0x0d, 0, 5), (0x0a, 0, 6)])
+        self.assertEqual(r[1][4], struct.pack('>I', 5))
+        self.assertEqual(r[1][6], b'hello')
+        self.assertEqual(r[2][5], b'missing')
+        self.assertEqual(r[3][5], b'key')
+        self.assertEqual(r[3][6], b'hello')
+        cas = r[1][3]
+        # the value is shared with the ascii protocol
+        self.assertEqual(call('get key\r\n'), b'VALUE key 5 5\r\nhello\r\nEND\r\n')
+
+        r = self.binary_call([req(0x01, b'key', b'aloha', set_extras, cas=cas + 1),
+            req(0x01, b'key', b'aloha', set_extras, cas=cas),
+            req(0x11, b'key2', b'1', set_extras),
+            req(0x05, b'key2', extras=struct.pack('>QQI', 2, 0, 0)),
+            req(0x05, b'counter', extras=struct.pack('>QQI', 1, 10, 0)),
+            req(0x06, b'nocounter', extras=struct.pack('>QQI', 1, 10, 0xffffffff)),
+            req(0x14, b'key2'),
+            req(0x04, b'key2'),
+            req(0x0b),
+            req(0x07)])
+        self.assertEqual([x[1] for x in r], [2, 0, 0, 0, 1, 1, 0, 0])
+        self.assertEqual(r[2][6], struct.pack('>Q', 3))
+        self.assertEqual(r[3][6], struct.pack('>Q', 10))
+        self.assertEqual(r[6][0], 0x0b)
+        self.assertEqual(r[7][0], 0x07)
+        self.assertEqual(call('get key\r\n'), b'VALUE key 5 5\r\naloha\r\nEND\r\n')
+
 class UdpSpecificTests(MemcacheTest):
     def test_large_response_is_split_into_mtu_chunks(self):
         max_datagram_size = 1400
@@ -535,6 +595,29 @@ class TestCommands(MemcacheTest):
         self.assertEqual(call('set key 0 0 2\r\n09\r\n'), b'STORED\r\n')
         self.assertEqual(call('decr key 1\r\n'), b'8\r\n')
 
+    def test_stats_shards(self):
+        resp = call('stats shards\r\n').decode()
+        self.assertRegex(resp, r'^STAT shards \d+\r\nSTAT key_hash fnv1a_64\r\nSTAT shard_port_base \d+\r\nEND\r\n$')
+
+    def test_meta_commands(self):
+        self.assertEqual(call('mn\r\n'), b'MN\r\n')
+        self.assertEqual(call('mg key v\r\n'), b'EN\r\n')
+        self.assertEqual(call('mg key v q\r\nmn\r\n'), b'MN\r\n')
+        self.assertEqual(call('ms key 5 F3\r\nhello\r\n'), b'HD\r\n')
+        self.assertEqual(call('mg key v f s k Oabc t\r\n'), b'VA 5 f3 s5 kkey Oabc t-1\r\nhello\r\n')
+        self.assertEqual(call('mg key\r\n'), b'HD\r\n')
+        self.assertEqual(call('get key\r\n'), b'VALUE key 3 5\r\nhello\r\nEND\r\n')
+        self.assertEqual(call('ms key 1 ME\r\na\r\n'), b'NS\r\n')
+        self.assertEqual(call('ms key2 1 MR\r\na\r\n'), b'NS\r\n')
+        self.assertEqual(call('ms key 1 q\r\na\r\nmn\r\n'), b'MN\r\n')
+        version = int(re.match(rb'HD c(\d+)', call('mg key c\r\n')).group(1))
+        self.assertEqual(call('ms key 1 C%d\r\nb\r\n' % (version + 1)), b'EX\r\n')
+        self.assertEqual(call('ms key 1 C%d\r\nb\r\n' % version), b'HD\r\n')
+        self.assertEqual(call('mg key v\r\n'), b'VA 1\r\nb\r\n')
+        self.assertEqual(call('mg key x\r\n'), b'CLIENT_ERROR invalid flag\r\n')
+        self.assertEqual(call('md key Oxyz\r\n'), b'HD Oxyz\r\n')
+        self.assertEqual(call('md key\r\n'), b'NF\r\n')
+
     def test_incr_and_decr_on_invalid_input(self):
         error_msg = b'CLIENT_ERROR cannot increment or decrement non-numeric value\r\n'
         for cmd in ['incr', 'decr']:
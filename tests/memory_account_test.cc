@@ -0,0 +1,82 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "tests/test-utils.hh"
+#include "core/memory_account.hh"
+#include "core/memory.hh"
+#include "core/reactor.hh"
+#include "net/api.hh"
+
+using namespace seastar;
+
+SEASTAR_TEST_CASE(test_hard_limit) {
+    memory_account acc("test_hard_limit", 100, 200);
+    BOOST_REQUIRE(acc.try_charge(150));
+    BOOST_REQUIRE(!acc.try_charge(51));
+    BOOST_REQUIRE(acc.try_charge(50));
+    BOOST_REQUIRE_EQUAL(acc.used(), 200u);
+    // charge() is for memory already allocated, and ignores the limit
+    acc.charge(10);
+    BOOST_REQUIRE_EQUAL(acc.used(), 210u);
+    acc.release(210);
+    BOOST_REQUIRE_EQUAL(acc.used(), 0u);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_admission_waits_for_soft_limit) {
+    if (memory::under_memory_pressure()) {
+        // admission is throttled regardless of the account
+        return make_ready_future<>();
+    }
+    auto acc = std::make_unique<memory_account>("test_admission", 100);
+    BOOST_REQUIRE(acc->wait_for_admission().available());
+    acc->charge(100);
+    BOOST_REQUIRE(acc->should_throttle());
+    auto f = acc->wait_for_admission();
+    BOOST_REQUIRE(!f.available());
+    acc->release(1);
+    return f.then([acc = std::move(acc)] {
+        BOOST_REQUIRE(!acc->should_throttle());
+    });
+}
+
+SEASTAR_TEST_CASE(test_receive_buffers_shrink_as_budget_fills) {
+    auto& budget = net::receive_memory();
+    auto soft_limit = budget.soft_limit();
+    auto hard_limit = budget.hard_limit();
+    // nothing else receives on this shard
+    BOOST_REQUIRE_EQUAL(budget.used(), 0u);
+    budget.set_limits(1000, hard_limit);
+    BOOST_REQUIRE_EQUAL(net::receive_buffer_size(8192, 1024), 8192u);
+    budget.charge(500);
+    BOOST_REQUIRE_EQUAL(net::receive_buffer_size(8192, 1024), 8192u);
+    // what is left of the second half of the budget
+    budget.charge(250);
+    BOOST_REQUIRE_EQUAL(net::receive_buffer_size(8192, 1024), 1024u + (8192u - 1024u) / 2);
+    budget.charge(250);
+    BOOST_REQUIRE_EQUAL(net::receive_buffer_size(8192, 1024), 1024u);
+    // never grows what was asked for
+    BOOST_REQUIRE_EQUAL(net::receive_buffer_size(512, 1024), 512u);
+    budget.release(1000);
+    budget.set_limits(soft_limit, hard_limit);
+    BOOST_REQUIRE_EQUAL(net::receive_buffer_size(8192, 1024), 8192u);
+    return make_ready_future<>();
+}
@@ -0,0 +1,119 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <cstring>
+#include <fcntl.h>
+#include "tests/test-utils.hh"
+#include "core/metrics_mmap.hh"
+#include "core/metrics.hh"
+#include "core/posix.hh"
+#include "core/reactor.hh"
+#include "core/sleep.hh"
+#include "core/thread.hh"
+
+using namespace seastar;
+using namespace std::chrono_literals;
+
+// Reads a snapshot of the values of a file, as a sidecar would
+static std::map<sstring, double> read_values(const sstring& path) {
+    auto fd = file_desc::open(path, O_RDONLY);
+    auto size = fd.size();
+    auto map = fd.map_shared_ro(size, 0);
+    auto header = reinterpret_cast<metrics_mmap::file_header*>(map.get());
+    BOOST_REQUIRE(std::equal(header->magic, header->magic + 8, metrics_mmap::file_header::magic_value));
+    BOOST_REQUIRE(!header->stale.load());
+    std::vector<uint64_t> raw(header->nr_values);
+    uint64_t seq;
+    do {
+        seq = header->sequence.load(std::memory_order_acquire);
+        std::memcpy(raw.data(), map.get() + header->values_offset, raw.size() * 8);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != header->sequence.load(std::memory_order_relaxed));
+
+    std::map<sstring, double> ret;
+    auto p = map.get() + header->names_offset;
+    for (auto& r : raw) {
+        auto type = metrics_mmap::value_type(*p);
+        uint16_t len;
+        std::memcpy(&len, p + 2, sizeof(len));
+        sstring name(p + 4, len);
+        p += 4 + len;
+        switch (type) {
+        case metrics_mmap::value_type::floating: {
+            double d;
+            std::memcpy(&d, &r, sizeof(d));
+            ret[name] = d;
+            break;
+        }
+        case metrics_mmap::value_type::unsigned_integer:
+            ret[name] = r;
+            break;
+        case metrics_mmap::value_type::signed_integer:
+            ret[name] = int64_t(r);
+            break;
+        }
+    }
+    return ret;
+}
+
+SEASTAR_TEST_CASE(test_values_are_exported) {
+    return seastar::async([] {
+        namespace sm = metrics;
+        double gauge = 1.5;
+        uint64_t counter = 7;
+        sm::metric_groups metrics;
+        metrics.add_group("mmap_test", {
+            sm::make_gauge("gauge", [&gauge] { return gauge; }, sm::description("a gauge")),
+            sm::make_derive("counter", counter, sm::description("a counter"), {sm::label("kind")("a")}),
+        });
+
+        metrics_mmap::config cfg;
+        cfg.path = "/tmp/metrics_mmap_test";
+        cfg.period = 10ms;
+        metrics_mmap::start(cfg).get();
+        auto path = sprint("%s-%d", cfg.path, engine().cpu_id());
+        sleep(50ms).get();
+        auto values = read_values(path);
+        BOOST_REQUIRE_EQUAL(values.at("mmap_test_gauge"), 1.5);
+        BOOST_REQUIRE_EQUAL(values.at("mmap_test_counter{kind=\"a\"}"), 7);
+
+        gauge = -2;
+        counter = 9;
+        sleep(50ms).get();
+        values = read_values(path);
+        BOOST_REQUIRE_EQUAL(values.at("mmap_test_gauge"), -2);
+        BOOST_REQUIRE_EQUAL(values.at("mmap_test_counter{kind=\"a\"}"), 9);
+
+        // a new metric changes the layout: the file is replaced
+        sm::metric_groups more;
+        more.add_group("mmap_test", {
+            sm::make_gauge("other", [] { return 3; }, sm::description("another gauge")),
+        });
+        sleep(50ms).get();
+        values = read_values(path);
+        BOOST_REQUIRE_EQUAL(values.at("mmap_test_other"), 3);
+        BOOST_REQUIRE_EQUAL(values.at("mmap_test_gauge"), -2);
+
+        metrics_mmap::stop().get();
+        BOOST_REQUIRE_EQUAL(::access(path.c_str(), F_OK), -1);
+    });
+}
@@ -0,0 +1,91 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "tests/test-utils.hh"
+#include "core/node_shared.hh"
+#include "core/reactor.hh"
+#include <set>
+
+using namespace seastar;
+
+namespace {
+
+struct table {
+    static std::atomic<int> live;
+    int version;
+    explicit table(int v) : version(v) { ++live; }
+    ~table() { --live; }
+};
+
+std::atomic<int> table::live = { 0 };
+
+}
+
+SEASTAR_TEST_CASE(test_shards_of_a_node_share_one_copy) {
+    auto ns = make_lw_shared<node_shared<table>>();
+    BOOST_REQUIRE(ns->get() == nullptr);
+    return ns->publish([] { return table(1); }).then([ns] {
+        auto& n = *ns;
+        auto copies = make_lw_shared<std::vector<const table*>>(smp::count);
+        return parallel_for_each(smp::all_cpus(), [&n, copies] (unsigned s) {
+            return smp::submit_to(s, [&n] {
+                return n.get();
+            }).then([copies, s] (const table* p) {
+                BOOST_REQUIRE_EQUAL(p->version, 1);
+                (*copies)[s] = p;
+            });
+        }).then([copies] {
+            // shards read the copy of their node
+            for (auto s : smp::all_cpus()) {
+                for (auto t : smp::all_cpus()) {
+                    BOOST_REQUIRE_EQUAL((*copies)[s] == (*copies)[t], smp::numa_node(s) == smp::numa_node(t));
+                }
+            }
+        }).then([ns] {
+            return ns->publish([] { return table(2); });
+        }).then([ns] {
+            BOOST_REQUIRE_EQUAL(ns->get()->version, 2);
+            // the first version was retired
+            std::set<unsigned> nodes;
+            for (auto s : smp::all_cpus()) {
+                nodes.insert(smp::numa_node(s));
+            }
+            BOOST_REQUIRE_EQUAL(table::live.load(), int(nodes.size()));
+            return ns->stop();
+        }).then([ns] {
+            BOOST_REQUIRE_EQUAL(table::live.load(), 0);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_failed_publish_keeps_old_copies) {
+    auto ns = make_lw_shared<node_shared<table>>();
+    return ns->publish([] { return table(1); }).then([ns] {
+        return ns->publish([] () -> table {
+            throw std::runtime_error("make failed");
+        }).then_wrapped([ns] (future<> f) {
+            BOOST_REQUIRE(f.failed());
+            f.ignore_ready_future();
+            BOOST_REQUIRE_EQUAL(ns->get()->version, 1);
+            return ns->stop();
+        });
+    });
+}
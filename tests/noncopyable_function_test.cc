@@ -60,13 +60,14 @@ struct payload {
 template <size_t Extra>
 unsigned payload<Extra>::live;
 
-template <size_t Extra>
+template <size_t Extra, size_t InlineSize = noncopyable_function_default_inline_size>
 void do_move_tests() {
     using payload = ::payload<Extra>;
-    auto f1 = noncopyable_function<int ()>(payload(3));
+    using function = noncopyable_function<int (), InlineSize>;
+    auto f1 = function(payload(3));
     BOOST_REQUIRE_EQUAL(payload::live, 1);
     BOOST_REQUIRE_EQUAL(f1(), 3);
-    auto f2 = noncopyable_function<int ()>();
+    auto f2 = function();
     BOOST_CHECK_THROW(f2(), std::bad_function_call);
     f2 = std::move(f1);
     BOOST_CHECK_THROW(f1(), std::bad_function_call);
@@ -85,3 +86,21 @@ BOOST_AUTO_TEST_CASE(large_move_tests) {
     do_move_tests<1000>();
 }
 
+BOOST_AUTO_TEST_CASE(larger_inline_size_tests) {
+    static_assert(sizeof(noncopyable_function<int (), 64>) >= 64 + sizeof(void*), "inline storage not enlarged");
+    do_move_tests<40, 64>();
+    do_move_tests<1000, 64>();
+}
+
+BOOST_AUTO_TEST_CASE(throwing_move_tests) {
+    struct throwing_move {
+        int v;
+        throwing_move(int x) : v(x) {}
+        throwing_move(throwing_move&& x) noexcept(false) : v(x.v) {}
+        int operator()() const { return v; }
+    };
+    auto f1 = noncopyable_function<int ()>(throwing_move(7));
+    auto f2 = std::move(f1);
+    BOOST_REQUIRE_EQUAL(f2(), 7);
+}
+
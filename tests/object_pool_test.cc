@@ -0,0 +1,102 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "tests/test-utils.hh"
+#include "core/object_pool.hh"
+#include "core/future-util.hh"
+#include <set>
+
+using namespace seastar;
+
+namespace {
+
+struct counted {
+    static int live;
+    int value;
+    explicit counted(int v = 0) : value(v) { ++live; }
+    ~counted() { --live; }
+};
+
+int counted::live = 0;
+
+}
+
+SEASTAR_TEST_CASE(test_pool_grows_and_recycles) {
+    object_pool<counted> pool(object_pool_config{4, 8});
+    std::vector<counted*> objs;
+    for (int i = 0; i < 20; ++i) {
+        objs.push_back(pool.allocate(i));
+    }
+    BOOST_REQUIRE_EQUAL(counted::live, 20);
+    BOOST_REQUIRE_EQUAL(pool.size(), 20u);
+    // blocks of 4, 8 and 8 objects
+    BOOST_REQUIRE_EQUAL(pool.capacity(), 20u);
+    std::set<counted*> addresses(objs.begin(), objs.end());
+    for (auto p : objs) {
+        pool.deallocate(p);
+    }
+    BOOST_REQUIRE_EQUAL(counted::live, 0);
+    BOOST_REQUIRE_EQUAL(pool.free_objects(), 20u);
+    // freed objects are handed out again before the pool grows
+    for (int i = 0; i < 20; ++i) {
+        auto p = pool.allocate(i);
+        BOOST_REQUIRE(addresses.count(p));
+        pool.deallocate(p);
+    }
+    BOOST_REQUIRE_EQUAL(pool.capacity(), 20u);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_reused_objects_are_not_reconstructed) {
+    {
+        object_pool<counted, true> pool;
+        auto p = pool.allocate();
+        p->value = 42;
+        pool.deallocate(p);
+        BOOST_REQUIRE_EQUAL(counted::live, 1);
+        auto q = pool.allocate();
+        BOOST_REQUIRE_EQUAL(q, p);
+        BOOST_REQUIRE_EQUAL(q->value, 42);
+        pool.deallocate(q);
+    }
+    BOOST_REQUIRE_EQUAL(counted::live, 0);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_objects_return_to_owner_shard) {
+    if (smp::count < 2) {
+        return make_ready_future<>();
+    }
+    auto pool = std::make_unique<object_pool<counted>>();
+    auto p = pool->make(7);
+    BOOST_REQUIRE_EQUAL(pool->size(), 1u);
+    return smp::submit_to(1, [p = std::move(p)] () mutable {
+        BOOST_REQUIRE_EQUAL(p->value, 7);
+        p.reset();
+    }).then([pool = std::move(pool)] () mutable {
+        auto& r = *pool;
+        return do_until([&r] { return r.size() == 0; }, [] {
+            return later();
+        }).finally([pool = std::move(pool)] {
+            BOOST_REQUIRE_EQUAL(counted::live, 0);
+        });
+    });
+}
@@ -25,6 +25,7 @@
 #include "core/vector-data-sink.hh"
 #include "core/future-util.hh"
 #include "core/sstring.hh"
+#include "core/thread.hh"
 #include "net/packet.hh"
 #include "test-utils.hh"
 #include <vector>
@@ -43,6 +44,7 @@ static sstring to_sstring(const packet& p) {
 
 struct stream_maker {
     bool _trim = false;
+    bool _batch = false;
     size_t _size;
 
     stream_maker size(size_t size) && {
@@ -55,8 +57,13 @@ struct stream_maker {
         return std::move(*this);
     }
 
+    stream_maker batch_flushes(bool batch) && {
+        _batch = batch;
+        return std::move(*this);
+    }
+
     lw_shared_ptr<output_stream<char>> operator()(data_sink sink) {
-        return make_lw_shared<output_stream<char>>(std::move(sink), _size, _trim);
+        return make_lw_shared<output_stream<char>>(std::move(sink), _size, _trim, _batch);
     }
 };
 
@@ -119,6 +126,35 @@ SEASTAR_TEST_CASE(test_splitting_with_trimming) {
         ;
 }
 
+SEASTAR_TEST_CASE(test_corking_with_batch_flushes) {
+    // what fills the buffer is corked, and put with what close() flushes
+    auto ctor = stream_maker().trim(false).batch_flushes(true).size(4);
+    return now()
+        .then([=] { return assert_split(ctor, {"1"}, {"1"}); })
+        .then([=] { return assert_split(ctor, {"12", "345"}, {"12345"}); })
+        .then([=] { return assert_split(ctor, {"1234567890"}, {"1234567890"}); })
+        .then([=] { return assert_split(ctor, {"1", "23456", "78", "9"}, {"123456789"}); })
+        ;
+}
+
+SEASTAR_TEST_CASE(test_corked_writer_waits_for_the_sink) {
+    return seastar::async([] {
+        auto v = make_shared<std::vector<packet>>();
+        auto out = stream_maker().trim(false).batch_flushes(true).size(4096)(data_sink(std::make_unique<vector_data_sink>(*v)));
+        sstring big(100 * 1024, 'x');
+        // past max_corked bytes, the writes wait for what is corked to be put
+        out->write(big).get();
+        BOOST_REQUIRE_EQUAL(v->size(), 1u);
+        out->write("1").get();
+        out->write(big).get();
+        BOOST_REQUIRE_EQUAL(v->size(), 2u);
+        out->close().get();
+        BOOST_REQUIRE_EQUAL(v->size(), 2u);
+        BOOST_REQUIRE(to_sstring((*v)[0]) == big);
+        BOOST_REQUIRE(to_sstring((*v)[1]) == sstring("1") + big);
+    });
+}
+
 SEASTAR_TEST_CASE(test_flush_on_empty_buffer_does_not_push_empty_packet_down_stream) {
     auto v = make_shared<std::vector<packet>>();
     auto out = make_shared<output_stream<char>>(
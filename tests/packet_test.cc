@@ -65,3 +65,34 @@ BOOST_AUTO_TEST_CASE(test_headers_are_contiguous_even_with_many_fragments) {
     BOOST_REQUIRE_EQUAL(p.nr_frags(), 9);
 }
 
+
+BOOST_AUTO_TEST_CASE(test_header_after_trim_back) {
+    char data[100];
+    for (unsigned i = 0; i < sizeof(data); ++i) {
+        data[i] = i;
+    }
+    packet p(fragment{data, sizeof(data)});
+    p.trim_back(60);
+    auto h = p.prepend_uninitialized_header(50);
+    std::fill_n(h, 50, 'h');
+    // grow the fragment array, which copies the internal data
+    for (int i = 0; i < 9; ++i) {
+        p.append(packet(fragment{data, 10}));
+    }
+    BOOST_REQUIRE_EQUAL(p.len(), 50u + 40 + 90);
+    BOOST_REQUIRE_EQUAL(p.frag(0).size, 50u);
+    BOOST_REQUIRE(std::all_of(p.frag(0).base, p.frag(0).base + 50, [] (char c) { return c == 'h'; }));
+    BOOST_REQUIRE_EQUAL(p.frag(1).size, 40u);
+    BOOST_REQUIRE(std::equal(p.frag(1).base, p.frag(1).base + 40, data));
+}
+
+BOOST_AUTO_TEST_CASE(test_impl_blocks_are_reused) {
+    char data[10] = {};
+    // the internal data is at the same place in the same block
+    auto freed = packet(fragment{data, sizeof(data)}).frag(0).base;
+    for (int i = 0; i < 100; ++i) {
+        packet p(fragment{data, sizeof(data)});
+        BOOST_REQUIRE_EQUAL(static_cast<void*>(p.frag(0).base), static_cast<void*>(freed));
+        BOOST_REQUIRE_EQUAL(reinterpret_cast<uintptr_t>(p.frag(0).base + sizeof(data)) % cache_line_size, 0u);
+    }
+}
@@ -0,0 +1,91 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+// Measures the cost of a continuation: on a ready future returning a plain
+// value (the cache hit case), on a ready future returning a future, and on a
+// future that is fulfilled later, which allocates a task.
+
+#include "../../core/reactor.hh"
+#include "../../core/app-template.hh"
+#include "../../core/future-util.hh"
+#include "../../core/print.hh"
+#include <chrono>
+
+using namespace seastar;
+
+using fnanoseconds = std::chrono::duration<double, std::nano>;
+
+// Keeps the compiler from folding the chain away
+static int sink;
+
+template <typename Func>
+static void report(const char* name, unsigned nr, Func&& func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+    print("%-24s %10.1f ns/continuation\n", name, fnanoseconds(end - start).count() / nr);
+}
+
+static void ready_value_chain(unsigned nr) {
+    auto f = make_ready_future<int>(0);
+    for (unsigned i = 0; i < nr; ++i) {
+        f = f.then([] (int x) { return x + 1; });
+    }
+    sink = f.get0();
+}
+
+static void ready_future_chain(unsigned nr) {
+    auto f = make_ready_future<int>(0);
+    for (unsigned i = 0; i < nr; ++i) {
+        f = f.then([] (int x) { return make_ready_future<int>(x + 1); });
+    }
+    // may have been deferred if preemption was due
+    sink = f.available() ? f.get0() : 0;
+}
+
+static future<> deferred_chain(unsigned nr) {
+    return do_with(unsigned(0), [nr] (unsigned& i) {
+        return do_until([&i, nr] { return i == nr; }, [&i] {
+            promise<int> pr;
+            auto f = pr.get_future().then([&i] (int x) { i += x; });
+            pr.set_value(1);
+            return f;
+        });
+    });
+}
+
+int main(int ac, char** av) {
+    app_template at;
+    namespace bpo = boost::program_options;
+    at.add_options()
+            ("continuations", bpo::value<unsigned>()->default_value(10000000), "Continuations to run per test")
+            ;
+    return at.run(ac, av, [&at] {
+        auto nr = at.configuration()["continuations"].as<unsigned>();
+        report("ready, value", nr, [nr] { ready_value_chain(nr); });
+        report("ready, future", nr, [nr] { ready_future_chain(nr); });
+        auto start = std::chrono::steady_clock::now();
+        return deferred_chain(nr).then([nr, start] {
+            auto end = std::chrono::steady_clock::now();
+            print("%-24s %10.1f ns/continuation\n", "deferred", fnanoseconds(end - start).count() / nr);
+        });
+    });
+}
@@ -0,0 +1,113 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+// Microbenchmarks of the reactor's building blocks: continuations, cross
+// shard calls, timers and semaphores.
+
+#include <chrono>
+#include "perf_tests.hh"
+#include "../../core/future-util.hh"
+#include "../../core/reactor.hh"
+#include "../../core/semaphore.hh"
+#include "../../core/sleep.hh"
+#include "../../core/timer.hh"
+
+using namespace seastar;
+
+PERF_TEST(future, ready_then) {
+    auto f = make_ready_future<int>(1).then([] (int x) { return x + 1; });
+    perf_tests::do_not_optimize(f.get0());
+}
+
+PERF_TEST(future, ready_then_chain_of_4) {
+    auto f = make_ready_future<int>(1).then([] (int x) {
+        return x + 1;
+    }).then([] (int x) {
+        return make_ready_future<int>(x + 1);
+    }).then([] (int x) {
+        return x + 1;
+    }).then([] (int x) {
+        return x + 1;
+    });
+    perf_tests::do_not_optimize(f.available() ? f.get0() : 0);
+}
+
+// a continuation on a future that is not ready yet, so it allocates a task
+PERF_TEST(future, deferred_then) {
+    promise<int> pr;
+    auto f = pr.get_future().then([] (int x) { perf_tests::do_not_optimize(x); });
+    pr.set_value(1);
+    return f;
+}
+
+PERF_TEST(future, exception) {
+    auto f = make_exception_future<int>(std::runtime_error("perf")).then_wrapped([] (future<int> f) {
+        f.ignore_ready_future();
+    });
+    perf_tests::do_not_optimize(f.available());
+}
+
+PERF_TEST(smp, submit_to_next_shard) {
+    return smp::submit_to((engine().cpu_id() + 1) % smp::count, [] {
+        return 1;
+    }).then([] (int x) {
+        perf_tests::do_not_optimize(x);
+    });
+}
+
+PERF_TEST(smp, submit_to_self) {
+    return smp::submit_to(engine().cpu_id(), [] {
+        return 1;
+    }).then([] (int x) {
+        perf_tests::do_not_optimize(x);
+    });
+}
+
+PERF_TEST(timer, arm_cancel) {
+    timer<> t([] {});
+    t.arm(std::chrono::seconds(10));
+    t.cancel();
+}
+
+PERF_TEST(timer, sleep_0) {
+    return sleep(std::chrono::microseconds(0));
+}
+
+PERF_TEST(semaphore, wait_signal) {
+    static thread_local semaphore sem(1);
+    auto f = sem.wait();
+    sem.signal();
+    return f;
+}
+
+PERF_TEST(semaphore, with_semaphore) {
+    static thread_local semaphore sem(1);
+    return with_semaphore(sem, 1, [] {});
+}
+
+// waits before the unit is there, so the waiter is queued
+PERF_TEST(semaphore, contended) {
+    static thread_local semaphore sem(0);
+    auto f = sem.wait();
+    sem.signal();
+    return f;
+}
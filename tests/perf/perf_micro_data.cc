@@ -0,0 +1,96 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+// Microbenchmarks of the data types on the I/O paths: sstring and packet.
+
+#include "perf_tests.hh"
+#include "../../core/print.hh"
+#include "../../core/sstring.hh"
+#include "../../net/packet.hh"
+
+using namespace seastar;
+
+static const char long_text[] = "a string too long for the small string optimization";
+
+PERF_TEST(sstring, construct_short) {
+    sstring s("short");
+    perf_tests::do_not_optimize(s);
+}
+
+PERF_TEST(sstring, construct_long) {
+    sstring s(long_text);
+    perf_tests::do_not_optimize(s);
+}
+
+PERF_TEST(sstring, append) {
+    sstring s("key:");
+    s += sstring("value");
+    perf_tests::do_not_optimize(s);
+}
+
+PERF_TEST(sstring, to_sstring) {
+    auto s = to_sstring(1234567);
+    perf_tests::do_not_optimize(s);
+}
+
+PERF_TEST(sstring, compare) {
+    static thread_local sstring a(long_text), b(long_text);
+    perf_tests::do_not_optimize(a == b);
+}
+
+PERF_TEST(sstring, sprint) {
+    auto s = sprint("%s=%d", "key", 42);
+    perf_tests::do_not_optimize(s);
+}
+
+PERF_TEST(packet, copy_construct) {
+    net::packet p(long_text, sizeof(long_text));
+    perf_tests::do_not_optimize(p.len());
+}
+
+PERF_TEST(packet, prepend_header) {
+    net::packet p(long_text, sizeof(long_text));
+    auto h = p.prepend_header<uint64_t>();
+    *h = 0;
+    perf_tests::do_not_optimize(p.len());
+}
+
+PERF_TEST(packet, append_fragments) {
+    net::packet p;
+    for (int i = 0; i < 4; ++i) {
+        p = net::packet(std::move(p), net::fragment{const_cast<char*>(long_text), sizeof(long_text)}, deleter());
+    }
+    perf_tests::do_not_optimize(p.nr_frags());
+}
+
+PERF_TEST(packet, share) {
+    static thread_local net::packet p(long_text, sizeof(long_text));
+    auto q = p.share(4, 16);
+    perf_tests::do_not_optimize(q.len());
+}
+
+PERF_TEST(packet, trim_front_linearize) {
+    net::packet p(net::fragment{const_cast<char*>(long_text), 10}, net::packet(long_text, sizeof(long_text)));
+    p.trim_front(4);
+    p.linearize();
+    perf_tests::do_not_optimize(p.len());
+}
@@ -0,0 +1,79 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+// Measures creating, moving twice (as into a task and out of it), calling
+// and destroying a noncopyable_function, for captures of various sizes and
+// inline storage of 32 (the default) and 64 bytes; captures that do not fit
+// are allocated.
+
+#include "../../util/noncopyable_function.hh"
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+using namespace seastar;
+
+// Keeps the compiler from folding the calls away
+static volatile unsigned sink;
+
+template <size_t Capture>
+struct capture {
+    std::array<unsigned char, Capture> data;
+    unsigned operator()() const {
+        return data[0] + data[Capture - 1];
+    }
+};
+
+template <size_t Capture, size_t InlineSize>
+static double run(size_t nr) {
+    using function = noncopyable_function<unsigned (), InlineSize>;
+    capture<Capture> c{};
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nr; ++i) {
+        c.data[0] = i;
+        function f1(c);
+        function f2(std::move(f1));
+        function f3(std::move(f2));
+        sink = sink + f3();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / nr;
+}
+
+template <size_t Capture>
+static void report(size_t nr) {
+    std::cout << std::setw(12) << Capture
+              << std::setw(14) << std::fixed << std::setprecision(1) << run<Capture, 32>(nr)
+              << std::setw(14) << run<Capture, 64>(nr) << "\n";
+}
+
+int main(int ac, char** av) {
+    size_t nr = ac > 1 ? std::strtoull(av[1], nullptr, 0) : 10000000;
+    std::cout << std::setw(12) << "capture" << std::setw(14) << "32 (ns)" << std::setw(14) << "64 (ns)" << "\n";
+    report<16>(nr);
+    report<32>(nr);
+    report<40>(nr);
+    report<48>(nr);
+    report<64>(nr);
+    report<96>(nr);
+}
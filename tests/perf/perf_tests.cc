@@ -0,0 +1,185 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <algorithm>
+#include <chrono>
+#include <regex>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "perf_tests.hh"
+#include "../../core/app-template.hh"
+#include "../../core/memory.hh"
+#include "../../core/print.hh"
+#include "../../core/reactor.hh"
+#include "../../core/thread.hh"
+
+using namespace seastar;
+
+namespace perf_tests {
+
+namespace internal {
+
+static std::vector<std::unique_ptr<performance_test>>& all_tests() {
+    static std::vector<std::unique_ptr<performance_test>> tests;
+    return tests;
+}
+
+void register_test(std::unique_ptr<performance_test> test) {
+    all_tests().push_back(std::move(test));
+}
+
+}
+
+using namespace internal;
+
+using clock_type = std::chrono::steady_clock;
+using fnanoseconds = std::chrono::duration<double, std::nano>;
+
+// Counts the instructions the calling thread retires in user space, if the
+// kernel lets us
+class instruction_counter {
+    int _fd = -1;
+public:
+    instruction_counter() {
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    instruction_counter(const instruction_counter&) = delete;
+    ~instruction_counter() {
+        if (_fd >= 0) {
+            ::close(_fd);
+        }
+    }
+    bool available() const {
+        return _fd >= 0;
+    }
+    uint64_t read() const {
+        uint64_t v = 0;
+        if (_fd < 0 || ::read(_fd, &v, sizeof(v)) != sizeof(v)) {
+            return 0;
+        }
+        return v;
+    }
+};
+
+struct result {
+    double ns = 0;
+    double allocs = 0;
+    double instructions = 0; // negative if they could not be counted
+};
+
+// Runs one run of n operations
+static result measure(performance_test& test, size_t n, const instruction_counter& insns) {
+    auto mallocs = memory::stats().mallocs();
+    auto instructions = insns.read();
+    auto start = clock_type::now();
+    test.run(n).get();
+    auto end = clock_type::now();
+    result r;
+    r.instructions = insns.available() ? double(insns.read() - instructions) / n : -1;
+    r.allocs = double(memory::stats().mallocs() - mallocs) / n;
+    r.ns = fnanoseconds(end - start).count() / n;
+    return r;
+}
+
+// Runs a test on the calling shard, in a seastar::thread, and returns the
+// median of its runs
+static result run_on_shard(performance_test& test, clock_type::duration duration, unsigned runs) {
+    static thread_local instruction_counter insns;
+    // warm up, and find a batch size that is long enough to time
+    test.run(1).get();
+    size_t n = 1;
+    auto batch_time = clock_type::duration();
+    while (true) {
+        auto start = clock_type::now();
+        test.run(n).get();
+        batch_time = clock_type::now() - start;
+        if (batch_time >= std::chrono::milliseconds(1) || n >= (size_t(1) << 40)) {
+            break;
+        }
+        n *= 2;
+    }
+    n = std::max<size_t>(1, n * (double(duration.count()) / std::max<clock_type::rep>(1, batch_time.count())));
+    std::vector<result> results;
+    for (unsigned i = 0; i < runs; ++i) {
+        results.push_back(measure(test, n, insns));
+    }
+    auto by_time = [] (const result& a, const result& b) { return a.ns < b.ns; };
+    std::nth_element(results.begin(), results.begin() + runs / 2, results.end(), by_time);
+    return results[runs / 2];
+}
+
+static future<result> run_test(performance_test& test, clock_type::duration duration, unsigned runs) {
+    return map_reduce(smp::all_cpus(), [&test, duration, runs] (unsigned shard) {
+        return smp::submit_to(shard, [&test, duration, runs] {
+            return seastar::async([&test, duration, runs] {
+                return run_on_shard(test, duration, runs);
+            });
+        });
+    }, result(), [] (result a, result b) {
+        a.ns += b.ns / smp::count;
+        a.allocs += b.allocs / smp::count;
+        if (a.instructions >= 0 && b.instructions >= 0) {
+            a.instructions += b.instructions / smp::count;
+        } else {
+            a.instructions = -1;
+        }
+        return a;
+    });
+}
+
+}
+
+int main(int ac, char** av) {
+    using namespace perf_tests;
+    app_template at;
+    namespace bpo = boost::program_options;
+    at.add_options()
+            ("duration", bpo::value<double>()->default_value(0.1), "Length of a run, in seconds")
+            ("runs", bpo::value<unsigned>()->default_value(5), "Runs of each test; the median is reported")
+            ("filter", bpo::value<std::string>()->default_value(""), "Only run the tests whose group.name matches this regular expression")
+            ;
+    return at.run(ac, av, [&at] {
+        auto& cfg = at.configuration();
+        auto duration = std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(cfg["duration"].as<double>()));
+        auto runs = std::max(1u, cfg["runs"].as<unsigned>());
+        std::regex filter(cfg["filter"].as<std::string>());
+        print("%-40s %12s %12s %12s\n", "test", "ns/op", "allocs/op", "insns/op");
+        return do_for_each(all_tests(), [duration, runs, filter] (std::unique_ptr<performance_test>& test) {
+            auto name = test->group() + "." + test->name();
+            if (!std::regex_search(name.begin(), name.end(), filter)) {
+                return make_ready_future<>();
+            }
+            return run_test(*test, duration, runs).then([name] (result r) {
+                auto instructions = r.instructions < 0 ? sstring("n/a") : to_sstring(sprint("%.1f", r.instructions));
+                print("%-40s %12.2f %12.2f %12s\n", name, r.ns, r.allocs, instructions);
+            });
+        });
+    });
+}
@@ -0,0 +1,118 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#pragma once
+
+// A harness for microbenchmarks. A benchmark is registered with
+//
+//     PERF_TEST(group, name) {
+//         ... one operation ...
+//     }
+//
+// whose body runs one operation, and may return a future<> to wait for.
+// perf_tests.cc provides main(): it runs the benchmarks whose
+// "group.name" matches --filter, on every shard at once. Each benchmark is
+// warmed up, and sized so that a run takes about --duration; the median
+// over --runs runs is reported as time, allocations and (where the kernel
+// lets us count them) instructions per operation, averaged over the
+// shards.
+
+#include <memory>
+#include <type_traits>
+#include "core/future.hh"
+#include "core/future-util.hh"
+#include "core/sstring.hh"
+
+namespace perf_tests {
+
+// Keeps the compiler from optimizing v, or the computation of v, away
+template <typename T>
+inline void do_not_optimize(const T& v) {
+    asm volatile("" : : "r,m"(v) : "memory");
+}
+
+namespace internal {
+
+class performance_test {
+    seastar::sstring _group;
+    seastar::sstring _name;
+public:
+    performance_test(seastar::sstring group, seastar::sstring name)
+        : _group(std::move(group)), _name(std::move(name)) {}
+    virtual ~performance_test() = default;
+    const seastar::sstring& group() const { return _group; }
+    const seastar::sstring& name() const { return _name; }
+    // Runs the operation n times
+    virtual seastar::future<> run(size_t n) = 0;
+};
+
+void register_test(std::unique_ptr<performance_test> test);
+
+// Test::run() is the body of a PERF_TEST
+template <typename Test>
+class concrete_performance_test final : public performance_test {
+private:
+    template <typename T = Test>
+    std::enable_if_t<std::is_void<decltype(T::run())>::value, seastar::future<>>
+    do_run(size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            Test::run();
+        }
+        return seastar::make_ready_future<>();
+    }
+    template <typename T = Test>
+    std::enable_if_t<!std::is_void<decltype(T::run())>::value, seastar::future<>>
+    do_run(size_t n) {
+        return seastar::do_with(size_t(0), [n] (size_t& i) {
+            return seastar::do_until([&i, n] { return i == n; }, [&i] {
+                ++i;
+                return Test::run();
+            });
+        });
+    }
+public:
+    using performance_test::performance_test;
+    virtual seastar::future<> run(size_t n) override {
+        return do_run(n);
+    }
+};
+
+// Its constructor is only instantiated at the end of the translation unit,
+// once the return type of Test::run() is known
+template <typename Test>
+struct test_registrar {
+    test_registrar(const char* group, const char* name) {
+        register_test(std::make_unique<concrete_performance_test<Test>>(group, name));
+    }
+};
+
+}
+
+}
+
+#define PERF_TEST(group, name) \
+    struct perf_test_##group##_##name { \
+        static auto run(); \
+    }; \
+    static ::perf_tests::internal::test_registrar<perf_test_##group##_##name> \
+            perf_test_registrar_##group##_##name(#group, #name); \
+    auto perf_test_##group##_##name::run()
@@ -0,0 +1,111 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+// Compares timer_set and timer_wheel with many outstanding timers that are
+// constantly re-armed, as TCP and connection timeouts are, while time advances.
+
+#include "../../core/timer-set.hh"
+#include "../../core/timer-wheel.hh"
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <cstdlib>
+
+using namespace seastar;
+
+struct bench_clock {
+    using rep = int64_t;
+    using period = std::milli;
+    using duration = std::chrono::duration<rep, period>;
+    using time_point = std::chrono::time_point<bench_clock, duration>;
+    static time_point now() { return time_point(); }
+};
+
+struct bench_timer {
+    using clock = bench_clock;
+    using duration = bench_clock::duration;
+    using time_point = bench_clock::time_point;
+    boost::intrusive::list_member_hook<> link;
+    time_point timeout;
+    bool queued = false;
+    time_point get_timeout() { return timeout; }
+    void cancel() { }
+};
+
+template <typename Set>
+static void run(const char* name, size_t nr_timers, size_t nr_ops) {
+    std::default_random_engine rnd(0);
+    // timeouts between 200ms and 60s, as for retransmission and idle timers
+    std::uniform_int_distribution<int64_t> delay(200, 60000);
+    std::vector<bench_timer> timers(nr_timers);
+    Set set;
+    int64_t now = 0;
+    size_t expired = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto& t : timers) {
+        t.timeout = bench_clock::time_point(bench_clock::duration(now + delay(rnd)));
+        t.queued = true;
+        set.insert(t);
+    }
+    auto armed = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nr_ops; ++i) {
+        auto& t = timers[rnd() % nr_timers];
+        if (t.queued) {
+            set.remove(t);
+        }
+        t.timeout = bench_clock::time_point(bench_clock::duration(now + delay(rnd)));
+        t.queued = true;
+        set.insert(t);
+        // advance time by one 10ms tick every 1000 operations
+        if (i % 1000 == 0) {
+            now += 10;
+            auto exp = set.expire(bench_clock::time_point(bench_clock::duration(now)));
+            for (auto& t : exp) {
+                t.queued = false;
+                ++expired;
+            }
+            exp.clear();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    set.clear();
+
+    using fseconds = std::chrono::duration<double>;
+    auto arm_time = std::chrono::duration_cast<fseconds>(armed - start).count();
+    auto churn_time = std::chrono::duration_cast<fseconds>(end - armed).count();
+    std::cout << std::setw(12) << name
+              << std::setw(12) << nr_timers
+              << std::setw(16) << std::fixed << std::setprecision(1) << nr_timers / arm_time / 1e6
+              << std::setw(16) << nr_ops / churn_time / 1e6
+              << std::setw(12) << expired << "\n";
+}
+
+int main(int ac, char** av) {
+    size_t nr_timers = ac > 1 ? std::strtoull(av[1], nullptr, 0) : 1000000;
+    size_t nr_ops = ac > 2 ? std::strtoull(av[2], nullptr, 0) : 10000000;
+    std::cout << std::setw(12) << "container" << std::setw(12) << "timers"
+              << std::setw(16) << "arm (M/s)" << std::setw(16) << "rearm (M/s)" << std::setw(12) << "expired" << "\n";
+    run<timer_set<bench_timer, &bench_timer::link>>("timer_set", nr_timers, nr_ops);
+    run<timer_wheel<bench_timer, &bench_timer::link, 10>>("timer_wheel", nr_timers, nr_ops);
+}
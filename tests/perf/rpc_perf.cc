@@ -0,0 +1,241 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <algorithm>
+#include <boost/range/irange.hpp>
+#include "core/app-template.hh"
+#include "core/thread.hh"
+#include "core/future-util.hh"
+#include "core/reactor.hh"
+#include "rpc/rpc.hh"
+#include "rpc/lz4_compressor.hh"
+#include "tests/loopback_socket.hh"
+
+using namespace seastar;
+using namespace std::chrono_literals;
+
+struct serializer {
+};
+
+template <typename Output>
+inline void write(serializer, Output& out, uint32_t v) {
+    out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template <typename Input>
+inline uint32_t read(serializer, Input& in, rpc::type<uint32_t>) {
+    uint32_t v;
+    in.read(reinterpret_cast<char*>(&v), sizeof(v));
+    return v;
+}
+
+template <typename Output>
+inline void write(serializer s, Output& out, const temporary_buffer<char>& v) {
+    write(s, out, uint32_t(v.size()));
+    rpc::write_fragment(out, v);
+}
+
+template <typename Input>
+inline temporary_buffer<char> read(serializer s, Input& in, rpc::type<temporary_buffer<char>>) {
+    auto size = read(s, in, rpc::type<uint32_t>());
+    return rpc::read_fragment(in, size);
+}
+
+using perf_rpc_proto = rpc::protocol<serializer>;
+using clock_type = std::chrono::steady_clock;
+
+struct run_config {
+    size_t payload;
+    unsigned concurrency;
+    unsigned connections;
+};
+
+struct run_result {
+    run_config cfg;
+    uint64_t ops = 0;
+    double seconds = 0;
+    std::vector<float> latencies_us;
+
+    double ops_per_sec() const {
+        return ops / seconds;
+    }
+    double mb_per_sec() const {
+        // both ways: the payload is echoed
+        return 2.0 * ops * cfg.payload / seconds / (1 << 20);
+    }
+    float percentile(double p) const {
+        if (latencies_us.empty()) {
+            return 0;
+        }
+        return latencies_us[std::min<size_t>(latencies_us.size() * p, latencies_us.size() - 1)];
+    }
+};
+
+// Runs one client and server pair in the calling shard, over an in-process
+// loopback transport or the TCP stack
+class rpc_bench {
+    perf_rpc_proto _proto{serializer{}};
+    loopback_connection_factory _lcf;
+    rpc::lz4_compressor::factory _lz4;
+    bool _loopback;
+    bool _compress;
+    ipv4_addr _addr;
+    std::unique_ptr<perf_rpc_proto::server> _server;
+    std::function<future<temporary_buffer<char>> (perf_rpc_proto::client&, temporary_buffer<char>)> _echo;
+private:
+    std::unique_ptr<perf_rpc_proto::client> make_client() {
+        rpc::client_options co;
+        if (_compress) {
+            co.compressor_factory = &_lz4;
+        }
+        if (_loopback) {
+            auto s = seastar::socket(std::make_unique<loopback_socket_impl>(_lcf));
+            return std::make_unique<perf_rpc_proto::client>(_proto, co, std::move(s), _addr);
+        }
+        return std::make_unique<perf_rpc_proto::client>(_proto, co, _addr);
+    }
+public:
+    rpc_bench(bool loopback, bool compress, ipv4_addr addr)
+            : _loopback(loopback), _compress(compress), _addr(addr) {
+        _echo = _proto.register_handler(1, [] (temporary_buffer<char> data) {
+            return data;
+        });
+        rpc::server_options so;
+        if (_compress) {
+            so.compressor_factory = &_lz4;
+        }
+        if (_loopback) {
+            _server = std::make_unique<perf_rpc_proto::server>(_proto, so, _lcf.get_server_socket());
+        } else {
+            _server = std::make_unique<perf_rpc_proto::server>(_proto, so, _addr);
+        }
+    }
+    // Must be called in a seastar::thread
+    run_result run(run_config cfg, clock_type::duration duration) {
+        std::vector<std::unique_ptr<perf_rpc_proto::client>> clients;
+        for (unsigned i = 0; i < cfg.connections; ++i) {
+            clients.push_back(make_client());
+        }
+        temporary_buffer<char> payload(cfg.payload);
+        for (size_t i = 0; i < payload.size(); ++i) {
+            payload.get_write()[i] = 'a' + i % 26;
+        }
+        // connect all clients before the clock starts
+        parallel_for_each(clients, [this] (auto& c) {
+            return _echo(*c, temporary_buffer<char>()).discard_result();
+        }).get();
+
+        run_result r;
+        r.cfg = cfg;
+        auto start = clock_type::now();
+        auto end = start + duration;
+        parallel_for_each(boost::irange(0u, cfg.concurrency), [&] (unsigned i) {
+            auto& c = *clients[i % clients.size()];
+            return do_until([end] { return clock_type::now() >= end; }, [&] {
+                auto sent = clock_type::now();
+                return _echo(c, payload.share()).then([&, sent] (temporary_buffer<char>) {
+                    auto latency = std::chrono::duration<float, std::micro>(clock_type::now() - sent);
+                    r.latencies_us.push_back(latency.count());
+                    ++r.ops;
+                });
+            });
+        }).get();
+        r.seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+        std::sort(r.latencies_us.begin(), r.latencies_us.end());
+        for (auto& c : clients) {
+            c->stop().get();
+        }
+        return r;
+    }
+    void stop() {
+        _server->stop().get();
+    }
+};
+
+static void print_text(const std::vector<run_result>& results) {
+    print("%10s %6s %6s %12s %10s %10s %10s %10s %10s %10s\n",
+            "payload", "conc", "conns", "ops/s", "MB/s", "p50(us)", "p90(us)", "p99(us)", "p999(us)", "max(us)");
+    for (auto&& r : results) {
+        print("%10d %6d %6d %12.0f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                r.cfg.payload, r.cfg.concurrency, r.cfg.connections, r.ops_per_sec(), r.mb_per_sec(),
+                r.percentile(0.5), r.percentile(0.9), r.percentile(0.99), r.percentile(0.999), r.percentile(1));
+    }
+}
+
+static void print_json(const std::vector<run_result>& results, sstring transport, bool compress) {
+    print("{\n  \"transport\": \"%s\",\n  \"compress\": %s,\n  \"results\": [\n", transport, compress ? "true" : "false");
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto& r = results[i];
+        print("    {\"payload\": %d, \"concurrency\": %d, \"connections\": %d, \"ops\": %d, \"seconds\": %.3f, "
+                "\"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f, "
+                "\"latency_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}}%s\n",
+                r.cfg.payload, r.cfg.concurrency, r.cfg.connections, r.ops, r.seconds, r.ops_per_sec(), r.mb_per_sec(),
+                r.percentile(0.5), r.percentile(0.9), r.percentile(0.99), r.percentile(0.999), r.percentile(1),
+                i + 1 == results.size() ? "" : ",");
+    }
+    print("  ]\n}\n");
+}
+
+int main(int ac, char** av) {
+    app_template at;
+    namespace bpo = boost::program_options;
+    at.add_options()
+            ("payload", bpo::value<std::vector<size_t>>()->multitoken()->default_value({64, 1024, 16384, 131072}, "64 1024 16384 131072"),
+                    "Request (and reply) payload sizes to measure, in bytes")
+            ("concurrency", bpo::value<std::vector<unsigned>>()->multitoken()->default_value({1, 64}, "1 64"),
+                    "Requests in flight to measure with")
+            ("connections", bpo::value<std::vector<unsigned>>()->multitoken()->default_value({1, 4}, "1 4"),
+                    "Client connections to spread the requests over")
+            ("duration", bpo::value<unsigned>()->default_value(5), "Seconds to run each measurement for")
+            ("compress", bpo::value<bool>()->default_value(false), "Compress RPC traffic with LZ4")
+            ("transport", bpo::value<sstring>()->default_value("loopback"),
+                    "loopback (in-process, no network stack) or tcp (the configured network stack)")
+            ("address", bpo::value<sstring>()->default_value("127.0.0.1:10005"), "Server address, for the tcp transport")
+            ("json", bpo::value<bool>()->default_value(false), "Print the results as JSON")
+            ;
+    return at.run(ac, av, [&at] {
+        return seastar::async([&at] {
+            auto&& config = at.configuration();
+            auto transport = config["transport"].as<sstring>();
+            if (transport != "loopback" && transport != "tcp") {
+                throw std::invalid_argument(sprint("unknown transport %s", transport));
+            }
+            auto compress = config["compress"].as<bool>();
+            auto duration = std::chrono::seconds(config["duration"].as<unsigned>());
+            rpc_bench bench(transport == "loopback", compress, ipv4_addr(config["address"].as<sstring>()));
+            std::vector<run_result> results;
+            for (auto payload : config["payload"].as<std::vector<size_t>>()) {
+                for (auto concurrency : config["concurrency"].as<std::vector<unsigned>>()) {
+                    for (auto connections : config["connections"].as<std::vector<unsigned>>()) {
+                        results.push_back(bench.run({payload, std::max(concurrency, 1u), std::max(connections, 1u)}, duration));
+                    }
+                }
+            }
+            bench.stop();
+            if (config["json"].as<bool>()) {
+                print_json(results, transport, compress);
+            } else {
+                print_text(results);
+            }
+        });
+    });
+}
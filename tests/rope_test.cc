@@ -0,0 +1,97 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "core/rope.hh"
+
+using namespace seastar;
+
+static sstring packet_content(net::packet& p) {
+    sstring ret;
+    for (auto&& f : p.fragments()) {
+        ret += sstring(f.base, f.size);
+    }
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(test_small_appends_are_copied) {
+    rope r(64);
+    r << "STAT " << sstring("pid") << " " << to_sstring(1234) << "\r\n";
+    BOOST_REQUIRE_EQUAL(r.size(), 15u);
+    BOOST_REQUIRE_EQUAL(r.linearize(), "STAT pid 1234\r\n");
+    auto p = std::move(r).release_packet();
+    BOOST_REQUIRE_EQUAL(p.nr_frags(), 1u);
+    BOOST_REQUIRE_EQUAL(packet_content(p), "STAT pid 1234\r\n");
+}
+
+BOOST_AUTO_TEST_CASE(test_chunks_fill_up) {
+    rope r(64);
+    sstring expected;
+    for (int i = 0; i < 100; ++i) {
+        auto s = to_sstring(i) + ",";
+        r.append(s);
+        expected += s;
+    }
+    BOOST_REQUIRE_EQUAL(r.linearize(), expected);
+    auto p = std::move(r).release_packet();
+    BOOST_REQUIRE_EQUAL(p.len(), expected.size());
+    BOOST_REQUIRE(p.nr_frags() > 1);
+    BOOST_REQUIRE_EQUAL(packet_content(p), expected);
+}
+
+BOOST_AUTO_TEST_CASE(test_large_buffers_are_referenced) {
+    rope r(64);
+    static const char big_static[] = "0123456789012345678901234567890123456789";
+    temporary_buffer<char> big(100);
+    std::fill_n(big.get_write(), big.size(), 'x');
+    auto big_ptr = big.get();
+    sstring big_string(50, 'y');
+
+    r << "head:";
+    r.append(std::move(big));
+    r << ":";
+    r.append_static(big_static, sizeof(big_static) - 1);
+    r.append(std::move(big_string));
+    r << ":tail";
+
+    auto expected = sstring("head:") + sstring(100, 'x') + ":" + big_static + sstring(50, 'y') + ":tail";
+    BOOST_REQUIRE_EQUAL(r.size(), expected.size());
+    BOOST_REQUIRE_EQUAL(r.linearize(), expected);
+    auto msg = std::move(r).release_message();
+    BOOST_REQUIRE_EQUAL(msg.size(), expected.size());
+    auto p = std::move(msg).release();
+    // head, big, ":", big_static, big_string, tail
+    BOOST_REQUIRE_EQUAL(p.nr_frags(), 6u);
+    BOOST_REQUIRE(p.fragments()[1].base == big_ptr);
+    BOOST_REQUIRE(p.fragments()[3].base == big_static);
+    BOOST_REQUIRE_EQUAL(packet_content(p), expected);
+}
+
+BOOST_AUTO_TEST_CASE(test_empty) {
+    rope r;
+    BOOST_REQUIRE(r.empty());
+    BOOST_REQUIRE_EQUAL(r.linearize(), "");
+    auto p = std::move(r).release_packet();
+    BOOST_REQUIRE_EQUAL(p.len(), 0u);
+}
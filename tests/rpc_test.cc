@@ -20,10 +20,13 @@
  */
 
 
+#include <algorithm>
+#include <random>
 #include "loopback_socket.hh"
 #include "rpc/rpc.hh"
 #include "rpc/lz4_compressor.hh"
 #include "rpc/multi_algo_compressor_factory.hh"
+#include "rpc/zstd_compressor.hh"
 #include "test-utils.hh"
 #include "core/thread.hh"
 #include "core/sleep.hh"
@@ -84,6 +87,18 @@ inline sstring read(serializer, Input& in, rpc::type<sstring>) {
     return ret;
 }
 
+template <typename Output>
+inline void write(serializer, Output& out, const temporary_buffer<char>& v) {
+    write_arithmetic_type(out, uint32_t(v.size()));
+    rpc::write_fragment(out, v);
+}
+
+template <typename Input>
+inline temporary_buffer<char> read(serializer, Input& in, rpc::type<temporary_buffer<char>>) {
+    auto size = read_arithmetic_type<uint32_t>(in);
+    return rpc::read_fragment(in, size);
+}
+
 using test_rpc_proto = rpc::protocol<serializer>;
 using connect_fn = std::function<test_rpc_proto::client (ipv4_addr addr)>;
 
@@ -260,6 +275,48 @@ SEASTAR_TEST_CASE(test_rpc_cancel) {
     });
 }
 
+SEASTAR_TEST_CASE(test_rpc_cancel_reaches_server) {
+    using namespace std::chrono_literals;
+    return with_rpc_env({}, {}, {}, true, [] (test_rpc_proto& proto, test_rpc_proto::server& s, connect_fn connect) {
+        return seastar::async([&proto, &s, connect] {
+            auto c1 = connect(ipv4_addr());
+            int running = 0;
+            int stopped = 0;
+            // runs until its caller gives up
+            auto call = proto.register_handler(1, [&running, &stopped] () {
+                auto cancellation = rpc::current_request_cancellation();
+                BOOST_REQUIRE(cancellation);
+                ++running;
+                return do_until([cancellation] { return cancellation->cancelled(); }, [] {
+                    return sleep(1ms);
+                }).then([&stopped] {
+                    ++stopped;
+                });
+            });
+            auto wait_for = [] (const int& counter, int value) {
+                while (counter < value) {
+                    sleep(1ms).get();
+                }
+            };
+            rpc::cancellable cancel;
+            auto f = call(c1, cancel);
+            wait_for(running, 1);
+            cancel.cancel();
+            BOOST_REQUIRE_THROW(f.get(), rpc::canceled_error);
+            wait_for(stopped, 1);
+
+            BOOST_REQUIRE_THROW(call(c1, std::chrono::milliseconds(100)).get(), rpc::timeout_error);
+            wait_for(stopped, 2);
+            uint64_t cancelled = 0;
+            s.foreach_connection([&cancelled] (test_rpc_proto::server::connection& c) {
+                cancelled += c.get_stats().cancelled;
+            });
+            BOOST_REQUIRE_EQUAL(cancelled, 2u);
+            c1.stop().get();
+        });
+    });
+}
+
 SEASTAR_TEST_CASE(test_message_to_big) {
     return with_rpc_env({0, 1, 100}, {}, {}, true, [] (test_rpc_proto& proto, test_rpc_proto::server& s, connect_fn connect) {
         return seastar::async([&proto, connect] {
@@ -280,3 +337,435 @@ SEASTAR_TEST_CASE(test_message_to_big) {
         });
     });
 }
+
+SEASTAR_TEST_CASE(test_rpc_stream) {
+    rpc::resource_limits limits;
+    // smaller than what is sent, so that the sink waits for credit
+    limits.stream_window = 64;
+    return with_rpc_env(limits, {}, {}, true, [] (test_rpc_proto& proto, test_rpc_proto::server& s, connect_fn connect) {
+        return seastar::async([&proto, connect] {
+            auto c = connect(ipv4_addr());
+            auto call = proto.register_handler(1, [] (rpc::source<int> source) {
+                return do_with(std::move(source), int(0), [] (rpc::source<int>& source, int& sum) {
+                    return repeat([&source, &sum] {
+                        return source().then([&sum] (std::experimental::optional<std::tuple<int>> v) {
+                            if (!v) {
+                                return stop_iteration::yes;
+                            }
+                            sum += std::get<0>(*v);
+                            return stop_iteration::no;
+                        });
+                    }).then([&sum] {
+                        return sum;
+                    });
+                });
+            });
+            auto sink = c.make_stream_sink<int>().get0();
+            auto f = call(c, sink);
+            int sum = 0;
+            for (int i = 0; i < 1000; ++i) {
+                sink(i).get();
+                sum += i;
+            }
+            sink.close().get();
+            BOOST_REQUIRE_EQUAL(f.get0(), sum);
+            c.stop().get();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_rpc_stream_both_ways) {
+    return with_rpc_env({}, {}, {}, true, [] (test_rpc_proto& proto, test_rpc_proto::server& s, connect_fn connect) {
+        return seastar::async([&proto, connect] {
+            auto c = connect(ipv4_addr());
+            auto call = proto.register_handler(1, [] (rpc::source<sstring> source) {
+                auto sink = source.make_sink<serializer, sstring>();
+                // echoes the stream, in the background
+                do_with(std::move(source), std::move(sink), [] (rpc::source<sstring>& source, rpc::sink<sstring>& sink) {
+                    return repeat([&source, &sink] {
+                        return source().then([&sink] (std::experimental::optional<std::tuple<sstring>> v) {
+                            if (!v) {
+                                return make_ready_future<stop_iteration>(stop_iteration::yes);
+                            }
+                            return sink(std::get<0>(*v)).then([] {
+                                return stop_iteration::no;
+                            });
+                        });
+                    }).finally([&sink] {
+                        return sink.close();
+                    });
+                });
+            });
+            auto sink = c.make_stream_sink<sstring>().get0();
+            auto source = sink.make_source<serializer, sstring>();
+            call(c, sink).get();
+            for (int i = 0; i < 100; ++i) {
+                sink(to_sstring(i)).get();
+                auto v = source().get0();
+                BOOST_REQUIRE(bool(v));
+                BOOST_REQUIRE_EQUAL(std::get<0>(*v), to_sstring(i));
+            }
+            sink.close().get();
+            BOOST_REQUIRE(!source().get0());
+            c.stop().get();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_marshall_fragments) {
+    serializer s;
+    temporary_buffer<char> big(3 * rpc::snd_buf::chunk_size / 2);
+    std::fill_n(big.get_write(), big.size(), 'x');
+    auto out = rpc::marshall(s, 28, int32_t(1), big, sstring("tail"));
+    BOOST_REQUIRE_EQUAL(out.size, 28 + 4 + 4 + big.size() + 4 + 4);
+    auto& bufs = boost::get<std::vector<temporary_buffer<char>>>(out.bufs);
+    // the buffer is referenced, not copied
+    BOOST_REQUIRE_EQUAL(bufs.size(), 3u);
+    BOOST_REQUIRE_EQUAL(bufs[0].size(), 28u + 8);
+    BOOST_REQUIRE(bufs[1].get() == big.get());
+
+    rpc::rcv_buf in(out.size - 28);
+    bufs[0].trim_front(28);
+    in.bufs = std::move(bufs);
+    auto args = rpc::unmarshall<serializer, int32_t, temporary_buffer<char>, sstring>(s, std::move(in));
+    BOOST_REQUIRE_EQUAL(std::get<0>(args), 1);
+    BOOST_REQUIRE(std::get<1>(args).get() == big.get());
+    BOOST_REQUIRE_EQUAL(std::get<2>(args), "tail");
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_rpc_large_buffer) {
+    return with_rpc_env({}, {}, {}, true, [] (test_rpc_proto& proto, test_rpc_proto::server& s, connect_fn connect) {
+        return seastar::async([&proto, connect] {
+            auto c1 = connect(ipv4_addr());
+            auto echo = proto.register_handler(1, [] (temporary_buffer<char> b) {
+                return b;
+            });
+            temporary_buffer<char> big(4 << 20);
+            for (size_t i = 0; i < big.size(); ++i) {
+                big.get_write()[i] = char(i % 251);
+            }
+            auto ret = echo(c1, big.share()).get0();
+            BOOST_REQUIRE_EQUAL(ret.size(), big.size());
+            BOOST_REQUIRE(std::equal(ret.begin(), ret.end(), big.begin()));
+            c1.stop().get();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_rpc_client_pool) {
+    return seastar::async([] {
+        test_rpc_proto proto(serializer{});
+        loopback_connection_factory lcf;
+        test_rpc_proto::server server(proto, lcf.get_server_socket());
+        test_rpc_proto::client_pool pool(proto, {}, 2, [&lcf] {
+            return seastar::socket(std::make_unique<rpc_socket_impl>(lcf, true));
+        });
+        auto sum = proto.register_handler(1, [] (int a, int b) {
+            return a + b;
+        });
+        ipv4_addr peer(0x7f000001, 7000);
+        BOOST_REQUIRE_EQUAL(sum(pool.get(peer, 0), 1, 2).get0(), 3);
+        auto& c = pool.get(peer, 0);
+        BOOST_REQUIRE(c.peer_shard_info());
+        BOOST_REQUIRE_EQUAL(c.peer_shard_info()->shard, engine().cpu_id());
+        BOOST_REQUIRE_EQUAL(c.peer_shard_info()->shard_count, smp::count);
+        // the server has no shard ports, so any connection will do
+        BOOST_REQUIRE_EQUAL(c.peer_shard_info()->port_base, 0u);
+        BOOST_REQUIRE(&pool.get(peer, 1) == &c);
+        BOOST_REQUIRE_EQUAL(pool.size(), 1u);
+
+        // a busy connection gets company, up to the limit
+        std::vector<future<int>> calls;
+        for (int i = 0; i < 4; ++i) {
+            calls.push_back(sum(pool.get(peer, 0), i, i));
+        }
+        BOOST_REQUIRE_EQUAL(pool.size(), 2u);
+        for (int i = 0; i < 4; ++i) {
+            BOOST_REQUIRE_EQUAL(calls[i].get0(), 2 * i);
+        }
+        pool.stop().get();
+        server.stop().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_rpc_verb_metrics) {
+    return with_rpc_env({}, {}, {}, true, [] (test_rpc_proto& proto, test_rpc_proto::server& s, connect_fn connect) {
+        return seastar::async([&proto, connect] {
+            proto.enable_verb_metrics("test_rpc_verb_metrics");
+            auto c1 = connect(ipv4_addr());
+            auto echo = proto.register_handler(1, [] (sstring s) {
+                return sleep(std::chrono::milliseconds(1)).then([s] {
+                    return s;
+                });
+            });
+            auto msg = sstring(1000, 'x');
+            for (int i = 0; i < 3; ++i) {
+                BOOST_REQUIRE_EQUAL(echo(c1, msg).get0(), msg);
+            }
+            auto count = [] (const rpc::log2_histogram& h) {
+                return h.to_metrics().sample_count;
+            };
+            auto& vm = *proto.get_verb_metrics(1);
+            BOOST_REQUIRE_EQUAL(count(vm.request_bytes), 3u);
+            // the serialized string: its length and data
+            BOOST_REQUIRE_EQUAL(vm.response_bytes.sum, 3 * (4 + msg.size()));
+            BOOST_REQUIRE_EQUAL(count(vm.handler_latency), 3u);
+            BOOST_REQUIRE_GE(vm.handler_latency.sum, 3 * 1000u);
+            BOOST_REQUIRE_EQUAL(count(vm.round_trip_latency), 3u);
+            BOOST_REQUIRE_GE(vm.round_trip_latency.sum, vm.handler_latency.sum);
+            BOOST_REQUIRE_EQUAL(count(vm.request_queue_time), 3u);
+            BOOST_REQUIRE_EQUAL(count(vm.response_queue_time), 3u);
+            // other verbs are not tracked until used
+            BOOST_REQUIRE_EQUAL(count(proto.get_verb_metrics(2)->request_bytes), 0u);
+            c1.stop().get();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_rpc_shed_load) {
+    return with_rpc_env({0, 1, 100}, {}, {}, true, [] (test_rpc_proto& proto, test_rpc_proto::server& s, connect_fn connect) {
+        return seastar::async([&proto, &s, connect] {
+            auto c = connect(ipv4_addr());
+            // only one request fits in the server's memory at a time
+            semaphore release(0);
+            auto call = proto.register_handler(1, [&release] (sstring payload) {
+                return release.wait();
+            });
+            auto payload = sstring(60, 'x');
+            auto a = call(c, payload);
+            auto b = call(c, std::chrono::seconds(10), payload);
+            // b waits for a, for two seconds
+            sleep(std::chrono::seconds(2)).get();
+            release.signal();
+            a.get();
+            release.signal();
+            b.get();
+
+            auto d = call(c, payload);
+            sleep(std::chrono::milliseconds(10)).get();
+            // expected to wait for about as long as b did, this one would
+            // rather expire
+            BOOST_REQUIRE_THROW(call(c, std::chrono::milliseconds(100), payload).get(), rpc::overloaded_error);
+            BOOST_REQUIRE_EQUAL(s.get_shed_stats().overloaded, 1u);
+            // while this one may make it
+            auto e = call(c, std::chrono::seconds(10), payload);
+            release.signal(2);
+            d.get();
+            e.get();
+            BOOST_REQUIRE_EQUAL(s.get_shed_stats().overloaded, 1u);
+            BOOST_REQUIRE_EQUAL(s.get_shed_stats().expired, 0u);
+            c.stop().get();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_rpc_priority_classes) {
+    return seastar::async([] {
+        test_rpc_proto proto(serializer{});
+        rpc::priority_class_config bulk, urgent;
+        urgent.max_memory = 1000;
+        proto.set_priority_classes({bulk, urgent});
+        proto.set_priority_class(2, 1);
+        BOOST_REQUIRE_THROW(proto.set_priority_class(3, 2), std::invalid_argument);
+        auto sg = create_scheduling_group("rpc_test_urgent", 100).get0();
+
+        loopback_connection_factory lcf;
+        // one bulk request fits in the server's memory at a time
+        test_rpc_proto::server server(proto, lcf.get_server_socket(), {0, 1, 100 * 1024});
+        semaphore release(0);
+        unsigned bulk_started = 0;
+        auto put = proto.register_handler(1, [&] (sstring data) {
+            ++bulk_started;
+            return release.wait();
+        });
+        auto ping = proto.register_handler(2, sg, [&] {
+            BOOST_REQUIRE(current_scheduling_group() == sg);
+            return bulk_started;
+        });
+        test_rpc_proto::client c(proto, seastar::socket(std::make_unique<rpc_socket_impl>(lcf, true)), ipv4_addr());
+        ping(c).get();
+
+        std::vector<future<>> puts;
+        for (int i = 0; i < 20; ++i) {
+            puts.push_back(put(c, sstring(64 * 1024, 'x')));
+        }
+        // sent ahead of most of the bulk requests, and served while they
+        // wait for memory
+        BOOST_REQUIRE_LE(ping(c).get0(), 2u);
+        release.signal(20);
+        when_all(puts.begin(), puts.end()).get();
+        BOOST_REQUIRE_EQUAL(bulk_started, 20u);
+        c.stop().get();
+        server.stop().get();
+    });
+}
+
+// Counts the frames its compressors compressed
+struct counting_lz4_factory : rpc::compressor::factory {
+    struct counting_compressor : rpc::lz4_compressor {
+        unsigned& calls;
+        explicit counting_compressor(unsigned& calls_) : calls(calls_) {}
+        rpc::snd_buf compress(size_t head_space, rpc::snd_buf data) override {
+            ++calls;
+            return rpc::lz4_compressor::compress(head_space, std::move(data));
+        }
+    };
+    const sstring name = "LZ4";
+    mutable unsigned compressed = 0;
+    const sstring& supported() const override {
+        return name;
+    }
+    std::unique_ptr<rpc::compressor> negotiate(sstring feature, bool is_server) const override {
+        return feature == name ? std::make_unique<counting_compressor>(compressed) : nullptr;
+    }
+};
+
+SEASTAR_TEST_CASE(test_rpc_adaptive_compression) {
+    auto factory = std::make_unique<counting_lz4_factory>();
+    rpc::server_options so;
+    rpc::client_options co;
+    so.compressor_factory = factory.get();
+    co.compressor_factory = factory.get();
+    return with_rpc_env({}, co, so, true, [&factory = *factory] (test_rpc_proto& proto, test_rpc_proto::server& s, connect_fn connect) {
+        return seastar::async([&proto, &factory, connect] {
+            auto c1 = connect(ipv4_addr());
+            auto echo = proto.register_handler(1, [] (sstring s) {
+                return s;
+            });
+            auto echo_random = proto.register_handler(2, [] (sstring s) {
+                return s;
+            });
+            // below the threshold
+            BOOST_REQUIRE_EQUAL(echo(c1, sstring("hi")).get0(), "hi");
+            BOOST_REQUIRE_EQUAL(factory.compressed, 0u);
+            sstring text(4096, 'a');
+            BOOST_REQUIRE_EQUAL(echo(c1, text).get0(), text);
+            BOOST_REQUIRE_EQUAL(factory.compressed, 2u);
+
+            // incompressible: sampled for a window, then mostly sent as is
+            std::default_random_engine rng;
+            std::uniform_int_distribution<int> dist(0, 255);
+            auto random_message = [&] {
+                sstring m(sstring::initialized_later(), 1024);
+                std::generate(m.begin(), m.end(), [&] { return char(dist(rng)); });
+                return m;
+            };
+            for (unsigned i = 0; i < rpc::compression_sampler::window / 2; ++i) {
+                auto m = random_message();
+                BOOST_REQUIRE_EQUAL(echo_random(c1, m).get0(), m);
+            }
+            auto sampled = factory.compressed;
+            BOOST_REQUIRE_EQUAL(sampled, 2 + rpc::compression_sampler::window);
+            for (unsigned i = 0; i < rpc::compression_sampler::window; ++i) {
+                auto m = random_message();
+                BOOST_REQUIRE_EQUAL(echo_random(c1, m).get0(), m);
+            }
+            BOOST_REQUIRE_LE(factory.compressed - sampled, 2u);
+            // the other verb is still compressed
+            BOOST_REQUIRE_EQUAL(echo(c1, text).get0(), text);
+            BOOST_REQUIRE_EQUAL(factory.compressed - sampled, 4u);
+            c1.stop().get();
+        });
+    }).finally([factory = std::move(factory)] {});
+}
+
+#ifdef HAVE_ZSTD
+
+#include <zdict.h>
+
+// Counts the connections a factory negotiated
+struct counting_factory : rpc::compressor::factory {
+    const rpc::compressor::factory& f;
+    mutable int negotiated = 0;
+    explicit counting_factory(const rpc::compressor::factory& f_) : f(f_) {}
+    const sstring& supported() const override {
+        return f.supported();
+    }
+    std::unique_ptr<rpc::compressor> negotiate(sstring feature, bool is_server) const override {
+        auto c = f.negotiate(std::move(feature), is_server);
+        negotiated += bool(c);
+        return c;
+    }
+};
+
+static sstring sample_message(int i) {
+    return sprint("{\"id\":%d,\"name\":\"user-%d\",\"status\":\"active\",\"region\":\"eu-west-%d\"}", i, i * 7, i % 3);
+}
+
+static sstring train_dictionary() {
+    sstring samples;
+    std::vector<size_t> sizes;
+    for (int i = 0; i < 5000; ++i) {
+        auto m = sample_message(i);
+        samples += m;
+        sizes.push_back(m.size());
+    }
+    sstring dict(sstring::initialized_later(), 4096);
+    auto size = ZDICT_trainFromBuffer(dict.begin(), dict.size(), samples.data(), sizes.data(), sizes.size());
+    BOOST_REQUIRE(!ZDICT_isError(size));
+    dict.resize(size);
+    return dict;
+}
+
+static size_t compressed_size(rpc::compressor& c, const sstring& msg) {
+    auto out = c.compress(0, rpc::snd_buf(temporary_buffer<char>(msg.data(), msg.size())));
+    auto size = out.size;
+    rpc::rcv_buf in(size);
+    in.bufs = std::move(out.front());
+    auto back = c.decompress(std::move(in));
+    BOOST_REQUIRE_EQUAL(back.size, msg.size());
+    auto data = rpc::linearize(back.bufs, back.size);
+    BOOST_REQUIRE_EQUAL(sstring(data.get(), data.size()), msg);
+    return size;
+}
+
+SEASTAR_TEST_CASE(test_zstd_dictionary) {
+    auto dict = train_dictionary();
+    rpc::zstd_compressor::factory plain;
+    rpc::zstd_compressor::factory primed(3, dict);
+    BOOST_REQUIRE_EQUAL(plain.supported(), "ZSTD");
+    BOOST_REQUIRE_NE(primed.supported(), plain.supported());
+    BOOST_REQUIRE(!primed.negotiate(plain.supported(), false));
+    auto p = plain.negotiate(plain.supported(), false);
+    auto d = primed.negotiate(primed.supported(), false);
+    auto msg = sample_message(100000);
+    BOOST_REQUIRE_LT(compressed_size(*d, msg), compressed_size(*p, msg));
+    BOOST_REQUIRE_THROW(rpc::zstd_compressor::factory(ZSTD_maxCLevel() + 1), std::invalid_argument);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_rpc_zstd_fallback) {
+    // the server lacks the client's dictionary, so they agree on plain zstd
+    auto dict = train_dictionary();
+    auto primed = std::make_unique<rpc::zstd_compressor::factory>(3, dict);
+    auto plain = std::make_unique<rpc::zstd_compressor::factory>();
+    auto client_plain = std::make_unique<counting_factory>(*plain);
+    auto server_plain = std::make_unique<counting_factory>(*plain);
+    auto lz4 = std::make_unique<rpc::lz4_compressor::factory>();
+    auto client = std::make_unique<rpc::multi_algo_compressor_factory>(
+            std::vector<const rpc::compressor::factory*>{primed.get(), client_plain.get(), lz4.get()});
+    auto server = std::make_unique<rpc::multi_algo_compressor_factory>(
+            std::vector<const rpc::compressor::factory*>{lz4.get(), server_plain.get()});
+    rpc::server_options so;
+    rpc::client_options co;
+    so.compressor_factory = server.get();
+    co.compressor_factory = client.get();
+    return with_rpc_env({}, co, so, true, [] (test_rpc_proto& proto, test_rpc_proto::server& s, connect_fn connect) {
+        return seastar::async([&proto, connect] {
+            auto c1 = connect(ipv4_addr());
+            auto echo = proto.register_handler(1, [] (sstring s) {
+                return s;
+            });
+            auto msg = sample_message(1);
+            BOOST_REQUIRE_EQUAL(echo(c1, msg).get0(), msg);
+            c1.stop().get();
+        });
+    }).finally([primed = std::move(primed), plain = std::move(plain), client_plain = std::move(client_plain),
+                server_plain = std::move(server_plain), lz4 = std::move(lz4), client = std::move(client), server = std::move(server)] {
+        BOOST_REQUIRE_EQUAL(client_plain->negotiated, 1);
+        BOOST_REQUIRE_EQUAL(server_plain->negotiated, 1);
+    });
+}
+
+#endif
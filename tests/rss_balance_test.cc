@@ -0,0 +1,100 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#define BOOST_TEST_MODULE rss_balance
+
+#include <boost/test/included/unit_test.hpp>
+#include <map>
+#include <vector>
+#include "net/rss_balance.hh"
+
+using namespace seastar;
+using namespace net;
+
+static std::map<unsigned, uint64_t> loads_after(std::vector<rss_bucket_load> buckets, const std::vector<rss_move>& moves) {
+    for (auto&& m : moves) {
+        BOOST_REQUIRE_EQUAL(buckets[m.bucket].owner, m.from);
+        buckets[m.bucket].owner = m.to;
+    }
+    std::map<unsigned, uint64_t> loads;
+    for (auto&& b : buckets) {
+        loads[b.owner] += b.packets;
+    }
+    return loads;
+}
+
+BOOST_AUTO_TEST_CASE(test_balanced_stays) {
+    std::vector<rss_bucket_load> buckets;
+    for (unsigned i = 0; i < 8; i++) {
+        buckets.push_back(rss_bucket_load{i, i % 4, 1000 + i});
+    }
+    BOOST_REQUIRE(plan_rss_moves(buckets, {0, 1, 2, 3}, 8, 0.1).empty());
+    // a single owner has nowhere to move buckets to
+    BOOST_REQUIRE(plan_rss_moves(buckets, {0}, 8, 0.1).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_hot_shard_sheds_buckets) {
+    // shard 0 has the hot buckets
+    std::vector<rss_bucket_load> buckets;
+    for (unsigned i = 0; i < 16; i++) {
+        buckets.push_back(rss_bucket_load{i, i % 4, i % 4 == 0 ? 4000u : 1000u});
+    }
+    auto moves = plan_rss_moves(buckets, {0, 1, 2, 3}, 8, 0.1);
+    BOOST_REQUIRE(!moves.empty());
+    BOOST_REQUIRE(moves.size() <= 8);
+    for (auto&& m : moves) {
+        BOOST_REQUIRE_EQUAL(m.from, 0u);
+    }
+    auto loads = loads_after(buckets, moves);
+    uint64_t max = 0;
+    for (auto&& l : loads) {
+        max = std::max(max, l.second);
+    }
+    BOOST_REQUIRE_LE(max, 8000u);
+}
+
+BOOST_AUTO_TEST_CASE(test_elephant_bucket_is_not_split) {
+    // one bucket is more than the rest together: the others move away
+    // from it, it stays
+    std::vector<rss_bucket_load> buckets = {
+        {0, 0, 10000}, {1, 0, 100}, {2, 0, 100}, {3, 1, 100},
+    };
+    auto moves = plan_rss_moves(buckets, {0, 1}, 8, 0.1);
+    for (auto&& m : moves) {
+        BOOST_REQUIRE_NE(m.bucket, 0u);
+    }
+    auto loads = loads_after(buckets, moves);
+    BOOST_REQUIRE_EQUAL(loads[0], 10000u);
+    BOOST_REQUIRE_EQUAL(loads[1], 300u);
+}
+
+BOOST_AUTO_TEST_CASE(test_unknown_owners_are_left_alone) {
+    // bucket 1 belongs to a cpu that is not a candidate
+    std::vector<rss_bucket_load> buckets = {
+        {0, 0, 1000}, {1, 5, 100000}, {2, 0, 1000}, {3, 1, 0},
+    };
+    auto moves = plan_rss_moves(buckets, {0, 1}, 8, 0.1);
+    BOOST_REQUIRE_EQUAL(moves.size(), 1u);
+    BOOST_REQUIRE_EQUAL(moves[0].from, 0u);
+    BOOST_REQUIRE_EQUAL(moves[0].to, 1u);
+    BOOST_REQUIRE_NE(moves[0].bucket, 1u);
+}
@@ -0,0 +1,76 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "core/thread.hh"
+#include "core/reactor.hh"
+#include "core/future-util.hh"
+#include "test-utils.hh"
+#include <boost/range/irange.hpp>
+
+using namespace seastar;
+
+SEASTAR_TEST_CASE(test_many_scheduling_groups) {
+    return seastar::async([] {
+        std::vector<scheduling_group> groups;
+        for (auto i : boost::irange(0, 100)) {
+            groups.push_back(create_scheduling_group(sprint("g%d", i), 100).get0());
+        }
+        std::vector<unsigned> ran(groups.size());
+        parallel_for_each(boost::irange<size_t>(0, groups.size()), [&] (size_t i) {
+            return with_scheduling_group(groups[i], [&ran, &groups, i] {
+                BOOST_REQUIRE(current_scheduling_group() == groups[i]);
+                return later().then([&ran, i] {
+                    ++ran[i];
+                });
+            });
+        }).get();
+        BOOST_REQUIRE(std::all_of(ran.begin(), ran.end(), [] (unsigned n) { return n == 1; }));
+        BOOST_REQUIRE_EQUAL(groups[42].name(), "g42");
+        for (auto sg : groups) {
+            destroy_scheduling_group(sg).get();
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_destroyed_scheduling_group_ids_are_reused) {
+    return seastar::async([] {
+        // Far more groups than can exist at a time
+        for (auto i : boost::irange(0, 2 * int(max_scheduling_groups()))) {
+            auto sg = create_scheduling_group(sprint("tmp%d", i), 10).get0();
+            with_scheduling_group(sg, [] {
+                return later();
+            }).get();
+            destroy_scheduling_group(sg).get();
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_destroy_current_scheduling_group_fails) {
+    return seastar::async([] {
+        auto sg = create_scheduling_group("self", 100).get0();
+        auto f = with_scheduling_group(sg, [sg] {
+            return destroy_scheduling_group(sg);
+        });
+        BOOST_REQUIRE_THROW(f.get(), std::invalid_argument);
+        BOOST_REQUIRE_THROW(destroy_scheduling_group(default_scheduling_group()).get(), std::invalid_argument);
+        destroy_scheduling_group(sg).get();
+    });
+}
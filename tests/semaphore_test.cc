@@ -30,7 +30,11 @@
 #include "core/future-util.hh"
 #include "core/sleep.hh"
 #include "core/shared_mutex.hh"
+#include "core/batched_rwlock.hh"
 #include <boost/range/irange.hpp>
+#include <algorithm>
+#include <vector>
+#include <boost/iterator/counting_iterator.hpp>
 
 using namespace seastar;
 using namespace std::chrono_literals;
@@ -119,6 +123,34 @@ SEASTAR_TEST_CASE(test_semaphore_mix_1) {
     });
 }
 
+SEASTAR_TEST_CASE(test_semaphore_deferred_wakeups) {
+    return seastar::async([] {
+        semaphore sem(0);
+        sem.defer_wakeups();
+        std::vector<int> order;
+        std::vector<future<>> waits;
+        for (int i = 0; i < 4; ++i) {
+            waits.push_back(sem.wait(2).then([&order, i] {
+                order.push_back(i);
+            }));
+        }
+        for (int i = 0; i < 5; ++i) {
+            sem.signal();
+        }
+        // the units wait for the wakeup task, and cannot be taken meanwhile
+        BOOST_REQUIRE_EQUAL(sem.waiters(), 4u);
+        BOOST_REQUIRE(!sem.try_wait());
+        later().get();
+        BOOST_REQUIRE_EQUAL(sem.waiters(), 2u);
+        BOOST_REQUIRE_EQUAL(sem.current(), 1u);
+        sem.defer_wakeups(false);
+        sem.signal(3);
+        BOOST_REQUIRE_EQUAL(sem.waiters(), 0u);
+        when_all(waits.begin(), waits.end()).get();
+        BOOST_REQUIRE(order == std::vector<int>({0, 1, 2, 3}));
+    });
+}
+
 SEASTAR_TEST_CASE(test_broken_semaphore) {
     auto sem = make_lw_shared<semaphore>(0);
     struct oops {};
@@ -214,6 +246,54 @@ SEASTAR_TEST_CASE(test_shared_mutex_mixed) {
 }
 
 
+SEASTAR_TEST_CASE(test_batched_rwlock_prefers_writers) {
+    batched_rwlock l;
+    BOOST_REQUIRE(l.try_read_lock());
+    auto w = l.write_lock();
+    BOOST_REQUIRE(!w.available());
+    // a waiting writer keeps new readers out
+    BOOST_REQUIRE(!l.try_read_lock());
+    std::vector<future<>> readers;
+    for (int i = 0; i < 100; ++i) {
+        readers.push_back(l.read_lock());
+    }
+    BOOST_REQUIRE_EQUAL(l.waiters(), 101u);
+    l.read_unlock();
+    BOOST_REQUIRE(w.available());
+    BOOST_REQUIRE(std::none_of(readers.begin(), readers.end(), [] (auto& f) { return f.available(); }));
+    l.write_unlock();
+    // all waiting readers go together
+    BOOST_REQUIRE(std::all_of(readers.begin(), readers.end(), [] (auto& f) { return f.available(); }));
+    BOOST_REQUIRE_EQUAL(l.read_batches(), 1u);
+    BOOST_REQUIRE_EQUAL(l.waiters(), 0u);
+    for (auto&& f : readers) {
+        f.get();
+        l.read_unlock();
+    }
+    BOOST_REQUIRE(l.try_write_lock());
+    l.write_unlock();
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_batched_rwlock_bounds_consecutive_writers) {
+    batched_rwlock l(2);
+    BOOST_REQUIRE(l.try_write_lock());
+    auto w2 = l.write_lock();
+    auto w3 = l.write_lock();
+    auto r = l.read_lock();
+    l.write_unlock();
+    BOOST_REQUIRE(w2.available());
+    BOOST_REQUIRE(!r.available());
+    l.write_unlock();
+    // two writers went, so the readers go before the third
+    BOOST_REQUIRE(r.available());
+    BOOST_REQUIRE(!w3.available());
+    l.read_unlock();
+    BOOST_REQUIRE(w3.available());
+    l.write_unlock();
+    return when_all(std::move(w2), std::move(w3), std::move(r)).discard_result();
+}
+
 SEASTAR_TEST_CASE(test_with_semaphore) {
     return do_with(semaphore(1), 0, [] (semaphore& sem, int& counter) {
         return with_semaphore(sem, 1, [&counter] {
@@ -230,3 +310,70 @@ SEASTAR_TEST_CASE(test_with_semaphore) {
         });
     });
 }
+
+SEASTAR_TEST_CASE(test_max_concurrent_for_each) {
+    return seastar::async([] {
+        unsigned in_flight = 0;
+        unsigned max_in_flight = 0;
+        std::vector<int> seen;
+        max_concurrent_for_each(boost::irange(0, 100), 7, [&] (int i) {
+            max_in_flight = std::max(max_in_flight, ++in_flight);
+            return sleep(std::chrono::microseconds(i % 5 * 100)).then([&, i] {
+                --in_flight;
+                seen.push_back(i);
+            });
+        }).get();
+        BOOST_REQUIRE_EQUAL(max_in_flight, 7u);
+        BOOST_REQUIRE_EQUAL(in_flight, 0u);
+        std::sort(seen.begin(), seen.end());
+        BOOST_REQUIRE(seen == boost::copy_range<std::vector<int>>(boost::irange(0, 100)));
+    });
+}
+
+SEASTAR_TEST_CASE(test_max_concurrent_for_each_shared_budget) {
+    return seastar::async([] {
+        semaphore sem(4);
+        unsigned in_flight = 0;
+        unsigned max_in_flight = 0;
+        auto func = [&] (int) {
+            max_in_flight = std::max(max_in_flight, ++in_flight);
+            return later().then([&] {
+                --in_flight;
+            });
+        };
+        auto f1 = max_concurrent_for_each(sem, boost::irange(0, 50), func);
+        auto f2 = max_concurrent_for_each(sem, boost::irange(0, 50), func);
+        when_all(std::move(f1), std::move(f2)).get();
+        BOOST_REQUIRE_LE(max_in_flight, 4u);
+        BOOST_REQUIRE_EQUAL(sem.available_units(), 4);
+    });
+}
+
+SEASTAR_TEST_CASE(test_max_concurrent_for_each_stops_on_failure) {
+    return seastar::async([] {
+        unsigned started = 0;
+        unsigned in_flight = 0;
+        auto f = max_concurrent_for_each(boost::irange(0, 1000), 3, [&] (int i) {
+            ++started;
+            ++in_flight;
+            return later().then([&, i] {
+                --in_flight;
+                if (i == 10) {
+                    throw std::runtime_error("expected");
+                }
+            });
+        });
+        BOOST_REQUIRE_THROW(f.get(), std::runtime_error);
+        BOOST_REQUIRE_EQUAL(in_flight, 0u);
+        BOOST_REQUIRE_LT(started, 1000u);
+    });
+}
+
+SEASTAR_TEST_CASE(test_max_concurrent_map_reduce) {
+    return max_concurrent_map_reduce(boost::make_counting_iterator(0), boost::make_counting_iterator(100), 5,
+            [] (int i) {
+        return later().then([i] { return i; });
+    }, 0, std::plus<int>()).then([] (int sum) {
+        BOOST_REQUIRE_EQUAL(sum, 4950);
+    });
+}
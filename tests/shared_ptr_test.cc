@@ -157,3 +157,44 @@ BOOST_AUTO_TEST_CASE(test_indirect_functors) {
         BOOST_REQUIRE(!a_map.count(make_shared<sstring>("k5")));
     }
 }
+
+namespace {
+
+struct compact_entry : public enable_compact_lw_shared_from_this<compact_entry> {
+    static int live;
+    uint32_t key;
+    uint32_t value;
+    compact_entry(uint32_t k, uint32_t v) : key(k), value(v) { ++live; }
+    ~compact_entry() { --live; }
+};
+
+int compact_entry::live = 0;
+
+struct entry : public enable_lw_shared_from_this<entry> {
+    uint32_t key;
+    uint32_t value;
+};
+
+}
+
+BOOST_AUTO_TEST_CASE(test_compact_lw_shared_from_this) {
+#ifndef DEBUG_SHARED_PTR
+    // the members fill the rest of the counter's word
+    static_assert(sizeof(compact_entry) == 12, "compact counter not packed");
+    static_assert(sizeof(compact_entry) < sizeof(entry), "compact counter not smaller");
+#endif
+    {
+        auto p = make_lw_shared<compact_entry>(1, 2);
+        BOOST_REQUIRE_EQUAL(p.use_count(), 1);
+        auto q = p->shared_from_this();
+        BOOST_REQUIRE_EQUAL(p.use_count(), 2);
+        lw_shared_ptr<const compact_entry> c = q;
+        BOOST_REQUIRE_EQUAL(c->value, 2u);
+        BOOST_REQUIRE(c == p);
+        BOOST_REQUIRE_EQUAL(c->shared_from_this().use_count(), 4);
+        p = {};
+        q = {};
+        BOOST_REQUIRE_EQUAL(compact_entry::live, 1);
+    }
+    BOOST_REQUIRE_EQUAL(compact_entry::live, 0);
+}
@@ -0,0 +1,129 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include <vector>
+#include "core/simple-stream.hh"
+#include "core/temporary_buffer.hh"
+
+using namespace seastar;
+
+namespace {
+
+struct point {
+    int32_t x;
+    int32_t y;
+    int64_t tag;
+};
+
+}
+
+namespace seastar {
+
+template <>
+struct serialized_size<point> : fixed_serialized_size<int32_t, int32_t, int64_t> {
+    static constexpr bool is_fixed = true;
+};
+
+}
+
+template <typename T, typename Output>
+static void write_arithmetic(Output& out, T v) {
+    out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template <typename Output>
+static void write(Output& out, const point& p) {
+    out.template write_fixed<serialized_size<point>::value>([&p] (auto& o) {
+        write_arithmetic(o, p.x);
+        write_arithmetic(o, p.y);
+        write_arithmetic(o, p.tag);
+    });
+}
+
+static_assert(serialized_size<point>::value == 16, "");
+static_assert(serialized_size<uint16_t>::value == 2, "");
+static_assert(!serialized_size<sstring>::is_fixed, "");
+
+static std::vector<point> points() {
+    std::vector<point> ret;
+    for (int i = 0; i < 10; ++i) {
+        ret.push_back(point{i, -i, int64_t(i) << 40});
+    }
+    return ret;
+}
+
+template <typename Input>
+static void check_points(Input& in) {
+    for (auto&& p : points()) {
+        point q;
+        in.read(reinterpret_cast<char*>(&q.x), 4);
+        in.read(reinterpret_cast<char*>(&q.y), 4);
+        in.read(reinterpret_cast<char*>(&q.tag), 8);
+        BOOST_REQUIRE_EQUAL(q.x, p.x);
+        BOOST_REQUIRE_EQUAL(q.y, p.y);
+        BOOST_REQUIRE_EQUAL(q.tag, p.tag);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_measuring_fixed) {
+    measuring_output_stream m;
+    for (auto&& p : points()) {
+        write(m, p);
+    }
+    write_arithmetic(m, uint8_t(1));
+    BOOST_REQUIRE_EQUAL(m.size(), 161u);
+}
+
+BOOST_AUTO_TEST_CASE(test_simple_fixed) {
+    std::vector<char> buf(160);
+    memory_output_stream<simple_stream_tag> out(simple_output_stream(buf.data(), buf.size()));
+    for (auto&& p : points()) {
+        write(out, p);
+    }
+    BOOST_REQUIRE_EQUAL(out.size(), 0u);
+    BOOST_REQUIRE_THROW(write(out, point{}), std::out_of_range);
+
+    simple_input_stream in(buf.data(), buf.size());
+    check_points(in);
+}
+
+BOOST_AUTO_TEST_CASE(test_fragmented_fixed) {
+    // points straddle the fragments, whose sizes are not multiples of 16
+    std::vector<temporary_buffer<char>> frags;
+    for (auto size : {20, 7, 40, 93}) {
+        frags.emplace_back(size);
+    }
+    using stream = memory_output_stream<std::vector<temporary_buffer<char>>::iterator>;
+    stream out(stream::fragmented(frags.begin(), 160));
+    for (auto&& p : points()) {
+        write(out, p);
+    }
+    BOOST_REQUIRE_EQUAL(out.size(), 0u);
+    BOOST_REQUIRE_THROW(write(out, point{}), std::out_of_range);
+
+    using istream = memory_input_stream<std::vector<temporary_buffer<char>>::iterator>;
+    istream in(istream::fragmented(frags.begin(), 160));
+    check_points(in);
+}
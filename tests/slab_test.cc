@@ -22,6 +22,7 @@
  */
 
 #include <iostream>
+#include <set>
 #include <assert.h>
 #include "core/slab.hh"
 
@@ -35,8 +36,9 @@ class item : public slab_item_base {
 public:
     bi::list_member_hook<> _cache_link;
     uint32_t _slab_page_index;
+    unsigned _id;
 
-    item(uint32_t slab_page_index) : _slab_page_index(slab_page_index) {}
+    item(uint32_t slab_page_index, unsigned id = 0) : _slab_page_index(slab_page_index), _id(id) {}
 
     const uint32_t get_slab_page_index() {
         return _slab_page_index;
@@ -118,10 +120,78 @@ static void test_allocation_with_lru(const double growth_factor, const unsigned
     std::cout << __FUNCTION__ << " done!\n";
 }
 
+// Creates max hot items, hits the first two of them, then creates scan_length
+// cold ones; returns the ids of the evicted items.
+static std::set<unsigned> evictions_after_scan(slab_eviction_policy policy, unsigned scan_length) {
+    constexpr unsigned slab_limit_size = 5*1024*1024;
+    std::set<unsigned> evicted;
+    slab_allocator<item> slab(1.25, slab_limit_size, max_object_size,
+        [&](item& item_ref) { evicted.insert(item_ref._id); }, policy);
+
+    auto max = slab_limit_size / max_object_size;
+    std::vector<item*> hot;
+    for (auto i = 0u; i < max; i++) {
+        hot.push_back(slab.create(max_object_size, i));
+    }
+    slab.touch(hot[0]);
+    slab.touch(hot[1]);
+    for (auto i = 0u; i < scan_length; i++) {
+        assert(slab.create(max_object_size, max + i) != nullptr);
+    }
+    return evicted;
+}
+
+static void test_eviction_policies() {
+    // lru: hot items go once the scan reaches them
+    auto evicted = evictions_after_scan(slab_eviction_policy::lru, 100);
+    assert(evicted.count(0) && evicted.count(1));
+
+    // segmented lru: hot items are promoted, and outlive any scan
+    evicted = evictions_after_scan(slab_eviction_policy::segmented_lru, 100);
+    assert(!evicted.count(0) && !evicted.count(1));
+    assert(evicted.size() == 100);
+
+    // clock: the first victim is the oldest item that was not hit
+    evicted = evictions_after_scan(slab_eviction_policy::clock, 1);
+    assert(evicted == std::set<unsigned>{2});
+
+    std::cout << __FUNCTION__ << " done!\n";
+}
+
+static void test_rebalance() {
+    constexpr unsigned slab_limit_size = 5*1024*1024;
+    unsigned evictions = 0;
+    slab_allocator<item> slab(1.25, slab_limit_size, max_object_size,
+        [&](item& item_ref) { evictions++; });
+
+    // two pages of small items, then three of large ones
+    auto per_slab_page = max_object_size / slab.class_size(1024);
+    for (auto i = 0u; i < 2 * per_slab_page; i++) {
+        assert(slab.create(1024) != nullptr);
+    }
+    for (auto i = 0u; i < 13; i++) {
+        assert(slab.create(max_object_size) != nullptr);
+    }
+    assert(evictions == 10);
+
+    // a page of small items goes to the large ones
+    assert(slab.rebalance());
+    assert(evictions == 10 + per_slab_page);
+    assert(slab.create(max_object_size) != nullptr);
+    assert(evictions == 10 + per_slab_page);
+
+    // nothing was evicted since
+    assert(!slab.rebalance());
+
+    std::cout << __FUNCTION__ << " done!\n";
+}
+
 int main(int ac, char** av) {
     test_allocation_1(1.25, 5*1024*1024);
     test_allocation_2(1.07, 5*1024*1024); // 1.07 is the growth factor used by facebook.
     test_allocation_with_lru(1.25, 5*1024*1024);
+    test_eviction_policies();
+    test_rebalance();
 
     return 0;
 }
@@ -22,6 +22,8 @@
 #include "core/reactor.hh"
 #include "core/app-template.hh"
 #include "core/print.hh"
+#include "core/future-util.hh"
+#include "core/sharded.hh"
 
 using namespace seastar;
 
@@ -57,6 +59,116 @@ future<bool> test_smp_exception() {
     });
 }
 
+// Closures too large for the preallocated work item slots go to the heap
+future<bool> test_smp_large_closure() {
+    std::array<char, 1024> payload;
+    payload.fill('x');
+    return smp::submit_to(1, [payload] {
+        return make_ready_future<int>(std::count(payload.begin(), payload.end(), 'x'));
+    }).then([] (int ret) {
+        return make_ready_future<bool>(ret == 1024);
+    });
+}
+
+// More requests in flight than there are preallocated work item slots
+future<bool> test_smp_many_inflight() {
+    std::vector<future<int>> results;
+    for (int i = 0; i < 1000; ++i) {
+        results.push_back(smp::submit_to(1, [i] {
+            return make_ready_future<int>(i);
+        }));
+    }
+    return when_all(results.begin(), results.end()).then([] (std::vector<future<int>> results) {
+        for (int i = 0; i < int(results.size()); ++i) {
+            if (results[i].get0() != i) {
+                return make_ready_future<bool>(false);
+            }
+        }
+        return make_ready_future<bool>(true);
+    });
+}
+
+// Stealable functions may run on any shard, but results and exceptions
+// come back to the submitting one
+future<bool> test_smp_stealable() {
+    std::vector<future<int>> results;
+    for (int i = 0; i < 200; ++i) {
+        results.push_back(smp::submit_stealable([i] {
+            auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(100);
+            while (std::chrono::steady_clock::now() < end) {
+            }
+            if (i == 17) {
+                throw nasty_exception();
+            }
+            return i;
+        }));
+    }
+    auto origin = engine().cpu_id();
+    return when_all(results.begin(), results.end()).then([origin] (std::vector<future<int>> results) {
+        bool ok = engine().cpu_id() == origin;
+        for (int i = 0; i < int(results.size()); ++i) {
+            if (i == 17) {
+                try {
+                    results[i].get();
+                    ok = false;
+                } catch (nasty_exception&) {
+                }
+            } else if (results[i].get0() != i) {
+                ok = false;
+            }
+        }
+        return make_ready_future<bool>(ok);
+    });
+}
+
+// foreign_ptr destructions are batched, but still happen on the origin shard
+struct origin_checker {
+    static thread_local unsigned destroyed;
+    static thread_local unsigned destroyed_elsewhere;
+    unsigned origin = engine().cpu_id();
+    ~origin_checker() {
+        ++(engine().cpu_id() == origin ? destroyed : destroyed_elsewhere);
+    }
+};
+thread_local unsigned origin_checker::destroyed;
+thread_local unsigned origin_checker::destroyed_elsewhere;
+
+future<bool> test_foreign_ptr_batched_destruction() {
+    std::vector<foreign_ptr<std::unique_ptr<origin_checker>>> objs;
+    for (int i = 0; i < 1000; ++i) {
+        objs.push_back(make_foreign(std::make_unique<origin_checker>()));
+    }
+    objs.push_back(make_foreign(std::unique_ptr<origin_checker>()));
+    return smp::submit_to(1, [objs = std::move(objs)] () mutable {
+        objs.clear();
+    }).then([] {
+        return do_until([] { return origin_checker::destroyed == 1000; }, [] {
+            return later();
+        });
+    }).then([] {
+        return smp::submit_to(1, [] { return origin_checker::destroyed_elsewhere; });
+    }).then([] (unsigned destroyed_elsewhere) {
+        return make_ready_future<bool>(destroyed_elsewhere == 0 && origin_checker::destroyed_elsewhere == 0);
+    });
+}
+
+future<bool> test_nearby_shards() {
+    bool ok = true;
+    for (auto s : smp::all_cpus()) {
+        auto nearby = smp::nearby_shards(s);
+        auto sorted = nearby;
+        std::sort(sorted.begin(), sorted.end());
+        ok &= nearby.front() == s;
+        ok &= sorted == std::vector<unsigned>(smp::all_cpus().begin(), smp::all_cpus().end());
+        // shards sharing the cache domain come before the others
+        auto shares_cache = [s] (unsigned peer) {
+            return smp::numa_node(peer) == smp::numa_node(s) && smp::cache_domain(peer) == smp::cache_domain(s);
+        };
+        ok &= std::is_partitioned(nearby.begin(), nearby.end(), shares_cache);
+    }
+    return make_ready_future<bool>(ok);
+}
+
 int tests, fails;
 
 future<>
@@ -72,6 +184,16 @@ int main(int ac, char** av) {
     return app_template().run_deprecated(ac, av, [] {
        return report("smp call", test_smp_call()).then([] {
            return report("smp exception", test_smp_exception());
+       }).then([] {
+           return report("smp large closure", test_smp_large_closure());
+       }).then([] {
+           return report("smp many in flight", test_smp_many_inflight());
+       }).then([] {
+           return report("smp stealable", test_smp_stealable());
+       }).then([] {
+           return report("foreign_ptr batched destruction", test_foreign_ptr_batched_destruction());
+       }).then([] {
+           return report("nearby shards", test_nearby_shards());
        }).then([] {
            print("\n%d tests / %d failures\n", tests, fails);
            engine().exit(fails ? 1 : 0);
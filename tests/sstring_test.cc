@@ -55,6 +55,8 @@ BOOST_AUTO_TEST_CASE(test_str_find_sstring) {
 
 BOOST_AUTO_TEST_CASE(test_str_not_find_sstring) {
     BOOST_REQUIRE_EQUAL(sstring("abcde").find("x"), sstring::npos);
+    BOOST_REQUIRE_EQUAL(sstring("abcde").find("dex"), sstring::npos);
+    BOOST_REQUIRE_EQUAL(sstring("abcde").find("b", 5), sstring::npos);
 }
 
 BOOST_AUTO_TEST_CASE(test_substr_sstring) {
@@ -129,3 +131,50 @@ BOOST_AUTO_TEST_CASE(test_ctor_iterator) {
     sstring s(data.begin(), data.end());
     BOOST_REQUIRE_EQUAL(s, "abc");
 }
+
+BOOST_AUTO_TEST_CASE(test_find_first_of) {
+    BOOST_REQUIRE_EQUAL(sstring("key value\r\n").find_first_of(" \r\n"), 3u);
+    BOOST_REQUIRE_EQUAL(sstring("key value\r\n").find_first_of("\r\n", 4), 9u);
+    BOOST_REQUIRE_EQUAL(sstring("key").find_first_of("\r\n"), sstring::npos);
+    BOOST_REQUIRE_EQUAL(sstring("key").find_first_of(""), sstring::npos);
+    // delimiters at every position of strings long enough for the vector
+    // loops, with sets small enough for them and not
+    const sstring sets[] = { ":", "\n:", ";,:=", "abcdefgh:", "0123456789abcdefghijklmnopqrstuvwxyz:" };
+    for (auto&& set : sets) {
+        for (size_t len = 1; len < 100; ++len) {
+            sstring s(len, '#');
+            BOOST_REQUIRE_EQUAL(s.find_first_of(set), sstring::npos);
+            for (size_t i = 0; i < len; i += 7) {
+                s[i] = ':';
+                BOOST_REQUIRE_EQUAL(s.find_first_of(set), i);
+                BOOST_REQUIRE_EQUAL(s.find_first_of(set, i + 1), sstring::npos);
+                BOOST_REQUIRE_EQUAL(s.find(':'), i);
+                s[i] = '#';
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_temporary_buffer_find) {
+    temporary_buffer<char> buf("GET / HTTP/1.1\r\nHost: x\r\n", 25);
+    BOOST_REQUIRE_EQUAL(buf.find('\n') - buf.begin(), 15);
+    BOOST_REQUIRE_EQUAL(buf.find_first_of(":\r", 2) - buf.begin(), 14);
+    BOOST_REQUIRE(buf.find('z') == buf.end());
+}
+
+BOOST_AUTO_TEST_CASE(test_append_grows) {
+    sstring s(100, 'a');
+    s.append("bcd", 3);
+    BOOST_REQUIRE_EQUAL(s.size(), 103u);
+    BOOST_REQUIRE_EQUAL(s, sstring(100, 'a') + "bcd");
+    // from itself
+    s.append(s.begin() + 99, 4);
+    BOOST_REQUIRE_EQUAL(s, sstring(100, 'a') + "bcdabcd");
+    s.resize(200, 'e');
+    BOOST_REQUIRE_EQUAL(s, sstring(100, 'a') + "bcdabcd" + sstring(93, 'e'));
+    BOOST_REQUIRE_EQUAL(s.c_str()[200], '\0');
+    sstring small("x");
+    small.append("yz", 2);
+    small.resize(5, 'w');
+    BOOST_REQUIRE_EQUAL(small, "xyzww");
+}
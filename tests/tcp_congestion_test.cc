@@ -0,0 +1,162 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#define BOOST_TEST_MODULE tcp_congestion
+
+#include <boost/test/included/unit_test.hpp>
+#include "net/tcp-congestion.hh"
+
+using namespace seastar;
+using namespace net;
+using namespace std::chrono_literals;
+
+using clock_type = tcp_congestion_control::clock_type;
+
+// Acknowledges a window of full segments per round trip
+static void run_round_trips(tcp_congestion_control& cc, tcp_congestion_state& s, clock_type::time_point& now, unsigned rtts) {
+    for (unsigned i = 0; i < rtts; ++i) {
+        auto acks = s.cwnd / s.mss;
+        for (unsigned j = 0; j < acks; ++j) {
+            cc.on_ack(s, s.mss, now);
+        }
+        now += s.srtt;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_algorithms_by_name) {
+    for (auto name : { "reno", "cubic", "bbr" }) {
+        BOOST_REQUIRE_EQUAL(sstring(make_tcp_congestion_control(name)->name()), sstring(name));
+    }
+    BOOST_REQUIRE_THROW(make_tcp_congestion_control("vegas"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(test_reno) {
+    tcp_reno reno;
+    tcp_congestion_state s;
+    s.mss = 1000;
+    s.cwnd = 4000;
+    s.ssthresh = 8000;
+    auto now = clock_type::now();
+    reno.on_ack(s, 1000, now);
+    BOOST_REQUIRE_EQUAL(s.cwnd, 5000u);
+    // slow start grows by at most a segment per ACK
+    reno.on_ack(s, 3000, now);
+    BOOST_REQUIRE_EQUAL(s.cwnd, 6000u);
+    s.cwnd = 10000;
+    reno.on_ack(s, 1000, now);
+    BOOST_REQUIRE_EQUAL(s.cwnd, 10100u);
+    reno.on_loss(s, 20000);
+    BOOST_REQUIRE_EQUAL(s.ssthresh, 10000u);
+    reno.on_loss(s, 1000);
+    BOOST_REQUIRE_EQUAL(s.ssthresh, 2000u);
+}
+
+BOOST_AUTO_TEST_CASE(test_cubic_regains_window_faster_than_reno) {
+    // 1000 segments of window, over 100ms round trips
+    tcp_congestion_state s;
+    s.mss = 1000;
+    s.cwnd = 1000000;
+    s.srtt = 100ms;
+    auto reno_s = s;
+
+    tcp_cubic cubic;
+    auto now = clock_type::now();
+    cubic.on_loss(s, s.cwnd);
+    BOOST_REQUIRE_EQUAL(s.ssthresh, 700000u);
+    s.cwnd = s.ssthresh;
+
+    tcp_reno reno;
+    reno.on_loss(reno_s, reno_s.cwnd);
+    reno_s.cwnd = reno_s.ssthresh = 700000;
+    auto reno_now = now;
+
+    // K = cbrt(W_max * (1 - beta) / C) is about 9.1s; the window grows
+    // fast at first, then levels off near W_max
+    run_round_trips(cubic, s, now, 30);
+    BOOST_REQUIRE_GT(s.cwnd, 850000u);
+    BOOST_REQUIRE_LT(s.cwnd, 1000000u);
+    run_round_trips(cubic, s, now, 50);
+    BOOST_REQUIRE_GT(s.cwnd, 990000u);
+    BOOST_REQUIRE_LT(s.cwnd, 1000000u);
+    // and probes beyond it after K
+    run_round_trips(cubic, s, now, 40);
+    BOOST_REQUIRE_GT(s.cwnd, 1005000u);
+
+    // where Reno regains a segment per round trip
+    run_round_trips(reno, reno_s, reno_now, 120);
+    BOOST_REQUIRE_LT(reno_s.cwnd, 830000u);
+
+    // fast convergence: a loss below W_max lowers it further
+    auto w = s.cwnd = 900000;
+    cubic.on_loss(s, s.cwnd);
+    BOOST_REQUIRE_EQUAL(s.ssthresh, uint32_t(w * tcp_cubic::beta));
+}
+
+BOOST_AUTO_TEST_CASE(test_bbr_models_the_path) {
+    // 100Mbit/s over 20ms round trips: a 250KB bandwidth-delay product
+    const uint64_t bottleneck = 12500000;
+    const auto rtt = 20ms;
+    const uint64_t bdp = bottleneck * std::chrono::duration_cast<std::chrono::microseconds>(rtt).count() / 1000000;
+
+    tcp_bbr bbr;
+    tcp_congestion_state s;
+    s.mss = 1000;
+    s.cwnd = 10000;
+    s.srtt = rtt;
+    auto now = clock_type::now();
+    uint64_t delivered = 0;
+    // the path delivers a window per round trip, up to its bandwidth-delay
+    // product
+    auto round_trip = [&] {
+        tcp_rate_sample rs;
+        rs.prior_delivered = delivered;
+        rs.acked_bytes = std::min<uint64_t>(s.cwnd, bdp);
+        delivered += rs.acked_bytes;
+        rs.delivered = delivered;
+        rs.interval = rtt;
+        rs.rtt = rtt;
+        now += rtt;
+        bbr.on_rate_sample(s, rs, now);
+    };
+
+    // Startup doubles the window each round trip
+    round_trip();
+    BOOST_REQUIRE_GT(s.pacing_rate, 0u);
+    BOOST_REQUIRE_EQUAL(s.cwnd, 20000u);
+    for (unsigned i = 0; i < 30; ++i) {
+        round_trip();
+    }
+    BOOST_REQUIRE_EQUAL(bbr.bandwidth(), bottleneck);
+    BOOST_REQUIRE(bbr.min_rtt() == rtt);
+    // ProbeBW keeps two bandwidth-delay products in flight, and paces
+    // around the bottleneck bandwidth
+    BOOST_REQUIRE_EQUAL(s.cwnd, 2 * bdp + 3 * s.mss);
+    BOOST_REQUIRE_GE(s.pacing_rate, bottleneck * 3 / 4);
+    BOOST_REQUIRE_LE(s.pacing_rate, bottleneck * 5 / 4);
+
+    // a loss does not shrink the window for good
+    auto cwnd = s.cwnd;
+    bbr.on_loss(s, s.cwnd);
+    s.cwnd = s.ssthresh / 2;
+    bbr.on_recovery_end(s);
+    BOOST_REQUIRE_EQUAL(s.cwnd, cwnd);
+}
@@ -0,0 +1,97 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE tcp_reassembly
+
+#include <boost/test/included/unit_test.hpp>
+#include "net/tcp.hh"
+
+using namespace seastar;
+using namespace net;
+
+static const sstring text = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+// The segment of text at [begin, end)
+static packet segment(uint32_t begin, uint32_t end) {
+    return packet(text.begin() + begin, end - begin);
+}
+
+static sstring contents(const tcp_reassembly::range& r) {
+    sstring s;
+    for (auto&& p : r.segments) {
+        for (auto&& f : p.fragments()) {
+            s += sstring(f.base, f.size);
+        }
+    }
+    return s;
+}
+
+static void check_ranges(const tcp_reassembly& ra, std::vector<std::pair<uint32_t, uint32_t>> expected) {
+    BOOST_REQUIRE_EQUAL(ra.ranges().size(), expected.size());
+    size_t bytes = 0;
+    for (size_t i = 0; i < expected.size(); ++i) {
+        auto& r = ra.ranges()[i];
+        BOOST_REQUIRE_EQUAL(r.begin.raw, expected[i].first);
+        BOOST_REQUIRE_EQUAL(r.end.raw, expected[i].second);
+        BOOST_REQUIRE_EQUAL(contents(r), text.substr(expected[i].first, expected[i].second - expected[i].first));
+        bytes += expected[i].second - expected[i].first;
+    }
+    BOOST_REQUIRE_EQUAL(ra.bytes(), bytes);
+}
+
+BOOST_AUTO_TEST_CASE(test_ranges_grow_and_join) {
+    tcp_reassembly ra;
+    BOOST_REQUIRE(ra.insert(make_seq(10), segment(10, 14)));
+    BOOST_REQUIRE(ra.insert(make_seq(14), segment(14, 16)));
+    check_ranges(ra, {{10, 16}});
+    BOOST_REQUIRE(ra.insert(make_seq(20), segment(20, 24)));
+    BOOST_REQUIRE(ra.insert(make_seq(2), segment(2, 4)));
+    check_ranges(ra, {{2, 4}, {10, 16}, {20, 24}});
+    // overlapping both ends of a range
+    BOOST_REQUIRE(ra.insert(make_seq(8), segment(8, 18)));
+    check_ranges(ra, {{2, 4}, {8, 18}, {20, 24}});
+    // already held
+    BOOST_REQUIRE(ra.insert(make_seq(11), segment(11, 13)));
+    check_ranges(ra, {{2, 4}, {8, 18}, {20, 24}});
+    // filling two gaps at once
+    BOOST_REQUIRE(ra.insert(make_seq(3), segment(3, 26)));
+    check_ranges(ra, {{2, 26}});
+
+    auto r = ra.pop_front();
+    BOOST_REQUIRE_EQUAL(contents(r), text.substr(2, 24));
+    BOOST_REQUIRE(ra.empty());
+    BOOST_REQUIRE_EQUAL(ra.bytes(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_limits_drop_the_furthest_data) {
+    tcp_reassembly ra(10, 2);
+    BOOST_REQUIRE(ra.insert(make_seq(10), segment(10, 12)));
+    BOOST_REQUIRE(ra.insert(make_seq(20), segment(20, 22)));
+    // a third range takes the place of the further one
+    BOOST_REQUIRE(ra.insert(make_seq(4), segment(4, 6)));
+    check_ranges(ra, {{4, 6}, {10, 12}});
+    // but is dropped when it is the furthest
+    BOOST_REQUIRE(!ra.insert(make_seq(30), segment(30, 32)));
+    check_ranges(ra, {{4, 6}, {10, 12}});
+    // and is cut to the bytes left
+    BOOST_REQUIRE(!ra.insert(make_seq(12), segment(12, 20)));
+    check_ranges(ra, {{4, 6}, {10, 18}});
+}
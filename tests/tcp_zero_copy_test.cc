@@ -0,0 +1,83 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <algorithm>
+#include <vector>
+#include "tests/test-utils.hh"
+#include "core/thread.hh"
+#include "core/reactor.hh"
+#include "core/sleep.hh"
+#include "net/api.hh"
+
+using namespace seastar;
+using namespace net;
+
+SEASTAR_TEST_CASE(test_zero_copy_writes_arrive_and_release_their_buffers) {
+    return seastar::async([] {
+        listen_options lo;
+        lo.reuse_address = true;
+        ipv4_addr addr("127.0.0.1", 10102);
+        auto ss = engine().listen(make_ipv4_address(addr), lo);
+        auto accepted = ss.accept();
+        auto client = engine().connect(make_ipv4_address(addr)).get0();
+        auto server = std::get<0>(accepted.get());
+        client.set_zero_copy_threshold(16 * 1024);
+
+        // the stream sends small packets along with the next ones, and the
+        // kernel copies loopback traffic anyway: all are sent zero-copy,
+        // until the first completion says so
+        std::vector<size_t> sizes = { 100, 64 * 1024, 1000, 256 * 1024, 16 * 1024 };
+        auto released = make_lw_shared<size_t>(0);
+        auto out = client.output();
+        size_t total = 0;
+        for (unsigned i = 0; i < sizes.size(); i++) {
+            auto buf = std::make_unique<std::vector<char>>(sizes[i], char('a' + i));
+            auto data = buf->data();
+            packet p(fragment{data, sizes[i]}, make_deleter([buf = std::move(buf), released] {
+                ++*released;
+            }));
+            out.write(std::move(p)).get();
+            total += sizes[i];
+        }
+        out.flush().get();
+
+        auto in = server.input();
+        std::vector<char> received;
+        while (received.size() < total) {
+            auto buf = in.read().get0();
+            BOOST_REQUIRE(!buf.empty());
+            received.insert(received.end(), buf.begin(), buf.end());
+        }
+        auto pos = received.begin();
+        for (unsigned i = 0; i < sizes.size(); i++) {
+            BOOST_REQUIRE(std::all_of(pos, pos + sizes[i], [i] (char c) { return c == char('a' + i); }));
+            pos += sizes[i];
+        }
+
+        for (unsigned tries = 0; *released < sizes.size() && tries < 1000; tries++) {
+            sleep(std::chrono::milliseconds(1)).get();
+        }
+        BOOST_REQUIRE_EQUAL(*released, sizes.size());
+        out.close().get();
+        in.close().get();
+    });
+}
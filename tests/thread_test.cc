@@ -135,6 +135,39 @@ SEASTAR_TEST_CASE(test_thread_sched_group) {
     });
 }
 
+SEASTAR_TEST_CASE(test_thread_stack_size) {
+    return async([] {
+        thread_attributes attr;
+        attr.stack_size = 1024 * 1024;
+        thread t(attr, [] {
+            // would overflow the default 128KB stack
+            std::vector<char> ref(512 * 1024, 'x');
+            auto buf = static_cast<volatile char*>(alloca(ref.size()));
+            for (size_t i = 0; i < ref.size(); i++) {
+                buf[i] = ref[i];
+            }
+            BOOST_REQUIRE_EQUAL(buf[ref.size() - 1], 'x');
+        });
+        t.join().get();
+    });
+}
+
+#ifndef ASAN_ENABLED
+SEASTAR_TEST_CASE(test_thread_stack_reuse) {
+    return async([] {
+        // warm up the pool with a stack of the default size
+        async([] { }).get();
+        auto before = thread_impl::get_stack_pool_stats();
+        for (int i = 0; i < 100; i++) {
+            async([] { }).get();
+        }
+        auto after = thread_impl::get_stack_pool_stats();
+        BOOST_REQUIRE_EQUAL(after.allocations, before.allocations);
+        BOOST_REQUIRE_EQUAL(after.reuses - before.reuses, 100u);
+    });
+}
+#endif
+
 #if defined(ASAN_ENABLED) && defined(HAVE_ASAN_FIBER_SUPPORT)
 volatile int force_write;
 volatile void* shut_up_gcc;
@@ -0,0 +1,148 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include <random>
+#include <vector>
+#include <memory>
+#include "core/timer-wheel.hh"
+
+using namespace seastar;
+
+struct test_clock {
+    using rep = int64_t;
+    using period = std::milli;
+    using duration = std::chrono::duration<rep, period>;
+    using time_point = std::chrono::time_point<test_clock, duration>;
+    static time_point now() { return time_point(); }
+};
+
+struct test_timer {
+    using clock = test_clock;
+    using duration = test_clock::duration;
+    using time_point = test_clock::time_point;
+    boost::intrusive::list_member_hook<> link;
+    time_point timeout;
+    bool queued = false;
+    time_point get_timeout() { return timeout; }
+    void cancel() { }
+};
+
+using wheel = timer_wheel<test_timer, &test_timer::link, 10>;
+
+static test_clock::time_point at(int64_t ms) {
+    return test_clock::time_point(test_clock::duration(ms));
+}
+
+BOOST_AUTO_TEST_CASE(test_expire_exact) {
+    wheel w;
+    test_timer t1, t2, t3;
+    t1.timeout = at(5);
+    t2.timeout = at(15);
+    t3.timeout = at(100000);
+    BOOST_REQUIRE(w.insert(t1));
+    BOOST_REQUIRE(!w.insert(t2));
+    BOOST_REQUIRE(!w.insert(t3));
+    BOOST_REQUIRE_EQUAL(w.size(), 3u);
+    BOOST_REQUIRE(w.get_next_timeout() == at(5));
+
+    // same tick as t1, but earlier than its timeout
+    auto exp = w.expire(at(4));
+    BOOST_REQUIRE(exp.empty());
+    exp = w.expire(at(5));
+    BOOST_REQUIRE_EQUAL(exp.size(), 1u);
+    BOOST_REQUIRE(&exp.front() == &t1);
+    exp.clear();
+    BOOST_REQUIRE(w.get_next_timeout() == at(15));
+
+    w.remove(t2);
+    BOOST_REQUIRE_EQUAL(w.size(), 1u);
+    exp = w.expire(at(99999));
+    BOOST_REQUIRE(exp.empty());
+    BOOST_REQUIRE(w.get_next_timeout() == at(100000));
+    exp = w.expire(at(200000));
+    BOOST_REQUIRE_EQUAL(exp.size(), 1u);
+    BOOST_REQUIRE(&exp.front() == &t3);
+    exp.clear();
+    BOOST_REQUIRE(w.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_insert_in_the_past) {
+    wheel w;
+    w.expire(at(1000));
+    test_timer t;
+    t.timeout = at(10);
+    BOOST_REQUIRE(w.insert(t));
+    BOOST_REQUIRE(w.get_next_timeout() == at(1000));
+    auto exp = w.expire(at(1000));
+    BOOST_REQUIRE_EQUAL(exp.size(), 1u);
+    exp.clear();
+}
+
+BOOST_AUTO_TEST_CASE(test_random_against_reference) {
+    std::default_random_engine rnd(42);
+    std::uniform_int_distribution<int64_t> delay(0, 1 << 22);
+    std::uniform_int_distribution<int> action(0, 9);
+    wheel w;
+    std::vector<std::unique_ptr<test_timer>> timers;
+    int64_t now = 0;
+    for (int i = 0; i < 20000; ++i) {
+        auto a = action(rnd);
+        if (a < 6) {
+            timers.push_back(std::make_unique<test_timer>());
+            timers.back()->timeout = at(now + delay(rnd));
+            timers.back()->queued = true;
+            w.insert(*timers.back());
+        } else if (a < 8 && !timers.empty()) {
+            auto& t = timers[rnd() % timers.size()];
+            if (t->queued) {
+                w.remove(*t);
+                t->queued = false;
+            }
+        } else {
+            now += delay(rnd) / 64;
+            auto exp = w.expire(at(now));
+            for (auto& t : exp) {
+                BOOST_REQUIRE(t.queued);
+                BOOST_REQUIRE(t.timeout <= at(now));
+                t.queued = false;
+            }
+            exp.clear();
+            for (auto& t : timers) {
+                BOOST_REQUIRE(!t->queued || t->timeout > at(now));
+            }
+            if (!w.empty()) {
+                auto next = w.get_next_timeout();
+                for (auto& t : timers) {
+                    BOOST_REQUIRE(!t->queued || t->timeout >= next);
+                }
+            }
+        }
+    }
+    size_t queued = 0;
+    for (auto& t : timers) {
+        queued += t->queued;
+    }
+    BOOST_REQUIRE_EQUAL(w.size(), queued);
+    w.clear();
+}
@@ -30,6 +30,7 @@
 #include "core/thread.hh"
 #include "core/gate.hh"
 #include "net/tls.hh"
+#include "util/defer.hh"
 
 #if 0
 #include <gnutls/gnutls.h>
@@ -250,12 +251,16 @@ class echoserver {
     bool _stopped = false;
     size_t _size;
 public:
-    echoserver(size_t message_size)
+    echoserver(size_t message_size, sstring ticket_key = {})
             : _certs(
                     ::make_shared<tls::server_credentials>(
                             ::make_shared<tls::dh_params>()))
             , _size(message_size)
-    {}
+    {
+        if (!ticket_key.empty()) {
+            _certs->enable_session_tickets(ticket_key);
+        }
+    }
 
     future<> listen(socket_address addr, sstring crtfile, sstring keyfile, tls::client_auth ca = tls::client_auth::NONE) {
         _certs->set_client_auth(ca);
@@ -471,3 +476,85 @@ SEASTAR_TEST_CASE(test_many_large_message_x509_client_server) {
     });
 }
 
+
+SEASTAR_TEST_CASE(test_session_resumption) {
+    return seastar::async([] {
+        static const auto port = 4712;
+        auto addr = ::make_ipv4_address( {0x7f000001, port});
+        auto certs = ::make_shared<tls::certificate_credentials>();
+        certs->set_x509_trust_file("tests/catest.pem", tls::x509_crt_format::PEM).get();
+        certs->enable_session_cache();
+
+        seastar::sharded<echoserver> server;
+        // the same master key on all shards
+        server.start(message.size(), tls::generate_session_ticket_key()).get();
+        auto stop_server = defer([&server] { server.stop().get(); });
+        server.invoke_on_all(&echoserver::listen, addr, sstring("tests/test.crt"), sstring("tests/test.key"), tls::client_auth::NONE).get();
+
+        // the later connections offer the session of the previous one
+        for (int i = 0; i < 3; ++i) {
+            streams s(tls::connect(certs, addr, "test.scylladb.org").get0());
+            s.out.write(message).get();
+            s.out.flush().get();
+            auto buf = s.in.read_exactly(message.size()).get0();
+            BOOST_REQUIRE_EQUAL(sstring(buf.begin(), buf.end()), message);
+            s.out.close().get();
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_session_ticket_key_size) {
+    tls::server_credentials creds(::make_shared<tls::dh_params>());
+    BOOST_REQUIRE_EQUAL(tls::generate_session_ticket_key().size(), 64u);
+    BOOST_REQUIRE_THROW(creds.enable_session_tickets("too short"), std::invalid_argument);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_kernel_tls_client) {
+    // Where the kernel has no kTLS, the session just stays in user space
+    return seastar::async([] {
+        static const auto port = 4713;
+        auto addr = ::make_ipv4_address( {0x7f000001, port});
+        auto certs = ::make_shared<tls::certificate_credentials>();
+        certs->set_x509_trust_file("tests/catest.pem", tls::x509_crt_format::PEM).get();
+        certs->enable_kernel_tls();
+
+        seastar::sharded<echoserver> server;
+        server.start(message.size()).get();
+        auto stop_server = defer([&server] { server.stop().get(); });
+        server.invoke_on_all(&echoserver::listen, addr, sstring("tests/test.crt"), sstring("tests/test.key"), tls::client_auth::NONE).get();
+
+        streams s(tls::connect(certs, addr, "test.scylladb.org").get0());
+        for (int i = 0; i < 20; ++i) {
+            s.out.write(message).get();
+            s.out.flush().get();
+            auto buf = s.in.read_exactly(message.size()).get0();
+            BOOST_REQUIRE_EQUAL(sstring(buf.begin(), buf.end()), message);
+        }
+        s.out.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_offloaded_handshake_client) {
+    return seastar::async([] {
+        static const auto port = 4714;
+        auto addr = ::make_ipv4_address( {0x7f000001, port});
+        auto certs = ::make_shared<tls::certificate_credentials>();
+        certs->set_x509_trust_file("tests/catest.pem", tls::x509_crt_format::PEM).get();
+        certs->enable_handshake_offload();
+
+        seastar::sharded<echoserver> server;
+        server.start(message.size()).get();
+        auto stop_server = defer([&server] { server.stop().get(); });
+        server.invoke_on_all(&echoserver::listen, addr, sstring("tests/test.crt"), sstring("tests/test.key"), tls::client_auth::NONE).get();
+
+        for (int i = 0; i < 3; ++i) {
+            streams s(tls::connect(certs, addr, "test.scylladb.org").get0());
+            s.out.write(message).get();
+            s.out.flush().get();
+            auto buf = s.in.read_exactly(message.size()).get0();
+            BOOST_REQUIRE_EQUAL(sstring(buf.begin(), buf.end()), message);
+            s.out.close().get();
+        }
+    });
+}
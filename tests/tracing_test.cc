@@ -0,0 +1,131 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <algorithm>
+#include "tests/test-utils.hh"
+#include "core/tracing.hh"
+#include "core/reactor.hh"
+#include "core/thread.hh"
+
+using namespace seastar;
+
+SEASTAR_TEST_CASE(test_spans_are_sampled) {
+    return seastar::async([] {
+        tracing::set_sampling_rate(0);
+        {
+            tracing::span sp("untraced");
+            BOOST_REQUIRE(!sp);
+        }
+        BOOST_REQUIRE(tracing::drain().empty());
+
+        tracing::set_sampling_rate(0.25);
+        unsigned sampled = 0;
+        for (unsigned i = 0; i < 100; ++i) {
+            tracing::span sp("root");
+            sampled += bool(sp);
+        }
+        BOOST_REQUIRE_EQUAL(sampled, 25u);
+        BOOST_REQUIRE_EQUAL(tracing::drain().size(), 25u);
+        tracing::set_sampling_rate(0);
+    });
+}
+
+SEASTAR_TEST_CASE(test_child_spans) {
+    return seastar::async([] {
+        tracing::set_sampling_rate(1);
+        tracing::span root("root");
+        tracing::set_sampling_rate(0);
+        BOOST_REQUIRE(root);
+        {
+            tracing::context_scope scope(root.context());
+            tracing::span child("child");
+            BOOST_REQUIRE(child);
+            BOOST_REQUIRE_EQUAL(child.context().trace_id, root.context().trace_id);
+            child.set_detail("work");
+        }
+        BOOST_REQUIRE(!tracing::current());
+        root.end();
+        BOOST_REQUIRE(!root);
+
+        auto spans = tracing::drain();
+        BOOST_REQUIRE_EQUAL(spans.size(), 2u);
+        BOOST_REQUIRE_EQUAL(sstring(spans[0].name), "child");
+        BOOST_REQUIRE_EQUAL(spans[0].detail, "work");
+        BOOST_REQUIRE_EQUAL(spans[0].parent_id, spans[1].span_id);
+        BOOST_REQUIRE_EQUAL(spans[1].parent_id, 0u);
+        BOOST_REQUIRE_EQUAL(spans[1].shard, engine().cpu_id());
+    });
+}
+
+SEASTAR_TEST_CASE(test_full_buffer_drops_oldest) {
+    return seastar::async([] {
+        tracing::set_sampling_rate(1);
+        tracing::set_buffer_capacity(2);
+        auto dropped = tracing::dropped_spans();
+        for (auto name : {"a", "b", "c"}) {
+            tracing::span sp(name);
+        }
+        tracing::set_sampling_rate(0);
+        BOOST_REQUIRE_EQUAL(tracing::dropped_spans(), dropped + 1);
+        auto spans = tracing::drain(1);
+        BOOST_REQUIRE_EQUAL(spans.size(), 1u);
+        BOOST_REQUIRE_EQUAL(sstring(spans[0].name), "b");
+        BOOST_REQUIRE_EQUAL(tracing::drain().size(), 1u);
+        tracing::set_buffer_capacity(4096);
+    });
+}
+
+SEASTAR_TEST_CASE(test_context_follows_submit_to) {
+    return seastar::async([] {
+        tracing::set_sampling_rate(1);
+        tracing::span root("root");
+        tracing::set_sampling_rate(0);
+        auto trace_id = root.context().trace_id;
+        auto shard = smp::count - 1;
+        {
+            tracing::context_scope scope(root.context());
+            smp::submit_to(shard, [] {
+                tracing::span sp("remote");
+            }).get();
+        }
+        root.end();
+        auto spans = tracing::drain_all().get0();
+        BOOST_REQUIRE_EQUAL(spans.size(), 2u);
+        auto remote = std::find_if(spans.begin(), spans.end(), [] (const tracing::span_record& s) {
+            return sstring(s.name) == "remote";
+        });
+        BOOST_REQUIRE(remote != spans.end());
+        BOOST_REQUIRE_EQUAL(remote->shard, shard);
+        BOOST_REQUIRE_EQUAL(remote->trace_id, trace_id);
+    });
+}
+
+SEASTAR_TEST_CASE(test_parse_traceparent) {
+    auto ctx = tracing::parse_traceparent("00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01");
+    BOOST_REQUIRE_EQUAL(ctx.trace_id, 0xa3ce929d0e0e4736u);
+    BOOST_REQUIRE_EQUAL(ctx.span_id, 0x00f067aa0ba902b7u);
+    // not sampled
+    BOOST_REQUIRE(!tracing::parse_traceparent("00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-00"));
+    BOOST_REQUIRE(!tracing::parse_traceparent("00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7"));
+    BOOST_REQUIRE(!tracing::parse_traceparent("00-4BF92F3577B34DA6A3CE929D0E0E4736-00f067aa0ba902b7-01"));
+    return make_ready_future<>();
+}
@@ -0,0 +1,84 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "test-utils.hh"
+
+#include <core/tsc_clock.hh>
+#include <core/sleep.hh>
+#include <core/thread.hh>
+
+#include <chrono>
+#include <thread>
+
+using namespace seastar;
+using namespace std::chrono_literals;
+
+//
+// The clock never goes back, including across re-anchoring to steady_clock.
+//
+SEASTAR_TEST_CASE(tsc_clock_is_monotonic) {
+    return seastar::async([] {
+        auto prev = tsc_clock::now();
+        auto end = std::chrono::steady_clock::now() + 300ms;
+        while (std::chrono::steady_clock::now() < end) {
+            auto now = tsc_clock::now();
+            BOOST_REQUIRE(now >= prev);
+            prev = now;
+        }
+    });
+}
+
+//
+// The clock keeps to steady_clock, on the reactor thread and on threads
+// that calibrate it themselves or not at all. Boost.Test is not thread
+// safe, so the other threads just report.
+//
+static bool tracks_steady_clock() {
+    for (unsigned i = 0; i < 3; ++i) {
+        std::this_thread::sleep_for(60ms);
+        auto before = std::chrono::steady_clock::now();
+        auto now = tsc_clock::to_steady(tsc_clock::now());
+        auto after = std::chrono::steady_clock::now();
+        if (now < before - 100us || now > after + 100us) {
+            return false;
+        }
+    }
+    return true;
+}
+
+SEASTAR_TEST_CASE(tsc_clock_tracks_steady_clock) {
+    return seastar::async([] {
+        BOOST_REQUIRE(tracks_steady_clock());
+        bool calibrated_ok = false;
+        bool uncalibrated_ok = false;
+        std::thread calibrated([&calibrated_ok] {
+            tsc_clock::calibrate();
+            calibrated_ok = tracks_steady_clock();
+        });
+        std::thread uncalibrated([&uncalibrated_ok] {
+            uncalibrated_ok = !tsc_clock::uses_tsc() && tracks_steady_clock();
+        });
+        calibrated.join();
+        uncalibrated.join();
+        BOOST_REQUIRE(calibrated_ok);
+        BOOST_REQUIRE(uncalibrated_ok);
+    });
+}
@@ -0,0 +1,113 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "tests/test-utils.hh"
+#include "core/thread.hh"
+#include "core/reactor.hh"
+#include "core/future-util.hh"
+#include "net/api.hh"
+
+using namespace seastar;
+using namespace net;
+
+static packet make_datagram(unsigned i, size_t size) {
+    std::string s(size, char('a' + i % 26));
+    return packet(s.data(), s.size());
+}
+
+SEASTAR_TEST_CASE(test_datagrams_sent_together_arrive_in_order) {
+    return seastar::async([] {
+        ipv4_addr server_addr("127.0.0.1", 10101);
+        auto server = engine().net().make_udp_channel(server_addr);
+        auto client = engine().net().make_udp_channel(ipv4_addr("127.0.0.1", 0));
+
+        // a run of equally sized datagrams, which may go as one GSO
+        // message, a shorter one that ends it, then differently sized ones
+        // and one that overflows its receive slot
+        std::vector<size_t> sizes(30, 100);
+        sizes.push_back(60);
+        for (size_t i = 0; i < 10; i++) {
+            sizes.push_back(200 + i);
+        }
+        sizes.push_back(20000);
+        std::vector<future<>> sent;
+        for (unsigned i = 0; i < sizes.size(); i++) {
+            sent.push_back(client.send(server_addr, make_datagram(i, sizes[i])));
+        }
+        for (auto&& f : when_all(sent.begin(), sent.end()).get0()) {
+            f.get();
+        }
+
+        for (unsigned i = 0; i < sizes.size(); i++) {
+            auto d = server.receive().get0();
+            auto& p = d.get_data();
+            BOOST_REQUIRE_EQUAL(p.len(), sizes[i]);
+            p.linearize();
+            auto data = p.frag(0);
+            BOOST_REQUIRE(std::all_of(data.base, data.base + data.size, [i] (char c) { return c == char('a' + i % 26); }));
+            BOOST_REQUIRE_EQUAL(d.get_src().ip, 0x7f000001u);
+            BOOST_REQUIRE_EQUAL(d.get_dst().ip, 0x7f000001u);
+            BOOST_REQUIRE_EQUAL(d.get_dst_port(), 10101u);
+        }
+        client.close();
+        server.close();
+    });
+}
+
+SEASTAR_TEST_CASE(test_payloads_outlive_channel) {
+    return seastar::async([] {
+        ipv4_addr server_addr("127.0.0.1", 10103);
+        auto server = engine().net().make_udp_channel(server_addr);
+        auto client = engine().net().make_udp_channel(ipv4_addr("127.0.0.1", 0));
+
+        std::vector<size_t> sizes = { 10, 3000, 20, 60000, 30 };
+        for (unsigned i = 0; i < sizes.size(); i++) {
+            client.send(server_addr, make_datagram(i, sizes[i])).get();
+        }
+        std::vector<packet> payloads;
+        for (unsigned i = 0; i < sizes.size(); i++) {
+            payloads.push_back(std::move(server.receive().get0().get_data()));
+        }
+        client.close();
+        server.close();
+        server = {};
+
+        for (unsigned i = 0; i < sizes.size(); i++) {
+            auto& p = payloads[i];
+            BOOST_REQUIRE_EQUAL(p.len(), sizes[i]);
+            for (auto&& f : p.fragments()) {
+                BOOST_REQUIRE(std::all_of(f.base, f.base + f.size, [i] (char c) { return c == char('a' + i % 26); }));
+            }
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_send_after_close_fails) {
+    return seastar::async([] {
+        auto chan = engine().net().make_udp_channel(ipv4_addr("127.0.0.1", 0));
+        chan.close();
+        BOOST_REQUIRE_THROW(chan.send(ipv4_addr("127.0.0.1", 10102), "x").get(), std::system_error);
+    });
+}
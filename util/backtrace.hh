@@ -83,6 +83,8 @@ class saved_backtrace {
     saved_backtrace(vector_type f) : _frames(std::move(f)) {}
     size_t hash() const;
 
+    const vector_type& frames() const { return _frames; }
+
     friend std::ostream& operator<<(std::ostream& out, const saved_backtrace&);
 
     bool operator==(const saved_backtrace& o) const {
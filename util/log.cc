@@ -33,12 +33,17 @@
 #include <cxxabi.h>
 #include <syslog.h>
 
+#include <algorithm>
+#include <condition_variable>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <regex>
 #include <string>
 #include <system_error>
 #include <chrono>
+#include <thread>
+#include <vector>
 
 using namespace std::chrono_literals;
 
@@ -143,6 +148,164 @@ std::istream& operator>>(std::istream& in, log_level& level) {
 
 std::atomic<bool> logger::_stdout = { true };
 std::atomic<bool> logger::_syslog = { false };
+std::atomic<bool> logger::_async = { false };
+
+namespace {
+
+// A message formatted by a shard, waiting to be written
+struct async_log_entry {
+    bool to_stdout;
+    bool to_syslog;
+    int syslog_level;
+    std::string stdout_prefix; // level and timestamp
+    std::string text;
+};
+
+// Messages of one thread, which alone produces them, to the writer thread,
+// which alone consumes them. The entries are reused, so that their strings
+// are allocated and freed by the producer.
+class async_log_ring {
+    std::vector<async_log_entry> _entries;
+    std::atomic<size_t> _head = { 0 }; // consumed
+    std::atomic<size_t> _tail = { 0 }; // produced
+    std::atomic<uint64_t> _dropped = { 0 };
+public:
+    const int shard;
+    uint64_t reported_dropped = 0; // by the writer
+public:
+    async_log_ring(size_t capacity, int shard) : _entries(std::max<size_t>(capacity, 1)), shard(shard) {}
+    // Returns the entry to fill, or nullptr, counting a dropped message,
+    // if the ring is full
+    async_log_entry* prepare() {
+        auto tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == _entries.size()) {
+            _dropped.store(_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &_entries[tail % _entries.size()];
+    }
+    void commit() {
+        _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    uint64_t dropped() const {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+    // Passes the committed entries to func; returns their number
+    template <typename Func>
+    size_t consume(Func func) {
+        auto head = _head.load(std::memory_order_relaxed);
+        auto tail = _tail.load(std::memory_order_acquire);
+        for (auto i = head; i != tail; ++i) {
+            func(_entries[i % _entries.size()]);
+        }
+        _head.store(tail, std::memory_order_release);
+        return tail - head;
+    }
+};
+
+// The thread that writes the messages of all rings
+class async_log_writer {
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::vector<std::shared_ptr<async_log_ring>> _rings;
+    std::thread _thread;
+    bool _stopping = false;
+private:
+    static void write(const async_log_entry& e) {
+        if (e.to_stdout) {
+            std::cout << e.stdout_prefix << e.text;
+        }
+        if (e.to_syslog) {
+            syslog(e.syslog_level, "%s", e.text.c_str());
+        }
+    }
+    static void report_dropped(async_log_ring& r) {
+        auto dropped = r.dropped();
+        if (dropped == r.reported_dropped) {
+            return;
+        }
+        auto n = dropped - r.reported_dropped;
+        r.reported_dropped = dropped;
+        std::ostringstream out;
+        out << "WARN  " << space_and_current_timestamp();
+        auto text = r.shard >= 0
+                ? sprint(" [shard %d] seastar - asynchronous logging dropped %d messages, its buffer was full\n", r.shard, n)
+                : sprint(" seastar - asynchronous logging dropped %d messages, its buffer was full\n", n);
+        std::cout << out.str() << text;
+        syslog(LOG_WARNING, "%s", text.c_str());
+    }
+    // Returns whether anything was written
+    bool drain(const std::vector<std::shared_ptr<async_log_ring>>& rings) {
+        size_t written = 0;
+        for (auto&& r : rings) {
+            written += r->consume(write);
+            report_dropped(*r);
+        }
+        if (written) {
+            std::cout.flush();
+        }
+        return written;
+    }
+    void run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            auto rings = _rings;
+            lock.unlock();
+            auto wrote = drain(rings);
+            rings.clear();
+            lock.lock();
+            // rings whose thread is gone; what it logged last is written
+            // before they go
+            _rings.erase(std::remove_if(_rings.begin(), _rings.end(), [this] (auto&& r) {
+                if (r.use_count() != 1) {
+                    return false;
+                }
+                drain({r});
+                return true;
+            }), _rings.end());
+            if (wrote) {
+                continue;
+            }
+            if (_stopping) {
+                break;
+            }
+            // a notification may be missed while draining; the timeout
+            // bounds the delay it causes
+            _cv.wait_for(lock, 100ms);
+        }
+    }
+public:
+    ~async_log_writer() {
+        // whatever is logged from now on is written synchronously
+        logger::set_async_enabled(false);
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (!_thread.joinable()) {
+            return;
+        }
+        _stopping = true;
+        lock.unlock();
+        _cv.notify_one();
+        _thread.join();
+    }
+    std::shared_ptr<async_log_ring> add_ring(size_t capacity) {
+        auto r = std::make_shared<async_log_ring>(capacity, local_engine ? int(engine().cpu_id()) : -1);
+        std::lock_guard<std::mutex> g(_mutex);
+        if (!_thread.joinable()) {
+            _thread = std::thread([this] { run(); });
+        }
+        _rings.push_back(r);
+        return r;
+    }
+    void wake() {
+        _cv.notify_one();
+    }
+};
+
+async_log_writer the_async_log_writer;
+std::atomic<size_t> async_log_buffer_size = { 1024 };
+thread_local std::shared_ptr<async_log_ring> local_async_log_ring;
+
+}
 
 logger::logger(sstring name) : _name(std::move(name)) {
     global_logger_registry().register_logger(this);
@@ -157,12 +320,22 @@ logger::~logger() {
 }
 
 void
-logger::really_do_log(log_level level, const char* fmt, stringer** s, size_t n) {
+logger::really_do_log(log_level level, uint64_t dropped, const char* fmt, stringer** s, size_t n) {
     bool is_stdout_enabled = _stdout.load(std::memory_order_relaxed);
     bool is_syslog_enabled = _syslog.load(std::memory_order_relaxed);
     if(!is_stdout_enabled && !is_syslog_enabled) {
       return;
     }
+    async_log_entry* async_entry = nullptr;
+    if (_async.load(std::memory_order_relaxed)) {
+        if (!local_async_log_ring) {
+            local_async_log_ring = the_async_log_writer.add_ring(async_log_buffer_size.load(std::memory_order_relaxed));
+        }
+        async_entry = local_async_log_ring->prepare();
+        if (!async_entry) {
+            return;
+        }
+    }
     std::ostringstream out, log;
     static array_map<sstring, 20> level_map = {
             { int(log_level::debug), "DEBUG" },
@@ -177,6 +350,9 @@ logger::really_do_log(log_level level, const char* fmt, stringer** s, size_t n)
       } else {
         out << " " << _name << " - ";
       }
+      if (dropped) {
+        out << "(rate limiting dropped " << dropped << " similar messages) ";
+      }
       const char* p = fmt;
       while (*p != '\0') {
         if (*p == '{' && *(p+1) == '}') {
@@ -198,6 +374,28 @@ logger::really_do_log(log_level level, const char* fmt, stringer** s, size_t n)
       }
       out << "\n";
     };
+    static array_map<int, 20> syslog_level_map = {
+            { int(log_level::debug), LOG_DEBUG },
+            { int(log_level::info), LOG_INFO },
+            { int(log_level::trace), LOG_DEBUG },  // no LOG_TRACE
+            { int(log_level::warn), LOG_WARNING },
+            { int(log_level::error), LOG_ERR },
+    };
+    if (async_entry) {
+        // formatted once, since both outputs share the text after the timestamp
+        async_entry->to_stdout = is_stdout_enabled;
+        async_entry->to_syslog = is_syslog_enabled;
+        async_entry->syslog_level = syslog_level_map[int(level)];
+        if (is_stdout_enabled) {
+            out << level_map[int(level)] << space_and_current_timestamp();
+        }
+        async_entry->stdout_prefix = out.str();
+        print_once(log);
+        async_entry->text = log.str();
+        local_async_log_ring->commit();
+        the_async_log_writer.wake();
+        return;
+    }
     if (is_stdout_enabled) {
         out << level_map[int(level)] << space_and_current_timestamp();
         print_once(out);
@@ -205,13 +403,6 @@ logger::really_do_log(log_level level, const char* fmt, stringer** s, size_t n)
     }
     if (is_syslog_enabled) {
         print_once(log);
-        static array_map<int, 20> level_map = {
-                { int(log_level::debug), LOG_DEBUG },
-                { int(log_level::info), LOG_INFO },
-                { int(log_level::trace), LOG_DEBUG },  // no LOG_TRACE
-                { int(log_level::warn), LOG_WARNING },
-                { int(log_level::error), LOG_ERR },
-        };
         // NOTE: syslog() can block, which will stall the reactor thread.
         //       this should be rare (will have to fill the pipe buffer
         //       before syslogd can clear it) but can happen.  If it does,
@@ -219,14 +410,14 @@ logger::really_do_log(log_level level, const char* fmt, stringer** s, size_t n)
         //       still means the problem can happen, just less frequently).
         // syslog() interprets % characters, so send msg as a parameter
         auto msg = log.str();
-        syslog(level_map[int(level)], "%s", msg.c_str());
+        syslog(syslog_level_map[int(level)], "%s", msg.c_str());
     }
 }
 
 void logger::failed_to_log(std::exception_ptr ex)
 {
     try {
-        do_log(log_level::error, "failed to log message: {}", ex);
+        do_log(log_level::error, 0, "failed to log message: {}", ex);
     } catch (...) {
         ++logging_failures;
     }
@@ -242,6 +433,32 @@ logger::set_syslog_enabled(bool enabled) {
     _syslog.store(enabled, std::memory_order_relaxed);
 }
 
+void
+logger::set_async_enabled(bool enabled, size_t buffer_size) {
+    async_log_buffer_size.store(buffer_size, std::memory_order_relaxed);
+    _async.store(enabled, std::memory_order_relaxed);
+}
+
+uint64_t
+logger::async_dropped_messages() {
+    return local_async_log_ring ? local_async_log_ring->dropped() : 0;
+}
+
+logger::rate_limit::rate_limit(std::chrono::milliseconds interval)
+        : _interval(interval) {
+}
+
+bool
+logger::rate_limit::check() {
+    auto now = clock::now();
+    if (now < _next) {
+        ++_dropped_messages;
+        return false;
+    }
+    _next = now + _interval;
+    return true;
+}
+
 bool logger::is_shard_zero() {
     return engine().cpu_id() == 0;
 }
@@ -309,6 +526,7 @@ void apply_logging_settings(const logging_settings& s) {
 
     logger::set_stdout_enabled(s.stdout_enabled);
     logger::set_syslog_enabled(s.syslog_enabled);
+    logger::set_async_enabled(s.async_enabled, s.async_buffer_size);
 
     switch (s.stdout_timestamp_style) {
     case logger_timestamp_style::none:
@@ -372,6 +590,11 @@ bpo::options_description get_options_description() {
                     "Select timestamp style for stdout logs: none|boot|real")
             ("log-to-stdout", bpo::value<bool>()->default_value(true), "Send log output to stdout.")
             ("log-to-syslog", bpo::value<bool>()->default_value(false), "Send log output to syslog.")
+            ("log-async", bpo::value<bool>()->default_value(false),
+                    "Write log output from a separate thread, so that a slow stdout or syslog does not stall the shards; "
+                    "messages are dropped when a shard logs faster than they are written.")
+            ("log-async-buffer-size", bpo::value<size_t>()->default_value(1024),
+                    "Number of messages each shard may have waiting to be written, with --log-async.")
             ("help-loggers", bpo::bool_switch(), "Print a list of logger names and exit.");
 
     return opts;
@@ -400,7 +623,9 @@ logging_settings extract_settings(const boost::program_options::variables_map& v
         parse_log_level(vars["default-log-level"].as<sstring>()),
         vars["log-to-stdout"].as<bool>(),
         vars["log-to-syslog"].as<bool>(),
-        vars["logger-stdout-timestamps"].as<logger_timestamp_style>()
+        vars["logger-stdout-timestamps"].as<logger_timestamp_style>(),
+        vars["log-async"].as<bool>(),
+        vars["log-async-buffer-size"].as<size_t>(),
     };
 
 }
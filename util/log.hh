@@ -26,6 +26,7 @@
 #include <exception>
 #include <iosfwd>
 #include <atomic>
+#include <chrono>
 #include <mutex>
 #include <boost/lexical_cast.hpp>
 
@@ -50,6 +51,17 @@ enum class log_level {
 
 std::ostream& operator<<(std::ostream& out, log_level level);
 std::istream& operator>>(std::istream& in, log_level& level);
+
+#ifndef SEASTAR_LOG_MAX_LEVEL
+#define SEASTAR_LOG_MAX_LEVEL trace
+#endif
+
+/// The most verbose level that is compiled in, set by defining
+/// SEASTAR_LOG_MAX_LEVEL to a level name (configure.py's
+/// --release-log-max-level does it for release builds). Messages of the
+/// levels above it are never enabled, and the checks of \ref logger::is_enabled()
+/// for them fold to false, so that the code that logs them is compiled out.
+constexpr log_level max_compiled_log_level = log_level::SEASTAR_LOG_MAX_LEVEL;
 }
 
 // Boost doesn't auto-deduce the existence of the streaming operators for some reason
@@ -80,6 +92,35 @@ class logger {
     std::atomic<log_level> _level = { log_level::info };
     static std::atomic<bool> _stdout;
     static std::atomic<bool> _syslog;
+    static std::atomic<bool> _async;
+public:
+    /// Limits the rate of the messages logged through it, for call sites
+    /// that may be hit many times in a row (errors of every connection
+    /// during an outage). Messages that come sooner than \c interval after
+    /// the last logged one are dropped, and counted in the next one.
+    ///
+    /// A rate_limit is meant to be owned by its call site, once per shard:
+    /// \code {.cpp}
+    /// static thread_local logger::rate_limit rate_limit(std::chrono::seconds(10));
+    /// logger.log(log_level::warn, rate_limit, "cannot connect to {}: {}", addr, ex);
+    /// \endcode
+    class rate_limit {
+        using clock = std::chrono::steady_clock;
+        clock::duration _interval;
+        clock::time_point _next;
+        uint64_t _dropped_messages = 0;
+    private:
+        // Returns whether a message may be logged now; counts it as
+        // dropped otherwise
+        bool check();
+        friend class logger;
+    public:
+        explicit rate_limit(std::chrono::milliseconds interval);
+        /// Messages dropped since the last one that was logged
+        uint64_t dropped_messages() const {
+            return _dropped_messages;
+        }
+    };
 private:
     struct stringer {
         // no need for virtual dtor, since not dynamically destroyed
@@ -94,8 +135,9 @@ class logger {
         }
     };
     template <typename... Args>
-    void do_log(log_level level, const char* fmt, Args&&... args);
-    void really_do_log(log_level level, const char* fmt, stringer** stringers, size_t n);
+    void do_log(log_level level, uint64_t dropped, const char* fmt, Args&&... args);
+    // dropped: similar messages dropped by a rate_limit, to mention
+    void really_do_log(log_level level, uint64_t dropped, const char* fmt, stringer** stringers, size_t n);
     void failed_to_log(std::exception_ptr ex);
 public:
     explicit logger(sstring name);
@@ -109,7 +151,7 @@ class logger {
     /// \param level - enum level value (info|error...)
     /// \return true if the log level has been enabled.
     bool is_enabled(log_level level) const {
-        return level <= _level.load(std::memory_order_relaxed);
+        return level <= max_compiled_log_level && level <= _level.load(std::memory_order_relaxed);
     }
 
     /// logs to desired level if enabled, otherwise we ignore the log line
@@ -121,10 +163,32 @@ class logger {
     void log(log_level level, const char* fmt, Args&&... args) {
         if (is_enabled(level)) {
             try {
-                do_log(level, fmt, std::forward<Args>(args)...);
+                do_log(level, 0, fmt, std::forward<Args>(args)...);
+            } catch (...) {
+                failed_to_log(std::current_exception());
+            }
+        }
+    }
+
+    /// logs to desired level if enabled and \c rl allows it, otherwise we
+    /// ignore the log line
+    ///
+    /// The arguments are not printed when the line is ignored. The logged
+    /// line mentions how many were dropped by \c rl before it.
+    ///
+    /// \param rl - rate limit of the call site
+    /// \param fmt - printf style format
+    /// \param args - args to print string
+    ///
+    template <typename... Args>
+    void log(log_level level, rate_limit& rl, const char* fmt, Args&&... args) {
+        if (is_enabled(level) && rl.check()) {
+            try {
+                do_log(level, rl._dropped_messages, fmt, std::forward<Args>(args)...);
             } catch (...) {
                 failed_to_log(std::current_exception());
             }
+            rl._dropped_messages = 0;
         }
     }
 
@@ -218,6 +282,20 @@ class logger {
     ///       this should be rare (will have to fill the pipe buffer
     ///       before syslogd can clear it) but can happen.
     static void set_syslog_enabled(bool enabled);
+
+    /// Write the log output from a separate thread. default is false
+    ///
+    /// Messages are still formatted by the shards that log them, into a
+    /// per-shard buffer of \c buffer_size messages, so a slow stdout or
+    /// syslog cannot stall the reactor; when the buffer is full, messages
+    /// are dropped, counted, and their number reported once there is room.
+    /// The buffer size applies to the shards that have not logged since
+    /// asynchronous logging was first enabled.
+    static void set_async_enabled(bool enabled, size_t buffer_size = 1024);
+
+    /// Messages that the calling shard dropped because its asynchronous
+    /// logging buffer was full
+    static uint64_t async_dropped_messages();
 };
 
 /// \brief used to keep a static registry of loggers
@@ -285,6 +363,8 @@ struct logging_settings final {
     bool stdout_enabled;
     bool syslog_enabled;
     logger_timestamp_style stdout_timestamp_style = logger_timestamp_style::real;
+    bool async_enabled = false;
+    size_t async_buffer_size = 1024;
 };
 
 /// Shortcut for configuring the logging system all at once.
@@ -307,10 +387,10 @@ class logger_for : public logger {
 
 template <typename... Args>
 void
-logger::do_log(log_level level, const char* fmt, Args&&... args) {
+logger::do_log(log_level level, uint64_t dropped, const char* fmt, Args&&... args) {
     [&](auto&&... stringers) {
         stringer* s[sizeof...(stringers)] = {&stringers...};
-        this->really_do_log(level, fmt, s, sizeof...(stringers));
+        this->really_do_log(level, dropped, fmt, s, sizeof...(stringers));
     } (stringer_for<Args>(std::forward<Args>(args))...);
 }
 
@@ -324,5 +404,26 @@ std::ostream& operator<<(std::ostream&, const std::exception&);
 std::ostream& operator<<(std::ostream&, const std::system_error&);
 }
 
+/// Logs with \c logger at \c level, like \ref seastar::logger::log(), but
+/// evaluates the format arguments only if the level is enabled, and is
+/// compiled out if the level is above \ref seastar::max_compiled_log_level:
+/// \code {.cpp}
+/// SEASTAR_LOG(logger, log_level::debug, "state: {}", describe_state());
+/// \endcode
+/// To defer the evaluation of a single argument instead, wrap it with
+/// \ref seastar::value_of().
+#define SEASTAR_LOG(logger, level, ...) \
+    do { \
+        if ((logger).is_enabled(level)) { \
+            (logger).log(level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+/// \ref SEASTAR_LOG() at the debug level
+#define SEASTAR_LOG_DEBUG(logger, ...) SEASTAR_LOG(logger, ::seastar::log_level::debug, __VA_ARGS__)
+
+/// \ref SEASTAR_LOG() at the trace level
+#define SEASTAR_LOG_TRACE(logger, ...) SEASTAR_LOG(logger, ::seastar::log_level::trace, __VA_ARGS__)
+
 #endif /* LOG_HH_ */
 /// @}
@@ -21,20 +21,30 @@
 
 #pragma once
 
+#include <cstddef>
 #include <utility>
 #include <type_traits>
 #include <functional>
 
 namespace seastar {
 
-template <typename Signature>
+/// Inline storage of a \ref noncopyable_function, unless given otherwise
+constexpr size_t noncopyable_function_default_inline_size = 32;
+
+template <typename Signature, size_t InlineSize = noncopyable_function_default_inline_size>
 class noncopyable_function;
 
 /// A clone of \c std::function, but only invokes the move constructor
 /// of the contained function.
-template <typename Ret, typename... Args>
-class noncopyable_function<Ret (Args...)> {
-    static constexpr size_t nr_direct = 32;
+///
+/// Functions of up to \c InlineSize bytes, whose move constructor does not
+/// throw, are stored inline; larger ones are allocated. Hot paths whose
+/// functions capture a little more than the default may choose a larger
+/// \c InlineSize, at the cost of larger objects for all of their
+/// functions.
+template <typename Ret, typename... Args, size_t InlineSize>
+class noncopyable_function<Ret (Args...), InlineSize> {
+    static constexpr size_t nr_direct = InlineSize;
     union [[gnu::may_alias]] storage {
         char direct[nr_direct];
         void* indirect;
@@ -105,7 +115,8 @@ class noncopyable_function<Ret (Args...)> {
     struct select_vtable_for<Func, false> : indirect_vtable_for<Func> {};
     template <typename Func>
     static constexpr bool is_direct() {
-        return sizeof(Func) <= nr_direct && alignof(Func) <= alignof(storage);
+        return sizeof(Func) <= nr_direct && alignof(Func) <= alignof(storage)
+                && std::is_nothrow_move_constructible<Func>::value;
     }
     template <typename Func>
     struct vtable_for : select_vtable_for<Func, is_direct<Func>()> {};
@@ -113,8 +124,8 @@ class noncopyable_function<Ret (Args...)> {
     noncopyable_function() noexcept : _vtable(&_s_empty_vtable) {}
     template <typename Func>
     noncopyable_function(Func func) noexcept {
-        // If we want, we can support throwing move constructible functions by using the indirect path
-        static_assert(std::is_nothrow_move_constructible<Func>::value, "must be nothrow move constructible");
+        // functions whose move constructor may throw are stored indirectly,
+        // so that moving them never does
         vtable_for<Func>::initialize(std::move(func), this);
         _vtable = &vtable_for<Func>::s_vtable;
     }
@@ -152,19 +163,19 @@ class noncopyable_function<Ret (Args...)> {
 };
 
 
-template <typename Ret, typename... Args>
-constexpr typename noncopyable_function<Ret (Args...)>::vtable noncopyable_function<Ret (Args...)>::_s_empty_vtable;
+template <typename Ret, typename... Args, size_t InlineSize>
+constexpr typename noncopyable_function<Ret (Args...), InlineSize>::vtable noncopyable_function<Ret (Args...), InlineSize>::_s_empty_vtable;
 
-template <typename Ret, typename... Args>
+template <typename Ret, typename... Args, size_t InlineSize>
 template <typename Func>
-const typename noncopyable_function<Ret (Args...)>::vtable noncopyable_function<Ret (Args...)>::direct_vtable_for<Func>::s_vtable
-        = noncopyable_function<Ret (Args...)>::direct_vtable_for<Func>::make_vtable();
+const typename noncopyable_function<Ret (Args...), InlineSize>::vtable noncopyable_function<Ret (Args...), InlineSize>::direct_vtable_for<Func>::s_vtable
+        = noncopyable_function<Ret (Args...), InlineSize>::direct_vtable_for<Func>::make_vtable();
 
 
-template <typename Ret, typename... Args>
+template <typename Ret, typename... Args, size_t InlineSize>
 template <typename Func>
-const typename noncopyable_function<Ret (Args...)>::vtable noncopyable_function<Ret (Args...)>::indirect_vtable_for<Func>::s_vtable
-        = noncopyable_function<Ret (Args...)>::indirect_vtable_for<Func>::make_vtable();
+const typename noncopyable_function<Ret (Args...), InlineSize>::vtable noncopyable_function<Ret (Args...), InlineSize>::indirect_vtable_for<Func>::s_vtable
+        = noncopyable_function<Ret (Args...), InlineSize>::indirect_vtable_for<Func>::make_vtable();
 
 }
 